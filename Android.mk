@@ -18,6 +18,7 @@ subdirs := $(addprefix $(LOCAL_PATH)/,$(addsuffix /Android.mk, \
 		libdex \
 		vm \
 		dexgen \
+		dexlayout \
 		dexlist \
 		dexopt \
 		dexdump \
@@ -49,6 +49,10 @@
 #include <getopt.h>
 #include <errno.h>
 #include <assert.h>
+#include <stdarg.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 static const char* gProgName = "dexdump";
 
@@ -69,10 +73,87 @@ struct Options {
     const char* tempFileName;
     bool exportsOnly;
     bool verbose;
+    int numThreads;
 };
 
 struct Options gOptions;
 
+/*
+ * Output made on a worker thread is collected here, one class at a time,
+ * and written out in class order.  On the main thread gOutBuf is NULL and
+ * output goes straight to (a generously buffered) stdout.
+ */
+struct OutBuf {
+    char*   data;
+    size_t  len;
+    size_t  cap;
+};
+
+static __thread OutBuf* gOutBuf;
+
+static void outReserve(OutBuf* pBuf, size_t count)
+{
+    if (pBuf->len + count <= pBuf->cap)
+        return;
+    size_t newCap = (pBuf->cap == 0) ? 4096 : pBuf->cap;
+    while (pBuf->len + count > newCap)
+        newCap *= 2;
+    char* newData = (char*) realloc(pBuf->data, newCap);
+    if (newData == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    pBuf->data = newData;
+    pBuf->cap = newCap;
+}
+
+static void outPrintf(const char* fmt, ...)
+    __attribute__ ((format (printf, 1, 2)));
+static void outPrintf(const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    if (gOutBuf == NULL) {
+        vprintf(fmt, args);
+    } else {
+        va_list copy;
+        va_copy(copy, args);
+        size_t avail = gOutBuf->cap - gOutBuf->len;
+        int count = vsnprintf(gOutBuf->data + gOutBuf->len, avail, fmt, args);
+        if (count >= 0 && (size_t) count >= avail) {
+            outReserve(gOutBuf, count + 1);
+            vsnprintf(gOutBuf->data + gOutBuf->len, count + 1, fmt, copy);
+        }
+        va_end(copy);
+        if (count > 0)
+            gOutBuf->len += count;
+    }
+    va_end(args);
+}
+
+static void outPuts(const char* str)
+{
+    if (gOutBuf == NULL) {
+        fputs(str, stdout);
+    } else {
+        size_t len = strlen(str);
+        outReserve(gOutBuf, len);
+        memcpy(gOutBuf->data + gOutBuf->len, str, len);
+        gOutBuf->len += len;
+    }
+}
+
+static void outPutc(char ch)
+{
+    if (gOutBuf == NULL) {
+        putchar(ch);
+    } else {
+        outReserve(gOutBuf, 1);
+        gOutBuf->data[gOutBuf->len++] = ch;
+    }
+}
+
 /* basic info about a field or method */
 struct FieldMethodInfo {
     const char* classDescriptor;
@@ -398,59 +479,59 @@ void dumpFileHeader(const DexFile* pDexFile)
     assert(sizeof(pHeader->magic) == sizeof(pOptHeader->magic));
 
     if (pOptHeader != NULL) {
-        printf("Optimized DEX file header:\n");
+        outPrintf("Optimized DEX file header:\n");
 
         asciify(sanitized, pOptHeader->magic, sizeof(pOptHeader->magic));
-        printf("magic               : '%s'\n", sanitized);
-        printf("dex_offset          : %d (0x%06x)\n",
+        outPrintf("magic               : '%s'\n", sanitized);
+        outPrintf("dex_offset          : %d (0x%06x)\n",
             pOptHeader->dexOffset, pOptHeader->dexOffset);
-        printf("dex_length          : %d\n", pOptHeader->dexLength);
-        printf("deps_offset         : %d (0x%06x)\n",
+        outPrintf("dex_length          : %d\n", pOptHeader->dexLength);
+        outPrintf("deps_offset         : %d (0x%06x)\n",
             pOptHeader->depsOffset, pOptHeader->depsOffset);
-        printf("deps_length         : %d\n", pOptHeader->depsLength);
-        printf("opt_offset          : %d (0x%06x)\n",
+        outPrintf("deps_length         : %d\n", pOptHeader->depsLength);
+        outPrintf("opt_offset          : %d (0x%06x)\n",
             pOptHeader->optOffset, pOptHeader->optOffset);
-        printf("opt_length          : %d\n", pOptHeader->optLength);
-        printf("flags               : %08x\n", pOptHeader->flags);
-        printf("checksum            : %08x\n", pOptHeader->checksum);
-        printf("\n");
+        outPrintf("opt_length          : %d\n", pOptHeader->optLength);
+        outPrintf("flags               : %08x\n", pOptHeader->flags);
+        outPrintf("checksum            : %08x\n", pOptHeader->checksum);
+        outPrintf("\n");
     }
 
-    printf("DEX file header:\n");
+    outPrintf("DEX file header:\n");
     asciify(sanitized, pHeader->magic, sizeof(pHeader->magic));
-    printf("magic               : '%s'\n", sanitized);
-    printf("checksum            : %08x\n", pHeader->checksum);
-    printf("signature           : %02x%02x...%02x%02x\n",
+    outPrintf("magic               : '%s'\n", sanitized);
+    outPrintf("checksum            : %08x\n", pHeader->checksum);
+    outPrintf("signature           : %02x%02x...%02x%02x\n",
         pHeader->signature[0], pHeader->signature[1],
         pHeader->signature[kSHA1DigestLen-2],
         pHeader->signature[kSHA1DigestLen-1]);
-    printf("file_size           : %d\n", pHeader->fileSize);
-    printf("header_size         : %d\n", pHeader->headerSize);
-    printf("link_size           : %d\n", pHeader->linkSize);
-    printf("link_off            : %d (0x%06x)\n",
+    outPrintf("file_size           : %d\n", pHeader->fileSize);
+    outPrintf("header_size         : %d\n", pHeader->headerSize);
+    outPrintf("link_size           : %d\n", pHeader->linkSize);
+    outPrintf("link_off            : %d (0x%06x)\n",
         pHeader->linkOff, pHeader->linkOff);
-    printf("string_ids_size     : %d\n", pHeader->stringIdsSize);
-    printf("string_ids_off      : %d (0x%06x)\n",
+    outPrintf("string_ids_size     : %d\n", pHeader->stringIdsSize);
+    outPrintf("string_ids_off      : %d (0x%06x)\n",
         pHeader->stringIdsOff, pHeader->stringIdsOff);
-    printf("type_ids_size       : %d\n", pHeader->typeIdsSize);
-    printf("type_ids_off        : %d (0x%06x)\n",
+    outPrintf("type_ids_size       : %d\n", pHeader->typeIdsSize);
+    outPrintf("type_ids_off        : %d (0x%06x)\n",
         pHeader->typeIdsOff, pHeader->typeIdsOff);
-    printf("proto_ids_size       : %d\n", pHeader->protoIdsSize);
-    printf("proto_ids_off        : %d (0x%06x)\n",
+    outPrintf("proto_ids_size       : %d\n", pHeader->protoIdsSize);
+    outPrintf("proto_ids_off        : %d (0x%06x)\n",
         pHeader->protoIdsOff, pHeader->protoIdsOff);
-    printf("field_ids_size      : %d\n", pHeader->fieldIdsSize);
-    printf("field_ids_off       : %d (0x%06x)\n",
+    outPrintf("field_ids_size      : %d\n", pHeader->fieldIdsSize);
+    outPrintf("field_ids_off       : %d (0x%06x)\n",
         pHeader->fieldIdsOff, pHeader->fieldIdsOff);
-    printf("method_ids_size     : %d\n", pHeader->methodIdsSize);
-    printf("method_ids_off      : %d (0x%06x)\n",
+    outPrintf("method_ids_size     : %d\n", pHeader->methodIdsSize);
+    outPrintf("method_ids_off      : %d (0x%06x)\n",
         pHeader->methodIdsOff, pHeader->methodIdsOff);
-    printf("class_defs_size     : %d\n", pHeader->classDefsSize);
-    printf("class_defs_off      : %d (0x%06x)\n",
+    outPrintf("class_defs_size     : %d\n", pHeader->classDefsSize);
+    outPrintf("class_defs_off      : %d (0x%06x)\n",
         pHeader->classDefsOff, pHeader->classDefsOff);
-    printf("data_size           : %d\n", pHeader->dataSize);
-    printf("data_off            : %d (0x%06x)\n",
+    outPrintf("data_size           : %d\n", pHeader->dataSize);
+    outPrintf("data_off            : %d (0x%06x)\n",
         pHeader->dataOff, pHeader->dataOff);
-    printf("\n");
+    outPrintf("\n");
 }
 
 /*
@@ -462,12 +543,12 @@ void dumpOptDirectory(const DexFile* pDexFile)
     if (pOptHeader == NULL)
         return;
 
-    printf("OPT section contents:\n");
+    outPrintf("OPT section contents:\n");
 
     const u4* pOpt = (const u4*) ((u1*) pOptHeader + pOptHeader->optOffset);
 
     if (*pOpt == 0) {
-        printf("(1.0 format, only class lookup table is present)\n\n");
+        outPrintf("(1.0 format, only class lookup table is present)\n\n");
         return;
     }
 
@@ -487,19 +568,22 @@ void dumpOptDirectory(const DexFile* pDexFile)
         case kDexChunkRegisterMaps:
             verboseStr = "register maps";
             break;
+        case kDexChunkVerifyRecords:
+            verboseStr = "verification records";
+            break;
         default:
             verboseStr = "(unknown chunk type)";
             break;
         }
 
-        printf("Chunk %08x (%c%c%c%c) - %s (%d bytes)\n", *pOpt,
+        outPrintf("Chunk %08x (%c%c%c%c) - %s (%d bytes)\n", *pOpt,
             *pOpt >> 24, (char)(*pOpt >> 16), (char)(*pOpt >> 8), (char)*pOpt,
             verboseStr, size);
 
         size = (size + 8 + 7) & ~7;
         pOpt += size / sizeof(u4);
     }
-    printf("\n");
+    outPrintf("\n");
 }
 
 /*
@@ -520,25 +604,25 @@ void dumpClassDef(DexFile* pDexFile, int idx)
         return;
     }
 
-    printf("Class #%d header:\n", idx);
-    printf("class_idx           : %d\n", pClassDef->classIdx);
-    printf("access_flags        : %d (0x%04x)\n",
+    outPrintf("Class #%d header:\n", idx);
+    outPrintf("class_idx           : %d\n", pClassDef->classIdx);
+    outPrintf("access_flags        : %d (0x%04x)\n",
         pClassDef->accessFlags, pClassDef->accessFlags);
-    printf("superclass_idx      : %d\n", pClassDef->superclassIdx);
-    printf("interfaces_off      : %d (0x%06x)\n",
+    outPrintf("superclass_idx      : %d\n", pClassDef->superclassIdx);
+    outPrintf("interfaces_off      : %d (0x%06x)\n",
         pClassDef->interfacesOff, pClassDef->interfacesOff);
-    printf("source_file_idx     : %d\n", pClassDef->sourceFileIdx);
-    printf("annotations_off     : %d (0x%06x)\n",
+    outPrintf("source_file_idx     : %d\n", pClassDef->sourceFileIdx);
+    outPrintf("annotations_off     : %d (0x%06x)\n",
         pClassDef->annotationsOff, pClassDef->annotationsOff);
-    printf("class_data_off      : %d (0x%06x)\n",
+    outPrintf("class_data_off      : %d (0x%06x)\n",
         pClassDef->classDataOff, pClassDef->classDataOff);
-    printf("static_fields_size  : %d\n", pClassData->header.staticFieldsSize);
-    printf("instance_fields_size: %d\n",
+    outPrintf("static_fields_size  : %d\n", pClassData->header.staticFieldsSize);
+    outPrintf("instance_fields_size: %d\n",
             pClassData->header.instanceFieldsSize);
-    printf("direct_methods_size : %d\n", pClassData->header.directMethodsSize);
-    printf("virtual_methods_size: %d\n",
+    outPrintf("direct_methods_size : %d\n", pClassData->header.directMethodsSize);
+    outPrintf("virtual_methods_size: %d\n",
             pClassData->header.virtualMethodsSize);
-    printf("\n");
+    outPrintf("\n");
 
     free(pClassData);
 }
@@ -553,10 +637,10 @@ void dumpInterface(const DexFile* pDexFile, const DexTypeItem* pTypeItem,
         dexStringByTypeIdx(pDexFile, pTypeItem->typeIdx);
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("    #%d              : '%s'\n", i, interfaceName);
+        outPrintf("    #%d              : '%s'\n", i, interfaceName);
     } else {
         char* dotted = descriptorToDot(interfaceName);
-        printf("<implements name=\"%s\">\n</implements>\n", dotted);
+        outPrintf("<implements name=\"%s\">\n</implements>\n", dotted);
         free(dotted);
     }
 }
@@ -569,11 +653,11 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
     u4 triesSize = pCode->triesSize;
 
     if (triesSize == 0) {
-        printf("      catches       : (none)\n");
+        outPrintf("      catches       : (none)\n");
         return;
     }
 
-    printf("      catches       : %d\n", triesSize);
+    outPrintf("      catches       : %d\n", triesSize);
 
     const DexTry* pTries = dexGetTries(pCode);
     u4 i;
@@ -584,7 +668,7 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
         u4 end = start + pTry->insnCount;
         DexCatchIterator iterator;
 
-        printf("        0x%04x - 0x%04x\n", start, end);
+        outPrintf("        0x%04x - 0x%04x\n", start, end);
 
         dexCatchIteratorInit(&iterator, pCode, pTry->handlerOff);
 
@@ -599,7 +683,7 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
             descriptor = (handler->typeIdx == kDexNoIndex) ? "<any>" :
                 dexStringByTypeIdx(pDexFile, handler->typeIdx);
 
-            printf("          %s -> 0x%04x\n", descriptor,
+            outPrintf("          %s -> 0x%04x\n", descriptor,
                     handler->address);
         }
     }
@@ -607,7 +691,7 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
 
 static int dumpPositionsCb(void *cnxt, u4 address, u4 lineNum)
 {
-    printf("        0x%04x line=%d\n", address, lineNum);
+    outPrintf("        0x%04x line=%d\n", address, lineNum);
     return 0;
 }
 
@@ -617,7 +701,7 @@ static int dumpPositionsCb(void *cnxt, u4 address, u4 lineNum)
 void dumpPositions(DexFile* pDexFile, const DexCode* pCode,
         const DexMethod *pDexMethod)
 {
-    printf("      positions     : \n");
+    outPrintf("      positions     : \n");
     const DexMethodId *pMethodId
             = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
     const char *classDescriptor
@@ -631,7 +715,7 @@ static void dumpLocalsCb(void *cnxt, u2 reg, u4 startAddress,
         u4 endAddress, const char *name, const char *descriptor,
         const char *signature)
 {
-    printf("        0x%04x - 0x%04x reg=%d %s %s %s\n",
+    outPrintf("        0x%04x - 0x%04x reg=%d %s %s %s\n",
             startAddress, endAddress, reg, name, descriptor,
             signature);
 }
@@ -642,7 +726,7 @@ static void dumpLocalsCb(void *cnxt, u2 reg, u4 startAddress,
 void dumpLocals(DexFile* pDexFile, const DexCode* pCode,
         const DexMethod *pDexMethod)
 {
-    printf("      locals        : \n");
+    outPrintf("      locals        : \n");
 
     const DexMethodId *pMethodId
             = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
@@ -854,37 +938,37 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
     const u2* insns = pCode->insns;
     int i;
 
-    printf("%06x:", ((u1*)insns - pDexFile->baseAddr) + insnIdx*2);
+    outPrintf("%06x:", ((u1*)insns - pDexFile->baseAddr) + insnIdx*2);
     for (i = 0; i < 8; i++) {
         if (i < insnWidth) {
             if (i == 7) {
-                printf(" ... ");
+                outPrintf(" ... ");
             } else {
                 /* print 16-bit value in little-endian order */
                 const u1* bytePtr = (const u1*) &insns[insnIdx+i];
-                printf(" %02x%02x", bytePtr[0], bytePtr[1]);
+                outPrintf(" %02x%02x", bytePtr[0], bytePtr[1]);
             }
         } else {
-            fputs("     ", stdout);
+            outPuts("     ");
         }
     }
 
     if (pDecInsn->opcode == OP_NOP) {
         u2 instr = get2LE((const u1*) &insns[insnIdx]);
         if (instr == kPackedSwitchSignature) {
-            printf("|%04x: packed-switch-data (%d units)",
+            outPrintf("|%04x: packed-switch-data (%d units)",
                 insnIdx, insnWidth);
         } else if (instr == kSparseSwitchSignature) {
-            printf("|%04x: sparse-switch-data (%d units)",
+            outPrintf("|%04x: sparse-switch-data (%d units)",
                 insnIdx, insnWidth);
         } else if (instr == kArrayDataSignature) {
-            printf("|%04x: array-data (%d units)",
+            outPrintf("|%04x: array-data (%d units)",
                 insnIdx, insnWidth);
         } else {
-            printf("|%04x: nop // spacer", insnIdx);
+            outPrintf("|%04x: nop // spacer", insnIdx);
         }
     } else {
-        printf("|%04x: %s", insnIdx, dexGetOpcodeName(pDecInsn->opcode));
+        outPrintf("|%04x: %s", insnIdx, dexGetOpcodeName(pDecInsn->opcode));
     }
 
     if (pDecInsn->indexType != kIndexNone) {
@@ -896,83 +980,83 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
     case kFmt10x:        // op
         break;
     case kFmt12x:        // op vA, vB
-        printf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
+        outPrintf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
         break;
     case kFmt11n:        // op vA, #+B
-        printf(" v%d, #int %d // #%x",
+        outPrintf(" v%d, #int %d // #%x",
             pDecInsn->vA, (s4)pDecInsn->vB, (u1)pDecInsn->vB);
         break;
     case kFmt11x:        // op vAA
-        printf(" v%d", pDecInsn->vA);
+        outPrintf(" v%d", pDecInsn->vA);
         break;
     case kFmt10t:        // op +AA
     case kFmt20t:        // op +AAAA
         {
             s4 targ = (s4) pDecInsn->vA;
-            printf(" %04x // %c%04x",
+            outPrintf(" %04x // %c%04x",
                 insnIdx + targ,
                 (targ < 0) ? '-' : '+',
                 (targ < 0) ? -targ : targ);
         }
         break;
     case kFmt22x:        // op vAA, vBBBB
-        printf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
+        outPrintf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
         break;
     case kFmt21t:        // op vAA, +BBBB
         {
             s4 targ = (s4) pDecInsn->vB;
-            printf(" v%d, %04x // %c%04x", pDecInsn->vA,
+            outPrintf(" v%d, %04x // %c%04x", pDecInsn->vA,
                 insnIdx + targ,
                 (targ < 0) ? '-' : '+',
                 (targ < 0) ? -targ : targ);
         }
         break;
     case kFmt21s:        // op vAA, #+BBBB
-        printf(" v%d, #int %d // #%x",
+        outPrintf(" v%d, #int %d // #%x",
             pDecInsn->vA, (s4)pDecInsn->vB, (u2)pDecInsn->vB);
         break;
     case kFmt21h:        // op vAA, #+BBBB0000[00000000]
         // The printed format varies a bit based on the actual opcode.
         if (pDecInsn->opcode == OP_CONST_HIGH16) {
             s4 value = pDecInsn->vB << 16;
-            printf(" v%d, #int %d // #%x",
+            outPrintf(" v%d, #int %d // #%x",
                 pDecInsn->vA, value, (u2)pDecInsn->vB);
         } else {
             s8 value = ((s8) pDecInsn->vB) << 48;
-            printf(" v%d, #long %lld // #%x",
+            outPrintf(" v%d, #long %lld // #%x",
                 pDecInsn->vA, value, (u2)pDecInsn->vB);
         }
         break;
     case kFmt21c:        // op vAA, thing@BBBB
     case kFmt31c:        // op vAA, thing@BBBBBBBB
-        printf(" v%d, %s", pDecInsn->vA, indexBuf);
+        outPrintf(" v%d, %s", pDecInsn->vA, indexBuf);
         break;
     case kFmt23x:        // op vAA, vBB, vCC
-        printf(" v%d, v%d, v%d", pDecInsn->vA, pDecInsn->vB, pDecInsn->vC);
+        outPrintf(" v%d, v%d, v%d", pDecInsn->vA, pDecInsn->vB, pDecInsn->vC);
         break;
     case kFmt22b:        // op vAA, vBB, #+CC
-        printf(" v%d, v%d, #int %d // #%02x",
+        outPrintf(" v%d, v%d, #int %d // #%02x",
             pDecInsn->vA, pDecInsn->vB, (s4)pDecInsn->vC, (u1)pDecInsn->vC);
         break;
     case kFmt22t:        // op vA, vB, +CCCC
         {
             s4 targ = (s4) pDecInsn->vC;
-            printf(" v%d, v%d, %04x // %c%04x", pDecInsn->vA, pDecInsn->vB,
+            outPrintf(" v%d, v%d, %04x // %c%04x", pDecInsn->vA, pDecInsn->vB,
                 insnIdx + targ,
                 (targ < 0) ? '-' : '+',
                 (targ < 0) ? -targ : targ);
         }
         break;
     case kFmt22s:        // op vA, vB, #+CCCC
-        printf(" v%d, v%d, #int %d // #%04x",
+        outPrintf(" v%d, v%d, #int %d // #%04x",
             pDecInsn->vA, pDecInsn->vB, (s4)pDecInsn->vC, (u2)pDecInsn->vC);
         break;
     case kFmt22c:        // op vA, vB, thing@CCCC
     case kFmt22cs:       // [opt] op vA, vB, field offset CCCC
-        printf(" v%d, v%d, %s", pDecInsn->vA, pDecInsn->vB, indexBuf);
+        outPrintf(" v%d, v%d, %s", pDecInsn->vA, pDecInsn->vB, indexBuf);
         break;
     case kFmt30t:
-        printf(" #%08x", pDecInsn->vA);
+        outPrintf(" #%08x", pDecInsn->vA);
         break;
     case kFmt31i:        // op vAA, #+BBBBBBBB
         {
@@ -982,29 +1066,29 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
                 u4 i;
             } conv;
             conv.i = pDecInsn->vB;
-            printf(" v%d, #float %f // #%08x",
+            outPrintf(" v%d, #float %f // #%08x",
                 pDecInsn->vA, conv.f, pDecInsn->vB);
         }
         break;
     case kFmt31t:       // op vAA, offset +BBBBBBBB
-        printf(" v%d, %08x // +%08x",
+        outPrintf(" v%d, %08x // +%08x",
             pDecInsn->vA, insnIdx + pDecInsn->vB, pDecInsn->vB);
         break;
     case kFmt32x:        // op vAAAA, vBBBB
-        printf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
+        outPrintf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
         break;
     case kFmt35c:        // op {vC, vD, vE, vF, vG}, thing@BBBB
     case kFmt35ms:       // [opt] invoke-virtual+super
     case kFmt35mi:       // [opt] inline invoke
         {
-            fputs(" {", stdout);
+            outPuts(" {");
             for (i = 0; i < (int) pDecInsn->vA; i++) {
                 if (i == 0)
-                    printf("v%d", pDecInsn->arg[i]);
+                    outPrintf("v%d", pDecInsn->arg[i]);
                 else
-                    printf(", v%d", pDecInsn->arg[i]);
+                    outPrintf(", v%d", pDecInsn->arg[i]);
             }
-            printf("}, %s", indexBuf);
+            outPrintf("}, %s", indexBuf);
         }
         break;
     case kFmt3rc:        // op {vCCCC .. v(CCCC+AA-1)}, thing@BBBB
@@ -1015,14 +1099,14 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
              * This doesn't match the "dx" output when some of the args are
              * 64-bit values -- dx only shows the first register.
              */
-            fputs(" {", stdout);
+            outPuts(" {");
             for (i = 0; i < (int) pDecInsn->vA; i++) {
                 if (i == 0)
-                    printf("v%d", pDecInsn->vC + i);
+                    outPrintf("v%d", pDecInsn->vC + i);
                 else
-                    printf(", v%d", pDecInsn->vC + i);
+                    outPrintf(", v%d", pDecInsn->vC + i);
             }
-            printf("}, %s", indexBuf);
+            outPrintf("}, %s", indexBuf);
         }
         break;
     case kFmt51l:        // op vAA, #+BBBBBBBBBBBBBBBB
@@ -1033,18 +1117,18 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
                 u8 j;
             } conv;
             conv.j = pDecInsn->vB_wide;
-            printf(" v%d, #double %f // #%016llx",
+            outPrintf(" v%d, #double %f // #%016llx",
                 pDecInsn->vA, conv.d, pDecInsn->vB_wide);
         }
         break;
     case kFmt00x:        // unknown op or breakpoint
         break;
     default:
-        printf(" ???");
+        outPrintf(" ???");
         break;
     }
 
-    putchar('\n');
+    outPutc('\n');
 
     if (indexBuf != indexBufChars) {
         free(indexBuf);
@@ -1070,7 +1154,7 @@ void dumpBytecodes(DexFile* pDexFile, const DexMethod* pDexMethod)
     startAddr = ((u1*)pCode - pDexFile->baseAddr);
     className = descriptorToDot(methInfo.classDescriptor);
 
-    printf("%06x:                                        |[%06x] %s.%s:%s\n",
+    outPrintf("%06x:                                        |[%06x] %s.%s:%s\n",
         startAddr, startAddr,
         className, methInfo.name, methInfo.signature);
     free((void *) methInfo.signature);
@@ -1127,10 +1211,10 @@ void dumpCode(DexFile* pDexFile, const DexMethod* pDexMethod)
 {
     const DexCode* pCode = dexGetCode(pDexFile, pDexMethod);
 
-    printf("      registers     : %d\n", pCode->registersSize);
-    printf("      ins           : %d\n", pCode->insSize);
-    printf("      outs          : %d\n", pCode->outsSize);
-    printf("      insns size    : %d 16-bit code units\n", pCode->insnsSize);
+    outPrintf("      registers     : %d\n", pCode->registersSize);
+    outPrintf("      ins           : %d\n", pCode->insSize);
+    outPrintf("      outs          : %d\n", pCode->outsSize);
+    outPrintf("      insns size    : %d 16-bit code units\n", pCode->insnsSize);
 
     if (gOptions.disassemble)
         dumpBytecodes(pDexFile, pDexMethod);
@@ -1168,21 +1252,21 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
                     kAccessForMethod);
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("    #%d              : (in %s)\n", i, backDescriptor);
-        printf("      name          : '%s'\n", name);
-        printf("      type          : '%s'\n", typeDescriptor);
-        printf("      access        : 0x%04x (%s)\n",
+        outPrintf("    #%d              : (in %s)\n", i, backDescriptor);
+        outPrintf("      name          : '%s'\n", name);
+        outPrintf("      type          : '%s'\n", typeDescriptor);
+        outPrintf("      access        : 0x%04x (%s)\n",
             pDexMethod->accessFlags, accessStr);
 
         if (pDexMethod->codeOff == 0) {
-            printf("      code          : (none)\n");
+            outPrintf("      code          : (none)\n");
         } else {
-            printf("      code          -\n");
+            outPrintf("      code          -\n");
             dumpCode(pDexFile, pDexMethod);
         }
 
         if (gOptions.disassemble)
-            putchar('\n');
+            outPutc('\n');
     } else if (gOptions.outputFormat == OUTPUT_XML) {
         bool constructor = (name[0] == '<');
 
@@ -1190,14 +1274,14 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
             char* tmp;
 
             tmp = descriptorClassToDot(backDescriptor);
-            printf("<constructor name=\"%s\"\n", tmp);
+            outPrintf("<constructor name=\"%s\"\n", tmp);
             free(tmp);
 
             tmp = descriptorToDot(backDescriptor);
-            printf(" type=\"%s\"\n", tmp);
+            outPrintf(" type=\"%s\"\n", tmp);
             free(tmp);
         } else {
-            printf("<method name=\"%s\"\n", name);
+            outPrintf("<method name=\"%s\"\n", name);
 
             const char* returnType = strrchr(typeDescriptor, ')');
             if (returnType == NULL) {
@@ -1207,29 +1291,29 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
             }
 
             char* tmp = descriptorToDot(returnType+1);
-            printf(" return=\"%s\"\n", tmp);
+            outPrintf(" return=\"%s\"\n", tmp);
             free(tmp);
 
-            printf(" abstract=%s\n",
+            outPrintf(" abstract=%s\n",
                 quotedBool((pDexMethod->accessFlags & ACC_ABSTRACT) != 0));
-            printf(" native=%s\n",
+            outPrintf(" native=%s\n",
                 quotedBool((pDexMethod->accessFlags & ACC_NATIVE) != 0));
 
             bool isSync =
                 (pDexMethod->accessFlags & ACC_SYNCHRONIZED) != 0 ||
                 (pDexMethod->accessFlags & ACC_DECLARED_SYNCHRONIZED) != 0;
-            printf(" synchronized=%s\n", quotedBool(isSync));
+            outPrintf(" synchronized=%s\n", quotedBool(isSync));
         }
 
-        printf(" static=%s\n",
+        outPrintf(" static=%s\n",
             quotedBool((pDexMethod->accessFlags & ACC_STATIC) != 0));
-        printf(" final=%s\n",
+        outPrintf(" final=%s\n",
             quotedBool((pDexMethod->accessFlags & ACC_FINAL) != 0));
         // "deprecated=" not knowable w/o parsing annotations
-        printf(" visibility=%s\n",
+        outPrintf(" visibility=%s\n",
             quotedVisibility(pDexMethod->accessFlags));
 
-        printf(">\n");
+        outPrintf(">\n");
 
         /*
          * Parameters.
@@ -1268,15 +1352,15 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
             *cp++ = '\0';
 
             char* tmp = descriptorToDot(tmpBuf);
-            printf("<parameter name=\"arg%d\" type=\"%s\">\n</parameter>\n",
+            outPrintf("<parameter name=\"arg%d\" type=\"%s\">\n</parameter>\n",
                 argNum++, tmp);
             free(tmp);
         }
 
         if (constructor)
-            printf("</constructor>\n");
+            outPrintf("</constructor>\n");
         else
-            printf("</method>\n");
+            outPrintf("</method>\n");
     }
 
 bail:
@@ -1309,33 +1393,33 @@ void dumpSField(const DexFile* pDexFile, const DexField* pSField, int i)
     accessStr = createAccessFlagStr(pSField->accessFlags, kAccessForField);
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("    #%d              : (in %s)\n", i, backDescriptor);
-        printf("      name          : '%s'\n", name);
-        printf("      type          : '%s'\n", typeDescriptor);
-        printf("      access        : 0x%04x (%s)\n",
+        outPrintf("    #%d              : (in %s)\n", i, backDescriptor);
+        outPrintf("      name          : '%s'\n", name);
+        outPrintf("      type          : '%s'\n", typeDescriptor);
+        outPrintf("      access        : 0x%04x (%s)\n",
             pSField->accessFlags, accessStr);
     } else if (gOptions.outputFormat == OUTPUT_XML) {
         char* tmp;
 
-        printf("<field name=\"%s\"\n", name);
+        outPrintf("<field name=\"%s\"\n", name);
 
         tmp = descriptorToDot(typeDescriptor);
-        printf(" type=\"%s\"\n", tmp);
+        outPrintf(" type=\"%s\"\n", tmp);
         free(tmp);
 
-        printf(" transient=%s\n",
+        outPrintf(" transient=%s\n",
             quotedBool((pSField->accessFlags & ACC_TRANSIENT) != 0));
-        printf(" volatile=%s\n",
+        outPrintf(" volatile=%s\n",
             quotedBool((pSField->accessFlags & ACC_VOLATILE) != 0));
         // "value=" not knowable w/o parsing annotations
-        printf(" static=%s\n",
+        outPrintf(" static=%s\n",
             quotedBool((pSField->accessFlags & ACC_STATIC) != 0));
-        printf(" final=%s\n",
+        outPrintf(" final=%s\n",
             quotedBool((pSField->accessFlags & ACC_FINAL) != 0));
         // "deprecated=" not knowable w/o parsing annotations
-        printf(" visibility=%s\n",
+        outPrintf(" visibility=%s\n",
             quotedVisibility(pSField->accessFlags));
-        printf(">\n</field>\n");
+        outPrintf(">\n</field>\n");
     }
 
     free(accessStr);
@@ -1372,7 +1456,7 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     pClassDef = dexGetClassDef(pDexFile, idx);
 
     if (gOptions.exportsOnly && (pClassDef->accessFlags & ACC_PUBLIC) == 0) {
-        //printf("<!-- omitting non-public class %s -->\n",
+        //outPrintf("<!-- omitting non-public class %s -->\n",
         //    classDescriptor);
         goto bail;
     }
@@ -1381,7 +1465,7 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     pClassData = dexReadAndVerifyClassData(&pEncodedData, NULL);
 
     if (pClassData == NULL) {
-        printf("Trouble reading class data (#%d)\n", idx);
+        outPrintf("Trouble reading class data (#%d)\n", idx);
         goto bail;
     }
 
@@ -1423,8 +1507,8 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
         if (*pLastPackage == NULL || strcmp(mangle, *pLastPackage) != 0) {
             /* start of a new package */
             if (*pLastPackage != NULL)
-                printf("</package>\n");
-            printf("<package name=\"%s\"\n>\n", mangle);
+                outPrintf("</package>\n");
+            outPrintf("<package name=\"%s\"\n>\n", mangle);
             free(*pLastPackage);
             *pLastPackage = mangle;
         } else {
@@ -1442,37 +1526,37 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     }
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("Class #%d            -\n", idx);
-        printf("  Class descriptor  : '%s'\n", classDescriptor);
-        printf("  Access flags      : 0x%04x (%s)\n",
+        outPrintf("Class #%d            -\n", idx);
+        outPrintf("  Class descriptor  : '%s'\n", classDescriptor);
+        outPrintf("  Access flags      : 0x%04x (%s)\n",
             pClassDef->accessFlags, accessStr);
 
         if (superclassDescriptor != NULL)
-            printf("  Superclass        : '%s'\n", superclassDescriptor);
+            outPrintf("  Superclass        : '%s'\n", superclassDescriptor);
 
-        printf("  Interfaces        -\n");
+        outPrintf("  Interfaces        -\n");
     } else {
         char* tmp;
 
         tmp = descriptorClassToDot(classDescriptor);
-        printf("<class name=\"%s\"\n", tmp);
+        outPrintf("<class name=\"%s\"\n", tmp);
         free(tmp);
 
         if (superclassDescriptor != NULL) {
             tmp = descriptorToDot(superclassDescriptor);
-            printf(" extends=\"%s\"\n", tmp);
+            outPrintf(" extends=\"%s\"\n", tmp);
             free(tmp);
         }
-        printf(" abstract=%s\n",
+        outPrintf(" abstract=%s\n",
             quotedBool((pClassDef->accessFlags & ACC_ABSTRACT) != 0));
-        printf(" static=%s\n",
+        outPrintf(" static=%s\n",
             quotedBool((pClassDef->accessFlags & ACC_STATIC) != 0));
-        printf(" final=%s\n",
+        outPrintf(" final=%s\n",
             quotedBool((pClassDef->accessFlags & ACC_FINAL) != 0));
         // "deprecated=" not knowable w/o parsing annotations
-        printf(" visibility=%s\n",
+        outPrintf(" visibility=%s\n",
             quotedVisibility(pClassDef->accessFlags));
-        printf(">\n");
+        outPrintf(">\n");
     }
     pInterfaces = dexGetInterfacesList(pDexFile, pClassDef);
     if (pInterfaces != NULL) {
@@ -1481,25 +1565,25 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     }
 
     if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Static fields     -\n");
+        outPrintf("  Static fields     -\n");
     for (i = 0; i < (int) pClassData->header.staticFieldsSize; i++) {
         dumpSField(pDexFile, &pClassData->staticFields[i], i);
     }
 
     if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Instance fields   -\n");
+        outPrintf("  Instance fields   -\n");
     for (i = 0; i < (int) pClassData->header.instanceFieldsSize; i++) {
         dumpIField(pDexFile, &pClassData->instanceFields[i], i);
     }
 
     if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Direct methods    -\n");
+        outPrintf("  Direct methods    -\n");
     for (i = 0; i < (int) pClassData->header.directMethodsSize; i++) {
         dumpMethod(pDexFile, &pClassData->directMethods[i], i);
     }
 
     if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Virtual methods   -\n");
+        outPrintf("  Virtual methods   -\n");
     for (i = 0; i < (int) pClassData->header.virtualMethodsSize; i++) {
         dumpMethod(pDexFile, &pClassData->virtualMethods[i], i);
     }
@@ -1512,13 +1596,13 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
         fileName = "unknown";
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("  source_file_idx   : %d (%s)\n",
+        outPrintf("  source_file_idx   : %d (%s)\n",
             pClassDef->sourceFileIdx, fileName);
-        printf("\n");
+        outPrintf("\n");
     }
 
     if (gOptions.outputFormat == OUTPUT_XML) {
-        printf("</class>\n");
+        outPrintf("</class>\n");
     }
 
 bail:
@@ -1564,7 +1648,7 @@ void dumpDifferentialCompressedMap(const u1** pData)
     int origLen = 4 + (addrWidth + regWidth) * numEntries;
     int compLen = (data - dataStart) + compressedLen;
 
-    printf("        (differential compression %d -> %d [%d -> %d])\n",
+    outPrintf("        (differential compression %d -> %d [%d -> %d])\n",
         origLen, compLen,
         (addrWidth + regWidth) * numEntries, compressedLen);
 
@@ -1574,6 +1658,40 @@ void dumpDifferentialCompressedMap(const u1** pData)
     *pData = data;
 }
 
+/*
+ * Dump a map in the "indexed" format.  As with the differential format, we
+ * only show the sizes.
+ */
+void dumpIndexedCompressedMap(const u1** pData)
+{
+    const u1* data = *pData;
+    const u1* dataStart = data -1;      // format byte already removed
+    u1 regWidth;
+    u2 numEntries;
+
+    /* standard header */
+    regWidth = *data++;
+    numEntries = *data++;
+    numEntries |= (*data++) << 8;
+
+    /* compressed data begins with the compressed data length */
+    int compressedLen = readUnsignedLeb128(&data);
+
+    /* 16 entries per block, 4 bytes per index entry */
+    int numBlocks = (numEntries + 15) / 16;
+    int compLen = (data - dataStart) + compressedLen;
+
+    outPrintf("        (indexed compression rw=%d ne=%d -> %d [%d blocks])\n",
+        regWidth, numEntries, compLen, numBlocks);
+
+    /* skip past end of entry */
+    data += compressedLen;
+
+    *pData = data;
+}
+
+void dumpMapData(const u1** pData);
+
 /*
  * Dump register map contents of the current method.
  *
@@ -1590,15 +1708,28 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
 
     pMethodId = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
     name = dexStringById(pDexFile, pMethodId->nameIdx);
-    printf("      #%d: 0x%08x %s\n", idx, offset, name);
+    outPrintf("      #%d: 0x%08x %s\n", idx, offset, name);
 
+    dumpMapData(pData);
+}
+
+/*
+ * Dump one register map, and the liveness map after it if its format byte
+ * says there is one.  Advances "*pData" past both.
+ */
+void dumpMapData(const u1** pData)
+{
+    const u1* data = *pData;
     u1 format;
     int addrWidth;
+    bool hasLiveness;
 
     format = *data++;
+    hasLiveness = (format & 0x40) != 0;     /* kRegMapFormatHasLiveness */
+    format &= ~0x40;
     if (format == 1) {              /* kRegMapFormatNone */
         /* no map */
-        printf("        (no map)\n");
+        outPrintf("        (no map)\n");
         addrWidth = 0;
     } else if (format == 2) {       /* kRegMapFormatCompact8 */
         addrWidth = 1;
@@ -1607,8 +1738,11 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
     } else if (format == 4) {       /* kRegMapFormatDifferential */
         dumpDifferentialCompressedMap(&data);
         goto bail;
+    } else if (format == 5) {       /* kRegMapFormatIndexed */
+        dumpIndexedCompressedMap(&data);
+        goto bail;
     } else {
-        printf("        (unknown format %d!)\n", format);
+        outPrintf("        (unknown format %d!)\n", format);
         /* don't know how to skip data; failure will cascade to end of class */
         goto bail;
     }
@@ -1627,11 +1761,11 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
             if (addrWidth > 1)
                 addr |= (*data++) << 8;
 
-            printf("        %4x:", addr);
+            outPrintf("        %4x:", addr);
             for (byte = 0; byte < regWidth; byte++) {
-                printf(" %02x", *data++);
+                outPrintf(" %02x", *data++);
             }
-            printf("\n");
+            outPrintf("\n");
         }
     }
 
@@ -1639,6 +1773,11 @@ bail:
     //if (addrWidth >= 0)
     //    *pData = align32(data);
     *pData = data;
+
+    if (hasLiveness) {
+        outPrintf("        liveness:\n");
+        dumpMapData(pData);
+    }
 }
 
 /*
@@ -1659,7 +1798,7 @@ void dumpRegisterMaps(DexFile* pDexFile)
     int idx;
 
     if (pClassPool == NULL) {
-        printf("No register maps found\n");
+        outPrintf("No register maps found\n");
         return;
     }
 
@@ -1668,8 +1807,8 @@ void dumpRegisterMaps(DexFile* pDexFile)
     ptr += sizeof(u4);
     classOffsets = (const u4*) ptr;
 
-    printf("RMAP begins at offset 0x%07x\n", baseFileOffset);
-    printf("Maps for %d classes\n", numClasses);
+    outPrintf("RMAP begins at offset 0x%07x\n", baseFileOffset);
+    outPrintf("Maps for %d classes\n", numClasses);
     for (idx = 0; idx < (int) numClasses; idx++) {
         const DexClassDef* pClassDef;
         const char* classDescriptor;
@@ -1677,7 +1816,7 @@ void dumpRegisterMaps(DexFile* pDexFile)
         pClassDef = dexGetClassDef(pDexFile, idx);
         classDescriptor = dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
 
-        printf("%4d: +%d (0x%08x) %s\n", idx, classOffsets[idx],
+        outPrintf("%4d: +%d (0x%08x) %s\n", idx, classOffsets[idx],
             baseFileOffset + classOffsets[idx], classDescriptor);
 
         if (classOffsets[idx] == 0)
@@ -1706,19 +1845,19 @@ void dumpRegisterMaps(DexFile* pDexFile)
         if (methodCount != pClassData->header.directMethodsSize
                             + pClassData->header.virtualMethodsSize)
         {
-            printf("NOTE: method count discrepancy (%d != %d + %d)\n",
+            outPrintf("NOTE: method count discrepancy (%d != %d + %d)\n",
                 methodCount, pClassData->header.directMethodsSize,
                 pClassData->header.virtualMethodsSize);
             /* this is bad, but keep going anyway */
         }
 
-        printf("    direct methods: %d\n",
+        outPrintf("    direct methods: %d\n",
             pClassData->header.directMethodsSize);
         for (i = 0; i < (int) pClassData->header.directMethodsSize; i++) {
             dumpMethodMap(pDexFile, &pClassData->directMethods[i], i, &data);
         }
 
-        printf("    virtual methods: %d\n",
+        outPrintf("    virtual methods: %d\n",
             pClassData->header.virtualMethodsSize);
         for (i = 0; i < (int) pClassData->header.virtualMethodsSize; i++) {
             dumpMethodMap(pDexFile, &pClassData->virtualMethods[i], i, &data);
@@ -1728,6 +1867,128 @@ void dumpRegisterMaps(DexFile* pDexFile)
     }
 }
 
+/*
+ * Dump one class, and its class_def if they asked for section headers.
+ */
+static void dumpOneClass(DexFile* pDexFile, int idx, char** pLastPackage)
+{
+    if (gOptions.showSectionHeaders)
+        dumpClassDef(pDexFile, idx);
+
+    dumpClass(pDexFile, idx, pLastPackage);
+}
+
+#ifndef _WIN32
+/* how far the workers may get ahead of the class being written */
+#define kParallelWindow 1024
+
+/*
+ * State shared by the dumpClassesParallel() workers.  Class "i" is kept
+ * in slots[i % kParallelWindow] until it has been written.
+ */
+struct ParallelDump {
+    DexFile*        pDexFile;
+    int             numClasses;
+    int             nextClass;      /* next class a worker will take */
+    int             nextWrite;      /* next class to write to stdout */
+    OutBuf          slots[kParallelWindow];
+    bool            ready[kParallelWindow];
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+static void* dumpWorker(void* arg)
+{
+    ParallelDump* pDump = (ParallelDump*) arg;
+    char* package = NULL;
+
+    pthread_mutex_lock(&pDump->lock);
+    while (true) {
+        while (pDump->nextClass < pDump->numClasses &&
+               pDump->nextClass - pDump->nextWrite >= kParallelWindow)
+        {
+            pthread_cond_wait(&pDump->cond, &pDump->lock);
+        }
+        if (pDump->nextClass >= pDump->numClasses)
+            break;
+        int idx = pDump->nextClass++;
+        pthread_mutex_unlock(&pDump->lock);
+
+        OutBuf buf = { NULL, 0, 0 };
+        gOutBuf = &buf;
+        dumpOneClass(pDump->pDexFile, idx, &package);
+        gOutBuf = NULL;
+
+        pthread_mutex_lock(&pDump->lock);
+        pDump->slots[idx % kParallelWindow] = buf;
+        pDump->ready[idx % kParallelWindow] = true;
+        pthread_cond_broadcast(&pDump->cond);
+    }
+    pthread_mutex_unlock(&pDump->lock);
+
+    free(package);      /* only used for XML; should still be NULL */
+    return NULL;
+}
+
+/*
+ * Format the classes on gOptions.numThreads worker threads, and write
+ * each one out on this thread as soon as it and all before it are done.
+ * The output is the same as the sequential loop's.
+ */
+static void dumpClassesParallel(DexFile* pDexFile)
+{
+    ParallelDump* pDump = (ParallelDump*) calloc(1, sizeof(ParallelDump));
+    pthread_t* threads =
+        (pthread_t*) malloc(gOptions.numThreads * sizeof(pthread_t));
+    int numThreads = 0;
+
+    pDump->pDexFile = pDexFile;
+    pDump->numClasses = pDexFile->pHeader->classDefsSize;
+    pthread_mutex_init(&pDump->lock, NULL);
+    pthread_cond_init(&pDump->cond, NULL);
+
+    for (int i = 0; i < gOptions.numThreads; i++) {
+        if (pthread_create(&threads[numThreads], NULL, dumpWorker, pDump) != 0)
+            break;
+        numThreads++;
+    }
+    if (numThreads == 0) {
+        /* couldn't start any; do the work ourselves */
+        char* package = NULL;
+        for (int i = 0; i < pDump->numClasses; i++)
+            dumpOneClass(pDexFile, i, &package);
+        free(package);
+        pDump->nextWrite = pDump->numClasses;
+    }
+
+    pthread_mutex_lock(&pDump->lock);
+    while (pDump->nextWrite < pDump->numClasses) {
+        int slot = pDump->nextWrite % kParallelWindow;
+        while (!pDump->ready[slot])
+            pthread_cond_wait(&pDump->cond, &pDump->lock);
+        OutBuf buf = pDump->slots[slot];
+        pDump->ready[slot] = false;
+        pDump->nextWrite++;
+        pthread_cond_broadcast(&pDump->cond);
+        pthread_mutex_unlock(&pDump->lock);
+
+        fwrite(buf.data, 1, buf.len, stdout);
+        free(buf.data);
+
+        pthread_mutex_lock(&pDump->lock);
+    }
+    pthread_mutex_unlock(&pDump->lock);
+
+    for (int i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&pDump->cond);
+    pthread_mutex_destroy(&pDump->lock);
+    free(threads);
+    free(pDump);
+}
+#endif
+
 /*
  * Dump the requested sections of the file.
  */
@@ -1737,7 +1998,7 @@ void processDexFile(const char* fileName, DexFile* pDexFile)
     int i;
 
     if (gOptions.verbose) {
-        printf("Opened '%s', DEX version '%.3s'\n", fileName,
+        outPrintf("Opened '%s', DEX version '%.3s'\n", fileName,
             pDexFile->pHeader->magic +4);
     }
 
@@ -1752,23 +2013,26 @@ void processDexFile(const char* fileName, DexFile* pDexFile)
     }
 
     if (gOptions.outputFormat == OUTPUT_XML)
-        printf("<api>\n");
-
+        outPrintf("<api>\n");
+
+#ifndef _WIN32
+    /* XML output carries the current package from one class to the next */
+    if (gOptions.numThreads > 1 && gOptions.outputFormat == OUTPUT_PLAIN) {
+        dumpClassesParallel(pDexFile);
+    } else
+#endif
     for (i = 0; i < (int) pDexFile->pHeader->classDefsSize; i++) {
-        if (gOptions.showSectionHeaders)
-            dumpClassDef(pDexFile, i);
-
-        dumpClass(pDexFile, i, &package);
+        dumpOneClass(pDexFile, i, &package);
     }
 
     /* free the last one allocated */
     if (package != NULL) {
-        printf("</package>\n");
+        outPrintf("</package>\n");
         free(package);
     }
 
     if (gOptions.outputFormat == OUTPUT_XML)
-        printf("</api>\n");
+        outPrintf("</api>\n");
 }
 
 
@@ -1783,7 +2047,7 @@ int process(const char* fileName)
     int result = -1;
 
     if (gOptions.verbose)
-        printf("Processing '%s'...\n", fileName);
+        outPrintf("Processing '%s'...\n", fileName);
 
     if (dexOpenAndMap(fileName, gOptions.tempFileName, &map, false) != 0) {
         return result;
@@ -1801,7 +2065,7 @@ int process(const char* fileName)
     }
 
     if (gOptions.checksumOnly) {
-        printf("Checksum verified\n");
+        outPrintf("Checksum verified\n");
     } else {
         processDexFile(fileName, pDexFile);
     }
@@ -1824,7 +2088,8 @@ void usage(void)
 {
     fprintf(stderr, "Copyright (C) 2007 The Android Open Source Project\n\n");
     fprintf(stderr,
-        "%s: [-c] [-d] [-f] [-h] [-i] [-l layout] [-m] [-t tempfile] dexfile...\n",
+        "%s: [-c] [-d] [-f] [-h] [-i] [-j threads] [-l layout] [-m]"
+        " [-t tempfile] dexfile...\n",
         gProgName);
     fprintf(stderr, "\n");
     fprintf(stderr, " -c : verify checksum and exit\n");
@@ -1832,6 +2097,7 @@ void usage(void)
     fprintf(stderr, " -f : display summary information from file header\n");
     fprintf(stderr, " -h : display file header details\n");
     fprintf(stderr, " -i : ignore checksum failures\n");
+    fprintf(stderr, " -j : format classes on this many threads (plain only)\n");
     fprintf(stderr, " -l : output layout, either 'plain' or 'xml'\n");
     fprintf(stderr, " -m : dump register maps (and nothing else)\n");
     fprintf(stderr, " -t : temp file name (defaults to /sdcard/dex-temp-*)\n");
@@ -1851,7 +2117,7 @@ int main(int argc, char* const argv[])
     gOptions.verbose = true;
 
     while (1) {
-        ic = getopt(argc, argv, "cdfhil:mt:");
+        ic = getopt(argc, argv, "cdfhij:l:mt:");
         if (ic < 0)
             break;
 
@@ -1871,6 +2137,11 @@ int main(int argc, char* const argv[])
         case 'i':       // continue even if checksum is bad
             gOptions.ignoreBadChecksum = true;
             break;
+        case 'j':       // format classes in parallel
+            gOptions.numThreads = atoi(optarg);
+            if (gOptions.numThreads < 1)
+                wantUsage = true;
+            break;
         case 'l':       // layout
             if (strcmp(optarg, "plain") == 0) {
                 gOptions.outputFormat = OUTPUT_PLAIN;
@@ -1909,6 +2180,9 @@ int main(int argc, char* const argv[])
         return 2;
     }
 
+    /* dumps are large; don't write them a line at a time */
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
     int result = 0;
     while (optind < argc) {
         result |= process(argv[optind++]);
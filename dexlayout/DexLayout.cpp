@@ -0,0 +1,1089 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Rewrite a DEX file so that what startup touches is packed together.
+ *
+ * dx lays out classes, code and strings in its own order, so the classes
+ * an app loads while starting are spread over the whole file and each
+ * one costs a page fault or two.  Given a list of the classes loaded at
+ * startup -- either descriptors or class names, one per line, or the
+ * "PRELOAD" lines logged by a VM built with LOG_CLASS_LOADING -- this
+ * moves, within their sections:
+ *
+ *   - the class defs of the startup classes to the front (superclasses
+ *     and interfaces defined in the file still come first),
+ *   - their class_data items and code items to the front of those
+ *     sections, in the same order, and
+ *   - the string data they use (names, descriptors, const-string
+ *     operands) to the front of the string data section.
+ *
+ * Nothing else moves, and every section keeps its offset and size, so
+ * only the references to moved items need fixing: string_id offsets,
+ * class_def class_data offsets and encoded_method code offsets.  The
+ * last is a ULEB128; values that get shorter are padded to the old
+ * length.  If one would get longer, the class_data section has to grow,
+ * which is only done when nothing but the map follows it (as dx writes
+ * it); otherwise the file is left alone.
+ */
+#include "libdex/DexFile.h"
+
+#include "libdex/Adler32.h"
+#include "libdex/DexClass.h"
+#include "libdex/DexOpcodes.h"
+#include "libdex/InstrUtils.h"
+#include "libdex/Leb128.h"
+#include "libdex/sha1.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* gProgName = "dexlayout";
+
+/* command-line args */
+static struct {
+    bool        verbose;
+    const char* profileName;
+    const char* outputName;
+} gOptions;
+
+/* rank of a class that isn't in the profile */
+static const int kNotStartup = INT_MAX;
+
+/* one profile entry */
+struct ProfileClass {
+    char*   descriptor;
+    int     rank;               /* order of first appearance */
+};
+
+/* an item in one of the sections we reorder */
+struct LayoutItem {
+    u4      oldOff;
+    u4      size;
+    u4      newOff;
+    bool    placed;
+    bool    startup;            /* placed for a startup class */
+};
+
+/* a section we reorder, with its items in file order */
+struct LayoutSection {
+    const DexMapItem* pMapItem;
+    LayoutItem* items;
+    u4      count;
+    u4      alignment;
+    u4      start;
+    u4      end;                /* just past the last item */
+};
+
+struct Layout {
+    const u1*   orig;           /* the input, unmodified */
+    size_t      origLen;
+    DexFile*    pDexFile;       /* parsed from "orig" */
+
+    ProfileClass* profile;      /* sorted by descriptor */
+    int         profileCount;
+
+    u4*         classOrder;     /* class def indices, new order */
+    int*        classRank;      /* per class def */
+    u4          numStartup;     /* leading entries of classOrder */
+
+    LayoutSection codeItems;
+    LayoutSection classData;
+    LayoutSection stringData;
+
+    bool*       stringPlaced;   /* per string id */
+};
+
+/*
+ * Convert "java.lang.Object" or "java/lang/Object" to "Ljava/lang/Object;".
+ * Something that already looks like a descriptor is copied as-is.
+ */
+static char* nameToDescriptor(const char* name)
+{
+    size_t len = strlen(name);
+    if (name[0] == 'L' && name[len - 1] == ';')
+        return strdup(name);
+
+    char* desc = (char*) malloc(len + 3);
+    desc[0] = 'L';
+    for (size_t i = 0; i < len; i++)
+        desc[i + 1] = (name[i] == '.') ? '/' : name[i];
+    desc[len + 1] = ';';
+    desc[len + 2] = '\0';
+    return desc;
+}
+
+static int compareProfileClasses(const void* a, const void* b)
+{
+    return strcmp(((const ProfileClass*) a)->descriptor,
+                  ((const ProfileClass*) b)->descriptor);
+}
+
+/*
+ * Read the startup class profile.  A PRELOAD log line looks like
+ *
+ *   >ppid:pid:tid:process:loader:Ldescriptor;:time
+ *
+ * where '>' starts a load and '<' finishes one; the class is taken from
+ * the first line it appears on.  Anything else is a class name or
+ * descriptor on a line by itself.
+ */
+static bool loadProfile(Layout* pLayout, const char* fileName)
+{
+    FILE* fp = fopen(fileName, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: unable to open '%s': %s\n", gProgName,
+            fileName, strerror(errno));
+        return false;
+    }
+
+    int count = 0, alloc = 0;
+    ProfileClass* profile = NULL;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        /* strip logcat's prefix, if any */
+        const char* cp = strstr(line, "PRELOAD");
+        if (cp != NULL) {
+            cp = strpbrk(cp, "<>");
+            if (cp == NULL)
+                continue;
+        } else {
+            cp = line + strspn(line, " \t");
+        }
+        if (*cp == '\0' || *cp == '#')
+            continue;
+
+        char* desc;
+        if (*cp == '<' || *cp == '>') {
+            /* the descriptor is the sixth field */
+            const char* field = cp + 1;
+            for (int i = 0; i < 5 && field != NULL; i++) {
+                field = strchr(field, ':');
+                if (field != NULL)
+                    field++;
+            }
+            const char* end = (field != NULL) ? strchr(field, ':') : NULL;
+            if (end == NULL)
+                continue;
+            desc = strndup(field, end - field);
+        } else {
+            desc = nameToDescriptor(cp);
+        }
+
+        if (count == alloc) {
+            alloc = (alloc == 0) ? 1024 : alloc * 2;
+            profile = (ProfileClass*) realloc(profile,
+                alloc * sizeof(ProfileClass));
+        }
+        profile[count].descriptor = desc;
+        profile[count].rank = count;
+        count++;
+    }
+    fclose(fp);
+
+    /* sort, keeping only the first appearance of each class */
+    qsort(profile, count, sizeof(ProfileClass), compareProfileClasses);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (kept > 0 &&
+            strcmp(profile[kept - 1].descriptor, profile[i].descriptor) == 0)
+        {
+            if (profile[i].rank < profile[kept - 1].rank)
+                profile[kept - 1].rank = profile[i].rank;
+            free(profile[i].descriptor);
+        } else {
+            profile[kept++] = profile[i];
+        }
+    }
+
+    pLayout->profile = profile;
+    pLayout->profileCount = kept;
+    return true;
+}
+
+static int lookupRank(const Layout* pLayout, const char* descriptor)
+{
+    ProfileClass key;
+    key.descriptor = const_cast<char*>(descriptor);
+    const ProfileClass* pFound = (const ProfileClass*) bsearch(&key,
+        pLayout->profile, pLayout->profileCount, sizeof(ProfileClass),
+        compareProfileClasses);
+    return (pFound != NULL) ? pFound->rank : kNotStartup;
+}
+
+/*
+ * ===========================================================================
+ *      Class def order
+ * ===========================================================================
+ */
+
+struct ClassOrderState {
+    Layout*     pLayout;
+    int*        defForType;     /* class def index per type id, or -1 */
+    u1*         state;          /* 0 = unseen, 1 = in progress, 2 = placed */
+    u4          numPlaced;
+};
+
+/*
+ * Place a class def after the ones it depends on.  The verifier would
+ * reject a cycle; we just stop following it.
+ */
+static void placeClass(ClassOrderState* pState, int idx)
+{
+    if (idx < 0 || pState->state[idx] != 0)
+        return;
+    pState->state[idx] = 1;
+
+    const DexFile* pDexFile = pState->pLayout->pDexFile;
+    const DexClassDef* pClassDef = dexGetClassDef(pDexFile, idx);
+    if (pClassDef->superclassIdx != kDexNoIndex)
+        placeClass(pState, pState->defForType[pClassDef->superclassIdx]);
+
+    const DexTypeList* pInterfaces = dexGetInterfacesList(pDexFile, pClassDef);
+    if (pInterfaces != NULL) {
+        for (u4 i = 0; i < pInterfaces->size; i++) {
+            placeClass(pState, pState->defForType[
+                dexTypeListGetIdx(pInterfaces, i)]);
+        }
+    }
+
+    pState->state[idx] = 2;
+    pState->pLayout->classOrder[pState->numPlaced++] = idx;
+}
+
+/* qsort has no context argument; this is only used from one thread */
+static const int* gSortRanks;
+
+static int compareByRank(const void* a, const void* b)
+{
+    u4 idxA = *(const u4*) a;
+    u4 idxB = *(const u4*) b;
+    if (gSortRanks[idxA] != gSortRanks[idxB])
+        return (gSortRanks[idxA] < gSortRanks[idxB]) ? -1 : 1;
+    return (idxA < idxB) ? -1 : (idxA > idxB) ? 1 : 0;
+}
+
+static void orderClasses(Layout* pLayout)
+{
+    const DexFile* pDexFile = pLayout->pDexFile;
+    u4 count = pDexFile->pHeader->classDefsSize;
+
+    pLayout->classRank = (int*) malloc(count * sizeof(int));
+    pLayout->classOrder = (u4*) malloc(count * sizeof(u4));
+
+    u4* wanted = (u4*) malloc(count * sizeof(u4));
+    for (u4 i = 0; i < count; i++) {
+        const DexClassDef* pClassDef = dexGetClassDef(pDexFile, i);
+        pLayout->classRank[i] = lookupRank(pLayout,
+            dexStringByTypeIdx(pDexFile, pClassDef->classIdx));
+        wanted[i] = i;
+    }
+    gSortRanks = pLayout->classRank;
+    qsort(wanted, count, sizeof(u4), compareByRank);
+
+    ClassOrderState state;
+    state.pLayout = pLayout;
+    state.defForType =
+        (int*) malloc(pDexFile->pHeader->typeIdsSize * sizeof(int));
+    state.state = (u1*) calloc(count, 1);
+    state.numPlaced = 0;
+    for (u4 i = 0; i < pDexFile->pHeader->typeIdsSize; i++)
+        state.defForType[i] = -1;
+    for (u4 i = 0; i < count; i++)
+        state.defForType[dexGetClassDef(pDexFile, i)->classIdx] = i;
+
+    pLayout->numStartup = 0;
+    for (u4 i = 0; i < count; i++) {
+        placeClass(&state, wanted[i]);
+        if (pLayout->classRank[wanted[i]] != kNotStartup)
+            pLayout->numStartup = state.numPlaced;
+    }
+    assert(state.numPlaced == count);
+
+    free(state.defForType);
+    free(state.state);
+    free(wanted);
+}
+
+/*
+ * ===========================================================================
+ *      Sections
+ * ===========================================================================
+ */
+
+static const DexMapItem* findMapItem(const DexFile* pDexFile, u2 type)
+{
+    const DexMapList* pMap = dexGetMap(pDexFile);
+    for (u4 i = 0; i < pMap->size; i++) {
+        if (pMap->list[i].type == type)
+            return &pMap->list[i];
+    }
+    return NULL;
+}
+
+static u4 stringDataSize(const u1* data)
+{
+    const u1* ptr = data;
+    readUnsignedLeb128(&ptr);
+    ptr += strlen((const char*) ptr) + 1;
+    return ptr - data;
+}
+
+/*
+ * dexGetDexCodeSize() counts the padding after the instructions even when
+ * no tries follow, which would run the last item into the next section.
+ */
+static u4 codeItemSize(const DexCode* pCode)
+{
+    if (pCode->triesSize != 0)
+        return dexGetDexCodeSize(pCode);
+    return offsetof(DexCode, insns) + pCode->insnsSize * sizeof(u2);
+}
+
+static u4 classDataSize(const u1* data)
+{
+    const u1* ptr = data;
+    DexClassDataHeader header;
+    dexReadClassDataHeader(&ptr, &header);
+
+    u4 fields = header.staticFieldsSize + header.instanceFieldsSize;
+    for (u4 i = 0; i < fields * 2; i++)
+        readUnsignedLeb128(&ptr);
+    u4 methods = header.directMethodsSize + header.virtualMethodsSize;
+    for (u4 i = 0; i < methods * 3; i++)
+        readUnsignedLeb128(&ptr);
+    return ptr - data;
+}
+
+/*
+ * Find the items of one section, walking it from the start.
+ */
+static bool loadSection(Layout* pLayout, u2 type, u4 alignment,
+    LayoutSection* pSection)
+{
+    memset(pSection, 0, sizeof(*pSection));
+    pSection->pMapItem = findMapItem(pLayout->pDexFile, type);
+    pSection->alignment = alignment;
+    if (pSection->pMapItem == NULL)
+        return true;
+
+    u4 count = pSection->pMapItem->size;
+    u4 off = pSection->pMapItem->offset;
+    pSection->items = (LayoutItem*) calloc(count, sizeof(LayoutItem));
+    pSection->count = count;
+    pSection->start = off;
+
+    for (u4 i = 0; i < count; i++) {
+        off = (off + alignment - 1) & ~(alignment - 1);
+        if (off >= pLayout->origLen)
+            return false;
+
+        const u1* data = pLayout->orig + off;
+        u4 size;
+        switch (type) {
+        case kDexTypeCodeItem:
+            size = codeItemSize((const DexCode*) data);
+            break;
+        case kDexTypeClassDataItem:
+            size = classDataSize(data);
+            break;
+        case kDexTypeStringDataItem:
+            size = stringDataSize(data);
+            break;
+        default:
+            assert(false);
+            return false;
+        }
+        pSection->items[i].oldOff = off;
+        pSection->items[i].size = size;
+        off += size;
+    }
+    pSection->end = off;
+    return off <= pLayout->origLen;
+}
+
+static int compareItemOffsets(const void* key, const void* item)
+{
+    u4 off = *(const u4*) key;
+    u4 itemOff = ((const LayoutItem*) item)->oldOff;
+    return (off < itemOff) ? -1 : (off > itemOff) ? 1 : 0;
+}
+
+static LayoutItem* findItem(const LayoutSection* pSection, u4 oldOff)
+{
+    return (LayoutItem*) bsearch(&oldOff, pSection->items, pSection->count,
+        sizeof(LayoutItem), compareItemOffsets);
+}
+
+/*
+ * Give an item the next spot in its section, if it doesn't have one.
+ */
+static void placeItem(LayoutSection* pSection, LayoutItem* pItem, u4* pNext)
+{
+    if (pItem == NULL || pItem->placed)
+        return;
+    u4 align = pSection->alignment;
+    *pNext = (*pNext + align - 1) & ~(align - 1);
+    pItem->newOff = *pNext;
+    pItem->placed = true;
+    *pNext += pItem->size;
+}
+
+/*
+ * Place everything not placed yet, in file order.  The item that was
+ * last stays last: with every item aligned, that keeps the section's
+ * length exactly what it was.
+ */
+static void placeRemaining(LayoutSection* pSection, u4* pNext)
+{
+    if (pSection->count == 0)
+        return;
+    LayoutItem* pLast = &pSection->items[pSection->count - 1];
+    bool lastPlaced = pLast->placed;
+    pLast->placed = true;
+    for (u4 i = 0; i < pSection->count; i++)
+        placeItem(pSection, &pSection->items[i], pNext);
+    pLast->placed = lastPlaced;
+    placeItem(pSection, pLast, pNext);
+}
+
+/*
+ * Copy a section's items to their new places in "out".
+ */
+static void writeSection(const Layout* pLayout, const LayoutSection* pSection,
+    u1* out)
+{
+    if (pSection->count == 0)
+        return;
+    memset(out + pSection->start, 0, pSection->end - pSection->start);
+    for (u4 i = 0; i < pSection->count; i++) {
+        const LayoutItem* pItem = &pSection->items[i];
+        memcpy(out + pItem->newOff, pLayout->orig + pItem->oldOff,
+            pItem->size);
+    }
+}
+
+/*
+ * ===========================================================================
+ *      Code items and strings
+ * ===========================================================================
+ */
+
+static void useString(Layout* pLayout, u4 stringIdx, u4* pNext)
+{
+    if (stringIdx == kDexNoIndex || pLayout->stringPlaced[stringIdx])
+        return;
+    pLayout->stringPlaced[stringIdx] = true;
+
+    const DexStringId* pStringId =
+        dexGetStringId(pLayout->pDexFile, stringIdx);
+    placeItem(&pLayout->stringData,
+        findItem(&pLayout->stringData, pStringId->stringDataOff), pNext);
+}
+
+static void useType(Layout* pLayout, u4 typeIdx, u4* pNext)
+{
+    if (typeIdx != kDexNoIndex) {
+        useString(pLayout,
+            dexGetTypeId(pLayout->pDexFile, typeIdx)->descriptorIdx, pNext);
+    }
+}
+
+static void useProto(Layout* pLayout, u4 protoIdx, u4* pNext)
+{
+    const DexProtoId* pProtoId = dexGetProtoId(pLayout->pDexFile, protoIdx);
+    useString(pLayout, pProtoId->shortyIdx, pNext);
+    useType(pLayout, pProtoId->returnTypeIdx, pNext);
+
+    const DexTypeList* pParams =
+        dexGetProtoParameters(pLayout->pDexFile, pProtoId);
+    if (pParams != NULL) {
+        for (u4 i = 0; i < pParams->size; i++)
+            useType(pLayout, dexTypeListGetIdx(pParams, i), pNext);
+    }
+}
+
+/*
+ * Place the strings a method's code loads with const-string.
+ */
+static void useCodeStrings(Layout* pLayout, const DexCode* pCode, u4* pNext)
+{
+    const u2* insns = pCode->insns;
+    u4 insnsSize = pCode->insnsSize;
+
+    for (u4 pc = 0; pc < insnsSize; ) {
+        Opcode opcode = dexOpcodeFromCodeUnit(insns[pc]);
+        if (opcode == OP_CONST_STRING && pc + 1 < insnsSize) {
+            useString(pLayout, insns[pc + 1], pNext);
+        } else if (opcode == OP_CONST_STRING_JUMBO && pc + 2 < insnsSize) {
+            useString(pLayout, insns[pc + 1] | ((u4) insns[pc + 2] << 16),
+                pNext);
+        }
+        size_t width = dexGetWidthFromInstruction(&insns[pc]);
+        if (width == 0)
+            break;
+        pc += width;
+    }
+}
+
+static void markStartup(LayoutSection* pSection)
+{
+    for (u4 i = 0; i < pSection->count; i++)
+        pSection->items[i].startup = pSection->items[i].placed;
+}
+
+/*
+ * Place the class data, code and strings of the startup classes, then
+ * everything else.
+ */
+static void orderItems(Layout* pLayout)
+{
+    const DexFile* pDexFile = pLayout->pDexFile;
+    u4 nextCode = pLayout->codeItems.start;
+    u4 nextClassData = pLayout->classData.start;
+    u4 nextString = pLayout->stringData.start;
+
+    for (u4 i = 0; i < pLayout->numStartup; i++) {
+        const DexClassDef* pClassDef =
+            dexGetClassDef(pDexFile, pLayout->classOrder[i]);
+
+        useType(pLayout, pClassDef->classIdx, &nextString);
+        useType(pLayout, pClassDef->superclassIdx, &nextString);
+        const DexTypeList* pInterfaces =
+            dexGetInterfacesList(pDexFile, pClassDef);
+        if (pInterfaces != NULL) {
+            for (u4 j = 0; j < pInterfaces->size; j++) {
+                useType(pLayout, dexTypeListGetIdx(pInterfaces, j),
+                    &nextString);
+            }
+        }
+
+        if (pClassDef->classDataOff == 0)
+            continue;
+        placeItem(&pLayout->classData,
+            findItem(&pLayout->classData, pClassDef->classDataOff),
+            &nextClassData);
+
+        const u1* ptr = pLayout->orig + pClassDef->classDataOff;
+        DexClassDataHeader header;
+        dexReadClassDataHeader(&ptr, &header);
+
+        u4 fields = header.staticFieldsSize + header.instanceFieldsSize;
+        u4 lastIdx = 0;
+        for (u4 j = 0; j < fields; j++) {
+            DexField field;
+            if (j == header.staticFieldsSize)
+                lastIdx = 0;
+            dexReadClassDataField(&ptr, &field, &lastIdx);
+            const DexFieldId* pFieldId =
+                dexGetFieldId(pDexFile, field.fieldIdx);
+            useString(pLayout, pFieldId->nameIdx, &nextString);
+            useType(pLayout, pFieldId->typeIdx, &nextString);
+        }
+
+        u4 methods = header.directMethodsSize + header.virtualMethodsSize;
+        lastIdx = 0;
+        for (u4 j = 0; j < methods; j++) {
+            DexMethod method;
+            if (j == header.directMethodsSize)
+                lastIdx = 0;
+            dexReadClassDataMethod(&ptr, &method, &lastIdx);
+            const DexMethodId* pMethodId =
+                dexGetMethodId(pDexFile, method.methodIdx);
+            useString(pLayout, pMethodId->nameIdx, &nextString);
+            useProto(pLayout, pMethodId->protoIdx, &nextString);
+
+            if (method.codeOff != 0) {
+                placeItem(&pLayout->codeItems,
+                    findItem(&pLayout->codeItems, method.codeOff), &nextCode);
+                useCodeStrings(pLayout,
+                    (const DexCode*) (pLayout->orig + method.codeOff),
+                    &nextString);
+            }
+        }
+    }
+
+    markStartup(&pLayout->codeItems);
+    markStartup(&pLayout->classData);
+    markStartup(&pLayout->stringData);
+
+    /* the remaining class data follows the new class order */
+    for (u4 i = pLayout->numStartup; i < pDexFile->pHeader->classDefsSize;
+         i++)
+    {
+        const DexClassDef* pClassDef =
+            dexGetClassDef(pDexFile, pLayout->classOrder[i]);
+        if (pClassDef->classDataOff != 0) {
+            placeItem(&pLayout->classData,
+                findItem(&pLayout->classData, pClassDef->classDataOff),
+                &nextClassData);
+        }
+    }
+
+    placeRemaining(&pLayout->codeItems, &nextCode);
+    placeRemaining(&pLayout->classData, &nextClassData);
+    placeRemaining(&pLayout->stringData, &nextString);
+}
+
+/*
+ * ===========================================================================
+ *      Output
+ * ===========================================================================
+ */
+
+/*
+ * Write "value" as a ULEB128 of at least "minLen" bytes.
+ */
+static u1* writePaddedLeb128(u1* ptr, u4 value, int minLen)
+{
+    int len = unsignedLeb128Size(value);
+    if (len >= minLen)
+        return writeUnsignedLeb128(ptr, value);
+
+    for (int i = 0; i < minLen - 1; i++) {
+        *ptr++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *ptr++ = value;
+    return ptr;
+}
+
+/*
+ * Re-encode one class_data item with the new code offsets.  If "keepSize"
+ * is set, every value keeps its old length; returns -1 if one can't.
+ * Otherwise values are written as small as they go.  Returns the size
+ * written.
+ */
+static int rewriteClassData(const Layout* pLayout, const u1* data, u1* out,
+    bool keepSize)
+{
+    const u1* ptr = data;
+    u1* outPtr = out;
+
+    u4 counts = 4;
+    DexClassDataHeader header;
+    const u1* headerPtr = data;
+    dexReadClassDataHeader(&headerPtr, &header);
+    counts += (header.staticFieldsSize + header.instanceFieldsSize) * 2;
+    u4 methods = header.directMethodsSize + header.virtualMethodsSize;
+
+    /* everything up to the methods is copied as it is */
+    for (u4 i = 0; i < counts; i++)
+        readUnsignedLeb128(&ptr);
+    memcpy(outPtr, data, ptr - data);
+    outPtr += ptr - data;
+
+    for (u4 i = 0; i < methods; i++) {
+        for (int j = 0; j < 2; j++) {
+            const u1* start = ptr;
+            readUnsignedLeb128(&ptr);
+            memcpy(outPtr, start, ptr - start);
+            outPtr += ptr - start;
+        }
+
+        const u1* start = ptr;
+        u4 codeOff = readUnsignedLeb128(&ptr);
+        int oldLen = ptr - start;
+        if (codeOff != 0) {
+            const LayoutItem* pItem = findItem(&pLayout->codeItems, codeOff);
+            assert(pItem != NULL);
+            codeOff = pItem->newOff;
+        }
+        if (keepSize) {
+            if (unsignedLeb128Size(codeOff) > oldLen)
+                return -1;
+            outPtr = writePaddedLeb128(outPtr, codeOff, oldLen);
+        } else {
+            outPtr = writeUnsignedLeb128(outPtr, codeOff);
+        }
+    }
+
+    return outPtr - out;
+}
+
+static void set4LE(u1* buf, u4 val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+    buf[3] = val >> 24;
+}
+
+
+static int compareNewOffsets(const void* a, const void* b)
+{
+    u4 offA = (*(const LayoutItem* const*) a)->newOff;
+    u4 offB = (*(const LayoutItem* const*) b)->newOff;
+    return (offA < offB) ? -1 : (offA > offB) ? 1 : 0;
+}
+
+/*
+ * Re-encode the class data into "buf", in the order placed, updating
+ * each item's new offset and size.  Returns the length, or -1 if
+ * "keepSize" is set and an item would have to grow.
+ */
+static int packClassData(Layout* pLayout, u1* buf, bool keepSize)
+{
+    LayoutSection* pClassData = &pLayout->classData;
+    LayoutItem** byNew = (LayoutItem**) malloc(
+        pClassData->count * sizeof(LayoutItem*));
+    for (u4 i = 0; i < pClassData->count; i++)
+        byNew[i] = &pClassData->items[i];
+    qsort(byNew, pClassData->count, sizeof(LayoutItem*), compareNewOffsets);
+
+    int next = 0;
+    for (u4 i = 0; i < pClassData->count; i++) {
+        LayoutItem* pItem = byNew[i];
+        int len = rewriteClassData(pLayout, pLayout->orig + pItem->oldOff,
+            buf + next, keepSize);
+        if (len < 0) {
+            next = -1;
+            break;
+        }
+        pItem->newOff = pClassData->start + next;
+        next += len;
+    }
+
+    free(byNew);
+    return next;
+}
+
+/*
+ * Build the new file.  Returns it, with its length in "*pLen", or NULL.
+ */
+static u1* buildOutput(Layout* pLayout, size_t* pLen)
+{
+    const DexFile* pDexFile = pLayout->pDexFile;
+    const DexHeader* pHeader = pDexFile->pHeader;
+    const LayoutSection* pClassData = &pLayout->classData;
+    const DexMapList* pMap = dexGetMap(pDexFile);
+    u4 mapSize = sizeof(u4) + pMap->size * sizeof(DexMapItem);
+
+    /*
+     * Re-encode the class data at its old size if it fits.  If not, it
+     * can grow only when the map is all that follows it.
+     */
+    u1* classDataBuf = (u1*) malloc((pClassData->end - pClassData->start) * 2);
+    int classDataLen = packClassData(pLayout, classDataBuf, true);
+    u4 newMapOff = pHeader->mapOff;
+    if (classDataLen < 0) {
+        bool canGrow = pHeader->mapOff >= pClassData->end &&
+            pHeader->mapOff - pClassData->end < 4 &&
+            pHeader->mapOff + mapSize == pLayout->origLen;
+        for (u4 i = 0; i < pMap->size && canGrow; i++) {
+            if (pMap->list[i].offset > pClassData->start &&
+                pMap->list[i].type != kDexTypeMapList)
+            {
+                canGrow = false;
+            }
+        }
+        if (!canGrow) {
+            fprintf(stderr, "%s: class_data would have to grow, and it isn't "
+                "at the end of the file\n", gProgName);
+            free(classDataBuf);
+            return NULL;
+        }
+
+        classDataLen = packClassData(pLayout, classDataBuf, false);
+        newMapOff = (pClassData->start + classDataLen + 3) & ~3;
+        if (gOptions.verbose) {
+            printf("class_data grows by %d bytes\n",
+                (int) (newMapOff - pHeader->mapOff));
+        }
+    }
+
+    /* the map may move up, never down */
+    size_t newLen = newMapOff + mapSize;
+    if (newLen < pLayout->origLen)
+        newLen = pLayout->origLen;
+    u1* out = (u1*) calloc(1, newLen);
+    memcpy(out, pLayout->orig, pLayout->origLen);
+
+    /* class defs, in the new order */
+    for (u4 i = 0; i < pHeader->classDefsSize; i++) {
+        const DexClassDef* pClassDef =
+            dexGetClassDef(pDexFile, pLayout->classOrder[i]);
+        DexClassDef* pOut = (DexClassDef*) (out + pHeader->classDefsOff) + i;
+        *pOut = *pClassDef;
+        if (pClassDef->classDataOff != 0) {
+            pOut->classDataOff =
+                findItem(pClassData, pClassDef->classDataOff)->newOff;
+        }
+    }
+
+    /* string ids follow their data */
+    writeSection(pLayout, &pLayout->stringData, out);
+    for (u4 i = 0; i < pHeader->stringIdsSize; i++) {
+        const DexStringId* pStringId = dexGetStringId(pDexFile, i);
+        DexStringId* pOut = (DexStringId*) (out + pHeader->stringIdsOff) + i;
+        pOut->stringDataOff =
+            findItem(&pLayout->stringData, pStringId->stringDataOff)->newOff;
+    }
+
+    writeSection(pLayout, &pLayout->codeItems, out);
+
+    u4 classDataEnd = (newMapOff != pHeader->mapOff) ?
+        newMapOff : pClassData->end;
+    memset(out + pClassData->start, 0, classDataEnd - pClassData->start);
+    memcpy(out + pClassData->start, classDataBuf, classDataLen);
+    free(classDataBuf);
+
+    if (newMapOff != pHeader->mapOff) {
+        memcpy(out + newMapOff, pLayout->orig + pHeader->mapOff, mapSize);
+
+        DexHeader* pOutHeader = (DexHeader*) out;
+        pOutHeader->dataSize += newLen - pLayout->origLen;
+        pOutHeader->fileSize = newLen;
+        pOutHeader->mapOff = newMapOff;
+
+        DexMapList* pOutMap = (DexMapList*) (out + newMapOff);
+        for (u4 i = 0; i < pOutMap->size; i++) {
+            if (pOutMap->list[i].type == kDexTypeMapList)
+                pOutMap->list[i].offset = newMapOff;
+        }
+    }
+
+    /* the signature covers what follows it; the checksum, what follows it */
+    DexHeader* pOutHeader = (DexHeader*) out;
+    const size_t sigStart = offsetof(DexHeader, signature) + kSHA1DigestLen;
+    SHA1_CTX context;
+    SHA1Init(&context);
+    SHA1Update(&context, out + sigStart, newLen - sigStart);
+    SHA1Final(pOutHeader->signature, &context);
+
+    const size_t sumStart = offsetof(DexHeader, signature);
+    set4LE((u1*) &pOutHeader->checksum,
+        dexAdler32(kDexAdler32Init, out + sumStart, newLen - sumStart));
+
+    *pLen = newLen;
+    return out;
+}
+
+/*
+ * Report how the startup data is spread before and after.
+ */
+static void reportSpan(const char* what, const LayoutSection* pSection)
+{
+    u4 oldLow = UINT_MAX, oldHigh = 0, newHigh = 0, count = 0;
+    for (u4 i = 0; i < pSection->count; i++) {
+        const LayoutItem* pItem = &pSection->items[i];
+        if (!pItem->startup)
+            continue;
+        count++;
+        oldLow = (pItem->oldOff < oldLow) ? pItem->oldOff : oldLow;
+        if (pItem->oldOff + pItem->size > oldHigh)
+            oldHigh = pItem->oldOff + pItem->size;
+        if (pItem->newOff + pItem->size > newHigh)
+            newHigh = pItem->newOff + pItem->size;
+    }
+    if (count == 0)
+        return;
+    printf("%-12s %6u of %6u startup, span %8u -> %8u bytes\n", what,
+        count, pSection->count, oldHigh - oldLow, newHigh - pSection->start);
+}
+
+/*
+ * Process one file.
+ */
+static int process(const char* inName)
+{
+    Layout layout;
+    memset(&layout, 0, sizeof(layout));
+    int result = 1;
+    u1* out = NULL;
+    size_t outLen = 0;
+    u1* check = NULL;
+    FILE* fp = NULL;
+
+    if (!loadProfile(&layout, gOptions.profileName))
+        return 1;
+
+    fp = fopen(inName, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: unable to open '%s': %s\n", gProgName, inName,
+            strerror(errno));
+        goto bail;
+    }
+    {
+        struct stat sb;
+        if (fstat(fileno(fp), &sb) != 0 || sb.st_size < (off_t) sizeof(DexHeader)) {
+            fprintf(stderr, "%s: '%s' is too short\n", gProgName, inName);
+            goto bail;
+        }
+        layout.origLen = sb.st_size;
+        u1* data = (u1*) malloc(layout.origLen);
+        layout.orig = data;
+        if (fread(data, 1, layout.origLen, fp) != layout.origLen) {
+            fprintf(stderr, "%s: unable to read '%s'\n", gProgName, inName);
+            goto bail;
+        }
+        if (!dexHasValidMagic((const DexHeader*) data)) {
+            fprintf(stderr, "%s: '%s' is not a DEX file (optimized DEX "
+                "files can't be rearranged)\n", gProgName, inName);
+            goto bail;
+        }
+        if (dexSwapAndVerify(data, layout.origLen) != 0) {
+            fprintf(stderr, "%s: '%s' failed verification\n", gProgName,
+                inName);
+            goto bail;
+        }
+    }
+    fclose(fp);
+    fp = NULL;
+
+    layout.pDexFile = dexFileParse(layout.orig, layout.origLen,
+        kDexParseVerifyChecksum);
+    if (layout.pDexFile == NULL)
+        goto bail;
+
+    if (!loadSection(&layout, kDexTypeCodeItem, 4, &layout.codeItems) ||
+        !loadSection(&layout, kDexTypeClassDataItem, 1, &layout.classData) ||
+        !loadSection(&layout, kDexTypeStringDataItem, 1, &layout.stringData))
+    {
+        fprintf(stderr, "%s: unexpected section layout in '%s'\n", gProgName,
+            inName);
+        goto bail;
+    }
+    layout.stringPlaced = (bool*) calloc(
+        layout.pDexFile->pHeader->stringIdsSize, sizeof(bool));
+
+    orderClasses(&layout);
+    orderItems(&layout);
+    if (gOptions.verbose) {
+        printf("%-12s %6u of %6u startup\n", "classes", layout.numStartup,
+            layout.pDexFile->pHeader->classDefsSize);
+        reportSpan("class_data", &layout.classData);
+        reportSpan("code", &layout.codeItems);
+        reportSpan("strings", &layout.stringData);
+    }
+
+    out = buildOutput(&layout, &outLen);
+    if (out == NULL)
+        goto bail;
+
+    /* make sure what we wrote still holds together */
+    check = (u1*) malloc(outLen);
+    memcpy(check, out, outLen);
+    if (dexSwapAndVerify(check, outLen) != 0) {
+        fprintf(stderr, "%s: rearranged file failed verification\n",
+            gProgName);
+        goto bail;
+    }
+
+    fp = fopen(gOptions.outputName, "wb");
+    if (fp == NULL || fwrite(out, 1, outLen, fp) != outLen) {
+        fprintf(stderr, "%s: unable to write '%s': %s\n", gProgName,
+            gOptions.outputName, strerror(errno));
+        goto bail;
+    }
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        fprintf(stderr, "%s: unable to write '%s': %s\n", gProgName,
+            gOptions.outputName, strerror(errno));
+        goto bail;
+    }
+    fp = NULL;
+    result = 0;
+
+bail:
+    if (fp != NULL)
+        fclose(fp);
+    free(check);
+    free(out);
+    if (layout.pDexFile != NULL)
+        dexFileFree(layout.pDexFile);
+    free((void*) layout.orig);
+    free(layout.codeItems.items);
+    free(layout.classData.items);
+    free(layout.stringData.items);
+    free(layout.stringPlaced);
+    free(layout.classOrder);
+    free(layout.classRank);
+    for (int i = 0; i < layout.profileCount; i++)
+        free(layout.profile[i].descriptor);
+    free(layout.profile);
+    return result;
+}
+
+/*
+ * Show usage.
+ */
+static void usage()
+{
+    fprintf(stderr, "Copyright (C) 2012 The Android Open Source Project\n\n");
+    fprintf(stderr,
+        "%s: [-v] -p profile -o out.dex in.dex\n", gProgName);
+    fprintf(stderr, "\n");
+    fprintf(stderr,
+        " -p : startup classes, one per line, or PRELOAD log lines\n");
+    fprintf(stderr, " -o : output file\n");
+    fprintf(stderr, " -v : report what moved\n");
+}
+
+/*
+ * Parse args.
+ */
+int main(int argc, char* const argv[])
+{
+    bool wantUsage = false;
+    int ic;
+
+    memset(&gOptions, 0, sizeof(gOptions));
+
+    while (1) {
+        ic = getopt(argc, argv, "p:o:v");
+        if (ic < 0)
+            break;
+
+        switch (ic) {
+        case 'p':
+            gOptions.profileName = optarg;
+            break;
+        case 'o':
+            gOptions.outputName = optarg;
+            break;
+        case 'v':
+            gOptions.verbose = true;
+            break;
+        default:
+            wantUsage = true;
+            break;
+        }
+    }
+
+    if (optind != argc - 1 || gOptions.profileName == NULL ||
+        gOptions.outputName == NULL)
+    {
+        wantUsage = true;
+    }
+
+    if (wantUsage) {
+        usage();
+        return 2;
+    }
+
+    return process(argv[optind]);
+}
@@ -29,6 +29,10 @@
  * (3) On the host during a build for preoptimization. This behaves
  *     almost the same as (2), except it takes file names instead of
  *     file descriptors.
+ * (4) Also on the host, with a list of files to preoptimize.  This does
+ *     the same thing as (3) for each of them, but starts the VM and
+ *     loads the bootstrap classes only once for all of the entries that
+ *     aren't themselves on the bootstrap class path.
  *
  * There are some fragile aspects around bootclasspath entries, owing
  * largely to the VM's history of working on whenever it thought it needed
@@ -41,31 +45,33 @@
 #include "cutils/log.h"
 #include "cutils/process_name.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 static const char* kClassesDex = "classes.dex";
 
 
 /*
  * Extract "classes.dex" from zipFd into "cacheFd", leaving a little space
- * up front for the DEX optimization header.
+ * up front for the DEX optimization header.  On success, the offset of the
+ * DEX data and the zip entry it came from are returned through the next
+ * two arguments, and "*pChecksumOk" says whether the DEX checksum was
+ * verified on the way.
  */
-static int extractAndProcessZip(int zipFd, int cacheFd,
-    const char* debugFileName, bool isBootstrap, const char* bootClassPath,
-    const char* dexoptFlagStr)
+static int extractZip(int zipFd, int cacheFd, const char* debugFileName,
+    off_t* pDexOffset, ZipEntry* pZipEntry, bool* pChecksumOk)
 {
     ZipArchiveHandle zippy;
-    ZipEntry zipEntry;
     off_t dexOffset;
     int err;
     int result = -1;
-    int dexoptFlags = 0;        /* bit flags, from enum DexoptFlags */
-    DexClassVerifyMode verifyMode = VERIFY_MODE_ALL;
-    DexOptimizerMode dexOptMode = OPTIMIZE_MODE_VERIFIED;
 
     /* make sure we're still at the start of an empty file */
     if (lseek(cacheFd, 0, SEEK_END) != 0) {
@@ -94,7 +100,7 @@ static int extractAndProcessZip(int zipFd, int cacheFd,
         goto bail;
     }
 
-    if (dexZipFindEntry(zippy, kClassesDex, &zipEntry) != 0) {
+    if (dexZipFindEntry(zippy, kClassesDex, pZipEntry) != 0) {
         ALOGW("DexOptZ: zip archive '%s' does not include %s",
             debugFileName, kClassesDex);
         goto bail;
@@ -103,53 +109,105 @@ static int extractAndProcessZip(int zipFd, int cacheFd,
     /*
      * Extract the DEX data into the cache file at the current offset.
      */
-    if (dexZipExtractEntryToFile(zippy, &zipEntry, cacheFd) != 0) {
+    if (dexZipExtractDexToFile(zippy, pZipEntry, cacheFd, dexOffset,
+            pChecksumOk) != 0)
+    {
         ALOGW("DexOptZ: extraction of %s from %s failed",
             kClassesDex, debugFileName);
         goto bail;
     }
 
-    /* Parse the options. */
-    if (dexoptFlagStr[0] != '\0') {
-        const char* opc;
-        const char* val;
+    *pDexOffset = dexOffset;
+    result = 0;
 
-        opc = strstr(dexoptFlagStr, "v=");      /* verification */
-        if (opc != NULL) {
-            switch (*(opc+2)) {
-            case 'n':   verifyMode = VERIFY_MODE_NONE;          break;
-            case 'r':   verifyMode = VERIFY_MODE_REMOTE;        break;
-            case 'a':   verifyMode = VERIFY_MODE_ALL;           break;
-            default:                                            break;
-            }
+bail:
+    dexZipCloseArchive(zippy);
+    return result;
+}
+
+/*
+ * Parse the dexopt flags string ("v=a,o=v,m=y,u=n" and so on).  Anything
+ * not mentioned keeps the value it came in with.
+ */
+static void parseDexoptFlags(const char* dexoptFlagStr,
+    DexClassVerifyMode* pVerifyMode, DexOptimizerMode* pDexOptMode,
+    int* pDexoptFlags)
+{
+    const char* opc;
+
+    if (dexoptFlagStr[0] == '\0')
+        return;
+
+    opc = strstr(dexoptFlagStr, "v=");      /* verification */
+    if (opc != NULL) {
+        switch (*(opc+2)) {
+        case 'n':   *pVerifyMode = VERIFY_MODE_NONE;        break;
+        case 'r':   *pVerifyMode = VERIFY_MODE_REMOTE;      break;
+        case 'a':   *pVerifyMode = VERIFY_MODE_ALL;         break;
+        default:                                            break;
         }
+    }
 
-        opc = strstr(dexoptFlagStr, "o=");      /* optimization */
-        if (opc != NULL) {
-            switch (*(opc+2)) {
-            case 'n':   dexOptMode = OPTIMIZE_MODE_NONE;        break;
-            case 'v':   dexOptMode = OPTIMIZE_MODE_VERIFIED;    break;
-            case 'a':   dexOptMode = OPTIMIZE_MODE_ALL;         break;
-            case 'f':   dexOptMode = OPTIMIZE_MODE_FULL;        break;
-            default:                                            break;
-            }
+    opc = strstr(dexoptFlagStr, "o=");      /* optimization */
+    if (opc != NULL) {
+        switch (*(opc+2)) {
+        case 'n':   *pDexOptMode = OPTIMIZE_MODE_NONE;      break;
+        case 'v':   *pDexOptMode = OPTIMIZE_MODE_VERIFIED;  break;
+        case 'a':   *pDexOptMode = OPTIMIZE_MODE_ALL;       break;
+        case 'f':   *pDexOptMode = OPTIMIZE_MODE_FULL;      break;
+        default:                                            break;
         }
+    }
 
-        opc = strstr(dexoptFlagStr, "m=y");     /* register map */
-        if (opc != NULL) {
-            dexoptFlags |= DEXOPT_GEN_REGISTER_MAPS;
+    opc = strstr(dexoptFlagStr, "m=");      /* register map */
+    if (opc != NULL) {
+        switch (*(opc+2)) {
+        case 'y':   *pDexoptFlags |= DEXOPT_GEN_REGISTER_MAPS;  break;
+        case 'l':   *pDexoptFlags |= DEXOPT_GEN_REGISTER_MAPS |
+                                     DEXOPT_LIVE_REGISTER_MAPS; break;
+        default:                                                break;
         }
+    }
 
-        opc = strstr(dexoptFlagStr, "u=");      /* uniprocessor target */
-        if (opc != NULL) {
-            switch (*(opc+2)) {
-            case 'y':   dexoptFlags |= DEXOPT_UNIPROCESSOR;     break;
-            case 'n':   dexoptFlags |= DEXOPT_SMP;              break;
-            default:                                            break;
-            }
+    opc = strstr(dexoptFlagStr, "u=");      /* uniprocessor target */
+    if (opc != NULL) {
+        switch (*(opc+2)) {
+        case 'y':   *pDexoptFlags |= DEXOPT_UNIPROCESSOR;   break;
+        case 'n':   *pDexoptFlags |= DEXOPT_SMP;            break;
+        default:                                            break;
         }
     }
 
+    opc = strstr(dexoptFlagStr, "p=n");     /* no parallel verify/opt */
+    if (opc != NULL) {
+        *pDexoptFlags |= DEXOPT_SERIAL;
+    }
+}
+
+/*
+ * Extract the DEX from zipFd into cacheFd, start the VM, and optimize.
+ */
+static int extractAndProcessZip(int zipFd, int cacheFd,
+    const char* debugFileName, bool isBootstrap, const char* bootClassPath,
+    const char* dexoptFlagStr)
+{
+    ZipEntry zipEntry;
+    off_t dexOffset;
+    bool checksumOk;
+    int dexoptFlags = 0;        /* bit flags, from enum DexoptFlags */
+    DexClassVerifyMode verifyMode = VERIFY_MODE_ALL;
+    DexOptimizerMode dexOptMode = OPTIMIZE_MODE_VERIFIED;
+
+    if (extractZip(zipFd, cacheFd, debugFileName, &dexOffset, &zipEntry,
+            &checksumOk) != 0)
+    {
+        return -1;
+    }
+
+    parseDexoptFlags(dexoptFlagStr, &verifyMode, &dexOptMode, &dexoptFlags);
+    if (checksumOk)
+        dexoptFlags |= DEXOPT_CHECKSUM_OK;
+
     /*
      * Prep the VM and perform the optimization.
      */
@@ -158,27 +216,21 @@ static int extractAndProcessZip(int zipFd, int cacheFd,
             dexoptFlags) != 0)
     {
         ALOGE("DexOptZ: VM init failed");
-        goto bail;
+        return -1;
     }
 
-    //vmStarted = 1;
-
     /* do the optimization */
     if (!dvmContinueOptimization(cacheFd, dexOffset,
             zipEntry.uncompressed_length, debugFileName,
-            zipEntry.mod_time, zipEntry.crc32, isBootstrap))
+            zipEntry.mod_time, zipEntry.crc32, isBootstrap, NULL))
     {
         ALOGE("Optimization failed");
-        goto bail;
+        return -1;
     }
 
     /* we don't shut the VM down -- process is about to exit */
 
-    result = 0;
-
-bail:
-    dexZipCloseArchive(zippy);
-    return result;
+    return 0;
 }
 
 /*
@@ -366,6 +418,326 @@ bail:
     return result;
 }
 
+/* one line of a --preopt-batch list */
+struct BatchEntry {
+    char*   zipName;
+    char*   outName;
+    bool    isBootstrap;
+    pid_t   pid;            /* worker optimizing it, or 0 */
+};
+
+/*
+ * Read a --preopt-batch list: one "<zipfile> <output file>" pair per
+ * line.  Blank lines and lines starting with '#' are ignored.  Returns
+ * the number of entries, or -1 on failure.
+ */
+static int readBatchList(const char* listName, BatchEntry** pEntries)
+{
+    FILE* fp = (strcmp(listName, "-") == 0) ? stdin : fopen(listName, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open '%s': %s\n", listName,
+                strerror(errno));
+        return -1;
+    }
+
+    BatchEntry* entries = NULL;
+    int count = 0, alloc = 0;
+    char line[PATH_MAX * 2 + 2];
+    int result = -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char* savePtr;
+        char* zipName = strtok_r(line, " \t\r\n", &savePtr);
+        if (zipName == NULL || zipName[0] == '#')
+            continue;
+        char* outName = strtok_r(NULL, " \t\r\n", &savePtr);
+        if (outName == NULL || strtok_r(NULL, " \t\r\n", &savePtr) != NULL) {
+            fprintf(stderr, "Bad line in '%s' for '%s'\n", listName, zipName);
+            goto bail;
+        }
+
+        if (count == alloc) {
+            alloc = (alloc == 0) ? 64 : alloc * 2;
+            entries = (BatchEntry*) realloc(entries,
+                alloc * sizeof(BatchEntry));
+        }
+        entries[count].zipName = strdup(zipName);
+        entries[count].outName = strdup(outName);
+        entries[count].isBootstrap = false;
+        entries[count].pid = 0;
+        count++;
+    }
+
+    result = count;
+
+bail:
+    if (fp != stdin)
+        fclose(fp);
+    if (result < 0) {
+        for (int i = 0; i < count; i++) {
+            free(entries[i].zipName);
+            free(entries[i].outName);
+        }
+        free(entries);
+    } else {
+        *pEntries = entries;
+    }
+    return result;
+}
+
+/*
+ * Open the input and output files for one batch entry and optimize it in
+ * the VM that this process has already started.
+ */
+static int preoptBatchEntry(const BatchEntry* pEntry)
+{
+    int zipFd = -1;
+    int outFd = -1;
+    int result = -1;
+    ZipEntry zipEntry;
+    off_t dexOffset;
+    bool checksumOk;
+
+    zipFd = open(pEntry->zipName, O_RDONLY);
+    if (zipFd < 0) {
+        fprintf(stderr, "Unable to open '%s': %s\n", pEntry->zipName,
+                strerror(errno));
+        goto bail;
+    }
+
+    outFd = open(pEntry->outName, O_RDWR | O_EXCL | O_CREAT, 0666);
+    if (outFd < 0) {
+        fprintf(stderr, "Unable to create '%s': %s\n", pEntry->outName,
+                strerror(errno));
+        goto bail;
+    }
+
+    if (extractZip(zipFd, outFd, pEntry->zipName, &dexOffset, &zipEntry,
+            &checksumOk) != 0)
+    {
+        goto bail;
+    }
+
+    /* this process only ever optimizes this one file */
+    gDvm.dexOptChecksumOk = checksumOk;
+
+    if (!dvmContinueOptimization(outFd, dexOffset,
+            zipEntry.uncompressed_length, pEntry->zipName,
+            zipEntry.mod_time, zipEntry.crc32, false, NULL))
+    {
+        ALOGE("Optimization failed");
+        goto bail;
+    }
+
+    result = 0;
+
+bail:
+    if (zipFd >= 0)
+        close(zipFd);
+    if (outFd >= 0)
+        close(outFd);
+    return result;
+}
+
+/*
+ * Wait for one batch worker to finish.  Returns the index of its entry,
+ * and whether it succeeded in "*pOk", or -1 if there are none left.
+ */
+static int waitForBatchWorker(BatchEntry* entries, int count, bool* pOk)
+{
+    int status;
+    pid_t pid;
+
+    do {
+        pid = waitpid(-1, &status, 0);
+    } while (pid < 0 && errno == EINTR);
+    if (pid < 0)
+        return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].pid == pid) {
+            entries[i].pid = 0;
+            *pOk = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            return i;
+        }
+    }
+    *pOk = false;
+    return -1;
+}
+
+/*
+ * Parse arguments for a batch preoptimization run, which optimizes a list
+ * of zip files with the same flags.  We want:
+ *   0. (name of dexopt command -- ignored)
+ *   1. "--preopt-batch"
+ *   2. name of the list file, or "-" for stdin
+ *   3. dexopt flags
+ *   4. (optional) number of files to optimize at once; default 1
+ *
+ * Every --preopt run starts a VM and loads much the same bootstrap classes
+ * before it gets to the one file it was asked to do.  Here the entries
+ * that aren't on the bootstrap class path share one VM: it is started
+ * once, all of the bootstrap classes are loaded, and then a worker is
+ * forked for each file, up to the requested number at a time.  A worker
+ * is thrown away afterward, because the classes it loaded from its file
+ * point into a mapping it has released.
+ *
+ * Entries that are on the bootstrap class path each need the path cut
+ * off in front of them, and each depends on the output for the ones
+ * before it, so those are done first, one at a time, each in a worker
+ * with a VM of its own, in the order they appear in the list.
+ */
+static int preoptBatch(int argc, char* const argv[])
+{
+    BatchEntry* entries = NULL;
+    int count, maxJobs = 1;
+    int running = 0, failures = 0;
+    int dexoptFlags = 0;
+    DexClassVerifyMode verifyMode = VERIFY_MODE_ALL;
+    DexOptimizerMode dexOptMode = OPTIMIZE_MODE_VERIFIED;
+    bool vmStarted = false;
+
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "Wrong number of args for --preopt-batch (found %d)\n",
+                argc);
+        return -1;
+    }
+
+    const char* listName = argv[2];
+    const char* dexoptFlagStr = argv[3];
+    if (argc == 5) {
+        char* endp;
+        maxJobs = strtol(argv[4], &endp, 10);
+        if (*endp != '\0' || maxJobs < 1) {
+            fprintf(stderr, "Bad job count '%s'\n", argv[4]);
+            return -1;
+        }
+    }
+
+    if (strstr(dexoptFlagStr, "u=y") == NULL &&
+        strstr(dexoptFlagStr, "u=n") == NULL)
+    {
+        fprintf(stderr, "Either 'u=y' or 'u=n' must be specified\n");
+        return -1;
+    }
+
+    const char* bcp = getenv("BOOTCLASSPATH");
+    if (bcp == NULL) {
+        fprintf(stderr, "BOOTCLASSPATH not set\n");
+        return -1;
+    }
+
+    count = readBatchList(listName, &entries);
+    if (count < 0)
+        return -1;
+
+    /* same test processZipFile() makes */
+    for (int i = 0; i < count; i++)
+        entries[i].isBootstrap = (strstr(bcp, entries[i].zipName) != NULL);
+
+    /*
+     * Bootstrap entries, serially.  The worker goes through the same
+     * path as --preopt.
+     */
+    for (int i = 0; i < count; i++) {
+        if (!entries[i].isBootstrap)
+            continue;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            char* childArgv[] = { argv[0], (char*) "--preopt",
+                entries[i].zipName, entries[i].outName,
+                (char*) dexoptFlagStr, NULL };
+            _exit(preopt(5, childArgv) == 0 ? 0 : 1);
+        } else if (pid < 0) {
+            fprintf(stderr, "fork failed: %s\n", strerror(errno));
+            failures++;
+            continue;
+        }
+
+        entries[i].pid = pid;
+        bool ok;
+        if (waitForBatchWorker(entries, count, &ok) != i || !ok) {
+            fprintf(stderr, "Failed to optimize '%s'\n", entries[i].zipName);
+            failures++;
+        }
+    }
+
+    /*
+     * Everything else, sharing one VM started against the whole
+     * bootstrap class path.
+     */
+    parseDexoptFlags(dexoptFlagStr, &verifyMode, &dexOptMode, &dexoptFlags);
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].isBootstrap)
+            continue;
+
+        if (!vmStarted) {
+            if (dvmPrepForDexOpt(bcp, dexOptMode, verifyMode,
+                    dexoptFlags) != 0 || !dvmPreloadForDexOpt())
+            {
+                fprintf(stderr, "VM init failed\n");
+                failures++;
+                break;
+            }
+            vmStarted = true;
+        }
+
+        while (running >= maxJobs) {
+            bool ok;
+            int done = waitForBatchWorker(entries, count, &ok);
+            if (done < 0)
+                break;
+            running--;
+            if (!ok) {
+                fprintf(stderr, "Failed to optimize '%s'\n",
+                        entries[done].zipName);
+                failures++;
+            }
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(preoptBatchEntry(&entries[i]) == 0 ? 0 : 1);
+        } else if (pid < 0) {
+            fprintf(stderr, "fork failed: %s\n", strerror(errno));
+            failures++;
+            continue;
+        }
+        entries[i].pid = pid;
+        running++;
+    }
+
+    while (running > 0) {
+        bool ok;
+        int done = waitForBatchWorker(entries, count, &ok);
+        if (done < 0)
+            break;
+        running--;
+        if (!ok) {
+            fprintf(stderr, "Failed to optimize '%s'\n",
+                    entries[done].zipName);
+            failures++;
+        }
+    }
+
+    /* as with the single-file modes, the VM is not shut down */
+
+    for (int i = 0; i < count; i++) {
+        free(entries[i].zipName);
+        free(entries[i].outName);
+    }
+    free(entries);
+
+    if (failures != 0) {
+        fprintf(stderr, "%d of %d files failed to optimize\n", failures,
+                count);
+        return -1;
+    }
+    return 0;
+}
+
 /*
  * Parse arguments for an "old-style" invocation directly from the VM.
  *
@@ -380,8 +752,9 @@ bail:
  *   7. modification date of source (goes into dependency section)
  *   8. CRC of source (goes into dependency section)
  *   9. flags (optimization level, isBootstrap)
- *  10. bootclasspath entry #1
- *  11. bootclasspath entry #2
+ *  10. verification records of an earlier version of the output, or ""
+ *  11. bootclasspath entry #1
+ *  12. bootclasspath entry #2
  *   ...
  *
  * dvmOptimizeDexFile() in dalvik/vm/analysis/DexOptimize.c builds the
@@ -403,13 +776,14 @@ static int fromDex(int argc, char* const argv[])
     int fd, flags, vmBuildVersion;
     long offset, length;
     const char* debugFileName;
+    const char* recordsFileName;
     u4 crc, modWhen;
     char* endp;
     bool onlyOptVerifiedDex = false;
     DexClassVerifyMode verifyMode;
     DexOptimizerMode dexOptMode;
 
-    if (argc < 10) {
+    if (argc < 11) {
         /* don't have all mandatory args */
         ALOGE("Not enough arguments for --dex (found %d)", argc);
         goto bail;
@@ -436,6 +810,8 @@ static int fromDex(int argc, char* const argv[])
     GET_ARG(modWhen, strtoul, "bad modWhen");
     GET_ARG(crc, strtoul, "bad crc");
     GET_ARG(flags, strtol, "bad flags");
+    recordsFileName = *++argv;
+    --argc;
 
     ALOGV("Args: fd=%d off=%ld len=%ld name='%s' mod=%#x crc=%#x flg=%d (argc=%d)",
         fd, offset, length, debugFileName, modWhen, crc, flags, argc);
@@ -501,7 +877,8 @@ static int fromDex(int argc, char* const argv[])
 
     /* do the optimization */
     if (!dvmContinueOptimization(fd, offset, length, debugFileName,
-            modWhen, crc, (flags & DEXOPT_IS_BOOTSTRAP) != 0))
+            modWhen, crc, (flags & DEXOPT_IS_BOOTSTRAP) != 0,
+            recordsFileName))
     {
         ALOGE("Optimization failed");
         goto bail;
@@ -549,6 +926,8 @@ int main(int argc, char* const argv[])
             return fromDex(argc, argv);
         else if (strcmp(argv[1], "--preopt") == 0)
             return preopt(argc, argv);
+        else if (strcmp(argv[1], "--preopt-batch") == 0)
+            return preoptBatch(argc, argv);
     }
 
     fprintf(stderr,
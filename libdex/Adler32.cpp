@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vectorized Adler-32.
+ *
+ * Over a block of n bytes b[0..n-1], s1 grows by the sum of the bytes
+ * and s2 grows by n*s1 (the value on entry) plus the sum of (n-i)*b[i].
+ * Both sums are taken across vector lanes, with a third accumulator
+ * ("ps") holding the running s1 at the start of each block so the n*s1
+ * term can be applied with a shift at the end.  As in zlib, the modulo
+ * is deferred until just before s2 could overflow.
+ */
+
+#include "Adler32.h"
+
+#include <zlib.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__SSSE3__)
+
+/* largest prime smaller than 65536 */
+static const u4 kBase = 65521;
+/* largest n such that 255n(n+1)/2 + (n+1)(kBase-1) <= 2^32-1 */
+static const u4 kNmax = 5552;
+
+#if defined(__ARM_NEON__)
+static const size_t kBlockSize = 16;
+#define kBlockShift 4
+#else
+static const size_t kBlockSize = 32;
+#define kBlockShift 5
+#endif
+
+/*
+ * Sum as many whole blocks as there are at "*pBuf", advancing the
+ * pointer and length past them.
+ */
+static void adler32Blocks(u4* pS1, u4* pS2, const u1** pBuf, size_t* pLen)
+{
+    const u1* buf = *pBuf;
+    size_t blocks = *pLen / kBlockSize;
+    u4 s1 = *pS1;
+    u4 s2 = *pS2;
+
+    *pLen -= blocks * kBlockSize;
+
+#if defined(__ARM_NEON__)
+    static const u1 kTaps[16] = {
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    };
+    const uint8x8_t tapsLo = vld1_u8(kTaps);
+    const uint8x8_t tapsHi = vld1_u8(kTaps + 8);
+#else
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                       24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                       8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+#endif
+
+    while (blocks != 0) {
+        size_t n = kNmax / kBlockSize;
+        if (n > blocks)
+            n = blocks;
+        blocks -= n;
+
+#if defined(__ARM_NEON__)
+        uint32x4_t vps = vsetq_lane_u32(s1 * n, vdupq_n_u32(0), 0);
+        uint32x4_t vs1 = vdupq_n_u32(0);
+        uint32x4_t vs2 = vsetq_lane_u32(s2, vdupq_n_u32(0), 0);
+
+        do {
+            const uint8x16_t bytes = vld1q_u8(buf);
+            vps = vaddq_u32(vps, vs1);
+            vs1 = vpadalq_u16(vs1, vpaddlq_u8(bytes));
+            uint16x8_t prod = vmull_u8(vget_low_u8(bytes), tapsLo);
+            prod = vmlal_u8(prod, vget_high_u8(bytes), tapsHi);
+            vs2 = vpadalq_u16(vs2, prod);
+            buf += kBlockSize;
+        } while (--n != 0);
+
+        vs2 = vaddq_u32(vs2, vshlq_n_u32(vps, kBlockShift));
+
+        s1 += vgetq_lane_u32(vs1, 0) + vgetq_lane_u32(vs1, 1) +
+              vgetq_lane_u32(vs1, 2) + vgetq_lane_u32(vs1, 3);
+        s2 = vgetq_lane_u32(vs2, 0) + vgetq_lane_u32(vs2, 1) +
+             vgetq_lane_u32(vs2, 2) + vgetq_lane_u32(vs2, 3);
+#else
+        __m128i vps = _mm_set_epi32(0, 0, 0, (int) (s1 * n));
+        __m128i vs1 = _mm_setzero_si128();
+        __m128i vs2 = _mm_set_epi32(0, 0, 0, (int) s2);
+
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i*) buf);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i*) (buf + 16));
+            vps = _mm_add_epi32(vps, vs1);
+            vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes1, zero));
+            vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes2, zero));
+            vs2 = _mm_add_epi32(vs2,
+                _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            vs2 = _mm_add_epi32(vs2,
+                _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            buf += kBlockSize;
+        } while (--n != 0);
+
+        vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(vps, kBlockShift));
+
+        /* reduce the four lanes of each */
+        vs1 = _mm_add_epi32(vs1, _mm_shuffle_epi32(vs1, _MM_SHUFFLE(2,3,0,1)));
+        vs1 = _mm_add_epi32(vs1, _mm_shuffle_epi32(vs1, _MM_SHUFFLE(1,0,3,2)));
+        s1 += _mm_cvtsi128_si32(vs1);
+        vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, _MM_SHUFFLE(2,3,0,1)));
+        vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, _MM_SHUFFLE(1,0,3,2)));
+        s2 = _mm_cvtsi128_si32(vs2);
+#endif
+
+        s1 %= kBase;
+        s2 %= kBase;
+    }
+
+    *pS1 = s1;
+    *pS2 = s2;
+    *pBuf = buf;
+}
+
+u4 dexAdler32(u4 adler, const u1* buf, size_t len)
+{
+    u4 s1 = adler & 0xffff;
+    u4 s2 = adler >> 16;
+
+    /* not worth setting up the vectors for short runs */
+    if (len < 4 * kBlockSize)
+        return (u4) adler32(adler, buf, len);
+
+    adler32Blocks(&s1, &s2, &buf, &len);
+
+    /* zlib finishes off the tail */
+    return (u4) adler32((s2 << 16) | s1, buf, len);
+}
+
+#else
+
+u4 dexAdler32(u4 adler, const u1* buf, size_t len)
+{
+    return (u4) adler32(adler, buf, len);
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Adler-32 checksum, as used in the DEX and optimized DEX headers.
+ */
+
+#ifndef LIBDEX_ADLER32_H_
+#define LIBDEX_ADLER32_H_
+
+#include "DexFile.h"
+
+/*
+ * The initial value for a running checksum.
+ */
+#define kDexAdler32Init 1
+
+/*
+ * Update a running Adler-32 checksum with "len" bytes at "buf", and
+ * return the new value.  The result is identical to zlib's adler32();
+ * on CPUs with NEON or SSSE3 the bulk of the data is summed 16 or 32
+ * bytes at a time.
+ */
+u4 dexAdler32(u4 adler, const u1* buf, size_t len);
+
+#endif  // LIBDEX_ADLER32_H_
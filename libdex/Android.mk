@@ -15,6 +15,7 @@
 LOCAL_PATH:= $(call my-dir)
 
 dex_src_files := \
+	Adler32.cpp \
 	CmdUtils.cpp \
 	DexCatch.cpp \
 	DexClass.cpp \
@@ -32,6 +33,7 @@ dex_src_files := \
 	OptInvocation.cpp \
 	sha1.cpp \
 	SysUtil.cpp \
+	ZipArchive.cpp \
 
 dex_include_files := \
 	dalvik \
@@ -120,10 +120,13 @@ DEX_INLINE const DexCode* dexGetCode(const DexFile* pDexFile,
  * data. */
 DEX_INLINE void dexReadClassDataHeader(const u1** pData,
         DexClassDataHeader *pHeader) {
-    pHeader->staticFieldsSize = readUnsignedLeb128(pData);
-    pHeader->instanceFieldsSize = readUnsignedLeb128(pData);
-    pHeader->directMethodsSize = readUnsignedLeb128(pData);
-    pHeader->virtualMethodsSize = readUnsignedLeb128(pData);
+    u4 sizes[4];
+
+    readUnsignedLeb128Array(pData, sizes, 4);
+    pHeader->staticFieldsSize = sizes[0];
+    pHeader->instanceFieldsSize = sizes[1];
+    pHeader->directMethodsSize = sizes[2];
+    pHeader->virtualMethodsSize = sizes[3];
 }
 
 /* Read an encoded_field without verification. This updates the
@@ -135,9 +138,13 @@ DEX_INLINE void dexReadClassDataHeader(const u1** pData,
  */
 DEX_INLINE void dexReadClassDataField(const u1** pData, DexField* pField,
         u4* lastIndex) {
-    u4 index = *lastIndex + readUnsignedLeb128(pData);
+    u4 values[2];
+
+    readUnsignedLeb128Array(pData, values, 2);
+
+    u4 index = *lastIndex + values[0];
 
-    pField->accessFlags = readUnsignedLeb128(pData);
+    pField->accessFlags = values[1];
     pField->fieldIdx = index;
     *lastIndex = index;
 }
@@ -151,10 +158,14 @@ DEX_INLINE void dexReadClassDataField(const u1** pData, DexField* pField,
  */
 DEX_INLINE void dexReadClassDataMethod(const u1** pData, DexMethod* pMethod,
         u4* lastIndex) {
-    u4 index = *lastIndex + readUnsignedLeb128(pData);
+    u4 values[3];
+
+    readUnsignedLeb128Array(pData, values, 3);
+
+    u4 index = *lastIndex + values[0];
 
-    pMethod->accessFlags = readUnsignedLeb128(pData);
-    pMethod->codeOff = readUnsignedLeb128(pData);
+    pMethod->accessFlags = values[1];
+    pMethod->codeOff = values[2];
     pMethod->methodIdx = index;
     *lastIndex = index;
 }
@@ -25,32 +25,37 @@
 /*
  * Allocate and initialize a DexDataMap. Returns NULL on failure.
  */
-DexDataMap* dexDataMapAlloc(u4 maxCount) {
+DexDataMap* dexDataMapAlloc(u4 start, u4 end) {
     /*
      * Allocate a single chunk for the DexDataMap per se as well as the
-     * two arrays.
+     * bit vector.
      */
     size_t size = 0;
+    size_t bitWords;
     DexDataMap* map = NULL;
 
+    if (end < start) {
+        return NULL;
+    }
+    bitWords = ((size_t) (end - start) + 31) / 32;
+
     /*
      * Avoiding pulling in safe_iop for safe_iopf.
      */
-    if (!safe_mul(&size, maxCount, sizeof(u4) + sizeof(u2)) ||
+    if (!safe_mul(&size, bitWords, sizeof(u4)) ||
         !safe_add(&size, size, sizeof(DexDataMap))) {
       return NULL;
     }
 
-    map = (DexDataMap*) malloc(size);
+    map = (DexDataMap*) calloc(1, size);
 
     if (map == NULL) {
         return NULL;
     }
 
-    map->count = 0;
-    map->max = maxCount;
-    map->offsets = (u4*) (map + 1);
-    map->types = (u2*) (map->offsets + maxCount);
+    map->start = start;
+    map->end = end;
+    map->itemBits = (u4*) (map + 1);
 
     return map;
 }
@@ -73,17 +78,31 @@ void dexDataMapFree(DexDataMap* map) {
  */
 void dexDataMapAdd(DexDataMap* map, u4 offset, u2 type) {
     assert(map != NULL);
-    assert(map->count < map->max);
 
-    if ((map->count != 0) &&
-            (map->offsets[map->count - 1] >= offset)) {
+    if ((map->count != 0) && (map->lastOffset >= offset)) {
         ALOGE("Out-of-order data map offset: %#x then %#x",
-                map->offsets[map->count - 1], offset);
+                map->lastOffset, offset);
         return;
     }
 
-    map->offsets[map->count] = offset;
-    map->types[map->count] = type;
+    if ((offset < map->start) || (offset >= map->end)) {
+        ALOGE("Data map offset out of range: %#x", offset);
+        return;
+    }
+
+    if ((map->numRuns == 0) || (map->runTypes[map->numRuns - 1] != type)) {
+        if (map->numRuns == kDexDataMapMaxRuns) {
+            ALOGE("Too many data map runs; dropping %#x", offset);
+            return;
+        }
+        map->runStarts[map->numRuns] = offset;
+        map->runTypes[map->numRuns] = type;
+        map->numRuns++;
+    }
+
+    u4 bit = offset - map->start;
+    map->itemBits[bit >> 5] |= 1U << (bit & 31);
+    map->lastOffset = offset;
     map->count++;
 }
 
@@ -94,27 +113,22 @@ void dexDataMapAdd(DexDataMap* map, u4 offset, u2 type) {
 int dexDataMapGet(DexDataMap* map, u4 offset) {
     assert(map != NULL);
 
-    // Note: Signed type is important for max and min.
-    int min = 0;
-    int max = map->count - 1;
-    u4* offsets = map->offsets;
-
-    while (max >= min) {
-        int guessIdx = (min + max) >> 1;
-        u4 guess = offsets[guessIdx];
-
-        if (offset < guess) {
-            max = guessIdx - 1;
-        } else if (offset > guess) {
-            min = guessIdx + 1;
-        } else {
-            // We have a winner!
-            return map->types[guessIdx];
-        }
+    if ((offset < map->start) || (offset >= map->end)) {
+        return -1;
+    }
+
+    u4 bit = offset - map->start;
+    if ((map->itemBits[bit >> 5] & (1U << (bit & 31))) == 0) {
+        return -1;
+    }
+
+    /* find the last run that starts at or before the offset */
+    int idx = map->numRuns - 1;
+    while (map->runStarts[idx] > offset) {
+        idx--;
     }
 
-    // No match.
-    return -1;
+    return map->runTypes[idx];
 }
 
 /*
@@ -23,17 +23,32 @@
 
 #include "DexFile.h"
 
+/*
+ * The map records which offsets start a data item with one bit per byte
+ * of the covered range, rather than a list of offsets, so its size is
+ * bounded by the size of the data section instead of the number of items
+ * in it.  Items are added in increasing offset order one map section at
+ * a time, so the type of an item is that of the run of items it falls in;
+ * there is at most one run per data item type.
+ */
+#define kDexDataMapMaxRuns 32
+
 struct DexDataMap {
-    u4 count;    /* number of items currently in the map */
-    u4 max;      /* maximum number of items that may be held */
-    u4* offsets; /* array of item offsets */
-    u2* types;   /* corresponding array of item types */
+    u4 start;       /* file offset of the first byte covered */
+    u4 end;         /* file offset just past the last byte covered */
+    u4 count;       /* number of items currently in the map */
+    u4 lastOffset;  /* offset of the last item added */
+    u4 numRuns;     /* number of runs in runStarts[] / runTypes[] */
+    u4 runStarts[kDexDataMapMaxRuns];   /* offset of each run's first item */
+    u2 runTypes[kDexDataMapMaxRuns];    /* item type of each run */
+    u4* itemBits;   /* one bit per byte in [start, end) */
 };
 
 /*
- * Allocate and initialize a DexDataMap. Returns NULL on failure.
+ * Allocate and initialize a DexDataMap covering file offsets from "start"
+ * inclusive to "end" exclusive. Returns NULL on failure.
  */
-DexDataMap* dexDataMapAlloc(u4 maxCount);
+DexDataMap* dexDataMapAlloc(u4 start, u4 end);
 
 /*
  * Free a DexDataMap.
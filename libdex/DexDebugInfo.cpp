@@ -151,8 +151,10 @@ static void dexDecodeDebugInfo0(
 {
     DexProto proto = { pDexFile, protoIdx };
     u4 insnsSize = pCode->insnsSize;
-    u4 line = readUnsignedLeb128(&stream);
-    u4 parametersSize = readUnsignedLeb128(&stream);
+    u4 header[2];
+    readUnsignedLeb128Array(&stream, header, 2);
+    u4 line = header[0];
+    u4 parametersSize = header[1];
     u2 argReg = pCode->registersSize - pCode->insSize;
     u4 address = 0;
 
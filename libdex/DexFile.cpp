@@ -19,6 +19,7 @@
  */
 
 #include "DexFile.h"
+#include "Adler32.h"
 #include "DexOptData.h"
 #include "DexProto.h"
 #include "DexCatch.h"
@@ -26,7 +27,6 @@
 #include "sha1.h"
 #include "ZipArchive.h"
 
-#include <zlib.h>
 
 #include <stdlib.h>
 #include <stddef.h>
@@ -160,7 +160,7 @@ static const char* dexSHA1DigestToStr(const unsigned char digest[],char* tmpBuf)
  * The basic "multiply by 31 and add" approach does better on class names
  * than most other things tried (e.g. adler32).
  */
-static u4 classDescriptorHash(const char* str)
+u4 dexClassDescriptorHash(const char* str)
 {
     u4 hash = 1;
 
@@ -181,7 +181,7 @@ static void classLookupAdd(DexFile* pDexFile, DexClassLookup* pLookup,
         (const char*) (pDexFile->baseAddr + stringOff);
     const DexClassDef* pClassDef =
         (const DexClassDef*) (pDexFile->baseAddr + classDefOff);
-    u4 hash = classDescriptorHash(classDescriptor);
+    u4 hash = dexClassDescriptorHash(classDescriptor);
     int mask = pLookup->numEntries-1;
     int idx = hash & mask;
 
@@ -445,7 +445,7 @@ const DexClassDef* dexFindClass(const DexFile* pDexFile,
     u4 hash;
     int idx, mask;
 
-    hash = classDescriptorHash(descriptor);
+    hash = dexClassDescriptorHash(descriptor);
     mask = pLookup->numEntries - 1;
     idx = hash & mask;
 
@@ -481,10 +481,10 @@ u4 dexComputeChecksum(const DexHeader* pHeader)
 {
     const u1* start = (const u1*) pHeader;
 
-    uLong adler = adler32(0L, Z_NULL, 0);
     const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum);
 
-    return (u4) adler32(adler, start + nonSum, pHeader->fileSize - nonSum);
+    return dexAdler32(kDexAdler32Init, start + nonSum,
+        pHeader->fileSize - nonSum);
 }
 
 /*
@@ -189,6 +189,7 @@ enum {
 enum {
     kDexChunkClassLookup            = 0x434c4b50,   /* CLKP */
     kDexChunkRegisterMaps           = 0x524d4150,   /* RMAP */
+    kDexChunkVerifyRecords          = 0x56524543,   /* VREC */
 
     kDexChunkEnd                    = 0x41454e44,   /* AEND */
 };
@@ -489,8 +490,6 @@ struct DexOptHeader {
 
 #define DEX_OPT_FLAG_BIG            (1<<1)  /* swapped to big-endian */
 
-#define DEX_INTERFACE_CACHE_SIZE    128     /* must be power of 2 */
-
 /*
  * Structure representing a DEX file.
  *
@@ -524,8 +523,9 @@ struct DexFile {
     /* track memory overhead for auxillary structures */
     int                 overhead;
 
-    /* additional app-specific data structures associated with the DEX */
-    //void*               auxData;
+    /* additional app-specific data structures associated with the DEX;
+     * in the VM, the DvmDex */
+    void*               auxData;
 };
 
 /*
@@ -556,6 +556,12 @@ enum {
  */
 int dexSwapAndVerify(u1* addr, int len);
 
+/*
+ * Same as dexSwapAndVerify(), but skips the header checksum, for use when
+ * the caller computed it while extracting the data.
+ */
+int dexSwapAndVerifyChecksummed(u1* addr, int len);
+
 /*
  * Detect the file type of the given memory buffer via magic number.
  * Call dexSwapAndVerify() on an unoptimized DEX file, do nothing
@@ -583,6 +589,12 @@ u4 dexComputeChecksum(const DexHeader* pHeader);
  */
 void dexFileFree(DexFile* pDexFile);
 
+/*
+ * Compute the hash code used for class descriptors in the class lookup
+ * table.
+ */
+u4 dexClassDescriptorHash(const char* str);
+
 /*
  * Create class lookup table.
  */
@@ -92,8 +92,8 @@ static const char* gOpNames[kNumPackedOpcodes] = {
     "if-gez",
     "if-gtz",
     "if-lez",
-    "unused-3e",
-    "unused-3f",
+    "+iget-quick-if-eqz",
+    "+const/4-add-int",
     "unused-40",
     "unused-41",
     "unused-42",
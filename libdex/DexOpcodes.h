@@ -130,8 +130,8 @@ enum Opcode {
     OP_IF_GEZ                       = 0x3b,
     OP_IF_GTZ                       = 0x3c,
     OP_IF_LEZ                       = 0x3d,
-    OP_UNUSED_3E                    = 0x3e,
-    OP_UNUSED_3F                    = 0x3f,
+    OP_IGET_QUICK_IF_EQZ            = 0x3e,
+    OP_CONST_4_ADD_INT              = 0x3f,
     OP_UNUSED_40                    = 0x40,
     OP_UNUSED_41                    = 0x41,
     OP_UNUSED_42                    = 0x42,
@@ -396,8 +396,8 @@ enum Opcode {
         H(OP_IF_GEZ),                                                         \
         H(OP_IF_GTZ),                                                         \
         H(OP_IF_LEZ),                                                         \
-        H(OP_UNUSED_3E),                                                      \
-        H(OP_UNUSED_3F),                                                      \
+        H(OP_IGET_QUICK_IF_EQZ),                                              \
+        H(OP_CONST_4_ADD_INT),                                                \
         H(OP_UNUSED_40),                                                      \
         H(OP_UNUSED_41),                                                      \
         H(OP_UNUSED_42),                                                      \
@@ -616,6 +616,20 @@ DEX_INLINE Opcode dexOpcodeFromCodeUnit(u2 codeUnit) {
     }
 }
 
+/*
+ * Return the opcode that a superinstruction was rewritten from.  dexopt
+ * only replaces the opcode of the first instruction of a pair, so code
+ * that doesn't run the pair as a unit can treat it as the original
+ * first instruction, followed by the second one as usual.
+ */
+DEX_INLINE Opcode dexGetBaseOpcode(Opcode opcode) {
+    switch (opcode) {
+    case OP_IGET_QUICK_IF_EQZ:  return OP_IGET_QUICK;
+    case OP_CONST_4_ADD_INT:    return OP_CONST_4;
+    default:                    return opcode;
+    }
+}
+
 /*
  * Return the name of an opcode.
  */
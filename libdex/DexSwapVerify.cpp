@@ -28,6 +28,11 @@
 #include <safe_iop.h>
 #include <zlib.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
@@ -513,9 +518,10 @@ static bool swapMap(CheckState* state, DexMapList* pMap)
         return false;
     }
 
-    state->pDataMap = dexDataMapAlloc(dataItemCount);
+    state->pDataMap = dexDataMapAlloc(state->pHeader->dataOff,
+            state->fileLen);
     if (state->pDataMap == NULL) {
-        ALOGE("Unable to allocate data map (size %#x)", dataItemCount);
+        ALOGE("Unable to allocate data map (%d items)", dataItemCount);
         return false;
     }
 
@@ -2691,10 +2697,196 @@ static bool swapEverythingButHeaderAndMap(CheckState* state,
     return okay;
 }
 
+/*
+ * Perform cross-item verification on one section of the map.
+ */
+static bool crossVerifySection(CheckState* state, const DexMapItem* item)
+{
+    u4 sectionOffset = item->offset;
+    u4 sectionCount = item->size;
+    bool okay = true;
+
+    switch (item->type) {
+        case kDexTypeHeaderItem:
+        case kDexTypeMapList:
+        case kDexTypeTypeList:
+        case kDexTypeCodeItem:
+        case kDexTypeStringDataItem:
+        case kDexTypeDebugInfoItem:
+        case kDexTypeAnnotationItem:
+        case kDexTypeEncodedArrayItem: {
+            // There is no need for cross-item verification for these.
+            break;
+        }
+        case kDexTypeStringIdItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyStringIdItem, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeTypeIdItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyTypeIdItem, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeProtoIdItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyProtoIdItem, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeFieldIdItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyFieldIdItem, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeMethodIdItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyMethodIdItem, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeClassDefItem: {
+            // Allocate (on the stack) the "observed class_def" bits.
+            size_t arraySize = calcDefinedClassBitsSize(state);
+            u4 definedClassBits[arraySize];
+            memset(definedClassBits, 0, arraySize * sizeof(u4));
+            state->pDefinedClassBits = definedClassBits;
+
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyClassDefItem, sizeof(u4), NULL);
+
+            state->pDefinedClassBits = NULL;
+            break;
+        }
+        case kDexTypeAnnotationSetRefList: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyAnnotationSetRefList, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeAnnotationSetItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyAnnotationSetItem, sizeof(u4), NULL);
+            break;
+        }
+        case kDexTypeClassDataItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyClassDataItem, sizeof(u1), NULL);
+            break;
+        }
+        case kDexTypeAnnotationsDirectoryItem: {
+            okay = iterateSection(state, sectionOffset, sectionCount,
+                    crossVerifyAnnotationsDirectoryItem, sizeof(u4), NULL);
+            break;
+        }
+        default: {
+            ALOGE("Unknown map item type %04x", item->type);
+            okay = false;
+            break;
+        }
+    }
+
+    if (!okay) {
+        ALOGE("Cross-item verify of section type %04x failed", item->type);
+    }
+
+    return okay;
+}
+
+/*
+ * Sections with fewer items than this are always cross-verified on the
+ * calling thread.
+ */
+#define kMinParallelCrossVerifyItems 65536
+
+#define kMaxCrossVerifyThreads 4
+
+#ifndef _WIN32
+/*
+ * Work shared by the cross-verification threads. Each thread takes the
+ * next unclaimed section from the map and checks it with its own copy of
+ * the CheckState; everything the checks read is finished by then, and
+ * the only per-check scratch (previousItem and the class def bits) lives
+ * in that copy.
+ */
+struct CrossVerifyWork {
+    const CheckState*   state;
+    const DexMapList*   pMap;
+    pthread_mutex_t     lock;
+    u4                  nextSection;    /* guarded by lock */
+    bool                okay;           /* guarded by lock */
+};
+
+static void* crossVerifyThreadStart(void* arg)
+{
+    CrossVerifyWork* work = (CrossVerifyWork*) arg;
+    CheckState state = *work->state;
+
+    while (true) {
+        pthread_mutex_lock(&work->lock);
+        u4 idx = work->nextSection++;
+        bool stop = !work->okay || idx >= work->pMap->size;
+        pthread_mutex_unlock(&work->lock);
+
+        if (stop) {
+            break;
+        }
+
+        if (!crossVerifySection(&state, &work->pMap->list[idx])) {
+            pthread_mutex_lock(&work->lock);
+            work->okay = false;
+            pthread_mutex_unlock(&work->lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Cross-verify the sections of the map on several threads. Returns false
+ * if any section failed; if a thread can't be created, the ones that
+ * were get the work between them.
+ */
+static bool crossVerifyInParallel(CheckState* state, const DexMapList* pMap,
+        int numThreads)
+{
+    CrossVerifyWork work;
+    pthread_t threads[kMaxCrossVerifyThreads];
+    int started = 0;
+
+    work.state = state;
+    work.pMap = pMap;
+    work.nextSection = 0;
+    work.okay = true;
+    pthread_mutex_init(&work.lock, NULL);
+
+    for (int i = 1; i < numThreads; i++) {
+        if (pthread_create(&threads[started], NULL, crossVerifyThreadStart,
+                &work) != 0) {
+            ALOGW("Unable to start cross-verify thread");
+            break;
+        }
+        started++;
+    }
+
+    /* the calling thread takes part too */
+    crossVerifyThreadStart(&work);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&work.lock);
+
+    return work.okay;
+}
+#endif
+
 /*
  * Perform cross-item verification on everything that needs it. This
  * pass is only called after all items are byte-swapped and
  * intra-verified (checked for internal consistency).
+ *
+ * The sections are independent of each other at this point, so when
+ * there's a lot to check and more than one CPU, they're checked on
+ * several threads.
  */
 static bool crossVerifyEverything(CheckState* state, DexMapList* pMap)
 {
@@ -2702,91 +2894,28 @@ static bool crossVerifyEverything(CheckState* state, DexMapList* pMap)
     u4 count = pMap->size;
     bool okay = true;
 
-    while (okay && count--) {
-        u4 sectionOffset = item->offset;
-        u4 sectionCount = item->size;
-
-        switch (item->type) {
-            case kDexTypeHeaderItem:
-            case kDexTypeMapList:
-            case kDexTypeTypeList:
-            case kDexTypeCodeItem:
-            case kDexTypeStringDataItem:
-            case kDexTypeDebugInfoItem:
-            case kDexTypeAnnotationItem:
-            case kDexTypeEncodedArrayItem: {
-                // There is no need for cross-item verification for these.
-                break;
-            }
-            case kDexTypeStringIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyStringIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeTypeIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyTypeIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeProtoIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyProtoIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeFieldIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyFieldIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeMethodIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyMethodIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeClassDefItem: {
-                // Allocate (on the stack) the "observed class_def" bits.
-                size_t arraySize = calcDefinedClassBitsSize(state);
-                u4 definedClassBits[arraySize];
-                memset(definedClassBits, 0, arraySize * sizeof(u4));
-                state->pDefinedClassBits = definedClassBits;
-
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyClassDefItem, sizeof(u4), NULL);
-
-                state->pDefinedClassBits = NULL;
-                break;
-            }
-            case kDexTypeAnnotationSetRefList: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyAnnotationSetRefList, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeAnnotationSetItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyAnnotationSetItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeClassDataItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyClassDataItem, sizeof(u1), NULL);
-                break;
-            }
-            case kDexTypeAnnotationsDirectoryItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyAnnotationsDirectoryItem, sizeof(u4), NULL);
-                break;
-            }
-            default: {
-                ALOGE("Unknown map item type %04x", item->type);
-                return false;
-            }
+#ifndef _WIN32
+    u4 totalItems = 0;
+    int numBigSections = 0;
+    for (u4 i = 0; i < count; i++) {
+        totalItems += item[i].size;
+        if (item[i].size >= kMinParallelCrossVerifyItems / 4) {
+            numBigSections++;
         }
+    }
 
-        if (!okay) {
-            ALOGE("Cross-item verify of section type %04x failed",
-                    item->type);
-        }
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int numThreads = (numCpus < numBigSections) ? numCpus : numBigSections;
+    if (numThreads > kMaxCrossVerifyThreads) {
+        numThreads = kMaxCrossVerifyThreads;
+    }
+    if (totalItems >= kMinParallelCrossVerifyItems && numThreads > 1) {
+        return crossVerifyInParallel(state, pMap, numThreads);
+    }
+#endif
 
+    while (okay && count--) {
+        okay = crossVerifySection(state, item);
         item++;
     }
 
@@ -2821,12 +2950,12 @@ bool dexHasValidMagic(const DexHeader* pHeader)
 
 /*
  * Fix the byte ordering of all fields in the DEX file, and do
- * structural verification. This is only required for code that opens
- * "raw" DEX files, such as the DEX optimizer.
+ * structural verification, checking the header checksum first if
+ * "checkChecksum" is set.
  *
  * Returns 0 on success, nonzero on failure.
  */
-int dexSwapAndVerify(u1* addr, int len)
+static int swapAndVerify(u1* addr, int len, bool checkChecksum)
 {
     DexHeader* pHeader;
     CheckState state;
@@ -2857,7 +2986,7 @@ int dexSwapAndVerify(u1* addr, int len)
         }
     }
 
-    if (okay) {
+    if (okay && checkChecksum) {
         /*
          * Compute the adler32 checksum and compare it to what's stored in
          * the file.  This isn't free, but chances are good that we just
@@ -2944,6 +3073,27 @@ int dexSwapAndVerify(u1* addr, int len)
     return !okay;       // 0 == success
 }
 
+/*
+ * Fix the byte ordering of all fields in the DEX file, and do
+ * structural verification. This is only required for code that opens
+ * "raw" DEX files, such as the DEX optimizer.
+ *
+ * Returns 0 on success, nonzero on failure.
+ */
+int dexSwapAndVerify(u1* addr, int len)
+{
+    return swapAndVerify(addr, len, true);
+}
+
+/*
+ * Same as dexSwapAndVerify(), for data whose header checksum was already
+ * checked as it was extracted.
+ */
+int dexSwapAndVerifyChecksummed(u1* addr, int len)
+{
+    return swapAndVerify(addr, len, false);
+}
+
 /*
  * Detect the file type of the given memory buffer via magic number.
  * Call dexSwapAndVerify() on an unoptimized DEX file, do nothing
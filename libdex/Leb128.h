@@ -101,6 +101,55 @@ DEX_INLINE int readSignedLeb128(const u1** pStream) {
     return result;
 }
 
+/*
+ * Reads "count" consecutive unsigned LEB128 values into "pValues",
+ * updating the given pointer to point just past the end of the last
+ * one.  Tolerates the same garbage as readUnsignedLeb128().
+ *
+ * Most values in class data and debug info fit in a single byte.  Since
+ * every value is at least one byte long, the next min(count, 4) bytes
+ * are known to be there; when none of them has its continuation bit set
+ * they're taken as a group with a single test.
+ */
+DEX_INLINE void readUnsignedLeb128Array(const u1** pStream, u4* pValues,
+        int count) {
+    const u1* ptr = *pStream;
+
+    for (; count >= 4; count -= 4, pValues += 4) {
+        if (((ptr[0] | ptr[1] | ptr[2] | ptr[3]) & 0x80) == 0) {
+            pValues[0] = ptr[0];
+            pValues[1] = ptr[1];
+            pValues[2] = ptr[2];
+            pValues[3] = ptr[3];
+            ptr += 4;
+        } else {
+            pValues[0] = readUnsignedLeb128(&ptr);
+            pValues[1] = readUnsignedLeb128(&ptr);
+            pValues[2] = readUnsignedLeb128(&ptr);
+            pValues[3] = readUnsignedLeb128(&ptr);
+        }
+    }
+
+    if (count >= 2) {
+        if (((ptr[0] | ptr[1]) & 0x80) == 0) {
+            pValues[0] = ptr[0];
+            pValues[1] = ptr[1];
+            ptr += 2;
+        } else {
+            pValues[0] = readUnsignedLeb128(&ptr);
+            pValues[1] = readUnsignedLeb128(&ptr);
+        }
+        pValues += 2;
+        count -= 2;
+    }
+
+    if (count != 0) {
+        pValues[0] = readUnsignedLeb128(&ptr);
+    }
+
+    *pStream = ptr;
+}
+
 /*
  * Reads an unsigned LEB128 value, updating the given pointer to point
  * just past the end of the read value and also indicating whether the
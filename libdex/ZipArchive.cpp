@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Extraction of a DEX entry straight into a mapped cache file.
+ */
+#include "ZipArchive.h"
+#include "Adler32.h"
+
+#include <zlib.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cutils/log.h>
+
+/* how much is produced between checksum updates; small enough to be hot */
+static const size_t kExtractChunk = 64 * 1024;
+
+/*
+ * Running checksums over the DEX data as it is produced.
+ */
+struct ExtractSums {
+    uLong   crc;            /* zip CRC-32 over everything */
+    u4      adler;          /* DEX Adler-32 over everything after it */
+    size_t  done;           /* bytes seen so far */
+};
+
+static void updateSums(ExtractSums* pSums, const u1* data, size_t len)
+{
+    /* the DEX checksum skips the magic and the checksum itself */
+    static const size_t kNonSum = 12;
+
+    pSums->crc = crc32(pSums->crc, data, len);
+
+    size_t skip = 0;
+    if (pSums->done < kNonSum)
+        skip = (len < kNonSum - pSums->done) ? len : kNonSum - pSums->done;
+    pSums->adler = dexAdler32(pSums->adler, data + skip, len - skip);
+    pSums->done += len;
+}
+
+/*
+ * Copy a stored entry out of a read-only mapping of the archive.
+ */
+static bool copyStored(const u1* src, u1* dst, size_t len, ExtractSums* pSums)
+{
+    for (size_t off = 0; off < len; off += kExtractChunk) {
+        size_t n = (len - off < kExtractChunk) ? len - off : kExtractChunk;
+        memcpy(dst + off, src + off, n);
+        updateSums(pSums, dst + off, n);
+    }
+    return true;
+}
+
+/*
+ * Inflate a deflated entry, a chunk of output at a time.
+ */
+static bool inflateDeflated(const u1* src, size_t srcLen, u1* dst, size_t len,
+    ExtractSums* pSums)
+{
+    z_stream zstream;
+    memset(&zstream, 0, sizeof(zstream));
+
+    /* negative window bits: raw deflate data, no zlib header */
+    int zerr = inflateInit2(&zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+        ALOGE("Zip: inflateInit2 failed (%d)", zerr);
+        return false;
+    }
+
+    zstream.next_in = (Bytef*) src;
+    zstream.avail_in = srcLen;
+
+    bool result = false;
+    size_t produced = 0;
+    while (produced < len) {
+        size_t n = (len - produced < kExtractChunk) ?
+            len - produced : kExtractChunk;
+        zstream.next_out = dst + produced;
+        zstream.avail_out = n;
+
+        zerr = inflate(&zstream, Z_NO_FLUSH);
+        size_t got = n - zstream.avail_out;
+        updateSums(pSums, dst + produced, got);
+        produced += got;
+
+        if (zerr == Z_STREAM_END)
+            break;
+        if (zerr != Z_OK || got == 0) {
+            ALOGE("Zip: inflate failed (%d) at %zu of %zu", zerr, produced,
+                len);
+            goto bail;
+        }
+    }
+
+    if (produced != len) {
+        ALOGE("Zip: inflated %zu bytes, expected %zu", produced, len);
+        goto bail;
+    }
+    result = true;
+
+bail:
+    inflateEnd(&zstream);
+    return result;
+}
+
+/*
+ * Extract "entry", which holds a DEX file, into "fd" at "dexOffset".
+ *
+ * The file is extended and mapped, and the data is inflated (or, for a
+ * stored entry, copied out of a mapping of the archive) directly into
+ * the mapping.  The zip CRC and the DEX Adler-32 are computed on each
+ * chunk as it is written, while it is still in the cache, so nothing has
+ * to go back over the data afterward.  A mismatched CRC is a failure;
+ * "*pChecksumOk" reports whether the DEX header checksum matched.
+ *
+ * Returns 0 on success.
+ */
+int dexZipExtractDexToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd,
+    off_t dexOffset, bool* pChecksumOk)
+{
+    size_t len = entry->uncompressed_length;
+    size_t mapLen = dexOffset + len;
+    MemMapping srcMap;
+    bool srcMapped = false;
+    void* dstMap = MAP_FAILED;
+    int result = -1;
+
+    *pChecksumOk = false;
+
+    if (entry->method != kCompressStored &&
+        entry->method != kCompressDeflated)
+    {
+        return dexZipExtractEntryToFile(handle, entry, fd);
+    }
+
+    size_t srcLen = (entry->method == kCompressStored) ?
+        len : entry->compressed_length;
+    if (sysMapFileSegmentInShmem(dexZipGetArchiveFd(handle), entry->offset,
+            srcLen, &srcMap) != 0)
+    {
+        return dexZipExtractEntryToFile(handle, entry, fd);
+    }
+    srcMapped = true;
+
+    if (ftruncate(fd, mapLen) != 0) {
+        ALOGE("Zip: unable to extend output to %zu: %s", mapLen,
+            strerror(errno));
+        goto bail;
+    }
+    dstMap = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (dstMap == MAP_FAILED) {
+        ALOGE("Zip: unable to map output: %s", strerror(errno));
+        goto bail;
+    }
+
+    {
+        u1* dst = (u1*) dstMap + dexOffset;
+        const u1* src = (const u1*) srcMap.addr;
+        ExtractSums sums;
+        sums.crc = crc32(0L, Z_NULL, 0);
+        sums.adler = kDexAdler32Init;
+        sums.done = 0;
+
+        bool okay = (entry->method == kCompressStored) ?
+            copyStored(src, dst, len, &sums) :
+            inflateDeflated(src, srcLen, dst, len, &sums);
+        if (!okay)
+            goto bail;
+
+        if (sums.crc != entry->crc32) {
+            ALOGE("Zip: CRC mismatch (%08lx, expected %08x)", sums.crc,
+                entry->crc32);
+            goto bail;
+        }
+
+        /*
+         * The DEX checksum only counts if the header's file size is the
+         * length we checksummed, and only in the header's byte order.
+         */
+        if (len >= sizeof(DexHeader)) {
+            const DexHeader* pHeader = (const DexHeader*) dst;
+            if (dexHasValidMagic(pHeader) && pHeader->fileSize == len &&
+                pHeader->checksum == sums.adler)
+            {
+                *pChecksumOk = true;
+            }
+        }
+    }
+
+    if (lseek(fd, mapLen, SEEK_SET) < 0)
+        goto bail;
+    result = 0;
+
+bail:
+    if (dstMap != MAP_FAILED)
+        munmap(dstMap, mapLen);
+    if (srcMapped)
+        sysReleaseShmem(&srcMap);
+    return result;
+}
@@ -83,4 +83,15 @@ DEX_INLINE int dexZipExtractEntryToFile(ZipArchiveHandle handle,
     return ExtractEntryToFile(handle, entry, fd);
 }
 
+/*
+ * Extract an entry holding a DEX file into "fd" at "dexOffset", by way of
+ * a mapping of the file, checking the zip CRC and computing the DEX
+ * checksum as the data is produced.  "*pChecksumOk" is set if the DEX
+ * header checksum matched.
+ *
+ * Returns 0 on success.
+ */
+int dexZipExtractDexToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd,
+    off_t dexOffset, bool* pChecksumOk);
+
 #endif  // LIBDEX_ZIPARCHIVE_H_
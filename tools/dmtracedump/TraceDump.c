@@ -31,6 +31,9 @@
 #include <time.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Version number in the key file.
  * Version 1 uses one byte for the thread id.
@@ -138,6 +141,8 @@ typedef struct TimedMethod {
     uint64_t elapsedInclusive;
     int numCalls;
     struct MethodEntry *method;
+    struct MethodEntry *owner;          /* method whose list this is on */
+    int list;                           /* see findTimedMethod() */
 } TimedMethod;
 
 typedef struct ClassEntry {
@@ -181,14 +186,25 @@ typedef struct MethodEntry {
  * The parsed contents of the key file.
  */
 typedef struct DataKeys {
-    char*        fileData;      /* contents of the entire file */
+    char*        fileData;      /* copy of the key section */
     long         fileLen;
     int          numThreads;
     ThreadEntry* threads;
     int          numMethods;
     MethodEntry* methods;       /* 2 extra methods: "toplevel" and "unknown" */
+    int*         methodHash;    /* index into methods[], or -1 */
+    unsigned int methodHashMask;
 } DataKeys;
 
+/*
+ * A trace file mapped into memory, and our read position in it.
+ */
+typedef struct DataFile {
+    const unsigned char* data;
+    size_t       len;
+    size_t       pos;
+} DataFile;
+
 #define TOPLEVEL_INDEX 0
 #define UNKNOWN_INDEX 1
 
@@ -223,6 +239,7 @@ typedef struct Options {
     int outputHtml;
     const char* sortableUrl;
     int threshold;
+    int summaryOnly;
 } Options;
 
 typedef struct TraceData {
@@ -572,6 +589,7 @@ void freeDataKeys(DataKeys* pKeys)
     free(pKeys->fileData);
     free(pKeys->threads);
     free(pKeys->methods);
+    free(pKeys->methodHash);
     free(pKeys);
 }
 
@@ -929,10 +947,106 @@ void sortMethodList(DataKeys* pKeys)
         compareMethods);
 }
 
+/*
+ * Map a trace file into memory.  Returns 0 on success.
+ */
+int openDataFile(const char* fileName, DataFile* pFile)
+{
+    struct stat st;
+    void* data;
+    int fd;
+
+    memset(pFile, 0, sizeof(*pFile));
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    /* records are read front to back, once */
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    pFile->data = (const unsigned char*) data;
+    pFile->len = st.st_size;
+    return 0;
+}
+
+void closeDataFile(DataFile* pFile)
+{
+    if (pFile->data != NULL)
+        munmap((void*) pFile->data, pFile->len);
+    pFile->data = NULL;
+}
+
+/*
+ * Find where the text key section ends: just past the "*end" line.
+ * Returns the whole file if there isn't one, and lets the parser fail.
+ */
+static size_t findKeysEnd(const DataFile* pFile)
+{
+    const unsigned char* data = pFile->data;
+    size_t len = pFile->len;
+    size_t pos = 0;
+
+    while (pos < len) {
+        const unsigned char* eol = memchr(data + pos, '\n', len - pos);
+        size_t next = (eol == NULL) ? len : (size_t) (eol - data) + 1;
+        if (next - pos >= 4 && memcmp(data + pos, "*end", 4) == 0)
+            return next;
+        pos = next;
+    }
+    return len;
+}
+
+/*
+ * Index the (sorted) method list by method ID.
+ */
+static inline unsigned int methodIdHash(int64_t methodId)
+{
+    uint64_t id = (uint64_t) methodId >> 2;     /* low bits are the action */
+    return (unsigned int) (id ^ (id >> 32)) * 2654435761u;
+}
+
+static int buildMethodHash(DataKeys* pKeys)
+{
+    unsigned int size = 16;
+    int i;
+
+    while (size < (unsigned int) pKeys->numMethods * 2)
+        size *= 2;
+    pKeys->methodHash = (int*) malloc(size * sizeof(int));
+    if (pKeys->methodHash == NULL)
+        return -1;
+    memset(pKeys->methodHash, 0xff, size * sizeof(int));
+    pKeys->methodHashMask = size - 1;
+
+    for (i = 0; i < pKeys->numMethods; i++) {
+        unsigned int idx = methodIdHash(pKeys->methods[i].methodId) & (size - 1);
+        while (pKeys->methodHash[idx] >= 0) {
+            if (pKeys->methods[pKeys->methodHash[idx]].methodId ==
+                pKeys->methods[i].methodId)
+                break;          /* duplicate; keep the first */
+            idx = (idx + 1) & (size - 1);
+        }
+        if (pKeys->methodHash[idx] < 0)
+            pKeys->methodHash[idx] = i;
+    }
+    return 0;
+}
+
 /*
  * Parse the key section, and return a copy of the parsed contents.
+ *
+ * On success the file's read position is at the data section header.
  */
-DataKeys* parseKeys(FILE *fp, int verbose)
+DataKeys* parseKeys(DataFile* pFile, int verbose)
 {
     DataKeys* pKeys = NULL;
     long offset;
@@ -943,32 +1057,17 @@ DataKeys* parseKeys(FILE *fp, int verbose)
         goto fail;
 
     /*
-     * We load the entire file into memory.  We do this, rather than memory-
-     * mapping it, because we want to change some whitespace to NULs.
+     * We copy the key section out of the mapping, rather than parsing it
+     * in place, because we want to change some whitespace to NULs.  The
+     * records after it are read straight from the mapping.
      */
-    if (fseek(fp, 0L, SEEK_END) != 0) {
-        perror("fseek");
-        goto fail;
-    }
-    pKeys->fileLen = ftell(fp);
-    if (pKeys->fileLen == 0) {
-        fprintf(stderr, "Key file is empty.\n");
-        goto fail;
-    }
-    rewind(fp);
-
+    pKeys->fileLen = findKeysEnd(pFile);
     pKeys->fileData = (char*) malloc(pKeys->fileLen);
     if (pKeys->fileData == NULL) {
         fprintf(stderr, "ERROR: unable to alloc %ld bytes\n", pKeys->fileLen);
         goto fail;
     }
-
-    if (fread(pKeys->fileData, 1, pKeys->fileLen, fp) != (size_t) pKeys->fileLen)
-    {
-        fprintf(stderr, "ERROR: unable to read %ld bytes from trace file\n",
-            pKeys->fileLen);
-        goto fail;
-    }
+    memcpy(pKeys->fileData, pFile->data, pKeys->fileLen);
 
     offset = 0;
 
@@ -979,14 +1078,13 @@ DataKeys* parseKeys(FILE *fp, int verbose)
     if (offset < 0)
         goto fail;
 
-    /* Reduce our allocation now that we know where the end of the key section is. */
-    pKeys->fileData = (char *)realloc(pKeys->fileData, offset);
-    pKeys->fileLen = offset;
-    /* Leave fp pointing to the beginning of the data section. */
-    fseek(fp, offset, SEEK_SET);
+    /* Leave the file positioned at the beginning of the data section. */
+    pFile->pos = offset;
 
     sortThreadList(pKeys);
     sortMethodList(pKeys);
+    if (buildMethodHash(pKeys) < 0)
+        goto fail;
 
     /*
      * Dump list of threads.
@@ -1022,43 +1120,21 @@ fail:
 
 
 /*
- * Read values from the binary data file.
- */
-
-/* Make the return value "unsigned int" instead of "unsigned short" so that
- * we can detect EOF.
+ * Read values from the binary data file.  The caller checks that enough
+ * bytes are left.
  */
-unsigned int read2LE(FILE* fp)
+static inline unsigned int get2LE(const unsigned char* buf)
 {
-    unsigned int val;
-
-    val = getc(fp);
-    val |= getc(fp) << 8;
-    return val;
+    return buf[0] | (buf[1] << 8);
 }
-unsigned int read4LE(FILE* fp)
+static inline unsigned int get4LE(const unsigned char* buf)
 {
-    unsigned int val;
-
-    val = getc(fp);
-    val |= getc(fp) << 8;
-    val |= getc(fp) << 16;
-    val |= getc(fp) << 24;
-    return val;
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+        ((unsigned int) buf[3] << 24);
 }
-unsigned long long read8LE(FILE* fp)
+static inline unsigned long long get8LE(const unsigned char* buf)
 {
-    unsigned long long val;
-
-    val = getc(fp);
-    val |= (unsigned long long) getc(fp) << 8;
-    val |= (unsigned long long) getc(fp) << 16;
-    val |= (unsigned long long) getc(fp) << 24;
-    val |= (unsigned long long) getc(fp) << 32;
-    val |= (unsigned long long) getc(fp) << 40;
-    val |= (unsigned long long) getc(fp) << 48;
-    val |= (unsigned long long) getc(fp) << 56;
-    return val;
+    return get4LE(buf) | ((unsigned long long) get4LE(buf + 4) << 32);
 }
 
 /*
@@ -1066,30 +1142,33 @@ unsigned long long read8LE(FILE* fp)
  *
  * Returns with the file positioned at the start of the record data.
  */
-int parseDataHeader(FILE *fp, DataHeader* pHeader)
+int parseDataHeader(DataFile* pFile, DataHeader* pHeader)
 {
-    int bytesToRead;
+    const unsigned char* buf = pFile->data + pFile->pos;
+    size_t avail = pFile->len - pFile->pos;
 
-    pHeader->magic = read4LE(fp);
-    pHeader->version = read2LE(fp);
-    pHeader->offsetToData = read2LE(fp);
-    pHeader->startWhen = read8LE(fp);
-    bytesToRead = pHeader->offsetToData - 16;
+    if (avail < 16)
+        return -1;
+    pHeader->magic = get4LE(buf);
+    pHeader->version = get2LE(buf + 4);
+    pHeader->offsetToData = get2LE(buf + 6);
+    pHeader->startWhen = get8LE(buf + 8);
     if (pHeader->version == 1) {
         pHeader->recordSize = 9;
     } else if (pHeader->version == 2) {
         pHeader->recordSize = 10;
     } else if (pHeader->version == 3) {
-        pHeader->recordSize = read2LE(fp);
-        bytesToRead -= 2;
+        if (avail < 18)
+            return -1;
+        pHeader->recordSize = get2LE(buf + 16);
     } else {
         fprintf(stderr, "Unsupported trace file version: %d\n", pHeader->version);
         return -1;
     }
 
-    if (fseek(fp, bytesToRead, SEEK_CUR) != 0) {
+    if (pHeader->offsetToData < 16 || (size_t) pHeader->offsetToData > avail)
         return -1;
-    }
+    pFile->pos += pHeader->offsetToData;
 
     return 0;
 }
@@ -1101,22 +1180,13 @@ int parseDataHeader(FILE *fp, DataHeader* pHeader)
  */
 MethodEntry* lookupMethod(DataKeys* pKeys, int64_t methodId)
 {
-    int hi, lo, mid;
-    int64_t id;
-
-    lo = 0;
-    hi = pKeys->numMethods - 1;
-
-    while (hi >= lo) {
-        mid = (hi + lo) / 2;
+    unsigned int idx = methodIdHash(methodId) & pKeys->methodHashMask;
+    int i;
 
-        id = pKeys->methods[mid].methodId;
-        if (id == methodId)           /* match */
-            return &pKeys->methods[mid];
-        else if (id < methodId)       /* too low */
-            lo = mid + 1;
-        else                          /* too high */
-            hi = mid - 1;
+    while ((i = pKeys->methodHash[idx]) >= 0) {
+        if (pKeys->methods[i].methodId == methodId)
+            return &pKeys->methods[i];
+        idx = (idx + 1) & pKeys->methodHashMask;
     }
 
     return NULL;
@@ -1128,36 +1198,29 @@ MethodEntry* lookupMethod(DataKeys* pKeys, int64_t methodId)
  * and elapsedTime are unchanged.  Returns 1 on end-of-file, otherwise
  * returns 0.
  */
-int readDataRecord(FILE *dataFp, DataHeader* dataHeader,
+int readDataRecord(DataFile *dataFile, DataHeader* dataHeader,
         int *threadId, unsigned int *methodVal, uint64_t *elapsedTime)
 {
-    int id;
-    int bytesToRead;
+    const unsigned char* rec;
 
-    bytesToRead = dataHeader->recordSize;
-    if (dataHeader->version == 1) {
-        id = getc(dataFp);
-        bytesToRead -= 1;
-    } else {
-        id = read2LE(dataFp);
-        bytesToRead -= 2;
-    }
-    if (id == EOF)
+    if (dataFile->pos >= dataFile->len)
         return 1;
-    *threadId = id;
-
-    *methodVal = read4LE(dataFp);
-    *elapsedTime = read4LE(dataFp);
-    bytesToRead -= 8;
-
-    while (bytesToRead-- > 0) {
-        getc(dataFp);
-    }
-
-    if (feof(dataFp)) {
+    if (dataFile->len - dataFile->pos < (size_t) dataHeader->recordSize) {
         fprintf(stderr, "WARNING: hit EOF mid-record\n");
         return 1;
     }
+    rec = dataFile->data + dataFile->pos;
+    dataFile->pos += dataHeader->recordSize;
+
+    if (dataHeader->version == 1) {
+        *threadId = rec[0];
+        rec += 1;
+    } else {
+        *threadId = get2LE(rec);
+        rec += 2;
+    }
+    *methodVal = get4LE(rec);
+    *elapsedTime = get4LE(rec + 4);
     return 0;
 }
 
@@ -1172,7 +1235,7 @@ void dumpTrace()
                                 {NULL, NULL}, {NULL, NULL}, {0, 0}, 0, 0, -1 };
     char bogusBuf[80];
     char spaces[MAX_STACK_DEPTH+1];
-    FILE* dataFp = NULL;
+    DataFile dataFile;
     DataHeader dataHeader;
     DataKeys* pKeys = NULL;
     int i;
@@ -1186,14 +1249,13 @@ void dumpTrace()
     for (i = 0; i < MAX_THREADS; i++)
         traceData.depth[i] = 2;       // adjust for return from start function
 
-    dataFp = fopen(gOptions.traceFileName, "rb");
-    if (dataFp == NULL)
-        goto bail;
+    if (openDataFile(gOptions.traceFileName, &dataFile) < 0)
+        return;
 
-    if ((pKeys = parseKeys(dataFp, 1)) == NULL)
+    if ((pKeys = parseKeys(&dataFile, 1)) == NULL)
         goto bail;
 
-    if (parseDataHeader(dataFp, &dataHeader) < 0)
+    if (parseDataHeader(&dataFile, &dataHeader) < 0)
         goto bail;
 
     printf("Trace (threadID action usecs class.method signature):\n");
@@ -1211,7 +1273,7 @@ void dumpTrace()
         /*
          * Extract values from file.
          */
-        if (readDataRecord(dataFp, &dataHeader, &threadId, &methodVal, &elapsedTime))
+        if (readDataRecord(&dataFile, &dataHeader, &threadId, &methodVal, &elapsedTime))
             break;
 
         action = METHOD_ACTION(methodVal);
@@ -1269,12 +1331,91 @@ void dumpTrace()
     }
 
 bail:
-    if (dataFp != NULL)
-        fclose(dataFp);
+    closeDataFile(&dataFile);
     if (pKeys != NULL)
         freeDataKeys(pKeys);
 }
 
+/*
+ * All TimedMethods, hashed by the list they're on and the method they
+ * count, so addInclusiveTime() doesn't walk the lists.
+ */
+static TimedMethod** gTimedHash;
+static unsigned int gTimedHashMask;
+static unsigned int gTimedCount;
+
+static inline unsigned int timedMethodHash(const MethodEntry* owner, int list,
+                                           const MethodEntry* method)
+{
+    uintptr_t key = ((uintptr_t) owner * 31 + (uintptr_t) method) * 4 + list;
+    return (unsigned int) (key ^ (key >> 17)) * 2654435761u;
+}
+
+static void growTimedHash()
+{
+    unsigned int newSize = (gTimedHash == NULL) ? 1024 : (gTimedHashMask + 1) * 2;
+    TimedMethod** newHash = (TimedMethod**) calloc(newSize, sizeof(TimedMethod*));
+    unsigned int i;
+
+    if (newHash == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; gTimedHash != NULL && i <= gTimedHashMask; i++) {
+        TimedMethod* pTimed = gTimedHash[i];
+        unsigned int idx;
+        if (pTimed == NULL)
+            continue;
+        idx = timedMethodHash(pTimed->owner, pTimed->list, pTimed->method) &
+                (newSize - 1);
+        while (newHash[idx] != NULL)
+            idx = (idx + 1) & (newSize - 1);
+        newHash[idx] = pTimed;
+    }
+    free(gTimedHash);
+    gTimedHash = newHash;
+    gTimedHashMask = newSize - 1;
+}
+
+/*
+ * Find "method" on the TimedMethod list "*pList" belonging to "owner",
+ * adding a zeroed entry to the front of the list if it isn't there.
+ * "list" says which list it is: 0/1 for the normal/recursive children,
+ * 2/3 for the normal/recursive parents.
+ */
+static TimedMethod* findTimedMethod(TimedMethod** pList, MethodEntry* owner,
+                                    int list, MethodEntry* method)
+{
+    TimedMethod* pTimed;
+    unsigned int idx;
+
+    if (gTimedHash == NULL || gTimedCount * 2 >= gTimedHashMask)
+        growTimedHash();
+
+    idx = timedMethodHash(owner, list, method) & gTimedHashMask;
+    while ((pTimed = gTimedHash[idx]) != NULL) {
+        if (pTimed->owner == owner && pTimed->list == list &&
+            pTimed->method == method)
+            return pTimed;
+        idx = (idx + 1) & gTimedHashMask;
+    }
+
+    pTimed = (TimedMethod *) malloc(sizeof(TimedMethod));
+    pTimed->elapsedInclusive = 0;
+    pTimed->numCalls = 0;
+    pTimed->method = method;
+    pTimed->owner = owner;
+    pTimed->list = list;
+
+    /* Add it to the front of the list */
+    pTimed->next = *pList;
+    *pList = pTimed;
+
+    gTimedHash[idx] = pTimed;
+    gTimedCount++;
+    return pTimed;
+}
+
 /* This routine adds the given time to the parent and child methods.
  * This is called when the child routine exits, after the child has
  * been popped from the stack.  The elapsedTime parameter is the
@@ -1311,47 +1452,21 @@ void addInclusiveTime(MethodEntry *parent, MethodEntry *child,
     }
 #endif
 
-    /* Find the child method in the parent */
-    TimedMethod *children = parent->children[parentIsRecursive];
-    for (pTimed = children; pTimed; pTimed = pTimed->next) {
-        if (pTimed->method == child) {
-            pTimed->elapsedInclusive += elapsedTime;
-            pTimed->numCalls += 1;
-            break;
-        }
-    }
-    if (pTimed == NULL) {
-        /* Allocate a new TimedMethod */
-        pTimed = (TimedMethod *) malloc(sizeof(TimedMethod));
-        pTimed->elapsedInclusive = elapsedTime;
-        pTimed->numCalls = 1;
-        pTimed->method = child;
+    /* The summary only needs the totals above */
+    if (gOptions.summaryOnly)
+        return;
 
-        /* Add it to the front of the list */
-        pTimed->next = children;
-        parent->children[parentIsRecursive] = pTimed;
-    }
+    /* Find the child method in the parent */
+    pTimed = findTimedMethod(&parent->children[parentIsRecursive],
+                             parent, parentIsRecursive, child);
+    pTimed->elapsedInclusive += elapsedTime;
+    pTimed->numCalls += 1;
 
     /* Find the parent method in the child */
-    TimedMethod *parents = child->parents[childIsRecursive];
-    for (pTimed = parents; pTimed; pTimed = pTimed->next) {
-        if (pTimed->method == parent) {
-            pTimed->elapsedInclusive += elapsedTime;
-            pTimed->numCalls += 1;
-            break;
-        }
-    }
-    if (pTimed == NULL) {
-        /* Allocate a new TimedMethod */
-        pTimed = (TimedMethod *) malloc(sizeof(TimedMethod));
-        pTimed->elapsedInclusive = elapsedTime;
-        pTimed->numCalls = 1;
-        pTimed->method = parent;
-
-        /* Add it to the front of the list */
-        pTimed->next = parents;
-        child->parents[childIsRecursive] = pTimed;
-    }
+    pTimed = findTimedMethod(&child->parents[childIsRecursive],
+                             child, 2 + childIsRecursive, parent);
+    pTimed->elapsedInclusive += elapsedTime;
+    pTimed->numCalls += 1;
 
 #if 0
     if (verbose) {
@@ -2295,20 +2410,19 @@ DataKeys* parseDataKeys(TraceData* traceData, const char* traceFileName, uint64_
     DataKeys* dataKeys = NULL;
     MethodEntry **pMethods = NULL;
     MethodEntry* method;
-    FILE* dataFp = NULL;
+    DataFile dataFile;
     DataHeader dataHeader;
     int ii;
     uint64_t currentTime;
     MethodEntry* caller;
 
-    dataFp = fopen(traceFileName, "rb");
-    if (dataFp == NULL)
-        goto bail;
+    if (openDataFile(traceFileName, &dataFile) < 0)
+        return NULL;
 
-    if ((dataKeys = parseKeys(dataFp, 0)) == NULL)
+    if ((dataKeys = parseKeys(&dataFile, 0)) == NULL)
         goto bail;
 
-    if (parseDataHeader(dataFp, &dataHeader) < 0)
+    if (parseDataHeader(&dataFile, &dataHeader) < 0)
         goto bail;
 
 #if 0
@@ -2323,7 +2437,7 @@ DataKeys* parseDataKeys(TraceData* traceData, const char* traceFileName, uint64_
         /*
          * Extract values from file.
          */
-        if (readDataRecord(dataFp, &dataHeader, &threadId, &methodVal, &currentTime))
+        if (readDataRecord(&dataFile, &dataHeader, &threadId, &methodVal, &currentTime))
             break;
 
         action = METHOD_ACTION(methodVal);
@@ -2475,8 +2589,7 @@ DataKeys* parseDataKeys(TraceData* traceData, const char* traceFileName, uint64_
     }
 
 bail:
-    if (dataFp != NULL)
-        fclose(dataFp);
+    closeDataFile(&dataFile);
 
     return dataKeys;
 }
@@ -2510,7 +2623,8 @@ void profileTrace(TraceData* traceData, MethodEntry **pMethods, int numMethods,
     }
 
     printExclusiveProfile(pMethods, numMethods, sumThreadTime);
-    printInclusiveProfile(pMethods, numMethods, sumThreadTime);
+    if (!gOptions.summaryOnly)
+        printInclusiveProfile(pMethods, numMethods, sumThreadTime);
 
     createClassList(traceData, pMethods, numMethods);
     printClassProfiles(traceData, sumThreadTime);
@@ -2804,12 +2918,13 @@ void createDiff(DataKeys* d1, uint64_t sum1, DataKeys* d2, uint64_t sum2)
 int usage(const char *program)
 {
     fprintf(stderr, "Copyright (C) 2006 The Android Open Source Project\n\n");
-    fprintf(stderr, "usage: %s [-ho] [-s sortable] [-d trace-file-name] [-g outfile] trace-file-name\n", program);
+    fprintf(stderr, "usage: %s [-hop] [-s sortable] [-d trace-file-name] [-g outfile] trace-file-name\n", program);
     fprintf(stderr, "  -d trace-file-name  - Diff with this trace\n");
     fprintf(stderr, "  -g outfile          - Write graph to 'outfile'\n");
     fprintf(stderr, "  -k                  - When writing a graph, keep the intermediate DOT file\n");
     fprintf(stderr, "  -h                  - Turn on HTML output\n");
     fprintf(stderr, "  -o                  - Dump the dmtrace file instead of profiling\n");
+    fprintf(stderr, "  -p                  - Summary only: skip the caller/callee profile and graph\n");
     fprintf(stderr, "  -s                  - URL base to where the sortable javascript file\n");
     fprintf(stderr, "  -t threshold        - Threshold percentage for including nodes in the graph\n");
     return 2;
@@ -2819,7 +2934,7 @@ int usage(const char *program)
 int parseOptions(int argc, char **argv)
 {
     while (1) {
-        int opt = getopt(argc, argv, "d:hg:kos:t:");
+        int opt = getopt(argc, argv, "d:hg:kops:t:");
         if (opt == -1)
             break;
         switch (opt) {
@@ -2838,6 +2953,9 @@ int parseOptions(int argc, char **argv)
             case 'o':
                 gOptions.dump = 1;
                 break;
+            case 'p':
+                gOptions.summaryOnly = 1;
+                break;
             case 's':
                 gOptions.sortableUrl = optarg;
                 break;
@@ -2867,6 +2985,10 @@ int main(int argc, char** argv)
     if (gOptions.threshold < 0 || 100 <= gOptions.threshold) {
         gOptions.threshold = 20;
     }
+    if (gOptions.summaryOnly && gOptions.graphFileName != NULL) {
+        fprintf(stderr, "-g needs the call graph; ignoring -p\n");
+        gOptions.summaryOnly = 0;
+    }
 
     if (gOptions.dump) {
         dumpTrace();
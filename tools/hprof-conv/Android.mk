@@ -18,4 +18,11 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := HprofConv.c
 LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE := hprof-conv
+
+ifneq ($(strip $(USE_MINGW)),)
+LOCAL_STATIC_LIBRARIES += libz
+else
+LOCAL_LDLIBS += -lz -lpthread
+endif
+
 include $(BUILD_HOST_EXECUTABLE)
@@ -18,6 +18,15 @@
  * Strip Android-specific records out of hprof data, back-converting from
  * 1.0.3 to 1.0.2.  This removes some useful information, but allows
  * Android hprof data to be handled by widely-available tools (like "jhat").
+ *
+ * The input may be gzipped, as the VM writes it with -XX:+HprofCompress;
+ * the output never is.
+ *
+ * An uncompressed input file is mapped rather than read, and converted in
+ * one pass into a large output buffer, so a dump of several GB costs no
+ * more memory than its largest record.  With "-j <threads>" the records
+ * are cut into chunks that are converted in parallel and written in
+ * order; the output is the same either way.
  */
 #include <stdio.h>
 #include <string.h>
@@ -25,6 +34,16 @@
 #include <stdint.h>
 #include <errno.h>
 #include <assert.h>
+#include <zlib.h>
+
+#ifndef _WIN32
+# define HAVE_MMAP_INPUT
+# include <fcntl.h>
+# include <pthread.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
 
 //#define VERBOSE_DEBUG
 #ifdef VERBOSE_DEBUG
@@ -87,6 +106,13 @@ typedef enum HprofHeapTag {
 #define kIdentSize  4
 #define kRecHdrLen  9
 
+/* output is written out once this much of it is buffered */
+#define kFlushSize  (1024 * 1024)
+
+/* records converted by one thread at a time, with -j */
+#define kChunkSize  (16 * 1024 * 1024)
+#define kMaxThreads 64
+
 
 /*
  * ===========================================================================
@@ -159,15 +185,17 @@ static void ebClear(ExpandBuf* pBuf)
 /*
  * Ensure that the buffer can hold at least "size" additional bytes.
  */
-static int ebEnsureCapacity(ExpandBuf* pBuf, int size)
+static int ebEnsureCapacity(ExpandBuf* pBuf, size_t size)
 {
     assert(size > 0);
 
     if (pBuf->curLen + size > pBuf->maxLen) {
-        int newSize = pBuf->curLen + size + 128;    /* oversize slightly */
+        size_t newSize = pBuf->maxLen * 2;
+        if (newSize < pBuf->curLen + size)
+            newSize = pBuf->curLen + size;
         unsigned char* newStorage = realloc(pBuf->storage, newSize);
         if (newStorage == NULL) {
-            fprintf(stderr, "ERROR: realloc failed on size=%d\n", newSize);
+            fprintf(stderr, "ERROR: realloc failed on size=%zd\n", newSize);
             return -1;
         }
 
@@ -184,7 +212,8 @@ static int ebEnsureCapacity(ExpandBuf* pBuf, int size)
  */
 static int ebAddData(ExpandBuf* pBuf, const void* data, size_t count)
 {
-    ebEnsureCapacity(pBuf, count);
+    if (ebEnsureCapacity(pBuf, count) != 0)
+        return -1;
     memcpy(pBuf->storage + pBuf->curLen, data, count);
     pBuf->curLen += count;
     return 0;
@@ -193,15 +222,16 @@ static int ebAddData(ExpandBuf* pBuf, const void* data, size_t count)
 /*
  * Read a NULL-terminated string from the input.
  */
-static int ebReadString(ExpandBuf* pBuf, FILE* in)
+static int ebReadString(ExpandBuf* pBuf, gzFile in)
 {
     int ic;
 
     do {
-        ebEnsureCapacity(pBuf, 1);
+        if (ebEnsureCapacity(pBuf, 1) != 0)
+            return -1;
 
-        ic = getc(in);
-        if (feof(in) || ferror(in)) {
+        ic = gzgetc(in);
+        if (ic == -1) {
             fprintf(stderr, "ERROR: failed reading input\n");
             return -1;
         }
@@ -212,22 +242,34 @@ static int ebReadString(ExpandBuf* pBuf, FILE* in)
     return 0;
 }
 
+/*
+ * Returns TRUE if reading "in" has failed, as opposed to reaching the end.
+ */
+static int gzFailed(gzFile in)
+{
+    int errnum;
+
+    gzerror(in, &errnum);
+    return errnum < 0;
+}
+
 /*
  * Read some data, adding it to the expanding buffer.
  *
  * This will ensure that the buffer has enough space to hold the new data
  * (plus the previous contents).
  */
-static int ebReadData(ExpandBuf* pBuf, FILE* in, size_t count, int eofExpected)
+static int ebReadData(ExpandBuf* pBuf, gzFile in, size_t count, int eofExpected)
 {
-    size_t actual;
+    int actual;
 
     assert(count > 0);
 
-    ebEnsureCapacity(pBuf, count);
-    actual = fread(pBuf->storage + pBuf->curLen, 1, count, in);
-    if (actual != count) {
-        if (eofExpected && feof(in) && !ferror(in)) {
+    if (ebEnsureCapacity(pBuf, count) != 0)
+        return -1;
+    actual = gzread(in, pBuf->storage + pBuf->curLen, count);
+    if (actual != (int) count) {
+        if (eofExpected && gzeof(in) && !gzFailed(in)) {
             /* return without reporting an error */
         } else {
             fprintf(stderr, "ERROR: read %d of %d bytes\n", actual, count);
@@ -332,6 +374,8 @@ static int computeClassDumpLen(const unsigned char* origBuf, int len)
     if (len < 0)
         return -1;
 
+    if (len < 2)
+        return -1;
     count = get2BE(buf);
     buf += 2;
     len -= 2;
@@ -340,6 +384,8 @@ static int computeClassDumpLen(const unsigned char* origBuf, int len)
         HprofBasicType basicType;
         int basicLen;
 
+        if (len < 3)
+            return -1;
         basicType = buf[2];
         basicLen = computeBasicLen(basicType);
         if (basicLen < 0) {
@@ -353,6 +399,8 @@ static int computeClassDumpLen(const unsigned char* origBuf, int len)
             return -1;
     }
 
+    if (len < 2)
+        return -1;
     count = get2BE(buf);
     buf += 2;
     len -= 2;
@@ -361,6 +409,8 @@ static int computeClassDumpLen(const unsigned char* origBuf, int len)
         HprofBasicType basicType;
         int basicLen;
 
+        if (len < kIdentSize + 1)
+            return -1;
         basicType = buf[kIdentSize];
         basicLen = computeBasicLen(basicType);
         if (basicLen < 0) {
@@ -374,6 +424,8 @@ static int computeClassDumpLen(const unsigned char* origBuf, int len)
             return -1;
     }
 
+    if (len < 2)
+        return -1;
     count = get2BE(buf);
     buf += 2;
     len -= 2;
@@ -394,6 +446,8 @@ static int computeClassDumpLen(const unsigned char* origBuf, int len)
  */
 static int computeInstanceDumpLen(const unsigned char* origBuf, int len)
 {
+    if (len < kIdentSize * 2 + 8)
+        return -1;
     int extraCount = get4BE(origBuf + kIdentSize * 2 + 4);
     return kIdentSize * 2 + 8 + extraCount;
 }
@@ -403,6 +457,8 @@ static int computeInstanceDumpLen(const unsigned char* origBuf, int len)
  */
 static int computeObjectArrayDumpLen(const unsigned char* origBuf, int len)
 {
+    if (len < kIdentSize * 2 + 8)
+        return -1;
     int arrayCount = get4BE(origBuf + kIdentSize + 4);
     return kIdentSize * 2 + 8 + arrayCount * kIdentSize;
 }
@@ -412,36 +468,46 @@ static int computeObjectArrayDumpLen(const unsigned char* origBuf, int len)
  */
 static int computePrimitiveArrayDumpLen(const unsigned char* origBuf, int len)
 {
+    if (len < kIdentSize + 9)
+        return -1;
     int arrayCount = get4BE(origBuf + kIdentSize + 4);
     HprofBasicType basicType = origBuf[kIdentSize + 8];
     int basicLen = computeBasicLen(basicType);
 
+    if (basicLen < 0)
+        return -1;
     return kIdentSize + 9 + arrayCount * basicLen;
 }
 
 /*
- * Crunch through a heap dump record, writing the original or converted
- * data to "out".
+ * Crunch through a heap dump record of "recLen" bytes, adding the
+ * original or converted data to "pOutBuf".
+ *
+ * The converted record is never longer than the original, so the room
+ * for it is made up front and it is written straight into the buffer.
  */
-static int processHeapDump(ExpandBuf* pBuf, FILE* out)
+static int processHeapDump(const unsigned char* origBuf, size_t recLen,
+    ExpandBuf* pOutBuf)
 {
-    ExpandBuf* pOutBuf = ebAlloc();
-    unsigned char* origBuf = ebGetBuffer(pBuf);
-    unsigned char* buf = origBuf;
-    int len = ebGetLength(pBuf);
-    int result = -1;
+    const unsigned char* buf = origBuf;
+    long len = recLen;
+    unsigned char* outStart;
+    unsigned char* out;
 
-    pBuf = NULL;        /* we just use the raw pointer from here forward */
+    if (ebEnsureCapacity(pOutBuf, recLen) != 0)
+        return -1;
+    outStart = out = ebGetBuffer(pOutBuf) + ebGetLength(pOutBuf);
 
     /* copy the original header to the output buffer */
-    if (ebAddData(pOutBuf, buf, kRecHdrLen) != 0)
-        goto bail;
+    memcpy(out, buf, kRecHdrLen);
+    out += kRecHdrLen;
 
     buf += kRecHdrLen;      /* skip past record header */
     len -= kRecHdrLen;
 
     while (len > 0) {
         unsigned char subType = buf[0];
+        unsigned char outType = subType;
         int justCopy = TRUE;
         int subLen;
 
@@ -495,53 +561,51 @@ static int processHeapDump(ExpandBuf* pBuf, FILE* out)
             // no 1.0.2 equivalent for this
             break;
         case HPROF_ROOT_INTERNED_STRING:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_FINALIZING:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_DEBUGGER:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_REFERENCE_CLEANUP:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_VM_INTERNAL:
-            buf[0] = HPROF_ROOT_UNKNOWN;
+        case HPROF_UNREACHABLE:
+            outType = HPROF_ROOT_UNKNOWN;
             subLen = kIdentSize;
             break;
         case HPROF_ROOT_JNI_MONITOR:
             /* keep the ident, drop the next 8 bytes */
-            buf[0] = HPROF_ROOT_UNKNOWN;
+            outType = HPROF_ROOT_UNKNOWN;
             justCopy = FALSE;
-            ebAddData(pOutBuf, buf, 1 + kIdentSize);
             subLen = kIdentSize + 8;
-            break;
-        case HPROF_UNREACHABLE:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
+            if (len >= 1 + subLen) {
+                *out = outType;
+                memcpy(out + 1, buf + 1, kIdentSize);
+                out += 1 + kIdentSize;
+            }
             break;
         case HPROF_PRIMITIVE_ARRAY_NODATA_DUMP:
-            buf[0] = HPROF_PRIMITIVE_ARRAY_DUMP;
-            buf[5] = buf[6] = buf[7] = buf[8] = 0;  /* set array len to 0 */
+            outType = HPROF_PRIMITIVE_ARRAY_DUMP;
             subLen = kIdentSize + 9;
             break;
 
         /* shouldn't get here */
         default:
             fprintf(stderr, "ERROR: unexpected subtype 0x%02x at offset %d\n",
-                subType, buf - origBuf);
-            goto bail;
+                subType, (int) (buf - origBuf));
+            return -1;
+        }
+
+        if (subLen < 0 || len < 1 + subLen) {
+            fprintf(stderr, "ERROR: truncated subtype 0x%02x at offset %d\n",
+                subType, (int) (buf - origBuf));
+            return -1;
         }
 
         if (justCopy) {
             /* copy source data */
             DBUG("(%d)\n", 1 + subLen);
-            ebAddData(pOutBuf, buf, 1 + subLen);
+            *out = outType;
+            memcpy(out + 1, buf + 1, subLen);
+            if (subType == HPROF_PRIMITIVE_ARRAY_NODATA_DUMP)
+                memset(out + 5, 0, 4);      /* set array len to 0 */
+            out += 1 + subLen;
         } else {
             /* other data has been written, or the sub-record omitted */
             DBUG("(adv %d)\n", 1 + subLen);
@@ -555,29 +619,80 @@ static int processHeapDump(ExpandBuf* pBuf, FILE* out)
     /*
      * Update the record length.
      */
-    set4BE(ebGetBuffer(pOutBuf) + 5, ebGetLength(pOutBuf) - kRecHdrLen);
+    set4BE(outStart + 5, out - outStart - kRecHdrLen);
+    pOutBuf->curLen += out - outStart;
 
-    if (ebWriteData(pOutBuf, out) != 0)
-        goto bail;
+    return 0;
+}
 
-    result = 0;
+/*
+ * Add the converted form of the record at "buf", which is "recLen" bytes
+ * with its header, to "pOutBuf".
+ */
+static int processRecord(const unsigned char* buf, size_t recLen,
+    ExpandBuf* pOutBuf)
+{
+    unsigned char type = buf[0];
+
+    if (type == HPROF_TAG_HEAP_DUMP ||
+        type == HPROF_TAG_HEAP_DUMP_SEGMENT)
+    {
+        DBUG("Processing heap dump 0x%02x (%d bytes)\n",
+            type, (int) (recLen - kRecHdrLen));
+        return processHeapDump(buf, recLen, pOutBuf);
+    } else {
+        /* keep */
+        DBUG("Keeping 0x%02x (%d bytes)\n", type, (int) (recLen - kRecHdrLen));
+        return ebAddData(pOutBuf, buf, recLen);
+    }
+}
 
-bail:
-    ebFree(pOutBuf);
-    return result;
+/*
+ * Check the file header, and add its 1.0.2 form to "pOutBuf".  "magic"
+ * is the NUL-terminated format string the header starts with.
+ */
+static int processFileHeader(const char* magic, ExpandBuf* pOutBuf)
+{
+    if (strcmp(magic, "JAVA PROFILE 1.0.3") != 0) {
+        if (strcmp(magic, "JAVA PROFILE 1.0.2") == 0) {
+            fprintf(stderr, "ERROR: HPROF file already in 1.0.2 format.\n");
+        } else {
+            fprintf(stderr, "ERROR: expecting HPROF file format 1.0.3\n");
+        }
+        return -1;
+    }
+
+    /* downgrade to 1.0.2 */
+    size_t start = ebGetLength(pOutBuf);
+    if (ebAddData(pOutBuf, magic, strlen(magic) + 1) != 0)
+        return -1;
+    (ebGetBuffer(pOutBuf) + start)[17] = '2';
+    return 0;
+}
+
+/*
+ * Write out the buffered output if there is enough of it, or any of it
+ * if "force" is set.
+ */
+static int flushOutput(ExpandBuf* pOutBuf, FILE* out, int force)
+{
+    if (ebGetLength(pOutBuf) >= (force ? 1 : kFlushSize))
+        return ebWriteData(pOutBuf, out);
+    return 0;
 }
 
 /*
- * Filter an hprof data file.
+ * Filter an hprof data stream, which zlib inflates if it was gzipped.
  */
-static int filterData(FILE* in, FILE* out)
+static int filterData(gzFile in, FILE* out)
 {
-    const char *magicString;
     ExpandBuf* pBuf;
+    ExpandBuf* pOutBuf;
     int result = -1;
 
     pBuf = ebAlloc();
-    if (pBuf == NULL)
+    pOutBuf = ebAlloc();
+    if (pBuf == NULL || pOutBuf == NULL)
         goto bail;
 
     /*
@@ -585,30 +700,16 @@ static int filterData(FILE* in, FILE* out)
      */
     if (ebReadString(pBuf, in) != 0)
         goto bail;
-
-    magicString = (const char*)ebGetBuffer(pBuf);
-    if (strcmp(magicString, "JAVA PROFILE 1.0.3") != 0) {
-        if (strcmp(magicString, "JAVA PROFILE 1.0.2") == 0) {
-            fprintf(stderr, "ERROR: HPROF file already in 1.0.2 format.\n");
-        } else {
-            fprintf(stderr, "ERROR: expecting HPROF file format 1.0.3\n");
-        }
-        goto bail;
-    }
-
-    /* downgrade to 1.0.2 */
-    (ebGetBuffer(pBuf))[17] = '2';
-    if (ebWriteData(pBuf, out) != 0)
+    if (processFileHeader((const char*) ebGetBuffer(pBuf), pOutBuf) != 0)
         goto bail;
+    ebClear(pBuf);
 
     /*
      * Copy:
      * (4b) identifier size, always 4
      * (8b) file creation date
      */
-    if (ebReadData(pBuf, in, 12, FALSE) != 0)
-        goto bail;
-    if (ebWriteData(pBuf, out) != 0)
+    if (ebReadData(pOutBuf, in, 12, FALSE) != 0)
         goto bail;
 
     /*
@@ -623,21 +724,14 @@ static int filterData(FILE* in, FILE* out)
         /* read type char */
         if (ebReadData(pBuf, in, 1, TRUE) != 0)
             goto bail;
-        if (feof(in))
+        if (gzeof(in))
             break;
 
         /* read the rest of the header */
         if (ebReadData(pBuf, in, kRecHdrLen-1, FALSE) != 0)
             goto bail;
 
-        unsigned char* buf = ebGetBuffer(pBuf);
-        unsigned char type;
-        unsigned int timestamp, length;
-
-        type = buf[0];
-        timestamp = get4BE(buf + 1);
-        length = get4BE(buf + 5);
-        buf = NULL;     /* ptr invalid after next read op */
+        unsigned int length = get4BE(ebGetBuffer(pBuf) + 5);
 
         /* read the record data */
         if (length != 0) {
@@ -645,80 +739,317 @@ static int filterData(FILE* in, FILE* out)
                 goto bail;
         }
 
-        if (type == HPROF_TAG_HEAP_DUMP ||
-            type == HPROF_TAG_HEAP_DUMP_SEGMENT)
-        {
-            DBUG("Processing heap dump 0x%02x (%d bytes)\n",
-                type, length);
-            if (processHeapDump(pBuf, out) != 0)
-                goto bail;
-            ebClear(pBuf);
-        } else {
-            /* keep */
-            DBUG("Keeping 0x%02x (%d bytes)\n", type, length);
-            if (ebWriteData(pBuf, out) != 0)
-                goto bail;
-        }
+        if (processRecord(ebGetBuffer(pBuf), ebGetLength(pBuf), pOutBuf) != 0)
+            goto bail;
+        ebClear(pBuf);
+        if (flushOutput(pOutBuf, out, FALSE) != 0)
+            goto bail;
     }
 
+    if (flushOutput(pOutBuf, out, TRUE) != 0)
+        goto bail;
+
     result = 0;
 
 bail:
     ebFree(pBuf);
+    ebFree(pOutBuf);
     return result;
 }
 
+#ifdef HAVE_MMAP_INPUT
+/*
+ * Returns the length of the first record at "buf", or 0 if it runs past
+ * the "size" bytes that are left.
+ */
+static size_t recordLen(const unsigned char* buf, size_t size)
+{
+    if (size < kRecHdrLen)
+        return 0;
+    size_t length = get4BE(buf + 5);
+    if (length > size - kRecHdrLen)
+        return 0;
+    return kRecHdrLen + length;
+}
+
+/*
+ * Convert the "size" bytes of records at "buf" into "pOutBuf".  If "out"
+ * isn't NULL, the output is written out as it builds up.
+ */
+static int processRecords(const unsigned char* buf, size_t size,
+    ExpandBuf* pOutBuf, FILE* out)
+{
+    while (size > 0) {
+        size_t recLen = recordLen(buf, size);
+        if (recLen == 0) {
+            fprintf(stderr, "ERROR: truncated record 0x%02x\n", buf[0]);
+            return -1;
+        }
+        if (processRecord(buf, recLen, pOutBuf) != 0)
+            return -1;
+        if (out != NULL && flushOutput(pOutBuf, out, FALSE) != 0)
+            return -1;
+        buf += recLen;
+        size -= recLen;
+    }
+    return 0;
+}
+
+/*
+ * A run of whole records, converted by a thread of its own.
+ */
+typedef struct {
+    const unsigned char* buf;
+    size_t size;
+    ExpandBuf* pOutBuf;
+    pthread_t thread;
+    int started;
+    int result;
+} Chunk;
+
+static void* chunkThreadStart(void* arg)
+{
+    Chunk* pChunk = (Chunk*) arg;
+
+    pChunk->result = processRecords(pChunk->buf, pChunk->size,
+        pChunk->pOutBuf, NULL);
+    return NULL;
+}
+
+/*
+ * Returns the length of the run of whole records at "buf" that makes up
+ * the next chunk.  A truncated record ends the chunk, for processRecords
+ * to report.
+ */
+static size_t chunkLen(const unsigned char* buf, size_t size)
+{
+    size_t len = 0;
+
+    while (len < kChunkSize && len < size) {
+        size_t recLen = recordLen(buf + len, size - len);
+        if (recLen == 0)
+            return size;
+        len += recLen;
+    }
+    return len;
+}
+
+/*
+ * Convert the records with "numThreads" threads, "numThreads" chunks at
+ * a time, writing each round of chunks out in order.
+ */
+static int processRecordsInParallel(const unsigned char* buf, size_t size,
+    int numThreads, FILE* out)
+{
+    Chunk chunks[kMaxThreads];
+    int i, result = 0;
+
+    memset(chunks, 0, sizeof(chunks));
+    for (i = 0; i < numThreads; i++) {
+        chunks[i].pOutBuf = ebAlloc();
+        if (chunks[i].pOutBuf == NULL)
+            result = -1;
+    }
+
+    while (result == 0 && size > 0) {
+        int numChunks;
+
+        for (numChunks = 0; numChunks < numThreads && size > 0; numChunks++) {
+            Chunk* pChunk = &chunks[numChunks];
+            pChunk->buf = buf;
+            pChunk->size = chunkLen(buf, size);
+            pChunk->started = (pthread_create(&pChunk->thread, NULL,
+                chunkThreadStart, pChunk) == 0);
+            if (!pChunk->started)
+                chunkThreadStart(pChunk);
+            buf += pChunk->size;
+            size -= pChunk->size;
+        }
+
+        for (i = 0; i < numChunks; i++) {
+            Chunk* pChunk = &chunks[i];
+            if (pChunk->started)
+                pthread_join(pChunk->thread, NULL);
+            if (result == 0 && pChunk->result != 0)
+                result = -1;
+            if (result == 0 && flushOutput(pChunk->pOutBuf, out, TRUE) != 0)
+                result = -1;
+            ebClear(pChunk->pOutBuf);
+        }
+    }
+
+    for (i = 0; i < numThreads; i++)
+        ebFree(chunks[i].pOutBuf);
+    return result;
+}
+
+/*
+ * Filter an uncompressed hprof file mapped at "buf".
+ */
+static int filterMappedData(const unsigned char* buf, size_t size,
+    int numThreads, FILE* out)
+{
+    ExpandBuf* pOutBuf;
+    const unsigned char* end;
+    int result = -1;
+
+    pOutBuf = ebAlloc();
+    if (pOutBuf == NULL)
+        goto bail;
+
+    /*
+     * Copy the header, then:
+     * (4b) identifier size, always 4
+     * (8b) file creation date
+     */
+    end = (const unsigned char*) memchr(buf, '\0', size);
+    if (end == NULL || (size_t) (end + 1 + 12 - buf) > size) {
+        fprintf(stderr, "ERROR: failed reading input\n");
+        goto bail;
+    }
+    if (processFileHeader((const char*) buf, pOutBuf) != 0)
+        goto bail;
+    if (ebAddData(pOutBuf, end + 1, 12) != 0)
+        goto bail;
+    size -= end + 1 + 12 - buf;
+    buf = end + 1 + 12;
+
+    if (numThreads > 1) {
+        if (flushOutput(pOutBuf, out, TRUE) != 0)
+            goto bail;
+        if (processRecordsInParallel(buf, size, numThreads, out) != 0)
+            goto bail;
+    } else {
+        if (processRecords(buf, size, pOutBuf, out) != 0)
+            goto bail;
+        if (flushOutput(pOutBuf, out, TRUE) != 0)
+            goto bail;
+    }
+
+    result = 0;
+
+bail:
+    ebFree(pOutBuf);
+    return result;
+}
+
+/*
+ * Map "fileName" and filter it, unless it is gzipped or can't be mapped.
+ * Returns -2 if the file should be read through zlib instead.
+ */
+static int filterFile(const char* fileName, int numThreads, FILE* out)
+{
+    struct stat st;
+    void* map;
+    int fd, result;
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return -2;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 2 ||
+        (uint64_t) st.st_size > SIZE_MAX)
+    {
+        close(fd);
+        return -2;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -2;
+
+    const unsigned char* buf = (const unsigned char*) map;
+    if (buf[0] == 0x1f && buf[1] == 0x8b) {
+        /* gzip magic */
+        munmap(map, st.st_size);
+        return -2;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    result = filterMappedData(buf, st.st_size, numThreads, out);
+    munmap(map, st.st_size);
+    return result;
+}
+#endif
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: hprof-conf [-j threads] infile outfile\n\n");
+    fprintf(stderr,
+        "Specify '-' for either or both to use stdin/stdout.\n"
+        "With -j, an uncompressed infile is converted by that many "
+        "threads.\n\n");
+
+    fprintf(stderr,
+        "Copyright (C) 2009 The Android Open Source Project\n\n"
+        "This software is built from source code licensed under the "
+        "Apache License,\n"
+        "Version 2.0 (the \"License\"). You may obtain a copy of the "
+        "License at\n\n"
+        "     http://www.apache.org/licenses/LICENSE-2.0\n\n"
+        "See the associated NOTICE file for this software for further "
+        "details.\n");
+}
+
 /*
  * Get args.
  */
 int main(int argc, char** argv)
 {
-    FILE* in = stdin;
+    gzFile in;
     FILE* out = stdout;
-    int cc;
-
+    int numThreads = 1;
+    int cc = -2;
+
+    if (argc == 5 && strcmp(argv[1], "-j") == 0) {
+        numThreads = atoi(argv[2]);
+        if (numThreads < 1 || numThreads > kMaxThreads) {
+            fprintf(stderr, "ERROR: threads must be 1 to %d\n", kMaxThreads);
+            return 2;
+        }
+        argc -= 2;
+        argv += 2;
+    }
     if (argc != 3) {
-        fprintf(stderr, "Usage: hprof-conf infile outfile\n\n");
-        fprintf(stderr,
-            "Specify '-' for either or both to use stdin/stdout.\n\n");
-
-        fprintf(stderr,
-            "Copyright (C) 2009 The Android Open Source Project\n\n"
-            "This software is built from source code licensed under the "
-            "Apache License,\n"
-            "Version 2.0 (the \"License\"). You may obtain a copy of the "
-            "License at\n\n"
-            "     http://www.apache.org/licenses/LICENSE-2.0\n\n"
-            "See the associated NOTICE file for this software for further "
-            "details.\n");
-
+        usage();
         return 2;
     }
 
-    if (strcmp(argv[1], "-") != 0) {
-        in = fopen(argv[1], "rb");
-        if (in == NULL) {
-            fprintf(stderr, "ERROR: failed to open input '%s': %s\n",
-                argv[1], strerror(errno));
-            return 1;
-        }
-    }
     if (strcmp(argv[2], "-") != 0) {
         out = fopen(argv[2], "wb");
         if (out == NULL) {
             fprintf(stderr, "ERROR: failed to open output '%s': %s\n",
                 argv[2], strerror(errno));
-            if (in != stdin)
-                fclose(in);
             return 1;
         }
     }
 
-    cc = filterData(in, out);
+#ifdef HAVE_MMAP_INPUT
+    if (strcmp(argv[1], "-") != 0)
+        cc = filterFile(argv[1], numThreads, out);
+#endif
+
+    if (cc == -2) {
+        /* gzip'd or not, zlib sorts it out */
+        if (strcmp(argv[1], "-") != 0) {
+            in = gzopen(argv[1], "rb");
+        } else {
+            in = gzdopen(fileno(stdin), "rb");
+        }
+        if (in == NULL) {
+            fprintf(stderr, "ERROR: failed to open input '%s': %s\n",
+                argv[1], strerror(errno));
+            if (out != stdout)
+                fclose(out);
+            return 1;
+        }
+        cc = filterData(in, out);
+        gzclose(in);
+    }
 
-    if (in != stdin)
-        fclose(in);
-    if (out != stdout)
-        fclose(out);
+    if (out != stdout && fclose(out) != 0 && cc == 0) {
+        fprintf(stderr, "ERROR: failed writing output '%s': %s\n",
+            argv[2], strerror(errno));
+        cc = -1;
+    }
     return (cc != 0);
 }
@@ -36,6 +36,172 @@ LOCAL_SHARED_LIBRARIES += libcutils libdvm
 LOCAL_32_BIT_ONLY := true
 include $(BUILD_NATIVE_TEST)
 
+# A microbenchmark of the heap bitmap walks. Run with:
+#   adb shell /data/nativetest/dalvik-vm-bitmap-benchmark/dalvik-vm-bitmap-benchmark
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_SMP=1
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-bitmap-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-bitmap-benchmark
+LOCAL_SRC_FILES := dvmHeapBitmapWalk_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A benchmark of array allocation, run in a VM of its own. Arguments are
+# passed to the VM. Run with:
+#   adb shell /data/nativetest/dalvik-vm-array-benchmark/dalvik-vm-array-benchmark
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-array-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-array-benchmark
+LOCAL_SRC_FILES := dvmArrayAlloc_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A benchmark of calls between interpreted methods, run in a VM of its own.
+# Arguments are passed to the VM. Run with:
+#   adb shell /data/nativetest/dalvik-vm-invoke-benchmark/dalvik-vm-invoke-benchmark
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-invoke-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-invoke-benchmark
+LOCAL_SRC_FILES := dvmInvoke_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A microbenchmark of LEB128 decoding, one value at a time and in groups.
+# Run with:
+#   adb shell /data/nativetest/dalvik-vm-leb128-benchmark/dalvik-vm-leb128-benchmark
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-leb128-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-leb128-benchmark
+LOCAL_SRC_FILES := dvmLeb128_benchmark.cpp
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A benchmark of the BitVector operations, running a JIT-style liveness
+# fixpoint over large synthetic loop bodies. Run with:
+#   adb shell /data/nativetest/dalvik-vm-bitvector-benchmark/dalvik-vm-bitvector-benchmark
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_SMP=1
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-bitvector-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-bitvector-benchmark
+LOCAL_SRC_FILES := dvmBitVector_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A benchmark of the 64-bit quasi-atomics behind volatile long fields,
+# with several threads contending for the fields of one object. The
+# argument is the largest number of threads to try. Run with:
+#   adb shell /data/nativetest/dalvik-vm-quasiatomic-benchmark/dalvik-vm-quasiatomic-benchmark
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_SMP=1
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-quasiatomic-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-quasiatomic-benchmark
+LOCAL_SRC_FILES := dvmQuasiAtomic_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# Litmus tests of the barriers behind volatile fields: Dekker and message
+# passing through volatile int and long fields. The argument is the number
+# of chunks of iterations to run. Run with:
+#   adb shell /data/nativetest/dalvik-vm-volatile-stress/dalvik-vm-volatile-stress
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_SMP=1
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-volatile-stress
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-volatile-stress
+LOCAL_SRC_FILES := dvmVolatile_stress.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A benchmark of the VM's hot paths, from allocation and locking to JNI and
+# interface dispatch, run in a VM of its own. Prints one "<name> <ns/op>
+# <ops>" line per benchmark for comparing builds. Arguments are passed to
+# the VM. Run with:
+#   adb shell /data/nativetest/dalvik-vm-hotpaths-benchmark/dalvik-vm-hotpaths-benchmark
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_SMP=1
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-hotpaths-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-hotpaths-benchmark
+LOCAL_SRC_FILES := dvmHotPaths_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# A GC stress harness: runs the allocation patterns in GcStress.java in a
+# VM of its own and prints one line per workload with the pause
+# percentiles, GC time and CPU, and footprint, for comparing collector
+# options and changes. Arguments not for the harness are passed to the VM.
+# Run with:
+#   adb shell /data/nativetest/dalvik-vm-gcstress-benchmark/dalvik-vm-gcstress-benchmark
+include $(CLEAR_VARS)
+LOCAL_MODULE := dalvik-vm-gcstress-workload
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-gcstress-benchmark
+LOCAL_SRC_FILES := GcStress.java
+LOCAL_DEX_PREOPT := false
+include $(BUILD_JAVA_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_SMP=1
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-gcstress-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-gcstress-benchmark
+LOCAL_SRC_FILES := dvmGcStress_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_REQUIRED_MODULES := dalvik-vm-gcstress-workload
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
+# Bytecode microbenchmarks for the interpreters and the JIT: runs the
+# loops in InterpBench.java in a VM of its own and prints one "<name>
+# <ns/op> <ops> <compilations> <code-cache-bytes>" line per benchmark.
+# Arguments are passed to the VM, so run it once per mode:
+#   adb shell /data/nativetest/dalvik-vm-interp-benchmark/dalvik-vm-interp-benchmark -Xint:portable
+#   adb shell /data/nativetest/dalvik-vm-interp-benchmark/dalvik-vm-interp-benchmark -Xint:fast
+#   adb shell /data/nativetest/dalvik-vm-interp-benchmark/dalvik-vm-interp-benchmark -Xint:jit
+include $(CLEAR_VARS)
+LOCAL_MODULE := dalvik-vm-interp-corpus
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-interp-benchmark
+LOCAL_SRC_FILES := InterpBench.java
+LOCAL_DEX_PREOPT := false
+include $(BUILD_JAVA_LIBRARY)
+
+include $(CLEAR_VARS)
+# The installed libdvm is always built with the JIT (see vm/Android.mk),
+# and the JIT counters live in gDvmJit.
+LOCAL_CFLAGS += -DANDROID_SMP=1 -DWITH_JIT
+LOCAL_C_INCLUDES += $(test_c_includes)
+LOCAL_MODULE := dalvik-vm-interp-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/dalvik-vm-interp-benchmark
+LOCAL_SRC_FILES := dvmInterp_benchmark.cpp
+LOCAL_SHARED_LIBRARIES += libcutils libdvm
+LOCAL_REQUIRED_MODULES := dalvik-vm-interp-corpus
+LOCAL_32_BIT_ONLY := true
+include $(BUILD_EXECUTABLE)
+
 # Build for the host.
 # TODO: BUILD_HOST_NATIVE_TEST doesn't work yet; STL-related compile-time and
 # run-time failures, presumably astl/stlport/genuine host STL confusion.
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import java.lang.ref.WeakReference;
+
+/**
+ * The allocation patterns driven by dvmGcStress_benchmark.  Each
+ * workload is a static method that does one round of <ops> operations
+ * and returns a value that depends on all of them, so nothing can be
+ * optimized away.  The live set is kept across rounds and workloads, so
+ * every collection has something to mark.
+ */
+public class GcStress {
+    private static final int LARGE_ARRAY_BYTES = 256 * 1024;
+    private static final int LARGE_ARRAYS_KEPT = 8;
+    private static final int WEAK_REFS_KEPT = 4096;
+    private static final int GRAPH_DEPTH = 64 * 1024;
+
+    private static Node[] liveSet = new Node[0];
+    private static int liveSetCursor;
+
+    private static byte[][] largeArrays = new byte[LARGE_ARRAYS_KEPT][];
+    private static WeakReference<Object>[] weakRefs =
+            newWeakRefArray(WEAK_REFS_KEPT);
+    private static Object[] weakReferents = new Object[WEAK_REFS_KEPT / 4];
+    private static Node deepGraph;
+
+    static volatile int finalized;
+
+    static class Node {
+        Node left;
+        Node right;
+        int value;
+
+        Node(Node left, Node right, int value) {
+            this.left = left;
+            this.right = right;
+            this.value = value;
+        }
+    }
+
+    static class Finalizable {
+        private final int value;
+
+        Finalizable(int value) {
+            this.value = value;
+        }
+
+        @Override protected void finalize() throws Throwable {
+            finalized += value & 1;
+            super.finalize();
+        }
+    }
+
+    @SuppressWarnings("unchecked")
+    private static WeakReference<Object>[] newWeakRefArray(int length) {
+        return (WeakReference<Object>[]) new WeakReference[length];
+    }
+
+    /**
+     * Keeps about <kbytes> kilobytes of small objects reachable, as
+     * binary trees of 64 nodes.
+     */
+    public static void setLiveSet(int kbytes) {
+        int trees = kbytes * 1024 / (64 * 24);
+        Node[] set = new Node[trees];
+        for (int i = 0; i < trees; i++) {
+            set[i] = tree(6, i);
+        }
+        liveSet = set;
+        liveSetCursor = 0;
+    }
+
+    private static Node tree(int depth, int value) {
+        if (depth == 0) {
+            return null;
+        }
+        return new Node(tree(depth - 1, value), tree(depth - 1, value), value);
+    }
+
+    /**
+     * Replaces a few of the live trees, so the old ones die in middle
+     * age and the card table sees old-to-young stores.
+     */
+    private static void churnLiveSet(int value) {
+        if (liveSet.length != 0) {
+            liveSet[liveSetCursor] = tree(6, value);
+            liveSetCursor = (liveSetCursor + 1) % liveSet.length;
+        }
+    }
+
+    /**
+     * Small objects and arrays that die at once.
+     */
+    public static int young(int ops) {
+        int sum = 0;
+        for (int i = 0; i < ops; i++) {
+            Node n = new Node(null, null, i);
+            int[] a = new int[i & 15];
+            sum += n.value + a.length;
+            if ((i & 1023) == 0) {
+                churnLiveSet(i);
+            }
+        }
+        return sum;
+    }
+
+    /**
+     * Arrays big enough to take the large object path, a few of which
+     * stay live until replaced.
+     */
+    public static int largeArrays(int ops) {
+        int sum = 0;
+        for (int i = 0; i < ops; i++) {
+            byte[] a = new byte[LARGE_ARRAY_BYTES + (i & 7) * 4096];
+            a[i % a.length] = (byte) i;
+            largeArrays[i % LARGE_ARRAYS_KEPT] = a;
+            sum += a.length;
+        }
+        return sum;
+    }
+
+    /**
+     * Weak references, a quarter of whose referents stay strongly
+     * reachable for a while, so reference processing has both kinds
+     * to deal with.
+     */
+    public static int weakRefs(int ops) {
+        int cleared = 0;
+        for (int i = 0; i < ops; i++) {
+            int slot = i % WEAK_REFS_KEPT;
+            WeakReference<Object> old = weakRefs[slot];
+            if (old != null && old.get() == null) {
+                cleared++;
+            }
+            Object referent = new Node(null, null, i);
+            if ((i & 3) == 0) {
+                weakReferents[(i >> 2) % weakReferents.length] = referent;
+            }
+            weakRefs[slot] = new WeakReference<Object>(referent);
+        }
+        return cleared;
+    }
+
+    /**
+     * Objects with finalizers, none of which are kept.
+     */
+    public static int finalizers(int ops) {
+        for (int i = 0; i < ops; i++) {
+            new Finalizable(i);
+        }
+        return finalized;
+    }
+
+    /**
+     * A long chain whose nodes point back into it, replaced piece by
+     * piece, so marking has a deep graph to trace rather than a wide
+     * one.
+     */
+    public static int deepGraph(int ops) {
+        int sum = 0;
+        for (int i = 0; i < ops; i++) {
+            if (deepGraph == null || (i % GRAPH_DEPTH) == 0) {
+                deepGraph = new Node(null, null, 0);
+            }
+            Node head = new Node(deepGraph, null, i);
+            head.right = deepGraph.left != null ? deepGraph.left : head;
+            deepGraph = head;
+            sum += head.value;
+        }
+        return sum;
+    }
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * The bytecode microbenchmarks driven by dvmInterp_benchmark.  Each is a
+ * static method "int name(int ops)" whose loop runs <ops> times around a
+ * small body built from one kind of instruction, and returns a value
+ * that depends on every iteration, so the loop can't be skipped.  The
+ * bodies are kept short so a trace covers the whole loop under the JIT.
+ */
+public class InterpBench {
+    interface Shape {
+        int area();
+    }
+
+    static class Square implements Shape {
+        int side;
+        Square(int side) { this.side = side; }
+        public int area() { return side * side; }
+        int size() { return side; }
+    }
+
+    static class Rect extends Square {
+        int height;
+        Rect(int side, int height) { super(side); this.height = height; }
+        public int area() { return side * height; }
+        int size() { return side + height; }
+    }
+
+    static class Circle extends Square {
+        Circle(int radius) { super(radius); }
+        public int area() { return 3 * side * side; }
+        int size() { return 2 * side; }
+    }
+
+    static class BenchException extends Exception {
+        BenchException() { super(); }
+    }
+
+    private static final BenchException EXCEPTION = new BenchException();
+
+    private static int staticCounter;
+    private int instanceCounter;
+    private long instanceLong;
+    private Object instanceRef;
+
+    private static final int[] INTS = new int[1024];
+    private static final Object[] REFS = new Object[1024];
+    private static final Square[] SHAPES = {
+        new Square(3), new Rect(3, 4), new Circle(2)
+    };
+    private static final String TEXT =
+            "The quick brown fox jumps over the lazy dog";
+
+    static {
+        for (int i = 0; i < INTS.length; i++) {
+            INTS[i] = i * 31;
+            REFS[i] = (i & 1) == 0 ? TEXT : null;
+        }
+    }
+
+    /* Arithmetic loops. */
+
+    public static int intArith(int ops) {
+        int x = 1;
+        for (int i = 0; i < ops; i++) {
+            x = (x * 33 + i) ^ (x >>> 7);
+        }
+        return x;
+    }
+
+    public static int intDiv(int ops) {
+        int x = 0;
+        for (int i = 1; i <= ops; i++) {
+            x += 1000003 / i + 1000003 % i;
+        }
+        return x;
+    }
+
+    public static int longArith(int ops) {
+        long x = 1;
+        for (int i = 0; i < ops; i++) {
+            x = (x * 6364136223846793005L + i) ^ (x >>> 29);
+        }
+        return (int) (x ^ (x >>> 32));
+    }
+
+    public static int doubleArith(int ops) {
+        double x = 1.0;
+        for (int i = 0; i < ops; i++) {
+            x = x * 1.0000001 + 0.5 / (i + 1);
+        }
+        return (int) x;
+    }
+
+    /* Field access. */
+
+    public static int instanceFields(int ops) {
+        InterpBench b = new InterpBench();
+        for (int i = 0; i < ops; i++) {
+            b.instanceCounter += i;
+            b.instanceLong += b.instanceCounter;
+            b.instanceRef = (i & 1) == 0 ? b : null;
+        }
+        return b.instanceCounter + (int) b.instanceLong
+                + (b.instanceRef == null ? 0 : 1);
+    }
+
+    public static int staticFields(int ops) {
+        staticCounter = 0;
+        for (int i = 0; i < ops; i++) {
+            staticCounter += i;
+        }
+        return staticCounter;
+    }
+
+    /* Array loops. */
+
+    public static int intArrayLoop(int ops) {
+        int[] a = INTS;
+        int sum = 0;
+        for (int i = 0; i < ops; i++) {
+            int j = i & 1023;
+            sum += a[j];
+            a[j] = sum;
+        }
+        return sum;
+    }
+
+    public static int refArrayLoop(int ops) {
+        Object[] a = REFS;
+        int nulls = 0;
+        for (int i = 0; i < ops; i++) {
+            int j = i & 1023;
+            Object o = a[j];
+            if (o == null) {
+                nulls++;
+            }
+            a[1023 - j] = o;
+        }
+        return nulls;
+    }
+
+    /* Invokes. */
+
+    private static int staticCallee(int x) {
+        return x + 1;
+    }
+
+    public static int invokeStatic(int ops) {
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            x = staticCallee(x);
+        }
+        return x;
+    }
+
+    public static int invokeVirtualMono(int ops) {
+        Square s = SHAPES[0];
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            x += s.size();
+        }
+        return x;
+    }
+
+    public static int invokeVirtualPoly(int ops) {
+        Square[] shapes = SHAPES;
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            x += shapes[i % 3].size();
+        }
+        return x;
+    }
+
+    public static int invokeInterface(int ops) {
+        Shape[] shapes = SHAPES;
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            x += shapes[i % 3].area();
+        }
+        return x;
+    }
+
+    /* Exceptions. */
+
+    private static void thrower(int i) throws BenchException {
+        if (i >= 0) {
+            throw EXCEPTION;
+        }
+    }
+
+    public static int throwCatch(int ops) {
+        int caught = 0;
+        for (int i = 0; i < ops; i++) {
+            try {
+                thrower(i);
+            } catch (BenchException e) {
+                caught++;
+            }
+        }
+        return caught;
+    }
+
+    public static int throwNewCatch(int ops) {
+        int caught = 0;
+        for (int i = 0; i < ops; i++) {
+            try {
+                throw new BenchException();
+            } catch (BenchException e) {
+                caught++;
+            }
+        }
+        return caught;
+    }
+
+    /* String operations, mostly through the inlined natives. */
+
+    public static int stringCharAt(int ops) {
+        String s = TEXT;
+        int len = s.length();
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            x += s.charAt(i % len);
+        }
+        return x;
+    }
+
+    public static int stringEquals(int ops) {
+        String a = TEXT;
+        String b = new String(TEXT);
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            if (a.equals(b)) {
+                x++;
+            }
+        }
+        return x;
+    }
+
+    public static int stringIndexOf(int ops) {
+        String s = TEXT;
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            x += s.indexOf('z' - (i & 7));
+        }
+        return x;
+    }
+
+    public static int stringBuilder(int ops) {
+        StringBuilder sb = new StringBuilder();
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            sb.append((char) ('a' + (i & 15)));
+            if (sb.length() == 64) {
+                x += sb.toString().hashCode();
+                sb.setLength(0);
+            }
+        }
+        return x;
+    }
+
+    /* Control flow. */
+
+    public static int packedSwitch(int ops) {
+        int x = 0;
+        for (int i = 0; i < ops; i++) {
+            switch (i & 7) {
+            case 0: x += 1; break;
+            case 1: x ^= 2; break;
+            case 2: x -= 3; break;
+            case 3: x += i; break;
+            case 4: x >>= 1; break;
+            case 5: x <<= 1; break;
+            case 6: x |= 6; break;
+            default: x &= 0xffff; break;
+            }
+        }
+        return x;
+    }
+}
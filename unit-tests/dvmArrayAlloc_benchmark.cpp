@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cost of allocating arrays of a range of sizes, zeroing
+ * included, through JNI in a VM of its own.  Primitive arrays may go
+ * to the large object space while object arrays always come from the
+ * heaps, so both kinds are timed.  Arguments are passed on to the VM,
+ * which makes it easy to compare, say, -XX:LargeObjectThreshold=0 or
+ * -XX:LowMemoryMode against the defaults.
+ */
+
+#include <jni.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* The number of bytes allocated for each size and kind. */
+#define BYTES_PER_RUN   (256 * 1024 * 1024)
+#define RUNS            3
+
+static uint64_t nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+enum Kind { BYTE_ARRAY, OBJECT_ARRAY };
+
+static const char *kKindNames[] = { "byte[]", "Object[]" };
+
+/*
+ * Returns the best time of RUNS runs, in nanoseconds, or 0 if an
+ * allocation failed.
+ */
+static uint64_t timeAllocations(JNIEnv *env, jclass objectClass, Kind kind,
+                                size_t bytes, size_t count)
+{
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < RUNS; ++run) {
+        uint64_t start = nowNsec();
+        for (size_t i = 0; i < count; ++i) {
+            jobject array;
+            if (kind == BYTE_ARRAY) {
+                array = env->NewByteArray(bytes);
+            } else {
+                array = env->NewObjectArray(bytes / sizeof(jobject),
+                                            objectClass, NULL);
+            }
+            if (array == NULL) {
+                env->ExceptionClear();
+                return 0;
+            }
+            env->DeleteLocalRef(array);
+        }
+        uint64_t elapsed = nowNsec() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t kSizes[] = {
+        1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4096 * 1024
+    };
+
+    JavaVMOption *options = new JavaVMOption[argc];
+    for (int i = 1; i < argc; ++i) {
+        options[i - 1].optionString = argv[i];
+        options[i - 1].extraInfo = NULL;
+    }
+    JavaVMInitArgs args;
+    args.version = JNI_VERSION_1_6;
+    args.nOptions = argc - 1;
+    args.options = options;
+    args.ignoreUnrecognized = JNI_FALSE;
+
+    JavaVM *vm;
+    JNIEnv *env;
+    if (JNI_CreateJavaVM(&vm, &env, &args) != JNI_OK) {
+        fprintf(stderr, "Unable to create the VM\n");
+        return 1;
+    }
+    jclass objectClass = env->FindClass("java/lang/Object");
+    if (objectClass == NULL) {
+        fprintf(stderr, "Unable to find java.lang.Object\n");
+        return 1;
+    }
+
+    printf("%-9s %9s %8s %12s %10s\n",
+           "kind", "bytes", "count", "ns/array", "MB/s");
+    for (int kind = BYTE_ARRAY; kind <= OBJECT_ARRAY; ++kind) {
+        for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+            size_t count = BYTES_PER_RUN / kSizes[i];
+            uint64_t nsec = timeAllocations(env, objectClass, (Kind)kind,
+                                            kSizes[i], count);
+            if (nsec == 0) {
+                printf("%-9s %9zd allocation failed\n",
+                       kKindNames[kind], kSizes[i]);
+                continue;
+            }
+            printf("%-9s %9zd %8zd %12.1f %10.1f\n",
+                   kKindNames[kind], kSizes[i], count,
+                   (double)nsec / count,
+                   BYTES_PER_RUN / 1048576.0 / (nsec / 1e9));
+        }
+    }
+    vm->DestroyJavaVM();
+    delete[] options;
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs a backward liveness fixpoint, the way the JIT's dataflow passes
+ * use bit vectors, over a synthetic loop body: a chain of basic blocks
+ * with a back edge and some random forward branches, each using and
+ * defining random virtual registers.  The same solve is done once with
+ * the BitVector functions and once with copies of the one-word-at-a-time
+ * versions they replaced; the two must agree.
+ */
+
+#include "Dalvik.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RUNS            5
+#define USES_PER_BLOCK  6
+#define DEFS_PER_BLOCK  3
+
+struct Block {
+    int succ[2];                /* -1 if absent */
+    BitVector* use;
+    BitVector* notDef;          /* complement of the defined registers */
+    BitVector* liveIn;
+    BitVector* liveOut;
+};
+
+static volatile u4 gSink;
+
+static u8 nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u8)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static Block *buildLoop(int numBlocks, int numRegs)
+{
+    srand(numBlocks ^ numRegs);
+    Block *blocks = (Block *)calloc(numBlocks, sizeof(Block));
+    for (int i = 0; i < numBlocks; ++i) {
+        Block *bb = &blocks[i];
+        bb->succ[0] = (i + 1) % numBlocks;      /* last one is the back edge */
+        bb->succ[1] = (rand() % 4 == 0 && i + 2 < numBlocks)
+                      ? i + 2 + rand() % (numBlocks - i - 2) : -1;
+        bb->use = dvmAllocBitVector(numRegs, false);
+        bb->notDef = dvmAllocBitVector(numRegs, false);
+        bb->liveIn = dvmAllocBitVector(numRegs, false);
+        bb->liveOut = dvmAllocBitVector(numRegs, false);
+        for (int j = 0; j < USES_PER_BLOCK; ++j) {
+            dvmSetBit(bb->use, rand() % numRegs);
+        }
+        dvmSetInitialBits(bb->notDef, numRegs);
+        for (int j = 0; j < DEFS_PER_BLOCK; ++j) {
+            dvmClearBit(bb->notDef, rand() % numRegs);
+        }
+    }
+    return blocks;
+}
+
+static void resetLiveness(Block *blocks, int numBlocks)
+{
+    for (int i = 0; i < numBlocks; ++i) {
+        dvmClearAllBits(blocks[i].liveIn);
+        dvmClearAllBits(blocks[i].liveOut);
+    }
+}
+
+/*
+ * The operations the solve uses.  "ref" is the one-word-at-a-time code
+ * BitVector.cpp had before; "lib" is what it has now.
+ */
+struct BitVectorOps {
+    const char *name;
+    bool (*unify)(BitVector *, const BitVector *, const BitVector *);
+    bool (*intersect)(BitVector *, const BitVector *, const BitVector *);
+    bool (*checkMerge)(BitVector *, const BitVector *);
+    int (*countSetBits)(const BitVector *);
+    int (*iteratorNext)(BitVectorIterator *);
+};
+
+static bool refUnify(BitVector *dest, const BitVector *src1,
+                     const BitVector *src2)
+{
+    for (unsigned int idx = 0; idx < dest->storageSize; idx++) {
+        dest->storage[idx] = src1->storage[idx] | src2->storage[idx];
+    }
+    return true;
+}
+
+static bool refIntersect(BitVector *dest, const BitVector *src1,
+                         const BitVector *src2)
+{
+    for (unsigned int idx = 0; idx < dest->storageSize; idx++) {
+        dest->storage[idx] = src1->storage[idx] & src2->storage[idx];
+    }
+    return true;
+}
+
+static bool refCheckMerge(BitVector *dst, const BitVector *src)
+{
+    bool changed = false;
+    for (unsigned int idx = 0; idx < dst->storageSize; idx++) {
+        u4 merged = src->storage[idx] | dst->storage[idx];
+        if (dst->storage[idx] != merged) {
+            dst->storage[idx] = merged;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static int refCountSetBits(const BitVector *pBits)
+{
+    unsigned int count = 0;
+    for (unsigned int word = 0; word < pBits->storageSize; word++) {
+        u4 val = pBits->storage[word];
+        if (val == 0xffffffff) {
+            count += 32;
+        } else {
+            while (val != 0) {
+                val &= val - 1;
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static int refIteratorNext(BitVectorIterator *iterator)
+{
+    const BitVector *pBits = iterator->pBits;
+    for (u4 bitIndex = iterator->idx; bitIndex < iterator->bitSize;
+         bitIndex++) {
+        if (pBits->storage[bitIndex >> 5] & (1 << (bitIndex & 0x1f))) {
+            iterator->idx = bitIndex + 1;
+            return bitIndex;
+        }
+    }
+    return -1;
+}
+
+static const BitVectorOps kRefOps = {
+    "ref", refUnify, refIntersect, refCheckMerge, refCountSetBits,
+    refIteratorNext
+};
+static const BitVectorOps kLibOps = {
+    "lib", dvmUnifyBitVectors, dvmIntersectBitVectors,
+    dvmCheckMergeBitVectors, dvmCountSetBits, dvmBitVectorIteratorNext
+};
+
+/*
+ * liveOut = OR of the successors' liveIn; liveIn |= use | (liveOut & ~def).
+ * Blocks are visited in reverse until nothing changes.  Returns the
+ * number of passes.
+ */
+static int solve(const BitVectorOps *ops, Block *blocks, int numBlocks,
+                 BitVector *tmp)
+{
+    int passes = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        passes++;
+        for (int i = numBlocks - 1; i >= 0; --i) {
+            Block *bb = &blocks[i];
+            for (int s = 0; s < 2; ++s) {
+                if (bb->succ[s] >= 0) {
+                    ops->unify(bb->liveOut, bb->liveOut,
+                               blocks[bb->succ[s]].liveIn);
+                }
+            }
+            ops->intersect(tmp, bb->liveOut, bb->notDef);
+            ops->unify(tmp, tmp, bb->use);
+            changed |= ops->checkMerge(bb->liveIn, tmp);
+        }
+    }
+    return passes;
+}
+
+/*
+ * Sums the live-in register numbers and counts, as a register allocator
+ * walking the results would.
+ */
+static u4 summarize(const BitVectorOps *ops, Block *blocks, int numBlocks)
+{
+    u4 sum = 0;
+    for (int i = 0; i < numBlocks; ++i) {
+        BitVectorIterator iterator;
+        dvmBitVectorIteratorInit(blocks[i].liveIn, &iterator);
+        int reg;
+        while ((reg = ops->iteratorNext(&iterator)) != -1) {
+            sum += reg;
+        }
+        sum += ops->countSetBits(blocks[i].liveIn) << 16;
+    }
+    return sum;
+}
+
+/*
+ * Returns the best time of RUNS solves plus summaries, in nanoseconds,
+ * and the summary in <pSum>.
+ */
+static u8 timeSolve(const BitVectorOps *ops, Block *blocks, int numBlocks,
+                    BitVector *tmp, u4 *pSum)
+{
+    u8 best = ~0ULL;
+    for (int run = 0; run < RUNS; ++run) {
+        resetLiveness(blocks, numBlocks);
+        u8 start = nowNsec();
+        solve(ops, blocks, numBlocks, tmp);
+        *pSum = summarize(ops, blocks, numBlocks);
+        best = MIN(best, nowNsec() - start);
+        gSink += *pSum;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static const int kNumBlocks[] = { 64, 256, 1024 };
+    static const int kNumRegs[] = { 128, 512, 2048 };
+
+    printf("%7s %6s %7s %10s %10s %8s\n",
+           "blocks", "regs", "passes", "ref us", "lib us", "speedup");
+    for (size_t b = 0; b < NELEM(kNumBlocks); ++b) {
+        for (size_t r = 0; r < NELEM(kNumRegs); ++r) {
+            int numBlocks = kNumBlocks[b];
+            Block *blocks = buildLoop(numBlocks, kNumRegs[r]);
+            BitVector *tmp = dvmAllocBitVector(kNumRegs[r], false);
+
+            resetLiveness(blocks, numBlocks);
+            int passes = solve(&kLibOps, blocks, numBlocks, tmp);
+
+            u4 refSum, libSum;
+            u8 refNsec = timeSolve(&kRefOps, blocks, numBlocks, tmp, &refSum);
+            u8 libNsec = timeSolve(&kLibOps, blocks, numBlocks, tmp, &libSum);
+            if (refSum != libSum) {
+                fprintf(stderr, "%d blocks, %d regs: results differ\n",
+                        numBlocks, kNumRegs[r]);
+                return 1;
+            }
+            printf("%7d %6d %7d %10.1f %10.1f %7.2fx\n",
+                   numBlocks, kNumRegs[r], passes, refNsec / 1e3,
+                   libNsec / 1e3, (double)refNsec / libNsec);
+
+            for (int i = 0; i < numBlocks; ++i) {
+                dvmFreeBitVector(blocks[i].use);
+                dvmFreeBitVector(blocks[i].notDef);
+                dvmFreeBitVector(blocks[i].liveIn);
+                dvmFreeBitVector(blocks[i].liveOut);
+            }
+            free(blocks);
+            dvmFreeBitVector(tmp);
+        }
+    }
+    return 0;
+}
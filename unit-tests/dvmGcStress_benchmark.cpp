@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the allocation patterns in GcStress.java -- young garbage, large
+ * arrays, weak references, finalizers and a deep object graph -- in a
+ * VM of its own, and reports what the collector did during each one,
+ * from the GC history: the pause percentiles, the time and CPU spent
+ * collecting, and the footprint.
+ *
+ * Options of the harness come first:
+ *
+ *   --workload=<name>  run only this workload (may be repeated)
+ *   --rounds=<n>       rounds per workload (default 20)
+ *   --ops=<n>          scale the operations per round by n/100
+ *   --live=<kbytes>    live set kept across rounds (default 8192)
+ *
+ * Everything else is passed on to the VM, so the same run can be
+ * repeated with, say, -Xgc:noconcurrent or a different heap size.
+ * The workload is found on the class path, which defaults to the jar
+ * installed next to this binary.
+ *
+ * Each workload prints one line,
+ *
+ *   <name> <gcs> <p50> <p90> <p99> <max> <gc-ms> <gc-cpu-ms>
+ *       <cpu-ms> <wall-ms> <footprint-kb> <lost>
+ *
+ * separated by single spaces, with pauses in microseconds; lines
+ * starting with '#' are comments.  "cpu-ms" is the CPU time of the
+ * whole process, so it takes in the parallel mark threads that
+ * "gc-cpu-ms" leaves out.  "lost" counts the collections that fell out
+ * of the history before they could be read, and is 0 unless a round is
+ * too long.
+ */
+
+#include "Dalvik.h"
+#include "alloc/GcHistory.h"
+
+#include <jni.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_CLASS_PATH \
+    "-Djava.class.path=/data/nativetest/dalvik-vm-gcstress-benchmark/" \
+    "dalvik-vm-gcstress-workload.jar"
+
+/*
+ * Collections read back from the history per call; smaller than the
+ * history itself.
+ */
+#define EVENT_BATCH 16
+
+struct Workload {
+    const char* name;
+    int ops;            /* per round, before scaling */
+    bool selected;
+};
+
+static Workload gWorkloads[] = {
+    { "young",       1000000, false },
+    { "largeArrays",     400, false },
+    { "weakRefs",     200000, false },
+    { "finalizers",    50000, false },
+    { "deepGraph",    500000, false },
+};
+
+static uint64_t nowUsec(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * What the collector did during one workload.
+ */
+struct GcStats {
+    u4* pauses;
+    size_t numPauses;
+    size_t maxPauses;
+    size_t numGcs;
+    uint64_t gcUsec;
+    uint64_t gcCpuUsec;
+    size_t maxFootprint;
+    size_t lost;
+};
+
+static size_t gNextEvent;
+
+static bool addPause(GcStats* stats, u4 usec)
+{
+    if (stats->numPauses == stats->maxPauses) {
+        size_t max = stats->maxPauses == 0 ? 256 : stats->maxPauses * 2;
+        u4* pauses = (u4*) realloc(stats->pauses, max * sizeof(u4));
+        if (pauses == NULL) {
+            return false;
+        }
+        stats->pauses = pauses;
+        stats->maxPauses = max;
+    }
+    stats->pauses[stats->numPauses++] = usec;
+    return true;
+}
+
+/*
+ * Reads the collections since the last call into "stats", or just
+ * skips them if it is NULL.
+ */
+static void collectEvents(GcStats* stats)
+{
+    GcEvent events[EVENT_BATCH];
+    for (;;) {
+        size_t first = gNextEvent;
+        size_t count = dvmGcHistoryCopyEvents(&gNextEvent, events,
+                                              EVENT_BATCH);
+        if (count == 0) {
+            break;
+        }
+        if (stats == NULL) {
+            continue;
+        }
+        stats->lost += gNextEvent - count - first;
+        for (size_t i = 0; i < count; i++) {
+            const GcEvent* event = &events[i];
+            stats->numGcs++;
+            stats->gcUsec += event->totalUsec;
+            stats->gcCpuUsec += event->cpuUsec;
+            stats->maxFootprint = MAX(stats->maxFootprint,
+                                      MAX(event->footprintBefore,
+                                          event->footprintAfter));
+            addPause(stats, event->pauseUsec[0]);
+            if (event->isConcurrent) {
+                addPause(stats, event->pauseUsec[1]);
+            }
+        }
+    }
+}
+
+static int compareU4(const void* a, const void* b)
+{
+    u4 x = *(const u4*) a;
+    u4 y = *(const u4*) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Returns the smallest pause that at least <percent> of the sorted
+ * pauses are no longer than.
+ */
+static u4 percentile(const GcStats* stats, size_t percent)
+{
+    if (stats->numPauses == 0) {
+        return 0;
+    }
+    size_t rank = (stats->numPauses * percent + 99) / 100;
+    return stats->pauses[rank == 0 ? 0 : rank - 1];
+}
+
+/*
+ * Runs one workload for <rounds> rounds and prints its line.  Returns
+ * false if the workload threw.
+ */
+static bool runWorkload(JNIEnv* env, jclass clazz, const Workload* workload,
+                        int rounds, int scale)
+{
+    jmethodID method = env->GetStaticMethodID(clazz, workload->name, "(I)I");
+    if (method == NULL) {
+        fprintf(stderr, "Unable to find GcStress.%s\n", workload->name);
+        return false;
+    }
+    jint ops = (jint)((int64_t) workload->ops * scale / 100);
+
+    /* Start from a collected heap, and leave that collection out. */
+    jclass systemClass = env->FindClass("java/lang/System");
+    jmethodID gc = env->GetStaticMethodID(systemClass, "gc", "()V");
+    env->CallStaticVoidMethod(systemClass, gc);
+    env->DeleteLocalRef(systemClass);
+    collectEvents(NULL);
+
+    GcStats stats;
+    memset(&stats, 0, sizeof(stats));
+    uint64_t wallStart = nowUsec(CLOCK_MONOTONIC);
+    uint64_t cpuStart = nowUsec(CLOCK_PROCESS_CPUTIME_ID);
+    for (int round = 0; round < rounds; round++) {
+        env->CallStaticIntMethod(clazz, method, ops);
+        if (env->ExceptionCheck()) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+            free(stats.pauses);
+            return false;
+        }
+        collectEvents(&stats);
+    }
+    uint64_t cpuUsec = nowUsec(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+    uint64_t wallUsec = nowUsec(CLOCK_MONOTONIC) - wallStart;
+
+    qsort(stats.pauses, stats.numPauses, sizeof(u4), compareU4);
+    printf("%s %zd %u %u %u %u %llu %llu %llu %llu %zd %zd\n",
+           workload->name, stats.numGcs,
+           percentile(&stats, 50), percentile(&stats, 90),
+           percentile(&stats, 99), percentile(&stats, 100),
+           stats.gcUsec / 1000, stats.gcCpuUsec / 1000,
+           cpuUsec / 1000, wallUsec / 1000,
+           stats.maxFootprint / 1024, stats.lost);
+    fflush(stdout);
+    free(stats.pauses);
+    return true;
+}
+
+static bool selectWorkload(const char* name)
+{
+    for (size_t i = 0; i < NELEM(gWorkloads); i++) {
+        if (strcmp(gWorkloads[i].name, name) == 0) {
+            gWorkloads[i].selected = true;
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown workload '%s'\n", name);
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = 20;
+    int scale = 100;
+    int liveKbytes = 8192;
+    bool anySelected = false;
+    bool haveClassPath = false;
+
+    JavaVMOption* options = new JavaVMOption[argc + 1];
+    int numOptions = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--workload=", 11) == 0) {
+            if (!selectWorkload(arg + 11)) {
+                return 1;
+            }
+            anySelected = true;
+        } else if (strncmp(arg, "--rounds=", 9) == 0) {
+            rounds = atoi(arg + 9);
+        } else if (strncmp(arg, "--ops=", 6) == 0) {
+            scale = atoi(arg + 6);
+        } else if (strncmp(arg, "--live=", 7) == 0) {
+            liveKbytes = atoi(arg + 7);
+        } else {
+            if (strncmp(arg, "-Djava.class.path=", 18) == 0) {
+                haveClassPath = true;
+            }
+            options[numOptions].optionString = argv[i];
+            options[numOptions].extraInfo = NULL;
+            numOptions++;
+        }
+    }
+    if (!haveClassPath) {
+        options[numOptions].optionString = (char*) DEFAULT_CLASS_PATH;
+        options[numOptions].extraInfo = NULL;
+        numOptions++;
+    }
+    if (!anySelected) {
+        for (size_t i = 0; i < NELEM(gWorkloads); i++) {
+            gWorkloads[i].selected = true;
+        }
+    }
+
+    JavaVMInitArgs args;
+    args.version = JNI_VERSION_1_6;
+    args.nOptions = numOptions;
+    args.options = options;
+    args.ignoreUnrecognized = JNI_FALSE;
+
+    JavaVM* vm;
+    JNIEnv* env;
+    if (JNI_CreateJavaVM(&vm, &env, &args) != JNI_OK) {
+        fprintf(stderr, "Unable to create the VM\n");
+        return 1;
+    }
+
+    jclass clazz = env->FindClass("GcStress");
+    jmethodID setLiveSet = (clazz != NULL) ?
+        env->GetStaticMethodID(clazz, "setLiveSet", "(I)V") : NULL;
+    if (setLiveSet == NULL) {
+        env->ExceptionClear();
+        fprintf(stderr, "Unable to find the GcStress workload\n");
+        return 1;
+    }
+    env->CallStaticVoidMethod(clazz, setLiveSet, liveKbytes);
+
+    printf("# rounds=%d ops=%d%% live=%dK\n", rounds, scale, liveKbytes);
+    printf("# name gcs p50 p90 p99 max gc-ms gc-cpu-ms cpu-ms wall-ms "
+           "footprint-kb lost\n");
+    int status = 0;
+    for (size_t i = 0; i < NELEM(gWorkloads); i++) {
+        if (gWorkloads[i].selected &&
+            !runWorkload(env, clazz, &gWorkloads[i], rounds, scale)) {
+            status = 1;
+        }
+    }
+
+    vm->DestroyJavaVM();
+    delete[] options;
+    return status;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the throughput of the heap bitmap walks over synthetic
+ * heaps.  The heap is larger than the caches and is laid out as a run
+ * of objects of random sizes; a given fraction of them has its live
+ * bit set, and a given fraction of those survives for the sweep.  The
+ * callbacks read each object's first word, as the collector's do.
+ */
+
+#include "Dalvik.h"
+#include "alloc/HeapBitmap.h"
+#include "alloc/HeapBitmapInlines.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define HEAP_SIZE       (64 * 1024 * 1024)
+#define MIN_OBJECT_SIZE 16
+#define MAX_OBJECT_SIZE 128
+#define RUNS            5
+
+struct Heap {
+    u1 *base;
+    HeapBitmap liveBits;
+    HeapBitmap markBits;
+    size_t numLive;
+    size_t numGarbage;
+};
+
+static volatile u4 gSink;
+
+static u8 nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u8)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Lays out objects across the heap, setting live bits for roughly
+ * <livePercent> of them and mark bits for <survivePercent> of those.
+ */
+static void populate(Heap *heap, int livePercent, int survivePercent)
+{
+    dvmHeapBitmapZero(&heap->liveBits);
+    dvmHeapBitmapZero(&heap->markBits);
+    heap->numLive = heap->numGarbage = 0;
+    srand(livePercent * 101 + survivePercent);
+    for (size_t offset = 0; offset + MAX_OBJECT_SIZE <= HEAP_SIZE; ) {
+        u1 *obj = heap->base + offset;
+        *(u4 *)obj = (u4)offset;
+        if (rand() % 100 < livePercent) {
+            dvmHeapBitmapSetObjectBit(&heap->liveBits, obj);
+            if (rand() % 100 < survivePercent) {
+                dvmHeapBitmapSetObjectBit(&heap->markBits, obj);
+            } else {
+                heap->numGarbage++;
+            }
+            heap->numLive++;
+        }
+        size_t size = MIN_OBJECT_SIZE +
+                      rand() % (MAX_OBJECT_SIZE - MIN_OBJECT_SIZE + 1);
+        offset += ALIGN_UP(size, HB_OBJECT_ALIGNMENT);
+    }
+    heap->markBits.max = heap->liveBits.max;
+}
+
+/*
+ * Evicts the heap from the caches between runs.
+ */
+static void flushCaches(Heap *heap)
+{
+    u4 sum = 0;
+    for (size_t offset = 0; offset < HEAP_SIZE; offset += 64) {
+        sum += heap->base[(offset * 7919) % HEAP_SIZE];
+    }
+    gSink += sum;
+}
+
+static void walkCallback(Object *obj, void *arg)
+{
+    *(u4 *)arg += *(u4 *)obj;
+}
+
+static void scanCallback(Object *obj, void *finger, void *arg)
+{
+    *(u4 *)arg += *(u4 *)obj;
+}
+
+static void sweepCallback(size_t numPtrs, void **ptrs, void *arg)
+{
+    u4 sum = 0;
+    for (size_t i = 0; i < numPtrs; ++i) {
+        sum += *(u4 *)ptrs[i];
+    }
+    *(u4 *)arg += sum;
+}
+
+enum Walk { WALK, SCAN_WALK, SWEEP_WALK };
+
+static const char *kWalkNames[] = { "walk", "scan", "sweep" };
+
+/*
+ * Returns the best time of RUNS walks, in nanoseconds.
+ */
+static u8 timeWalk(Heap *heap, Walk walk)
+{
+    u8 best = ~0ULL;
+    for (int run = 0; run < RUNS; ++run) {
+        flushCaches(heap);
+        u4 sum = 0;
+        u8 start = nowNsec();
+        switch (walk) {
+        case WALK:
+            dvmHeapBitmapWalk(&heap->liveBits, walkCallback, &sum);
+            break;
+        case SCAN_WALK:
+            dvmHeapBitmapScanWalk(&heap->liveBits, scanCallback, &sum);
+            break;
+        case SWEEP_WALK:
+            dvmHeapBitmapSweepWalk(&heap->liveBits, &heap->markBits,
+                                   heap->liveBits.base, heap->liveBits.max,
+                                   sweepCallback, &sum);
+            break;
+        }
+        u8 elapsed = nowNsec() - start;
+        best = MIN(best, elapsed);
+        gSink += sum;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static const int kLivePercents[] = { 1, 10, 50, 100 };
+    Heap heap;
+    heap.base = (u1 *)mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap.base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (!dvmHeapBitmapInit(&heap.liveBits, heap.base, HEAP_SIZE, "bench-live") ||
+        !dvmHeapBitmapInit(&heap.markBits, heap.base, HEAP_SIZE, "bench-mark")) {
+        return 1;
+    }
+    printf("%-6s %6s %10s %10s %10s\n",
+           "walk", "live%", "objects", "ns/object", "MB/s");
+    for (size_t i = 0; i < NELEM(kLivePercents); ++i) {
+        populate(&heap, kLivePercents[i], 50);
+        for (int walk = WALK; walk <= SWEEP_WALK; ++walk) {
+            u8 nsec = timeWalk(&heap, (Walk)walk);
+            size_t objects = walk == SWEEP_WALK ? heap.numGarbage : heap.numLive;
+            printf("%-6s %6d %10zd %10.2f %10.1f\n",
+                   kWalkNames[walk], kLivePercents[i], objects,
+                   objects == 0 ? 0.0 : (double)nsec / objects,
+                   HEAP_SIZE / 1048576.0 / (nsec / 1e9));
+        }
+    }
+    dvmHeapBitmapDelete(&heap.liveBits);
+    dvmHeapBitmapDelete(&heap.markBits);
+    munmap(heap.base, HEAP_SIZE);
+    return 0;
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Times the VM's hot paths, each called directly in a loop in a VM of
+ * its own: allocation, thin and fat locking, instanceof, JNI calls and
+ * references, hash table, intern table and class lookups, interface
+ * dispatch through the iftable, and LEB128 and UTF conversions.
+ *
+ * Each benchmark prints one line, with the best of RUNS runs,
+ *
+ *   <name> <ns/op> <ops per run>
+ *
+ * separated by single spaces, so the output of two builds can be
+ * compared with a script; lines starting with '#' are comments.
+ * Arguments are passed on to the VM.
+ */
+
+#include "Dalvik.h"
+#include "libdex/Leb128.h"
+
+#include <jni.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RUNS    5
+
+static uint64_t nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * State shared by the benchmarks, set up once by setUp().
+ */
+static JNIEnv* gEnv;
+static Thread* gSelf;
+
+static ClassObject* gObjectClass;
+static ClassObject* gArrayListClass;
+static ClassObject* gAbstractCollectionClass;
+static ClassObject* gCollectionClass;
+static ClassObject* gListClass;
+static ClassObject* gStringArrayClass;
+static ClassObject* gObjectArrayClass;
+static ClassObject* gListImpls[3];
+static Method* gListSize;
+
+static Object* gThinLock;
+static Object* gFatLock;
+static StringObject* gInternedString;
+
+static jclass gIntegerClass;
+static jmethodID gIntegerSignum;
+static jobject gLocalRef;
+
+#define HASH_ITEMS  1024
+static HashTable* gHashTable;
+static u4 gHashItems[HASH_ITEMS];
+
+#define LEB128_VALUES   1024
+static u1 gLeb128Data[LEB128_VALUES * 5];
+
+static const char kUtf8String[] =
+    "java.lang.String \xc3\xa9t\xc3\xa9 \xe2\x82\xac sixty-four chars of text";
+static u2 gUtf16Buf[sizeof(kUtf8String)];
+
+/* Keeps the results of the loops from being optimized away. */
+static volatile uintptr_t gSink;
+
+static int compareHashItems(const void* tableItem, const void* looseItem)
+{
+    return *(const u4*) tableItem - *(const u4*) looseItem;
+}
+
+static u4 hashItem(u4 value)
+{
+    return value * 2654435761U;
+}
+
+/*
+ * Benchmarks that call into the VM directly run with the thread in
+ * THREAD_RUNNING, as VM code does, and the JNI ones in THREAD_NATIVE.
+ */
+static void benchAllocObject(int n)
+{
+    for (int i = 0; i < n; i++)
+        gSink = (uintptr_t) dvmAllocObject(gObjectClass, ALLOC_DONT_TRACK);
+}
+
+static void benchAllocSmallArray(int n)
+{
+    for (int i = 0; i < n; i++)
+        gSink = (uintptr_t) dvmAllocPrimitiveArray('I', 4, ALLOC_DONT_TRACK);
+}
+
+static void benchAllocLargeArray(int n)
+{
+    for (int i = 0; i < n; i++) {
+        gSink = (uintptr_t) dvmAllocPrimitiveArray('B', 64 * 1024,
+                                                   ALLOC_DONT_TRACK);
+    }
+}
+
+static void benchThinLock(int n)
+{
+    for (int i = 0; i < n; i++) {
+        dvmLockObject(gSelf, gThinLock);
+        dvmUnlockObject(gSelf, gThinLock);
+    }
+}
+
+static void benchFatLock(int n)
+{
+    for (int i = 0; i < n; i++) {
+        dvmLockObject(gSelf, gFatLock);
+        dvmUnlockObject(gSelf, gFatLock);
+    }
+}
+
+static void benchInstanceofClass(int n)
+{
+    for (int i = 0; i < n; i++) {
+        gSink = dvmInstanceofNonTrivial(gArrayListClass,
+                                        gAbstractCollectionClass);
+    }
+}
+
+static void benchInstanceofInterface(int n)
+{
+    for (int i = 0; i < n; i++)
+        gSink = dvmInstanceofNonTrivial(gArrayListClass, gCollectionClass);
+}
+
+static void benchInstanceofArray(int n)
+{
+    for (int i = 0; i < n; i++)
+        gSink = dvmInstanceofNonTrivial(gStringArrayClass, gObjectArrayClass);
+}
+
+static void benchJniCall(int n)
+{
+    for (int i = 0; i < n; i++) {
+        gSink = gEnv->CallStaticIntMethod(gIntegerClass, gIntegerSignum,
+                                          (jint) i);
+    }
+}
+
+static void benchJniLocalRef(int n)
+{
+    for (int i = 0; i < n; i++) {
+        jobject ref = gEnv->NewLocalRef(gLocalRef);
+        gEnv->DeleteLocalRef(ref);
+    }
+}
+
+static void benchJniGlobalRef(int n)
+{
+    for (int i = 0; i < n; i++) {
+        jobject ref = gEnv->NewGlobalRef(gLocalRef);
+        gEnv->DeleteGlobalRef(ref);
+    }
+}
+
+static void benchHashLookup(int n)
+{
+    dvmHashTableLock(gHashTable);
+    for (int i = 0; i < n; i++) {
+        u4* item = &gHashItems[i & (HASH_ITEMS - 1)];
+        gSink = (uintptr_t) dvmHashTableLookup(gHashTable, hashItem(*item),
+                                               item, compareHashItems, false);
+    }
+    dvmHashTableUnlock(gHashTable);
+}
+
+static void benchInternLookup(int n)
+{
+    for (int i = 0; i < n; i++)
+        gSink = (uintptr_t) dvmLookupInternedString(gInternedString);
+}
+
+static void benchClassLookup(int n)
+{
+    for (int i = 0; i < n; i++)
+        gSink = (uintptr_t) dvmFindSystemClassNoInit("Ljava/util/ArrayList;");
+}
+
+/*
+ * The work of invoke-interface once the interface method is resolved,
+ * cycling through a few receiver classes as a megamorphic site would.
+ */
+static void benchInterfaceDispatch(int n)
+{
+    for (int i = 0; i < n; i++) {
+        ClassObject* clazz = gListImpls[i % NELEM(gListImpls)];
+        InterfaceEntry* entry = dvmFindIftableEntry(clazz, gListClass);
+        int vtableIndex = entry->methodIndexArray[gListSize->methodIndex];
+        gSink = (uintptr_t) clazz->vtable[vtableIndex];
+    }
+}
+
+static void benchLeb128(int n)
+{
+    for (int i = 0; i < n; i += LEB128_VALUES) {
+        const u1* ptr = gLeb128Data;
+        u4 sum = 0;
+        for (int j = 0; j < LEB128_VALUES; j++)
+            sum += readUnsignedLeb128(&ptr);
+        gSink = sum;
+    }
+}
+
+static void benchUtf8ToUtf16(int n)
+{
+    for (int i = 0; i < n; i++) {
+        gSink = dvmUtf8Len(kUtf8String);
+        dvmConvertUtf8ToUtf16(gUtf16Buf, kUtf8String);
+    }
+}
+
+static void benchStringToUtf8(int n)
+{
+    for (int i = 0; i < n; i++)
+        free(dvmCreateCstrFromString(gInternedString));
+}
+
+struct Benchmark {
+    const char* name;
+    void (*func)(int n);
+    int ops;
+    bool jni;
+};
+
+static const Benchmark kBenchmarks[] = {
+    { "alloc.object",         benchAllocObject,         1000000, false },
+    { "alloc.array.small",    benchAllocSmallArray,     1000000, false },
+    { "alloc.array.large",    benchAllocLargeArray,     4000,    false },
+    { "lock.thin",            benchThinLock,            4000000, false },
+    { "lock.fat",             benchFatLock,             4000000, false },
+    { "instanceof.class",     benchInstanceofClass,     4000000, false },
+    { "instanceof.interface", benchInstanceofInterface, 4000000, false },
+    { "instanceof.array",     benchInstanceofArray,     4000000, false },
+    { "jni.call.static",      benchJniCall,             1000000, true  },
+    { "jni.ref.local",        benchJniLocalRef,         1000000, true  },
+    { "jni.ref.global",       benchJniGlobalRef,        1000000, true  },
+    { "hash.lookup",          benchHashLookup,          4000000, false },
+    { "intern.lookup",        benchInternLookup,        1000000, false },
+    { "class.lookup",         benchClassLookup,         1000000, false },
+    { "dispatch.interface",   benchInterfaceDispatch,   4000000, false },
+    { "leb128.decode",        benchLeb128,              4194304, false },
+    { "utf.utf8-to-utf16",    benchUtf8ToUtf16,         1000000, false },
+    { "utf.string-to-utf8",   benchStringToUtf8,        1000000, false },
+};
+
+static ClassObject* findClass(const char* descriptor)
+{
+    ClassObject* clazz = dvmFindSystemClassNoInit(descriptor);
+    if (clazz == NULL) {
+        dvmClearException(gSelf);
+        fprintf(stderr, "Unable to find %s\n", descriptor);
+    }
+    return clazz;
+}
+
+/*
+ * Sets up the classes, objects and tables the benchmarks use.  Called
+ * with the thread running.  Returns false on failure.
+ */
+static bool setUp()
+{
+    if ((gObjectClass = findClass("Ljava/lang/Object;")) == NULL ||
+        (gArrayListClass = findClass("Ljava/util/ArrayList;")) == NULL ||
+        (gAbstractCollectionClass =
+            findClass("Ljava/util/AbstractCollection;")) == NULL ||
+        (gCollectionClass = findClass("Ljava/util/Collection;")) == NULL ||
+        (gListClass = findClass("Ljava/util/List;")) == NULL ||
+        (gStringArrayClass = findClass("[Ljava/lang/String;")) == NULL ||
+        (gObjectArrayClass = findClass("[Ljava/lang/Object;")) == NULL ||
+        (gListImpls[1] = findClass("Ljava/util/LinkedList;")) == NULL ||
+        (gListImpls[2] = findClass("Ljava/util/Vector;")) == NULL) {
+        return false;
+    }
+    gListImpls[0] = gArrayListClass;
+    gListSize = dvmFindInterfaceMethodHierByDescriptor(gListClass, "size",
+                                                      "()I");
+    if (gListSize == NULL) {
+        fprintf(stderr, "Unable to find List.size\n");
+        return false;
+    }
+
+    /* Tracked, so they survive the collections the allocations cause. */
+    gThinLock = dvmAllocObject(gObjectClass, ALLOC_DEFAULT);
+    gFatLock = dvmAllocObject(gObjectClass, ALLOC_DEFAULT);
+    StringObject* str = dvmCreateStringFromCstr(kUtf8String);
+    if (gThinLock == NULL || gFatLock == NULL || str == NULL) {
+        return false;
+    }
+    gInternedString = dvmLookupImmortalInternedString(str);
+    dvmReleaseTrackedAlloc((Object*) str, gSelf);
+    if (gInternedString == NULL) {
+        return false;
+    }
+
+    /* Waiting needs a fat lock, so this inflates it. */
+    dvmLockObject(gSelf, gFatLock);
+    dvmObjectWait(gSelf, gFatLock, 0, 1, false);
+    dvmUnlockObject(gSelf, gFatLock);
+
+    gHashTable = dvmHashTableCreate(HASH_ITEMS * 2, NULL);
+    if (gHashTable == NULL) {
+        return false;
+    }
+    for (int i = 0; i < HASH_ITEMS; i++) {
+        gHashItems[i] = i * 7919;
+        dvmHashTableLookup(gHashTable, hashItem(gHashItems[i]),
+                           &gHashItems[i], compareHashItems, true);
+    }
+
+    /* Mostly one- and two-byte values, as in DEX files. */
+    u1* ptr = gLeb128Data;
+    srand(1);
+    for (int i = 0; i < LEB128_VALUES; i++) {
+        u4 value = rand();
+        switch (i % 8) {
+        case 0: case 1: case 2: case 3: value &= 0x7f;      break;
+        case 4: case 5:                 value &= 0x3fff;    break;
+        case 6:                         value &= 0x1fffff;  break;
+        }
+        ptr = writeUnsignedLeb128(ptr, value);
+    }
+    return true;
+}
+
+static void tearDown()
+{
+    dvmHashTableFree(gHashTable);
+    dvmReleaseTrackedAlloc(gThinLock, gSelf);
+    dvmReleaseTrackedAlloc(gFatLock, gSelf);
+}
+
+/*
+ * Returns the best time of RUNS runs of "bench", in nanoseconds.
+ */
+static uint64_t runBenchmark(const Benchmark* bench)
+{
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < RUNS; run++) {
+        uint64_t start = nowNsec();
+        (*bench->func)(bench->ops);
+        uint64_t elapsed = nowNsec() - start;
+        if (elapsed < best)
+            best = elapsed;
+        /* Let a collection on the GC daemon suspend us between runs. */
+        if (!bench->jni)
+            dvmCheckSuspendPending(gSelf);
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    JavaVMOption* options = new JavaVMOption[argc];
+    for (int i = 1; i < argc; i++) {
+        options[i - 1].optionString = argv[i];
+        options[i - 1].extraInfo = NULL;
+    }
+    JavaVMInitArgs args;
+    args.version = JNI_VERSION_1_6;
+    args.nOptions = argc - 1;
+    args.options = options;
+    args.ignoreUnrecognized = JNI_FALSE;
+
+    JavaVM* vm;
+    if (JNI_CreateJavaVM(&vm, &gEnv, &args) != JNI_OK) {
+        fprintf(stderr, "Unable to create the VM\n");
+        return 1;
+    }
+    gSelf = dvmThreadSelf();
+
+    gIntegerClass = gEnv->FindClass("java/lang/Integer");
+    gIntegerSignum = (gIntegerClass != NULL) ?
+        gEnv->GetStaticMethodID(gIntegerClass, "signum", "(I)I") : NULL;
+    gLocalRef = (gIntegerClass != NULL) ?
+        gEnv->NewStringUTF(kUtf8String) : NULL;
+    if (gIntegerSignum == NULL || gLocalRef == NULL) {
+        fprintf(stderr, "Unable to set up the JNI benchmarks\n");
+        return 1;
+    }
+
+    dvmChangeStatus(gSelf, THREAD_RUNNING);
+    if (!setUp()) {
+        return 1;
+    }
+
+    printf("# name ns/op ops\n");
+    for (size_t i = 0; i < NELEM(kBenchmarks); i++) {
+        const Benchmark* bench = &kBenchmarks[i];
+        if (bench->jni)
+            dvmChangeStatus(gSelf, THREAD_NATIVE);
+        uint64_t nsec = runBenchmark(bench);
+        if (bench->jni)
+            dvmChangeStatus(gSelf, THREAD_RUNNING);
+        printf("%s %.2f %d\n", bench->name, (double) nsec / bench->ops,
+               bench->ops);
+        fflush(stdout);
+    }
+
+    tearDown();
+    dvmChangeStatus(gSelf, THREAD_NATIVE);
+    vm->DestroyJavaVM();
+    delete[] options;
+    return 0;
+}
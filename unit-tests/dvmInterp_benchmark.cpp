@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Times the bytecode microbenchmarks in InterpBench.java -- arithmetic,
+ * field and array access, invokes, exceptions, strings and switches --
+ * under whichever interpreter the VM is started with, so the mterp,
+ * portable interpreter and JIT can be compared on the same corpus:
+ *
+ *   dalvik-vm-interp-benchmark -Xint:portable
+ *   dalvik-vm-interp-benchmark -Xint:fast
+ *   dalvik-vm-interp-benchmark -Xint:jit -Xjitblocking
+ *
+ * Each benchmark is run once to warm up, which is when the JIT compiles
+ * its loop, and then RUNS times.  It prints one line, with the best
+ * run,
+ *
+ *   <name> <ns/op> <ops per run> <compilations> <code-cache-bytes>
+ *
+ * separated by single spaces; the last two are the JIT compilations and
+ * the growth of the code cache during the benchmark, and are 0 when not
+ * running the JIT.  Lines starting with '#' are comments.  The full JIT
+ * statistics from dvmJitStats() go to the log at the end.
+ *
+ * "--filter=<prefix>" runs only the benchmarks whose names start with
+ * the prefix; everything else is passed on to the VM.  The corpus is
+ * found on the class path, which defaults to the jar installed next to
+ * this binary.
+ */
+
+#include "Dalvik.h"
+#include "interp/Jit.h"
+
+#include <jni.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS    5
+
+#define DEFAULT_CLASS_PATH \
+    "-Djava.class.path=/data/nativetest/dalvik-vm-interp-benchmark/" \
+    "dalvik-vm-interp-corpus.jar"
+
+struct Benchmark {
+    const char* name;
+    int ops;
+};
+
+static const Benchmark kBenchmarks[] = {
+    { "intArith",           2000000 },
+    { "intDiv",             1000000 },
+    { "longArith",          2000000 },
+    { "doubleArith",        2000000 },
+    { "instanceFields",     2000000 },
+    { "staticFields",       2000000 },
+    { "intArrayLoop",       2000000 },
+    { "refArrayLoop",       2000000 },
+    { "invokeStatic",       1000000 },
+    { "invokeVirtualMono",  1000000 },
+    { "invokeVirtualPoly",  1000000 },
+    { "invokeInterface",    1000000 },
+    { "throwCatch",          100000 },
+    { "throwNewCatch",        50000 },
+    { "stringCharAt",       1000000 },
+    { "stringEquals",        500000 },
+    { "stringIndexOf",       500000 },
+    { "stringBuilder",       500000 },
+    { "packedSwitch",       2000000 },
+};
+
+static uint64_t nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char* executionModeName()
+{
+    switch (gDvm.executionMode) {
+    case kExecutionModeInterpPortable:  return "portable";
+    case kExecutionModeInterpFast:      return "fast";
+#if defined(WITH_JIT)
+    case kExecutionModeJit:             return "jit";
+#endif
+    default:                            return "other";
+    }
+}
+
+/*
+ * The JIT counters the benchmark lines report.
+ */
+struct JitCounts {
+    unsigned int compilations;
+    unsigned int codeCacheBytes;
+};
+
+static void getJitCounts(JitCounts* counts)
+{
+#if defined(WITH_JIT)
+    counts->compilations = gDvmJit.numCompilations;
+    counts->codeCacheBytes = gDvmJit.codeCacheByteUsed;
+#else
+    counts->compilations = 0;
+    counts->codeCacheBytes = 0;
+#endif
+}
+
+/*
+ * Runs one benchmark and prints its line.  Returns false if it threw.
+ */
+static bool runBenchmark(JNIEnv* env, jclass clazz, const Benchmark* bench)
+{
+    jmethodID method = env->GetStaticMethodID(clazz, bench->name, "(I)I");
+    if (method == NULL) {
+        env->ExceptionClear();
+        fprintf(stderr, "Unable to find InterpBench.%s\n", bench->name);
+        return false;
+    }
+
+    JitCounts before, after;
+    getJitCounts(&before);
+    uint64_t best = UINT64_MAX;
+    for (int run = -1; run < RUNS; run++) {
+        uint64_t start = nowNsec();
+        env->CallStaticIntMethod(clazz, method, bench->ops);
+        uint64_t elapsed = nowNsec() - start;
+        if (env->ExceptionCheck()) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+            return false;
+        }
+        /* Run -1 is the warm-up. */
+        if (run >= 0 && elapsed < best)
+            best = elapsed;
+    }
+    getJitCounts(&after);
+
+    printf("%s %.2f %d %u %u\n", bench->name, (double) best / bench->ops,
+           bench->ops, after.compilations - before.compilations,
+           after.codeCacheBytes - before.codeCacheBytes);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = "";
+    bool haveClassPath = false;
+
+    JavaVMOption* options = new JavaVMOption[argc + 1];
+    int numOptions = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+            continue;
+        }
+        if (strncmp(argv[i], "-Djava.class.path=", 18) == 0) {
+            haveClassPath = true;
+        }
+        options[numOptions].optionString = argv[i];
+        options[numOptions].extraInfo = NULL;
+        numOptions++;
+    }
+    if (!haveClassPath) {
+        options[numOptions].optionString = (char*) DEFAULT_CLASS_PATH;
+        options[numOptions].extraInfo = NULL;
+        numOptions++;
+    }
+
+    JavaVMInitArgs args;
+    args.version = JNI_VERSION_1_6;
+    args.nOptions = numOptions;
+    args.options = options;
+    args.ignoreUnrecognized = JNI_FALSE;
+
+    JavaVM* vm;
+    JNIEnv* env;
+    if (JNI_CreateJavaVM(&vm, &env, &args) != JNI_OK) {
+        fprintf(stderr, "Unable to create the VM\n");
+        return 1;
+    }
+
+    jclass clazz = env->FindClass("InterpBench");
+    if (clazz == NULL) {
+        env->ExceptionClear();
+        fprintf(stderr, "Unable to find the InterpBench corpus\n");
+        return 1;
+    }
+
+    printf("# mode=%s\n", executionModeName());
+    printf("# name ns/op ops compilations code-cache-bytes\n");
+    int status = 0;
+    size_t filterLen = strlen(filter);
+    for (size_t i = 0; i < NELEM(kBenchmarks); i++) {
+        if (strncmp(kBenchmarks[i].name, filter, filterLen) != 0)
+            continue;
+        if (!runBenchmark(env, clazz, &kBenchmarks[i]))
+            status = 1;
+    }
+
+#if defined(WITH_JIT)
+    if (gDvm.executionMode == kExecutionModeJit)
+        dvmJitStats();
+#endif
+
+    vm->DestroyJavaVM();
+    delete[] options;
+    return status;
+}
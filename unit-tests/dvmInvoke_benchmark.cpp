@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cost of calls between interpreted methods, in a VM of
+ * its own.  Sorting an Integer[] with Arrays.sort() is little else
+ * but invokes: each comparison goes through Comparable.compareTo(),
+ * Integer.compareTo() and Integer.compare(), all of them tiny.  Only
+ * the sorts are timed, not the JNI calls that shuffle the array back.
+ * Arguments are passed on to the VM, which makes it easy to compare,
+ * say, -Xint:portable, -Xint:fast and -Xint:jit.
+ */
+
+#include <jni.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ELEMENTS        4096
+#define SORTS_PER_RUN   64
+#define RUNS            3
+
+static uint64_t nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Puts the boxed values back in the same pseudo-random order, so that
+ * every sort does the same work.
+ */
+static bool shuffle(JNIEnv *env, jobjectArray array, jobject *values)
+{
+    uint32_t seed = 12345;
+    for (int i = 0; i < ELEMENTS; ++i) {
+        env->SetObjectArrayElement(array, i, values[i]);
+    }
+    for (int i = ELEMENTS - 1; i > 0; --i) {
+        seed = seed * 1103515245 + 12345;
+        int j = (seed >> 8) % (i + 1);
+        jobject a = env->GetObjectArrayElement(array, i);
+        jobject b = env->GetObjectArrayElement(array, j);
+        env->SetObjectArrayElement(array, i, b);
+        env->SetObjectArrayElement(array, j, a);
+        env->DeleteLocalRef(a);
+        env->DeleteLocalRef(b);
+    }
+    return !env->ExceptionCheck();
+}
+
+/*
+ * Returns the best time of RUNS runs, in nanoseconds, or 0 if
+ * something threw.
+ */
+static uint64_t timeSorts(JNIEnv *env, jclass arraysClass, jmethodID sort,
+                          jobjectArray array, jobject *values)
+{
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < RUNS; ++run) {
+        uint64_t elapsed = 0;
+        for (int i = 0; i < SORTS_PER_RUN; ++i) {
+            if (!shuffle(env, array, values)) {
+                return 0;
+            }
+            uint64_t start = nowNsec();
+            env->CallStaticVoidMethod(arraysClass, sort, array);
+            elapsed += nowNsec() - start;
+            if (env->ExceptionCheck()) {
+                return 0;
+            }
+        }
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    JavaVMOption *options = new JavaVMOption[argc];
+    for (int i = 1; i < argc; ++i) {
+        options[i - 1].optionString = argv[i];
+        options[i - 1].extraInfo = NULL;
+    }
+    JavaVMInitArgs args;
+    args.version = JNI_VERSION_1_6;
+    args.nOptions = argc - 1;
+    args.options = options;
+    args.ignoreUnrecognized = JNI_FALSE;
+
+    JavaVM *vm;
+    JNIEnv *env;
+    if (JNI_CreateJavaVM(&vm, &env, &args) != JNI_OK) {
+        fprintf(stderr, "Unable to create the VM\n");
+        return 1;
+    }
+    jclass integerClass = env->FindClass("java/lang/Integer");
+    jclass arraysClass = env->FindClass("java/util/Arrays");
+    if (integerClass == NULL || arraysClass == NULL) {
+        fprintf(stderr, "Unable to find Integer or Arrays\n");
+        return 1;
+    }
+    jmethodID valueOf = env->GetStaticMethodID(integerClass, "valueOf",
+                                               "(I)Ljava/lang/Integer;");
+    jmethodID sort = env->GetStaticMethodID(arraysClass, "sort",
+                                            "([Ljava/lang/Object;)V");
+    if (valueOf == NULL || sort == NULL) {
+        fprintf(stderr, "Unable to find Integer.valueOf or Arrays.sort\n");
+        return 1;
+    }
+
+    /* Use values outside the Integer cache, so the boxes are distinct. */
+    env->EnsureLocalCapacity(ELEMENTS + 16);
+    jobject *values = new jobject[ELEMENTS];
+    for (int i = 0; i < ELEMENTS; ++i) {
+        values[i] = env->CallStaticObjectMethod(integerClass, valueOf,
+                                                1000 + i);
+    }
+    jobjectArray array = env->NewObjectArray(ELEMENTS, integerClass, NULL);
+    if (env->ExceptionCheck() || array == NULL) {
+        fprintf(stderr, "Unable to set up the array\n");
+        return 1;
+    }
+
+    uint64_t nsec = timeSorts(env, arraysClass, sort, array, values);
+    if (nsec == 0) {
+        fprintf(stderr, "The sort threw\n");
+        env->ExceptionDescribe();
+        return 1;
+    }
+    printf("%d sorts of %d Integers: %.1f us/sort, %.1f ns/element\n",
+           SORTS_PER_RUN, ELEMENTS, nsec / 1000.0 / SORTS_PER_RUN,
+           (double)nsec / SORTS_PER_RUN / ELEMENTS);
+    vm->DestroyJavaVM();
+    delete[] values;
+    delete[] options;
+    return 0;
+}
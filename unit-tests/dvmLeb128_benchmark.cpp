@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares decoding a stream of unsigned LEB128 values one at a time
+ * with readUnsignedLeb128() against decoding them in groups with
+ * readUnsignedLeb128Array(), as the class data readers do.  The stream
+ * is larger than the caches; a given fraction of its values needs more
+ * than one byte.  Both decoders must agree on every value.
+ */
+
+#include "libdex/Leb128.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_VALUES      (6 * 1024 * 1024)   /* a multiple of 2, 3 and 4 */
+#define RUNS            5
+
+static volatile u4 gSink;
+
+static u8 nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u8)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Fills <buf> with NUM_VALUES encoded values, <multiPercent> of which
+ * are two to five bytes long.  Returns the end of the encoded data.
+ */
+static u1 *populate(u1 *buf, int multiPercent)
+{
+    srand(multiPercent);
+    u1 *ptr = buf;
+    for (int i = 0; i < NUM_VALUES; ++i) {
+        u4 value = rand() & 0x7f;
+        if (rand() % 100 < multiPercent) {
+            value = (u4)rand() >> (rand() % 24);
+            value |= 0x80;
+        }
+        ptr = writeUnsignedLeb128(ptr, value);
+    }
+    return ptr;
+}
+
+/*
+ * Decodes the whole stream <group> values at a time.  The group size is
+ * a constant at each call site, as it is in the class data readers.
+ */
+static inline const u1 *decodeGrouped(const u1 *ptr, int group, u4 *pSum)
+{
+    u4 values[4];
+    u4 sum = 0;
+    for (int i = 0; i < NUM_VALUES; i += group) {
+        readUnsignedLeb128Array(&ptr, values, group);
+        for (int j = 0; j < group; ++j) {
+            sum += values[j];
+        }
+    }
+    *pSum = sum;
+    return ptr;
+}
+
+/*
+ * Returns the best time of RUNS decodes of the stream, in nanoseconds,
+ * taking values <group> at a time; a group of 1 means one at a time
+ * through readUnsignedLeb128().
+ */
+static u8 timeDecode(const u1 *buf, const u1 *end, int group)
+{
+    u8 best = ~0ULL;
+    for (int run = 0; run < RUNS; ++run) {
+        const u1 *ptr = buf;
+        u4 sum = 0;
+        u8 start = nowNsec();
+        switch (group) {
+        case 1:
+            for (int i = 0; i < NUM_VALUES; ++i) {
+                sum += readUnsignedLeb128(&ptr);
+            }
+            break;
+        case 2: ptr = decodeGrouped(ptr, 2, &sum); break;
+        case 3: ptr = decodeGrouped(ptr, 3, &sum); break;
+        case 4: ptr = decodeGrouped(ptr, 4, &sum); break;
+        }
+        u8 elapsed = nowNsec() - start;
+        if (ptr != end) {
+            fprintf(stderr, "group %d stopped at %+d\n", group, (int)(ptr - end));
+            exit(1);
+        }
+        best = MIN(best, elapsed);
+        gSink += sum;
+    }
+    return best;
+}
+
+/*
+ * Checks that both decoders produce the same values.
+ */
+static bool verify(const u1 *buf)
+{
+    const u1 *single = buf;
+    const u1 *grouped = buf;
+    for (int i = 0; i < NUM_VALUES; i += 4) {
+        u4 values[4];
+        readUnsignedLeb128Array(&grouped, values, 4);
+        for (int j = 0; j < 4; ++j) {
+            u4 expected = readUnsignedLeb128(&single);
+            if (values[j] != expected) {
+                fprintf(stderr, "value %d: got %#x, expected %#x\n",
+                        i + j, values[j], expected);
+                return false;
+            }
+        }
+        if (grouped != single) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    static const int kMultiPercents[] = { 0, 5, 20, 50 };
+    static const int kGroups[] = { 1, 2, 3, 4 };
+    u1 *buf = (u1 *)malloc(NUM_VALUES * 5);
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    printf("%6s %6s %10s %10s\n", "multi%", "group", "ns/value", "MB/s");
+    for (size_t i = 0; i < NELEM(kMultiPercents); ++i) {
+        u1 *end = populate(buf, kMultiPercents[i]);
+        if (!verify(buf)) {
+            return 1;
+        }
+        for (size_t g = 0; g < NELEM(kGroups); ++g) {
+            u8 nsec = timeDecode(buf, end, kGroups[g]);
+            printf("%6d %6d %10.2f %10.1f\n",
+                   kMultiPercents[i], kGroups[g], (double)nsec / NUM_VALUES,
+                   (end - buf) / 1048576.0 / (nsec / 1e9));
+        }
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the throughput of the 64-bit quasi-atomics, as used for
+ * volatile long and double fields, with several threads working on the
+ * fields of one small object.  Each mix gives the share of reads; the
+ * rest are swaps, except in the "cas" mix, where every operation is a
+ * read followed by a compare-and-swap increment, as in
+ * AtomicLong.incrementAndGet().
+ *
+ * The stored values always have equal high and low words, so a read
+ * that saw half of a store is caught and reported.
+ */
+
+#include "Dalvik.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_FIELDS      4
+#define OPS_PER_THREAD  2000000
+#define MAX_THREADS     16
+
+struct Mix {
+    const char *name;
+    int readPercent;
+    bool cas;
+};
+
+static const Mix kMixes[] = {
+    { "read",   100, false },
+    { "90/10",   90, false },
+    { "50/50",   50, false },
+    { "cas",      0, true  },
+};
+
+/* The fields of one object, next to each other as an object's would be. */
+static volatile int64_t gFields[NUM_FIELDS] __attribute__((aligned(64)));
+
+static const Mix *gMix;
+static volatile int32_t gTornReads;
+static pthread_barrier_t gStartBarrier;
+
+static u8 nowNsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u8)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t makeValue(u4 word)
+{
+    return ((int64_t)word << 32) | word;
+}
+
+static inline bool isWhole(int64_t value)
+{
+    return (u4)(value >> 32) == (u4)value;
+}
+
+static void *workerThread(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    int torn = 0;
+    pthread_barrier_wait(&gStartBarrier);
+    for (int i = 0; i < OPS_PER_THREAD; i++) {
+        volatile int64_t *field = &gFields[rand_r(&seed) % NUM_FIELDS];
+        if (gMix->cas) {
+            int64_t old;
+            do {
+                old = dvmQuasiAtomicRead64(field);
+                if (!isWhole(old))
+                    torn++;
+            } while (dvmQuasiAtomicCas64(old, makeValue((u4)old + 1), field));
+        } else if ((int)(rand_r(&seed) % 100) < gMix->readPercent) {
+            if (!isWhole(dvmQuasiAtomicRead64(field)))
+                torn++;
+        } else {
+            dvmQuasiAtomicSwap64Sync(makeValue(rand_r(&seed)), field);
+        }
+    }
+    if (torn != 0)
+        android_atomic_add(torn, &gTornReads);
+    return NULL;
+}
+
+/*
+ * Returns the time for numThreads threads to do OPS_PER_THREAD operations
+ * each, in nanoseconds.
+ */
+static u8 timeMix(const Mix *mix, int numThreads)
+{
+    pthread_t threads[MAX_THREADS];
+    gMix = mix;
+    for (int i = 0; i < NUM_FIELDS; i++)
+        gFields[i] = makeValue(0);
+    pthread_barrier_init(&gStartBarrier, NULL, numThreads + 1);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, workerThread,
+                       (void *)(uintptr_t)(i + 1));
+    }
+    pthread_barrier_wait(&gStartBarrier);
+    u8 start = nowNsec();
+    for (int i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    u8 elapsed = nowNsec() - start;
+    pthread_barrier_destroy(&gStartBarrier);
+
+    if (mix->cas) {
+        int64_t total = 0;
+        for (int i = 0; i < NUM_FIELDS; i++)
+            total += (u4)gFields[i];
+        if (total != (int64_t)numThreads * OPS_PER_THREAD) {
+            printf("lost updates: %lld of %lld\n",
+                   (long long)numThreads * OPS_PER_THREAD - total,
+                   (long long)numThreads * OPS_PER_THREAD);
+        }
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    int maxThreads = (argc > 1) ? atoi(argv[1]) : 4;
+    if (maxThreads < 1 || maxThreads > MAX_THREADS) {
+        fprintf(stderr, "usage: %s [max threads, 1-%d]\n", argv[0],
+                MAX_THREADS);
+        return 1;
+    }
+
+    dvmQuasiAtomicsStartup();
+    printf("%-6s %8s %12s %10s\n", "mix", "threads", "Mops/s", "ns/op");
+    for (size_t m = 0; m < NELEM(kMixes); m++) {
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            u8 nsec = timeMix(&kMixes[m], threads);
+            double ops = (double)threads * OPS_PER_THREAD;
+            printf("%-6s %8d %12.2f %10.1f\n", kMixes[m].name, threads,
+                   ops / (nsec / 1e3), nsec * threads / ops);
+        }
+    }
+    dvmQuasiAtomicsShutdown();
+
+    if (gTornReads != 0) {
+        printf("%d torn reads\n", gTornReads);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the memory-model litmus tests that the barriers behind volatile
+ * fields have to pass, through the same accessors the interpreter's
+ * portable handlers and the native code use:
+ *
+ *   dekker     each thread stores to its own volatile int and loads the
+ *              other's; both seeing the old value needs a StoreLoad
+ *              reordering, which volatiles forbid.
+ *   mp-int     a plain store followed by a volatile int store, read back
+ *              with a volatile load followed by a plain one; seeing the
+ *              flag but not the data breaks release/acquire.
+ *   mp-long    the same with a volatile long flag, read and written with
+ *              the 64-bit quasi-atomics.
+ *
+ * The fields live in a buffer standing in for objects, one pair per
+ * iteration, so no iteration sees another's stores.  The two threads
+ * meet at a barrier before each chunk of iterations.  The argument is
+ * the number of chunks.
+ */
+
+#include "Dalvik.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHUNK_SIZE      2048
+
+/* Two 64-bit slots per iteration, each the only field of its "object". */
+static s8 gFields[2 * CHUNK_SIZE] __attribute__((aligned(64)));
+static int gResults[2][CHUNK_SIZE];
+
+static Object* gObj = (Object*) gFields;
+static pthread_barrier_t gChunkBarrier;
+static int gChunks;
+
+static inline int slotOffset(int i, int which)
+{
+    return (2 * i + which) * sizeof(s8);
+}
+
+static void resetFields()
+{
+    memset(gFields, 0, sizeof(gFields));
+    memset(gResults, 0, sizeof(gResults));
+}
+
+struct Test {
+    const char* name;
+    void* (*thread[2])(void*);
+    /* Counts the iterations of the last chunk that broke the rules. */
+    int (*check)();
+};
+
+static void* dekkerThread(void* arg)
+{
+    int me = (int)(uintptr_t) arg;
+    for (int c = 0; c < gChunks; c++) {
+        pthread_barrier_wait(&gChunkBarrier);
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            dvmSetFieldIntVolatile(gObj, slotOffset(i, me), 1);
+            gResults[me][i] = dvmGetFieldIntVolatile(gObj, slotOffset(i, !me));
+        }
+        pthread_barrier_wait(&gChunkBarrier);
+        pthread_barrier_wait(&gChunkBarrier);
+    }
+    return NULL;
+}
+
+static int dekkerCheck()
+{
+    int bad = 0;
+    for (int i = 0; i < CHUNK_SIZE; i++) {
+        if (gResults[0][i] == 0 && gResults[1][i] == 0)
+            bad++;
+    }
+    return bad;
+}
+
+static void* mpIntWriter(void*)
+{
+    for (int c = 0; c < gChunks; c++) {
+        pthread_barrier_wait(&gChunkBarrier);
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            dvmSetFieldInt(gObj, slotOffset(i, 0), i + 1);
+            dvmSetFieldIntVolatile(gObj, slotOffset(i, 1), 1);
+        }
+        pthread_barrier_wait(&gChunkBarrier);
+        pthread_barrier_wait(&gChunkBarrier);
+    }
+    return NULL;
+}
+
+static void* mpIntReader(void*)
+{
+    for (int c = 0; c < gChunks; c++) {
+        pthread_barrier_wait(&gChunkBarrier);
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            while (dvmGetFieldIntVolatile(gObj, slotOffset(i, 1)) == 0)
+                ;
+            gResults[0][i] = dvmGetFieldInt(gObj, slotOffset(i, 0));
+        }
+        pthread_barrier_wait(&gChunkBarrier);
+        pthread_barrier_wait(&gChunkBarrier);
+    }
+    return NULL;
+}
+
+static void* mpLongWriter(void*)
+{
+    for (int c = 0; c < gChunks; c++) {
+        pthread_barrier_wait(&gChunkBarrier);
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            dvmSetFieldInt(gObj, slotOffset(i, 0), i + 1);
+            dvmSetFieldLongVolatile(gObj, slotOffset(i, 1), -1LL);
+        }
+        pthread_barrier_wait(&gChunkBarrier);
+        pthread_barrier_wait(&gChunkBarrier);
+    }
+    return NULL;
+}
+
+static void* mpLongReader(void*)
+{
+    for (int c = 0; c < gChunks; c++) {
+        pthread_barrier_wait(&gChunkBarrier);
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            s8 flag;
+            while ((flag = dvmGetFieldLongVolatile(gObj, slotOffset(i, 1))) == 0)
+                ;
+            /* A torn flag counts as a failure too. */
+            gResults[0][i] = (flag == -1LL) ?
+                    dvmGetFieldInt(gObj, slotOffset(i, 0)) : 0;
+        }
+        pthread_barrier_wait(&gChunkBarrier);
+        pthread_barrier_wait(&gChunkBarrier);
+    }
+    return NULL;
+}
+
+static int mpCheck()
+{
+    int bad = 0;
+    for (int i = 0; i < CHUNK_SIZE; i++) {
+        if (gResults[0][i] != i + 1)
+            bad++;
+    }
+    return bad;
+}
+
+static const Test kTests[] = {
+    { "dekker",  { dekkerThread, dekkerThread }, dekkerCheck },
+    { "mp-int",  { mpIntWriter,  mpIntReader  }, mpCheck     },
+    { "mp-long", { mpLongWriter, mpLongReader }, mpCheck     },
+};
+
+/*
+ * Runs one test for gChunks chunks and returns the number of iterations
+ * that failed.  Between the second and third barrier of each chunk the
+ * threads are idle, and the main thread checks and clears the fields.
+ */
+static int runTest(const Test* test)
+{
+    pthread_t threads[2];
+    int bad = 0;
+
+    resetFields();
+    pthread_barrier_init(&gChunkBarrier, NULL, 3);
+    for (int t = 0; t < 2; t++) {
+        pthread_create(&threads[t], NULL, test->thread[t],
+                       (void*)(uintptr_t) t);
+    }
+    for (int c = 0; c < gChunks; c++) {
+        pthread_barrier_wait(&gChunkBarrier);
+        pthread_barrier_wait(&gChunkBarrier);
+        bad += test->check();
+        resetFields();
+        pthread_barrier_wait(&gChunkBarrier);
+    }
+    for (int t = 0; t < 2; t++)
+        pthread_join(threads[t], NULL);
+    pthread_barrier_destroy(&gChunkBarrier);
+    return bad;
+}
+
+int main(int argc, char** argv)
+{
+    gChunks = (argc > 1) ? atoi(argv[1]) : 1000;
+    if (gChunks < 1) {
+        fprintf(stderr, "usage: %s [chunks of %d iterations]\n", argv[0],
+                CHUNK_SIZE);
+        return 1;
+    }
+
+    dvmQuasiAtomicsStartup();
+    int failures = 0;
+    for (size_t t = 0; t < NELEM(kTests); t++) {
+        int bad = runTest(&kTests[t]);
+        printf("%-8s %10lld iterations %8d failed\n", kTests[t].name,
+               (long long) gChunks * CHUNK_SIZE, bad);
+        failures += bad;
+    }
+    dvmQuasiAtomicsShutdown();
+    return (failures != 0) ? 1 : 0;
+}
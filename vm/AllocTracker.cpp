@@ -18,16 +18,17 @@
  * Allocation tracking and reporting.  We maintain a circular buffer with
  * the most recent allocations.  The data can be viewed through DDMS.
  *
- * There are two basic approaches: manage the buffer with atomic updates
- * and do a system-wide suspend when DDMS requests it, or protect all
- * accesses with a mutex.  The former is potentially more efficient, but
- * the latter is much simpler and more reliable.
+ * Each thread records its allocations into a small buffer of its own,
+ * without any locking, and moves the batch into the shared circular
+ * buffer under allocTrackerLock when it fills up or the thread exits.
+ * When DDMS asks for the data we do a system-wide suspend and move
+ * everything that's still sitting in the per-thread buffers.  Records
+ * from different threads end up interleaved a batch at a time, so the
+ * window of "most recent" allocations is approximate across threads.
  *
- * Ideally we'd just use the object heap allocation mutex to guard this
- * structure, but at the point we grab that (under dvmMalloc()) we're just
- * allocating a collection of bytes and no longer have the class reference.
- * Because this is an optional feature it's best to leave the existing
- * code undisturbed and just use an additional lock.
+ * Walking the stack is most of the cost of a record, so the
+ * dalvik.vm.allocTrackerSampleBytes property can make us record only one
+ * allocation per N bytes allocated on each thread.
  *
  * We don't currently track allocations of class objects.  We could, but
  * with the possible exception of Proxy objects they're not that interesting.
@@ -52,6 +53,8 @@ static bool isPowerOfTwo(int x) { return (x & (x - 1)) == 0; }
 
 #define kDefaultNumAllocRecords 64*1024 /* MUST be power of 2 */
 
+#define kThreadAllocRecords     64      /* per-thread batch size */
+
 /*
  * Record the details of an allocation.
  */
@@ -120,6 +123,23 @@ static int getAllocRecordMax() {
     return kDefaultNumAllocRecords;
 }
 
+static size_t getAllocSampleBytes() {
+#ifdef HAVE_ANDROID_OS
+    const char* propertyName = "dalvik.vm.allocTrackerSampleBytes";
+    char sampleBytesString[PROPERTY_VALUE_MAX];
+    if (property_get(propertyName, sampleBytesString, "") > 0) {
+        char* end;
+        size_t value = strtoul(sampleBytesString, &end, 10);
+        if (*end != '\0') {
+            ALOGE("Ignoring %s '%s' --- invalid", propertyName, sampleBytesString);
+            return 0;
+        }
+        return value;
+    }
+#endif
+    return 0;
+}
+
 /*
  * Enable allocation tracking.  Does nothing if tracking is already enabled.
  *
@@ -137,6 +157,8 @@ bool dvmEnableAllocTracker()
               gDvm.allocRecordMax, kMaxAllocRecordStackDepth,
               sizeof(AllocRecord) * gDvm.allocRecordMax);
         gDvm.allocRecordHead = gDvm.allocRecordCount = 0;
+        gDvm.allocTrackerSampleBytes = getAllocSampleBytes();
+        gDvm.allocTrackerGeneration++;
         gDvm.allocRecords = (AllocRecord*) malloc(sizeof(AllocRecord) * gDvm.allocRecordMax);
 
         if (gDvm.allocRecords == NULL)
@@ -202,6 +224,33 @@ static void getStackFrames(Thread* self, AllocRecord* pRec)
     }
 }
 
+/*
+ * Move the thread's buffered records into the shared buffer.  Records
+ * made before tracking was last enabled are dropped.  Caller must hold
+ * allocTrackerLock, and the thread must be the caller or suspended.
+ */
+static void flushThreadRecords(Thread* thread)
+{
+    int count = thread->allocRecordBufCount;
+    thread->allocRecordBufCount = 0;
+    if (gDvm.allocRecords == NULL ||
+        thread->allocRecordGeneration != gDvm.allocTrackerGeneration) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        /* advance and clip */
+        if (++gDvm.allocRecordHead == gDvm.allocRecordMax)
+            gDvm.allocRecordHead = 0;
+
+        memcpy(&gDvm.allocRecords[gDvm.allocRecordHead],
+            &thread->allocRecordBuf[i], sizeof(AllocRecord));
+
+        if (gDvm.allocRecordCount < gDvm.allocRecordMax)
+            gDvm.allocRecordCount++;
+    }
+}
+
 /*
  * Add a new allocation to the set.
  */
@@ -213,27 +262,85 @@ void dvmDoTrackAllocation(ClassObject* clazz, size_t size)
         return;
     }
 
-    dvmLockMutex(&gDvm.allocTrackerLock);
-    if (gDvm.allocRecords == NULL) {
-        dvmUnlockMutex(&gDvm.allocTrackerLock);
-        return;
+    if (gDvm.allocTrackerSampleBytes != 0) {
+        self->allocTrackerBytes += size;
+        if (self->allocTrackerBytes < gDvm.allocTrackerSampleBytes)
+            return;
+        self->allocTrackerBytes = 0;
     }
 
-    /* advance and clip */
-    if (++gDvm.allocRecordHead == gDvm.allocRecordMax)
-        gDvm.allocRecordHead = 0;
+    /*
+     * This is read without the lock.  If tracking was re-enabled since
+     * our last record, anything still buffered belongs to the old
+     * session.
+     */
+    u4 generation = gDvm.allocTrackerGeneration;
+    if (self->allocRecordGeneration != generation) {
+        self->allocRecordGeneration = generation;
+        self->allocRecordBufCount = 0;
+    }
+    if (self->allocRecordBuf == NULL) {
+        self->allocRecordBuf =
+            (AllocRecord*) malloc(sizeof(AllocRecord) * kThreadAllocRecords);
+        if (self->allocRecordBuf == NULL)
+            return;
+    }
 
-    AllocRecord* pRec = &gDvm.allocRecords[gDvm.allocRecordHead];
+    AllocRecord* pRec = &self->allocRecordBuf[self->allocRecordBufCount];
 
     pRec->clazz = clazz;
     pRec->size = size;
     pRec->threadId = self->threadId;
     getStackFrames(self, pRec);
 
-    if (gDvm.allocRecordCount < gDvm.allocRecordMax)
-        gDvm.allocRecordCount++;
+    if (++self->allocRecordBufCount == kThreadAllocRecords) {
+        dvmLockMutex(&gDvm.allocTrackerLock);
+        flushThreadRecords(self);
+        dvmUnlockMutex(&gDvm.allocTrackerLock);
+    }
+}
 
+/*
+ * Move the exiting thread's records into the shared buffer.  The thread
+ * is no longer on the thread list, so nobody else will look at them.
+ */
+void dvmAllocTrackerThreadExit(Thread* thread)
+{
+    if (thread->allocRecordBuf == NULL)
+        return;
+
+    if (thread->allocRecordBufCount != 0) {
+        dvmLockMutex(&gDvm.allocTrackerLock);
+        flushThreadRecords(thread);
+        dvmUnlockMutex(&gDvm.allocTrackerLock);
+    }
+    free(thread->allocRecordBuf);
+    thread->allocRecordBuf = NULL;
+}
+
+/*
+ * Move the records still sitting in every thread's buffer into the
+ * shared buffer.  The other threads are suspended so that none of them
+ * is in the middle of adding a record.  Must not be called with
+ * allocTrackerLock held.
+ */
+static void collectThreadRecords()
+{
+    Thread* self = dvmThreadSelf();
+
+    dvmSuspendAllThreads(SUSPEND_FOR_ALLOC_TRACKER);
+
+    dvmLockThreadList(self);
+    dvmLockMutex(&gDvm.allocTrackerLock);
+    for (Thread* thread = gDvm.threadList; thread != NULL;
+         thread = thread->next) {
+        if (thread->allocRecordBufCount != 0)
+            flushThreadRecords(thread);
+    }
     dvmUnlockMutex(&gDvm.allocTrackerLock);
+    dvmUnlockThreadList();
+
+    dvmResumeAllThreads(SUSPEND_FOR_ALLOC_TRACKER);
 }
 
 
@@ -529,6 +636,7 @@ bool dvmGenerateTrackedAllocationReport(u1** pData, size_t* pDataLen)
     bool result = false;
     u1* buffer = NULL;
 
+    collectThreadRecords();
     dvmLockMutex(&gDvm.allocTrackerLock);
 
     /*
@@ -621,6 +729,7 @@ void dvmDumpTrackedAllocations(bool enable)
     if (enable)
         dvmEnableAllocTracker();
 
+    collectThreadRecords();
     dvmLockMutex(&gDvm.allocTrackerLock);
     if (gDvm.allocRecords == NULL) {
         dvmUnlockMutex(&gDvm.allocTrackerLock);
@@ -36,15 +36,24 @@ bool dvmEnableAllocTracker(void);
 void dvmDisableAllocTracker(void);
 
 /*
- * If allocation tracking is enabled, add a new entry to the set.
+ * If allocation tracking is enabled, add a new entry to the set.  Also
+ * feeds the sampling allocation profiler when that's running.
  */
 #define dvmTrackAllocation(_clazz, _size)                                   \
     {                                                                       \
         if (gDvm.allocRecords != NULL)                                      \
             dvmDoTrackAllocation(_clazz, _size);                            \
+        if (gDvm.allocProfilerInterval != 0)                                \
+            dvmAllocProfilerRecord(_clazz, _size);                          \
     }
 void dvmDoTrackAllocation(ClassObject* clazz, size_t size);
 
+/*
+ * Move whatever the exiting thread has recorded into the shared buffer
+ * and free its per-thread buffer.
+ */
+void dvmAllocTrackerThreadExit(Thread* thread);
+
 /*
  * Generate a DDM packet with all of the tracked allocation data.
  *
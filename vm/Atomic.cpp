@@ -165,45 +165,75 @@ int64_t dvmQuasiAtomicRead64(volatile const int64_t* addr)
 // another twist is that we use a small array of mutexes to dispatch
 // the contention locks from different memory addresses
 
+// Writers take the mutex of their stripe and bump its sequence number
+// before and after the store, so it is odd while a store is under way.
+// Readers never take the mutex: they read the sequence number, the value
+// and the sequence number again, and retry if a store overlapped.  A torn
+// read is therefore never returned.  Each stripe has a cache line of its
+// own, so neither the mutexes nor the sequence numbers of different
+// stripes are thrashed between cores.
+
 #include <pthread.h>
+#include <sched.h>
+
+#define kCacheLineSize  64
+
+struct SwapLock {
+    pthread_mutex_t lock;
+    volatile int32_t sequence;      // odd while a store is in progress
+} __attribute__((aligned(kCacheLineSize)));
+
+static const size_t kSwapLockCount = 64;
+static SwapLock gSwapLocks[kSwapLockCount];
 
-static const size_t kSwapLockCount = 32;
-static pthread_mutex_t* gSwapLocks[kSwapLockCount];
+/* How often a reader retries before it yields to a preempted writer. */
+static const int kReadSpinCount = 100;
 
 void dvmQuasiAtomicsStartup() {
     for (size_t i = 0; i < kSwapLockCount; ++i) {
-        pthread_mutex_t* m = new pthread_mutex_t;
-        dvmInitMutex(m);
-        gSwapLocks[i] = m;
+        dvmInitMutex(&gSwapLocks[i].lock);
+        gSwapLocks[i].sequence = 0;
     }
 }
 
 void dvmQuasiAtomicsShutdown() {
     for (size_t i = 0; i < kSwapLockCount; ++i) {
-        pthread_mutex_t* m = gSwapLocks[i];
-        gSwapLocks[i] = NULL;
-        if (m != NULL) {
-            dvmDestroyMutex(m);
-        }
-        delete m;
+        dvmDestroyMutex(&gSwapLocks[i].lock);
     }
 }
 
-static inline pthread_mutex_t* GetSwapLock(const volatile int64_t* addr) {
-    return gSwapLocks[((unsigned)(void*)(addr) >> 3U) % kSwapLockCount];
+static inline SwapLock* GetSwapLock(const volatile int64_t* addr) {
+    uintptr_t bits = (uintptr_t) addr >> 3;
+    // Fold in higher bits, so the same field of objects a power of two
+    // apart doesn't always land on the same stripe.
+    bits ^= bits >> 6;
+    bits ^= bits >> 12;
+    return &gSwapLocks[bits % kSwapLockCount];
+}
+
+static inline void BeginWrite(SwapLock* swapLock) {
+    pthread_mutex_lock(&swapLock->lock);
+    swapLock->sequence++;
+    ANDROID_MEMBAR_STORE();
+}
+
+static inline void EndWrite(SwapLock* swapLock) {
+    ANDROID_MEMBAR_STORE();
+    swapLock->sequence++;
+    pthread_mutex_unlock(&swapLock->lock);
 }
 
 int64_t dvmQuasiAtomicSwap64(int64_t value, volatile int64_t* addr)
 {
     int64_t oldValue;
-    pthread_mutex_t* lock = GetSwapLock(addr);
+    SwapLock* swapLock = GetSwapLock(addr);
 
-    pthread_mutex_lock(lock);
+    BeginWrite(swapLock);
 
     oldValue = *addr;
     *addr    = value;
 
-    pthread_mutex_unlock(lock);
+    EndWrite(swapLock);
     return oldValue;
 }
 
@@ -217,29 +247,41 @@ int dvmQuasiAtomicCas64(int64_t oldvalue, int64_t newvalue,
     volatile int64_t* addr)
 {
     int result;
-    pthread_mutex_t* lock = GetSwapLock(addr);
+    SwapLock* swapLock = GetSwapLock(addr);
 
-    pthread_mutex_lock(lock);
+    pthread_mutex_lock(&swapLock->lock);
 
     if (*addr == oldvalue) {
+        swapLock->sequence++;
+        ANDROID_MEMBAR_STORE();
         *addr  = newvalue;
+        ANDROID_MEMBAR_STORE();
+        swapLock->sequence++;
         result = 0;
     } else {
         result = 1;
     }
-    pthread_mutex_unlock(lock);
+    pthread_mutex_unlock(&swapLock->lock);
     return result;
 }
 
 int64_t dvmQuasiAtomicRead64(volatile const int64_t* addr)
 {
-    int64_t result;
-    pthread_mutex_t* lock = GetSwapLock(addr);
-
-    pthread_mutex_lock(lock);
-    result = *addr;
-    pthread_mutex_unlock(lock);
-    return result;
+    const SwapLock* swapLock = GetSwapLock(addr);
+
+    for (int spins = 0; ; spins++) {
+        // Only load-load ordering is needed, which x86 gives for free.
+        int32_t sequence = swapLock->sequence;
+        DVM_MEMBAR_ACQUIRE();
+        int64_t result = *addr;
+        DVM_MEMBAR_ACQUIRE();
+        if ((sequence & 1) == 0 && swapLock->sequence == sequence) {
+            return result;
+        }
+        if (spins >= kReadSpinCount) {
+            sched_yield();
+        }
+    }
 }
 
 #else
@@ -23,6 +23,20 @@
 #include <cutils/atomic.h>          /* use common Android atomic ops */
 #include <cutils/atomic-inline.h>   /* and some uncommon ones */
 
+/*
+ * Completes a volatile load the way android_atomic_acquire_load() does
+ * for 32-bit ones: no later load or store may be performed before it.
+ * x86 never reorders a load with later memory accesses, so there the
+ * compiler is all that has to be held back.  Volatile stores keep using
+ * ANDROID_MEMBAR_STORE before and ANDROID_MEMBAR_FULL after, the latter
+ * being the StoreLoad barrier no architecture lets us drop.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#define DVM_MEMBAR_ACQUIRE()    android_compiler_barrier()
+#else
+#define DVM_MEMBAR_ACQUIRE()    ANDROID_MEMBAR_FULL()
+#endif
+
 void dvmQuasiAtomicsStartup();
 void dvmQuasiAtomicsShutdown();
 
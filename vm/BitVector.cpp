@@ -22,8 +22,101 @@
 #include <stdlib.h>
 #include <strings.h>
 
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define kBitVectorGrowth    4   /* increase by 4 u4s when limit hit */
 
+/*
+ * The set operations work on four words at a time where we have 128-bit
+ * vectors, and finish up (or do everything) one word at a time.  Storage
+ * comes from malloc, so we use unaligned loads and stores.  "dest" may
+ * be the same vector as a source.
+ */
+static void andWords(u4* dest, const u4* src1, const u4* src2,
+    unsigned int count)
+{
+    unsigned int idx = 0;
+#if defined(__ARM_NEON__)
+    for (; idx + 4 <= count; idx += 4) {
+        vst1q_u32(dest + idx,
+            vandq_u32(vld1q_u32(src1 + idx), vld1q_u32(src2 + idx)));
+    }
+#elif defined(__SSE2__)
+    for (; idx + 4 <= count; idx += 4) {
+        _mm_storeu_si128((__m128i*) (dest + idx),
+            _mm_and_si128(_mm_loadu_si128((const __m128i*) (src1 + idx)),
+                          _mm_loadu_si128((const __m128i*) (src2 + idx))));
+    }
+#endif
+    for (; idx < count; idx++)
+        dest[idx] = src1[idx] & src2[idx];
+}
+
+static void orWords(u4* dest, const u4* src1, const u4* src2,
+    unsigned int count)
+{
+    unsigned int idx = 0;
+#if defined(__ARM_NEON__)
+    for (; idx + 4 <= count; idx += 4) {
+        vst1q_u32(dest + idx,
+            vorrq_u32(vld1q_u32(src1 + idx), vld1q_u32(src2 + idx)));
+    }
+#elif defined(__SSE2__)
+    for (; idx + 4 <= count; idx += 4) {
+        _mm_storeu_si128((__m128i*) (dest + idx),
+            _mm_or_si128(_mm_loadu_si128((const __m128i*) (src1 + idx)),
+                         _mm_loadu_si128((const __m128i*) (src2 + idx))));
+    }
+#endif
+    for (; idx < count; idx++)
+        dest[idx] = src1[idx] | src2[idx];
+}
+
+/*
+ * OR "src" into "dest".  Returns the OR of all the bits that changed, so
+ * nonzero means something did.
+ */
+static u4 mergeWords(u4* dest, const u4* src, unsigned int count)
+{
+    unsigned int idx = 0;
+    u4 changed = 0;
+#if defined(__ARM_NEON__)
+    uint32x4_t diff = vdupq_n_u32(0);
+    for (; idx + 4 <= count; idx += 4) {
+        uint32x4_t old = vld1q_u32(dest + idx);
+        uint32x4_t merged = vorrq_u32(old, vld1q_u32(src + idx));
+        diff = vorrq_u32(diff, veorq_u32(merged, old));
+        vst1q_u32(dest + idx, merged);
+    }
+    uint32x2_t half = vorr_u32(vget_low_u32(diff), vget_high_u32(diff));
+    changed = vget_lane_u32(half, 0) | vget_lane_u32(half, 1);
+#elif defined(__SSE2__)
+    __m128i diff = _mm_setzero_si128();
+    for (; idx + 4 <= count; idx += 4) {
+        __m128i old = _mm_loadu_si128((const __m128i*) (dest + idx));
+        __m128i merged =
+            _mm_or_si128(old, _mm_loadu_si128((const __m128i*) (src + idx)));
+        diff = _mm_or_si128(diff, _mm_xor_si128(merged, old));
+        _mm_storeu_si128((__m128i*) (dest + idx), merged);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(diff, _mm_setzero_si128()))
+            != 0xffff)
+    {
+        changed = 1;
+    }
+#endif
+    for (; idx < count; idx++) {
+        u4 merged = dest[idx] | src[idx];
+        changed |= merged ^ dest[idx];
+        dest[idx] = merged;
+    }
+    return changed;
+}
+
 
 /*
  * Allocate a bit vector with enough space to hold at least the specified
@@ -177,24 +270,25 @@ bool dvmIsBitSet(const BitVector* pBits, unsigned int num)
  */
 int dvmCountSetBits(const BitVector* pBits)
 {
-    unsigned int word;
+    const u4* storage = pBits->storage;
+    unsigned int word = 0;
     unsigned int count = 0;
 
-    for (word = 0; word < pBits->storageSize; word++) {
-        u4 val = pBits->storage[word];
-
-        if (val != 0) {
-            if (val == 0xffffffff) {
-                count += 32;
-            } else {
-                /* count the number of '1' bits */
-                while (val != 0) {
-                    val &= val - 1;
-                    count++;
-                }
-            }
-        }
+#if defined(__ARM_NEON__)
+    /* per-byte counts, widened and summed into four lanes */
+    uint32x4_t sums = vdupq_n_u32(0);
+    for (; word + 4 <= pBits->storageSize; word += 4) {
+        uint8x16_t bytes = vcntq_u8(vreinterpretq_u8_u32(
+            vld1q_u32(storage + word)));
+        sums = vaddq_u32(sums, vpaddlq_u16(vpaddlq_u8(bytes)));
     }
+    uint64x2_t pairs = vpaddlq_u32(sums);
+    count = (unsigned int) (vgetq_lane_u64(pairs, 0) +
+                            vgetq_lane_u64(pairs, 1));
+#endif
+    /* a single instruction where the CPU has one */
+    for (; word < pBits->storageSize; word++)
+        count += __builtin_popcount(storage[word]);
 
     return count;
 }
@@ -235,10 +329,7 @@ bool dvmIntersectBitVectors(BitVector *dest, const BitVector *src1,
         dest->expandable != src2->expandable)
         return false;
 
-    unsigned int idx;
-    for (idx = 0; idx < dest->storageSize; idx++) {
-        dest->storage[idx] = src1->storage[idx] & src2->storage[idx];
-    }
+    andWords(dest->storage, src1->storage, src2->storage, dest->storageSize);
     return true;
 }
 
@@ -254,10 +345,7 @@ bool dvmUnifyBitVectors(BitVector *dest, const BitVector *src1,
         dest->expandable != src2->expandable)
         return false;
 
-    unsigned int idx;
-    for (idx = 0; idx < dest->storageSize; idx++) {
-        dest->storage[idx] = src1->storage[idx] | src2->storage[idx];
-    }
+    orWords(dest->storage, src1->storage, src2->storage, dest->storageSize);
     return true;
 }
 
@@ -270,11 +358,8 @@ bool dvmCompareBitVectors(const BitVector *src1, const BitVector *src2)
         src1->expandable != src2->expandable)
         return true;
 
-    unsigned int idx;
-    for (idx = 0; idx < src1->storageSize; idx++) {
-        if (src1->storage[idx] != src2->storage[idx]) return true;
-    }
-    return false;
+    return memcmp(src1->storage, src2->storage,
+                  src1->storageSize * sizeof(u4)) != 0;
 }
 
 /* Initialize the iterator structure */
@@ -283,27 +368,32 @@ void dvmBitVectorIteratorInit(BitVector* pBits, BitVectorIterator* iterator)
     iterator->pBits = pBits;
     iterator->bitSize = pBits->storageSize * sizeof(u4) * 8;
     iterator->idx = 0;
+    iterator->bits = (pBits->storageSize != 0) ? pBits->storage[0] : 0;
 }
 
-/* Return the next position set to 1. -1 means end-of-element reached */
+/*
+ * Return the next position set to 1. -1 means end-of-element reached
+ *
+ * We skip over zero words, take the lowest bit left in the current one
+ * by counting its trailing zeros, and then clear it.
+ */
 int dvmBitVectorIteratorNext(BitVectorIterator* iterator)
 {
     const BitVector* pBits = iterator->pBits;
-    u4 bitIndex = iterator->idx;
+    u4 bits = iterator->bits;
 
     assert(iterator->bitSize == pBits->storageSize * sizeof(u4) * 8);
-    if (bitIndex >= iterator->bitSize) return -1;
-
-    for (; bitIndex < iterator->bitSize; bitIndex++) {
-        unsigned int wordIndex = bitIndex >> 5;
-        unsigned int mask = 1 << (bitIndex & 0x1f);
-        if (pBits->storage[wordIndex] & mask) {
-            iterator->idx = bitIndex+1;
-            return bitIndex;
+
+    while (bits == 0) {
+        if (iterator->idx + 1 >= pBits->storageSize) {
+            /* No more set bits */
+            return -1;
         }
+        bits = pBits->storage[++iterator->idx];
     }
-    /* No more set bits */
-    return -1;
+
+    iterator->bits = bits & (bits - 1);
+    return (iterator->idx << 5) + __builtin_ctz(bits);
 }
 
 
@@ -315,18 +405,7 @@ int dvmBitVectorIteratorNext(BitVectorIterator* iterator)
  */
 bool dvmCheckMergeBitVectors(BitVector* dst, const BitVector* src)
 {
-    bool changed = false;
-
     checkSizes(dst, src);
 
-    unsigned int idx;
-    for (idx = 0; idx < dst->storageSize; idx++) {
-        u4 merged = src->storage[idx] | dst->storage[idx];
-        if (dst->storage[idx] != merged) {
-            dst->storage[idx] = merged;
-            changed = true;
-        }
-    }
-
-    return changed;
+    return mergeWords(dst->storage, src->storage, dst->storageSize) != 0;
 }
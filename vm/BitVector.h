@@ -32,11 +32,16 @@ struct BitVector {
     u4*     storage;
 };
 
-/* Handy iterator to walk through the bit positions set to 1 */
+/*
+ * Handy iterator to walk through the bit positions set to 1.  "bits" holds
+ * the set bits of word "idx" that haven't been returned yet, so changes to
+ * that word made during the walk aren't seen.
+ */
 struct BitVectorIterator {
     BitVector *pBits;
     u4 idx;
     u4 bitSize;
+    u4 bits;
 };
 
 /* allocate a bit vector with enough space to hold "startBits" bits */
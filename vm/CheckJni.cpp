@@ -136,6 +136,22 @@ static inline bool callNeedsCheck(const u4* args, JValue* pResult,
     return (method->shorty[0] == 'L' && !dvmCheckException(self) && pResult->l != NULL);
 }
 
+/*
+ * Decide whether this JNI call on "env"'s thread gets the argument checks.
+ * Without sampling, every call does.
+ */
+static inline bool shouldCheckCall(JNIEnvExt* env)
+{
+    if (gDvmJni.checkSample <= 1) {
+        return true;
+    }
+    if (--env->checkCountdown > 0) {
+        return false;
+    }
+    env->checkCountdown = gDvmJni.checkSample;
+    return true;
+}
+
 /*
  * Check a call into native code.
  */
@@ -143,7 +159,8 @@ void dvmCheckCallJNIMethod(const u4* args, JValue* pResult,
     const Method* method, Thread* self)
 {
     dvmCallJNIMethod(args, pResult, method, self);
-    if (callNeedsCheck(args, pResult, method, self)) {
+    if (callNeedsCheck(args, pResult, method, self) &&
+            shouldCheckCall((JNIEnvExt*) self->jniEnv)) {
         checkCallResultCommon(args, pResult, method, self);
     }
 }
@@ -165,14 +182,16 @@ static inline const JNIInvokeInterface* baseVm(JavaVM* vm) {
 class ScopedCheckJniThreadState {
 public:
     explicit ScopedCheckJniThreadState(JNIEnv* env) {
-        dvmChangeStatus(NULL, THREAD_RUNNING);
+        mOldStatus = dvmChangeStatus(NULL, THREAD_RUNNING);
     }
 
     ~ScopedCheckJniThreadState() {
-        dvmChangeStatus(NULL, THREAD_NATIVE);
+        dvmChangeStatus(NULL, mOldStatus);
     }
 
 private:
+    ThreadStatus mOldStatus;
+
     // Disallow copy and assignment.
     ScopedCheckJniThreadState(const ScopedCheckJniThreadState&);
     void operator=(const ScopedCheckJniThreadState&);
@@ -197,6 +216,20 @@ private:
 
 #define kFlag_Invocation    0x8000      /* Part of the invocation interface (JavaVM*) */
 
+/*
+ * Classes that have passed checkClass.  Classes are neither moved nor
+ * unloaded, so one that was valid once stays valid, and we can skip the
+ * heap lookup the next time.  The entries are single words, so racing
+ * updates just lose a cache entry.
+ */
+#define kCheckedClassCacheSize  256     /* must be power of 2 */
+static ClassObject* gCheckedClasses[kCheckedClassCacheSize];
+
+static inline ClassObject** checkedClassSlot(const Object* obj)
+{
+    return &gCheckedClasses[((uintptr_t) obj >> 3) & (kCheckedClassCacheSize - 1)];
+}
+
 static const char* indirectRefKindName(IndirectRef iref)
 {
     return indirectRefKindToString(indirectRefKind(iref));
@@ -208,6 +241,7 @@ public:
     explicit ScopedCheck(JNIEnv* env, int flags, const char* functionName) {
         init(env, flags, functionName, true);
         checkThread(flags);
+        mCheckArgs = shouldCheckCall((JNIEnvExt*) env);
     }
 
     // For JavaVM* functions.
@@ -229,6 +263,9 @@ public:
      * "[Ljava/lang/Object;".
      */
     void checkClassName(const char* className) {
+        if (!mCheckArgs) {
+            return;
+        }
         if (!dexIsValidClassName(className, false)) {
             ALOGW("JNI WARNING: illegal class name '%s' (%s)", className, mFunctionName);
             ALOGW("             (should be formed like 'dalvik/system/DexFile')");
@@ -238,6 +275,9 @@ public:
     }
 
     void checkFieldTypeForGet(jfieldID fid, const char* expectedSignature, bool isStatic) {
+        if (!mCheckArgs) {
+            return;
+        }
         if (fid == NULL) {
             ALOGW("JNI WARNING: null jfieldID (%s)", mFunctionName);
             showLocation();
@@ -281,6 +321,9 @@ public:
      * Works for both static and instance fields.
      */
     void checkFieldTypeForSet(jobject jobj, jfieldID fieldID, PrimitiveType prim, bool isStatic) {
+        if (!mCheckArgs) {
+            return;
+        }
         if (fieldID == NULL) {
             ALOGW("JNI WARNING: null jfieldID (%s)", mFunctionName);
             showLocation();
@@ -339,6 +382,9 @@ public:
      * Assumes "jobj" has already been validated.
      */
     void checkInstanceFieldID(jobject jobj, jfieldID fieldID) {
+        if (!mCheckArgs) {
+            return;
+        }
         ScopedCheckJniThreadState ts(mEnv);
 
         Object* obj = dvmDecodeIndirectRef(self(), jobj);
@@ -371,6 +417,9 @@ public:
      * Verify that the pointer value is non-NULL.
      */
     void checkNonNull(const void* ptr) {
+        if (!mCheckArgs) {
+            return;
+        }
         if (ptr == NULL) {
             ALOGW("JNI WARNING: invalid null pointer (%s)", mFunctionName);
             abortMaybe();
@@ -382,6 +431,9 @@ public:
      * 'expectedType' will be "L" for all objects, including arrays.
      */
     void checkSig(jmethodID methodID, const char* expectedType, bool isStatic) {
+        if (!mCheckArgs) {
+            return;
+        }
         const Method* method = (const Method*) methodID;
         bool printWarn = false;
 
@@ -412,6 +464,9 @@ public:
      * Assumes "jclazz" has already been validated.
      */
     void checkStaticFieldID(jclass jclazz, jfieldID fieldID) {
+        if (!mCheckArgs) {
+            return;
+        }
         ScopedCheckJniThreadState ts(mEnv);
         ClassObject* clazz = (ClassObject*) dvmDecodeIndirectRef(self(), jclazz);
         StaticField* base = &clazz->sfields[0];
@@ -435,6 +490,9 @@ public:
      * Instances of "jclazz" must be instances of the method's declaring class.
      */
     void checkStaticMethod(jclass jclazz, jmethodID methodID) {
+        if (!mCheckArgs) {
+            return;
+        }
         ScopedCheckJniThreadState ts(mEnv);
 
         ClassObject* clazz = (ClassObject*) dvmDecodeIndirectRef(self(), jclazz);
@@ -456,6 +514,9 @@ public:
      * will be handled automatically by the instanceof check.)
      */
     void checkVirtualMethod(jobject jobj, jmethodID methodID) {
+        if (!mCheckArgs) {
+            return;
+        }
         ScopedCheckJniThreadState ts(mEnv);
 
         Object* obj = dvmDecodeIndirectRef(self(), jobj);
@@ -663,8 +724,8 @@ public:
             }
         }
 
-        // We always do the thorough checks on entry, and never on exit...
-        if (entry) {
+        // We always do the thorough checks on entry (of sampled calls), and never on exit...
+        if (entry && mCheckArgs) {
             va_start(ap, fmt0);
             for (const char* fmt = fmt0; *fmt; ++fmt) {
                 char ch = *fmt;
@@ -715,11 +776,13 @@ private:
     const char* mFunctionName;
     int mFlags;
     bool mHasMethod;
+    bool mCheckArgs;
     size_t mIndent;
 
     void init(JNIEnv* env, int flags, const char* functionName, bool hasMethod) {
         mEnv = env;
         mFlags = flags;
+        mCheckArgs = true;
 
         // Use +6 to drop the leading "Check_"...
         mFunctionName = functionName + 6;
@@ -764,6 +827,13 @@ private:
     }
 
     void checkClass(jclass c) {
+        if (c != NULL) {
+            ScopedCheckJniThreadState ts(mEnv);
+            Object* obj = dvmDecodeIndirectRef(self(), c);
+            if (*checkedClassSlot(obj) == obj) {
+                return;
+            }
+        }
         checkInstance(c, gDvm.classJavaLangClass, "jclass");
     }
 
@@ -975,6 +1045,8 @@ private:
             ALOGW("JNI WARNING: %s arg has wrong type (expected %s, got %s) (%s)",
                   argName, expectedClass->descriptor, obj->clazz->descriptor, mFunctionName);
             printWarn = true;
+        } else if (expectedClass == gDvm.classJavaLangClass) {
+            *checkedClassSlot(obj) = (ClassObject*) obj;
         }
 
         if (printWarn) {
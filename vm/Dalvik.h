@@ -42,6 +42,7 @@
 #include "Profile.h"
 #include "UtfString.h"
 #include "Intern.h"
+#include "LineTable.h"
 #include "ReferenceTable.h"
 #include "IndirectRefTable.h"
 #include "AtomicCache.h"
@@ -54,6 +55,7 @@
 #include "oo/Array.h"
 #include "Exception.h"
 #include "alloc/Alloc.h"
+#include "alloc/AllocProfiler.h"
 #include "alloc/CardTable.h"
 #include "alloc/HeapDebug.h"
 #include "alloc/WriteBarrier.h"
@@ -62,6 +64,8 @@
 #include "jdwp/Jdwp.h"
 #include "SignalCatcher.h"
 #include "StdioConverter.h"
+#include "StartupPages.h"
+#include "StartupTimeline.h"
 #include "JniInternal.h"
 #include "LinearAlloc.h"
 #include "analysis/DexVerify.h"
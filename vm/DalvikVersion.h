@@ -32,6 +32,6 @@
  * way classes load changes, e.g. field ordering or vtable layout.  Changing
  * this guarantees that the optimized form of the DEX file is regenerated.
  */
-#define DALVIK_VM_BUILD         27
+#define DALVIK_VM_BUILD         30
 
 #endif  // DALVIK_VERSION_H_
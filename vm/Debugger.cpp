@@ -65,8 +65,10 @@ being executed.
 don't interfere with the GC, and can support JDWP requests like
 "ObjectReference.IsCollected".
 
-The current implementation is #2.  The set should be reasonably small and
-performance isn't critical, so a simple expanding array can be used.
+The current implementation is #2.  Each entry counts how many times its
+ID was handed out, so "VirtualMachine.DisposeObjects" can release it once
+the debugger is done with it and the registry doesn't grow for as long as
+the session lasts.
 
 
 Notes on threads:
@@ -100,7 +102,7 @@ bool dvmDebuggerStartup()
     if (!dvmBreakpointStartup())
         return false;
 
-    gDvm.dbgRegistry = dvmHashTableCreate(1000, NULL);
+    gDvm.dbgRegistry = dvmHashTableCreateRobinHood(dvmHashSize(1000), free);
     return (gDvm.dbgRegistry != NULL);
 }
 
@@ -170,35 +172,41 @@ static inline u4 registryHash(u4 val)
 /*
  * (This is a dvmHashTableLookup() callback.)
  */
-static int registryCompare(const void* obj1, const void* obj2)
+static int registryCompare(const void* item1, const void* item2)
 {
-    return (int) obj1 - (int) obj2;
+    const DbgRegistryEntry* entry1 = (const DbgRegistryEntry*) item1;
+    const DbgRegistryEntry* entry2 = (const DbgRegistryEntry*) item2;
+    return (int) entry1->obj - (int) entry2->obj;
 }
 
+/*
+ * Find the registry entry for an id, or NULL.
+ *
+ * Lock the registry before calling here.
+ */
+static DbgRegistryEntry* lookupEntry(ObjectId id)
+{
+    DbgRegistryEntry key;
+    key.obj = (Object*)(u4) id;
+    return (DbgRegistryEntry*) dvmHashTableLookup(gDvm.dbgRegistry,
+                registryHash((u4) id), &key, registryCompare, false);
+}
 
 /*
  * Determine if an id is already in the list.
  *
- * If the list doesn't yet exist, this creates it.
- *
  * Lock the registry before calling here.
  */
 #ifndef NDEBUG
 static bool lookupId(ObjectId id)
 {
-    void* found;
-
-    found = dvmHashTableLookup(gDvm.dbgRegistry, registryHash((u4) id),
-                (void*)(u4) id, registryCompare, false);
-    if (found == NULL)
-        return false;
-    assert(found == (void*)(u4) id);
-    return true;
+    return lookupEntry(id) != NULL;
 }
 #endif
 
 /*
- * Register an object, if it hasn't already been.
+ * Register an object, if it hasn't already been, and count one more
+ * reference to its ID.
  *
  * This is used for both ObjectId and RefTypeId.  In theory we don't have
  * to register RefTypeIds unless we're worried about classes unloading.
@@ -209,6 +217,7 @@ static bool lookupId(ObjectId id)
 static ObjectId registerObject(const Object* obj, RegistryType type, bool reg)
 {
     ObjectId id;
+    DbgRegistryEntry* entry;
 
     if (obj == NULL)
         return 0;
@@ -229,14 +238,67 @@ static ObjectId registerObject(const Object* obj, RegistryType type, bool reg)
         goto bail;
     }
 
-    dvmHashTableLookup(gDvm.dbgRegistry, registryHash((u4) id),
-                (void*)(u4) id, registryCompare, true);
+    /*
+     * Counting an ID the debugger never sees just keeps the object a bit
+     * longer; counting too few could free it while the debugger uses it.
+     */
+    entry = lookupEntry(id);
+    if (entry != NULL) {
+        entry->refCount++;
+    } else {
+        entry = (DbgRegistryEntry*) malloc(sizeof(*entry));
+        if (entry == NULL) {
+            ALOGE("Unable to register object %p with the debugger", obj);
+            dvmAbort();
+        }
+        entry->obj = (Object*) obj;
+        entry->refCount = 1;
+        dvmHashTableLookup(gDvm.dbgRegistry, registryHash((u4) id),
+                entry, registryCompare, true);
+        gDvm.dbgRegistryAdded++;
+        gDvm.dbgRegistryPeak = MAX(gDvm.dbgRegistryPeak,
+                dvmHashTableNumEntries(gDvm.dbgRegistry));
+    }
 
 bail:
     dvmHashTableUnlock(gDvm.dbgRegistry);
     return id;
 }
 
+/*
+ * Drop "refCounts[i]" references to each of "ids".  An object leaves the
+ * registry, and becomes collectable again, when its count reaches zero.
+ * IDs we don't know are ignored, as the spec asks.
+ *
+ * The whole batch is done under one lock.
+ */
+void dvmDbgDisposeObjects(const ObjectId* ids, const u4* refCounts,
+    int count)
+{
+    int disposed = 0;
+
+    dvmHashTableLock(gDvm.dbgRegistry);
+    for (int i = 0; i < count; i++) {
+        if (ids[i] == 0)
+            continue;
+        DbgRegistryEntry* entry = lookupEntry(ids[i]);
+        if (entry == NULL)
+            continue;
+        if (refCounts[i] < entry->refCount) {
+            entry->refCount -= refCounts[i];
+            continue;
+        }
+        dvmHashTableRemove(gDvm.dbgRegistry, registryHash((u4) ids[i]),
+            entry);
+        free(entry);
+        disposed++;
+    }
+    gDvm.dbgRegistryDisposed += disposed;
+    dvmHashTableUnlock(gDvm.dbgRegistry);
+
+    ALOGV("Disposed %d of %d object IDs", disposed, count);
+}
+
 /*
  * Verify that an object has been registered.  If it hasn't, the debugger
  * is asking for something we didn't send it, which means something
@@ -388,6 +450,10 @@ void dvmDbgConnected()
  *
  * This is a no-op if we're already active.
  *
+ * Attaching alone only turns on exception reporting; threads keep running
+ * the fast interpreter (and the JIT) until the debugger asks for something
+ * that needs per-instruction checks.  See dvmDbgSetInstrumented().
+ *
  * Only called from the JDWP handler thread.
  */
 void dvmDbgActive()
@@ -398,7 +464,29 @@ void dvmDbgActive()
     ALOGI("Debugger is active");
     dvmInitBreakpoints();
     gDvm.debuggerActive = true;
-    dvmEnableAllSubMode(kSubModeDebuggerActive);
+    dvmEnableAllSubMode(kSubModeDebuggerAttached);
+}
+
+/*
+ * Switch the per-instruction debugger checks on or off.  The JDWP event
+ * code turns them on before registering the first breakpoint, step or
+ * method entry/exit event, and off again once the last one goes away.
+ * The JIT stays out of the way for as long as they're on.
+ *
+ * Only called from the JDWP handler thread.
+ */
+void dvmDbgSetInstrumented(bool enable)
+{
+    if (gDvm.debuggerInstrumented == enable || !gDvm.debuggerActive)
+        return;
+
+    ALOGV("Debugger instrumentation %s", enable ? "on" : "off");
+    gDvm.debuggerInstrumented = enable;
+    if (enable) {
+        dvmEnableAllSubMode(kSubModeDebuggerActive);
+    } else {
+        dvmDisableAllSubMode(kSubModeDebuggerActive);
+    }
 #if defined(WITH_JIT)
     dvmCompilerUpdateGlobalState();
 #endif
@@ -417,7 +505,9 @@ void dvmDbgDisconnected()
     assert(gDvm.debuggerConnected);
 
     gDvm.debuggerActive = false;
+    gDvm.debuggerInstrumented = false;
     dvmDisableAllSubMode(kSubModeDebuggerActive);
+    dvmDisableAllSubMode(kSubModeDebuggerAttached);
 #if defined(WITH_JIT)
     dvmCompilerUpdateGlobalState();
 #endif
@@ -425,8 +515,12 @@ void dvmDbgDisconnected()
     dvmHashTableLock(gDvm.dbgRegistry);
     gDvm.debuggerConnected = false;
 
-    ALOGD("Debugger has detached; object registry had %d entries",
-        dvmHashTableNumEntries(gDvm.dbgRegistry));
+    ALOGD("Debugger has detached; object registry had %d entries"
+          " (peak %d, %u registered, %u disposed)",
+        dvmHashTableNumEntries(gDvm.dbgRegistry), gDvm.dbgRegistryPeak,
+        gDvm.dbgRegistryAdded, gDvm.dbgRegistryDisposed);
+    gDvm.dbgRegistryPeak = 0;
+    gDvm.dbgRegistryAdded = gDvm.dbgRegistryDisposed = 0;
     //int i;
     //for (i = 0; i < gDvm.dbgRegistryNext; i++)
     //    LOGVV("%4d: 0x%llx", i, gDvm.dbgRegistryTable[i]);
@@ -1177,6 +1271,7 @@ void dvmDbgOutputAllFields(RefTypeId refTypeId, bool withGeneric,
     assert(clazz != NULL);
 
     u4 declared = clazz->sfieldCount + clazz->ifieldCount;
+    expandBufReserve(pReply, 4 + declared * (8 + 4 + 3 * 4 + 32));
     expandBufAdd4BE(pReply, declared);
 
     for (int i = 0; i < clazz->sfieldCount; i++) {
@@ -1224,10 +1319,12 @@ void dvmDbgOutputAllMethods(RefTypeId refTypeId, bool withGeneric,
     assert(clazz != NULL);
 
     declared = clazz->directMethodCount + clazz->virtualMethodCount;
+    /* id, flags, string lengths, and a typical name and signature */
+    expandBufReserve(pReply, 4 + declared * (8 + 4 + 3 * 4 + 48));
     expandBufAdd4BE(pReply, declared);
 
     for (i = 0; i < clazz->directMethodCount; i++) {
-        meth = &clazz->directMethods[i];
+        meth = &dvmGetDirectMethods(clazz)[i];
 
         expandBufAddMethodId(pReply, methodToMethodId(meth));
         expandBufAddUtf8String(pReply, (const u1*) meth->name);
@@ -1327,12 +1424,7 @@ void dvmDbgOutputLineTable(RefTypeId refTypeId, MethodId methodId,
 
     context.pReply = pReply;
 
-    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile,
-        dvmGetMethodCode(method),
-        method->clazz->descriptor,
-        method->prototype.protoIdx,
-        method->accessFlags,
-        lineTablePositionsCb, NULL, &context);
+    dvmLineTableVisit(method, lineTablePositionsCb, &context);
 
     set4BE(expandBufGetBuffer(pReply) + numLinesOffset, context.numItems);
 }
@@ -2880,7 +2972,6 @@ static int addressSetCb (void *cnxt, u4 address, u4 lineNum)
 const AddressSet *dvmAddressSetForLine(const Method* method, int line)
 {
     AddressSet *result;
-    const DexFile *pDexFile = method->clazz->pDvmDex->pDexFile;
     u4 insnsSize = dvmGetMethodInsnsSize(method);
     AddressSetContext context;
 
@@ -2892,11 +2983,7 @@ const AddressSet *dvmAddressSetForLine(const Method* method, int line)
     context.lineNum = line;
     context.lastAddressValid = false;
 
-    dexDecodeDebugInfo(pDexFile, dvmGetMethodCode(method),
-        method->clazz->descriptor,
-        method->prototype.protoIdx,
-        method->accessFlags,
-        addressSetCb, NULL, &context);
+    dvmLineTableVisit(method, addressSetCb, &context);
 
     // If the line number was the last in the position table...
     if (context.lastAddressValid) {
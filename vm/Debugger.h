@@ -32,6 +32,15 @@ struct ClassObject;
 struct Method;
 struct Thread;
 
+/*
+ * An entry in gDvm.dbgRegistry: an object the debugger has been given an
+ * ID for, and how many times.  The GC treats "obj" as a root.
+ */
+struct DbgRegistryEntry {
+    Object* obj;
+    u4      refCount;
+};
+
 /*
  * Used by StepControl to track a set of addresses associated with
  * a single line.
@@ -128,6 +137,7 @@ DebugInvokeReq* dvmDbgGetInvokeReq(void);
 void dvmDbgConnected(void);
 void dvmDbgActive(void);
 void dvmDbgDisconnected(void);
+void dvmDbgSetInstrumented(bool enable);
 
 /*
  * Returns "true" if a debugger is connected.  Returns "false" if it's
@@ -293,6 +303,10 @@ const AddressSet *dvmAddressSetForLine(const Method* method, int line);
 /* perform "late registration" of an object ID */
 void dvmDbgRegisterObjectId(ObjectId id);
 
+/* ObjectReference/VirtualMachine.DisposeObjects */
+void dvmDbgDisposeObjects(const ObjectId* ids, const u4* refCounts,
+    int count);
+
 /*
  * DDM support.
  */
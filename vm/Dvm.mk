@@ -102,7 +102,9 @@ LOCAL_SRC_FILES := \
 	InlineNative.cpp.arm \
 	Inlines.cpp \
 	Intern.cpp \
+	LineTable.cpp \
 	Jni.cpp \
+	JniStubs.cpp \
 	JarFile.cpp \
 	LinearAlloc.cpp \
 	Misc.cpp \
@@ -112,16 +114,20 @@ LOCAL_SRC_FILES := \
 	RawDexFile.cpp \
 	ReferenceTable.cpp \
 	SignalCatcher.cpp \
+	StartupPages.cpp \
+	StartupTimeline.cpp \
 	StdioConverter.cpp \
 	Sync.cpp \
 	Thread.cpp \
 	UtfString.cpp \
 	alloc/Alloc.cpp \
+	alloc/AllocProfiler.cpp \
 	alloc/CardTable.cpp \
 	alloc/HeapBitmap.cpp.arm \
 	alloc/HeapDebug.cpp \
 	alloc/Heap.cpp.arm \
 	alloc/DdmHeap.cpp \
+	alloc/GcHistory.cpp \
 	alloc/Verify.cpp \
 	alloc/Visit.cpp \
 	analysis/CodeVerify.cpp \
@@ -180,6 +186,7 @@ LOCAL_SRC_FILES := \
 	oo/AccessCheck.cpp \
 	oo/Array.cpp \
 	oo/Class.cpp \
+	oo/FieldProfile.cpp \
 	oo/Object.cpp \
 	oo/Resolve.cpp \
 	oo/TypeCheck.cpp \
@@ -204,8 +211,10 @@ ifeq ($(WITH_COPYING_GC),true)
 	alloc/Copying.cpp.arm
 else
   LOCAL_SRC_FILES += \
+	alloc/Compact.cpp \
 	alloc/DlMalloc.cpp \
 	alloc/HeapSource.cpp \
+	alloc/LargeObjectSpace.cpp \
 	alloc/MarkSweep.cpp.arm
 endif
 
@@ -223,6 +232,12 @@ ifeq ($(WITH_JIT),true)
 	compiler/SSATransformation.cpp \
 	compiler/Loop.cpp \
 	compiler/Ralloc.cpp \
+	compiler/InlineCache.cpp \
+	compiler/NullFault.cpp \
+	compiler/JitBudget.cpp \
+	compiler/JitProfile.cpp \
+	compiler/JitSampler.cpp \
+	compiler/TypeProfile.cpp \
 	interp/Jit.cpp
 endif
 
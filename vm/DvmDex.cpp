@@ -36,13 +36,46 @@
  * use the entry for virtual methods that are only called through
  * invoke-virtual-quick), creating the possibility of some space reduction
  * at dexopt time.
+ *
+ * The tables live in an anonymous region that the kernel fills with zero
+ * pages on first touch, so only the pages holding resolved entries are
+ * ever committed.  Each table starts on its own page, which keeps the
+ * DvmDex header and the first few entries of one table from dirtying
+ * the start of the next.
+ */
+
+/*
+ * Compute the page-aligned offsets of the four resolution tables and the
+ * proto id table, and return the size of the whole region.
  */
+static size_t computeAuxLayout(const DexHeader* pHeader, size_t offsets[5])
+{
+    size_t offset = ALIGN_UP_TO_PAGE_SIZE(sizeof(DvmDex));
+
+    offsets[0] = offset;
+    offset += ALIGN_UP_TO_PAGE_SIZE(
+        pHeader->stringIdsSize * sizeof(struct StringObject*));
+    offsets[1] = offset;
+    offset += ALIGN_UP_TO_PAGE_SIZE(
+        pHeader->typeIdsSize * sizeof(struct ClassObject*));
+    offsets[2] = offset;
+    offset += ALIGN_UP_TO_PAGE_SIZE(
+        pHeader->methodIdsSize * sizeof(struct Method*));
+    offsets[3] = offset;
+    offset += ALIGN_UP_TO_PAGE_SIZE(
+        pHeader->fieldIdsSize * sizeof(struct Field*));
+    offsets[4] = offset;
+    offset += ALIGN_UP_TO_PAGE_SIZE(pHeader->protoIdsSize * sizeof(u4));
+
+    return offset;
+}
 
 static DvmDex* allocateAuxStructures(DexFile* pDexFile)
 {
     DvmDex* pDvmDex;
     const DexHeader* pHeader;
     u4 stringSize, classSize, methodSize, fieldSize;
+    size_t offsets[5];
 
     pHeader = pDexFile->pHeader;
 
@@ -51,33 +84,41 @@ static DvmDex* allocateAuxStructures(DexFile* pDexFile)
     methodSize = pHeader->methodIdsSize * sizeof(struct Method*);
     fieldSize  = pHeader->fieldIdsSize * sizeof(struct Field*);
 
-    u4 totalSize = sizeof(DvmDex) +
-                   stringSize + classSize + methodSize + fieldSize;
+    size_t totalSize = computeAuxLayout(pHeader, offsets);
 
     u1 *blob = (u1 *)dvmAllocRegion(totalSize,
                               PROT_READ | PROT_WRITE, "dalvik-aux-structure");
-    if ((void *)blob == MAP_FAILED)
+    if (blob == NULL)
         return NULL;
 
     pDvmDex = (DvmDex*)blob;
-    blob += sizeof(DvmDex);
 
     pDvmDex->pDexFile = pDexFile;
     pDvmDex->pHeader = pHeader;
+    pDvmDex->auxSize = totalSize;
 
-    pDvmDex->pResStrings = (struct StringObject**)blob;
-    blob += stringSize;
-    pDvmDex->pResClasses = (struct ClassObject**)blob;
-    blob += classSize;
-    pDvmDex->pResMethods = (struct Method**)blob;
-    blob += methodSize;
-    pDvmDex->pResFields = (struct Field**)blob;
+    pDvmDex->pResStrings = (struct StringObject**)(blob + offsets[0]);
+    pDvmDex->pResClasses = (struct ClassObject**)(blob + offsets[1]);
+    pDvmDex->pResMethods = (struct Method**)(blob + offsets[2]);
+    pDvmDex->pResFields = (struct Field**)(blob + offsets[3]);
+    pDvmDex->pProtoIds = (u4*)(blob + offsets[4]);
+    pDexFile->auxData = pDvmDex;
 
-    ALOGV("+++ DEX %p: allocateAux (%d+%d+%d+%d)*4 = %d bytes",
+    ALOGV("+++ DEX %p: allocateAux (%d+%d+%d+%d)*4 = %d bytes (%zd mapped)",
         pDvmDex, stringSize/4, classSize/4, methodSize/4, fieldSize/4,
-        stringSize + classSize + methodSize + fieldSize);
+        stringSize + classSize + methodSize + fieldSize, totalSize);
 
-    pDvmDex->pInterfaceCache = dvmAllocAtomicCache(DEX_INTERFACE_CACHE_SIZE);
+    /*
+     * Code optimized ahead of time holds the field offsets of the VM
+     * that optimized it, which rules out a profile-driven layout of the
+     * classes it can refer to.
+     */
+    for (u4 i = 0; i < pHeader->classDefsSize; i++) {
+        if (dexGetClassDef(pDexFile, i)->accessFlags & CLASS_ISOPTIMIZED) {
+            pDvmDex->hasOptimizedClasses = true;
+            break;
+        }
+    }
 
     dvmInitMutex(&pDvmDex->modLock);
 
@@ -181,25 +222,47 @@ bail:
  */
 void dvmDexFileFree(DvmDex* pDvmDex)
 {
-    u4 totalSize;
-
     if (pDvmDex == NULL)
         return;
 
     dvmDestroyMutex(&pDvmDex->modLock);
-
-    totalSize  = pDvmDex->pHeader->stringIdsSize * sizeof(struct StringObject*);
-    totalSize += pDvmDex->pHeader->typeIdsSize * sizeof(struct ClassObject*);
-    totalSize += pDvmDex->pHeader->methodIdsSize * sizeof(struct Method*);
-    totalSize += pDvmDex->pHeader->fieldIdsSize * sizeof(struct Field*);
-    totalSize += sizeof(DvmDex);
+    dvmStartupPagesForget(pDvmDex);
 
     dexFileFree(pDvmDex->pDexFile);
 
     ALOGV("+++ DEX %p: freeing aux structs", pDvmDex);
-    dvmFreeAtomicCache(pDvmDex->pInterfaceCache);
     sysReleaseShmem(&pDvmDex->memMap);
-    munmap(pDvmDex, totalSize);
+    munmap(pDvmDex, pDvmDex->auxSize);
+}
+
+/*
+ * Count the pages of the aux region that have been committed.
+ *
+ * mincore() reports the pages that are resident; since the region is
+ * anonymous and never swapped, that's the set that has been touched.
+ */
+void dvmDexGetAuxPageCounts(const DvmDex* pDvmDex, size_t* pTotal,
+    size_t* pCommitted)
+{
+    size_t numPages = pDvmDex->auxSize / SYSTEM_PAGE_SIZE;
+    size_t committed = 0;
+
+    *pTotal = numPages;
+    *pCommitted = 0;
+
+    unsigned char* vec = (unsigned char*) malloc(numPages);
+    if (vec == NULL)
+        return;
+    if (mincore((void*) pDvmDex, pDvmDex->auxSize, vec) == 0) {
+        for (size_t i = 0; i < numPages; i++) {
+            if ((vec[i] & 1) != 0)
+                committed++;
+        }
+        *pCommitted = committed;
+    } else {
+        ALOGW("mincore on DEX aux region failed: %s", strerror(errno));
+    }
+    free(vec);
 }
 
 
@@ -55,17 +55,23 @@ struct DvmDex {
     /* (this holds both InstField and StaticField) */
     struct Field**      pResFields;
 
-    /* interface method lookup cache */
-    struct AtomicCache* pInterfaceCache;
+    /* canonical signature ids, or 0 until needed; parallel to "protoIds" */
+    u4*                 pProtoIds;
 
     /* shared memory region with file contents */
     bool                isMappedReadOnly;
+
+    /* some classes were optimized ahead of time, by dexopt */
+    bool                hasOptimizedClasses;
     MemMapping          memMap;
 
     jobject dex_object;
 
     /* lock ensuring mutual exclusion during updates */
     pthread_mutex_t     modLock;
+
+    /* size of the mapping holding this struct and the tables above */
+    size_t              auxSize;
 };
 
 
@@ -88,6 +94,13 @@ int dvmDexFileOpenPartial(const void* addr, int len, DvmDex** ppDvmDex);
  */
 void dvmDexFileFree(DvmDex* pDvmDex);
 
+/*
+ * Report how many pages the resolution tables span, and how many of them
+ * have actually been committed by resolving something.
+ */
+void dvmDexGetAuxPageCounts(const DvmDex* pDvmDex, size_t* pTotal,
+    size_t* pCommitted);
+
 
 /*
  * Change the 1- or 2-byte value at the specified address to a new value.  If
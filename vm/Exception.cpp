@@ -592,6 +592,187 @@ void dvmPrintExceptionStackTrace()
     dvmReleaseTrackedAlloc(exception, self);
 }
 
+/*
+ * A method's try/catch data, decoded from the DEX file the first time an
+ * exception is thrown through the method, so that later throws don't have
+ * to read leb128 handler lists or look up the catch classes again.  The
+ * ranges are sorted and don't overlap, as in the DEX file.  Each range
+ * points at its handlers in the order they are listed; a catch-all has
+ * the type index kDexNoIndex.  Everything is in one heap block.
+ */
+struct CatchHandlerEntry {
+    ClassObject*    clazz;          /* NULL until resolved */
+    u4              typeIdx;
+    u4              address;
+};
+
+struct CatchRange {
+    u4              startAddr;
+    u4              endAddr;
+    u4              firstHandler;
+    u4              handlerCount;
+};
+
+struct CatchTable {
+    u4              rangeCount;
+    CatchRange*     ranges;
+    CatchHandlerEntry* handlers;
+};
+
+/*
+ * Decode the try/catch data of "pCode".  Returns NULL if we're out of
+ * memory.
+ */
+static CatchTable* decodeCatchTable(const DexCode* pCode)
+{
+    const DexTry* pTries = dexGetTries(pCode);
+    u4 rangeCount = pCode->triesSize;
+    u4 handlerCount = 0;
+    DexCatchIterator iterator;
+
+    for (u4 i = 0; i < rangeCount; i++) {
+        dexCatchIteratorInit(&iterator, pCode, pTries[i].handlerOff);
+        while (dexCatchIteratorNext(&iterator) != NULL) {
+            handlerCount++;
+        }
+    }
+
+    CatchTable* table = (CatchTable*) malloc(sizeof(CatchTable) +
+        rangeCount * sizeof(CatchRange) +
+        handlerCount * sizeof(CatchHandlerEntry));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->rangeCount = rangeCount;
+    table->ranges = (CatchRange*) (table + 1);
+    table->handlers = (CatchHandlerEntry*) (table->ranges + rangeCount);
+
+    CatchHandlerEntry* entry = table->handlers;
+    for (u4 i = 0; i < rangeCount; i++) {
+        CatchRange* range = &table->ranges[i];
+        range->startAddr = pTries[i].startAddr;
+        range->endAddr = pTries[i].startAddr + pTries[i].insnCount;
+        range->firstHandler = entry - table->handlers;
+        dexCatchIteratorInit(&iterator, pCode, pTries[i].handlerOff);
+        DexCatchHandler* handler;
+        while ((handler = dexCatchIteratorNext(&iterator)) != NULL) {
+            entry->clazz = NULL;
+            entry->typeIdx = handler->typeIdx;
+            entry->address = handler->address;
+            entry++;
+        }
+        range->handlerCount = (entry - table->handlers) - range->firstHandler;
+    }
+    return table;
+}
+
+/*
+ * Get the decoded try/catch data of "method", decoding it if this is the
+ * first throw through the method.  Two threads may decode it at once; the
+ * first one to finish wins.  Returns NULL if we're out of memory.
+ */
+static CatchTable* getCatchTable(const Method* method)
+{
+    CatchTable* table = (CatchTable*) android_atomic_acquire_load(
+        (volatile int32_t*)(void*) &method->catchTable);
+    if (table != NULL) {
+        return table;
+    }
+    table = decodeCatchTable(dvmGetMethodCode(method));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    ClassObject* clazz = method->clazz;
+    dvmLinearReadWrite(clazz->classLoader, clazz->virtualMethods);
+    dvmLinearReadWrite(clazz->classLoader, clazz->directMethods);
+    if (android_atomic_release_cas(0, (int32_t) table,
+            (volatile int32_t*)(void*) &method->catchTable) != 0) {
+        free(table);
+        table = (CatchTable*) android_atomic_acquire_load(
+            (volatile int32_t*)(void*) &method->catchTable);
+    }
+    dvmLinearReadOnly(clazz->classLoader, clazz->virtualMethods);
+    dvmLinearReadOnly(clazz->classLoader, clazz->directMethods);
+    return table;
+}
+
+/*
+ * Find the range of "table" that covers "relPc", if any.
+ */
+static const CatchRange* findCatchRange(const CatchTable* table, u4 relPc)
+{
+    int lo = 0;
+    int hi = table->rangeCount - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        const CatchRange* range = &table->ranges[mid];
+        if (relPc < range->startAddr) {
+            hi = mid - 1;
+        } else if (relPc >= range->endAddr) {
+            lo = mid + 1;
+        } else {
+            return range;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Resolve the class of a "catch" block in "method".  Returns NULL, with
+ * the exception status clear, if it can't be resolved.
+ */
+static ClassObject* resolveCatchClass(Thread* self, const Method* method,
+    u4 typeIdx)
+{
+    ClassObject* throwable =
+        dvmDexGetResolvedClass(method->clazz->pDvmDex, typeIdx);
+    if (throwable != NULL) {
+        return throwable;
+    }
+
+    /*
+     * TODO: this behaves badly if we run off the stack while trying to
+     * throw an exception.  The problem is that, if we're in a class
+     * loaded by a class loader, the call to dvmResolveClass has to ask
+     * the class loader for help resolving any previously-unresolved
+     * classes.  If this particular class loader hasn't resolved
+     * StackOverflowError, it will call into interpreted code, and blow
+     * up.
+     *
+     * We currently replace the previous exception with the
+     * StackOverflowError, which means they won't be catching it
+     * *unless* they explicitly catch StackOverflowError, in which case
+     * we'll be unable to resolve the class referred to by the "catch"
+     * block.
+     *
+     * We end up getting a huge pile of warnings if we do a simple
+     * synthetic test, because this method gets called on every stack
+     * frame up the tree, and it fails every time.
+     *
+     * This eventually bails out, effectively becoming an uncatchable
+     * exception, so other than the flurry of warnings it's not really a
+     * problem.  Still, we could probably handle this better.
+     */
+    throwable = dvmResolveClass(method->clazz, typeIdx, true);
+    if (throwable == NULL) {
+        /*
+         * We couldn't find the exception they wanted in our class files
+         * (or, perhaps, the stack blew up while we were querying a class
+         * loader). Cough up a warning, then move on to the next entry.
+         * Keep the exception status clear.
+         */
+        ALOGW("Could not resolve class ref'ed in exception "
+                "catch list (class index %d, exception %s)",
+                typeIdx,
+                (self->exception != NULL) ?
+                self->exception->clazz->descriptor : "(none)");
+        dvmClearException(self);
+    }
+    return throwable;
+}
+
 /*
  * Search the method's list of exceptions for a match.
  *
@@ -611,84 +792,57 @@ static int findCatchInMethod(Thread* self, const Method* method, int relPc,
         method->clazz->descriptor, method->name, excepClass->descriptor,
         dvmComputeExactFrameDepth(self->interpSave.curFrame));
 
-    DvmDex* pDvmDex = method->clazz->pDvmDex;
     const DexCode* pCode = dvmGetMethodCode(method);
-    DexCatchIterator iterator;
-
-    if (dexFindCatchHandler(&iterator, pCode, relPc)) {
-        for (;;) {
-            DexCatchHandler* handler = dexCatchIteratorNext(&iterator);
-
-            if (handler == NULL) {
-                break;
-            }
-
-            if (handler->typeIdx == kDexNoIndex) {
-                /* catch-all */
-                ALOGV("Match on catch-all block at 0x%02x in %s.%s for %s",
-                        relPc, method->clazz->descriptor,
-                        method->name, excepClass->descriptor);
-                return handler->address;
-            }
-
-            ClassObject* throwable =
-                dvmDexGetResolvedClass(pDvmDex, handler->typeIdx);
-            if (throwable == NULL) {
-                /*
-                 * TODO: this behaves badly if we run off the stack
-                 * while trying to throw an exception.  The problem is
-                 * that, if we're in a class loaded by a class loader,
-                 * the call to dvmResolveClass has to ask the class
-                 * loader for help resolving any previously-unresolved
-                 * classes.  If this particular class loader hasn't
-                 * resolved StackOverflowError, it will call into
-                 * interpreted code, and blow up.
-                 *
-                 * We currently replace the previous exception with
-                 * the StackOverflowError, which means they won't be
-                 * catching it *unless* they explicitly catch
-                 * StackOverflowError, in which case we'll be unable
-                 * to resolve the class referred to by the "catch"
-                 * block.
-                 *
-                 * We end up getting a huge pile of warnings if we do
-                 * a simple synthetic test, because this method gets
-                 * called on every stack frame up the tree, and it
-                 * fails every time.
-                 *
-                 * This eventually bails out, effectively becoming an
-                 * uncatchable exception, so other than the flurry of
-                 * warnings it's not really a problem.  Still, we could
-                 * probably handle this better.
-                 */
-                throwable = dvmResolveClass(method->clazz, handler->typeIdx,
-                    true);
-                if (throwable == NULL) {
-                    /*
-                     * We couldn't find the exception they wanted in
-                     * our class files (or, perhaps, the stack blew up
-                     * while we were querying a class loader). Cough
-                     * up a warning, then move on to the next entry.
-                     * Keep the exception status clear.
-                     */
-                    ALOGW("Could not resolve class ref'ed in exception "
-                            "catch list (class index %d, exception %s)",
-                            handler->typeIdx,
-                            (self->exception != NULL) ?
-                            self->exception->clazz->descriptor : "(none)");
-                    dvmClearException(self);
-                    continue;
+    if (pCode->triesSize != 0) {
+        CatchTable* table = getCatchTable(method);
+        if (table != NULL) {
+            const CatchRange* range = findCatchRange(table, relPc);
+            if (range != NULL) {
+                CatchHandlerEntry* entry =
+                    &table->handlers[range->firstHandler];
+                for (u4 i = 0; i < range->handlerCount; i++, entry++) {
+                    if (entry->typeIdx == kDexNoIndex) {
+                        /* catch-all */
+                        ALOGV("Match on catch-all block at 0x%02x in %s.%s "
+                                "for %s", relPc, method->clazz->descriptor,
+                                method->name, excepClass->descriptor);
+                        return entry->address;
+                    }
+
+                    ClassObject* throwable = entry->clazz;
+                    if (throwable == NULL) {
+                        throwable = resolveCatchClass(self, method,
+                            entry->typeIdx);
+                        if (throwable == NULL) {
+                            continue;
+                        }
+                        entry->clazz = throwable;
+                    }
+
+                    if (dvmInstanceof(excepClass, throwable)) {
+                        ALOGV("Match on catch block at 0x%02x in %s.%s "
+                                "for %s", relPc, method->clazz->descriptor,
+                                method->name, excepClass->descriptor);
+                        return entry->address;
+                    }
                 }
             }
-
-            //ALOGD("ADDR MATCH, check %s instanceof %s",
-            //    excepClass->descriptor, pEntry->excepClass->descriptor);
-
-            if (dvmInstanceof(excepClass, throwable)) {
-                ALOGV("Match on catch block at 0x%02x in %s.%s for %s",
-                        relPc, method->clazz->descriptor,
-                        method->name, excepClass->descriptor);
-                return handler->address;
+        } else {
+            /* out of memory; read the DEX data directly */
+            DexCatchIterator iterator;
+            if (dexFindCatchHandler(&iterator, pCode, relPc)) {
+                DexCatchHandler* handler;
+                while ((handler = dexCatchIteratorNext(&iterator)) != NULL) {
+                    if (handler->typeIdx == kDexNoIndex) {
+                        return handler->address;
+                    }
+                    ClassObject* throwable =
+                        resolveCatchClass(self, method, handler->typeIdx);
+                    if (throwable != NULL &&
+                        dvmInstanceof(excepClass, throwable)) {
+                        return handler->address;
+                    }
+                }
             }
         }
     }
@@ -817,6 +971,11 @@ int dvmFindCatchBlock(Thread* self, int relPc, Object* exception,
  * presently an array of integers, but could become something else in the
  * future.  If "wantObject" is false, return plain malloc data.
  *
+ * A Throwable (the "wantObject" case) keeps only the innermost
+ * gDvm.stackTraceDepth frames, so deep recursion doesn't make every
+ * exception walk and copy the whole stack.  Raw traces, which are for
+ * the debugger and for thread dumps, are always complete.
+ *
  * NOTE: if we support class unloading, we will need to scan the class
  * object references out of these arrays.
  */
@@ -827,6 +986,7 @@ void* dvmFillInStackTraceInternal(Thread* thread, bool wantObject, size_t* pCoun
     void* fp;
     void* startFp;
     size_t stackDepth;
+    size_t maxDepth;
     int* intPtr;
 
     if (pCount != NULL)
@@ -862,12 +1022,16 @@ void* dvmFillInStackTraceInternal(Thread* thread, bool wantObject, size_t* pCoun
     /*
      * Compute the stack depth.
      */
+    maxDepth = wantObject ? gDvm.stackTraceDepth : 0;
     stackDepth = 0;
     while (fp != NULL) {
         const StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
 
-        if (!dvmIsBreakFrame((u4*)fp))
+        if (!dvmIsBreakFrame((u4*)fp)) {
+            if (stackDepth == maxDepth && maxDepth != 0)
+                break;
             stackDepth++;
+        }
 
         assert(fp != saveArea->prevFrame);
         fp = saveArea->prevFrame;
@@ -903,7 +1067,7 @@ void* dvmFillInStackTraceInternal(Thread* thread, bool wantObject, size_t* pCoun
         *pCount = stackDepth;
 
     fp = startFp;
-    while (fp != NULL) {
+    while (fp != NULL && stackDepth != 0) {
         const StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
         const Method* method = saveArea->method;
 
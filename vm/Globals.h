@@ -39,6 +39,8 @@
 struct GcHeap;
 struct BreakpointSet;
 struct InlineSub;
+struct BootClassIndex;
+struct LineTableCache;
 
 /*
  * One of these for each -ea/-da/-esa/-dsa on the command line.
@@ -58,7 +60,9 @@ struct AssertionControl {
  *
  * "TypePrecise" is slower and requires additional storage for the register
  * maps, but allows type-precise GC.  "LivePrecise" is even slower and
- * requires additional heap during processing, but allows live-precise GC.
+ * requires additional heap during processing, but allows live-precise GC;
+ * it also keeps a map of every live register at each GC point, which the
+ * JIT uses to skip writing back values nothing reads.
  */
 enum RegisterMapMode {
     kRegisterMapModeUnknown = 0,
@@ -66,6 +70,17 @@ enum RegisterMapMode {
     kRegisterMapModeLivePrecise
 };
 
+/*
+ * How the heap is sized after a collection.  "Utilization" keeps the
+ * live set a fixed fraction of the heap.  "GcTime" gives the heap as
+ * much free space as the measured allocation rate needs for the
+ * collector to take a fixed fraction of the time.
+ */
+enum HeapGrowthPolicy {
+    kHeapGrowthPolicyUtilization = 0,
+    kHeapGrowthPolicyGcTime
+};
+
 /*
  * Profiler clock source.
  */
@@ -91,9 +106,14 @@ struct DvmGlobals {
     size_t      heapMaximumSize;
     size_t      heapGrowthLimit;
     bool        lowMemoryMode;
+    bool        useHugePages;
     double      heapTargetUtilization;
     size_t      heapMinFree;
     size_t      heapMaxFree;
+    HeapGrowthPolicy heapGrowthPolicy;
+    double      heapTargetGcTime;   // fraction of time, for kHeapGrowthPolicyGcTime
+    size_t      tlabSize;           // 0 disables thread-local alloc buffers
+    size_t      largeObjectThreshold; // 0 disables the large object space
     size_t      stackSize;
     size_t      mainThreadStackSize;
 
@@ -101,6 +121,7 @@ struct DvmGlobals {
     bool        verboseJni;
     bool        verboseClass;
     bool        verboseShutdown;
+    bool        verboseStartup;
 
     bool        jdwpAllowed;        // debugging allowed for this process?
     bool        jdwpConfigured;     // has debugging info been provided?
@@ -120,6 +141,20 @@ struct DvmGlobals {
      */
     u4          lockProfThreshold;
 
+    /*
+     * Keep totals of the time threads block on monitors, by the place
+     * the owner locked it and the place the waiter blocked.  See
+     * dvmDumpContentionSites().
+     */
+    bool        lockProfSites;
+
+    /* bias thin locks toward the first thread to take them */
+    bool        biasedLocking;
+
+    /* scramble identity hash codes with identityHashSeed */
+    bool        randomIdentityHash;
+    u4          identityHashSeed;
+
     int         (*vfprintfHook)(FILE*, const char*, va_list);
     void        (*exitHook)(int);
     void        (*abortHook)(void);
@@ -130,6 +165,14 @@ struct DvmGlobals {
     bool        noQuitHandler;
     bool        verifyDexChecksum;
     char*       stackTraceFile;     // for SIGQUIT-inspired output
+    char*       perfSnapshotFile;   // for SIGUSR2-inspired output
+    size_t      stackTraceDepth;    // frames kept per Throwable, 0 for all
+    size_t      lineTableCacheSize; // bytes of decoded line tables to keep
+    char*       fieldProfileFile;   // hot fields to lay out first
+    char*       startupPageDir;     // where startup page profiles live
+    int         startupPageWindowMs; // how long startup lasts, for them
+    size_t      hprofPrimitiveArrayLimit; // larger arrays dumped without data
+    bool        hprofCompress;      // gzip heap dumps written to files
 
     bool        logStdio;
 
@@ -142,6 +185,8 @@ struct DvmGlobals {
     bool        monitorVerification;
 
     bool        dexOptForSmp;
+    bool        dexOptParallel;     // verify/optimize on several threads
+    bool        dexOptChecksumOk;   // DEX checksum was checked on extract
 
     /*
      * GC option flags.
@@ -150,8 +195,17 @@ struct DvmGlobals {
     bool        preVerify;
     bool        postVerify;
     bool        concurrentMarkSweep;
+    bool        stickyGc;
+    bool        sizeClassAlloc;     // small objects come from size-class runs
+    bool        backgroundCompaction; // compact the heap when backgrounded
+    bool        zygoteCompaction;   // pack the zygote heap before forking
+    bool        preresolveZygote;   // resolve const-strings before forking
+    bool        preresolveApps;     // ...and in app DEX files, in background
+    size_t      markThreads;        // threads tracing the heap, incl. the GC
     bool        verifyCardTable;
+    size_t      heapVerifySampleRate; // pre/postverify check one in N objects
     bool        disableExplicitGc;
+    bool        incrementalThreadRoots; // scan threads one at a time
 
     int         assertionCtrlCount;
     AssertionControl*   assertionCtrl;
@@ -178,6 +232,8 @@ struct DvmGlobals {
      * Where the VM goes to find system classes.
      */
     ClassPathEntry* bootClassPath;
+    /* merged descriptor index over all of bootClassPath, once it's open */
+    BootClassIndex* bootClassIndex;
     /* used by the DEX optimizer to load classes from an unfinished DEX */
     DvmDex*     bootClassPathOptExtra;
     bool        optimizingBootstrapClass;
@@ -188,6 +244,27 @@ struct DvmGlobals {
      */
     HashTable*  loadedClasses;
 
+    /*
+     * Interned iftable method index arrays, shared by all the classes
+     * that implement an interface with the same vtable offsets.  Small
+     * arrays are carved out of a LinearAlloc chunk, of which
+     * ifviChunkUsed ints are taken.  Guarded by the table's lock.
+     */
+    HashTable*  ifviArrays;
+    int*        ifviChunk;
+    int         ifviChunkUsed;
+
+    /*
+     * Canonical ids of method signatures, shared by all DEX files, so
+     * that prototypes from different files compare as integers.  Guarded
+     * by the table's lock.
+     */
+    HashTable*  protoIdTable;
+    u4          protoIdCount;
+
+    /* held while the direct methods of a class are built */
+    pthread_mutex_t directMethodsLock;
+
     /*
      * Value for the next class serial number to be assigned.  This is
      * incremented as we load classes.  Failed loads and races may result
@@ -217,6 +294,15 @@ struct DvmGlobals {
     /* Hash table of strings interned by the class loader. */
     HashTable*  literalStrings;
 
+    /* decoded line number tables, for stack traces and the debugger */
+    LineTableCache* lineTableCache;
+
+    /* resolved signatures of reflected methods (ReflectSig, Reflect.cpp) */
+    HashTable*  reflectSigCache;
+
+    /* decoded annotation sets (AnnotationSetEntry, Annotation.cpp) */
+    HashTable*  annotationCache;
+
     /*
      * Classes constructed directly by the vm.
      */
@@ -235,6 +321,9 @@ struct DvmGlobals {
     ClassObject* typeFloat;
     ClassObject* typeDouble;
 
+    /* java/lang/Integer and friends, indexed by PrimitiveType */
+    ClassObject* boxClasses[PRIM_DOUBLE + 1];
+
     /* synthetic classes for arrays of primitives */
     ClassObject* classArrayBoolean;
     ClassObject* classArrayByte;
@@ -405,6 +494,9 @@ struct DvmGlobals {
     /* direct method pointers - java.lang.reflect.Proxy */
     Method*     methJavaLangReflectProxy_constructorPrototype;
 
+    /* interface method pointer - java.lang.reflect.InvocationHandler */
+    Method*     methJavaLangReflectInvocationHandler_invoke;
+
     /* field offsets - java.lang.reflect.Proxy */
     int         offJavaLangReflectProxy_h;
 
@@ -470,23 +562,14 @@ struct DvmGlobals {
     pthread_mutex_t _threadSuspendLock;
 
     /*
-     * Guards Thread->suspendCount for all threads, and
-     * provides the lock for the condition variable that all suspended threads
-     * sleep on (threadSuspendCountCond).
+     * Guards Thread->suspendCount for all threads.  Suspended threads
+     * sleep on their own suspendCount, as a futex, until it is zero.
      *
      * This has to be separate from threadListLock because of the way
      * threads put themselves to sleep.
      */
     pthread_mutex_t threadSuspendCountLock;
 
-    /*
-     * Suspended threads sleep on this.  They should sleep on the condition
-     * variable until their "suspend count" is zero.
-     *
-     * Paired with "threadSuspendCountLock".
-     */
-    pthread_cond_t  threadSuspendCountCond;
-
     /*
      * Sum of all threads' suspendCount fields. Guarded by
      * threadSuspendCountLock.
@@ -523,18 +606,19 @@ struct DvmGlobals {
     HashTable*  userDexFiles;
 
     /*
-     * JNI global reference table.
+     * JNI global reference tables.  The strong one needs no lock.
      */
-    IndirectRefTable jniGlobalRefTable;
+    ShardedIndirectRefTable jniGlobalRefTable;
     IndirectRefTable jniWeakGlobalRefTable;
-    pthread_mutex_t jniGlobalRefLock;
     pthread_mutex_t jniWeakGlobalRefLock;
 
     /*
-     * JNI pinned object table (used for primitive arrays).
+     * JNI pinned object table (used for primitive arrays), mapping each
+     * pinned array to its pin count.  Arrays are only pinned if the GC
+     * may move them, or if CheckJNI was on at startup and wants to hear
+     * about leaked pins; otherwise jniPinTable is NULL.
      */
-    ReferenceTable  jniPinRefTable;
-    pthread_mutex_t jniPinRefLock;
+    HashTable*  jniPinTable;
 
     /*
      * Native shared library table.
@@ -585,6 +669,13 @@ struct DvmGlobals {
      */
     AtomicCache* instanceofCache;
 
+    /*
+     * Cache results of Class.forName(), keyed on the initiating loader
+     * and the hash of the name.  Entries for dead loaders are cleared
+     * by the GC.
+     */
+    AtomicCache* classNameCache;
+
     /* inline substitution table, used during optimization */
     InlineSub*          inlineSubs;
 
@@ -610,15 +701,22 @@ struct DvmGlobals {
      * Note: Each thread will normally determine whether the debugger is active
      * for it by referring to its subMode flags.  "debuggerActive" here should be
      * seen as "debugger is making requests of 1 or more threads".
+     * "debuggerInstrumented" is set while breakpoints, steps or method
+     * entry/exit events need every thread to check each instruction.
      */
     bool        debuggerConnected;      /* debugger or DDMS is connected */
     bool        debuggerActive;         /* debugger is making requests */
+    bool        debuggerInstrumented;   /* kSubModeDebuggerActive is on */
     JdwpState*  jdwpState;
 
     /*
-     * Registry of objects known to the debugger.
+     * Registry of objects known to the debugger, holding DbgRegistryEntry
+     * items, and some counts for the log when the debugger detaches.
      */
     HashTable*  dbgRegistry;
+    int         dbgRegistryPeak;
+    u4          dbgRegistryAdded;
+    u4          dbgRegistryDisposed;
 
     /*
      * Debugger breakpoint table.
@@ -645,13 +743,23 @@ struct DvmGlobals {
     /*
      * Used for tracking allocations that we report to DDMS.  When the feature
      * is enabled (through a DDMS request) the "allocRecords" pointer becomes
-     * non-NULL.
+     * non-NULL.  Threads fill their own buffers and move them here in
+     * batches; the generation changes each time tracking is enabled, so
+     * records left over from an earlier session are dropped.
      */
     pthread_mutex_t allocTrackerLock;
     AllocRecord*    allocRecords;
     int             allocRecordHead;        /* most-recently-added entry */
     int             allocRecordCount;       /* #of valid entries */
     int             allocRecordMax;         /* Number of allocated entries. */
+    u4              allocTrackerGeneration;
+    size_t          allocTrackerSampleBytes;    /* 0 records everything */
+
+    /*
+     * Bytes between samples of the allocation profiler, or 0 if it isn't
+     * running; see alloc/AllocProfiler.cpp.
+     */
+    size_t          allocProfilerInterval;
 
     /*
      * When a profiler is enabled, this is incremented.  Distinct profilers
@@ -696,12 +804,25 @@ struct DvmGlobals {
     int*        executedInstrCounts;
     int         instructionCountEnableCount;
 
+    /*
+     * Counts of instructions followed by another without a branch, at
+     * [first * kNumPackedOpcodes + second].  Only allocated, and counted,
+     * with -Xopcodepairs; used to choose the superinstructions.
+     */
+    bool        countOpcodePairs;
+    u4*         executedPairCounts;
+
     /*
      * Signal catcher thread (for SIGQUIT).
      */
     pthread_t   signalCatcherHandle;
     bool        haltSignalCatcher;
 
+    /*
+     * Thread that finishes post-zygote initialization in the background.
+     */
+    pthread_t   postForkInitHandle;
+
     /*
      * Stdout/stderr conversion thread.
      */
@@ -710,6 +831,8 @@ struct DvmGlobals {
     pthread_t       stdioConverterHandle;
     pthread_mutex_t stdioConverterLock;
     pthread_cond_t  stdioConverterCond;
+    pthread_t       stdioLoggerHandle;
+    pthread_cond_t  stdioLoggerCond;
     int             stdoutPipe[2];
     int             stderrPipe[2];
 
@@ -769,19 +892,12 @@ enum NoChainExits {
  */
 struct DvmJitGlobals {
     /*
-     * Guards writes to Dalvik PC (dPC), translated code address (codeAddr) and
-     * chain fields within the JIT hash table.  Note carefully the access
-     * mechanism.
-     * Only writes are guarded, and the guarded fields must be updated in a
-     * specific order using atomic operations.  Further, once a field is
-     * written it cannot be changed without halting all threads.
-     *
-     * The write order is:
+     * Guards the whole-table operations on the JIT hash table: resizing,
+     * resetting and eviction.  Entries are added without it by claiming a
+     * free slot with a CAS on its info word, and then writing, in order:
      *    1) codeAddr
      *    2) dPC
-     *    3) chain [if necessary]
-     *
-     * This mutex also guards both read and write of curJitTableEntries.
+     * Once dPC is written it cannot be changed without halting all threads.
      */
     pthread_mutex_t tableLock;
 
@@ -813,27 +929,77 @@ struct DvmJitGlobals {
     /* Trigger for trace selection */
     unsigned short threshold;
 
+    /*
+     * Runs of a baseline translation after which its trace is compiled in
+     * full.  0 compiles every trace in full right away.
+     */
+    int recompileThreshold;
+
+    /*
+     * Largest method, in code units, whose hot entry trace takes in all of
+     * its forward code.  0 disables method regions, -1 leaves the choice to
+     * the target.
+     */
+    int methodRegionSize;
+
+    /*
+     * Largest callee, in code units, whose invoke trace selection follows
+     * to keep the trace going after the return.  0 ends traces at invokes.
+     */
+    int followInvokeSize;
+
     /* JIT Compiler Control */
     bool               haltCompilerThread;
     bool               blockingMode;
     bool               methodTraceSupport;
     bool               genSuspendPoll;
+
+    /*
+     * explicitNullChecks is set by -Xjitexplicitnullchecks.  Otherwise
+     * implicitNullChecks is set once the SIGSEGV handler is installed, and
+     * field accesses in translations then leave the null check to the
+     * fault.  It is cleared again if another handler takes SIGSEGV over.
+     */
+    bool               explicitNullChecks;
+    bool               implicitNullChecks;
+
+    /*
+     * Set by -Xjitverifycardelision: card marks are still left out where
+     * they aren't needed, and every GC verifies the card table, so that
+     * a store that did need its mark aborts the VM.
+     */
+    bool               verifyCardElision;
     Thread*            compilerThread;
     pthread_t          compilerHandle;
     pthread_mutex_t    compilerLock;
+    pthread_mutex_t    compilerInstallLock;
     pthread_mutex_t    compilerICPatchLock;
     pthread_cond_t     compilerQueueActivity;
     pthread_cond_t     compilerQueueEmpty;
     volatile int       compilerQueueLength;
     int                compilerHighWater;
-    int                compilerWorkEnqueueIndex;
-    int                compilerWorkDequeueIndex;
+    unsigned int       compilerWorkSequence;
     int                compilerICPatchIndex;
 
+    /*
+     * Compiler threads, including the first one above.  The others are
+     * started by the first once it has set up the code cache.
+     */
+    unsigned int       numCompilerThreads;
+    unsigned int       numCompilerHelpers;
+    pthread_t          compilerHelperHandles[COMPILER_MAX_THREADS - 1];
+
     /* JIT internal stats */
     int                compilerMaxQueued;
     int                translationChains;
 
+    /* Work order stats, guarded by compilerLock */
+    int                compilerOrdersDone;
+    u8                 compilerQueueTime;
+    u8                 compilerMaxQueueTime;
+    u8                 compilerWorkTime;
+    u8                 compilerMaxWorkTime;
+
     /* Compiled code cache */
     void* codeCache;
 
@@ -863,18 +1029,59 @@ struct DvmJitGlobals {
     /* Flag to indicate that the code cache is full */
     bool codeCacheFull;
 
+    /*
+     * The code cache regions, and the one translations are added to.
+     * codeCacheRegionFull is set when that region ran out of space, so
+     * that the safe point evicts a region rather than resetting the cache.
+     */
+    JitCodeCacheRegion codeCacheRegions[JIT_MAX_CODE_CACHE_REGIONS];
+    unsigned int numCodeCacheRegions;
+    unsigned int codeCacheRegion;
+    unsigned int codeCacheGeneration;
+    bool codeCacheRegionFull;
+
     /* Page size  - 1 */
     unsigned int pageSizeMask;
 
     /* Lock to change the protection type of the code cache */
     pthread_mutex_t    codeCacheProtectionLock;
 
+    /* The code cache is on huge pages, and its protection isn't changed */
+    bool codeCacheWritable;
+
+    /*
+     * Writes to the code cache between syncs of the pages left writable
+     * and the flushes queued, and the counts of each.
+     */
+    unsigned int codeCacheWriteBatch;
+    u8 numCodeCacheWrites;
+    u8 numCodeCacheFlushes;
+    u8 numCodeCacheMprotects;
+
     /* Number of times that the code cache has been reset */
     int numCodeCacheReset;
 
     /* Number of times that the code cache reset request has been delayed */
     int numCodeCacheResetDelayed;
 
+    /* Number of regions evicted, and of the translations they held */
+    int numCodeCacheEvictions;
+    int numTranslationsEvicted;
+
+    /* Implicit null check sites recorded, and the faults taken at them */
+    int numNullFaultSites;
+    volatile int32_t numNullFaults;
+
+    /* Reference stores compiled without a card mark */
+    int numCardMarksElided;
+
+    /* Bytes of translations ever committed to the code cache */
+    u8 codeCacheBytesCommitted;
+
+    /* Baseline translations compiled, and those recompiled in full */
+    int numBaselineTraces;
+    int numTracesRecompiled;
+
     /* true/false: compile/reject opcodes specified in the -Xjitop list */
     bool includeSelectedOp;
 
@@ -897,6 +1104,19 @@ struct DvmJitGlobals {
     unsigned int pcTable[COMPILER_PC_OFFSET_SIZE];
     int num_entries_pcTable;
 
+    /* File that keeps the hot traces across runs, or NULL */
+    char* traceFile;
+
+    /* Interval of the translation sampler in milliseconds, 0 if off */
+    int sampleIntervalMs;
+
+    /*
+     * Share of one CPU, in percent, that the compiler threads may use, and
+     * code cache growth allowed in KB per second.  0 is no limit.
+     */
+    int compileBudgetPercent;
+    int codeCacheBudgetKBPerSec;
+
     /* Flag to dump all compiled code */
     bool printMe;
 
@@ -927,6 +1147,19 @@ struct DvmJitGlobals {
 #if defined(WITH_SELF_VERIFICATION)
     /* Spin when error is detected, volatile so GDB can reset it */
     volatile bool selfVerificationSpin;
+
+    /*
+     * Verify one in selfVerificationSample trace runs, on one thread in
+     * selfVerificationThreads.  The other runs keep what the translation
+     * did.  Sampling also turns a divergence from a hang into a report.
+     */
+    int selfVerificationSample;
+    int selfVerificationThreads;
+
+    /* Runs verified and kept unverified, and divergences reported */
+    volatile int selfVerificationChecked;
+    volatile int selfVerificationKept;
+    volatile int selfVerificationDivergences;
 #endif
 
     /* Framework or stand-alone? */
@@ -958,10 +1191,13 @@ struct DvmJitGlobals {
     int                invokeMonoSetterInlined;
     int                invokePolyGetterInlined;
     int                invokePolySetterInlined;
+    int                invokeMonoLeafInlined;
+    int                invokePolyLeafInlined;
     int                returnOp;
     int                icPatchInit;
     int                icPatchLockFree;
     int                icPatchQueued;
+    int                icPatchUnsuspended;
     int                icPatchRejected;
     int                icPatchDropped;
     int                codeCachePatches;
@@ -998,6 +1234,13 @@ struct DvmJniGlobals {
     bool warnOnly;
     bool forceCopy;
 
+    /*
+     * With -Xjniopts:sample=N, CheckJNI gives each thread's JNI calls the
+     * full argument checks only once every checkSample calls, and doesn't
+     * pin arrays.  Values of 1 or less check every call.
+     */
+    int checkSample;
+
     // Provide backwards compatibility for pre-ICS apps on ICS.
     bool workAroundAppJniBugs;
 
@@ -17,10 +17,17 @@
  * Hash table.  The dominant calls are add and lookup, with removals
  * happening very infrequently.  We use probing, and don't worry much
  * about tombstone removal.
+ *
+ * Tables that do see a lot of removals can be created in "Robin Hood"
+ * mode instead.  An entry may then displace one that is closer to its
+ * home slot, which keeps probe lengths even and lets a lookup stop as
+ * soon as it reaches an entry nearer home than itself would be.  Removal
+ * shifts the rest of the cluster back by one, so there are no tombstones.
  */
 #include "Dalvik.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 /* table load factor, i.e. how full can it get before we resize */
 //#define LOAD_NUMER  3       // 75%
@@ -38,6 +45,14 @@ size_t dvmHashSize(size_t size) {
 }
 
 
+/*
+ * An entry array replaced by a resize, in a table with concurrent readers.
+ */
+struct HashRetiredEntries {
+    HashEntry*  pEntries;
+    HashRetiredEntries* next;
+};
+
 /*
  * Create and initialize a hash table.
  */
@@ -56,6 +71,9 @@ HashTable* dvmHashTableCreate(size_t initialSize, HashFreeFunc freeFunc)
     pHashTable->tableSize = dexRoundUpPower2(initialSize);
     pHashTable->numEntries = pHashTable->numDeadEntries = 0;
     pHashTable->freeFunc = freeFunc;
+    pHashTable->concurrentReads = false;
+    pHashTable->robinHood = false;
+    pHashTable->retired = NULL;
     pHashTable->pEntries =
         (HashEntry*) calloc(pHashTable->tableSize, sizeof(HashEntry));
     if (pHashTable->pEntries == NULL) {
@@ -66,6 +84,82 @@ HashTable* dvmHashTableCreate(size_t initialSize, HashFreeFunc freeFunc)
     return pHashTable;
 }
 
+HashTable* dvmHashTableCreateConcurrent(size_t initialSize,
+    HashFreeFunc freeFunc)
+{
+    HashTable* pHashTable = dvmHashTableCreate(initialSize, freeFunc);
+    if (pHashTable != NULL)
+        pHashTable->concurrentReads = true;
+    return pHashTable;
+}
+
+HashTable* dvmHashTableCreateRobinHood(size_t initialSize,
+    HashFreeFunc freeFunc)
+{
+    HashTable* pHashTable = dvmHashTableCreate(initialSize, freeFunc);
+    if (pHashTable != NULL)
+        pHashTable->robinHood = true;
+    return pHashTable;
+}
+
+/*
+ * How far the entry in slot "idx" is from the slot its hash maps to.
+ */
+static inline int probeDistance(u4 hashValue, int idx, int tableSize)
+{
+    return (idx - (int) (hashValue & (tableSize-1))) & (tableSize-1);
+}
+
+/*
+ * Store an entry in a Robin Hood table, starting at slot "idx", which is
+ * "dist" slots from the entry's home.  Whenever we pass an entry that is
+ * closer to its own home than we are to ours, the two trade places and
+ * we carry on placing the displaced one.
+ *
+ * The caller guarantees there is an empty slot.
+ */
+static void robinHoodPlace(HashEntry* pEntries, int tableSize, int idx,
+    int dist, u4 hashValue, void* data)
+{
+    while (pEntries[idx].data != NULL) {
+        int theirDist = probeDistance(pEntries[idx].hashValue, idx, tableSize);
+        if (theirDist < dist) {
+            u4 tmpHash = pEntries[idx].hashValue;
+            void* tmpData = pEntries[idx].data;
+            pEntries[idx].hashValue = hashValue;
+            pEntries[idx].data = data;
+            hashValue = tmpHash;
+            data = tmpData;
+            dist = theirDist;
+        }
+        idx = (idx + 1) & (tableSize-1);
+        dist++;
+    }
+    pEntries[idx].hashValue = hashValue;
+    pEntries[idx].data = data;
+}
+
+/*
+ * Empty slot "idx" of a Robin Hood table by moving each following entry
+ * of the cluster back one slot.  We stop at an empty slot, or at an entry
+ * that is already in its home slot.
+ */
+static void robinHoodShiftBack(HashTable* pHashTable, int idx)
+{
+    HashEntry* pEntries = pHashTable->pEntries;
+    int tableSize = pHashTable->tableSize;
+    int next = (idx + 1) & (tableSize-1);
+
+    while (pEntries[next].data != NULL &&
+        probeDistance(pEntries[next].hashValue, next, tableSize) != 0)
+    {
+        pEntries[idx] = pEntries[next];
+        idx = next;
+        next = (next + 1) & (tableSize-1);
+    }
+    pEntries[idx].data = NULL;
+}
+
 /*
  * Clear out all entries.
  */
@@ -100,6 +194,12 @@ void dvmHashTableFree(HashTable* pHashTable)
         return;
     dvmHashTableClear(pHashTable);
     free(pHashTable->pEntries);
+    while (pHashTable->retired != NULL) {
+        HashRetiredEntries* retired = pHashTable->retired;
+        pHashTable->retired = retired->next;
+        free(retired->pEntries);
+        free(retired);
+    }
     free(pHashTable);
 }
 
@@ -128,6 +228,12 @@ static int countTombStones(HashTable* pHashTable)
  * If multiple threads can access the hash table, the table's lock should
  * have been grabbed before issuing the "lookup+add" call that led to the
  * resize, so we don't have a synchronization problem here.
+ *
+ * Lock-free readers see either the old array with the old size, or the new
+ * array with either size (see dvmHashTableLookupConcurrent), so the new
+ * array is published before the new size, and the old one is retired
+ * rather than freed.  An array is never smaller than half of the next, so
+ * the retired ones only add up to the size of the live one.
  */
 static bool resizeHash(HashTable* pHashTable, int newSize)
 {
@@ -147,6 +253,12 @@ static bool resizeHash(HashTable* pHashTable, int newSize)
             int hashValue = pHashTable->pEntries[i].hashValue;
             int newIdx;
 
+            if (pHashTable->robinHood) {
+                robinHoodPlace(pNewEntries, newSize, hashValue & (newSize-1),
+                    0, hashValue, data);
+                continue;
+            }
+
             /* probe for new spot, wrapping around */
             newIdx = hashValue & (newSize-1);
             while (pNewEntries[newIdx].data != NULL)
@@ -157,15 +269,90 @@ static bool resizeHash(HashTable* pHashTable, int newSize)
         }
     }
 
-    free(pHashTable->pEntries);
-    pHashTable->pEntries = pNewEntries;
-    pHashTable->tableSize = newSize;
+    if (pHashTable->concurrentReads) {
+        HashRetiredEntries* retired =
+            (HashRetiredEntries*) malloc(sizeof(*retired));
+        if (retired == NULL) {
+            free(pNewEntries);
+            return false;
+        }
+        retired->pEntries = pHashTable->pEntries;
+        retired->next = pHashTable->retired;
+        pHashTable->retired = retired;
+        android_atomic_release_store((int32_t) pNewEntries,
+            (volatile int32_t*) &pHashTable->pEntries);
+        android_atomic_release_store(newSize,
+            (volatile int32_t*) &pHashTable->tableSize);
+    } else {
+        free(pHashTable->pEntries);
+        pHashTable->pEntries = pNewEntries;
+        pHashTable->tableSize = newSize;
+    }
     pHashTable->numDeadEntries = 0;
 
     assert(countTombStones(pHashTable) == 0);
     return true;
 }
 
+/*
+ * Check whether a lookup+add just pushed the table past its load limit,
+ * and grow it if so.
+ */
+static void checkLoad(HashTable* pHashTable)
+{
+    if ((pHashTable->numEntries+pHashTable->numDeadEntries) * LOAD_DENOM
+        > pHashTable->tableSize * LOAD_NUMER)
+    {
+        if (!resizeHash(pHashTable, pHashTable->tableSize * 2)) {
+            /* don't really have a way to indicate failure */
+            ALOGE("Dalvik hash resize failure");
+            dvmAbort();
+        }
+    }
+
+    /* full table is bad -- search for nonexistent never halts */
+    assert(pHashTable->numEntries < pHashTable->tableSize);
+}
+
+/*
+ * Look up an entry in a Robin Hood table.
+ *
+ * An entry that is closer to its home than we would be to ours at the
+ * same slot means ours isn't in the table, since the add would have
+ * displaced it.  That is also where a new entry goes.
+ */
+static void* robinHoodLookup(HashTable* pHashTable, u4 itemHash, void* item,
+    HashCompareFunc cmpFunc, bool doAdd)
+{
+    HashEntry* pEntries = pHashTable->pEntries;
+    int tableSize = pHashTable->tableSize;
+    int idx = itemHash & (tableSize-1);
+    int dist;
+
+    for (dist = 0; ; dist++) {
+        const HashEntry* pEntry = &pEntries[idx];
+        if (pEntry->data == NULL ||
+            probeDistance(pEntry->hashValue, idx, tableSize) < dist)
+        {
+            break;
+        }
+        if (pEntry->hashValue == itemHash &&
+            (*cmpFunc)(pEntry->data, item) == 0)
+        {
+            return pEntry->data;
+        }
+        idx = (idx + 1) & (tableSize-1);
+    }
+
+    if (!doAdd)
+        return NULL;
+
+    robinHoodPlace(pEntries, tableSize, idx, dist, itemHash, item);
+    pHashTable->numEntries++;
+    checkLoad(pHashTable);
+    return item;
+}
+
 /*
  * Look up an entry.
  *
@@ -182,6 +369,9 @@ void* dvmHashTableLookup(HashTable* pHashTable, u4 itemHash, void* item,
     assert(item != HASH_TOMBSTONE);
     assert(item != NULL);
 
+    if (pHashTable->robinHood)
+        return robinHoodLookup(pHashTable, itemHash, item, cmpFunc, doAdd);
+
     /* jump to the first entry and probe for a match */
     pEntry = &pHashTable->pEntries[itemHash & (pHashTable->tableSize-1)];
     pEnd = &pHashTable->pEntries[pHashTable->tableSize];
@@ -207,30 +397,17 @@ void* dvmHashTableLookup(HashTable* pHashTable, u4 itemHash, void* item,
 
     if (pEntry->data == NULL) {
         if (doAdd) {
+            /* "data" last: a lock-free reader checks the hash after it */
             pEntry->hashValue = itemHash;
-            pEntry->data = item;
+            android_atomic_release_store((int32_t) item,
+                (volatile int32_t*) &pEntry->data);
             pHashTable->numEntries++;
 
             /*
              * We've added an entry.  See if this brings us too close to full.
+             * Note "pEntry" is invalid after this.
              */
-            if ((pHashTable->numEntries+pHashTable->numDeadEntries) * LOAD_DENOM
-                > pHashTable->tableSize * LOAD_NUMER)
-            {
-                if (!resizeHash(pHashTable, pHashTable->tableSize * 2)) {
-                    /* don't really have a way to indicate failure */
-                    ALOGE("Dalvik hash resize failure");
-                    dvmAbort();
-                }
-                /* note "pEntry" is now invalid */
-            } else {
-                //ALOGW("okay %d/%d/%d",
-                //    pHashTable->numEntries, pHashTable->tableSize,
-                //    (pHashTable->tableSize * LOAD_NUMER) / LOAD_DENOM);
-            }
-
-            /* full table is bad -- search for nonexistent never halts */
-            assert(pHashTable->numEntries < pHashTable->tableSize);
+            checkLoad(pHashTable);
             result = item;
         } else {
             assert(result == NULL);
@@ -242,6 +419,49 @@ void* dvmHashTableLookup(HashTable* pHashTable, u4 itemHash, void* item,
     return result;
 }
 
+/*
+ * Look up an entry without the lock.
+ *
+ * The size is read before the array, and resizeHash publishes them in
+ * the other order, so the size we use is never larger than the array.
+ * We give up after one full pass over the table, since with a stale size
+ * we might otherwise not find an empty slot to stop at.
+ */
+void* dvmHashTableLookupConcurrent(HashTable* pHashTable, u4 itemHash,
+    void* item, HashCompareFunc cmpFunc, int* pProbes)
+{
+    assert(pHashTable->concurrentReads);
+    assert(item != HASH_TOMBSTONE);
+    assert(item != NULL);
+
+    int tableSize = android_atomic_acquire_load(
+        (volatile int32_t*) &pHashTable->tableSize);
+    HashEntry* pEntries = (HashEntry*) android_atomic_acquire_load(
+        (volatile int32_t*) &pHashTable->pEntries);
+    int idx = itemHash & (tableSize-1);
+    void* result = NULL;
+    int probes;
+
+    for (probes = 0; probes < tableSize; probes++) {
+        HashEntry* pEntry = &pEntries[idx];
+        void* data = (void*) android_atomic_acquire_load(
+            (volatile int32_t*) &pEntry->data);
+        if (data == NULL)
+            break;
+        if (data != HASH_TOMBSTONE && pEntry->hashValue == itemHash &&
+            (*cmpFunc)(data, item) == 0)
+        {
+            result = data;
+            break;
+        }
+        idx = (idx + 1) & (tableSize-1);
+    }
+
+    if (pProbes != NULL)
+        *pProbes = probes;
+    return result;
+}
+
 /*
  * Remove an entry from the table.
  *
@@ -254,6 +474,25 @@ bool dvmHashTableRemove(HashTable* pHashTable, u4 itemHash, void* item)
 
     assert(pHashTable->tableSize > 0);
 
+    if (pHashTable->robinHood) {
+        int tableSize = pHashTable->tableSize;
+        int idx = itemHash & (tableSize-1);
+        int dist;
+
+        for (dist = 0; pHashTable->pEntries[idx].data != NULL; dist++) {
+            pEntry = &pHashTable->pEntries[idx];
+            if (probeDistance(pEntry->hashValue, idx, tableSize) < dist)
+                break;
+            if (pEntry->data == item) {
+                robinHoodShiftBack(pHashTable, idx);
+                pHashTable->numEntries--;
+                return true;
+            }
+            idx = (idx + 1) & (tableSize-1);
+        }
+        return false;
+    }
+
     /* jump to the first entry and probe for a match */
     pEntry = &pHashTable->pEntries[itemHash & (pHashTable->tableSize-1)];
     pEnd = &pHashTable->pEntries[pHashTable->tableSize];
@@ -279,6 +518,31 @@ bool dvmHashTableRemove(HashTable* pHashTable, u4 itemHash, void* item)
     return false;
 }
 
+/*
+ * Close up the slots that dvmHashForeachRemove marked in a Robin Hood
+ * table.  Shifting back never moves an entry across an empty slot, so
+ * starting the sweep just past one means no entry is moved behind us.
+ * A marked entry moves like any other (its hash is still there), and a
+ * slot is looked at again after something is shifted into it.
+ */
+static void robinHoodCompact(HashTable* pHashTable)
+{
+    HashEntry* pEntries = pHashTable->pEntries;
+    int tableSize = pHashTable->tableSize;
+    int start, idx;
+
+    for (start = 0; pEntries[start].data != NULL; start++)
+        ;
+
+    idx = (start + 1) & (tableSize-1);
+    while (idx != start) {
+        if (pEntries[idx].data == HASH_TOMBSTONE)
+            robinHoodShiftBack(pHashTable, idx);
+        else
+            idx = (idx + 1) & (tableSize-1);
+    }
+}
+
 /*
  * Scan every entry in the hash table and evaluate it with the specified
  * indirect function call. If the function returns 1, remove the entry from
@@ -287,12 +551,17 @@ bool dvmHashTableRemove(HashTable* pHashTable, u4 itemHash, void* item)
  * Does NOT invoke the "free" function on the item.
  *
  * Returning values other than 0 or 1 will abort the routine.
+ *
+ * A Robin Hood table is marked with tombstones during the scan, so that
+ * entries don't move under it, and compacted afterward.
  */
 int dvmHashForeachRemove(HashTable* pHashTable, HashForeachRemoveFunc func)
 {
     int i, val, tableSize;
+    int removed = 0;
 
     tableSize = pHashTable->tableSize;
+    val = 0;
 
     for (i = 0; i < tableSize; i++) {
         HashEntry* pEnt = &pHashTable->pEntries[i];
@@ -302,14 +571,22 @@ int dvmHashForeachRemove(HashTable* pHashTable, HashForeachRemoveFunc func)
             if (val == 1) {
                 pEnt->data = HASH_TOMBSTONE;
                 pHashTable->numEntries--;
-                pHashTable->numDeadEntries++;
+                removed++;
+                val = 0;
             }
             else if (val != 0) {
-                return val;
+                break;
             }
         }
     }
-    return 0;
+
+    if (pHashTable->robinHood) {
+        if (removed != 0)
+            robinHoodCompact(pHashTable);
+    } else {
+        pHashTable->numDeadEntries += removed;
+    }
+    return val;
 }
 
 
@@ -385,18 +662,22 @@ static int countProbes(HashTable* pHashTable, u4 itemHash, const void* item,
  * Evaluate the amount of probing required for the specified hash table.
  *
  * We do this by running through all entries in the hash table, computing
- * the hash value and then doing a lookup.
+ * the hash value and then doing a lookup.  Along with the summary we log
+ * how many entries needed 0, 1, 2-3, 4-7, ... probes.
  *
  * The caller should lock the table before calling here.
  */
 void dvmHashTableProbeCount(HashTable* pHashTable, HashCalcFunc calcFunc,
     HashCompareFunc cmpFunc)
 {
+    enum { kNumBuckets = 8 };
     int numEntries, minProbe, maxProbe, totalProbe;
+    int histogram[kNumBuckets];
     HashIter iter;
 
     numEntries = maxProbe = totalProbe = 0;
     minProbe = 65536*32767;
+    memset(histogram, 0, sizeof(histogram));
 
     for (dvmHashIterBegin(pHashTable, &iter); !dvmHashIterDone(&iter);
         dvmHashIterNext(&iter))
@@ -413,9 +694,22 @@ void dvmHashTableProbeCount(HashTable* pHashTable, HashCalcFunc calcFunc,
         if (count > maxProbe)
             maxProbe = count;
         totalProbe += count;
+
+        /* bucket 0 is "no probes", bucket n is [2^(n-1), 2^n) */
+        int bucket = 0;
+        while (count > 0 && bucket < kNumBuckets-1) {
+            count >>= 1;
+            bucket++;
+        }
+        histogram[bucket]++;
     }
 
-    ALOGI("Probe: min=%d max=%d, total=%d in %d (%d), avg=%.3f",
+    ALOGI("Probe: min=%d max=%d, total=%d in %d (%d), avg=%.3f%s",
         minProbe, maxProbe, totalProbe, numEntries, pHashTable->tableSize,
-        (float) totalProbe / (float) numEntries);
+        (float) totalProbe / (float) numEntries,
+        pHashTable->robinHood ? " (robin hood)" : "");
+    ALOGI("Probe histogram: 0:%d 1:%d 2-3:%d 4-7:%d 8-15:%d 16-31:%d"
+        " 32-63:%d 64+:%d",
+        histogram[0], histogram[1], histogram[2], histogram[3],
+        histogram[4], histogram[5], histogram[6], histogram[7]);
 }
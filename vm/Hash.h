@@ -77,6 +77,21 @@ struct HashTable {
     HashEntry*  pEntries;           /* array on heap */
     HashFreeFunc freeFunc;
     pthread_mutex_t lock;
+
+    /*
+     * If set, dvmHashTableLookupConcurrent() may be used.  The arrays
+     * that resizing replaces are then kept until the table is freed,
+     * since a reader may still be probing them.
+     */
+    bool        concurrentReads;
+    struct HashRetiredEntries* retired;
+
+    /*
+     * If set, entries are placed Robin Hood style and removal shifts
+     * the cluster back instead of leaving a tombstone.  Entries move
+     * around, so this can't be combined with concurrentReads.
+     */
+    bool        robinHood;
 };
 
 /*
@@ -89,6 +104,22 @@ struct HashTable {
  */
 HashTable* dvmHashTableCreate(size_t initialSize, HashFreeFunc freeFunc);
 
+/*
+ * Like dvmHashTableCreate, but the table may also be searched without
+ * its lock, with dvmHashTableLookupConcurrent().
+ */
+HashTable* dvmHashTableCreateConcurrent(size_t initialSize,
+    HashFreeFunc freeFunc);
+
+/*
+ * Like dvmHashTableCreate, but entries are placed with Robin Hood
+ * displacement and removed without tombstones.  Use this for tables that
+ * see a steady stream of removals; probe lengths stay short without
+ * waiting for a resize.  The rest of the API behaves the same.
+ */
+HashTable* dvmHashTableCreateRobinHood(size_t initialSize,
+    HashFreeFunc freeFunc);
+
 /*
  * Compute the capacity needed for a table to hold "size" elements.  Use
  * this when you know ahead of time how many elements the table will hold.
@@ -145,6 +176,22 @@ INLINE int dvmHashTableMemUsage(HashTable* pHashTable) {
 void* dvmHashTableLookup(HashTable* pHashTable, u4 itemHash, void* item,
     HashCompareFunc cmpFunc, bool doAdd);
 
+/*
+ * Look up an entry without taking the lock, in a table created with
+ * dvmHashTableCreateConcurrent().  Other threads may be adding to or
+ * removing from the table at the same time.
+ *
+ * An entry that is being added right now, or that is moved by a resize
+ * halfway through the search, may not be found.  Returning NULL only
+ * means the caller should try again with dvmHashTableLookup() and the
+ * table locked.  If "pProbes" isn't NULL, the number of entries passed
+ * over is stored there.
+ *
+ * "cmpFunc" must be safe to call without the lock too.
+ */
+void* dvmHashTableLookupConcurrent(HashTable* pHashTable, u4 itemHash,
+    void* item, HashCompareFunc cmpFunc, int* pProbes);
+
 /*
  * Remove an item from the hash table, given its "data" pointer.  Does not
  * invoke the "free" function; just detaches it from the table.
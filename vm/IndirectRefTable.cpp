@@ -19,6 +19,8 @@
  */
 #include "Dalvik.h"
 
+#include <sys/mman.h>
+
 static void abortMaybe() {
     // If CheckJNI is on, it'll give a more detailed error before aborting.
     // Otherwise, we want to abort rather than hand back a bad reference.
@@ -27,21 +29,32 @@ static void abortMaybe() {
     }
 }
 
-bool IndirectRefTable::init(size_t initialCount,
-        size_t maxCount, IndirectRefKind desiredKind)
+/*
+ * The table and the hole stack share one anonymous mapping.  Only the
+ * pages that are used get backed, so reserving the maximum up front costs
+ * little, and the table never has to be copied to grow.
+ */
+static size_t tableMappingSize(size_t maxCount)
+{
+    return ALIGN_UP_TO_PAGE_SIZE(maxCount * (sizeof(IndirectRefSlot) + sizeof(u2)));
+}
+
+bool IndirectRefTable::init(size_t maxCount, IndirectRefKind desiredKind)
 {
-    assert(initialCount > 0);
-    assert(initialCount <= maxCount);
+    assert(maxCount > 0 && maxCount <= 65536);
     assert(desiredKind != kIndirectKindInvalid);
 
-    table_ = (IndirectRefSlot*) malloc(initialCount * sizeof(IndirectRefSlot));
-    if (table_ == NULL) {
+    void* base = mmap(NULL, tableMappingSize(maxCount), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
         return false;
     }
-    memset(table_, 0xd1, initialCount * sizeof(IndirectRefSlot));
+    table_ = (IndirectRefSlot*) base;
+    holes_ = (u2*) (table_ + maxCount);
+    numHoleEntries_ = 0;
+    holeScanSteps_ = 0;
 
     segmentState.all = IRT_FIRST_SEGMENT;
-    alloc_entries_ = initialCount;
     max_entries_ = maxCount;
     kind_ = desiredKind;
 
@@ -53,9 +66,41 @@ bool IndirectRefTable::init(size_t initialCount,
  */
 void IndirectRefTable::destroy()
 {
-    free(table_);
+    if (table_ != NULL) {
+        munmap(table_, tableMappingSize(max_entries_));
+    }
     table_ = NULL;
-    alloc_entries_ = max_entries_ = -1;
+    holes_ = NULL;
+    max_entries_ = -1;
+}
+
+/*
+ * Records a new hole at "index".  If the stack is full it must be mostly
+ * stale, so it's rebuilt from the table instead.
+ */
+void IndirectRefTable::pushHole(u4 index)
+{
+    if (numHoleEntries_ == max_entries_) {
+        rebuildHoles();
+    } else {
+        holes_[numHoleEntries_++] = index;
+    }
+}
+
+/*
+ * Replaces the contents of the hole stack with the actual holes, lowest
+ * index at the bottom, so that lower segments stay deeper in the stack.
+ */
+void IndirectRefTable::rebuildHoles()
+{
+    u4 topIndex = segmentState.parts.topIndex;
+    numHoleEntries_ = 0;
+    for (u4 i = 0; i < topIndex; i++) {
+        if (table_[i].obj == NULL) {
+            holes_[numHoleEntries_++] = i;
+        }
+    }
+    holeScanSteps_ += topIndex;
 }
 
 IndirectRef IndirectRefTable::add(u4 cookie, Object* obj)
@@ -67,58 +112,52 @@ IndirectRef IndirectRefTable::add(u4 cookie, Object* obj)
     assert(obj != NULL);
     assert(dvmIsHeapAddress(obj));
     assert(table_ != NULL);
-    assert(alloc_entries_ <= max_entries_);
     assert(segmentState.parts.numHoles >= prevState.parts.numHoles);
 
     /*
-     * We know there's enough room in the table.  Now we just need to find
-     * the right spot.  If there's a hole, find it and fill it; otherwise,
+     * If there's a hole in this segment, find it and fill it; otherwise,
      * add to the end of the list.
      */
     IndirectRef result;
-    IndirectRefSlot* slot;
+    IndirectRefSlot* slot = NULL;
     int numHoles = segmentState.parts.numHoles - prevState.parts.numHoles;
     if (numHoles > 0) {
         assert(topIndex > 1);
-        /* find the first hole; likely to be near the end of the list,
-         * we know the item at the topIndex is not a hole */
-        slot = &table_[topIndex - 1];
-        assert(slot->obj != NULL);
-        while ((--slot)->obj != NULL) {
-            assert(slot >= table_ + prevState.parts.topIndex);
-        }
-        segmentState.parts.numHoles--;
-    } else {
-        /* add to the end, grow if needed */
-        if (topIndex == alloc_entries_) {
-            /* reached end of allocated space; did we hit buffer max? */
-            if (topIndex == max_entries_) {
-                ALOGE("JNI ERROR (app bug): %s reference table overflow (max=%d)",
-                        indirectRefKindToString(kind_), max_entries_);
-                return NULL;
+        u4 bottomIndex = prevState.parts.topIndex;
+        /* pop holes until one is still a hole in this segment; an entry
+         * below the bottom belongs to a lower segment and must be kept */
+        while (numHoleEntries_ > 0) {
+            u4 index = holes_[numHoleEntries_ - 1];
+            holeScanSteps_++;
+            if (index < bottomIndex) {
+                break;
             }
-
-            size_t newSize = alloc_entries_ * 2;
-            if (newSize > max_entries_) {
-                newSize = max_entries_;
+            numHoleEntries_--;
+            if (index < topIndex && table_[index].obj == NULL) {
+                slot = &table_[index];
+                break;
             }
-            assert(newSize > alloc_entries_);
-
-            IndirectRefSlot* newTable =
-                    (IndirectRefSlot*) realloc(table_, newSize * sizeof(IndirectRefSlot));
-            if (table_ == NULL) {
-                ALOGE("JNI ERROR (app bug): unable to expand %s reference table "
-                        "(from %d to %d, max=%d)",
-                        indirectRefKindToString(kind_),
-                        alloc_entries_, newSize, max_entries_);
-                return NULL;
+        }
+        if (slot == NULL) {
+            /* shouldn't happen; fall back on a scan from the top, we know
+             * the item at the topIndex is not a hole */
+            slot = &table_[topIndex - 1];
+            assert(slot->obj != NULL);
+            while ((--slot)->obj != NULL) {
+                assert(slot >= table_ + bottomIndex);
+                holeScanSteps_++;
             }
-
-            memset(newTable + alloc_entries_, 0xd1,
-                   (newSize - alloc_entries_) * sizeof(IndirectRefSlot));
-
-            alloc_entries_ = newSize;
-            table_ = newTable;
+        }
+        segmentState.parts.numHoles--;
+    } else {
+        if (segmentState.parts.numHoles == 0) {
+            /* no holes anywhere, so whatever is on the stack is stale */
+            numHoleEntries_ = 0;
+        }
+        if (topIndex == max_entries_) {
+            ALOGE("JNI ERROR (app bug): %s reference table overflow (max=%d)",
+                    indirectRefKindToString(kind_), max_entries_);
+            return NULL;
         }
         slot = &table_[topIndex++];
         segmentState.parts.topIndex = topIndex;
@@ -218,7 +257,6 @@ bool IndirectRefTable::remove(u4 cookie, IndirectRef iref)
     u4 bottomIndex = prevState.parts.topIndex;
 
     assert(table_ != NULL);
-    assert(alloc_entries_ <= max_entries_);
     assert(segmentState.parts.numHoles >= prevState.parts.numHoles);
 
     IndirectRefKind kind = indirectRefKind(iref);
@@ -273,6 +311,7 @@ bool IndirectRefTable::remove(u4 cookie, IndirectRef iref)
                 }
                 ALOGV("+++ ate hole at %d", topIndex-1);
                 numHoles--;
+                holeScanSteps_++;
             }
             segmentState.parts.numHoles = numHoles + prevState.parts.numHoles;
             segmentState.parts.topIndex = topIndex;
@@ -288,6 +327,7 @@ bool IndirectRefTable::remove(u4 cookie, IndirectRef iref)
          */
         table_[index].obj = NULL;
         segmentState.parts.numHoles++;
+        pushHole(index);
         ALOGV("+++ left hole at %d, holes=%d", index, segmentState.parts.numHoles);
     }
 
@@ -315,3 +355,271 @@ void IndirectRefTable::dump(const char* descr) const
     dvmDumpReferenceTableContents(copy, count, descr);
     delete[] copy;
 }
+
+bool ShardedIndirectRefTable::init(size_t maxCount,
+        IndirectRefKind desiredKind)
+{
+    assert(maxCount >= IRT_SHARD_COUNT && maxCount <= 65536);
+    assert(desiredKind != kIndirectKindInvalid);
+
+    shardEntries_ = maxCount / IRT_SHARD_COUNT;
+    max_entries_ = shardEntries_ * IRT_SHARD_COUNT;
+
+    /*
+     * The region starts out zeroed, so every slot is unused with serial
+     * 0, and pages are only touched as the shards fill.
+     */
+    size_t tableSize = max_entries_ * sizeof(IndirectRefSlot);
+    void* base = dvmAllocRegion(tableSize + max_entries_ * sizeof(u2),
+                                PROT_READ | PROT_WRITE, "dalvik-jni-refs");
+    if (base == NULL) {
+        return false;
+    }
+    table_ = (IndirectRefSlot*) base;
+    nextFree_ = (volatile u2*) ((u1*) base + tableSize);
+    memset(shards_, 0, sizeof(shards_));
+    kind_ = desiredKind;
+
+    return true;
+}
+
+void ShardedIndirectRefTable::destroy()
+{
+    size_t size = max_entries_ * (sizeof(IndirectRefSlot) + sizeof(u2));
+    munmap(table_, ALIGN_UP_TO_PAGE_SIZE(size));
+    table_ = NULL;
+    nextFree_ = NULL;
+}
+
+/*
+ * Take a slot off the free list of "shard", whose first slot is at
+ * "base".  Returns its index in the shard, or -1 if there is none.
+ *
+ * The tag in the head makes a CAS fail if the head has been popped and
+ * pushed back since we read it, unless that happened 64K times.
+ */
+int ShardedIndirectRefTable::popFree(IndirectRefShard* shard, size_t base)
+{
+    for (;;) {
+        int32_t head = android_atomic_acquire_load(&shard->freeHead);
+        u4 first = head & 0xffff;
+        if (first == 0) {
+            return -1;
+        }
+        u4 tag = ((u4) head + 0x10000) & 0xffff0000;
+        int32_t newHead = (int32_t) (tag | nextFree_[base + first - 1]);
+        if (android_atomic_acquire_cas(head, newHead, &shard->freeHead) == 0) {
+            return first - 1;
+        }
+    }
+}
+
+void ShardedIndirectRefTable::pushFree(IndirectRefShard* shard, size_t base,
+        size_t index)
+{
+    for (;;) {
+        int32_t head = shard->freeHead;
+        nextFree_[base + index] = head & 0xffff;
+        u4 tag = ((u4) head + 0x10000) & 0xffff0000;
+        int32_t newHead = (int32_t) (tag | (index + 1));
+        if (android_atomic_release_cas(head, newHead, &shard->freeHead) == 0) {
+            return;
+        }
+    }
+}
+
+IndirectRef ShardedIndirectRefTable::add(u4 threadId, Object* obj)
+{
+    assert(obj != NULL);
+    assert(dvmIsHeapAddress(obj));
+    assert(table_ != NULL);
+
+    for (size_t i = 0; i < IRT_SHARD_COUNT; i++) {
+        size_t shardIndex = (threadId + i) % IRT_SHARD_COUNT;
+        IndirectRefShard* shard = &shards_[shardIndex];
+        size_t base = shardIndex * shardEntries_;
+
+        /* reuse a freed slot, or else take the one above the top */
+        int index = popFree(shard, base);
+        if (index < 0) {
+            int32_t top;
+            do {
+                top = shard->topIndex;
+                if ((size_t) top == shardEntries_) {
+                    break;
+                }
+            } while (android_atomic_release_cas(top, top + 1,
+                                                &shard->topIndex) != 0);
+            if ((size_t) top == shardEntries_) {
+                continue;
+            }
+            index = top;
+        }
+
+        IndirectRefSlot* slot = &table_[base + index];
+        u4 serial = IndirectRefTable::nextSerial(slot->serial);
+        slot->serial = serial;
+        android_atomic_release_store((int32_t) obj,
+                                     (volatile int32_t*) &slot->obj);
+        return IndirectRefTable::toIndirectRef(base + index, serial, kind_);
+    }
+
+    ALOGE("JNI ERROR (app bug): %s reference table overflow (max=%d)",
+            indirectRefKindToString(kind_), max_entries_);
+    return NULL;
+}
+
+/*
+ * Returns true if the slot at "index" has ever been handed out.
+ */
+bool ShardedIndirectRefTable::isHandedOut(u4 index) const
+{
+    if (index >= max_entries_) {
+        return false;
+    }
+    size_t shard = index / shardEntries_;
+    return index - shard * shardEntries_ < (size_t) shards_[shard].topIndex;
+}
+
+Object* ShardedIndirectRefTable::get(IndirectRef iref) const
+{
+    IndirectRefKind kind = indirectRefKind(iref);
+    if (kind != kind_) {
+        if (iref == NULL) {
+            ALOGW("Attempt to look up NULL %s reference", indirectRefKindToString(kind_));
+            return kInvalidIndirectRefObject;
+        }
+        if (kind == kIndirectKindInvalid) {
+            ALOGE("JNI ERROR (app bug): invalid %s reference %p",
+                    indirectRefKindToString(kind_), iref);
+            abortMaybe();
+            return kInvalidIndirectRefObject;
+        }
+        // References of the requested kind cannot appear within this table.
+        return kInvalidIndirectRefObject;
+    }
+
+    u4 index = IndirectRefTable::extractIndex(iref);
+    if (!isHandedOut(index)) {
+        /* bad -- stale reference? */
+        ALOGE("JNI ERROR (app bug): accessed stale %s reference %p (index %d)",
+                indirectRefKindToString(kind_), iref, index);
+        abortMaybe();
+        return kInvalidIndirectRefObject;
+    }
+
+    Object* obj = table_[index].obj;
+    if (obj == NULL) {
+        ALOGI("JNI ERROR (app bug): accessed deleted %s reference %p",
+                indirectRefKindToString(kind_), iref);
+        abortMaybe();
+        return kInvalidIndirectRefObject;
+    }
+
+    if (IndirectRefTable::extractSerial(iref) != table_[index].serial) {
+        ALOGE("JNI ERROR (app bug): attempt to use stale %s reference %p",
+                indirectRefKindToString(kind_), iref);
+        abortMaybe();
+        return kInvalidIndirectRefObject;
+    }
+
+    return obj;
+}
+
+bool ShardedIndirectRefTable::contains(const Object* obj) const
+{
+    for (size_t i = 0; i < IRT_SHARD_COUNT; i++) {
+        int base = i * shardEntries_;
+        if (findObject(obj, base, base + shards_[i].topIndex, table_) >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Remove the entry for "iref".  Clearing the slot is a CAS, so that of
+ * two threads deleting the same reference only one frees the slot.
+ *
+ * Returns "false" if nothing was removed.
+ */
+bool ShardedIndirectRefTable::remove(IndirectRef iref)
+{
+    assert(table_ != NULL);
+
+    IndirectRefKind kind = indirectRefKind(iref);
+    int index = -1;
+    if (kind == kind_) {
+        index = IndirectRefTable::extractIndex(iref);
+        if (!isHandedOut(index)) {
+            /* bad -- stale reference? */
+            ALOGD("Attempt to remove invalid index %ud", index);
+            return false;
+        }
+        if (table_[index].serial != IndirectRefTable::extractSerial(iref)) {
+            ALOGD("Attempt to remove stale %s reference %p",
+                    indirectRefKindToString(kind_), iref);
+            return false;
+        }
+    } else if (kind == kIndirectKindInvalid && gDvmJni.workAroundAppJniBugs) {
+        // reference looks like a pointer, scan the table to find the index
+        Object* obj = reinterpret_cast<Object*>(iref);
+        for (size_t i = 0; i < IRT_SHARD_COUNT && index < 0; i++) {
+            int base = i * shardEntries_;
+            index = findObject(obj, base, base + shards_[i].topIndex, table_);
+        }
+        if (index < 0) {
+            ALOGW("trying to work around app JNI bugs, but didn't find %p in table!", iref);
+            return false;
+        }
+    } else {
+        // References of the requested kind cannot appear within this table.
+        return false;
+    }
+
+    Object* obj = table_[index].obj;
+    if (obj == NULL || android_atomic_release_cas((int32_t) obj, 0,
+            (volatile int32_t*) &table_[index].obj) != 0) {
+        ALOGD("Attempt to remove cleared %s reference %p",
+                indirectRefKindToString(kind_), iref);
+        return false;
+    }
+
+    size_t shard = index / shardEntries_;
+    size_t base = shard * shardEntries_;
+    pushFree(&shards_[shard], base, index - base);
+    return true;
+}
+
+size_t ShardedIndirectRefTable::capacity() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < IRT_SHARD_COUNT; i++) {
+        count += shards_[i].topIndex;
+    }
+    return count;
+}
+
+void ShardedIndirectRefTable::dump(const char* descr) const
+{
+    /* the tops may grow while we look */
+    size_t tops[IRT_SHARD_COUNT];
+    size_t total = 0;
+    for (size_t i = 0; i < IRT_SHARD_COUNT; i++) {
+        tops[i] = shards_[i].topIndex;
+        total += tops[i];
+    }
+    Object** copy = new Object*[total];
+    size_t count = 0;
+    for (size_t i = 0; i < IRT_SHARD_COUNT; i++) {
+        size_t base = i * shardEntries_;
+        for (size_t j = base; j < base + tops[i]; j++) {
+            Object* obj = table_[j].obj;
+            if (obj != NULL) {
+                copy[count++] = obj;
+            }
+        }
+    }
+    dvmDumpReferenceTableContents(copy, count, descr);
+    delete[] copy;
+}
@@ -132,14 +132,19 @@ struct IndirectRefSlot {
  * most-recently-added entry).  For JNI local references, the common
  * operations are adding a new entry and removing an entire table segment.
  *
- * If "alloc_entries_" is not equal to "max_entries_", the table may expand
- * when entries are added, which means the memory may move.  If you want
- * to keep pointers into "table" rather than offsets, you must use a
- * fixed-size table.
+ * The table is a mapping big enough for "max_entries_", whose pages are
+ * only touched as the table fills up, so it grows without being copied and
+ * the memory never moves.
  *
  * If we delete entries from the middle of the list, we will be left with
  * "holes".  We track the number of holes so that, when adding new elements,
- * we can quickly decide to do a trivial append or go slot-hunting.
+ * we can quickly decide to do a trivial append or go slot-hunting.  Each
+ * new hole's index is also pushed on a stack, "holes_", so slot-hunting
+ * is usually a pop.  The stack isn't trimmed when a segment is popped;
+ * instead an entry is only used if it is still a hole in the current
+ * segment, and dropped otherwise.  A hole can only be made in the current
+ * segment, so holes of lower segments are deeper in the stack than those
+ * of the current one.
  *
  * When the top-most entry is removed, any holes immediately below it are
  * also removed.  Thus, deletion of an entry may reduce "topIndex" by more
@@ -176,20 +181,14 @@ struct IndirectRefSlot {
  * stale references aren't possible (though we may be able to get similar
  * benefits with other approaches).
  *
- * TODO: consider a "lastDeleteIndex" for quick hole-filling when an
- * add immediately follows a delete; must invalidate after segment pop
- * (which could increase the cost/complexity of method call/return).
- * Might be worth only using it for JNI globals.
- *
  * TODO: may want completely different add/remove algorithms for global
  * and local refs to improve performance.  A large circular buffer might
  * reduce the amortized cost of adding global references.
  *
- * TODO: if we can guarantee that the underlying storage doesn't move,
- * e.g. by using oversized mmap regions to handle expanding tables, we may
- * be able to avoid having to synchronize lookups.  Might make sense to
- * add a "synchronized lookup" call that takes the mutex as an argument,
- * and either locks or doesn't lock based on internal details.
+ * TODO: now that the underlying storage doesn't move, we may be able to
+ * avoid having to synchronize lookups.  Might make sense to add a
+ * "synchronized lookup" call that takes the mutex as an argument, and
+ * either locks or doesn't lock based on internal details.
  */
 union IRTSegmentState {
     u4          all;
@@ -255,13 +254,13 @@ public:
     IndirectRefSlot* table_;
     /* bit mask, ORed into all irefs */
     IndirectRefKind kind_;
-    /* #of entries we have space for */
-    size_t          alloc_entries_;
     /* max #of entries allowed */
     size_t          max_entries_;
-
-    // TODO: want hole-filling stats (#of holes filled, total entries scanned)
-    //       for performance evaluation.
+    /* indices of holes, most recent on top; up to "max_entries_" of them */
+    u2*             holes_;
+    size_t          numHoleEntries_;
+    /* #of entries looked at while hunting for holes; for dvmDumpJniStats */
+    u4              holeScanSteps_;
 
     /*
      * Add a new entry.  "obj" must be a valid non-NULL object reference
@@ -297,16 +296,14 @@ public:
     bool remove(u4 cookie, IndirectRef iref);
 
     /*
-     * Initialize an IndirectRefTable.
-     *
-     * If "initialCount" != "maxCount", the table will expand as required.
+     * Initialize an IndirectRefTable that can hold up to "maxCount" entries.
      *
      * "kind" should be Local or Global.  The Global table may also hold
      * WeakGlobal refs.
      *
      * Returns "false" if table allocation fails.
      */
-    bool init(size_t initialCount, size_t maxCount, IndirectRefKind kind);
+    bool init(size_t maxCount, IndirectRefKind kind);
 
     /*
      * Clear out the contents, freeing allocated storage.
@@ -335,6 +332,14 @@ public:
         return segmentState.parts.topIndex;
     }
 
+    /*
+     * Return the #of entries looked at so far while hunting for, or
+     * consuming, holes.
+     */
+    u4 holeScanSteps() const {
+        return holeScanSteps_;
+    }
+
     iterator begin() {
         return iterator(table_, 0, capacity());
     }
@@ -344,6 +349,11 @@ public:
     }
 
 private:
+    friend struct ShardedIndirectRefTable;
+
+    void pushHole(u4 index);
+    void rebuildHoles();
+
     static inline u4 extractIndex(IndirectRef iref) {
         u4 uref = (u4) iref;
         return (uref >> 2) & 0xffff;
@@ -364,4 +374,157 @@ private:
     }
 };
 
+/*
+ * A table of indirect references that many threads add to and remove
+ * from at once, without a lock.  Used for JNI global references.
+ *
+ * The table is split into IRT_SHARD_COUNT shards of equal size, and the
+ * index in an IndirectRef is the shard's first index plus the slot's
+ * index in the shard.  A thread adds to the shard its thread id picks,
+ * or to another one if that is full, and a removal goes back to the
+ * shard the slot came from.  Each shard hands out slots from a lock-free
+ * list of freed ones, or failing that by bumping its top index.
+ *
+ * All slots are allocated up front and never move, so get() needs no
+ * lock either.  The stale reference checks are those of IndirectRefTable.
+ *
+ * There are no segments, and nothing here keeps the GC from seeing a
+ * half-done add or remove: callers must be in THREAD_RUNNING, and the
+ * GC only scans the table while they are suspended.
+ */
+#define IRT_SHARD_COUNT     8
+
+struct IndirectRefShard {
+    /* freed slots: tag << 16 | (first free index + 1), 0 when empty; the
+     * tag changes on each push and pop, so a stale CAS fails */
+    volatile int32_t freeHead;
+    /* slots handed out so far */
+    volatile int32_t topIndex;
+};
+
+class sharded_iref_iterator {
+public:
+    sharded_iref_iterator(IndirectRefSlot* table, const IndirectRefShard* shards,
+            size_t shardEntries, size_t i) :
+            table_(table), shards_(shards), shardEntries_(shardEntries), i_(i) {
+        skipUnused();
+    }
+
+    sharded_iref_iterator& operator++() {
+        ++i_;
+        skipUnused();
+        return *this;
+    }
+
+    Object** operator*() {
+        return &table_[i_].obj;
+    }
+
+    bool equals(const sharded_iref_iterator& rhs) const {
+        return (i_ == rhs.i_ && table_ == rhs.table_);
+    }
+
+private:
+    void skipUnused() {
+        size_t end = shardEntries_ * IRT_SHARD_COUNT;
+        while (i_ < end) {
+            size_t shard = i_ / shardEntries_;
+            if (i_ - shard * shardEntries_ >= (size_t) shards_[shard].topIndex) {
+                i_ = (shard + 1) * shardEntries_;
+            } else if (table_[i_].obj == NULL) {
+                ++i_;
+            } else {
+                break;
+            }
+        }
+        if (i_ > end) {
+            i_ = end;
+        }
+    }
+
+    IndirectRefSlot* table_;
+    const IndirectRefShard* shards_;
+    size_t shardEntries_;
+    size_t i_;
+};
+
+bool inline operator!=(const sharded_iref_iterator& lhs,
+        const sharded_iref_iterator& rhs) {
+    return !lhs.equals(rhs);
+}
+
+struct ShardedIndirectRefTable {
+public:
+    typedef sharded_iref_iterator iterator;
+
+    IndirectRefShard shards_[IRT_SHARD_COUNT];
+    /* every slot, max_entries_ of them */
+    IndirectRefSlot* table_;
+    /* free list links, by slot: the next free index + 1, or 0 */
+    volatile u2*    nextFree_;
+    /* bit mask, ORed into all irefs */
+    IndirectRefKind kind_;
+    /* #of entries in each shard */
+    size_t          shardEntries_;
+    size_t          max_entries_;
+
+    /*
+     * Add a new entry, preferably to the shard picked by "threadId".
+     *
+     * Returns NULL if the table is full.
+     */
+    IndirectRef add(u4 threadId, Object* obj);
+
+    /*
+     * Given an IndirectRef in the table, return the Object it refers to.
+     *
+     * Returns kInvalidIndirectRefObject if iref is invalid.
+     */
+    Object* get(IndirectRef iref) const;
+
+    /*
+     * Returns true if the table contains a reference to this object.
+     */
+    bool contains(const Object* obj) const;
+
+    /*
+     * Remove an existing entry.  Returns "false" if nothing was removed.
+     */
+    bool remove(IndirectRef iref);
+
+    /*
+     * Initialize the table, with room for "maxCount" entries (rounded
+     * down to a multiple of IRT_SHARD_COUNT).
+     *
+     * Returns "false" if table allocation fails.
+     */
+    bool init(size_t maxCount, IndirectRefKind kind);
+
+    void destroy();
+
+    /*
+     * Dump the contents of the table to the log file.
+     */
+    void dump(const char* descr) const;
+
+    /*
+     * Return the #of slots handed out, including the freed ones.
+     */
+    size_t capacity() const;
+
+    iterator begin() {
+        return iterator(table_, shards_, shardEntries_, 0);
+    }
+
+    iterator end() {
+        return iterator(table_, shards_, shardEntries_,
+                        shardEntries_ * IRT_SHARD_COUNT);
+    }
+
+private:
+    bool isHandedOut(u4 index) const;
+    int popFree(IndirectRefShard* shard, size_t base);
+    void pushFree(IndirectRefShard* shard, size_t base, size_t index);
+};
+
 #endif  // DALVIK_INDIRECTREFTABLE_H_
@@ -22,6 +22,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <sys/mount.h>
 #include <sys/wait.h>
 #include <linux/fs.h>
@@ -44,6 +45,13 @@
 #define kMinHeapStartSize   (1*1024*1024)
 #define kMinHeapSize        (2*1024*1024)
 #define kMaxHeapSize        (1*1024*1024*1024)
+#define kMinTlabSize        (1*1024)
+#define kMaxTlabSize        (1*1024*1024)
+#define kDefaultTlabSize    (8*1024)
+#define kMinLargeObjectThreshold     (4*1024)
+#define kDefaultLargeObjectThreshold (12*1024)
+#define kDefaultStackTraceDepth      1024
+#define kMaxMarkThreads     8
 
 /*
  * Register VM-agnostic native methods for system classes.
@@ -121,26 +129,68 @@ static void usage()
     dvmFprintf(stderr, "  -Xzygote\n");
     dvmFprintf(stderr, "  -Xdexopt:{none,verified,all,full}\n");
     dvmFprintf(stderr, "  -Xnoquithandler\n");
-    dvmFprintf(stderr, "  -Xjniopts:{warnonly,forcecopy}\n");
+    dvmFprintf(stderr, "  -Xjniopts:{warnonly,forcecopy,sample=N}\n");
     dvmFprintf(stderr, "  -Xjnitrace:substring (eg NativeClass or nativeMethod)\n");
     dvmFprintf(stderr, "  -Xstacktracefile:<filename>\n");
+    dvmFprintf(stderr, "  -Xlockprofsites\n");
+    dvmFprintf(stderr, "  -Xperfsnapshotfile:<filename> (written on SIGUSR2)\n");
+    dvmFprintf(stderr, "  -Xfieldprofile:<filename>\n");
+    dvmFprintf(stderr, "  -Xstartuppages:<directory>\n");
+    dvmFprintf(stderr, "  -Xstartuppagewindow:<msec>\n");
     dvmFprintf(stderr, "  -Xgc:[no]precise\n");
     dvmFprintf(stderr, "  -Xgc:[no]preverify\n");
     dvmFprintf(stderr, "  -Xgc:[no]postverify\n");
     dvmFprintf(stderr, "  -Xgc:[no]concurrent\n");
+    dvmFprintf(stderr, "  -Xgc:[no]sticky\n");
+    dvmFprintf(stderr, "  -Xgc:[no]sizeclasses\n");
+    dvmFprintf(stderr, "  -Xgc:[no]compact\n");
+    dvmFprintf(stderr, "  -Xgc:[no]zygotecompact\n");
     dvmFprintf(stderr, "  -Xgc:[no]verifycardtable\n");
+    dvmFprintf(stderr, "  -Xgc:[no]threadroots\n");
+    dvmFprintf(stderr, "  -Xpreresolve:{none,zygote,apps,all}\n");
+    dvmFprintf(stderr, "  -XX:TlabSize=N  (thread-local alloc buffer, 0 to disable)\n");
+    dvmFprintf(stderr, "  -XX:ParallelMarkThreads=N  (GC marking threads, 1 to disable)\n");
+    dvmFprintf(stderr, "  -XX:HeapVerifySampleRate=N  (verify one object in N, 1 for all)\n");
+    dvmFprintf(stderr, "  -XX:LargeObjectThreshold=N  (large object space, 0 to disable)\n");
+    dvmFprintf(stderr, "  -XX:HeapGrowthPolicy={utilization,gctime}\n");
+    dvmFprintf(stderr, "  -XX:HeapTargetGcTime=F  (GC time fraction for gctime, 0.01 to 0.5)\n");
     dvmFprintf(stderr, "  -XX:+DisableExplicitGC\n");
+    dvmFprintf(stderr, "  -XX:+UseBiasedLocking\n");
+    dvmFprintf(stderr, "  -XX:+UseHugePages  (heap, GC tables and JIT code cache)\n");
+    dvmFprintf(stderr, "  -XX:IdentityHash={address,random}\n");
+    dvmFprintf(stderr, "  -XX:StackTraceDepth=N  (frames kept per Throwable, 0 for all)\n");
+    dvmFprintf(stderr, "  -XX:LineTableCacheSize=N  (decoded line tables kept)\n");
+    dvmFprintf(stderr, "  -XX:HprofPrimitiveArrayLimit=N  (array bytes kept in heap dumps)\n");
+    dvmFprintf(stderr, "  -XX:+HprofCompress  (gzip heap dumps written to files)\n");
     dvmFprintf(stderr, "  -X[no]genregmap\n");
+    dvmFprintf(stderr, "  -Xgenregmap:live  (trim maps to live registers)\n");
     dvmFprintf(stderr, "  -Xverifyopt:[no]checkmon\n");
     dvmFprintf(stderr, "  -Xcheckdexsum\n");
+    dvmFprintf(stderr, "  -Xopcodepairs  (count pairs of opcodes, slowly)\n");
 #if defined(WITH_JIT)
     dvmFprintf(stderr, "  -Xincludeselectedop\n");
     dvmFprintf(stderr, "  -Xjitop:hexopvalue[-endvalue]"
                        "[,hexopvalue[-endvalue]]*\n");
     dvmFprintf(stderr, "  -Xincludeselectedmethod\n");
     dvmFprintf(stderr, "  -Xjitthreshold:decimalvalue\n");
+    dvmFprintf(stderr, "  -Xjitrecompile:N (runs of a baseline trace, "
+                       "0 for one tier)\n");
     dvmFprintf(stderr, "  -Xjitcodecachesize:decimalvalueofkbytes\n");
+    dvmFprintf(stderr, "  -Xjitcacheregions:N (1-%d)\n",
+               JIT_MAX_CODE_CACHE_REGIONS);
+    dvmFprintf(stderr, "  -Xjitcachebatch:N (writes per flush, 1 for each)\n");
+    dvmFprintf(stderr, "  -Xjitmethodregion:N (code units, 0 to disable)\n");
+    dvmFprintf(stderr, "  -Xjitfollowinvoke:N (code units, 0 to disable)\n");
+#if defined(WITH_SELF_VERIFICATION)
+    dvmFprintf(stderr, "  -Xjitverifysample:N (verify 1 in N trace runs)\n");
+    dvmFprintf(stderr, "  -Xjitverifythreads:N (verify 1 in N threads)\n");
+#endif
     dvmFprintf(stderr, "  -Xjitblocking\n");
+    dvmFprintf(stderr, "  -Xjitthreads:N (1-%d)\n", COMPILER_MAX_THREADS);
+    dvmFprintf(stderr, "  -Xjittracefile:filename\n");
+    dvmFprintf(stderr, "  -Xjitsample:N (ms between samples, 0 for off)\n");
+    dvmFprintf(stderr, "  -Xjitbudget:N (%% of a CPU to compile, 0 for any)\n");
+    dvmFprintf(stderr, "  -Xjitcachebudget:N (KB/s of code, 0 for any)\n");
     dvmFprintf(stderr, "  -Xjitmethod:signature[,signature]* "
                        "(eg Ljava/lang/String\\;replace)\n");
     dvmFprintf(stderr, "  -Xjitclass:classname[,classname]*\n");
@@ -151,6 +201,8 @@ static void usage()
     dvmFprintf(stderr, "  -Xjitprofile\n");
     dvmFprintf(stderr, "  -Xjitdisableopt\n");
     dvmFprintf(stderr, "  -Xjitsuspendpoll\n");
+    dvmFprintf(stderr, "  -Xjitexplicitnullchecks\n");
+    dvmFprintf(stderr, "  -Xjitverifycardelision\n");
 #endif
     dvmFprintf(stderr, "\n");
     dvmFprintf(stderr, "Configured with:"
@@ -941,6 +993,93 @@ static int processOptions(int argc, const char* const argv[],
                 dvmFprintf(stderr, "Invalid -XX:HeapMaxFree option '%s'\n", argv[i]);
                 return -1;
             }
+        } else if (strncmp(argv[i], "-XX:TlabSize=", 13) == 0) {
+            if (strcmp(argv[i] + 13, "0") == 0) {
+                gDvm.tlabSize = 0;
+            } else {
+                size_t val = parseMemOption(argv[i] + 13, 1024);
+                if (val >= kMinTlabSize && val <= kMaxTlabSize) {
+                    gDvm.tlabSize = val;
+                } else {
+                    dvmFprintf(stderr,
+                        "Invalid -XX:TlabSize '%s', range is %dKB to %dKB\n",
+                        argv[i], kMinTlabSize/1024, kMaxTlabSize/1024);
+                    return -1;
+                }
+            }
+        } else if (strncmp(argv[i], "-XX:LargeObjectThreshold=", 25) == 0) {
+            if (strcmp(argv[i] + 25, "0") == 0) {
+                gDvm.largeObjectThreshold = 0;
+            } else {
+                size_t val = parseMemOption(argv[i] + 25, 1024);
+                if (val >= kMinLargeObjectThreshold) {
+                    gDvm.largeObjectThreshold = val;
+                } else {
+                    dvmFprintf(stderr,
+                        "Invalid -XX:LargeObjectThreshold '%s', minimum is %dKB\n",
+                        argv[i], kMinLargeObjectThreshold/1024);
+                    return -1;
+                }
+            }
+        } else if (strncmp(argv[i], "-XX:ParallelMarkThreads=", 24) == 0) {
+            char* end;
+            long val = strtol(argv[i] + 24, &end, 10);
+            if (argv[i][24] == '\0' || *end != '\0' ||
+                val < 1 || val > kMaxMarkThreads) {
+                dvmFprintf(stderr,
+                    "Invalid -XX:ParallelMarkThreads '%s', range is 1 to %d\n",
+                    argv[i], kMaxMarkThreads);
+                return -1;
+            }
+            gDvm.markThreads = val;
+        } else if (strncmp(argv[i], "-XX:HeapVerifySampleRate=", 25) == 0) {
+            char* end;
+            long val = strtol(argv[i] + 25, &end, 10);
+            if (argv[i][25] == '\0' || *end != '\0' || val < 1) {
+                dvmFprintf(stderr,
+                    "Invalid -XX:HeapVerifySampleRate '%s', minimum is 1\n",
+                    argv[i]);
+                return -1;
+            }
+            gDvm.heapVerifySampleRate = val;
+        } else if (strncmp(argv[i], "-XX:StackTraceDepth=", 20) == 0) {
+            char* end;
+            long val = strtol(argv[i] + 20, &end, 10);
+            if (argv[i][20] == '\0' || *end != '\0' || val < 0) {
+                dvmFprintf(stderr,
+                    "Invalid -XX:StackTraceDepth '%s', minimum is 0\n",
+                    argv[i]);
+                return -1;
+            }
+            gDvm.stackTraceDepth = val;
+        } else if (strncmp(argv[i], "-XX:LineTableCacheSize=", 23) == 0) {
+            if (strcmp(argv[i] + 23, "0") == 0) {
+                gDvm.lineTableCacheSize = 0;
+            } else {
+                size_t val = parseMemOption(argv[i] + 23, 1024);
+                if (val == 0) {
+                    dvmFprintf(stderr,
+                        "Invalid -XX:LineTableCacheSize '%s'\n", argv[i]);
+                    return -1;
+                }
+                gDvm.lineTableCacheSize = val;
+            }
+        } else if (strncmp(argv[i], "-XX:HprofPrimitiveArrayLimit=", 29) == 0) {
+            if (strcmp(argv[i] + 29, "0") == 0) {
+                gDvm.hprofPrimitiveArrayLimit = 0;
+            } else {
+                size_t val = parseMemOption(argv[i] + 29, 1);
+                if (val == 0) {
+                    dvmFprintf(stderr,
+                        "Invalid -XX:HprofPrimitiveArrayLimit '%s'\n", argv[i]);
+                    return -1;
+                }
+                gDvm.hprofPrimitiveArrayLimit = val;
+            }
+        } else if (strcmp(argv[i], "-XX:+HprofCompress") == 0) {
+            gDvm.hprofCompress = true;
+        } else if (strcmp(argv[i], "-XX:-HprofCompress") == 0) {
+            gDvm.hprofCompress = false;
         } else if (strcmp(argv[i], "-XX:LowMemoryMode") == 0) {
           gDvm.lowMemoryMode = true;
         } else if (strncmp(argv[i], "-XX:HeapTargetUtilization=", 26) == 0) {
@@ -957,6 +1096,28 @@ static int processOptions(int argc, const char* const argv[],
                 dvmFprintf(stderr, "Invalid -XX:HeapTargetUtilization option '%s'\n", argv[i]);
                 return -1;
             }
+        } else if (strncmp(argv[i], "-XX:HeapGrowthPolicy=", 21) == 0) {
+            const char* policy = argv[i] + 21;
+            if (strcmp(policy, "utilization") == 0) {
+                gDvm.heapGrowthPolicy = kHeapGrowthPolicyUtilization;
+            } else if (strcmp(policy, "gctime") == 0) {
+                gDvm.heapGrowthPolicy = kHeapGrowthPolicyGcTime;
+            } else {
+                dvmFprintf(stderr, "Invalid -XX:HeapGrowthPolicy option '%s'\n", argv[i]);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "-XX:HeapTargetGcTime=", 21) == 0) {
+            const char* start = argv[i] + 21;
+            const char* end = start;
+            double val = strtod(start, const_cast<char**>(&end));
+            bool sane_val = (start != end) && (end[0] == '\0') &&
+                (val >= 0.01) && (val <= 0.5);
+            if (sane_val) {
+                gDvm.heapTargetGcTime = val;
+            } else {
+                dvmFprintf(stderr, "Invalid -XX:HeapTargetGcTime option '%s'\n", argv[i]);
+                return -1;
+            }
         } else if (strncmp(argv[i], "-Xss", 4) == 0) {
             size_t val = parseMemOption(argv[i]+4, 1);
             if (val != 0) {
@@ -992,6 +1153,24 @@ static int processOptions(int argc, const char* const argv[],
 
         } else if (strncmp(argv[i], "-XX:+DisableExplicitGC", 22) == 0) {
             gDvm.disableExplicitGc = true;
+        } else if (strcmp(argv[i], "-XX:+UseBiasedLocking") == 0) {
+            gDvm.biasedLocking = true;
+        } else if (strcmp(argv[i], "-XX:-UseBiasedLocking") == 0) {
+            gDvm.biasedLocking = false;
+        } else if (strcmp(argv[i], "-XX:+UseHugePages") == 0) {
+            gDvm.useHugePages = true;
+        } else if (strcmp(argv[i], "-XX:-UseHugePages") == 0) {
+            gDvm.useHugePages = false;
+        } else if (strncmp(argv[i], "-XX:IdentityHash=", 17) == 0) {
+            const char* kind = argv[i] + 17;
+            if (strcmp(kind, "address") == 0) {
+                gDvm.randomIdentityHash = false;
+            } else if (strcmp(kind, "random") == 0) {
+                gDvm.randomIdentityHash = true;
+            } else {
+                dvmFprintf(stderr, "Invalid -XX:IdentityHash option '%s'\n", argv[i]);
+                return -1;
+            }
         } else if (strcmp(argv[i], "-verbose") == 0 ||
             strcmp(argv[i], "-verbose:class") == 0)
         {
@@ -1004,6 +1183,8 @@ static int processOptions(int argc, const char* const argv[],
             gDvm.verboseGc = true;
         } else if (strcmp(argv[i], "-verbose:shutdown") == 0) {
             gDvm.verboseShutdown = true;
+        } else if (strcmp(argv[i], "-verbose:startup") == 0) {
+            gDvm.verboseStartup = true;
 
         } else if (strncmp(argv[i], "-enableassertions", 17) == 0) {
             enableAssertions(argv[i] + 17, true);
@@ -1107,6 +1288,9 @@ static int processOptions(int argc, const char* const argv[],
         } else if (strncmp(argv[i], "-Xlockprofthreshold:", 20) == 0) {
             gDvm.lockProfThreshold = atoi(argv[i] + 20);
 
+        } else if (strcmp(argv[i], "-Xlockprofsites") == 0) {
+            gDvm.lockProfSites = true;
+
 #ifdef WITH_JIT
         } else if (strncmp(argv[i], "-Xjitop", 7) == 0) {
             processXjitop(argv[i]);
@@ -1122,6 +1306,110 @@ static int processOptions(int argc, const char* const argv[],
           gDvmJit.blockingMode = true;
         } else if (strncmp(argv[i], "-Xjitthreshold:", 15) == 0) {
           gDvmJit.threshold = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "-Xjitrecompile:", 15) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 15, &end, 10);
+          if (*end != '\0' || val < 0 || val > 1000000) {
+              dvmFprintf(stderr, "Invalid -Xjitrecompile value: %s\n",
+                         argv[i] + 15);
+              return -1;
+          }
+          gDvmJit.recompileThreshold = val;
+        } else if (strncmp(argv[i], "-Xjitthreads:", 13) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 13, &end, 10);
+          if (*end != '\0' || val < 1 || val > COMPILER_MAX_THREADS) {
+              dvmFprintf(stderr, "Invalid -Xjitthreads value: %s\n",
+                         argv[i] + 13);
+              return -1;
+          }
+          gDvmJit.numCompilerThreads = val;
+        } else if (strncmp(argv[i], "-Xjittracefile:", 15) == 0) {
+          free(gDvmJit.traceFile);
+          gDvmJit.traceFile = strdup(argv[i] + 15);
+        } else if (strncmp(argv[i], "-Xjitsample:", 12) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 12, &end, 10);
+          if (*end != '\0' || val < 0 || val > 60000) {
+              dvmFprintf(stderr, "Invalid -Xjitsample value: %s\n",
+                         argv[i] + 12);
+              return -1;
+          }
+          gDvmJit.sampleIntervalMs = val;
+        } else if (strncmp(argv[i], "-Xjitbudget:", 12) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 12, &end, 10);
+          if (*end != '\0' || val < 0 || val > 100) {
+              dvmFprintf(stderr, "Invalid -Xjitbudget value: %s\n",
+                         argv[i] + 12);
+              return -1;
+          }
+          gDvmJit.compileBudgetPercent = val;
+        } else if (strncmp(argv[i], "-Xjitcachebudget:", 17) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 17, &end, 10);
+          if (*end != '\0' || val < 0 || val > 1000000) {
+              dvmFprintf(stderr, "Invalid -Xjitcachebudget value: %s\n",
+                         argv[i] + 17);
+              return -1;
+          }
+          gDvmJit.codeCacheBudgetKBPerSec = val;
+        } else if (strncmp(argv[i], "-Xjitcacheregions:", 18) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 18, &end, 10);
+          if (*end != '\0' || val < 1 || val > JIT_MAX_CODE_CACHE_REGIONS) {
+              dvmFprintf(stderr, "Invalid -Xjitcacheregions value: %s\n",
+                         argv[i] + 18);
+              return -1;
+          }
+          gDvmJit.numCodeCacheRegions = val;
+        } else if (strncmp(argv[i], "-Xjitcachebatch:", 16) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 16, &end, 10);
+          if (*end != '\0' || val < 1 || val > 1024) {
+              dvmFprintf(stderr, "Invalid -Xjitcachebatch value: %s\n",
+                         argv[i] + 16);
+              return -1;
+          }
+          gDvmJit.codeCacheWriteBatch = val;
+        } else if (strncmp(argv[i], "-Xjitmethodregion:", 18) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 18, &end, 10);
+          if (*end != '\0' || val < 0 || val > 65535) {
+              dvmFprintf(stderr, "Invalid -Xjitmethodregion value: %s\n",
+                         argv[i] + 18);
+              return -1;
+          }
+          gDvmJit.methodRegionSize = val;
+        } else if (strncmp(argv[i], "-Xjitfollowinvoke:", 18) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 18, &end, 10);
+          if (*end != '\0' || val < 0 || val > 65535) {
+              dvmFprintf(stderr, "Invalid -Xjitfollowinvoke value: %s\n",
+                         argv[i] + 18);
+              return -1;
+          }
+          gDvmJit.followInvokeSize = val;
+#if defined(WITH_SELF_VERIFICATION)
+        } else if (strncmp(argv[i], "-Xjitverifysample:", 18) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 18, &end, 10);
+          if (*end != '\0' || val < 1) {
+              dvmFprintf(stderr, "Invalid -Xjitverifysample value: %s\n",
+                         argv[i] + 18);
+              return -1;
+          }
+          gDvmJit.selfVerificationSample = val;
+        } else if (strncmp(argv[i], "-Xjitverifythreads:", 19) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 19, &end, 10);
+          if (*end != '\0' || val < 1) {
+              dvmFprintf(stderr, "Invalid -Xjitverifythreads value: %s\n",
+                         argv[i] + 19);
+              return -1;
+          }
+          gDvmJit.selfVerificationThreads = val;
+#endif
         } else if (strncmp(argv[i], "-Xjitcodecachesize:", 19) == 0) {
           gDvmJit.codeCacheSize = atoi(argv[i] + 19) * 1024;
           if (gDvmJit.codeCacheSize == 0) {
@@ -1151,21 +1439,65 @@ static int processOptions(int argc, const char* const argv[],
           }
         } else if (strncmp(argv[i], "-Xjitsuspendpoll", 16) == 0) {
           gDvmJit.genSuspendPoll = true;
+        } else if (strcmp(argv[i], "-Xjitexplicitnullchecks") == 0) {
+          gDvmJit.explicitNullChecks = true;
+        } else if (strcmp(argv[i], "-Xjitverifycardelision") == 0) {
+          gDvmJit.verifyCardElision = true;
+          gDvm.verifyCardTable = true;
 #endif
 
         } else if (strncmp(argv[i], "-Xstacktracefile:", 17) == 0) {
             gDvm.stackTraceFile = strdup(argv[i]+17);
 
+        } else if (strncmp(argv[i], "-Xperfsnapshotfile:", 19) == 0) {
+            free(gDvm.perfSnapshotFile);
+            gDvm.perfSnapshotFile = strdup(argv[i]+19);
+
+        } else if (strncmp(argv[i], "-Xfieldprofile:", 15) == 0) {
+            free(gDvm.fieldProfileFile);
+            gDvm.fieldProfileFile = strdup(argv[i]+15);
+
+        } else if (strncmp(argv[i], "-Xstartuppages:", 15) == 0) {
+            free(gDvm.startupPageDir);
+            gDvm.startupPageDir = strdup(argv[i]+15);
+
+        } else if (strncmp(argv[i], "-Xstartuppagewindow:", 20) == 0) {
+            char* end;
+            long msec = strtol(argv[i]+20, &end, 10);
+            if (end == argv[i]+20 || *end != '\0' || msec < 0) {
+                dvmFprintf(stderr, "Invalid -Xstartuppagewindow '%s'\n",
+                    argv[i]);
+                return -1;
+            }
+            gDvm.startupPageWindowMs = msec;
+
         } else if (strcmp(argv[i], "-Xgenregmap") == 0) {
             gDvm.generateRegisterMaps = true;
         } else if (strcmp(argv[i], "-Xnogenregmap") == 0) {
             gDvm.generateRegisterMaps = false;
+        } else if (strcmp(argv[i], "-Xgenregmap:live") == 0) {
+            gDvm.generateRegisterMaps = true;
+            gDvm.registerMapMode = kRegisterMapModeLivePrecise;
 
         } else if (strcmp(argv[i], "Xverifyopt:checkmon") == 0) {
             gDvm.monitorVerification = true;
         } else if (strcmp(argv[i], "Xverifyopt:nocheckmon") == 0) {
             gDvm.monitorVerification = false;
 
+        } else if (strncmp(argv[i], "-Xpreresolve:", 13) == 0) {
+            const char* mode = argv[i] + 13;
+            if (strcmp(mode, "none") == 0) {
+                gDvm.preresolveZygote = gDvm.preresolveApps = false;
+            } else if (strcmp(mode, "zygote") == 0) {
+                gDvm.preresolveZygote = true;
+            } else if (strcmp(mode, "apps") == 0) {
+                gDvm.preresolveApps = true;
+            } else if (strcmp(mode, "all") == 0) {
+                gDvm.preresolveZygote = gDvm.preresolveApps = true;
+            } else {
+                dvmFprintf(stderr, "Bad value for -Xpreresolve: '%s'\n", mode);
+                return -1;
+            }
         } else if (strncmp(argv[i], "-Xgc:", 5) == 0) {
             if (strcmp(argv[i] + 5, "precise") == 0)
                 gDvm.preciseGc = true;
@@ -1183,10 +1515,30 @@ static int processOptions(int argc, const char* const argv[],
                 gDvm.concurrentMarkSweep = true;
             else if (strcmp(argv[i] + 5, "noconcurrent") == 0)
                 gDvm.concurrentMarkSweep = false;
+            else if (strcmp(argv[i] + 5, "sticky") == 0)
+                gDvm.stickyGc = true;
+            else if (strcmp(argv[i] + 5, "nosticky") == 0)
+                gDvm.stickyGc = false;
+            else if (strcmp(argv[i] + 5, "sizeclasses") == 0)
+                gDvm.sizeClassAlloc = true;
+            else if (strcmp(argv[i] + 5, "nosizeclasses") == 0)
+                gDvm.sizeClassAlloc = false;
+            else if (strcmp(argv[i] + 5, "compact") == 0)
+                gDvm.backgroundCompaction = true;
+            else if (strcmp(argv[i] + 5, "nocompact") == 0)
+                gDvm.backgroundCompaction = false;
+            else if (strcmp(argv[i] + 5, "zygotecompact") == 0)
+                gDvm.zygoteCompaction = true;
+            else if (strcmp(argv[i] + 5, "nozygotecompact") == 0)
+                gDvm.zygoteCompaction = false;
             else if (strcmp(argv[i] + 5, "verifycardtable") == 0)
                 gDvm.verifyCardTable = true;
             else if (strcmp(argv[i] + 5, "noverifycardtable") == 0)
                 gDvm.verifyCardTable = false;
+            else if (strcmp(argv[i] + 5, "threadroots") == 0)
+                gDvm.incrementalThreadRoots = true;
+            else if (strcmp(argv[i] + 5, "nothreadroots") == 0)
+                gDvm.incrementalThreadRoots = false;
             else {
                 dvmFprintf(stderr, "Bad value for -Xgc");
                 return -1;
@@ -1196,6 +1548,9 @@ static int processOptions(int argc, const char* const argv[],
         } else if (strcmp(argv[i], "-Xcheckdexsum") == 0) {
             gDvm.verifyDexChecksum = true;
 
+        } else if (strcmp(argv[i], "-Xopcodepairs") == 0) {
+            gDvm.countOpcodePairs = true;
+
         } else if (strcmp(argv[i], "-Xprofile:threadcpuclock") == 0) {
             gDvm.profilerClockSource = kProfilerClockSourceThreadCpu;
         } else if (strcmp(argv[i], "-Xprofile:wallclock") == 0) {
@@ -1245,6 +1600,7 @@ static void setCommandLineDefaults()
     gDvm.lowMemoryMode = false;
     gDvm.stackSize = kDefaultStackSize;
     gDvm.mainThreadStackSize = kDefaultStackSize;
+    gDvm.startupPageWindowMs = 5000;
     // When the heap is less than the maximum or growth limited size,
     // fix the free portion of the heap. The utilization is the ratio
     // of live to free memory, 0.5 implies half the heap is available
@@ -1254,8 +1610,21 @@ static void setCommandLineDefaults()
     gDvm.heapTargetUtilization = 0.5;
     gDvm.heapMaxFree = 2 * 1024 * 1024;
     gDvm.heapMinFree = gDvm.heapMaxFree / 4;
+    // The gctime policy only uses min free, and the target utilization
+    // until it has measured a collection.
+    gDvm.heapGrowthPolicy = kHeapGrowthPolicyUtilization;
+    gDvm.heapTargetGcTime = 0.05;
+    gDvm.tlabSize = kDefaultTlabSize;
+    gDvm.largeObjectThreshold = kDefaultLargeObjectThreshold;
+    gDvm.lineTableCacheSize = kLineTableCacheDefaultBudget;
+    gDvm.hprofPrimitiveArrayLimit = SIZE_MAX;
 
     gDvm.concurrentMarkSweep = true;
+    gDvm.sizeClassAlloc = true;
+    gDvm.incrementalThreadRoots = true;
+    gDvm.markThreads = 1;
+    gDvm.heapVerifySampleRate = 1;
+    gDvm.stackTraceDepth = kDefaultStackTraceDepth;
 
     /* gDvm.jdwpSuspend = true; */
 
@@ -1284,6 +1653,17 @@ static void setCommandLineDefaults()
     gDvmJit.methodTable = NULL;
     gDvmJit.classTable = NULL;
     gDvmJit.codeCacheSize = DEFAULT_CODE_CACHE_SIZE;
+    gDvmJit.numCompilerThreads = 1;
+    gDvmJit.numCodeCacheRegions = JIT_CODE_CACHE_REGIONS;
+    gDvmJit.codeCacheWriteBatch = JIT_CODE_CACHE_WRITE_BATCH;
+    gDvmJit.methodRegionSize = -1;
+#if defined(WITH_SELF_VERIFICATION)
+    gDvmJit.followInvokeSize = 0;
+    gDvmJit.selfVerificationSample = 1;
+    gDvmJit.selfVerificationThreads = 1;
+#else
+    gDvmJit.followInvokeSize = JIT_FOLLOW_INVOKE_SIZE;
+#endif
 
     gDvm.constInit = false;
     gDvm.commonInit = false;
@@ -1323,6 +1703,25 @@ static void busCatcher(int signum, siginfo_t* info, void* context)
     signal(SIGBUS, SIG_DFL);
 }
 
+/*
+ * Picks the seed for -XX:IdentityHash=random.
+ */
+static u4 pickIdentityHashSeed()
+{
+    u4 seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &seed, sizeof(seed)) != (ssize_t) sizeof(seed)) {
+            seed = 0;
+        }
+        close(fd);
+    }
+    if (seed == 0) {
+        seed = (u4) dvmGetRelativeTimeUsec() ^ ((u4) getpid() << 16);
+    }
+    return seed;
+}
+
 /*
  * Configure signals.  We need to block SIGQUIT so that the signal only
  * reaches the dump-stack-trace thread.
@@ -1339,6 +1738,9 @@ static void blockSignals()
     sigaddset(&mask, SIGUSR1);      // used to initiate heap dump
 #if defined(WITH_JIT) && defined(WITH_JIT_TUNING)
     sigaddset(&mask, SIGUSR2);      // used to investigate JIT internals
+#else
+    if (gDvm.perfSnapshotFile != NULL)
+        sigaddset(&mask, SIGUSR2);  // used to write a perf snapshot
 #endif
     sigaddset(&mask, SIGPIPE);
     cc = sigprocmask(SIG_BLOCK, &mask, NULL);
@@ -1387,6 +1789,10 @@ std::string dvmStartup(int argc, const char* const argv[],
 
     assert(gDvm.initializing);
 
+    /* time each step of startup from here */
+    dvmStartupTimelineStartup();
+    dvmStartupTimelineBegin("startup");
+
     ALOGV("VM init args (%d):", argc);
     for (int i = 0; i < argc; i++) {
         ALOGV("  %d: '%s'", i, argv[i]);
@@ -1404,6 +1810,7 @@ std::string dvmStartup(int argc, const char* const argv[],
         }
         return "syntax error";
     }
+    dvmStartupTimelineMark("options");
 
 #if WITH_EXTRA_GC_CHECKS > 1
     /* only "portable" interp has the extra goodies */
@@ -1421,6 +1828,14 @@ std::string dvmStartup(int argc, const char* const argv[],
         ALOGV("Using kernel scheduler policies");
     }
 
+    /* Hash codes are handed out from here on; zygote children keep
+     * the seed, as their objects that came from the zygote keep their
+     * codes.
+     */
+    if (gDvm.randomIdentityHash) {
+        gDvm.identityHashSeed = pickIdentityHashSeed();
+    }
+
     /* configure signal handling */
     if (!gDvm.reduceSignals)
         blockSignals();
@@ -1442,24 +1857,39 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmAllocTrackerStartup()) {
         return "dvmAllocTrackerStartup failed";
     }
+    dvmStartupTimelineMark("alloc-tracker");
+    if (!dvmAllocProfilerStartup()) {
+        return "dvmAllocProfilerStartup failed";
+    }
+    dvmStartupTimelineMark("alloc-profiler");
     if (!dvmGcStartup()) {
         return "dvmGcStartup failed";
     }
+    dvmStartupTimelineMark("gc");
     if (!dvmThreadStartup()) {
         return "dvmThreadStartup failed";
     }
+    dvmStartupTimelineMark("thread");
     if (!dvmInlineNativeStartup()) {
         return "dvmInlineNativeStartup";
     }
+    dvmStartupTimelineMark("inline-native");
     if (!dvmRegisterMapStartup()) {
         return "dvmRegisterMapStartup failed";
     }
+    dvmStartupTimelineMark("register-map");
     if (!dvmInstanceofStartup()) {
         return "dvmInstanceofStartup failed";
     }
+    dvmStartupTimelineMark("instanceof");
+    if (!dvmStartupPagesStartup()) {
+        return "dvmStartupPagesStartup failed";
+    }
+    dvmStartupTimelineMark("startup-pages");
     if (!dvmClassStartup()) {
         return "dvmClassStartup failed";
     }
+    dvmStartupTimelineMark("class");
 
     /*
      * At this point, the system is guaranteed to be sufficiently
@@ -1470,22 +1900,36 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmFindRequiredClassesAndMembers()) {
         return "dvmFindRequiredClassesAndMembers failed";
     }
+    dvmStartupTimelineMark("required-classes");
 
     if (!dvmStringInternStartup()) {
         return "dvmStringInternStartup failed";
     }
+    dvmStartupTimelineMark("intern");
+    if (!dvmLineTableStartup()) {
+        return "dvmLineTableStartup failed";
+    }
+    dvmStartupTimelineMark("line-table");
+    if (!dvmReflectStartup()) {
+        return "dvmReflectStartup failed";
+    }
+    dvmStartupTimelineMark("reflect");
     if (!dvmNativeStartup()) {
         return "dvmNativeStartup failed";
     }
+    dvmStartupTimelineMark("native");
     if (!dvmInternalNativeStartup()) {
         return "dvmInternalNativeStartup failed";
     }
+    dvmStartupTimelineMark("internal-native");
     if (!dvmJniStartup()) {
         return "dvmJniStartup failed";
     }
+    dvmStartupTimelineMark("jni");
     if (!dvmProfilingStartup()) {
         return "dvmProfilingStartup failed";
     }
+    dvmStartupTimelineMark("profiling");
 
     /*
      * Create a table of methods for which we will substitute an "inline"
@@ -1494,6 +1938,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmCreateInlineSubsTable()) {
         return "dvmCreateInlineSubsTable failed";
     }
+    dvmStartupTimelineMark("inline-subs");
 
     /*
      * Miscellaneous class library validation.
@@ -1501,6 +1946,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmValidateBoxClasses()) {
         return "dvmValidateBoxClasses failed";
     }
+    dvmStartupTimelineMark("box-classes");
 
     /*
      * Do the last bits of Thread struct initialization we need to allow
@@ -1509,6 +1955,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmPrepMainForJni(pEnv)) {
         return "dvmPrepMainForJni failed";
     }
+    dvmStartupTimelineMark("main-jni");
 
     /*
      * Explicitly initialize java.lang.Class.  This doesn't happen
@@ -1520,6 +1967,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmInitClass(gDvm.classJavaLangClass)) {
         return "couldn't initialized java.lang.Class";
     }
+    dvmStartupTimelineMark("init-class");
 
     /*
      * Register the system native methods, which are registered through JNI.
@@ -1527,6 +1975,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!registerSystemNatives(pEnv)) {
         return "couldn't register system natives";
     }
+    dvmStartupTimelineMark("system-natives");
 
     /*
      * Do some "late" initialization for the memory allocator.  This may
@@ -1535,6 +1984,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmCreateStockExceptions()) {
         return "dvmCreateStockExceptions failed";
     }
+    dvmStartupTimelineMark("stock-exceptions");
 
     /*
      * At this point, the VM is in a pretty good state.  Finish prep on
@@ -1545,6 +1995,7 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmPrepMainThread()) {
         return "dvmPrepMainThread failed";
     }
+    dvmStartupTimelineMark("main-thread");
 
     /*
      * Make sure we haven't accumulated any tracked references.  The main
@@ -1560,10 +2011,12 @@ std::string dvmStartup(int argc, const char* const argv[],
     if (!dvmDebuggerStartup()) {
         return "dvmDebuggerStartup failed";
     }
+    dvmStartupTimelineMark("debugger");
 
     if (!dvmGcStartupClasses()) {
         return "dvmGcStartupClasses failed";
     }
+    dvmStartupTimelineMark("gc-classes");
 
     /*
      * Init for either zygote mode or non-zygote mode.  The key difference
@@ -1573,6 +2026,8 @@ std::string dvmStartup(int argc, const char* const argv[],
         if (!initZygote()) {
             return "initZygote failed";
         }
+        dvmStartupTimelineMark("zygote");
+        dvmStartupTimelineFinish();
     } else {
         if (!dvmInitAfterZygote()) {
             return "dvmInitAfterZygote failed";
@@ -1749,41 +2204,83 @@ static bool initZygote()
     return true;
 }
 
+/*
+ * Start the threads that nothing in a new process waits for.  A SIGQUIT
+ * that arrives before the signal catcher is up stays pending, since the
+ * signal is blocked in every thread, and JIT requests aren't taken until
+ * the compiler thread has set up its tables anyway.
+ */
+static void* postForkInitThreadStart(void* arg)
+{
+    /* start signal catcher thread that dumps stacks on SIGQUIT */
+    if (!gDvm.reduceSignals && !gDvm.noQuitHandler) {
+        if (!dvmSignalCatcherStartup())
+            ALOGE("Unable to start the signal catcher");
+        dvmStartupTimelineMark("signal-catcher");
+    }
+
+    /* record startup page profiles once startup is over */
+    if (!dvmStartupPagesStartRecorder())
+        ALOGW("Unable to start the startup page recorder");
+
+#ifdef WITH_JIT
+    if (gDvm.executionMode == kExecutionModeJit) {
+        if (!dvmCompilerStartThread())
+            ALOGE("Unable to start the JIT compiler thread");
+        dvmStartupTimelineMark("jit-thread");
+    }
+#endif
+
+    dvmStartupTimelineMark("background-done");
+    dvmStartupTimelineFinish();
+    return NULL;
+}
+
 /*
  * Do non-zygote-mode initialization.  This is done during VM init for
  * standard startup, or after a "zygote fork" when creating a new process.
+ *
+ * Only the work that has to be done before the process runs any code of
+ * its own happens here; the threads that can come up later are started
+ * by postForkInitThreadStart() while the process gets going.  Each step
+ * is noted on the startup timeline.
  */
 bool dvmInitAfterZygote()
 {
-    u8 startHeap, startQuit, startJdwp;
-    u8 endHeap, endQuit, endJdwp;
-
-    startHeap = dvmGetRelativeTimeUsec();
-
     /*
      * Post-zygote heap initialization, including starting
      * the HeapWorker thread.
      */
     if (!dvmGcStartupAfterZygote())
         return false;
-
-    endHeap = dvmGetRelativeTimeUsec();
-    startQuit = dvmGetRelativeTimeUsec();
-
-    /* start signal catcher thread that dumps stacks on SIGQUIT */
-    if (!gDvm.reduceSignals && !gDvm.noQuitHandler) {
-        if (!dvmSignalCatcherStartup())
-            return false;
-    }
+    dvmStartupTimelineMark("heap");
 
     /* start stdout/stderr copier, if requested */
     if (gDvm.logStdio) {
         if (!dvmStdioConverterStartup())
             return false;
+        dvmStartupTimelineMark("stdio");
     }
 
-    endQuit = dvmGetRelativeTimeUsec();
-    startJdwp = dvmGetRelativeTimeUsec();
+#ifdef WITH_JIT
+    /*
+     * The trace profile has to be read before the process initializes
+     * the classes it names.  The code cache and JIT tables are set up by
+     * the compiler thread, once it is told to start compiling.
+     */
+    if (gDvm.executionMode == kExecutionModeJit) {
+        if (!dvmCompilerStartup())
+            return false;
+        dvmStartupTimelineMark("jit");
+    }
+#endif
+
+    if (!dvmCreateInternalThread(&gDvm.postForkInitHandle, "Post-fork init",
+            postForkInitThreadStart, NULL))
+    {
+        return false;
+    }
+    dvmStartupTimelineMark("background-start");
 
     /*
      * Start JDWP thread.  If the command-line debugger flags specified
@@ -1793,19 +2290,7 @@ bool dvmInitAfterZygote()
     if (!initJdwp()) {
         ALOGD("JDWP init failed; continuing anyway");
     }
-
-    endJdwp = dvmGetRelativeTimeUsec();
-
-    ALOGV("thread-start heap=%d quit=%d jdwp=%d total=%d usec",
-        (int)(endHeap-startHeap), (int)(endQuit-startQuit),
-        (int)(endJdwp-startJdwp), (int)(endJdwp-startHeap));
-
-#ifdef WITH_JIT
-    if (gDvm.executionMode == kExecutionModeJit) {
-        if (!dvmCompilerStartup())
-            return false;
-    }
-#endif
+    dvmStartupTimelineMark("jdwp");
 
     return true;
 }
@@ -1908,6 +2393,8 @@ int dvmPrepForDexOpt(const char* bootClassPath, DexOptimizerMode dexOptMode,
     gDvm.dexOptMode = dexOptMode;
     gDvm.classVerifyMode = verifyMode;
     gDvm.generateRegisterMaps = (dexoptFlags & DEXOPT_GEN_REGISTER_MAPS) != 0;
+    if (dexoptFlags & DEXOPT_LIVE_REGISTER_MAPS)
+        gDvm.registerMapMode = kRegisterMapModeLivePrecise;
     if (dexoptFlags & DEXOPT_SMP) {
         assert((dexoptFlags & DEXOPT_UNIPROCESSOR) == 0);
         gDvm.dexOptForSmp = true;
@@ -1916,6 +2403,8 @@ int dvmPrepForDexOpt(const char* bootClassPath, DexOptimizerMode dexOptMode,
     } else {
         gDvm.dexOptForSmp = (ANDROID_SMP != 0);
     }
+    gDvm.dexOptParallel = (dexoptFlags & DEXOPT_SERIAL) == 0;
+    gDvm.dexOptChecksumOk = (dexoptFlags & DEXOPT_CHECKSUM_OK) != 0;
 
     /*
      * Initialize the heap, some basic thread control mutexes, and
@@ -1987,10 +2476,23 @@ void dvmShutdown()
     gDvm.jniTrace = NULL;
     free(gDvm.stackTraceFile);
     gDvm.stackTraceFile = NULL;
+    free(gDvm.perfSnapshotFile);
+    gDvm.perfSnapshotFile = NULL;
+    free(gDvm.fieldProfileFile);
+    gDvm.fieldProfileFile = NULL;
+
+    /* let the threads started after the zygote finish coming up */
+    if (gDvm.postForkInitHandle != 0) {
+        pthread_join(gDvm.postForkInitHandle, NULL);
+        gDvm.postForkInitHandle = 0;
+    }
 
     /* tell signal catcher to shut down if it was started */
     dvmSignalCatcherShutdown();
 
+    /* stop the startup page recorder, if it's still waiting */
+    dvmStartupPagesShutdown();
+
     /* shut down stdout/stderr conversion */
     dvmStdioConverterShutdown();
 
@@ -2015,12 +2517,15 @@ void dvmShutdown()
     dvmProfilingShutdown();
     dvmJniShutdown();
     dvmStringInternShutdown();
+    dvmLineTableShutdown();
+    dvmReflectShutdown();
     dvmThreadShutdown();
     dvmClassShutdown();
     dvmRegisterMapShutdown();
     dvmInstanceofShutdown();
     dvmInlineNativeShutdown();
     dvmGcShutdown();
+    dvmAllocProfilerShutdown();
     dvmAllocTrackerShutdown();
 
     /* these must happen AFTER dvmClassShutdown has walked through class data */
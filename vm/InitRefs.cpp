@@ -443,6 +443,43 @@ static bool initVirtualMethodOffsets() {
     return true;
 }
 
+static bool initInterfaceMethodReferences() {
+    static struct {
+        Method** method;
+        const char* className;
+        const char* name;
+        const char* descriptor;
+    } methods[] = {
+        { &gDvm.methJavaLangReflectInvocationHandler_invoke,
+          "Ljava/lang/reflect/InvocationHandler;", "invoke",
+          "(Ljava/lang/Object;Ljava/lang/reflect/Method;[Ljava/lang/Object;)"
+          "Ljava/lang/Object;" },
+        { NULL, NULL, NULL, NULL }
+    };
+
+    int i;
+    for (i = 0; methods[i].method != NULL; i++) {
+        ClassObject* clazz = dvmFindSystemClassNoInit(methods[i].className);
+        if (clazz == NULL) {
+            ALOGE("Could not find essential class %s for interface method lookup",
+                    methods[i].className);
+            return false;
+        }
+
+        Method* method = dvmFindInterfaceMethodHierByDescriptor(clazz,
+                methods[i].name, methods[i].descriptor);
+        if (method == NULL) {
+            ALOGE("Could not find essential interface method %s.%s with descriptor %s",
+                    clazz->descriptor, methods[i].name, methods[i].descriptor);
+            return false;
+        }
+
+        *methods[i].method = method;
+    }
+
+    return true;
+}
+
 static bool initFinalizerReference()
 {
     gDvm.classJavaLangRefFinalizerReference =
@@ -490,6 +527,7 @@ bool dvmFindRequiredClassesAndMembers() {
         && initConstructorReferences()
         && initDirectMethodReferences()
         && initVirtualMethodOffsets()
+        && initInterfaceMethodReferences()
         && initFinalizerReference()
         && verifyStringOffsets();
 }
@@ -22,6 +22,12 @@
 
 #include <math.h>
 
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef HAVE__MEMCMP16
 /* hand-coded assembly implementation, available on some platforms */
 //#warning "trying memcmp16"
@@ -121,6 +127,69 @@ static bool org_apache_harmony_dalvik_NativeTestTarget_emptyInlineMethod(
  * ===========================================================================
  */
 
+#ifdef WITH_VECTOR_STRING_INTRINSICS
+/*
+ * Return the index of the first of "count" chars at which "s0" and "s1"
+ * differ, or "count" if there isn't one.  String offsets mean neither
+ * is likely to be aligned, so these are all unaligned loads.
+ */
+static inline int firstDiff16(const u2* s0, const u2* s1, int count)
+{
+    int i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 8 <= count; i += 8) {
+        uint64x2_t eq = vreinterpretq_u64_u16(
+            vceqq_u16(vld1q_u16(s0 + i), vld1q_u16(s1 + i)));
+        if ((vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) != ~0ULL)
+            break;
+    }
+#else
+    for (; i + 8 <= count; i += 8) {
+        __m128i eq = _mm_cmpeq_epi16(
+            _mm_loadu_si128((const __m128i*) (s0 + i)),
+            _mm_loadu_si128((const __m128i*) (s1 + i)));
+        int diff = _mm_movemask_epi8(eq) ^ 0xffff;
+        if (diff != 0)
+            return i + (__builtin_ctz(diff) >> 1);
+    }
+#endif
+    while (i < count && s0[i] == s1[i])
+        i++;
+    return i;
+}
+
+/*
+ * Return the index of the first "ch" in chars[start..count), or -1.
+ */
+static inline int indexOf16(const u2* chars, u2 ch, int start, int count)
+{
+    int i = start;
+#if defined(__ARM_NEON__)
+    const uint16x8_t match = vdupq_n_u16(ch);
+    for (; i + 8 <= count; i += 8) {
+        uint64x2_t eq = vreinterpretq_u64_u16(
+            vceqq_u16(vld1q_u16(chars + i), match));
+        if ((vgetq_lane_u64(eq, 0) | vgetq_lane_u64(eq, 1)) != 0)
+            break;
+    }
+#else
+    const __m128i match = _mm_set1_epi16(ch);
+    for (; i + 8 <= count; i += 8) {
+        __m128i eq = _mm_cmpeq_epi16(
+            _mm_loadu_si128((const __m128i*) (chars + i)), match);
+        int found = _mm_movemask_epi8(eq);
+        if (found != 0)
+            return i + (__builtin_ctz(found) >> 1);
+    }
+#endif
+    for (; i < count; i++) {
+        if (chars[i] == ch)
+            return i;
+    }
+    return -1;
+}
+#endif
+
 /*
  * public char charAt(int index)
  */
@@ -241,7 +310,19 @@ bool javaLangString_compareTo(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
     thisChars = ((const u2*)(void*)thisArray->contents) + thisOffset;
     compChars = ((const u2*)(void*)compArray->contents) + compOffset;
 
-#ifdef HAVE__MEMCMP16
+#if defined(WITH_VECTOR_STRING_INTRINSICS)
+    /*
+     * Find the first difference 8 chars at a time.  As with the other
+     * versions, the characters are widened without sign extension before
+     * they're subtracted.
+     */
+    int i = firstDiff16(thisChars, compChars, minCount);
+    if (i < minCount) {
+        pResult->i = (s4) thisChars[i] - (s4) compChars[i];
+        return true;
+    }
+
+#elif defined(HAVE__MEMCMP16)
     /*
      * Use assembly version, which returns the difference between the
      * characters.  The annoying part here is that 0x00e9 - 0xffff != 0x00ea,
@@ -362,7 +443,9 @@ bool javaLangString_equals(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
     thisChars = ((const u2*)(void*)thisArray->contents) + thisOffset;
     compChars = ((const u2*)(void*)compArray->contents) + compOffset;
 
-#ifdef HAVE__MEMCMP16
+#if defined(WITH_VECTOR_STRING_INTRINSICS)
+    pResult->i = (firstDiff16(thisChars, compChars, thisCount) == thisCount);
+#elif defined(HAVE__MEMCMP16)
     pResult->i = (__memcmp16(thisChars, compChars, thisCount) == 0);
 # ifdef CHECK_MEMCMP16
     int otherRes = (memcmp(thisChars, compChars, thisCount * 2) == 0);
@@ -466,7 +549,12 @@ static inline int indexOfCommon(Object* strObj, int ch, int start)
     else if (start > count)
         start = count;
 
-#if 0
+#if defined(WITH_VECTOR_STRING_INTRINSICS)
+    /* 8 chars at a time; a "ch" that doesn't fit in a lane can't match */
+    if ((ch & 0xffff) != ch)
+        return -1;
+    return indexOf16(chars, ch, start, count);
+#elif 0
     /* 16-bit loop, simple */
     while (start < count) {
         if (chars[start] == ch)
@@ -640,6 +728,125 @@ bool javaLangMath_sin(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
     return true;
 }
 
+/*
+ * public static double floor(double)
+ */
+bool javaLangMath_floor(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    Convert64 convert;
+    convert.arg[0] = arg0;
+    convert.arg[1] = arg1;
+    pResult->d = floor(convert.dd);
+    return true;
+}
+
+/*
+ * public static double ceil(double)
+ */
+bool javaLangMath_ceil(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    Convert64 convert;
+    convert.arg[0] = arg0;
+    convert.arg[1] = arg1;
+    pResult->d = ceil(convert.dd);
+    return true;
+}
+
+/*
+ * public static double rint(double)
+ *
+ * The VM always runs in round-to-nearest mode, which is what rint()
+ * rounds with.
+ */
+bool javaLangMath_rint(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    Convert64 convert;
+    convert.arg[0] = arg0;
+    convert.arg[1] = arg1;
+    pResult->d = rint(convert.dd);
+    return true;
+}
+
+/*
+ * ===========================================================================
+ *      java.lang.Integer, java.lang.Long
+ * ===========================================================================
+ */
+
+/*
+ * public static int bitCount(int)
+ */
+bool javaLangInteger_bitCount(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    pResult->i = __builtin_popcount(arg0);
+    return true;
+}
+
+/*
+ * public static int numberOfLeadingZeros(int)
+ */
+bool javaLangInteger_numberOfLeadingZeros(u4 arg0, u4 arg1, u4 arg2,
+    u4 arg3, JValue* pResult)
+{
+    /* __builtin_clz() is undefined for 0 */
+    pResult->i = (arg0 == 0) ? 32 : __builtin_clz(arg0);
+    return true;
+}
+
+/*
+ * public static int bitCount(long)
+ */
+bool javaLangLong_bitCount(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    pResult->i = __builtin_popcount(arg0) + __builtin_popcount(arg1);
+    return true;
+}
+
+/*
+ * public static int numberOfLeadingZeros(long)
+ */
+bool javaLangLong_numberOfLeadingZeros(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    Convert64 convert;
+    convert.arg[0] = arg0;
+    convert.arg[1] = arg1;
+    u8 val = (u8) convert.ll;
+    pResult->i = (val == 0) ? 64 : __builtin_clzll(val);
+    return true;
+}
+
+/*
+ * ===========================================================================
+ *      java.lang.System, java.lang.Thread
+ * ===========================================================================
+ */
+
+/*
+ * public static native long nanoTime()
+ */
+bool javaLangSystem_nanoTime(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    pResult->j = dvmGetRelativeTimeNsec();
+    return true;
+}
+
+/*
+ * public static native Thread currentThread()
+ */
+bool javaLangThread_currentThread(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    pResult->l = dvmThreadSelf()->threadObj;
+    return true;
+}
+
 /*
  * ===========================================================================
  *      java.lang.Float
@@ -707,6 +914,76 @@ bool javaLangDouble_longBitsToDouble(u4 arg0, u4 arg1, u4 arg2, u4 arg,
     return true;
 }
 
+/*
+ * ===========================================================================
+ *      sun.misc.Unsafe
+ * ===========================================================================
+ */
+
+/*
+ * Returns the address of the field "offset" bytes into "obj".  The offset
+ * arrives as a long in arg2/arg3; as in the native implementations, "obj"
+ * isn't checked.
+ */
+static inline volatile int32_t* unsafeFieldAddress(u4 obj, u4 offsetLo,
+    u4 offsetHi)
+{
+    s8 offset = (s8) (((u8) offsetHi << 32) | offsetLo);
+    return (volatile int32_t*) (((u1*) obj) + offset);
+}
+
+/*
+ * public native int getIntVolatile(Object obj, long offset)
+ */
+bool sunMiscUnsafe_getIntVolatile(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    /* null reference check on "this" */
+    if ((Object*) arg0 == NULL) {
+        dvmThrowNullPointerException(NULL);
+        return false;
+    }
+
+    pResult->i = android_atomic_acquire_load(
+            unsafeFieldAddress(arg1, arg2, arg3));
+    return true;
+}
+
+/*
+ * public native long getLongVolatile(Object obj, long offset)
+ */
+bool sunMiscUnsafe_getLongVolatile(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    /* null reference check on "this" */
+    if ((Object*) arg0 == NULL) {
+        dvmThrowNullPointerException(NULL);
+        return false;
+    }
+
+    pResult->j = dvmQuasiAtomicRead64(
+            (volatile int64_t*) unsafeFieldAddress(arg1, arg2, arg3));
+    DVM_MEMBAR_ACQUIRE();
+    return true;
+}
+
+/*
+ * public native Object getObjectVolatile(Object obj, long offset)
+ */
+bool sunMiscUnsafe_getObjectVolatile(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    /* null reference check on "this" */
+    if ((Object*) arg0 == NULL) {
+        dvmThrowNullPointerException(NULL);
+        return false;
+    }
+
+    pResult->l = (Object*) android_atomic_acquire_load(
+            unsafeFieldAddress(arg1, arg2, arg3));
+    return true;
+}
+
 /*
  * ===========================================================================
  *      Infrastructure
@@ -767,6 +1044,31 @@ const InlineOperation gDvmInlineOpsTable[] = {
     { javaLangMath_min_int, "Ljava/lang/StrictMath;", "min", "(II)I" },
     { javaLangMath_max_int, "Ljava/lang/StrictMath;", "max", "(II)I" },
     { javaLangMath_sqrt, "Ljava/lang/StrictMath;", "sqrt", "(D)D" },
+
+    // The compareAndSwap and putOrdered methods take more than the four
+    // argument words an inline op gets; the JIT handles those at the
+    // invoke instead.
+    { sunMiscUnsafe_getIntVolatile, "Lsun/misc/Unsafe;", "getIntVolatile",
+        "(Ljava/lang/Object;J)I" },
+    { sunMiscUnsafe_getLongVolatile, "Lsun/misc/Unsafe;", "getLongVolatile",
+        "(Ljava/lang/Object;J)J" },
+    { sunMiscUnsafe_getObjectVolatile, "Lsun/misc/Unsafe;",
+        "getObjectVolatile", "(Ljava/lang/Object;J)Ljava/lang/Object;" },
+
+    { javaLangMath_floor, "Ljava/lang/Math;", "floor", "(D)D" },
+    { javaLangMath_ceil, "Ljava/lang/Math;", "ceil", "(D)D" },
+    { javaLangMath_rint, "Ljava/lang/Math;", "rint", "(D)D" },
+
+    { javaLangInteger_bitCount, "Ljava/lang/Integer;", "bitCount", "(I)I" },
+    { javaLangInteger_numberOfLeadingZeros, "Ljava/lang/Integer;",
+        "numberOfLeadingZeros", "(I)I" },
+    { javaLangLong_bitCount, "Ljava/lang/Long;", "bitCount", "(J)I" },
+    { javaLangLong_numberOfLeadingZeros, "Ljava/lang/Long;",
+        "numberOfLeadingZeros", "(J)I" },
+
+    { javaLangSystem_nanoTime, "Ljava/lang/System;", "nanoTime", "()J" },
+    { javaLangThread_currentThread, "Ljava/lang/Thread;", "currentThread",
+        "()Ljava/lang/Thread;" },
 };
 
 /*
@@ -838,9 +1140,11 @@ Method* dvmFindInlinableMethod(const char* classDescriptor,
     }
 
     /*
-     * Check that the method is appropriate for inlining.
+     * Check that the method is appropriate for inlining.  Static methods
+     * can't be overridden, so they needn't be final.
      */
-    if (!dvmIsFinalClass(clazz) && !dvmIsFinalMethod(method)) {
+    if (!dvmIsFinalClass(clazz) && !dvmIsFinalMethod(method) &&
+            !dvmIsStaticMethod(method)) {
         ALOGE("dvmFindInlinableMethod: can't inline non-final method %s.%s",
             clazz->descriptor, method->name);
         return NULL;
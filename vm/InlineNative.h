@@ -87,6 +87,18 @@ enum NativeInlineOps {
     INLINE_STRICT_MATH_MIN_INT = 26,
     INLINE_STRICT_MATH_MAX_INT = 27,
     INLINE_STRICT_MATH_SQRT = 28,
+    INLINE_UNSAFE_GET_INT_VOLATILE = 29,
+    INLINE_UNSAFE_GET_LONG_VOLATILE = 30,
+    INLINE_UNSAFE_GET_OBJECT_VOLATILE = 31,
+    INLINE_MATH_FLOOR = 32,
+    INLINE_MATH_CEIL = 33,
+    INLINE_MATH_RINT = 34,
+    INLINE_INTEGER_BIT_COUNT = 35,
+    INLINE_INTEGER_NUMBER_OF_LEADING_ZEROS = 36,
+    INLINE_LONG_BIT_COUNT = 37,
+    INLINE_LONG_NUMBER_OF_LEADING_ZEROS = 38,
+    INLINE_SYSTEM_NANO_TIME = 39,
+    INLINE_THREAD_CURRENT_THREAD = 40,
 };
 
 /*
@@ -128,6 +140,14 @@ bool dvmPerformInlineOp4Dbg(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
  */
 extern "C" Method* dvmResolveInlineNative(int opIndex);
 
+/*
+ * Defined when the String intrinsics compare and search 8 chars at a
+ * time.  The JIT then calls them rather than using its own scalar loops.
+ */
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+# define WITH_VECTOR_STRING_INTRINSICS
+#endif
+
 /*
  * The actual inline native definitions.
  */
@@ -197,4 +217,40 @@ bool javaLangDouble_doubleToRawLongBits(u4 arg0, u4 arg1, u4 arg2,
 bool javaLangDouble_longBitsToDouble(u4 arg0, u4 arg1, u4 arg2, u4 arg,
                                      JValue* pResult);
 
+bool sunMiscUnsafe_getIntVolatile(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                  JValue* pResult);
+
+bool sunMiscUnsafe_getLongVolatile(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                   JValue* pResult);
+
+bool sunMiscUnsafe_getObjectVolatile(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                     JValue* pResult);
+
+bool javaLangMath_floor(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                        JValue* pResult);
+
+bool javaLangMath_ceil(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                       JValue* pResult);
+
+bool javaLangMath_rint(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                       JValue* pResult);
+
+bool javaLangInteger_bitCount(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                              JValue* pResult);
+
+bool javaLangInteger_numberOfLeadingZeros(u4 arg0, u4 arg1, u4 arg2,
+                                          u4 arg3, JValue* pResult);
+
+bool javaLangLong_bitCount(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                           JValue* pResult);
+
+bool javaLangLong_numberOfLeadingZeros(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                       JValue* pResult);
+
+bool javaLangSystem_nanoTime(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                             JValue* pResult);
+
+bool javaLangThread_currentThread(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                  JValue* pResult);
+
 #endif  // DALVIK_INLINENATIVE_H_
@@ -26,10 +26,10 @@
 bool dvmStringInternStartup()
 {
     dvmInitMutex(&gDvm.internLock);
-    gDvm.internedStrings = dvmHashTableCreate(256, NULL);
+    gDvm.internedStrings = dvmHashTableCreateConcurrent(256, NULL);
     if (gDvm.internedStrings == NULL)
         return false;
-    gDvm.literalStrings = dvmHashTableCreate(256, NULL);
+    gDvm.literalStrings = dvmHashTableCreateConcurrent(256, NULL);
     if (gDvm.literalStrings == NULL)
         return false;
     return true;
@@ -58,6 +58,18 @@ static StringObject* lookupString(HashTable* table, u4 key, StringObject* value)
     return (StringObject*)entry;
 }
 
+/*
+ * Search a table without holding the intern lock.  A NULL result is
+ * not final; the caller must repeat the search under the lock.
+ */
+static StringObject* lookupStringConcurrent(HashTable* table, u4 key,
+    StringObject* value)
+{
+    void* entry = dvmHashTableLookupConcurrent(table, key, (void*)value,
+                                               dvmHashcmpStrings, NULL);
+    return (StringObject*)entry;
+}
+
 static StringObject* insertString(HashTable* table, u4 key, StringObject* value)
 {
     if (dvmIsNonMovingObject(value) == false) {
@@ -74,6 +86,23 @@ static StringObject* lookupInternedString(StringObject* strObj, bool isLiteral)
 
     assert(strObj != NULL);
     u4 key = dvmComputeStringHash(strObj);
+
+    /*
+     * Most calls find a string that is already interned, so look first
+     * without the lock.  Writers still serialize on internLock, and the
+     * only thing that removes entries other than a move to the literal
+     * table (which keeps the same object) is the GC, which runs with
+     * this thread suspended.  Whatever a hit returns is therefore the
+     * canonical instance.
+     */
+    found = lookupStringConcurrent(gDvm.literalStrings, key, strObj);
+    if (found == NULL && !isLiteral) {
+        found = lookupStringConcurrent(gDvm.internedStrings, key, strObj);
+    }
+    if (found != NULL) {
+        return found;
+    }
+
     dvmLockMutex(&gDvm.internLock);
     if (isLiteral) {
         /*
@@ -286,23 +286,32 @@ tryArchive:
             if (newFile) {
                 u8 startWhen, extractWhen, endWhen;
                 bool result;
+                bool checksumOk = false;
                 off_t dexOffset;
 
                 dexOffset = lseek(fd, 0, SEEK_CUR);
                 result = (dexOffset > 0);
 
+                /*
+                 * Inflate straight into a mapping of the cache file,
+                 * checking the DEX checksum on the way, so dexopt doesn't
+                 * have to make another pass over it.
+                 */
                 if (result) {
                     startWhen = dvmGetRelativeTimeUsec();
-                    result = dexZipExtractEntryToFile(archive, &entry, fd) == 0;
+                    result = dexZipExtractDexToFile(archive, &entry, fd,
+                                dexOffset, &checksumOk) == 0;
                     extractWhen = dvmGetRelativeTimeUsec();
                 }
                 if (result) {
                     result = dvmOptimizeDexFile(fd, dexOffset,
                                 entry.uncompressed_length,
                                 fileName,
+                                cachedName,
                                 entry.mod_time,
                                 entry.crc32,
-                                isBootstrap);
+                                isBootstrap,
+                                checksumOk);
                 }
 
                 if (!result) {
@@ -332,6 +341,7 @@ tryArchive:
         ALOGI("Unable to map %s in %s", kDexInJarName, fileName);
         goto bail;
     }
+    dvmStartupPagesAdvise(pDvmDex, cachedName);
 
     if (locked) {
         /* unlock the fd */
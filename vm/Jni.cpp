@@ -40,6 +40,10 @@ simple functions, e.g.  IsSameObject, GetJavaVM, GetStringLength, maybe
 even access to fields with primitive types.  Our options are more limited
 with a compacting GC.
 
+Fast JNI methods (registered with a '!' before the signature) are called
+without leaving THREAD_RUNNING, so JNI functions restore the status they
+found rather than assuming THREAD_NATIVE.
+
 For performance reasons we do as little error-checking as possible here.
 For example, we don't check to make sure the correct type of Object is
 passed in when setting a field, and we don't prevent you from storing
@@ -226,11 +230,12 @@ public:
         }
 
         CHECK_STACK_SUM(mSelf);
-        dvmChangeStatus(mSelf, THREAD_RUNNING);
+        // Fast JNI methods call us without having left THREAD_RUNNING.
+        mOldStatus = dvmChangeStatus(mSelf, THREAD_RUNNING);
     }
 
     ~ScopedJniThreadState() {
-        dvmChangeStatus(mSelf, THREAD_NATIVE);
+        dvmChangeStatus(mSelf, mOldStatus);
         COMPUTE_STACK_SUM(mSelf);
     }
 
@@ -240,49 +245,61 @@ public:
 
 private:
     Thread* mSelf;
+    ThreadStatus mOldStatus;
 
     // Disallow copy and assignment.
     ScopedJniThreadState(const ScopedJniThreadState&);
     void operator=(const ScopedJniThreadState&);
 };
 
-#define kGlobalRefsTableInitialSize 512
 #define kGlobalRefsTableMaxSize     51200       /* arbitrary, must be < 64K */
 
-#define kWeakGlobalRefsTableInitialSize 16
-
 #define kPinTableInitialSize        16
 #define kPinTableMaxSize            1024
 #define kPinComplainThreshold       10
 
 bool dvmJniStartup() {
-    if (!gDvm.jniGlobalRefTable.init(kGlobalRefsTableInitialSize,
-                                 kGlobalRefsTableMaxSize,
-                                 kIndirectKindGlobal)) {
+    if (!gDvm.jniGlobalRefTable.init(kGlobalRefsTableMaxSize,
+                                     kIndirectKindGlobal)) {
         return false;
     }
-    if (!gDvm.jniWeakGlobalRefTable.init(kWeakGlobalRefsTableInitialSize,
-                                 kGlobalRefsTableMaxSize,
-                                 kIndirectKindWeakGlobal)) {
+    if (!gDvm.jniWeakGlobalRefTable.init(kGlobalRefsTableMaxSize,
+                                         kIndirectKindWeakGlobal)) {
         return false;
     }
 
-    dvmInitMutex(&gDvm.jniGlobalRefLock);
     dvmInitMutex(&gDvm.jniWeakGlobalRefLock);
 
-    if (!dvmInitReferenceTable(&gDvm.jniPinRefTable, kPinTableInitialSize, kPinTableMaxSize)) {
-        return false;
+    /*
+     * Heap compaction (alloc/Compact.cpp) moves objects while threads are
+     * in native code, and only leaves alone what the root set points to,
+     * so the arrays and strings handed out by the Get<Type>ArrayElements,
+     * GetPrimitiveArrayCritical and GetStringChars families must be in
+     * the pin table whenever it is enabled.  Otherwise nothing moves, and
+     * the caller keeps the array alive through the reference it must pass
+     * to the Release function, so pinning is only bookkeeping; it is then
+     * skipped unless CheckJNI checks every call and can report leaked pins.
+     */
+    bool pinArrays = gDvm.backgroundCompaction || gDvm.zygoteCompaction ||
+        (gDvmJni.useCheckJni && gDvmJni.checkSample <= 1);
+#ifdef WITH_COPYING_GC
+    pinArrays = true;
+#endif
+    if (pinArrays) {
+        gDvm.jniPinTable = dvmHashTableCreateRobinHood(kPinTableInitialSize, free);
+        if (gDvm.jniPinTable == NULL) {
+            return false;
+        }
     }
 
-    dvmInitMutex(&gDvm.jniPinRefLock);
-
     return true;
 }
 
 void dvmJniShutdown() {
     gDvm.jniGlobalRefTable.destroy();
     gDvm.jniWeakGlobalRefTable.destroy();
-    dvmClearReferenceTable(&gDvm.jniPinRefTable);
+    dvmHashTableFree(gDvm.jniPinTable);
+    gDvm.jniPinTable = NULL;
 }
 
 bool dvmIsBadJniVersion(int version) {
@@ -331,10 +348,8 @@ Object* dvmDecodeIndirectRef(Thread* self, jobject jobj) {
         }
     case kIndirectKindGlobal:
         {
-            // TODO: find a way to avoid the mutex activity here
-            IndirectRefTable* pRefTable = &gDvm.jniGlobalRefTable;
-            ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
-            Object* result = pRefTable->get(jobj);
+            // The global table never moves, so no lock is needed.
+            Object* result = gDvm.jniGlobalRefTable.get(jobj);
             if (UNLIKELY(result == NULL)) {
                 ALOGE("JNI ERROR (app bug): use of deleted global reference (%p)", jobj);
                 ReportJniError();
@@ -352,6 +367,10 @@ Object* dvmDecodeIndirectRef(Thread* self, jobject jobj) {
             } else if (UNLIKELY(result == NULL)) {
                 ALOGE("JNI ERROR (app bug): use of deleted weak global reference (%p)", jobj);
                 ReportJniError();
+            } else if (result != kInvalidIndirectRefObject &&
+                       UNLIKELY(dvmIsDeadWeakGlobalReferent(result))) {
+                // Dead, but the concurrent sweep hasn't cleared it yet.
+                result = NULL;
             }
             return result;
         }
@@ -441,7 +460,7 @@ static void deleteLocalReference(Thread* self, jobject jobj) {
  * We may add the same object more than once.  Add/remove calls are paired,
  * so it needs to appear on the list multiple times.
  */
-static jobject addGlobalReference(Object* obj) {
+static jobject addGlobalReference(Thread* self, Object* obj) {
     if (obj == NULL) {
         return NULL;
     }
@@ -477,8 +496,6 @@ static jobject addGlobalReference(Object* obj) {
         }
     }
 
-    ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
-
     /*
      * Throwing an exception on failure is problematic, because JNI code
      * may not be expecting an exception, and things sort of cascade.  We
@@ -488,7 +505,7 @@ static jobject addGlobalReference(Object* obj) {
      * we're either leaking global ref table entries or we're going to
      * run out of space in the GC heap.
      */
-    jobject jobj = (jobject) gDvm.jniGlobalRefTable.add(IRT_FIRST_SEGMENT, obj);
+    jobject jobj = (jobject) gDvm.jniGlobalRefTable.add(self->threadId, obj);
     if (jobj == NULL) {
         gDvm.jniGlobalRefTable.dump("JNI global");
         ALOGE("Failed adding to JNI global ref table (%zd entries)",
@@ -532,58 +549,76 @@ static void deleteWeakGlobalReference(jobject jobj) {
 }
 
 /*
- * Remove a global reference.  In most cases it's the entry most recently
- * added, which makes this pretty quick.
- *
- * Thought: if it's not the most recent entry, just null it out.  When we
- * fill up, do a compaction pass before we expand the list.
+ * Remove a global reference.  Its slot goes back on the free list of the
+ * shard it came from, without a lock.
  */
 static void deleteGlobalReference(jobject jobj) {
     if (jobj == NULL) {
         return;
     }
 
-    ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
-    if (!gDvm.jniGlobalRefTable.remove(IRT_FIRST_SEGMENT, jobj)) {
+    if (!gDvm.jniGlobalRefTable.remove(jobj)) {
         ALOGW("JNI: DeleteGlobalRef(%p) failed to find entry", jobj);
         return;
     }
 }
 
+static u4 pinHash(const Object* obj) {
+    return (u4) ((uintptr_t) obj >> 3);
+}
+
+static int pinEntryCmp(const void* tableItem, const void* looseItem) {
+    return ((const JniPinEntry*) tableItem)->obj != ((const JniPinEntry*) looseItem)->obj;
+}
+
+/*
+ * Returns the pin table entry of "obj", or NULL.  The table must be locked.
+ */
+static JniPinEntry* findPinEntry(Object* obj) {
+    JniPinEntry key = { obj, 0 };
+    return (JniPinEntry*) dvmHashTableLookup(gDvm.jniPinTable, pinHash(obj),
+                                             &key, pinEntryCmp, false);
+}
+
 /*
- * Objects don't currently move, so we just need to create a reference
- * that will ensure the array object isn't collected.
+ * Create a reference that will ensure the array object isn't collected
+ * or moved.  Nothing is recorded if objects can't move and CheckJNI
+ * isn't checking every call (see dvmJniStartup).
  *
- * We use a separate reference table, which is part of the GC root set.
+ * The pin table is part of the GC root set.
  */
 static void pinPrimitiveArray(ArrayObject* arrayObj) {
-    if (arrayObj == NULL) {
+    if (arrayObj == NULL || gDvm.jniPinTable == NULL) {
         return;
     }
 
-    ScopedPthreadMutexLock lock(&gDvm.jniPinRefLock);
-
-    if (!dvmAddToReferenceTable(&gDvm.jniPinRefTable, (Object*)arrayObj)) {
-        dvmDumpReferenceTable(&gDvm.jniPinRefTable, "JNI pinned array");
-        ALOGE("Failed adding to JNI pinned array ref table (%d entries)",
-           (int) dvmReferenceTableEntries(&gDvm.jniPinRefTable));
-        ReportJniError();
+    dvmHashTableLock(gDvm.jniPinTable);
+    JniPinEntry* entry = findPinEntry((Object*) arrayObj);
+    if (entry == NULL) {
+        if (dvmHashTableNumEntries(gDvm.jniPinTable) >= kPinTableMaxSize) {
+            dvmHashTableUnlock(gDvm.jniPinTable);
+            ALOGE("Failed adding to JNI pinned array table (%d entries)",
+                  kPinTableMaxSize);
+            ReportJniError();
+        }
+        entry = (JniPinEntry*) malloc(sizeof(*entry));
+        if (entry == NULL) {
+            dvmHashTableUnlock(gDvm.jniPinTable);
+            dvmAbort();
+        }
+        entry->obj = (Object*) arrayObj;
+        entry->count = 0;
+        dvmHashTableLookup(gDvm.jniPinTable, pinHash(entry->obj), entry,
+                           pinEntryCmp, true);
     }
+    int count = ++entry->count;
+    dvmHashTableUnlock(gDvm.jniPinTable);
 
     /*
-     * The total number of pinned primitive arrays should be pretty small.
      * A single array should not be pinned more than once or twice; any
      * more than that is a strong indicator that a Release function is
      * not being called.
      */
-    int count = 0;
-    Object** ppObj = gDvm.jniPinRefTable.table;
-    while (ppObj < gDvm.jniPinRefTable.nextEntry) {
-        if (*ppObj++ == (Object*) arrayObj) {
-            count++;
-        }
-    }
-
     if (count > kPinComplainThreshold) {
         ALOGW("JNI: pin count on array %p (%s) is now %d",
               arrayObj, arrayObj->clazz->descriptor, count);
@@ -596,18 +631,43 @@ static void pinPrimitiveArray(ArrayObject* arrayObj) {
  * unpinned twice before it's free to move.
  */
 static void unpinPrimitiveArray(ArrayObject* arrayObj) {
-    if (arrayObj == NULL) {
+    if (arrayObj == NULL || gDvm.jniPinTable == NULL) {
         return;
     }
 
-    ScopedPthreadMutexLock lock(&gDvm.jniPinRefLock);
-    if (!dvmRemoveFromReferenceTable(&gDvm.jniPinRefTable,
-            gDvm.jniPinRefTable.table, (Object*) arrayObj))
-    {
+    dvmHashTableLock(gDvm.jniPinTable);
+    JniPinEntry* entry = findPinEntry((Object*) arrayObj);
+    if (entry == NULL) {
+        dvmHashTableUnlock(gDvm.jniPinTable);
         ALOGW("JNI: unpinPrimitiveArray(%p) failed to find entry (valid=%d)",
             arrayObj, dvmIsHeapAddress((Object*) arrayObj));
         return;
     }
+    if (--entry->count == 0) {
+        dvmHashTableRemove(gDvm.jniPinTable, pinHash(entry->obj), entry);
+        free(entry);
+    }
+    dvmHashTableUnlock(gDvm.jniPinTable);
+}
+
+/*
+ * Dump the pinned arrays, with their pin counts, to the log file.
+ */
+static void dumpPinTable() {
+    if (gDvm.jniPinTable == NULL) {
+        return;
+    }
+    dvmHashTableLock(gDvm.jniPinTable);
+    ALOGW("JNI pinned array table (%d entries)",
+          dvmHashTableNumEntries(gDvm.jniPinTable));
+    HashIter iter;
+    for (dvmHashIterBegin(gDvm.jniPinTable, &iter); !dvmHashIterDone(&iter);
+         dvmHashIterNext(&iter)) {
+        const JniPinEntry* entry = (const JniPinEntry*) dvmHashIterData(&iter);
+        ALOGW("  %p %s (pinned %d times)", entry->obj,
+              entry->obj->clazz->descriptor, entry->count);
+    }
+    dvmHashTableUnlock(gDvm.jniPinTable);
 }
 
 /*
@@ -619,7 +679,7 @@ void dvmDumpJniReferenceTables() {
     Thread* self = dvmThreadSelf();
     self->jniLocalRefTable.dump("JNI local");
     gDvm.jniGlobalRefTable.dump("JNI global");
-    dvmDumpReferenceTable(&gDvm.jniPinRefTable, "JNI pinned array");
+    dumpPinTable();
 }
 
 void dvmDumpJniStats(DebugOutputTarget* target) {
@@ -627,23 +687,35 @@ void dvmDumpJniStats(DebugOutputTarget* target) {
     if (gDvmJni.forceCopy) {
         dvmPrintDebugMessage(target, " (with forcecopy)");
     }
+    if (gDvmJni.useCheckJni && gDvmJni.checkSample > 1) {
+        dvmPrintDebugMessage(target, " (sampling 1 in %d)", gDvmJni.checkSample);
+    }
     dvmPrintDebugMessage(target, "; workarounds are %s", gDvmJni.workAroundAppJniBugs ? "on" : "off");
 
-    dvmLockMutex(&gDvm.jniPinRefLock);
-    dvmPrintDebugMessage(target, "; pins=%d", dvmReferenceTableEntries(&gDvm.jniPinRefTable));
-    dvmUnlockMutex(&gDvm.jniPinRefLock);
+    if (gDvm.jniPinTable != NULL) {
+        dvmHashTableLock(gDvm.jniPinTable);
+        dvmPrintDebugMessage(target, "; pins=%d", dvmHashTableNumEntries(gDvm.jniPinTable));
+        dvmHashTableUnlock(gDvm.jniPinTable);
+    }
 
-    dvmLockMutex(&gDvm.jniGlobalRefLock);
     dvmPrintDebugMessage(target, "; globals=%d", gDvm.jniGlobalRefTable.capacity());
-    dvmUnlockMutex(&gDvm.jniGlobalRefLock);
 
     dvmLockMutex(&gDvm.jniWeakGlobalRefLock);
     size_t weaks = gDvm.jniWeakGlobalRefTable.capacity();
     if (weaks > 0) {
         dvmPrintDebugMessage(target, " (plus %d weak)", weaks);
     }
+    u8 holeScanSteps = gDvm.jniWeakGlobalRefTable.holeScanSteps();
     dvmUnlockMutex(&gDvm.jniWeakGlobalRefLock);
 
+    /* The other threads' counts may be a little behind; it doesn't matter. */
+    dvmLockThreadList(dvmThreadSelf());
+    for (Thread* thread = gDvm.threadList; thread != NULL; thread = thread->next) {
+        holeScanSteps += thread->jniLocalRefTable.holeScanSteps();
+    }
+    dvmUnlockThreadList();
+    dvmPrintDebugMessage(target, "; hole scan steps=%llu", holeScanSteps);
+
     dvmPrintDebugMessage(target, "\n\n");
 }
 
@@ -695,7 +767,7 @@ static void dumpCandidateMethods(ClassObject* clazz, const char* methodName, con
     ALOGE("ERROR: couldn't find native method");
     ALOGE("Requested: %s.%s:%s", clazz->descriptor, methodName, signature);
     dumpMethods(clazz->virtualMethods, clazz->virtualMethodCount, methodName);
-    dumpMethods(clazz->directMethods, clazz->directMethodCount, methodName);
+    dumpMethods(dvmGetDirectMethods(clazz), clazz->directMethodCount, methodName);
 }
 
 static void throwNoSuchMethodError(ClassObject* c, const char* name, const char* sig, const char* kind) {
@@ -714,7 +786,8 @@ static bool dvmRegisterJNIMethod(ClassObject* clazz, const char* methodName,
     }
 
     // If a signature starts with a '!', we take that as a sign that the native code doesn't
-    // need the extra JNI arguments (the JNIEnv* and the jclass).
+    // need the extra JNI arguments (the JNIEnv* and the jclass), and that it neither blocks
+    // nor calls back into the VM, so it can run without leaving THREAD_RUNNING.
     bool fastJni = false;
     if (*signature == '!') {
         fastJni = true;
@@ -816,6 +889,8 @@ void dvmUseJNIBridge(Method* method, void* func) {
         }
     }
 
+    method->jniCallStub = dvmFindJniCallStub(method->shorty);
+
     DalvikBridgeFunc bridge = gDvmJni.useCheckJni ? dvmCheckCallJNIMethod : dvmCallJNIMethod;
     dvmSetNativeFunc(method, bridge, (const u2*) func);
 }
@@ -1090,6 +1165,11 @@ static inline void convertReferenceResult(JNIEnv* env, JValue* pResult,
 
 /*
  * General form, handles all cases.
+ *
+ * A fast JNI method is called without leaving THREAD_RUNNING, so no
+ * suspension checks are made on the way in or out, and its jclass is not
+ * a valid reference.  The GC and anything else that suspends all threads wait for
+ * it to return, which is why it must not block.
  */
 void dvmCallJNIMethod(const u4* args, JValue* pResult, const Method* method, Thread* self) {
     u4* modArgs = (u4*) args;
@@ -1109,8 +1189,16 @@ void dvmCallJNIMethod(const u4* args, JValue* pResult, const Method* method, Thr
     Object* lockObj;
     if ((accessFlags & ACC_STATIC) != 0) {
         lockObj = (Object*) method->clazz;
-        /* add the class object we pass in */
-        staticMethodClass = (jclass) addLocalReference(self, (Object*) method->clazz);
+        /*
+         * Add the class object we pass in.  A fast method doesn't look at
+         * it, so it gets the bare pointer: dvmPlatformInvoke needs a
+         * non-NULL class to know the method is static.
+         */
+        if (LIKELY(!method->fastJni)) {
+            staticMethodClass = (jclass) addLocalReference(self, (Object*) method->clazz);
+        } else {
+            staticMethodClass = (jclass) method->clazz;
+        }
     } else {
         lockObj = (Object*) args[0];
         /* add "this" */
@@ -1146,20 +1234,36 @@ void dvmCallJNIMethod(const u4* args, JValue* pResult, const Method* method, Thr
         dvmLockObject(self, lockObj);
     }
 
-    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_NATIVE);
+    bool fastJni = method->fastJni;
+    ThreadStatus oldStatus = THREAD_RUNNING;
+    if (LIKELY(!fastJni)) {
+        oldStatus = dvmChangeStatus(self, THREAD_NATIVE);
+    }
 
     ANDROID_MEMBAR_FULL();      /* guarantee ordering on method->insns */
     assert(method->insns != NULL);
 
     JNIEnv* env = self->jniEnv;
     COMPUTE_STACK_SUM(self);
-    dvmPlatformInvoke(env,
-            (ClassObject*) staticMethodClass,
-            method->jniArgInfo, method->insSize, modArgs, method->shorty,
-            (void*) method->insns, pResult);
+    if (method->jniCallStub != NULL) {
+        if (staticMethodClass != NULL) {
+            (*method->jniCallStub)(env, staticMethodClass, modArgs,
+                    (void*) method->insns, pResult);
+        } else {
+            (*method->jniCallStub)(env, (void*) modArgs[0], modArgs + 1,
+                    (void*) method->insns, pResult);
+        }
+    } else {
+        dvmPlatformInvoke(env,
+                (ClassObject*) staticMethodClass,
+                method->jniArgInfo, method->insSize, modArgs, method->shorty,
+                (void*) method->insns, pResult);
+    }
     CHECK_STACK_SUM(self);
 
-    dvmChangeStatus(self, oldStatus);
+    if (LIKELY(!fastJni)) {
+        dvmChangeStatus(self, oldStatus);
+    }
 
     convertReferenceResult(env, pResult, method, self);
 
@@ -1449,7 +1553,7 @@ static jobject PopLocalFrame(JNIEnv* env, jobject jresult) {
 static jobject NewGlobalRef(JNIEnv* env, jobject jobj) {
     ScopedJniThreadState ts(env);
     Object* obj = dvmDecodeIndirectRef(ts.self(), jobj);
-    return addGlobalReference(obj);
+    return addGlobalReference(ts.self(), obj);
 }
 
 /*
@@ -2182,9 +2286,132 @@ static jsize GetStringUTFLength(JNIEnv* env, jstring jstr) {
     return strObj->utfLength();
 }
 
+/*
+ * The modified UTF-8 of the ASCII strings GetStringUTFChars was last
+ * asked for, so converting the same string again returns the same
+ * buffer instead of a new copy.  Only strings of 1..0x7f chars are
+ * cached, as their modified UTF-8 is just their chars as bytes.
+ *
+ * A slot is picked by the string's hash code, which stays put when a
+ * compaction moves the string, and holds a weak reference to it.
+ * "pins" counts the GetStringUTFChars calls not yet released; a pinned
+ * slot is never given to another string.  The GC clears the slots of
+ * dead strings in the remark pause, and a compaction forwards them,
+ * both with every thread that could hold the lock suspended.
+ */
+#define kUtfCacheSize               512         /* must be a power of 2 */
+#define kUtfCacheMaxLength          256
+
+struct UtfCacheEntry {
+    StringObject* str;
+    char* utf;
+    int pins;
+};
+
+static UtfCacheEntry gUtfCache[kUtfCacheSize];
+static pthread_mutex_t gUtfCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static UtfCacheEntry* utfCacheEntry(StringObject* strObj) {
+    return &gUtfCache[dvmComputeStringHash(strObj) & (kUtfCacheSize - 1)];
+}
+
+/*
+ * Returns a new copy of the chars of "strObj" if they are all ASCII,
+ * or NULL.
+ */
+static char* createAsciiCstr(const StringObject* strObj) {
+    int len = strObj->length();
+    if (len > kUtfCacheMaxLength) {
+        return NULL;
+    }
+    const u2* chars = strObj->chars();
+    for (int i = 0; i < len; i++) {
+        if (chars[i] == 0 || chars[i] > 0x7f) {
+            return NULL;
+        }
+    }
+    char* utf = (char*) malloc(len + 1);
+    if (utf != NULL) {
+        for (int i = 0; i < len; i++) {
+            utf[i] = (char) chars[i];
+        }
+        utf[len] = '\0';
+    }
+    return utf;
+}
+
+/*
+ * Returns the cached modified UTF-8 of "strObj", caching it first if the
+ * string is ASCII and its slot is free, or NULL.
+ */
+static const char* getCachedUtf(StringObject* strObj) {
+    UtfCacheEntry* pEntry = utfCacheEntry(strObj);
+    ScopedPthreadMutexLock lock(&gUtfCacheLock);
+    if (pEntry->str == strObj) {
+        pEntry->pins++;
+        return pEntry->utf;
+    }
+    if (pEntry->pins != 0) {
+        return NULL;
+    }
+    char* utf = createAsciiCstr(strObj);
+    if (utf == NULL) {
+        return NULL;
+    }
+    free(pEntry->utf);
+    pEntry->str = strObj;
+    pEntry->utf = utf;
+    pEntry->pins = 1;
+    return utf;
+}
+
+/*
+ * Unpins "utf" if it is the cached modified UTF-8 of "strObj".  Returns
+ * false if it is a copy of its own.
+ */
+static bool releaseCachedUtf(StringObject* strObj, const char* utf) {
+    UtfCacheEntry* pEntry = utfCacheEntry(strObj);
+    ScopedPthreadMutexLock lock(&gUtfCacheLock);
+    if (pEntry->str != strObj || pEntry->utf != utf) {
+        return false;
+    }
+    assert(pEntry->pins > 0);
+    pEntry->pins--;
+    return true;
+}
+
+/*
+ * A string only dies with its chars pinned if native code let go of it
+ * before releasing them.  Its slot is freed without the buffer, which
+ * ReleaseStringUTFChars will then take for a copy and free.
+ */
+void dvmSweepJniUtfCache(int (*isUnmarkedObject)(void*)) {
+    for (int i = 0; i < kUtfCacheSize; i++) {
+        UtfCacheEntry* pEntry = &gUtfCache[i];
+        if (pEntry->str != NULL && isUnmarkedObject(pEntry->str)) {
+            if (pEntry->pins == 0) {
+                free(pEntry->utf);
+            }
+            pEntry->str = NULL;
+            pEntry->utf = NULL;
+            pEntry->pins = 0;
+        }
+    }
+}
+
+void dvmVisitJniUtfCache(void (*visitor)(void* addr, void* arg), void* arg) {
+    for (int i = 0; i < kUtfCacheSize; i++) {
+        if (gUtfCache[i].str != NULL) {
+            (*visitor)(&gUtfCache[i].str, arg);
+        }
+    }
+}
+
 /*
  * Convert "string" to modified UTF-8 and return a pointer.  The returned
- * value must be released with ReleaseStringUTFChars.
+ * value must be released with ReleaseStringUTFChars.  ASCII strings are
+ * converted once and then handed out from the cache above, with
+ * *isCopy set to JNI_FALSE.
  *
  * According to the JNI reference, "Returns a pointer to a UTF-8 string,
  * or NULL if the operation fails. Returns NULL if and only if an invocation
@@ -2202,10 +2429,17 @@ static const char* GetStringUTFChars(JNIEnv* env, jstring jstr, jboolean* isCopy
         /* this shouldn't happen; throw NPE? */
         return NULL;
     }
+    StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
+    const char* cached = getCachedUtf(strObj);
+    if (cached != NULL) {
+        if (isCopy != NULL) {
+            *isCopy = JNI_FALSE;
+        }
+        return cached;
+    }
     if (isCopy != NULL) {
         *isCopy = JNI_TRUE;
     }
-    StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
     char* newStr = dvmCreateCstrFromString(strObj);
     if (newStr == NULL) {
         /* assume memory failure */
@@ -2219,6 +2453,10 @@ static const char* GetStringUTFChars(JNIEnv* env, jstring jstr, jboolean* isCopy
  */
 static void ReleaseStringUTFChars(JNIEnv* env, jstring jstr, const char* utf) {
     ScopedJniThreadState ts(env);
+    StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
+    if (strObj != NULL && releaseCachedUtf(strObj, utf)) {
+        return;
+    }
     free((char*) utf);
 }
 
@@ -3484,6 +3722,17 @@ jint JNI_CreateJavaVM(JavaVM** p_vm, JNIEnv** p_env, void* vm_args) {
                     gDvmJni.forceCopy = true;
                 } else if (strcmp(jniOpt, "logThirdPartyJni") == 0) {
                     gDvmJni.logThirdPartyJni = true;
+                } else if (strncmp(jniOpt, "sample=", 7) == 0) {
+                    char* end;
+                    long sample = strtol(jniOpt + 7, &end, 10);
+                    if (end == jniOpt + 7 || *end != '\0' || sample < 1) {
+                        dvmFprintf(stderr, "ERROR: CreateJavaVM failed: bad -Xjniopts sample '%s'\n",
+                                jniOpt + 7);
+                        free(pVM);
+                        free(jniOpts);
+                        return JNI_ERR;
+                    }
+                    gDvmJni.checkSample = sample;
                 } else {
                     dvmFprintf(stderr, "ERROR: CreateJavaVM failed: unknown -Xjniopts option '%s'\n",
                             jniOpt);
@@ -3494,6 +3743,12 @@ jint JNI_CreateJavaVM(JavaVM** p_vm, JNIEnv** p_env, void* vm_args) {
                 jniOpt += strlen(jniOpt) + 1;
             }
             free(jniOpts);
+            if (gDvmJni.checkSample > 1 && gDvmJni.forceCopy) {
+                // A guarded copy has to be released as one, so copying can't be sampled.
+                dvmFprintf(stderr, "WARNING: -Xjniopts:forcecopy ignored with sample=%d\n",
+                        gDvmJni.checkSample);
+                gDvmJni.forceCopy = false;
+            }
         } else {
             /* regular option */
             argv[argc++] = optStr;
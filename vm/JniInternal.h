@@ -45,6 +45,9 @@ struct JNIEnvExt {
     /* if nonzero, we are in a "critical" JNI call */
     int     critical;
 
+    /* calls until CheckJNI next checks arguments, with sampling */
+    int     checkCountdown;
+
     struct JNIEnvExt* prev;
     struct JNIEnvExt* next;
 };
@@ -59,6 +62,15 @@ struct JavaVMExt {
     pthread_mutex_t envListLock;
 };
 
+/*
+ * An entry in gDvm.jniPinTable.  The array doesn't move while it's
+ * pinned, so its address serves as the hash.
+ */
+struct JniPinEntry {
+    Object* obj;
+    int     count;
+};
+
 /*
  * Native function return type; used by dvmPlatformInvoke().
  *
@@ -164,6 +176,19 @@ void dvmReleaseJniMonitors(Thread* self);
  */
 void dvmDumpJniReferenceTables(void);
 
+/*
+ * Clear the GetStringUTFChars cache entries of dead strings.  Called by
+ * the GC with the world stopped.
+ */
+void dvmSweepJniUtfCache(int (*isUnmarkedObject)(void*));
+
+/*
+ * Pass the address of each string reference in the GetStringUTFChars
+ * cache to "visitor", so a compaction can forward it.  Called with the
+ * world stopped.
+ */
+void dvmVisitJniUtfCache(void (*visitor)(void* addr, void* arg), void* arg);
+
 // Dumps JNI statistics in response to SIGQUIT.
 struct DebugOutputTarget;
 void dvmDumpJniStats(DebugOutputTarget* target);
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Call stubs for JNI methods with the most common shorties.
+ *
+ * dvmPlatformInvoke works out where each argument goes from the shorty
+ * and the method's hints on every call (with libffi it even builds a new
+ * call interface each time).  A stub instead calls the native function
+ * through a pointer of the exact C type, so the compiler has done that
+ * work once, and the C calling convention is followed to the letter.
+ *
+ * Arguments of type boolean, byte, char and short are passed as jint,
+ * which the interpreter has already extended the way Java does.  Return
+ * types that are narrower than an int, other than boolean, are rare and
+ * are left to dvmPlatformInvoke.
+ */
+#include "Dalvik.h"
+
+namespace {
+
+/*
+ * One-letter names for the types, so that the table below can be written
+ * in shorty form.
+ */
+typedef void V;
+typedef jboolean Z;
+typedef jint I;
+typedef jlong J;
+typedef jfloat F;
+typedef jdouble D;
+typedef jobject L;
+
+/*
+ * Fetch the next argument from "args" and step past it.  Wide values
+ * take two slots, and are stored the same way the interpreter stores
+ * them in registers.
+ */
+template <typename T> T fetch(const u4*& args);
+
+template <> inline jint fetch<jint>(const u4*& args) {
+    return (jint) *args++;
+}
+
+template <> inline jobject fetch<jobject>(const u4*& args) {
+    return (jobject) *args++;
+}
+
+template <> inline jfloat fetch<jfloat>(const u4*& args) {
+    jfloat value;
+    memcpy(&value, args++, sizeof(value));
+    return value;
+}
+
+template <> inline jlong fetch<jlong>(const u4*& args) {
+    jlong value;
+    memcpy(&value, args, sizeof(value));
+    args += 2;
+    return value;
+}
+
+template <> inline jdouble fetch<jdouble>(const u4*& args) {
+    jdouble value;
+    memcpy(&value, args, sizeof(value));
+    args += 2;
+    return value;
+}
+
+inline void store(JValue* pResult, jboolean value) { pResult->i = value; }
+inline void store(JValue* pResult, jint value) { pResult->i = value; }
+inline void store(JValue* pResult, jlong value) { pResult->j = value; }
+inline void store(JValue* pResult, jfloat value) { pResult->f = value; }
+inline void store(JValue* pResult, jdouble value) { pResult->d = value; }
+inline void store(JValue* pResult, jobject value) { pResult->l = (Object*) value; }
+
+/*
+ * The arguments are fetched into locals first, because the order in
+ * which function arguments are evaluated is unspecified.
+ */
+template <typename R>
+struct Stub {
+    static void call0(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef R (*Func)(JNIEnv*, void*);
+        store(pResult, ((Func) func)(env, arg1));
+    }
+
+    template <typename A0>
+    static void call1(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef R (*Func)(JNIEnv*, void*, A0);
+        A0 a0 = fetch<A0>(args);
+        store(pResult, ((Func) func)(env, arg1, a0));
+    }
+
+    template <typename A0, typename A1>
+    static void call2(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef R (*Func)(JNIEnv*, void*, A0, A1);
+        A0 a0 = fetch<A0>(args);
+        A1 a1 = fetch<A1>(args);
+        store(pResult, ((Func) func)(env, arg1, a0, a1));
+    }
+
+    template <typename A0, typename A1, typename A2>
+    static void call3(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef R (*Func)(JNIEnv*, void*, A0, A1, A2);
+        A0 a0 = fetch<A0>(args);
+        A1 a1 = fetch<A1>(args);
+        A2 a2 = fetch<A2>(args);
+        store(pResult, ((Func) func)(env, arg1, a0, a1, a2));
+    }
+};
+
+template <>
+struct Stub<void> {
+    static void call0(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef void (*Func)(JNIEnv*, void*);
+        ((Func) func)(env, arg1);
+    }
+
+    template <typename A0>
+    static void call1(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef void (*Func)(JNIEnv*, void*, A0);
+        A0 a0 = fetch<A0>(args);
+        ((Func) func)(env, arg1, a0);
+    }
+
+    template <typename A0, typename A1>
+    static void call2(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef void (*Func)(JNIEnv*, void*, A0, A1);
+        A0 a0 = fetch<A0>(args);
+        A1 a1 = fetch<A1>(args);
+        ((Func) func)(env, arg1, a0, a1);
+    }
+
+    template <typename A0, typename A1, typename A2>
+    static void call3(JNIEnv* env, void* arg1, const u4* args, void* func,
+            JValue* pResult) {
+        typedef void (*Func)(JNIEnv*, void*, A0, A1, A2);
+        A0 a0 = fetch<A0>(args);
+        A1 a1 = fetch<A1>(args);
+        A2 a2 = fetch<A2>(args);
+        ((Func) func)(env, arg1, a0, a1, a2);
+    }
+};
+
+struct StubEntry {
+    const char* shorty;
+    JniCallStub stub;
+};
+
+#define STUB0(r)            { #r, &Stub<r>::call0 }
+#define STUB1(r, a)         { #r #a, &Stub<r>::call1<a> }
+#define STUB2(r, a, b)      { #r #a #b, &Stub<r>::call2<a, b> }
+#define STUB3(r, a, b, c)   { #r #a #b #c, &Stub<r>::call3<a, b, c> }
+
+/*
+ * The shorties that get a stub, with every argument of type boolean,
+ * byte, char or short written as I.  Methods with more arguments pay for
+ * the marshalling in proportion anyway.
+ */
+const StubEntry kStubs[] = {
+    STUB0(V), STUB0(Z), STUB0(I), STUB0(J), STUB0(F), STUB0(D), STUB0(L),
+
+    STUB1(V, I), STUB1(V, J), STUB1(V, L),
+    STUB1(Z, I), STUB1(Z, J), STUB1(Z, L),
+    STUB1(I, I), STUB1(I, J), STUB1(I, L),
+    STUB1(J, I), STUB1(J, J), STUB1(J, L),
+    STUB1(L, I), STUB1(L, J), STUB1(L, L),
+    STUB1(F, F), STUB1(D, D),
+
+    STUB2(V, I, I), STUB2(V, I, L), STUB2(V, L, I), STUB2(V, L, L),
+    STUB2(V, J, I), STUB2(V, J, J), STUB2(V, J, L), STUB2(V, L, J),
+    STUB2(Z, I, I), STUB2(Z, L, I), STUB2(Z, L, L), STUB2(Z, J, J),
+    STUB2(Z, J, L),
+    STUB2(I, I, I), STUB2(I, I, L), STUB2(I, L, I), STUB2(I, L, L),
+    STUB2(I, J, I), STUB2(I, J, J), STUB2(I, J, L),
+    STUB2(J, I, I), STUB2(J, J, I), STUB2(J, J, J), STUB2(J, J, L),
+    STUB2(J, L, I), STUB2(J, L, L),
+    STUB2(L, I, I), STUB2(L, L, I), STUB2(L, L, L), STUB2(L, J, I),
+    STUB2(L, J, L),
+    STUB2(F, F, F), STUB2(D, D, D),
+
+    STUB3(V, I, I, I), STUB3(V, L, I, I), STUB3(V, L, L, L),
+    STUB3(V, J, I, I), STUB3(V, J, J, J), STUB3(V, J, L, I),
+    STUB3(Z, L, L, L), STUB3(Z, J, I, I),
+    STUB3(I, I, I, I), STUB3(I, L, I, I), STUB3(I, L, L, L),
+    STUB3(I, J, I, I), STUB3(I, J, L, I), STUB3(I, J, J, J),
+    STUB3(J, J, I, I), STUB3(J, J, J, J), STUB3(J, L, I, I),
+    STUB3(L, L, I, I), STUB3(L, L, L, L), STUB3(L, J, I, I),
+};
+
+#undef STUB0
+#undef STUB1
+#undef STUB2
+#undef STUB3
+
+}  // namespace
+
+JniCallStub dvmFindJniCallStub(const char* shorty)
+{
+    /* Fold the narrow argument types into I; see kStubs. */
+    char key[5];
+    size_t len = strlen(shorty);
+    if (len > sizeof(key) - 1) {
+        return NULL;
+    }
+    key[0] = shorty[0];
+    for (size_t i = 1; i < len; i++) {
+        switch (shorty[i]) {
+        case 'Z': case 'B': case 'C': case 'S':
+            key[i] = 'I';
+            break;
+        default:
+            key[i] = shorty[i];
+            break;
+        }
+    }
+    key[len] = '\0';
+
+    for (int i = 0; i < NELEM(kStubs); i++) {
+        if (strcmp(kStubs[i].shorty, key) == 0) {
+            return kStubs[i].stub;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cache of decoded line number tables.
+ *
+ * Every stack trace element, lock contention event and debugger line
+ * table request used to decode the method's debug info stream from the
+ * start.  Services that build lots of stack traces hit the same few
+ * methods over and over, so the position table of each method is
+ * decoded once into a sorted array of (address, line) pairs and kept
+ * here, keyed by Method.
+ *
+ * The tables are held in a hash table, whose lock guards the whole
+ * cache, and on a list in least-recently-used order.  When the tables
+ * add up to more than the budget (-XX:LineTableCacheSize), the least
+ * recently used ones are freed.  Methods are never unloaded, so a table
+ * only goes away through eviction or shutdown.
+ */
+#include "Dalvik.h"
+
+struct LineTable {
+    const Method*   method;
+    LineTable*      prev;           /* toward most recently used */
+    LineTable*      next;           /* toward least recently used */
+    size_t          size;           /* bytes, including this header */
+    u4              numEntries;
+    LineTableEntry  entries[1];
+};
+
+struct LineTableCache {
+    HashTable*      tables;         /* LineTable*, keyed by method */
+    LineTable*      mostRecent;
+    LineTable*      leastRecent;
+    size_t          totalSize;
+    size_t          budget;
+
+    /* stats */
+    u4              hits;
+    u4              misses;
+    u4              evictions;
+};
+
+static inline u4 methodHash(const Method* method)
+{
+    return (u4) ((uintptr_t) method >> 3);
+}
+
+static int compareMethod(const void* tableItem, const void* looseItem)
+{
+    const LineTable* table = (const LineTable*) tableItem;
+    const LineTable* key = (const LineTable*) looseItem;
+    return (table->method == key->method) ? 0 : 1;
+}
+
+bool dvmLineTableStartup()
+{
+    LineTableCache* pCache = (LineTableCache*) calloc(1, sizeof(*pCache));
+    if (pCache == NULL)
+        return false;
+
+    pCache->tables = dvmHashTableCreateRobinHood(dvmHashSize(256), free);
+    if (pCache->tables == NULL) {
+        free(pCache);
+        return false;
+    }
+    pCache->budget = gDvm.lineTableCacheSize;
+
+    gDvm.lineTableCache = pCache;
+    return true;
+}
+
+void dvmLineTableShutdown()
+{
+    LineTableCache* pCache = gDvm.lineTableCache;
+
+    if (pCache == NULL)
+        return;
+
+    dvmHashTableFree(pCache->tables);      /* frees the tables too */
+    free(pCache);
+    gDvm.lineTableCache = NULL;
+}
+
+/*
+ * Unlink "table" from the LRU list.
+ */
+static void unlinkTable(LineTableCache* pCache, LineTable* table)
+{
+    if (table->prev != NULL)
+        table->prev->next = table->next;
+    else
+        pCache->mostRecent = table->next;
+    if (table->next != NULL)
+        table->next->prev = table->prev;
+    else
+        pCache->leastRecent = table->prev;
+    table->prev = table->next = NULL;
+}
+
+/*
+ * Put "table" at the most recently used end of the LRU list.
+ */
+static void pushTable(LineTableCache* pCache, LineTable* table)
+{
+    table->prev = NULL;
+    table->next = pCache->mostRecent;
+    if (pCache->mostRecent != NULL)
+        pCache->mostRecent->prev = table;
+    else
+        pCache->leastRecent = table;
+    pCache->mostRecent = table;
+}
+
+/*
+ * Free least recently used tables until we're back under budget.  The
+ * most recently used table is always kept, whatever its size.
+ */
+static void trimCache(LineTableCache* pCache)
+{
+    while (pCache->totalSize > pCache->budget &&
+           pCache->leastRecent != pCache->mostRecent)
+    {
+        LineTable* victim = pCache->leastRecent;
+
+        unlinkTable(pCache, victim);
+        dvmHashTableRemove(pCache->tables, methodHash(victim->method), victim);
+        pCache->totalSize -= victim->size;
+        pCache->evictions++;
+        free(victim);
+    }
+}
+
+/*
+ * Context for decoding a method's position table.  We grow the array
+ * as entries arrive.
+ */
+struct DecodeContext {
+    LineTableEntry* entries;
+    u4              numEntries;
+    u4              capacity;
+    bool            failed;
+};
+
+static int decodePositionCb(void* cnxt, u4 address, u4 lineNum)
+{
+    DecodeContext* pContext = (DecodeContext*) cnxt;
+
+    if (pContext->numEntries == pContext->capacity) {
+        u4 newCapacity = (pContext->capacity == 0) ? 16 : pContext->capacity * 2;
+        LineTableEntry* newEntries = (LineTableEntry*)
+            realloc(pContext->entries, newCapacity * sizeof(LineTableEntry));
+        if (newEntries == NULL) {
+            pContext->failed = true;
+            return 1;
+        }
+        pContext->entries = newEntries;
+        pContext->capacity = newCapacity;
+    }
+
+    pContext->entries[pContext->numEntries].address = address;
+    pContext->entries[pContext->numEntries].lineNum = lineNum;
+    pContext->numEntries++;
+    return 0;
+}
+
+/*
+ * Decode the method's position table into a new LineTable.  Returns NULL
+ * if we run out of memory.
+ *
+ * The debug info stream only ever advances the address, so the entries
+ * come out sorted.
+ */
+static LineTable* decodeLineTable(const Method* method)
+{
+    DecodeContext context;
+    memset(&context, 0, sizeof(context));
+
+    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile,
+            dvmGetMethodCode(method),
+            method->clazz->descriptor,
+            method->prototype.protoIdx,
+            method->accessFlags,
+            decodePositionCb, NULL, &context);
+
+    LineTable* table = NULL;
+    if (!context.failed) {
+        size_t size = offsetof(LineTable, entries) +
+            context.numEntries * sizeof(LineTableEntry);
+        table = (LineTable*) malloc(size);
+        if (table != NULL) {
+            table->method = method;
+            table->prev = table->next = NULL;
+            table->size = size;
+            table->numEntries = context.numEntries;
+            if (context.numEntries != 0) {
+                memcpy(table->entries, context.entries,
+                    context.numEntries * sizeof(LineTableEntry));
+            }
+        }
+    }
+
+    free(context.entries);
+    return table;
+}
+
+/*
+ * Find the method's table, decoding it if it isn't cached, and make it
+ * the most recently used.  The cache must be locked; it's unlocked while
+ * decoding.  Returns NULL if we run out of memory.
+ */
+static LineTable* getLineTable(LineTableCache* pCache, const Method* method)
+{
+    LineTable key;
+    key.method = method;
+    u4 hash = methodHash(method);
+
+    LineTable* table = (LineTable*)
+        dvmHashTableLookup(pCache->tables, hash, &key, compareMethod, false);
+    if (table != NULL) {
+        pCache->hits++;
+        if (table != pCache->mostRecent) {
+            unlinkTable(pCache, table);
+            pushTable(pCache, table);
+        }
+        return table;
+    }
+    pCache->misses++;
+
+    dvmHashTableUnlock(pCache->tables);
+    LineTable* newTable = decodeLineTable(method);
+    dvmHashTableLock(pCache->tables);
+
+    if (newTable == NULL)
+        return NULL;
+
+    table = (LineTable*)
+        dvmHashTableLookup(pCache->tables, hash, newTable, compareMethod, true);
+    if (table != newTable) {
+        /* another thread got there first; use theirs */
+        free(newTable);
+        if (table != pCache->mostRecent) {
+            unlinkTable(pCache, table);
+            pushTable(pCache, table);
+        }
+        return table;
+    }
+
+    pushTable(pCache, table);
+    pCache->totalSize += table->size;
+    trimCache(pCache);
+    return table;
+}
+
+/*
+ * Find the line for "relPc" the way lineNumForPcCb does over the raw
+ * stream: the first entry at exactly that address, or else the last
+ * entry before it.
+ */
+static int findLine(const LineTable* table, u4 relPc)
+{
+    int lo = 0;
+    int hi = table->numEntries;
+
+    /* find the first entry with address >= relPc */
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (table->entries[mid].address < relPc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < (int) table->numEntries && table->entries[lo].address == relPc)
+        return table->entries[lo].lineNum;
+    if (lo > 0)
+        return table->entries[lo - 1].lineNum;
+    return -1;
+}
+
+/*
+ * Walk the position table straight from the debug info, for when there's
+ * no cache or no memory for a table.
+ */
+static void visitUncached(const Method* method, DexDebugNewPositionCb posCb,
+    void* cnxt)
+{
+    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile,
+            dvmGetMethodCode(method),
+            method->clazz->descriptor,
+            method->prototype.protoIdx,
+            method->accessFlags,
+            posCb, NULL, cnxt);
+}
+
+struct LookupContext {
+    u4      address;
+    int     lineNum;
+};
+
+static int lookupPositionCb(void* cnxt, u4 address, u4 lineNum)
+{
+    LookupContext* pContext = (LookupContext*) cnxt;
+
+    /* entries arrive in ascending address order */
+    if (address > pContext->address)
+        return 1;
+    pContext->lineNum = lineNum;
+    return (address == pContext->address) ? 1 : 0;
+}
+
+int dvmLineTableLookup(const Method* method, u4 relPc)
+{
+    LineTableCache* pCache = gDvm.lineTableCache;
+
+    assert(dvmGetMethodCode(method) != NULL);
+
+    if (pCache != NULL) {
+        dvmHashTableLock(pCache->tables);
+        LineTable* table = getLineTable(pCache, method);
+        if (table != NULL) {
+            int lineNum = findLine(table, relPc);
+            dvmHashTableUnlock(pCache->tables);
+            return lineNum;
+        }
+        dvmHashTableUnlock(pCache->tables);
+    }
+
+    LookupContext context = { relPc, -1 };
+    visitUncached(method, lookupPositionCb, &context);
+    return context.lineNum;
+}
+
+void dvmLineTableVisit(const Method* method, DexDebugNewPositionCb posCb,
+    void* cnxt)
+{
+    LineTableCache* pCache = gDvm.lineTableCache;
+
+    if (dvmGetMethodCode(method) == NULL)
+        return;
+
+    if (pCache != NULL) {
+        dvmHashTableLock(pCache->tables);
+        LineTable* table = getLineTable(pCache, method);
+        if (table != NULL) {
+            for (u4 i = 0; i < table->numEntries; i++) {
+                if ((*posCb)(cnxt, table->entries[i].address,
+                        table->entries[i].lineNum) != 0)
+                    break;
+            }
+            dvmHashTableUnlock(pCache->tables);
+            return;
+        }
+        dvmHashTableUnlock(pCache->tables);
+    }
+
+    visitUncached(method, posCb, cnxt);
+}
+
+void dvmLineTableDumpStats()
+{
+    LineTableCache* pCache = gDvm.lineTableCache;
+
+    if (pCache == NULL)
+        return;
+
+    dvmHashTableLock(pCache->tables);
+    ALOGI("Line table cache: %d tables, %zd of %zd bytes; "
+          "hits=%u misses=%u evictions=%u",
+        dvmHashTableNumEntries(pCache->tables), pCache->totalSize,
+        pCache->budget, pCache->hits, pCache->misses, pCache->evictions);
+    dvmHashTableUnlock(pCache->tables);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Cache of decoded per-method line number tables.
+ */
+#ifndef DALVIK_LINETABLE_H_
+#define DALVIK_LINETABLE_H_
+
+/*
+ * Default limit on the memory held by the cache, in bytes.
+ */
+#define kLineTableCacheDefaultBudget (256 * 1024)
+
+/*
+ * One entry from the position table of a method's debug info.
+ */
+struct LineTableEntry {
+    u4          address;    /* in 16-bit code units from method start */
+    u4          lineNum;
+};
+
+bool dvmLineTableStartup(void);
+void dvmLineTableShutdown(void);
+
+/*
+ * Return the source line number for "relPc" in "method", which must have
+ * code, or -1 if there's no line information for it.  Same result as
+ * walking the position table with dexDecodeDebugInfo().
+ */
+int dvmLineTableLookup(const Method* method, u4 relPc);
+
+/*
+ * Call "posCb" on each entry of the method's line table in address
+ * order, stopping if it returns nonzero -- the same calls that
+ * dexDecodeDebugInfo() makes, from the cached table.  The cache is locked
+ * during the calls, so "posCb" mustn't suspend or call back into the
+ * cache.
+ */
+void dvmLineTableVisit(const Method* method, DexDebugNewPositionCb posCb,
+    void* cnxt);
+
+/*
+ * Write cache usage to the log.
+ */
+void dvmLineTableDumpStats(void);
+
+#endif  // DALVIK_LINETABLE_H_
@@ -63,6 +63,17 @@ loader, which is never unloaded (until the VM shuts down).
 
 Because the memory is not expected to be updated, we can use mprotect to
 guard the pages on debug builds.  Handy when tracking down corruption.
+
+To keep threads that load classes in parallel from queueing up on the
+lock, each thread carves a chunk out of the region and bump-allocates
+small blocks from it without locking.  The unused tail of a chunk is
+always a single block marked free, so the region can still be walked
+from one length word to the next.  (Not done for ENFORCE_READ_ONLY,
+which needs the lock for its page reference counts anyway.)
+
+When a region fills up we map another one rather than abort, and keep
+the old one around; blocks never move.  Allocation counts are kept for
+each class loader, to see who is using the space.
 */
 
 /* alignment for allocations; must be power of 2, and currently >= hdr_xtra */
@@ -71,6 +82,13 @@ guard the pages on debug builds.  Handy when tracking down corruption.
 /* default length of memory segment (worst case is probably "dexopt") */
 #define DEFAULT_MAX_LENGTH  (16*1024*1024)
 
+/* length of the regions mapped after the first one fills up */
+#define GROW_LENGTH         (4*1024*1024)
+
+/* size of a per-thread chunk, and largest block we take from one */
+#define CHUNK_LENGTH        (16*1024)
+#define CHUNK_MAX_ALLOC     (CHUNK_LENGTH / 8)
+
 /* leave enough space for a length word */
 #define HEADER_EXTRA        4
 
@@ -80,6 +98,15 @@ guard the pages on debug builds.  Handy when tracking down corruption.
 #define LENGTHFLAG_MASK    (~(LENGTHFLAG_FREE|LENGTHFLAG_RW))
 
 
+/*
+ * Allocations made on behalf of one class loader.
+ */
+struct LinearAllocLoaderStats {
+    const Object* classLoader;
+    u4      numAllocs;
+    u4      numBytes;
+};
+
 /* fwd */
 static void checkAllFree(Object* classLoader);
 
@@ -103,71 +130,76 @@ static inline u4* getBlockHeader(void* mem)
 }
 
 /*
- * Create a new linear allocation block.
+ * Compute where the block header after one of "size" bytes goes, given
+ * where this block's header goes.  That's past the header, the data, and
+ * room for the next header, rounded up to BLOCK_ALIGN and backed up to
+ * the header again.  Regions are page-aligned, so this works the same
+ * on offsets and addresses.
+ *
+ * Examples:
+ *   old=12 size=3 new=((12+(4*2)+3+7) & ~7)-4 = 24-4 --> 20
+ *   old=12 size=5 new=((12+(4*2)+5+7) & ~7)-4 = 32-4 --> 28
  */
-LinearAllocHdr* dvmLinearAllocCreate(Object* classLoader)
+static inline uintptr_t nextBlockStart(uintptr_t start, size_t size)
 {
-#ifdef DISABLE_LINEAR_ALLOC
-    return (LinearAllocHdr*) 0x12345;
-#endif
-    LinearAllocHdr* pHdr;
-
-    pHdr = (LinearAllocHdr*) malloc(sizeof(*pHdr));
-
+    return ((start + HEADER_EXTRA*2 + size + (BLOCK_ALIGN-1))
+                & ~(BLOCK_ALIGN-1)) - HEADER_EXTRA;
+}
 
-    /*
-     * "curOffset" points to the location of the next pre-block header,
-     * which means we have to advance to the next BLOCK_ALIGN address and
-     * back up.
-     *
-     * Note we leave the first page empty (see below), and start the
-     * first entry on the second page at an offset that ensures the next
-     * chunk of data will be properly aligned.
-     */
-    assert(BLOCK_ALIGN >= HEADER_EXTRA);
-    pHdr->curOffset = pHdr->firstOffset =
-        (BLOCK_ALIGN-HEADER_EXTRA) + SYSTEM_PAGE_SIZE;
-    pHdr->mapLength = DEFAULT_MAX_LENGTH;
+/*
+ * Map a region of "length" bytes and make it the one we allocate from.
+ * On failure the header is left alone.
+ */
+static bool mapRegion(LinearAllocHdr* pHdr, int length)
+{
+    char* mapAddr;
 
 #ifdef USE_ASHMEM
     int fd;
 
-    fd = ashmem_create_region("dalvik-LinearAlloc", DEFAULT_MAX_LENGTH);
+    fd = ashmem_create_region("dalvik-LinearAlloc", length);
     if (fd < 0) {
         ALOGE("ashmem LinearAlloc failed %s", strerror(errno));
-        free(pHdr);
-        return NULL;
+        return false;
     }
 
-    pHdr->mapAddr = (char*)mmap(NULL, pHdr->mapLength, PROT_READ | PROT_WRITE,
+    mapAddr = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
         MAP_PRIVATE, fd, 0);
-    if (pHdr->mapAddr == MAP_FAILED) {
-        ALOGE("LinearAlloc mmap(%d) failed: %s", pHdr->mapLength,
-            strerror(errno));
-        free(pHdr);
+    if (mapAddr == MAP_FAILED) {
+        ALOGE("LinearAlloc mmap(%d) failed: %s", length, strerror(errno));
         close(fd);
-        return NULL;
+        return false;
     }
 
     close(fd);
 #else /*USE_ASHMEM*/
     // MAP_ANON is listed as "deprecated" on Linux,
     // but MAP_ANONYMOUS is not defined under Mac OS X.
-    pHdr->mapAddr = mmap(NULL, pHdr->mapLength, PROT_READ | PROT_WRITE,
+    mapAddr = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
         MAP_PRIVATE | MAP_ANON, -1, 0);
-    if (pHdr->mapAddr == MAP_FAILED) {
-        ALOGE("LinearAlloc mmap(%d) failed: %s", pHdr->mapLength,
-            strerror(errno));
-        free(pHdr);
-        return NULL;
+    if (mapAddr == MAP_FAILED) {
+        ALOGE("LinearAlloc mmap(%d) failed: %s", length, strerror(errno));
+        return false;
     }
 #endif /*USE_ASHMEM*/
 
     /* region expected to begin on a page boundary */
-    assert(((int) pHdr->mapAddr & (SYSTEM_PAGE_SIZE-1)) == 0);
+    assert(((int) mapAddr & (SYSTEM_PAGE_SIZE-1)) == 0);
+
+    /*
+     * "curOffset" points to the location of the next pre-block header,
+     * which means we have to advance to the next BLOCK_ALIGN address and
+     * back up.
+     *
+     * Note we leave the first page empty (see below), and start the
+     * first entry on the second page at an offset that ensures the next
+     * chunk of data will be properly aligned.
+     */
+    assert(BLOCK_ALIGN >= HEADER_EXTRA);
+    int firstOffset = (BLOCK_ALIGN-HEADER_EXTRA) + SYSTEM_PAGE_SIZE;
 
     /* the system should initialize newly-mapped memory to zero */
-    assert(*(u4*) (pHdr->mapAddr + pHdr->curOffset) == 0);
+    assert(*(u4*) (mapAddr + firstOffset) == 0);
 
     /*
      * Disable access to all except starting page.  We will enable pages
@@ -186,15 +218,150 @@ LinearAllocHdr* dvmLinearAllocCreate(Object* classLoader)
      * stuff blends into the neighboring pages.  [TODO: do we still need
      * the extra page now that we have ashmem?]
      */
-    if (mprotect(pHdr->mapAddr, pHdr->mapLength, PROT_NONE) != 0) {
+    if (mprotect(mapAddr, length, PROT_NONE) != 0) {
         ALOGW("LinearAlloc init mprotect failed: %s", strerror(errno));
-        free(pHdr);
-        return NULL;
+        munmap(mapAddr, length);
+        return false;
     }
-    if (mprotect(pHdr->mapAddr + SYSTEM_PAGE_SIZE, SYSTEM_PAGE_SIZE,
+    if (mprotect(mapAddr + SYSTEM_PAGE_SIZE, SYSTEM_PAGE_SIZE,
             ENFORCE_READ_ONLY ? PROT_READ : PROT_READ|PROT_WRITE) != 0)
     {
         ALOGW("LinearAlloc init mprotect #2 failed: %s", strerror(errno));
+        munmap(mapAddr, length);
+        return false;
+    }
+
+    pHdr->mapAddr = mapAddr;
+    pHdr->mapLength = length;
+    pHdr->curOffset = pHdr->firstOffset = firstOffset;
+    return true;
+}
+
+/*
+ * The current region can't hold a block of "size" bytes.  Retire it and
+ * map a new one that can.  Called with the lock held.
+ */
+static bool growRegion(LinearAllocHdr* pHdr, size_t size)
+{
+    LinearAllocRegion* pFull;
+
+    pFull = (LinearAllocRegion*) malloc(sizeof(*pFull));
+    if (pFull == NULL)
+        return false;
+    pFull->mapAddr = pHdr->mapAddr;
+    pFull->mapLength = pHdr->mapLength;
+    pFull->firstOffset = pHdr->firstOffset;
+    pFull->curOffset = pHdr->curOffset;
+    pFull->next = pHdr->fullRegions;
+
+    /* leave room for the empty first page and a header at either end */
+    int length = GROW_LENGTH;
+    while ((size_t) length < SYSTEM_PAGE_SIZE + HEADER_EXTRA*2 + BLOCK_ALIGN
+            + size)
+    {
+        length *= 2;
+    }
+    if (!mapRegion(pHdr, length)) {
+        free(pFull);
+        return false;
+    }
+
+    pHdr->fullRegions = pFull;
+    pHdr->fullRegionsUsed += pFull->curOffset;
+
+    ALOGI("LinearAlloc region %p full (%d bytes), continuing in %p-%p",
+        pFull->mapAddr, pFull->curOffset,
+        pHdr->mapAddr, pHdr->mapAddr + pHdr->mapLength-1);
+    return true;
+}
+
+/*
+ * Is [start, start+length) in the in-use part of one of the regions?
+ */
+static bool inUseArea(const LinearAllocHdr* pHdr, const void* start,
+    size_t length)
+{
+    const char* first = (const char*) start;
+    const char* last = first + length;
+
+    if (first >= pHdr->mapAddr && last <= pHdr->mapAddr + pHdr->curOffset)
+        return true;
+
+    const LinearAllocRegion* pFull;
+    for (pFull = pHdr->fullRegions; pFull != NULL; pFull = pFull->next) {
+        if (first >= pFull->mapAddr &&
+            last <= pFull->mapAddr + pFull->curOffset)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int compareLoaderStats(const void* tableItem, const void* looseItem)
+{
+    const LinearAllocLoaderStats* pStats =
+        (const LinearAllocLoaderStats*) tableItem;
+    const LinearAllocLoaderStats* pKey =
+        (const LinearAllocLoaderStats*) looseItem;
+    return (pStats->classLoader == pKey->classLoader) ? 0 : 1;
+}
+
+/*
+ * Add "count" allocations totaling "bytes" to a class loader's figures.
+ * Called with the lock held.
+ */
+static void countLoaderAllocs(LinearAllocHdr* pHdr, const Object* classLoader,
+    u4 count, u4 bytes)
+{
+    if (count == 0 || pHdr->loaderStats == NULL)
+        return;
+
+    LinearAllocLoaderStats key;
+    key.classLoader = classLoader;
+    u4 hash = ((u4) classLoader) >> 3;
+
+    LinearAllocLoaderStats* pStats = (LinearAllocLoaderStats*)
+        dvmHashTableLookup(pHdr->loaderStats, hash, &key,
+            compareLoaderStats, false);
+    if (pStats == NULL) {
+        pStats = (LinearAllocLoaderStats*) calloc(1, sizeof(*pStats));
+        if (pStats == NULL)
+            return;         /* losing a statistic is fine */
+        pStats->classLoader = classLoader;
+        dvmHashTableLookup(pHdr->loaderStats, hash, pStats,
+            compareLoaderStats, true);
+    }
+    pStats->numAllocs += count;
+    pStats->numBytes += bytes;
+}
+
+/*
+ * Hand the counts from a thread's chunk allocations over to the
+ * per-loader figures.  Called with the lock held.
+ */
+static void flushThreadCounts(LinearAllocHdr* pHdr, Thread* self)
+{
+    countLoaderAllocs(pHdr, self->linearAllocLoader,
+        self->linearAllocCount, self->linearAllocBytes);
+    self->linearAllocCount = self->linearAllocBytes = 0;
+}
+
+/*
+ * Create a new linear allocation block.
+ */
+LinearAllocHdr* dvmLinearAllocCreate(Object* classLoader)
+{
+#ifdef DISABLE_LINEAR_ALLOC
+    return (LinearAllocHdr*) 0x12345;
+#endif
+    LinearAllocHdr* pHdr;
+
+    pHdr = (LinearAllocHdr*) calloc(1, sizeof(*pHdr));
+    if (pHdr == NULL)
+        return NULL;
+
+    if (!mapRegion(pHdr, DEFAULT_MAX_LENGTH)) {
         free(pHdr);
         return NULL;
     }
@@ -204,11 +371,14 @@ LinearAllocHdr* dvmLinearAllocCreate(Object* classLoader)
         int numPages = (pHdr->mapLength+SYSTEM_PAGE_SIZE-1) / SYSTEM_PAGE_SIZE;
         pHdr->writeRefCount = (short*)calloc(numPages, sizeof(short));
         if (pHdr->writeRefCount == NULL) {
+            munmap(pHdr->mapAddr, pHdr->mapLength);
             free(pHdr);
             return NULL;
         }
     }
 
+    pHdr->loaderStats = dvmHashTableCreate(8, free);
+
     dvmInitMutex(&pHdr->lock);
 
     ALOGV("LinearAlloc: created region at %p-%p",
@@ -241,51 +411,41 @@ void dvmLinearAllocDestroy(Object* classLoader)
         ALOGD("LinearAlloc %p used %d of %d (%d%%)",
             classLoader, pHdr->curOffset, pHdr->mapLength,
             (pHdr->curOffset * 100) / pHdr->mapLength);
+        if (pHdr->fullRegions != NULL) {
+            ALOGD("LinearAlloc %p also used %d in full regions",
+                classLoader, pHdr->fullRegionsUsed);
+        }
     }
 
     if (munmap(pHdr->mapAddr, pHdr->mapLength) != 0) {
         ALOGW("LinearAlloc munmap(%p, %d) failed: %s",
             pHdr->mapAddr, pHdr->mapLength, strerror(errno));
     }
+    while (pHdr->fullRegions != NULL) {
+        LinearAllocRegion* pFull = pHdr->fullRegions;
+        pHdr->fullRegions = pFull->next;
+        if (munmap(pFull->mapAddr, pFull->mapLength) != 0) {
+            ALOGW("LinearAlloc munmap(%p, %d) failed: %s",
+                pFull->mapAddr, pFull->mapLength, strerror(errno));
+        }
+        free(pFull);
+    }
+    dvmHashTableFree(pHdr->loaderStats);
+    free(pHdr->writeRefCount);
     free(pHdr);
 }
 
 /*
- * Allocate "size" bytes of storage, associated with a particular class
- * loader.
- *
- * It's okay for size to be zero.
+ * Carve a block out of the current region.  Called with the lock held.
  *
  * We always leave "curOffset" pointing at the next place where we will
  * store the header that precedes the returned storage.
- *
- * This aborts the VM on failure, so it's not necessary to check for a
- * NULL return value.
  */
-void* dvmLinearAlloc(Object* classLoader, size_t size)
+static void* allocLocked(LinearAllocHdr* pHdr, size_t size)
 {
-    LinearAllocHdr* pHdr = getHeader(classLoader);
     int startOffset, nextOffset;
     int lastGoodOff, firstWriteOff, lastWriteOff;
 
-#ifdef DISABLE_LINEAR_ALLOC
-    return calloc(1, size);
-#endif
-
-    LOGVV("--- LinearAlloc(%p, %d)", classLoader, size);
-
-    /*
-     * What we'd like to do is just determine the new end-of-alloc size
-     * and atomic-swap the updated value in.  The trouble is that, the
-     * first time we reach a new page, we need to call mprotect() to
-     * make the page available, and we don't want to call mprotect() on
-     * every allocation.  The troubled situation is:
-     *  - thread A allocs across a page boundary, but gets preempted
-     *    before mprotect() completes
-     *  - thread B allocs within the new page, and doesn't call mprotect()
-     */
-    dvmLockMutex(&pHdr->lock);
-
     startOffset = pHdr->curOffset;
     assert(((startOffset + HEADER_EXTRA) & (BLOCK_ALIGN-1)) == 0);
 
@@ -296,25 +456,23 @@ void* dvmLinearAlloc(Object* classLoader, size_t size)
      * know we have room for that, and round up to BLOCK_ALIGN.  That's
      * the next location where we'll put user data.  We then subtract the
      * chunk header size off so we're back to the header pointer.
-     *
-     * Examples:
-     *   old=12 size=3 new=((12+(4*2)+3+7) & ~7)-4 = 24-4 --> 20
-     *   old=12 size=5 new=((12+(4*2)+5+7) & ~7)-4 = 32-4 --> 28
      */
-    nextOffset = ((startOffset + HEADER_EXTRA*2 + size + (BLOCK_ALIGN-1))
-                    & ~(BLOCK_ALIGN-1)) - HEADER_EXTRA;
+    nextOffset = nextBlockStart(startOffset, size);
     LOGVV("--- old=%d size=%d new=%d", startOffset, size, nextOffset);
 
     if (nextOffset > pHdr->mapLength) {
         /*
-         * We don't have to abort here.  We could fall back on the system
-         * malloc(), and have our "free" call figure out what to do.  Only
-         * works if the users of these functions actually free everything
-         * they allocate.
+         * Move on to a new region.  The page reference counts for
+         * ENFORCE_READ_ONLY only cover the first one, so there we still
+         * give up.
          */
-        ALOGE("LinearAlloc exceeded capacity (%d), last=%d",
-            pHdr->mapLength, (int) size);
-        dvmAbort();
+        if (ENFORCE_READ_ONLY || !growRegion(pHdr, size)) {
+            ALOGE("LinearAlloc exceeded capacity (%d), last=%d",
+                pHdr->mapLength, (int) size);
+            dvmAbort();
+        }
+        startOffset = pHdr->curOffset;
+        nextOffset = nextBlockStart(startOffset, size);
     }
 
     /*
@@ -385,10 +543,115 @@ void* dvmLinearAlloc(Object* classLoader, size_t size)
      */
     pHdr->curOffset = nextOffset;
 
-    dvmUnlockMutex(&pHdr->lock);
     return pHdr->mapAddr + startOffset + HEADER_EXTRA;
 }
 
+/*
+ * Give the thread a fresh chunk.  The whole chunk starts out as one
+ * free block, which each allocation then splits.
+ */
+static void refillChunk(LinearAllocHdr* pHdr, Thread* self)
+{
+    dvmLockMutex(&pHdr->lock);
+    flushThreadCounts(pHdr, self);
+
+    /* sized so the chunk ends exactly CHUNK_LENGTH past its header */
+    char* mem = (char*) allocLocked(pHdr, CHUNK_LENGTH - HEADER_EXTRA*2);
+    u4* pLen = getBlockHeader(mem);
+    self->linearAllocTop = (char*) pLen;
+    self->linearAllocEnd = mem + *pLen;
+    *pLen |= LENGTHFLAG_FREE;
+
+    dvmUnlockMutex(&pHdr->lock);
+}
+
+/*
+ * Allocate from the thread's chunk.  The lock is only needed when the
+ * chunk runs out, or to record counts for a different class loader.
+ */
+static void* chunkAlloc(LinearAllocHdr* pHdr, Thread* self,
+    Object* classLoader, size_t size)
+{
+    if (self->linearAllocLoader != classLoader) {
+        if (self->linearAllocCount != 0) {
+            dvmLockMutex(&pHdr->lock);
+            flushThreadCounts(pHdr, self);
+            dvmUnlockMutex(&pHdr->lock);
+        }
+        self->linearAllocLoader = classLoader;
+    }
+
+    char* start = self->linearAllocTop;
+    char* next = (char*) nextBlockStart((uintptr_t) start, size);
+    if (start == NULL || next > self->linearAllocEnd) {
+        refillChunk(pHdr, self);
+        start = self->linearAllocTop;
+        next = (char*) nextBlockStart((uintptr_t) start, size);
+        assert(next <= self->linearAllocEnd);
+    }
+
+    /*
+     * Write our length over the free block's, then start a new free
+     * block after us with whatever is left.  As in allocLocked, the
+     * size includes the pad bytes.  The data area was never written,
+     * so it's still zero.
+     */
+    char* end = self->linearAllocEnd;
+    *(u4*) start = next - (start + HEADER_EXTRA);
+    if (next < end)
+        *(u4*) next = (end - (next + HEADER_EXTRA)) | LENGTHFLAG_FREE;
+    self->linearAllocTop = next;
+
+    self->linearAllocCount++;
+    self->linearAllocBytes += size;
+    return start + HEADER_EXTRA;
+}
+
+/*
+ * Allocate "size" bytes of storage, associated with a particular class
+ * loader.
+ *
+ * It's okay for size to be zero.
+ *
+ * Small blocks come from the calling thread's chunk when it has one;
+ * see chunkAlloc.
+ *
+ * This aborts the VM on failure, so it's not necessary to check for a
+ * NULL return value.
+ */
+void* dvmLinearAlloc(Object* classLoader, size_t size)
+{
+    LinearAllocHdr* pHdr = getHeader(classLoader);
+
+#ifdef DISABLE_LINEAR_ALLOC
+    return calloc(1, size);
+#endif
+
+    LOGVV("--- LinearAlloc(%p, %d)", classLoader, size);
+
+    if (!ENFORCE_READ_ONLY && size <= CHUNK_MAX_ALLOC) {
+        Thread* self = dvmThreadSelf();
+        if (self != NULL)
+            return chunkAlloc(pHdr, self, classLoader, size);
+    }
+
+    /*
+     * What we'd like to do is just determine the new end-of-alloc size
+     * and atomic-swap the updated value in.  The trouble is that, the
+     * first time we reach a new page, we need to call mprotect() to
+     * make the page available, and we don't want to call mprotect() on
+     * every allocation.  The troubled situation is:
+     *  - thread A allocs across a page boundary, but gets preempted
+     *    before mprotect() completes
+     *  - thread B allocs within the new page, and doesn't call mprotect()
+     */
+    dvmLockMutex(&pHdr->lock);
+    void* mem = allocLocked(pHdr, size);
+    countLoaderAllocs(pHdr, classLoader, 1, size);
+    dvmUnlockMutex(&pHdr->lock);
+    return mem;
+}
+
 /*
  * Helper function, replaces strdup().
  */
@@ -421,9 +684,7 @@ void* dvmLinearRealloc(Object* classLoader, void* mem, size_t newSize)
 #endif
     /* make sure we have the right region (and mem != NULL) */
     assert(mem != NULL);
-    assert(mem >= (void*) getHeader(classLoader)->mapAddr &&
-           mem < (void*) (getHeader(classLoader)->mapAddr +
-                          getHeader(classLoader)->curOffset));
+    assert(inUseArea(getHeader(classLoader), mem, 0));
 
     const u4* pLen = getBlockHeader(mem);
     ALOGV("--- LinearRealloc(%d) old=%d", newSize, *pLen);
@@ -570,9 +831,7 @@ void dvmLinearFree(Object* classLoader, void* mem)
         return;
 
     /* make sure we have the right region */
-    assert(mem >= (void*) getHeader(classLoader)->mapAddr &&
-           mem < (void*) (getHeader(classLoader)->mapAddr +
-                          getHeader(classLoader)->curOffset));
+    assert(inUseArea(getHeader(classLoader), mem, 0));
 
     if (ENFORCE_READ_ONLY)
         dvmLinearSetReadWrite(classLoader, mem);
@@ -584,6 +843,29 @@ void dvmLinearFree(Object* classLoader, void* mem)
         dvmLinearSetReadOnly(classLoader, mem);
 }
 
+/*
+ * Log each block of a region.
+ */
+static void dumpBlocks(const char* mapAddr, int firstOffset, int curOffset)
+{
+    int off = firstOffset;
+    u4 rawLen, fullLen;
+
+    while (off < curOffset) {
+        rawLen = *(u4*) (mapAddr + off);
+        fullLen = ((HEADER_EXTRA*2 + (rawLen & LENGTHFLAG_MASK))
+                    & ~(BLOCK_ALIGN-1));
+
+        ALOGI("  %p (%3d): %clen=%d%s", mapAddr + off + HEADER_EXTRA,
+            (int) ((off + HEADER_EXTRA) / SYSTEM_PAGE_SIZE),
+            (rawLen & LENGTHFLAG_FREE) != 0 ? '*' : ' ',
+            rawLen & LENGTHFLAG_MASK,
+            (rawLen & LENGTHFLAG_RW) != 0 ? " [RW]" : "");
+
+        off += fullLen;
+    }
+}
+
 /*
  * For debugging, dump the contents of a linear alloc area.
  *
@@ -600,26 +882,18 @@ void dvmLinearAllocDump(Object* classLoader)
     dvmLockMutex(&pHdr->lock);
 
     ALOGI("LinearAlloc classLoader=%p", classLoader);
+
+    const LinearAllocRegion* pFull;
+    for (pFull = pHdr->fullRegions; pFull != NULL; pFull = pFull->next) {
+        ALOGI("  full region mapAddr=%p mapLength=%d curOffset=%d",
+            pFull->mapAddr, pFull->mapLength, pFull->curOffset);
+        dumpBlocks(pFull->mapAddr, pFull->firstOffset, pFull->curOffset);
+    }
+
     ALOGI("  mapAddr=%p mapLength=%d firstOffset=%d",
         pHdr->mapAddr, pHdr->mapLength, pHdr->firstOffset);
     ALOGI("  curOffset=%d", pHdr->curOffset);
-
-    int off = pHdr->firstOffset;
-    u4 rawLen, fullLen;
-
-    while (off < pHdr->curOffset) {
-        rawLen = *(u4*) (pHdr->mapAddr + off);
-        fullLen = ((HEADER_EXTRA*2 + (rawLen & LENGTHFLAG_MASK))
-                    & ~(BLOCK_ALIGN-1));
-
-        ALOGI("  %p (%3d): %clen=%d%s", pHdr->mapAddr + off + HEADER_EXTRA,
-            (int) ((off + HEADER_EXTRA) / SYSTEM_PAGE_SIZE),
-            (rawLen & LENGTHFLAG_FREE) != 0 ? '*' : ' ',
-            rawLen & LENGTHFLAG_MASK,
-            (rawLen & LENGTHFLAG_RW) != 0 ? " [RW]" : "");
-
-        off += fullLen;
-    }
+    dumpBlocks(pHdr->mapAddr, pHdr->firstOffset, pHdr->curOffset);
 
     if (ENFORCE_READ_ONLY) {
         ALOGI("writeRefCount map:");
@@ -644,43 +918,82 @@ void dvmLinearAllocDump(Object* classLoader)
             printf(" %d-%d: zero\n", zstart, i-1);
     }
 
-    ALOGD("LinearAlloc %p using %d of %d (%d%%)",
+    ALOGD("LinearAlloc %p using %d of %d (%d%%), %d in full regions",
         classLoader, pHdr->curOffset, pHdr->mapLength,
-        (pHdr->curOffset * 100) / pHdr->mapLength);
+        (pHdr->curOffset * 100) / pHdr->mapLength, pHdr->fullRegionsUsed);
+
+    /* counts still sitting in threads' chunks aren't included */
+    HashIter iter;
+    for (dvmHashIterBegin(pHdr->loaderStats, &iter); !dvmHashIterDone(&iter);
+        dvmHashIterNext(&iter))
+    {
+        const LinearAllocLoaderStats* pStats =
+            (const LinearAllocLoaderStats*) dvmHashIterData(&iter);
+        ALOGD("  loader %p: %u allocs, %u bytes", pStats->classLoader,
+            pStats->numAllocs, pStats->numBytes);
+    }
 
     dvmUnlockMutex(&pHdr->lock);
 }
 
 /*
- * Verify that all blocks are freed.
- *
- * This should only be done as we're shutting down, but there could be a
- * daemon thread that's still trying to do something, so we grab the locks.
+ * Get the number of bytes in use, over all regions.  This is a snapshot
+ * taken without the lock.
  */
-static void checkAllFree(Object* classLoader)
+int dvmLinearAllocUsed(Object* classLoader)
 {
 #ifdef DISABLE_LINEAR_ALLOC
-    return;
+    return 0;
 #endif
     LinearAllocHdr* pHdr = getHeader(classLoader);
+    return pHdr->fullRegionsUsed + pHdr->curOffset;
+}
 
-    dvmLockMutex(&pHdr->lock);
-
-    int off = pHdr->firstOffset;
+/*
+ * Warn about each block of a region that is still in use.
+ */
+static void checkRegionFree(Object* classLoader, const char* mapAddr,
+    int firstOffset, int curOffset)
+{
+    int off = firstOffset;
     u4 rawLen, fullLen;
 
-    while (off < pHdr->curOffset) {
-        rawLen = *(u4*) (pHdr->mapAddr + off);
+    while (off < curOffset) {
+        rawLen = *(u4*) (mapAddr + off);
         fullLen = ((HEADER_EXTRA*2 + (rawLen & LENGTHFLAG_MASK))
                     & ~(BLOCK_ALIGN-1));
 
         if ((rawLen & LENGTHFLAG_FREE) == 0) {
             ALOGW("LinearAlloc %p not freed: %p len=%d", classLoader,
-                pHdr->mapAddr + off + HEADER_EXTRA, rawLen & LENGTHFLAG_MASK);
+                mapAddr + off + HEADER_EXTRA, rawLen & LENGTHFLAG_MASK);
         }
 
         off += fullLen;
     }
+}
+
+/*
+ * Verify that all blocks are freed.
+ *
+ * This should only be done as we're shutting down, but there could be a
+ * daemon thread that's still trying to do something, so we grab the locks.
+ */
+static void checkAllFree(Object* classLoader)
+{
+#ifdef DISABLE_LINEAR_ALLOC
+    return;
+#endif
+    LinearAllocHdr* pHdr = getHeader(classLoader);
+
+    dvmLockMutex(&pHdr->lock);
+
+    const LinearAllocRegion* pFull;
+    for (pFull = pHdr->fullRegions; pFull != NULL; pFull = pFull->next) {
+        checkRegionFree(classLoader, pFull->mapAddr, pFull->firstOffset,
+            pFull->curOffset);
+    }
+    checkRegionFree(classLoader, pHdr->mapAddr, pHdr->firstOffset,
+        pHdr->curOffset);
 
     dvmUnlockMutex(&pHdr->lock);
 }
@@ -689,8 +1002,8 @@ static void checkAllFree(Object* classLoader)
  * Determine if [start, start+length) is contained in the in-use area of
  * a single LinearAlloc.  The full set of linear allocators is scanned.
  *
- * [ Since we currently only have one region, this is pretty simple.  In
- * the future we'll need to traverse a table of class loaders. ]
+ * [ Since we currently only have one allocator, this is pretty simple.
+ * In the future we'll need to traverse a table of class loaders. ]
  */
 bool dvmLinearAllocContains(const void* start, size_t length)
 {
@@ -699,6 +1012,5 @@ bool dvmLinearAllocContains(const void* start, size_t length)
     if (pHdr == NULL)
         return false;
 
-    return (char*) start >= pHdr->mapAddr &&
-           ((char*)start + length) <= (pHdr->mapAddr + pHdr->curOffset);
+    return inUseArea(pHdr, start, length);
 }
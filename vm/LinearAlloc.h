@@ -25,10 +25,25 @@
  */
 #define ENFORCE_READ_ONLY   false
 
+/*
+ * A region that filled up.  Its blocks stay in place until shutdown.
+ */
+struct LinearAllocRegion {
+    char*   mapAddr;
+    int     mapLength;
+    int     firstOffset;
+    int     curOffset;
+    LinearAllocRegion* next;
+};
+
 /*
  * Linear allocation state.  We could tuck this into the start of the
  * allocated region, but that would prevent us from sharing the rest of
  * that first page.
+ *
+ * The map fields describe the region currently being allocated from.
+ * When it fills up another one is mapped, and the old one is moved to
+ * "fullRegions".
  */
 struct LinearAllocHdr {
     int     curOffset;          /* offset where next data goes */
@@ -39,6 +54,11 @@ struct LinearAllocHdr {
     int     firstOffset;        /* for chasing through */
 
     short*  writeRefCount;      /* for ENFORCE_READ_ONLY */
+
+    LinearAllocRegion* fullRegions; /* most recent first */
+    int     fullRegionsUsed;    /* sum of their curOffsets */
+
+    HashTable* loaderStats;     /* LinearAllocLoaderStats, by loader */
 };
 
 
@@ -111,6 +131,11 @@ char* dvmLinearStrdup(Object* classLoader, const char* str);
  */
 void dvmLinearAllocDump(Object* classLoader);
 
+/*
+ * Get the number of bytes in use, over all of the area's regions.
+ */
+int dvmLinearAllocUsed(Object* classLoader);
+
 /*
  * Determine if [start, start+length) is contained in the in-use area of
  * a single LinearAlloc.  The full set of linear allocators is scanned.
@@ -249,15 +249,20 @@ std::string dvmHumanReadableDescriptor(const char* descriptor) {
     }
 
     // At this point, 'c' is a string of the form "fully/qualified/Type;"
-    // or "primitive;". Rewrite the type with '.' instead of '/':
+    // or "primitive;". Size the result once, so it's built without
+    // reallocating, then rewrite the type with '.' instead of '/':
+    const char* end = strchr(c, ';');
+    if (end == NULL) {
+        return descriptor;
+    }
+    size_t length = end - c;
     std::string result;
-    const char* p = c;
-    while (*p != ';') {
-        char ch = *p++;
-        if (ch == '/') {
-          ch = '.';
+    result.reserve(length + 2 * dim);
+    result.append(c, length);
+    for (size_t i = 0; i < length; i++) {
+        if (result[i] == '/') {
+            result[i] = '.';
         }
-        result.push_back(ch);
     }
     // ...and replace the semicolon with 'dim' "[]" pairs:
     while (dim--) {
@@ -630,6 +635,175 @@ void *dvmAllocRegion(size_t byteCount, int prot, const char *name) {
     return base;
 }
 
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+#define MAX_HUGE_REGIONS 16
+
+struct HugeRegion {
+    const char *name;
+    const u1 *base;
+    size_t length;
+};
+
+/*
+ * The regions mapped for huge pages, for the coverage dump.  Regions are
+ * only ever added, by threads starting up, so the dump reads them
+ * without the lock.
+ */
+static HugeRegion gHugeRegions[MAX_HUGE_REGIONS];
+static volatile int32_t gNumHugeRegions;
+static pthread_mutex_t gHugeRegionLock = PTHREAD_MUTEX_INITIALIZER;
+/* 0 until probed, then the huge page size or 1 if there are none */
+static size_t gHugePageSize;
+
+/* Reads a small file into buf.  Returns false if it can't be read. */
+static bool readSmallFile(const char *path, char *buf, size_t bufLen)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t n = TEMP_FAILURE_RETRY(read(fd, buf, bufLen - 1));
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+static size_t probeHugePageSize()
+{
+    char buf[128];
+
+    /* "always [madvise] never", with the mode in use bracketed */
+    if (!readSmallFile("/sys/kernel/mm/transparent_hugepage/enabled",
+                       buf, sizeof(buf)) || strstr(buf, "[never]") != NULL) {
+        return 1;
+    }
+    size_t size = 2 * 1024 * 1024;
+    if (readSmallFile("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+                      buf, sizeof(buf))) {
+        size_t val = strtoul(buf, NULL, 10);
+        if (val > SYSTEM_PAGE_SIZE && (val & (val - 1)) == 0) {
+            size = val;
+        }
+    }
+    return size;
+}
+
+size_t dvmHugePageSize()
+{
+    if (!gDvm.useHugePages) {
+        return 0;
+    }
+    dvmLockMutex(&gHugeRegionLock);
+    if (gHugePageSize == 0) {
+        gHugePageSize = probeHugePageSize();
+        if (gHugePageSize == 1) {
+            ALOGW("No transparent huge pages, using small pages");
+        }
+    }
+    size_t size = gHugePageSize;
+    dvmUnlockMutex(&gHugeRegionLock);
+    return size == 1 ? 0 : size;
+}
+
+void dvmAdviseHugePages(void *base, size_t size)
+{
+    if (madvise(base, size, MADV_HUGEPAGE) != 0) {
+        ALOGW("madvise(MADV_HUGEPAGE) of %p-%p failed: %s",
+              base, (u1 *) base + size, strerror(errno));
+    }
+}
+
+void *dvmAllocHugeRegion(size_t byteCount, int prot, const char *name) {
+    size_t hugeSize = dvmHugePageSize();
+
+    byteCount = ALIGN_UP_TO_PAGE_SIZE(byteCount);
+    if (hugeSize == 0 || byteCount < hugeSize) {
+        return dvmAllocRegion(byteCount, prot, name);
+    }
+
+    /* Map enough to find an aligned start, and unmap the slop around it */
+    size_t mapLength = byteCount + hugeSize - SYSTEM_PAGE_SIZE;
+    u1 *map = (u1 *) mmap(NULL, mapLength, prot,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        ALOGW("Unable to map %zd bytes for %s on huge pages: %s",
+              byteCount, name, strerror(errno));
+        return dvmAllocRegion(byteCount, prot, name);
+    }
+    u1 *base = (u1 *) ALIGN_UP(map, hugeSize);
+    if (base > map) {
+        munmap(map, base - map);
+    }
+    if (map + mapLength > base + byteCount) {
+        munmap(base + byteCount, map + mapLength - (base + byteCount));
+    }
+    dvmAdviseHugePages(base, byteCount);
+
+    dvmLockMutex(&gHugeRegionLock);
+    int index = gNumHugeRegions;
+    if (index < MAX_HUGE_REGIONS) {
+        gHugeRegions[index].name = name;
+        gHugeRegions[index].base = base;
+        gHugeRegions[index].length = byteCount;
+        android_atomic_release_store(index + 1, &gNumHugeRegions);
+    }
+    dvmUnlockMutex(&gHugeRegionLock);
+    return base;
+}
+
+void dvmDumpHugePageCoverage(const DebugOutputTarget* target)
+{
+    int numRegions = android_atomic_acquire_load(&gNumHugeRegions);
+    if (numRegions == 0) {
+        return;
+    }
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    /*
+     * A region is split into several mappings once parts of it are
+     * protected differently, so the huge pages of each mapping go to the
+     * region it starts in.
+     */
+    size_t hugeKb[MAX_HUGE_REGIONS];
+    memset(hugeKb, 0, sizeof(hugeKb));
+    int current = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long start, end;
+        size_t kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            current = -1;
+            for (int i = 0; i < numRegions; i++) {
+                const HugeRegion *region = &gHugeRegions[i];
+                if (start >= (uintptr_t) region->base &&
+                    start < (uintptr_t) region->base + region->length) {
+                    current = i;
+                    break;
+                }
+            }
+        } else if (current >= 0 &&
+                   sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            hugeKb[current] += kb;
+        }
+    }
+    fclose(fp);
+
+    for (int i = 0; i < numRegions; i++) {
+        dvmPrintDebugMessage(target, "Huge pages: %s %zd/%zd KB\n",
+                             gHugeRegions[i].name, hugeKb[i],
+                             gHugeRegions[i].length / 1024);
+    }
+}
+
 /*
  * Get some per-thread stats.
  *
@@ -296,6 +296,33 @@ extern "C" size_t strlcpy(char *dst, const char *src, size_t size);
  */
 void *dvmAllocRegion(size_t size, int prot, const char *name);
 
+/*
+ * Like dvmAllocRegion, but with -XX:+UseHugePages a region of at least
+ * one huge page is mapped anonymous, aligned to a huge page and advised
+ * to be backed by transparent huge pages.  Falls back to dvmAllocRegion
+ * if the kernel has none or the mapping fails.
+ */
+void *dvmAllocHugeRegion(size_t size, int prot, const char *name);
+
+/*
+ * Returns the size of the huge pages dvmAllocHugeRegion maps on, or 0 if
+ * it doesn't, because -XX:+UseHugePages wasn't given or the kernel has no
+ * transparent huge pages.
+ */
+size_t dvmHugePageSize(void);
+
+/*
+ * Advises the kernel to back a range of an anonymous mapping with huge
+ * pages, for mappings replaced after dvmAllocHugeRegion.
+ */
+void dvmAdviseHugePages(void *base, size_t size);
+
+/*
+ * Prints how much of each region from dvmAllocHugeRegion is actually on
+ * huge pages, from /proc/self/smaps.
+ */
+void dvmDumpHugePageCoverage(const DebugOutputTarget* target);
+
 /*
  * Get some per-thread stats from /proc/self/task/N/stat.
  */
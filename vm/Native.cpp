@@ -25,6 +25,11 @@
 
 #include <stdlib.h>
 #include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static void freeSharedLibEntry(void* ptr);
 static void* lookupSharedLibMethod(const Method* method);
@@ -143,6 +148,18 @@ enum OnLoadState {
     kOnLoadOkay,
 };
 
+/*
+ * The hashes of the names of the JNI functions ("Java_...") a library
+ * exports, in an open-addressed table with "mask+1" slots.  A zero slot
+ * is empty, so a name that hashes to zero is stored as 1.  Two names can
+ * share a hash, so a hit only means dlsym() is worth calling; a miss
+ * means it isn't.
+ */
+struct JniSymbolIndex {
+    u4*         hashes;             /* NULL if the library wasn't indexed */
+    u4          mask;
+};
+
 /*
  * We add one of these to the hash table for every library we load.  The
  * hash is on the "pathName" field.
@@ -151,6 +168,7 @@ struct SharedLib {
     char*       pathName;           /* absolute path to library */
     void*       handle;             /* from dlopen */
     Object*     classLoader;        /* ClassLoader we are associated with */
+    JniSymbolIndex jniSymbols;      /* exported JNI function names */
 
     pthread_mutex_t onLoadLock;     /* guards remaining items */
     pthread_cond_t  onLoadCond;     /* wait for JNI_OnLoad in other thread */
@@ -234,10 +252,165 @@ static void freeSharedLibEntry(void* ptr)
      */
     if (false)
         dlclose(pLib->handle);
+    free(pLib->jniSymbols.hashes);
     free(pLib->pathName);
     free(pLib);
 }
 
+#if defined(__LP64__)
+typedef Elf64_Ehdr ElfEhdr;
+typedef Elf64_Shdr ElfShdr;
+typedef Elf64_Sym ElfSym;
+# define ELF_CLASS_NATIVE ELFCLASS64
+# define ELF_ST_BIND_OF(info) ELF64_ST_BIND(info)
+#else
+typedef Elf32_Ehdr ElfEhdr;
+typedef Elf32_Shdr ElfShdr;
+typedef Elf32_Sym ElfSym;
+# define ELF_CLASS_NATIVE ELFCLASS32
+# define ELF_ST_BIND_OF(info) ELF32_ST_BIND(info)
+#endif
+
+static inline u4 jniSymbolHash(const char* name)
+{
+    u4 hash = dvmComputeUtf8Hash(name);
+    return (hash != 0) ? hash : 1;
+}
+
+/*
+ * Returns "true" if "sym" is a JNI function the library defines and
+ * exports.  The caller has checked that "strs" is null-terminated.
+ */
+static bool isExportedJniSymbol(const ElfSym* sym, const char* strs,
+    size_t strsSize)
+{
+    if (sym->st_shndx == SHN_UNDEF || sym->st_name >= strsSize)
+        return false;
+    int bind = ELF_ST_BIND_OF(sym->st_info);
+    if (bind != STB_GLOBAL && bind != STB_WEAK)
+        return false;
+    return strncmp(strs + sym->st_name, "Java_", 5) == 0;
+}
+
+/*
+ * Fill out "pIndex" from the dynamic symbol table of the ELF file mapped
+ * at "base".  Returns "false" if the file doesn't look like one we can
+ * read, leaving "pIndex" alone.
+ */
+static bool indexJniSymbolsInImage(const u1* base, size_t size,
+    JniSymbolIndex* pIndex)
+{
+    const ElfEhdr* ehdr = (const ElfEhdr*) base;
+    if (size < sizeof(ElfEhdr) ||
+        memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELF_CLASS_NATIVE ||
+        ehdr->e_shentsize != sizeof(ElfShdr) ||
+        ehdr->e_shoff > size ||
+        ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(ElfShdr))
+    {
+        return false;
+    }
+
+    const ElfShdr* shdrs = (const ElfShdr*) (base + ehdr->e_shoff);
+    const ElfShdr* dynsym = NULL;
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+        if (shdrs[i].sh_type == SHT_DYNSYM) {
+            dynsym = &shdrs[i];
+            break;
+        }
+    }
+    if (dynsym == NULL || dynsym->sh_link >= ehdr->e_shnum ||
+        dynsym->sh_entsize != sizeof(ElfSym))
+        return false;
+    const ElfShdr* dynstr = &shdrs[dynsym->sh_link];
+    if (dynsym->sh_offset > size || dynsym->sh_size > size - dynsym->sh_offset ||
+        dynstr->sh_offset > size || dynstr->sh_size > size - dynstr->sh_offset ||
+        dynstr->sh_size == 0)
+        return false;
+
+    const ElfSym* syms = (const ElfSym*) (base + dynsym->sh_offset);
+    size_t numSyms = dynsym->sh_size / sizeof(ElfSym);
+    const char* strs = (const char*) (base + dynstr->sh_offset);
+    size_t strsSize = dynstr->sh_size;
+    if (strs[strsSize - 1] != '\0')
+        return false;
+
+    /* keep the table at most half full */
+    size_t count = 0;
+    for (size_t i = 0; i < numSyms; i++) {
+        if (isExportedJniSymbol(&syms[i], strs, strsSize))
+            count++;
+    }
+    u4 numSlots = 16;
+    while (numSlots < count * 2)
+        numSlots *= 2;
+
+    u4* hashes = (u4*) calloc(numSlots, sizeof(u4));
+    if (hashes == NULL)
+        return false;
+    u4 mask = numSlots - 1;
+    for (size_t i = 0; i < numSyms; i++) {
+        if (!isExportedJniSymbol(&syms[i], strs, strsSize))
+            continue;
+        u4 hash = jniSymbolHash(strs + syms[i].st_name);
+        u4 slot = hash & mask;
+        while (hashes[slot] != 0 && hashes[slot] != hash)
+            slot = (slot + 1) & mask;
+        hashes[slot] = hash;
+    }
+
+    pIndex->hashes = hashes;
+    pIndex->mask = mask;
+    return true;
+}
+
+/*
+ * Index the JNI functions exported by the library at "pathName", so that
+ * resolving a native method doesn't have to dlsym() every library we've
+ * loaded.  The index is left empty if the file can't be read, and
+ * lookups in that library always call dlsym().
+ */
+static void indexJniSymbols(const char* pathName, JniSymbolIndex* pIndex)
+{
+    pIndex->hashes = NULL;
+    pIndex->mask = 0;
+
+    int fd = open(pathName, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+        close(fd);
+        return;
+    }
+    size_t size = sb.st_size;
+    void* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return;
+
+    if (!indexJniSymbolsInImage((const u1*) base, size, pIndex))
+        ALOGV("Unable to index JNI symbols in '%s'", pathName);
+    munmap(base, size);
+}
+
+/*
+ * Returns "false" if the library certainly doesn't export a function
+ * whose name has the given hash.
+ */
+static bool mayExportJniSymbol(const SharedLib* pLib, u4 hash)
+{
+    const JniSymbolIndex* pIndex = &pLib->jniSymbols;
+    if (pIndex->hashes == NULL)
+        return true;
+    for (u4 slot = hash & pIndex->mask; ; slot = (slot + 1) & pIndex->mask) {
+        if (pIndex->hashes[slot] == hash)
+            return true;
+        if (pIndex->hashes[slot] == 0)
+            return false;
+    }
+}
+
 /*
  * Convert library name to system-dependent form, e.g. "jpeg" becomes
  * "libjpeg.so".
@@ -381,6 +554,9 @@ bool dvmLoadNativeCode(const char* pathName, Object* classLoader,
     Thread* self = dvmThreadSelf();
     ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
     handle = dlopen(pathName, RTLD_LAZY);
+    JniSymbolIndex jniSymbols;
+    if (handle != NULL)
+        indexJniSymbols(pathName, &jniSymbols);
     dvmChangeStatus(self, oldStatus);
 
     if (handle == NULL) {
@@ -395,6 +571,7 @@ bool dvmLoadNativeCode(const char* pathName, Object* classLoader,
     pNewEntry->pathName = strdup(pathName);
     pNewEntry->handle = handle;
     pNewEntry->classLoader = classLoader;
+    pNewEntry->jniSymbols = jniSymbols;
     dvmInitMutex(&pNewEntry->onLoadLock);
     pthread_cond_init(&pNewEntry->onLoadCond, NULL);
     pNewEntry->onLoadThreadId = self->threadId;
@@ -540,7 +717,7 @@ static void unregisterJNINativeMethods(Method* methods, size_t count)
  */
 void dvmUnregisterJNINativeMethods(ClassObject* clazz)
 {
-    unregisterJNINativeMethods(clazz->directMethods, clazz->directMethodCount);
+    unregisterJNINativeMethods(dvmGetDirectMethods(clazz), clazz->directMethodCount);
     unregisterJNINativeMethods(clazz->virtualMethods, clazz->virtualMethodCount);
 }
 
@@ -680,6 +857,19 @@ static char* createMangledSignature(const DexProto* proto)
     return result;
 }
 
+/*
+ * The names a native method's JNI function can have, built once for a
+ * lookup and tried against each library.
+ */
+struct JniNativeNames {
+    const Method* method;
+    char*   shortName;      /* Java_<class>_<method> */
+    u4      shortHash;
+    char*   longName;       /* ...with __<signature> appended */
+    u4      longHash;
+    bool    useIndex;       /* skip libraries whose index rules it out */
+};
+
 /*
  * (This is a dvmHashForeach callback.)
  *
@@ -687,16 +877,12 @@ static char* createMangledSignature(const DexProto* proto)
  *
  * TODO: we may want to skip libraries for which JNI_OnLoad failed.
  */
-static int findMethodInLib(void* vlib, void* vmethod)
+static int findMethodInLib(void* vlib, void* vnames)
 {
     const SharedLib* pLib = (const SharedLib*) vlib;
-    const Method* meth = (const Method*) vmethod;
-    char* preMangleCM = NULL;
-    char* mangleCM = NULL;
-    char* mangleSig = NULL;
-    char* mangleCMSig = NULL;
+    const JniNativeNames* pNames = (const JniNativeNames*) vnames;
+    const Method* meth = pNames->method;
     void* func = NULL;
-    int len;
 
     if (meth->clazz->classLoader != pLib->classLoader) {
         ALOGV("+++ not scanning '%s' for '%s' (wrong CL)",
@@ -708,43 +894,22 @@ static int findMethodInLib(void* vlib, void* vmethod)
     /*
      * First, we try it without the signature.
      */
-    preMangleCM =
-        createJniNameString(meth->clazz->descriptor, meth->name, &len);
-    if (preMangleCM == NULL)
-        goto bail;
-
-    mangleCM = mangleString(preMangleCM, len);
-    if (mangleCM == NULL)
-        goto bail;
-
-    ALOGV("+++ calling dlsym(%s)", mangleCM);
-    func = dlsym(pLib->handle, mangleCM);
-    if (func == NULL) {
-        mangleSig =
-            createMangledSignature(&meth->prototype);
-        if (mangleSig == NULL)
-            goto bail;
-
-        mangleCMSig = (char*) malloc(strlen(mangleCM) + strlen(mangleSig) +3);
-        if (mangleCMSig == NULL)
-            goto bail;
-
-        sprintf(mangleCMSig, "%s__%s", mangleCM, mangleSig);
-
-        ALOGV("+++ calling dlsym(%s)", mangleCMSig);
-        func = dlsym(pLib->handle, mangleCMSig);
+    if (!pNames->useIndex || mayExportJniSymbol(pLib, pNames->shortHash)) {
+        ALOGV("+++ calling dlsym(%s)", pNames->shortName);
+        func = dlsym(pLib->handle, pNames->shortName);
         if (func != NULL) {
-            ALOGV("Found '%s' with dlsym", mangleCMSig);
+            ALOGV("Found '%s' with dlsym", pNames->shortName);
+            return (int) func;
         }
-    } else {
-        ALOGV("Found '%s' with dlsym", mangleCM);
     }
 
-bail:
-    free(preMangleCM);
-    free(mangleCM);
-    free(mangleSig);
-    free(mangleCMSig);
+    if (!pNames->useIndex || mayExportJniSymbol(pLib, pNames->longHash)) {
+        ALOGV("+++ calling dlsym(%s)", pNames->longName);
+        func = dlsym(pLib->handle, pNames->longName);
+        if (func != NULL) {
+            ALOGV("Found '%s' with dlsym", pNames->longName);
+        }
+    }
     return (int) func;
 }
 
@@ -752,6 +917,11 @@ bail:
  * See if the requested method lives in any of the currently-loaded
  * shared libraries.  We do this by checking each of them for the expected
  * method signature.
+ *
+ * The libraries' symbol indexes let us skip the dlsym() calls for all
+ * but the library that has the method.  dlsym() also finds symbols in a
+ * library's dependencies, which aren't indexed, so if the indexes turn
+ * up nothing we ask every library before giving up.
  */
 static void* lookupSharedLibMethod(const Method* method)
 {
@@ -759,6 +929,46 @@ static void* lookupSharedLibMethod(const Method* method)
         ALOGE("Unexpected init state: nativeLibs not ready");
         dvmAbort();
     }
-    return (void*) dvmHashForeach(gDvm.nativeLibs, findMethodInLib,
-        (void*) method);
+
+    JniNativeNames names;
+    char* preMangleCM = NULL;
+    char* mangleSig = NULL;
+    void* func = NULL;
+    int len;
+
+    memset(&names, 0, sizeof(names));
+    names.method = method;
+
+    preMangleCM =
+        createJniNameString(method->clazz->descriptor, method->name, &len);
+    if (preMangleCM == NULL)
+        goto bail;
+    names.shortName = mangleString(preMangleCM, len);
+    if (names.shortName == NULL)
+        goto bail;
+    mangleSig = createMangledSignature(&method->prototype);
+    if (mangleSig == NULL)
+        goto bail;
+    names.longName =
+        (char*) malloc(strlen(names.shortName) + strlen(mangleSig) +3);
+    if (names.longName == NULL)
+        goto bail;
+    sprintf(names.longName, "%s__%s", names.shortName, mangleSig);
+    names.shortHash = jniSymbolHash(names.shortName);
+    names.longHash = jniSymbolHash(names.longName);
+
+    names.useIndex = true;
+    func = (void*) dvmHashForeach(gDvm.nativeLibs, findMethodInLib, &names);
+    if (func == NULL) {
+        names.useIndex = false;
+        func = (void*) dvmHashForeach(gDvm.nativeLibs, findMethodInLib,
+            &names);
+    }
+
+bail:
+    free(preMangleCM);
+    free(mangleSig);
+    free(names.shortName);
+    free(names.longName);
+    return func;
 }
@@ -57,6 +57,14 @@ extern "C" void dvmPlatformInvoke(void* pEnv, ClassObject* clazz, int argInfo,
  */
 u4 dvmPlatformInvokeHints(const DexProto* proto);
 
+/*
+ * Return a stub that calls a JNI method with this shorty more cheaply
+ * than dvmPlatformInvoke, or NULL if there isn't one.  The stub takes the
+ * second JNI argument (the class or "this") in "arg1", and the remaining
+ * arguments in "args".
+ */
+JniCallStub dvmFindJniCallStub(const char* shorty);
+
 /*
  * Convert a short library name ("jpeg") to a system-dependent name
  * ("libjpeg.so").  Returns a newly-allocated string.
@@ -18,15 +18,69 @@
  */
 #include "Dalvik.h"
 
+/*
+ * Sets larger than this are indexed by a hash table rather than kept
+ * sorted, so adds and lookups don't cost O(n) and O(log n).
+ */
+#define kHashThreshold  64
+
 /*
  * Sorted, expanding list of pointers.
+ *
+ * Past kHashThreshold entries, new entries are appended to "list" and
+ * "hash" maps pointers to their place: each slot holds an index into
+ * "list" plus one, or zero if empty.  "hashSize" is a power of two at
+ * least twice "count", and zero while the set is small.
  */
 struct PointerSet {
-    u2          alloc;
-    u2          count;
+    u4          alloc;
+    u4          count;
     const void** list;
+
+    u4*         hash;
+    u4          hashSize;
 };
 
+static inline u4 hashPointer(const void* ptr)
+{
+    u4 val = ((u4) ptr >> 2) * 2654435761u;
+    return val ^ (val >> 16);
+}
+
+/*
+ * Find the hash slot that holds "ptr", or the empty one where it would go.
+ */
+static u4 findSlot(const PointerSet* pSet, const void* ptr)
+{
+    u4 mask = pSet->hashSize - 1;
+    u4 slot = hashPointer(ptr) & mask;
+
+    while (pSet->hash[slot] != 0 && pSet->list[pSet->hash[slot] - 1] != ptr)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/*
+ * Replace the hash table with one of "size" slots indexing every entry.
+ */
+static void rebuildHash(PointerSet* pSet, u4 size)
+{
+    assert(size > pSet->count * 2);
+
+    u4* newHash = (u4*)calloc(size, sizeof(u4));
+    if (newHash == NULL) {
+        ALOGE("Failed hashing ptr set (count=%d)", pSet->count);
+        dvmAbort();
+    }
+    free(pSet->hash);
+    pSet->hash = newHash;
+    pSet->hashSize = size;
+
+    u4 i;
+    for (i = 0; i < pSet->count; i++)
+        pSet->hash[findSlot(pSet, pSet->list[i])] = i + 1;
+}
+
 /*
  * Verify that the set is in sorted order.
  */
@@ -34,7 +88,10 @@ struct PointerSet {
 static bool verifySorted(PointerSet* pSet)
 {
     const void* last = NULL;
-    int i;
+    u4 i;
+
+    if (pSet->hash != NULL)
+        return true;        /* insertion order */
 
     for (i = 0; i < pSet->count; i++) {
         const void* cur = pSet->list[i];
@@ -81,6 +138,7 @@ void dvmPointerSetFree(PointerSet* pSet)
         free(pSet->list);
         pSet->list = NULL;
     }
+    free(pSet->hash);
     free(pSet);
 }
 
@@ -90,6 +148,11 @@ void dvmPointerSetFree(PointerSet* pSet)
 void dvmPointerSetClear(PointerSet* pSet)
 {
     pSet->count = 0;
+
+    /* an empty set is sorted */
+    free(pSet->hash);
+    pSet->hash = NULL;
+    pSet->hashSize = 0;
 }
 
 /*
@@ -139,6 +202,15 @@ bool dvmPointerSetAddEntry(PointerSet* pSet, const void* ptr)
         pSet->list = newList;
     }
 
+    if (pSet->hash != NULL) {
+        /* append, and index it */
+        pSet->list[pSet->count] = ptr;
+        pSet->hash[findSlot(pSet, ptr)] = ++pSet->count;
+        if (pSet->count * 2 >= pSet->hashSize)
+            rebuildHash(pSet, pSet->hashSize * 2);
+        return true;
+    }
+
     if (pSet->count == 0) {
         /* empty list */
         assert(nearby == 0);
@@ -174,6 +246,9 @@ bool dvmPointerSetAddEntry(PointerSet* pSet, const void* ptr)
     pSet->count++;
 
     assert(verifySorted(pSet));
+
+    if (pSet->count > kHashThreshold)
+        rebuildHash(pSet, dexRoundUpPower2(pSet->count * 4));
     return true;
 }
 
@@ -195,6 +270,10 @@ bool dvmPointerSetRemoveEntry(PointerSet* pSet, const void* ptr)
 
     pSet->count--;
     pSet->list[pSet->count] = (const void*) 0xdecadead;     // debug
+
+    /* the following entries moved down; rare enough to just reindex */
+    if (pSet->hash != NULL)
+        rebuildHash(pSet, pSet->hashSize);
     return true;
 }
 
@@ -206,6 +285,13 @@ bool dvmPointerSetHas(const PointerSet* pSet, const void* ptr, int* pIndex)
 {
     int hi, lo, mid;
 
+    if (pSet->hash != NULL) {
+        u4 entry = pSet->hash[findSlot(pSet, ptr)];
+        if (pIndex != NULL)
+            *pIndex = (entry != 0) ? entry - 1 : pSet->count;
+        return entry != 0;
+    }
+
     lo = mid = 0;
     hi = pSet->count-1;
 
@@ -239,7 +325,7 @@ void dvmPointerSetIntersect(PointerSet* pSet, const void** ptrArray, int count)
 {
     int i, j;
 
-    for (i = 0; i < pSet->count; i++) {
+    for (i = 0; i < (int) pSet->count; i++) {
         for (j = 0; j < count; j++) {
             if (pSet->list[i] == ptrArray[j]) {
                 /* match, keep this one */
@@ -260,6 +346,9 @@ void dvmPointerSetIntersect(PointerSet* pSet, const void** ptrArray, int count)
             i--;        /* adjust loop counter */
         }
     }
+
+    if (pSet->hash != NULL)
+        rebuildHash(pSet, pSet->hashSize);
 }
 
 /*
@@ -267,8 +356,8 @@ void dvmPointerSetIntersect(PointerSet* pSet, const void** ptrArray, int count)
  */
 void dvmPointerSetDump(const PointerSet* pSet)
 {
-    ALOGI("PointerSet %p", pSet);
-    int i;
+    ALOGI("PointerSet %p%s", pSet, pSet->hash != NULL ? " (hashed)" : "");
+    u4 i;
     for (i = 0; i < pSet->count; i++)
         ALOGI(" %2d: %p", i, pSet->list[i]);
 }
@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 /*
- * Maintain an expanding set of unique pointer values.  The set is
- * kept in sorted order.
+ * Maintain an expanding set of unique pointer values.  Small sets are
+ * kept in sorted order; large ones are hashed, and keep entries in the
+ * order they were added.  Either way, an index is only valid until the
+ * next insert or removal, as inserting into a sorted set shifts the
+ * entries after it.
  */
 #ifndef DALVIK_POINTERSET_H_
 #define DALVIK_POINTERSET_H_
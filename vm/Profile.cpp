@@ -29,6 +29,8 @@
 #include <sched.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include <cutils/open_memstream.h>
 
@@ -78,6 +80,9 @@
 
 #define FILL_PATTERN        0xeeeeeeee
 
+/* records per chunk of the buffer claimed by a thread */
+#define TRACE_CHUNK_RECORDS 64
+
 
 /*
  * Returns true if the thread CPU clock should be used.
@@ -275,24 +280,272 @@ static void getSample(Thread* thread)
     thread->stackTraceSampleLength = newLength;
 }
 
+/*
+ * Run through the data buffer and pull out the methods that were visited.
+ * Set a mark so that we know which ones to output.
+ */
+static void markTouchedMethods(const u1* buf, int endOffset)
+{
+    const u1* ptr = buf + TRACE_HEADER_LEN;
+    const u1* end = buf + endOffset;
+    size_t recordSize = gDvm.methodTrace.recordSize;
+    unsigned int methodVal;
+    Method* method;
+
+    while (ptr < end) {
+        methodVal = ptr[2] | (ptr[3] << 8) | (ptr[4] << 16)
+                    | (ptr[5] << 24);
+        method = (Method*) METHOD_ID(methodVal);
+
+        method->inProfile = true;
+        ptr += recordSize;
+    }
+}
+
+/*
+ * Squeeze out the unused ends of the chunks the threads had claimed,
+ * which still hold the fill pattern, and return the new end of the
+ * data.  Each thread's records stay in the order it wrote them.
+ *
+ * It's possible (though unlikely) for a thread that was interrupted
+ * after claiming a chunk to be partway through writing a record; we
+ * take the method value as it is, just as we always have.
+ */
+static int compactTraceBuffer(u1* buf, int endOffset)
+{
+    size_t recordSize = gDvm.methodTrace.recordSize;
+    u4 fillVal = METHOD_ID(FILL_PATTERN);
+    u1* dst = buf + TRACE_HEADER_LEN;
+    u1* end = buf + endOffset;
+
+    for (u1* src = dst; src + recordSize <= end; src += recordSize) {
+        u4 methodVal = src[2] | (src[3] << 8) | (src[4] << 16)
+                    | (src[5] << 24);
+        if (METHOD_ID(methodVal) == fillVal)
+            continue;
+        if (dst != src)
+            memmove(dst, src, recordSize);
+        dst += recordSize;
+    }
+    return dst - buf;
+}
+
+/*
+ * Body of the trace writer thread.  File traces run with two buffers:
+ * while the threads fill one, this writes the other to the spill file,
+ * so a long trace needs neither a huge buffer nor a long pause.  It's a
+ * plain pthread, since it never touches the managed heap.
+ */
+static void* traceWriterThreadStart(void* arg)
+{
+    MethodTraceState* state = &gDvm.methodTrace;
+
+    dvmLockMutex(&state->writerLock);
+    while (true) {
+        while (state->pendingBuf == NULL && !state->writerStop)
+            dvmWaitCond(&state->writerCond, &state->writerLock);
+        u1* buf = state->pendingBuf;
+        if (buf == NULL)
+            break;
+        int endOffset = state->pendingEnd;
+        dvmUnlockMutex(&state->writerLock);
+
+        endOffset = compactTraceBuffer(buf, endOffset);
+        markTouchedMethods(buf, endOffset);
+        size_t dataLen = endOffset - TRACE_HEADER_LEN;
+        if (!state->spillError && dataLen != 0) {
+            if (fwrite(buf + TRACE_HEADER_LEN, dataLen, 1,
+                       state->spillFile) != 1) {
+                ALOGE("trace spill write failed: %s", strerror(errno));
+                state->spillError = true;
+                state->overflow = true;
+            } else {
+                state->spilledRecords += dataLen / state->recordSize;
+            }
+        }
+        memset(buf + TRACE_HEADER_LEN, (char)FILL_PATTERN,
+            state->bufferSize - TRACE_HEADER_LEN);
+
+        dvmLockMutex(&state->writerLock);
+        state->pendingBuf = NULL;
+        state->spareBuf = buf;
+        dvmBroadcastCond(&state->writerCond);
+    }
+    dvmUnlockMutex(&state->writerLock);
+    return NULL;
+}
+
+/*
+ * The buffer was full at "fullOffset".  Unless somebody else got there
+ * first, wait for the writer to be done with the other buffer, then stop
+ * the threads just long enough to switch them over to it, and hand the
+ * full one to the writer.
+ *
+ * Returns false if we aren't streaming or tracing is stopping, in which
+ * case the caller should drop the record, as we did before streaming
+ * existed.
+ */
+static bool flushTraceBuffer(Thread* self, int fullOffset)
+{
+    MethodTraceState* state = &gDvm.methodTrace;
+    if (!state->streaming || state->spillError)
+        return false;
+
+    /* wait in VMWAIT; whoever holds the lock may be suspending us */
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockMutex(&state->flushLock);
+    dvmLockMutex(&state->writerLock);
+    while (state->spareBuf == NULL)
+        dvmWaitCond(&state->writerCond, &state->writerLock);
+    dvmUnlockMutex(&state->writerLock);
+    dvmChangeStatus(self, oldStatus);
+
+    if (state->traceEnabled && state->curOffset == fullOffset) {
+        u1* fullBuf = state->buf;
+
+        dvmSuspendAllThreads(SUSPEND_FOR_METHOD_TRACE);
+        dvmLockThreadList(self);
+        for (Thread* thread = gDvm.threadList; thread != NULL;
+             thread = thread->next) {
+            thread->traceChunkCur = thread->traceChunkEnd = NULL;
+        }
+        dvmUnlockThreadList();
+        state->buf = state->spareBuf;
+        state->spareBuf = NULL;
+        android_atomic_release_store(TRACE_HEADER_LEN, &state->curOffset);
+        dvmResumeAllThreads(SUSPEND_FOR_METHOD_TRACE);
+
+        dvmLockMutex(&state->writerLock);
+        state->pendingBuf = fullBuf;
+        state->pendingEnd = fullOffset;
+        dvmBroadcastCond(&state->writerCond);
+        dvmUnlockMutex(&state->writerLock);
+    }
+
+    bool flushed = state->traceEnabled && !state->spillError;
+    dvmUnlockMutex(&state->flushLock);
+    return flushed;
+}
+
+/*
+ * Split the buffer in two, and start the thread that writes whichever
+ * half is full to the spill file.  Returns false if we can't, in which
+ * case tracing stops when the buffer fills, as it always did.
+ */
+static bool startTraceWriter(int bufferSize)
+{
+    MethodTraceState* state = &gDvm.methodTrace;
+    int halfSize = bufferSize / 2;
+    if (halfSize < TRACE_HEADER_LEN + state->chunkSize)
+        return false;
+
+    state->bufferSize = halfSize;
+    state->spareBuf = state->buf + halfSize;
+    memcpy(state->spareBuf, state->buf, TRACE_HEADER_LEN);
+    state->pendingBuf = NULL;
+    state->writerStop = false;
+    state->spillError = false;
+    int cc = pthread_create(&state->writerHandle, NULL,
+        traceWriterThreadStart, NULL);
+    if (cc != 0) {
+        ALOGW("Unable to start trace writer: %s", strerror(cc));
+        state->bufferSize = bufferSize;
+        state->spareBuf = NULL;
+        return false;
+    }
+    state->streaming = true;
+    return true;
+}
+
+/*
+ * Let the writer finish what it has and wait for it to exit.  Must be
+ * called in VMWAIT.
+ */
+static void stopTraceWriter()
+{
+    MethodTraceState* state = &gDvm.methodTrace;
+
+    dvmLockMutex(&state->writerLock);
+    state->writerStop = true;
+    dvmBroadcastCond(&state->writerCond);
+    dvmUnlockMutex(&state->writerLock);
+    if (pthread_join(state->writerHandle, NULL) != 0) {
+        ALOGW("Trace writer join failed");
+    }
+    state->streaming = false;
+}
+
+/*
+ * Claim the next chunk of the buffer for "self", spilling the buffer if
+ * it's full.  Returns a pointer to the start of the chunk, or NULL if
+ * the record has to be dropped.
+ *
+ * In sampling mode records are only written by the sampling thread,
+ * which holds the thread list lock while it does so; it spills between
+ * rounds instead.
+ */
+static u1* claimTraceChunk(Thread* self)
+{
+    MethodTraceState* state = &gDvm.methodTrace;
+    int oldOffset, newOffset;
+
+    while (true) {
+        oldOffset = state->curOffset;
+        newOffset = oldOffset + state->chunkSize;
+        if (newOffset > state->bufferSize) {
+            if (state->samplingEnabled ||
+                !flushTraceBuffer(self, oldOffset)) {
+                state->overflow = true;
+                return NULL;
+            }
+            continue;
+        }
+        if (android_atomic_release_cas(oldOffset, newOffset,
+                &state->curOffset) == 0) {
+            break;
+        }
+    }
+
+    self->traceChunkEnd = state->buf + newOffset;
+    return state->buf + oldOffset;
+}
+
 /*
  * Entry point for sampling thread. The sampling interval in microseconds is
  * passed in as an argument.
+ *
+ * Each thread is stopped only for as long as it takes to walk its own
+ * stack.  Stopping them all for every tick made the threads we weren't
+ * looking at stall from one sample to the next, which skewed the
+ * profile toward whatever ran right after a resume.
  */
 static void* runSamplingThread(void* arg)
 {
     int intervalUs = (int) arg;
-    while (gDvm.methodTrace.traceEnabled) {
-        dvmSuspendAllThreads(SUSPEND_FOR_SAMPLING);
+    Thread* self = dvmThreadSelf();
+    MethodTraceState* state = &gDvm.methodTrace;
+    while (state->traceEnabled) {
+        /*
+         * We can't switch buffers from dvmMethodTraceAdd while holding
+         * the thread list lock, so make room before each round.
+         */
+        if (state->streaming &&
+            state->curOffset > state->bufferSize / 2) {
+            flushTraceBuffer(self, state->curOffset);
+        }
 
-        dvmLockThreadList(dvmThreadSelf());
+        dvmLockThreadList(self);
         for (Thread *thread = gDvm.threadList; thread != NULL; thread = thread->next) {
+            if (thread == self) {
+                getSample(thread);
+                continue;
+            }
+            dvmSuspendThreadForGc(thread);
             getSample(thread);
+            dvmResumeThreadForGc(thread);
         }
         dvmUnlockThreadList();
 
-        dvmResumeAllThreads(SUSPEND_FOR_SAMPLING);
-
         usleep(intervalUs);
     }
     return NULL;
@@ -308,6 +561,9 @@ bool dvmProfilingStartup()
      */
     memset(&gDvm.methodTrace, 0, sizeof(gDvm.methodTrace));
     dvmInitMutex(&gDvm.methodTrace.startStopLock);
+    dvmInitMutex(&gDvm.methodTrace.flushLock);
+    dvmInitMutex(&gDvm.methodTrace.writerLock);
+    pthread_cond_init(&gDvm.methodTrace.writerCond, NULL);
     pthread_cond_init(&gDvm.methodTrace.threadExitCond, NULL);
 
     assert(!dvmCheckException(dvmThreadSelf()));
@@ -319,6 +575,18 @@ bool dvmProfilingStartup()
     if (gDvm.executedInstrCounts == NULL)
         return false;
 
+    /*
+     * Counting pairs needs every instruction to go through
+     * dvmCheckBefore, so it is on for the life of the VM or not at all.
+     */
+    if (gDvm.countOpcodePairs) {
+        gDvm.executedPairCounts = (u4*) calloc(
+            kNumPackedOpcodes * kNumPackedOpcodes, sizeof(u4));
+        if (gDvm.executedPairCounts == NULL)
+            return false;
+        dvmStartInstructionCounting();
+    }
+
 #ifdef UPDATE_MAGIC_PAGE
     /*
      * If we're running on the emulator, there's a magic page into which
@@ -359,6 +627,7 @@ void dvmProfilingShutdown()
         munmap(gDvm.emulatorTracePage, SYSTEM_PAGE_SIZE);
 #endif
     free(gDvm.executedInstrCounts);
+    free(gDvm.executedPairCounts);
 }
 
 /*
@@ -395,7 +664,8 @@ static void updateActiveProfilers(ExecutionSubModes newMode, bool enable)
 
 
 /*
- * Reset the "cpuClockBase" field in all threads.
+ * Reset the "cpuClockBase" field and the trace buffer chunk in all
+ * threads.
  */
 static void resetCpuClockBase()
 {
@@ -405,6 +675,7 @@ static void resetCpuClockBase()
     for (thread = gDvm.threadList; thread != NULL; thread = thread->next) {
         thread->cpuClockBaseSet = false;
         thread->cpuClockBase = 0;
+        thread->traceChunkCur = thread->traceChunkEnd = NULL;
     }
     dvmUnlockThreadList();
 }
@@ -464,7 +735,7 @@ static int dumpMarkedMethods(void* vclazz, void* vfp)
     }
 
     for (i = 0; i < clazz->directMethodCount; i++) {
-        meth = &clazz->directMethods[i];
+        meth = &dvmGetDirectMethods(clazz)[i];
         if (meth->inProfile) {
             name = dvmDescriptorToName(meth->clazz->descriptor);
             fprintf(fp, "0x%08x\t%s\t%s\t%s\t%s\t%d\n", (int) meth,
@@ -523,7 +794,7 @@ void dvmMethodTraceStart(const char* traceFileName, int traceFd, int bufferSize,
      * We don't need to initialize the buffer, but doing so might remove
      * some fault overhead if the pages aren't mapped until touched.
      */
-    state->buf = (u1*) malloc(bufferSize);
+    state->buf = state->bufBase = (u1*) malloc(bufferSize);
     if (state->buf == NULL) {
         dvmThrowInternalError("buffer alloc failed");
         goto fail;
@@ -572,6 +843,34 @@ void dvmMethodTraceStart(const char* traceFileName, int traceFd, int bufferSize,
     }
 
     state->samplingEnabled = samplingEnabled;
+    state->chunkSize = state->recordSize * TRACE_CHUNK_RECORDS;
+    state->spilledRecords = 0;
+
+    /*
+     * File traces stream the records to an unlinked file next to the
+     * trace as the buffer fills, rather than dropping everything after
+     * it; they're copied into the trace file when it's written.
+     */
+    state->spillFile = NULL;
+    state->streaming = false;
+    state->spillError = false;
+    if (!directToDdms) {
+        char spillName[PATH_MAX];
+        snprintf(spillName, sizeof(spillName), "%s.spill-XXXXXX",
+            traceFileName);
+        int spillFd = mkstemp(spillName);
+        if (spillFd >= 0) {
+            unlink(spillName);
+            state->spillFile = fdopen(spillFd, "w+");
+            if (state->spillFile == NULL)
+                close(spillFd);
+        }
+        if (state->spillFile == NULL) {
+            ALOGW("Unable to create trace spill file for '%s': %s; "
+                  "the trace stops when the buffer fills",
+                  traceFileName, strerror(errno));
+        }
+    }
 
     /*
      * Output the header.
@@ -586,6 +885,11 @@ void dvmMethodTraceStart(const char* traceFileName, int traceFd, int bufferSize,
     }
     state->curOffset = TRACE_HEADER_LEN;
 
+    if (state->spillFile != NULL && !startTraceWriter(bufferSize)) {
+        fclose(state->spillFile);
+        state->spillFile = NULL;
+    }
+
     /*
      * Set the "enabled" flag.  Once we do this, threads will wait to be
      * signaled before exiting, so we have to make sure we wake them up.
@@ -613,41 +917,25 @@ void dvmMethodTraceStart(const char* traceFileName, int traceFd, int bufferSize,
     return;
 
 fail:
+    if (state->streaming)
+        stopTraceWriter();
     if (state->traceFile != NULL) {
         fclose(state->traceFile);
         state->traceFile = NULL;
     }
+    if (state->spillFile != NULL) {
+        fclose(state->spillFile);
+        state->spillFile = NULL;
+    }
     if (state->buf != NULL) {
-        free(state->buf);
-        state->buf = NULL;
+        free(state->bufBase);
+        state->buf = state->bufBase = NULL;
     }
     if (traceFd >= 0)
         close(traceFd);
     dvmUnlockMutex(&state->startStopLock);
 }
 
-/*
- * Run through the data buffer and pull out the methods that were visited.
- * Set a mark so that we know which ones to output.
- */
-static void markTouchedMethods(int endOffset)
-{
-    u1* ptr = gDvm.methodTrace.buf + TRACE_HEADER_LEN;
-    u1* end = gDvm.methodTrace.buf + endOffset;
-    size_t recordSize = gDvm.methodTrace.recordSize;
-    unsigned int methodVal;
-    Method* method;
-
-    while (ptr < end) {
-        methodVal = ptr[2] | (ptr[3] << 8) | (ptr[4] << 16)
-                    | (ptr[5] << 24);
-        method = (Method*) METHOD_ID(methodVal);
-
-        method->inProfile = true;
-        ptr += recordSize;
-    }
-}
-
 /*
  * Exercises the clocks in the same way they will be during profiling.
  */
@@ -705,6 +993,23 @@ TracingMode dvmGetMethodTracingMode()
     }
 }
 
+/*
+ * Copy the records spilled during the trace to the end of "out".
+ */
+static bool copySpillFile(FILE* spill, FILE* out)
+{
+    char buf[64 * 1024];
+    size_t len;
+
+    if (fflush(spill) != 0 || fseek(spill, 0, SEEK_SET) != 0)
+        return false;
+    while ((len = fread(buf, 1, sizeof(buf), spill)) != 0) {
+        if (fwrite(buf, len, 1, out) != 1)
+            return false;
+    }
+    return !ferror(spill);
+}
+
 /*
  * Stop method tracing.  We write the buffer to disk and generate a key
  * file so we can interpret it.
@@ -749,55 +1054,46 @@ void dvmMethodTraceStop()
     sched_yield();
     usleep(250 * 1000);
 
+    /*
+     * Wait for the sampling thread before we start reading and freeing
+     * the buffer.  It may be waiting for us to reach a safe point.
+     */
+    if (samplingEnabled) {
+        Thread* self = dvmThreadSelf();
+        ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+        if (pthread_join(state->samplingThreadHandle, NULL) != 0) {
+            ALOGW("Sampling thread join failed");
+        }
+        dvmChangeStatus(self, oldStatus);
+    }
+
     if ((state->flags & TRACE_ALLOC_COUNTS) != 0)
         dvmStopAllocCounting();
 
     /*
-     * It's possible under some circumstances for a thread to have advanced
-     * the data pointer but not written the method value.  It's possible
-     * (though less likely) for the data pointer to be advanced, or partial
-     * data written, while we're doing work here.
-     *
-     * To avoid seeing partially-written data, we grab state->curOffset here,
-     * and use our local copy from here on.  We then scan through what's
-     * already written.  If we see the fill pattern in what should be the
-     * method pointer, we cut things off early.  (If we don't, we'll fail
-     * when we dereference the pointer.)
-     *
-     * There's a theoretical possibility of interrupting another thread
-     * after it has partially written the method pointer, in which case
-     * we'll likely crash when we dereference it.  The possibility of
-     * this actually happening should be at or near zero.  Fixing it
-     * completely could be done by writing the thread number last and
-     * using a sentinel value to indicate a partially-written record,
-     * but that requires memory barriers.
+     * Let any buffer switch in progress finish (new ones see that tracing
+     * is off), and the writer write out what it was given.
      */
-    int finalCurOffset = state->curOffset;
+    Thread* self = dvmThreadSelf();
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockMutex(&state->flushLock);
+    if (state->streaming)
+        stopTraceWriter();
+    dvmChangeStatus(self, oldStatus);
 
-    size_t recordSize = state->recordSize;
-    if (finalCurOffset > TRACE_HEADER_LEN) {
-        u4 fillVal = METHOD_ID(FILL_PATTERN);
-        u1* scanPtr = state->buf + TRACE_HEADER_LEN;
-
-        while (scanPtr < state->buf + finalCurOffset) {
-            u4 methodVal = scanPtr[2] | (scanPtr[3] << 8) | (scanPtr[4] << 16)
-                        | (scanPtr[5] << 24);
-            if (METHOD_ID(methodVal) == fillVal) {
-                u1* scanBase = state->buf + TRACE_HEADER_LEN;
-                ALOGW("Found unfilled record at %d (of %d)",
-                    (scanPtr - scanBase) / recordSize,
-                    (finalCurOffset - TRACE_HEADER_LEN) / recordSize);
-                finalCurOffset = scanPtr - state->buf;
-                break;
-            }
+    /*
+     * The threads' chunks end in unused records that still hold the fill
+     * pattern.  Squeeze them out; what's left is contiguous.
+     */
+    int finalCurOffset = compactTraceBuffer(state->buf, state->curOffset);
+    dvmUnlockMutex(&state->flushLock);
 
-            scanPtr += recordSize;
-        }
-    }
+    size_t recordSize = state->recordSize;
+    int numRecords = (state->spillError ? 0 : state->spilledRecords) +
+        (finalCurOffset - TRACE_HEADER_LEN) / recordSize;
 
     ALOGI("TRACE STOPPED%s: writing %d records",
-        state->overflow ? " (NOTE: overflowed buffer)" : "",
-        (finalCurOffset - TRACE_HEADER_LEN) / recordSize);
+        state->overflow ? " (NOTE: overflowed buffer)" : "", numRecords);
     if (gDvm.debuggerActive) {
         ALOGW("WARNING: a debugger is active; method-tracing results "
              "will be skewed");
@@ -808,7 +1104,7 @@ void dvmMethodTraceStop()
      */
     u4 clockNsec = getClockOverhead();
 
-    markTouchedMethods(finalCurOffset);
+    markTouchedMethods(state->buf, finalCurOffset);
 
     char* memStreamPtr;
     size_t memStreamSize;
@@ -837,8 +1133,7 @@ void dvmMethodTraceStop()
         fprintf(state->traceFile, "clock=wall\n");
     }
     fprintf(state->traceFile, "elapsed-time-usec=%llu\n", elapsed);
-    fprintf(state->traceFile, "num-method-calls=%d\n",
-        (finalCurOffset - TRACE_HEADER_LEN) / state->recordSize);
+    fprintf(state->traceFile, "num-method-calls=%d\n", numRecords);
     fprintf(state->traceFile, "clock-call-overhead-nsec=%d\n", clockNsec);
     fprintf(state->traceFile, "vm=dalvik\n");
     if ((state->flags & TRACE_ALLOC_COUNTS) != 0) {
@@ -869,21 +1164,39 @@ void dvmMethodTraceStop()
         iov[1].iov_len = finalCurOffset;
         dvmDbgDdmSendChunkV(CHUNK_TYPE("MPSE"), iov, 2);
     } else {
-        /* append the profiling data */
-        if (fwrite(state->buf, finalCurOffset, 1, state->traceFile) != 1) {
+        /*
+         * Append the profiling data: the header, whatever was spilled
+         * and then what's left in the buffer.
+         */
+        bool ok = fwrite(state->buf, TRACE_HEADER_LEN, 1,
+                         state->traceFile) == 1;
+        if (ok && state->spillFile != NULL && !state->spillError) {
+            ok = copySpillFile(state->spillFile, state->traceFile);
+        }
+        int dataLen = finalCurOffset - TRACE_HEADER_LEN;
+        if (ok && dataLen != 0) {
+            ok = fwrite(state->buf + TRACE_HEADER_LEN, dataLen, 1,
+                        state->traceFile) == 1;
+        }
+        if (!ok) {
             int err = errno;
-            ALOGE("trace fwrite(%d) failed: %s",
-                finalCurOffset, strerror(err));
+            ALOGE("trace fwrite(%zd) failed: %s",
+                numRecords * recordSize, strerror(err));
             dvmThrowExceptionFmt(gDvm.exRuntimeException,
                 "Trace data write failed: %s", strerror(err));
         }
     }
 
     /* done! */
-    free(state->buf);
-    state->buf = NULL;
+    free(state->bufBase);
+    state->buf = state->bufBase = NULL;
+    state->spareBuf = NULL;
     fclose(state->traceFile);
     state->traceFile = NULL;
+    if (state->spillFile != NULL) {
+        fclose(state->spillFile);
+        state->spillFile = NULL;
+    }
 
     /* free and clear sampling traces held by all threads */
     if (samplingEnabled) {
@@ -893,12 +1206,6 @@ void dvmMethodTraceStop()
     /* wake any threads that were waiting for profiling to complete */
     dvmBroadcastCond(&state->threadExitCond);
     dvmUnlockMutex(&state->startStopLock);
-
-    /* make sure the sampling thread has stopped */
-    if (samplingEnabled &&
-        pthread_join(state->samplingThreadHandle, NULL) != 0) {
-        ALOGW("Sampling thread join failed");
-    }
 }
 
 /*
@@ -926,40 +1233,32 @@ void dvmMethodTraceReadClocks(Thread* self, u4* cpuClockDiff,
 /*
  * We just did something with a method.  Emit a record.
  *
- * Multiple threads may be banging on this all at once.  We use atomic ops
- * rather than mutexes for speed.
+ * Multiple threads may be banging on this all at once.  Each one fills
+ * a chunk of the buffer it claimed with an atomic op, so they only
+ * touch "curOffset" once every TRACE_CHUNK_RECORDS records.
  */
 void dvmMethodTraceAdd(Thread* self, const Method* method, int action,
                        u4 cpuClockDiff, u4 wallClockDiff)
 {
     MethodTraceState* state = &gDvm.methodTrace;
     u4 methodVal;
-    int oldOffset, newOffset;
     u1* ptr;
 
     assert(method != NULL);
 
-    /*
-     * Advance "curOffset" atomically.
-     */
-    do {
-        oldOffset = state->curOffset;
-        newOffset = oldOffset + state->recordSize;
-        if (newOffset > state->bufferSize) {
-            state->overflow = true;
+    ptr = self->traceChunkCur;
+    if (ptr == self->traceChunkEnd) {
+        ptr = claimTraceChunk(self);
+        if (ptr == NULL) {
+            self->traceChunkCur = self->traceChunkEnd = NULL;
             return;
         }
-    } while (android_atomic_release_cas(oldOffset, newOffset,
-            &state->curOffset) != 0);
+    }
+    self->traceChunkCur = ptr + state->recordSize;
 
     //assert(METHOD_ACTION((u4) method) == 0);
 
     methodVal = METHOD_COMBINE((u4) method, action);
-
-    /*
-     * Write data into "oldOffset".
-     */
-    ptr = state->buf + oldOffset;
     *ptr++ = (u1) self->threadId;
     *ptr++ = (u1) (self->threadId >> 8);
     *ptr++ = (u1) methodVal;
@@ -1183,6 +1482,49 @@ void dvmStopInstructionCounting()
 }
 
 
+/*
+ * Print the pairs of opcodes most often run back to back.  As with the
+ * counts themselves, no attempt is made to get a consistent snapshot.
+ */
+void dvmDumpOpcodePairs(const DebugOutputTarget* target)
+{
+    enum { kTopPairs = 32 };
+    const u4* counts = gDvm.executedPairCounts;
+    u4 top[kTopPairs];
+    size_t numTop = 0;
+    u8 total = 0;
+
+    if (counts == NULL)
+        return;
+
+    for (u4 i = 0; i < kNumPackedOpcodes * kNumPackedOpcodes; i++) {
+        u4 count = counts[i];
+        if (count == 0)
+            continue;
+        total += count;
+        if (numTop == kTopPairs && count <= counts[top[numTop - 1]])
+            continue;
+
+        /* insert into the sorted list, dropping the smallest if full */
+        size_t j = (numTop < kTopPairs) ? numTop++ : numTop - 1;
+        while (j > 0 && counts[top[j - 1]] < count) {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = i;
+    }
+
+    dvmPrintDebugMessage(target, "Opcode pairs: %llu counted\n", total);
+    for (size_t i = 0; i < numTop; i++) {
+        u4 count = counts[top[i]];
+        dvmPrintDebugMessage(target, "  %10u %5.2f%%  %s, %s\n",
+            count, 100.0 * count / total,
+            dexGetOpcodeName((Opcode) (top[i] / kNumPackedOpcodes)),
+            dexGetOpcodeName((Opcode) (top[i] % kNumPackedOpcodes)));
+    }
+    dvmPrintDebugMessage(target, "\n");
+}
+
 /*
  * Start alloc counting.  Note this doesn't affect the "active profilers"
  * count, since the interpreter loop is not involved.
@@ -50,6 +50,28 @@ struct MethodTraceState {
     u8      startWhen;
     int     overflow;
 
+    /*
+     * Threads claim the buffer "chunkSize" bytes at a time.  File traces
+     * are streamed: "bufBase" is split in two, and when the half in "buf"
+     * fills up, the threads switch to "spareBuf" under "flushLock" while
+     * the writer thread appends the full one to "spillFile".
+     */
+    int     chunkSize;
+    u1*     bufBase;
+    bool    streaming;
+    pthread_mutex_t flushLock;
+    FILE*   spillFile;
+    int     spilledRecords;
+    bool    spillError;
+
+    pthread_t       writerHandle;
+    pthread_mutex_t writerLock;
+    pthread_cond_t  writerCond;
+    bool    writerStop;
+    u1*     spareBuf;
+    u1*     pendingBuf;
+    int     pendingEnd;
+
     int     traceVersion;
     size_t  recordSize;
 
@@ -111,6 +133,12 @@ void dvmEmulatorTraceStop(void);
 void dvmStartInstructionCounting();
 void dvmStopInstructionCounting();
 
+/*
+ * Dump the most frequent opcode pairs counted with -Xopcodepairs, if that
+ * was given.
+ */
+void dvmDumpOpcodePairs(const DebugOutputTarget* target);
+
 /*
  * Bit flags for dvmMethodTraceStart "flags" argument.  These must match
  * the values in android.os.Debug.
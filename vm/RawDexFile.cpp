@@ -190,7 +190,7 @@ int dvmRawDexFileOpen(const char* fileName, const char* odexOutputName,
 
         if (result) {
             result = dvmOptimizeDexFile(optFd, dexOffset, fileSize,
-                fileName, modTime, adler32, isBootstrap);
+                fileName, cachedName, modTime, adler32, isBootstrap, false);
         }
 
         if (!result) {
@@ -213,6 +213,7 @@ int dvmRawDexFileOpen(const char* fileName, const char* odexOutputName,
         ALOGI("Unable to map cached %s", fileName);
         goto bail;
     }
+    dvmStartupPagesAdvise(pDvmDex, cachedName);
 
     if (locked) {
         /* unlock the fd */
@@ -20,6 +20,12 @@
  * status of all threads.
  */
 #include "Dalvik.h"
+#include "alloc/GcHistory.h"
+#include "alloc/Heap.h"
+#include "alloc/HeapSource.h"
+#if defined(WITH_JIT)
+#include "interp/Jit.h"
+#endif
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -96,15 +102,11 @@ bail:
 }
 
 /*
- * Dump the stack traces for all threads to the supplied file, putting
- * a timestamp header on it.
+ * Print the "----- pid N at <time> -----" header that starts a dump,
+ * with "what" in front of the pid.
  */
-static void logThreadStacks(FILE* fp)
+static void printDumpHeader(const DebugOutputTarget* target, const char* what)
 {
-    DebugOutputTarget target;
-
-    dvmCreateFileOutputTarget(&target, fp);
-
     pid_t pid = getpid();
     time_t now = time(NULL);
     struct tm* ptm;
@@ -114,13 +116,58 @@ static void logThreadStacks(FILE* fp)
 #else
     ptm = localtime(&now);
 #endif
-    dvmPrintDebugMessage(&target,
-        "\n\n----- pid %d at %04d-%02d-%02d %02d:%02d:%02d -----\n",
-        pid, ptm->tm_year + 1900, ptm->tm_mon+1, ptm->tm_mday,
+    dvmPrintDebugMessage(target,
+        "\n\n----- %spid %d at %04d-%02d-%02d %02d:%02d:%02d -----\n",
+        what, pid, ptm->tm_year + 1900, ptm->tm_mon+1, ptm->tm_mday,
         ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
-    printProcessName(&target);
+    printProcessName(target);
+}
+
+/*
+ * Append "len" bytes of "buf" to "fileName" in a single write, creating
+ * the file if necessary.  "what" names the contents in the log.
+ */
+static void appendToDumpFile(const char* fileName, const char* buf,
+    size_t len, const char* what)
+{
+    /*
+     * It needs to be world-writable so other processes can write to it.
+     */
+    int fd = open(fileName, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (fd < 0) {
+        ALOGE("Unable to open %s file '%s': %s",
+            what, fileName, strerror(errno));
+        return;
+    }
+    ssize_t actual = TEMP_FAILURE_RETRY(write(fd, buf, len));
+    if (actual != (ssize_t) len) {
+        ALOGE("Failed to write %s to %s (%d of %zd): %s",
+            what, fileName, (int) actual, len, strerror(errno));
+    } else {
+        ALOGI("Wrote %s to '%s'", what, fileName);
+    }
+    close(fd);
+}
+
+/*
+ * Dump the stack traces for all threads to the supplied file, putting
+ * a timestamp header on it.
+ */
+static void logThreadStacks(FILE* fp)
+{
+    DebugOutputTarget target;
+
+    dvmCreateFileOutputTarget(&target, fp);
+
+    pid_t pid = getpid();
+    printDumpHeader(&target, "");
     dvmPrintDebugMessage(&target, "\n");
     dvmDumpJniStats(&target);
+    dvmGcHistoryDump(&target);
+    dvmDumpHugePageCoverage(&target);
+    dvmDumpSafepointStats(&target);
+    dvmStartupTimelineDump(&target);
+    dvmDumpOpcodePairs(&target);
     dvmDumpAllThreadsEx(&target, true);
     fprintf(fp, "----- end %d -----\n", pid);
 }
@@ -147,12 +194,18 @@ static void handleSigQuit()
     dvmSuspendAllThreads(SUSPEND_FOR_STACK_DUMP);
 
     dvmDumpLoaderStats("sig");
+    dvmLineTableDumpStats();
+    dvmCheckClassTablePerf();
 
     if (gDvm.stackTraceFile == NULL) {
         /* just dump to log */
         DebugOutputTarget target;
         dvmCreateLogOutputTarget(&target, ANDROID_LOG_INFO, LOG_TAG);
         dvmDumpJniStats(&target);
+        dvmGcHistoryDump(&target);
+        dvmDumpHugePageCoverage(&target);
+        dvmDumpSafepointStats(&target);
+        dvmDumpOpcodePairs(&target);
         dvmDumpAllThreadsEx(&target, true);
     } else {
         /* write to memory buffer */
@@ -181,32 +234,70 @@ static void handleSigQuit()
          * into VMWAIT for the duration.
          */
         ThreadStatus oldStatus = dvmChangeStatus(dvmThreadSelf(), THREAD_VMWAIT);
-
-        /*
-         * Open the stack trace output file, creating it if necessary.  It
-         * needs to be world-writable so other processes can write to it.
-         */
-        int fd = open(gDvm.stackTraceFile, O_WRONLY | O_APPEND | O_CREAT, 0666);
-        if (fd < 0) {
-            ALOGE("Unable to open stack trace file '%s': %s",
-                gDvm.stackTraceFile, strerror(errno));
-        } else {
-            ssize_t actual = TEMP_FAILURE_RETRY(write(fd, traceBuf, traceLen));
-            if (actual != (ssize_t) traceLen) {
-                ALOGE("Failed to write stack traces to %s (%d of %zd): %s",
-                    gDvm.stackTraceFile, (int) actual, traceLen,
-                    strerror(errno));
-            } else {
-                ALOGI("Wrote stack traces to '%s'", gDvm.stackTraceFile);
-            }
-            close(fd);
-        }
-
+        appendToDumpFile(gDvm.stackTraceFile, traceBuf, traceLen,
+            "stack trace");
         free(traceBuf);
         dvmChangeStatus(dvmThreadSelf(), oldStatus);
     }
 }
 
+/*
+ * Respond to a SIGUSR2, when -Xperfsnapshotfile is set, by appending a
+ * snapshot of the VM's performance counters and a heap histogram to that
+ * file.  The threads aren't suspended: every part takes its own lock,
+ * and the histogram holds the heap lock for one walk of the live
+ * objects, which stalls allocating threads but nobody else.
+ */
+static void handlePerfSnapshot()
+{
+    char* buf = NULL;
+    size_t len;
+    FILE* memfp = open_memstream(&buf, &len);
+    if (memfp == NULL) {
+        ALOGE("Unable to create memstream for perf snapshot");
+        return;
+    }
+
+    DebugOutputTarget target;
+    dvmCreateFileOutputTarget(&target, memfp);
+    printDumpHeader(&target, "perf snapshot ");
+
+    dvmPrintDebugMessage(&target, "\n[jni]\n");
+    dvmDumpJniStats(&target);
+    dvmPrintDebugMessage(&target, "\n[gc]\n");
+    dvmLockHeap();
+    size_t footprint = dvmHeapSourceGetValue(HS_FOOTPRINT, NULL, 0);
+    size_t allowed = dvmHeapSourceGetValue(HS_ALLOWED_FOOTPRINT, NULL, 0);
+    size_t allocated = dvmHeapSourceGetValue(HS_BYTES_ALLOCATED, NULL, 0);
+    size_t objects = dvmHeapSourceGetValue(HS_OBJECTS_ALLOCATED, NULL, 0);
+    dvmUnlockHeap();
+    dvmPrintDebugMessage(&target,
+        "Heap: footprint %zd, allowed %zd, %zd bytes in %zd objects\n",
+        footprint, allowed, allocated, objects);
+    dvmGcHistoryDump(&target);
+    dvmDumpHugePageCoverage(&target);
+    dvmPrintDebugMessage(&target, "\n[safepoints]\n");
+    dvmDumpSafepointStats(&target);
+    dvmPrintDebugMessage(&target, "\n[monitors]\n");
+    dvmDumpMonitorStats(&target);
+    if (gDvm.lockProfSites) {
+        dvmDumpContentionSites(&target, 20);
+    }
+#if defined(WITH_JIT)
+    dvmPrintDebugMessage(&target, "\n[jit]\n");
+    dvmJitPrintStats(&target);
+#endif
+    dvmPrintDebugMessage(&target, "\n[heap histogram]\n");
+    dvmHeapHistogramDump(&target, 50);
+    dvmPrintDebugMessage(&target, "----- end %d -----\n", getpid());
+    fclose(memfp);
+
+    ThreadStatus oldStatus = dvmChangeStatus(dvmThreadSelf(), THREAD_VMWAIT);
+    appendToDumpFile(gDvm.perfSnapshotFile, buf, len, "perf snapshot");
+    free(buf);
+    dvmChangeStatus(dvmThreadSelf(), oldStatus);
+}
+
 /*
  * Respond to a SIGUSR1 by forcing a GC.
  */
@@ -267,6 +358,9 @@ static void* signalCatcherThreadStart(void* arg)
     sigaddset(&mask, SIGUSR1);
 #if defined(WITH_JIT) && defined(WITH_JIT_TUNING)
     sigaddset(&mask, SIGUSR2);
+#else
+    if (gDvm.perfSnapshotFile != NULL)
+        sigaddset(&mask, SIGUSR2);
 #endif
 
     while (true) {
@@ -311,11 +405,15 @@ loop:
         case SIGUSR1:
             handleSigUsr1();
             break;
-#if defined(WITH_JIT) && defined(WITH_JIT_TUNING)
         case SIGUSR2:
+            if (gDvm.perfSnapshotFile != NULL) {
+                handlePerfSnapshot();
+                break;
+            }
+#if defined(WITH_JIT) && defined(WITH_JIT_TUNING)
             handleSigUsr2();
-            break;
 #endif
+            break;
         default:
             ALOGE("unexpected signal %d", rcvd);
             break;
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Startup page profiles for mapped DEX files.
+ *
+ * Starting cold, the VM takes page faults all over each optimized DEX
+ * it maps, and the kernel's readahead around each fault mostly reads
+ * pages nobody wants.  With -Xstartuppages:<dir>, the first time a file
+ * is mapped we note it, and once startup is over (when the zygote first
+ * forks, or -Xstartuppagewindow milliseconds after an ordinary VM or an
+ * app process starts) we ask mincore() which pages of it are resident
+ * and write them to a profile in <dir>.  Every later time the file is
+ * mapped, the profile's ranges get MADV_WILLNEED, so they're read in
+ * ahead of time in large requests, and the rest of the mapping gets
+ * MADV_RANDOM, so faults there read only what they need.
+ *
+ * A profile is a text file named after the cache file, with '/' turned
+ * into '@' and ".pages" appended:
+ *
+ *   # comment lines start with '#'
+ *   <mapping length> <DEX checksum>
+ *   <first page> <page count>
+ *   ...
+ *
+ * If the length or checksum no longer match, the file has been rebuilt;
+ * the profile is ignored and a new one is recorded.  A file that had a
+ * profile applied is not recorded again, since the prefetched pages
+ * would all show up as resident.
+ */
+#include "Dalvik.h"
+#include "StartupPages.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MAX_PROFILE_LINE 256
+
+/* a mapped file we may need to record a profile for */
+struct StartupPageFile {
+    DvmDex*         pDvmDex;
+    char*           profileName;
+    bool            inherited;      /* mapped by the zygote */
+    bool            recorded;
+    StartupPageFile* next;
+};
+
+static pthread_mutex_t gStartupPagesLock;
+static pthread_cond_t gStartupPagesCond;
+static pthread_t gRecorderHandle;
+static bool gRecorderRunning;
+static StartupPageFile* gFiles;
+
+static std::string profileFileName(const char* cacheFileName)
+{
+    std::string name(gDvm.startupPageDir);
+    name += '/';
+    const char* cp = cacheFileName;
+    if (*cp == '/')
+        cp++;
+    for ( ; *cp != '\0'; cp++)
+        name += (*cp == '/') ? '@' : *cp;
+    name += ".pages";
+    return name;
+}
+
+/*
+ * Read the profile in "fileName" and apply it to the mapping.  Returns
+ * "true" if there was a profile that matched.
+ */
+static bool applyProfile(const DvmDex* pDvmDex, const char* fileName)
+{
+    FILE* fp = fopen(fileName, "r");
+    if (fp == NULL)
+        return false;
+
+    u1* base = (u1*) pDvmDex->memMap.baseAddr;
+    size_t length = pDvmDex->memMap.baseLength;
+    size_t numPages = (length + SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE;
+    char line[MAX_PROFILE_LINE];
+    bool haveHeader = false;
+    size_t prefetched = 0;
+    int numRanges = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+
+        if (!haveHeader) {
+            unsigned long fileLength;
+            unsigned int checksum;
+            if (sscanf(line, "%lu %x", &fileLength, &checksum) != 2 ||
+                fileLength != length || checksum != pDvmDex->pHeader->checksum)
+            {
+                ALOGV("Startup page profile '%s' is stale", fileName);
+                break;
+            }
+            haveHeader = true;
+
+            /* everything the profile doesn't name is read on demand */
+            if (madvise(base, length, MADV_RANDOM) != 0) {
+                ALOGW("madvise(RANDOM) failed: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        unsigned long first, count;
+        if (sscanf(line, "%lu %lu", &first, &count) != 2 ||
+            first >= numPages || count > numPages - first)
+        {
+            ALOGW("Skipping bad line in startup page profile '%s'",
+                fileName);
+            continue;
+        }
+        if (madvise(base + first * SYSTEM_PAGE_SIZE,
+                count * SYSTEM_PAGE_SIZE, MADV_WILLNEED) != 0)
+        {
+            ALOGW("madvise(WILLNEED) failed: %s", strerror(errno));
+            continue;
+        }
+        prefetched += count;
+        numRanges++;
+    }
+    fclose(fp);
+
+    if (haveHeader) {
+        ALOGV("Prefetching %zu of %zu pages in %d ranges for '%s'",
+            prefetched, numPages, numRanges, fileName);
+    }
+    return haveHeader;
+}
+
+/*
+ * Write the resident pages of one mapping to its profile.  The profile is
+ * written to a temporary file and renamed, so a reader never sees half
+ * of one.
+ */
+static void recordProfile(StartupPageFile* pFile)
+{
+    const DvmDex* pDvmDex = pFile->pDvmDex;
+    u1* base = (u1*) pDvmDex->memMap.baseAddr;
+    size_t length = pDvmDex->memMap.baseLength;
+    size_t numPages = (length + SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE;
+
+    pFile->recorded = true;
+
+    unsigned char* vec = (unsigned char*) malloc(numPages);
+    if (vec == NULL)
+        return;
+    if (mincore(base, length, vec) != 0) {
+        ALOGW("mincore for startup page profile failed: %s",
+            strerror(errno));
+        free(vec);
+        return;
+    }
+
+    std::string tmpName(pFile->profileName);
+    tmpName += ".tmp";
+    FILE* fp = fopen(tmpName.c_str(), "w");
+    if (fp == NULL) {
+        ALOGW("Unable to write startup page profile '%s': %s",
+            tmpName.c_str(), strerror(errno));
+        free(vec);
+        return;
+    }
+
+    fprintf(fp, "# startup page profile, pages of %d bytes\n",
+        SYSTEM_PAGE_SIZE);
+    fprintf(fp, "%zu %08x\n", length, pDvmDex->pHeader->checksum);
+
+    size_t resident = 0;
+    for (size_t i = 0; i < numPages; ) {
+        if ((vec[i] & 1) == 0) {
+            i++;
+            continue;
+        }
+        size_t first = i;
+        while (i < numPages && (vec[i] & 1) != 0)
+            i++;
+        fprintf(fp, "%zu %zu\n", first, i - first);
+        resident += i - first;
+    }
+    free(vec);
+
+    bool okay = (fclose(fp) == 0);
+    if (okay && rename(tmpName.c_str(), pFile->profileName) != 0)
+        okay = false;
+    if (!okay) {
+        ALOGW("Unable to write startup page profile '%s': %s",
+            pFile->profileName, strerror(errno));
+        unlink(tmpName.c_str());
+        return;
+    }
+
+    ALOGD("Recorded %zu of %zu startup pages in '%s'", resident, numPages,
+        pFile->profileName);
+}
+
+/*
+ * Record every file that needs it.  Call with the lock held.
+ */
+static void recordPending(bool includeInherited)
+{
+    for (StartupPageFile* pFile = gFiles; pFile != NULL; pFile = pFile->next) {
+        if (!pFile->recorded && (includeInherited || !pFile->inherited))
+            recordProfile(pFile);
+    }
+}
+
+bool dvmStartupPagesStartup()
+{
+    dvmInitMutex(&gStartupPagesLock);
+    dvmInitCondForTimedWait(&gStartupPagesCond);
+    return true;
+}
+
+void dvmStartupPagesShutdown()
+{
+    dvmLockMutex(&gStartupPagesLock);
+    bool wasRunning = gRecorderRunning;
+    gRecorderRunning = false;
+    if (wasRunning)
+        pthread_cond_signal(&gStartupPagesCond);
+    dvmUnlockMutex(&gStartupPagesLock);
+
+    if (wasRunning && pthread_join(gRecorderHandle, NULL) != 0)
+        ALOGW("startup page recorder thread join failed");
+
+    while (gFiles != NULL) {
+        StartupPageFile* pNext = gFiles->next;
+        free(gFiles->profileName);
+        free(gFiles);
+        gFiles = pNext;
+    }
+}
+
+void dvmStartupPagesAdvise(DvmDex* pDvmDex, const char* cacheFileName)
+{
+    if (gDvm.startupPageDir == NULL || !pDvmDex->isMappedReadOnly)
+        return;
+
+    std::string profileName = profileFileName(cacheFileName);
+    if (applyProfile(pDvmDex, profileName.c_str()))
+        return;
+
+    StartupPageFile* pFile =
+        (StartupPageFile*) calloc(1, sizeof(StartupPageFile));
+    if (pFile == NULL)
+        return;
+    pFile->pDvmDex = pDvmDex;
+    pFile->profileName = strdup(profileName.c_str());
+    pFile->inherited = gDvm.zygote;
+    if (pFile->profileName == NULL) {
+        free(pFile);
+        return;
+    }
+
+    dvmLockMutex(&gStartupPagesLock);
+    pFile->next = gFiles;
+    gFiles = pFile;
+    dvmUnlockMutex(&gStartupPagesLock);
+}
+
+void dvmStartupPagesForget(DvmDex* pDvmDex)
+{
+    if (gDvm.startupPageDir == NULL)
+        return;
+
+    dvmLockMutex(&gStartupPagesLock);
+    for (StartupPageFile** ppFile = &gFiles; *ppFile != NULL;
+         ppFile = &(*ppFile)->next)
+    {
+        StartupPageFile* pFile = *ppFile;
+        if (pFile->pDvmDex == pDvmDex) {
+            *ppFile = pFile->next;
+            free(pFile->profileName);
+            free(pFile);
+            break;
+        }
+    }
+    dvmUnlockMutex(&gStartupPagesLock);
+}
+
+void dvmStartupPagesRecord()
+{
+    if (gDvm.startupPageDir == NULL)
+        return;
+
+    dvmLockMutex(&gStartupPagesLock);
+    recordPending(true);
+    dvmUnlockMutex(&gStartupPagesLock);
+}
+
+static void* recorderThreadStart(void* arg)
+{
+    Thread* self = dvmThreadSelf();
+    u8 deadline = dvmGetRelativeTimeUsec() +
+        (u8) gDvm.startupPageWindowMs * 1000;
+
+    dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockMutex(&gStartupPagesLock);
+    while (gRecorderRunning) {
+        u8 now = dvmGetRelativeTimeUsec();
+        if (now >= deadline) {
+            recordPending(false);
+            break;
+        }
+        u8 waitMsec = (deadline - now + 999) / 1000;
+        dvmRelativeCondWait(&gStartupPagesCond, &gStartupPagesLock,
+            (s8) waitMsec, 0);
+    }
+    dvmUnlockMutex(&gStartupPagesLock);
+    return NULL;
+}
+
+bool dvmStartupPagesStartRecorder()
+{
+    if (gDvm.startupPageDir == NULL)
+        return true;
+
+    dvmLockMutex(&gStartupPagesLock);
+    if (gRecorderRunning) {
+        dvmUnlockMutex(&gStartupPagesLock);
+        return true;
+    }
+    gRecorderRunning = true;
+    dvmUnlockMutex(&gStartupPagesLock);
+
+    if (!dvmCreateInternalThread(&gRecorderHandle, "Startup pages",
+            recorderThreadStart, NULL))
+    {
+        gRecorderRunning = false;
+        return false;
+    }
+    return true;
+}
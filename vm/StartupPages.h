@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Startup page profiles for mapped DEX files.
+ */
+#ifndef DALVIK_STARTUPPAGES_H_
+#define DALVIK_STARTUPPAGES_H_
+
+struct DvmDex;
+
+bool dvmStartupPagesStartup(void);
+void dvmStartupPagesShutdown(void);
+
+/*
+ * Called when the optimized DEX in "cacheFileName" has been mapped.  If
+ * there's a profile for it, the pages it lists are prefetched and the
+ * rest of the mapping is marked for random access; if not, the file is
+ * remembered so a profile can be recorded for it.  Does nothing unless
+ * -Xstartuppages was given.
+ */
+void dvmStartupPagesAdvise(DvmDex* pDvmDex, const char* cacheFileName);
+
+/*
+ * Called when a DvmDex is about to be unmapped.
+ */
+void dvmStartupPagesForget(DvmDex* pDvmDex);
+
+/*
+ * Record profiles for the files mapped so far.  The zygote calls this
+ * before it first forks, when it has finished preloading.
+ */
+void dvmStartupPagesRecord(void);
+
+/*
+ * Start a thread that records profiles for the files this process maps
+ * itself, once the startup window has passed.
+ */
+bool dvmStartupPagesStartRecorder(void);
+
+#endif  // DALVIK_STARTUPPAGES_H_
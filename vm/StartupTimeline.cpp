@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Startup timeline.
+ *
+ * Each step records when it finished, relative to the start of the
+ * timeline, and the CPU time and system thread ID of the thread that
+ * finished it.  A step's cost is measured from the previous step of the
+ * same thread, so the steps that run in the background after a fork are
+ * kept apart from the ones the new process waits for.  The first steps
+ * of dvmStartup() come before the thread list, so threads are identified
+ * by their system thread ID.
+ */
+#include "Dalvik.h"
+#include "StartupTimeline.h"
+
+#ifdef HAVE_ANDROID_OS
+#include "cutils/properties.h"
+#endif
+
+#define kMaxTimelineSteps   96
+#define kMaxStepName        40
+
+struct TimelineStep {
+    char        name[kMaxStepName];
+    u8          whenUsec;           /* since the timeline began */
+    u8          cpuUsec;            /* thread CPU time when it finished */
+    pid_t       tid;
+};
+
+static pthread_mutex_t gTimelineLock;
+static const char* gTimelineName;
+static u8 gTimelineStartUsec;
+static u8 gTimelineStartCpuUsec;
+static pid_t gTimelineStartTid;
+static TimelineStep gSteps[kMaxTimelineSteps];
+static int gNumSteps;
+static int gNumDropped;
+
+void dvmStartupTimelineStartup()
+{
+    dvmInitMutex(&gTimelineLock);
+}
+
+void dvmStartupTimelineBegin(const char* name)
+{
+    dvmLockMutex(&gTimelineLock);
+    gTimelineName = name;
+    gTimelineStartUsec = dvmGetRelativeTimeUsec();
+    gTimelineStartCpuUsec = dvmGetThreadCpuTimeUsec();
+    gTimelineStartTid = dvmGetSysThreadId();
+    gNumSteps = 0;
+    gNumDropped = 0;
+    dvmUnlockMutex(&gTimelineLock);
+}
+
+void dvmStartupTimelineMark(const char* step)
+{
+    u8 now = dvmGetRelativeTimeUsec();
+    u8 cpuNow = dvmGetThreadCpuTimeUsec();
+    pid_t tid = dvmGetSysThreadId();
+
+    dvmLockMutex(&gTimelineLock);
+    if (gTimelineName == NULL) {
+        dvmUnlockMutex(&gTimelineLock);
+        return;
+    }
+    u8 when = now - gTimelineStartUsec;
+    if (gNumSteps < kMaxTimelineSteps) {
+        TimelineStep* pStep = &gSteps[gNumSteps++];
+        strlcpy(pStep->name, step, sizeof(pStep->name));
+        pStep->whenUsec = when;
+        pStep->cpuUsec = cpuNow;
+        pStep->tid = tid;
+    } else {
+        gNumDropped++;
+    }
+    const char* name = gTimelineName;
+    dvmUnlockMutex(&gTimelineLock);
+
+    if (gDvm.verboseStartup) {
+        ALOGD("%s: %s done at +%lluus on tid %d", name, step, when, tid);
+    }
+}
+
+void dvmStartupTimelineMarkFile(const char* kind, const char* fileName)
+{
+    const char* base = strrchr(fileName, '/');
+    base = (base != NULL) ? base + 1 : fileName;
+    char step[kMaxStepName];
+    snprintf(step, sizeof(step), "%s %s", kind, base);
+    dvmStartupTimelineMark(step);
+}
+
+void dvmStartupTimelineFinish()
+{
+    bool dump = gDvm.verboseStartup;
+#ifdef HAVE_ANDROID_OS
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("dalvik.vm.startuptrace", value, "") > 0 &&
+        strcmp(value, "true") == 0)
+    {
+        dump = true;
+    }
+#endif
+    if (dump) {
+        DebugOutputTarget target;
+        dvmCreateLogOutputTarget(&target, ANDROID_LOG_INFO, LOG_TAG);
+        dvmStartupTimelineDump(&target);
+    }
+}
+
+void dvmStartupTimelineDump(const DebugOutputTarget* target)
+{
+    dvmLockMutex(&gTimelineLock);
+    if (gTimelineName == NULL || gNumSteps == 0) {
+        dvmUnlockMutex(&gTimelineLock);
+        return;
+    }
+
+    dvmPrintDebugMessage(target, "Startup timeline '%s' (tid %d began it):\n",
+        gTimelineName, gTimelineStartTid);
+    dvmPrintDebugMessage(target, "  %-40s %10s %10s %10s %6s\n",
+        "step", "at(us)", "wall(us)", "cpu(us)", "tid");
+    for (int i = 0; i < gNumSteps; i++) {
+        const TimelineStep* pStep = &gSteps[i];
+
+        /* find the previous step of the same thread */
+        u8 prevWhen = 0;
+        u8 prevCpu = 0;
+        bool havePrevCpu = false;
+        for (int j = i - 1; j >= 0; j--) {
+            if (gSteps[j].tid == pStep->tid) {
+                prevWhen = gSteps[j].whenUsec;
+                prevCpu = gSteps[j].cpuUsec;
+                havePrevCpu = true;
+                break;
+            }
+        }
+        if (!havePrevCpu && pStep->tid == gTimelineStartTid) {
+            prevCpu = gTimelineStartCpuUsec;
+            havePrevCpu = true;
+        }
+
+        /* a thread's first step is charged all of its CPU time */
+        u8 cpu = havePrevCpu ? pStep->cpuUsec - prevCpu : pStep->cpuUsec;
+        dvmPrintDebugMessage(target, "  %-40s %10llu %10llu %10llu %6d\n",
+            pStep->name, pStep->whenUsec, pStep->whenUsec - prevWhen, cpu,
+            pStep->tid);
+    }
+    if (gNumDropped != 0) {
+        dvmPrintDebugMessage(target, "  (%d later steps not recorded)\n",
+            gNumDropped);
+    }
+    dvmPrintDebugMessage(target, "\n");
+    dvmUnlockMutex(&gTimelineLock);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Timing of the steps of VM startup and of the zygote fork.
+ */
+#ifndef DALVIK_STARTUPTIMELINE_H_
+#define DALVIK_STARTUPTIMELINE_H_
+
+struct DebugOutputTarget;
+
+/*
+ * Called first thing in dvmStartup().
+ */
+void dvmStartupTimelineStartup(void);
+
+/*
+ * Start a new timeline called "name", discarding the steps of the last
+ * one.  Later steps are timed from now.  "name" must be a literal.
+ */
+void dvmStartupTimelineBegin(const char* name);
+
+/*
+ * Note that "step" of the current timeline has just finished.  May be
+ * called from any thread, including the ones startup runs in the
+ * background, and before the thread list exists.  The name is copied,
+ * and truncated if it's long.  With -verbose:startup each step is also
+ * logged.
+ */
+void dvmStartupTimelineMark(const char* step);
+
+/*
+ * Like dvmStartupTimelineMark(), for a step named "<kind> <file>".  Only
+ * the last component of the file's path is kept.
+ */
+void dvmStartupTimelineMarkFile(const char* kind, const char* fileName);
+
+/*
+ * Called when the last step of a timeline is done.  Logs the timeline
+ * with -verbose:startup, or when the system property
+ * "dalvik.vm.startuptrace" is set to "true".
+ */
+void dvmStartupTimelineFinish(void);
+
+/*
+ * Print the current timeline: when each step finished, and the wall and
+ * CPU time its thread spent on it since its previous step.  Part of the
+ * SIGQUIT dump and of VMDebug.getStartupTimeline().
+ */
+void dvmStartupTimelineDump(const DebugOutputTarget* target);
+
+#endif  // DALVIK_STARTUPTIMELINE_H_
@@ -16,6 +16,13 @@
 /*
  * Thread that reads from stdout/stderr and converts them to log messages.
  * (Sort of a hack.)
+ *
+ * The converter thread only cuts what it reads into lines and queues
+ * them; a second thread takes them off the queue and logs them, several
+ * lines at a time.  A slow log then can't keep the converter from
+ * draining the pipes, which would block the app on its next print.  If
+ * the queue is full, or the app prints faster than kMaxLinesPerSec,
+ * lines are dropped and the count is logged instead.
  */
 #include "Dalvik.h"
 
@@ -29,6 +36,17 @@
 
 #define kMaxLine    512
 
+/* queued lines; must be a power of 2 */
+#define kQueueSize          256
+
+/* the most text logged in one message, a little under the log's limit */
+#define kMaxBatch           4000
+
+#define kMaxLinesPerSec     2000
+
+/* what we ask for, where pipes can be resized */
+#define kPipeSize           (256 * 1024)
+
 /*
  * Hold some data.
  */
@@ -37,10 +55,51 @@ struct BufferedData {
     int     count;
 };
 
+/*
+ * A line waiting to be logged, without its EOL.
+ */
+struct QueuedLine {
+    const char* tag;
+    int length;
+    char text[kMaxLine+2];      /* room for the overflow '!' and a NUL */
+};
+
+/*
+ * Lines move from the converter thread to the logger thread.  Each slot
+ * belongs to one of the two until the index past it is published with a
+ * release store, so the queue itself needs no lock; the logger only takes
+ * gDvm.stdioConverterLock to sleep when the queue is empty.
+ */
+struct LineQueue {
+    volatile int32_t head;      /* next slot to fill; written by converter */
+    volatile int32_t tail;      /* next slot to log; written by logger */
+    volatile int32_t dropped;
+    QueuedLine lines[kQueueSize];
+};
+
+static LineQueue* gLineQueue;
+
+/* set once the converter can queue no more lines */
+static bool gConverterStopped;
+
 // fwd
 static void* stdioConverterThreadStart(void* arg);
+static void* stdioLoggerThreadStart(void* arg);
 static bool readAndLog(int fd, BufferedData* data, const char* tag);
 
+/*
+ * Try to make "fd" a pipe of kPipeSize bytes, so bursts of output fit in
+ * it while the converter is busy.
+ */
+static void growPipe(int fd)
+{
+#ifdef F_SETPIPE_SZ
+    if (fcntl(fd, F_SETPIPE_SZ, kPipeSize) < 0) {
+        ALOGV("F_SETPIPE_SZ failed: %s", strerror(errno));
+    }
+#endif
+}
+
 
 /*
  * Crank up the stdout/stderr converter thread.
@@ -62,6 +121,15 @@ bool dvmStdioConverterStartup()
         ALOGW("pipe failed: %s", strerror(errno));
         return false;
     }
+    growPipe(gDvm.stdoutPipe[0]);
+    growPipe(gDvm.stderrPipe[0]);
+
+    gLineQueue = (LineQueue*) calloc(1, sizeof(LineQueue));
+    if (gLineQueue == NULL) {
+        ALOGW("unable to allocate stdio line queue");
+        return false;
+    }
+    pthread_cond_init(&gDvm.stdioLoggerCond, NULL);
 
     if (dup2(gDvm.stdoutPipe[1], kFilenoStdout) != kFilenoStdout) {
         ALOGW("dup2(1) failed: %s", strerror(errno));
@@ -82,8 +150,15 @@ bool dvmStdioConverterStartup()
 
 
     /*
-     * Create the thread.
+     * Create the threads.  The logger just waits for lines to show up.
      */
+    if (!dvmCreateInternalThread(&gDvm.stdioLoggerHandle,
+                                 "Stdio Logger",
+                                 stdioLoggerThreadStart,
+                                 NULL)) {
+        return false;
+    }
+
     dvmLockMutex(&gDvm.stdioConverterLock);
 
     if (!dvmCreateInternalThread(&gDvm.stdioConverterHandle,
@@ -110,15 +185,157 @@ bool dvmStdioConverterStartup()
 void dvmStdioConverterShutdown()
 {
     gDvm.haltStdioConverter = true;
-    if (gDvm.stdioConverterHandle == 0)    // not started, or still starting
+    if (gDvm.stdioConverterHandle != 0) {
+        /* print something to wake it up */
+        printf("Shutting down\n");
+        fflush(stdout);
+
+        ALOGD("Joining stdio converter...");
+        pthread_join(gDvm.stdioConverterHandle, NULL);
+    }
+
+    /* the logger drains the queue before it stops */
+    if (gDvm.stdioLoggerHandle != 0) {
+        dvmLockMutex(&gDvm.stdioConverterLock);
+        gConverterStopped = true;
+        pthread_cond_signal(&gDvm.stdioLoggerCond);
+        dvmUnlockMutex(&gDvm.stdioConverterLock);
+        pthread_join(gDvm.stdioLoggerHandle, NULL);
+    }
+}
+
+/*
+ * Queue a line for the logger, or count it as dropped if the queue is
+ * full.  Only called by the converter thread.
+ */
+static void queueLine(const char* tag, const char* text, bool overflowed)
+{
+    LineQueue* queue = gLineQueue;
+    int32_t head = queue->head;
+
+    if (head - android_atomic_acquire_load(&queue->tail) == kQueueSize) {
+        android_atomic_inc(&queue->dropped);
         return;
+    }
 
-    /* print something to wake it up */
-    printf("Shutting down\n");
-    fflush(stdout);
+    QueuedLine* line = &queue->lines[head & (kQueueSize - 1)];
+    size_t length = strlen(text);
+    assert(length <= kMaxLine);
+    line->tag = tag;
+    memcpy(line->text, text, length);
+    if (overflowed)
+        line->text[length++] = '!';
+    line->text[length] = '\0';
+    line->length = length;
+    android_atomic_release_store(head + 1, &queue->head);
+}
 
-    ALOGD("Joining stdio converter...");
-    pthread_join(gDvm.stdioConverterHandle, NULL);
+/*
+ * Let the logger know there are lines queued.
+ */
+static void wakeLogger()
+{
+    dvmLockMutex(&gDvm.stdioConverterLock);
+    pthread_cond_signal(&gDvm.stdioLoggerCond);
+    dvmUnlockMutex(&gDvm.stdioConverterLock);
+}
+
+/*
+ * Log the lines that are queued, joining lines of the same stream into
+ * one message.  Lines past this second's share of kMaxLinesPerSec are
+ * dropped.
+ */
+static void logQueuedLines(char* batch, u8* pSecondStart, int* pLinesThisSecond)
+{
+    LineQueue* queue = gLineQueue;
+    int32_t tail = queue->tail;
+    int32_t head = android_atomic_acquire_load(&queue->head);
+    const char* batchTag = NULL;
+    int batchLength = 0;
+
+    u8 now = dvmGetRelativeTimeUsec();
+    if (now - *pSecondStart >= 1000000) {
+        *pSecondStart = now;
+        *pLinesThisSecond = 0;
+    }
+
+    while (tail != head) {
+        const QueuedLine* line = &queue->lines[tail & (kQueueSize - 1)];
+
+        if (*pLinesThisSecond >= kMaxLinesPerSec) {
+            android_atomic_inc(&queue->dropped);
+        } else {
+            if (batchTag != NULL && (line->tag != batchTag ||
+                    batchLength + 1 + line->length > kMaxBatch)) {
+                ALOG(LOG_INFO, batchTag, "%s", batch);
+                batchTag = NULL;
+            }
+            if (batchTag == NULL) {
+                batchTag = line->tag;
+                batchLength = 0;
+            } else {
+                batch[batchLength++] = '\n';
+            }
+            memcpy(batch + batchLength, line->text, line->length + 1);
+            batchLength += line->length;
+            (*pLinesThisSecond)++;
+        }
+
+        /* the slot can be refilled as soon as its text has been copied */
+        tail++;
+        android_atomic_release_store(tail, &queue->tail);
+    }
+    if (batchTag != NULL) {
+        ALOG(LOG_INFO, batchTag, "%s", batch);
+    }
+}
+
+/*
+ * Wait for lines to log until the converter has stopped and the queue is
+ * empty.  Dropped lines are reported at most once a second.
+ *
+ * DO NOT use printf from here.
+ */
+static void* stdioLoggerThreadStart(void* arg)
+{
+    LineQueue* queue = gLineQueue;
+    char* batch = new char[kMaxBatch + 1];
+    u8 secondStart = 0;
+    int linesThisSecond = 0;
+    int32_t reported = 0;
+    u8 lastReport = 0;
+
+    /* we never do anything that affects the rest of the VM */
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
+
+    while (true) {
+        dvmLockMutex(&gDvm.stdioConverterLock);
+        while (android_atomic_acquire_load(&queue->head) == queue->tail &&
+               !gConverterStopped) {
+            dvmWaitCond(&gDvm.stdioLoggerCond, &gDvm.stdioConverterLock);
+        }
+        bool halting = gConverterStopped;
+        dvmUnlockMutex(&gDvm.stdioConverterLock);
+
+        logQueuedLines(batch, &secondStart, &linesThisSecond);
+
+        int32_t dropped = android_atomic_acquire_load(&queue->dropped);
+        u8 now = dvmGetRelativeTimeUsec();
+        if (dropped != reported && (halting || now - lastReport >= 1000000)) {
+            ALOGW("stdio converter dropped %d lines", dropped - reported);
+            reported = dropped;
+            lastReport = now;
+        }
+        if (halting && android_atomic_acquire_load(&queue->head) == queue->tail) {
+            break;
+        }
+    }
+
+    delete[] batch;
+
+    /* change back for shutdown sequence */
+    dvmChangeStatus(NULL, THREAD_RUNNING);
+    return NULL;
 }
 
 /*
@@ -179,6 +396,7 @@ static void* stdioConverterThreadStart(void* arg)
                 err |= !readAndLog(gDvm.stderrPipe[0], stderrData,
                     "stderr");
             }
+            wakeLogger();
 
             /* probably EOF; give up */
             if (err) {
@@ -201,7 +419,7 @@ static void* stdioConverterThreadStart(void* arg)
 
 /*
  * Data is pending on "fd".  Read as much as will fit in "data", then
- * write out any full lines and compact "data".
+ * queue any full lines and compact "data".
  */
 static bool readAndLog(int fd, BufferedData* data, const char* tag)
 {
@@ -232,7 +450,7 @@ static bool readAndLog(int fd, BufferedData* data, const char* tag)
         if (*cp == '\n' || (*cp == '\r' && i != 0 && *(cp+1) != '\n')) {
             *cp = '\0';
             //ALOGW("GOT %d at %d '%s'", cp - start, start - data->buf, start);
-            ALOG(LOG_INFO, tag, "%s", start);
+            queueLine(tag, start, false);
             start = cp+1;
         }
     }
@@ -242,7 +460,7 @@ static bool readAndLog(int fd, BufferedData* data, const char* tag)
      */
     if (start == data->buf && data->count == kMaxLine) {
         data->buf[kMaxLine] = '\0';
-        ALOG(LOG_INFO, tag, "%s!", start);
+        queueLine(tag, start, true);
         start = cp + kMaxLine;
     }
 
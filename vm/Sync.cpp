@@ -15,6 +15,7 @@
  */
 
 #include "Dalvik.h"
+#include "alloc/HeapSource.h"
 
 #include <fcntl.h>
 #include <stdlib.h>
@@ -36,15 +37,23 @@
  *
  * The two states of an Object's lock are referred to as "thin" and
  * "fat".  A lock may transition from the "thin" state to the "fat"
- * state and this transition is referred to as inflation.  Once a lock
- * has been inflated it remains in the "fat" state indefinitely.
+ * state and this transition is referred to as inflation.  A fat lock
+ * that nobody holds, waits for, or has contended since the last GC is
+ * deflated back to a thin lock by the GC; see dvmSweepMonitorList().
  *
  * The lock value itself is stored in Object.lock.  The LSB of the
  * lock encodes its state.  When cleared, the lock is in the "thin"
  * state and its bits are formatted as follows:
  *
- *    [31 ---- 19] [18 ---- 3] [2 ---- 1] [0]
- *     lock count   thread id  hash state  0
+ *    [31] [30 ---- 19] [18 ---- 3] [2 ---- 1] [0]
+ *    bias  lock count   thread id  hash state  0
+ *
+ * With -XX:+UseBiasedLocking, the first thread to lock a thin lock
+ * from the VM may set the bias bit, keeping its thread id in the lock
+ * word after it lets go.  The lock count is then the number of times
+ * the lock is held, and that thread takes and releases the lock with
+ * plain stores.  Any other thread that wants the lock first revokes
+ * the bias; see revokeBias().
  *
  * When set, the lock is in the "fat" state and its bits are formatted
  * as follows:
@@ -76,6 +85,13 @@ struct Monitor {
 
     Thread*     waitSet;	/* threads currently waiting on this monitor */
 
+    /*
+     * Threads notified but not woken yet.  notify() moves waiters here
+     * rather than waking them just to block on the lock the notifier
+     * still holds; each release of the monitor wakes one of them.
+     */
+    Thread*     wakeSet;
+
     pthread_mutex_t lock;
 
     Monitor*    next;
@@ -86,8 +102,214 @@ struct Monitor {
      */
     const Method* ownerMethod;
     u4 ownerPc;
+
+    /*
+     * How many times a thread that finds the monitor owned by a running
+     * thread tries again before it blocks.  Doubled when spinning gets
+     * the lock and halved when it doesn't.
+     */
+    u4          spinLimit;
+
+    /* set when a thread had to spin, block or wait since the last GC */
+    bool        contended;
+
+    /*
+     * The number of threads blocked in lockMonitor() or waitMonitor(),
+     * which may not be running but still point at the monitor.
+     */
+    int32_t     users;
+};
+
+/*
+ * Bounds of Monitor.spinLimit.  A uniprocessor never spins: the owner
+ * can't make progress while we do.
+ */
+#if ANDROID_SMP != 0
+#define kMinMonitorSpins    16
+#define kMaxMonitorSpins    4096
+#define kThinLockSpins      256
+#else
+#define kMinMonitorSpins    0
+#define kMaxMonitorSpins    0
+#define kThinLockSpins      0
+#endif
+
+/*
+ * Instances of a class are no longer biased once this many biases have
+ * been revoked on them; the class is clearly shared between threads.
+ */
+#define kMaxBiasRevocations 32
+
+/*
+ * Counts of the slow monitor paths, for dvmDumpMonitorStats().  Only
+ * paths that already contend or block bump them.
+ */
+static struct {
+    volatile int32_t inflated;      /* thin locks made into monitors */
+    volatile int32_t spun;          /* monitors taken by spinning */
+    volatile int32_t blocked;       /* monitors taken after blocking */
+    volatile int32_t blockedMs;     /* total time blocked in those */
+    volatile int32_t waited;        /* calls to wait() */
+    volatile int32_t requeued;      /* waiters moved to the wake set */
+} gMonitorStats;
+
+
+/*
+ * Contention, totalled by the place the owner took the monitor and the
+ * place the waiter blocked on it.  Methods are never freed, so the
+ * entries stay good.  Only threads that have just blocked update the
+ * table, under its own lock, which costs little next to the wait.
+ * Once the table is three-quarters full, new sites are only counted.
+ */
+#define kContentionSites    512     /* must be power of 2 */
+
+struct ContentionSite {
+    const Method* ownerMethod;
+    u4 ownerPc;
+    const Method* waiterMethod;
+    u4 waiterPc;
+    u4 count;
+    u4 maxUsec;
+    u8 totalUsec;
 };
 
+static ContentionSite gContentionSites[kContentionSites];
+static u4 gContentionSitesUsed;
+static u4 gContentionSitesDropped;
+static pthread_mutex_t gContentionSitesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void recordContention(Thread* self, const Method* ownerMethod,
+    u4 ownerPc, u8 usec)
+{
+    const Method* waiterMethod = NULL;
+    u4 waiterPc = 0;
+    if (self->interpSave.curFrame != NULL) {
+        const StackSaveArea* saveArea =
+            SAVEAREA_FROM_FP(self->interpSave.curFrame);
+        waiterMethod = saveArea->method;
+        if (waiterMethod != NULL && !dvmIsNativeMethod(waiterMethod)) {
+            waiterPc = saveArea->xtra.currentPc - waiterMethod->insns;
+        }
+    }
+
+    u4 hash = ((uintptr_t) ownerMethod >> 3) * 31 + ownerPc;
+    hash = hash * 31 + ((uintptr_t) waiterMethod >> 3);
+    hash = hash * 31 + waiterPc;
+
+    dvmLockMutex(&gContentionSitesLock);
+    for (u4 i = 0; i < kContentionSites; i++) {
+        ContentionSite* site =
+            &gContentionSites[(hash + i) & (kContentionSites - 1)];
+        if (site->count == 0) {
+            if (gContentionSitesUsed >= kContentionSites / 4 * 3) {
+                break;
+            }
+            site->ownerMethod = ownerMethod;
+            site->ownerPc = ownerPc;
+            site->waiterMethod = waiterMethod;
+            site->waiterPc = waiterPc;
+            gContentionSitesUsed++;
+        } else if (site->ownerMethod != ownerMethod ||
+                   site->ownerPc != ownerPc ||
+                   site->waiterMethod != waiterMethod ||
+                   site->waiterPc != waiterPc) {
+            continue;
+        }
+        site->count++;
+        site->totalUsec += usec;
+        site->maxUsec = MAX(site->maxUsec, (u4) usec);
+        dvmUnlockMutex(&gContentionSitesLock);
+        return;
+    }
+    gContentionSitesDropped++;
+    dvmUnlockMutex(&gContentionSitesLock);
+}
+
+static int compareContentionSites(const void* a, const void* b)
+{
+    const ContentionSite* site1 = (const ContentionSite*) a;
+    const ContentionSite* site2 = (const ContentionSite*) b;
+    if (site1->totalUsec != site2->totalUsec) {
+        return site1->totalUsec < site2->totalUsec ? 1 : -1;
+    }
+    return site1->count < site2->count ? 1 :
+           site1->count > site2->count ? -1 : 0;
+}
+
+static std::string describeContentionSite(const Method* method, u4 pc)
+{
+    if (method == NULL) {
+        return "(unknown)";
+    }
+    std::string result(dvmHumanReadableMethod(method, false));
+    const char* fileName = dvmGetMethodSourceFile(method);
+    StringAppendF(&result, " (%s:%d)", fileName != NULL ? fileName : "?",
+        dvmLineNumFromPC(method, pc));
+    return result;
+}
+
+void dvmDumpContentionSites(const DebugOutputTarget* target, size_t maxSites)
+{
+    ContentionSite* sites =
+        (ContentionSite*) malloc(sizeof(gContentionSites));
+    if (sites == NULL) {
+        return;
+    }
+    /* Sort and print from a copy so blocking threads aren't held up. */
+    dvmLockMutex(&gContentionSitesLock);
+    size_t numSites = 0;
+    for (u4 i = 0; i < kContentionSites; i++) {
+        if (gContentionSites[i].count != 0) {
+            sites[numSites++] = gContentionSites[i];
+        }
+    }
+    u4 dropped = gContentionSitesDropped;
+    dvmUnlockMutex(&gContentionSitesLock);
+    qsort(sites, numSites, sizeof(*sites), compareContentionSites);
+
+    dvmPrintDebugMessage(target, "Contention sites: %zd%s, %u not kept\n",
+        numSites, gDvm.lockProfSites ? "" : " (not profiling)", dropped);
+    size_t shown = numSites;
+    if (maxSites != 0 && maxSites < shown) {
+        shown = maxSites;
+    }
+    for (size_t i = 0; i < shown; i++) {
+        const ContentionSite* site = &sites[i];
+        dvmPrintDebugMessage(target,
+            "%10llu us %8u waits %8u max  %s\n      held at %s\n",
+            site->totalUsec, site->count, site->maxUsec,
+            describeContentionSite(site->waiterMethod, site->waiterPc).c_str(),
+            describeContentionSite(site->ownerMethod, site->ownerPc).c_str());
+    }
+    free(sites);
+}
+
+void dvmResetContentionSites()
+{
+    dvmLockMutex(&gContentionSitesLock);
+    memset(gContentionSites, 0, sizeof(gContentionSites));
+    gContentionSitesUsed = 0;
+    gContentionSitesDropped = 0;
+    dvmUnlockMutex(&gContentionSitesLock);
+}
+
+/*
+ * Print the monitor counters.  The caller must be in THREAD_RUNNING, so
+ * the GC can't sweep the monitor list while we count it.
+ */
+void dvmDumpMonitorStats(const DebugOutputTarget* target)
+{
+    int monitors = 0;
+    for (Monitor* mon = gDvm.monitorList; mon != NULL; mon = mon->next) {
+        monitors++;
+    }
+    dvmPrintDebugMessage(target,
+        "Monitors: %d live, %d inflated, %d spun, %d blocked (%d ms), "
+        "%d waits, %d requeued\n",
+        monitors, gMonitorStats.inflated, gMonitorStats.spun,
+        gMonitorStats.blocked, gMonitorStats.blockedMs, gMonitorStats.waited,
+        gMonitorStats.requeued);
+}
 
 /*
  * Create and initialize a monitor.
@@ -102,6 +324,8 @@ Monitor* dvmCreateMonitor(Object* obj)
         dvmAbort();
     }
     mon->obj = obj;
+    mon->spinLimit = kMinMonitorSpins;
+    mon->contended = true;      /* inflation usually means contention */
     dvmInitMutex(&mon->lock);
 
     /* replace the head of the list with the new monitor */
@@ -140,6 +364,18 @@ Object* dvmGetMonitorObject(Monitor* mon)
         return mon->obj;
 }
 
+/*
+ * Returns the thread id of the thread holding the given thin lock, or 0.
+ * A biased lock is only held while its lock count is non-zero.
+ */
+static u4 thinLockOwner(u4 thin)
+{
+    if (LW_IS_BIASED(thin) && LW_LOCK_COUNT(thin) == 0) {
+        return 0;
+    }
+    return LW_LOCK_OWNER(thin);
+}
+
 /*
  * Returns the thread id of the thread owning the given lock.
  */
@@ -155,7 +391,7 @@ static u4 lockOwner(Object* obj)
      */
     lock = obj->lock;
     if (LW_SHAPE(lock) == LW_SHAPE_THIN) {
-        return LW_LOCK_OWNER(lock);
+        return thinLockOwner(lock);
     } else {
         owner = LW_MONITOR(lock)->owner;
         return owner ? owner->threadId : 0;
@@ -214,7 +450,45 @@ static void freeMonitor(Monitor *mon)
 }
 
 /*
- * Frees monitor objects belonging to unmarked objects.
+ * Returns true if nobody holds, waits for or waits on "mon", and nobody
+ * has had to since the last sweep, so that its object can go back to a
+ * thin lock.  Clears the contention history for the next sweep.
+ */
+static bool isIdleMonitor(Monitor *mon)
+{
+    if (mon->contended) {
+        mon->contended = false;
+        return false;
+    }
+    if (mon->owner != NULL || mon->waitSet != NULL || mon->wakeSet != NULL ||
+        mon->users != 0) {
+        return false;
+    }
+    /* the owner may not have set mon->owner yet */
+    if (pthread_mutex_trylock(&mon->lock) != 0) {
+        return false;
+    }
+    dvmUnlockMutex(&mon->lock);
+    return true;
+}
+
+/*
+ * Makes the lock of an object with an idle monitor thin again, and frees
+ * the monitor.
+ */
+static void deflateMonitor(Monitor *mon)
+{
+    Object *obj = mon->obj;
+    assert(LW_SHAPE(obj->lock) == LW_SHAPE_FAT);
+    assert(LW_MONITOR(obj->lock) == mon);
+    obj->lock &= LW_HASH_STATE_MASK << LW_HASH_STATE_SHIFT;
+    dvmDestroyMutex(&mon->lock);
+    free(mon);
+}
+
+/*
+ * Frees monitor objects belonging to unmarked objects, and deflates the
+ * idle monitors of marked ones.  All other threads must be suspended.
  */
 void dvmSweepMonitorList(Monitor** mon, int (*isUnmarkedObject)(void*))
 {
@@ -232,6 +506,10 @@ void dvmSweepMonitorList(Monitor** mon, int (*isUnmarkedObject)(void*))
             prev->next = curr->next;
             freeMonitor(curr);
             curr = prev->next;
+        } else if (obj != NULL && isIdleMonitor(curr)) {
+            prev->next = curr->next;
+            deflateMonitor(curr);
+            curr = prev->next;
         } else {
             prev = curr;
             curr = curr->next;
@@ -337,6 +615,36 @@ static void logContentionEvent(Thread *self, u4 waitMs, u4 samplePercent,
                        (size_t)(cp - eventBuffer));
 }
 
+/*
+ * Spin on a monitor owned by another thread, for as long as the owner is
+ * running and the monitor's spin limit allows.  Returns true if we got
+ * the lock.
+ *
+ * We stay in THREAD_RUNNING, so the GC waits for us; the spin limit keeps
+ * that short.  The owner's status is only a hint: it may change as soon
+ * as we have read it.
+ */
+static bool spinOnMonitor(Monitor* mon)
+{
+    u4 limit = mon->spinLimit;
+
+    mon->contended = true;
+    for (u4 i = 0; i < limit; i++) {
+        Thread* owner = mon->owner;
+        if (owner != NULL && owner->status != THREAD_RUNNING) {
+            /* it's blocked or waiting itself, so don't wait up */
+            break;
+        }
+        if (dvmTryLockMutex(&mon->lock) == 0) {
+            mon->spinLimit = MIN(limit * 2, kMaxMonitorSpins);
+            android_atomic_inc(&gMonitorStats.spun);
+            return true;
+        }
+    }
+    mon->spinLimit = MAX(limit / 2, kMinMonitorSpins);
+    return false;
+}
+
 /*
  * Lock a monitor.
  */
@@ -350,23 +658,28 @@ static void lockMonitor(Thread* self, Monitor* mon)
         mon->lockCount++;
         return;
     }
-    if (dvmTryLockMutex(&mon->lock) != 0) {
+    if (dvmTryLockMutex(&mon->lock) != 0 && !spinOnMonitor(mon)) {
+        /* keep the GC from deflating the monitor while we're blocked */
+        android_atomic_inc(&mon->users);
         oldStatus = dvmChangeStatus(self, THREAD_MONITOR);
         waitThreshold = gDvm.lockProfThreshold;
-        if (waitThreshold) {
-            waitStart = dvmGetRelativeTimeUsec();
-        }
+        waitStart = dvmGetRelativeTimeUsec();
 
         const Method* currentOwnerMethod = mon->ownerMethod;
         u4 currentOwnerPc = mon->ownerPc;
 
         dvmLockMutex(&mon->lock);
-        if (waitThreshold) {
-            waitEnd = dvmGetRelativeTimeUsec();
-        }
+        waitEnd = dvmGetRelativeTimeUsec();
+        android_atomic_dec(&mon->users);
         dvmChangeStatus(self, oldStatus);
+        waitMs = (waitEnd - waitStart) / 1000;
+        android_atomic_inc(&gMonitorStats.blocked);
+        android_atomic_add((int32_t) waitMs, &gMonitorStats.blockedMs);
+        if (gDvm.lockProfSites) {
+            recordContention(self, currentOwnerMethod, currentOwnerPc,
+                             waitEnd - waitStart);
+        }
         if (waitThreshold) {
-            waitMs = (waitEnd - waitStart) / 1000;
             if (waitMs >= waitThreshold) {
                 samplePercent = 100;
             } else {
@@ -391,8 +704,8 @@ static void lockMonitor(Thread* self, Monitor* mon)
     assert(mon->lockCount == 0);
 
     // When debugging, save the current monitor holder for future
-    // acquisition failures to use in sampled logging.
-    if (gDvm.lockProfThreshold > 0) {
+    // acquisition failures to use in sampled logging and the site table.
+    if (gDvm.lockProfThreshold > 0 || gDvm.lockProfSites) {
         mon->ownerMethod = NULL;
         mon->ownerPc = 0;
         if (self->interpSave.curFrame == NULL) {
@@ -430,6 +743,30 @@ static bool tryLockMonitor(Thread* self, Monitor* mon)
 }
 #endif
 
+/*
+ * Wakes the first thread in the wake set that is still waiting, as the
+ * monitor is released.  It then blocks on the lock only until we have
+ * let go of it.  Threads that have timed out or been interrupted since
+ * they were notified take themselves off the set once they have the
+ * lock again, and are skipped here meanwhile.  The caller must hold the
+ * monitor lock.
+ */
+static void wakeNotified(Monitor* mon)
+{
+    while (mon->wakeSet != NULL) {
+        Thread* thread = mon->wakeSet;
+        mon->wakeSet = thread->waitNext;
+        thread->waitNext = NULL;
+        dvmLockMutex(&thread->waitMutex);
+        if (thread->waitMonitor != NULL) {
+            pthread_cond_signal(&thread->waitCond);
+            dvmUnlockMutex(&thread->waitMutex);
+            return;
+        }
+        dvmUnlockMutex(&thread->waitMutex);
+    }
+}
+
 /*
  * Unlock a monitor.
  *
@@ -448,6 +785,9 @@ static bool unlockMonitor(Thread* self, Monitor* mon)
             mon->owner = NULL;
             mon->ownerMethod = NULL;
             mon->ownerPc = 0;
+            if (mon->wakeSet != NULL) {
+                wakeNotified(mon);
+            }
             dvmUnlockMutex(&mon->lock);
         } else {
             mon->lockCount--;
@@ -513,34 +853,47 @@ static void waitSetAppend(Monitor *mon, Thread *thread)
 }
 
 /*
- * Unlinks a thread from a monitor's wait set.  The monitor lock must
- * be held by the caller of this routine.
+ * Unlinks a thread from a list of threads chained through waitNext.
+ * Returns true if it was on the list.
  */
-static void waitSetRemove(Monitor *mon, Thread *thread)
+static bool threadListRemove(Thread **list, Thread *thread)
 {
     Thread *elt;
 
-    assert(mon != NULL);
-    assert(mon->owner == dvmThreadSelf());
-    assert(thread != NULL);
-    assert(waitSetCheck(mon) == 0);
-    if (mon->waitSet == NULL) {
-        return;
+    if (*list == NULL) {
+        return false;
     }
-    if (mon->waitSet == thread) {
-        mon->waitSet = thread->waitNext;
+    if (*list == thread) {
+        *list = thread->waitNext;
         thread->waitNext = NULL;
-        return;
+        return true;
     }
-    elt = mon->waitSet;
+    elt = *list;
     while (elt->waitNext != NULL) {
         if (elt->waitNext == thread) {
             elt->waitNext = thread->waitNext;
             thread->waitNext = NULL;
-            return;
+            return true;
         }
         elt = elt->waitNext;
     }
+    return false;
+}
+
+/*
+ * Unlinks a thread from a monitor's wait set, or from its wake set if
+ * it was notified.  The monitor lock must be held by the caller of this
+ * routine.
+ */
+static void waitSetRemove(Monitor *mon, Thread *thread)
+{
+    assert(mon != NULL);
+    assert(mon->owner == dvmThreadSelf());
+    assert(thread != NULL);
+    assert(waitSetCheck(mon) == 0);
+    if (!threadListRemove(&mon->waitSet, thread)) {
+        threadListRemove(&mon->wakeSet, thread);
+    }
 }
 
 /*
@@ -601,6 +954,21 @@ int dvmRelativeCondWait(pthread_cond_t* cond, pthread_mutex_t* mutex,
     return ret;
 }
 
+/*
+ * Appends a list of threads to a monitor's wake set.  The monitor lock
+ * must be held by the caller of this routine.
+ */
+static void wakeSetAppend(Monitor *mon, Thread *list)
+{
+    Thread **tail = &mon->wakeSet;
+
+    assert(mon->owner == dvmThreadSelf());
+    while (*tail != NULL) {
+        tail = &(*tail)->waitNext;
+    }
+    *tail = list;
+}
+
 /*
  * Wait on a monitor until timeout, interrupt, or notification.  Used for
  * Object.wait() and (somewhat indirectly) Thread.sleep() and Thread.join().
@@ -641,6 +1009,7 @@ static void waitMonitor(Thread* self, Monitor* mon, s8 msec, s4 nsec,
             "object not locked by thread before wait()");
         return;
     }
+    android_atomic_inc(&gMonitorStats.waited);
 
     /*
      * Enforce the timeout range.
@@ -661,6 +1030,10 @@ static void waitMonitor(Thread* self, Monitor* mon, s8 msec, s4 nsec,
         timed = true;
     }
 
+    /* the monitor has to stay fat until we're back */
+    android_atomic_inc(&mon->users);
+    mon->contended = true;
+
     /*
      * Add ourselves to the set of threads waiting on this monitor, and
      * release our hold.  We need to let it go even if we're a few levels
@@ -681,6 +1054,11 @@ static void waitMonitor(Thread* self, Monitor* mon, s8 msec, s4 nsec,
     mon->ownerMethod = NULL;
     mon->ownerPc = 0;
 
+    /* we're letting go of the monitor, so wake a notified thread */
+    if (mon->wakeSet != NULL) {
+        wakeNotified(mon);
+    }
+
     /*
      * Update thread status.  If the GC wakes up, it'll ignore us, knowing
      * that we won't touch any references in this state, and we'll check
@@ -749,6 +1127,7 @@ done:
     mon->ownerMethod = savedMethod;
     mon->ownerPc = savedPc;
     waitSetRemove(mon, self);
+    android_atomic_dec(&mon->users);
 
     /* set self->status back to THREAD_RUNNING, and self-suspend if needed */
     dvmChangeStatus(self, THREAD_RUNNING);
@@ -784,19 +1163,24 @@ static void notifyMonitor(Thread* self, Monitor* mon)
             "object not locked by thread before notify()");
         return;
     }
-    /* Signal the first waiting thread in the wait set. */
+    /*
+     * Move the first thread still waiting to the wake set.  It is woken
+     * when we let go of the monitor, so it doesn't wake up only to block
+     * on the lock.
+     */
     while (mon->waitSet != NULL) {
         thread = mon->waitSet;
         mon->waitSet = thread->waitNext;
         thread->waitNext = NULL;
         dvmLockMutex(&thread->waitMutex);
         /* Check to see if the thread is still waiting. */
-        if (thread->waitMonitor != NULL) {
-            pthread_cond_signal(&thread->waitCond);
-            dvmUnlockMutex(&thread->waitMutex);
+        bool waiting = (thread->waitMonitor != NULL);
+        dvmUnlockMutex(&thread->waitMutex);
+        if (waiting) {
+            wakeSetAppend(mon, thread);
+            android_atomic_inc(&gMonitorStats.requeued);
             return;
         }
-        dvmUnlockMutex(&thread->waitMutex);
     }
 }
 
@@ -816,18 +1200,22 @@ static void notifyAllMonitor(Thread* self, Monitor* mon)
             "object not locked by thread before notifyAll()");
         return;
     }
-    /* Signal all threads in the wait set. */
-    while (mon->waitSet != NULL) {
-        thread = mon->waitSet;
-        mon->waitSet = thread->waitNext;
-        thread->waitNext = NULL;
-        dvmLockMutex(&thread->waitMutex);
-        /* Check to see if the thread is still waiting. */
-        if (thread->waitMonitor != NULL) {
-            pthread_cond_signal(&thread->waitCond);
-        }
-        dvmUnlockMutex(&thread->waitMutex);
+    /*
+     * Move the whole wait set to the wake set.  Each release of the
+     * monitor wakes one thread, so they don't all wake up at once to
+     * fight over it.
+     */
+    int count = 0;
+    for (thread = mon->waitSet; thread != NULL; thread = thread->waitNext) {
+        count++;
+    }
+    if (count == 0) {
+        return;
     }
+    thread = mon->waitSet;
+    mon->waitSet = NULL;
+    wakeSetAppend(mon, thread);
+    android_atomic_add(count, &gMonitorStats.requeued);
 }
 
 /*
@@ -842,8 +1230,10 @@ static void inflateMonitor(Thread *self, Object *obj)
     assert(self != NULL);
     assert(obj != NULL);
     assert(LW_SHAPE(obj->lock) == LW_SHAPE_THIN);
+    assert(!LW_IS_BIASED(obj->lock));
     assert(LW_LOCK_OWNER(obj->lock) == self->threadId);
     /* Allocate and acquire a new monitor. */
+    android_atomic_inc(&gMonitorStats.inflated);
     mon = dvmCreateMonitor(obj);
     lockMonitor(self, mon);
     /* Propagate the lock state. */
@@ -855,6 +1245,98 @@ static void inflateMonitor(Thread *self, Object *obj)
     android_atomic_release_store(thin, (int32_t *)&obj->lock);
 }
 
+/*
+ * Returns true if a thin lock nobody owns should be biased toward the
+ * thread about to take it.  A copying collector may rewrite the hash
+ * state of a lock word while its owner runs, so there is no biasing
+ * there.
+ */
+static bool shouldBias(const Object *obj)
+{
+#ifdef WITH_COPYING_GC
+    return false;
+#else
+    return gDvm.biasedLocking &&
+        obj->clazz->biasRevocations < kMaxBiasRevocations;
+#endif
+}
+
+/*
+ * Returns the thin lock equivalent to a biased one: held as often by
+ * the same thread, or not at all.
+ */
+static u4 unbiasedLock(u4 thin)
+{
+    u4 holds = LW_LOCK_COUNT(thin);
+
+    assert(LW_SHAPE(thin) == LW_SHAPE_THIN && LW_IS_BIASED(thin));
+    if (holds == 0) {
+        return thin & (LW_HASH_STATE_MASK << LW_HASH_STATE_SHIFT);
+    }
+    thin &= ~(LW_BIASED | (LW_LOCK_COUNT_MASK << LW_LOCK_COUNT_SHIFT));
+    return thin | ((holds - 1) << LW_LOCK_COUNT_SHIFT);
+}
+
+/*
+ * Drops the bias of a lock toward the calling thread, which is needed
+ * before the lock can be inflated.  Nobody else changes a biased lock
+ * word while its owner is running, so no CAS is needed.
+ */
+static void unbiasSelf(Thread *self, Object *obj)
+{
+    u4 thin = obj->lock;
+
+    assert(LW_LOCK_OWNER(thin) == self->threadId);
+    android_atomic_release_store(unbiasedLock(thin), (int32_t *)&obj->lock);
+}
+
+/*
+ * Revokes the bias of a lock toward another thread.  That thread may be
+ * taking or releasing the lock with plain stores, so it is suspended,
+ * at a safe point, while its lock word is rewritten; the suspension is
+ * not counted as the debugger's.  If the owner has exited, nobody can
+ * take its id while we hold the thread list lock, so the word is just
+ * rewritten.  Each revocation counts against the class of the object.
+ */
+static void revokeBias(Thread *self, Object *obj)
+{
+    volatile u4 *thinp = &obj->lock;
+    Thread *thread;
+    u4 thin, owner;
+
+    dvmLockThreadList(self);
+    thin = *thinp;
+    if (LW_SHAPE(thin) != LW_SHAPE_THIN || !LW_IS_BIASED(thin)) {
+        /* The owner dropped the bias itself. */
+        dvmUnlockThreadList();
+        return;
+    }
+    owner = LW_LOCK_OWNER(thin);
+    assert(owner != self->threadId);
+    thread = dvmGetThreadByThreadId(owner);
+    if (thread != NULL) {
+        dvmSuspendThreadForGc(thread);
+    }
+    /*
+     * The owner may have dropped the bias and another thread biased the
+     * lock again before the suspension took effect.
+     */
+    thin = *thinp;
+    if (LW_SHAPE(thin) == LW_SHAPE_THIN && LW_IS_BIASED(thin) &&
+        LW_LOCK_OWNER(thin) == owner) {
+        android_atomic_release_store(unbiasedLock(thin), (int32_t *)thinp);
+        if (android_atomic_inc((int32_t *)&obj->clazz->biasRevocations) ==
+                kMaxBiasRevocations - 1) {
+            ALOGV("(%d) no more biased locking for %s",
+                  self->threadId, obj->clazz->descriptor);
+        }
+    }
+    if (thread != NULL) {
+        dvmResumeThreadForGc(thread);
+    }
+    dvmUnlockThreadList();
+}
+
 /*
  * Implements monitorenter for "synchronized" stuff.
  *
@@ -869,6 +1351,7 @@ void dvmLockObject(Thread* self, Object *obj)
     long sleepDelayNs;
     long minSleepDelayNs = 1000000;  /* 1 millisecond */
     long maxSleepDelayNs = 1000000000;  /* 1 second */
+    u4 spins;
     u4 thin, newThin, threadId;
 
     assert(self != NULL);
@@ -882,7 +1365,30 @@ retry:
          * The lock is a thin lock.  The owner field is used to
          * determine the acquire method, ordered by cost.
          */
-        if (LW_LOCK_OWNER(thin) == threadId) {
+        if (LW_IS_BIASED(thin)) {
+            if (LW_LOCK_OWNER(thin) != threadId) {
+                /*
+                 * The lock is biased toward another thread.  Revoke
+                 * the bias and contend for it as a thin lock.
+                 */
+                revokeBias(self, obj);
+                goto retry;
+            } else if (LW_LOCK_COUNT(thin) < LW_LOCK_COUNT_MASK) {
+                /*
+                 * The lock is biased toward the calling thread, the
+                 * only one to change it while we run.  Take it with
+                 * a plain store.
+                 */
+                *thinp = thin + (1 << LW_LOCK_COUNT_SHIFT);
+            } else {
+                /*
+                 * The hold count would overflow.  Go on as a thin
+                 * lock, which inflates at its reacquisition limit.
+                 */
+                unbiasSelf(self, obj);
+                goto retry;
+            }
+        } else if (LW_LOCK_OWNER(thin) == threadId) {
             /*
              * The calling thread owns the lock.  Increment the
              * value of the recursion count field.
@@ -904,6 +1410,9 @@ retry:
              * will have tried this before calling out to the VM.
              */
             newThin = thin | (threadId << LW_LOCK_OWNER_SHIFT);
+            if (shouldBias(obj)) {
+                newThin |= LW_BIASED | (1 << LW_LOCK_COUNT_SHIFT);
+            }
             if (android_atomic_acquire_cas(thin, newThin,
                     (int32_t*)thinp) != 0) {
                 /*
@@ -920,16 +1429,20 @@ retry:
              */
             oldStatus = dvmChangeStatus(self, THREAD_MONITOR);
             /*
-             * Spin until the thin lock is released or inflated.
+             * Spin until the thin lock is released or inflated.  Most
+             * thin locks are held briefly, so on a multiprocessor we
+             * first just look again a number of times.
              */
+            spins = 0;
             sleepDelayNs = 0;
             for (;;) {
                 thin = *thinp;
                 /*
                  * Check the shape of the lock word.  Another thread
-                 * may have inflated the lock while we were waiting.
+                 * may have inflated or biased the lock while we were
+                 * waiting.
                  */
-                if (LW_SHAPE(thin) == LW_SHAPE_THIN) {
+                if (LW_SHAPE(thin) == LW_SHAPE_THIN && !LW_IS_BIASED(thin)) {
                     if (LW_LOCK_OWNER(thin) == 0) {
                         /*
                          * The lock has been released.  Install the
@@ -950,7 +1463,9 @@ retry:
                          * The lock has not been released.  Yield so
                          * the owning thread can run.
                          */
-                        if (sleepDelayNs == 0) {
+                        if (spins < kThinLockSpins) {
+                            spins++;
+                        } else if (sleepDelayNs == 0) {
                             sched_yield();
                             sleepDelayNs = minSleepDelayNs;
                         } else {
@@ -970,9 +1485,9 @@ retry:
                     }
                 } else {
                     /*
-                     * The thin lock was inflated by another thread.
-                     * Let the VM know we are no longer waiting and
-                     * try again.
+                     * The thin lock was inflated or biased by another
+                     * thread.  Let the VM know we are no longer waiting
+                     * and try again.
                      */
                     ALOGV("(%d) lock %p surprise-fattened",
                              threadId, &obj->lock);
@@ -1024,7 +1539,18 @@ bool dvmUnlockObject(Thread* self, Object *obj)
          * The lock is thin.  We must ensure that the lock is owned
          * by the given thread before unlocking it.
          */
-        if (LW_LOCK_OWNER(thin) == self->threadId) {
+        if (LW_IS_BIASED(thin)) {
+            if (thinLockOwner(thin) != self->threadId) {
+                dvmThrowIllegalMonitorStateException(
+                    "unlock of unowned monitor");
+                return false;
+            }
+            /*
+             * The lock is biased toward us, so nobody else changes
+             * it while we run.  Release it with a plain store.
+             */
+            obj->lock = thin - (1 << LW_LOCK_COUNT_SHIFT);
+        } else if (LW_LOCK_OWNER(thin) == self->threadId) {
             /*
              * We are the lock owner.  It is safe to update the lock
              * without CAS as lock ownership guards the lock itself.
@@ -1082,11 +1608,14 @@ void dvmObjectWait(Thread* self, Object *obj, s8 msec, s4 nsec,
     if (LW_SHAPE(thin) == LW_SHAPE_THIN) {
         /* Make sure that 'self' holds the lock.
          */
-        if (LW_LOCK_OWNER(thin) != self->threadId) {
+        if (thinLockOwner(thin) != self->threadId) {
             dvmThrowIllegalMonitorStateException(
                 "object not locked by thread before wait()");
             return;
         }
+        if (LW_IS_BIASED(thin)) {
+            unbiasSelf(self, obj);
+        }
 
         /* This thread holds the lock.  We need to fatten the lock
          * so 'self' can block on it.  Don't update the object lock
@@ -1113,7 +1642,7 @@ void dvmObjectNotify(Thread* self, Object *obj)
     if (LW_SHAPE(thin) == LW_SHAPE_THIN) {
         /* Make sure that 'self' holds the lock.
          */
-        if (LW_LOCK_OWNER(thin) != self->threadId) {
+        if (thinLockOwner(thin) != self->threadId) {
             dvmThrowIllegalMonitorStateException(
                 "object not locked by thread before notify()");
             return;
@@ -1141,7 +1670,7 @@ void dvmObjectNotifyAll(Thread* self, Object *obj)
     if (LW_SHAPE(thin) == LW_SHAPE_THIN) {
         /* Make sure that 'self' holds the lock.
          */
-        if (LW_LOCK_OWNER(thin) != self->threadId) {
+        if (thinLockOwner(thin) != self->threadId) {
             dvmThrowIllegalMonitorStateException(
                 "object not locked by thread before notifyAll()");
             return;
@@ -1223,10 +1752,47 @@ void dvmThreadInterrupt(Thread* thread)
     dvmUnlockMutex(&thread->waitMutex);
 }
 
+size_t dvmIdentityHashSlotOffset(const Object *obj)
+{
+    size_t size;
+    if (IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISARRAY)) {
+        size = dvmArrayObjectSize((ArrayObject *)obj);
+    } else {
+        size = obj->clazz->objectSize;
+    }
+    return (size + 3) & ~3;
+}
+
 #ifndef WITH_COPYING_GC
+/*
+ * Returns the identity hash code of the given object.
+ *
+ * The code is the object's address, scrambled with a random seed under
+ * -XX:IdentityHash=random, so nothing is stored for an object that stays
+ * where it is and its lock word is never written.  The object is noted
+ * in a side bitmap instead, when compaction is enabled; a compaction
+ * that moves it appends the code to the copy and marks the copy
+ * HASHED_AND_MOVED, the only state in which the lock word is consulted.
+ */
 u4 dvmIdentityHashCode(Object *obj)
 {
-    return (u4)obj;
+    if (obj == NULL) {
+        return 0;
+    }
+    if (LW_HASH_STATE(obj->lock) == LW_HASH_STATE_HASHED_AND_MOVED) {
+        return *(u4 *)((u1 *)obj + dvmIdentityHashSlotOffset(obj));
+    }
+    dvmHeapSourceSetHashed(obj);
+    u4 hash = (u4)obj;
+    if (gDvm.randomIdentityHash) {
+        /* Each step is invertible, so distinct objects still get
+         * distinct codes.
+         */
+        hash ^= gDvm.identityHashSeed;
+        hash *= 0x9e3779b1;
+        hash ^= hash >> 16;
+    }
+    return hash;
 }
 #else
 /*
@@ -1262,12 +1828,7 @@ retry:
          * aligned word following the instance data.
          */
         assert(!dvmIsClassObject(obj));
-        if (IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISARRAY)) {
-            size = dvmArrayObjectSize((ArrayObject *)obj);
-            size = (size + 2) & ~2;
-        } else {
-            size = obj->clazz->objectSize;
-        }
+        size = dvmIdentityHashSlotOffset(obj);
         return *(u4 *)(((char *)obj) + size);
     } else if (hashState == LW_HASH_STATE_UNHASHED) {
         /*
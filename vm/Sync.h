@@ -57,12 +57,21 @@
 
 /*
  * Lock recursion count field.  Contains a count of the numer of times
- * a lock has been recursively acquired.
+ * a lock has been recursively acquired.  In a biased lock it is the
+ * number of times the lock is held, zero when it is not.
  */
-#define LW_LOCK_COUNT_MASK 0x1fff
+#define LW_LOCK_COUNT_MASK 0xfff
 #define LW_LOCK_COUNT_SHIFT 19
 #define LW_LOCK_COUNT(x) (((x) >> LW_LOCK_COUNT_SHIFT) & LW_LOCK_COUNT_MASK)
 
+/*
+ * Bias field.  Set in a thin lock that is biased toward the thread in
+ * its owner field, which may then take and release it without atomic
+ * operations.  Only meaningful in a thin lock.
+ */
+#define LW_BIASED 0x80000000
+#define LW_IS_BIASED(x) (((x) & LW_BIASED) != 0)
+
 struct Object;
 struct Monitor;
 struct Thread;
@@ -95,6 +104,12 @@ void dvmObjectNotifyAll(Thread* self, Object* obj);
  */
 u4 dvmIdentityHashCode(Object* obj);
 
+/*
+ * Returns the offset from the start of an object of the word that holds
+ * its identity hash code once it has been moved in the HASHED state.
+ */
+size_t dvmIdentityHashSlotOffset(const Object* obj);
+
 /*
  * Implementation of Thread.sleep().
  */
@@ -120,6 +135,22 @@ void dvmSweepMonitorList(Monitor** mon, int (*isUnmarkedObject)(void*));
 /* free monitor list */
 void dvmFreeMonitorList(void);
 
+/*
+ * Print counts of contended monitor operations.
+ */
+void dvmDumpMonitorStats(const DebugOutputTarget* target);
+
+/*
+ * Print the contention sites kept with -Xlockprofsites, the most time
+ * blocked first, at most maxSites of them or all if it is zero.
+ */
+void dvmDumpContentionSites(const DebugOutputTarget* target, size_t maxSites);
+
+/*
+ * Forget the contention sites seen so far.
+ */
+void dvmResetContentionSites(void);
+
 /*
  * Get the object a monitor is part of.
  *
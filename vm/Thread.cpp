@@ -20,6 +20,7 @@
  * Thread support.
  */
 #include "Dalvik.h"
+#include "interp/InterpDefs.h"
 #include "os/os.h"
 
 #include <stdlib.h>
@@ -32,6 +33,12 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+
+#if defined(HAVE_FUTEX)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #if defined(HAVE_PRCTL)
 #include <sys/prctl.h>
@@ -235,6 +242,9 @@ static bool prepareThread(Thread* thread);
 static void setThreadSelf(Thread* thread);
 static void unlinkThread(Thread* thread);
 static void freeThread(Thread* thread);
+#ifndef MALLOC_INTERP_STACK
+static void emptyInterpStackPool(void);
+#endif
 static void assignThreadId(Thread* thread);
 static bool createFakeEntryFrame(Thread* thread);
 static bool createFakeRunFrame(Thread* thread);
@@ -269,7 +279,6 @@ bool dvmThreadStartup()
     pthread_cond_init(&gDvm.vmExitCond, NULL);
     dvmInitMutex(&gDvm._threadSuspendLock);
     dvmInitMutex(&gDvm.threadSuspendCountLock);
-    pthread_cond_init(&gDvm.threadSuspendCountCond, NULL);
 
     /*
      * Dedicated monitor for Thread.sleep().
@@ -323,6 +332,10 @@ void dvmThreadShutdown()
 
     dvmFreeMonitorList();
 
+#ifndef MALLOC_INTERP_STACK
+    emptyInterpStackPool();
+#endif
+
     pthread_key_delete(gDvm.pthreadKeySelf);
 }
 
@@ -351,6 +364,73 @@ static inline void unlockThreadSuspendCount()
     dvmUnlockMutex(&gDvm.threadSuspendCountLock);
 }
 
+/*
+ * Two words of each thread serve as futexes for suspension.  A suspended
+ * thread sleeps on its suspendCount until that drops to zero, so a
+ * resume only wakes the threads it resumes.  A thread waiting for
+ * another to suspend sleeps on the other's status until it leaves
+ * THREAD_RUNNING.  Without futexes we just poll.
+ */
+#if defined(HAVE_FUTEX)
+static inline void futexWait(volatile void* addr, int value,
+    const struct timespec* timeout)
+{
+    syscall(__NR_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static inline void futexWake(volatile void* addr)
+{
+    syscall(__NR_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static inline void futexWait(volatile void* addr, int value,
+    const struct timespec* timeout)
+{
+    if (*(volatile int*) addr == value) {
+        usleep(timeout != NULL ? timeout->tv_nsec / 1000 : 1000);
+    }
+}
+
+static inline void futexWake(volatile void* addr)
+{
+}
+#endif
+
+/*
+ * Sleep until our suspend count may have dropped to zero.  The suspend
+ * count lock must be held; it is released while we sleep.
+ */
+static void waitForResume(Thread* self)
+{
+    int suspendCount = self->suspendCount;
+
+    unlockThreadSuspendCount();
+    futexWait(&self->suspendCount, suspendCount, NULL);
+    lockThreadSuspendCount();
+}
+
+/*
+ * Wake a thread if its suspend count has dropped to zero.  The caller
+ * must hold the thread list lock, or otherwise keep "thread" alive.
+ */
+static void wakeIfResumed(Thread* thread)
+{
+    if (thread->suspendCount == 0) {
+        futexWake(&thread->suspendCount);
+    }
+}
+
+/*
+ * Tell whoever waits for us to suspend that we are no longer running.
+ * Only worth a system call if we have been asked to suspend.
+ */
+static inline void ackSuspend(Thread* self)
+{
+    if (self->suspendCount != 0) {
+        futexWake(&self->status);
+    }
+}
+
 /*
  * Grab the thread list global lock.
  *
@@ -383,6 +463,7 @@ void dvmLockThreadList(Thread* self)
     if (self != NULL) {
         oldStatus = self->status;
         self->status = THREAD_VMWAIT;
+        ackSuspend(self);
     } else {
         /* happens during VM shutdown */
         oldStatus = THREAD_UNDEFINED;  // shut up gcc
@@ -424,8 +505,12 @@ static const char* getSuspendCauseStr(SuspendCause why)
     case SUSPEND_FOR_DEBUG:         return "debug";
     case SUSPEND_FOR_DEBUG_EVENT:   return "debug-event";
     case SUSPEND_FOR_STACK_DUMP:    return "stack-dump";
+    case SUSPEND_FOR_DEX_OPT:       return "dex-opt";
     case SUSPEND_FOR_VERIFY:        return "verify";
     case SUSPEND_FOR_HPROF:         return "hprof";
+    case SUSPEND_FOR_SAMPLING:      return "sampling";
+    case SUSPEND_FOR_ALLOC_TRACKER: return "alloc-tracker";
+    case SUSPEND_FOR_METHOD_TRACE:  return "method-trace";
 #if defined(WITH_JIT)
     case SUSPEND_FOR_TBL_RESIZE:    return "table-resize";
     case SUSPEND_FOR_IC_PATCH:      return "inline-cache-patch";
@@ -797,6 +882,96 @@ bool dvmPrepMainThread()
 }
 
 
+#ifndef MALLOC_INTERP_STACK
+/*
+ * Interpreter stacks of threads that have exited, kept for the next
+ * threads to start, so that a program that starts a thread per task
+ * doesn't map, fault in and unmap a stack for each one.  Only stacks of
+ * the default size are kept.  Every mapped stack has a PROT_NONE guard
+ * page below it, which stays in place while the stack waits here.
+ */
+#define kInterpStackPoolMax 8
+
+static u1* gInterpStackPool[kInterpStackPoolMax];
+static int gInterpStackPoolCount;
+static pthread_mutex_t gInterpStackPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns the bottom of a new interpreter stack of "size" bytes, or NULL.
+ *
+ * The guard page only catches runaway writes; overflow is still found by
+ * the explicit interpStackEnd checks.  Unlike a null dereference in a JIT
+ * translation (see compiler/NullFault.cpp), a fault here has no recorded
+ * site to resume at: it comes partway through building a frame, from
+ * mterp or C code, before the save area is consistent.  And a single
+ * frame can step right over one page.
+ */
+static u1* allocInterpStack(int size)
+{
+    if (size == gDvm.stackSize) {
+        u1* stackBottom = NULL;
+        dvmLockMutex(&gInterpStackPoolLock);
+        if (gInterpStackPoolCount > 0) {
+            stackBottom = gInterpStackPool[--gInterpStackPoolCount];
+        }
+        dvmUnlockMutex(&gInterpStackPoolLock);
+        if (stackBottom != NULL) {
+            return stackBottom;
+        }
+    }
+
+    u1* base = (u1*) mmap(NULL, size + SYSTEM_PAGE_SIZE,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(base, SYSTEM_PAGE_SIZE, PROT_NONE) != 0) {
+        ALOGW("mprotect(thread stack guard) failed: %s", strerror(errno));
+    }
+    return base + SYSTEM_PAGE_SIZE;
+}
+
+static void unmapInterpStack(u1* stackBottom, int size)
+{
+    if (munmap(stackBottom - SYSTEM_PAGE_SIZE, size + SYSTEM_PAGE_SIZE) != 0)
+        ALOGW("munmap(thread stack) failed");
+}
+
+/*
+ * Keeps the interpreter stack at "stackBottom" for another thread, or
+ * unmaps it if it isn't the default size or the pool is full.
+ */
+static void freeInterpStack(u1* stackBottom, int size)
+{
+    if (size == gDvm.stackSize) {
+        bool pooled = false;
+        dvmLockMutex(&gInterpStackPoolLock);
+        if (gInterpStackPoolCount < kInterpStackPoolMax) {
+            gInterpStackPool[gInterpStackPoolCount++] = stackBottom;
+            pooled = true;
+        }
+        dvmUnlockMutex(&gInterpStackPoolLock);
+        if (pooled) {
+            return;
+        }
+    }
+    unmapInterpStack(stackBottom, size);
+}
+
+/*
+ * Unmaps the pooled stacks.
+ */
+static void emptyInterpStackPool()
+{
+    dvmLockMutex(&gInterpStackPoolLock);
+    while (gInterpStackPoolCount > 0) {
+        unmapInterpStack(gInterpStackPool[--gInterpStackPoolCount],
+            gDvm.stackSize);
+    }
+    dvmUnlockMutex(&gInterpStackPoolLock);
+}
+#endif
+
 /*
  * Alloc and initialize a Thread struct.
  *
@@ -815,6 +990,13 @@ static Thread* allocThread(int interpStackSize)
     assert((((uintptr_t)&thread->interpBreak.all) & 0x7) == 0);
     assert(sizeof(thread->interpBreak) == sizeof(thread->interpBreak.all));
 
+    thread->interfaceSiteCache = (InterfaceSiteCacheEntry*)
+        calloc(INTERFACE_SITE_CACHE_SIZE, sizeof(InterfaceSiteCacheEntry));
+    if (thread->interfaceSiteCache == NULL) {
+        free(thread);
+        return NULL;
+    }
+
 
 #if defined(WITH_SELF_VERIFICATION)
     if (dvmSelfVerificationShadowSpaceAlloc(thread) == NULL)
@@ -843,9 +1025,8 @@ static Thread* allocThread(int interpStackSize)
     }
     memset(stackBottom, 0xc5, interpStackSize);     // stop valgrind complaints
 #else
-    stackBottom = (u1*) mmap(NULL, interpStackSize, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANON, -1, 0);
-    if (stackBottom == MAP_FAILED) {
+    stackBottom = allocInterpStack(interpStackSize);
+    if (stackBottom == NULL) {
 #if defined(WITH_SELF_VERIFICATION)
         dvmSelfVerificationShadowSpaceFree(thread);
 #endif
@@ -926,8 +1107,7 @@ static bool prepareThread(Thread* thread)
      * Most threads won't use jniMonitorRefTable, so we clear out the
      * structure but don't call the init function (which allocs storage).
      */
-    if (!thread->jniLocalRefTable.init(kJniLocalRefMin,
-            kJniLocalRefMax, kIndirectKindLocal)) {
+    if (!thread->jniLocalRefTable.init(kJniLocalRefMax, kIndirectKindLocal)) {
         return false;
     }
     if (!dvmInitReferenceTable(&thread->internalLocalRefTable,
@@ -984,8 +1164,7 @@ static void freeThread(Thread* thread)
 #ifdef MALLOC_INTERP_STACK
         free(interpStackBottom);
 #else
-        if (munmap(interpStackBottom, thread->interpStackSize) != 0)
-            ALOGW("munmap(thread stack) failed");
+        freeInterpStack(interpStackBottom, thread->interpStackSize);
 #endif
     }
 
@@ -998,6 +1177,8 @@ static void freeThread(Thread* thread)
     dvmSelfVerificationShadowSpaceFree(thread);
 #endif
     free(thread->stackTraceSample);
+    free(thread->interfaceSiteCache);
+    dvmAllocTrackerThreadExit(thread);
     free(thread);
 }
 
@@ -2098,6 +2279,9 @@ void dvmDetachCurrentThread()
     dvmReleaseTrackedAlloc(vmThread, self);
     vmThread = NULL;
 
+    /* Give back whatever is left of our allocation buffer. */
+    dvmRetireAllocBuffer(self);
+
     /*
      * We're done manipulating objects, so it's okay if the GC runs in
      * parallel with us from here out.  It's important to do this if
@@ -2175,6 +2359,60 @@ void dvmDetachCurrentThread()
     freeThread(self);
 }
 
+/*
+ * Attach the current thread with nothing but the native Thread struct,
+ * the way dvmThreadStartup sets up the main thread.
+ */
+bool dvmAttachHelperThread()
+{
+    assert(gDvm.optimizing);
+
+    Thread* self = allocThread(gDvm.stackSize);
+    if (self == NULL)
+        return false;
+    setThreadSelf(self);
+
+    dvmLockThreadList(self);
+    bool ok = prepareThread(self);
+    if (!ok) {
+        releaseThreadId(self);
+        dvmUnlockThreadList();
+        setThreadSelf(NULL);
+        freeThread(self);
+        return false;
+    }
+    self->next = gDvm.threadList->next;
+    if (self->next != NULL)
+        self->next->prev = self;
+    self->prev = gDvm.threadList;
+    gDvm.threadList->next = self;
+    dvmUnlockThreadList();
+
+    /* stall until any GC that missed us on the thread list is done */
+    dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockMutex(&gDvm.gcHeapLock);
+    dvmUnlockMutex(&gDvm.gcHeapLock);
+    dvmChangeStatus(self, THREAD_RUNNING);
+    return true;
+}
+
+void dvmDetachHelperThread()
+{
+    Thread* self = dvmThreadSelf();
+
+    dvmRetireAllocBuffer(self);
+    dvmChangeStatus(self, THREAD_VMWAIT);
+
+    dvmLockThreadList(self);
+    self->status = THREAD_ZOMBIE;
+    unlinkThread(self);
+    releaseThreadId(self);
+    dvmUnlockThreadList();
+
+    setThreadSelf(NULL);
+    freeThread(self);
+}
+
 
 /*
  * Suspend a single thread.  Do not use to suspend yourself.
@@ -2231,13 +2469,38 @@ void dvmResumeThread(Thread* thread)
     LOG_THREAD("threadid=%d: suspend--, now=%d",
         thread->threadId, thread->suspendCount);
 
-    if (thread->suspendCount == 0) {
-        dvmBroadcastCond(&gDvm.threadSuspendCountCond);
-    }
+    wakeIfResumed(thread);
 
     unlockThreadSuspendCount();
 }
 
+/*
+ * Like dvmSuspendThread(), but isn't counted as a debugger suspension.
+ */
+void dvmSuspendThreadForGc(Thread* thread)
+{
+    assert(thread != NULL);
+    assert(thread != dvmThreadSelf());
+
+    lockThreadSuspendCount();
+    dvmAddToSuspendCounts(thread, 1, 0);
+    unlockThreadSuspendCount();
+
+    waitForThreadSuspend(dvmThreadSelf(), thread);
+}
+
+void dvmResumeThreadForGc(Thread* thread)
+{
+    assert(thread != NULL);
+    assert(thread != dvmThreadSelf());
+
+    lockThreadSuspendCount();
+    assert(thread->suspendCount > 0);
+    dvmAddToSuspendCounts(thread, -1, 0);
+    wakeIfResumed(thread);
+    unlockThreadSuspendCount();
+}
+
 /*
  * Suspend yourself, as a result of debugger activity.
  */
@@ -2265,6 +2528,7 @@ void dvmSuspendSelf(bool jdwpActivity)
      */
     assert(self->suspendCount > 0);
     self->status = THREAD_SUSPENDED;
+    ackSuspend(self);
     LOG_THREAD("threadid=%d: self-suspending (dbg)", self->threadId);
 
     /*
@@ -2281,18 +2545,7 @@ void dvmSuspendSelf(bool jdwpActivity)
     }
 
     while (self->suspendCount != 0) {
-        dvmWaitCond(&gDvm.threadSuspendCountCond,
-                    &gDvm.threadSuspendCountLock);
-        if (self->suspendCount != 0) {
-            /*
-             * The condition was signaled but we're still suspended.  This
-             * can happen if the debugger lets go while a SIGQUIT thread
-             * dump event is pending (assuming SignalCatcher was resumed for
-             * just long enough to try to grab the thread-suspend lock).
-             */
-            ALOGD("threadid=%d: still suspended after undo (sc=%d dc=%d)",
-                self->threadId, self->suspendCount, self->dbgSuspendCount);
-        }
+        waitForResume(self);
     }
     assert(self->suspendCount == 0 && self->dbgSuspendCount == 0);
     self->status = THREAD_RUNNING;
@@ -2426,10 +2679,35 @@ void dvmResetThreadPriority(Thread* thread, int changeFlags,
  * doing the suspending.  (We may need to re-evaluate this now that
  * getThreadStackTrace is implemented as suspend-snapshot-resume.)
  *
- * TODO: track basic stats about time required to suspend VM.
+ * We sleep on the other thread's status, which wakes us as soon as it
+ * stops running.  Not every status change wakes us, so the sleep is cut
+ * short now and then to look again.
  */
 #define FIRST_SLEEP (250*1000)    /* 0.25s */
 #define MORE_SLEEP  (750*1000)    /* 0.75s */
+#define STATUS_POLL (1000)        /* 1ms */
+
+/*
+ * Sleep until "thread" may have stopped running.  Returns "false", like
+ * dvmIterativeSleep(), once "maxTotalSleep" usec have passed since
+ * "relStartTime".
+ */
+static bool waitForStatusChange(Thread* thread, int maxTotalSleep,
+    u8 relStartTime)
+{
+    u8 curTime = dvmGetRelativeTimeUsec();
+    if (curTime >= relStartTime + maxTotalSleep) {
+        return false;
+    }
+
+    struct timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = MIN(relStartTime + maxTotalSleep - curTime,
+                          STATUS_POLL) * 1000;
+    futexWait(&thread->status, THREAD_RUNNING, &timeout);
+    return true;
+}
+
 static void waitForThreadSuspend(Thread* self, Thread* thread)
 {
     const int kMaxRetries = 10;
@@ -2477,10 +2755,11 @@ static void waitForThreadSuspend(Thread* self, Thread* thread)
 #endif
 
         /*
-         * Sleep briefly.  The iterative sleep call returns false if we've
-         * exceeded the total time limit for this round of sleeping.
+         * Sleep until the thread stops running.  This returns false if
+         * we've exceeded the total time limit for this round of sleeping.
          */
-        if (!dvmIterativeSleep(sleepIter++, spinSleepTime, startWhen)) {
+        sleepIter++;
+        if (!waitForStatusChange(thread, spinSleepTime, startWhen)) {
             if (spinSleepTime != FIRST_SLEEP) {
                 ALOGW("threadid=%d: spin on suspend #%d threadid=%d (pcf=%d)",
                     self->threadId, retryCount,
@@ -2524,6 +2803,57 @@ static void waitForThreadSuspend(Thread* self, Thread* thread)
     }
 }
 
+/*
+ * Time to safepoint: how long each cause of suspend-all took to stop the
+ * other threads, counted from when we held the thread-suspend lock.
+ * Updated with that lock held; dvmDumpSafepointStats() reads without it
+ * and may see a suspend-all half recorded.
+ */
+struct SafepointStats {
+    u4 count;
+    u4 waitedThreads;       // threads that were running when asked
+    u4 maxUsec;
+    u8 totalUsec;
+};
+
+static SafepointStats gSafepointStats[SUSPEND_CAUSE_COUNT];
+
+static void recordSafepoint(SuspendCause why, u4 usec, u4 waitedThreads)
+{
+    SafepointStats* stats = &gSafepointStats[why];
+
+    stats->count++;
+    stats->waitedThreads += waitedThreads;
+    stats->maxUsec = MAX(stats->maxUsec, usec);
+    stats->totalUsec += usec;
+}
+
+void dvmDumpSafepointStats(const DebugOutputTarget* target)
+{
+    bool any = false;
+
+    for (int i = 0; i < SUSPEND_CAUSE_COUNT; i++) {
+        SafepointStats stats = gSafepointStats[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        if (!any) {
+            dvmPrintDebugMessage(target, "Time to safepoint, by cause:\n");
+            any = true;
+        }
+        u4 avgUsec = (u4) (stats.totalUsec / stats.count);
+        dvmPrintDebugMessage(target,
+            "  %-18s n=%u avg=%u.%03ums max=%u.%03ums, %.1f running/req\n",
+            getSuspendCauseStr((SuspendCause) i), stats.count,
+            avgUsec / 1000, avgUsec % 1000,
+            stats.maxUsec / 1000, stats.maxUsec % 1000,
+            (double) stats.waitedThreads / stats.count);
+    }
+    if (any) {
+        dvmPrintDebugMessage(target, "\n");
+    }
+}
+
 /*
  * Suspend all threads except the current one.  This is used by the GC,
  * the debugger, and by any thread that hits a "suspend all threads"
@@ -2563,6 +2893,8 @@ void dvmSuspendAllThreads(SuspendCause why)
     lockThreadSuspend("susp-all", why);
 
     LOG_THREAD("threadid=%d: SuspendAll starting", self->threadId);
+    u8 startWhen = dvmGetRelativeTimeUsec();
+    u4 waitedThreads = 0;
 
     /*
      * This is possible if the current thread was in VMWAIT mode when a
@@ -2618,19 +2950,39 @@ void dvmSuspendAllThreads(SuspendCause why)
             continue;
 
         /* wait for the other thread to see the pending suspend */
-        waitForThreadSuspend(self, thread);
+        if (thread->status == THREAD_RUNNING) {
+            waitedThreads++;
+            waitForThreadSuspend(self, thread);
+        }
 
         LOG_THREAD("threadid=%d:   threadid=%d status=%d sc=%d dc=%d",
             self->threadId, thread->threadId, thread->status,
             thread->suspendCount, thread->dbgSuspendCount);
     }
 
+    recordSafepoint(why, (u4) (dvmGetRelativeTimeUsec() - startWhen),
+                    waitedThreads);
+
     dvmUnlockThreadList();
     unlockThreadSuspend();
 
     LOG_THREAD("threadid=%d: SuspendAll complete", self->threadId);
 }
 
+/*
+ * Wake every other thread whose suspend count has dropped to zero.  The
+ * caller must hold the thread list lock.
+ */
+static void wakeAllResumed(Thread* self)
+{
+    for (Thread* thread = gDvm.threadList; thread != NULL;
+         thread = thread->next) {
+        if (thread != self) {
+            wakeIfResumed(thread);
+        }
+    }
+}
+
 /*
  * Resume all threads that are currently suspended.
  *
@@ -2673,56 +3025,23 @@ void dvmResumeAllThreads(SuspendCause why)
         }
     }
     unlockThreadSuspendCount();
-    dvmUnlockThreadList();
 
     /*
-     * In some ways it makes sense to continue to hold the thread-suspend
-     * lock while we issue the wakeup broadcast.  It allows us to complete
-     * one operation before moving on to the next, which simplifies the
-     * thread activity debug traces.
-     *
-     * This approach caused us some difficulty under Linux, because the
-     * condition variable broadcast not only made the threads runnable,
-     * but actually caused them to execute, and it was a while before
-     * the thread performing the wakeup had an opportunity to release the
-     * thread-suspend lock.
+     * Release the thread-suspend lock before the wakeups.  The threads we
+     * wake may run right away, and some of them may want to suspend all
+     * threads themselves; lockThreadSuspend() gives up on the lock after
+     * 3 seconds and aborts, which a busy system used to hit while the
+     * thread issuing the wakeups waited for a CPU.
      *
-     * This is a problem because, when a thread tries to acquire that
-     * lock, it times out after 3 seconds.  If at some point the thread
-     * is told to suspend, the clock resets; but since the VM is still
-     * theoretically mid-resume, there's no suspend pending.  If, for
-     * example, the GC was waking threads up while the SIGQUIT handler
-     * was trying to acquire the lock, we would occasionally time out on
-     * a busy system and SignalCatcher would abort.
-     *
-     * We now perform the unlock before the wakeup broadcast.  The next
-     * suspend can't actually start until the broadcast completes and
-     * returns, because we're holding the thread-suspend-count lock, but the
-     * suspending thread is now able to make progress and we avoid the abort.
-     *
-     * (Technically there is a narrow window between when we release
-     * the thread-suspend lock and grab the thread-suspend-count lock.
-     * This could cause us to send a broadcast to threads with nonzero
-     * suspend counts, but this is expected and they'll all just fall
-     * right back to sleep.  It's probably safe to grab the suspend-count
-     * lock before releasing thread-suspend, since we're still following
-     * the correct order of acquisition, but it feels weird.)
+     * The next suspend can't start until we let go of the thread list.
+     * Threads whose count goes up again before they see the wakeup just
+     * go back to sleep.
      */
-
-    LOG_THREAD("threadid=%d: ResumeAll waking others", self->threadId);
     unlockThreadSuspend();
 
-    /*
-     * Broadcast a notification to all suspended threads, some or all of
-     * which may choose to wake up.  No need to wait for them.
-     */
-    lockThreadSuspendCount();
-    int cc = pthread_cond_broadcast(&gDvm.threadSuspendCountCond);
-    if (cc != 0) {
-        ALOGE("pthread_cond_broadcast(&gDvm.threadSuspendCountCond) failed: %s", strerror(cc));
-        dvmAbort();
-    }
-    unlockThreadSuspendCount();
+    LOG_THREAD("threadid=%d: ResumeAll waking others", self->threadId);
+    wakeAllResumed(self);
+    dvmUnlockThreadList();
 
     LOG_THREAD("threadid=%d: ResumeAll complete", self->threadId);
 }
@@ -2761,19 +3080,10 @@ void dvmUndoDebuggerSuspensions()
                               -thread->dbgSuspendCount);
     }
     unlockThreadSuspendCount();
-    dvmUnlockThreadList();
 
-    /*
-     * Broadcast a notification to all suspended threads, some or all of
-     * which may choose to wake up.  No need to wait for them.
-     */
-    lockThreadSuspendCount();
-    int cc = pthread_cond_broadcast(&gDvm.threadSuspendCountCond);
-    if (cc != 0) {
-        ALOGE("pthread_cond_broadcast(&gDvm.threadSuspendCountCond) failed: %s", strerror(cc));
-        dvmAbort();
-    }
-    unlockThreadSuspendCount();
+    /* wake the threads we resumed; no need to wait for them */
+    wakeAllResumed(self);
+    dvmUnlockThreadList();
 
     unlockThreadSuspend();
 
@@ -2864,16 +3174,18 @@ static bool fullSuspendCheck(Thread* self)
         LOG_THREAD("threadid=%d: self-suspending", self->threadId);
         ThreadStatus oldStatus = self->status;      /* should be RUNNING */
         self->status = THREAD_SUSPENDED;
+        ackSuspend(self);
 
         ATRACE_BEGIN("DVM Suspend");
         while (self->suspendCount != 0) {
             /*
-             * Wait for wakeup signal, releasing lock.  The act of releasing
-             * and re-acquiring the lock provides the memory barriers we
-             * need for correct behavior on SMP.
+             * Wait for wakeup, releasing lock.  The act of releasing and
+             * re-acquiring the lock provides the memory barriers we need
+             * for correct behavior on SMP.  We only go back to our old
+             * status with the lock held, so nobody can suspend us again
+             * in between.
              */
-            dvmWaitCond(&gDvm.threadSuspendCountCond,
-                    &gDvm.threadSuspendCountLock);
+            waitForResume(self);
         }
         ATRACE_END();
         assert(self->suspendCount == 0 && self->dbgSuspendCount == 0);
@@ -2991,6 +3303,7 @@ ThreadStatus dvmChangeStatus(Thread* self, ThreadStatus newStatus)
         volatile void* raw = reinterpret_cast<volatile void*>(&self->status);
         volatile int32_t* addr = reinterpret_cast<volatile int32_t*>(raw);
         android_atomic_release_store(newStatus, addr);
+        ackSuspend(self);
     }
 
     return oldStatus;
@@ -70,7 +70,6 @@ void dvmThreadShutdown(void);
 void dvmSlayDaemons(void);
 
 
-#define kJniLocalRefMin         64
 #define kJniLocalRefMax         512     /* arbitrary; should be plenty */
 #define kInternalRefDefault     32      /* equally arbitrary */
 #define kInternalRefMax         4096    /* mainly a sanity check */
@@ -202,6 +201,20 @@ struct Thread {
     const Method*     methodToCall;
 #endif
 
+    /* last receiver class of each invoke-interface; see InterpDefs.h */
+    struct InterfaceSiteCacheEntry* interfaceSiteCache;
+
+    /*
+     * Allocations recorded by this thread that haven't been moved to
+     * gDvm.allocRecords yet, and the bytes allocated since the last
+     * sample; see AllocTracker.cpp.
+     */
+    struct AllocRecord* allocRecordBuf;
+    int         allocRecordBufCount;
+    u4          allocRecordGeneration;
+    size_t      allocTrackerBytes;
+    size_t      allocProfilerBytes;
+
     /* JNI local reference tracking */
     IndirectRefTable jniLocalRefTable;
 
@@ -217,6 +230,8 @@ struct Thread {
     int         currRunLen;     // Length of run in 16-bit words
     const u2*   lastPC;         // Stage the PC for the threaded interpreter
     const Method*  traceMethod; // Starting method of current trace
+    const u2*   followReturnPC; // Resume point in traceMethod of a callee
+    int         followSteps;    // Callee instructions skipped so far
     intptr_t    threshFilter[JIT_TRACE_THRESH_FILTER_SIZE];
     JitTraceRun trace[MAX_JIT_RUN_LEN];
 #endif
@@ -287,6 +302,13 @@ struct Thread {
     bool        cpuClockBaseSet;
     u8          cpuClockBase;
 
+    /*
+     * The part of the method trace buffer this thread has claimed and
+     * not filled yet; both NULL if none.
+     */
+    u1*         traceChunkCur;
+    u1*         traceChunkEnd;
+
     /* previous stack trace sample and length (used by sampling profiler) */
     const Method** stackTraceSample;
     size_t stackTraceSampleLength;
@@ -294,6 +316,38 @@ struct Thread {
     /* memory allocation profiling state */
     AllocProfState allocProf;
 
+    /*
+     * The last instruction counted for -Xopcodepairs, and where the one
+     * after it starts, so a fall-through can be told from a branch.
+     */
+    u2          pairFirstOpcode;
+    const u2*   pairNextPc;
+
+    /*
+     * Thread-local allocation buffer.  [tlabTop, tlabEnd) is the unused
+     * tail of a chunk carved out of the active heap; tlabObjects counts
+     * the objects bump-allocated from it since the last refill.  Only
+     * the owning thread touches these while it is running; the GC
+     * retires them with all threads suspended.
+     */
+    u1*         tlabTop;
+    u1*         tlabEnd;
+    size_t      tlabObjects;
+
+    /*
+     * LinearAlloc chunk.  [linearAllocTop, linearAllocEnd) is the unused
+     * tail of a chunk carved out of the boot loader's LinearAlloc, with
+     * the next block header going at linearAllocTop.  The counts are for
+     * blocks allocated to linearAllocLoader that haven't been added to
+     * the per-loader statistics yet.  Only the owning thread touches
+     * these.
+     */
+    char*       linearAllocTop;
+    char*       linearAllocEnd;
+    Object*     linearAllocLoader;
+    u4          linearAllocCount;
+    u4          linearAllocBytes;
+
 #ifdef WITH_JNI_STACK_CHECK
     u4          stackCrc;
 #endif
@@ -363,20 +417,37 @@ enum SuspendCause {
     SUSPEND_FOR_VERIFY,
     SUSPEND_FOR_HPROF,
     SUSPEND_FOR_SAMPLING,
+    SUSPEND_FOR_ALLOC_TRACKER,
+    SUSPEND_FOR_METHOD_TRACE,
 #if defined(WITH_JIT)
     SUSPEND_FOR_TBL_RESIZE,  // jit-table resize
     SUSPEND_FOR_IC_PATCH,    // polymorphic callsite inline-cache patch
     SUSPEND_FOR_CC_RESET,    // code-cache reset
     SUSPEND_FOR_REFRESH,     // Reload data cached in interpState
 #endif
+    SUSPEND_CAUSE_COUNT      // not a cause
 };
 void dvmSuspendThread(Thread* thread);
 void dvmSuspendSelf(bool jdwpActivity);
 void dvmResumeThread(Thread* thread);
+
+/*
+ * Suspend or resume one thread on behalf of the garbage collector,
+ * which scans it while the rest of the VM keeps running.  The thread
+ * list lock must be held.
+ */
+void dvmSuspendThreadForGc(Thread* thread);
+void dvmResumeThreadForGc(Thread* thread);
 void dvmSuspendAllThreads(SuspendCause why);
 void dvmResumeAllThreads(SuspendCause why);
 void dvmUndoDebuggerSuspensions(void);
 
+/*
+ * Print how long dvmSuspendAllThreads() took to stop the other threads,
+ * for each cause.
+ */
+void dvmDumpSafepointStats(const DebugOutputTarget* target);
+
 /*
  * Check suspend state.  Grab threadListLock before calling.
  */
@@ -507,6 +578,15 @@ bool dvmCreateInternalThread(pthread_t* pHandle, const char* name,
 bool dvmAttachCurrentThread(const JavaVMAttachArgs* pArgs, bool isDaemon);
 void dvmDetachCurrentThread(void);
 
+/*
+ * Attach or detach a helper of the main thread in dexopt.  Like the main
+ * thread there, the helper has no Thread object and no JNIEnv; it may
+ * load, verify and optimize classes, but must not run interpreted code.
+ * On success, the helper is left in THREAD_RUNNING.
+ */
+bool dvmAttachHelperThread(void);
+void dvmDetachHelperThread(void);
+
 /*
  * Get the "main" or "system" thread group.
  */
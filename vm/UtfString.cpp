@@ -24,6 +24,19 @@
 #include "Dalvik.h"
 #include <stdlib.h>
 
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * The conversions below take ASCII (1..0x7f, which encodes as itself in
+ * "modified" UTF-8) 8 or 16 characters at a time where we have 128-bit
+ * vectors.  Any block that holds something else, including NUL (which
+ * is two bytes in modified UTF-8), is handled by the scalar code.
+ */
+
 /*
  * Allocate a new instance of the class String, performing first-use
  * initialization of the class if necessary. Upon success, the
@@ -129,15 +142,98 @@ size_t dvmUtf8Len(const char* utf8Str)
  */
 void dvmConvertUtf8ToUtf16(u2* utf16Str, const char* utf8Str)
 {
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+    /*
+     * We don't know the length up front, so we only load aligned 16-byte
+     * blocks: they can't cross into an unmapped page, even when the
+     * terminating NUL is near the start of one.  A block of nothing but
+     * ASCII is widened in one go; otherwise (or until we're aligned) we
+     * convert one character at a time up to the next block.  A multi-byte
+     * sequence may then run past the block, which just means the next
+     * one starts unaligned.
+     */
+    for (;;) {
+        if (((uintptr_t) utf8Str & 15) == 0) {
+#if defined(__ARM_NEON__)
+            int8x16_t bytes = vld1q_s8((const int8_t*) utf8Str);
+            uint64x2_t ascii = vreinterpretq_u64_u8(
+                vcgtq_s8(bytes, vdupq_n_s8(0)));
+            if ((vgetq_lane_u64(ascii, 0) & vgetq_lane_u64(ascii, 1))
+                    == ~0ULL)
+            {
+                uint8x16_t ubytes = vreinterpretq_u8_s8(bytes);
+                vst1q_u16(utf16Str, vmovl_u8(vget_low_u8(ubytes)));
+                vst1q_u16(utf16Str + 8, vmovl_u8(vget_high_u8(ubytes)));
+                utf8Str += 16;
+                utf16Str += 16;
+                continue;
+            }
+#else
+            __m128i bytes = _mm_load_si128((const __m128i*) utf8Str);
+            __m128i zero = _mm_setzero_si128();
+            if (_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, zero)) == 0xffff) {
+                _mm_storeu_si128((__m128i*) utf16Str,
+                    _mm_unpacklo_epi8(bytes, zero));
+                _mm_storeu_si128((__m128i*) (utf16Str + 8),
+                    _mm_unpackhi_epi8(bytes, zero));
+                utf8Str += 16;
+                utf16Str += 16;
+                continue;
+            }
+#endif
+        }
+
+        const char* blockEnd = (const char*) (((uintptr_t) utf8Str + 16) & ~15);
+        do {
+            if (*utf8Str == '\0')
+                return;
+            *utf16Str++ = dexGetUtf16FromUtf8(&utf8Str);
+        } while (utf8Str < blockEnd);
+    }
+#else
     while (*utf8Str != '\0')
         *utf16Str++ = dexGetUtf16FromUtf8(&utf8Str);
+#endif
+}
+
+/*
+ * Return the number of characters at the start of "utf16Str" (8 at a
+ * time, at most "len") that are all in 1..0x7f.
+ */
+static inline int asciiPrefixLen(const u2* utf16Str, int len)
+{
+    int i = 0;
+#if defined(__ARM_NEON__)
+    /* x-1 < 0x7f, unsigned, leaves out 0 as well */
+    const uint16x8_t one = vdupq_n_u16(1);
+    const uint16x8_t limit = vdupq_n_u16(0x7f);
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t chars = vld1q_u16(utf16Str + i);
+        uint64x2_t ascii = vreinterpretq_u64_u16(
+            vcltq_u16(vsubq_u16(chars, one), limit));
+        if ((vgetq_lane_u64(ascii, 0) & vgetq_lane_u64(ascii, 1)) != ~0ULL)
+            break;
+    }
+#elif defined(__SSE2__)
+    /* signed 0 < x < 0x80; anything from 0x8000 up is negative */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i limit = _mm_set1_epi16(0x80);
+    for (; i + 8 <= len; i += 8) {
+        __m128i chars = _mm_loadu_si128((const __m128i*) (utf16Str + i));
+        __m128i ascii = _mm_and_si128(_mm_cmpgt_epi16(chars, zero),
+                                      _mm_cmplt_epi16(chars, limit));
+        if (_mm_movemask_epi8(ascii) != 0xffff)
+            break;
+    }
+#endif
+    return i;
 }
 
 /*
  * Given a UTF-16 string, compute the length of the corresponding UTF-8
- * string in bytes.
+ * string in bytes, one character at a time.
  */
-static int utf16_utf8ByteLen(const u2* utf16Str, int len)
+static inline int utf16_utf8ByteLenScalar(const u2* utf16Str, int len)
 {
     int utf8Len = 0;
 
@@ -158,6 +254,30 @@ static int utf16_utf8ByteLen(const u2* utf16Str, int len)
     return utf8Len;
 }
 
+/*
+ * Given a UTF-16 string, compute the length of the corresponding UTF-8
+ * string in bytes.
+ */
+static int utf16_utf8ByteLen(const u2* utf16Str, int len)
+{
+    int utf8Len = 0;
+
+    while (len > 0) {
+        /* an ASCII run is one byte per character */
+        int ascii = asciiPrefixLen(utf16Str, len);
+        utf8Len += ascii;
+        utf16Str += ascii;
+        len -= ascii;
+
+        /* then the block that stopped it, or the tail */
+        int count = (len < 8) ? len : 8;
+        utf8Len += utf16_utf8ByteLenScalar(utf16Str, count);
+        utf16Str += count;
+        len -= count;
+    }
+    return utf8Len;
+}
+
 /*
  * Convert a UTF-16 string to UTF-8.
  *
@@ -168,23 +288,45 @@ static void convertUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len)
 {
     assert(len >= 0);
 
-    while (len--) {
-        unsigned int uic = *utf16Str++;
-
-        /*
-         * The most common case is (uic > 0 && uic <= 0x7f).
-         */
-        if (uic == 0 || uic > 0x7f) {
-            if (uic > 0x07ff) {
-                *utf8Str++ = (uic >> 12) | 0xe0;
-                *utf8Str++ = ((uic >> 6) & 0x3f) | 0x80;
-                *utf8Str++ = (uic & 0x3f) | 0x80;
-            } else /*(uic > 0x7f || uic == 0)*/ {
-                *utf8Str++ = (uic >> 6) | 0xc0;
-                *utf8Str++ = (uic & 0x3f) | 0x80;
+    while (len > 0) {
+        /* narrow a run of ASCII straight across */
+        int ascii = asciiPrefixLen(utf16Str, len);
+        int i = 0;
+#if defined(__ARM_NEON__)
+        for (; i < ascii; i += 8)
+            vst1_u8((uint8_t*) utf8Str + i, vmovn_u16(vld1q_u16(utf16Str + i)));
+#elif defined(__SSE2__)
+        for (; i < ascii; i += 8) {
+            __m128i chars = _mm_loadu_si128((const __m128i*) (utf16Str + i));
+            _mm_storel_epi64((__m128i*) (utf8Str + i),
+                _mm_packus_epi16(chars, chars));
+        }
+#endif
+        utf8Str += ascii;
+        utf16Str += ascii;
+        len -= ascii;
+
+        /* then the block that stopped it, or the tail */
+        int count = (len < 8) ? len : 8;
+        len -= count;
+        while (count--) {
+            unsigned int uic = *utf16Str++;
+
+            /*
+             * The most common case is (uic > 0 && uic <= 0x7f).
+             */
+            if (uic == 0 || uic > 0x7f) {
+                if (uic > 0x07ff) {
+                    *utf8Str++ = (uic >> 12) | 0xe0;
+                    *utf8Str++ = ((uic >> 6) & 0x3f) | 0x80;
+                    *utf8Str++ = (uic & 0x3f) | 0x80;
+                } else /*(uic > 0x7f || uic == 0)*/ {
+                    *utf8Str++ = (uic >> 6) | 0xc0;
+                    *utf8Str++ = (uic & 0x3f) | 0x80;
+                }
+            } else {
+                *utf8Str++ = uic;
             }
-        } else {
-            *utf8Str++ = uic;
         }
     }
 
@@ -193,11 +335,20 @@ static void convertUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len)
 
 /*
  * Use the java/lang/String.computeHashCode() algorithm.
+ *
+ * Four characters at a time, hash*31^4 + c0*31^3 + c1*31^2 + c2*31 + c3
+ * gives the same result (the arithmetic is all mod 2^32) with only one
+ * multiply on the chain from one step to the next.
  */
 static inline u4 computeUtf16Hash(const u2* utf16Str, size_t len)
 {
     u4 hash = 0;
 
+    for (; len >= 4; len -= 4, utf16Str += 4) {
+        hash = hash * (31 * 31 * 31 * 31) +
+               utf16Str[0] * (31 * 31 * 31) + utf16Str[1] * (31 * 31) +
+               utf16Str[2] * 31 + utf16Str[3];
+    }
     while (len--)
         hash = hash * 31 + *utf16Str++;
 
@@ -68,6 +68,12 @@ void dvmGcShutdown()
  */
 bool dvmGcPreZygoteFork()
 {
+    if (gDvm.zygoteCompaction && !gDvm.newZygoteHeapAllocated) {
+        dvmLockHeap();
+        dvmWaitForConcurrentGcToComplete();
+        dvmCollectGarbageInternal(GC_BEFORE_FORK);
+        dvmUnlockHeap();
+    }
     return dvmHeapSourceStartupBeforeFork();
 }
 
@@ -198,6 +204,38 @@ Object* dvmAllocObject(ClassObject* clazz, int flags)
     return newObj;
 }
 
+void dvmInitFastAlloc(ClassObject* clazz)
+{
+    /* Instances of java.lang.Class vary in size, and arrays don't come
+     * through here.
+     */
+    if (dvmIsTheClassClass(clazz) || dvmIsArrayClass(clazz)) {
+        clazz->fastAllocSize = 0;
+    } else {
+        clazz->fastAllocSize = dvmHeapSourceTlabChunkSize(clazz->objectSize);
+    }
+}
+
+Object* dvmAllocObjectFast(ClassObject* clazz, Thread* self)
+{
+    assert(dvmIsClassInitialized(clazz) || dvmIsClassInitializing(clazz));
+    assert(self->status == THREAD_RUNNING);
+
+    /* Allocation profiling and DDMS allocation tracking want to see
+     * every allocation.
+     */
+    if (clazz->fastAllocSize != 0 && !gDvm.allocProf.enabled &&
+        gDvm.allocRecords == NULL) {
+        Object* newObj = (Object*)dvmHeapSourceAllocTlabChunk(self,
+                clazz->fastAllocSize);
+        if (newObj != NULL) {
+            DVM_OBJECT_INIT(newObj, clazz);
+            return newObj;
+        }
+    }
+    return dvmAllocObject(clazz, ALLOC_DONT_TRACK);
+}
+
 /*
  * Create a copy of an object, for Object.clone().
  *
@@ -222,21 +260,45 @@ Object* dvmCloneObject(Object* obj, int flags)
         size = clazz->objectSize;
     }
 
-    Object* copy = (Object*)dvmMalloc(size, flags);
-    if (copy == NULL)
-        return NULL;
+    /* Untracked clones, which is what Object.clone() and the JIT ask
+     * for, come straight out of the thread's allocation buffer when
+     * nobody is watching allocations.  Everything else goes through
+     * dvmMalloc(), which knows about the flags.
+     */
+    Object* copy = NULL;
+    bool tracked = true;
+    if (flags == ALLOC_DONT_TRACK && !gDvm.allocProf.enabled &&
+        gDvm.allocRecords == NULL) {
+        copy = (Object*)dvmHeapSourceAllocTlab(dvmThreadSelf(), size);
+        tracked = (copy == NULL);
+    }
+    if (copy == NULL) {
+        copy = (Object*)dvmMalloc(size, flags);
+        if (copy == NULL)
+            return NULL;
+    }
 
     DVM_OBJECT_INIT(copy, clazz);
     size_t offset = sizeof(Object);
     /* Copy instance data.  We assume memcpy copies by words. */
     memcpy((char*)copy + offset, (char*)obj + offset, size - offset);
 
+    /* The copy went around the write barrier, so one card mark covers
+     * every reference it holds.
+     */
+    if (IS_CLASS_FLAG_SET(clazz, CLASS_ISOBJECTARRAY) ||
+        (!IS_CLASS_FLAG_SET(clazz, CLASS_ISARRAY) && clazz->refOffsets != 0)) {
+        dvmWriteBarrierObject(copy);
+    }
+
     /* Mark the clone as finalizable if appropriate. */
     if (IS_CLASS_FLAG_SET(clazz, CLASS_ISFINALIZABLE)) {
         dvmSetFinalizable(copy);
     }
 
-    dvmTrackAllocation(clazz, size);    /* notify DDMS */
+    if (tracked) {
+        dvmTrackAllocation(clazz, size);    /* notify DDMS */
+    }
 
     return copy;
 }
@@ -362,6 +424,120 @@ size_t dvmCountAssignableInstancesOfClass(const ClassObject *clazz)
     return ctx.count;
 }
 
+struct HistogramEntry {
+    const ClassObject *clazz;
+    size_t count;
+    size_t bytes;
+};
+
+struct HistogramContext {
+    HashTable *classes;
+    size_t count;
+    size_t bytes;
+};
+
+static int compareHistogramClasses(const void *item1, const void *item2)
+{
+    return ((const HistogramEntry *)item1)->clazz !=
+           ((const HistogramEntry *)item2)->clazz;
+}
+
+static void heapHistogramCallback(Object *obj, void *arg)
+{
+    HistogramContext *ctx = (HistogramContext *)arg;
+    assert(ctx != NULL);
+    if (obj->clazz == NULL) {
+        return;
+    }
+    HistogramEntry key = { obj->clazz, 0, 0 };
+    u4 hash = (u4)((uintptr_t)obj->clazz >> 3);
+    HistogramEntry *entry = (HistogramEntry *)
+        dvmHashTableLookup(ctx->classes, hash, &key,
+                           compareHistogramClasses, false);
+    if (entry == NULL) {
+        entry = (HistogramEntry *)calloc(1, sizeof(*entry));
+        if (entry == NULL) {
+            return;
+        }
+        entry->clazz = obj->clazz;
+        dvmHashTableLookup(ctx->classes, hash, entry,
+                           compareHistogramClasses, true);
+    }
+    size_t size = dvmObjectSizeInHeap(obj);
+    entry->count += 1;
+    entry->bytes += size;
+    ctx->count += 1;
+    ctx->bytes += size;
+}
+
+static int collectHistogramEntry(void *data, void *arg)
+{
+    HistogramEntry ***pNext = (HistogramEntry ***)arg;
+    **pNext = (HistogramEntry *)data;
+    *pNext += 1;
+    return 0;
+}
+
+static int compareHistogramBytes(const void *a, const void *b)
+{
+    const HistogramEntry *entry1 = *(const HistogramEntry **)a;
+    const HistogramEntry *entry2 = *(const HistogramEntry **)b;
+    if (entry1->bytes != entry2->bytes) {
+        return entry1->bytes < entry2->bytes ? 1 : -1;
+    }
+    return entry1->count < entry2->count ? 1 :
+           entry1->count > entry2->count ? -1 : 0;
+}
+
+void dvmHeapHistogramDump(const DebugOutputTarget *target, size_t maxClasses)
+{
+    HistogramContext ctx = { dvmHashTableCreateRobinHood(dvmHashSize(1024),
+                                                         free), 0, 0 };
+    if (ctx.classes == NULL) {
+        return;
+    }
+    u8 start = dvmGetRelativeTimeUsec();
+    dvmLockHeap();
+    HeapBitmap *bitmap = dvmHeapSourceGetLiveBits();
+    dvmHeapBitmapWalk(bitmap, heapHistogramCallback, &ctx);
+    dvmUnlockHeap();
+    u8 usec = dvmGetRelativeTimeUsec() - start;
+
+    /*
+     * Classes are never unloaded, so the descriptors are still good
+     * after the heap lock is dropped.
+     */
+    size_t numClasses = dvmHashTableNumEntries(ctx.classes);
+    HistogramEntry **entries =
+        (HistogramEntry **)malloc(numClasses * sizeof(*entries));
+    if (entries != NULL) {
+        HistogramEntry **next = entries;
+        dvmHashForeach(ctx.classes, collectHistogramEntry, &next);
+        qsort(entries, numClasses, sizeof(*entries), compareHistogramBytes);
+
+        dvmPrintDebugMessage(target,
+            "Heap: %zd objects, %zd bytes, %zd classes (%llu us)\n",
+            ctx.count, ctx.bytes, numClasses, usec);
+        dvmPrintDebugMessage(target, "%12s %10s  %s\n",
+            "bytes", "count", "class");
+        size_t shown = numClasses;
+        if (maxClasses != 0 && maxClasses < shown) {
+            shown = maxClasses;
+        }
+        for (size_t i = 0; i < shown; ++i) {
+            dvmPrintDebugMessage(target, "%12zd %10zd  %s\n",
+                entries[i]->bytes, entries[i]->count,
+                entries[i]->clazz->descriptor);
+        }
+        if (shown < numClasses) {
+            dvmPrintDebugMessage(target, "  ... %zd more classes\n",
+                numClasses - shown);
+        }
+        free(entries);
+    }
+    dvmHashTableFree(ctx.classes);
+}
+
 bool dvmIsHeapAddress(void *address)
 {
     return address != NULL && (((uintptr_t) address & (8-1)) == 0);
@@ -369,5 +545,5 @@ bool dvmIsHeapAddress(void *address)
 
 bool dvmIsNonMovingObject(const Object* object)
 {
-    return true;
+    return dvmHeapSourceIsNonMoving(object);
 }
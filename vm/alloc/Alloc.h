@@ -26,6 +26,7 @@ enum {
     ALLOC_DEFAULT = 0x00,
     ALLOC_DONT_TRACK = 0x01,  /* don't add to internal tracking list */
     ALLOC_NON_MOVING = 0x02,
+    ALLOC_NO_REFS = 0x04,     /* object holds no references */
 };
 
 /*
@@ -53,6 +54,12 @@ bool dvmGcPreZygoteFork(void);
  */
 void* dvmMalloc(size_t size, int flags);
 
+/*
+ * Return the unused part of a thread's local allocation buffer to the
+ * heap.  Must be called by an exiting thread before it stops running.
+ */
+void dvmRetireAllocBuffer(Thread* self);
+
 /*
  * Allocate a new object.
  *
@@ -63,6 +70,22 @@ void* dvmMalloc(size_t size, int flags);
  */
 extern "C" Object* dvmAllocObject(ClassObject* clazz, int flags);
 
+/*
+ * Allocate a new, untracked instance of an initialized class.  This is
+ * the entry point for new-instance in the interpreters and the JIT;
+ * instances of classes set up by dvmInitFastAlloc() are carved from the
+ * thread's local allocation buffer without going through dvmMalloc().
+ *
+ * Returns NULL and throws an exception on failure.
+ */
+extern "C" Object* dvmAllocObjectFast(ClassObject* clazz, Thread* self);
+
+/*
+ * Set up clazz->fastAllocSize.  Called just before the class is marked
+ * initialized.
+ */
+void dvmInitFastAlloc(ClassObject* clazz);
+
 /*
  * Track an object reference that is currently only visible internally.
  * This is called automatically by dvmMalloc() unless ALLOC_DONT_TRACK
@@ -139,11 +162,25 @@ size_t dvmCountInstancesOfClass(const ClassObject *clazz);
  */
 size_t dvmCountAssignableInstancesOfClass(const ClassObject *clazz);
 
+/*
+ * Walks the live bitmap once and prints the number of instances and
+ * shallow bytes of every class with live objects, largest first.  Shows
+ * at most <maxClasses> classes, or all of them if it is zero.  Takes the
+ * heap lock for the walk only.
+ */
+void dvmHeapHistogramDump(const DebugOutputTarget *target, size_t maxClasses);
+
 /*
  * Removes any growth limits from the heap.
  */
 void dvmClearGrowthLimit(void);
 
+/*
+ * Asks the GC daemon to compact the heap, for when the process is no
+ * longer sensitive to pauses.  Does nothing unless -Xgc:compact.
+ */
+void dvmRequestHeapCompaction(void);
+
 /*
  * Returns true if the address is aligned appropriately for a heap object.
  * Does not require the caller to hold the heap lock, and does not take the
@@ -151,6 +188,16 @@ void dvmClearGrowthLimit(void);
  */
 bool dvmIsHeapAddress(void *address);
 
+/*
+ * Returns true if the object will never be moved by the collector.
+ */
 bool dvmIsNonMovingObject(const Object* object);
 
+/*
+ * Returns true if an object read from a JNI weak global is dead, though
+ * the concurrent sweep of the weak globals has yet to clear it.  The
+ * caller must hold jniWeakGlobalRefLock.
+ */
+bool dvmIsDeadWeakGlobalReferent(const Object* obj);
+
 #endif  // DALVIK_ALLOC_ALLOC_H_
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "alloc/AllocProfiler.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define kMaxSiteStackDepth      16
+
+/*
+ * An allocation site: the class allocated and the innermost frames of
+ * the stack that allocated it.  Classes and methods are never unloaded,
+ * so the pointers stay good after the profiler is stopped.
+ */
+struct AllocSite {
+    u4 hash;
+    const ClassObject* clazz;
+    int depth;
+    u8 samples;
+    u8 bytes;
+    struct {
+        const Method* method;
+        u4 pc;                  /* in 16-bit units; 0 if native */
+    } frames[kMaxSiteStackDepth];
+};
+
+/*
+ * The table's own lock guards it.  It is only taken once per sample, so
+ * it's never contended enough to matter at any sensible interval.
+ */
+static HashTable* gAllocSites;
+
+bool dvmAllocProfilerStartup()
+{
+    gAllocSites = dvmHashTableCreateRobinHood(dvmHashSize(1024), free);
+    return gAllocSites != NULL;
+}
+
+void dvmAllocProfilerShutdown()
+{
+    gDvm.allocProfilerInterval = 0;
+    dvmHashTableFree(gAllocSites);
+    gAllocSites = NULL;
+}
+
+void dvmAllocProfilerStart(size_t intervalBytes)
+{
+    assert(intervalBytes != 0);
+    dvmHashTableLock(gAllocSites);
+    dvmHashTableClear(gAllocSites);
+    gDvm.allocProfilerInterval = intervalBytes;
+    dvmHashTableUnlock(gAllocSites);
+}
+
+void dvmAllocProfilerStop()
+{
+    gDvm.allocProfilerInterval = 0;
+}
+
+static int compareAllocSites(const void* item1, const void* item2)
+{
+    const AllocSite* site1 = (const AllocSite*) item1;
+    const AllocSite* site2 = (const AllocSite*) item2;
+    if (site1->clazz != site2->clazz || site1->depth != site2->depth)
+        return 1;
+    return memcmp(site1->frames, site2->frames,
+        site1->depth * sizeof(site1->frames[0]));
+}
+
+/*
+ * Fills in the site's frames, and sets its depth and hash.
+ */
+static void getSiteStack(Thread* self, AllocSite* site)
+{
+    u4 hash = (u4) ((uintptr_t) site->clazz >> 3);
+    int depth = 0;
+
+    for (void* fp = self->interpSave.curFrame;
+         fp != NULL && depth < kMaxSiteStackDepth;
+         fp = SAVEAREA_FROM_FP(fp)->prevFrame) {
+        if (dvmIsBreakFrame((u4*) fp))
+            continue;
+
+        const StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
+        const Method* method = saveArea->method;
+        u4 pc = 0;
+        if (!dvmIsNativeMethod(method))
+            pc = saveArea->xtra.currentPc - method->insns;
+
+        site->frames[depth].method = method;
+        site->frames[depth].pc = pc;
+        hash = hash * 31 + (u4) ((uintptr_t) method >> 2);
+        hash = hash * 31 + pc;
+        depth++;
+    }
+    site->depth = depth;
+    site->hash = hash;
+}
+
+void dvmAllocProfilerRecord(ClassObject* clazz, size_t size)
+{
+    Thread* self = dvmThreadSelf();
+    size_t interval = gDvm.allocProfilerInterval;
+    if (self == NULL || interval == 0)
+        return;
+
+    self->allocProfilerBytes += size;
+    if (self->allocProfilerBytes < interval)
+        return;
+    self->allocProfilerBytes = 0;
+
+    /*
+     * Each sample stands for "interval" bytes of smaller allocations, or
+     * for itself if it's bigger than that.
+     */
+    AllocSite key;
+    key.clazz = clazz;
+    getSiteStack(self, &key);
+    u8 weight = size > interval ? size : interval;
+
+    dvmHashTableLock(gAllocSites);
+    AllocSite* site = (AllocSite*) dvmHashTableLookup(gAllocSites, key.hash,
+        &key, compareAllocSites, false);
+    if (site == NULL) {
+        site = (AllocSite*) malloc(sizeof(AllocSite));
+        if (site != NULL) {
+            memcpy(site, &key, sizeof(AllocSite));
+            site->samples = 0;
+            site->bytes = 0;
+            dvmHashTableLookup(gAllocSites, key.hash, site,
+                compareAllocSites, true);
+        }
+    }
+    if (site != NULL) {
+        site->samples++;
+        site->bytes += weight;
+    }
+    dvmHashTableUnlock(gAllocSites);
+}
+
+struct DumpContext {
+    FILE* fp;
+    bool counts;
+};
+
+static int dumpAllocSite(void* data, void* arg)
+{
+    const AllocSite* site = (const AllocSite*) data;
+    DumpContext* ctx = (DumpContext*) arg;
+
+    for (int i = site->depth - 1; i >= 0; i--) {
+        const Method* method = site->frames[i].method;
+        std::string className =
+            dvmHumanReadableDescriptor(method->clazz->descriptor);
+        if (dvmIsNativeMethod(method)) {
+            fprintf(ctx->fp, "%s.%s(Native);", className.c_str(),
+                method->name);
+        } else {
+            fprintf(ctx->fp, "%s.%s:%d;", className.c_str(), method->name,
+                dvmLineNumFromPC(method, site->frames[i].pc));
+        }
+    }
+    std::string allocated = dvmHumanReadableDescriptor(site->clazz->descriptor);
+    fprintf(ctx->fp, "%s %llu\n", allocated.c_str(),
+        ctx->counts ? site->samples : site->bytes);
+    return 0;
+}
+
+bool dvmAllocProfilerDump(const char* fileName, bool counts)
+{
+    FILE* fp = fopen(fileName, "w");
+    if (fp == NULL) {
+        ALOGE("Unable to open allocation profile '%s': %s",
+            fileName, strerror(errno));
+        return false;
+    }
+
+    DumpContext ctx = { fp, counts };
+    dvmHashTableLock(gAllocSites);
+    dvmHashForeach(gAllocSites, dumpAllocSite, &ctx);
+    dvmHashTableUnlock(gAllocSites);
+
+    bool result = !ferror(fp);
+    if (fclose(fp) != 0)
+        result = false;
+    return result;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sampling allocation profiler.  Every so many bytes allocated by a
+ * thread, the allocation's class and stack are added to a table of
+ * allocation sites.  Unlike the DDMS allocation tracker it keeps no
+ * per-allocation records, so it can be left on.
+ */
+#ifndef DALVIK_ALLOC_ALLOCPROFILER_H_
+#define DALVIK_ALLOC_ALLOCPROFILER_H_
+
+bool dvmAllocProfilerStartup(void);
+void dvmAllocProfilerShutdown(void);
+
+/*
+ * Starts sampling one allocation per "intervalBytes" bytes allocated on
+ * each thread, forgetting any earlier samples.
+ */
+void dvmAllocProfilerStart(size_t intervalBytes);
+
+/*
+ * Stops sampling.  The samples are kept for dvmAllocProfilerDump().
+ */
+void dvmAllocProfilerStop(void);
+
+/*
+ * Called through dvmTrackAllocation() while the profiler is running.
+ */
+void dvmAllocProfilerRecord(ClassObject* clazz, size_t size);
+
+/*
+ * Writes the sampled sites in the "folded stacks" format read by
+ * flame graph tools: one line per site, with the frames outermost first
+ * separated by semicolons, then the allocated class, then a space and
+ * the estimated bytes, or the number of samples if "counts" is set.
+ * Returns false if the file couldn't be written.
+ */
+bool dvmAllocProfilerDump(const char* fileName, bool counts);
+
+#endif  // DALVIK_ALLOC_ALLOCPROFILER_H_
@@ -22,6 +22,12 @@
 #include "alloc/HeapSource.h"
 #include "alloc/Visit.h"
 
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
  * Maintain a card table from the the write barrier. All writes of
  * non-NULL values to heap addresses should go through an entry in
@@ -30,7 +36,10 @@
  * The heap is divided into "cards" of GC_CARD_SIZE bytes, as
  * determined by GC_CARD_SHIFT. The card table contains one byte of
  * data per card, to be used by the GC. The value of the byte will be
- * one of GC_CARD_CLEAN or GC_CARD_DIRTY.
+ * one of GC_CARD_CLEAN, GC_CARD_AGED or GC_CARD_DIRTY.  Only the write
+ * barrier makes cards dirty; aged cards are dirty cards the GC has set
+ * aside to scan later while still noticing new writes.  The values are
+ * ordered so that "at least aged" means "aged or dirty".
  *
  * After any store of a non-NULL object pointer into a heap object,
  * code is obliged to mark the card dirty. The setters in
@@ -64,8 +73,8 @@ bool dvmCardTableStartup(size_t heapMaximumSize, size_t growthLimit)
     /* Set up the card table */
     length = heapMaximumSize / GC_CARD_SIZE;
     /* Allocate an extra 256 bytes to allow fixed low-byte of base */
-    allocBase = dvmAllocRegion(length + 0x100, PROT_READ | PROT_WRITE,
-                            "dalvik-card-table");
+    allocBase = dvmAllocHugeRegion(length + 0x100, PROT_READ | PROT_WRITE,
+                                   "dalvik-card-table");
     if (allocBase == NULL) {
         return false;
     }
@@ -92,6 +101,20 @@ void dvmCardTableShutdown()
     munmap(gDvm.gcHeap->cardTableBase, gDvm.gcHeap->cardTableLength);
 }
 
+/*
+ * Returns the first card that a collection may clean.  The cards of an
+ * immune zygote heap are never cleaned; they are how a collection finds
+ * the zygote objects that have been given references to newer ones.
+ */
+static u1 *firstCleanableCard()
+{
+    void *immuneLimit = dvmHeapSourceGetImmuneLimit(false);
+    if (immuneLimit == NULL) {
+        return gDvm.gcHeap->cardTableBase;
+    }
+    return dvmCardFromAddr(immuneLimit);
+}
+
 void dvmClearCardTable()
 {
     /*
@@ -133,9 +156,22 @@ void dvmClearCardTable()
      */
     assert(gDvm.gcHeap->cardTableBase != NULL);
 
+    u1 *base = gDvm.gcHeap->cardTableBase;
+    u1 *start = firstCleanableCard();
     if (gDvm.lowMemoryMode) {
       // zero out cards with madvise(), discarding all pages in the card table
-      madvise(gDvm.gcHeap->cardTableBase, gDvm.gcHeap->cardTableLength, MADV_DONTNEED);
+      // that hold no immune cards
+      u1 *end = base + gDvm.gcHeap->cardTableLength;
+      u1 *page = (u1 *)ALIGN_UP_TO_PAGE_SIZE(start);
+      if (page > end) {
+          page = end;
+      }
+      if (start < page) {
+          memset(start, GC_CARD_CLEAN, page - start);
+      }
+      if (page < end) {
+          madvise(page, end - page, MADV_DONTNEED);
+      }
     } else {
       // zero out cards with memset(), using liveBits as an estimate
       const HeapBitmap* liveBits = dvmHeapSourceGetLiveBits();
@@ -145,8 +181,161 @@ void dvmClearCardTable()
           maxLiveCard = gDvm.gcHeap->cardTableLength;
       }
 
-      memset(gDvm.gcHeap->cardTableBase, GC_CARD_CLEAN, maxLiveCard);
+      if (start < base + maxLiveCard) {
+          memset(start, GC_CARD_CLEAN, base + maxLiveCard - start);
+      }
+    }
+}
+
+/*
+ * Like dvmClearCardTable, but remembers which cards were dirty.  Cards
+ * aged by the previous sticky GC have been scanned by it and are no
+ * longer needed.
+ */
+void dvmAgeCardTable()
+{
+    assert(gDvm.gcHeap->cardTableBase != NULL);
+
+    const HeapBitmap* liveBits = dvmHeapSourceGetLiveBits();
+    size_t maxLiveCard = (liveBits->max - liveBits->base) / GC_CARD_SIZE + 1;
+    if (maxLiveCard > gDvm.gcHeap->cardTableLength) {
+        maxLiveCard = gDvm.gcHeap->cardTableLength;
+    }
+    u1 *card = firstCleanableCard();
+    u1 *end = gDvm.gcHeap->cardTableBase + maxLiveCard;
+    while (card < end) {
+        card = (u1 *)dvmFindCard(card, end, GC_CARD_AGED);
+        if (card == NULL) {
+            break;
+        }
+        *card = (*card == GC_CARD_DIRTY) ? GC_CARD_AGED : GC_CARD_CLEAN;
+        ++card;
+    }
+}
+
+/*
+ * Applies the pre-cleaning transition to each card in a word: dirty
+ * becomes aged, and aged becomes clean.
+ */
+static u4 preCleanCardWord(u4 word, size_t *numAged)
+{
+    u4 result = 0;
+    for (size_t shift = 0; shift < 32; shift += 8) {
+        if (((word >> shift) & 0xff) == GC_CARD_DIRTY) {
+            result |= (u4)GC_CARD_AGED << shift;
+            ++*numAged;
+        }
+    }
+    return result;
+}
+
+/*
+ * Cards are updated a word at a time with a compare-and-swap, so that
+ * a card dirtied by a mutator between our read and our write is left
+ * dirty rather than lost.
+ */
+size_t dvmPreCleanCardTable()
+{
+    GcHeap *h = gDvm.gcHeap;
+    assert(h->cardTableBase != NULL);
+    assert(((uintptr_t)h->cardTableBase & (sizeof(u4) - 1)) == 0);
+
+    u1 *base = h->cardTableBase;
+    // The limit is the card one after the last accessible card.
+    u1 *limit = dvmCardFromAddr((u1 *)dvmHeapSourceGetLimit() - GC_CARD_SIZE) + 1;
+    assert(limit <= &base[h->cardTableOffset + h->cardTableLength]);
+    /* The table is page-aligned, so rounding up stays in the mapping. */
+    limit = (u1 *)ALIGN_UP(limit, sizeof(u4));
+
+    /*
+     * Cards are cleaned a word at a time, so the word holding the first
+     * cleanable card is left alone; its cards are scanned in the pause.
+     */
+    size_t numAged = 0;
+    u1 *ptr = (u1 *)ALIGN_UP(firstCleanableCard(), sizeof(u4));
+    while (ptr < limit) {
+        u1 *card = (u1 *)dvmFindCard(ptr, limit, GC_CARD_AGED);
+        if (card == NULL) {
+            break;
+        }
+        volatile int32_t *addr =
+            (volatile int32_t *)((uintptr_t)card & ~(sizeof(u4) - 1));
+        for (;;) {
+            size_t aged = 0;
+            int32_t oldWord = *addr;
+            int32_t newWord = (int32_t)preCleanCardWord((u4)oldWord, &aged);
+            if (oldWord == newWord ||
+                android_atomic_release_cas(oldWord, newWord, addr) == 0) {
+                numAged += aged;
+                break;
+            }
+        }
+        ptr = (u1 *)addr + sizeof(u4);
+    }
+    return numAged;
+}
+
+/*
+ * Returns true if any card in the aligned block of kCardBlockSize
+ * cards at ptr is not clean.
+ */
+#if defined(__ARM_NEON__)
+static const size_t kCardBlockSize = 16;
+
+static inline bool isCardBlockTouched(const u1 *ptr)
+{
+    uint64x2_t v = vreinterpretq_u64_u8(vld1q_u8(ptr));
+    return (vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) != 0;
+}
+#elif defined(__SSE2__)
+static const size_t kCardBlockSize = 16;
+
+static inline bool isCardBlockTouched(const u1 *ptr)
+{
+    __m128i v = _mm_load_si128((const __m128i *)ptr);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+}
+#else
+static const size_t kCardBlockSize = sizeof(uintptr_t);
+
+static inline bool isCardBlockTouched(const u1 *ptr)
+{
+    return *(const uintptr_t *)ptr != 0;
+}
+#endif
+
+/*
+ * Returns the first card in [start, end) with a value of at least
+ * minCard, or NULL if there is none.  Clean cards are skipped a block
+ * at a time, which is most of the table during a re-mark.
+ */
+const u1 *dvmFindCard(const u1 *start, const u1 *end, u1 minCard)
+{
+    assert(minCard > GC_CARD_CLEAN);
+    const u1 *ptr = start;
+    /* Scan up to the first block boundary a byte at a time. */
+    while (ptr < end && ((uintptr_t)ptr & (kCardBlockSize - 1)) != 0) {
+        if (*ptr >= minCard) {
+            return ptr;
+        }
+        ++ptr;
+    }
+    while ((size_t)(end - ptr) >= kCardBlockSize) {
+        if (isCardBlockTouched(ptr)) {
+            for (size_t i = 0; i < kCardBlockSize; ++i) {
+                if (ptr[i] >= minCard) {
+                    return ptr + i;
+                }
+            }
+        }
+        ptr += kCardBlockSize;
+    }
+    for (; ptr < end; ++ptr) {
+        if (*ptr >= minCard) {
+            return ptr;
+        }
     }
+    return NULL;
 }
 
 /*
@@ -27,6 +27,8 @@
 #define GC_CARD_SIZE (1 << GC_CARD_SHIFT)
 #define GC_CARD_CLEAN 0
 #define GC_CARD_DIRTY 0x70
+/* A card that was dirty when the current or previous sticky GC began. */
+#define GC_CARD_AGED (GC_CARD_DIRTY - 1)
 
 /*
  * Initializes the card table; must be called before any other
@@ -44,6 +46,25 @@ void dvmCardTableShutdown(void);
  */
 void dvmClearCardTable(void);
 
+/*
+ * Ages the card table for a sticky collection: dirty cards become
+ * aged, and all other cards are cleaned.  Must be called with all
+ * mutator threads suspended.
+ */
+void dvmAgeCardTable(void);
+
+/*
+ * Ages dirty cards and cleans aged cards while mutator threads may be
+ * dirtying cards concurrently.  Returns the number of cards aged.
+ */
+size_t dvmPreCleanCardTable(void);
+
+/*
+ * Returns the first card in [start, end) with a value of at least
+ * minCard, or NULL if there is none.
+ */
+const u1 *dvmFindCard(const u1 *start, const u1 *end, u1 minCard);
+
 /*
  * Returns the address of the relevent byte in the card table, given
  * an address on the heap.
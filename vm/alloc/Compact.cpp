@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compaction of the active heap.
+ *
+ * A mark-sweep heap that has been running for a while is left with
+ * many pages holding only a few survivors, none of which can be given
+ * back to the kernel.  Once the process is in the background a
+ * compaction copies the movable objects off such pages into free space
+ * elsewhere, so that the trim which follows can release them.
+ *
+ * The VM hands out raw object pointers freely, so an object is moved
+ * only when every place that can hold its address is known and can be
+ * updated.  Objects referred to by the root set other than through JNI
+ * references stay put, as do class objects, objects allocated with
+ * ALLOC_NON_MOVING (which include all interned strings), and objects
+ * whose lock word is in use: a locked or inflated object is known to
+ * the monitor code.  An object whose identity hash code, derived from
+ * its address, has been taken is flagged in a side bitmap; its copy
+ * keeps the code in a word appended to the data, and its lock word says
+ * so.
+ *
+ * The compaction runs right after the sweep of a full collection, with
+ * the world stopped, when the live bitmap is exact and the mark bitmap
+ * is clear.  It borrows the mark bitmap, first to flag the pinned
+ * objects and then the evacuated ones.  An evacuated object keeps its
+ * mark bit but loses its live bit, and its class pointer is overwritten
+ * with its new address until it is freed.
+ *
+ * The zygote compacts once more before it first forks, with a
+ * different aim: its heap is shared with every app for as long as the
+ * app runs, and any page an app writes to stops being shared.  Before
+ * the fork every page that is not close to full is evacuated, which
+ * packs the survivors densely.  So is every page holding an object
+ * that is likely to be written after the fork: a class object, whose
+ * static fields and state change, or an object whose lock word is in
+ * use, which is likely to be locked again.  Such objects can't move
+ * themselves, but moving everything else off their pages keeps the
+ * writes from dirtying objects that are only read.
+ */
+
+#include "Dalvik.h"
+#include "alloc/CardTable.h"
+#include "alloc/Compact.h"
+#include "alloc/HeapBitmap.h"
+#include "alloc/HeapBitmapInlines.h"
+#include "alloc/HeapInternal.h"
+#include "alloc/HeapSource.h"
+#include "alloc/Visit.h"
+
+/*
+ * A page is evacuated when some, but fewer than this many, of its
+ * bytes are live.
+ */
+#define SPARSE_PAGE_LIVE_BYTES (SYSTEM_PAGE_SIZE / 4)
+
+/*
+ * Before a fork, a page is evacuated when fewer than this many of its
+ * bytes are live.
+ */
+#define DENSE_PAGE_LIVE_BYTES (SYSTEM_PAGE_SIZE * 3 / 4)
+
+/* Per-page flags.
+ */
+#define PAGE_EVACUATE   0x01    /* the movable objects leave the page */
+#define PAGE_WRITTEN    0x02    /* holds an object likely to be written */
+
+struct CompactContext {
+    HeapBitmap *liveBits;
+    HeapBitmap *markBits;
+
+    /* The active heap, rounded out to whole pages.
+     */
+    uintptr_t base;
+    uintptr_t limit;
+
+    /* The number of live bytes on each page of the active heap, as of
+     * the start of the compaction.  A page holds fewer than 64K bytes.
+     * The copies may extend the heap past these pages.
+     */
+    u2 *pageLiveBytes;
+    u1 *pageFlags;
+    size_t numPages;
+
+    /* Set when compacting the zygote before it forks.
+     */
+    bool beforeFork;
+
+    /* Set once the heap runs out of room for copies.
+     */
+    bool allocFailed;
+
+    /* The object whose references are being updated.
+     */
+    Object *obj;
+
+    size_t objectsMoved;
+    size_t bytesMoved;
+    size_t pagesEvacuated;
+    size_t pagesWritten;
+};
+
+static bool isActiveHeapAddress(const CompactContext *ctx, const void *addr)
+{
+    return (uintptr_t)addr >= ctx->base && (uintptr_t)addr < ctx->limit;
+}
+
+static size_t pageIndex(const CompactContext *ctx, uintptr_t addr)
+{
+    return (addr - ctx->base) / SYSTEM_PAGE_SIZE;
+}
+
+/*
+ * Returns true iff every page in [start, end) is being evacuated.
+ */
+static bool isEvacuatedRange(const CompactContext *ctx, uintptr_t start,
+                             uintptr_t end)
+{
+    for (size_t i = pageIndex(ctx, start); i <= pageIndex(ctx, end - 1); i++) {
+        if (i >= ctx->numPages || !(ctx->pageFlags[i] & PAGE_EVACUATE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Returns true iff any page in [start, end) is being evacuated.
+ */
+static bool overlapsEvacuatedRange(const CompactContext *ctx, uintptr_t start,
+                                   uintptr_t end)
+{
+    for (size_t i = pageIndex(ctx, start); i <= pageIndex(ctx, end - 1); i++) {
+        if (i < ctx->numPages && (ctx->pageFlags[i] & PAGE_EVACUATE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns true if the thread has a method on its stack, as opposed to
+ * only the break frames of an internal VM thread.
+ */
+static bool hasJavaFrames(const Thread *thread)
+{
+    const StackSaveArea *saveArea;
+    for (const u4 *fp = (const u4 *)thread->interpSave.curFrame;
+         fp != NULL;
+         fp = (const u4 *)saveArea->prevFrame) {
+        saveArea = SAVEAREA_FROM_FP(fp);
+        if (saveArea->method != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns true if no other thread can be holding a raw pointer to a
+ * movable object.  A thread blocked in native code, in Object.wait(),
+ * in Thread.sleep() or on a monitor only refers to objects through its
+ * frames and reference tables.  A thread that was stopped inside the
+ * VM, or on its way back into it, may have pointers in registers.
+ */
+static bool threadsAllowCompaction()
+{
+    Thread *self = dvmThreadSelf();
+    bool allow = true;
+
+    dvmLockThreadList(self);
+    for (Thread *thread = gDvm.threadList;
+         thread != NULL && allow;
+         thread = thread->next) {
+        if (thread == self) {
+            continue;
+        }
+#if defined(WITH_JIT)
+        if (thread->inJitCodeCache != NULL) {
+            allow = false;
+            continue;
+        }
+#endif
+        switch (thread->status) {
+        case THREAD_NATIVE:
+        case THREAD_WAIT:
+        case THREAD_TIMED_WAIT:
+        case THREAD_MONITOR:
+            break;
+        case THREAD_INITIALIZING:
+        case THREAD_STARTING:
+            allow = false;
+            break;
+        default:
+            allow = !hasJavaFrames(thread);
+            break;
+        }
+    }
+    dvmUnlockThreadList();
+    return allow;
+}
+
+/*
+ * Pins the objects referred to by the root set, other than through
+ * JNI references, which are indirect and can be updated in place.
+ */
+static void pinRootVisitor(void *addr, u4 threadId, RootType type, void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    Object *obj = *(Object **)addr;
+    if (type == ROOT_JNI_GLOBAL || type == ROOT_JNI_LOCAL) {
+        return;
+    }
+    if (obj != NULL && isActiveHeapAddress(ctx, obj)) {
+        dvmHeapBitmapSetObjectBit(ctx->markBits, obj);
+    }
+}
+
+static void countLiveBytesCallback(Object *obj, void *finger, void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    uintptr_t start = (uintptr_t)obj;
+    uintptr_t end = start + dvmHeapSourceChunkSize(obj);
+    bool written = ctx->beforeFork &&
+        (dvmIsClassObject(obj) || obj->lock != 0);
+    while (start < end) {
+        uintptr_t pageEnd = (start | (SYSTEM_PAGE_SIZE - 1)) + 1;
+        uintptr_t next = MIN(end, pageEnd);
+        size_t i = pageIndex(ctx, start);
+        ctx->pageLiveBytes[i] += next - start;
+        if (written) {
+            ctx->pageFlags[i] |= PAGE_WRITTEN;
+        }
+        start = next;
+    }
+}
+
+/*
+ * Decides which pages to evacuate, once their live bytes are counted.
+ */
+static void choosePages(CompactContext *ctx)
+{
+    for (size_t i = 0; i < ctx->numPages; i++) {
+        size_t live = ctx->pageLiveBytes[i];
+        bool evacuate;
+        if (live == 0) {
+            evacuate = false;
+        } else if (ctx->beforeFork) {
+            evacuate = live < DENSE_PAGE_LIVE_BYTES ||
+                       (ctx->pageFlags[i] & PAGE_WRITTEN);
+        } else {
+            evacuate = live < SPARSE_PAGE_LIVE_BYTES;
+        }
+        if (evacuate) {
+            ctx->pageFlags[i] |= PAGE_EVACUATE;
+            ctx->pagesEvacuated++;
+        }
+        if (ctx->pageFlags[i] & PAGE_WRITTEN) {
+            ctx->pagesWritten++;
+        }
+    }
+}
+
+static bool isMovable(const CompactContext *ctx, const Object *obj)
+{
+    if (obj->clazz == NULL || dvmIsClassObject(obj) || obj->lock != 0) {
+        return false;
+    }
+    if (dvmHeapBitmapIsObjectBitSet(ctx->markBits, obj)) {
+        return false;
+    }
+    if (dvmHeapSourceIsNonMoving(obj)) {
+        return false;
+    }
+    uintptr_t start = (uintptr_t)obj;
+    size_t size = dvmHeapSourceChunkSize(obj);
+    return size <= SYSTEM_PAGE_SIZE && isEvacuatedRange(ctx, start, start + size);
+}
+
+/*
+ * Allocates the new home of an evacuated object.  Free space on the
+ * pages being evacuated is claimed with placeholders until the
+ * allocator hands out memory elsewhere.  The placeholders are flagged
+ * like evacuated objects, so that they are freed along with them.
+ */
+static Object *allocCopy(CompactContext *ctx, size_t size)
+{
+    for (;;) {
+        void *ptr = dvmHeapSourceAlloc(size);
+        if (ptr == NULL) {
+            return NULL;
+        }
+        uintptr_t start = (uintptr_t)ptr;
+        if (!overlapsEvacuatedRange(ctx, start,
+                                    start + dvmHeapSourceChunkSize(ptr))) {
+            return (Object *)ptr;
+        }
+        dvmHeapBitmapClearObjectBit(ctx->liveBits, ptr);
+        dvmHeapBitmapSetObjectBit(ctx->markBits, ptr);
+    }
+}
+
+static void evacuateCallback(Object *obj, void *finger, void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    if (ctx->allocFailed || !isMovable(ctx, obj)) {
+        return;
+    }
+    size_t size;
+    if (IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISARRAY)) {
+        size = dvmArrayObjectSize((ArrayObject *)obj);
+    } else {
+        size = obj->clazz->objectSize;
+    }
+    bool hashed = dvmHeapSourceIsHashed(obj);
+    size_t copySize = size;
+    if (hashed) {
+        copySize = dvmIdentityHashSlotOffset(obj) + sizeof(u4);
+    }
+    Object *copy = allocCopy(ctx, copySize);
+    if (copy == NULL) {
+        ctx->allocFailed = true;
+        return;
+    }
+    memcpy(copy, obj, size);
+    if (hashed) {
+        u4 hash = dvmIdentityHashCode(obj);
+        copy->lock = LW_HASH_STATE_HASHED_AND_MOVED << LW_HASH_STATE_SHIFT;
+        *(u4 *)((u1 *)copy + dvmIdentityHashSlotOffset(copy)) = hash;
+    }
+    /* The copy may hold the only reference to a younger object from
+     * some old one's card.
+     */
+    dvmMarkCard(copy);
+    obj->clazz = (ClassObject *)copy;
+    dvmHeapBitmapClearObjectBit(ctx->liveBits, obj);
+    dvmHeapBitmapSetObjectBit(ctx->markBits, obj);
+    ctx->objectsMoved++;
+    ctx->bytesMoved += copySize;
+}
+
+/*
+ * Returns the new address of <obj> if it was evacuated, else <obj>.
+ */
+static Object *forwardedAddress(const CompactContext *ctx, Object *obj)
+{
+    if (obj != NULL && isActiveHeapAddress(ctx, obj) &&
+        dvmHeapBitmapIsObjectBitSet(ctx->markBits, obj) &&
+        !dvmHeapBitmapIsObjectBitSet(ctx->liveBits, obj)) {
+        return (Object *)obj->clazz;
+    }
+    return obj;
+}
+
+static void updateRootVisitor(void *addr, u4 threadId, RootType type,
+                              void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    Object **ref = (Object **)addr;
+    Object *obj = forwardedAddress(ctx, *ref);
+    if (obj != *ref) {
+        *ref = obj;
+    }
+}
+
+static void updateReferenceVisitor(void *addr, void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    Object **ref = (Object **)addr;
+    Object *obj = forwardedAddress(ctx, *ref);
+    if (obj != *ref) {
+        *ref = obj;
+        dvmMarkCard(ctx->obj);
+    }
+}
+
+static void updateObjectCallback(Object *obj, void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    ctx->obj = obj;
+    dvmVisitObject(updateReferenceVisitor, obj, ctx);
+}
+
+static void updateWeakVisitor(void *addr, void *arg)
+{
+    CompactContext *ctx = (CompactContext *)arg;
+    Object **ref = (Object **)addr;
+    *ref = forwardedAddress(ctx, *ref);
+}
+
+/*
+ * Updates the references that are not part of the root set.
+ */
+static void updateSystemWeaks(CompactContext *ctx)
+{
+    IndirectRefTable *table = &gDvm.jniWeakGlobalRefTable;
+    dvmLockMutex(&gDvm.jniWeakGlobalRefLock);
+    typedef IndirectRefTable::iterator It; // TODO: C++0x auto
+    for (It it = table->begin(), end = table->end(); it != end; ++it) {
+        Object **entry = *it;
+        *entry = forwardedAddress(ctx, *entry);
+    }
+    dvmUnlockMutex(&gDvm.jniWeakGlobalRefLock);
+    dvmVisitJniUtfCache(updateWeakVisitor, ctx);
+    dvmVisitClassNameCache(updateWeakVisitor, ctx);
+}
+
+static void freeEvacuatedCallback(size_t numPtrs, void **ptrs, void *arg)
+{
+    dvmHeapSourceFreeList(numPtrs, ptrs);
+}
+
+static void compactHeap(bool beforeFork)
+{
+    /* JNI references are raw pointers when working around app bugs,
+     * and the debugger keeps object ids of its own.  The zygote's heap
+     * is shared with its children, so it only compacts before it forks.
+     */
+    if (gDvm.zygote != beforeFork || gDvm.debuggerActive ||
+        gDvmJni.workAroundAppJniBugs) {
+        return;
+    }
+    if (!threadsAllowCompaction()) {
+        LOGD_HEAP("Skipping compaction, a thread is busy in the VM");
+        return;
+    }
+
+    CompactContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.beforeFork = beforeFork;
+    ctx.liveBits = dvmHeapSourceGetLiveBits();
+    ctx.markBits = dvmHeapSourceGetMarkBits();
+    uintptr_t max;
+    dvmHeapSourceGetRegions(&ctx.base, &max, 1);
+    ctx.limit = ALIGN_UP_TO_PAGE_SIZE((uintptr_t)dvmHeapSourceGetLimit());
+    ctx.numPages = (ctx.limit - ctx.base) / SYSTEM_PAGE_SIZE;
+    ctx.pageLiveBytes = (u2 *)calloc(ctx.numPages, sizeof(u2));
+    ctx.pageFlags = (u1 *)calloc(ctx.numPages, sizeof(u1));
+    if (ctx.pageLiveBytes == NULL || ctx.pageFlags == NULL) {
+        LOGW_HEAP("Skipping compaction, no memory for the page census");
+        free(ctx.pageLiveBytes);
+        free(ctx.pageFlags);
+        return;
+    }
+
+    dvmVisitRoots(pinRootVisitor, &ctx);
+    dvmHeapBitmapScanWalkRange(ctx.liveBits, ctx.base, ctx.limit,
+                               countLiveBytesCallback, &ctx);
+    choosePages(&ctx);
+    dvmHeapBitmapScanWalkRange(ctx.liveBits, ctx.base, ctx.limit,
+                               evacuateCallback, &ctx);
+    free(ctx.pageLiveBytes);
+    free(ctx.pageFlags);
+
+    if (ctx.objectsMoved != 0) {
+        dvmVisitRoots(updateRootVisitor, &ctx);
+        updateSystemWeaks(&ctx);
+        dvmHeapBitmapWalk(ctx.liveBits, updateObjectCallback, &ctx);
+    }
+
+    /* Free the evacuated objects and the placeholders.
+     */
+    uintptr_t base;
+    dvmHeapSourceGetRegions(&base, &max, 1);
+    if (max >= base) {
+        dvmHeapBitmapSweepWalk(ctx.markBits, ctx.liveBits, base, max,
+                               freeEvacuatedCallback, NULL);
+    }
+    dvmHeapSourceZeroMarkBitmap();
+
+    if (beforeFork) {
+        ALOGD("GC_BEFORE_FORK moved %zd objects (%zdK) off %zd of %zd pages, "
+              "%zd pages hold objects likely to be written%s",
+              ctx.objectsMoved, ctx.bytesMoved / 1024, ctx.pagesEvacuated,
+              ctx.numPages, ctx.pagesWritten,
+              ctx.allocFailed ? ", stopped when the heap filled" : "");
+    } else {
+        ALOGD("GC_COMPACT moved %zd objects (%zdK)%s",
+              ctx.objectsMoved, ctx.bytesMoved / 1024,
+              ctx.allocFailed ? ", stopped when the heap filled" : "");
+    }
+}
+
+void dvmHeapCompact()
+{
+    compactHeap(false);
+}
+
+void dvmHeapCompactBeforeFork()
+{
+    compactHeap(true);
+}
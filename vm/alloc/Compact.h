@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALVIK_ALLOC_COMPACT_H_
+#define DALVIK_ALLOC_COMPACT_H_
+
+/*
+ * Moves the movable objects off sparsely populated pages of the active
+ * heap.  Must be called with all other threads suspended, after the
+ * sweep of a full collection, while the mark bitmap is clear.  Does
+ * nothing if some thread might be holding a raw pointer to a movable
+ * object.
+ */
+void dvmHeapCompact(void);
+
+/*
+ * Packs the zygote's heap before its first fork, and moves the movable
+ * objects off the pages that hold objects likely to be written in the
+ * children.  Called like dvmHeapCompact().
+ */
+void dvmHeapCompactBeforeFork(void);
+
+#endif  // DALVIK_ALLOC_COMPACT_H_
@@ -726,7 +726,8 @@ void dvmSetTargetHeapUtilization(float newTarget)
  * just a no-op.  Eventually, we will either allocate or commit pages
  * on an as-need basis.
  */
-void dvmHeapSourceGrowForUtilization()
+void dvmHeapSourceGrowForUtilization(u8 gcStartUsec,
+                                     size_t bytesAllocatedBefore)
 {
     /* do nothing */
 }
@@ -738,6 +739,24 @@ void dvmHeapSourceWalk(void(*callback)(void* start, void* end,
     assert(!"implemented");
 }
 
+size_t dvmHeapSourceGetNumWalkRegions()
+{
+    return 1;
+}
+
+void dvmHeapSourceWalkRegion(size_t region,
+                             void(*callback)(void* start, void* end,
+                                             size_t used_bytes, void* arg),
+                             void *arg)
+{
+    assert(!"implemented");
+}
+
+bool dvmHeapSourceGetWalkRegionGeneration(size_t region, u4 *generation)
+{
+    return false;
+}
+
 size_t dvmHeapSourceGetNumHeaps()
 {
     return 1;
@@ -895,6 +914,8 @@ static void scavengeClassObject(ClassObject *obj)
     scavengeReference((Object **)(void *)&obj->super);
     /* Scavenge the class loader. */
     scavengeReference(&obj->classLoader);
+    /* Scavenge the cached name. */
+    scavengeReference((Object **)(void *)&obj->nameString);
     /* Scavenge static fields. */
     for (int i = 0; i < obj->sfieldCount; ++i) {
         char ch = obj->sfields[i].field.signature[0];
@@ -1275,30 +1296,43 @@ static void scavengeDataObject(Object *obj)
     }
 }
 
+/*
+ * Returns the offset of the word a moved object's hash code is kept in,
+ * which dvmIdentityHashCode() reads: the first aligned word past the
+ * instance data.
+ */
+static size_t hashSlotOffset(const Object *obj)
+{
+    if (obj->clazz == gDvm.classJavaLangClass) {
+        return alignUp(dvmClassObjectSize((ClassObject *)obj), sizeof(u4));
+    }
+    return dvmIdentityHashSlotOffset(obj);
+}
+
 static Object *transportObject(const Object *fromObj)
 {
     Object *toObj;
-    size_t allocSize, copySize;
+    size_t allocSize, copySize, hashOffset;
 
     LOG_TRAN("transportObject(fromObj=%p) allocBlocks=%zu",
                   fromObj,
                   gDvm.gcHeap->heapSource->allocBlocks);
     assert(fromObj != NULL);
     assert(fromSpaceContains(fromObj));
+    /*
+     * An object that was hashed and moved before already has its hash
+     * code slot, which objectSize() counts, so it is copied along with
+     * the instance data.
+     */
     allocSize = copySize = objectSize(fromObj);
-    if (LW_HASH_STATE(fromObj->lock) != LW_HASH_STATE_UNHASHED) {
-        /*
-         * The object has been hashed or hashed and moved.  We must
-         * reserve an additional word for a hash code.
-         */
-        allocSize += sizeof(u4);
-    }
-    if (LW_HASH_STATE(fromObj->lock) == LW_HASH_STATE_HASHED_AND_MOVED) {
+    hashOffset = 0;
+    if (LW_HASH_STATE(fromObj->lock) == LW_HASH_STATE_HASHED) {
         /*
-         * The object has its hash code allocated.  Ensure the hash
-         * code is copied along with the instance data.
+         * The object has been hashed.  We must reserve the slot for
+         * its hash code.
          */
-        copySize += sizeof(u4);
+        hashOffset = hashSlotOffset(fromObj);
+        allocSize = hashOffset + sizeof(u4);
     }
     /* TODO(cshapiro): don't copy, re-map large data objects. */
     assert(copySize <= allocSize);
@@ -1311,7 +1345,7 @@ static Object *transportObject(const Object *fromObj)
          * The object has had its hash code exposed.  Append it to the
          * instance and set a bit so we know to look for it there.
          */
-        *(u4 *)(((char *)toObj) + copySize) = (u4)fromObj >> 3;
+        *(u4 *)(((char *)toObj) + hashOffset) = (u4)fromObj >> 3;
         toObj->lock |= LW_HASH_STATE_HASHED_AND_MOVED << LW_HASH_STATE_SHIFT;
     }
     LOG_TRAN("transportObject: from %p/%zu to %p/%zu (%zu,%zu) %s",
@@ -1422,6 +1456,44 @@ static void pinHashTableEntries(HashTable *table)
     LOG_PIN("<<< pinHashTableEntries(table=%p)", table);
 }
 
+static void pinDebuggerRegistryEntries(HashTable *table)
+{
+    LOG_PIN(">>> pinDebuggerRegistryEntries(table=%p)", table);
+    if (table == NULL) {
+        return;
+    }
+    dvmHashTableLock(table);
+    for (int i = 0; i < table->tableSize; ++i) {
+        HashEntry *entry = &table->pEntries[i];
+        void *data = entry->data;
+        if (data == NULL || data == HASH_TOMBSTONE) {
+            continue;
+        }
+        pinObject(((DbgRegistryEntry *)data)->obj);
+    }
+    dvmHashTableUnlock(table);
+    LOG_PIN("<<< pinDebuggerRegistryEntries(table=%p)", table);
+}
+
+static void pinPinTableEntries(HashTable *table)
+{
+    LOG_PIN(">>> pinPinTableEntries(table=%p)", table);
+    if (table == NULL) {
+        return;
+    }
+    dvmHashTableLock(table);
+    for (int i = 0; i < table->tableSize; ++i) {
+        HashEntry *entry = &table->pEntries[i];
+        void *pin = entry->data;
+        if (pin == NULL || pin == HASH_TOMBSTONE) {
+            continue;
+        }
+        pinObject(((JniPinEntry *)pin)->obj);
+    }
+    dvmHashTableUnlock(table);
+    LOG_PIN("<<< pinPinTableEntries(table=%p)", table);
+}
+
 static void pinPrimitiveClasses()
 {
     size_t length = ARRAYSIZE(gDvm.primitiveClass);
@@ -1599,6 +1671,7 @@ static void scavengeThreadStack(Thread *thread)
 
             const RegisterMap* pMap;
             const u1* regVector;
+            u1 lineBuf[kRegMapMaxRegWidth];
 
             Method* nonConstMethod = (Method*) method;  // quiet gcc
             pMap = dvmGetExpandedRegisterMap(nonConstMethod);
@@ -1608,7 +1681,7 @@ static void scavengeThreadStack(Thread *thread)
             if (pMap != NULL) {
                 /* found map, get registers for this address */
                 int addr = saveArea->xtra.currentPc - method->insns;
-                regVector = dvmRegisterMapGetLine(pMap, addr);
+                regVector = dvmRegisterMapGetLine(pMap, addr, lineBuf);
                 /*
                 if (regVector == NULL) {
                     LOG_SCAV("PGC: map but no entry for %s.%s addr=0x%04x",
@@ -1808,12 +1881,13 @@ static void pinThreadStack(const Thread *thread)
         } else if (method != NULL && !dvmIsNativeMethod(method)) {
             const RegisterMap* pMap = dvmGetExpandedRegisterMap(method);
             const u1* regVector = NULL;
+            u1 lineBuf[kRegMapMaxRegWidth];
 
             ALOGI("conservative : %s.%s", method->clazz->descriptor, method->name);
 
             if (pMap != NULL) {
                 int addr = saveArea->xtra.currentPc - method->insns;
-                regVector = dvmRegisterMapGetLine(pMap, addr);
+                regVector = dvmRegisterMapGetLine(pMap, addr, lineBuf);
             }
             if (regVector == NULL) {
                 /*
@@ -1930,7 +2004,7 @@ static size_t objectSize(const Object *obj)
         size = obj->clazz->objectSize;
     }
     if (LW_HASH_STATE(obj->lock) == LW_HASH_STATE_HASHED_AND_MOVED) {
-        size += sizeof(u4);
+        size = hashSlotOffset(obj) + sizeof(u4);
     }
     return size;
 }
@@ -2081,9 +2155,9 @@ void dvmScavengeRoots()  /* Needs a new name badly */
      */
     pinThreadList();
     pinReferenceTable(&gDvm.jniGlobalRefTable);
-    pinReferenceTable(&gDvm.jniPinRefTable);
+    pinPinTableEntries(gDvm.jniPinTable);
     pinHashTableEntries(gDvm.loadedClasses);
-    pinHashTableEntries(gDvm.dbgRegistry);
+    pinDebuggerRegistryEntries(gDvm.dbgRegistry);
     pinPrimitiveClasses();
     pinInternedStrings();
 
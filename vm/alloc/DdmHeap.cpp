@@ -173,7 +173,26 @@ enum HpsgKind {
 #define HPSG_STATE(solidity, kind) \
     ((u1)((((kind) & 0x7) << 3) | ((solidity) & 0x7)))
 
+/*
+ * The HPSx chunks describing one walk region of the GC heap, kept from
+ * one dump to the next so a region that hasn't changed is not walked
+ * again.  Each chunk is stored as a u4 length, in host order, followed
+ * by its bytes.
+ */
+struct HpsgRegion {
+    u1 *data;
+    size_t length;
+    size_t capacity;
+    int type;
+    u4 generation;
+    bool valid;
+};
+
 struct HeapChunkContext {
+    /* Where the chunks go instead of straight to DDM, or NULL.
+     */
+    HpsgRegion *region;
+    bool regionFailed;
     void* startOfNextMemoryChunk;
     u1 *buf;
     u1 *p;
@@ -187,6 +206,37 @@ struct HeapChunkContext {
 
 #define ALLOCATION_UNIT_SIZE 8
 
+static bool appendRegionChunk(HpsgRegion *region, const u1 *buf, u4 len)
+{
+    size_t needed = region->length + sizeof(len) + len;
+    if (needed > region->capacity) {
+        size_t capacity = MAX(needed, region->capacity * 2);
+        u1 *data = (u1 *)realloc(region->data, capacity);
+        if (data == NULL) {
+            return false;
+        }
+        region->data = data;
+        region->capacity = capacity;
+    }
+    memcpy(region->data + region->length, &len, sizeof(len));
+    memcpy(region->data + region->length + sizeof(len), buf, len);
+    region->length = needed;
+    return true;
+}
+
+static void sendRegionChunks(const HpsgRegion *region)
+{
+    const u1 *p = region->data;
+    const u1 *end = region->data + region->length;
+    while (p < end) {
+        u4 len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        dvmDbgDdmSendChunk(region->type, len, p);
+        p += len;
+    }
+}
+
 static void flush_hpsg_chunk(HeapChunkContext *ctx)
 {
     if (ctx->pieceLenField == NULL && ctx->needHeader) {
@@ -199,9 +249,13 @@ static void flush_hpsg_chunk(HeapChunkContext *ctx)
             ctx->pieceLenField <= ctx->p);
     set4BE(ctx->pieceLenField, ctx->totalAllocationUnits);
 
-    /* Send the chunk.
+    /* Send the chunk, or keep it to send later.
      */
-    dvmDbgDdmSendChunk(ctx->type, ctx->p - ctx->buf, ctx->buf);
+    if (ctx->region == NULL) {
+        dvmDbgDdmSendChunk(ctx->type, ctx->p - ctx->buf, ctx->buf);
+    } else if (!appendRegionChunk(ctx->region, ctx->buf, ctx->p - ctx->buf)) {
+        ctx->regionFailed = true;
+    }
 
     /* Reset the context.
      */
@@ -391,39 +445,125 @@ enum HpsgWhat {
  */
 #define HPSx_CHUNK_SIZE (16384 - 16)
 
-static void walkHeap(bool merge, bool native)
-{
-    HeapChunkContext ctx;
+/*
+ * The GC heap regions from the last dump, and the lock that keeps two
+ * dumps from being sent at once.
+ */
+static pthread_mutex_t gHpsgLock = PTHREAD_MUTEX_INITIALIZER;
+static HpsgRegion *gHpsgRegions;
+static size_t gNumHpsgRegions;
 
-    memset(&ctx, 0, sizeof(ctx));
-    ctx.bufLen = HPSx_CHUNK_SIZE;
-    ctx.buf = (u1 *)malloc(ctx.bufLen);
-    if (ctx.buf == NULL) {
-        return;
+static void freeHpsgRegions()
+{
+    for (size_t i = 0; i < gNumHpsgRegions; i++) {
+        free(gHpsgRegions[i].data);
     }
+    free(gHpsgRegions);
+    gHpsgRegions = NULL;
+    gNumHpsgRegions = 0;
+}
 
-    ctx.merge = merge;
-    if (native) {
-        ctx.type = CHUNK_TYPE("NHSG");
-    } else {
-        if (ctx.merge) {
-            ctx.type = CHUNK_TYPE("HPSG");
-        } else {
-            ctx.type = CHUNK_TYPE("HPSO");
-        }
+static bool initChunkContext(HeapChunkContext *ctx, int type)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->bufLen = HPSx_CHUNK_SIZE;
+    ctx->buf = (u1 *)malloc(ctx->bufLen);
+    if (ctx->buf == NULL) {
+        return false;
     }
+    ctx->type = type;
+    ctx->merge = type != CHUNK_TYPE("HPSO");
+    ctx->p = ctx->buf;
+    ctx->needHeader = true;
+    return true;
+}
 
-    ctx.p = ctx.buf;
-    ctx.needHeader = true;
-    if (native) {
-        dlmalloc_inspect_all(heap_chunk_callback, (void*)&ctx);
-    } else {
-        dvmHeapSourceWalk(heap_chunk_callback, (void *)&ctx);
+/*
+ * Walks the native heap, sending the chunks as it goes.  Needs no lock
+ * of ours; dlmalloc takes its own.
+ */
+static void walkNativeHeap()
+{
+    HeapChunkContext ctx;
+    if (!initChunkContext(&ctx, CHUNK_TYPE("NHSG"))) {
+        return;
     }
+    dlmalloc_inspect_all(heap_chunk_callback, (void*)&ctx);
     if (ctx.p > ctx.buf) {
         flush_hpsg_chunk(&ctx);
     }
+    free(ctx.buf);
+}
+
+/*
+ * Brings the chunks of GC heap region <index> up to date, walking it
+ * only if it may have changed since the last dump.  Called with the
+ * heap lock held; returns the region to send once it is dropped.
+ */
+static const HpsgRegion *updateHpsgRegion(HeapChunkContext *ctx,
+                                          size_t index)
+{
+    HpsgRegion *region = &gHpsgRegions[index];
+    u4 generation;
+    bool tracked = dvmHeapSourceGetWalkRegionGeneration(index, &generation);
+    if (tracked && region->valid && region->type == ctx->type &&
+        region->generation == generation) {
+        return region;
+    }
 
+    region->length = 0;
+    region->type = ctx->type;
+    ctx->region = region;
+    ctx->regionFailed = false;
+    dvmHeapSourceWalkRegion(index, heap_chunk_callback, (void *)ctx);
+    if (ctx->p > ctx->buf) {
+        flush_hpsg_chunk(ctx);
+    }
+    if (ctx->regionFailed) {
+        ALOGW("Can't keep the HPSx chunks of heap region %zd", index);
+    }
+    region->generation = generation;
+    region->valid = tracked && !ctx->regionFailed;
+    return region;
+}
+
+/*
+ * Sends the GC heap one region at a time.  The heap lock is held to
+ * walk a region but not to send it, or to replay a region that hasn't
+ * changed, so the app only stalls for as long as the regions that did
+ * change take to walk.  The regions are therefore each consistent but
+ * not necessarily with each other, which is fine for a heap viewer.
+ * Called and returns with the heap lock held.
+ */
+static void walkGcHeap(int type)
+{
+    HeapChunkContext ctx;
+    if (!initChunkContext(&ctx, type)) {
+        return;
+    }
+    size_t numRegions = dvmHeapSourceGetNumWalkRegions();
+    if (numRegions != gNumHpsgRegions) {
+        /* A new heap was added; start over. */
+        freeHpsgRegions();
+        gHpsgRegions = (HpsgRegion *)calloc(numRegions, sizeof(HpsgRegion));
+        if (gHpsgRegions == NULL) {
+            free(ctx.buf);
+            return;
+        }
+        gNumHpsgRegions = numRegions;
+    }
+    for (size_t i = 0; i < numRegions; i++) {
+        const HpsgRegion *region = updateHpsgRegion(&ctx, i);
+        dvmUnlockHeap();
+        sendRegionChunks(region);
+        dvmLockHeap();
+        if (dvmHeapSourceGetNumWalkRegions() != numRegions) {
+            /* Changed while the lock was dropped; leave the rest to
+             * the next dump.
+             */
+            break;
+        }
+    }
     free(ctx.buf);
 }
 
@@ -432,7 +572,7 @@ void dvmDdmSendHeapSegments(bool shouldLock, bool native)
     u1 heapId[sizeof(u4)];
     GcHeap *gcHeap = gDvm.gcHeap;
     int when, what;
-    bool merge;
+    int type;
 
     /* Don't even grab the lock if there's nothing to do when we're called.
      */
@@ -449,22 +589,29 @@ void dvmDdmSendHeapSegments(bool shouldLock, bool native)
             return;
         }
     }
-    if (shouldLock && !dvmLockHeap()) {
-        ALOGW("Can't lock heap for DDM HPSx dump");
-        return;
-    }
 
     /* Figure out what kind of chunks we'll be sending.
      */
-    if (what == HPSG_WHAT_MERGED_OBJECTS) {
-        merge = true;
+    if (native) {
+        type = CHUNK_TYPE("NHSG");
+    } else if (what == HPSG_WHAT_MERGED_OBJECTS) {
+        type = CHUNK_TYPE("HPSG");
     } else if (what == HPSG_WHAT_DISTINCT_OBJECTS) {
-        merge = false;
+        type = CHUNK_TYPE("HPSO");
     } else {
         assert(!"bad HPSG.what value");
         return;
     }
 
+    /* The lock may be dropped while a dump is sent, so another thread
+     * could get here in the meantime; the dump it would send is left
+     * to the next collection rather than waiting, which could deadlock
+     * on the heap lock.
+     */
+    if (dvmTryLockMutex(&gHpsgLock) != 0) {
+        return;
+    }
+
     /* First, send a heap start chunk.
      */
     set4BE(heapId, DEFAULT_HEAP_ID);
@@ -473,16 +620,23 @@ void dvmDdmSendHeapSegments(bool shouldLock, bool native)
 
     /* Send a series of heap segment chunks.
      */
-    walkHeap(merge, native);
+    if (native) {
+        walkNativeHeap();
+    } else if (!shouldLock || dvmLockHeap()) {
+        walkGcHeap(type);
+        if (shouldLock) {
+            dvmUnlockHeap();
+        }
+    } else {
+        ALOGW("Can't lock heap for DDM HPSx dump");
+    }
 
     /* Finally, send a heap end chunk.
      */
     dvmDbgDdmSendChunk(native ? CHUNK_TYPE("NHEN") : CHUNK_TYPE("HPEN"),
         sizeof(u4), heapId);
 
-    if (shouldLock) {
-        dvmUnlockHeap();
-    }
+    dvmUnlockMutex(&gHpsgLock);
 }
 
 bool dvmDdmHandleHpsgNhsgChunk(int when, int what, bool native)
@@ -507,6 +661,14 @@ bool dvmDdmHandleHpsgNhsgChunk(int when, int what, bool native)
         return false;
     }
 
+    /* Nobody is looking any more, so drop what the dumps kept.
+     */
+    if (!native && when == HPSG_WHEN_NEVER) {
+        dvmLockMutex(&gHpsgLock);
+        freeHpsgRegions();
+        dvmUnlockMutex(&gHpsgLock);
+    }
+
     if (dvmLockHeap()) {
         if (!native) {
             gDvm.gcHeap->ddmHpsgWhen = when;
@@ -31,8 +31,12 @@ void dvmDdmSendHeapInfo(int reason, bool shouldLock);
  * HPST/NHST, HPSG/HPSO/NHSG, and HPEN/NHEN chunks that describe
  * the contents of the GC or native heap.
  *
+ * The heap lock is only held to walk the parts of the GC heap that
+ * changed since the last dump, and is dropped to send them.
+ *
  * @param shouldLock If true, grab the heap lock.  If false,
- *                   the heap lock must already be held.
+ *                   the heap lock must already be held, and is
+ *                   held again on return.
  * @param heap       If false, dump the GC heap; if true, dump the
  *                   native heap.
  */
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "alloc/GcHistory.h"
+
+/*
+ * The number of collections kept in full.
+ */
+#define GC_HISTORY_SIZE 64
+
+/*
+ * Bucket i of a histogram counts the times in [2^i, 2^(i+1))
+ * microseconds; bucket 0 also takes times under a microsecond.
+ */
+#define GC_HISTOGRAM_BUCKETS 32
+
+#define FRACTIONAL_MSEC(us)  (us) / 1000, ((us) % 1000) / 100
+
+struct GcHistogram {
+    u4 counts[GC_HISTOGRAM_BUCKETS];
+    u4 numSamples;
+    u4 maxUsec;
+};
+
+struct GcHistory {
+    /* A ring of the most recent collections.
+     */
+    GcEvent events[GC_HISTORY_SIZE];
+
+    /* The number of collections ever recorded.
+     */
+    size_t numEvents;
+
+    GcHistogram pauses;
+    GcHistogram totals;
+    GcHistogram phases[GC_PHASE_COUNT];
+
+    /* The heap trims, and the memory they gave back.
+     */
+    u4 numTrims;
+    u4 numInterruptedTrims;
+    u8 trimmedHeapBytes;
+    u8 trimmedNativeBytes;
+    GcHistogram trimSlices;
+};
+
+static const char *kPhaseNames[GC_PHASE_COUNT] = {
+    "roots", "mark", "remark", "refs", "sweep"
+};
+
+/*
+ * The history is updated by the GC with the heap lock held, but read
+ * by the signal catcher and by VMDebug without it, so it has a lock of
+ * its own.
+ */
+static pthread_mutex_t gHistoryLock;
+static GcHistory *gHistory;
+
+bool dvmGcHistoryStartup()
+{
+    gHistory = (GcHistory *)calloc(1, sizeof(*gHistory));
+    if (gHistory == NULL) {
+        return false;
+    }
+    dvmInitMutex(&gHistoryLock);
+    return true;
+}
+
+void dvmGcHistoryShutdown()
+{
+    if (gHistory != NULL) {
+        pthread_mutex_destroy(&gHistoryLock);
+        free(gHistory);
+        gHistory = NULL;
+    }
+}
+
+static void addSample(GcHistogram *histogram, u4 usec)
+{
+    size_t bucket = usec == 0 ? 0 : 31 - CLZ(usec);
+    histogram->counts[bucket]++;
+    histogram->numSamples++;
+    histogram->maxUsec = MAX(histogram->maxUsec, usec);
+}
+
+void dvmGcHistoryRecord(const GcEvent *event)
+{
+    if (gHistory == NULL) {
+        return;
+    }
+    dvmLockMutex(&gHistoryLock);
+    gHistory->events[gHistory->numEvents % GC_HISTORY_SIZE] = *event;
+    gHistory->numEvents++;
+    addSample(&gHistory->pauses, event->pauseUsec[0]);
+    if (event->isConcurrent) {
+        addSample(&gHistory->pauses, event->pauseUsec[1]);
+    }
+    addSample(&gHistory->totals, event->totalUsec);
+    for (size_t i = 0; i < GC_PHASE_COUNT; i++) {
+        if (i != GC_PHASE_REMARK || event->isConcurrent) {
+            addSample(&gHistory->phases[i], event->phaseUsec[i]);
+        }
+    }
+    dvmUnlockMutex(&gHistoryLock);
+}
+
+void dvmGcHistoryRecordTrim(size_t heapBytes, size_t nativeBytes,
+                            size_t slices, u4 usec, bool completed)
+{
+    if (gHistory == NULL) {
+        return;
+    }
+    dvmLockMutex(&gHistoryLock);
+    gHistory->numTrims++;
+    if (!completed) {
+        gHistory->numInterruptedTrims++;
+    }
+    gHistory->trimmedHeapBytes += heapBytes;
+    gHistory->trimmedNativeBytes += nativeBytes;
+    addSample(&gHistory->trimSlices, slices == 0 ? usec : usec / slices);
+    dvmUnlockMutex(&gHistoryLock);
+}
+
+size_t dvmGcHistoryCopyEvents(size_t *next, GcEvent *events,
+                              size_t maxEvents)
+{
+    if (gHistory == NULL) {
+        return 0;
+    }
+    dvmLockMutex(&gHistoryLock);
+    size_t first = *next;
+    if (gHistory->numEvents > GC_HISTORY_SIZE &&
+        first < gHistory->numEvents - GC_HISTORY_SIZE) {
+        first = gHistory->numEvents - GC_HISTORY_SIZE;
+    }
+    size_t count = 0;
+    while (count < maxEvents && first + count < gHistory->numEvents) {
+        events[count] = gHistory->events[(first + count) % GC_HISTORY_SIZE];
+        count++;
+    }
+    *next = first + count;
+    dvmUnlockMutex(&gHistoryLock);
+    return count;
+}
+
+/*
+ * Returns an upper bound on the time below which <percent> of the
+ * samples fall.
+ */
+static u4 percentile(const GcHistogram *histogram, u4 percent)
+{
+    u4 wanted = (histogram->numSamples * percent + 99) / 100;
+    u4 seen = 0;
+    for (size_t i = 0; i < GC_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= wanted) {
+            u8 bound = (u8)2 << i;
+            return (u4)MIN(bound, histogram->maxUsec);
+        }
+    }
+    return histogram->maxUsec;
+}
+
+static void dumpHistogram(const DebugOutputTarget *target, const char *name,
+                          const GcHistogram *histogram)
+{
+    if (histogram->numSamples == 0) {
+        return;
+    }
+    u4 p50 = percentile(histogram, 50);
+    u4 p90 = percentile(histogram, 90);
+    u4 p99 = percentile(histogram, 99);
+    dvmPrintDebugMessage(target,
+        "  %-6s n=%u p50<=%u.%ums p90<=%u.%ums p99<=%u.%ums max=%u.%ums\n",
+        name, histogram->numSamples,
+        FRACTIONAL_MSEC(p50), FRACTIONAL_MSEC(p90), FRACTIONAL_MSEC(p99),
+        FRACTIONAL_MSEC(histogram->maxUsec));
+}
+
+static void dumpEvent(const DebugOutputTarget *target, const GcEvent *event)
+{
+    const u4 *phase = event->phaseUsec;
+    char paused[32];
+    if (event->isConcurrent) {
+        snprintf(paused, sizeof(paused), "%u.%ums+%u.%ums",
+                 FRACTIONAL_MSEC(event->pauseUsec[0]),
+                 FRACTIONAL_MSEC(event->pauseUsec[1]));
+    } else {
+        snprintf(paused, sizeof(paused), "%u.%ums",
+                 FRACTIONAL_MSEC(event->pauseUsec[0]));
+    }
+    dvmPrintDebugMessage(target,
+        "  %s at %llums: paused %s, total %u.%ums, cpu %u.%ums "
+        "(%s %u.%u, %s %u.%u, %s %u.%u, %s %u.%u, %s %u.%u), "
+        "freed %zd objects/%zdK, %zdK/%zdK -> %zdK/%zdK\n",
+        event->reason, event->startUsec / 1000, paused,
+        FRACTIONAL_MSEC(event->totalUsec), FRACTIONAL_MSEC(event->cpuUsec),
+        kPhaseNames[GC_PHASE_ROOT_MARK], FRACTIONAL_MSEC(phase[GC_PHASE_ROOT_MARK]),
+        kPhaseNames[GC_PHASE_MARK], FRACTIONAL_MSEC(phase[GC_PHASE_MARK]),
+        kPhaseNames[GC_PHASE_REMARK], FRACTIONAL_MSEC(phase[GC_PHASE_REMARK]),
+        kPhaseNames[GC_PHASE_REFERENCES], FRACTIONAL_MSEC(phase[GC_PHASE_REFERENCES]),
+        kPhaseNames[GC_PHASE_SWEEP], FRACTIONAL_MSEC(phase[GC_PHASE_SWEEP]),
+        event->objectsFreed, event->bytesFreed / 1024,
+        event->bytesAllocatedBefore / 1024, event->footprintBefore / 1024,
+        event->bytesAllocatedAfter / 1024, event->footprintAfter / 1024);
+}
+
+void dvmGcHistoryDump(const DebugOutputTarget *target)
+{
+    if (gHistory == NULL) {
+        return;
+    }
+    /* Print from a copy so the GC isn't held up by slow output.
+     */
+    GcHistory *history = (GcHistory *)malloc(sizeof(*history));
+    if (history == NULL) {
+        return;
+    }
+    dvmLockMutex(&gHistoryLock);
+    *history = *gHistory;
+    dvmUnlockMutex(&gHistoryLock);
+
+    size_t count = MIN(history->numEvents, GC_HISTORY_SIZE);
+    dvmPrintDebugMessage(target, "GC: %zd collections, the last %zd:\n",
+                         history->numEvents, count);
+    for (size_t i = history->numEvents - count; i < history->numEvents; i++) {
+        dumpEvent(target, &history->events[i % GC_HISTORY_SIZE]);
+    }
+    dumpHistogram(target, "pause", &history->pauses);
+    dumpHistogram(target, "total", &history->totals);
+    for (size_t i = 0; i < GC_PHASE_COUNT; i++) {
+        dumpHistogram(target, kPhaseNames[i], &history->phases[i]);
+    }
+    if (history->numTrims != 0) {
+        dvmPrintDebugMessage(target,
+            "Trims: %u (%u interrupted), released %lluK heap, "
+            "%lluK native\n",
+            history->numTrims, history->numInterruptedTrims,
+            history->trimmedHeapBytes / 1024,
+            history->trimmedNativeBytes / 1024);
+        dumpHistogram(target, "slice", &history->trimSlices);
+    }
+    dvmPrintDebugMessage(target, "\n");
+    free(history);
+}
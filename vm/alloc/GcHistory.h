@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A record of recent garbage collections, with histograms of pause and
+ * phase times over the life of the process.
+ */
+
+#ifndef DALVIK_ALLOC_GCHISTORY_H_
+#define DALVIK_ALLOC_GCHISTORY_H_
+
+enum GcPhase {
+    GC_PHASE_ROOT_MARK,     /* suspending threads and marking the roots */
+    GC_PHASE_MARK,          /* tracing, concurrently if possible */
+    GC_PHASE_REMARK,        /* re-marking dirty objects; concurrent GCs only */
+    GC_PHASE_REFERENCES,    /* processing reference objects */
+    GC_PHASE_SWEEP,         /* sweeping system weaks and the heap */
+    GC_PHASE_COUNT
+};
+
+struct GcEvent {
+    /* The GcSpec reason, which must be a string constant.
+     */
+    const char *reason;
+
+    /* When the collection started, on the dvmGetRelativeTimeUsec()
+     * clock.
+     */
+    u8 startUsec;
+
+    u4 phaseUsec[GC_PHASE_COUNT];
+
+    /* The pauses of the mutators.  A non-concurrent GC has only the
+     * first, and no remark phase.
+     */
+    bool isConcurrent;
+    u4 pauseUsec[2];
+    u4 totalUsec;
+
+    /* The CPU time of the collecting thread; the parallel mark threads
+     * are not included.
+     */
+    u4 cpuUsec;
+
+    size_t objectsFreed;
+    size_t bytesFreed;
+    size_t bytesAllocatedBefore;
+    size_t bytesAllocatedAfter;
+    size_t footprintBefore;
+    size_t footprintAfter;
+};
+
+/*
+ * Sets up and tears down the history.
+ */
+bool dvmGcHistoryStartup(void);
+void dvmGcHistoryShutdown(void);
+
+/*
+ * Adds a completed collection to the history.
+ */
+void dvmGcHistoryRecord(const GcEvent *event);
+
+/*
+ * Adds a heap trim that gave back <heapBytes> of the managed heaps and
+ * <nativeBytes> of the native heap in <slices> turns at the heap lock.
+ * <completed> is false if it stopped early to make way for a GC.
+ */
+void dvmGcHistoryRecordTrim(size_t heapBytes, size_t nativeBytes,
+                            size_t slices, u4 usec, bool completed);
+
+/*
+ * Copies up to <maxEvents> of the collections numbered from <*next> on,
+ * in order, and returns how many were copied.  Those that have already
+ * fallen out of the history are skipped.  <*next> is set to the number
+ * of the collection after the last one copied, so a caller that starts
+ * at 0 and polls often enough to keep up sees every collection.
+ */
+size_t dvmGcHistoryCopyEvents(size_t *next, GcEvent *events,
+                              size_t maxEvents);
+
+/*
+ * Prints the recent collections, the percentiles of the pause and
+ * phase times, and the totals of the trims.  Does not need the heap
+ * lock.
+ */
+void dvmGcHistoryDump(const DebugOutputTarget *target);
+
+#endif  // DALVIK_ALLOC_GCHISTORY_H_
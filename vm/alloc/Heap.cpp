@@ -27,6 +27,8 @@
 #include "alloc/DdmHeap.h"
 #include "alloc/HeapSource.h"
 #include "alloc/MarkSweep.h"
+#include "alloc/Compact.h"
+#include "alloc/GcHistory.h"
 #include "os/os.h"
 
 #include <sys/mman.h>
@@ -41,6 +43,7 @@ static const GcSpec kGcForMallocSpec = {
     true,  /* isPartial */
     false,  /* isConcurrent */
     true,  /* doPreserve */
+    false,  /* isSticky */
     "GC_FOR_ALLOC"
 };
 
@@ -50,15 +53,27 @@ static const GcSpec kGcConcurrentSpec  = {
     true,  /* isPartial */
     true,  /* isConcurrent */
     true,  /* doPreserve */
+    false,  /* isSticky */
     "GC_CONCURRENT"
 };
 
 const GcSpec *GC_CONCURRENT = &kGcConcurrentSpec;
 
+static const GcSpec kGcStickySpec  = {
+    true,  /* isPartial */
+    true,  /* isConcurrent */
+    true,  /* doPreserve */
+    true,  /* isSticky */
+    "GC_STICKY"
+};
+
+const GcSpec *GC_STICKY = &kGcStickySpec;
+
 static const GcSpec kGcExplicitSpec = {
     false,  /* isPartial */
     true,  /* isConcurrent */
     true,  /* doPreserve */
+    false,  /* isSticky */
     "GC_EXPLICIT"
 };
 
@@ -68,11 +83,32 @@ static const GcSpec kGcBeforeOomSpec = {
     false,  /* isPartial */
     false,  /* isConcurrent */
     false,  /* doPreserve */
+    false,  /* isSticky */
     "GC_BEFORE_OOM"
 };
 
 const GcSpec *GC_BEFORE_OOM = &kGcBeforeOomSpec;
 
+static const GcSpec kGcCompactSpec = {
+    false,  /* isPartial */
+    false,  /* isConcurrent */
+    true,  /* doPreserve */
+    false,  /* isSticky */
+    "GC_COMPACT"
+};
+
+const GcSpec *GC_COMPACT = &kGcCompactSpec;
+
+static const GcSpec kGcBeforeForkSpec = {
+    false,  /* isPartial */
+    false,  /* isConcurrent */
+    true,  /* doPreserve */
+    false,  /* isSticky */
+    "GC_BEFORE_FORK"
+};
+
+const GcSpec *GC_BEFORE_FORK = &kGcBeforeForkSpec;
+
 /*
  * Initialize the GC heap.
  *
@@ -108,6 +144,11 @@ bool dvmHeapStartup()
         return false;
     }
 
+    if (!dvmGcHistoryStartup()) {
+        LOGE_HEAP("GC history startup failed.");
+        return false;
+    }
+
     return true;
 }
 
@@ -121,6 +162,8 @@ void dvmHeapShutdown()
 //TODO: make sure we're locked
     if (gDvm.gcHeap != NULL) {
         dvmCardTableShutdown();
+        dvmGcHistoryShutdown();
+        free(gDvm.gcHeap->pendingFinalizers);
         /* Destroy the heap.  Any outstanding pointers will point to
          * unmapped memory (unless/until someone else maps it).  This
          * frees gDvm.gcHeap as a side-effect.
@@ -134,6 +177,7 @@ void dvmHeapShutdown()
  */
 void dvmHeapThreadShutdown()
 {
+    dvmHeapShutdownMarkThreads();
     dvmHeapSourceThreadShutdown();
 }
 
@@ -179,9 +223,22 @@ static void gcForMalloc(bool clearSoftReferences)
     dvmCollectGarbageInternal(spec);
 }
 
+/*
+ * Allocates from the heap source, sending big objects without
+ * references to the large object space.
+ */
+static void *heapSourceAlloc(size_t size, int flags, bool grow)
+{
+    if ((flags & ALLOC_NO_REFS) != 0 && gDvm.largeObjectThreshold != 0 &&
+        size >= gDvm.largeObjectThreshold) {
+        return dvmHeapSourceAllocLarge(size, grow);
+    }
+    return grow ? dvmHeapSourceAllocAndGrow(size) : dvmHeapSourceAlloc(size);
+}
+
 /* Try as hard as possible to allocate some memory.
  */
-static void *tryMalloc(size_t size)
+static void *tryMalloc(size_t size, int flags)
 {
     void *ptr;
 
@@ -195,7 +252,14 @@ static void *tryMalloc(size_t size)
 //    DeflateTest allocs a bunch of ~128k buffers w/in 0-5 allocs of each other
 //      (or, at least, there are only 0-5 objects swept each time)
 
-    ptr = dvmHeapSourceAlloc(size);
+    if (!gDvm.allocProf.enabled) {
+        ptr = dvmHeapSourceAllocTlabRefill(dvmThreadSelf(), size);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+
+    ptr = heapSourceAlloc(size, flags, false);
     if (ptr != NULL) {
         return ptr;
     }
@@ -217,7 +281,7 @@ static void *tryMalloc(size_t size)
       gcForMalloc(false);
     }
 
-    ptr = dvmHeapSourceAlloc(size);
+    ptr = heapSourceAlloc(size, flags, false);
     if (ptr != NULL) {
         return ptr;
     }
@@ -225,7 +289,7 @@ static void *tryMalloc(size_t size)
     /* Even that didn't work;  this is an exceptional state.
      * Try harder, growing the heap if necessary.
      */
-    ptr = dvmHeapSourceAllocAndGrow(size);
+    ptr = heapSourceAlloc(size, flags, true);
     if (ptr != NULL) {
         size_t newHeapSize;
 
@@ -249,7 +313,7 @@ static void *tryMalloc(size_t size)
     LOGI_HEAP("Forcing collection of SoftReferences for %zu-byte allocation",
             size);
     gcForMalloc(true);
-    ptr = dvmHeapSourceAllocAndGrow(size);
+    ptr = heapSourceAlloc(size, flags, true);
     if (ptr != NULL) {
         return ptr;
     }
@@ -340,14 +404,34 @@ void* dvmMalloc(size_t size, int flags)
 {
     void *ptr;
 
+    /* Small objects can usually come out of the thread's local
+     * allocation buffer without taking the heap lock.  Allocation
+     * profiling wants to see every allocation, so it disables this.
+     */
+    if (!gDvm.allocProf.enabled) {
+        ptr = dvmHeapSourceAllocTlab(dvmThreadSelf(), size);
+        if (ptr != NULL) {
+            if ((flags & ALLOC_NON_MOVING) != 0) {
+                dvmHeapSourceSetNonMoving(ptr);
+            }
+            if ((flags & ALLOC_DONT_TRACK) == 0) {
+                dvmAddTrackedAlloc((Object*)ptr, NULL);
+            }
+            return ptr;
+        }
+    }
+
     dvmLockHeap();
 
     /* Try as hard as possible to allocate some memory.
      */
-    ptr = tryMalloc(size);
+    ptr = tryMalloc(size, flags);
     if (ptr != NULL) {
         /* We've got the memory.
          */
+        if ((flags & ALLOC_NON_MOVING) != 0) {
+            dvmHeapSourceSetNonMoving(ptr);
+        }
         if (gDvm.allocProf.enabled) {
             Thread* self = dvmThreadSelf();
             gDvm.allocProf.allocCount++;
@@ -392,6 +476,13 @@ void* dvmMalloc(size_t size, int flags)
     return ptr;
 }
 
+void dvmRetireAllocBuffer(Thread* self)
+{
+    dvmLockHeap();
+    dvmHeapSourceRetireTlab(self);
+    dvmUnlockHeap();
+}
+
 /*
  * Returns true iff <obj> points to a valid allocated object.
  */
@@ -425,8 +516,59 @@ size_t dvmObjectSizeInHeap(const Object *obj)
 
 static void verifyRootsAndHeap()
 {
-    dvmVerifyRoots();
-    dvmVerifyBitmap(dvmHeapSourceGetLiveBits());
+    dvmVerifyHeap(gDvm.heapVerifySampleRate);
+}
+
+/*
+ * The number of sticky GCs allowed in a row.  Garbage in the old
+ * generation is only reclaimed by full GCs.
+ */
+#define kMaxStickyGcs 8
+
+/*
+ * Returns true if a concurrent GC may be a sticky one, which only
+ * traces and frees objects allocated since the last GC.  The card
+ * table serves as the remembered set for old objects.
+ */
+static bool shouldCollectSticky(const GcHeap *gcHeap)
+{
+    return gDvm.stickyGc && gcHeap->hasLiveSnapshot &&
+           gcHeap->stickyGcCount < kMaxStickyGcs;
+}
+
+/*
+ * Updates the sticky GC policy after a collection freed numBytesFreed
+ * out of bytesAllocated.
+ */
+static void updateStickyGcPolicy(GcHeap *gcHeap, const GcSpec *spec,
+                                 size_t bytesAllocated, size_t numBytesFreed)
+{
+    if (!spec->isSticky) {
+        gcHeap->stickyGcCount = 0;
+        return;
+    }
+    gcHeap->stickyGcCount++;
+    size_t youngBytes = 0;
+    if (bytesAllocated > gcHeap->bytesAllocatedAfterGc) {
+        youngBytes = bytesAllocated - gcHeap->bytesAllocatedAfterGc;
+    }
+    if (numBytesFreed < youngBytes / 4) {
+        /* Most of the young objects survived, so old garbage is the
+         * likelier culprit.  Make the next concurrent GC a full one.
+         */
+        gcHeap->stickyGcCount = kMaxStickyGcs;
+    }
+}
+
+/*
+ * Charges the time since *phaseStart to <phase> and starts the next
+ * phase.
+ */
+static void endGcPhase(GcEvent *event, GcPhase phase, u8 *phaseStart)
+{
+    u8 now = dvmGetRelativeTimeUsec();
+    event->phaseUsec[phase] = (u4)(now - *phaseStart);
+    *phaseStart = now;
 }
 
 /*
@@ -453,6 +595,8 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     size_t currAllocated, currFootprint;
     size_t percentFree;
     int oldThreadPriority = INT_MAX;
+    GcEvent event;
+    u8 phaseStart, remarkStart = 0;
 
     /* The heap lock must be held.
      */
@@ -462,25 +606,46 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
         return;
     }
 
+    if (spec == GC_CONCURRENT && shouldCollectSticky(gcHeap)) {
+        spec = GC_STICKY;
+    }
+
     // Trace the beginning of the top-level GC.
     if (spec == GC_FOR_MALLOC) {
         ATRACE_BEGIN("GC (alloc)");
     } else if (spec == GC_CONCURRENT) {
         ATRACE_BEGIN("GC (concurrent)");
+    } else if (spec == GC_STICKY) {
+        ATRACE_BEGIN("GC (sticky)");
     } else if (spec == GC_EXPLICIT) {
         ATRACE_BEGIN("GC (explicit)");
     } else if (spec == GC_BEFORE_OOM) {
         ATRACE_BEGIN("GC (before OOM)");
+    } else if (spec == GC_COMPACT) {
+        ATRACE_BEGIN("GC (compact)");
+    } else if (spec == GC_BEFORE_FORK) {
+        ATRACE_BEGIN("GC (before fork)");
     } else {
         ATRACE_BEGIN("GC (unknown)");
     }
 
     gcHeap->gcRunning = true;
 
+    memset(&event, 0, sizeof(event));
+    event.reason = spec->reason;
+    event.isConcurrent = spec->isConcurrent;
+    event.startUsec = phaseStart = dvmGetRelativeTimeUsec();
+    u8 cpuStart = dvmGetThreadCpuTimeUsec();
     rootStart = dvmGetRelativeTimeMsec();
     ATRACE_BEGIN("GC: Threads Suspended"); // Suspend A
     dvmSuspendAllThreads(SUSPEND_FOR_GC);
 
+    /*
+     * Return the unused parts of the thread-local allocation buffers.
+     * No new ones are handed out until the collection completes.
+     */
+    dvmHeapSourceRetireAllTlabs();
+
     /*
      * If we are not marking concurrently raise the priority of the
      * thread performing the garbage collection.
@@ -497,7 +662,10 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
 
     /* Set up the marking context.
      */
-    if (!dvmHeapBeginMarkStep(spec->isPartial)) {
+    size_t bytesAllocated = dvmHeapSourceGetValue(HS_BYTES_ALLOCATED, NULL, 0);
+    event.bytesAllocatedBefore = bytesAllocated;
+    event.footprintBefore = dvmHeapSourceGetValue(HS_FOOTPRINT, NULL, 0);
+    if (!dvmHeapBeginMarkStep(spec->isPartial, spec->isSticky)) {
         ATRACE_END(); // Suspend A
         ATRACE_END(); // Top-level GC
         LOGE_HEAP("dvmHeapBeginMarkStep failed; aborting");
@@ -507,7 +675,13 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     /* Mark the set of objects that are strongly reachable from the roots.
      */
     LOGD_HEAP("Marking...");
-    dvmHeapMarkRootSet();
+    bool threadRootsLater = spec->isConcurrent && gDvm.incrementalThreadRoots;
+    if (threadRootsLater) {
+        dvmHeapMarkGlobalRootSet();
+    } else {
+        dvmHeapMarkRootSet();
+    }
+    endGcPhase(&event, GC_PHASE_ROOT_MARK, &phaseStart);
 
     /* dvmHeapScanMarkedObjects() will build the lists of known
      * instances of the Reference classes.
@@ -516,18 +690,31 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     assert(gcHeap->weakReferences == NULL);
     assert(gcHeap->finalizerReferences == NULL);
     assert(gcHeap->phantomReferences == NULL);
-    assert(gcHeap->clearedReferences == NULL);
 
     if (spec->isConcurrent) {
         /*
          * Resume threads while tracing from the roots.  We unlock the
          * heap to allow mutator threads to allocate from free space.
+         * A sticky GC still needs the cards dirtied before this point,
+         * so it ages them instead.
          */
-        dvmClearCardTable();
+        if (spec->isSticky) {
+            dvmAgeCardTable();
+        } else {
+            dvmClearCardTable();
+        }
         dvmUnlockHeap();
         dvmResumeAllThreads(SUSPEND_FOR_GC);
         ATRACE_END(); // Suspend A
         rootEnd = dvmGetRelativeTimeMsec();
+        event.pauseUsec[0] = (u4)(dvmGetRelativeTimeUsec() - event.startUsec);
+        /*
+         * Only the global roots were marked in the pause; visit the
+         * threads one at a time now.
+         */
+        if (threadRootsLater) {
+            dvmHeapMarkThreadRootSet();
+        }
     }
 
     /* Recursively mark any objects that marked objects point to strongly.
@@ -538,11 +725,20 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     dvmHeapScanMarkedObjects();
 
     if (spec->isConcurrent) {
+        /*
+         * Clean up after the mutators while they are still running,
+         * so the pause only has to deal with what they dirty from
+         * here on.
+         */
+        dvmHeapPreCleanMarkedObjects();
+        endGcPhase(&event, GC_PHASE_MARK, &phaseStart);
+
         /*
          * Re-acquire the heap lock and perform the final thread
          * suspension.
          */
         dirtyStart = dvmGetRelativeTimeMsec();
+        remarkStart = phaseStart;
         dvmLockHeap();
         ATRACE_BEGIN("GC: Threads Suspended"); // Suspend B
         dvmSuspendAllThreads(SUSPEND_FOR_GC);
@@ -563,6 +759,9 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
          * heap objects dirtied during the concurrent mark.
          */
         dvmHeapReScanMarkedObjects();
+        endGcPhase(&event, GC_PHASE_REMARK, &phaseStart);
+    } else {
+        endGcPhase(&event, GC_PHASE_MARK, &phaseStart);
     }
 
     /*
@@ -574,6 +773,7 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
                              &gcHeap->weakReferences,
                              &gcHeap->finalizerReferences,
                              &gcHeap->phantomReferences);
+    endGcPhase(&event, GC_PHASE_REFERENCES, &phaseStart);
 
 #if defined(WITH_JIT)
     /*
@@ -582,14 +782,15 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
      * that makes it expensive.
      *
      * Therefore we batch those work orders in a queue and go through them
-     * when threads are suspended for GC.
+     * when threads are suspended for GC, unless the queue could be emptied
+     * without suspending anyone before.
      */
     dvmCompilerPerformSafePointChecks();
 #endif
 
     LOGD_HEAP("Sweeping...");
 
-    dvmHeapSweepSystemWeaks();
+    dvmHeapSweepSystemWeaks(spec->isConcurrent);
 
     /*
      * Live objects have a bit set in the mark bitmap, swap the mark
@@ -608,11 +809,27 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
         dvmResumeAllThreads(SUSPEND_FOR_GC);
         ATRACE_END(); // Suspend B
         dirtyEnd = dvmGetRelativeTimeMsec();
+        event.pauseUsec[1] = (u4)(dvmGetRelativeTimeUsec() - remarkStart);
+        dvmHeapSweepWeakJniGlobals();
     }
     dvmHeapSweepUnmarkedObjects(spec->isPartial, spec->isConcurrent,
                                 &numObjectsFreed, &numBytesFreed);
+    updateStickyGcPolicy(gcHeap, spec, bytesAllocated, numBytesFreed);
     LOGD_HEAP("Cleaning up...");
-    dvmHeapFinishMarkStep();
+    bool compacting = spec == GC_COMPACT || spec == GC_BEFORE_FORK;
+    dvmHeapFinishMarkStep(!compacting && gDvm.stickyGc &&
+                          gcHeap->stickyGcCount < kMaxStickyGcs);
+    if (compacting) {
+        /* The threads are still suspended and the mark bitmap is
+         * clear, which is what the compaction needs.
+         */
+        if (spec == GC_COMPACT) {
+            dvmHeapCompact();
+        } else {
+            dvmHeapCompactBeforeFork();
+        }
+    }
+    endGcPhase(&event, GC_PHASE_SWEEP, &phaseStart);
     if (spec->isConcurrent) {
         dvmLockHeap();
     }
@@ -625,9 +842,10 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
      * This doesn't actually resize any memory;
      * it just lets the heap grow more when necessary.
      */
-    dvmHeapSourceGrowForUtilization();
+    dvmHeapSourceGrowForUtilization(event.startUsec, bytesAllocated);
 
     currAllocated = dvmHeapSourceGetValue(HS_BYTES_ALLOCATED, NULL, 0);
+    gcHeap->bytesAllocatedAfterGc = currAllocated;
     currFootprint = dvmHeapSourceGetValue(HS_FOOTPRINT, NULL, 0);
 
     dvmMethodTraceGCEnd();
@@ -649,6 +867,7 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
         dvmResumeAllThreads(SUSPEND_FOR_GC);
         ATRACE_END(); // Suspend A
         dirtyEnd = dvmGetRelativeTimeMsec();
+        event.pauseUsec[0] = (u4)(dvmGetRelativeTimeUsec() - event.startUsec);
         /*
          * Restore the original thread scheduling priority if it was
          * changed at the start of the current garbage collection.
@@ -659,11 +878,24 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     }
 
     /*
-     * Move queue of pending references back into Java.
+     * Move queue of pending references back into Java.  Unless the
+     * caller may be waiting on the queues, leave it to the GC daemon,
+     * which does it without the heap lock.  Until then the references
+     * are kept alive as a root.
      */
-    dvmEnqueueClearedReferences(&gDvm.gcHeap->clearedReferences);
+    if (spec == GC_EXPLICIT || spec == GC_BEFORE_OOM ||
+        !dvmHeapSourceRequestReferenceEnqueue()) {
+        dvmEnqueueClearedReferences(&gcHeap->clearedReferences);
+    }
 
     gcEnd = dvmGetRelativeTimeMsec();
+    event.totalUsec = (u4)(dvmGetRelativeTimeUsec() - event.startUsec);
+    event.cpuUsec = (u4)(dvmGetThreadCpuTimeUsec() - cpuStart);
+    event.objectsFreed = numObjectsFreed;
+    event.bytesFreed = numBytesFreed;
+    event.bytesAllocatedAfter = currAllocated;
+    event.footprintAfter = currFootprint;
+    dvmGcHistoryRecord(&event);
     percentFree = 100 - (size_t)(100.0f * (float)currAllocated / currFootprint);
     if (!spec->isConcurrent) {
         u4 markSweepTime = dirtyEnd - rootStart;
@@ -744,3 +976,48 @@ bool dvmWaitForConcurrentGcToComplete()
     ATRACE_END();
     return waited;
 }
+
+void dvmHeapEnqueueClearedReferences()
+{
+    Thread *self = dvmThreadSelf();
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_RUNNING);
+    dvmLockHeap();
+    Object *cleared = gDvm.gcHeap->clearedReferences;
+    gDvm.gcHeap->clearedReferences = NULL;
+    if (cleared != NULL) {
+        /* The rest of the list is reachable through the head. */
+        dvmAddTrackedAlloc(cleared, self);
+    }
+    dvmUnlockHeap();
+    if (cleared != NULL) {
+        Object *list = cleared;
+        dvmEnqueueClearedReferences(&list);
+        dvmReleaseTrackedAlloc(cleared, self);
+    }
+    dvmChangeStatus(self, oldStatus);
+}
+
+void dvmHeapGetFinalizerStats(size_t *numPending, u4 *oldestAgeMsec,
+                              u8 *totalQueued)
+{
+    size_t zombieOffset = gDvm.offJavaLangRefFinalizerReference_zombie;
+    dvmLockHeap();
+    GcHeap *gcHeap = gDvm.gcHeap;
+    size_t pending = 0;
+    u4 oldest = 0;
+    /* Entries outlive their references only until the GC sweeps them,
+     * which needs the heap lock.
+     */
+    for (size_t i = 0; i < gcHeap->numPendingFinalizers; ++i) {
+        const PendingFinalizer *entry = &gcHeap->pendingFinalizers[i];
+        if (dvmGetFieldObject(entry->reference, zombieOffset) != NULL) {
+            if (pending++ == 0) {
+                oldest = dvmGetRelativeTimeMsec() - entry->queuedMsec;
+            }
+        }
+    }
+    *numPending = pending;
+    *oldestAgeMsec = oldest;
+    *totalQueued = gcHeap->totalFinalizersQueued;
+    dvmUnlockHeap();
+}
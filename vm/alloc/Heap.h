@@ -26,6 +26,8 @@ struct GcSpec {
   bool isConcurrent;
   /* Toggles for the soft reference clearing policy. */
   bool doPreserve;
+  /* If true, only objects allocated since the last GC are threatened. */
+  bool isSticky;
   /* A name for this garbage collection mode. */
   const char *reason;
 };
@@ -36,12 +38,21 @@ extern const GcSpec *GC_FOR_MALLOC;
 /* Automatic GC triggered by exceeding a heap occupancy threshold. */
 extern const GcSpec *GC_CONCURRENT;
 
+/* A GC_CONCURRENT that only collects objects allocated since the last GC. */
+extern const GcSpec *GC_STICKY;
+
 /* Explicit GC via Runtime.gc(), VMRuntime.gc(), or SIGUSR1. */
 extern const GcSpec *GC_EXPLICIT;
 
 /* Final attempt to reclaim memory before throwing an OOM. */
 extern const GcSpec *GC_BEFORE_OOM;
 
+/* Full GC that also compacts the heap, while the process is in the background. */
+extern const GcSpec *GC_COMPACT;
+
+/* Full GC that packs the zygote heap, right before the zygote first forks. */
+extern const GcSpec *GC_BEFORE_FORK;
+
 /*
  * Initialize the GC heap.
  *
@@ -94,6 +105,21 @@ void dvmCollectGarbageInternal(const GcSpec *spec);
  */
 bool dvmWaitForConcurrentGcToComplete(void);
 
+/*
+ * Hands the references cleared by earlier collections to their
+ * reference queues.  The caller must not hold the heap lock; the list
+ * is taken under it, but the queues are appended to without it.
+ */
+void dvmHeapEnqueueClearedReferences(void);
+
+/*
+ * Returns the number of objects queued for finalization whose finalize()
+ * has yet to run, the age in msec of the oldest of them (0 if there are
+ * none), and the number queued since startup.
+ */
+void dvmHeapGetFinalizerStats(size_t *numPending, u4 *oldestAgeMsec,
+                              u8 *totalQueued);
+
 /*
  * Returns true iff <obj> points to a valid allocated object.
  */
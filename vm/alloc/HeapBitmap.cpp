@@ -32,7 +32,7 @@ bool dvmHeapBitmapInit(HeapBitmap *hb, const void *base, size_t maxSize,
     assert(hb != NULL);
     assert(name != NULL);
     bitsLen = HB_OFFSET_TO_INDEX(maxSize) * sizeof(*hb->bits);
-    bits = dvmAllocRegion(bitsLen, PROT_READ | PROT_WRITE, name);
+    bits = dvmAllocHugeRegion(bitsLen, PROT_READ | PROT_WRITE, name);
     if (bits == NULL) {
         ALOGE("Could not mmap %zd-byte ashmem region '%s'", bitsLen, name);
         return false;
@@ -74,6 +74,67 @@ void dvmHeapBitmapZero(HeapBitmap *hb)
     }
 }
 
+/*
+ * Zeroes the partial page of bits at <from> and gives the pages after
+ * it back to the system.
+ */
+void dvmHeapBitmapZeroFrom(HeapBitmap *hb, uintptr_t from)
+{
+    assert(hb != NULL);
+    assert(from % (HB_BITS_PER_WORD * HB_OBJECT_ALIGNMENT) == 0);
+
+    if (from <= hb->base) {
+        dvmHeapBitmapZero(hb);
+        return;
+    }
+    if (hb->bits == NULL) {
+        return;
+    }
+    size_t start = HB_OFFSET_TO_BYTE_INDEX(from - hb->base);
+    if (start < hb->bitsLen) {
+        size_t pageStart = MIN(ALIGN_UP_TO_PAGE_SIZE(start), hb->bitsLen);
+        memset((char *)hb->bits + start, 0, pageStart - start);
+        if (pageStart < hb->bitsLen) {
+            madvise((char *)hb->bits + pageStart, hb->bitsLen - pageStart,
+                    MADV_DONTNEED);
+        }
+    }
+    if (hb->max >= from) {
+        hb->max = from - 1;
+    }
+}
+
+/*
+ * Copy all bits up to the higher of the two maxes, which clears any
+ * stale bits in <dst> beyond the max of <src>.
+ */
+void dvmHeapBitmapCopy(HeapBitmap *dst, const HeapBitmap *src)
+{
+    dvmHeapBitmapCopyFrom(dst, src, dst->base);
+}
+
+void dvmHeapBitmapCopyFrom(HeapBitmap *dst, const HeapBitmap *src,
+                           uintptr_t from)
+{
+    assert(dst != NULL);
+    assert(src != NULL);
+    assert(dst->base == src->base);
+    assert(dst->bitsLen == src->bitsLen);
+    assert(from >= dst->base);
+    assert(from % (HB_BITS_PER_WORD * HB_OBJECT_ALIGNMENT) == 0);
+
+    uintptr_t srcMax = src->max;
+    uintptr_t max = MAX(srcMax, dst->max);
+    if (max >= from) {
+        size_t start = HB_OFFSET_TO_BYTE_INDEX(from - dst->base);
+        size_t length = HB_OFFSET_TO_BYTE_INDEX(max - dst->base) +
+                        sizeof(*dst->bits) - start;
+        memcpy((char *)dst->bits + start, (const char *)src->bits + start,
+               length);
+    }
+    dst->max = srcMax;
+}
+
 /*
  * Return true iff <obj> is within the range of pointers that this
  * bitmap could potentially cover, even if a bit has not been set
@@ -90,6 +151,84 @@ bool dvmHeapBitmapCoversAddress(const HeapBitmap *hb, const void *obj)
     return false;
 }
 
+/*
+ * The walkers decode the set bits of as many words as fit into a
+ * buffer of object addresses before calling back on any of them, and
+ * prefetch each object a few entries ahead of the callback.  Nearly
+ * every callback starts by reading the object's header, and the
+ * prefetch overlaps those cache misses with the work on the objects
+ * before them.  Bits come out in address order with CLZ; see
+ * HB_OFFSET_TO_MASK.
+ */
+#define HB_WALK_BATCH           (4 * HB_BITS_PER_WORD)
+#define HB_PREFETCH_DISTANCE    4
+
+/*
+ * Appends the addresses that correspond to the bits set in <word> to
+ * the buffer at <pb>, in increasing order, and returns the new end of
+ * the buffer.  <ptrBase> is the address of the word's first bit.
+ */
+static inline void **decodeWord(unsigned long word, uintptr_t ptrBase,
+                                void **pb)
+{
+    const unsigned long highBit = 1UL << (HB_BITS_PER_WORD - 1);
+    while (word != 0) {
+        const int shift = CLZ(word);
+        word ^= highBit >> shift;
+        *pb++ = (void *)(ptrBase + shift * HB_OBJECT_ALIGNMENT);
+    }
+    return pb;
+}
+
+/*
+ * Returns true if another word's worth of addresses may not fit in
+ * the buffer.
+ */
+static inline bool isBatchFull(void **buf, void **pb)
+{
+    return pb > buf + HB_WALK_BATCH - HB_BITS_PER_WORD;
+}
+
+/*
+ * Prefetches the first objects of a batch, so that the loop over it
+ * starts HB_PREFETCH_DISTANCE objects ahead.
+ */
+static inline void prefetchBatch(void **objs, size_t count)
+{
+    for (size_t i = 0; i < count && i < HB_PREFETCH_DISTANCE; ++i) {
+        __builtin_prefetch(objs[i]);
+    }
+}
+
+static void walkBatch(void **objs, size_t count,
+                      BitmapCallback *callback, void *arg)
+{
+    prefetchBatch(objs, count);
+    for (size_t i = 0; i < count; ++i) {
+        if (i + HB_PREFETCH_DISTANCE < count) {
+            __builtin_prefetch(objs[i + HB_PREFETCH_DISTANCE]);
+        }
+        (*callback)((Object *)objs[i], arg);
+    }
+}
+
+/*
+ * The finger passed with a batch is the end of the last word read,
+ * not of the word holding the object: a bit set in any word already
+ * read will not be seen by the walk.
+ */
+static void scanBatch(void **objs, size_t count, void *finger,
+                      BitmapScanCallback *callback, void *arg)
+{
+    prefetchBatch(objs, count);
+    for (size_t i = 0; i < count; ++i) {
+        if (i + HB_PREFETCH_DISTANCE < count) {
+            __builtin_prefetch(objs[i + HB_PREFETCH_DISTANCE]);
+        }
+        (*callback)((Object *)objs[i], finger, arg);
+    }
+}
+
 /*
  * Visits set bits in address order.  The callback is not permitted to
  * change the bitmap bits or max during the traversal.
@@ -100,20 +239,21 @@ void dvmHeapBitmapWalk(const HeapBitmap *bitmap, BitmapCallback *callback,
     assert(bitmap != NULL);
     assert(bitmap->bits != NULL);
     assert(callback != NULL);
+    void *objs[HB_WALK_BATCH];
+    void **pb = objs;
     uintptr_t end = HB_OFFSET_TO_INDEX(bitmap->max - bitmap->base);
     for (uintptr_t i = 0; i <= end; ++i) {
         unsigned long word = bitmap->bits[i];
         if (UNLIKELY(word != 0)) {
-            unsigned long highBit = 1 << (HB_BITS_PER_WORD - 1);
             uintptr_t ptrBase = HB_INDEX_TO_OFFSET(i) + bitmap->base;
-            while (word != 0) {
-                const int shift = CLZ(word);
-                Object* obj = (Object *)(ptrBase + shift * HB_OBJECT_ALIGNMENT);
-                (*callback)(obj, arg);
-                word &= ~(highBit >> shift);
+            pb = decodeWord(word, ptrBase, pb);
+            if (isBatchFull(objs, pb)) {
+                walkBatch(objs, pb - objs, callback, arg);
+                pb = objs;
             }
         }
     }
+    walkBatch(objs, pb - objs, callback, arg);
 }
 
 /*
@@ -130,27 +270,81 @@ void dvmHeapBitmapWalk(const HeapBitmap *bitmap, BitmapCallback *callback,
  */
 void dvmHeapBitmapScanWalk(HeapBitmap *bitmap,
                            BitmapScanCallback *callback, void *arg)
+{
+    dvmHeapBitmapScanWalkFrom(bitmap, bitmap->base, callback, arg);
+}
+
+void dvmHeapBitmapScanWalkFrom(HeapBitmap *bitmap, uintptr_t from,
+                               BitmapScanCallback *callback, void *arg)
 {
     assert(bitmap != NULL);
     assert(bitmap->bits != NULL);
     assert(callback != NULL);
+    assert(from >= bitmap->base);
+    assert(from % (HB_BITS_PER_WORD * HB_OBJECT_ALIGNMENT) == 0);
+    void *objs[HB_WALK_BATCH];
+    void **pb = objs;
     uintptr_t end = HB_OFFSET_TO_INDEX(bitmap->max - bitmap->base);
-    uintptr_t i;
-    for (i = 0; i <= end; ++i) {
+    uintptr_t i = HB_OFFSET_TO_INDEX(from - bitmap->base);
+    for (;;) {
+        for (; i <= end; ++i) {
+            unsigned long word = bitmap->bits[i];
+            if (UNLIKELY(word != 0)) {
+                uintptr_t ptrBase = HB_INDEX_TO_OFFSET(i) + bitmap->base;
+                pb = decodeWord(word, ptrBase, pb);
+                if (isBatchFull(objs, pb)) {
+                    void *finger =
+                        (void *)(HB_INDEX_TO_OFFSET(i + 1) + bitmap->base);
+                    scanBatch(objs, pb - objs, finger, callback, arg);
+                    pb = objs;
+                    end = HB_OFFSET_TO_INDEX(bitmap->max - bitmap->base);
+                }
+            }
+        }
+        if (pb == objs) {
+            break;
+        }
+        /* The callbacks may raise the max past the words read so far.
+         */
+        void *finger = (void *)(HB_INDEX_TO_OFFSET(i) + bitmap->base);
+        scanBatch(objs, pb - objs, finger, callback, arg);
+        pb = objs;
+        end = HB_OFFSET_TO_INDEX(bitmap->max - bitmap->base);
+    }
+}
+
+/*
+ * Similar to dvmHeapBitmapScanWalk, restricted to [base, limit).  The
+ * range does not shrink to the max of the bitmap, so that concurrent
+ * walkers each see bits set above the max they would have read.
+ */
+void dvmHeapBitmapScanWalkRange(HeapBitmap *bitmap, uintptr_t base,
+                                uintptr_t limit,
+                                BitmapScanCallback *callback, void *arg)
+{
+    assert(bitmap != NULL);
+    assert(bitmap->bits != NULL);
+    assert(callback != NULL);
+    assert(base >= bitmap->base);
+    assert(base <= limit);
+    assert(HB_OFFSET_TO_BYTE_INDEX(limit - bitmap->base) <= bitmap->bitsLen);
+    void *objs[HB_WALK_BATCH];
+    void **pb = objs;
+    uintptr_t start = HB_OFFSET_TO_INDEX(base - bitmap->base);
+    uintptr_t end = HB_OFFSET_TO_INDEX(limit - bitmap->base);
+    for (uintptr_t i = start; i < end; ++i) {
         unsigned long word = bitmap->bits[i];
         if (UNLIKELY(word != 0)) {
-            unsigned long highBit = 1 << (HB_BITS_PER_WORD - 1);
             uintptr_t ptrBase = HB_INDEX_TO_OFFSET(i) + bitmap->base;
-            void *finger = (void *)(HB_INDEX_TO_OFFSET(i + 1) + bitmap->base);
-            while (word != 0) {
-                const int shift = CLZ(word);
-                Object *obj = (Object *)(ptrBase + shift * HB_OBJECT_ALIGNMENT);
-                (*callback)(obj, finger, arg);
-                word &= ~(highBit >> shift);
+            pb = decodeWord(word, ptrBase, pb);
+            if (isBatchFull(objs, pb)) {
+                void *finger = (void *)(HB_INDEX_TO_OFFSET(i + 1) + bitmap->base);
+                scanBatch(objs, pb - objs, finger, callback, arg);
+                pb = objs;
             }
-            end = HB_OFFSET_TO_INDEX(bitmap->max - bitmap->base);
         }
     }
+    scanBatch(objs, pb - objs, (void *)limit, callback, arg);
 }
 
 /*
@@ -179,7 +373,7 @@ void dvmHeapBitmapSweepWalk(const HeapBitmap *liveHb, const HeapBitmap *markHb,
          */
         return;
     }
-    void *pointerBuf[4 * HB_BITS_PER_WORD];
+    void *pointerBuf[HB_WALK_BATCH];
     void **pb = pointerBuf;
     size_t start = HB_OFFSET_TO_INDEX(base - liveHb->base);
     size_t end = HB_OFFSET_TO_INDEX(max - liveHb->base);
@@ -188,16 +382,19 @@ void dvmHeapBitmapSweepWalk(const HeapBitmap *liveHb, const HeapBitmap *markHb,
     for (size_t i = start; i <= end; i++) {
         unsigned long garbage = live[i] & ~mark[i];
         if (UNLIKELY(garbage != 0)) {
-            unsigned long highBit = 1 << (HB_BITS_PER_WORD - 1);
             uintptr_t ptrBase = HB_INDEX_TO_OFFSET(i) + liveHb->base;
-            while (garbage != 0) {
-                int shift = CLZ(garbage);
-                garbage &= ~(highBit >> shift);
-                *pb++ = (void *)(ptrBase + shift * HB_OBJECT_ALIGNMENT);
+            void **first = pb;
+            pb = decodeWord(garbage, ptrBase, pb);
+            /* Freeing writes the chunk headers, which sit just below
+             * the objects.  The callback won't get to these until the
+             * buffer is full, so they can all be fetched now.
+             */
+            for (void **p = first; p < pb; ++p) {
+                __builtin_prefetch(*p, 1);
             }
             /* Make sure that there are always enough slots available */
             /* for an entire word of 1s. */
-            if (pb >= &pointerBuf[NELEM(pointerBuf) - HB_BITS_PER_WORD]) {
+            if (isBatchFull(pointerBuf, pb)) {
                 (*callback)(pb - pointerBuf, pointerBuf, callbackArg);
                 pb = pointerBuf;
             }
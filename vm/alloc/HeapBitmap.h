@@ -96,6 +96,25 @@ void dvmHeapBitmapDelete(HeapBitmap *hb);
  */
 void dvmHeapBitmapZero(HeapBitmap *hb);
 
+/*
+ * Like dvmHeapBitmapZero, but leaves the bits for addresses below
+ * <from> alone.  <from> must be aligned to the coverage of a bitmap
+ * word.
+ */
+void dvmHeapBitmapZeroFrom(HeapBitmap *hb, uintptr_t from);
+
+/*
+ * Makes <dst> a copy of <src>.  Both bitmaps must cover the same range.
+ */
+void dvmHeapBitmapCopy(HeapBitmap *dst, const HeapBitmap *src);
+
+/*
+ * Like dvmHeapBitmapCopy, but only copies the bits for addresses at or
+ * above <from>, which must be aligned to the coverage of a bitmap word.
+ */
+void dvmHeapBitmapCopyFrom(HeapBitmap *dst, const HeapBitmap *src,
+                           uintptr_t from);
+
 /*
  * Returns true if the address range of the bitmap covers the object
  * address.
@@ -115,6 +134,24 @@ void dvmHeapBitmapWalk(const HeapBitmap *bitmap,
 void dvmHeapBitmapScanWalk(HeapBitmap *bitmap,
                            BitmapScanCallback *callback, void *arg);
 
+/*
+ * Like dvmHeapBitmapScanWalk but starts at <from> rather than the base
+ * of the bitmap.  <from> must be aligned to the coverage of a bitmap
+ * word.
+ */
+void dvmHeapBitmapScanWalkFrom(HeapBitmap *bitmap, uintptr_t from,
+                               BitmapScanCallback *callback, void *arg);
+
+/*
+ * Like dvmHeapBitmapScanWalk but only visits the addresses in the
+ * range [base, limit).  Both ends must be aligned to the coverage of
+ * a bitmap word.  Bits set behind the finger during the walk are not
+ * visited.
+ */
+void dvmHeapBitmapScanWalkRange(HeapBitmap *bitmap, uintptr_t base,
+                                uintptr_t limit,
+                                BitmapScanCallback *callback, void *arg);
+
 /*
  * Walk through the bitmaps in increasing address order, and find the
  * object pointers that correspond to garbage objects.  Call
@@ -20,6 +20,8 @@
 static unsigned long dvmHeapBitmapSetAndReturnObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
 static void dvmHeapBitmapSetObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
 static void dvmHeapBitmapClearObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
+static void dvmHeapBitmapAtomicSetObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
+static unsigned long dvmHeapBitmapAtomicSetAndReturnObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
 
 /*
  * Internal function; do not call directly.
@@ -75,6 +77,70 @@ static void dvmHeapBitmapSetObjectBit(HeapBitmap *hb, const void *obj)
     _heapBitmapModifyObjectBit(hb, obj, true, false);
 }
 
+/*
+ * Internal function; do not call directly.  Widens the range of seen
+ * pointers to include <obj> in the face of concurrent updates.
+ */
+static void _heapBitmapAtomicWidenMax(HeapBitmap *hb, const void *obj)
+{
+    for (;;) {
+        uintptr_t max = hb->max;
+        if ((uintptr_t)obj <= max) {
+            break;
+        }
+        if (android_atomic_release_cas((int32_t)max, (int32_t)obj,
+                                       (volatile int32_t *)&hb->max) == 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Like dvmHeapBitmapSetObjectBit, but safe against other threads
+ * setting bits in the same word and widening the same range.  Used
+ * when objects are allocated without holding the heap lock.
+ */
+static void dvmHeapBitmapAtomicSetObjectBit(HeapBitmap *hb, const void *obj)
+{
+    const uintptr_t offset = (uintptr_t)obj - hb->base;
+    const size_t index = HB_OFFSET_TO_INDEX(offset);
+    const unsigned long mask = HB_OFFSET_TO_MASK(offset);
+
+    assert(hb->bits != NULL);
+    assert((uintptr_t)obj >= hb->base);
+    assert(index < hb->bitsLen / sizeof(*hb->bits));
+    _heapBitmapAtomicWidenMax(hb, obj);
+    android_atomic_or((int32_t)mask, (volatile int32_t *)(hb->bits + index));
+}
+
+/*
+ * Like dvmHeapBitmapSetAndReturnObjectBit, but safe against other
+ * threads setting bits in the same word.  Exactly one of several
+ * threads racing to set the same bit sees a zero return value.
+ */
+static unsigned long dvmHeapBitmapAtomicSetAndReturnObjectBit(HeapBitmap *hb,
+                                                              const void *obj)
+{
+    const uintptr_t offset = (uintptr_t)obj - hb->base;
+    const size_t index = HB_OFFSET_TO_INDEX(offset);
+    const unsigned long mask = HB_OFFSET_TO_MASK(offset);
+    volatile int32_t *p = (volatile int32_t *)(hb->bits + index);
+
+    assert(hb->bits != NULL);
+    assert((uintptr_t)obj >= hb->base);
+    assert(index < hb->bitsLen / sizeof(*hb->bits));
+    _heapBitmapAtomicWidenMax(hb, obj);
+    for (;;) {
+        int32_t word = *p;
+        if (word & mask) {
+            return word & mask;
+        }
+        if (android_atomic_release_cas(word, word | (int32_t)mask, p) == 0) {
+            return 0;
+        }
+    }
+}
+
 /*
  * Clears the bit corresponding to <obj>.  Does no range checking.
  */
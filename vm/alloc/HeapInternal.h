@@ -23,6 +23,12 @@
 
 struct HeapSource;
 
+/* A finalizer reference and when a GC queued it for finalization. */
+struct PendingFinalizer {
+    Object *reference;
+    u4 queuedMsec;
+};
+
 struct GcHeap {
     HeapSource *heapSource;
 
@@ -40,6 +46,20 @@ struct GcHeap {
      */
     Object *clearedReferences;
 
+    /* The finalizer references queued by earlier GCs whose referents
+     * may not have been finalized yet, oldest first.  Each GC drops
+     * the ones that are finalized or dead.  Only used for statistics.
+     */
+    PendingFinalizer *pendingFinalizers;
+    size_t numPendingFinalizers;
+    size_t maxPendingFinalizers;
+
+    /* When the current GC queues its finalizer references, and how
+     * many have been queued since startup.
+     */
+    u4 finalizerQueueMsec;
+    u8 totalFinalizersQueued;
+
     /* The current state of the mark step.
      * Only valid during a GC.
      */
@@ -55,6 +75,19 @@ struct GcHeap {
      */
     bool gcRunning;
 
+    /* True if the mark bitmap still holds the live objects as of the
+     * end of the last GC, which lets the next GC be sticky.
+     */
+    bool hasLiveSnapshot;
+
+    /* The number of sticky GCs since the last full one.
+     */
+    size_t stickyGcCount;
+
+    /* The value of HS_BYTES_ALLOCATED when the last GC completed.
+     */
+    size_t bytesAllocatedAfterGc;
+
     /*
      * Debug control values
      */
@@ -17,21 +17,30 @@
 #include <stdint.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <cutils/ashmem.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "Dalvik.h"
 #include "alloc/DlMalloc.h"
+#include "alloc/GcHistory.h"
 #include "alloc/Heap.h"
 #include "alloc/HeapInternal.h"
 #include "alloc/HeapSource.h"
 #include "alloc/HeapBitmap.h"
 #include "alloc/HeapBitmapInlines.h"
+#include "alloc/LargeObjectSpace.h"
 
-static void dvmHeapSourceUpdateMaxNativeFootprint();
 static void snapIdealFootprint();
 static void setIdealFootprint(size_t max);
 static size_t getMaximumSize(const HeapSource *hs);
-static void trimHeaps();
+static bool trimHeaps(bool canYield);
+static size_t getUtilizationTarget(const HeapSource* hs, size_t liveSize);
+static size_t getGcTimeTarget(const HeapSource* hs, size_t liveSize);
 
 #define HEAP_UTILIZATION_MAX        1024
 
@@ -40,6 +49,21 @@ static void trimHeaps();
  */
 #define HEAP_TRIM_IDLE_TIME_MS (5 * 1000)
 
+/* How long a heap trim may hold the heap lock before letting other
+ * threads have it.
+ */
+#define HEAP_TRIM_SLICE_USEC 2000
+
+/* dlmalloc keeps the bookkeeping of a free chunk, and the footer of the
+ * top chunk, within this many bytes of the chunk's boundaries.
+ */
+#define CHUNK_BOOKKEEPING_SIZE (16 * sizeof(size_t))
+
+/* Allocations at least this large are zeroed without going through
+ * the caches.
+ */
+#define ZERO_STREAMING_MIN (64 * 1024)
+
 /* Start a concurrent collection when free memory falls under this
  * many bytes.
  */
@@ -50,6 +74,12 @@ static void trimHeaps();
  */
 #define CONCURRENT_MIN_FREE (CONCURRENT_START + (128 << 10))
 
+/* Threads registering native allocations wait for a GC once the bytes
+ * registered since the last one reach this many times the threshold
+ * that starts a concurrent GC.
+ */
+#define NATIVE_BLOCK_FACTOR 4
+
 #define HS_BOILERPLATE() \
     do { \
         assert(gDvm.gcHeap != NULL); \
@@ -57,11 +87,52 @@ static void trimHeaps();
         assert(gHs == gDvm.gcHeap->heapSource); \
     } while (0)
 
+/*
+ * Small objects are allocated from size-class runs.  A run is one
+ * page taken from a heap's mspace and divided into equal-sized slots;
+ * the run header at the start of the page records which slots are in
+ * use.  Runs with at least one free slot are kept on their heap's
+ * partial list for the size class, and a run whose slots have all
+ * been freed goes back to the mspace.  Size classes are spaced by the
+ * allocation granularity so that every slot starts on a bitmap bit.
+ */
+#define SMALL_RUN_SIZE          SYSTEM_PAGE_SIZE
+#define SMALL_OBJECT_GRAIN      HB_OBJECT_ALIGNMENT
+#define SMALL_OBJECT_MAX        128
+#define SMALL_RUN_NUM_CLASSES   (SMALL_OBJECT_MAX / SMALL_OBJECT_GRAIN)
+#define SMALL_RUN_MAX_SLOTS     (SMALL_RUN_SIZE / SMALL_OBJECT_GRAIN)
+#define SMALL_RUN_BITMAP_WORDS  (SMALL_RUN_MAX_SLOTS / 32)
+
+struct SmallRun {
+    /* Links in the owning heap's partial list for this size class.
+     */
+    SmallRun *prev;
+    SmallRun *next;
+
+    u2 sizeClass;
+    u2 slotSize;
+    u2 numSlots;
+    u2 numFree;
+
+    /* One bit per slot, set when the slot is in use.  Bits past
+     * numSlots are always set.
+     */
+    u4 slotBits[SMALL_RUN_BITMAP_WORDS];
+};
+
+#define SMALL_RUN_HEADER_SIZE   ALIGN_UP(sizeof(SmallRun), SMALL_OBJECT_GRAIN)
+#define SMALL_RUN_SLOT_WORD(i_) ((i_) / 32)
+#define SMALL_RUN_SLOT_BIT(i_)  (0x80000000U >> ((i_) % 32))
+
 struct Heap {
     /* The mspace to allocate from.
      */
     mspace msp;
 
+    /* Size-class runs with free slots, by size class.
+     */
+    SmallRun *partialRuns[SMALL_RUN_NUM_CLASSES];
+
     /* The largest size that this heap is allowed to grow to.
      */
     size_t maximumSize;
@@ -96,13 +167,39 @@ struct Heap {
      * allocations requested via dvmHeapSourceMorecore.
      */
     char *brk;
+
+    /* Bumped whenever chunks of this heap are allocated, freed or
+     * trimmed, so a walker can tell whether its layout may have changed.
+     */
+    u4 generation;
 };
 
+struct HeapSource;
+
+/*
+ * A heap growth policy returns the size the active heap should have,
+ * given the size of its live set after a collection.
+ */
+typedef size_t GrowthPolicy(const HeapSource *hs, size_t liveSize);
+
 struct HeapSource {
     /* Target ideal heap utilization ratio; range 1..HEAP_UTILIZATION_MAX
      */
     size_t targetUtilization;
 
+    /* The growth policy selected with -XX:HeapGrowthPolicy.
+     */
+    GrowthPolicy *growthPolicy;
+
+    /* Measurements for the GC time growth policy, smoothed over
+     * recent collections.  The rate and the cost are zero until a
+     * collection has been measured.
+     */
+    u8 lastGcEndUsec;
+    size_t bytesAllocatedAfterGc;
+    double allocBytesPerUsec;
+    double gcUsecPerLiveByte;
+
     /* The starting heap size.
      */
     size_t startSize;
@@ -156,6 +253,12 @@ struct HeapSource {
      */
     bool sawZygote;
 
+    /* True once the zygote heap has been split off.  From then on it is
+     * immune to every collection, partial or not, in the zygote and in
+     * its children, and both bitmaps hold its live bits.
+     */
+    bool immuneZygoteHeap;
+
     /*
      * The base address of the virtual memory reservation.
      */
@@ -166,6 +269,29 @@ struct HeapSource {
      */
     size_t heapLength;
 
+    /*
+     * One byte per page of the reservation, non-zero when the page
+     * holds a size-class run.  NULL if size-class runs are disabled.
+     */
+    u1 *runMap;
+    size_t runMapLength;
+
+    /*
+     * One bit per page of the reservation, set while the page is known
+     * to be zero because it was given back to the system and nothing
+     * has been allocated on it since.  Allocations don't zero these
+     * pages again and trims don't release them again.
+     */
+    u4 *cleanPages;
+    size_t cleanPagesLength;
+
+    /*
+     * Large objects without references, placed directly after the
+     * heaps in the reservation.  Its base is NULL if the large object
+     * space is disabled.
+     */
+    LargeObjectSpace largeObjects;
+
     /*
      * The live object bitmap.
      */
@@ -177,12 +303,26 @@ struct HeapSource {
     HeapBitmap markBits;
 
     /*
-     * Native allocations.
+     * Objects allocated with ALLOC_NON_MOVING, which a compaction must
+     * leave in place.  Only kept when compaction is enabled.
+     */
+    HeapBitmap nonMovingBits;
+
+    /*
+     * Objects whose identity hash code has been taken, which a
+     * compaction moves along with their hash code.  Only kept when
+     * compaction is enabled.
      */
-    int32_t nativeBytesAllocated;
-    size_t nativeFootprintGCWatermark;
-    size_t nativeFootprintLimit;
-    bool nativeNeedToRunFinalization;
+    HeapBitmap hashedBits;
+
+    /*
+     * Native allocations registered through VMRuntime, in total and
+     * since the end of the last GC, and whether a concurrent GC has
+     * been asked for on their account since then.
+     */
+    volatile int32_t nativeBytesAllocated;
+    volatile int32_t nativeBytesSinceGc;
+    volatile int32_t nativeGcRequested;
 
     /*
      * State for the GC daemon.
@@ -193,10 +333,22 @@ struct HeapSource {
     pthread_mutex_t gcThreadMutex;
     pthread_cond_t gcThreadCond;
     bool gcThreadTrimNeeded;
+    volatile bool gcThreadCompactNeeded;
+    volatile bool gcThreadGcNeeded;
+    volatile bool gcThreadEnqueueNeeded;
 };
 
 #define hs2heap(hs_) (&((hs_)->heaps[0]))
 
+/*
+ * Returns the number of bytes allocated by the active heap, counting
+ * the large object space as part of it.
+ */
+static size_t activeBytesAllocated(const HeapSource *hs)
+{
+    return hs->heaps[0].bytesAllocated + hs->largeObjects.bytesAllocated;
+}
+
 /*
  * Returns true iff a soft limit is in effect for the active heap.
  */
@@ -265,6 +417,35 @@ static Heap *ptr2heap(const HeapSource *hs, const void *ptr)
     return NULL;
 }
 
+/*
+ * Returns the size-class run that <ptr> was allocated from, or NULL if
+ * <ptr> is an ordinary mspace chunk.
+ */
+static SmallRun *ptr2run(const HeapSource *hs, const void *ptr)
+{
+    if (hs->runMap == NULL || (const char *)ptr < hs->heapBase) {
+        return NULL;
+    }
+    size_t page = ((const char *)ptr - hs->heapBase) / SMALL_RUN_SIZE;
+    if (page >= hs->runMapLength || hs->runMap[page] == 0) {
+        return NULL;
+    }
+    return (SmallRun *)(hs->heapBase + page * SMALL_RUN_SIZE);
+}
+
+/*
+ * Returns the number of bytes of heap that <ptr> occupies, including
+ * any per-chunk overhead.
+ */
+static size_t allocationSize(const HeapSource *hs, const void *ptr)
+{
+    const SmallRun *run = ptr2run(hs, ptr);
+    if (run != NULL) {
+        return run->slotSize;
+    }
+    return mspace_usable_size(ptr) + HEAP_SOURCE_CHUNK_OVERHEAD;
+}
+
 /*
  * Functions to update heapSource->bytesAllocated when an object
  * is allocated or freed.  mspace_usable_size() will give
@@ -277,29 +458,37 @@ static void countAllocation(Heap *heap, const void *ptr)
 {
     assert(heap->bytesAllocated < mspace_footprint(heap->msp));
 
-    heap->bytesAllocated += mspace_usable_size(ptr) +
-            HEAP_SOURCE_CHUNK_OVERHEAD;
-    heap->objectsAllocated++;
     HeapSource* hs = gDvm.gcHeap->heapSource;
-    dvmHeapBitmapSetObjectBit(&hs->liveBits, ptr);
+    heap->bytesAllocated += allocationSize(hs, ptr);
+    heap->objectsAllocated++;
+    heap->generation++;
+    /* Threads bump-allocating from their TLABs set live bits without
+     * the heap lock, possibly in the same bitmap word.
+     */
+    dvmHeapBitmapAtomicSetObjectBit(&hs->liveBits, ptr);
 
     assert(heap->bytesAllocated < mspace_footprint(heap->msp));
 }
 
 static void countFree(Heap *heap, const void *ptr, size_t *numBytes)
 {
-    size_t delta = mspace_usable_size(ptr) + HEAP_SOURCE_CHUNK_OVERHEAD;
+    HeapSource* hs = gDvm.gcHeap->heapSource;
+    size_t delta = allocationSize(hs, ptr);
     assert(delta > 0);
     if (delta < heap->bytesAllocated) {
         heap->bytesAllocated -= delta;
     } else {
         heap->bytesAllocated = 0;
     }
-    HeapSource* hs = gDvm.gcHeap->heapSource;
     dvmHeapBitmapClearObjectBit(&hs->liveBits, ptr);
+    if (hs->nonMovingBits.bits != NULL) {
+        dvmHeapBitmapClearObjectBit(&hs->nonMovingBits, ptr);
+        dvmHeapBitmapClearObjectBit(&hs->hashedBits, ptr);
+    }
     if (heap->objectsAllocated > 0) {
         heap->objectsAllocated--;
     }
+    heap->generation++;
     *numBytes += delta;
 }
 
@@ -324,6 +513,54 @@ static mspace createMspace(void* begin, size_t morecoreStart, size_t startingSiz
     return msp;
 }
 
+static bool isPageClean(const HeapSource *hs, const void *addr)
+{
+    size_t page = ((const char *)addr - hs->heapBase) / SYSTEM_PAGE_SIZE;
+    return (hs->cleanPages[page / 32] & (1U << (page % 32))) != 0;
+}
+
+/*
+ * Marks the whole pages in [begin, end) as known to be zero.
+ */
+static void markPagesClean(HeapSource *hs, const void *begin, const void *end)
+{
+    size_t first = ((const char *)begin - hs->heapBase) / SYSTEM_PAGE_SIZE;
+    size_t last = ((const char *)end - hs->heapBase) / SYSTEM_PAGE_SIZE;
+    for (size_t page = first; page < last; page++) {
+        hs->cleanPages[page / 32] |= 1U << (page % 32);
+    }
+}
+
+/*
+ * Marks every page overlapping [begin, end) as possibly holding data.
+ */
+static void markPagesDirty(HeapSource *hs, const void *begin, const void *end)
+{
+    const char *lo = MAX((const char *)begin, hs->heapBase);
+    const char *hi = MIN((const char *)end, hs->heapBase + hs->heapLength);
+    if (lo >= hi) {
+        return;
+    }
+    size_t first = (lo - hs->heapBase) / SYSTEM_PAGE_SIZE;
+    size_t last = (hi - 1 - hs->heapBase) / SYSTEM_PAGE_SIZE;
+    for (size_t page = first; page <= last; page++) {
+        hs->cleanPages[page / 32] &= ~(1U << (page % 32));
+    }
+}
+
+/*
+ * Called for each chunk taken from an mspace.  Besides the chunk
+ * itself, dlmalloc writes to its header and, if it split the chunk off
+ * a larger one, to the remainder's bookkeeping just past its end.
+ */
+static void markChunkDirty(HeapSource *hs, const void *mem)
+{
+    const char *begin = (const char *)mem - CHUNK_BOOKKEEPING_SIZE;
+    const char *end = (const char *)mem + mspace_usable_size(mem) +
+                      CHUNK_BOOKKEEPING_SIZE;
+    markPagesDirty(hs, begin, end);
+}
+
 /*
  * Service request from DlMalloc to increase heap size.
  */
@@ -348,6 +585,8 @@ void* dvmHeapSourceMorecore(void* mspace, intptr_t increment)
             // Enforced by mspace_set_footprint_limit.
             assert(new_brk <= heap->limit);
             mprotect(original_brk, increment, PROT_READ | PROT_WRITE);
+            markPagesClean(gHs, (void *)ALIGN_UP_TO_PAGE_SIZE(original_brk),
+                           new_brk);
         } else {
             // Should never be asked for negative footprint (ie before base).
             assert(original_brk + increment > heap->base);
@@ -355,7 +594,11 @@ void* dvmHeapSourceMorecore(void* mspace, intptr_t increment)
             size_t size = -increment;
             madvise(new_brk, size, MADV_DONTNEED);
             mprotect(new_brk, size, PROT_NONE);
+            markPagesClean(gHs, (void *)ALIGN_UP_TO_PAGE_SIZE(new_brk),
+                           original_brk);
         }
+        // dlmalloc writes the top chunk's footer just below the new brk.
+        markPagesDirty(gHs, new_brk - CHUNK_BOOKKEEPING_SIZE, new_brk);
         // Update brk.
         heap->brk = new_brk;
     }
@@ -394,6 +637,17 @@ static bool remapNewHeap(HeapSource* hs, Heap* newHeap)
 {
   char* newHeapBase = newHeap->base;
   size_t rem_size = hs->heapBase + hs->heapLength - newHeapBase;
+  if (dvmHugePageSize() != 0) {
+    /* An ashmem region can't have huge pages, so stay anonymous */
+    void* addr = mmap(newHeapBase, rem_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (addr == MAP_FAILED) {
+      ALOGE("Unable to remap the new heap: %s", strerror(errno));
+      return false;
+    }
+    dvmAdviseHugePages(addr, rem_size);
+    return true;
+  }
   munmap(newHeapBase, rem_size);
   int fd = ashmem_create_region("dalvik-heap", rem_size);
   if (fd == -1) {
@@ -459,6 +713,10 @@ static bool addNewHeap(HeapSource *hs)
     if (heap.msp == NULL) {
         return false;
     }
+    /* The old heap may have given these pages back before the mspace
+     * header was written to them.
+     */
+    markPagesDirty(hs, heap.base, heap.brk);
 
     /* Don't let the soon-to-be-old heap grow any further.
      */
@@ -478,8 +736,9 @@ static bool addNewHeap(HeapSource *hs)
 
 /*
  * The garbage collection daemon.  Initiates a concurrent collection
- * when signaled.  Also periodically trims the heaps when a few seconds
- * have elapsed since the last concurrent GC.
+ * when signaled, or a compaction when one has been requested.  Also
+ * periodically trims the heaps when a few seconds have elapsed since
+ * the last concurrent GC.
  */
 static void *gcDaemonThread(void* arg)
 {
@@ -506,6 +765,17 @@ static void *gcDaemonThread(void* arg)
             continue;
         }
 
+        /*
+         * A wake-up that only hands over cleared references doesn't
+         * need the heap lock, let alone a collection.
+         */
+        if (gHs->gcThreadEnqueueNeeded && !gHs->gcThreadGcNeeded &&
+            !gHs->gcThreadCompactNeeded && !trim) {
+            gHs->gcThreadEnqueueNeeded = false;
+            dvmHeapEnqueueClearedReferences();
+            continue;
+        }
+
         dvmLockHeap();
         /*
          * Another thread may have started a concurrent garbage
@@ -514,16 +784,38 @@ static void *gcDaemonThread(void* arg)
          */
         if (!gDvm.gcHeap->gcRunning) {
             dvmChangeStatus(NULL, THREAD_RUNNING);
-            if (trim) {
-                trimHeaps();
-                gHs->gcThreadTrimNeeded = false;
+            if (gHs->gcThreadCompactNeeded) {
+                /* Give back the pages the compaction emptied right
+                 * away rather than after the idle delay.
+                 */
+                gHs->gcThreadCompactNeeded = false;
+                dvmCollectGarbageInternal(GC_COMPACT);
+                gHs->gcThreadTrimNeeded = !trimHeaps(true);
+            } else if (trim) {
+                if (trimHeaps(true)) {
+                    gHs->gcThreadTrimNeeded = false;
+                } else if (gHs->gcThreadGcNeeded &&
+                           !gDvm.gcHeap->gcRunning) {
+                    /* The trim gave way to a thread that wants a
+                     * collection; its signal came while we weren't
+                     * waiting.  The rest of the trim is retried after
+                     * the idle delay.
+                     */
+                    gHs->gcThreadGcNeeded = false;
+                    dvmCollectGarbageInternal(GC_CONCURRENT);
+                }
             } else {
+                gHs->gcThreadGcNeeded = false;
                 dvmCollectGarbageInternal(GC_CONCURRENT);
                 gHs->gcThreadTrimNeeded = true;
             }
             dvmChangeStatus(NULL, THREAD_VMWAIT);
         }
         dvmUnlockHeap();
+        if (gHs->gcThreadEnqueueNeeded) {
+            gHs->gcThreadEnqueueNeeded = false;
+            dvmHeapEnqueueClearedReferences();
+        }
     }
     dvmChangeStatus(NULL, THREAD_RUNNING);
     return NULL;
@@ -593,7 +885,7 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
     GcHeap *gcHeap = NULL;
     HeapSource *hs = NULL;
     mspace msp;
-    size_t length;
+    size_t length, largeLength;
     void *base;
 
     assert(gHs == NULL);
@@ -609,7 +901,16 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
      * among the heaps managed by the garbage collector.
      */
     length = ALIGN_UP_TO_PAGE_SIZE(maximumSize);
-    base = dvmAllocRegion(length, PROT_NONE, gDvm.zygote ? "dalvik-zygote" : "dalvik-heap");
+    /* The large object space follows the heaps in the same reservation
+     * so the bitmaps cover it too.  Large objects that don't fit in it
+     * fall back to the heaps.
+     */
+    largeLength = 0;
+    if (gDvm.largeObjectThreshold != 0) {
+        largeLength = ALIGN_UP_TO_PAGE_SIZE(maximumSize / 2);
+    }
+    base = dvmAllocHugeRegion(length + largeLength, PROT_NONE,
+                              gDvm.zygote ? "dalvik-zygote" : "dalvik-heap");
     if (base == NULL) {
         dvmAbort();
     }
@@ -635,6 +936,11 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
     }
 
     hs->targetUtilization = gDvm.heapTargetUtilization * HEAP_UTILIZATION_MAX;
+    if (gDvm.heapGrowthPolicy == kHeapGrowthPolicyGcTime) {
+        hs->growthPolicy = getGcTimeTarget;
+    } else {
+        hs->growthPolicy = getUtilizationTarget;
+    }
     hs->minFree = gDvm.heapMinFree;
     hs->maxFree = gDvm.heapMaxFree;
     hs->startSize = startSize;
@@ -645,9 +951,8 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
     hs->numHeaps = 0;
     hs->sawZygote = gDvm.zygote;
     hs->nativeBytesAllocated = 0;
-    hs->nativeFootprintGCWatermark = startSize;
-    hs->nativeFootprintLimit = startSize * 2;
-    hs->nativeNeedToRunFinalization = false;
+    hs->nativeBytesSinceGc = 0;
+    hs->nativeGcRequested = 0;
     hs->hasGcThread = false;
     hs->heapBase = (char *)base;
     hs->heapLength = length;
@@ -665,11 +970,13 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
         LOGE_HEAP("Can't add initial heap");
         dvmAbort();
     }
-    if (!dvmHeapBitmapInit(&hs->liveBits, base, length, "dalvik-bitmap-1")) {
+    if (!dvmHeapBitmapInit(&hs->liveBits, base, length + largeLength,
+                           "dalvik-bitmap-1")) {
         LOGE_HEAP("Can't create liveBits");
         dvmAbort();
     }
-    if (!dvmHeapBitmapInit(&hs->markBits, base, length, "dalvik-bitmap-2")) {
+    if (!dvmHeapBitmapInit(&hs->markBits, base, length + largeLength,
+                           "dalvik-bitmap-2")) {
         LOGE_HEAP("Can't create markBits");
         dvmHeapBitmapDelete(&hs->liveBits);
         dvmAbort();
@@ -680,6 +987,42 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
         dvmHeapBitmapDelete(&hs->liveBits);
         dvmAbort();
     }
+    if ((gDvm.backgroundCompaction || gDvm.zygoteCompaction) &&
+        !dvmHeapBitmapInit(&hs->nonMovingBits, base, length,
+                           "dalvik-bitmap-nonmoving")) {
+        LOGE_HEAP("Can't create nonMovingBits");
+        dvmAbort();
+    }
+    if ((gDvm.backgroundCompaction || gDvm.zygoteCompaction) &&
+        !dvmHeapBitmapInit(&hs->hashedBits, base, length,
+                           "dalvik-bitmap-hashed")) {
+        LOGE_HEAP("Can't create hashedBits");
+        dvmAbort();
+    }
+    if (gDvm.sizeClassAlloc) {
+        hs->runMapLength = length / SMALL_RUN_SIZE;
+        hs->runMap = (u1 *)dvmAllocRegion(hs->runMapLength,
+                                          PROT_READ | PROT_WRITE,
+                                          "dalvik-heap-runs");
+        if (hs->runMap == NULL) {
+            LOGE_HEAP("Can't create size-class run map");
+            dvmAbort();
+        }
+    }
+    hs->cleanPagesLength = ALIGN_UP(length / SYSTEM_PAGE_SIZE, 32) / 8;
+    hs->cleanPages = (u4 *)dvmAllocRegion(hs->cleanPagesLength,
+                                          PROT_READ | PROT_WRITE,
+                                          "dalvik-heap-clean-pages");
+    if (hs->cleanPages == NULL) {
+        LOGE_HEAP("Can't create clean page map");
+        dvmAbort();
+    }
+    if (largeLength != 0 &&
+        !dvmLargeObjectSpaceInit(&hs->largeObjects, (char *)base + length,
+                                 largeLength)) {
+        LOGE_HEAP("Can't create the large object space");
+        dvmAbort();
+    }
     gcHeap->markContext.bitmap = &hs->markBits;
     gcHeap->heapSource = hs;
 
@@ -708,19 +1051,93 @@ bool dvmHeapSourceStartupBeforeFork()
     assert(gDvm.zygote);
 
     if (!gDvm.newZygoteHeapAllocated) {
+        /* TLABs belong to the heap they were carved from, which is
+         * about to stop being the active heap.
+         */
+        dvmLockHeap();
+        dvmHeapSourceRetireAllTlabs();
+        dvmUnlockHeap();
        /* Ensure heaps are trimmed to minimize footprint pre-fork.
         */
-        trimHeaps();
+        trimHeaps(false);
         /* Create a new heap for post-fork zygote allocations.  We only
          * try once, even if it fails.
          */
         ALOGV("Splitting out new zygote heap");
         gDvm.newZygoteHeapAllocated = true;
-        return addNewHeap(hs);
+        if (!addNewHeap(hs)) {
+            return false;
+        }
+        /* Give the mark bits their copy of the zygote heap's live bits
+         * now, once.  Neither copy is written again, so the bitmap pages
+         * stay shared with the children along with the heap.
+         */
+        dvmLockHeap();
+        dvmMarkImmuneObjects(hs->heaps[0].base);
+        hs->immuneZygoteHeap = true;
+        dvmUnlockHeap();
     }
     return true;
 }
 
+/*
+ * The kernel's pagemap has one little-endian word per page; a resident
+ * page that no other process maps has the "exclusive" bit set.
+ */
+#define PAGEMAP_PRESENT     (1ULL << 63)
+#define PAGEMAP_EXCLUSIVE   (1ULL << 56)
+
+void dvmHeapSourceLogZygoteSharing()
+{
+    HeapSource *hs = gHs; // use a local to avoid the implicit "volatile"
+
+    HS_BOILERPLATE();
+
+    if (gDvm.zygote || hs->numHeaps < 2) {
+        return;
+    }
+
+    /* The zygote's heap is the oldest one, and no longer grows.
+     */
+    const Heap *heap = &hs->heaps[hs->numHeaps - 1];
+    uintptr_t start = (uintptr_t)heap->base;
+    uintptr_t end = ALIGN_UP_TO_PAGE_SIZE((uintptr_t)heap->brk);
+
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        LOGW_HEAP("Unable to open pagemap: %s", strerror(errno));
+        return;
+    }
+    size_t shared = 0, copied = 0;
+    u8 entries[512];
+    off_t offset = (start / SYSTEM_PAGE_SIZE) * sizeof(u8);
+    for (uintptr_t addr = start; addr < end; ) {
+        size_t count = MIN(sizeof(entries) / sizeof(entries[0]),
+                           (end - addr) / SYSTEM_PAGE_SIZE);
+        ssize_t got = pread(fd, entries, count * sizeof(u8), offset);
+        if (got <= 0) {
+            break;
+        }
+        count = got / sizeof(u8);
+        for (size_t i = 0; i < count; i++) {
+            if (entries[i] & PAGEMAP_PRESENT) {
+                if (entries[i] & PAGEMAP_EXCLUSIVE) {
+                    copied++;
+                } else {
+                    shared++;
+                }
+            }
+        }
+        addr += count * SYSTEM_PAGE_SIZE;
+        offset += count * sizeof(u8);
+    }
+    close(fd);
+
+    ALOGD("Zygote heap: %zdK shared, %zdK copied, of %zdK",
+          shared * SYSTEM_PAGE_SIZE / 1024, copied * SYSTEM_PAGE_SIZE / 1024,
+          (size_t)(end - start) / 1024);
+}
+
 void dvmHeapSourceThreadShutdown()
 {
     if (gDvm.gcHeap != NULL && gDvm.concurrentMarkSweep) {
@@ -740,8 +1157,16 @@ void dvmHeapSourceShutdown(GcHeap **gcHeap)
         HeapSource *hs = (*gcHeap)->heapSource;
         dvmHeapBitmapDelete(&hs->liveBits);
         dvmHeapBitmapDelete(&hs->markBits);
+        dvmHeapBitmapDelete(&hs->nonMovingBits);
+        dvmHeapBitmapDelete(&hs->hashedBits);
         freeMarkStack(&(*gcHeap)->markContext.stack);
-        munmap(hs->heapBase, hs->heapLength);
+        if (hs->runMap != NULL) {
+            munmap(hs->runMap, ALIGN_UP_TO_PAGE_SIZE(hs->runMapLength));
+        }
+        munmap(hs->cleanPages, ALIGN_UP_TO_PAGE_SIZE(hs->cleanPagesLength));
+        size_t largeLength = hs->largeObjects.length;
+        dvmLargeObjectSpaceDelete(&hs->largeObjects);
+        munmap(hs->heapBase, hs->heapLength + largeLength);
         free(hs);
         gHs = NULL;
         free(*gcHeap);
@@ -759,7 +1184,8 @@ void *dvmHeapSourceGetBase()
 
 /*
  * Returns a high water mark, between base and limit all objects must have been
- * allocated.
+ * allocated.  The large object space lies above the limit; since its objects
+ * hold no references, the card table need not cover it.
  */
 void *dvmHeapSourceGetLimit()
 {
@@ -799,15 +1225,24 @@ size_t dvmHeapSourceGetValue(HeapSourceValueSpec spec, size_t perHeapStats[],
         case HS_FOOTPRINT:
             value = heap->brk - heap->base;
             assert(value == mspace_footprint(heap->msp));
+            if (i == 0) {
+                value += hs->largeObjects.bytesAllocated;
+            }
             break;
         case HS_ALLOWED_FOOTPRINT:
             value = mspace_footprint_limit(heap->msp);
             break;
         case HS_BYTES_ALLOCATED:
             value = heap->bytesAllocated;
+            if (i == 0) {
+                value += hs->largeObjects.bytesAllocated;
+            }
             break;
         case HS_OBJECTS_ALLOCATED:
             value = heap->objectsAllocated;
+            if (i == 0) {
+                value += hs->largeObjects.objectsAllocated;
+            }
             break;
         default:
             // quiet gcc
@@ -834,6 +1269,25 @@ void dvmHeapSourceGetRegions(uintptr_t *base, uintptr_t *max, size_t numHeaps)
     }
 }
 
+/*
+ * Gets the range of the large object space that may hold objects, for
+ * the sweep.  Returns false if there is nothing to sweep there.
+ */
+bool dvmHeapSourceGetLargeObjectRegion(uintptr_t *base, uintptr_t *max)
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    const LargeObjectSpace *los = &hs->largeObjects;
+    if (los->base == NULL || los->brk == los->base) {
+        return false;
+    }
+    *base = (uintptr_t)los->base;
+    *max = MIN((uintptr_t)los->brk - 1, hs->markBits.max);
+    return *max >= *base;
+}
+
 /*
  * Get the bitmap representing all live objects.
  */
@@ -861,19 +1315,42 @@ void dvmHeapSourceSwapBitmaps()
     gHs->markBits = tmp;
 }
 
+/*
+ * Returns the lowest address whose bits a collection may change.
+ */
+static uintptr_t threatenedBitsBase(const HeapSource *hs)
+{
+    if (hs->immuneZygoteHeap) {
+        return (uintptr_t)hs->heaps[0].base;
+    }
+    return hs->markBits.base;
+}
+
 void dvmHeapSourceZeroMarkBitmap()
 {
     HS_BOILERPLATE();
 
-    dvmHeapBitmapZero(&gHs->markBits);
+    dvmHeapBitmapZeroFrom(&gHs->markBits, threatenedBitsBase(gHs));
+}
+
+void dvmHeapSourceCopyLiveToMarkBitmap()
+{
+    HS_BOILERPLATE();
+
+    dvmHeapBitmapCopyFrom(&gHs->markBits, &gHs->liveBits,
+                          threatenedBitsBase(gHs));
 }
 
 void dvmMarkImmuneObjects(const char *immuneLimit)
 {
     /*
      * Copy the contents of the live bit vector for immune object
-     * range into the mark bit vector.
+     * range into the mark bit vector.  Once the zygote heap is split
+     * off, both always hold them.
      */
+    if (gHs->immuneZygoteHeap) {
+        return;
+    }
     /* The only values generated by dvmHeapSourceGetImmuneLimit() */
     assert(immuneLimit == gHs->heaps[0].base ||
            immuneLimit == NULL);
@@ -906,124 +1383,293 @@ void dvmMarkImmuneObjects(const char *immuneLimit)
 }
 
 /*
- * Allocates <n> bytes of zeroed data.
+ * Check to see if a concurrent GC should be initiated.
  */
-void* dvmHeapSourceAlloc(size_t n)
+static void checkConcurrentStart(HeapSource *hs, const Heap *heap)
 {
-    HS_BOILERPLATE();
-
-    HeapSource *hs = gHs;
-    Heap* heap = hs2heap(hs);
-    if (heap->bytesAllocated + n > hs->softLimit) {
-        /*
-         * This allocation would push us over the soft limit; act as
-         * if the heap is full.
-         */
-        LOGV_HEAP("softLimit of %zd.%03zdMB hit for %zd-byte allocation",
-                  FRACTIONAL_MB(hs->softLimit), n);
-        return NULL;
-    }
-    void* ptr;
-    if (gDvm.lowMemoryMode) {
-        /* This is only necessary because mspace_calloc always memsets the
-         * allocated memory to 0. This is bad for memory usage since it leads
-         * to dirty zero pages. If low memory mode is enabled, we use
-         * mspace_malloc which doesn't memset the allocated memory and madvise
-         * the page aligned region back to the kernel.
-         */
-        ptr = mspace_malloc(heap->msp, n);
-        if (ptr == NULL) {
-            return NULL;
-        }
-        uintptr_t zero_begin = (uintptr_t)ptr;
-        uintptr_t zero_end = (uintptr_t)ptr + n;
-        /* Calculate the page aligned region.
-         */
-        uintptr_t begin = ALIGN_UP_TO_PAGE_SIZE(zero_begin);
-        uintptr_t end = zero_end & ~(uintptr_t)(SYSTEM_PAGE_SIZE - 1);
-        /* If our allocation spans more than one page, we attempt to madvise.
-         */
-        if (begin < end) {
-            /* madvise the page aligned region to kernel.
-             */
-            madvise((void*)begin, end - begin, MADV_DONTNEED);
-            /* Zero the region after the page aligned region.
-             */
-            memset((void*)end, 0, zero_end - end);
-            /* Zero out the region before the page aligned region.
-             */
-            zero_end = begin;
-        }
-        memset((void*)zero_begin, 0, zero_end - zero_begin);
-    } else {
-        ptr = mspace_calloc(heap->msp, 1, n);
-        if (ptr == NULL) {
-            return NULL;
-        }
-    }
-
-    countAllocation(heap, ptr);
-    /*
-     * Check to see if a concurrent GC should be initiated.
-     */
     if (gDvm.gcHeap->gcRunning || !hs->hasGcThread) {
         /*
          * The garbage collector thread is already running or has yet
          * to be started.  Do nothing.
          */
-        return ptr;
+        return;
     }
-    if (heap->bytesAllocated > heap->concurrentStartBytes) {
+    if (activeBytesAllocated(hs) > heap->concurrentStartBytes) {
         /*
          * We have exceeded the allocation threshold.  Wake up the
          * garbage collector.
          */
-        dvmSignalCond(&gHs->gcThreadCond);
+        hs->gcThreadGcNeeded = true;
+        dvmSignalCond(&hs->gcThreadCond);
     }
-    return ptr;
 }
 
-/* Remove any hard limits, try to allocate, and shrink back down.
- * Last resort when trying to allocate an object.
- */
-static void* heapAllocAndGrow(HeapSource *hs, Heap *heap, size_t n)
+static inline u1 *runSlots(SmallRun *run)
 {
-    /* Grow as much as possible, but don't let the real footprint
-     * go over the absolute max.
-     */
-    size_t max = heap->maximumSize;
+    return (u1 *)run + SMALL_RUN_HEADER_SIZE;
+}
 
-    mspace_set_footprint_limit(heap->msp, max);
-    void* ptr = dvmHeapSourceAlloc(n);
+static void pushPartialRun(Heap *heap, SmallRun *run)
+{
+    SmallRun **head = &heap->partialRuns[run->sizeClass];
+    run->prev = NULL;
+    run->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = run;
+    }
+    *head = run;
+}
 
-    /* Shrink back down as small as possible.  Our caller may
-     * readjust max_allowed to a more appropriate value.
-     */
-    mspace_set_footprint_limit(heap->msp,
-                               mspace_footprint(heap->msp));
-    return ptr;
+static void unlinkPartialRun(Heap *heap, SmallRun *run)
+{
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        assert(heap->partialRuns[run->sizeClass] == run);
+        heap->partialRuns[run->sizeClass] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    run->prev = run->next = NULL;
 }
 
 /*
- * Allocates <n> bytes of zeroed data, growing as much as possible
- * if necessary.
+ * Takes a page from the heap's mspace and formats it as an empty run
+ * of the given size class.  Returns NULL if the mspace is full.
  */
-void* dvmHeapSourceAllocAndGrow(size_t n)
+static SmallRun *newSmallRun(HeapSource *hs, Heap *heap, size_t sizeClass)
 {
-    HS_BOILERPLATE();
-
-    HeapSource *hs = gHs;
-    Heap* heap = hs2heap(hs);
-    void* ptr = dvmHeapSourceAlloc(n);
-    if (ptr != NULL) {
-        return ptr;
+    void *mem = mspace_memalign(heap->msp, SMALL_RUN_SIZE, SMALL_RUN_SIZE);
+    if (mem == NULL) {
+        return NULL;
+    }
+    assert(((uintptr_t)mem & (SMALL_RUN_SIZE - 1)) == 0);
+    SmallRun *run = (SmallRun *)mem;
+    memset(run, 0, sizeof(*run));
+    run->sizeClass = sizeClass;
+    run->slotSize = (sizeClass + 1) * SMALL_OBJECT_GRAIN;
+    run->numSlots = (SMALL_RUN_SIZE - SMALL_RUN_HEADER_SIZE) / run->slotSize;
+    run->numFree = run->numSlots;
+    for (size_t i = run->numSlots; i < SMALL_RUN_MAX_SLOTS; i++) {
+        run->slotBits[SMALL_RUN_SLOT_WORD(i)] |= SMALL_RUN_SLOT_BIT(i);
     }
+    hs->runMap[((char *)mem - hs->heapBase) / SMALL_RUN_SIZE] = 1;
+    markChunkDirty(hs, mem);
+    pushPartialRun(heap, run);
+    return run;
+}
 
-    size_t oldIdealSize = hs->idealSize;
-    if (isSoftLimited(hs)) {
-        /* We're soft-limited.  Try removing the soft limit to
-         * see if we can allocate without actually growing.
-         */
+/*
+ * Allocates a zeroed slot of at least <n> bytes from a size-class
+ * run, making a new run if the class has no partial runs.
+ */
+static void *allocRunSlot(HeapSource *hs, Heap *heap, size_t n)
+{
+    size_t sizeClass = (n == 0) ? 0 : (n - 1) / SMALL_OBJECT_GRAIN;
+    assert(sizeClass < SMALL_RUN_NUM_CLASSES);
+    SmallRun *run = heap->partialRuns[sizeClass];
+    if (run == NULL) {
+        run = newSmallRun(hs, heap, sizeClass);
+        if (run == NULL) {
+            return NULL;
+        }
+    }
+    assert(run->numFree > 0);
+    size_t i = 0;
+    while (run->slotBits[i] == ~0U) {
+        i++;
+        assert(i < SMALL_RUN_BITMAP_WORDS);
+    }
+    size_t bit = CLZ(~run->slotBits[i]);
+    run->slotBits[i] |= 0x80000000U >> bit;
+    if (--run->numFree == 0) {
+        unlinkPartialRun(heap, run);
+    }
+    u1 *ptr = runSlots(run) + (i * 32 + bit) * run->slotSize;
+    memset(ptr, 0, run->slotSize);
+    return ptr;
+}
+
+/*
+ * Returns a slot to its run.  An empty run is given back to the mspace
+ * unless it is the only partial run of its class, which keeps a
+ * single object being allocated and freed from churning pages.
+ */
+static void freeRunSlot(HeapSource *hs, Heap *heap, SmallRun *run,
+                        const void *ptr)
+{
+    size_t slot = ((const u1 *)ptr - runSlots(run)) / run->slotSize;
+    assert(slot < run->numSlots);
+    assert((run->slotBits[SMALL_RUN_SLOT_WORD(slot)] &
+            SMALL_RUN_SLOT_BIT(slot)) != 0);
+    run->slotBits[SMALL_RUN_SLOT_WORD(slot)] &= ~SMALL_RUN_SLOT_BIT(slot);
+    if (run->numFree++ == 0) {
+        pushPartialRun(heap, run);
+    }
+    if (run->numFree == run->numSlots &&
+        (run->prev != NULL || run->next != NULL)) {
+        unlinkPartialRun(heap, run);
+        hs->runMap[((char *)run - hs->heapBase) / SMALL_RUN_SIZE] = 0;
+        mspace_free(heap->msp, run);
+    }
+}
+
+/*
+ * Zeroes [begin, end) with stores that bypass the caches, so that a
+ * large new array doesn't evict everything else on its way in.  Where
+ * there are no such stores this is just memset().
+ */
+static void zeroStreaming(char *begin, char *end)
+{
+#if defined(__SSE2__)
+    char *lineBegin = (char *)ALIGN_UP(begin, 64);
+    char *lineEnd = (char *)ALIGN_DOWN(end, 64);
+    memset(begin, 0, lineBegin - begin);
+    __m128i zero = _mm_setzero_si128();
+    for (char *p = lineBegin; p < lineEnd; p += 64) {
+        _mm_stream_si128((__m128i *)p, zero);
+        _mm_stream_si128((__m128i *)(p + 16), zero);
+        _mm_stream_si128((__m128i *)(p + 32), zero);
+        _mm_stream_si128((__m128i *)(p + 48), zero);
+    }
+    /* Order the streaming stores before the object is published. */
+    _mm_sfence();
+    memset(lineEnd, 0, end - lineEnd);
+#else
+    memset(begin, 0, end - begin);
+#endif
+}
+
+/*
+ * Zeroes [begin, end).  In low memory mode the whole pages are given
+ * back to the kernel instead, as writing zeroes to them would only
+ * make them dirty.
+ */
+static void zeroRange(char *begin, char *end)
+{
+    if (gDvm.lowMemoryMode) {
+        char *pageBegin = (char *)ALIGN_UP_TO_PAGE_SIZE(begin);
+        char *pageEnd = (char *)ALIGN_DOWN_TO_PAGE_SIZE(end);
+        if (pageBegin < pageEnd) {
+            madvise(pageBegin, pageEnd - pageBegin, MADV_DONTNEED);
+            memset(pageEnd, 0, end - pageEnd);
+            end = pageBegin;
+        }
+    } else if ((size_t)(end - begin) >= ZERO_STREAMING_MIN) {
+        zeroStreaming(begin, end);
+        return;
+    }
+    memset(begin, 0, end - begin);
+}
+
+/*
+ * Zeroes the first <n> bytes of a chunk just taken from an mspace,
+ * skipping the whole pages that are known to be zero already.  Must be
+ * called before the chunk's pages are marked dirty.
+ */
+static void zeroChunk(HeapSource *hs, void *mem, size_t n)
+{
+    char *begin = (char *)mem;
+    char *end = begin + n;
+    char *page = (char *)ALIGN_UP_TO_PAGE_SIZE(begin);
+    char *pageEnd = (char *)ALIGN_DOWN_TO_PAGE_SIZE(end);
+    while (page < pageEnd) {
+        if (!isPageClean(hs, page)) {
+            page += SYSTEM_PAGE_SIZE;
+            continue;
+        }
+        zeroRange(begin, page);
+        while (page < pageEnd && isPageClean(hs, page)) {
+            page += SYSTEM_PAGE_SIZE;
+        }
+        begin = page;
+    }
+    zeroRange(begin, end);
+}
+
+/*
+ * Allocates <n> bytes of zeroed data.
+ */
+void* dvmHeapSourceAlloc(size_t n)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    Heap* heap = hs2heap(hs);
+    if (activeBytesAllocated(hs) + n > hs->softLimit) {
+        /*
+         * This allocation would push us over the soft limit; act as
+         * if the heap is full.
+         */
+        LOGV_HEAP("softLimit of %zd.%03zdMB hit for %zd-byte allocation",
+                  FRACTIONAL_MB(hs->softLimit), n);
+        return NULL;
+    }
+    void* ptr;
+    if (hs->runMap != NULL && n <= SMALL_OBJECT_MAX) {
+        ptr = allocRunSlot(hs, heap, n);
+        if (ptr == NULL) {
+            return NULL;
+        }
+    } else {
+        /* Not mspace_calloc, which would write to every page of the
+         * chunk, including the ones still zero since the last trim.
+         */
+        ptr = mspace_malloc(heap->msp, n);
+        if (ptr == NULL) {
+            return NULL;
+        }
+        zeroChunk(hs, ptr, n);
+        markChunkDirty(hs, ptr);
+    }
+
+    countAllocation(heap, ptr);
+    checkConcurrentStart(hs, heap);
+    return ptr;
+}
+
+/* Remove any hard limits, try to allocate, and shrink back down.
+ * Last resort when trying to allocate an object.
+ */
+static void* heapAllocAndGrow(HeapSource *hs, Heap *heap, size_t n)
+{
+    /* Grow as much as possible, but don't let the real footprint
+     * go over the absolute max.
+     */
+    size_t max = heap->maximumSize;
+
+    mspace_set_footprint_limit(heap->msp, max);
+    void* ptr = dvmHeapSourceAlloc(n);
+
+    /* Shrink back down as small as possible.  Our caller may
+     * readjust max_allowed to a more appropriate value.
+     */
+    mspace_set_footprint_limit(heap->msp,
+                               mspace_footprint(heap->msp));
+    return ptr;
+}
+
+/*
+ * Allocates <n> bytes of zeroed data, growing as much as possible
+ * if necessary.
+ */
+void* dvmHeapSourceAllocAndGrow(size_t n)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    Heap* heap = hs2heap(hs);
+    void* ptr = dvmHeapSourceAlloc(n);
+    if (ptr != NULL) {
+        return ptr;
+    }
+
+    size_t oldIdealSize = hs->idealSize;
+    if (isSoftLimited(hs)) {
+        /* We're soft-limited.  Try removing the soft limit to
+         * see if we can allocate without actually growing.
+         */
         hs->softLimit = SIZE_MAX;
         ptr = dvmHeapSourceAlloc(n);
         if (ptr != NULL) {
@@ -1054,6 +1700,279 @@ void* dvmHeapSourceAllocAndGrow(size_t n)
     return ptr;
 }
 
+/*
+ * Allocates <n> bytes of zeroed data for an object that holds no
+ * references, using the large object space when there is one.  If
+ * <grow> is set, the soft limit is ignored as it is by
+ * dvmHeapSourceAllocAndGrow().
+ *
+ * The zygote keeps its large objects in the heaps, where they become
+ * part of the shared zygote heap, because a partial collection in a
+ * child would not know which large objects the zygote heap refers to.
+ */
+void* dvmHeapSourceAllocLarge(size_t n, bool grow)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    Heap *heap = hs2heap(hs);
+    LargeObjectSpace *los = &hs->largeObjects;
+    if (los->base == NULL || gDvm.zygote) {
+        return grow ? dvmHeapSourceAllocAndGrow(n) : dvmHeapSourceAlloc(n);
+    }
+
+    /* The large object space shares the active heap's budget.  Never
+     * let the two together take more than the active heap may.
+     */
+    size_t length = ALIGN_UP_TO_PAGE_SIZE(n);
+    if (mspace_footprint(heap->msp) + los->bytesAllocated + length >
+            heap->maximumSize) {
+        return NULL;
+    }
+    if (!grow && activeBytesAllocated(hs) + length > getAllocLimit(hs)) {
+        return NULL;
+    }
+
+    void *ptr = dvmLargeObjectSpaceAlloc(los, n);
+    if (ptr == NULL) {
+        /* Out of address space; the heaps may still have room. */
+        return grow ? dvmHeapSourceAllocAndGrow(n) : dvmHeapSourceAlloc(n);
+    }
+    dvmHeapBitmapAtomicSetObjectBit(&hs->liveBits, ptr);
+    if (grow) {
+        snapIdealFootprint();
+    }
+    checkConcurrentStart(hs, heap);
+    return ptr;
+}
+
+/*
+ * Thread-local allocation buffers.
+ *
+ * A TLAB is one chunk taken from the active mspace under the heap lock
+ * and then carved up by its owning thread without the lock.  Every
+ * object carved out of it gets a proper dlmalloc in-use chunk header,
+ * and the unused tail is always kept formatted as a single in-use
+ * chunk, so the sweep can free TLAB objects one at a time and heap
+ * walks see a consistent chunk list.  Retiring a TLAB frees the tail.
+ *
+ * The whole chunk is counted in bytesAllocated when the TLAB is
+ * refilled, and the unused tail is subtracted again when it is
+ * retired.  Objects are counted when the TLAB is retired.
+ *
+ * TLABs only exist while no collection is running.  They are retired
+ * once the GC has suspended all threads and are not refilled until
+ * it completes, so the sweep never races with a lock-free allocation.
+ */
+
+/* Mirror dlmalloc's chunk layout; see malloc.c. */
+#define TLAB_PINUSE_BIT     ((size_t)1)
+#define TLAB_CINUSE_BIT     ((size_t)2)
+#define TLAB_CHUNK_ALIGN    (2 * sizeof(void *))
+#define TLAB_MIN_CHUNK      ALIGN_UP(4 * sizeof(size_t), TLAB_CHUNK_ALIGN)
+
+/* Requests larger than this always go through the mspace.
+ */
+#define TLAB_MAX_OBJECT_SIZE 512
+
+/*
+ * Returns a pointer to the dlmalloc "head" word of the chunk whose
+ * payload begins at <mem>.
+ */
+static inline size_t *tlabChunkHead(u1 *mem)
+{
+    return (size_t *)(mem - HEAP_SOURCE_CHUNK_OVERHEAD);
+}
+
+/*
+ * Returns the size of the chunk dlmalloc would use for an <n> byte
+ * request.
+ */
+static inline size_t tlabChunkSize(size_t n)
+{
+    size_t size = ALIGN_UP(n + HEAP_SOURCE_CHUNK_OVERHEAD, TLAB_CHUNK_ALIGN);
+    return size < TLAB_MIN_CHUNK ? TLAB_MIN_CHUNK : size;
+}
+
+static inline bool isTlabCandidate(const Thread *self, size_t n)
+{
+    return self != NULL && gDvm.tlabSize != 0 && n <= TLAB_MAX_OBJECT_SIZE;
+}
+
+/*
+ * Carves a chunk of <size> bytes, as computed by tlabChunkSize(), off
+ * the front of the calling thread's TLAB.  Returns NULL if it does not
+ * fit, which includes the thread having no TLAB.
+ */
+static void *carveTlabChunk(HeapSource *hs, Thread *self, size_t size)
+{
+    u1 *top = self->tlabTop;
+    size_t remaining = self->tlabEnd - top;
+    if (size > remaining) {
+        return NULL;
+    }
+    if (remaining - size < TLAB_MIN_CHUNK) {
+        /* The leftover could not form a chunk; hand it to this object. */
+        size = remaining;
+    }
+    memset(top, 0, size - HEAP_SOURCE_CHUNK_OVERHEAD);
+    /* Format the new tail before shrinking the chunk in front of it,
+     * so a concurrent walk of the mspace always sees valid chunks.
+     */
+    if (size < remaining) {
+        *tlabChunkHead(top + size) =
+            (remaining - size) | TLAB_PINUSE_BIT | TLAB_CINUSE_BIT;
+    }
+    size_t *head = tlabChunkHead(top);
+    *head = size | (*head & TLAB_PINUSE_BIT) | TLAB_CINUSE_BIT;
+    dvmHeapBitmapAtomicSetObjectBit(&hs->liveBits, top);
+    self->tlabTop = top + size;
+    self->tlabObjects++;
+    return top;
+}
+
+/*
+ * Carves an <n> byte object off the front of the calling thread's
+ * TLAB.  Returns NULL if it does not fit.
+ */
+static void *carveTlab(HeapSource *hs, Thread *self, size_t n)
+{
+    return carveTlabChunk(hs, self, tlabChunkSize(n));
+}
+
+/*
+ * Returns the unused part of a thread's TLAB to the mspace it came
+ * from.  The caller must hold the heap lock.
+ */
+static void retireTlab(HeapSource *hs, Thread *thread)
+{
+    u1 *top = thread->tlabTop;
+    if (top == NULL) {
+        return;
+    }
+    Heap *heap = ptr2heap(hs, top - HEAP_SOURCE_CHUNK_OVERHEAD);
+    assert(heap != NULL);
+    size_t remaining = thread->tlabEnd - top;
+    if (remaining != 0) {
+        assert(*tlabChunkHead(top) & TLAB_CINUSE_BIT);
+        assert((*tlabChunkHead(top) & ~(TLAB_CHUNK_ALIGN - 1)) == remaining);
+        mspace_free(heap->msp, top);
+        if (remaining < heap->bytesAllocated) {
+            heap->bytesAllocated -= remaining;
+        } else {
+            heap->bytesAllocated = 0;
+        }
+    }
+    heap->objectsAllocated += thread->tlabObjects;
+    heap->generation++;
+    thread->tlabTop = NULL;
+    thread->tlabEnd = NULL;
+    thread->tlabObjects = 0;
+}
+
+/*
+ * Allocates <n> bytes of zeroed data from the calling thread's TLAB
+ * without taking the heap lock.  Returns NULL if the request is not
+ * eligible or does not fit, in which case the caller should fall back
+ * to the locked path.
+ */
+void* dvmHeapSourceAllocTlab(Thread *self, size_t n)
+{
+    /* A thread that is not running may be treated as suspended by the
+     * GC, which could be retiring its TLAB right now.
+     */
+    if (!isTlabCandidate(self, n) || self->status != THREAD_RUNNING) {
+        return NULL;
+    }
+    return carveTlab(gHs, self, n);
+}
+
+size_t dvmHeapSourceTlabChunkSize(size_t n)
+{
+    if (gDvm.tlabSize == 0 || n > TLAB_MAX_OBJECT_SIZE) {
+        return 0;
+    }
+    return tlabChunkSize(n);
+}
+
+void* dvmHeapSourceAllocTlabChunk(Thread *self, size_t chunkSize)
+{
+    assert(self->status == THREAD_RUNNING);
+    return carveTlabChunk(gHs, self, chunkSize);
+}
+
+/*
+ * Retires the calling thread's TLAB, takes a new one from the active
+ * heap, and allocates <n> bytes of zeroed data from it.  Returns NULL
+ * if the request is not eligible or there is not enough room for a new
+ * TLAB.  The caller must hold the heap lock.
+ */
+void* dvmHeapSourceAllocTlabRefill(Thread *self, size_t n)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    if (!isTlabCandidate(self, n) || gDvm.gcHeap->gcRunning) {
+        return NULL;
+    }
+    retireTlab(hs, self);
+
+    Heap *heap = hs2heap(hs);
+    size_t length = gDvm.tlabSize;
+    if (activeBytesAllocated(hs) + length > hs->softLimit) {
+        /* Leave the remaining space for the general allocator, which
+         * knows how to grow the heap or collect.
+         */
+        return NULL;
+    }
+    u1 *mem = (u1 *)mspace_malloc(heap->msp,
+                                  length - HEAP_SOURCE_CHUNK_OVERHEAD);
+    if (mem == NULL) {
+        return NULL;
+    }
+    markChunkDirty(hs, mem);
+    size_t chunkSize = mspace_usable_size(mem) + HEAP_SOURCE_CHUNK_OVERHEAD;
+    heap->bytesAllocated += chunkSize;
+    heap->generation++;
+    self->tlabTop = mem;
+    self->tlabEnd = mem + chunkSize;
+    /* Carve the first object while we still hold the lock.  Its header
+     * is the only one in this TLAB that dlmalloc may update on behalf
+     * of a neighboring chunk.
+     */
+    void *ptr = carveTlab(hs, self, n);
+    assert(ptr != NULL);
+    checkConcurrentStart(hs, heap);
+    return ptr;
+}
+
+/*
+ * Retires a thread's TLAB.  The caller must hold the heap lock, and
+ * the thread must be the caller or be suspended.
+ */
+void dvmHeapSourceRetireTlab(Thread *thread)
+{
+    HS_BOILERPLATE();
+
+    retireTlab(gHs, thread);
+}
+
+/*
+ * Retires the TLABs of every thread.  The caller must hold the heap
+ * lock and all other threads must be suspended.
+ */
+void dvmHeapSourceRetireAllTlabs()
+{
+    HS_BOILERPLATE();
+
+    dvmLockThreadList(dvmThreadSelf());
+    for (Thread *thread = gDvm.threadList; thread != NULL;
+         thread = thread->next) {
+        retireTlab(gHs, thread);
+    }
+    dvmUnlockThreadList();
+}
+
 /*
  * Frees the first numPtrs objects in the ptrs list and returns the
  * amount of reclaimed storage. The list must contain addresses all in
@@ -1070,8 +1989,17 @@ size_t dvmHeapSourceFreeList(size_t numPtrs, void **ptrs)
 
     assert(ptrs != NULL);
     assert(*ptrs != NULL);
-    Heap* heap = ptr2heap(gHs, *ptrs);
     size_t numBytes = 0;
+    LargeObjectSpace *los = &gHs->largeObjects;
+    if (dvmLargeObjectSpaceContains(los, *ptrs)) {
+        for (size_t i = 0; i < numPtrs; i++) {
+            assert(dvmLargeObjectSpaceContains(los, ptrs[i]));
+            dvmHeapBitmapClearObjectBit(&gHs->liveBits, ptrs[i]);
+            numBytes += dvmLargeObjectSpaceFree(los, ptrs[i]);
+        }
+        return numBytes;
+    }
+    Heap* heap = ptr2heap(gHs, *ptrs);
     if (heap != NULL) {
         mspace msp = heap->msp;
         // Calling mspace_free on shared heaps disrupts sharing too
@@ -1079,14 +2007,23 @@ size_t dvmHeapSourceFreeList(size_t numPtrs, void **ptrs)
         // mspace_free, but on the other heaps we only do some
         // accounting.
         if (heap == gHs->heaps) {
-            // Count freed objects.
+            // Count freed objects.  Slots go back to their runs; the
+            // remaining chunks are packed to the front of the list,
+            // keeping their order, for the bulk free.
+            size_t numChunks = 0;
             for (size_t i = 0; i < numPtrs; i++) {
                 assert(ptrs[i] != NULL);
                 assert(ptr2heap(gHs, ptrs[i]) == heap);
                 countFree(heap, ptrs[i], &numBytes);
+                SmallRun *run = ptr2run(gHs, ptrs[i]);
+                if (run != NULL) {
+                    freeRunSlot(gHs, heap, run, ptrs[i]);
+                } else {
+                    ptrs[numChunks++] = ptrs[i];
+                }
             }
             // Bulk free ptrs.
-            mspace_bulk_free(msp, ptrs, numPtrs);
+            mspace_bulk_free(msp, ptrs, numChunks);
         } else {
             // This is not an 'active heap'. Only do the accounting.
             for (size_t i = 0; i < numPtrs; i++) {
@@ -1106,6 +2043,9 @@ bool dvmHeapSourceContainsAddress(const void *ptr)
 {
     HS_BOILERPLATE();
 
+    if (dvmLargeObjectSpaceContains(&gHs->largeObjects, ptr)) {
+        return true;
+    }
     return (dvmHeapSourceGetBase() <= ptr) && (ptr <= dvmHeapSourceGetLimit());
 }
 
@@ -1153,8 +2093,15 @@ size_t dvmHeapSourceChunkSize(const void *ptr)
 
     Heap* heap = ptr2heap(gHs, ptr);
     if (heap != NULL) {
+        const SmallRun *run = ptr2run(gHs, ptr);
+        if (run != NULL) {
+            return run->slotSize;
+        }
         return mspace_usable_size(ptr);
     }
+    if (dvmLargeObjectSpaceContains(&gHs->largeObjects, ptr)) {
+        return dvmLargeObjectSpaceObjectSize(&gHs->largeObjects, ptr);
+    }
     return 0;
 }
 
@@ -1169,7 +2116,7 @@ size_t dvmHeapSourceFootprint()
     HS_BOILERPLATE();
 
 //TODO: include size of bitmaps?
-    return oldHeapOverhead(gHs, true);
+    return oldHeapOverhead(gHs, true) + gHs->largeObjects.bytesAllocated;
 }
 
 static size_t getMaximumSize(const HeapSource *hs)
@@ -1187,6 +2134,108 @@ size_t dvmHeapSourceGetMaximumSize()
     return getMaximumSize(gHs);
 }
 
+/*
+ * Records that the object at <ptr> was allocated with ALLOC_NON_MOVING.
+ * TLAB allocations get here without the heap lock.
+ */
+void dvmHeapSourceSetNonMoving(const void *ptr)
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    if (hs->nonMovingBits.bits != NULL && ptr2heap(hs, ptr) == hs2heap(hs)) {
+        dvmHeapBitmapAtomicSetObjectBit(&hs->nonMovingBits, ptr);
+    }
+}
+
+/*
+ * Returns true iff a compaction must leave the object at <ptr> where
+ * it is.  Only objects in the active heap are ever moved.
+ */
+bool dvmHeapSourceIsNonMoving(const void *ptr)
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    if (hs->nonMovingBits.bits == NULL || ptr2heap(hs, ptr) != hs2heap(hs)) {
+        return true;
+    }
+    return dvmHeapBitmapIsObjectBitSet(&hs->nonMovingBits, ptr) != 0;
+}
+
+/*
+ * Records that the identity hash code of the object at <ptr> has been
+ * taken.  Called without the heap lock, on every hash of an object in
+ * the active heap, so the bit is only set atomically the first time.
+ */
+void dvmHeapSourceSetHashed(const void *ptr)
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    if (hs->hashedBits.bits != NULL && ptr2heap(hs, ptr) == hs2heap(hs) &&
+        !dvmHeapBitmapIsObjectBitSet(&hs->hashedBits, ptr)) {
+        dvmHeapBitmapAtomicSetObjectBit(&hs->hashedBits, ptr);
+    }
+}
+
+/*
+ * Returns true iff dvmHeapSourceSetHashed() was called for the object
+ * at <ptr>.
+ */
+bool dvmHeapSourceIsHashed(const void *ptr)
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    if (hs->hashedBits.bits == NULL || ptr2heap(hs, ptr) != hs2heap(hs)) {
+        return false;
+    }
+    return dvmHeapBitmapIsObjectBitSet(&hs->hashedBits, ptr) != 0;
+}
+
+/*
+ * Like any other wake-up of the daemon, this may be lost if it comes
+ * while the daemon is busy; the daemon checks for cleared references
+ * after each of its collections anyway, and they are a root until then.
+ */
+bool dvmHeapSourceRequestReferenceEnqueue()
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    if (!hs->hasGcThread || gDvm.debuggerConnected) {
+        return false;
+    }
+    hs->gcThreadEnqueueNeeded = true;
+    dvmSignalCond(&hs->gcThreadCond);
+    return true;
+}
+
+/*
+ * Asks the GC daemon to compact the heap.  Like the other wake-ups of
+ * the daemon this doesn't take its mutex, which the daemon holds while
+ * it collects; a request that races with a collection in progress is
+ * picked up the next time the daemon wakes.
+ */
+void dvmRequestHeapCompaction()
+{
+    HeapSource *hs = gHs;
+
+    HS_BOILERPLATE();
+
+    if (!gDvm.backgroundCompaction || !hs->hasGcThread) {
+        return;
+    }
+    hs->gcThreadCompactNeeded = true;
+    dvmSignalCond(&hs->gcThreadCond);
+}
+
 /*
  * Removes any growth limits.  Allows the user to allocate up to the
  * maximum heap size.
@@ -1217,7 +2266,7 @@ static size_t getSoftFootprint(bool includeActive)
     HeapSource *hs = gHs;
     size_t ret = oldHeapOverhead(hs, false);
     if (includeActive) {
-        ret += hs->heaps[0].bytesAllocated;
+        ret += activeBytesAllocated(hs);
     }
 
     return ret;
@@ -1365,12 +2414,80 @@ static size_t getUtilizationTarget(const HeapSource* hs, size_t liveSize)
     return targetSize;
 }
 
+/*
+ * The weight of the latest collection in the smoothed measurements.
+ */
+#define GC_TIME_SMOOTHING   0.25
+
+static double smoothSample(double average, double sample)
+{
+    if (average == 0) {
+        return sample;
+    }
+    return average + (sample - average) * GC_TIME_SMOOTHING;
+}
+
+/*
+ * Folds the collection that just finished into the allocation rate
+ * and the cost of collecting, which is taken to be proportional to
+ * the live set.
+ */
+static void measureGc(HeapSource *hs, u8 gcStartUsec,
+                      size_t bytesAllocatedBefore, size_t liveSize)
+{
+    u8 now = dvmGetRelativeTimeUsec();
+    if (hs->lastGcEndUsec != 0 && gcStartUsec > hs->lastGcEndUsec &&
+        bytesAllocatedBefore > hs->bytesAllocatedAfterGc) {
+        double allocated = bytesAllocatedBefore - hs->bytesAllocatedAfterGc;
+        double mutatorUsec = gcStartUsec - hs->lastGcEndUsec;
+        hs->allocBytesPerUsec = smoothSample(hs->allocBytesPerUsec,
+                                             allocated / mutatorUsec);
+    }
+    if (liveSize > 0 && now > gcStartUsec) {
+        double gcUsec = now - gcStartUsec;
+        hs->gcUsecPerLiveByte = smoothSample(hs->gcUsecPerLiveByte,
+                                             gcUsec / liveSize);
+    }
+    hs->lastGcEndUsec = now;
+    hs->bytesAllocatedAfterGc = dvmHeapSourceGetValue(HS_BYTES_ALLOCATED,
+                                                      NULL, 0);
+}
+
+/*
+ * Given the size of a live set, returns the heap size at which the
+ * collector should take the target fraction of the time.  At an
+ * allocation rate r, F free bytes last F/r between collections that
+ * each take c, so c / (c + F/r) = f gives F = r * c * (1 - f) / f.
+ * Unlike the utilization target, the free space is only bounded from
+ * below, by the min free value; setIdealFootprint() keeps it within
+ * the growth limit.
+ */
+static size_t getGcTimeTarget(const HeapSource* hs, size_t liveSize)
+{
+    if (hs->allocBytesPerUsec == 0 || hs->gcUsecPerLiveByte == 0) {
+        /* Nothing measured yet. */
+        return getUtilizationTarget(hs, liveSize);
+    }
+    double fraction = gDvm.heapTargetGcTime;
+    double gcUsec = hs->gcUsecPerLiveByte * liveSize;
+    double freeBytes = hs->allocBytesPerUsec * gcUsec *
+                       (1 - fraction) / fraction;
+    if (freeBytes > hs->maximumSize) {
+        freeBytes = hs->maximumSize;
+    } else if (freeBytes < hs->minFree) {
+        freeBytes = hs->minFree;
+    }
+    return liveSize + (size_t)freeBytes;
+}
+
 /*
  * Given the current contents of the active heap, increase the allowed
- * heap footprint to match the target utilization ratio.  This
- * should only be called immediately after a full mark/sweep.
+ * heap footprint as the growth policy directs.  This should only be
+ * called immediately after a mark/sweep, with the time it started and
+ * the number of bytes allocated then.
  */
-void dvmHeapSourceGrowForUtilization()
+void dvmHeapSourceGrowForUtilization(u8 gcStartUsec,
+                                     size_t bytesAllocatedBefore)
 {
     HS_BOILERPLATE();
 
@@ -1384,10 +2501,11 @@ void dvmHeapSourceGrowForUtilization()
      * Avoid letting the old heaps influence the target free size,
      * because they may be full of objects that aren't actually
      * in the working set.  Just look at the allocated size of
-     * the current heap.
+     * the current heap and the large object space.
      */
-    size_t currentHeapUsed = heap->bytesAllocated;
-    size_t targetHeapSize = getUtilizationTarget(hs, currentHeapUsed);
+    size_t currentHeapUsed = activeBytesAllocated(hs);
+    measureGc(hs, gcStartUsec, bytesAllocatedBefore, currentHeapUsed);
+    size_t targetHeapSize = (*hs->growthPolicy)(hs, currentHeapUsed);
 
     /* The ideal size includes the old heaps; add overhead so that
      * it can be immediately subtracted again in setIdealFootprint().
@@ -1405,15 +2523,15 @@ void dvmHeapSourceGrowForUtilization()
         heap->concurrentStartBytes = freeBytes - CONCURRENT_START;
     }
 
-    /* Mark that we need to run finalizers and update the native watermarks
-     * next time we attempt to register a native allocation.
+    /* Native allocations count towards the next GC from here on.
      */
-    gHs->nativeNeedToRunFinalization = true;
+    android_atomic_release_store(0, &hs->nativeBytesSinceGc);
+    android_atomic_release_store(0, &hs->nativeGcRequested);
 }
 
 /*
- * Return free pages to the system.
- * TODO: move this somewhere else, especially the native heap part.
+ * Return free pages of the native heap to the system.
+ * TODO: move this somewhere else.
  */
 static void releasePagesInRange(void* start, void* end, size_t used_bytes,
                                 void* releasedBytes)
@@ -1434,37 +2552,161 @@ static void releasePagesInRange(void* start, void* end, size_t used_bytes,
     }
 }
 
+struct TrimContext {
+    HeapSource *hs;
+
+    /* The pages below this address were seen by an earlier slice.
+     */
+    char *resume;
+
+    u8 deadlineUsec;
+    bool interrupted;
+    size_t releasedBytes;
+};
+
 /*
- * Return unused memory to the system if possible.
+ * Returns the whole free pages of an mspace chunk to the system,
+ * skipping those already returned.  Once the slice is out of time the
+ * rest of the walk is left for the next one.
  */
-static void trimHeaps()
+static void releaseHeapPages(void* start, void* end, size_t used_bytes,
+                             void* arg)
+{
+    TrimContext *ctx = (TrimContext *)arg;
+    if (used_bytes != 0 || ctx->interrupted || (char *)end <= ctx->resume) {
+        return;
+    }
+    /* Stay clear of the bookkeeping dlmalloc may write at the start of
+     * the chunk, which is more than it has now if the chunk is later
+     * coalesced into a larger one.
+     */
+    char *begin = MAX((char *)start + CHUNK_BOOKKEEPING_SIZE, ctx->resume);
+    char *page = (char *)ALIGN_UP_TO_PAGE_SIZE(begin);
+    char *pageEnd = (char *)ALIGN_DOWN_TO_PAGE_SIZE(end);
+    while (page < pageEnd) {
+        if (isPageClean(ctx->hs, page)) {
+            page += SYSTEM_PAGE_SIZE;
+            continue;
+        }
+        if (dvmGetRelativeTimeUsec() > ctx->deadlineUsec) {
+            ctx->interrupted = true;
+            ctx->resume = page;
+            return;
+        }
+        char *dirtyEnd = page + SYSTEM_PAGE_SIZE;
+        while (dirtyEnd < pageEnd && !isPageClean(ctx->hs, dirtyEnd)) {
+            dirtyEnd += SYSTEM_PAGE_SIZE;
+        }
+        madvise(page, dirtyEnd - page, MADV_DONTNEED);
+        markPagesClean(ctx->hs, page, dirtyEnd);
+        ctx->releasedBytes += dirtyEnd - page;
+        page = dirtyEnd;
+    }
+}
+
+/*
+ * Return unused memory to the system if possible.  If <canYield> is
+ * set the caller holds the heap lock, and it is given up between
+ * slices of HEAP_TRIM_SLICE_USEC so that allocating threads aren't
+ * held up for the length of the trim.  The trim stops early, returning
+ * false, if a collection is wanted in the meantime.
+ */
+static bool trimHeaps(bool canYield)
 {
     HS_BOILERPLATE();
 
     HeapSource *hs = gHs;
+    u8 startUsec = dvmGetRelativeTimeUsec();
     size_t heapBytes = 0;
-    for (size_t i = 0; i < hs->numHeaps; i++) {
+    size_t slices = 0;
+    bool completed = true;
+    for (size_t i = 0; i < hs->numHeaps && completed; i++) {
         Heap *heap = &hs->heaps[i];
 
         /* Return the wilderness chunk to the system. */
         mspace_trim(heap->msp, 0);
+        heap->generation++;
 
         /* Return any whole free pages to the system. */
-        mspace_inspect_all(heap->msp, releasePagesInRange, &heapBytes);
+        TrimContext ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.hs = hs;
+        do {
+            ctx.interrupted = false;
+            ctx.deadlineUsec = canYield ?
+                dvmGetRelativeTimeUsec() + HEAP_TRIM_SLICE_USEC : ~0ULL;
+            mspace_inspect_all(heap->msp, releaseHeapPages, &ctx);
+            slices++;
+            if (ctx.interrupted) {
+                dvmUnlockHeap();
+                sched_yield();
+                dvmLockHeap();
+                if (gDvm.gcHeap->gcRunning || hs->gcThreadGcNeeded ||
+                    hs->gcThreadCompactNeeded) {
+                    completed = false;
+                }
+            }
+        } while (ctx.interrupted && completed);
+        heapBytes += ctx.releasedBytes;
     }
 
-    /* Same for the native heap. */
-    dlmalloc_trim(0);
+    /* Same for the native heap, which has a lock of its own. */
     size_t nativeBytes = 0;
-    dlmalloc_inspect_all(releasePagesInRange, &nativeBytes);
+    if (completed) {
+        if (canYield) {
+            dvmUnlockHeap();
+        }
+        dlmalloc_trim(0);
+        dlmalloc_inspect_all(releasePagesInRange, &nativeBytes);
+        if (canYield) {
+            dvmLockHeap();
+        }
+    }
+
+    u4 usec = (u4)(dvmGetRelativeTimeUsec() - startUsec);
+    dvmGcHistoryRecordTrim(heapBytes, nativeBytes, slices, usec, completed);
+    LOGD_HEAP("madvised %zd (GC) + %zd (native) = %zd total bytes "
+              "in %zd slices%s",
+              heapBytes, nativeBytes, heapBytes + nativeBytes, slices,
+              completed ? "" : ", interrupted");
+    return completed;
+}
+
+struct RunWalkContext {
+    void (*callback)(void* start, void* end, size_t used_bytes, void* arg);
+    void *arg;
+};
 
-    LOGD_HEAP("madvised %zd (GC) + %zd (native) = %zd total bytes",
-            heapBytes, nativeBytes, heapBytes + nativeBytes);
+/*
+ * Passes mspace chunks through to the walk callback, but splits a
+ * size-class run into its header and one chunk per slot.
+ */
+static void runWalkCallback(void* start, void* end, size_t used_bytes,
+                            void* arg)
+{
+    RunWalkContext *ctx = (RunWalkContext *)arg;
+    SmallRun *run = (used_bytes != 0) ? ptr2run(gHs, start) : NULL;
+    if (run == NULL || (void *)run != start) {
+        ctx->callback(start, end, used_bytes, ctx->arg);
+        return;
+    }
+    u1 *slot = runSlots(run);
+    ctx->callback(run, slot, SMALL_RUN_HEADER_SIZE, ctx->arg);
+    for (size_t i = 0; i < run->numSlots; i++, slot += run->slotSize) {
+        bool inUse = (run->slotBits[SMALL_RUN_SLOT_WORD(i)] &
+                      SMALL_RUN_SLOT_BIT(i)) != 0;
+        ctx->callback(slot, slot + run->slotSize,
+                      inUse ? run->slotSize : 0, ctx->arg);
+    }
+    if (slot < (u1 *)end) {
+        ctx->callback(slot, end, 0, ctx->arg);
+    }
 }
 
 /*
  * Walks over the heap source and passes every allocated and
- * free chunk to the callback.
+ * free chunk to the callback.  Each slot of a size-class run is
+ * reported as a chunk of its own.
  */
 void dvmHeapSourceWalk(void(*callback)(void* start, void* end,
                                        size_t used_bytes, void* arg),
@@ -1472,14 +2714,65 @@ void dvmHeapSourceWalk(void(*callback)(void* start, void* end,
 {
     HS_BOILERPLATE();
 
+    RunWalkContext ctx = { callback, arg };
+
     /* Walk the heaps from oldest to newest.
      */
 //TODO: do this in address order
     HeapSource *hs = gHs;
     for (size_t i = hs->numHeaps; i > 0; --i) {
-        mspace_inspect_all(hs->heaps[i-1].msp, callback, arg);
+        mspace_inspect_all(hs->heaps[i-1].msp, runWalkCallback, &ctx);
         callback(NULL, NULL, 0, arg);  // Indicate end of a heap.
     }
+    if (hs->largeObjects.base != NULL) {
+        dvmLargeObjectSpaceWalk(&hs->largeObjects, callback, arg);
+        callback(NULL, NULL, 0, arg);
+    }
+}
+
+/*
+ * The regions are the heaps, oldest first, then the large object
+ * space.  The oldest heap keeps its index when a new one is added.
+ */
+size_t dvmHeapSourceGetNumWalkRegions()
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    return hs->numHeaps + (hs->largeObjects.base != NULL ? 1 : 0);
+}
+
+bool dvmHeapSourceGetWalkRegionGeneration(size_t region, u4 *generation)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    assert(region < dvmHeapSourceGetNumWalkRegions());
+    if (region < hs->numHeaps) {
+        *generation = hs->heaps[hs->numHeaps - 1 - region].generation;
+        return true;
+    }
+    /* The large object space is cheap to walk every time. */
+    return false;
+}
+
+void dvmHeapSourceWalkRegion(size_t region,
+                             void(*callback)(void* start, void* end,
+                                             size_t used_bytes, void* arg),
+                             void *arg)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    assert(region < dvmHeapSourceGetNumWalkRegions());
+    if (region < hs->numHeaps) {
+        RunWalkContext ctx = { callback, arg };
+        mspace_inspect_all(hs->heaps[hs->numHeaps - 1 - region].msp,
+                           runWalkCallback, &ctx);
+    } else {
+        dvmLargeObjectSpaceWalk(&hs->largeObjects, callback, arg);
+    }
+    callback(NULL, NULL, 0, arg);  // Indicate end of a region.
 }
 
 /*
@@ -1497,101 +2790,101 @@ size_t dvmHeapSourceGetNumHeaps()
 
 void *dvmHeapSourceGetImmuneLimit(bool isPartial)
 {
-    if (isPartial) {
+    if (isPartial || gHs->immuneZygoteHeap) {
         return hs2heap(gHs)->base;
     } else {
         return NULL;
     }
 }
 
-static void dvmHeapSourceUpdateMaxNativeFootprint()
+/*
+ * Returns the number of native bytes that may be registered after a
+ * GC before another is started.  Like the managed heap, the native
+ * allocations that survived the last GC are given room to grow by the
+ * target utilization, within the bounds on the free space.
+ */
+static size_t nativeGcThreshold(const HeapSource *hs)
 {
-    /* Use the current target utilization ratio to determine the new native GC
-     * watermarks.
-     */
-    size_t nativeSize = gHs->nativeBytesAllocated;
+    int32_t live = hs->nativeBytesAllocated - hs->nativeBytesSinceGc;
+    size_t liveSize = MAX(live, 0);
     size_t targetSize =
-        (nativeSize / gHs->targetUtilization) * HEAP_UTILIZATION_MAX;
-
-    if (targetSize > nativeSize + gHs->maxFree) {
-        targetSize = nativeSize + gHs->maxFree;
-    } else if (targetSize < nativeSize + gHs->minFree) {
-        targetSize = nativeSize + gHs->minFree;
+        (liveSize / hs->targetUtilization) * HEAP_UTILIZATION_MAX;
+    size_t freeSize = targetSize > liveSize ? targetSize - liveSize : 0;
+    if (freeSize > hs->maxFree) {
+        freeSize = hs->maxFree;
+    } else if (freeSize < hs->minFree) {
+        freeSize = hs->minFree;
     }
-    gHs->nativeFootprintGCWatermark = targetSize;
-    gHs->nativeFootprintLimit = 2 * targetSize - nativeSize;
+    return freeSize;
 }
 
-void dvmHeapSourceRegisterNativeAllocation(int bytes)
+/*
+ * Waits for a GC to free native allocations when they are being
+ * registered much faster than the concurrent GC can keep up with.
+ * Threads only block here once far past the point at which the
+ * concurrent GC was requested.
+ */
+static void waitForNativeGc(HeapSource *hs, size_t threshold)
 {
-    /* If we have just done a GC, ensure that the finalizers are done and update
-     * the native watermarks.
-     */
-    if (gHs->nativeNeedToRunFinalization) {
-        dvmRunFinalization();
-        dvmHeapSourceUpdateMaxNativeFootprint();
-        gHs->nativeNeedToRunFinalization = false;
+    dvmLockHeap();
+    bool waited = dvmWaitForConcurrentGcToComplete();
+    if (!waited &&
+        (size_t)hs->nativeBytesSinceGc > NATIVE_BLOCK_FACTOR * threshold) {
+        dvmCollectGarbageInternal(GC_FOR_MALLOC);
     }
+    dvmUnlockHeap();
+    /* Much of the native memory is only freed by finalizers, and the
+     * finalizers to run must be queued first.  An exception thrown by
+     * one is left pending for our caller.
+     */
+    dvmHeapEnqueueClearedReferences();
+    dvmRunFinalization();
+}
 
-    android_atomic_add(bytes, &gHs->nativeBytesAllocated);
-
-    if ((size_t)gHs->nativeBytesAllocated > gHs->nativeFootprintGCWatermark) {
-        /* The second watermark is higher than the gc watermark. If you hit
-         * this it means you are allocating native objects faster than the GC
-         * can keep up with. If this occurs, we do a GC for alloc.
-         */
-        if ((size_t)gHs->nativeBytesAllocated > gHs->nativeFootprintLimit) {
-            Thread* self = dvmThreadSelf();
-            dvmRunFinalization();
-            if (dvmCheckException(self)) {
-                return;
-            }
-            dvmLockHeap();
-            bool waited = dvmWaitForConcurrentGcToComplete();
-            dvmUnlockHeap();
-            if (waited) {
-                // Just finished a GC, attempt to run finalizers.
-                dvmRunFinalization();
-                if (dvmCheckException(self)) {
-                    return;
-                }
-            }
+/*
+ * Called from VMRuntime.registerNativeAllocation.  Asks the GC daemon
+ * for a concurrent GC when the bytes registered since the last GC pass
+ * the threshold, and waits for a GC only when far beyond it.
+ */
+void dvmHeapSourceRegisterNativeAllocation(int bytes)
+{
+    HeapSource *hs = gHs;
 
-            // If we still are over the watermark, attempt a GC for alloc and run finalizers.
-            if ((size_t)gHs->nativeBytesAllocated > gHs->nativeFootprintLimit) {
-                dvmLockHeap();
-                dvmWaitForConcurrentGcToComplete();
-                dvmCollectGarbageInternal(GC_FOR_MALLOC);
-                dvmUnlockHeap();
-                dvmRunFinalization();
-                gHs->nativeNeedToRunFinalization = false;
-                if (dvmCheckException(self)) {
-                    return;
-                }
-            }
-            /* We have just run finalizers, update the native watermark since
-             * it is very likely that finalizers released native managed
-             * allocations.
-             */
-            dvmHeapSourceUpdateMaxNativeFootprint();
-        } else {
-            dvmSignalCond(&gHs->gcThreadCond);
-        }
+    android_atomic_add(bytes, &hs->nativeBytesAllocated);
+    int32_t sinceGc = android_atomic_add(bytes, &hs->nativeBytesSinceGc) +
+                      bytes;
+    size_t threshold = nativeGcThreshold(hs);
+    if ((size_t)sinceGc <= threshold) {
+        return;
+    }
+    if ((size_t)sinceGc > NATIVE_BLOCK_FACTOR * threshold) {
+        waitForNativeGc(hs, threshold);
+    } else if (hs->hasGcThread &&
+               android_atomic_acquire_cas(0, 1, &hs->nativeGcRequested) == 0) {
+        hs->gcThreadGcNeeded = true;
+        dvmSignalCond(&hs->gcThreadCond);
     }
 }
 
 /*
- * Called from VMRuntime.registerNativeFree.
+ * Subtracts <bytes> from <*count>, stopping at zero.
  */
-void dvmHeapSourceRegisterNativeFree(int bytes)
+static void subtractNativeBytes(volatile int32_t *count, int bytes)
 {
     int expected_size, new_size;
     do {
-        expected_size = gHs->nativeBytesAllocated;
-        new_size = expected_size - bytes;
-        if (new_size < 0) {
-            break;
-        }
-    } while (android_atomic_cas(expected_size, new_size,
-                                &gHs->nativeBytesAllocated));
+        expected_size = *count;
+        new_size = MAX(expected_size - bytes, 0);
+    } while (android_atomic_cas(expected_size, new_size, count));
+}
+
+/*
+ * Called from VMRuntime.registerNativeFree.  Frees count against the
+ * bytes registered since the last GC too, so that buffers which come
+ * and go between GCs do not bring on the next one.
+ */
+void dvmHeapSourceRegisterNativeFree(int bytes)
+{
+    subtractNativeBytes(&gHs->nativeBytesAllocated, bytes);
+    subtractNativeBytes(&gHs->nativeBytesSinceGc, bytes);
 }
@@ -58,12 +58,25 @@ bool dvmHeapSourceStartupAfterZygote(void);
  */
 bool dvmHeapSourceStartupBeforeFork(void);
 
+/*
+ * In a process forked from the zygote, logs how many of the zygote
+ * heap's pages are still shared with the zygote and how many have been
+ * copied by writes.
+ */
+void dvmHeapSourceLogZygoteSharing(void);
+
 /*
  * Shutdown any threads internal to the heap source.  This should be
  * called before the heap source itself is shutdown.
  */
 void dvmHeapSourceThreadShutdown(void);
 
+/*
+ * Asks the GC daemon to enqueue the references cleared by the last
+ * collection.  Returns false if there is no daemon to do it.
+ */
+bool dvmHeapSourceRequestReferenceEnqueue(void);
+
 /*
  * Tears down the heap source and frees any resources associated with it.
  */
@@ -76,6 +89,12 @@ void dvmHeapSourceShutdown(GcHeap **gcHeap);
  */
 void dvmHeapSourceGetRegions(uintptr_t *base, uintptr_t *max, size_t numHeaps);
 
+/*
+ * Returns the base and inclusive max addresses of the large object
+ * space, in the same form.  Returns false if it holds nothing to sweep.
+ */
+bool dvmHeapSourceGetLargeObjectRegion(uintptr_t *base, uintptr_t *max);
+
 /*
  * Get the bitmap representing all live objects.
  */
@@ -115,6 +134,52 @@ void *dvmHeapSourceAlloc(size_t n);
  */
 void *dvmHeapSourceAllocAndGrow(size_t n);
 
+/*
+ * Allocates <n> bytes of zeroed data for an object that holds no
+ * references, from the large object space if possible.  If <grow> is
+ * set, behaves like dvmHeapSourceAllocAndGrow().
+ */
+void *dvmHeapSourceAllocLarge(size_t n, bool grow);
+
+/*
+ * Allocates <n> bytes of zeroed data from the calling thread's local
+ * allocation buffer without taking the heap lock.  Returns NULL if the
+ * request cannot be satisfied from the buffer.
+ */
+void *dvmHeapSourceAllocTlab(Thread *self, size_t n);
+
+/*
+ * Returns the size of the local allocation buffer chunk that an <n>
+ * byte object takes, or 0 if such objects never come from a buffer.
+ */
+size_t dvmHeapSourceTlabChunkSize(size_t n);
+
+/*
+ * Like dvmHeapSourceAllocTlab(), but takes the chunk size computed by
+ * dvmHeapSourceTlabChunkSize().  The caller must be THREAD_RUNNING.
+ */
+void *dvmHeapSourceAllocTlabChunk(Thread *self, size_t chunkSize);
+
+/*
+ * Replaces the calling thread's local allocation buffer with a fresh
+ * one and allocates <n> bytes of zeroed data from it.  Returns NULL if
+ * the request is not suitable for a buffer or no buffer is available.
+ * The caller must hold the heap lock.
+ */
+void *dvmHeapSourceAllocTlabRefill(Thread *self, size_t n);
+
+/*
+ * Returns the unused part of a thread's local allocation buffer to the
+ * heap.  The caller must hold the heap lock.
+ */
+void dvmHeapSourceRetireTlab(Thread *thread);
+
+/*
+ * Retires the local allocation buffers of all threads.  The caller
+ * must hold the heap lock with all other threads suspended.
+ */
+void dvmHeapSourceRetireAllTlabs(void);
+
 /*
  * Frees the first numPtrs objects in the ptrs list and returns the
  * amount of reclaimed storage.  The list must contain addresses all
@@ -139,6 +204,23 @@ bool dvmHeapSourceContainsAddress(const void *ptr);
  */
 size_t dvmHeapSourceChunkSize(const void *ptr);
 
+/*
+ * Records that the object at <ptr> was allocated with ALLOC_NON_MOVING.
+ */
+void dvmHeapSourceSetNonMoving(const void *ptr);
+
+/*
+ * Returns true iff a compaction must not move the object at <ptr>.
+ */
+bool dvmHeapSourceIsNonMoving(const void *ptr);
+
+/*
+ * Records that the identity hash code of the object at <ptr> has been
+ * taken, and tests for it.
+ */
+void dvmHeapSourceSetHashed(const void *ptr);
+bool dvmHeapSourceIsHashed(const void *ptr);
+
 /*
  * Returns the number of bytes that the heap source has allocated
  * from the system using sbrk/mmap, etc.
@@ -153,10 +235,12 @@ size_t dvmHeapSourceGetIdealFootprint(void);
 
 /*
  * Given the current contents of the heap, increase the allowed
- * heap footprint to match the target utilization ratio.  This
- * should only be called immediately after a full mark/sweep.
+ * heap footprint as the growth policy directs.  This should only be
+ * called immediately after a mark/sweep, with the time it started and
+ * the number of bytes allocated then.
  */
-void dvmHeapSourceGrowForUtilization(void);
+void dvmHeapSourceGrowForUtilization(u8 gcStartUsec,
+                                     size_t bytesAllocatedBefore);
 
 /*
  * Walks over the heap source and passes every allocated and
@@ -165,6 +249,26 @@ void dvmHeapSourceGrowForUtilization(void);
 void dvmHeapSourceWalk(void(*callback)(void* start, void* end,
                                        size_t used_bytes, void* arg),
                        void *arg);
+/*
+ * Walks the heap source one region at a time, so the heap lock can be
+ * dropped in between.  Walking every region from 0 on passes the
+ * callback the same chunks as dvmHeapSourceWalk().  The caller must hold
+ * the heap lock.
+ */
+size_t dvmHeapSourceGetNumWalkRegions(void);
+void dvmHeapSourceWalkRegion(size_t region,
+                             void(*callback)(void* start, void* end,
+                                             size_t used_bytes, void* arg),
+                             void *arg);
+
+/*
+ * Gets a number that changes whenever the chunks of a walk region may
+ * have, so a walker can keep what it learned about the region until
+ * then.  Returns false if the region does not track its changes and
+ * must always be walked.
+ */
+bool dvmHeapSourceGetWalkRegionGeneration(size_t region, u4 *generation);
+
 /*
  * Gets the number of heaps available in the heap source.
  */
@@ -176,10 +280,17 @@ size_t dvmHeapSourceGetNumHeaps(void);
 void dvmHeapSourceSwapBitmaps(void);
 
 /*
- * Zeroes the mark bitmap.
+ * Zeroes the mark bitmap, except for the bits of the immune zygote
+ * heap.
  */
 void dvmHeapSourceZeroMarkBitmap(void);
 
+/*
+ * Makes the mark bitmap a copy of the live bitmap, skipping the bits of
+ * the immune zygote heap, which they already share.
+ */
+void dvmHeapSourceCopyLiveToMarkBitmap(void);
+
 /*
  * Marks all objects inside the immune region of the heap. Addresses
  * at or above this pointer are threatened, addresses below this
@@ -190,7 +301,10 @@ void dvmMarkImmuneObjects(const char *immuneLimit);
 /*
  * Returns a pointer that demarcates the threatened region of the
  * heap.  Addresses at or above this pointer are threatened, addresses
- * below this pointer are immune.
+ * below this pointer are immune.  Once the zygote heap has been split
+ * off it is immune even to a collection that isn't partial; the cards
+ * below the limit are then never cleaned, and record which immune
+ * objects may refer to threatened ones.
  */
 void *dvmHeapSourceGetImmuneLimit(bool isPartial);
 
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+
+#include "Dalvik.h"
+#include "alloc/LargeObjectSpace.h"
+
+/*
+ * A run of free pages below the space's brk.
+ */
+struct LargeExtent {
+    char *base;
+    size_t length;
+    LargeExtent *next;
+};
+
+static size_t pageIndex(const LargeObjectSpace *los, const void *ptr)
+{
+    return ((const char *)ptr - los->base) / SYSTEM_PAGE_SIZE;
+}
+
+bool dvmLargeObjectSpaceInit(LargeObjectSpace *los, void *base,
+                             size_t length)
+{
+    assert(((uintptr_t)base & (SYSTEM_PAGE_SIZE - 1)) == 0);
+    memset(los, 0, sizeof(*los));
+    los->pageMapLength = length / SYSTEM_PAGE_SIZE * sizeof(u4);
+    los->pageMap = (u4 *)dvmAllocRegion(los->pageMapLength,
+                                        PROT_READ | PROT_WRITE,
+                                        "dalvik-large-object-map");
+    if (los->pageMap == NULL) {
+        return false;
+    }
+    los->base = (char *)base;
+    los->length = length;
+    los->brk = los->base;
+    return true;
+}
+
+void dvmLargeObjectSpaceDelete(LargeObjectSpace *los)
+{
+    LargeExtent *extent = los->freeList;
+    while (extent != NULL) {
+        LargeExtent *next = extent->next;
+        free(extent);
+        extent = next;
+    }
+    if (los->pageMap != NULL) {
+        munmap(los->pageMap, ALIGN_UP_TO_PAGE_SIZE(los->pageMapLength));
+    }
+    memset(los, 0, sizeof(*los));
+}
+
+/*
+ * Takes <length> bytes of address space, first fit, from the free
+ * extents or from above brk.
+ */
+static char *takeAddressSpace(LargeObjectSpace *los, size_t length)
+{
+    LargeExtent **prev = &los->freeList;
+    for (LargeExtent *extent = *prev; extent != NULL; extent = *prev) {
+        if (extent->length >= length) {
+            char *addr = extent->base;
+            if (extent->length == length) {
+                *prev = extent->next;
+                free(extent);
+            } else {
+                extent->base += length;
+                extent->length -= length;
+            }
+            return addr;
+        }
+        prev = &extent->next;
+    }
+    if ((size_t)(los->base + los->length - los->brk) < length) {
+        return NULL;
+    }
+    char *addr = los->brk;
+    los->brk += length;
+    return addr;
+}
+
+/*
+ * Returns [addr, addr+length) to the free extents, merging it with
+ * its neighbours and lowering brk when it ends there.
+ */
+static void returnAddressSpace(LargeObjectSpace *los, char *addr,
+                               size_t length)
+{
+    LargeExtent **prev = &los->freeList;
+    LargeExtent *before = NULL;
+    while (*prev != NULL && (*prev)->base < addr) {
+        before = *prev;
+        prev = &before->next;
+    }
+    LargeExtent *after = *prev;
+    if (before != NULL && before->base + before->length == addr) {
+        before->length += length;
+        if (after != NULL && addr + length == after->base) {
+            before->length += after->length;
+            before->next = after->next;
+            free(after);
+        }
+    } else if (after != NULL && addr + length == after->base) {
+        after->base = addr;
+        after->length += length;
+    } else {
+        LargeExtent *extent = (LargeExtent *)malloc(sizeof(*extent));
+        if (extent == NULL) {
+            /* Leak the address space rather than fail the free. */
+            ALOGW("Dropping %zd bytes from the large object space", length);
+            return;
+        }
+        extent->base = addr;
+        extent->length = length;
+        extent->next = after;
+        *prev = extent;
+    }
+
+    /* The last extent may now reach brk. */
+    prev = &los->freeList;
+    while (*prev != NULL && (*prev)->next != NULL) {
+        prev = &(*prev)->next;
+    }
+    LargeExtent *last = *prev;
+    if (last != NULL && last->base + last->length == los->brk) {
+        los->brk = last->base;
+        *prev = NULL;
+        free(last);
+    }
+}
+
+void *dvmLargeObjectSpaceAlloc(LargeObjectSpace *los, size_t n)
+{
+    size_t length = ALIGN_UP_TO_PAGE_SIZE(n);
+    char *addr = takeAddressSpace(los, length);
+    if (addr == NULL) {
+        return NULL;
+    }
+    /* The pages were discarded when they were last freed, so they
+     * fault back in zeroed.
+     */
+    if (mprotect(addr, length, PROT_READ | PROT_WRITE) != 0) {
+        ALOGW("Unable to map %zd bytes in the large object space: %s",
+              length, strerror(errno));
+        returnAddressSpace(los, addr, length);
+        return NULL;
+    }
+    los->pageMap[pageIndex(los, addr)] = length / SYSTEM_PAGE_SIZE;
+    los->bytesAllocated += length;
+    los->objectsAllocated++;
+    return addr;
+}
+
+size_t dvmLargeObjectSpaceFree(LargeObjectSpace *los, void *ptr)
+{
+    size_t index = pageIndex(los, ptr);
+    size_t length = los->pageMap[index] * SYSTEM_PAGE_SIZE;
+    assert(length != 0);
+    assert(length <= los->bytesAllocated);
+    los->pageMap[index] = 0;
+    madvise(ptr, length, MADV_DONTNEED);
+    mprotect(ptr, length, PROT_NONE);
+    returnAddressSpace(los, (char *)ptr, length);
+    los->bytesAllocated -= length;
+    los->objectsAllocated--;
+    return length;
+}
+
+size_t dvmLargeObjectSpaceObjectSize(const LargeObjectSpace *los,
+                                     const void *ptr)
+{
+    if (((uintptr_t)ptr & (SYSTEM_PAGE_SIZE - 1)) != 0) {
+        return 0;
+    }
+    return los->pageMap[pageIndex(los, ptr)] * SYSTEM_PAGE_SIZE;
+}
+
+void dvmLargeObjectSpaceWalk(const LargeObjectSpace *los,
+                             void(*callback)(void* start, void* end,
+                                             size_t used_bytes, void* arg),
+                             void *arg)
+{
+    char *addr = los->base;
+    while (addr < los->brk) {
+        size_t length = los->pageMap[pageIndex(los, addr)] * SYSTEM_PAGE_SIZE;
+        if (length != 0) {
+            callback(addr, addr + length, length, arg);
+            addr += length;
+        } else {
+            addr += SYSTEM_PAGE_SIZE;
+        }
+    }
+}
+
+bool dvmLargeObjectSpaceContains(const LargeObjectSpace *los,
+                                 const void *ptr)
+{
+    return (const char *)ptr >= los->base &&
+           (const char *)ptr < los->base + los->length;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A page-granular space for large objects.  Each object gets its own
+ * run of pages inside a reserved range of address space; the pages
+ * are made accessible when the object is allocated and are given back
+ * to the kernel when it is freed.
+ */
+
+#ifndef DALVIK_ALLOC_LARGEOBJECTSPACE_H_
+#define DALVIK_ALLOC_LARGEOBJECTSPACE_H_
+
+struct LargeExtent;
+
+struct LargeObjectSpace {
+    /* The reserved range of address space, page aligned.
+     */
+    char *base;
+    size_t length;
+
+    /* The end of the highest object ever allocated; pages at and
+     * above this address have never been handed out.
+     */
+    char *brk;
+
+    /* One entry per page.  The first page of an object holds the
+     * object's length in pages; every other entry is zero.
+     */
+    u4 *pageMap;
+    size_t pageMapLength;
+
+    /* Free extents below brk, in address order.
+     */
+    LargeExtent *freeList;
+
+    /* Bytes and objects currently allocated.
+     */
+    size_t bytesAllocated;
+    size_t objectsAllocated;
+};
+
+/*
+ * Sets up a large object space over the reservation [base, base+length).
+ * The reservation must already be mapped PROT_NONE.
+ */
+bool dvmLargeObjectSpaceInit(LargeObjectSpace *los, void *base,
+                             size_t length);
+
+/*
+ * Releases the bookkeeping of a large object space.  Does not unmap
+ * the reservation.
+ */
+void dvmLargeObjectSpaceDelete(LargeObjectSpace *los);
+
+/*
+ * Allocates <n> bytes of zeroed, page-aligned memory.  Returns NULL if
+ * there is no room left in the reservation.
+ */
+void *dvmLargeObjectSpaceAlloc(LargeObjectSpace *los, size_t n);
+
+/*
+ * Frees an object returned by dvmLargeObjectSpaceAlloc() and returns
+ * the number of bytes given back.
+ */
+size_t dvmLargeObjectSpaceFree(LargeObjectSpace *los, void *ptr);
+
+/*
+ * Returns the number of usable bytes of the object at <ptr>, or zero
+ * if no object starts there.
+ */
+size_t dvmLargeObjectSpaceObjectSize(const LargeObjectSpace *los,
+                                     const void *ptr);
+
+/*
+ * Passes every allocated object to the callback, in address order.
+ */
+void dvmLargeObjectSpaceWalk(const LargeObjectSpace *los,
+                             void(*callback)(void* start, void* end,
+                                             size_t used_bytes, void* arg),
+                             void *arg);
+
+/*
+ * Returns true iff <ptr> lies in the reservation.
+ */
+bool dvmLargeObjectSpaceContains(const LargeObjectSpace *los,
+                                 const void *ptr);
+
+#endif  // DALVIK_ALLOC_LARGEOBJECTSPACE_H_
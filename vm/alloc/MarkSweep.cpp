@@ -83,20 +83,209 @@ static const Object *markStackPop(GcMarkStack *stack)
     return *stack->top;
 }
 
-bool dvmHeapBeginMarkStep(bool isPartial)
+/*
+ * Parallel marking.
+ *
+ * When more than one mark thread is configured, the bitmap scan is
+ * split into fixed-size address chunks which the GC thread and a pool
+ * of helper threads claim in increasing address order.  (The same
+ * pool also sweeps; see parallelSweep().)  Each worker
+ * marks with an atomic test-and-set and pushes newly marked objects on
+ * a small private stack, except for objects that a bitmap walk is
+ * still due to visit: those ahead of the finger in the worker's own
+ * chunk, and those in chunks nobody has claimed yet.  Workers with
+ * more work than they need hand batches to the shared stack, from
+ * which idle workers steal.  Marking terminates once every worker is
+ * idle and the shared stack is empty.
+ *
+ * Long reference lists are processed the same way: the workers take
+ * batches of references off a list, and a mark that blackens referents
+ * is followed by a drain of the workers' stacks in which they steal
+ * from each other as above.
+ *
+ * The roots are marked by the same pool: the workers claim units of
+ * the root set (see dvmBeginParallelRootVisit()) and mark them with
+ * the atomic test-and-set.  When the roots must be grayed, as for a
+ * sticky mark or the re-mark, the workers push them on their private
+ * stacks, which overflow to the shared stack and are emptied onto it
+ * at the end.
+ */
+#define MARK_CHUNK_SIZE         (256 * 1024)
+#define MARK_LOCAL_STACK_SIZE   1024
+
+/* The heaps and the large object space. */
+#define SWEEP_MAX_REGIONS       (HEAP_SOURCE_MAX_HEAP_COUNT + 1)
+
+struct GcMarkPool;
+
+struct GcMarkWorker {
+    GcMarkContext ctx;
+    GcMarkPool *pool;
+    /* End of the chunk being walked, or 0 if not walking one. */
+    uintptr_t chunkLimit;
+    pthread_t thread;
+
+    /* Sweep state; see runSweepWorker(). */
+    size_t sweepCount;
+    size_t sweptObjects;
+    size_t sweptBytes;
+    size_t sweptStripes;
+    u8 sweepUsec;
+    u8 maxStripeUsec;
+};
+
+typedef void GcWorkerTask(GcMarkWorker *worker);
+
+enum ReferencePass {
+    REFERENCE_PASS_PRESERVE,    // preserveSomeSoftReferences()
+    REFERENCE_PASS_CLEAR,       // clearWhiteReferences()
+    REFERENCE_PASS_FINALIZE     // enqueueFinalizerReferences()
+};
+
+struct GcMarkPool {
+    pthread_mutex_t lock;
+    pthread_cond_t startCond;       // a new mark has begun
+    pthread_cond_t workCond;        // work was shared, or marking ended
+    pthread_cond_t doneCond;        // the last helper went idle
+    pthread_mutex_t referenceLock;  // guards the gcHeap reference lists
+
+    GcWorkerTask *task;             // what the workers are to run
+    GcMarkWorker *workers;          // workers[0] is the GC thread
+    size_t numWorkers;
+    size_t runningHelpers;
+    size_t idleWorkers;
+    unsigned int generation;
+    bool done;
+    bool shutdown;
+
+    /* Overflow and stealing happen through the regular mark stack. */
+    GcMarkStack *shared;
+
+    uintptr_t base;
+    uintptr_t limit;
+    int32_t numChunks;
+    volatile int32_t nextChunk;
+
+    /* Sweep state.  Stripes are numbered across the swept heaps, the
+     * large object space counting as one more heap; heap i holds
+     * stripes firstStripe[i] up to firstStripe[i + 1].
+     */
+    const HeapBitmap *sweepLive;
+    const HeapBitmap *sweepMark;
+    uintptr_t sweepBase[SWEEP_MAX_REGIONS];
+    uintptr_t sweepMax[SWEEP_MAX_REGIONS];
+    int32_t firstStripe[SWEEP_MAX_REGIONS + 1];
+    size_t numSweepHeaps;
+    bool sweepConcurrent;
+    pthread_mutex_t sweepLock;      // serializes frees in a paused sweep
+
+    /* Reference processing state; see runReferenceWorker().  The
+     * lists are guarded by referenceLock.
+     */
+    ReferencePass refPass;
+    Object **refList;               // references yet to be processed
+    Object *refKept;                // soft references left to clear
+
+    /* Root marking state; see parallelMarkRoots(). */
+    bool pushRoots;
+
+    /* Bitmap walk state; see dvmHeapParallelBitmapWalk(). */
+    HeapBitmap *walkBitmap;
+    BitmapCallback *walkCallback;
+    void *walkArg;
+};
+
+static GcMarkPool *gMarkPool;
+
+/*
+ * Returns true if a bitmap walk has yet to reach <obj>, in which case
+ * it does not need to be pushed on a mark stack.  The caller must have
+ * set the mark bit with a barrier before checking the chunk counter.
+ */
+static bool isAheadOfScan(const GcMarkWorker *worker, const Object *obj)
 {
-    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    if ((const void *)obj >= worker->ctx.finger &&
+        (uintptr_t)obj < worker->chunkLimit) {
+        return true;
+    }
+    const GcMarkPool *pool = worker->pool;
+    if ((uintptr_t)obj >= pool->limit) {
+        /* Allocated after the scan started. */
+        return false;
+    }
+    /* Pairs with the barrier after a chunk is claimed: either its
+     * walker sees our mark bit or we see that the chunk is claimed.
+     */
+    ANDROID_MEMBAR_FULL();
+    int32_t chunk = ((uintptr_t)obj - pool->base) / MARK_CHUNK_SIZE;
+    return chunk >= pool->nextChunk;
+}
+
+/*
+ * Moves the upper half of a worker's private stack to the shared
+ * stack and wakes an idle worker to take it.
+ */
+static void shareMarkStack(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    GcMarkStack *stack = &worker->ctx.stack;
+    size_t count = (stack->top - stack->base) / 2;
+    if (count == 0) {
+        return;
+    }
+    stack->top -= count;
+    dvmLockMutex(&pool->lock);
+    GcMarkStack *shared = pool->shared;
+    assert(shared->top + count < shared->limit);
+    memcpy(shared->top, stack->top, count * sizeof(*stack->top));
+    shared->top += count;
+    if (pool->idleWorkers > 0) {
+        pthread_cond_signal(&pool->workCond);
+    }
+    dvmUnlockMutex(&pool->lock);
+}
+
+/*
+ * Pushes a newly marked object on a worker's private stack, sharing
+ * half of it first if it is almost full.
+ */
+static void parallelMarkStackPush(GcMarkWorker *worker, const Object *obj)
+{
+    GcMarkStack *stack = &worker->ctx.stack;
+    if (stack->top + 1 >= stack->limit) {
+        shareMarkStack(worker);
+    }
+    markStackPush(stack, obj);
+}
+
+bool dvmHeapBeginMarkStep(bool isPartial, bool isSticky)
+{
+    GcHeap *gcHeap = gDvm.gcHeap;
+    GcMarkContext *ctx = &gcHeap->markContext;
 
     if (!createMarkStack(&ctx->stack)) {
         return false;
     }
+    /* A sticky GC starts with everything that survived the last GC
+     * marked; any other GC needs empty mark bits.
+     */
+    assert(!isSticky || gcHeap->hasLiveSnapshot);
+    if (!isSticky && gcHeap->hasLiveSnapshot) {
+        dvmHeapSourceZeroMarkBitmap();
+    }
+    gcHeap->hasLiveSnapshot = false;
+    ctx->isSticky = isSticky;
     ctx->finger = NULL;
+    ctx->worker = NULL;
     ctx->immuneLimit = (char*)dvmHeapSourceGetImmuneLimit(isPartial);
     return true;
 }
 
 static long setAndReturnMarkBit(GcMarkContext *ctx, const void *obj)
 {
+    if (ctx->worker != NULL) {
+        return dvmHeapBitmapAtomicSetAndReturnObjectBit(ctx->bitmap, obj);
+    }
     return dvmHeapBitmapSetAndReturnObjectBit(ctx->bitmap, obj);
 }
 
@@ -113,7 +302,12 @@ static void markObjectNonNull(const Object *obj, GcMarkContext *ctx,
     if (!setAndReturnMarkBit(ctx, obj)) {
         /* This object was not previously marked.
          */
-        if (checkFinger && (void *)obj < ctx->finger) {
+        if (ctx->worker != NULL) {
+            assert(checkFinger);
+            if (!isAheadOfScan(ctx->worker, obj)) {
+                parallelMarkStackPush(ctx->worker, obj);
+            }
+        } else if (checkFinger && (void *)obj < ctx->finger) {
             /* This object will need to go on the mark stack.
              */
             markStackPush(&ctx->stack, obj);
@@ -151,6 +345,27 @@ static void rootMarkObjectVisitor(void *addr, u4 thread, RootType type,
     }
 }
 
+static void rootReMarkObjectVisitor(void *addr, u4 thread, RootType type,
+                                    void *arg);
+static bool parallelMarkRoots(GcMarkContext *ctx, RootVisitor *visitor,
+                              bool withThreads);
+
+/*
+ * Returns the visitor for the initial marking of the roots.
+ */
+static RootVisitor *rootMarkVisitor(GcMarkContext *ctx)
+{
+    if (ctx->isSticky) {
+        /* There is no bitmap walk to find the newly marked roots, so
+         * they go on the mark stack.  Immune objects are part of the
+         * snapshot already.
+         */
+        ctx->finger = (void *)ULONG_MAX;
+        return rootReMarkObjectVisitor;
+    }
+    return rootMarkObjectVisitor;
+}
+
 /* Mark the set of root objects.
  *
  * Things we need to scan:
@@ -177,9 +392,58 @@ static void rootMarkObjectVisitor(void *addr, u4 thread, RootType type,
  */
 void dvmHeapMarkRootSet()
 {
-    GcHeap *gcHeap = gDvm.gcHeap;
-    dvmMarkImmuneObjects(gcHeap->markContext.immuneLimit);
-    dvmVisitRoots(rootMarkObjectVisitor, &gcHeap->markContext);
+    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    if (!ctx->isSticky) {
+        dvmMarkImmuneObjects(ctx->immuneLimit);
+    }
+    RootVisitor *visitor = rootMarkVisitor(ctx);
+    if (!parallelMarkRoots(ctx, visitor, true)) {
+        dvmVisitRoots(visitor, ctx);
+    }
+}
+
+/*
+ * Like dvmHeapMarkRootSet(), but leaves out the roots of the threads,
+ * which are marked by dvmHeapMarkThreadRootSet() once the mutators
+ * have been resumed.
+ */
+void dvmHeapMarkGlobalRootSet()
+{
+    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    if (!ctx->isSticky) {
+        dvmMarkImmuneObjects(ctx->immuneLimit);
+    }
+    RootVisitor *visitor = rootMarkVisitor(ctx);
+    if (!parallelMarkRoots(ctx, visitor, false)) {
+        dvmVisitGlobalRoots(visitor, ctx);
+    }
+}
+
+/*
+ * Marks the roots of each thread in turn, suspending only that thread
+ * while its stack and local references are scanned.  For a concurrent
+ * collection, after dvmHeapMarkGlobalRootSet() and before the marked
+ * objects are scanned.  A thread that changes its references after its
+ * turn is caught by the remark pause, which rescans all the roots.
+ */
+void dvmHeapMarkThreadRootSet()
+{
+    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    RootVisitor *visitor = rootMarkVisitor(ctx);
+    Thread *self = dvmThreadSelf();
+    dvmLockThreadList(self);
+    for (Thread *thread = gDvm.threadList;
+         thread != NULL;
+         thread = thread->next) {
+        if (thread == self) {
+            dvmVisitThreadRoots(visitor, thread, ctx);
+            continue;
+        }
+        dvmSuspendThreadForGc(thread);
+        dvmVisitThreadRoots(visitor, thread, ctx);
+        dvmResumeThreadForGc(thread);
+    }
+    dvmUnlockThreadList();
 }
 
 /*
@@ -205,7 +469,9 @@ void dvmHeapReMarkRootSet()
 {
     GcMarkContext *ctx = &gDvm.gcHeap->markContext;
     assert(ctx->finger == (void *)ULONG_MAX);
-    dvmVisitRoots(rootReMarkObjectVisitor, ctx);
+    if (!parallelMarkRoots(ctx, rootReMarkObjectVisitor, true)) {
+        dvmVisitRoots(rootReMarkObjectVisitor, ctx);
+    }
 }
 
 /*
@@ -225,6 +491,12 @@ static void scanFields(const Object *obj, GcMarkContext *ctx)
             markObject(ref, ctx);
             refOffsets &= ~(CLASS_HIGH_BIT >> rshift);
         }
+    } else if (obj->clazz->refOffsetList != NULL) {
+        const u2 *offsets = obj->clazz->refOffsetList;
+        size_t count = obj->clazz->refOffsetCount;
+        for (size_t i = 0; i < count; ++i) {
+            markObject(dvmGetFieldObject(obj, offsets[i]), ctx);
+        }
     } else {
         for (ClassObject *clazz = obj->clazz;
              clazz != NULL;
@@ -286,6 +558,7 @@ static void scanClassObject(const Object *obj, GcMarkContext *ctx)
         markObject((const Object *)asClass->super, ctx);
     }
     markObject((const Object *)asClass->classLoader, ctx);
+    markObject((const Object *)asClass->nameString, ctx);
     scanFields(obj, ctx);
     scanStaticFields(asClass, ctx);
     if (asClass->status > CLASS_IDX) {
@@ -397,6 +670,46 @@ static Object *dequeuePendingReference(Object **list)
     return ref;
 }
 
+/*
+ * Appends a circular queue of references to another.
+ */
+static void splicePendingReferences(Object *refs, Object **list)
+{
+    assert(list != NULL);
+    if (refs == NULL) {
+        return;
+    }
+    if (*list != NULL) {
+        size_t offset = gDvm.offJavaLangRefReference_pendingNext;
+        Object *head = dvmGetFieldObject(*list, offset);
+        dvmSetFieldObject(*list, offset, dvmGetFieldObject(refs, offset));
+        dvmSetFieldObject(refs, offset, head);
+    }
+    *list = refs;
+}
+
+/*
+ * Holds the reference list lock for the scope of a parallel worker.
+ */
+class ScopedReferenceLock {
+public:
+    explicit ScopedReferenceLock(const GcMarkContext *ctx)
+        : mLock(ctx->worker != NULL ? &ctx->worker->pool->referenceLock : NULL)
+    {
+        if (mLock != NULL) {
+            dvmLockMutex(mLock);
+        }
+    }
+    ~ScopedReferenceLock()
+    {
+        if (mLock != NULL) {
+            dvmUnlockMutex(mLock);
+        }
+    }
+private:
+    pthread_mutex_t *mLock;
+};
+
 /*
  * Process the "referent" field in a java.lang.ref.Reference.  If the
  * referent has not yet been marked, put it on the appropriate list in
@@ -411,6 +724,8 @@ static void delayReferenceReferent(Object *obj, GcMarkContext *ctx)
     GcHeap *gcHeap = gDvm.gcHeap;
     size_t pendingNextOffset = gDvm.offJavaLangRefReference_pendingNext;
     size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    /* Parallel workers may scan the same reference twice. */
+    ScopedReferenceLock lock(ctx);
     Object *pending = dvmGetFieldObject(obj, pendingNextOffset);
     Object *referent = dvmGetFieldObject(obj, referentOffset);
     if (pending == NULL && referent != NULL && !isMarked(referent, ctx)) {
@@ -511,16 +826,17 @@ static Object *nextGrayObject(const u1 *base, const u1 *limit,
 /*
  * Scans range of dirty cards between start and end.  A range of dirty
  * cards is composed consecutively dirty cards or dirty cards spanned
- * by a gray object.  Returns the address of a clean card if the scan
- * reached a clean card or NULL if the scan reached the end.
+ * by a gray object.  Cards with a value of at least minCard count as
+ * dirty.  Returns the address of a clean card if the scan reached a
+ * clean card or NULL if the scan reached the end.
  */
 const u1 *scanDirtyCards(const u1 *start, const u1 *end,
-                         GcMarkContext *ctx)
+                         GcMarkContext *ctx, u1 minCard)
 {
     const HeapBitmap *markBits = ctx->bitmap;
     const u1 *card = start, *prevAddr = NULL;
     while (card < end) {
-        if (*card != GC_CARD_DIRTY) {
+        if (*card < minCard) {
             return card;
         }
         const u1 *ptr = prevAddr ? prevAddr : (u1*)dvmAddrFromCard(card);
@@ -547,26 +863,22 @@ const u1 *scanDirtyCards(const u1 *start, const u1 *end,
 }
 
 /*
- * Blackens gray objects found on dirty cards.
+ * Blackens gray objects found on the cards in [base, limit) with a
+ * value of at least minCard.
  */
-static void scanGrayObjects(GcMarkContext *ctx)
+static void scanGrayObjectsInRange(GcMarkContext *ctx, const u1 *base,
+                                   const u1 *limit, u1 minCard)
 {
-    GcHeap *h = gDvm.gcHeap;
-    const u1 *base, *limit, *ptr, *dirty;
-
-    base = &h->cardTableBase[0];
-    // The limit is the card one after the last accessible card.
-    limit = dvmCardFromAddr((u1 *)dvmHeapSourceGetLimit() - GC_CARD_SIZE) + 1;
-    assert(limit <= &base[h->cardTableOffset + h->cardTableLength]);
+    const u1 *ptr, *dirty;
 
     ptr = base;
     for (;;) {
-        dirty = (const u1 *)memchr(ptr, GC_CARD_DIRTY, limit - ptr);
+        dirty = dvmFindCard(ptr, limit, minCard);
         if (dirty == NULL) {
             break;
         }
-        assert((dirty > ptr) && (dirty < limit));
-        ptr = scanDirtyCards(dirty, limit, ctx);
+        assert((dirty >= ptr) && (dirty < limit));
+        ptr = scanDirtyCards(dirty, limit, ctx, minCard);
         if (ptr == NULL) {
             break;
         }
@@ -574,6 +886,49 @@ static void scanGrayObjects(GcMarkContext *ctx)
     }
 }
 
+/*
+ * Blackens gray objects found on cards with a value of at least
+ * minCard.
+ */
+static void scanGrayObjects(GcMarkContext *ctx, u1 minCard)
+{
+    GcHeap *h = gDvm.gcHeap;
+    const u1 *base = &h->cardTableBase[0];
+    // The limit is the card one after the last accessible card.
+    const u1 *limit =
+        dvmCardFromAddr((u1 *)dvmHeapSourceGetLimit() - GC_CARD_SIZE) + 1;
+    assert(limit <= &base[h->cardTableOffset + h->cardTableLength]);
+    scanGrayObjectsInRange(ctx, base, limit, minCard);
+}
+
+/*
+ * Returns the lowest address a collection may free.
+ */
+static uintptr_t threatenedBase(const GcMarkContext *ctx)
+{
+    if (ctx->immuneLimit != NULL) {
+        return (uintptr_t)ctx->immuneLimit;
+    }
+    return ctx->bitmap->base;
+}
+
+/*
+ * Scans the immune objects that may refer to threatened ones.  Every
+ * immune object is marked, but only those on cards dirtied since the
+ * zygote heap was split off can refer outside it, and the cards of the
+ * immune range are never cleaned.  The rest are never read, so their
+ * pages stay shared with the zygote.
+ */
+static void scanImmuneObjects(GcMarkContext *ctx)
+{
+    uintptr_t base = ctx->bitmap->base;
+    uintptr_t limit = threatenedBase(ctx);
+    if (limit > base) {
+        scanGrayObjectsInRange(ctx, dvmCardFromAddr((void *)base),
+                               dvmCardFromAddr((void *)limit), GC_CARD_AGED);
+    }
+}
+
 /*
  * Callback for scanning each object in the bitmap.  The finger is set
  * to the address corresponding to the lowest address in the next word
@@ -586,6 +941,401 @@ static void scanBitmapCallback(Object *obj, void *finger, void *arg)
     scanObject(obj, ctx);
 }
 
+/*
+ * Scans the objects on a worker's private stack until it is empty,
+ * sharing work whenever another worker is idle.
+ */
+static void drainWorkerStack(GcMarkWorker *worker)
+{
+    GcMarkContext *ctx = &worker->ctx;
+    GcMarkStack *stack = &ctx->stack;
+    ctx->finger = (void *)ULONG_MAX;
+    worker->chunkLimit = 0;
+    while (stack->top > stack->base) {
+        if (worker->pool->idleWorkers > 0) {
+            shareMarkStack(worker);
+        }
+        const Object *obj = markStackPop(stack);
+        scanObject(obj, ctx);
+    }
+}
+
+/*
+ * Waits for work to appear on the shared stack and moves a batch of
+ * it to the worker's private stack.  Returns false once every worker
+ * has run out of work.
+ */
+static bool stealMarkWork(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    GcMarkStack *stack = &worker->ctx.stack;
+    bool found = false;
+    dvmLockMutex(&pool->lock);
+    pool->idleWorkers++;
+    for (;;) {
+        GcMarkStack *shared = pool->shared;
+        size_t available = shared->top - shared->base;
+        if (available > 0) {
+            size_t count = MIN(available, MARK_LOCAL_STACK_SIZE / 2);
+            shared->top -= count;
+            memcpy(stack->top, shared->top, count * sizeof(*stack->top));
+            stack->top += count;
+            pool->idleWorkers--;
+            found = true;
+            break;
+        }
+        if (pool->done) {
+            break;
+        }
+        if (pool->idleWorkers == pool->numWorkers) {
+            pool->done = true;
+            pthread_cond_broadcast(&pool->workCond);
+            break;
+        }
+        dvmWaitCond(&pool->workCond, &pool->lock);
+    }
+    dvmUnlockMutex(&pool->lock);
+    return found;
+}
+
+/*
+ * Callback for scanning each object in a bitmap chunk.
+ */
+static void parallelScanBitmapCallback(Object *obj, void *finger, void *arg)
+{
+    GcMarkWorker *worker = (GcMarkWorker *)arg;
+    worker->ctx.finger = finger;
+    scanObject(obj, &worker->ctx);
+}
+
+/*
+ * Marks from chunks of the bitmap and from stolen work until all
+ * workers have finished.
+ */
+static void runMarkWorker(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    for (;;) {
+        int32_t chunk = android_atomic_inc(&pool->nextChunk);
+        if (chunk < pool->numChunks) {
+            uintptr_t base = pool->base + chunk * MARK_CHUNK_SIZE;
+            uintptr_t limit = MIN(base + MARK_CHUNK_SIZE, pool->limit);
+            worker->ctx.finger = (void *)base;
+            worker->chunkLimit = limit;
+            ANDROID_MEMBAR_FULL();
+            dvmHeapBitmapScanWalkRange(worker->ctx.bitmap, base, limit,
+                                       parallelScanBitmapCallback, worker);
+        } else if (!stealMarkWork(worker)) {
+            break;
+        }
+        drainWorkerStack(worker);
+    }
+    assert(worker->ctx.stack.top == worker->ctx.stack.base);
+}
+
+static void *markHelperThreadStart(void *arg)
+{
+    GcMarkWorker *worker = (GcMarkWorker *)arg;
+    GcMarkPool *pool = worker->pool;
+    unsigned int generation = 0;
+    dvmLockMutex(&pool->lock);
+    for (;;) {
+        while (pool->generation == generation && !pool->shutdown) {
+            dvmWaitCond(&pool->startCond, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        generation = pool->generation;
+        GcWorkerTask *task = pool->task;
+        dvmUnlockMutex(&pool->lock);
+        (*task)(worker);
+        dvmLockMutex(&pool->lock);
+        assert(pool->runningHelpers > 0);
+        if (--pool->runningHelpers == 0) {
+            dvmSignalCond(&pool->doneCond);
+        }
+    }
+    dvmUnlockMutex(&pool->lock);
+    return NULL;
+}
+
+/*
+ * Creates the mark thread pool.  The helper threads are not attached
+ * to the VM; they only ever touch the heap while the GC thread waits
+ * for them.  Returns NULL if no helper could be started.
+ */
+static GcMarkPool *createMarkPool(size_t numWorkers)
+{
+    GcMarkPool *pool = (GcMarkPool *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->workers = (GcMarkWorker *)calloc(numWorkers, sizeof(GcMarkWorker));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+    dvmInitMutex(&pool->lock);
+    dvmInitMutex(&pool->referenceLock);
+    dvmInitMutex(&pool->sweepLock);
+    pthread_cond_init(&pool->startCond, NULL);
+    pthread_cond_init(&pool->workCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+    for (size_t i = 0; i < numWorkers; ++i) {
+        GcMarkWorker *worker = &pool->workers[i];
+        GcMarkStack *stack = &worker->ctx.stack;
+        stack->length = MARK_LOCAL_STACK_SIZE * sizeof(*stack->base);
+        stack->base = (const Object **)malloc(stack->length);
+        if (stack->base == NULL) {
+            break;
+        }
+        stack->limit = stack->base + MARK_LOCAL_STACK_SIZE;
+        stack->top = stack->base;
+        worker->ctx.worker = worker;
+        worker->pool = pool;
+        if (i > 0) {
+            int cc = pthread_create(&worker->thread, NULL,
+                                    markHelperThreadStart, worker);
+            if (cc != 0) {
+                ALOGW("Unable to create mark thread: %s", strerror(cc));
+                free(stack->base);
+                break;
+            }
+        }
+        pool->numWorkers++;
+    }
+    if (pool->numWorkers < 2) {
+        ALOGW("Parallel marking disabled");
+    } else {
+        ALOGV("Started %zu mark threads", pool->numWorkers - 1);
+    }
+    return pool;
+}
+
+/*
+ * Returns the worker pool, starting it if needed, or NULL if the heap
+ * should be traced and swept by the GC thread alone.  The zygote stays
+ * single-threaded so that it can fork.
+ */
+static GcMarkPool *getMarkPool()
+{
+    if (gDvm.markThreads < 2 || gDvm.zygote) {
+        return NULL;
+    }
+    if (gMarkPool == NULL) {
+        gMarkPool = createMarkPool(gDvm.markThreads);
+    }
+    if (gMarkPool == NULL || gMarkPool->numWorkers < 2) {
+        return NULL;
+    }
+    return gMarkPool;
+}
+
+/*
+ * Runs a task on every worker, including the calling GC thread, and
+ * waits for all of them to finish.
+ */
+static void runWorkerTask(GcMarkPool *pool, GcWorkerTask *task)
+{
+    dvmLockMutex(&pool->lock);
+    pool->task = task;
+    pool->generation++;
+    pool->runningHelpers = pool->numWorkers - 1;
+    pthread_cond_broadcast(&pool->startCond);
+    dvmUnlockMutex(&pool->lock);
+
+    (*task)(&pool->workers[0]);
+
+    dvmLockMutex(&pool->lock);
+    while (pool->runningHelpers > 0) {
+        dvmWaitCond(&pool->doneCond, &pool->lock);
+    }
+    dvmUnlockMutex(&pool->lock);
+}
+
+/*
+ * Parallel version of the bitmap scan and mark stack processing done
+ * by dvmHeapScanMarkedObjects.
+ */
+static void parallelScanMarkedObjects(GcMarkPool *pool, GcMarkContext *ctx)
+{
+    assert(ctx->stack.top == ctx->stack.base);
+    pool->shared = &ctx->stack;
+    pool->base = threatenedBase(ctx);
+    pool->limit = ALIGN_UP(dvmHeapSourceGetLimit(),
+                           HB_BITS_PER_WORD * HB_OBJECT_ALIGNMENT);
+    pool->numChunks = (pool->limit - pool->base + MARK_CHUNK_SIZE - 1) /
+                      MARK_CHUNK_SIZE;
+    pool->nextChunk = 0;
+    pool->idleWorkers = 0;
+    pool->done = false;
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        GcMarkWorker *worker = &pool->workers[i];
+        worker->ctx.bitmap = ctx->bitmap;
+        worker->ctx.immuneLimit = ctx->immuneLimit;
+        worker->ctx.finger = (void *)ULONG_MAX;
+        worker->chunkLimit = 0;
+        assert(worker->ctx.stack.top == worker->ctx.stack.base);
+    }
+    runWorkerTask(pool, runMarkWorker);
+    assert(ctx->stack.top == ctx->stack.base);
+}
+
+/*
+ * Callback applied to root references on the mark threads.  Marks white
+ * objects, and pushes them on the worker's stack if the roots are to be
+ * grayed.
+ */
+static void parallelRootMarkVisitor(void *addr, u4 thread, RootType type,
+                                    void *arg)
+{
+    assert(addr != NULL);
+    Object *obj = *(Object **)addr;
+    GcMarkWorker *worker = (GcMarkWorker *)arg;
+    if (obj == NULL || obj < (Object *)worker->ctx.immuneLimit) {
+        return;
+    }
+    assert(dvmIsValidObject(obj));
+    if (!dvmHeapBitmapAtomicSetAndReturnObjectBit(worker->ctx.bitmap, obj) &&
+        worker->pool->pushRoots) {
+        parallelMarkStackPush(worker, obj);
+    }
+}
+
+/*
+ * Hands out units of the root set until none are left.
+ */
+static void runRootMarkWorker(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    for (;;) {
+        int32_t unit = android_atomic_inc(&pool->nextChunk);
+        if (unit >= pool->numChunks) {
+            break;
+        }
+        dvmVisitRootUnit(unit, parallelRootMarkVisitor, worker);
+    }
+}
+
+/*
+ * Parallel version of the root visits in dvmHeapMarkRootSet() and
+ * friends, where <visitor> is the one the GC thread would have used.
+ * Leaves the grayed roots, if any, on the mark stack.  Returns false,
+ * having done nothing, if there are no mark threads to run it on.
+ */
+static bool parallelMarkRoots(GcMarkContext *ctx, RootVisitor *visitor,
+                              bool withThreads)
+{
+    GcMarkPool *pool = getMarkPool();
+    if (pool == NULL) {
+        return false;
+    }
+    size_t numUnits = dvmBeginParallelRootVisit(withThreads);
+    if (numUnits == 0) {
+        return false;
+    }
+    pool->shared = &ctx->stack;
+    pool->pushRoots = (visitor == rootReMarkObjectVisitor);
+    pool->numChunks = numUnits;
+    pool->nextChunk = 0;
+    pool->idleWorkers = 0;
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        GcMarkWorker *worker = &pool->workers[i];
+        worker->ctx.bitmap = ctx->bitmap;
+        worker->ctx.immuneLimit = ctx->immuneLimit;
+        assert(worker->ctx.stack.top == worker->ctx.stack.base);
+    }
+    runWorkerTask(pool, runRootMarkWorker);
+    dvmEndParallelRootVisit();
+
+    /* The workers' stacks hold what didn't overflow. */
+    GcMarkStack *shared = &ctx->stack;
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        GcMarkStack *stack = &pool->workers[i].ctx.stack;
+        size_t count = stack->top - stack->base;
+        assert(shared->top + count < shared->limit);
+        memcpy(shared->top, stack->base, count * sizeof(*stack->base));
+        shared->top += count;
+        stack->top = stack->base;
+    }
+    return true;
+}
+
+static void parallelWalkBitmapCallback(Object *obj, void *finger, void *arg)
+{
+    const GcMarkPool *pool = (const GcMarkPool *)arg;
+    (*pool->walkCallback)(obj, pool->walkArg);
+}
+
+/*
+ * Hands out chunks of the walked bitmap until none are left.
+ */
+static void runBitmapWalkWorker(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    for (;;) {
+        int32_t chunk = android_atomic_inc(&pool->nextChunk);
+        if (chunk >= pool->numChunks) {
+            break;
+        }
+        uintptr_t base = pool->base + chunk * MARK_CHUNK_SIZE;
+        uintptr_t limit = MIN(base + MARK_CHUNK_SIZE, pool->limit);
+        dvmHeapBitmapScanWalkRange(pool->walkBitmap, base, limit,
+                                   parallelWalkBitmapCallback, pool);
+    }
+}
+
+/*
+ * Calls <callback> for each object in <bitmap>, in no particular order,
+ * on the mark threads.  The callback may run on several threads at
+ * once and must not change the bitmap.  Returns false, having done
+ * nothing, if there are no mark threads to run it on.
+ */
+bool dvmHeapParallelBitmapWalk(HeapBitmap *bitmap, BitmapCallback *callback,
+                               void *arg)
+{
+    GcMarkPool *pool = getMarkPool();
+    if (pool == NULL) {
+        return false;
+    }
+    pool->walkBitmap = bitmap;
+    pool->walkCallback = callback;
+    pool->walkArg = arg;
+    pool->base = bitmap->base;
+    pool->limit = ALIGN_UP(bitmap->max + HB_OBJECT_ALIGNMENT,
+                           HB_BITS_PER_WORD * HB_OBJECT_ALIGNMENT);
+    pool->numChunks = (pool->limit - pool->base + MARK_CHUNK_SIZE - 1) /
+                      MARK_CHUNK_SIZE;
+    pool->nextChunk = 0;
+    runWorkerTask(pool, runBitmapWalkWorker);
+    return true;
+}
+
+/*
+ * Stops the parallel mark threads, if any were started.
+ */
+void dvmHeapShutdownMarkThreads()
+{
+    GcMarkPool *pool = gMarkPool;
+    if (pool == NULL) {
+        return;
+    }
+    dvmLockMutex(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->startCond);
+    dvmUnlockMutex(&pool->lock);
+    for (size_t i = 1; i < pool->numWorkers; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        free(pool->workers[i].ctx.stack.base);
+    }
+    free(pool->workers);
+    free(pool);
+    gMarkPool = NULL;
+}
+
 /* Given bitmaps with the root set marked, find and mark all
  * reachable objects.  When this returns, the entire set of
  * live objects will be marked and the mark stack will be empty.
@@ -594,12 +1344,35 @@ void dvmHeapScanMarkedObjects(void)
 {
     GcMarkContext *ctx = &gDvm.gcHeap->markContext;
 
+    if (ctx->isSticky) {
+        /* Besides the roots, only objects on cards dirtied since the
+         * last GC can point to objects allocated since then.
+         */
+        assert(ctx->finger == (void *)ULONG_MAX);
+        scanGrayObjects(ctx, GC_CARD_AGED);
+        processMarkStack(ctx);
+        return;
+    }
+
     assert(ctx->finger == NULL);
 
+    /* Anything the immune objects mark is above the finger, and is
+     * found by the walk of the threatened range.
+     */
+    scanImmuneObjects(ctx);
+
+    GcMarkPool *pool = getMarkPool();
+    if (pool != NULL) {
+        parallelScanMarkedObjects(pool, ctx);
+        ctx->finger = (void *)ULONG_MAX;
+        return;
+    }
+
     /* The bitmaps currently have bits set for the root set.
      * Walk across the bitmaps and scan each object.
      */
-    dvmHeapBitmapScanWalk(ctx->bitmap, scanBitmapCallback, ctx);
+    dvmHeapBitmapScanWalkFrom(ctx->bitmap, threatenedBase(ctx),
+                              scanBitmapCallback, ctx);
 
     ctx->finger = (void *)ULONG_MAX;
 
@@ -609,6 +1382,39 @@ void dvmHeapScanMarkedObjects(void)
     processMarkStack(ctx);
 }
 
+/*
+ * Limits on pre-cleaning.  We stop once a pass finds few enough dirty
+ * cards that the pause can handle them, or when the number stops
+ * shrinking because mutators dirty cards as fast as we clean them.
+ */
+#define PRECLEAN_MAX_PASSES     4
+#define PRECLEAN_RESIDUE_CARDS  64
+
+/*
+ * Processes cards dirtied during the concurrent mark while mutators
+ * are still running.  Each pass ages the dirty cards and then scans
+ * the gray objects on them; a card dirtied again after it has been
+ * aged stays dirty for the re-mark.  Must be called with the heap
+ * unlocked after dvmHeapScanMarkedObjects.
+ */
+void dvmHeapPreCleanMarkedObjects()
+{
+    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+
+    assert(ctx->finger == (void *)ULONG_MAX);
+    size_t prevAged = SIZE_MAX;
+    for (int pass = 0; pass < PRECLEAN_MAX_PASSES; ++pass) {
+        size_t aged = dvmPreCleanCardTable();
+        scanGrayObjects(ctx, GC_CARD_AGED);
+        processMarkStack(ctx);
+        LOGV_HEAP("Pre-clean pass %d scanned %zu cards", pass, aged);
+        if (aged <= PRECLEAN_RESIDUE_CARDS || aged >= prevAged) {
+            break;
+        }
+        prevAged = aged;
+    }
+}
+
 void dvmHeapReScanMarkedObjects()
 {
     GcMarkContext *ctx = &gDvm.gcHeap->markContext;
@@ -618,7 +1424,7 @@ void dvmHeapReScanMarkedObjects()
      * that gray objects will be pushed onto the mark stack.
      */
     assert(ctx->finger == (void *)ULONG_MAX);
-    scanGrayObjects(ctx);
+    scanGrayObjects(ctx, GC_CARD_DIRTY);
     processMarkStack(ctx);
 }
 
@@ -648,12 +1454,97 @@ static bool isEnqueuable(const Object *reference)
 /*
  * Schedules a reference to be appended to its reference queue.
  */
-static void enqueueReference(Object *ref)
+static void enqueueReference(Object *ref, Object **cleared)
 {
     assert(ref != NULL);
     assert(dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queue) != NULL);
     assert(dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queueNext) == NULL);
-    enqueuePendingReference(ref, &gDvm.gcHeap->clearedReferences);
+    enqueuePendingReference(ref, cleared);
+}
+
+/*
+ * Blackens a white referent and pushes it on the mark stack.  Returns
+ * false if the referent was already marked, perhaps by another worker
+ * a moment ago.
+ */
+static bool markReferent(Object *referent, GcMarkContext *ctx)
+{
+    assert(ctx->finger == (void *)ULONG_MAX);
+    if (referent < (Object *)ctx->immuneLimit ||
+        setAndReturnMarkBit(ctx, referent)) {
+        return false;
+    }
+    if (ctx->worker != NULL) {
+        parallelMarkStackPush(ctx->worker, referent);
+    } else {
+        markStackPush(&ctx->stack, referent);
+    }
+    return true;
+}
+
+/*
+ * Applies the soft reference clearing policy to a reference.  Every
+ * other white referent is blackened.  Returns true if the referent is
+ * still white and the reference must stay on the list for clearing.
+ */
+static bool preserveSoftReference(Object *ref, GcMarkContext *ctx,
+                                  size_t *counter)
+{
+    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    Object *referent = dvmGetFieldObject(ref, referentOffset);
+    if (referent == NULL) {
+        /* Referent was cleared by the user during marking. */
+        return false;
+    }
+    if (isMarked(referent, ctx)) {
+        return false;
+    }
+    if ((++*counter) & 1) {
+        /* Referent is white and biased toward saving, mark it. */
+        markReferent(referent, ctx);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Clears a reference with a white referent, scheduling it for
+ * enqueueing if it is registered with a queue.
+ */
+static void clearWhiteReference(Object *ref, GcMarkContext *ctx,
+                                Object **cleared)
+{
+    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    Object *referent = dvmGetFieldObject(ref, referentOffset);
+    if (referent != NULL && !isMarked(referent, ctx)) {
+        /* Referent is white, clear it. */
+        clearReference(ref);
+        if (isEnqueuable(ref)) {
+            enqueueReference(ref, cleared);
+        }
+    }
+}
+
+/*
+ * Blackens the white referent of a finalizer reference, moves it to
+ * the zombie field and schedules the reference for enqueueing.
+ * Returns true if the referent was white.
+ */
+static bool enqueueFinalizerReference(Object *ref, GcMarkContext *ctx,
+                                      Object **cleared)
+{
+    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    size_t zombieOffset = gDvm.offJavaLangRefFinalizerReference_zombie;
+    Object *referent = dvmGetFieldObject(ref, referentOffset);
+    if (referent == NULL || !markReferent(referent, ctx)) {
+        return false;
+    }
+    /* If the referent is non-null the reference must queuable. */
+    assert(isEnqueuable(ref));
+    dvmSetFieldObject(ref, zombieOffset, referent);
+    clearReference(ref);
+    enqueueReference(ref, cleared);
+    return true;
 }
 
 /*
@@ -666,23 +1557,11 @@ static void preserveSomeSoftReferences(Object **list)
 {
     assert(list != NULL);
     GcMarkContext *ctx = &gDvm.gcHeap->markContext;
-    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
     Object *clear = NULL;
     size_t counter = 0;
     while (*list != NULL) {
         Object *ref = dequeuePendingReference(list);
-        Object *referent = dvmGetFieldObject(ref, referentOffset);
-        if (referent == NULL) {
-            /* Referent was cleared by the user during marking. */
-            continue;
-        }
-        bool marked = isMarked(referent, ctx);
-        if (!marked && ((++counter) & 1)) {
-            /* Referent is white and biased toward saving, mark it. */
-            markObject(referent, ctx);
-            marked = true;
-        }
-        if (!marked) {
+        if (preserveSoftReference(ref, ctx, &counter)) {
             /* Referent is white, queue it for clearing. */
             enqueuePendingReference(ref, &clear);
         }
@@ -703,22 +1582,45 @@ static void preserveSomeSoftReferences(Object **list)
 static void clearWhiteReferences(Object **list)
 {
     assert(list != NULL);
-    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
-    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    GcHeap *gcHeap = gDvm.gcHeap;
     while (*list != NULL) {
         Object *ref = dequeuePendingReference(list);
-        Object *referent = dvmGetFieldObject(ref, referentOffset);
-        if (referent != NULL && !isMarked(referent, ctx)) {
-            /* Referent is white, clear it. */
-            clearReference(ref);
-            if (isEnqueuable(ref)) {
-                enqueueReference(ref);
-            }
-        }
+        clearWhiteReference(ref, &gcHeap->markContext,
+                            &gcHeap->clearedReferences);
     }
     assert(*list == NULL);
 }
 
+/*
+ * Notes finalizer references just queued for finalization, for
+ * dvmHeapGetFinalizerStats().  Parallel workers must hold the
+ * reference lock.
+ */
+static void recordPendingFinalizers(Object *const *refs, size_t count)
+{
+    GcHeap *gcHeap = gDvm.gcHeap;
+    gcHeap->totalFinalizersQueued += count;
+    if (gcHeap->numPendingFinalizers + count > gcHeap->maxPendingFinalizers) {
+        size_t length = MAX(2 * gcHeap->maxPendingFinalizers,
+                            gcHeap->numPendingFinalizers + count);
+        PendingFinalizer *entries = (PendingFinalizer *)
+                realloc(gcHeap->pendingFinalizers, length * sizeof(*entries));
+        if (entries == NULL) {
+            /* The statistics just miss these. */
+            return;
+        }
+        gcHeap->pendingFinalizers = entries;
+        gcHeap->maxPendingFinalizers = length;
+    }
+    PendingFinalizer *entry =
+            &gcHeap->pendingFinalizers[gcHeap->numPendingFinalizers];
+    for (size_t i = 0; i < count; ++i, ++entry) {
+        entry->reference = refs[i];
+        entry->queuedMsec = gcHeap->finalizerQueueMsec;
+    }
+    gcHeap->numPendingFinalizers += count;
+}
+
 /*
  * Enqueues finalizer references with white referents.  White
  * referents are blackened, moved to the zombie field, and the
@@ -727,29 +1629,202 @@ static void clearWhiteReferences(Object **list)
 static void enqueueFinalizerReferences(Object **list)
 {
     assert(list != NULL);
-    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
-    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
-    size_t zombieOffset = gDvm.offJavaLangRefFinalizerReference_zombie;
+    GcHeap *gcHeap = gDvm.gcHeap;
     bool hasEnqueued = false;
     while (*list != NULL) {
         Object *ref = dequeuePendingReference(list);
-        Object *referent = dvmGetFieldObject(ref, referentOffset);
-        if (referent != NULL && !isMarked(referent, ctx)) {
-            markObject(referent, ctx);
-            /* If the referent is non-null the reference must queuable. */
-            assert(isEnqueuable(ref));
-            dvmSetFieldObject(ref, zombieOffset, referent);
-            clearReference(ref);
-            enqueueReference(ref);
+        if (enqueueFinalizerReference(ref, &gcHeap->markContext,
+                                      &gcHeap->clearedReferences)) {
+            recordPendingFinalizers(&ref, 1);
             hasEnqueued = true;
         }
     }
     if (hasEnqueued) {
-        processMarkStack(ctx);
+        processMarkStack(&gcHeap->markContext);
     }
     assert(*list == NULL);
 }
 
+/*
+ * The number of references a worker takes off a list at a time.  Lists
+ * no longer than this are processed by the GC thread alone.
+ */
+#define REFERENCE_BATCH_SIZE    128
+
+/*
+ * Returns true if a reference list is too short to be worth sharing
+ * out between the workers.
+ */
+static bool isShortReferenceList(Object *list)
+{
+    if (list == NULL) {
+        return true;
+    }
+    size_t offset = gDvm.offJavaLangRefReference_pendingNext;
+    Object *ref = list;
+    for (size_t i = 0; i < REFERENCE_BATCH_SIZE; ++i) {
+        ref = dvmGetFieldObject(ref, offset);
+        if (ref == list) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Takes batches of references off the pool's list and applies the
+ * current pass to them.  References cleared or kept by the worker are
+ * gathered on private lists which are spliced onto the shared ones at
+ * the end, so the lock is only taken once per batch.  Blackened
+ * referents are left on the worker's stack for runDrainWorker().
+ */
+static void runReferenceWorker(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    GcMarkContext *ctx = &worker->ctx;
+    Object *batch[REFERENCE_BATCH_SIZE];
+    Object *cleared = NULL;
+    Object *kept = NULL;
+    size_t counter = 0;
+    size_t numQueued = 0;
+    for (;;) {
+        size_t count = 0;
+        dvmLockMutex(&pool->referenceLock);
+        recordPendingFinalizers(batch, numQueued);
+        numQueued = 0;
+        while (count < REFERENCE_BATCH_SIZE && *pool->refList != NULL) {
+            batch[count++] = dequeuePendingReference(pool->refList);
+        }
+        dvmUnlockMutex(&pool->referenceLock);
+        if (count == 0) {
+            break;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            Object *ref = batch[i];
+            switch (pool->refPass) {
+            case REFERENCE_PASS_PRESERVE:
+                if (preserveSoftReference(ref, ctx, &counter)) {
+                    enqueuePendingReference(ref, &kept);
+                }
+                break;
+            case REFERENCE_PASS_CLEAR:
+                clearWhiteReference(ref, ctx, &cleared);
+                break;
+            case REFERENCE_PASS_FINALIZE:
+                /* The queued ones are recorded under the next lock. */
+                if (enqueueFinalizerReference(ref, ctx, &cleared)) {
+                    batch[numQueued++] = ref;
+                }
+                break;
+            }
+        }
+    }
+    dvmLockMutex(&pool->referenceLock);
+    splicePendingReferences(cleared, &gDvm.gcHeap->clearedReferences);
+    splicePendingReferences(kept, &pool->refKept);
+    dvmUnlockMutex(&pool->referenceLock);
+}
+
+/*
+ * Traces from the objects left on the workers' stacks until all of
+ * them are empty.
+ */
+static void runDrainWorker(GcMarkWorker *worker)
+{
+    do {
+        drainWorkerStack(worker);
+    } while (stealMarkWork(worker));
+    assert(worker->ctx.stack.top == worker->ctx.stack.base);
+}
+
+/*
+ * Returns true if a worker or the shared stack holds objects that
+ * have yet to be scanned.
+ */
+static bool hasMarkWork(const GcMarkPool *pool)
+{
+    if (pool->shared->top > pool->shared->base) {
+        return true;
+    }
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        const GcMarkStack *stack = &pool->workers[i].ctx.stack;
+        if (stack->top > stack->base) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Parallel version of the reference list walks above.  There is no
+ * bitmap left to scan, so every object a worker marks is pushed on its
+ * stack.  The walk of the list ends before any tracing starts, which
+ * keeps the results the same as those of a serial walk: in particular,
+ * a finalizable object reachable only from another is finalized in the
+ * same collection.
+ */
+static void parallelProcessReferences(GcMarkPool *pool, ReferencePass pass,
+                                      Object **list)
+{
+    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    assert(ctx->finger == (void *)ULONG_MAX);
+    assert(ctx->stack.top == ctx->stack.base);
+    pool->shared = &ctx->stack;
+    pool->base = (uintptr_t)ctx->bitmap->base;
+    pool->limit = pool->base;
+    pool->numChunks = 0;
+    pool->nextChunk = 0;
+    pool->idleWorkers = 0;
+    pool->done = false;
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        GcMarkWorker *worker = &pool->workers[i];
+        worker->ctx.bitmap = ctx->bitmap;
+        worker->ctx.immuneLimit = ctx->immuneLimit;
+        worker->ctx.finger = (void *)ULONG_MAX;
+        worker->chunkLimit = 0;
+        assert(worker->ctx.stack.top == worker->ctx.stack.base);
+    }
+    pool->refPass = pass;
+    pool->refList = list;
+    pool->refKept = NULL;
+    runWorkerTask(pool, runReferenceWorker);
+    assert(*list == NULL);
+    if (pass == REFERENCE_PASS_PRESERVE) {
+        *list = pool->refKept;
+        pool->refKept = NULL;
+    }
+    if (hasMarkWork(pool)) {
+        /* Restart the mark from the newly black referents. */
+        runWorkerTask(pool, runDrainWorker);
+    }
+    assert(ctx->stack.top == ctx->stack.base);
+}
+
+/*
+ * Applies a pass to a reference list, in parallel if the list is long
+ * and mark threads are available.
+ */
+static void processReferenceList(GcMarkPool *pool, ReferencePass pass,
+                                 Object **list)
+{
+    assert(list != NULL);
+    if (pool != NULL && !isShortReferenceList(*list)) {
+        parallelProcessReferences(pool, pass, list);
+        return;
+    }
+    switch (pass) {
+    case REFERENCE_PASS_PRESERVE:
+        preserveSomeSoftReferences(list);
+        break;
+    case REFERENCE_PASS_CLEAR:
+        clearWhiteReferences(list);
+        break;
+    case REFERENCE_PASS_FINALIZE:
+        enqueueFinalizerReferences(list);
+        break;
+    }
+}
+
 /*
  * This object is an instance of a class that overrides finalize().  Mark
  * it as finalizable.
@@ -780,35 +1855,37 @@ void dvmHeapProcessReferences(Object **softReferences, bool clearSoftRefs,
     assert(weakReferences != NULL);
     assert(finalizerReferences != NULL);
     assert(phantomReferences != NULL);
+    GcMarkPool *pool = getMarkPool();
     /*
      * Unless we are in the zygote or required to clear soft
      * references with white references, preserve some white
      * referents.
      */
     if (!gDvm.zygote && !clearSoftRefs) {
-        preserveSomeSoftReferences(softReferences);
+        processReferenceList(pool, REFERENCE_PASS_PRESERVE, softReferences);
     }
     /*
      * Clear all remaining soft and weak references with white
      * referents.
      */
-    clearWhiteReferences(softReferences);
-    clearWhiteReferences(weakReferences);
+    processReferenceList(pool, REFERENCE_PASS_CLEAR, softReferences);
+    processReferenceList(pool, REFERENCE_PASS_CLEAR, weakReferences);
     /*
      * Preserve all white objects with finalize methods and schedule
      * them for finalization.
      */
-    enqueueFinalizerReferences(finalizerReferences);
+    gDvm.gcHeap->finalizerQueueMsec = dvmGetRelativeTimeMsec();
+    processReferenceList(pool, REFERENCE_PASS_FINALIZE, finalizerReferences);
     /*
      * Clear all f-reachable soft and weak references with white
      * referents.
      */
-    clearWhiteReferences(softReferences);
-    clearWhiteReferences(weakReferences);
+    processReferenceList(pool, REFERENCE_PASS_CLEAR, softReferences);
+    processReferenceList(pool, REFERENCE_PASS_CLEAR, weakReferences);
     /*
      * Clear all phantom references with white referents.
      */
-    clearWhiteReferences(phantomReferences);
+    processReferenceList(pool, REFERENCE_PASS_CLEAR, phantomReferences);
     /*
      * At this point all reference lists should be empty.
      */
@@ -836,13 +1913,22 @@ void dvmEnqueueClearedReferences(Object **cleared)
     }
 }
 
-void dvmHeapFinishMarkStep()
+void dvmHeapFinishMarkStep(bool keepLiveSnapshot)
 {
-    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    GcHeap *gcHeap = gDvm.gcHeap;
+    GcMarkContext *ctx = &gcHeap->markContext;
 
-    /* The mark bits are now not needed.
+    /* The mark bits are now not needed, unless the next GC is to be
+     * sticky, in which case they start out as a copy of the live bits.
+     * Objects allocated while we copy may or may not make it in, which
+     * is harmless either way.
      */
-    dvmHeapSourceZeroMarkBitmap();
+    if (keepLiveSnapshot) {
+        dvmHeapSourceCopyLiveToMarkBitmap();
+    } else {
+        dvmHeapSourceZeroMarkBitmap();
+    }
+    gcHeap->hasLiveSnapshot = keepLiveSnapshot;
 
     /* Clean up everything else associated with the marking process.
      */
@@ -893,15 +1979,249 @@ static void sweepWeakJniGlobals()
     }
 }
 
+/*
+ * Number of weak global slots swept per hold of jniWeakGlobalRefLock
+ * by dvmHeapSweepWeakJniGlobals().
+ */
+#define WEAK_GLOBAL_SWEEP_BATCH 512
+
+/*
+ * Set from the end of a concurrent mark until its weak globals have
+ * been swept.  Only changed with the mutators suspended or with
+ * jniWeakGlobalRefLock held.
+ */
+static bool gWeakGlobalsUnswept;
+
+/*
+ * Returns true if <obj>, just read from a weak global, died in a
+ * collection whose weak globals are still to be swept.  The bitmaps have
+ * been swapped by then, so the live bitmap has the marked objects plus
+ * those allocated since.  The caller must hold jniWeakGlobalRefLock.
+ */
+bool dvmIsDeadWeakGlobalReferent(const Object *obj)
+{
+    return gWeakGlobalsUnswept && !dvmHeapSourceContains(obj);
+}
+
+/*
+ * Sweeps the weak globals after a concurrent collection, with the
+ * mutators running.  The lock is only held for a batch of slots at a
+ * time; until the sweep is done dvmIsDeadWeakGlobalReferent() keeps the
+ * dead referents from being handed out.  Slots filled meanwhile hold
+ * live objects, so it doesn't matter which of them the sweep sees.
+ * Must be called before any object is freed, while the live bitmap
+ * still tells the dead from the living.
+ */
+void dvmHeapSweepWeakJniGlobals()
+{
+    if (!gWeakGlobalsUnswept) {
+        return;
+    }
+    IndirectRefTable *table = &gDvm.jniWeakGlobalRefTable;
+    typedef IndirectRefTable::iterator It; // TODO: C++0x auto
+    size_t begin = 0;
+    for (;;) {
+        dvmLockMutex(&gDvm.jniWeakGlobalRefLock);
+        size_t capacity = table->capacity();
+        size_t end = MIN(begin + WEAK_GLOBAL_SWEEP_BATCH, capacity);
+        for (It it(table->table_, begin, end), last(table->table_, end, end);
+             it != last; ++it) {
+            Object** entry = *it;
+            if (!dvmHeapSourceContains(*entry)) {
+                *entry = kClearedJniWeakGlobal;
+            }
+        }
+        bool done = (end >= capacity);
+        if (done) {
+            gWeakGlobalsUnswept = false;
+        }
+        dvmUnlockMutex(&gDvm.jniWeakGlobalRefLock);
+        if (done) {
+            break;
+        }
+        begin = end;
+    }
+}
+
+/*
+ * Drops the pending finalizers whose references are dead or have been
+ * finalized, keeping the rest in the order they were queued.
+ */
+static void sweepPendingFinalizers()
+{
+    GcHeap *gcHeap = gDvm.gcHeap;
+    size_t zombieOffset = gDvm.offJavaLangRefFinalizerReference_zombie;
+    size_t kept = 0;
+    for (size_t i = 0; i < gcHeap->numPendingFinalizers; ++i) {
+        PendingFinalizer entry = gcHeap->pendingFinalizers[i];
+        if (!isUnmarkedObject(entry.reference) &&
+            dvmGetFieldObject(entry.reference, zombieOffset) != NULL) {
+            gcHeap->pendingFinalizers[kept++] = entry;
+        }
+    }
+    gcHeap->numPendingFinalizers = kept;
+}
+
 /*
  * Process all the internal system structures that behave like
- * weakly-held objects.
+ * weakly-held objects.  After a concurrent mark the JNI weak globals
+ * are left to dvmHeapSweepWeakJniGlobals(), since apps can hold a great
+ * many of them.
  */
-void dvmHeapSweepSystemWeaks()
+void dvmHeapSweepSystemWeaks(bool isConcurrent)
 {
     dvmGcDetachDeadInternedStrings(isUnmarkedObject);
     dvmSweepMonitorList(&gDvm.monitorList, isUnmarkedObject);
-    sweepWeakJniGlobals();
+    if (isConcurrent) {
+        gWeakGlobalsUnswept = true;
+    } else {
+        sweepWeakJniGlobals();
+    }
+    sweepPendingFinalizers();
+    dvmSweepClassNameCache(isUnmarkedObject);
+    dvmSweepJniUtfCache(isUnmarkedObject);
+}
+
+/*
+ * Parallel sweeping.
+ *
+ * The swept heaps are cut into stripes which the mark workers claim
+ * one at a time.  A worker collects the garbage it finds in its idle
+ * mark stack and frees it in large batches, so the heap lock is taken
+ * once per batch rather than once per bitmap word.  Stripes never span
+ * heaps, which keeps each batch within one mspace and in address order.
+ */
+#define SWEEP_STRIPE_SIZE   (1024 * 1024)
+
+/*
+ * Frees the objects collected by a sweep worker.
+ */
+static void flushSweepBuffer(GcMarkWorker *worker)
+{
+    if (worker->sweepCount == 0) {
+        return;
+    }
+    GcMarkPool *pool = worker->pool;
+    void **ptrs = (void **)worker->ctx.stack.base;
+    size_t numBytes;
+    if (!pool->sweepConcurrent) {
+        /* The GC thread holds the heap lock for the whole pause. */
+        dvmLockMutex(&pool->sweepLock);
+        numBytes = dvmHeapSourceFreeList(worker->sweepCount, ptrs);
+        dvmUnlockMutex(&pool->sweepLock);
+    } else if (worker == &pool->workers[0]) {
+        dvmLockHeap();
+        numBytes = dvmHeapSourceFreeList(worker->sweepCount, ptrs);
+        dvmUnlockHeap();
+    } else {
+        /* Helpers are not VM threads and cannot change their status. */
+        dvmLockMutex(&gDvm.gcHeapLock);
+        numBytes = dvmHeapSourceFreeList(worker->sweepCount, ptrs);
+        dvmUnlockMutex(&gDvm.gcHeapLock);
+    }
+    worker->sweptObjects += worker->sweepCount;
+    worker->sweptBytes += numBytes;
+    worker->sweepCount = 0;
+}
+
+static void parallelSweepCallback(size_t numPtrs, void **ptrs, void *arg)
+{
+    GcMarkWorker *worker = (GcMarkWorker *)arg;
+    const size_t capacity = worker->ctx.stack.limit - worker->ctx.stack.base;
+    while (numPtrs > 0) {
+        size_t count = MIN(numPtrs, capacity - worker->sweepCount);
+        memcpy(worker->ctx.stack.base + worker->sweepCount, ptrs,
+               count * sizeof(*ptrs));
+        worker->sweepCount += count;
+        if (worker->sweepCount == capacity) {
+            flushSweepBuffer(worker);
+        }
+        ptrs += count;
+        numPtrs -= count;
+    }
+}
+
+/*
+ * Sweeps stripes until none are left.
+ */
+static void runSweepWorker(GcMarkWorker *worker)
+{
+    GcMarkPool *pool = worker->pool;
+    for (;;) {
+        int32_t stripe = android_atomic_inc(&pool->nextChunk);
+        if (stripe >= pool->numChunks) {
+            break;
+        }
+        size_t heap = 0;
+        while (stripe >= pool->firstStripe[heap + 1]) {
+            ++heap;
+        }
+        assert(heap < pool->numSweepHeaps);
+        uintptr_t base = pool->sweepBase[heap] +
+            (uintptr_t)(stripe - pool->firstStripe[heap]) * SWEEP_STRIPE_SIZE;
+        uintptr_t max = MIN(base + SWEEP_STRIPE_SIZE - HB_OBJECT_ALIGNMENT,
+                            pool->sweepMax[heap]);
+        u8 start = dvmGetRelativeTimeUsec();
+        dvmHeapBitmapSweepWalk(pool->sweepLive, pool->sweepMark, base, max,
+                               parallelSweepCallback, worker);
+        flushSweepBuffer(worker);
+        u8 elapsed = dvmGetRelativeTimeUsec() - start;
+        worker->sweepUsec += elapsed;
+        worker->maxStripeUsec = MAX(worker->maxStripeUsec, elapsed);
+        worker->sweptStripes++;
+    }
+}
+
+/*
+ * Parallel version of the bitmap sweep in dvmHeapSweepUnmarkedObjects.
+ */
+static void parallelSweep(GcMarkPool *pool, const HeapBitmap *liveBits,
+                          const HeapBitmap *markBits, const uintptr_t *base,
+                          const uintptr_t *max, size_t numSweepHeaps,
+                          bool isConcurrent, size_t *numObjects,
+                          size_t *numBytes)
+{
+    assert(numSweepHeaps <= SWEEP_MAX_REGIONS);
+    pool->sweepLive = liveBits;
+    pool->sweepMark = markBits;
+    pool->sweepConcurrent = isConcurrent;
+    pool->numSweepHeaps = numSweepHeaps;
+    int32_t numStripes = 0;
+    for (size_t i = 0; i < numSweepHeaps; ++i) {
+        pool->sweepBase[i] = base[i];
+        pool->sweepMax[i] = max[i];
+        pool->firstStripe[i] = numStripes;
+        if (base[i] <= max[i]) {
+            numStripes += (max[i] - base[i]) / SWEEP_STRIPE_SIZE + 1;
+        }
+    }
+    pool->firstStripe[numSweepHeaps] = numStripes;
+    pool->numChunks = numStripes;
+    pool->nextChunk = 0;
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        GcMarkWorker *worker = &pool->workers[i];
+        assert(worker->ctx.stack.top == worker->ctx.stack.base);
+        worker->sweepCount = 0;
+        worker->sweptObjects = worker->sweptBytes = 0;
+        worker->sweptStripes = 0;
+        worker->sweepUsec = worker->maxStripeUsec = 0;
+    }
+
+    runWorkerTask(pool, runSweepWorker);
+
+    u8 totalUsec = 0, maxStripeUsec = 0;
+    *numObjects = *numBytes = 0;
+    for (size_t i = 0; i < pool->numWorkers; ++i) {
+        const GcMarkWorker *worker = &pool->workers[i];
+        *numObjects += worker->sweptObjects;
+        *numBytes += worker->sweptBytes;
+        totalUsec += worker->sweepUsec;
+        maxStripeUsec = MAX(maxStripeUsec, worker->maxStripeUsec);
+    }
+    LOGD_HEAP("Swept %d stripes on %zu threads, avg %lluus, max %lluus",
+              numStripes, pool->numWorkers,
+              numStripes > 0 ? totalUsec / numStripes : 0ULL,
+              maxStripeUsec);
 }
 
 /*
@@ -911,27 +2231,40 @@ void dvmHeapSweepSystemWeaks()
 void dvmHeapSweepUnmarkedObjects(bool isPartial, bool isConcurrent,
                                  size_t *numObjects, size_t *numBytes)
 {
-    uintptr_t base[HEAP_SOURCE_MAX_HEAP_COUNT];
-    uintptr_t max[HEAP_SOURCE_MAX_HEAP_COUNT];
+    uintptr_t base[SWEEP_MAX_REGIONS];
+    uintptr_t max[SWEEP_MAX_REGIONS];
     SweepContext ctx;
     HeapBitmap *prevLive, *prevMark;
     size_t numHeaps, numSweepHeaps;
 
     numHeaps = dvmHeapSourceGetNumHeaps();
     dvmHeapSourceGetRegions(base, max, numHeaps);
-    if (isPartial) {
+    if (isPartial || gDvm.gcHeap->markContext.immuneLimit != NULL) {
         assert((uintptr_t)gDvm.gcHeap->markContext.immuneLimit == base[0]);
         numSweepHeaps = 1;
     } else {
         numSweepHeaps = numHeaps;
     }
+    /* Zygote objects never live in the large object space, so it is
+     * swept by partial collections too.
+     */
+    if (dvmHeapSourceGetLargeObjectRegion(&base[numSweepHeaps],
+                                          &max[numSweepHeaps])) {
+        numSweepHeaps++;
+    }
     ctx.numObjects = ctx.numBytes = 0;
     ctx.isConcurrent = isConcurrent;
     prevLive = dvmHeapSourceGetMarkBits();
     prevMark = dvmHeapSourceGetLiveBits();
-    for (size_t i = 0; i < numSweepHeaps; ++i) {
-        dvmHeapBitmapSweepWalk(prevLive, prevMark, base[i], max[i],
-                               sweepBitmapCallback, &ctx);
+    GcMarkPool *pool = getMarkPool();
+    if (pool != NULL) {
+        parallelSweep(pool, prevLive, prevMark, base, max, numSweepHeaps,
+                      isConcurrent, &ctx.numObjects, &ctx.numBytes);
+    } else {
+        for (size_t i = 0; i < numSweepHeaps; ++i) {
+            dvmHeapBitmapSweepWalk(prevLive, prevMark, base[i], max[i],
+                                   sweepBitmapCallback, &ctx);
+        }
     }
     *numObjects = ctx.numObjects;
     *numBytes = ctx.numBytes;
@@ -37,6 +37,8 @@ struct GcMarkStack {
     size_t length;
 };
 
+struct GcMarkWorker;
+
 /* This is declared publicly so that it can be included in gDvm.gcHeap.
  */
 struct GcMarkContext {
@@ -44,21 +46,30 @@ struct GcMarkContext {
     GcMarkStack stack;
     const char *immuneLimit;
     const void *finger;   // only used while scanning/recursing.
+    GcMarkWorker *worker; // non-NULL while marking in parallel.
+    bool isSticky;        // only objects allocated since the last GC.
 };
 
-bool dvmHeapBeginMarkStep(bool isPartial);
+bool dvmHeapBeginMarkStep(bool isPartial, bool isSticky);
 void dvmHeapMarkRootSet(void);
+void dvmHeapMarkGlobalRootSet(void);
+void dvmHeapMarkThreadRootSet(void);
 void dvmHeapReMarkRootSet(void);
 void dvmHeapScanMarkedObjects(void);
+void dvmHeapPreCleanMarkedObjects(void);
 void dvmHeapReScanMarkedObjects(void);
 void dvmHeapProcessReferences(Object **softReferences, bool clearSoftRefs,
                               Object **weakReferences,
                               Object **finalizerReferences,
                               Object **phantomReferences);
-void dvmHeapFinishMarkStep(void);
-void dvmHeapSweepSystemWeaks(void);
+void dvmHeapFinishMarkStep(bool keepLiveSnapshot);
+void dvmHeapSweepSystemWeaks(bool isConcurrent);
+void dvmHeapSweepWeakJniGlobals(void);
 void dvmHeapSweepUnmarkedObjects(bool isPartial, bool isConcurrent,
                                  size_t *numObjects, size_t *numBytes);
 void dvmEnqueueClearedReferences(Object **references);
+void dvmHeapShutdownMarkThreads(void);
+bool dvmHeapParallelBitmapWalk(HeapBitmap *bitmap, BitmapCallback *callback,
+                               void *arg);
 
 #endif  // DALVIK_ALLOC_MARK_SWEEP_H_
@@ -17,6 +17,7 @@
 #include "Dalvik.h"
 #include "alloc/HeapBitmap.h"
 #include "alloc/HeapSource.h"
+#include "alloc/MarkSweep.h"
 #include "alloc/Verify.h"
 #include "alloc/Visit.h"
 
@@ -103,13 +104,22 @@ static void verifyReference(void *addr, void *arg)
 }
 
 /*
- * Verifies an object reference.
+ * Checks the references of an object, logging any bad ones.  Returns
+ * false if there were some.
  */
-void dvmVerifyObject(const Object *obj)
+static bool verifyObjectReferences(const Object *obj)
 {
     Object *arg = const_cast<Object*>(obj);
     dvmVisitObject(verifyReference, arg, &arg);
-    if (arg == NULL) {
+    return arg != NULL;
+}
+
+/*
+ * Verifies an object reference.
+ */
+void dvmVerifyObject(const Object *obj)
+{
+    if (!verifyObjectReferences(obj)) {
         dumpReferences(obj);
         dvmAbort();
     }
@@ -132,6 +142,63 @@ void dvmVerifyBitmap(const HeapBitmap *bitmap)
     dvmHeapBitmapWalk(bitmap, verifyBitmapCallback, NULL);
 }
 
+struct VerifyHeapContext {
+    size_t sampleRate;
+    u4 seed;
+    Object *volatile failed;    // the first bad object found
+};
+
+/*
+ * Returns true if <obj> is in this verification's sample.  The seed
+ * changes from one verification to the next, so that over many GCs
+ * every object gets checked.
+ */
+static bool isSampled(const VerifyHeapContext *ctx, const Object *obj)
+{
+    if (ctx->sampleRate <= 1) {
+        return true;
+    }
+    u4 hash = ((u4)(uintptr_t)obj / HB_OBJECT_ALIGNMENT ^ ctx->seed) *
+              2654435761U;
+    return (hash >> 8) % ctx->sampleRate == 0;
+}
+
+/*
+ * Bitmap callback of dvmVerifyHeap, which may run on several threads
+ * at once.
+ */
+static void verifyHeapCallback(Object *obj, void *arg)
+{
+    VerifyHeapContext *ctx = (VerifyHeapContext *)arg;
+    if (isSampled(ctx, obj) && !verifyObjectReferences(obj)) {
+        android_atomic_release_cas(0, (int32_t)obj,
+                                   (volatile int32_t *)&ctx->failed);
+    }
+}
+
+/*
+ * Verifies the roots and the objects in the live bitmap, or one in
+ * <sampleRate> of the objects, on the mark threads if there are any.
+ * Assumes the VM is suspended.
+ */
+void dvmVerifyHeap(size_t sampleRate)
+{
+    dvmVerifyRoots();
+    VerifyHeapContext ctx;
+    ctx.sampleRate = sampleRate;
+    ctx.seed = (u4)dvmGetRelativeTimeUsec();
+    ctx.failed = NULL;
+    HeapBitmap *bitmap = dvmHeapSourceGetLiveBits();
+    if (!dvmHeapParallelBitmapWalk(bitmap, verifyHeapCallback, &ctx)) {
+        dvmHeapBitmapWalk(bitmap, verifyHeapCallback, &ctx);
+    }
+    ANDROID_MEMBAR_FULL();
+    if (ctx.failed != NULL) {
+        dumpReferences(ctx.failed);
+        dvmAbort();
+    }
+}
+
 /*
  * Helper function to call verifyReference from the root verifier.
  */
@@ -33,4 +33,10 @@ void dvmVerifyBitmap(const HeapBitmap *bitmap);
  */
 void dvmVerifyRoots(void);
 
+/*
+ * Verifies the roots and the live objects, or one in <sampleRate> of
+ * them, in parallel where possible.  Assumes the VM is suspended.
+ */
+void dvmVerifyHeap(size_t sampleRate);
+
 #endif  // DALVIK_ALLOC_VERIFY_H_
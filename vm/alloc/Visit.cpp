@@ -30,11 +30,41 @@ void dvmVisitObject(Visitor *visitor, Object *obj, void *arg)
     visitObject(visitor, obj, arg);
 }
 
+/*
+ * Applies a verification function to the present values in entries
+ * [begin, end) of the hash table, which the caller has locked.
+ */
+static void visitHashTableRange(RootVisitor *visitor, HashTable *table,
+                                int begin, int end, RootType type, void *arg)
+{
+    assert(visitor != NULL);
+    assert(table != NULL);
+    for (int i = begin; i < end; ++i) {
+        HashEntry *entry = &table->pEntries[i];
+        if (entry->data != NULL && entry->data != HASH_TOMBSTONE) {
+            (*visitor)(&entry->data, 0, type, arg);
+        }
+    }
+}
+
 /*
  * Applies a verification function to all present values in the hash table.
  */
 static void visitHashTable(RootVisitor *visitor, HashTable *table,
                            RootType type, void *arg)
+{
+    assert(visitor != NULL);
+    assert(table != NULL);
+    dvmHashTableLock(table);
+    visitHashTableRange(visitor, table, 0, table->tableSize, type, arg);
+    dvmHashTableUnlock(table);
+}
+
+/*
+ * Visits the objects in the debugger's registry.
+ */
+static void visitDebuggerRegistry(RootVisitor *visitor, HashTable *table,
+                                  void *arg)
 {
     assert(visitor != NULL);
     assert(table != NULL);
@@ -42,7 +72,66 @@ static void visitHashTable(RootVisitor *visitor, HashTable *table,
     for (int i = 0; i < table->tableSize; ++i) {
         HashEntry *entry = &table->pEntries[i];
         if (entry->data != NULL && entry->data != HASH_TOMBSTONE) {
-            (*visitor)(&entry->data, 0, type, arg);
+            DbgRegistryEntry *reg = (DbgRegistryEntry *)entry->data;
+            (*visitor)(&reg->obj, 0, ROOT_DEBUGGER, arg);
+        }
+    }
+    dvmHashTableUnlock(table);
+}
+
+/*
+ * Visits the arrays in the JNI pin table.
+ */
+static void visitPinTable(RootVisitor *visitor, HashTable *table, void *arg)
+{
+    assert(visitor != NULL);
+    assert(table != NULL);
+    dvmHashTableLock(table);
+    for (int i = 0; i < table->tableSize; ++i) {
+        HashEntry *entry = &table->pEntries[i];
+        if (entry->data != NULL && entry->data != HASH_TOMBSTONE) {
+            JniPinEntry *pin = (JniPinEntry *)entry->data;
+            (*visitor)(&pin->obj, 0, ROOT_VM_INTERNAL, arg);
+        }
+    }
+    dvmHashTableUnlock(table);
+}
+
+/*
+ * Visits the objects held by the reflected method signature cache.
+ */
+static void visitReflectSigCache(RootVisitor *visitor, HashTable *table,
+                                 void *arg)
+{
+    assert(visitor != NULL);
+    assert(table != NULL);
+    dvmHashTableLock(table);
+    for (int i = 0; i < table->tableSize; ++i) {
+        HashEntry *entry = &table->pEntries[i];
+        if (entry->data != NULL && entry->data != HASH_TOMBSTONE) {
+            ReflectSig *sig = (ReflectSig *)entry->data;
+            (*visitor)(&sig->params, 0, ROOT_VM_INTERNAL, arg);
+            (*visitor)(&sig->exceptions, 0, ROOT_VM_INTERNAL, arg);
+            (*visitor)(&sig->name, 0, ROOT_VM_INTERNAL, arg);
+        }
+    }
+    dvmHashTableUnlock(table);
+}
+
+/*
+ * Visits the decoded arrays in the annotation set cache.
+ */
+static void visitAnnotationCache(RootVisitor *visitor, HashTable *table,
+                                 void *arg)
+{
+    assert(visitor != NULL);
+    assert(table != NULL);
+    dvmHashTableLock(table);
+    for (int i = 0; i < table->tableSize; ++i) {
+        HashEntry *entry = &table->pEntries[i];
+        if (entry->data != NULL && entry->data != HASH_TOMBSTONE) {
+            AnnotationSetEntry *set = (AnnotationSetEntry *)entry->data;
+            (*visitor)(&set->annotations, 0, ROOT_VM_INTERNAL, arg);
         }
     }
     dvmHashTableUnlock(table);
@@ -65,12 +154,13 @@ static void visitReferenceTable(RootVisitor *visitor, ReferenceTable *table,
 /*
  * Visits all entries in the indirect reference table.
  */
-static void visitIndirectRefTable(RootVisitor *visitor, IndirectRefTable *table,
+template <typename Table>
+static void visitIndirectRefTable(RootVisitor *visitor, Table *table,
                                   u4 threadId, RootType type, void *arg)
 {
     assert(visitor != NULL);
     assert(table != NULL);
-    typedef IndirectRefTable::iterator It; // TODO: C++0x auto
+    typedef typename Table::iterator It; // TODO: C++0x auto
     for (It it = table->begin(), end = table->end(); it != end; ++it) {
         (*visitor)(*it, threadId, type, arg);
     }
@@ -95,10 +185,11 @@ static void visitThreadStack(RootVisitor *visitor, Thread *thread, void *arg)
         if (method != NULL && !dvmIsNativeMethod(method)) {
             const RegisterMap* pMap = dvmGetExpandedRegisterMap(method);
             const u1* regVector = NULL;
+            u1 lineBuf[kRegMapMaxRegWidth];
             if (pMap != NULL) {
                 /* found map, get registers for this address */
                 int addr = saveArea->xtra.currentPc - method->insns;
-                regVector = dvmRegisterMapGetLine(pMap, addr);
+                regVector = dvmRegisterMapGetLine(pMap, addr, lineBuf);
             }
             if (regVector == NULL) {
                 /*
@@ -206,28 +297,171 @@ static void visitPrimitiveTypes(RootVisitor *visitor, void *arg)
     (*visitor)(&gDvm.typeDouble, 0, ROOT_STICKY_CLASS, arg);
 }
 
+void dvmVisitThreadRoots(RootVisitor *visitor, Thread *thread, void *arg)
+{
+    visitThread(visitor, thread, arg);
+}
+
 /*
- * Visits roots.  TODO: visit cached global references.
+ * Visits roots.
  */
 void dvmVisitRoots(RootVisitor *visitor, void *arg)
 {
-    assert(visitor != NULL);
-    visitHashTable(visitor, gDvm.loadedClasses, ROOT_STICKY_CLASS, arg);
+    dvmVisitGlobalRoots(visitor, arg);
+    visitThreads(visitor, arg);
+}
+
+/*
+ * Visits the global roots other than the loaded classes, the interned
+ * strings and the JNI global references.
+ */
+static void visitOtherGlobalRoots(RootVisitor *visitor, void *arg)
+{
     visitPrimitiveTypes(visitor, arg);
     if (gDvm.dbgRegistry != NULL) {
-        visitHashTable(visitor, gDvm.dbgRegistry, ROOT_DEBUGGER, arg);
+        visitDebuggerRegistry(visitor, gDvm.dbgRegistry, arg);
     }
-    if (gDvm.literalStrings != NULL) {
-        visitHashTable(visitor, gDvm.literalStrings, ROOT_INTERNED_STRING, arg);
+    if (gDvm.jniPinTable != NULL) {
+        visitPinTable(visitor, gDvm.jniPinTable, arg);
+    }
+    if (gDvm.reflectSigCache != NULL) {
+        visitReflectSigCache(visitor, gDvm.reflectSigCache, arg);
+    }
+    if (gDvm.annotationCache != NULL) {
+        visitAnnotationCache(visitor, gDvm.annotationCache, arg);
     }
-    dvmLockMutex(&gDvm.jniGlobalRefLock);
-    visitIndirectRefTable(visitor, &gDvm.jniGlobalRefTable, 0, ROOT_JNI_GLOBAL, arg);
-    dvmUnlockMutex(&gDvm.jniGlobalRefLock);
-    dvmLockMutex(&gDvm.jniPinRefLock);
-    visitReferenceTable(visitor, &gDvm.jniPinRefTable, 0, ROOT_VM_INTERNAL, arg);
-    dvmUnlockMutex(&gDvm.jniPinRefLock);
-    visitThreads(visitor, arg);
     (*visitor)(&gDvm.outOfMemoryObj, 0, ROOT_VM_INTERNAL, arg);
     (*visitor)(&gDvm.internalErrorObj, 0, ROOT_VM_INTERNAL, arg);
     (*visitor)(&gDvm.noClassDefFoundErrorObj, 0, ROOT_VM_INTERNAL, arg);
+    (*visitor)(&gDvm.gcHeap->clearedReferences, 0, ROOT_VM_INTERNAL, arg);
+}
+
+/*
+ * TODO: visit cached global references.
+ */
+void dvmVisitGlobalRoots(RootVisitor *visitor, void *arg)
+{
+    assert(visitor != NULL);
+    visitHashTable(visitor, gDvm.loadedClasses, ROOT_STICKY_CLASS, arg);
+    if (gDvm.literalStrings != NULL) {
+        visitHashTable(visitor, gDvm.literalStrings, ROOT_INTERNED_STRING, arg);
+    }
+    /* Without a lock: the threads that change it are suspended. */
+    visitIndirectRefTable(visitor, &gDvm.jniGlobalRefTable, 0, ROOT_JNI_GLOBAL, arg);
+    visitOtherGlobalRoots(visitor, arg);
+}
+
+/*
+ * Parallel root visiting.  The roots are split into units: the JNI
+ * global references, the remaining small global tables, slices of
+ * ROOT_SLICE_ENTRIES entries of the loaded class and interned string
+ * tables, and each thread.  Between dvmBeginParallelRootVisit() and
+ * dvmEndParallelRootVisit() the two big tables and the thread list stay
+ * locked by the calling thread, so the units can be visited on threads
+ * that aren't attached to the VM.
+ */
+#define ROOT_SLICE_ENTRIES  1024
+
+enum {
+    ROOT_UNIT_JNI_GLOBALS,
+    ROOT_UNIT_OTHER_GLOBALS,
+    ROOT_UNIT_FIRST_SLICE
+};
+
+static struct {
+    int classSlices;
+    int stringSlices;
+    Thread **threads;
+    size_t numThreads;
+    bool withThreads;
+} gRootUnits;
+
+static int sliceCount(const HashTable *table)
+{
+    if (table == NULL) {
+        return 0;
+    }
+    return (table->tableSize + ROOT_SLICE_ENTRIES - 1) / ROOT_SLICE_ENTRIES;
+}
+
+size_t dvmBeginParallelRootVisit(bool withThreads)
+{
+    size_t numThreads = 0;
+    Thread **threads = NULL;
+
+    if (withThreads) {
+        dvmLockThreadList(dvmThreadSelf());
+        for (Thread *thread = gDvm.threadList; thread; thread = thread->next) {
+            numThreads++;
+        }
+        threads = (Thread **)malloc(numThreads * sizeof(*threads));
+        if (threads == NULL) {
+            dvmUnlockThreadList();
+            return 0;
+        }
+        size_t i = 0;
+        for (Thread *thread = gDvm.threadList; thread; thread = thread->next) {
+            threads[i++] = thread;
+        }
+    }
+    gRootUnits.threads = threads;
+    gRootUnits.numThreads = numThreads;
+    gRootUnits.withThreads = withThreads;
+
+    dvmHashTableLock(gDvm.loadedClasses);
+    gRootUnits.classSlices = sliceCount(gDvm.loadedClasses);
+    if (gDvm.literalStrings != NULL) {
+        dvmHashTableLock(gDvm.literalStrings);
+    }
+    gRootUnits.stringSlices = sliceCount(gDvm.literalStrings);
+
+    return ROOT_UNIT_FIRST_SLICE + gRootUnits.classSlices +
+           gRootUnits.stringSlices + numThreads;
+}
+
+void dvmVisitRootUnit(size_t unit, RootVisitor *visitor, void *arg)
+{
+    assert(visitor != NULL);
+    if (unit == ROOT_UNIT_JNI_GLOBALS) {
+        /* Without a lock: the threads that change it are suspended. */
+        visitIndirectRefTable(visitor, &gDvm.jniGlobalRefTable, 0, ROOT_JNI_GLOBAL, arg);
+        return;
+    }
+    if (unit == ROOT_UNIT_OTHER_GLOBALS) {
+        visitOtherGlobalRoots(visitor, arg);
+        return;
+    }
+    unit -= ROOT_UNIT_FIRST_SLICE;
+    HashTable *table = NULL;
+    RootType type = ROOT_UNKNOWN;
+    if (unit < (size_t)gRootUnits.classSlices) {
+        table = gDvm.loadedClasses;
+        type = ROOT_STICKY_CLASS;
+    } else if ((unit -= gRootUnits.classSlices) <
+               (size_t)gRootUnits.stringSlices) {
+        table = gDvm.literalStrings;
+        type = ROOT_INTERNED_STRING;
+    }
+    if (table != NULL) {
+        int begin = unit * ROOT_SLICE_ENTRIES;
+        int end = MIN(begin + ROOT_SLICE_ENTRIES, table->tableSize);
+        visitHashTableRange(visitor, table, begin, end, type, arg);
+        return;
+    }
+    unit -= gRootUnits.stringSlices;
+    assert(unit < gRootUnits.numThreads);
+    visitThread(visitor, gRootUnits.threads[unit], arg);
+}
+
+void dvmEndParallelRootVisit()
+{
+    if (gDvm.literalStrings != NULL) {
+        dvmHashTableUnlock(gDvm.literalStrings);
+    }
+    dvmHashTableUnlock(gDvm.loadedClasses);
+    if (gRootUnits.withThreads) {
+        dvmUnlockThreadList();
+    }
+    free(gRootUnits.threads);
+    memset(&gRootUnits, 0, sizeof(gRootUnits));
 }
@@ -58,4 +58,35 @@ void dvmVisitObject(Visitor *visitor, Object *obj, void *arg);
  */
 void dvmVisitRoots(RootVisitor *visitor, void *arg);
 
+/*
+ * Visits the roots that don't belong to a thread.
+ */
+void dvmVisitGlobalRoots(RootVisitor *visitor, void *arg);
+
+/*
+ * Visits the roots of one thread, which must be suspended or the
+ * caller.
+ */
+void dvmVisitThreadRoots(RootVisitor *visitor, Thread *thread, void *arg);
+
+/*
+ * Splits the roots that don't belong to a thread, and those of every
+ * thread if <withThreads> is set, into units that may be visited at the
+ * same time on different threads.  Returns the number of units, or 0 if
+ * the roots could not be split, in which case nothing needs ending.
+ */
+size_t dvmBeginParallelRootVisit(bool withThreads);
+
+/*
+ * Visits the roots in one unit.  Safe to call from threads that are not
+ * attached to the VM.
+ */
+void dvmVisitRootUnit(size_t unit, RootVisitor *visitor, void *arg);
+
+/*
+ * Ends a parallel root visit begun by dvmBeginParallelRootVisit(), on the
+ * thread that began it.
+ */
+void dvmEndParallelRootVisit();
+
 #endif  // DALVIK_ALLOC_VISIT_H_
@@ -34,6 +34,13 @@ static void visitFields(Visitor *visitor, Object *obj, void *arg)
             (*visitor)(ref, arg);
             refOffsets &= ~(CLASS_HIGH_BIT >> rshift);
         }
+    } else if (obj->clazz->refOffsetList != NULL) {
+        const u2 *offsets = obj->clazz->refOffsetList;
+        size_t count = obj->clazz->refOffsetCount;
+        for (size_t i = 0; i < count; ++i) {
+            Object **ref = (Object **)BYTE_OFFSET(obj, offsets[i]);
+            (*visitor)(ref, arg);
+        }
     } else {
         for (ClassObject *clazz = obj->clazz;
              clazz != NULL;
@@ -97,6 +104,7 @@ static void visitClassObject(Visitor *visitor, Object *obj, void *arg)
         (*visitor)(&asClass->super, arg);
     }
     (*visitor)(&asClass->classLoader, arg);
+    (*visitor)(&asClass->nameString, arg);
     visitFields(visitor, obj, arg);
     visitStaticFields(visitor, asClass, arg);
     if (asClass->status > CLASS_IDX) {
@@ -68,6 +68,43 @@ static bool gDebugVerbose = false;
 #define kExtraRegs  2
 #define RESULT_REGISTER(_insnRegCount)  (_insnRegCount)
 
+/*
+ * Fall-through lines are kept in sparse form if the method has at least
+ * this many registers (see RegisterLine), as long as no more than one
+ * register in kSparseLineRatio differs from the base line.
+ */
+#define kSparseLineMinRegs  32
+#define kSparseLineRatio    4
+
+/*
+ * Methods with at least this many code units are verified in reverse
+ * postorder.  Smaller ones are verified in address order, which costs
+ * nothing to set up and is close enough.
+ */
+#define kRpoMinInsns        1024
+
+/* size of the blocks that register line storage is carved from */
+#define kLineChunkSize      (64 * 1024)
+
+struct LineChunk {
+    LineChunk*  next;
+    size_t      used;
+    size_t      size;
+};
+
+/*
+ * Number of entries in the reference merge cache (power of 2).  The loops
+ * and join points of a method tend to merge the same few pairs of classes
+ * over and over.
+ */
+#define kMergeCacheSize     64
+
+struct MergeCacheEntry {
+    RegType     type1;          /* the smaller of the two types */
+    RegType     type2;
+    RegType     result;
+};
+
 /*
  * Big fat collection of register data.
  */
@@ -75,16 +112,35 @@ typedef struct RegisterTable {
     /*
      * Array of RegisterLine structs, one per address in the method.  We only
      * set the pointers for certain addresses, based on instruction widths
-     * and what we're trying to accomplish.
+     * and what we're trying to accomplish, and only once the address has
+     * been reached.
      */
     RegisterLine* registerLines;
 
+    /*
+     * Which addresses get a RegisterLine.
+     */
+    RegisterTrackingMode trackRegsFor;
+
     /*
      * Number of registers we track for each instruction.  This is equal
      * to the method's declared "registersSize" plus kExtraRegs.
      */
     size_t      insnRegCountPlus;
 
+    /*
+     * Are we tracking monitors, and are fall-through lines sparse?
+     */
+    bool        trackMonitors;
+    bool        sparseLines;
+
+    /*
+     * The base most recently given to a sparse line.  Lines that follow
+     * each other usually differ in a few registers only, so this tends
+     * to be a good base for the next one.
+     */
+    const RegType* lastBase;
+
     /*
      * Storage for a register line we're currently working on.
      */
@@ -96,10 +152,36 @@ typedef struct RegisterTable {
     RegisterLine savedLine;
 
     /*
-     * A single large alloc, with all of the storage needed for RegisterLine
-     * data (RegType array, MonitorEntries array, monitor stack).
+     * Storage for expanding a sparse line that is being merged into.
+     */
+    RegisterLine mergeLine;
+
+    /*
+     * Storage for the register lines (RegType array, MonitorEntries array,
+     * monitor stack) and sparse line data, handed out as it is needed
+     * and freed all at once.
+     */
+    LineChunk*  lineChunks;
+    size_t      lineAllocSize;
+
+    /*
+     * For methods verified in reverse postorder: the position of each
+     * instruction in the order, the instruction at each position, and the
+     * positions of the instructions marked "changed", as a bit vector.
+     * "pendingLow" is the lowest word of "pending" that may be non-zero.
      */
-    void*       lineAlloc;
+    int*        rpoIndex;
+    int*        rpoOrder;
+    u4*         pending;
+    size_t      pendingWords;
+    size_t      pendingLow;
+
+    /*
+     * Results of merging two initialized references, direct-mapped on
+     * the pair of types.  An empty entry has type1 == 0, which no
+     * reference type has.
+     */
+    MergeCacheEntry mergeCache[kMergeCacheSize];
 } RegisterTable;
 
 
@@ -114,8 +196,8 @@ static void verifyRegisterType(RegisterLine* registerLine, \
     u4 vsrc, RegType checkType, VerifyError* pFailure);
 static bool doCodeVerification(VerifierData* vdata, RegisterTable* regTable);
 static bool verifyInstruction(const Method* meth, InsnFlags* insnFlags,\
-    RegisterTable* regTable, int insnIdx, UninitInstanceMap* uninitMap,
-    int* pStartGuess);
+    RegisterTable* regTable, int insnIdx, DecodedInstruction* pDecInsn,
+    UninitInstanceMap* uninitMap, int* pStartGuess);
 static ClassObject* findCommonSuperclass(ClassObject* c1, ClassObject* c2);
 static void dumpRegTypes(const VerifierData* vdata, \
     const RegisterLine* registerLine, int addr, const char* addrName,
@@ -1784,6 +1866,202 @@ static inline RegisterLine* getRegisterLine(const RegisterTable* regTable,
     return &regTable->registerLines[insnIdx];
 }
 
+/*
+ * Returns "true" if we keep a register line for the specified address.
+ */
+static bool isTrackedAddr(const RegisterTable* regTable,
+    const InsnFlags* insnFlags, int addr)
+{
+    switch (regTable->trackRegsFor) {
+    case kTrackRegsAll:
+        return dvmInsnIsOpcode(insnFlags, addr);
+    case kTrackRegsGcPoints:
+        return dvmInsnIsGcPoint(insnFlags, addr) ||
+               dvmInsnIsBranchTarget(insnFlags, addr);
+    case kTrackRegsBranches:
+        return dvmInsnIsBranchTarget(insnFlags, addr);
+    default:
+        dvmAbort();
+        return false;
+    }
+}
+
+/*
+ * Returns "true" if the register line for the specified address, which
+ * must be tracked, is kept in sparse form.
+ */
+static inline bool isSparseAddr(const RegisterTable* regTable,
+    const InsnFlags* insnFlags, int addr)
+{
+    return regTable->sparseLines && !dvmInsnIsBranchTarget(insnFlags, addr);
+}
+
+/*
+ * Carve "size" bytes out of the register line storage.
+ */
+static void* allocLineStorage(RegisterTable* regTable, size_t size)
+{
+    const size_t headerSize = (sizeof(LineChunk) + 7) & ~7;
+    LineChunk* chunk = regTable->lineChunks;
+
+    size = (size + 7) & ~7;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunkSize = MAX(kLineChunkSize, headerSize + size);
+
+        chunk = (LineChunk*) malloc(chunkSize);
+        if (chunk == NULL) {
+            ALOGE("VFY: unable to allocate %zd bytes for register lines",
+                chunkSize);
+            return NULL;
+        }
+        chunk->next = regTable->lineChunks;
+        chunk->used = headerSize;
+        chunk->size = chunkSize;
+        regTable->lineChunks = chunk;
+        regTable->lineAllocSize += chunkSize;
+    }
+
+    void* result = (u1*) chunk + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+/*
+ * Give "line" storage of its own for all of the registers, plus the
+ * monitor data if we're tracking monitors.  The contents are undefined.
+ */
+static bool allocRegisterLine(RegisterTable* regTable, RegisterLine* line)
+{
+    size_t regTypeSize = regTable->insnRegCountPlus * sizeof(RegType);
+    size_t monEntSize = regTable->insnRegCountPlus * sizeof(MonitorEntries);
+    size_t stackSize = kMaxMonitorStackDepth * sizeof(u4);
+    size_t size = regTypeSize +
+        (regTable->trackMonitors ? monEntSize + stackSize : 0);
+
+    u1* storage = (u1*) allocLineStorage(regTable, size);
+    if (storage == NULL)
+        return false;
+
+    line->regTypes = (RegType*) storage;
+    if (regTable->trackMonitors) {
+        line->monitorEntries = (MonitorEntries*) (storage + regTypeSize);
+        line->monitorStack = (u4*) (storage + regTypeSize + monEntSize);
+    }
+    return true;
+}
+
+/*
+ * Store "types" in "line" in sparse form.  The line shares the base of
+ * the sparse line stored before it if they're close enough; otherwise a
+ * copy of "types" becomes the new base.
+ *
+ * Bases are never modified once they're shared, so storing a line again
+ * (when a loop is re-verified) can't change any other line.
+ */
+static bool storeSparseLine(RegisterTable* regTable, RegisterLine* line,
+    const RegType* types)
+{
+    const size_t insnRegCountPlus = regTable->insnRegCountPlus;
+    const size_t limit = insnRegCountPlus / kSparseLineRatio;
+    const RegType* base = regTable->lastBase;
+    size_t numDeltas = 0;
+    size_t i;
+
+    if (base != NULL) {
+        for (i = 0; i < insnRegCountPlus && numDeltas <= limit; i++) {
+            if (types[i] != base[i])
+                numDeltas++;
+        }
+    }
+
+    if (base == NULL || numDeltas > limit) {
+        RegType* newBase = (RegType*) allocLineStorage(regTable,
+            insnRegCountPlus * sizeof(RegType));
+        if (newBase == NULL)
+            return false;
+        memcpy(newBase, types, insnRegCountPlus * sizeof(RegType));
+        regTable->lastBase = base = newBase;
+        numDeltas = 0;
+    }
+
+    if (numDeltas > line->maxDeltas) {
+        /* leave some room, in case the line is stored again */
+        size_t maxDeltas = MIN((numDeltas + 7) & ~7, limit);
+        RegTypeDelta* deltas = (RegTypeDelta*) allocLineStorage(regTable,
+            maxDeltas * sizeof(RegTypeDelta));
+        if (deltas == NULL)
+            return false;
+        line->deltas = deltas;
+        line->maxDeltas = maxDeltas;
+    }
+
+    line->baseTypes = base;
+    line->numDeltas = numDeltas;
+    if (numDeltas != 0) {
+        RegTypeDelta* delta = line->deltas;
+        for (i = 0; i < insnRegCountPlus; i++) {
+            if (types[i] != base[i]) {
+                delta->reg = i;
+                delta->type = types[i];
+                delta++;
+            }
+        }
+        assert(delta == line->deltas + numDeltas);
+    }
+    return true;
+}
+
+/*
+ * Get the types of the first "numRegs" registers in "line".
+ */
+const RegType* dvmGetRegisterLineTypes(const RegisterLine* line,
+    size_t numRegs, RegType* buf)
+{
+    if (line->regTypes != NULL)
+        return line->regTypes;
+
+    if (line->baseTypes == NULL) {
+        memset(buf, 0, numRegs * sizeof(RegType));
+        return buf;
+    }
+
+    memcpy(buf, line->baseTypes, numRegs * sizeof(RegType));
+    for (unsigned int i = 0; i < line->numDeltas; i++) {
+        const RegTypeDelta* delta = &line->deltas[i];
+        if (delta->reg < numRegs)
+            buf[delta->reg] = delta->type;
+    }
+    return buf;
+}
+
+/*
+ * Mark the instruction at "addr" as needing to be (re-)verified.
+ */
+static inline void setChanged(RegisterTable* regTable, InsnFlags* insnFlags,
+    int addr)
+{
+    dvmInsnSetChanged(insnFlags, addr, true);
+    if (regTable->pending != NULL) {
+        size_t pos = regTable->rpoIndex[addr];
+        regTable->pending[pos / 32] |= 1u << (pos % 32);
+        if (pos / 32 < regTable->pendingLow)
+            regTable->pendingLow = pos / 32;
+    }
+}
+
+/*
+ * Clear the "changed" flag on the instruction at "addr".
+ */
+static inline void clearChanged(RegisterTable* regTable, InsnFlags* insnFlags,
+    int addr)
+{
+    dvmInsnSetChanged(insnFlags, addr, false);
+    if (regTable->pending != NULL) {
+        size_t pos = regTable->rpoIndex[addr];
+        regTable->pending[pos / 32] &= ~(1u << (pos % 32));
+    }
+}
+
 /*
  * Copy a register line.
  */
@@ -1805,18 +2083,24 @@ static inline void copyRegisterLine(RegisterLine* dst, const RegisterLine* src,
 }
 
 /*
- * Copy a register line into the table.
+ * Copy a register line into the table.  The line gets its storage the
+ * first time its address is reached.
  */
-static inline void copyLineToTable(RegisterTable* regTable, int insnIdx,
-    const RegisterLine* src)
+static inline bool copyLineToTable(RegisterTable* regTable,
+    const InsnFlags* insnFlags, int insnIdx, const RegisterLine* src)
 {
     RegisterLine* dst = getRegisterLine(regTable, insnIdx);
-    assert(dst->regTypes != NULL);
+    if (isSparseAddr(regTable, insnFlags, insnIdx))
+        return storeSparseLine(regTable, dst, src->regTypes);
+    if (dst->regTypes == NULL && !allocRegisterLine(regTable, dst))
+        return false;
     copyRegisterLine(dst, src, regTable->insnRegCountPlus);
+    return true;
 }
 
 /*
- * Copy a register line out of the table.
+ * Copy a register line out of the table.  Only branch targets are ever
+ * loaded, and those are never sparse.
  */
 static inline void copyLineFromTable(RegisterLine* dst,
     const RegisterTable* regTable, int insnIdx)
@@ -1838,6 +2122,13 @@ static inline int compareLineToTable(const RegisterTable* regTable,
     int insnIdx, const RegisterLine* line2)
 {
     const RegisterLine* line1 = getRegisterLine(regTable, insnIdx);
+    if (line1->regTypes == NULL) {
+        /* sparse lines don't have monitor data */
+        const RegType* types = dvmGetRegisterLineTypes(line1,
+            regTable->insnRegCountPlus, regTable->mergeLine.regTypes);
+        return memcmp(types, line2->regTypes,
+            regTable->insnRegCountPlus * sizeof(RegType));
+    }
     if (line1->monitorEntries != NULL) {
         int result;
 
@@ -2058,7 +2349,8 @@ static void copyResultRegister2(RegisterLine* registerLine,
  * Verify types for a simple two-register instruction (e.g. "neg-int").
  * "dstType" is stored into vA, and "srcType" is verified against vB.
  */
-static void checkUnop(RegisterLine* registerLine, DecodedInstruction* pDecInsn,
+static void checkUnop(RegisterLine* registerLine,
+    const DecodedInstruction* pDecInsn,
     RegType dstType, RegType srcType, VerifyError* pFailure)
 {
     verifyRegisterType(registerLine, pDecInsn->vB, srcType, pFailure);
@@ -2105,7 +2397,8 @@ static bool upcastBooleanOp(RegisterLine* registerLine, u4 reg1, u4 reg2)
  *
  * If "checkBooleanOp" is set, we use the constant value in vC.
  */
-static void checkLitop(RegisterLine* registerLine, DecodedInstruction* pDecInsn,
+static void checkLitop(RegisterLine* registerLine,
+    const DecodedInstruction* pDecInsn,
     RegType dstType, RegType srcType, bool checkBooleanOp,
     VerifyError* pFailure)
 {
@@ -2127,7 +2420,8 @@ static void checkLitop(RegisterLine* registerLine, DecodedInstruction* pDecInsn,
  * "dstType" is stored into vA, and "srcType1"/"srcType2" are verified
  * against vB/vC.
  */
-static void checkBinop(RegisterLine* registerLine, DecodedInstruction* pDecInsn,
+static void checkBinop(RegisterLine* registerLine,
+    const DecodedInstruction* pDecInsn,
     RegType dstType, RegType srcType1, RegType srcType2, bool checkBooleanOp,
     VerifyError* pFailure)
 {
@@ -2146,7 +2440,7 @@ static void checkBinop(RegisterLine* registerLine, DecodedInstruction* pDecInsn,
  * are verified against vA/vB, then "dstType" is stored into vA.
  */
 static void checkBinop2addr(RegisterLine* registerLine,
-    DecodedInstruction* pDecInsn, RegType dstType, RegType srcType1,
+    const DecodedInstruction* pDecInsn, RegType dstType, RegType srcType1,
     RegType srcType2, bool checkBooleanOp, VerifyError* pFailure)
 {
     verifyRegisterType(registerLine, pDecInsn->vA, srcType1, pFailure);
@@ -2285,61 +2579,65 @@ static RegType adjustForRightShift(RegisterLine* registerLine, int reg,
  */
 
 /*
- * Compute the "class depth" of a class.  This is the distance from the
- * class to the top of the tree, chasing superclass links.  java.lang.Object
- * has a class depth of 0.
+ * Return the superclass of "clazz" at class depth "depth", which must be
+ * no deeper than the class itself.  (java.lang.Object has a class depth
+ * of 0.)
  */
-static int getClassDepth(ClassObject* clazz)
+static ClassObject* getSuperclassAtDepth(ClassObject* clazz, u4 depth)
 {
-    int depth = 0;
+    assert(depth <= clazz->classDepth);
 
-    while (clazz->super != NULL) {
+    if (depth < CLASS_DISPLAY_SIZE)
+        return clazz->display[depth];
+    for (u4 i = clazz->classDepth; i > depth; i--)
         clazz = clazz->super;
-        depth++;
-    }
-    return depth;
+    return clazz;
 }
 
 /*
- * Given two classes, walk up the superclass tree to find a common
- * ancestor.  (Called from findCommonSuperclass().)
+ * Given two classes, find their closest common superclass.  (Called from
+ * findCommonSuperclass().)
  *
- * TODO: consider caching the class depth in the class object so we don't
- * have to search for it here.
+ * The class depths are computed when the classes are linked, and the
+ * displays list the superclasses by depth, so apart from very deep
+ * hierarchies this is a binary search for the deepest entry the two
+ * displays agree on.
  */
 static ClassObject* digForSuperclass(ClassObject* c1, ClassObject* c2)
 {
-    int depth1, depth2;
-
-    depth1 = getClassDepth(c1);
-    depth2 = getClassDepth(c2);
+    u4 depth = MIN(c1->classDepth, c2->classDepth);
 
     if (gDebugVerbose) {
         LOGVV("COMMON: %s(%d) + %s(%d)",
-            c1->descriptor, depth1, c2->descriptor, depth2);
+            c1->descriptor, c1->classDepth, c2->descriptor, c2->classDepth);
     }
 
     /* pull the deepest one up */
-    if (depth1 > depth2) {
-        while (depth1 > depth2) {
-            c1 = c1->super;
-            depth1--;
-        }
-    } else {
-        while (depth2 > depth1) {
-            c2 = c2->super;
-            depth2--;
-        }
-    }
+    c1 = getSuperclassAtDepth(c1, depth);
+    c2 = getSuperclassAtDepth(c2, depth);
 
-    /* walk up in lock-step */
-    while (c1 != c2) {
+    /* walk up in lock-step until the displays cover the rest */
+    while (c1 != c2 && depth >= CLASS_DISPLAY_SIZE) {
         c1 = c1->super;
         c2 = c2->super;
+        depth--;
 
         assert(c1 != NULL && c2 != NULL);
     }
 
+    if (c1 != c2) {
+        /* both displays start with java.lang.Object */
+        u4 lo = 0, hi = depth;
+        while (lo < hi) {
+            u4 mid = (lo + hi + 1) / 2;
+            if (c1->display[mid] == c2->display[mid])
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        c1 = c1->display[lo];
+    }
+
     if (gDebugVerbose) {
         LOGVV("      : --> %s", c1->descriptor);
     }
@@ -2486,12 +2784,44 @@ static ClassObject* findCommonSuperclass(ClassObject* c1, ClassObject* c2)
     return digForSuperclass(c1, c2);
 }
 
+/*
+ * Merge two initialized reference types, going through the table's merge
+ * cache.  The merge is symmetric, so the pair is looked up smaller first.
+ */
+static RegType mergeReferences(RegisterTable* regTable, RegType type1,
+    RegType type2)
+{
+    if (type1 > type2) {
+        RegType tmp = type1;
+        type1 = type2;
+        type2 = tmp;
+    }
+
+    u4 hash = (type1 ^ (type2 >> 3) ^ (type2 << 5)) >> 3;
+    MergeCacheEntry* entry = &regTable->mergeCache[hash & (kMergeCacheSize-1)];
+    if (entry->type1 == type1 && entry->type2 == type2)
+        return entry->result;
+
+    ClassObject* clazz1 = regTypeInitializedReferenceToClass(type1);
+    ClassObject* clazz2 = regTypeInitializedReferenceToClass(type2);
+    ClassObject* mergedClass;
+
+    mergedClass = findCommonSuperclass(clazz1, clazz2);
+    assert(mergedClass != NULL);
+
+    entry->type1 = type1;
+    entry->type2 = type2;
+    entry->result = regTypeFromClass(mergedClass);
+    return entry->result;
+}
+
 /*
  * Merge two RegType values.
  *
  * Sets "*pChanged" to "true" if the result doesn't match "type1".
  */
-static RegType mergeTypes(RegType type1, RegType type2, bool* pChanged)
+static RegType mergeTypes(RegisterTable* regTable, RegType type1,
+    RegType type2, bool* pChanged)
 {
     RegType result;
 
@@ -2535,13 +2865,7 @@ static RegType mergeTypes(RegType type1, RegType type2, bool* pChanged)
                 /* can't merge uninit with anything but self */
                 result = kRegTypeConflict;
             } else {
-                ClassObject* clazz1 = regTypeInitializedReferenceToClass(type1);
-                ClassObject* clazz2 = regTypeInitializedReferenceToClass(type2);
-                ClassObject* mergedClass;
-
-                mergedClass = findCommonSuperclass(clazz1, clazz2);
-                assert(mergedClass != NULL);
-                result = regTypeFromClass(mergedClass);
+                result = mergeReferences(regTable, type1, type2);
             }
         }
     }
@@ -2575,7 +2899,8 @@ static MonitorEntries mergeMonitorEntries(MonitorEntries ents1,
  * set the "changed" flag on the target address if any of the registers
  * has changed.
  *
- * Returns "false" if we detect mis-matched monitor stacks.
+ * Returns "false" if we detect mis-matched monitor stacks, or can't get
+ * storage for the line.
  */
 static bool updateRegisters(const Method* meth, InsnFlags* insnFlags,
     RegisterTable* regTable, int nextInsn, const RegisterLine* workLine)
@@ -2593,8 +2918,9 @@ static bool updateRegisters(const Method* meth, InsnFlags* insnFlags,
          * just an optimization.)
          */
         LOGVV("COPY into 0x%04x", nextInsn);
-        copyLineToTable(regTable, nextInsn, workLine);
-        dvmInsnSetChanged(insnFlags, nextInsn, true);
+        if (!copyLineToTable(regTable, insnFlags, nextInsn, workLine))
+            return false;
+        setChanged(regTable, insnFlags, nextInsn);
 #ifdef VERIFIER_STATS
         gDvm.verifierStats.copyRegCount++;
 #endif
@@ -2604,7 +2930,10 @@ static bool updateRegisters(const Method* meth, InsnFlags* insnFlags,
             //dumpRegTypes(vdata, targetRegs, 0, "targ", NULL, 0);
             //dumpRegTypes(vdata, workRegs, 0, "work", NULL, 0);
         }
-        /* merge registers, set Changed only if different */
+        /*
+         * Merge registers, set Changed only if different.  A sparse line
+         * is expanded, merged, and stored again if it changed.
+         */
         RegisterLine* targetLine = getRegisterLine(regTable, nextInsn);
         RegType* targetRegs = targetLine->regTypes;
         MonitorEntries* workMonEnts = workLine->monitorEntries;
@@ -2612,7 +2941,11 @@ static bool updateRegisters(const Method* meth, InsnFlags* insnFlags,
         bool changed = false;
         unsigned int idx;
 
-        assert(targetRegs != NULL);
+        if (targetRegs == NULL) {
+            assert(isSparseAddr(regTable, insnFlags, nextInsn));
+            targetRegs = regTable->mergeLine.regTypes;
+            dvmGetRegisterLineTypes(targetLine, insnRegCountPlus, targetRegs);
+        }
 
         if (targetMonEnts != NULL) {
             /*
@@ -2636,7 +2969,8 @@ static bool updateRegisters(const Method* meth, InsnFlags* insnFlags,
 
         for (idx = 0; idx < insnRegCountPlus; idx++) {
             targetRegs[idx] =
-                    mergeTypes(targetRegs[idx], workRegs[idx], &changed);
+                    mergeTypes(regTable, targetRegs[idx], workRegs[idx],
+                        &changed);
 
             if (targetMonEnts != NULL) {
                 targetMonEnts[idx] = mergeMonitorEntries(targetMonEnts[idx],
@@ -2654,8 +2988,14 @@ static bool updateRegisters(const Method* meth, InsnFlags* insnFlags,
             gDvm.verifierStats.mergeRegChanged++;
 #endif
 
-        if (changed)
-            dvmInsnSetChanged(insnFlags, nextInsn, true);
+        if (changed) {
+            if (targetLine->regTypes == NULL &&
+                !storeSparseLine(regTable, targetLine, targetRegs))
+            {
+                return false;
+            }
+            setChanged(regTable, insnFlags, nextInsn);
+        }
     }
 
     return true;
@@ -2983,29 +3323,6 @@ static ClassObject* getCaughtExceptionType(const Method* meth, int insnIdx,
     return commonSuper;
 }
 
-/*
- * Helper for initRegisterTable.
- *
- * Returns an updated copy of "storage".
- */
-static u1* assignLineStorage(u1* storage, RegisterLine* line,
-    bool trackMonitors, size_t regTypeSize, size_t monEntSize, size_t stackSize)
-{
-    line->regTypes = (RegType*) storage;
-    storage += regTypeSize;
-
-    if (trackMonitors) {
-        line->monitorEntries = (MonitorEntries*) storage;
-        storage += monEntSize;
-        line->monitorStack = (u4*) storage;
-        storage += stackSize;
-
-        assert(line->monitorStackTop == 0);
-    }
-
-    return storage;
-}
-
 /*
  * Initialize the RegisterTable.
  *
@@ -3013,26 +3330,23 @@ static u1* assignLineStorage(u1* storage, RegisterLine* line,
  * what's in which register, but for verification purposes we only need to
  * store it at branch target addresses (because we merge into that).
  *
- * By zeroing out the regType storage we are effectively initializing the
- * register information to kRegTypeUnknown.
- *
- * We jump through some hoops here to minimize the total number of
- * allocations we have to perform per method verified.
+ * Lines get their storage when their address is first reached, so this
+ * only sets up the first line (which receives the method arguments) and
+ * our "temporary" lines.  By zeroing out their regType storage we are
+ * effectively initializing the register information to kRegTypeUnknown.
  */
 static bool initRegisterTable(const VerifierData* vdata,
     RegisterTable* regTable, RegisterTrackingMode trackRegsFor)
 {
     const Method* meth = vdata->method;
     const int insnsSize = vdata->insnsSize;
-    const InsnFlags* insnFlags = vdata->insnFlags;
-    const int kExtraLines = 2;  /* workLine, savedLine */
-    int i;
 
     /*
      * Every address gets a RegisterLine struct.  This is wasteful, but
      * not so much that it's worth chasing through an extra level of
      * indirection.
      */
+    regTable->trackRegsFor = trackRegsFor;
     regTable->insnRegCountPlus = meth->registersSize + kExtraRegs;
     regTable->registerLines =
         (RegisterLine*) calloc(insnsSize, sizeof(RegisterLine));
@@ -3042,117 +3356,275 @@ static bool initRegisterTable(const VerifierData* vdata,
     assert(insnsSize > 0);
 
     /*
-     * Count up the number of "interesting" instructions.
-     *
-     * "All" means "every address that holds the start of an instruction".
-     * "Branches" and "GcPoints" mean just those addresses.
-     *
-     * "GcPoints" fills about half the addresses, "Branches" about 15%.
+     * TODO: set trackMonitors based on global config option
      */
-    int interestingCount = kExtraLines;
+    if (gDvm.monitorVerification) {
+        regTable->trackMonitors = (vdata->monitorEnterCount != 0);
+    } else {
+        regTable->trackMonitors = false;
+    }
+    regTable->sparseLines = !regTable->trackMonitors &&
+        regTable->insnRegCountPlus >= kSparseLineMinRegs;
 
-    for (i = 0; i < insnsSize; i++) {
-        bool interesting;
+    RegisterLine* lines[] = {
+        &regTable->registerLines[0], &regTable->workLine, &regTable->savedLine,
+        &regTable->mergeLine
+    };
+    size_t numLines = regTable->sparseLines ? NELEM(lines) : NELEM(lines) - 1;
 
-        switch (trackRegsFor) {
-        case kTrackRegsAll:
-            interesting = dvmInsnIsOpcode(insnFlags, i);
-            break;
-        case kTrackRegsGcPoints:
-            interesting = dvmInsnIsGcPoint(insnFlags, i) ||
-                          dvmInsnIsBranchTarget(insnFlags, i);
-            break;
-        case kTrackRegsBranches:
-            interesting = dvmInsnIsBranchTarget(insnFlags, i);
-            break;
-        default:
-            dvmAbort();
+    assert(dvmInsnIsBranchTarget(vdata->insnFlags, 0));
+    for (size_t i = 0; i < numLines; i++) {
+        RegisterLine* line = lines[i];
+
+        if (!allocRegisterLine(regTable, line))
             return false;
+        memset(line->regTypes, 0,
+            regTable->insnRegCountPlus * sizeof(RegType));
+        if (regTable->trackMonitors) {
+            memset(line->monitorEntries, 0,
+                regTable->insnRegCountPlus * sizeof(MonitorEntries));
+            memset(line->monitorStack, 0, kMaxMonitorStackDepth * sizeof(u4));
         }
+    }
 
-        if (interesting)
-            interestingCount++;
+    return true;
+}
 
-        /* count instructions, for display only */
-        //if (dvmInsnIsOpcode(insnFlags, i))
-        //    insnCount++;
+/*
+ * Free the RegisterTable's storage.
+ */
+static void freeRegisterTable(RegisterTable* regTable)
+{
+    LineChunk* chunk = regTable->lineChunks;
+    while (chunk != NULL) {
+        LineChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
 
-    /*
-     * Allocate storage for the register type arrays.
-     * TODO: set trackMonitors based on global config option
-     */
-    size_t regTypeSize = regTable->insnRegCountPlus * sizeof(RegType);
-    size_t monEntSize = regTable->insnRegCountPlus * sizeof(MonitorEntries);
-    size_t stackSize = kMaxMonitorStackDepth * sizeof(u4);
-    bool trackMonitors;
+    free(regTable->registerLines);
+    free(regTable->rpoIndex);
+    free(regTable->rpoOrder);
+    free(regTable->pending);
+}
 
-    if (gDvm.monitorVerification) {
-        trackMonitors = (vdata->monitorEnterCount != 0);
-    } else {
-        trackMonitors = false;
-    }
+/*
+ * State of the walk over an instruction's successors, for
+ * computeReversePostorder.
+ */
+enum RpoStep {
+    kRpoFindHandlers, kRpoHandlers, kRpoSwitch, kRpoBranch, kRpoContinue,
+    kRpoDone
+};
 
-    size_t spacePerEntry = regTypeSize +
-        (trackMonitors ? monEntSize + stackSize : 0);
-    regTable->lineAlloc = calloc(interestingCount, spacePerEntry);
-    if (regTable->lineAlloc == NULL)
-        return false;
+struct RpoFrame {
+    int                 addr;
+    RpoStep             step;
+    int                 switchIdx;
+    DexCatchIterator    handlers;
+};
 
-#ifdef VERIFIER_STATS
-    size_t totalSpace = interestingCount * spacePerEntry +
-        insnsSize * sizeof(RegisterLine);
-    if (gDvm.verifierStats.biggestAlloc < totalSpace)
-        gDvm.verifierStats.biggestAlloc = totalSpace;
-#endif
+/*
+ * Returns the next successor of the instruction in "frame", or -1 if
+ * there are no more.
+ *
+ * Exception handlers are taken to be reachable from every instruction in
+ * a "try" block, since the verifier may turn any instruction into one that
+ * throws.  The next instruction comes last, so that it is placed right
+ * after this one in the order.
+ */
+static int nextSuccessor(const Method* meth, const InsnFlags* insnFlags,
+    int insnsSize, RpoFrame* frame)
+{
+    const int addr = frame->addr;
+    const u2* insns = meth->insns + addr;
+    OpcodeFlags opFlags = dexGetFlagsFromOpcode(dexOpcodeFromCodeUnit(*insns));
 
-    /*
-     * Populate the sparse register line table.
-     *
-     * There is a RegisterLine associated with every address, but not
-     * every RegisterLine has non-NULL pointers to storage for its fields.
-     */
-    u1* storage = (u1*)regTable->lineAlloc;
-    for (i = 0; i < insnsSize; i++) {
-        bool interesting;
+    while (true) {
+        switch (frame->step) {
+        case kRpoFindHandlers:
+            if (dvmInsnIsInTry(insnFlags, addr) &&
+                dexFindCatchHandler(&frame->handlers, dvmGetMethodCode(meth),
+                    addr))
+            {
+                frame->step = kRpoHandlers;
+            } else {
+                frame->step = kRpoSwitch;
+            }
+            break;
+        case kRpoHandlers: {
+            DexCatchHandler* handler = dexCatchIteratorNext(&frame->handlers);
+            if (handler != NULL)
+                return handler->address;
+            frame->step = kRpoSwitch;
+            break;
+        }
+        case kRpoSwitch:
+            if ((opFlags & kInstrCanSwitch) != 0) {
+                /* the table has been checked by the static verifier */
+                const u2* switchInsns =
+                    insns + (insns[1] | (((s4) insns[2]) << 16));
+                int switchCount = switchInsns[1];
+                int offsetToTargets;
 
-        switch (trackRegsFor) {
-        case kTrackRegsAll:
-            interesting = dvmInsnIsOpcode(insnFlags, i);
+                if (dexOpcodeFromCodeUnit(*insns) == OP_PACKED_SWITCH) {
+                    offsetToTargets = 4;
+                } else {
+                    offsetToTargets = 2 + 2*switchCount;
+                }
+                if (frame->switchIdx < switchCount) {
+                    const u2* target =
+                        switchInsns + offsetToTargets + frame->switchIdx*2;
+                    frame->switchIdx++;
+                    return addr + (target[0] | (((s4) target[1]) << 16));
+                }
+            }
+            frame->step = kRpoBranch;
             break;
-        case kTrackRegsGcPoints:
-            interesting = dvmInsnIsGcPoint(insnFlags, i) ||
-                          dvmInsnIsBranchTarget(insnFlags, i);
+        case kRpoBranch:
+            frame->step = kRpoContinue;
+            if ((opFlags & kInstrCanBranch) != 0) {
+                s4 branchOffset;
+                bool isConditional;
+
+                if (dvmGetBranchOffset(meth, insnFlags, addr, &branchOffset,
+                        &isConditional))
+                {
+                    return addr + branchOffset;
+                }
+            }
             break;
-        case kTrackRegsBranches:
-            interesting = dvmInsnIsBranchTarget(insnFlags, i);
+        case kRpoContinue:
+            frame->step = kRpoDone;
+            if ((opFlags & kInstrCanContinue) != 0) {
+                int nextAddr = addr + dvmInsnGetWidth(insnFlags, addr);
+                if (nextAddr < insnsSize)
+                    return nextAddr;
+            }
             break;
         default:
-            dvmAbort();
-            return false;
+            return -1;
         }
+    }
+}
 
-        if (interesting) {
-            storage = assignLineStorage(storage, &regTable->registerLines[i],
-                trackMonitors, regTypeSize, monEntSize, stackSize);
-        }
+/*
+ * Number the instructions in reverse postorder of a depth-first walk from
+ * the start of the method, so that (loops aside) an instruction comes
+ * after everything that can flow into it and is verified once its inputs
+ * have settled.  Instructions the walk doesn't find go at the end.
+ *
+ * Also allocates the "pending" bit vector that doCodeVerification uses in
+ * place of the "changed" flags to find the next instruction.
+ */
+static bool computeReversePostorder(const VerifierData* vdata,
+    RegisterTable* regTable)
+{
+    const Method* meth = vdata->method;
+    const InsnFlags* insnFlags = vdata->insnFlags;
+    const int insnsSize = vdata->insnsSize;
+    RpoFrame* stack = NULL;
+    int numInsns = 0;
+    int addr, i;
+    bool result = false;
+
+    for (addr = 0; addr < insnsSize; addr += dvmInsnGetWidth(insnFlags, addr))
+        numInsns++;
+
+    regTable->rpoIndex = (int*) malloc(insnsSize * sizeof(int));
+    regTable->rpoOrder = (int*) malloc(numInsns * sizeof(int));
+    regTable->pendingWords = (numInsns + 31) / 32;
+    regTable->pending = (u4*) calloc(regTable->pendingWords, sizeof(u4));
+    stack = (RpoFrame*) malloc(numInsns * sizeof(RpoFrame));
+    if (regTable->rpoIndex == NULL || regTable->rpoOrder == NULL ||
+        regTable->pending == NULL || stack == NULL)
+    {
+        goto bail;
     }
 
     /*
-     * Grab storage for our "temporary" register lines.
+     * Walk the instructions, using rpoIndex to mark the ones we've seen,
+     * and list them in rpoOrder as they're finished (i.e. in postorder).
      */
-    storage = assignLineStorage(storage, &regTable->workLine,
-        trackMonitors, regTypeSize, monEntSize, stackSize);
-    storage = assignLineStorage(storage, &regTable->savedLine,
-        trackMonitors, regTypeSize, monEntSize, stackSize);
+    memset(regTable->rpoIndex, 0xff, insnsSize * sizeof(int));
 
-    //ALOGD("Tracking registers for [%d], total %d in %d units",
-    //    trackRegsFor, interestingCount-kExtraLines, insnsSize);
+    {
+        int depth = 1;
+        int done = 0;
+
+        regTable->rpoIndex[0] = 0;
+        stack[0].addr = 0;
+        stack[0].step = kRpoFindHandlers;
+        stack[0].switchIdx = 0;
+
+        while (depth > 0) {
+            RpoFrame* frame = &stack[depth-1];
+            int succ = nextSuccessor(meth, insnFlags, insnsSize, frame);
+
+            if (succ < 0) {
+                regTable->rpoOrder[done++] = frame->addr;
+                depth--;
+            } else if (regTable->rpoIndex[succ] < 0) {
+                assert(dvmInsnIsOpcode(insnFlags, succ));
+                regTable->rpoIndex[succ] = 0;
+                stack[depth].addr = succ;
+                stack[depth].step = kRpoFindHandlers;
+                stack[depth].switchIdx = 0;
+                depth++;
+            }
+        }
 
-    assert(storage - (u1*)regTable->lineAlloc ==
-        (int) (interestingCount * spacePerEntry));
-    assert(regTable->registerLines[0].regTypes != NULL);
-    return true;
+        for (i = 0; i < done / 2; i++) {
+            int tmp = regTable->rpoOrder[i];
+            regTable->rpoOrder[i] = regTable->rpoOrder[done-1 - i];
+            regTable->rpoOrder[done-1 - i] = tmp;
+        }
+
+        for (addr = 0; addr < insnsSize;
+            addr += dvmInsnGetWidth(insnFlags, addr))
+        {
+            if (regTable->rpoIndex[addr] < 0)
+                regTable->rpoOrder[done++] = addr;
+        }
+        assert(done == numInsns);
+    }
+
+    for (i = 0; i < numInsns; i++)
+        regTable->rpoIndex[regTable->rpoOrder[i]] = i;
+    regTable->pendingLow = 0;
+    result = true;
+
+bail:
+    free(stack);
+    return result;
+}
+
+/*
+ * Find the next instruction to verify in a method that is verified in
+ * reverse postorder.  Returns -1 if no instruction is marked "changed".
+ *
+ * If the instruction after the one we just verified ("startGuess") is
+ * marked and isn't a branch target, it must come next, because its
+ * register types are only in the work line.
+ */
+static int nextChangedInsn(RegisterTable* regTable,
+    const InsnFlags* insnFlags, int startGuess)
+{
+    if (dvmInsnIsChanged(insnFlags, startGuess) &&
+        !dvmInsnIsBranchTarget(insnFlags, startGuess))
+    {
+        return startGuess;
+    }
+
+    while (regTable->pendingLow < regTable->pendingWords) {
+        u4 word = regTable->pending[regTable->pendingLow];
+        if (word != 0) {
+            int pos = regTable->pendingLow * 32 + ffs(word) - 1;
+            return regTable->rpoOrder[pos];
+        }
+        regTable->pendingLow++;
+    }
+    return -1;
 }
 
 /*
@@ -3485,6 +3957,13 @@ bool dvmVerifyCodeFlow(VerifierData* vdata)
 
     vdata->registerLines = regTable.registerLines;
 
+    /*
+     * Work out the order to verify the instructions in, if the method is
+     * big enough for it to matter.
+     */
+    if (insnsSize >= kRpoMinInsns && !computeReversePostorder(vdata, &regTable))
+        goto bail;
+
     /*
      * Perform liveness analysis.
      *
@@ -3539,6 +4018,18 @@ bool dvmVerifyCodeFlow(VerifierData* vdata)
              */
             dvmSetRegisterMap((Method*)meth, pMap);
         }
+
+        /*
+         * With live-precise maps, keep the liveness too.  The JIT uses it
+         * to drop writebacks of registers that nothing reads.
+         */
+        if (gDvm.registerMapMode == kRegisterMapModeLivePrecise &&
+            meth->liveMap == NULL)
+        {
+            RegisterMap* pLiveMap = dvmGenerateLivenessMapV(vdata);
+            if (pLiveMap != NULL)
+                dvmSetLivenessMap((Method*)meth, pLiveMap);
+        }
     }
 
     /*
@@ -3547,9 +4038,14 @@ bool dvmVerifyCodeFlow(VerifierData* vdata)
     result = true;
 
 bail:
+#ifdef VERIFIER_STATS
+    size_t totalSpace = regTable.lineAllocSize +
+        insnsSize * sizeof(RegisterLine);
+    if (gDvm.verifierStats.biggestAlloc < totalSpace)
+        gDvm.verifierStats.biggestAlloc = totalSpace;
+#endif
     freeRegisterLineInnards(vdata);
-    free(regTable.registerLines);
-    free(regTable.lineAlloc);
+    freeRegisterTable(&regTable);
     return result;
 }
 
@@ -3616,7 +4112,7 @@ static bool doCodeVerification(VerifierData* vdata, RegisterTable* regTable)
     /*
      * Begin by marking the first instruction as "changed".
      */
-    dvmInsnSetChanged(insnFlags, 0, true);
+    setChanged(regTable, insnFlags, 0);
 
     if (dvmWantVerboseVerification(meth)) {
         IF_ALOGI() {
@@ -3639,24 +4135,32 @@ static bool doCodeVerification(VerifierData* vdata, RegisterTable* regTable)
      * Continue until no instructions are marked "changed".
      */
     while (true) {
-        /*
-         * Find the first marked one.  Use "startGuess" as a way to find
-         * one quickly.
-         */
-        for (insnIdx = startGuess; insnIdx < insnsSize; insnIdx++) {
-            if (dvmInsnIsChanged(insnFlags, insnIdx))
-                break;
-        }
-
-        if (insnIdx == insnsSize) {
-            if (startGuess != 0) {
-                /* try again, starting from the top */
-                startGuess = 0;
-                continue;
-            } else {
+        if (regTable->pending != NULL) {
+            insnIdx = nextChangedInsn(regTable, insnFlags, startGuess);
+            if (insnIdx < 0) {
                 /* all flags are clear */
                 break;
             }
+        } else {
+            /*
+             * Find the first marked one.  Use "startGuess" as a way to find
+             * one quickly.
+             */
+            for (insnIdx = startGuess; insnIdx < insnsSize; insnIdx++) {
+                if (dvmInsnIsChanged(insnFlags, insnIdx))
+                    break;
+            }
+
+            if (insnIdx == insnsSize) {
+                if (startGuess != 0) {
+                    /* try again, starting from the top */
+                    startGuess = 0;
+                    continue;
+                } else {
+                    /* all flags are clear */
+                    break;
+                }
+            }
         }
 
         /*
@@ -3681,14 +4185,17 @@ static bool doCodeVerification(VerifierData* vdata, RegisterTable* regTable)
              * a full table) and make sure it actually matches.
              */
             RegisterLine* registerLine = getRegisterLine(regTable, insnIdx);
-            if (registerLine->regTypes != NULL &&
+            if (isTrackedAddr(regTable, insnFlags, insnIdx) &&
                 compareLineToTable(regTable, insnIdx, &regTable->workLine) != 0)
             {
                 char* desc = dexProtoCopyMethodDescriptor(&meth->prototype);
                 LOG_VFY("HUH? workLine diverged in %s.%s %s",
                         meth->clazz->descriptor, meth->name, desc);
                 free(desc);
-                dumpRegTypes(vdata, registerLine, 0, "work",
+                /* a sparse line was expanded into mergeLine by the compare */
+                if (registerLine->regTypes == NULL)
+                    registerLine = &regTable->mergeLine;
+                dumpRegTypes(vdata, &regTable->workLine, 0, "work",
                     uninitMap, DRT_SHOW_REF_TYPES | DRT_SHOW_LOCALS);
                 dumpRegTypes(vdata, registerLine, 0, "insn",
                     uninitMap, DRT_SHOW_REF_TYPES | DRT_SHOW_LOCALS);
@@ -3703,7 +4210,7 @@ static bool doCodeVerification(VerifierData* vdata, RegisterTable* regTable)
         //ALOGI("process %s.%s %s %d",
         //    meth->clazz->descriptor, meth->name, meth->descriptor, insnIdx);
         if (!verifyInstruction(meth, insnFlags, regTable, insnIdx,
-                uninitMap, &startGuess))
+                dvmGetDecodedInsn(vdata, insnIdx), uninitMap, &startGuess))
         {
             //ALOGD("+++ %s bailing at %d", meth->name, insnIdx);
             goto bail;
@@ -3713,7 +4220,7 @@ static bool doCodeVerification(VerifierData* vdata, RegisterTable* regTable)
          * Clear "changed" and mark as visited.
          */
         dvmInsnSetVisited(insnFlags, insnIdx, true);
-        dvmInsnSetChanged(insnFlags, insnIdx, false);
+        clearChanged(regTable, insnFlags, insnIdx);
     }
 
     if (DEAD_CODE_SCAN && !IS_METHOD_FLAG_SET(meth, METHOD_ISWRITABLE)) {
@@ -3794,8 +4301,8 @@ bail:
  * throw-verification-error.
  */
 static bool verifyInstruction(const Method* meth, InsnFlags* insnFlags,
-    RegisterTable* regTable, int insnIdx, UninitInstanceMap* uninitMap,
-    int* pStartGuess)
+    RegisterTable* regTable, int insnIdx, DecodedInstruction* pDecInsn,
+    UninitInstanceMap* uninitMap, int* pStartGuess)
 {
     const int insnsSize = dvmGetMethodInsnsSize(meth);
     const u2* insns = meth->insns + insnIdx;
@@ -3834,15 +4341,10 @@ static bool verifyInstruction(const Method* meth, InsnFlags* insnFlags,
     s4 branchTarget = 0;
     const int insnRegCount = meth->registersSize;
     RegType tmpType;
-    DecodedInstruction decInsn;
+    const DecodedInstruction& decInsn = *pDecInsn;
     bool justSetResult = false;
     VerifyError failure = VERIFY_ERROR_NONE;
 
-#ifndef NDEBUG
-    memset(&decInsn, 0x81, sizeof(decInsn));
-#endif
-    dexDecodeInstruction(insns, &decInsn);
-
     int nextFlags = dexGetFlagsFromOpcode(decInsn.opcode);
 
     /*
@@ -5774,6 +6276,8 @@ sput_1nr_common:
     case OP_INVOKE_VIRTUAL_QUICK_RANGE:
     case OP_INVOKE_SUPER_QUICK:
     case OP_INVOKE_SUPER_QUICK_RANGE:
+    case OP_IGET_QUICK_IF_EQZ:
+    case OP_CONST_4_ADD_INT:
         /* fall through to failure */
 
     /*
@@ -5800,8 +6304,6 @@ sput_1nr_common:
         /* fall through to failure */
 
     /* these should never appear during verification */
-    case OP_UNUSED_3E:
-    case OP_UNUSED_3F:
     case OP_UNUSED_40:
     case OP_UNUSED_41:
     case OP_UNUSED_42:
@@ -5837,6 +6339,7 @@ sput_1nr_common:
             }
             /* IMPORTANT: meth->insns may have been changed */
             insns = meth->insns + insnIdx;
+            dexDecodeInstruction(insns, pDecInsn);
 
             /* continue on as if we just handled a throw-verification-error */
             failure = VERIFY_ERROR_NONE;
@@ -5875,7 +6378,7 @@ sput_1nr_common:
         if (!checkMoveException(meth, insnIdx+insnWidth, "next"))
             goto bail;
 
-        if (getRegisterLine(regTable, insnIdx+insnWidth)->regTypes != NULL) {
+        if (isTrackedAddr(regTable, insnFlags, insnIdx+insnWidth)) {
             /*
              * Merge registers into what we have for the next instruction,
              * and set the "changed" flag if needed.
@@ -5889,7 +6392,7 @@ sput_1nr_common:
              * so we don't know what the prior state was.  We have to
              * assume that something has changed and re-evaluate it.
              */
-            dvmInsnSetChanged(insnFlags, insnIdx+insnWidth, true);
+            setChanged(regTable, insnFlags, insnIdx+insnWidth);
         }
     }
 
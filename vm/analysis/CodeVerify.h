@@ -20,6 +20,7 @@
 #ifndef DALVIK_CODEVERIFY_H_
 #define DALVIK_CODEVERIFY_H_
 
+#include "libdex/InstrUtils.h"
 #include "analysis/VerifySubs.h"
 #include "analysis/VfyBasicBlock.h"
 
@@ -132,13 +133,29 @@ typedef u4 MonitorEntries;
  * be populated.  Unlike the other lists of registers here, we do not
  * track the liveness of the method result register (which is not visible
  * to the GC).
+ *
+ * A line that can only be reached by falling through from the previous
+ * instruction is never merged into, so in methods with many registers it
+ * may be kept in sparse form instead: "regTypes" is NULL, and the types
+ * are those in "baseTypes" (a read-only copy of some earlier line, which
+ * other lines may share) with the "deltas" applied.  Use
+ * dvmGetRegisterLineTypes() to read a line that may be sparse.
  */
+struct RegTypeDelta {
+    u4              reg;
+    RegType         type;
+};
+
 struct RegisterLine {
     RegType*        regTypes;
     MonitorEntries* monitorEntries;
     u4*             monitorStack;
     unsigned int    monitorStackTop;
     BitVector*      liveRegs;
+    const RegType*  baseTypes;
+    RegTypeDelta*   deltas;
+    u2              numDeltas;
+    u2              maxDeltas;
 };
 
 /*
@@ -202,6 +219,15 @@ struct VerifierData {
     size_t          newInstanceCount;
     size_t          monitorEnterCount;
 
+    /*
+     * Every instruction, decoded once up front for all the passes over
+     * the method; "decodedIndex" has the entry for each code unit that
+     * starts an instruction.
+     */
+    size_t          insnCount;
+    DecodedInstruction* decodedInsns;
+    u4*             decodedIndex;
+
     /*
      * Array of pointers to basic blocks, one entry per code unit.  Used
      * for liveness analysis.
@@ -213,6 +239,14 @@ struct VerifierData {
 /* table with static merge logic for primitive types */
 extern const char gDvmMergeTab[kRegTypeMAX][kRegTypeMAX];
 
+/*
+ * Get the types of the first "numRegs" registers in "line".  A sparse
+ * line is expanded into "buf", which must have room for "numRegs"
+ * entries, and a line that was never reached reads as all unknown.
+ */
+const RegType* dvmGetRegisterLineTypes(const RegisterLine* line,
+    size_t numRegs, RegType* buf);
+
 
 /*
  * Returns "true" if the flags indicate that this address holds the start
@@ -222,6 +256,16 @@ INLINE bool dvmInsnIsOpcode(const InsnFlags* insnFlags, int addr) {
     return (insnFlags[addr] & kInsnFlagWidthMask) != 0;
 }
 
+/*
+ * Get the decoded form of the instruction that starts at "addr".
+ */
+INLINE DecodedInstruction* dvmGetDecodedInsn(const VerifierData* vdata,
+    int addr)
+{
+    assert(dvmInsnIsOpcode(vdata->insnFlags, addr));
+    return &vdata->decodedInsns[vdata->decodedIndex[addr]];
+}
+
 /*
  * Extract the unsigned 16-bit instruction width from "flags".
  */
@@ -25,6 +25,8 @@
  * more rigorously structured.
  */
 #include "Dalvik.h"
+#include "libdex/Adler32.h"
+#include "libdex/DexCatch.h"
 #include "libdex/OptInvocation.h"
 #include "analysis/RegisterMap.h"
 #include "analysis/Optimize.h"
@@ -45,19 +47,69 @@
 #include <unistd.h>
 #include <zlib.h>
 
+/*
+ * Per-class verification records.  For every class def that verified,
+ * this holds a fingerprint of everything outside the class's own code
+ * that the verifier could have relied on.  When the DEX is optimized again
+ * -- typically because something on the bootclasspath changed -- a class
+ * whose fingerprint hasn't changed takes its earlier result, register
+ * maps included, instead of being verified again.  A fingerprint of zero
+ * means there is no record.
+ */
+struct VerifyRecords {
+    u4          flags;              /* kVerifyRecords* settings, below */
+    u4          classCount;
+    u8*         fingerprints;       /* one per class def */
+
+    /* when read back from an earlier run: its maps, and the storage */
+    const RegisterMapClassPool* pRegisterMaps;
+    void*       storage;
+};
+
+/* settings that must be the same for earlier records to apply */
+enum {
+    kVerifyRecordsRegisterMaps  = 1,
+    kVerifyRecordsBootstrap     = 1 << 1,
+};
+
+struct VerifyWork;
+
+/*
+ * Set by dvmPreloadForDexOpt(): the core classes and members are already
+ * looked up and the class Class is initialized.
+ */
+static bool gBootClassesPreloaded = false;
+
 /* fwd */
 static bool rewriteDex(u1* addr, int len, bool doVerify, bool doOpt,
+    const VerifyRecords* pPrior, VerifyRecords* pRecords,
     DexClassLookup** ppClassLookup, DvmDex** ppDvmDex);
 static bool loadAllClasses(DvmDex* pDvmDex);
 static void verifyAndOptimizeClasses(DexFile* pDexFile, bool doVerify,
-    bool doOpt);
-static void verifyAndOptimizeClass(DexFile* pDexFile, ClassObject* clazz,
-    const DexClassDef* pClassDef, bool doVerify, bool doOpt);
+    bool doOpt, const VerifyRecords* pPrior, VerifyRecords* pRecords);
+static void verifyAndOptimizeClass(VerifyWork* work, ClassObject* clazz,
+    u4 idx);
+static void saveVerifyRecords(int fd, const char* cacheFileName, u4 modWhen,
+    u4 crc);
+static VerifyRecords* loadVerifyRecords(const char* fileName, u4 modWhen,
+    u4 crc);
+static void freeVerifyRecords(VerifyRecords* pRecords);
 static void updateChecksum(u1* addr, int len, DexHeader* pHeader);
 static int writeDependencies(int fd, u4 modWhen, u4 crc);
 static bool writeOptData(int fd, const DexClassLookup* pClassLookup,\
-    const RegisterMapBuilder* pRegMapBuilder);
+    const RegisterMapBuilder* pRegMapBuilder, const VerifyRecords* pRecords);
 static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum);
+static bool writeChunk(int fd, u4 type, const void* data, size_t size);
+static bool writeVerifyRecords(int fd, const VerifyRecords* pRecords);
+
+/*
+ * The file that carries the verification records of a stale cache file
+ * over to the dexopt run that replaces it.
+ */
+static std::string verifyRecordsFileName(const char* cacheFileName)
+{
+    return std::string(cacheFileName) + ".vfy";
+}
 
 /*
  * Get just the directory portion of the given path. Equivalent to dirname(3).
@@ -281,7 +333,12 @@ retry:
              * boot DEX gets updated, and for general "why aren't my
              * changes doing anything" purposes its best if we just make
              * everything crash when a DEX they're using gets updated.
+             *
+             * What the verifier concluded about each class can outlive
+             * the file, though, so keep that for the next dexopt run.
              */
+            saveVerifyRecords(fd, cacheFileName, modWhen, crc);
+
             ALOGD("ODEX file is stale or bad; removing and retrying (%s)",
                 cacheFileName);
             if (ftruncate(fd, 0) != 0) {
@@ -349,7 +406,8 @@ bool dvmUnlockCachedDexFile(int fd)
  * Returns "true" on success.  All data will have been written to "fd".
  */
 bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLength,
-    const char* fileName, u4 modWhen, u4 crc, bool isBootstrap)
+    const char* fileName, const char* cacheFileName, u4 modWhen, u4 crc,
+    bool isBootstrap, bool checksumOk)
 {
     const char* lastPart = strrchr(fileName, '/');
     if (lastPart != NULL)
@@ -370,12 +428,17 @@ bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLength,
         return false;
     }
 
+    /* left by dvmOpenCachedDexFile if it threw out an earlier version */
+    std::string recordsFileName;
+    if (cacheFileName != NULL)
+        recordsFileName = verifyRecordsFileName(cacheFileName);
+
     pid = fork();
     if (pid == 0) {
         static const int kUseValgrind = 0;
         static const char* kDexOptBin = "/bin/dexopt";
         static const char* kValgrinder = "/usr/bin/valgrind";
-        static const int kFixedArgCount = 10;
+        static const int kFixedArgCount = 11;
         static const int kValgrindArgCount = 5;
         static const int kMaxIntLen = 12;   // '-'+10dig+'\0' -OR- 0x+8dig
         int bcpSize = dvmGetBootPathSize();
@@ -451,11 +514,18 @@ bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLength,
         }
         if (isBootstrap)
             flags |= DEXOPT_IS_BOOTSTRAP;
-        if (gDvm.generateRegisterMaps)
+        if (gDvm.generateRegisterMaps) {
             flags |= DEXOPT_GEN_REGISTER_MAPS;
+            if (gDvm.registerMapMode == kRegisterMapModeLivePrecise)
+                flags |= DEXOPT_LIVE_REGISTER_MAPS;
+        }
+        if (checksumOk)
+            flags |= DEXOPT_CHECKSUM_OK;
         sprintf(values[9], "%d", flags);
         argv[curArg++] = values[9];
 
+        argv[curArg++] = recordsFileName.c_str();
+
         assert(((!kUseValgrind && curArg == kFixedArgCount) ||
                ((kUseValgrind && curArg == kFixedArgCount+kValgrindArgCount))));
 
@@ -494,6 +564,11 @@ bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLength,
             }
         }
         dvmChangeStatus(NULL, oldStatus);
+
+        /* used or not, the earlier records are done with */
+        if (!recordsFileName.empty())
+            unlink(recordsFileName.c_str());
+
         if (gotPid != pid) {
             ALOGE("waitpid failed: wanted %d, got %d: %s",
                 (int) pid, (int) gotPid, strerror(errno));
@@ -525,10 +600,15 @@ bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLength,
  * Returns "true" on success.
  */
 bool dvmContinueOptimization(int fd, off_t dexOffset, long dexLength,
-    const char* fileName, u4 modWhen, u4 crc, bool isBootstrap)
+    const char* fileName, u4 modWhen, u4 crc, bool isBootstrap,
+    const char* recordsFileName)
 {
     DexClassLookup* pClassLookup = NULL;
     RegisterMapBuilder* pRegMapBuilder = NULL;
+    VerifyRecords* pPrior = NULL;
+    VerifyRecords records;
+
+    memset(&records, 0, sizeof(records));
 
     assert(gDvm.optimizing);
 
@@ -555,6 +635,9 @@ bool dvmContinueOptimization(int fd, off_t dexOffset, long dexLength,
      */
     gDvm.optimizingBootstrapClass = isBootstrap;
 
+    if (recordsFileName != NULL && recordsFileName[0] != '\0')
+        pPrior = loadVerifyRecords(recordsFileName, modWhen, crc);
+
     {
         /*
          * Map the entire file (so we don't have to worry about page
@@ -600,7 +683,7 @@ bool dvmContinueOptimization(int fd, off_t dexOffset, long dexLength,
          * This creates the class lookup table as part of doing the processing.
          */
         success = rewriteDex(((u1*) mapAddr) + dexOffset, dexLength,
-                    doVerify, doOpt, &pClassLookup, NULL);
+                    doVerify, doOpt, pPrior, &records, &pClassLookup, NULL);
 
         if (success) {
             DvmDex* pDvmDex = NULL;
@@ -693,7 +776,7 @@ bool dvmContinueOptimization(int fd, off_t dexOffset, long dexLength,
     /*
      * Append any optimized pre-computed data structures.
      */
-    if (!writeOptData(fd, pClassLookup, pRegMapBuilder)) {
+    if (!writeOptData(fd, pClassLookup, pRegMapBuilder, &records)) {
         ALOGW("Failed writing opt data");
         goto bail;
     }
@@ -743,6 +826,8 @@ bool dvmContinueOptimization(int fd, off_t dexOffset, long dexLength,
 bail:
     dvmFreeRegisterMapBuilder(pRegMapBuilder);
     free(pClassLookup);
+    free(records.fingerprints);
+    freeVerifyRecords(pPrior);
     return result;
 }
 
@@ -768,7 +853,9 @@ bool dvmPrepareDexInMemory(u1* addr, size_t len, DvmDex** ppDvmDex)
      * also need to be changed, or we will try to verify the class twice,
      * and possibly reject it when optimized opcodes are encountered.)
      */
-    if (!rewriteDex(addr, len, false, false, &pClassLookup, ppDvmDex)) {
+    if (!rewriteDex(addr, len, false, false, NULL, NULL, &pClassLookup,
+            ppDvmDex))
+    {
         return false;
     }
 
@@ -790,8 +877,13 @@ bool dvmPrepareDexInMemory(u1* addr, size_t len, DvmDex** ppDvmDex)
  *
  * If "ppDvmDex" is non-NULL, a newly-allocated DvmDex struct will be
  * returned on success.
+ *
+ * If classes are verified and "pRecords" is non-NULL, it is filled in with
+ * newly-allocated verification records.  "pPrior" holds the records of an
+ * earlier run, if there are any.
  */
 static bool rewriteDex(u1* addr, int len, bool doVerify, bool doOpt,
+    const VerifyRecords* pPrior, VerifyRecords* pRecords,
     DexClassLookup** ppClassLookup, DvmDex** ppDvmDex)
 {
     DexClassLookup* pClassLookup = NULL;
@@ -800,9 +892,16 @@ static bool rewriteDex(u1* addr, int len, bool doVerify, bool doOpt,
     bool result = false;
     const char* msgStr = "???";
 
-    /* if the DEX is in the wrong byte order, swap it now */
-    if (dexSwapAndVerify(addr, len) != 0)
+    /*
+     * If the DEX is in the wrong byte order, swap it now.  The checksum
+     * doesn't need another pass if it was checked during extraction.
+     */
+    if (gDvm.dexOptChecksumOk) {
+        if (dexSwapAndVerifyChecksummed(addr, len) != 0)
+            goto bail;
+    } else if (dexSwapAndVerify(addr, len) != 0) {
         goto bail;
+    }
 
     /*
      * Now that the DEX file can be read directly, create a DexFile struct
@@ -851,7 +950,7 @@ static bool rewriteDex(u1* addr, int len, bool doVerify, bool doOpt,
      * for dexopt on core.jar the order of operations gets a bit tricky,
      * so we defer it to here.
      */
-    if (!dvmCreateInlineSubsTable())
+    if (gDvm.inlineSubs == NULL && !dvmCreateInlineSubsTable())
         goto bail;
 
     /*
@@ -861,7 +960,8 @@ static bool rewriteDex(u1* addr, int len, bool doVerify, bool doOpt,
      * This is best-effort, so there's really no way for dexopt to
      * fail at this point.
      */
-    verifyAndOptimizeClasses(pDvmDex->pDexFile, doVerify, doOpt);
+    verifyAndOptimizeClasses(pDvmDex->pDexFile, doVerify, doOpt, pPrior,
+        pRecords);
     verifyOptWhen = dvmGetRelativeTimeUsec();
 
     if (doVerify && doOpt)
@@ -874,7 +974,7 @@ static bool rewriteDex(u1* addr, int len, bool doVerify, bool doOpt,
         (int) (loadWhen - prepWhen) / 1000,
         msgStr,
         (int) (verifyOptWhen - loadWhen) / 1000,
-        gDvm.pBootLoaderAlloc->curOffset);
+        dvmLinearAllocUsed(NULL));
 
     result = true;
 
@@ -903,6 +1003,40 @@ bail:
     return result;
 }
 
+/*
+ * Do the class loading that every optimization against the current
+ * bootstrap class path would otherwise repeat: look up the VM's required
+ * classes and members, initialize the class Class, build the inline
+ * substitution table, and load every bootstrap class.  A batch dexopt
+ * calls this once after dvmPrepForDexOpt() and then forks a worker per
+ * DEX file, each of which starts with all of this already in place.
+ *
+ * Not for use when the DEX being optimized is itself a bootstrap class
+ * path entry, since that is where the required classes may come from.
+ */
+bool dvmPreloadForDexOpt()
+{
+    assert(gDvm.optimizing);
+
+    u8 startWhen = dvmGetRelativeTimeUsec();
+
+    if (!dvmFindRequiredClassesAndMembers())
+        return false;
+    if (!dvmInitClass(gDvm.classJavaLangClass)) {
+        ALOGE("ERROR: failed to initialize the class Class!");
+        return false;
+    }
+    if (!dvmCreateInlineSubsTable())
+        return false;
+
+    int loaded = dvmLoadAllBootClasses();
+    gBootClassesPreloaded = true;
+
+    ALOGD("DexOpt: preloaded %d bootstrap classes in %dms", loaded,
+        (int) (dvmGetRelativeTimeUsec() - startWhen) / 1000);
+    return true;
+}
+
 /*
  * Try to load all classes in the specified DEX.  If they have some sort
  * of broken dependency, e.g. their superclass lives in a different DEX
@@ -940,7 +1074,7 @@ static bool loadAllClasses(DvmDex* pDvmDex)
      * referring to many of the class references that got set up by
      * this call.)
      */
-    if (!dvmFindRequiredClassesAndMembers()) {
+    if (!gBootClassesPreloaded && !dvmFindRequiredClassesAndMembers()) {
         return false;
     }
 
@@ -953,7 +1087,7 @@ static bool loadAllClasses(DvmDex* pDvmDex)
      * that contains Object, and only when Object comes first in the
      * list, but it costs very little to do it in all cases.)
      */
-    if (!dvmInitClass(gDvm.classJavaLangClass)) {
+    if (!gBootClassesPreloaded && !dvmInitClass(gDvm.classJavaLangClass)) {
         ALOGE("ERROR: failed to initialize the class Class!");
         return false;
     }
@@ -993,28 +1127,389 @@ static bool loadAllClasses(DvmDex* pDvmDex)
     return true;
 }
 
+/* the most threads that verify and optimize classes at once */
+static const int kMaxVerifyThreads = 8;
+
+/* a DEX with fewer classes than this per thread gets fewer threads */
+static const u4 kMinClassesPerThread = 64;
+
 /*
- * Verify and/or optimize all classes that were successfully loaded from
- * this DEX file.
+ * The class defs of a DEX file, shared out among the threads that verify
+ * and optimize them.  Each thread claims the next class def in turn.
  */
-static void verifyAndOptimizeClasses(DexFile* pDexFile, bool doVerify,
-    bool doOpt)
+struct VerifyWork {
+    DexFile*        pDexFile;
+    bool            doVerify;
+    bool            doOpt;
+    volatile int32_t nextIdx;
+
+    /* verification records: from an earlier run, and the ones we write */
+    const VerifyRecords* pPrior;
+    VerifyRecords*  pRecords;
+    HashTable*      classShapes;
+    volatile int32_t reusedCount;
+};
+
+/*
+ * ===========================================================================
+ *      Verification records
+ * ===========================================================================
+ */
+
+/* fingerprints are 64-bit FNV-1a hashes */
+static const u8 kFingerprintBasis = 0xcbf29ce484222325ULL;
+static const u8 kFingerprintPrime = 0x100000001b3ULL;
+
+/* what a class that can't be found contributes to a fingerprint */
+static const u8 kMissingClassShape = 1;
+
+static u8 hashBytes(u8 hash, const void* data, size_t length)
+{
+    const u1* ptr = (const u1*) data;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= ptr[i];
+        hash *= kFingerprintPrime;
+    }
+    return hash;
+}
+
+static inline u8 hashString(u8 hash, const char* str)
+{
+    return hashBytes(hash, str, strlen(str) + 1);
+}
+
+static inline u8 hashU8(u8 hash, u8 value)
+{
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+static u8 hashProto(u8 hash, const DexProto* pProto)
+{
+    DexParameterIterator iterator;
+    const char* descriptor;
+
+    hash = hashU8(hash, dexProtoGetParameterCount(pProto));
+    dexParameterIteratorInit(&iterator, pProto);
+    while ((descriptor = dexParameterIteratorNextDescriptor(&iterator)) != NULL)
+        hash = hashString(hash, descriptor);
+    return hashString(hash, dexProtoGetReturnType(pProto));
+}
+
+static u8 hashMember(u8 hash, const char* name, u4 accessFlags)
+{
+    return hashU8(hashString(hash, name), accessFlags);
+}
+
+/*
+ * The shape of each class seen while fingerprinting, in VerifyWork's
+ * "classShapes".
+ */
+struct ClassShape {
+    const ClassObject* clazz;
+    u8          hash;
+};
+
+static int compareClassShapes(const void* tableItem, const void* looseItem)
+{
+    return ((const ClassShape*) tableItem)->clazz !=
+           ((const ClassShape*) looseItem)->clazz;
+}
+
+/*
+ * Compute a hash of what the verifier can see of a class when it checks
+ * code in another one: its name and flags, its members, and the shapes
+ * of the classes it extends and implements.  Code, field offsets and the
+ * vtable layout don't come into it.  A NULL class, one that can't be
+ * found, gets a shape of its own.
+ */
+static u8 classShape(VerifyWork* work, const ClassObject* clazz)
+{
+    if (clazz == NULL)
+        return kMissingClassShape;
+
+    u4 itemHash = (u4) ((uintptr_t) clazz >> 3);
+    ClassShape probe;
+    probe.clazz = clazz;
+    dvmHashTableLock(work->classShapes);
+    const ClassShape* found = (const ClassShape*) dvmHashTableLookup(
+        work->classShapes, itemHash, &probe, compareClassShapes, false);
+    dvmHashTableUnlock(work->classShapes);
+    if (found != NULL)
+        return found->hash;
+
+    u8 hash = hashString(kFingerprintBasis, clazz->descriptor);
+    hash = hashU8(hash, clazz->accessFlags & JAVA_FLAGS_MASK);
+    hash = hashU8(hash, IS_CLASS_FLAG_SET(clazz, CLASS_MULTIPLE_DEFS));
+    hash = hashU8(hash, clazz->pDvmDex != NULL &&
+        clazz->pDvmDex->pDexFile == work->pDexFile);
+    hash = hashU8(hash,
+        (clazz->super != NULL) ? classShape(work, clazz->super) : 0);
+    if (clazz->elementClass != NULL)
+        hash = hashU8(hash, classShape(work, clazz->elementClass));
+    for (int i = 0; i < clazz->interfaceCount; i++)
+        hash = hashU8(hash, classShape(work, clazz->interfaces[i]));
+
+    for (int i = 0; i < clazz->sfieldCount; i++) {
+        const StaticField* field = &clazz->sfields[i];
+        hash = hashMember(hash, field->name, field->accessFlags);
+        hash = hashString(hash, field->signature);
+    }
+    for (int i = 0; i < clazz->ifieldCount; i++) {
+        const InstField* field = &clazz->ifields[i];
+        hash = hashMember(hash, field->name, field->accessFlags);
+        hash = hashString(hash, field->signature);
+    }
+
+    const Method* directMethods = dvmGetDirectMethods(clazz);
+    for (int i = 0; i < clazz->directMethodCount; i++) {
+        const Method* meth = &directMethods[i];
+        hash = hashMember(hash, meth->name, meth->accessFlags);
+        hash = hashProto(hash, &meth->prototype);
+    }
+    for (int i = 0; i < clazz->virtualMethodCount; i++) {
+        const Method* meth = &clazz->virtualMethods[i];
+        hash = hashMember(hash, meth->name, meth->accessFlags);
+        hash = hashProto(hash, &meth->prototype);
+    }
+
+    ClassShape* entry = (ClassShape*) malloc(sizeof(ClassShape));
+    if (entry != NULL) {
+        entry->clazz = clazz;
+        entry->hash = hash;
+        dvmHashTableLock(work->classShapes);
+        found = (const ClassShape*) dvmHashTableLookup(work->classShapes,
+            itemHash, entry, compareClassShapes, true);
+        dvmHashTableUnlock(work->classShapes);
+        if (found != entry)
+            free(entry);
+    }
+    return hash;
+}
+
+/*
+ * Find a class named by code in "referrer" the way the verifier would,
+ * but without recording it as resolved.  Returns NULL if there is no
+ * such class.
+ */
+static ClassObject* findFingerprintClass(const ClassObject* referrer,
+    const char* descriptor)
+{
+    if (descriptor[0] != '\0' && descriptor[1] == '\0')
+        return dvmFindPrimitiveClass(descriptor[0]);
+
+    ClassObject* clazz = dvmFindClassNoInit(descriptor, referrer->classLoader);
+    if (clazz == NULL)
+        dvmClearOptException(dvmThreadSelf());
+    return clazz;
+}
+
+static u8 hashTypeIdx(VerifyWork* work, u8 hash, const ClassObject* referrer,
+    u4 typeIdx)
+{
+    ClassObject* clazz = dvmDexGetResolvedClass(referrer->pDvmDex, typeIdx);
+    if (clazz == NULL) {
+        clazz = findFingerprintClass(referrer,
+            dexStringByTypeIdx(work->pDexFile, typeIdx));
+    }
+    return hashU8(hash, classShape(work, clazz));
+}
+
+static u8 hashProtoTypes(VerifyWork* work, u8 hash,
+    const ClassObject* referrer, const DexProto* pProto)
+{
+    DexParameterIterator iterator;
+    const char* descriptor;
+
+    dexParameterIteratorInit(&iterator, pProto);
+    while ((descriptor = dexParameterIteratorNextDescriptor(&iterator)) != NULL)
+        hash = hashU8(hash, classShape(work,
+            findFingerprintClass(referrer, descriptor)));
+    return hashU8(hash, classShape(work,
+        findFingerprintClass(referrer, dexProtoGetReturnType(pProto))));
+}
+
+/*
+ * Add to "*pHash" the shapes of the classes that one method names: in
+ * its signature, its instructions and its exception handlers.  Returns
+ * "false" if the verifier has rewritten any instruction to throw, since
+ * a later run can't know to do the same without verifying.
+ */
+static bool fingerprintMethod(VerifyWork* work, const Method* meth,
+    u8* pHash)
+{
+    DexFile* pDexFile = work->pDexFile;
+    const ClassObject* clazz = meth->clazz;
+    u8 hash = hashProtoTypes(work, *pHash, clazz, &meth->prototype);
+
+    const DexCode* pCode = dvmGetMethodCode(meth);
+    if (pCode == NULL) {
+        *pHash = hash;
+        return true;
+    }
+
+    const u2* insns = pCode->insns;
+    u4 insnsSize = pCode->insnsSize;
+    for (u4 offset = 0; offset < insnsSize; ) {
+        Opcode opcode = dexOpcodeFromCodeUnit(insns[offset]);
+        if (opcode == OP_THROW_VERIFICATION_ERROR)
+            return false;
+
+        /* every reference that matters here is in the second code unit */
+        switch (dexGetIndexTypeFromOpcode(opcode)) {
+        case kIndexTypeRef:
+            hash = hashTypeIdx(work, hash, clazz, insns[offset + 1]);
+            break;
+        case kIndexFieldRef: {
+            const DexFieldId* pFieldId =
+                dexGetFieldId(pDexFile, insns[offset + 1]);
+            hash = hashTypeIdx(work, hash, clazz, pFieldId->classIdx);
+            hash = hashTypeIdx(work, hash, clazz, pFieldId->typeIdx);
+            break;
+        }
+        case kIndexMethodRef: {
+            const DexMethodId* pMethodId =
+                dexGetMethodId(pDexFile, insns[offset + 1]);
+            DexProto proto = { pDexFile, pMethodId->protoIdx };
+            hash = hashTypeIdx(work, hash, clazz, pMethodId->classIdx);
+            hash = hashProtoTypes(work, hash, clazz, &proto);
+            break;
+        }
+        default:
+            break;
+        }
+
+        size_t width = dexGetWidthFromInstruction(&insns[offset]);
+        if (width == 0)
+            return false;
+        offset += width;
+    }
+
+    if (pCode->triesSize != 0) {
+        u4 handlersSize = dexGetHandlersSize(pCode);
+        u4 handlerOffset = dexGetFirstHandlerOffset(pCode);
+        for (u4 i = 0; i < handlersSize; i++) {
+            DexCatchIterator iterator;
+            dexCatchIteratorInit(&iterator, pCode, handlerOffset);
+            while (true) {
+                const DexCatchHandler* handler =
+                    dexCatchIteratorNext(&iterator);
+                if (handler == NULL)
+                    break;
+                if (handler->typeIdx != kDexNoIndex)
+                    hash = hashTypeIdx(work, hash, clazz, handler->typeIdx);
+            }
+            handlerOffset = dexCatchIteratorGetEndOffset(&iterator, pCode);
+        }
+    }
+
+    *pHash = hash;
+    return true;
+}
+
+/*
+ * Compute the fingerprint of a class's verification: its own shape, and
+ * the shape of every class its code names.  That covers what the
+ * verifier looks at outside the class, since it looks up members
+ * through the shapes of the classes that declare them.
+ *
+ * This has to see the code as it is before optimization.  Returns zero
+ * if the class can't have a record.
+ */
+static u8 verifyFingerprint(VerifyWork* work, const ClassObject* clazz)
+{
+    u8 hash = hashU8(kFingerprintBasis, classShape(work, clazz));
+
+    const Method* directMethods = dvmGetDirectMethods(clazz);
+    for (int i = 0; i < clazz->directMethodCount; i++) {
+        if (!fingerprintMethod(work, &directMethods[i], &hash))
+            return 0;
+    }
+    for (int i = 0; i < clazz->virtualMethodCount; i++) {
+        const Method* meth = &clazz->virtualMethods[i];
+        if (dvmIsMirandaMethod(meth))
+            continue;
+        if (!fingerprintMethod(work, meth, &hash))
+            return 0;
+    }
+    return (hash != 0) ? hash : 1;
+}
+
+static void attachPriorRegisterMap(Method* meth, const RegisterMap* pMap)
+{
+    if (dvmRegisterMapGetFormat(pMap) != kRegMapFormatNone)
+        dvmSetRegisterMap(meth, pMap);
+}
+
+/*
+ * Give the methods of a class the register maps that the earlier run
+ * generated for them.  They're still right if the class's fingerprint is
+ * the same.  The maps are stored the way writeMapsAllMethods() wrote
+ * them: direct methods first, without Miranda methods.
+ *
+ * Returns "false", having changed nothing, if the maps don't fit.
+ */
+static bool attachPriorRegisterMaps(VerifyWork* work, ClassObject* clazz,
+    u4 idx)
+{
+    if (!gDvm.generateRegisterMaps)
+        return true;
+
+    const RegisterMapClassPool* pClassPool = work->pPrior->pRegisterMaps;
+    u4 classOffset = pClassPool->classDataOffset[idx];
+    if (classOffset == 0)
+        return false;
+    const RegisterMapMethodPool* pMethodPool = (const RegisterMapMethodPool*)
+        (((const u1*) pClassPool) + classOffset);
+
+    Method* directMethods = dvmGetDirectMethods(clazz);
+    int methodCount = clazz->directMethodCount;
+    for (int i = 0; i < clazz->virtualMethodCount; i++) {
+        if (!dvmIsMirandaMethod(&clazz->virtualMethods[i]))
+            methodCount++;
+    }
+    if (pMethodPool->methodCount != methodCount)
+        return false;
+
+    const void* data = pMethodPool->methodData;
+    for (int i = 0; i < clazz->directMethodCount; i++)
+        attachPriorRegisterMap(&directMethods[i], dvmRegisterMapGetNext(&data));
+    for (int i = 0; i < clazz->virtualMethodCount; i++) {
+        Method* meth = &clazz->virtualMethods[i];
+        if (!dvmIsMirandaMethod(meth))
+            attachPriorRegisterMap(meth, dvmRegisterMapGetNext(&data));
+    }
+    return true;
+}
+
+/*
+ * Verify and/or optimize the classes that "work" has left, until there
+ * are none.
+ *
+ * A class only rewrites its own instructions and its own DexClassDef,
+ * and whatever it resolves resolves the same way whichever thread gets
+ * there first, so the output doesn't depend on which thread handles
+ * which class.  (The register maps are written out later, in class def
+ * order.)
+ */
+static void verifyAndOptimizeFrom(VerifyWork* work)
 {
+    DexFile* pDexFile = work->pDexFile;
     u4 count = pDexFile->pHeader->classDefsSize;
-    u4 idx;
 
-    for (idx = 0; idx < count; idx++) {
-        const DexClassDef* pClassDef;
-        const char* classDescriptor;
-        ClassObject* clazz;
+    while (true) {
+        u4 idx = (u4) android_atomic_inc(&work->nextIdx);
+        if (idx >= count)
+            break;
 
-        pClassDef = dexGetClassDef(pDexFile, idx);
-        classDescriptor = dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
+        const DexClassDef* pClassDef = dexGetClassDef(pDexFile, idx);
+        const char* classDescriptor =
+            dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
 
         /* all classes are loaded into the bootstrap class loader */
-        clazz = dvmLookupClass(classDescriptor, NULL, false);
+        ClassObject* clazz = dvmLookupClass(classDescriptor, NULL, false);
         if (clazz != NULL) {
-            verifyAndOptimizeClass(pDexFile, clazz, pClassDef, doVerify, doOpt);
+            verifyAndOptimizeClass(work, clazz, idx);
 
         } else {
             // TODO: log when in verbose mode
@@ -1022,8 +1517,110 @@ static void verifyAndOptimizeClasses(DexFile* pDexFile, bool doVerify,
                 classDescriptor);
         }
     }
+}
+
+/*
+ * Entry point for the threads that help the main thread.  A thread that
+ * can't attach leaves its share to the others.
+ */
+static void* verifyThreadStart(void* arg)
+{
+    if (!dvmAttachHelperThread()) {
+        ALOGW("DexOpt: unable to attach verify thread");
+        return NULL;
+    }
+    verifyAndOptimizeFrom((VerifyWork*) arg);
+    dvmDetachHelperThread();
+    return NULL;
+}
+
+/*
+ * Verify and/or optimize all classes that were successfully loaded from
+ * this DEX file.
+ *
+ * Unless dexopt was asked to stay serial, the work is spread over one
+ * thread per CPU (up to kMaxVerifyThreads), the main thread included.
+ */
+static void verifyAndOptimizeClasses(DexFile* pDexFile, bool doVerify,
+    bool doOpt, const VerifyRecords* pPrior, VerifyRecords* pRecords)
+{
+    u4 count = pDexFile->pHeader->classDefsSize;
+    VerifyWork work;
+    work.pDexFile = pDexFile;
+    work.doVerify = doVerify;
+    work.doOpt = doOpt;
+    work.nextIdx = 0;
+    work.pPrior = NULL;
+    work.pRecords = NULL;
+    work.classShapes = NULL;
+    work.reusedCount = 0;
+
+    if (doVerify && pRecords != NULL) {
+        pRecords->flags = 0;
+        if (gDvm.generateRegisterMaps)
+            pRecords->flags |= kVerifyRecordsRegisterMaps;
+        if (gDvm.optimizingBootstrapClass)
+            pRecords->flags |= kVerifyRecordsBootstrap;
+        pRecords->classCount = count;
+        pRecords->fingerprints = (u8*) calloc(count, sizeof(u8));
+        work.classShapes = dvmHashTableCreate(dvmHashSize(count * 4), free);
+        if (pRecords->fingerprints != NULL && work.classShapes != NULL)
+            work.pRecords = pRecords;
+
+        if (pPrior != NULL && work.pRecords != NULL) {
+            bool mapsMatch = (pPrior->pRegisterMaps != NULL) ?
+                (pPrior->pRegisterMaps->numClasses == count) :
+                !gDvm.generateRegisterMaps;
+            if (pPrior->flags == pRecords->flags &&
+                pPrior->classCount == count && mapsMatch)
+            {
+                work.pPrior = pPrior;
+            } else {
+                ALOGD("DexOpt: earlier verification records don't apply");
+            }
+        }
+    }
+
+    int threadCount = 1;
+    if (gDvm.dexOptParallel) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 1)
+            threadCount = (int) MIN(cpus, kMaxVerifyThreads);
+        threadCount = MIN(threadCount, (int) (count / kMinClassesPerThread));
+        threadCount = MAX(threadCount, 1);
+    }
+
+    pthread_t handles[kMaxVerifyThreads];
+    int started = 0;
+    for (int i = 1; i < threadCount; i++) {
+        if (pthread_create(&handles[started], NULL, verifyThreadStart,
+                &work) == 0)
+        {
+            started++;
+        } else {
+            ALOGW("DexOpt: unable to start verify thread");
+        }
+    }
+
+    verifyAndOptimizeFrom(&work);
+
+    if (started > 0) {
+        Thread* self = dvmThreadSelf();
+        ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+        for (int i = 0; i < started; i++)
+            pthread_join(handles[i], NULL);
+        dvmChangeStatus(self, oldStatus);
+    }
+
+    if (work.pPrior != NULL) {
+        ALOGD("DexOpt: took %d of %u verification results from last time",
+            work.reusedCount, count);
+    }
+    if (work.classShapes != NULL)
+        dvmHashTableFree(work.classShapes);
 
 #ifdef VERIFIER_STATS
+    /* the counters aren't atomic, so with helpers they are approximate */
     ALOGI("Verifier stats:");
     ALOGI(" methods examined        : %u", gDvm.verifierStats.methodsExamined);
     ALOGI(" monitor-enter methods   : %u", gDvm.verifierStats.monEnterMethods);
@@ -1040,9 +1637,13 @@ static void verifyAndOptimizeClasses(DexFile* pDexFile, bool doVerify,
 /*
  * Verify and/or optimize a specific class.
  */
-static void verifyAndOptimizeClass(DexFile* pDexFile, ClassObject* clazz,
-    const DexClassDef* pClassDef, bool doVerify, bool doOpt)
+static void verifyAndOptimizeClass(VerifyWork* work, ClassObject* clazz,
+    u4 idx)
 {
+    DexFile* pDexFile = work->pDexFile;
+    const DexClassDef* pClassDef = dexGetClassDef(pDexFile, idx);
+    bool doVerify = work->doVerify;
+    bool doOpt = work->doOpt;
     const char* classDescriptor;
     bool verified = false;
 
@@ -1062,10 +1663,20 @@ static void verifyAndOptimizeClass(DexFile* pDexFile, ClassObject* clazz,
     classDescriptor = dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
 
     /*
-     * First, try to verify it.
+     * First, try to verify it, unless the last run already did and
+     * nothing it depended on has changed since.
      */
     if (doVerify) {
-        if (dvmVerifyClass(clazz)) {
+        bool reused = false;
+        if (work->pPrior != NULL && work->pPrior->fingerprints[idx] != 0) {
+            reused = (verifyFingerprint(work, clazz) ==
+                        work->pPrior->fingerprints[idx]) &&
+                     attachPriorRegisterMaps(work, clazz, idx);
+            if (reused)
+                android_atomic_inc(&work->reusedCount);
+        }
+
+        if (reused || dvmVerifyClass(clazz)) {
             /*
              * Set the "is preverified" flag in the DexClassDef.  We
              * do it here, rather than in the ClassObject structure,
@@ -1075,6 +1686,13 @@ static void verifyAndOptimizeClass(DexFile* pDexFile, ClassObject* clazz,
                 pClassDef->accessFlags);
             ((DexClassDef*)pClassDef)->accessFlags |= CLASS_ISPREVERIFIED;
             verified = true;
+
+            /* before the optimizer rewrites the code we scan */
+            if (work->pRecords != NULL) {
+                work->pRecords->fingerprints[idx] = reused ?
+                    work->pPrior->fingerprints[idx] :
+                    verifyFingerprint(work, clazz);
+            }
         } else {
             // TODO: log when in verbose mode
             ALOGV("DexOpt: '%s' failed verification", classDescriptor);
@@ -1480,7 +2098,7 @@ static bool writeChunk(int fd, u4 type, const void* data, size_t size)
  * so it can be used directly when the file is mapped for reading.
  */
 static bool writeOptData(int fd, const DexClassLookup* pClassLookup,
-    const RegisterMapBuilder* pRegMapBuilder)
+    const RegisterMapBuilder* pRegMapBuilder, const VerifyRecords* pRecords)
 {
     /* pre-computed class lookup hash table */
     if (!writeChunk(fd, (u4) kDexChunkClassLookup,
@@ -1498,6 +2116,12 @@ static bool writeOptData(int fd, const DexClassLookup* pClassLookup,
         }
     }
 
+    /* verification records (optional) */
+    if (pRecords != NULL && pRecords->fingerprints != NULL) {
+        if (!writeVerifyRecords(fd, pRecords))
+            return false;
+    }
+
     /* write the end marker */
     if (!writeChunk(fd, (u4) kDexChunkEnd, NULL, 0)) {
         return false;
@@ -1517,7 +2141,7 @@ static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum)
 {
     unsigned char readBuf[8192];
     ssize_t actual;
-    uLong adler;
+    u4 adler;
 
     if (lseek(fd, start, SEEK_SET) != start) {
         ALOGE("Unable to seek to start of checksum area (%ld): %s",
@@ -1525,7 +2149,7 @@ static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum)
         return false;
     }
 
-    adler = adler32(0L, Z_NULL, 0);
+    adler = kDexAdler32Init;
 
     while (length != 0) {
         size_t wanted = (length < sizeof(readBuf)) ? length : sizeof(readBuf);
@@ -1536,7 +2160,7 @@ static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum)
             return false;
         }
 
-        adler = adler32(adler, readBuf, actual);
+        adler = dexAdler32(adler, readBuf, actual);
 
         length -= actual;
     }
@@ -1555,9 +2179,223 @@ static void updateChecksum(u1* addr, int len, DexHeader* pHeader)
     /*
      * Rewrite the checksum.  We leave the SHA-1 signature alone.
      */
-    uLong adler = adler32(0L, Z_NULL, 0);
     const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum);
 
-    adler = adler32(adler, addr + nonSum, len - nonSum);
-    pHeader->checksum = adler;
+    pHeader->checksum = dexAdler32(kDexAdler32Init, addr + nonSum, len - nonSum);
+}
+
+
+/*
+ * ===========================================================================
+ *      Verification record files
+ * ===========================================================================
+ */
+
+/*
+ * Header of the file that carries verification records from a stale
+ * cache file to the next dexopt run.  The records chunk follows, then
+ * the register map chunk (if any).  Everything is in host byte order.
+ */
+struct VerifyRecordsFileHeader {
+    u4  magic;
+    u4  modWhen;            /* of the source, as in the dependencies */
+    u4  crc;
+    u4  recordsSize;
+    u4  mapsSize;
+    u4  checksum;           /* adler32 of the chunks */
+};
+
+static const u4 kVerifyRecordsMagic = 0x76726563;   /* vrec */
+
+/* stale cache files with more opt data than this aren't worth keeping */
+static const u4 kMaxVerifyRecordsSize = 64 * 1024 * 1024;
+
+/*
+ * The cache file open on "fd" is about to be replaced.  If it was made
+ * from the same source (same "modWhen" and "crc") by this build of the
+ * VM, copy its verification records and register maps to a file next
+ * to it, for dvmOptimizeDexFile() to pass to dexopt.  Anything that
+ * doesn't look right just means there is nothing to keep.
+ */
+static void saveVerifyRecords(int fd, const char* cacheFileName, u4 modWhen,
+    u4 crc)
+{
+    DexOptHeader optHdr;
+    if (pread(fd, &optHdr, sizeof(optHdr), 0) != (ssize_t) sizeof(optHdr))
+        return;
+    if (memcmp(optHdr.magic, DEX_OPT_MAGIC, 4) != 0 ||
+        memcmp(optHdr.magic+4, DEX_OPT_MAGIC_VERS, 4) != 0 ||
+        optHdr.depsLength < 3*4 || optHdr.optOffset < optHdr.depsOffset)
+    {
+        return;
+    }
+
+    u4 length = optHdr.optOffset + optHdr.optLength - optHdr.depsOffset;
+    if (length > kMaxVerifyRecordsSize)
+        return;
+    u1* data = (u1*) malloc(length);
+    if (data == NULL)
+        return;
+
+    const u1* records = NULL;
+    const u1* maps = NULL;
+    u4 recordsSize = 0, mapsSize = 0;
+    const u1* ptr;
+    const u1* end;
+    std::string fileName;
+    int outFd = -1;
+    VerifyRecordsFileHeader fileHdr;
+
+    if (pread(fd, data, length, optHdr.depsOffset) != (ssize_t) length)
+        goto bail;
+    if (adler32(adler32(0L, Z_NULL, 0), data, length) != optHdr.checksum)
+        goto bail;
+
+    /* the dependencies start with the source's date and CRC, and the build */
+    ptr = data;
+    if (read4LE(&ptr) != modWhen || read4LE(&ptr) != crc ||
+        read4LE(&ptr) != DALVIK_VM_BUILD)
+    {
+        goto bail;
+    }
+
+    /* find the chunks; see writeChunk() */
+    ptr = data + (optHdr.optOffset - optHdr.depsOffset);
+    end = data + length;
+    while (end - ptr >= 8) {
+        u4 type = ((const u4*) ptr)[0];
+        u4 size = ((const u4*) ptr)[1];
+        if (type == (u4) kDexChunkEnd || size > (u4) (end - ptr) - 8)
+            break;
+        if (type == (u4) kDexChunkVerifyRecords) {
+            records = ptr + 8;
+            recordsSize = size;
+        } else if (type == (u4) kDexChunkRegisterMaps) {
+            maps = ptr + 8;
+            mapsSize = size;
+        }
+        ptr += (size + 8 + 7) & ~7;
+    }
+    if (records == NULL || (recordsSize & 7) != 0)
+        goto bail;
+
+    fileHdr.magic = kVerifyRecordsMagic;
+    fileHdr.modWhen = modWhen;
+    fileHdr.crc = crc;
+    fileHdr.recordsSize = recordsSize;
+    fileHdr.mapsSize = mapsSize;
+    fileHdr.checksum = adler32(adler32(adler32(0L, Z_NULL, 0),
+        records, recordsSize), maps, mapsSize);
+
+    fileName = verifyRecordsFileName(cacheFileName);
+    outFd = open(fileName.c_str(), O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    if (outFd < 0)
+        goto bail;
+    if (sysWriteFully(outFd, &fileHdr, sizeof(fileHdr), "DexOpt vrec") != 0 ||
+        sysWriteFully(outFd, records, recordsSize, "DexOpt vrec") != 0 ||
+        (mapsSize != 0 &&
+         sysWriteFully(outFd, maps, mapsSize, "DexOpt vrec") != 0))
+    {
+        unlink(fileName.c_str());
+        goto bail;
+    }
+    ALOGV("DexOpt: kept verification records of '%s'", cacheFileName);
+
+bail:
+    if (outFd >= 0)
+        close(outFd);
+    free(data);
+}
+
+/*
+ * Read the records that saveVerifyRecords() kept, if they are for the
+ * same source.  Returns NULL if there are none to use.
+ */
+static VerifyRecords* loadVerifyRecords(const char* fileName, u4 modWhen,
+    u4 crc)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    VerifyRecords* pRecords = NULL;
+    u1* storage = NULL;
+    const VerifyRecordsFileHeader* pHdr;
+    const u1* records;
+    u4 count;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(*pHdr) ||
+        st.st_size > (off_t) kMaxVerifyRecordsSize)
+    {
+        goto bail;
+    }
+    storage = (u1*) malloc(st.st_size);
+    if (storage == NULL ||
+        read(fd, storage, st.st_size) != (ssize_t) st.st_size)
+    {
+        goto bail;
+    }
+
+    pHdr = (const VerifyRecordsFileHeader*) storage;
+    records = storage + sizeof(*pHdr);
+    if (pHdr->magic != kVerifyRecordsMagic || pHdr->modWhen != modWhen ||
+        pHdr->crc != crc || pHdr->recordsSize < 8 ||
+        sizeof(*pHdr) + pHdr->recordsSize + pHdr->mapsSize !=
+            (size_t) st.st_size ||
+        adler32(adler32(0L, Z_NULL, 0), records,
+            pHdr->recordsSize + pHdr->mapsSize) != pHdr->checksum)
+    {
+        ALOGD("DexOpt: ignoring bad verification records '%s'", fileName);
+        goto bail;
+    }
+    count = ((const u4*) records)[1];
+    if (pHdr->recordsSize != 8 + count * sizeof(u8))
+        goto bail;
+
+    pRecords = (VerifyRecords*) calloc(1, sizeof(VerifyRecords));
+    if (pRecords == NULL)
+        goto bail;
+    pRecords->flags = ((const u4*) records)[0];
+    pRecords->classCount = count;
+    pRecords->fingerprints = (u8*) (records + 8);
+    if (pHdr->mapsSize >= sizeof(u4)) {
+        pRecords->pRegisterMaps =
+            (const RegisterMapClassPool*) (records + pHdr->recordsSize);
+    }
+    pRecords->storage = storage;
+    storage = NULL;
+
+bail:
+    free(storage);
+    close(fd);
+    return pRecords;
+}
+
+static void freeVerifyRecords(VerifyRecords* pRecords)
+{
+    if (pRecords == NULL)
+        return;
+    free(pRecords->storage);
+    free(pRecords);
+}
+
+/*
+ * Write the verification records chunk: the settings, the class count,
+ * then a fingerprint for each class def.
+ */
+static bool writeVerifyRecords(int fd, const VerifyRecords* pRecords)
+{
+    size_t size = 8 + pRecords->classCount * sizeof(u8);
+    u1* buf = (u1*) malloc(size);
+    if (buf == NULL)
+        return false;
+
+    ((u4*) buf)[0] = pRecords->flags;
+    ((u4*) buf)[1] = pRecords->classCount;
+    memcpy(buf + 8, pRecords->fingerprints,
+        pRecords->classCount * sizeof(u8));
+    bool result = writeChunk(fd, (u4) kDexChunkVerifyRecords, buf, size);
+    free(buf);
+    return result;
 }
@@ -44,7 +44,10 @@ enum DexoptFlags {
     DEXOPT_IS_BOOTSTRAP      = 1 << 4,  /* is dex in bootstrap class path? */
     DEXOPT_GEN_REGISTER_MAPS = 1 << 5,  /* generate register maps during vfy */
     DEXOPT_UNIPROCESSOR      = 1 << 6,  /* specify uniprocessor target */
-    DEXOPT_SMP               = 1 << 7   /* specify SMP target */
+    DEXOPT_SMP               = 1 << 7,  /* specify SMP target */
+    DEXOPT_SERIAL            = 1 << 8,  /* verify/optimize on one thread */
+    DEXOPT_CHECKSUM_OK       = 1 << 9,  /* DEX checksum checked on extract */
+    DEXOPT_LIVE_REGISTER_MAPS = 1 << 10, /* live-precise register maps */
 };
 
 /*
@@ -89,6 +92,9 @@ enum VerifyErrorRefType {
  * "opt" header, and the caller is expected to fill in the blanks.
  *
  * Returns the file descriptor, locked and seeked past the "opt" header.
+ *
+ * If a stale file is thrown out, its verification records are kept for
+ * dvmOptimizeDexFile() to pass on.
  */
 int dvmOpenCachedDexFile(const char* fileName, const char* cachedFile,
     u4 modWhen, u4 crc, bool isBootstrap, bool* pNewFile, bool createIfMissing);
@@ -112,16 +118,30 @@ bool dvmCheckOptHeaderAndDependencies(int fd, bool sourceAvail, u4 modWhen,
  * Optimize a DEX file.  The file must start with the "opt" header, followed
  * by the plain DEX data.  It must be mmap()able.
  *
- * "fileName" is only used for debug output.
+ * "fileName" is only used for debug output.  "cacheFileName" is the name
+ * of the cache file open on "fd", used to find the verification records
+ * of the file it replaces; it may be NULL.
  */
 bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLen,
-    const char* fileName, u4 modWhen, u4 crc, bool isBootstrap);
+    const char* fileName, const char* cacheFileName, u4 modWhen, u4 crc,
+    bool isBootstrap, bool checksumOk);
 
 /*
  * Continue the optimization process on the other side of a fork/exec.
+ *
+ * "recordsFileName" names the verification records of an earlier run to
+ * reuse what they can; it may be NULL or empty.
  */
 bool dvmContinueOptimization(int fd, off_t dexOffset, long dexLength,
-    const char* fileName, u4 modWhen, u4 crc, bool isBootstrap);
+    const char* fileName, u4 modWhen, u4 crc, bool isBootstrap,
+    const char* recordsFileName);
+
+/*
+ * After dvmPrepForDexOpt(), load the bootstrap classes once so that
+ * processes forked for dvmContinueOptimization() share them.  Only valid
+ * when none of the DEX files to be optimized is on the bootstrap path.
+ */
+bool dvmPreloadForDexOpt(void);
 
 /*
  * Prepare DEX data that is only available to the VM as in-memory data.
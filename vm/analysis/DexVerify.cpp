@@ -47,7 +47,7 @@ bool dvmVerifyClass(ClassObject* clazz)
     }
 
     for (i = 0; i < clazz->directMethodCount; i++) {
-        if (!verifyMethod(&clazz->directMethods[i])) {
+        if (!verifyMethod(&dvmGetDirectMethods(clazz)[i])) {
             LOG_VFY("Verifier rejected class %s", clazz->descriptor);
             return false;
         }
@@ -89,6 +89,7 @@ static bool computeWidthsAndCountOps(VerifierData* vdata)
     bool result = false;
     int newInstanceCount = 0;
     int monitorEnterCount = 0;
+    size_t count = 0;
     int i;
 
     for (i = 0; i < (int) insnCount; /**/) {
@@ -110,6 +111,7 @@ static bool computeWidthsAndCountOps(VerifierData* vdata)
         insnFlags[i] |= width;
         i += width;
         insns += width;
+        count++;
     }
     if (i != (int) vdata->insnsSize) {
         LOG_VFY_METH(meth, "VFY: code did not end where expected (%d vs. %d)",
@@ -120,11 +122,38 @@ static bool computeWidthsAndCountOps(VerifierData* vdata)
     result = true;
     vdata->newInstanceCount = newInstanceCount;
     vdata->monitorEnterCount = monitorEnterCount;
+    vdata->insnCount = count;
 
 bail:
     return result;
 }
 
+/*
+ * Decode every instruction, once, for the static checks, the code-flow
+ * pass (which may visit an instruction many times) and liveness.  The
+ * widths must have been checked.
+ */
+static bool decodeInstructions(VerifierData* vdata)
+{
+    const u2* insns = vdata->method->insns;
+
+    vdata->decodedInsns = (DecodedInstruction*)
+        malloc(vdata->insnCount * sizeof(DecodedInstruction));
+    vdata->decodedIndex = (u4*) malloc(vdata->insnsSize * sizeof(u4));
+    if (vdata->decodedInsns == NULL || vdata->decodedIndex == NULL)
+        return false;
+
+    u4 n = 0;
+    for (u4 addr = 0; addr < vdata->insnsSize;
+         addr += dvmInsnGetWidth(vdata->insnFlags, addr))
+    {
+        vdata->decodedIndex[addr] = n;
+        dexDecodeInstruction(insns + addr, &vdata->decodedInsns[n++]);
+    }
+    assert(n == vdata->insnCount);
+    return true;
+}
+
 /*
  * Set the "in try" flags for all instructions protected by "try" statements.
  * Also sets the "branch target" flags for exception handlers.
@@ -251,6 +280,8 @@ static bool verifyMethod(Method* meth)
     vdata.insnFlags = NULL;
     vdata.uninitMap = NULL;
     vdata.basicBlocks = NULL;
+    vdata.decodedInsns = NULL;
+    vdata.decodedIndex = NULL;
 
     /*
      * If there aren't any instructions, make sure that's expected, then
@@ -294,6 +325,8 @@ static bool verifyMethod(Method* meth)
      */
     if (!computeWidthsAndCountOps(&vdata))
         goto bail;
+    if (!decodeInstructions(&vdata))
+        goto bail;
 
     /*
      * Allocate a map to hold the classes of uninitialized instances.
@@ -334,6 +367,8 @@ success:
 bail:
     dvmFreeVfyBasicBlocks(&vdata);
     dvmFreeUninitInstanceMap(vdata.uninitMap);
+    free(vdata.decodedInsns);
+    free(vdata.decodedIndex);
     free(vdata.insnFlags);
     return result;
 }
@@ -807,11 +842,10 @@ static bool verifyInstructions(VerifierData* vdata)
          * Pull the instruction apart.
          */
         int width = dvmInsnGetWidth(insnFlags, codeOffset);
-        DecodedInstruction decInsn;
+        const DecodedInstruction& decInsn =
+            *dvmGetDecodedInsn(vdata, codeOffset);
         bool okay = true;
 
-        dexDecodeInstruction(meth->insns + codeOffset, &decInsn);
-
         /*
          * Check register, type, class, field, method, and string indices
          * for out-of-range values.  Do additional checks on branch targets
@@ -1169,8 +1203,8 @@ static bool verifyInstructions(VerifierData* vdata)
         case OP_INVOKE_VIRTUAL_QUICK_RANGE:
         case OP_INVOKE_SUPER_QUICK:
         case OP_INVOKE_SUPER_QUICK_RANGE:
-        case OP_UNUSED_3E:
-        case OP_UNUSED_3F:
+        case OP_IGET_QUICK_IF_EQZ:
+        case OP_CONST_4_ADD_INT:
         case OP_UNUSED_40:
         case OP_UNUSED_41:
         case OP_UNUSED_42:
@@ -24,6 +24,7 @@
 static bool processInstruction(VerifierData* vdata, u4 curIdx,
     BitVector* workBits);
 static bool markDebugLocals(VerifierData* vdata);
+static void markThisLive(VerifierData* vdata);
 static void dumpLiveState(const VerifierData* vdata, u4 curIdx,
     const BitVector* workBits);
 
@@ -268,6 +269,7 @@ bool dvmComputeLiveness(VerifierData* vdata)
      */
     if (!markDebugLocals(vdata))
         goto bail;
+    markThisLive(vdata);
 
     result = true;
 
@@ -320,11 +322,7 @@ static inline void KILLW(BitVector* workBits, u4 regIndex)
 static bool processInstruction(VerifierData* vdata, u4 insnIdx,
     BitVector* workBits)
 {
-    const Method* meth = vdata->method;
-    const u2* insns = meth->insns + insnIdx;
-    DecodedInstruction decInsn;
-
-    dexDecodeInstruction(insns, &decInsn);
+    const DecodedInstruction& decInsn = *dvmGetDecodedInsn(vdata, insnIdx);
 
     /*
      * Add registers to the "GEN" or "KILL" sets.  We want to do KILL
@@ -695,6 +693,8 @@ static bool processInstruction(VerifierData* vdata, u4 insnIdx,
     case OP_INVOKE_VIRTUAL_QUICK_RANGE:
     case OP_INVOKE_SUPER_QUICK:
     case OP_INVOKE_SUPER_QUICK_RANGE:
+    case OP_IGET_QUICK_IF_EQZ:
+    case OP_CONST_4_ADD_INT:
         /* fall through to failure */
 
     /* correctness fixes, not expected to appear */
@@ -715,8 +715,6 @@ static bool processInstruction(VerifierData* vdata, u4 insnIdx,
         /* fall through to failure */
 
     /* these should never appear during verification */
-    case OP_UNUSED_3E:
-    case OP_UNUSED_3F:
     case OP_UNUSED_40:
     case OP_UNUSED_41:
     case OP_UNUSED_42:
@@ -794,6 +792,29 @@ static bool markDebugLocals(VerifierData* vdata)
 }
 
 
+/*
+ * Mark "this" as live at every GC point.
+ *
+ * The debugger reads "this" straight out of the frame at any point in the
+ * method (see dvmGetThisPtr()), relying on dx never reusing its register,
+ * so it has to hold the object even after the method's last use of it.
+ */
+static void markThisLive(VerifierData* vdata)
+{
+    const Method* meth = vdata->method;
+
+    if (dvmIsStaticMethod(meth))
+        return;
+
+    u4 thisReg = meth->registersSize - meth->insSize;
+    for (u4 idx = 0; idx < vdata->insnsSize; idx++) {
+        BitVector* liveRegs = vdata->registerLines[idx].liveRegs;
+        if (liveRegs != NULL)
+            GEN(liveRegs, thisReg);
+    }
+}
+
+
 /*
  * Dump the liveness bits to the log.
  *
@@ -48,6 +48,8 @@ static bool rewriteExecuteInline(Method* method, u2* insns,
 static bool rewriteExecuteInlineRange(Method* method, u2* insns,
     MethodType methodType);
 static void rewriteReturnVoid(Method* method, u2* insns);
+static void rewriteInstructionPair(Method* method, u2* insns,
+    u4 insnsSize);
 static bool needsReturnBarrier(Method* method);
 
 
@@ -123,7 +125,7 @@ void dvmOptimizeClass(ClassObject* clazz, bool essentialOnly)
     int i;
 
     for (i = 0; i < clazz->directMethodCount; i++) {
-        optimizeMethod(&clazz->directMethods[i], essentialOnly);
+        optimizeMethod(&dvmGetDirectMethods(clazz)[i], essentialOnly);
     }
     for (i = 0; i < clazz->virtualMethodCount; i++) {
         optimizeMethod(&clazz->virtualMethods[i], essentialOnly);
@@ -337,6 +339,14 @@ rewrite_static_field:
             }
         }
 
+        /*
+         * non-essential substitutions, once the above are done:
+         *  iget-quick + if-eqz --> iget-quick-if-eqz
+         *  const/4 + add-int --> const/4-add-int
+         */
+        if (!essentialOnly)
+            rewriteInstructionPair(method, insns, insnsSize);
+
         assert(width > 0);
         assert(width <= insnsSize);
         assert(width == dexGetWidthFromInstruction(insns));
@@ -1186,3 +1196,41 @@ static void rewriteReturnVoid(Method* method, u2* insns)
     assert((insns[0] & 0xff) == OP_RETURN_VOID);
     updateOpcode(method, insns, OP_RETURN_VOID_BARRIER);
 }
+
+/*
+ * The pairs of instructions that have a superinstruction, as chosen by
+ * -Xopcodepairs.  Only the opcode of the first instruction is replaced;
+ * the second is left as it is, so that branches to it still work.
+ */
+static const struct {
+    Opcode first;
+    Opcode second;
+    Opcode fused;
+} gSuperInstructions[] = {
+    { OP_IGET_QUICK,    OP_IF_EQZ,      OP_IGET_QUICK_IF_EQZ },
+    { OP_CONST_4,       OP_ADD_INT,     OP_CONST_4_ADD_INT },
+};
+
+/*
+ * Rewrite the instruction at "insns" as a superinstruction if it and the
+ * one after it make one of the pairs above.
+ */
+static void rewriteInstructionPair(Method* method, u2* insns,
+    u4 insnsSize)
+{
+    Opcode first = dexOpcodeFromCodeUnit(insns[0]);
+    size_t width = dexGetWidthFromOpcode(first);
+
+    if (width == 0 || width >= insnsSize)
+        return;
+    Opcode second = dexOpcodeFromCodeUnit(insns[width]);
+
+    for (size_t i = 0; i < NELEM(gSuperInstructions); i++) {
+        if (gSuperInstructions[i].first == first &&
+            gSuperInstructions[i].second == second)
+        {
+            updateOpcode(method, insns, gSuperInstructions[i].fused);
+            return;
+        }
+    }
+}
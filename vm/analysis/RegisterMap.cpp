@@ -39,16 +39,22 @@
 //#define REGISTER_MAP_STATS
 
 // fwd
-static void outputTypeVector(const RegType* regs, int insnRegCount, u1* data);
+static void outputTypeVector(const RegType* regs, int insnRegCount,
+    const BitVector* liveRegs, u1* data);
+static void outputLiveVector(const BitVector* liveRegs, int insnRegCount,
+    u1* data);
 static bool verifyMap(VerifierData* vdata, const RegisterMap* pMap);
-static int compareMaps(const RegisterMap* pMap1, const RegisterMap* pMap2);
+static bool verifyIndexedMap(const RegisterMap* pMap,
+    const RegisterMap* pCompMap);
 
 #ifdef REGISTER_MAP_STATS
 static void computeMapStats(RegisterMap* pMap, const Method* method);
 #endif
-static RegisterMap* compressMapDifferential(const RegisterMap* pMap,\
+static RegisterMap* compressMapIndexed(const RegisterMap* pMap,\
     const Method* meth);
 static RegisterMap* uncompressMapDifferential(const RegisterMap* pMap);
+static const u1* applyDiffEntry(const u1* ptr, int* pAddrDiff, u1* bits,
+    int regWidth);
 
 #ifdef REGISTER_MAP_STATS
 /*
@@ -178,14 +184,17 @@ void dvmRegisterMapDumpStats()
 
 /*
  * Generate the register map for a method that has just been verified
- * (i.e. we're doing this as part of verification).
+ * (i.e. we're doing this as part of verification), or with "liveness"
+ * set, the map of live registers.
  *
  * For type-precise determination we have all the data we need, so we
- * just need to encode it in some clever fashion.
+ * just need to encode it in some clever fashion.  If liveness was
+ * computed, registers that are dead at a GC point are left out of the
+ * register map, since nothing will read them.
  *
  * Returns a pointer to a newly-allocated RegisterMap, or NULL on failure.
  */
-RegisterMap* dvmGenerateRegisterMapV(VerifierData* vdata)
+static RegisterMap* generateMap(VerifierData* vdata, bool liveness)
 {
     static const int kHeaderSize = offsetof(RegisterMap, data);
     RegisterMap* pMap = NULL;
@@ -255,63 +264,63 @@ RegisterMap* dvmGenerateRegisterMapV(VerifierData* vdata)
      * Populate it.
      */
     mapData = pMap->data;
-    for (i = 0; i < (int) vdata->insnsSize; i++) {
-        if (dvmInsnIsGcPoint(vdata->insnFlags, i)) {
-            assert(vdata->registerLines[i].regTypes != NULL);
-            if (format == kRegMapFormatCompact8) {
-                *mapData++ = i;
-            } else /*kRegMapFormatCompact16*/ {
-                *mapData++ = i & 0xff;
-                *mapData++ = i >> 8;
+    {
+        /* room to expand sparse register lines */
+        RegType lineBuf[vdata->insnRegCount + 1];
+
+        for (i = 0; i < (int) vdata->insnsSize; i++) {
+            if (dvmInsnIsGcPoint(vdata->insnFlags, i)) {
+                if (format == kRegMapFormatCompact8) {
+                    *mapData++ = i;
+                } else /*kRegMapFormatCompact16*/ {
+                    *mapData++ = i & 0xff;
+                    *mapData++ = i >> 8;
+                }
+                const BitVector* liveRegs = vdata->registerLines[i].liveRegs;
+                if (liveness) {
+                    assert(liveRegs != NULL);
+                    outputLiveVector(liveRegs, vdata->insnRegCount, mapData);
+                } else {
+                    outputTypeVector(
+                        dvmGetRegisterLineTypes(&vdata->registerLines[i],
+                            vdata->insnRegCount, lineBuf),
+                        vdata->insnRegCount, liveRegs, mapData);
+                }
+                mapData += regWidth;
             }
-            outputTypeVector(vdata->registerLines[i].regTypes,
-                vdata->insnRegCount, mapData);
-            mapData += regWidth;
         }
     }
 
     ALOGV("mapData=%p pMap=%p bufSize=%d", mapData, pMap, bufSize);
     assert(mapData - (const u1*) pMap == bufSize);
 
-    if (REGISTER_MAP_VERIFY && !verifyMap(vdata, pMap))
-        goto bail;
+    if (!liveness) {
+        if (REGISTER_MAP_VERIFY && !verifyMap(vdata, pMap))
+            goto bail;
 #ifdef REGISTER_MAP_STATS
-    computeMapStats(pMap, vdata->method);
+        computeMapStats(pMap, vdata->method);
 #endif
+    }
 
     /*
      * Try to compress the map.
      */
     RegisterMap* pCompMap;
 
-    pCompMap = compressMapDifferential(pMap, vdata->method);
+    pCompMap = compressMapIndexed(pMap, vdata->method);
     if (pCompMap != NULL) {
         if (REGISTER_MAP_VERIFY) {
             /*
-             * Expand the compressed map we just created, and compare it
-             * to the original.  Abort the VM if it doesn't match up.
+             * Look up every line of the original in the compressed map
+             * we just created.  Abort the VM if they don't match up.
              */
-            RegisterMap* pUncompMap;
-            pUncompMap = uncompressMapDifferential(pCompMap);
-            if (pUncompMap == NULL) {
-                ALOGE("Map failed to uncompress - %s.%s",
+            if (!verifyIndexedMap(pMap, pCompMap)) {
+                ALOGE("Map comparison failed - %s.%s",
                     vdata->method->clazz->descriptor,
                     vdata->method->name);
                 free(pCompMap);
-                /* bad - compression is broken or we're out of memory */
+                /* bad - compression is broken */
                 dvmAbort();
-            } else {
-                if (compareMaps(pMap, pUncompMap) != 0) {
-                    ALOGE("Map comparison failed - %s.%s",
-                        vdata->method->clazz->descriptor,
-                        vdata->method->name);
-                    free(pCompMap);
-                    /* bad - compression is broken */
-                    dvmAbort();
-                }
-
-                /* verify succeeded */
-                delete pUncompMap;
             }
         }
 
@@ -338,6 +347,16 @@ bail:
     return pResult;
 }
 
+RegisterMap* dvmGenerateRegisterMapV(VerifierData* vdata)
+{
+    return generateMap(vdata, false);
+}
+
+RegisterMap* dvmGenerateLivenessMapV(VerifierData* vdata)
+{
+    return generateMap(vdata, true);
+}
+
 /*
  * Release the storage held by a RegisterMap.
  */
@@ -369,8 +388,12 @@ static inline bool isReferenceType(RegType type)
  * We use '1' to indicate it's a reference, '0' for anything else (numeric
  * value, uninitialized data, merge conflict).  Register 0 will be found
  * in the low bit of the first byte.
+ *
+ * If "liveRegs" is non-NULL, dead registers are output as '0' whatever
+ * they hold.
  */
-static void outputTypeVector(const RegType* regs, int insnRegCount, u1* data)
+static void outputTypeVector(const RegType* regs, int insnRegCount,
+    const BitVector* liveRegs, u1* data)
 {
     u1 val = 0;
     int i;
@@ -378,8 +401,11 @@ static void outputTypeVector(const RegType* regs, int insnRegCount, u1* data)
     for (i = 0; i < insnRegCount; i++) {
         RegType type = *regs++;
         val >>= 1;
-        if (isReferenceType(type))
+        if (isReferenceType(type) &&
+            (liveRegs == NULL || dvmIsBitSet(liveRegs, i)))
+        {
             val |= 0x80;        /* set hi bit */
+        }
 
         if ((i & 0x07) == 7)
             *data++ = val;
@@ -391,6 +417,20 @@ static void outputTypeVector(const RegType* regs, int insnRegCount, u1* data)
     }
 }
 
+/*
+ * Output a bit vector with '1' for each live register, in the same layout
+ * as outputTypeVector().
+ */
+static void outputLiveVector(const BitVector* liveRegs, int insnRegCount,
+    u1* data)
+{
+    memset(data, 0, (insnRegCount + 7) / 8);
+    for (int i = 0; i < insnRegCount; i++) {
+        if (dvmIsBitSet(liveRegs, i))
+            data[i >> 3] |= 1 << (i & 0x07);
+    }
+}
+
 /*
  * Print the map as a series of binary strings.
  *
@@ -493,6 +533,8 @@ static bool verifyMap(VerifierData* vdata, const RegisterMap* pMap)
         return false;
     }
 
+    RegType lineBuf[vdata->method->registersSize + 1];
+
     for (ent = 0; ent < numEntries; ent++) {
         int addr;
 
@@ -512,11 +554,9 @@ static bool verifyMap(VerifierData* vdata, const RegisterMap* pMap)
             addr = 0;
         }
 
-        const RegType* regs = vdata->registerLines[addr].regTypes;
-        if (regs == NULL) {
-            ALOGE("GLITCH: addr %d has no data", addr);
-            return false;
-        }
+        const RegType* regs = dvmGetRegisterLineTypes(
+            &vdata->registerLines[addr], vdata->method->registersSize,
+            lineBuf);
 
         u1 val = 0;
         int i;
@@ -533,7 +573,9 @@ static bool verifyMap(VerifierData* vdata, const RegisterMap* pMap)
             bitIsRef = val & 0x01;
 
             RegType type = regs[i];
-            regIsRef = isReferenceType(type);
+            const BitVector* liveRegs = vdata->registerLines[addr].liveRegs;
+            regIsRef = isReferenceType(type) &&
+                (liveRegs == NULL || dvmIsBitSet(liveRegs, i));
 
             if (bitIsRef != regIsRef) {
                 ALOGE("GLITCH: addr %d reg %d: bit=%d reg=%d(%d)",
@@ -585,6 +627,7 @@ static size_t computeRegisterMapSize(const RegisterMap* pMap)
     case kRegMapFormatCompact16:
         return kHeaderSize + (2 + pMap->regWidth) * numEntries;
     case kRegMapFormatDifferential:
+    case kRegMapFormatIndexed:
         {
             /* kHeaderSize + decoded ULEB128 length */
             const u1* ptr = pMap->data;
@@ -627,6 +670,16 @@ static bool writeMapForMethod(const Method* meth, u1** pPtr)
     assert(**pPtr == meth->registerMap->format);
     **pPtr &= ~(kRegMapFormatOnHeap);
 
+    /* the liveness map, if any, goes right after it */
+    if (meth->liveMap != NULL) {
+        **pPtr |= kRegMapFormatHasLiveness;
+        u1* livePtr = *pPtr + mapSize;
+        size_t liveSize = computeRegisterMapSize(meth->liveMap);
+        memcpy(livePtr, meth->liveMap, liveSize);
+        *livePtr &= ~(kRegMapFormatOnHeap);
+        mapSize += liveSize;
+    }
+
     *pPtr += mapSize;
 
     return true;
@@ -668,10 +721,10 @@ static bool writeMapsAllMethods(DvmDex* pDvmDex, const ClassObject* clazz,
      * method counts in the DEX file.
      */
     for (i = 0; i < clazz->directMethodCount; i++) {
-        const Method* meth = &clazz->directMethods[i];
+        const Method* meth = &dvmGetDirectMethods(clazz)[i];
         if (dvmIsMirandaMethod(meth))
             continue;
-        if (!writeMapForMethod(&clazz->directMethods[i], &ptr)) {
+        if (!writeMapForMethod(&dvmGetDirectMethods(clazz)[i], &ptr)) {
             return false;
         }
         methodCount++;
@@ -796,11 +849,14 @@ RegisterMapBuilder* dvmGenerateRegisterMaps(DvmDex* pDvmDex)
      * worrying about the effect on the rest of the system.
      *
      * The basic encoding on the largest jar file requires about 1MB of
-     * storage.  We map out 4MB here.  (TODO: guarantee that the last
-     * page of the mapping is marked invalid, so we reliably fail if
-     * we overrun.)
+     * storage.  We map out 4MB here, twice that if there are liveness
+     * maps too.  (TODO: guarantee that the last page of the mapping is
+     * marked invalid, so we reliably fail if we overrun.)
      */
-    if (sysCreatePrivateMap(4 * 1024 * 1024, &pBuilder->memMap) != 0) {
+    size_t mapLength = 4 * 1024 * 1024;
+    if (gDvm.registerMapMode == kRegisterMapModeLivePrecise)
+        mapLength *= 2;
+    if (sysCreatePrivateMap(mapLength, &pBuilder->memMap) != 0) {
         free(pBuilder);
         return NULL;
     }
@@ -876,12 +932,26 @@ const RegisterMap* dvmRegisterMapGetNext(const void** pPtr)
     const RegisterMap* pMap = (const RegisterMap*) *pPtr;
 
     *pPtr = /*align32*/(((u1*) pMap) + computeRegisterMapSize(pMap));
+    if (dvmRegisterMapGetHasLiveness(pMap)) {
+        *pPtr = ((u1*) *pPtr) +
+            computeRegisterMapSize((const RegisterMap*) *pPtr);
+    }
     LOGVV("getNext: %p -> %p (f=%#x w=%d e=%d)",
         pMap, *pPtr, pMap->format, pMap->regWidth,
         dvmRegisterMapGetNumEntries(pMap));
     return pMap;
 }
 
+/*
+ * Get the liveness map stored after "pMap".
+ */
+const RegisterMap* dvmRegisterMapGetLiveness(const RegisterMap* pMap)
+{
+    if (!dvmRegisterMapGetHasLiveness(pMap))
+        return NULL;
+    return (const RegisterMap*) (((u1*) pMap) + computeRegisterMapSize(pMap));
+}
+
 
 /*
  * ===========================================================================
@@ -889,12 +959,65 @@ const RegisterMap* dvmRegisterMapGetNext(const void** pPtr)
  * ===========================================================================
  */
 
+/*
+ * Find the line for "addr" in an indexed map, and expand it into "buf".
+ *
+ * The block index is searched for the last block that starts at or
+ * before "addr", and then the lines of that block are decoded in turn
+ * until we reach "addr" (or go past it).
+ */
+static const u1* getIndexedLine(const RegisterMap* pMap, int addr, u1* buf)
+{
+    const int regWidth = pMap->regWidth;
+    const int numEntries = dvmRegisterMapGetNumEntries(pMap);
+    const int numBlocks =
+        (numEntries + kRegMapBlockEntries - 1) / kRegMapBlockEntries;
+    const u1* index = pMap->data;
+
+    (void) readUnsignedLeb128(&index);
+    const u1* blocks = index + numBlocks * kRegMapIndexEntrySize;
+
+    int lo = 0;
+    int hi = numBlocks - 1;
+    int block = -1;
+    while (hi >= lo) {
+        int mid = (hi + lo) / 2;
+        const u1* entry = index + mid * kRegMapIndexEntrySize;
+        int blockAddr = entry[0] | (entry[1] << 8);
+
+        if (blockAddr <= addr) {
+            block = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (block < 0)
+        return NULL;
+
+    const u1* entry = index + block * kRegMapIndexEntrySize;
+    int lineAddr = entry[0] | (entry[1] << 8);
+    const u1* ptr = blocks + (entry[2] | (entry[3] << 8));
+    int count = MIN(kRegMapBlockEntries,
+        numEntries - block * kRegMapBlockEntries);
+
+    memcpy(buf, ptr, regWidth);
+    ptr += regWidth;
+    for (int i = 1; i < count && lineAddr < addr; i++) {
+        int addrDiff;
+        ptr = applyDiffEntry(ptr, &addrDiff, buf, regWidth);
+        lineAddr += addrDiff;
+    }
+
+    return (lineAddr == addr) ? buf : NULL;
+}
+
 /*
  * Return the data for the specified address, or NULL if not found.
  *
  * The result must be released with dvmReleaseRegisterMapLine().
  */
-const u1* dvmRegisterMapGetLine(const RegisterMap* pMap, int addr)
+const u1* dvmRegisterMapGetLine(const RegisterMap* pMap, int addr, u1* buf)
 {
     int addrWidth, lineWidth;
     u1 format = dvmRegisterMapGetFormat(pMap);
@@ -905,6 +1028,8 @@ const u1* dvmRegisterMapGetLine(const RegisterMap* pMap, int addr)
     switch (format) {
     case kRegMapFormatNone:
         return NULL;
+    case kRegMapFormatIndexed:
+        return getIndexedLine(pMap, addr, buf);
     case kRegMapFormatCompact8:
         addrWidth = 1;
         break;
@@ -968,27 +1093,41 @@ const u1* dvmRegisterMapGetLine(const RegisterMap* pMap, int addr)
 }
 
 /*
- * Compare two register maps.
- *
- * Returns 0 if they're equal, nonzero if not.
+ * Check that looking up each line of the uncompressed map "pMap" in the
+ * indexed map "pCompMap" gets the same bits.
  */
-static int compareMaps(const RegisterMap* pMap1, const RegisterMap* pMap2)
+static bool verifyIndexedMap(const RegisterMap* pMap,
+    const RegisterMap* pCompMap)
 {
-    size_t size1, size2;
+    const int addrWidth =
+        (dvmRegisterMapGetFormat(pMap) == kRegMapFormatCompact8) ? 1 : 2;
+    const int regWidth = pMap->regWidth;
+    const int numEntries = dvmRegisterMapGetNumEntries(pMap);
+    const u1* data = pMap->data;
+    u1 buf[kRegMapMaxRegWidth];
 
-    size1 = computeRegisterMapSize(pMap1);
-    size2 = computeRegisterMapSize(pMap2);
-    if (size1 != size2) {
-        ALOGI("compareMaps: size mismatch (%zd vs %zd)", size1, size2);
-        return -1;
+    if (dvmRegisterMapGetNumEntries(pCompMap) != numEntries ||
+        pCompMap->regWidth != regWidth)
+    {
+        ALOGI("verifyIndexedMap: header mismatch");
+        return false;
     }
 
-    if (memcmp(pMap1, pMap2, size1) != 0) {
-        ALOGI("compareMaps: content mismatch");
-        return -1;
+    for (int i = 0; i < numEntries; i++) {
+        int addr = data[0];
+        if (addrWidth > 1)
+            addr |= data[1] << 8;
+        data += addrWidth;
+
+        const u1* line = dvmRegisterMapGetLine(pCompMap, addr, buf);
+        if (line == NULL || memcmp(line, data, regWidth) != 0) {
+            ALOGI("verifyIndexedMap: mismatch at 0x%04x", addr);
+            return false;
+        }
+        data += regWidth;
     }
 
-    return 0;
+    return true;
 }
 
 
@@ -999,17 +1138,16 @@ static int compareMaps(const RegisterMap* pMap1, const RegisterMap* pMap2)
  * immediately.  Otherwise, we expand the map and replace method's register
  * map pointer, freeing it if it was allocated on the heap.
  *
- * NOTE: this function is not synchronized; external locking is mandatory
- * (unless we're in the zygote, where single-threaded access is guaranteed).
+ * NOTE: this must only be called during GC (or in the zygote, where
+ * single-threaded access is guaranteed).  The GC's mark threads may
+ * expand maps at the same time, so the expansion itself is serialized.
  */
-const RegisterMap* dvmGetExpandedRegisterMap0(Method* method)
-{
-    const RegisterMap* curMap = method->registerMap;
-    RegisterMap* newMap;
+static pthread_mutex_t gExpandMapLock = PTHREAD_MUTEX_INITIALIZER;
 
-    if (curMap == NULL)
-        return NULL;
+static const RegisterMap* expandRegisterMap(Method* method);
 
+const RegisterMap* dvmGetExpandedRegisterMap0(Method* method)
+{
     /* sanity check to ensure this isn't called w/o external locking */
     /* (if we use this at a time other than during GC, fix/remove this test) */
     if (true) {
@@ -1019,10 +1157,25 @@ const RegisterMap* dvmGetExpandedRegisterMap0(Method* method)
         }
     }
 
+    dvmLockMutex(&gExpandMapLock);
+    const RegisterMap* map = expandRegisterMap(method);
+    dvmUnlockMutex(&gExpandMapLock);
+    return map;
+}
+
+static const RegisterMap* expandRegisterMap(Method* method)
+{
+    const RegisterMap* curMap = method->registerMap;
+    RegisterMap* newMap;
+
+    if (curMap == NULL)
+        return NULL;
+
     RegisterMapFormat format = dvmRegisterMapGetFormat(curMap);
     switch (format) {
     case kRegMapFormatCompact8:
     case kRegMapFormatCompact16:
+    case kRegMapFormatIndexed:
         if (REGISTER_MAP_VERBOSE) {
             if (dvmRegisterMapGetOnHeap(curMap)) {
                 ALOGD("RegMap: already expanded: %s.%s",
@@ -1241,6 +1394,32 @@ code units, has no changes or just a single bit change, and the changed
 register is less than 16.  We should therefore be able to encode a large
 number of entries with a single byte, which is half the size of the
 Compact8 encoding method.
+
+
+----- indexed format -----
+
+The differential format has to be expanded onto the heap before the GC can
+use it, and the expanded copy stays there.  The indexed format uses the
+same entry encoding, but starts over every kRegMapBlockEntries entries, so
+that a single line can be decoded without touching the rest of the map.
+
+// common header
++00 1B format
++01 1B regWidth
++02 2B numEntries (little-endian)
++04 nB length in bytes of the data that follows, in ULEB128 format
+
+// block index, one entry per kRegMapBlockEntries entries
++00 2B address of the block's first entry (little-endian)
++02 2B offset of the block from the end of the index (little-endian)
+
+// for each block
++00 nB bit vector of the first entry
++nn    the remaining entries, as in the differential format
+
+A lookup is a binary search of the index followed by the decoding of at
+most kRegMapBlockEntries-1 entries.  Maps whose blocks don't fit in 64KB
+are left uncompressed.
 */
 
 /*
@@ -1434,28 +1613,87 @@ static int computeBitDiff(const u1* bits1, const u1* bits2, int byteWidth,
 }
 
 /*
- * Compress the register map with differential encoding.
+ * Output a differentially-encoded entry for the bit vector "bits", which
+ * is "addrDiff" code units past the entry with bit vector "prevBits".
+ *
+ * Returns the updated output pointer.
+ */
+static u1* writeDiffEntry(u1* ptr, int addrDiff, const u1* prevBits,
+    const u1* bits, int regWidth)
+{
+    u1 key;
+
+    assert(addrDiff > 0);
+    if (addrDiff < 8) {
+        /* small difference, encode in 3 bits */
+        key = addrDiff -1;          /* set 00000AAA */
+    } else {
+        /* large difference, output escape code */
+        key = 0x07;                 /* escape code for AAA */
+    }
+
+    int numBitsChanged, firstBitChanged, lebSize;
+
+    lebSize = computeBitDiff(prevBits, bits, regWidth,
+        &firstBitChanged, &numBitsChanged, NULL);
+
+    if (numBitsChanged == 0) {
+        /* set B to 1 and CCCC to zero to indicate no bits were changed */
+        key |= 0x08;
+    } else if (numBitsChanged == 1 && firstBitChanged < 16) {
+        /* set B to 0 and CCCC to the index of the changed bit */
+        key |= firstBitChanged << 4;
+    } else if (numBitsChanged < 15 && lebSize < regWidth) {
+        /* set B to 1 and CCCC to the number of bits */
+        key |= 0x08 | (numBitsChanged << 4);
+    } else {
+        /* set B to 1 and CCCC to 0x0f so we store the entire vector */
+        key |= 0x08 | 0xf0;
+    }
+
+    /*
+     * Encode output.  Start with the key, follow with the address
+     * diff (if it didn't fit in 3 bits), then the changed bit info.
+     */
+    *ptr++ = key;
+    if ((key & 0x07) == 0x07)
+        ptr = writeUnsignedLeb128(ptr, addrDiff);
+
+    if ((key & 0x08) != 0) {
+        int bitCount = key >> 4;
+        if (bitCount == 0) {
+            /* nothing changed, no additional output required */
+        } else if (bitCount == 15) {
+            /* full vector is most compact representation */
+            memcpy(ptr, bits, regWidth);
+            ptr += regWidth;
+        } else {
+            /* write bit indices in LEB128 format */
+            (void) computeBitDiff(prevBits, bits, regWidth, NULL, NULL, ptr);
+            ptr += lebSize;
+        }
+    } else {
+        /* single-bit changed, value encoded in key byte */
+    }
+
+    return ptr;
+}
+
+/*
+ * Compress the register map into the indexed format.
  *
  * "meth" is only needed for debug output.
  *
  * On success, returns a newly-allocated RegisterMap.  If the map is not
  * compatible for some reason, or fails to get smaller, this will return NULL.
  */
-static RegisterMap* compressMapDifferential(const RegisterMap* pMap,
+static RegisterMap* compressMapIndexed(const RegisterMap* pMap,
     const Method* meth)
 {
+    static const int kHeaderSize = offsetof(RegisterMap, data);
     RegisterMap* pNewMap = NULL;
     int origSize = computeRegisterMapSize(pMap);
-    u1* tmpPtr;
     int addrWidth, regWidth, numEntries;
-    bool debug = false;
-
-    if (false &&
-        strcmp(meth->clazz->descriptor, "Landroid/text/StaticLayout;") == 0 &&
-        strcmp(meth->name, "generate") == 0)
-    {
-        debug = true;
-    }
 
     u1 format = dvmRegisterMapGetFormat(pMap);
     switch (format) {
@@ -1473,184 +1711,72 @@ static RegisterMap* compressMapDifferential(const RegisterMap* pMap,
     regWidth = dvmRegisterMapGetRegWidth(pMap);
     numEntries = dvmRegisterMapGetNumEntries(pMap);
 
-    if (debug) {
-        ALOGI("COMPRESS: %s.%s aw=%d rw=%d ne=%d",
-            meth->clazz->descriptor, meth->name,
-            addrWidth, regWidth, numEntries);
-        dumpRegisterMap(pMap, -1);
-    }
-
     if (numEntries <= 1) {
         ALOGV("Can't compress map with 0 or 1 entries");
         return NULL;
     }
 
     /*
-     * We don't know how large the compressed data will be.  It's possible
-     * for it to expand and become larger than the original.  The header
-     * itself is variable-sized, so we generate everything into a temporary
-     * buffer and then copy it to form-fitting storage once we know how big
-     * it will be (and that it's smaller than the original).
-     *
-     * If we use a size that is equal to the size of the input map plus
-     * a value longer than a single entry can possibly expand to, we need
-     * only check for overflow at the end of each entry.  The worst case
-     * for a single line is (1 + <ULEB8 address> + <full copy of vector>).
-     * Addresses are 16 bits, so that's (1 + 3 + regWidth).
-     *
-     * The initial address offset and bit vector will take up less than
-     * or equal to the amount of space required when uncompressed -- large
-     * initial offsets are rejected.
+     * We don't know how large the compressed data will be, so we generate
+     * it into a temporary buffer that can hold the worst case (the index,
+     * plus a key, a 3-byte address difference and a full bit vector for
+     * every line), and copy it to form-fitting storage once we know that
+     * it's smaller than the original.
      */
-    UniquePtr<u1[]> tmpBuf(new u1[origSize + (1 + 3 + regWidth)]);
+    int numBlocks = (numEntries + kRegMapBlockEntries - 1) / kRegMapBlockEntries;
+    int indexSize = numBlocks * kRegMapIndexEntrySize;
+    UniquePtr<u1[]> tmpBuf(
+        new u1[indexSize + numEntries * (1 + 3 + regWidth)]);
     if (tmpBuf.get() == NULL)
         return NULL;
 
-    tmpPtr = tmpBuf.get();
-
+    u1* indexPtr = tmpBuf.get();
+    u1* blockStart = indexPtr + indexSize;
+    u1* tmpPtr = blockStart;
     const u1* mapData = pMap->data;
-    const u1* prevBits;
-    u2 addr, prevAddr;
-
-    addr = *mapData++;
-    if (addrWidth > 1)
-        addr |= (*mapData++) << 8;
-
-    if (addr >= 128) {
-        ALOGV("Can't compress map with starting address >= 128");
-        return NULL;
-    }
-
-    /*
-     * Start by writing the initial address and bit vector data.  The high
-     * bit of the initial address is used to indicate the required address
-     * width (which the decoder can't otherwise determine without parsing
-     * the compressed data).
-     */
-    *tmpPtr++ = addr | (addrWidth > 1 ? 0x80 : 0x00);
-    memcpy(tmpPtr, mapData, regWidth);
+    const u1* prevBits = NULL;
+    int prevAddr = 0;
 
-    prevBits = mapData;
-    prevAddr = addr;
-
-    tmpPtr += regWidth;
-    mapData += regWidth;
-
-    /*
-     * Loop over all following entries.
-     */
-    for (int entry = 1; entry < numEntries; entry++) {
-        int addrDiff;
-        u1 key;
-
-        /*
-         * Pull out the address and figure out how to encode it.
-         */
-        addr = *mapData++;
+    for (int entry = 0; entry < numEntries; entry++) {
+        int addr = *mapData++;
         if (addrWidth > 1)
             addr |= (*mapData++) << 8;
 
-        if (debug)
-            ALOGI(" addr=0x%04x ent=%d (aw=%d)", addr, entry, addrWidth);
-
-        addrDiff = addr - prevAddr;
-        assert(addrDiff > 0);
-        if (addrDiff < 8) {
-            /* small difference, encode in 3 bits */
-            key = addrDiff -1;          /* set 00000AAA */
-            if (debug)
-                ALOGI(" : small %d, key=0x%02x", addrDiff, key);
-        } else {
-            /* large difference, output escape code */
-            key = 0x07;                 /* escape code for AAA */
-            if (debug)
-                ALOGI(" : large %d, key=0x%02x", addrDiff, key);
-        }
-
-        int numBitsChanged, firstBitChanged, lebSize;
-
-        lebSize = computeBitDiff(prevBits, mapData, regWidth,
-            &firstBitChanged, &numBitsChanged, NULL);
-
-        if (debug) {
-            ALOGI(" : diff fbc=%d nbc=%d ls=%d (rw=%d)",
-                firstBitChanged, numBitsChanged, lebSize, regWidth);
-        }
-
-        if (numBitsChanged == 0) {
-            /* set B to 1 and CCCC to zero to indicate no bits were changed */
-            key |= 0x08;
-            if (debug) ALOGI(" : no bits changed");
-        } else if (numBitsChanged == 1 && firstBitChanged < 16) {
-            /* set B to 0 and CCCC to the index of the changed bit */
-            key |= firstBitChanged << 4;
-            if (debug) ALOGI(" : 1 low bit changed");
-        } else if (numBitsChanged < 15 && lebSize < regWidth) {
-            /* set B to 1 and CCCC to the number of bits */
-            key |= 0x08 | (numBitsChanged << 4);
-            if (debug) ALOGI(" : some bits changed");
-        } else {
-            /* set B to 1 and CCCC to 0x0f so we store the entire vector */
-            key |= 0x08 | 0xf0;
-            if (debug) ALOGI(" : encode original");
-        }
-
-        /*
-         * Encode output.  Start with the key, follow with the address
-         * diff (if it didn't fit in 3 bits), then the changed bit info.
-         */
-        *tmpPtr++ = key;
-        if ((key & 0x07) == 0x07)
-            tmpPtr = writeUnsignedLeb128(tmpPtr, addrDiff);
-
-        if ((key & 0x08) != 0) {
-            int bitCount = key >> 4;
-            if (bitCount == 0) {
-                /* nothing changed, no additional output required */
-            } else if (bitCount == 15) {
-                /* full vector is most compact representation */
-                memcpy(tmpPtr, mapData, regWidth);
-                tmpPtr += regWidth;
-            } else {
-                /* write bit indices in LEB128 format */
-                (void) computeBitDiff(prevBits, mapData, regWidth,
-                    NULL, NULL, tmpPtr);
-                tmpPtr += lebSize;
+        if (entry % kRegMapBlockEntries == 0) {
+            /* start a new block with a full copy of the bit vector */
+            int offset = tmpPtr - blockStart;
+            if (offset > 0xffff) {
+                ALOGV("Can't index map with %d bytes of blocks in %s.%s",
+                    offset, meth->clazz->descriptor, meth->name);
+                return NULL;
             }
+            *indexPtr++ = addr & 0xff;
+            *indexPtr++ = addr >> 8;
+            *indexPtr++ = offset & 0xff;
+            *indexPtr++ = offset >> 8;
+
+            memcpy(tmpPtr, mapData, regWidth);
+            tmpPtr += regWidth;
         } else {
-            /* single-bit changed, value encoded in key byte */
+            tmpPtr = writeDiffEntry(tmpPtr, addr - prevAddr, prevBits,
+                mapData, regWidth);
         }
 
         prevBits = mapData;
         prevAddr = addr;
         mapData += regWidth;
-
-        /*
-         * See if we've run past the original size.
-         */
-        if (tmpPtr - tmpBuf.get() >= origSize) {
-            if (debug) {
-                ALOGD("Compressed size >= original (%d vs %d): %s.%s",
-                    tmpPtr - tmpBuf.get(), origSize,
-                    meth->clazz->descriptor, meth->name);
-            }
-            return NULL;
-        }
     }
+    assert(indexPtr == blockStart);
 
     /*
      * Create a RegisterMap with the contents.
-     *
-     * TODO: consider using a threshold other than merely ">=".  We would
-     * get poorer compression but potentially use less native heap space.
      */
-    static const int kHeaderSize = offsetof(RegisterMap, data);
     int newDataSize = tmpPtr - tmpBuf.get();
     int newMapSize;
 
     newMapSize = kHeaderSize + unsignedLeb128Size(newDataSize) + newDataSize;
     if (newMapSize >= origSize) {
-        if (debug) {
+        if (REGISTER_MAP_VERBOSE) {
             ALOGD("Final comp size >= original (%d vs %d): %s.%s",
                 newMapSize, origSize, meth->clazz->descriptor, meth->name);
         }
@@ -1660,7 +1786,7 @@ static RegisterMap* compressMapDifferential(const RegisterMap* pMap,
     pNewMap = (RegisterMap*) malloc(newMapSize);
     if (pNewMap == NULL)
         return NULL;
-    dvmRegisterMapSetFormat(pNewMap, kRegMapFormatDifferential);
+    dvmRegisterMapSetFormat(pNewMap, kRegMapFormatIndexed);
     dvmRegisterMapSetOnHeap(pNewMap, true);
     dvmRegisterMapSetRegWidth(pNewMap, regWidth);
     dvmRegisterMapSetNumEntries(pNewMap, numEntries);
@@ -1671,8 +1797,7 @@ static RegisterMap* compressMapDifferential(const RegisterMap* pMap,
 
     if (REGISTER_MAP_VERBOSE) {
         ALOGD("Compression successful (%d -> %d) from aw=%d rw=%d ne=%d",
-            computeRegisterMapSize(pMap), computeRegisterMapSize(pNewMap),
-            addrWidth, regWidth, numEntries);
+            origSize, newMapSize, addrWidth, regWidth, numEntries);
     }
 
     return pNewMap;
@@ -1686,9 +1811,55 @@ static inline void toggleBit(u1* ptr, int idx)
     ptr[idx >> 3] ^= 1 << (idx & 0x07);
 }
 
+/*
+ * Decode the differentially-encoded entry at "ptr".  "bits" holds the
+ * bit vector of the previous entry, and is updated in place.
+ *
+ * Returns a pointer to the next entry.
+ */
+static const u1* applyDiffEntry(const u1* ptr, int* pAddrDiff, u1* bits,
+    int regWidth)
+{
+    u1 key = *ptr++;
+
+    /* get the address */
+    if ((key & 0x07) == 7) {
+        /* address diff follows in ULEB128 */
+        *pAddrDiff = readUnsignedLeb128(&ptr);
+    } else {
+        *pAddrDiff = (key & 0x07) +1;
+    }
+
+    /* unpack the bits */
+    if ((key & 0x08) != 0) {
+        int bitCount = (key >> 4);
+        if (bitCount == 0) {
+            /* no bits changed */
+        } else if (bitCount == 15) {
+            /* full copy of bit vector is present */
+            memcpy(bits, ptr, regWidth);
+            ptr += regWidth;
+        } else {
+            /* modify listed indices */
+            while (bitCount--) {
+                int bitIndex = readUnsignedLeb128(&ptr);
+                toggleBit(bits, bitIndex);
+            }
+        }
+    } else {
+        /* one bit, from 0-15 inclusive, was changed */
+        toggleBit(bits, key >> 4);
+    }
+
+    return ptr;
+}
+
 /*
  * Expand a compressed map to an uncompressed form.
  *
+ * Maps are no longer compressed this way, but files written by older
+ * builds may still hold them.
+ *
  * Returns a newly-allocated RegisterMap on success, or NULL on failure.
  *
  * TODO: consider using the linear allocator or a custom allocator with
@@ -1764,48 +1935,16 @@ static RegisterMap* uncompressMapDifferential(const RegisterMap* pMap)
     int entry;
     for (entry = 1; entry < numEntries; entry++) {
         int addrDiff;
-        u1 key;
-
-        key = *srcPtr++;
+        u1* addrPtr = dstPtr;
 
-        /* get the address */
-        if ((key & 0x07) == 7) {
-            /* address diff follows in ULEB128 */
-            addrDiff = readUnsignedLeb128(&srcPtr);
-        } else {
-            addrDiff = (key & 0x07) +1;
-        }
+        dstPtr += newAddrWidth;
+        memcpy(dstPtr, prevBits, regWidth);
+        srcPtr = applyDiffEntry(srcPtr, &addrDiff, dstPtr, regWidth);
 
         addr = prevAddr + addrDiff;
-        *dstPtr++ = addr & 0xff;
+        *addrPtr++ = addr & 0xff;
         if (newAddrWidth > 1)
-            *dstPtr++ = (u1) (addr >> 8);
-
-        /* unpack the bits */
-        if ((key & 0x08) != 0) {
-            int bitCount = (key >> 4);
-            if (bitCount == 0) {
-                /* no bits changed, just copy previous */
-                memcpy(dstPtr, prevBits, regWidth);
-            } else if (bitCount == 15) {
-                /* full copy of bit vector is present; ignore prevBits */
-                memcpy(dstPtr, srcPtr, regWidth);
-                srcPtr += regWidth;
-            } else {
-                /* copy previous bits and modify listed indices */
-                memcpy(dstPtr, prevBits, regWidth);
-                while (bitCount--) {
-                    int bitIndex = readUnsignedLeb128(&srcPtr);
-                    toggleBit(dstPtr, bitIndex);
-                }
-            }
-        } else {
-            /* copy previous bits and modify the specified one */
-            memcpy(dstPtr, prevBits, regWidth);
-
-            /* one bit, from 0-15 inclusive, was changed */
-            toggleBit(dstPtr, key >> 4);
-        }
+            *addrPtr++ = (u1) (addr >> 8);
 
         prevAddr = addr;
         prevBits = dstPtr;
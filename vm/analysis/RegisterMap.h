@@ -34,7 +34,9 @@ enum RegisterMapFormat {
     kRegMapFormatCompact8,      /* compact layout, 8-bit addresses */
     kRegMapFormatCompact16,     /* compact layout, 16-bit addresses */
     kRegMapFormatDifferential,  /* compressed, differential encoding */
+    kRegMapFormatIndexed,       /* compressed, indexed blocks of differences */
 
+    kRegMapFormatHasLiveness = 0x40, /* bit flag, liveness map follows */
     kRegMapFormatOnHeap = 0x80, /* bit flag, indicates allocation on heap */
 };
 
@@ -67,7 +69,8 @@ void dvmRegisterMapShutdown(void);
  * Get the format.
  */
 INLINE RegisterMapFormat dvmRegisterMapGetFormat(const RegisterMap* pMap) {
-    return (RegisterMapFormat)(pMap->format & ~(kRegMapFormatOnHeap));
+    return (RegisterMapFormat)(pMap->format &
+        ~(kRegMapFormatOnHeap | kRegMapFormatHasLiveness));
 }
 
 /*
@@ -75,7 +78,7 @@ INLINE RegisterMapFormat dvmRegisterMapGetFormat(const RegisterMap* pMap) {
  */
 INLINE void dvmRegisterMapSetFormat(RegisterMap* pMap, RegisterMapFormat format)
 {
-    pMap->format &= kRegMapFormatOnHeap;
+    pMap->format &= kRegMapFormatOnHeap | kRegMapFormatHasLiveness;
     pMap->format |= format;
 }
 
@@ -86,6 +89,14 @@ INLINE bool dvmRegisterMapGetOnHeap(const RegisterMap* pMap) {
     return (pMap->format & kRegMapFormatOnHeap) != 0;
 }
 
+/*
+ * Get the "has liveness" flag.  Only set on maps in a DEX file, where the
+ * method's liveness map immediately follows.
+ */
+INLINE bool dvmRegisterMapGetHasLiveness(const RegisterMap* pMap) {
+    return (pMap->format & kRegMapFormatHasLiveness) != 0;
+}
+
 /*
  * Get the register bit vector width, in bytes.
  */
@@ -125,16 +136,29 @@ INLINE void dvmRegisterMapSetNumEntries(RegisterMap* pMap, u2 numEntries) {
     pMap->numEntries[1] = numEntries >> 8;
 }
 
+/*
+ * Lines of an indexed map are grouped in blocks of this many entries.
+ */
+#define kRegMapBlockEntries     16
+#define kRegMapIndexEntrySize   4
+
+/*
+ * The largest register bit vector, in bytes.  (We don't generate maps for
+ * methods with 2048 or more registers.)
+ */
+#define kRegMapMaxRegWidth      256
+
 /*
  * Retrieve the bit vector for the specified address.  This is a pointer
- * to the bit data from an uncompressed map, or to a temporary copy of
- * data from a compressed map.
+ * to the bit data from an uncompressed map, or to "buf" (which must have
+ * room for kRegMapMaxRegWidth bytes) with the line expanded from an
+ * indexed map.
  *
  * The caller must call dvmReleaseRegisterMapLine() with the result.
  *
  * Returns NULL if not found.
  */
-const u1* dvmRegisterMapGetLine(const RegisterMap* pMap, int addr);
+const u1* dvmRegisterMapGetLine(const RegisterMap* pMap, int addr, u1* buf);
 
 /*
  * Release "data".
@@ -202,6 +226,12 @@ const void* dvmRegisterMapGetClassData(const DexFile* pDexFile, u4 classIdx,
  */
 const RegisterMap* dvmRegisterMapGetNext(const void** pPtr);
 
+/*
+ * Get the liveness map stored after "pMap" in a DEX file, or NULL if
+ * there isn't one.  "pMap" must be a result of dvmRegisterMapGetNext().
+ */
+const RegisterMap* dvmRegisterMapGetLiveness(const RegisterMap* pMap);
+
 /*
  * This holds some meta-data while we construct the set of register maps
  * for a DEX file.
@@ -236,10 +266,21 @@ void dvmFreeRegisterMapBuilder(RegisterMapBuilder* pBuilder);
  */
 RegisterMap* dvmGenerateRegisterMapV(VerifierData* vdata);
 
+/*
+ * Generate the liveness map for a method that has just been verified with
+ * live-precise register maps enabled.  It has the same layout as the
+ * register map, but each line has a bit set for every register that is
+ * live (of any type) before the instruction at that GC point.
+ *
+ * Returns a pointer to a newly-allocated RegisterMap, or NULL on failure.
+ */
+RegisterMap* dvmGenerateLivenessMapV(VerifierData* vdata);
+
 /*
  * Get the expanded form of the register map associated with the specified
- * method.  May update method->registerMap, possibly freeing the previous
- * map.
+ * method.  Indexed maps can be used as they are, and are returned
+ * unchanged.  May update method->registerMap, possibly freeing the
+ * previous map.
  *
  * Returns NULL on failure (e.g. unable to expand map).
  *
@@ -253,7 +294,9 @@ INLINE const RegisterMap* dvmGetExpandedRegisterMap(Method* method)
     if (curMap == NULL)
         return NULL;
     RegisterMapFormat format = dvmRegisterMapGetFormat(curMap);
-    if (format == kRegMapFormatCompact8 || format == kRegMapFormatCompact16) {
+    if (format == kRegMapFormatCompact8 || format == kRegMapFormatCompact16 ||
+        format == kRegMapFormatIndexed)
+    {
         return curMap;
     } else {
         return dvmGetExpandedRegisterMap0(method);
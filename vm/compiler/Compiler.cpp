@@ -21,6 +21,11 @@
 #include "Dalvik.h"
 #include "interp/Jit.h"
 #include "CompilerInternals.h"
+#include "JitProfile.h"
+#include "InlineCache.h"
+#include "NullFault.h"
+#include "JitSampler.h"
+#include "JitBudget.h"
 #ifdef ARCH_IA32
 #include "codegen/x86/Translator.h"
 #include "codegen/x86/Lower.h"
@@ -34,26 +39,99 @@ static inline bool workQueueLength(void)
     return gDvmJit.compilerQueueLength;
 }
 
-static CompilerWorkOrder workDequeue(void)
+/*
+ * Baseline translations that have been recompiled stay in the code cache
+ * until it is emptied, but they and the cells chained into them must be
+ * unchained before they can be forgotten, which takes a safe point.  The
+ * list is guarded by compilerLock.
+ */
+#define JIT_MAX_REPLACED_TRACES         16
+#define JIT_RECOMPILE_BATCH             8
+#define JIT_RECOMPILE_SCAN_INTERVAL_MS  500
+
+static JitEntry replacedTraces[JIT_MAX_REPLACED_TRACES];
+static int numReplacedTraces;
+
+/*
+ * The work queue is a binary heap with the hottest order on top.  An
+ * order's priority is bumped each time its trace is found hot again
+ * while it waits, and orders of equal priority leave in the order they
+ * came.  All of these must be called with compilerLock held.
+ */
+static inline bool workOrderBefore(const CompilerWorkOrder *a,
+                                   const CompilerWorkOrder *b)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    /* Wrap-around safe */
+    return (int) (a->sequence - b->sequence) < 0;
+}
+
+static void workSiftUp(int i)
+{
+    CompilerWorkOrder *queue = gDvmJit.compilerWorkQueue;
+    CompilerWorkOrder order = queue[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!workOrderBefore(&order, &queue[parent])) {
+            break;
+        }
+        queue[i] = queue[parent];
+        i = parent;
+    }
+    queue[i] = order;
+}
+
+static void workSiftDown(int i)
 {
-    assert(gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkDequeueIndex].kind
-           != kWorkOrderInvalid);
-    CompilerWorkOrder work =
-        gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkDequeueIndex];
-    gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkDequeueIndex++].kind =
-        kWorkOrderInvalid;
-    if (gDvmJit.compilerWorkDequeueIndex == COMPILER_WORK_QUEUE_SIZE) {
-        gDvmJit.compilerWorkDequeueIndex = 0;
+    CompilerWorkOrder *queue = gDvmJit.compilerWorkQueue;
+    int length = gDvmJit.compilerQueueLength;
+    CompilerWorkOrder order = queue[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= length) {
+            break;
+        }
+        if (child + 1 < length &&
+            workOrderBefore(&queue[child + 1], &queue[child])) {
+            child++;
+        }
+        if (!workOrderBefore(&queue[child], &order)) {
+            break;
+        }
+        queue[i] = queue[child];
+        i = child;
     }
+    queue[i] = order;
+}
+
+static int findWorkOrder(const u2 *pc)
+{
+    for (int i = 0; i < gDvmJit.compilerQueueLength; i++) {
+        if (gDvmJit.compilerWorkQueue[i].pc == pc) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static CompilerWorkOrder workDequeue(void)
+{
+    assert(gDvmJit.compilerQueueLength > 0);
+    assert(gDvmJit.compilerWorkQueue[0].kind != kWorkOrderInvalid);
+    CompilerWorkOrder work = gDvmJit.compilerWorkQueue[0];
     gDvmJit.compilerQueueLength--;
     if (gDvmJit.compilerQueueLength == 0) {
+        gDvmJit.compilerWorkQueue[0].kind = kWorkOrderInvalid;
         dvmSignalCond(&gDvmJit.compilerQueueEmpty);
+    } else {
+        int last = gDvmJit.compilerQueueLength;
+        gDvmJit.compilerWorkQueue[0] = gDvmJit.compilerWorkQueue[last];
+        gDvmJit.compilerWorkQueue[last].kind = kWorkOrderInvalid;
+        workSiftDown(0);
     }
 
-    /* Remember the high water mark of the queue length */
-    if (gDvmJit.compilerQueueLength > gDvmJit.compilerMaxQueued)
-        gDvmJit.compilerMaxQueued = gDvmJit.compilerQueueLength;
-
     return work;
 }
 
@@ -86,6 +164,19 @@ void dvmCompilerForceWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
     } while (!success);
 }
 
+/*
+ * With -Xjitrecompile, a trace is first given a baseline translation and
+ * only compiled in full once that has run often enough.
+ */
+int dvmCompilerTraceHints(WorkOrderKind kind)
+{
+    if (kind == kWorkOrderTraceRecompile) {
+        return JIT_OPT_REPLACE;
+    }
+    return (kind == kWorkOrderTrace && gDvmJit.recompileThreshold != 0) ?
+           JIT_OPT_BASELINE : 0;
+}
+
 /*
  * Attempt to enqueue a work order, returning true if successful.
  *
@@ -95,8 +186,6 @@ void dvmCompilerForceWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
 bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
 {
     int cc;
-    int i;
-    int numWork;
     bool result = true;
 
     dvmLockMutex(&gDvmJit.compilerLock);
@@ -110,22 +199,14 @@ bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
         return false;
     }
 
-    for (numWork = gDvmJit.compilerQueueLength,
-           i = gDvmJit.compilerWorkDequeueIndex;
-         numWork > 0;
-         numWork--) {
-        /* Already enqueued */
-        if (gDvmJit.compilerWorkQueue[i++].pc == pc) {
-            dvmUnlockMutex(&gDvmJit.compilerLock);
-            return true;
-        }
-        /* Wrap around */
-        if (i == COMPILER_WORK_QUEUE_SIZE)
-            i = 0;
+    /* Already enqueued */
+    if (findWorkOrder(pc) >= 0) {
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        return true;
     }
 
     CompilerWorkOrder *newOrder =
-        &gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkEnqueueIndex];
+        &gDvmJit.compilerWorkQueue[gDvmJit.compilerQueueLength];
     newOrder->pc = pc;
     newOrder->kind = kind;
     newOrder->info = info;
@@ -135,11 +216,19 @@ bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
         (kind == kWorkOrderTraceDebug) ? true : false;
     newOrder->result.cacheVersion = gDvmJit.cacheVersion;
     newOrder->result.requestingThread = dvmThreadSelf();
+    newOrder->result.holdsInstallLock = false;
+    newOrder->result.isBaseline = false;
+    newOrder->priority = 0;
+    newOrder->sequence = gDvmJit.compilerWorkSequence++;
+    newOrder->enqueueTime = dvmGetRelativeTimeUsec();
 
-    gDvmJit.compilerWorkEnqueueIndex++;
-    if (gDvmJit.compilerWorkEnqueueIndex == COMPILER_WORK_QUEUE_SIZE)
-        gDvmJit.compilerWorkEnqueueIndex = 0;
     gDvmJit.compilerQueueLength++;
+    workSiftUp(gDvmJit.compilerQueueLength - 1);
+
+    /* Remember the high water mark of the queue length */
+    if (gDvmJit.compilerQueueLength > gDvmJit.compilerMaxQueued)
+        gDvmJit.compilerMaxQueued = gDvmJit.compilerQueueLength;
+
     cc = pthread_cond_signal(&gDvmJit.compilerQueueActivity);
     assert(cc == 0);
 
@@ -147,6 +236,48 @@ bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
     return result;
 }
 
+/*
+ * Note that the trace at <pc> was found hot again while its order was
+ * waiting, and move the order up the queue.  This is only a hint, so
+ * give up rather than wait if the queue is busy.
+ */
+void dvmCompilerBoostWorkOrder(const u2 *pc)
+{
+    if (dvmTryLockMutex(&gDvmJit.compilerLock) != 0) {
+        return;
+    }
+    int i = findWorkOrder(pc);
+    if (i >= 0) {
+        gDvmJit.compilerWorkQueue[i].priority++;
+        workSiftUp(i);
+    }
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+}
+
+/*
+ * Serialize the placement of translations in the code cache.  The
+ * assembler resolves pc-relative references against the address the code
+ * will be copied to, and gDvmJit.inflightBaseAddr can only describe one
+ * translation, so the lock is held from the start of assembly until the
+ * translation is registered in the JitTable, when the compiler thread
+ * releases it.  Must be taken before compilerLock.
+ */
+void dvmCompilerLockInstall(JitTranslationInfo *info)
+{
+    if (!info->holdsInstallLock) {
+        dvmLockMutex(&gDvmJit.compilerInstallLock);
+        info->holdsInstallLock = true;
+    }
+}
+
+static void unlockInstall(JitTranslationInfo *info)
+{
+    if (info->holdsInstallLock) {
+        info->holdsInstallLock = false;
+        dvmUnlockMutex(&gDvmJit.compilerInstallLock);
+    }
+}
+
 /* Block until the queue length is 0, or there is a pending suspend request */
 void dvmCompilerDrainQueue(void)
 {
@@ -166,25 +297,246 @@ void dvmCompilerDrainQueue(void)
     dvmUnlockMutex(&gDvmJit.compilerLock);
 }
 
-bool dvmCompilerSetupCodeCache(void)
+/*
+ * Split the code cache past the templates into word aligned regions of
+ * equal size, all of them empty.
+ */
+static void resetCodeCacheRegions(void)
 {
-    int fd;
+    unsigned int numRegions = gDvmJit.numCodeCacheRegions;
+    unsigned int regionSize =
+        ((gDvmJit.codeCacheSize - gDvmJit.templateSize) / numRegions) & ~3;
+    unsigned int i;
 
-    /* Allocate the code cache */
-    fd = ashmem_create_region("dalvik-jit-code-cache", gDvmJit.codeCacheSize);
-    if (fd < 0) {
-        ALOGE("Could not create %u-byte ashmem region for the JIT code cache",
-             gDvmJit.codeCacheSize);
+    for (i = 0; i < numRegions; i++) {
+        JitCodeCacheRegion *region = &gDvmJit.codeCacheRegions[i];
+        region->start = gDvmJit.templateSize + i * regionSize;
+        region->end = (i == numRegions - 1) ?
+            gDvmJit.codeCacheSize : region->start + regionSize;
+        region->top = region->start;
+        region->generation = 0;
+    }
+    gDvmJit.codeCacheRegion = 0;
+    gDvmJit.codeCacheGeneration = 0;
+    gDvmJit.codeCacheRegionFull = false;
+}
+
+/*
+ * Returns where a translation of <size> bytes is to be assembled: the top
+ * of the current region, or the start of the next one while the cache is
+ * filled for the first time.  If there is no room, flags the cache as
+ * full so that the next safe point makes some, and returns NULL.  A
+ * translation too big for any region is just dropped.
+ */
+char *dvmCompilerCodeCacheAddr(unsigned int size)
+{
+    char *addr = NULL;
+
+    dvmLockMutex(&gDvmJit.compilerLock);
+    JitCodeCacheRegion *region =
+        &gDvmJit.codeCacheRegions[gDvmJit.codeCacheRegion];
+    if (region->top + size > region->end &&
+        gDvmJit.codeCacheRegion + 1 < gDvmJit.numCodeCacheRegions &&
+        region[1].top == region[1].start) {
+        gDvmJit.codeCacheRegion++;
+        region++;
+        region->generation = ++gDvmJit.codeCacheGeneration;
+    }
+    if (region->top + size <= region->end) {
+        addr = (char *) gDvmJit.codeCache + region->top;
+    } else if (size <= region->end - region->start) {
+        gDvmJit.codeCacheFull = true;
+        gDvmJit.codeCacheRegionFull = true;
+    }
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+    return addr;
+}
+
+/*
+ * Claims <size> bytes at <addr> for the translation assembled there.
+ * Returns false if a region has been evicted since
+ * dvmCompilerCodeCacheAddr returned <addr>, in which case the translation
+ * has to be assembled again.  Must be called with compilerLock held.
+ */
+bool dvmCompilerCodeCacheCommit(char *addr, unsigned int size)
+{
+    JitCodeCacheRegion *region =
+        &gDvmJit.codeCacheRegions[gDvmJit.codeCacheRegion];
+
+    if (addr != (char *) gDvmJit.codeCache + region->top) {
+        return false;
+    }
+    region->top += size;
+    gDvmJit.codeCacheBytesCommitted += size;
+    if (region->top > gDvmJit.codeCacheByteUsed) {
+        gDvmJit.codeCacheByteUsed = region->top;
+    }
+    return true;
+}
+
+/*
+ * A batch of code cache writes.  The pages written so far are left
+ * writable, and the flushes of the patches are queued, until the batch
+ * is synced: when it is full, when the writable pages would span too
+ * much of the cache, at the end of each work order and at safe points.
+ * A patch that isn't flushed yet is only late, as the code it replaces
+ * still works; a translation is flushed before it is installed.  All of
+ * this is guarded by codeCacheProtectionLock.
+ */
+#define CODE_CACHE_FLUSH_RANGES         16
+/* Queued flushes this close together are done as one */
+#define CODE_CACHE_FLUSH_SPAN_MAX       (16 * 1024)
+/* Writable pages this far apart are synced rather than kept */
+#define CODE_CACHE_WRITABLE_SPAN_MAX    (64 * 1024)
+
+static uintptr_t gWritableStart;
+static uintptr_t gWritableEnd;
+static uintptr_t gFlushStart[CODE_CACHE_FLUSH_RANGES];
+static uintptr_t gFlushEnd[CODE_CACHE_FLUSH_RANGES];
+static unsigned int gNumFlushes;
+static unsigned int gNumWrites;
+
+static void flushQueuedRanges(void)
+{
+    if (gNumFlushes == 0) {
+        return;
+    }
+    uintptr_t start = gFlushStart[0];
+    uintptr_t end = gFlushEnd[0];
+    unsigned int i;
+    for (i = 1; i < gNumFlushes; i++) {
+        start = MIN(start, gFlushStart[i]);
+        end = MAX(end, gFlushEnd[i]);
+    }
+    if (end - start <= CODE_CACHE_FLUSH_SPAN_MAX) {
+        dvmCompilerCacheFlush(start, end);
+    } else {
+        for (i = 0; i < gNumFlushes; i++) {
+            dvmCompilerCacheFlush(gFlushStart[i], gFlushEnd[i]);
+        }
+    }
+    gNumFlushes = 0;
+}
+
+static void syncCodeCacheWrites(void)
+{
+    flushQueuedRanges();
+    if (gWritableEnd > gWritableStart) {
+        mprotect((void *) gWritableStart, gWritableEnd - gWritableStart,
+                 PROTECT_CODE_CACHE_ATTRS);
+        gDvmJit.numCodeCacheMprotects++;
+        gWritableStart = gWritableEnd = 0;
+    }
+    gNumWrites = 0;
+}
+
+void dvmCompilerUnprotectCodeCache(void *addr, size_t size)
+{
+    uintptr_t start = (uintptr_t) addr & ~gDvmJit.pageSizeMask;
+    uintptr_t end = ((uintptr_t) addr + size + gDvmJit.pageSizeMask) &
+                    ~gDvmJit.pageSizeMask;
+
+    dvmLockMutex(&gDvmJit.codeCacheProtectionLock);
+    if (gDvmJit.codeCacheWritable ||
+        (start >= gWritableStart && end <= gWritableEnd)) {
+        return;
+    }
+    if (gWritableEnd > gWritableStart) {
+        if (MAX(end, gWritableEnd) - MIN(start, gWritableStart) >
+                CODE_CACHE_WRITABLE_SPAN_MAX) {
+            syncCodeCacheWrites();
+        } else {
+            start = MIN(start, gWritableStart);
+            end = MAX(end, gWritableEnd);
+        }
+    }
+    mprotect((void *) start, end - start, UNPROTECT_CODE_CACHE_ATTRS);
+    gDvmJit.numCodeCacheMprotects++;
+    gWritableStart = start;
+    gWritableEnd = end;
+}
+
+void dvmCompilerProtectCodeCache(void *addr, size_t size)
+{
+    gDvmJit.numCodeCacheWrites++;
+    if (++gNumWrites >= gDvmJit.codeCacheWriteBatch ||
+        gWritableEnd - gWritableStart > CODE_CACHE_WRITABLE_SPAN_MAX) {
+        syncCodeCacheWrites();
+    }
+    dvmUnlockMutex(&gDvmJit.codeCacheProtectionLock);
+}
+
+/*
+ * Queue the flush of a patch to the code cache, between
+ * UNPROTECT_CODE_CACHE and PROTECT_CODE_CACHE.
+ */
+void dvmCompilerQueueCacheFlush(uintptr_t start, uintptr_t end)
+{
+    if (gDvmJit.codeCacheWriteBatch <= 1) {
+        dvmCompilerCacheFlush(start, end);
+        return;
+    }
+    if (gNumFlushes == CODE_CACHE_FLUSH_RANGES) {
+        flushQueuedRanges();
+    }
+    gFlushStart[gNumFlushes] = start;
+    gFlushEnd[gNumFlushes] = end;
+    gNumFlushes++;
+}
+
+/* Write-protect the pages and do the flushes left by the batch */
+void dvmCompilerSyncCodeCache(void)
+{
+    dvmLockMutex(&gDvmJit.codeCacheProtectionLock);
+    syncCodeCacheWrites();
+    dvmUnlockMutex(&gDvmJit.codeCacheProtectionLock);
+}
+
+/*
+ * Maps the code cache on huge pages, rounded up to a whole one.  As
+ * changing the protection of a page would split its huge page, the
+ * cache is then left writable.  Returns false if there are no huge pages.
+ */
+static bool setupHugeCodeCache(void)
+{
+    size_t hugeSize = dvmHugePageSize();
+    if (hugeSize == 0) {
         return false;
     }
-    gDvmJit.codeCache = mmap(NULL, gDvmJit.codeCacheSize,
-                             PROT_READ | PROT_WRITE | PROT_EXEC,
-                             MAP_PRIVATE , fd, 0);
-    close(fd);
-    if (gDvmJit.codeCache == MAP_FAILED) {
-        ALOGE("Failed to mmap the JIT code cache of size %d: %s", gDvmJit.codeCacheSize, strerror(errno));
+    size_t size = ALIGN_UP(gDvmJit.codeCacheSize, hugeSize);
+    void *base = dvmAllocHugeRegion(size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                    "dalvik-jit-code-cache");
+    if (base == NULL) {
         return false;
     }
+    gDvmJit.codeCache = base;
+    gDvmJit.codeCacheSize = size;
+    gDvmJit.codeCacheWritable = true;
+    return true;
+}
+
+bool dvmCompilerSetupCodeCache(void)
+{
+    int fd;
+
+    /* Allocate the code cache */
+    if (!setupHugeCodeCache()) {
+        fd = ashmem_create_region("dalvik-jit-code-cache",
+                                  gDvmJit.codeCacheSize);
+        if (fd < 0) {
+            ALOGE("Could not create %u-byte ashmem region for the JIT code "
+                  "cache", gDvmJit.codeCacheSize);
+            return false;
+        }
+        gDvmJit.codeCache = mmap(NULL, gDvmJit.codeCacheSize,
+                                 PROT_READ | PROT_WRITE | PROT_EXEC,
+                                 MAP_PRIVATE , fd, 0);
+        close(fd);
+        if (gDvmJit.codeCache == MAP_FAILED) {
+            ALOGE("Failed to mmap the JIT code cache of size %d: %s", gDvmJit.codeCacheSize, strerror(errno));
+            return false;
+        }
+    }
 
     gDvmJit.pageSizeMask = getpagesize() - 1;
 
@@ -223,9 +575,11 @@ bool dvmCompilerSetupCodeCache(void)
     gDvmJit.codeCacheByteUsed = (stream - streamStart);
     ALOGV("stream = %p after initJIT", stream);
 #endif
+    resetCodeCacheRegions();
 
-    int result = mprotect(gDvmJit.codeCache, gDvmJit.codeCacheSize,
-                          PROTECT_CODE_CACHE_ATTRS);
+    int result = gDvmJit.codeCacheWritable ? 0 :
+        mprotect(gDvmJit.codeCache, gDvmJit.codeCacheSize,
+                 PROTECT_CODE_CACHE_ATTRS);
 
     if (result == -1) {
         ALOGE("Failed to remove the write permission for the code cache");
@@ -276,14 +630,16 @@ static void crawlDalvikStack(Thread *thread, bool print)
            (u1 *) (saveArea+1) == thread->interpStackStart);
 }
 
-static void resetCodeCache(void)
+/*
+ * Wipes out the return addresses into the code cache on all the Dalvik
+ * stacks and cancels any trace selection.  Returns the number of threads
+ * that are still running translations.
+ */
+static int detachThreadsFromCodeCache(void)
 {
     Thread* thread;
-    u8 startTime = dvmGetRelativeTimeUsec();
     int inJit = 0;
-    int byteUsed = gDvmJit.codeCacheByteUsed;
 
-    /* If any thread is found stuck in the JIT state, don't reset the cache  */
     dvmLockThreadList(NULL);
     for (thread = gDvm.threadList; thread != NULL; thread = thread->next) {
         /*
@@ -300,8 +656,16 @@ static void resetCodeCache(void)
         dvmDisableSubMode(thread, kSubModeJitTraceBuild);
     }
     dvmUnlockThreadList();
+    return inJit;
+}
+
+static void resetCodeCache(void)
+{
+    u8 startTime = dvmGetRelativeTimeUsec();
+    int byteUsed = gDvmJit.codeCacheByteUsed;
 
-    if (inJit) {
+    /* If any thread is found stuck in the JIT state, don't reset the cache  */
+    if (detachThreadsFromCodeCache() != 0) {
         ALOGD("JIT code cache reset delayed (%d bytes %d/%d)",
              gDvmJit.codeCacheByteUsed, gDvmJit.numCodeCacheReset,
              ++gDvmJit.numCodeCacheResetDelayed);
@@ -338,18 +702,21 @@ static void resetCodeCache(void)
 
     /* Reset the current mark of used bytes to the end of template code */
     gDvmJit.codeCacheByteUsed = gDvmJit.templateSize;
+    resetCodeCacheRegions();
     gDvmJit.numCompilations = 0;
 
     /* Reset the work queue */
     memset(gDvmJit.compilerWorkQueue, 0,
            sizeof(CompilerWorkOrder) * COMPILER_WORK_QUEUE_SIZE);
-    gDvmJit.compilerWorkEnqueueIndex = gDvmJit.compilerWorkDequeueIndex = 0;
     gDvmJit.compilerQueueLength = 0;
+    numReplacedTraces = 0;
 
     /* Reset the IC patch work queue */
     dvmLockMutex(&gDvmJit.compilerICPatchLock);
     gDvmJit.compilerICPatchIndex = 0;
+    dvmJitICSiteForget(NULL, NULL);
     dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
+    dvmJitNullFaultForget(NULL, NULL);
 
     /*
      * Reset the inflight compilation address (can only be done in safe points
@@ -368,19 +735,222 @@ static void resetCodeCache(void)
          gDvmJit.numCodeCacheResetDelayed);
 }
 
+/*
+ * Unchains the replaced translations, except those in [start, end), which
+ * are about to be discarded with the cells chained into them.  Must be
+ * called at a safe point with compilerLock and tableLock held.
+ */
+static void unchainReplacedTraces(const char *start, const char *end)
+{
+    for (int i = 0; i < numReplacedTraces; i++) {
+        const char *codeAddr = (const char *) replacedTraces[i].codeAddress;
+        if (codeAddr < start || codeAddr >= end) {
+            dvmJitUnchainReplaced(&replacedTraces[i]);
+        }
+    }
+    numReplacedTraces = 0;
+}
+
+/* Returns the region holding <addr>, or -1 for the templates */
+static int codeCacheRegionOf(const void *addr)
+{
+    unsigned int offset =
+        (const char *) addr - (const char *) gDvmJit.codeCache;
+    unsigned int i;
+
+    for (i = 0; i < gDvmJit.numCodeCacheRegions; i++) {
+        if (offset >= gDvmJit.codeCacheRegions[i].start &&
+            offset < gDvmJit.codeCacheRegions[i].end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Empties the region whose translations ran the least since the last
+ * eviction, the oldest one on a tie, and has the compiler fill it next.
+ * Only the chaining cells that branch into the region are unchained, and
+ * the JitTable entries of its translations are kept but flagged so that
+ * their traces can be selected again once they turn hot.  Returns false
+ * if the whole cache has to be reset instead.
+ */
+static bool evictCodeCacheRegion(void)
+{
+    u8 startTime = dvmGetRelativeTimeUsec();
+    unsigned int numRuns[JIT_MAX_CODE_CACHE_REGIONS];
+    unsigned int victim;
+    unsigned int i;
+    int numEvicted = 0;
+
+    /*
+     * Only a full region calls for an eviction.  The JitTable entries of
+     * the evicted translations stay, so a JitTable that couldn't grow
+     * needs a reset, and so does running low on profile counters, as
+     * every trace compiled takes one and only a reset gives them back.
+     */
+    if (!gDvmJit.codeCacheRegionFull || gDvmJit.numCodeCacheRegions < 2 ||
+        gDvmJit.jitTableEntriesUsed >
+            (gDvmJit.jitTableSize - gDvmJit.jitTableSize/4) ||
+        gDvmJit.pJitTraceProfCounters == NULL ||
+        gDvmJit.pJitTraceProfCounters->next >= JIT_MAX_ENTRIES / 2) {
+        return false;
+    }
+
+    if (detachThreadsFromCodeCache() != 0) {
+        ALOGD("JIT code cache eviction delayed (%d/%d)",
+             gDvmJit.numCodeCacheEvictions,
+             ++gDvmJit.numCodeCacheResetDelayed);
+        return true;
+    }
+
+    dvmLockMutex(&gDvmJit.compilerLock);
+    dvmLockMutex(&gDvmJit.tableLock);
+
+    JitEntry *table = gDvmJit.pJitEntryTable;
+    memset(numRuns, 0, sizeof(numRuns));
+    for (i = 0; i < gDvmJit.jitTableSize; i++) {
+        if (table[i].codeAddress != NULL && table[i].u.info.recentlyUsed) {
+            int r = codeCacheRegionOf(table[i].codeAddress);
+            if (r >= 0) {
+                numRuns[r]++;
+            }
+        }
+    }
+    victim = gDvmJit.codeCacheRegion;
+    for (i = 0; i < gDvmJit.numCodeCacheRegions; i++) {
+        if (i == gDvmJit.codeCacheRegion) {
+            continue;
+        }
+        if (victim == gDvmJit.codeCacheRegion ||
+            numRuns[i] < numRuns[victim] ||
+            (numRuns[i] == numRuns[victim] &&
+             gDvmJit.codeCacheRegions[i].generation <
+             gDvmJit.codeCacheRegions[victim].generation)) {
+            victim = i;
+        }
+    }
+    JitCodeCacheRegion *region = &gDvmJit.codeCacheRegions[victim];
+    char *start = (char *) gDvmJit.codeCache + region->start;
+    char *end = (char *) gDvmJit.codeCache + region->top;
+
+    /* Send the predecessors back to the interpreter */
+    unchainReplacedTraces(start, end);
+    dvmJitUnchainRange(start, end);
+
+    for (i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &table[i];
+        bool evict = (char *) entry->codeAddress >= start &&
+                     (char *) entry->codeAddress < end;
+        if (!evict && !entry->u.info.recentlyUsed) {
+            continue;
+        }
+        if (evict) {
+            entry->codeAddress = NULL;
+            numEvicted++;
+        }
+        /* The compiler threads may still be setting method entries */
+        JitEntryInfoUnion oldValue;
+        JitEntryInfoUnion newValue;
+        do {
+            oldValue = entry->u;
+            newValue = oldValue;
+            newValue.info.recentlyUsed = false;
+            newValue.info.evicted |= evict;
+        } while (android_atomic_release_cas(
+                 oldValue.infoWord, newValue.infoWord,
+                 &entry->u.infoWord) != 0);
+    }
+
+    if (end > start) {
+        UNPROTECT_CODE_CACHE(start, end - start);
+        dvmCompilerCacheClear(start, end - start);
+        dvmCompilerCacheFlush((intptr_t) start, (intptr_t) end);
+        PROTECT_CODE_CACHE(start, end - start);
+    }
+
+    dvmUnlockMutex(&gDvmJit.tableLock);
+
+    /*
+     * The queued patches and site records may be for cells now gone.  Those
+     * of the other regions are for retired cells, so they are kept.
+     */
+    dvmLockMutex(&gDvmJit.compilerICPatchLock);
+    int numPatches = 0;
+    for (int i = 0; i < gDvmJit.compilerICPatchIndex; i++) {
+        const char *cellAddr =
+            (const char *) gDvmJit.compilerICPatchQueue[i].cellAddr;
+        if (cellAddr < start || cellAddr >= end) {
+            gDvmJit.compilerICPatchQueue[numPatches++] =
+                gDvmJit.compilerICPatchQueue[i];
+        }
+    }
+    gDvmJit.compilerICPatchIndex = numPatches;
+    dvmJitICSiteForget(start, end);
+    dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
+    dvmJitNullFaultForget(start, end);
+
+    region->top = region->start;
+    region->generation = ++gDvmJit.codeCacheGeneration;
+    gDvmJit.codeCacheRegion = victim;
+    gDvmJit.numTranslationsEvicted += numEvicted;
+    gDvmJit.codeCacheRegionFull = false;
+    gDvmJit.codeCacheFull = false;
+
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+
+    ALOGD("JIT code cache evicted %d translations from region %d "
+         "in %lld ms (%d/%d)",
+         numEvicted, victim, (dvmGetRelativeTimeUsec() - startTime) / 1000,
+         ++gDvmJit.numCodeCacheEvictions, gDvmJit.numCodeCacheReset);
+    return true;
+}
+
 /*
  * Perform actions that are only safe when all threads are suspended. Currently
  * we do:
- * 1) Check if the code cache is full. If so reset it and restart populating it
- *    from scratch.
+ * 1) Check if the code cache is full. If so evict its coldest region, or
+ *    if that won't do reset it and restart populating it from scratch.
  * 2) Patch predicted chaining cells by consuming recorded work orders.
  */
 void dvmCompilerPerformSafePointChecks(void)
 {
-    if (gDvmJit.codeCacheFull) {
+    dvmLockMutex(&gDvmJit.compilerLock);
+    if (numReplacedTraces != 0) {
+        dvmLockMutex(&gDvmJit.tableLock);
+        unchainReplacedTraces(NULL, NULL);
+        dvmUnlockMutex(&gDvmJit.tableLock);
+    }
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+
+    if (gDvmJit.codeCacheFull && !evictCodeCacheRegion()) {
         resetCodeCache();
     }
     dvmCompilerPatchInlineCache();
+    dvmCompilerSyncCodeCache();
+}
+
+/*
+ * Returns true if no thread but the caller can be between reading a
+ * predicted chaining cell and taking its branch, which is only done by a
+ * RUNNING thread in the code cache.  A cell retired before the call can
+ * then be rewritten in place, as any thread getting to it afterwards sees
+ * it retired.  Must be called with the thread list locked.
+ */
+bool dvmCompilerChainingCellsQuiescent(void)
+{
+    Thread *self = dvmThreadSelf();
+
+    /* Make the retired cells visible before looking at the threads */
+    ANDROID_MEMBAR_FULL();
+    for (Thread *thread = gDvm.threadList; thread != NULL;
+         thread = thread->next) {
+        if (thread != self && thread->status == THREAD_RUNNING &&
+            thread->inJitCodeCache != NULL) {
+            return false;
+        }
+    }
+    return true;
 }
 
 static bool compilerThreadStartup(void)
@@ -388,11 +958,13 @@ static bool compilerThreadStartup(void)
     JitEntry *pJitTable = NULL;
     unsigned char *pJitProfTable = NULL;
     JitTraceProfCounters *pJitTraceProfCounters = NULL;
-    unsigned int i;
 
     if (!dvmCompilerArchInit())
         goto fail;
 
+    /* The target has picked the threshold to throttle from */
+    dvmJitBudgetStartup();
+
     /*
      * Setup the code cache if we have not inherited a valid code cache
      * from the zygote.
@@ -401,6 +973,7 @@ static bool compilerThreadStartup(void)
         if (!dvmCompilerSetupCodeCache())
             goto fail;
     }
+    dvmJitNullFaultStartup();
 
     /* Allocate the initial arena block */
     if (dvmCompilerHeapInit() == false) {
@@ -452,11 +1025,6 @@ static bool compilerThreadStartup(void)
         goto fail;
     }
     memset(pJitProfTable, gDvmJit.threshold, JIT_PROF_SIZE);
-    for (i=0; i < gDvmJit.jitTableSize; i++) {
-       pJitTable[i].u.info.chain = gDvmJit.jitTableSize;
-    }
-    /* Is chain field wide enough for termination pattern? */
-    assert(pJitTable[0].u.info.chain == gDvmJit.jitTableSize);
 
     /* Allocate the trace profiling structure */
     pJitTraceProfCounters = (JitTraceProfCounters*)
@@ -594,58 +1162,119 @@ fail:
 
 }
 
-static void *compilerThreadStart(void *arg)
+static void recordWorkStats(u8 queueTime, u8 workTime)
 {
-    dvmChangeStatus(NULL, THREAD_VMWAIT);
+    dvmLockMutex(&gDvmJit.compilerLock);
+    gDvmJit.compilerOrdersDone++;
+    gDvmJit.compilerQueueTime += queueTime;
+    gDvmJit.compilerWorkTime += workTime;
+    if (queueTime > gDvmJit.compilerMaxQueueTime)
+        gDvmJit.compilerMaxQueueTime = queueTime;
+    if (workTime > gDvmJit.compilerMaxWorkTime)
+        gDvmJit.compilerMaxWorkTime = workTime;
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+}
 
-    /*
-     * If we're not running stand-alone, wait a little before
-     * recieving translation requests on the assumption that process start
-     * up code isn't worth compiling.  We'll resume when the framework
-     * signals us that the first screen draw has happened, or the timer
-     * below expires (to catch daemons).
-     *
-     * There is a theoretical race between the callback to
-     * VMRuntime.startJitCompiation and when the compiler thread reaches this
-     * point. In case the callback happens earlier, in order not to permanently
-     * hold the system_server (which is not using the timed wait) in
-     * interpreter-only mode we bypass the delay here.
-     */
-    if (gDvmJit.runningInAndroidFramework &&
-        !gDvmJit.alreadyEnabledViaFramework) {
-        /*
-         * If the current VM instance is the system server (detected by having
-         * 0 in gDvm.systemServerPid), we will use the indefinite wait on the
-         * conditional variable to determine whether to start the JIT or not.
-         * If the system server detects that the whole system is booted in
-         * safe mode, the conditional variable will never be signaled and the
-         * system server will remain in the interpreter-only mode. All
-         * subsequent apps will be started with the --enable-safemode flag
-         * explicitly appended.
-         */
-        if (gDvm.systemServerPid == 0) {
-            dvmLockMutex(&gDvmJit.compilerLock);
-            pthread_cond_wait(&gDvmJit.compilerQueueActivity,
-                              &gDvmJit.compilerLock);
-            dvmUnlockMutex(&gDvmJit.compilerLock);
-            ALOGD("JIT started for system_server");
-        } else {
-            dvmLockMutex(&gDvmJit.compilerLock);
-            /*
-             * TUNING: experiment with the delay & perhaps make it
-             * target-specific
-             */
-            dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
-                                 &gDvmJit.compilerLock, 3000, 0);
-            dvmUnlockMutex(&gDvmJit.compilerLock);
+/* Sets or clears the baseline flag of a JitTable entry */
+static void setBaseline(JitEntry *entry, bool isBaseline)
+{
+    JitEntryInfoUnion oldValue;
+    JitEntryInfoUnion newValue;
+    do {
+        oldValue = entry->u;
+        newValue = oldValue;
+        newValue.info.baseline = isBaseline;
+    } while (android_atomic_release_cas(
+             oldValue.infoWord, newValue.infoWord,
+             &entry->u.infoWord) != 0);
+}
+
+/*
+ * Queues the baseline translations that have run recompileThreshold times
+ * for a full compilation.  Returns true if there are baseline translations
+ * left to watch.  Called by the primary compiler thread, which is the one
+ * that resizes the JitTable, without compilerLock.
+ */
+static bool recompileHotTraces(void)
+{
+    const u2 *pcs[JIT_RECOMPILE_BATCH];
+    JitTraceDescription *descs[JIT_RECOMPILE_BATCH];
+    int numHot = 0;
+    bool baselineLeft = false;
+
+    /* The code cache can only be emptied with compilerLock held */
+    dvmLockMutex(&gDvmJit.compilerLock);
+    if (numReplacedTraces + JIT_RECOMPILE_BATCH > JIT_MAX_REPLACED_TRACES) {
+        /* Wait for a safe point to unchain the ones already replaced */
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        return true;
+    }
+    for (unsigned int i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        if (!entry->u.info.baseline || entry->codeAddress == NULL) {
+            continue;
         }
-        if (gDvmJit.haltCompilerThread) {
-             return NULL;
+        if (numHot == JIT_RECOMPILE_BATCH ||
+            dvmJitGetTraceCount(entry) < gDvmJit.recompileThreshold ||
+            findWorkOrder(entry->dPC) >= 0) {
+            baselineLeft = true;
+            continue;
         }
+        JitTraceDescription *desc = dvmCopyTraceDescriptor(NULL, entry);
+        if (desc == NULL) {
+            baselineLeft = true;
+            continue;
+        }
+        setBaseline(entry, false);
+        pcs[numHot] = entry->dPC;
+        descs[numHot++] = desc;
     }
+    dvmUnlockMutex(&gDvmJit.compilerLock);
 
-    compilerThreadStartup();
+    for (int i = 0; i < numHot; i++) {
+        if (!dvmCompilerWorkEnqueue(pcs[i], kWorkOrderTraceRecompile,
+                                    descs[i])) {
+            free(descs[i]);
+            JitEntry *entry = dvmJitFindEntry(pcs[i], false);
+            if (entry != NULL) {
+                setBaseline(entry, true);
+            }
+            baselineLeft = true;
+        }
+    }
+    return baselineLeft;
+}
+
+/*
+ * Installs the full translation of a trace in place of its baseline one,
+ * which is kept for unchaining at the next safe point.  Must be called
+ * with compilerLock held.
+ */
+static void installRecompiledTrace(const CompilerWorkOrder *work)
+{
+    JitEntry *entry = dvmJitFindEntry(work->pc, false);
+    if (entry != NULL && entry->codeAddress != NULL &&
+        entry->codeAddress != dvmCompilerGetInterpretTemplate()) {
+        if (numReplacedTraces == JIT_MAX_REPLACED_TRACES) {
+            /* Keep the baseline; the new code goes with the region */
+            return;
+        }
+        replacedTraces[numReplacedTraces++] = *entry;
+    }
+    dvmJitSetCodeAddr(work->pc, work->result.codeAddress,
+                      work->result.instructionSet,
+                      false, /* not method entry */
+                      work->result.profileCodeSize,
+                      false /* not baseline */);
+    gDvmJit.numTracesRecompiled++;
+}
 
+/*
+ * Take work orders off the queue until the compiler is halted.  Only the
+ * first compiler thread looks after the JitTable.
+ */
+static void compilerWorkLoop(bool isPrimary)
+{
     dvmLockMutex(&gDvmJit.compilerLock);
     /*
      * Since the compiler thread will not touch any objects on the heap once
@@ -657,21 +1286,71 @@ static void *compilerThreadStart(void *arg)
             int cc;
             cc = pthread_cond_signal(&gDvmJit.compilerQueueEmpty);
             assert(cc == 0);
-            pthread_cond_wait(&gDvmJit.compilerQueueActivity,
-                              &gDvmJit.compilerLock);
+            if (isPrimary && (gDvmJit.traceFile != NULL ||
+                              gDvmJit.recompileThreshold != 0)) {
+                /*
+                 * Replay saved traces and save the profile while idle, and
+                 * recompile the baseline translations that turned hot.
+                 */
+                bool watchBaseline = false;
+                bool watchBudget;
+                dvmUnlockMutex(&gDvmJit.compilerLock);
+                if (gDvmJit.traceFile != NULL)
+                    dvmJitProfileIdle();
+                if (gDvmJit.recompileThreshold != 0)
+                    watchBaseline = recompileHotTraces();
+                watchBudget = dvmJitBudgetIdle();
+                dvmLockMutex(&gDvmJit.compilerLock);
+                if (workQueueLength() != 0 || gDvmJit.haltCompilerThread)
+                    continue;
+                if (watchBaseline) {
+                    dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
+                                        &gDvmJit.compilerLock,
+                                        JIT_RECOMPILE_SCAN_INTERVAL_MS, 0);
+                } else if (watchBudget) {
+                    dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
+                                        &gDvmJit.compilerLock,
+                                        JIT_BUDGET_WINDOW_MS, 0);
+                } else if (gDvmJit.traceFile != NULL) {
+                    dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
+                                        &gDvmJit.compilerLock,
+                                        JIT_PROFILE_SAVE_INTERVAL_MS, 0);
+                } else {
+                    pthread_cond_wait(&gDvmJit.compilerQueueActivity,
+                                      &gDvmJit.compilerLock);
+                }
+            } else if (isPrimary && (gDvmJit.compileBudgetPercent != 0 ||
+                                     gDvmJit.codeCacheBudgetKBPerSec != 0)) {
+                /* Bring the threshold back down once the JIT is quiet */
+                dvmUnlockMutex(&gDvmJit.compilerLock);
+                bool watchBudget = dvmJitBudgetIdle();
+                dvmLockMutex(&gDvmJit.compilerLock);
+                if (workQueueLength() != 0 || gDvmJit.haltCompilerThread)
+                    continue;
+                if (watchBudget) {
+                    dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
+                                        &gDvmJit.compilerLock,
+                                        JIT_BUDGET_WINDOW_MS, 0);
+                } else {
+                    pthread_cond_wait(&gDvmJit.compilerQueueActivity,
+                                      &gDvmJit.compilerLock);
+                }
+            } else {
+                pthread_cond_wait(&gDvmJit.compilerQueueActivity,
+                                  &gDvmJit.compilerLock);
+            }
             continue;
         } else {
             do {
                 CompilerWorkOrder work = workDequeue();
                 dvmUnlockMutex(&gDvmJit.compilerLock);
-#if defined(WITH_JIT_TUNING)
                 /*
                  * This is live across setjmp().  Mark it volatile to suppress
                  * a gcc warning.  We should not need this since it is assigned
                  * only once but gcc is not smart enough.
                  */
                 volatile u8 startTime = dvmGetRelativeTimeUsec();
-#endif
+                volatile u8 startCpuTime = dvmGetThreadCpuTimeNsec();
                 /*
                  * Check whether there is a suspend request on me.  This
                  * is necessary to allow a clean shutdown.
@@ -685,7 +1364,7 @@ static void *compilerThreadStart(void *arg)
                 if (!gDvmJit.blockingMode)
                     dvmCheckSuspendPending(dvmThreadSelf());
                 /* Is JitTable filling up? */
-                if (gDvmJit.jitTableEntriesUsed >
+                if (isPrimary && gDvmJit.jitTableEntriesUsed >
                     (gDvmJit.jitTableSize - gDvmJit.jitTableSize/4)) {
                     bool resizeFail =
                         dvmJitResizeJitTable(gDvmJit.jitTableSize * 2);
@@ -695,11 +1374,21 @@ static void *compilerThreadStart(void *arg)
                      */
                     gDvmJit.codeCacheFull |= resizeFail;
                 }
+                dvmJitNullFaultCheckHandler();
                 if (gDvmJit.haltCompilerThread) {
                     ALOGD("Compiler shutdown in progress - discarding request");
                 } else if (!gDvmJit.codeCacheFull) {
                     jmp_buf jmpBuf;
                     work.bailPtr = &jmpBuf;
+                    /*
+                     * Debug orders turn on gDvmJit.printMe and profile mode
+                     * changes retarget the templates, so neither may overlap
+                     * with another compilation.
+                     */
+                    if (work.kind != kWorkOrderTrace &&
+                        work.kind != kWorkOrderTraceRecompile) {
+                        dvmCompilerLockInstall(&work.result);
+                    }
                     bool aborted = setjmp(jmpBuf);
                     if (!aborted) {
                         bool codeCompiled = dvmCompilerDoWork(&work);
@@ -714,18 +1403,35 @@ static void *compilerThreadStart(void *arg)
                              codeCompiled &&
                              !work.result.discardResult &&
                              work.result.codeAddress) {
-                            dvmJitSetCodeAddr(work.pc, work.result.codeAddress,
+                            if (work.kind == kWorkOrderTraceRecompile) {
+                                installRecompiledTrace(&work);
+                            } else {
+                                dvmJitSetCodeAddr(work.pc,
+                                              work.result.codeAddress,
                                               work.result.instructionSet,
                                               false, /* not method entry */
-                                              work.result.profileCodeSize);
+                                              work.result.profileCodeSize,
+                                              work.result.isBaseline);
+                                if (work.result.isBaseline)
+                                    gDvmJit.numBaselineTraces++;
+                            }
                         }
                         dvmUnlockMutex(&gDvmJit.compilerLock);
                     }
+                    unlockInstall(&work.result);
                     dvmCompilerArenaReset();
                 }
                 free(work.info);
+                dvmCompilerSyncCodeCache();
+                u8 endTime = dvmGetRelativeTimeUsec();
+                recordWorkStats(startTime - work.enqueueTime,
+                                endTime - startTime);
+                u4 pauseMs = dvmJitBudgetRecord(dvmGetThreadCpuTimeNsec() -
+                                                startCpuTime);
+                if (pauseMs != 0 && !gDvmJit.blockingMode)
+                    usleep(pauseMs * 1000);
 #if defined(WITH_JIT_TUNING)
-                gDvmJit.jitTime += dvmGetRelativeTimeUsec() - startTime;
+                gDvmJit.jitTime += endTime - startTime;
 #endif
                 dvmLockMutex(&gDvmJit.compilerLock);
             } while (workQueueLength() != 0);
@@ -733,6 +1439,100 @@ static void *compilerThreadStart(void *arg)
     }
     pthread_cond_signal(&gDvmJit.compilerQueueEmpty);
     dvmUnlockMutex(&gDvmJit.compilerLock);
+}
+
+static void *compilerHelperStart(void *arg)
+{
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
+
+    if (dvmCompilerHeapInit()) {
+        compilerWorkLoop(false);
+    }
+
+    dvmChangeStatus(NULL, THREAD_RUNNING);
+    return NULL;
+}
+
+/*
+ * Start the compiler threads beyond the first, now that the code cache
+ * is set up.
+ */
+static void startCompilerHelpers(void)
+{
+    gDvmJit.numCompilerHelpers = 0;
+    for (unsigned int i = 1; i < gDvmJit.numCompilerThreads; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Compiler %d", i);
+        if (!dvmCreateInternalThread(
+                &gDvmJit.compilerHelperHandles[gDvmJit.numCompilerHelpers],
+                name, compilerHelperStart, NULL)) {
+            ALOGW("Unable to start compiler thread %d", i);
+            break;
+        }
+        gDvmJit.numCompilerHelpers++;
+    }
+}
+
+static void *compilerThreadStart(void *arg)
+{
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
+
+    /*
+     * If we're not running stand-alone, wait a little before
+     * recieving translation requests on the assumption that process start
+     * up code isn't worth compiling.  We'll resume when the framework
+     * signals us that the first screen draw has happened, or the timer
+     * below expires (to catch daemons).
+     *
+     * There is a theoretical race between the callback to
+     * VMRuntime.startJitCompiation and when the compiler thread reaches this
+     * point. In case the callback happens earlier, in order not to permanently
+     * hold the system_server (which is not using the timed wait) in
+     * interpreter-only mode we bypass the delay here.
+     */
+    if (gDvmJit.runningInAndroidFramework &&
+        !gDvmJit.alreadyEnabledViaFramework) {
+        /*
+         * If the current VM instance is the system server (detected by having
+         * 0 in gDvm.systemServerPid), we will use the indefinite wait on the
+         * conditional variable to determine whether to start the JIT or not.
+         * If the system server detects that the whole system is booted in
+         * safe mode, the conditional variable will never be signaled and the
+         * system server will remain in the interpreter-only mode. All
+         * subsequent apps will be started with the --enable-safemode flag
+         * explicitly appended.
+         */
+        if (gDvm.systemServerPid == 0) {
+            dvmLockMutex(&gDvmJit.compilerLock);
+            pthread_cond_wait(&gDvmJit.compilerQueueActivity,
+                              &gDvmJit.compilerLock);
+            dvmUnlockMutex(&gDvmJit.compilerLock);
+            ALOGD("JIT started for system_server");
+        } else {
+            dvmLockMutex(&gDvmJit.compilerLock);
+            /*
+             * TUNING: experiment with the delay & perhaps make it
+             * target-specific
+             */
+            dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
+                                 &gDvmJit.compilerLock, 3000, 0);
+            dvmUnlockMutex(&gDvmJit.compilerLock);
+        }
+        if (gDvmJit.haltCompilerThread) {
+             return NULL;
+        }
+    }
+
+    compilerThreadStartup();
+    startCompilerHelpers();
+
+    compilerWorkLoop(true);
+
+    for (unsigned int i = 0; i < gDvmJit.numCompilerHelpers; i++) {
+        if (pthread_join(gDvmJit.compilerHelperHandles[i], NULL) != 0)
+            ALOGW("Compiler thread %d join failed", i + 1);
+    }
+    gDvmJit.numCompilerHelpers = 0;
 
     /*
      * As part of detaching the thread we need to call into Java code to update
@@ -750,6 +1550,7 @@ bool dvmCompilerStartup(void)
 {
 
     dvmInitMutex(&gDvmJit.compilerLock);
+    dvmInitMutex(&gDvmJit.compilerInstallLock);
     dvmInitMutex(&gDvmJit.compilerICPatchLock);
     dvmInitMutex(&gDvmJit.codeCacheProtectionLock);
     dvmLockMutex(&gDvmJit.compilerLock);
@@ -757,10 +1558,21 @@ bool dvmCompilerStartup(void)
     dvmInitCondForTimedWait(&gDvmJit.compilerQueueEmpty);
 
     /* Reset the work queue */
-    gDvmJit.compilerWorkEnqueueIndex = gDvmJit.compilerWorkDequeueIndex = 0;
     gDvmJit.compilerQueueLength = 0;
+    gDvmJit.compilerWorkSequence = 0;
     dvmUnlockMutex(&gDvmJit.compilerLock);
 
+    /* Pick up the hot traces of the last run */
+    if (gDvmJit.traceFile != NULL) {
+        dvmJitProfileStartup(gDvmJit.traceFile);
+    }
+
+    dvmJitSamplerStartup();
+    return true;
+}
+
+bool dvmCompilerStartThread(void)
+{
     /*
      * Defer rest of initialization until we're sure JIT'ng makes sense. Launch
      * the compiler thread, which will do the real initialization if and
@@ -779,6 +1591,11 @@ void dvmCompilerShutdown(void)
     gDvmJit.pProfTableCopy = NULL;
     dvmJitUpdateThreadStateAll();
 
+    /* Remember the hot traces for the next run */
+    dvmJitProfileSave();
+
+    dvmJitSamplerStop();
+
     if (gDvm.verboseShutdown ||
             gDvmJit.profileMode == kTraceProfilingContinuous) {
         dvmCompilerDumpStats();
@@ -790,8 +1607,9 @@ void dvmCompilerShutdown(void)
 
         gDvmJit.haltCompilerThread = true;
 
+        /* Wake up all of the compiler threads */
         dvmLockMutex(&gDvmJit.compilerLock);
-        pthread_cond_signal(&gDvmJit.compilerQueueActivity);
+        pthread_cond_broadcast(&gDvmJit.compilerQueueActivity);
         dvmUnlockMutex(&gDvmJit.compilerLock);
 
         if (pthread_join(gDvmJit.compilerHandle, &threadReturn) != 0)
@@ -26,15 +26,33 @@
  */
 
 #define COMPILER_WORK_QUEUE_SIZE        100
-#define COMPILER_IC_PATCH_QUEUE_SIZE    64
+#define COMPILER_MAX_THREADS            4
+#define COMPILER_IC_PATCH_QUEUE_SIZE    256
 #define COMPILER_PC_OFFSET_SIZE         100
 
+/*
+ * The code cache past the templates is split into regions that are filled
+ * in turn.  Once they are all full, the region whose translations ran the
+ * least since the last eviction is emptied and refilled instead of
+ * resetting the whole cache.
+ */
+#define JIT_CODE_CACHE_REGIONS          4
+#define JIT_MAX_CODE_CACHE_REGIONS      8
+
+/*
+ * Writes to the code cache made between two syncs, after which the pages
+ * written are made read-only again and the queued flushes are done.
+ */
+#define JIT_CODE_CACHE_WRITE_BATCH      16
+
 /* Architectural-independent parameters for predicted chains */
 #define PREDICTED_CHAIN_CLAZZ_INIT       0
 #define PREDICTED_CHAIN_METHOD_INIT      0
 #define PREDICTED_CHAIN_COUNTER_INIT     0
 /* A fake value which will avoid initialization and won't match any class */
 #define PREDICTED_CHAIN_FAKE_CLAZZ       0xdeadc001
+/* Marks a cell that misses until its queued patch is applied */
+#define PREDICTED_CHAIN_RETIRED_CLAZZ    0xdeadc002
 /* Has to be positive */
 #define PREDICTED_CHAIN_COUNTER_AVOID    0x7fffffff
 /* Rechain after this many misses - shared globally and has to be positive */
@@ -48,23 +66,17 @@
 #define PROTECT_CODE_CACHE_ATTRS       (PROT_READ | PROT_EXEC)
 #define UNPROTECT_CODE_CACHE_ATTRS     (PROT_READ | PROT_EXEC | PROT_WRITE)
 
-/* Acquire the lock before removing PROT_WRITE from the specified mem region */
+/*
+ * Acquire the lock and make the specified mem region writable.  The pages
+ * are left writable by PROTECT_CODE_CACHE until the batch of writes is
+ * synced, so a region already writable takes no mprotect.
+ */
 #define UNPROTECT_CODE_CACHE(addr, size)                                       \
-    {                                                                          \
-        dvmLockMutex(&gDvmJit.codeCacheProtectionLock);                        \
-        mprotect((void *) (((intptr_t) (addr)) & ~gDvmJit.pageSizeMask),       \
-                 (size) + (((intptr_t) (addr)) & gDvmJit.pageSizeMask),        \
-                 (UNPROTECT_CODE_CACHE_ATTRS));                                \
-    }
-
-/* Add the PROT_WRITE to the specified memory region then release the lock */
+    dvmCompilerUnprotectCodeCache((void *) (addr), (size))
+
+/* Count the write to the specified mem region then release the lock */
 #define PROTECT_CODE_CACHE(addr, size)                                         \
-    {                                                                          \
-        mprotect((void *) (((intptr_t) (addr)) & ~gDvmJit.pageSizeMask),       \
-                 (size) + (((intptr_t) (addr)) & gDvmJit.pageSizeMask),        \
-                 (PROTECT_CODE_CACHE_ATTRS));                                  \
-        dvmUnlockMutex(&gDvmJit.codeCacheProtectionLock);                      \
-    }
+    dvmCompilerProtectCodeCache((void *) (addr), (size))
 
 #define SINGLE_STEP_OP(opcode)                                                 \
     (gDvmJit.includeSelectedOp !=                                              \
@@ -88,6 +100,8 @@ typedef struct JitTranslationInfo {
     bool methodCompilationAborted;  // Cannot compile the whole method
     Thread *requestingThread;   // For debugging purpose
     int cacheVersion;           // Used to identify stale trace requests
+    bool holdsInstallLock;      // See dvmCompilerLockInstall()
+    bool isBaseline;            // Quick translation, to be recompiled if hot
 } JitTranslationInfo;
 
 typedef enum WorkOrderKind {
@@ -96,6 +110,7 @@ typedef enum WorkOrderKind {
     kWorkOrderTrace = 2,        // Work is to compile code fragment(s)
     kWorkOrderTraceDebug = 3,   // Work is to compile/debug code fragment(s)
     kWorkOrderProfileMode = 4,  // Change profiling mode
+    kWorkOrderTraceRecompile = 5,   // Recompile a hot baseline trace in full
 } WorkOrderKind;
 
 typedef struct CompilerWorkOrder {
@@ -104,6 +119,9 @@ typedef struct CompilerWorkOrder {
     void* info;
     JitTranslationInfo result;
     jmp_buf *bailPtr;
+    int priority;               // Raised each time the trace is hot again
+    unsigned int sequence;      // Orders of equal priority are FIFO
+    u8 enqueueTime;             // For the queue latency stats
 } CompilerWorkOrder;
 
 /* Chain cell for predicted method invocation */
@@ -119,6 +137,14 @@ typedef struct PredictedChainingCell {
     const ClassObject *stagedClazz;   /* possible next key for prediction */
 } PredictedChainingCell;
 
+/* A region of the code cache; the offsets are from gDvmJit.codeCache */
+typedef struct JitCodeCacheRegion {
+    unsigned int start;
+    unsigned int end;
+    unsigned int top;           /* Where the next translation goes */
+    unsigned int generation;    /* When the region was last emptied */
+} JitCodeCacheRegion;
+
 /* Work order for inline cache patching */
 typedef struct ICPatchWorkOrder {
     PredictedChainingCell *cellAddr;    /* Address to be patched */
@@ -162,9 +188,13 @@ typedef enum JitMethodAttributes {
 /* Vectors to provide optimization hints */
 typedef enum JitOptimizationHints {
     kJitOptNoLoop = 0,          // Disable loop formation/optimization
+    kJitOptBaseline,            // No loops, inlining or LIR optimizations
+    kJitOptReplace,             // Replace the trace's current translation
 } JitOptimizationHints;
 
 #define JIT_OPT_NO_LOOP         (1 << kJitOptNoLoop)
+#define JIT_OPT_BASELINE        (1 << kJitOptBaseline)
+#define JIT_OPT_REPLACE         (1 << kJitOptReplace)
 
 /* Customized node traversal orders for different needs */
 typedef enum DataFlowAnalysisMode {
@@ -194,9 +224,12 @@ bool dvmCompilerSetupCodeCache(void);
 bool dvmCompilerArchInit(void);
 void dvmCompilerArchDump(void);
 bool dvmCompilerStartup(void);
+bool dvmCompilerStartThread(void);
 void dvmCompilerShutdown(void);
 void dvmCompilerForceWorkEnqueue(const u2* pc, WorkOrderKind kind, void* info);
 bool dvmCompilerWorkEnqueue(const u2* pc, WorkOrderKind kind, void* info);
+void dvmCompilerBoostWorkOrder(const u2* pc);
+void dvmCompilerLockInstall(JitTranslationInfo *info);
 void *dvmCheckCodeCache(void *method);
 CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
                                                   bool isCallee);
@@ -207,10 +240,20 @@ bool dvmCompileTrace(JitTraceDescription *trace, int numMaxInsts,
                      JitTranslationInfo *info, jmp_buf *bailPtr, int optHints);
 void dvmCompilerDumpStats(void);
 void dvmCompilerDrainQueue(void);
+int dvmCompilerTraceHints(WorkOrderKind kind);
 void dvmJitUnchainAll(void);
+void dvmJitUnchainRange(const char *start, const char *end);
+void dvmJitUnchainReplaced(const struct JitEntry *entry);
+char *dvmCompilerCodeCacheAddr(unsigned int size);
+bool dvmCompilerCodeCacheCommit(char *addr, unsigned int size);
+void dvmCompilerUnprotectCodeCache(void *addr, size_t size);
+void dvmCompilerProtectCodeCache(void *addr, size_t size);
+void dvmCompilerQueueCacheFlush(uintptr_t start, uintptr_t end);
+void dvmCompilerSyncCodeCache(void);
 void dvmJitScanAllClassPointers(void (*callback)(void *ptr));
 void dvmCompilerSortAndPrintTraceProfiles(void);
 void dvmCompilerPerformSafePointChecks(void);
+bool dvmCompilerChainingCellsQuiescent(void);
 void dvmCompilerInlineMIR(struct CompilationUnit *cUnit,
                           JitTranslationInfo *info);
 void dvmInitializeSSAConversion(struct CompilationUnit *cUnit);
@@ -218,6 +261,8 @@ int dvmConvertSSARegToDalvik(const struct CompilationUnit *cUnit, int ssaReg);
 bool dvmCompilerLoopOpt(struct CompilationUnit *cUnit);
 void dvmCompilerInsertBackwardChaining(struct CompilationUnit *cUnit);
 void dvmCompilerNonLoopAnalysis(struct CompilationUnit *cUnit);
+void dvmCompilerFindDeadWritebacks(struct CompilationUnit *cUnit);
+void dvmCompilerFindUnneededCardMarks(struct CompilationUnit *cUnit);
 bool dvmCompilerFindLocalLiveIn(struct CompilationUnit *cUnit,
                                 struct BasicBlock *bb);
 bool dvmCompilerDoSSAConversion(struct CompilationUnit *cUnit,
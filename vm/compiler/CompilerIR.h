@@ -107,6 +107,9 @@ typedef enum {
     kMIRInlinedPred,                    // Invoke is inlined via prediction
     kMIRCallee,                         // Instruction is inlined from callee
     kMIRInvokeMethodJIT,                // Callee is JIT'ed as a whole method
+    kMIRUnsafeIntrinsic,                // Invoke is expanded in place
+    kMIRArrayClone,                     // Invoke is an array's clone()
+    kMIRIgnoreCardMark,                 // Reference store needs no card mark
 } MIROptimizationFlagPositons;
 
 #define MIR_IGNORE_NULL_CHECK           (1 << kMIRIgnoreNullCheck)
@@ -117,6 +120,21 @@ typedef enum {
 #define MIR_INLINED_PRED                (1 << kMIRInlinedPred)
 #define MIR_CALLEE                      (1 << kMIRCallee)
 #define MIR_INVOKE_METHOD_JIT           (1 << kMIRInvokeMethodJIT)
+#define MIR_UNSAFE_INTRINSIC            (1 << kMIRUnsafeIntrinsic)
+#define MIR_ARRAY_CLONE                 (1 << kMIRArrayClone)
+#define MIR_IGNORE_CARD_MARK            (1 << kMIRIgnoreCardMark)
+
+/*
+ * The sun.misc.Unsafe calls that are expanded at the invoke, for those that
+ * take too many argument words for execute-inline.  An invoke flagged with
+ * MIR_UNSAFE_INTRINSIC holds one of these in vB.
+ */
+typedef enum UnsafeIntrinsic {
+    kUnsafeCasInt,                      // compareAndSwapInt
+    kUnsafeCasObject,                   // compareAndSwapObject
+    kUnsafePutOrderedInt,               // putOrderedInt
+    kUnsafePutOrderedObject,            // putOrderedObject
+} UnsafeIntrinsic;
 
 typedef struct CallsiteInfo {
     const char *classDescriptor;
@@ -213,6 +231,7 @@ typedef struct CompilationUnit {
     int numClassPointers;
     LIR *chainCellOffsetLIR;
     GrowableList pcReconstructionList;
+    GrowableList nullFaultList;         // Accesses doing the null check
     int headerSize;                     // bytes before the first code ptr
     int dataOffset;                     // starting offset of literal pool
     int totalSize;                      // header + code size
@@ -225,6 +244,7 @@ typedef struct CompilationUnit {
     bool hasClassLiterals;              // Contains class ptrs used as literals
     bool hasLoop;                       // Contains a loop
     bool hasInvoke;                     // Contains an invoke instruction
+    bool isBaseline;                    // Skip the LIR optimizations
     bool heapMemOp;                     // Mark mem ops for self verification
     bool usesLinkRegister;              // For self-verification only
     int profileCodeSize;                // Size of the profile prefix in bytes
@@ -275,6 +295,7 @@ typedef struct CompilationUnit {
     BitVector *tempBlockV;
     BitVector *tempDalvikRegisterV;
     BitVector *tempSSARegisterV;        // numSSARegs
+    BitVector *deadDefSRegV;            // numSSARegs, defs not written back
     bool printSSANames;
     void *blockLabelList;
     bool quitLoopMode;                  // cold path/complex bytecode
@@ -22,6 +22,16 @@
 /* Each arena page has some overhead, so take a few bytes off 8k */
 #define ARENA_DEFAULT_SIZE 8100
 
+/*
+ * Requests bigger than a default block get one of their own.  Those of
+ * up to ARENA_LARGE_MIN << (ARENA_LARGE_BUCKETS - 1) bytes are rounded
+ * up to a power of two, and up to ARENA_LARGE_RETAIN bytes of them are
+ * kept by each compiler thread after a compilation.
+ */
+#define ARENA_LARGE_MIN     16384
+#define ARENA_LARGE_BUCKETS 8
+#define ARENA_LARGE_RETAIN  (512 * 1024)
+
 /* Allocate the initial memory block for arena-based allocation */
 bool dvmCompilerHeapInit(void);
 
@@ -216,11 +216,11 @@ int dvmCompilerDataFlowAttributes[kMirOpLast] = {
     // 3D OP_IF_LEZ vAA, +BBBB
     DF_UA,
 
-    // 3E OP_UNUSED_3E
-    DF_NOP,
+    // 3E OP_IGET_QUICK_IF_EQZ
+    DF_DA | DF_UB | DF_IS_GETTER,
 
-    // 3F OP_UNUSED_3F
-    DF_NOP,
+    // 3F OP_CONST_4_ADD_INT
+    DF_DA | DF_SETS_CONST,
 
     // 40 OP_UNUSED_40
     DF_NOP,
@@ -1416,21 +1416,29 @@ bool dvmCompilerDoConstantPropagation(CompilationUnit *cUnit, BasicBlock *bb)
     return true;
 }
 
+/*
+ * The update of an induction variable can be in any block of the loop, but
+ * its phi is always in the loop head.  A dependent induction variable can be
+ * seen before the one it depends on, so this is meant to be run iteratively
+ * and returns true whenever it finds a new one.
+ */
 bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
                                        struct BasicBlock *bb)
 {
     BitVector *isIndVarV = cUnit->loopAnalysis->isIndVarV;
     BitVector *isConstantV = cUnit->isConstantV;
     GrowableList *ivList = cUnit->loopAnalysis->ivList;
+    BasicBlock *loopHead = cUnit->entryBlock->fallThrough;
+    bool changed = false;
     MIR *mir;
 
     if (bb->blockType != kDalvikByteCode && bb->blockType != kEntryBlock) {
         return false;
     }
 
-    /* If the bb doesn't have a phi it cannot contain an induction variable */
-    if (bb->firstMIRInsn == NULL ||
-        (int)bb->firstMIRInsn->dalvikInsn.opcode != (int)kMirOpPhi) {
+    /* Without a phi in the loop head there is no induction variable */
+    if (loopHead == NULL || loopHead->firstMIRInsn == NULL ||
+        (int)loopHead->firstMIRInsn->dalvikInsn.opcode != (int)kMirOpPhi) {
         return false;
     }
 
@@ -1441,6 +1449,9 @@ bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
 
         if (!(dfAttributes & DF_IS_LINEAR)) continue;
 
+        /* Already found on an earlier pass */
+        if (dvmIsBitSet(isIndVarV, mir->ssaRep->uses[0])) continue;
+
         /*
          * For a basic induction variable:
          *   1) use[0] should belong to the output of a phi node
@@ -1448,7 +1459,7 @@ bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
          *   3) the value added/subtracted is a constant
          */
         MIR *phi;
-        for (phi = bb->firstMIRInsn; phi; phi = phi->next) {
+        for (phi = loopHead->firstMIRInsn; phi; phi = phi->next) {
             if ((int)phi->dalvikInsn.opcode != (int)kMirOpPhi) break;
 
             if (phi->ssaRep->defs[0] == mir->ssaRep->uses[0] &&
@@ -1493,6 +1504,7 @@ bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
                     ivInfo->inc = deltaValue;
                     dvmInsertGrowableList(ivList, (intptr_t) ivInfo);
                     cUnit->loopAnalysis->numBasicIV++;
+                    changed = true;
                     break;
                 }
             }
@@ -1574,10 +1586,11 @@ bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
                 ivInfo->c = c + ivInfoOld->c;
                 ivInfo->inc = ivInfoOld->inc;
                 dvmInsertGrowableList(ivList, (intptr_t) ivInfo);
+                changed = true;
             }
         }
     }
-    return true;
+    return changed;
 }
 
 /* Setup the basic data structures for SSA conversion */
@@ -1744,3 +1757,315 @@ void dvmCompilerNonLoopAnalysis(CompilationUnit *cUnit)
                                           kAllNodes,
                                           false /* isIterative */);
 }
+
+/*
+ * Add the registers the verifier found live before the instruction at
+ * "offset" to "live".  Returns false if the liveness map has no line for
+ * it.
+ */
+static bool addVerifierLiveness(CompilationUnit *cUnit, unsigned int offset,
+                                BitVector *live)
+{
+    u1 buf[kRegMapMaxRegWidth];
+    const u1 *line = dvmRegisterMapGetLine(cUnit->method->liveMap, offset,
+                                           buf);
+    int i;
+
+    if (line == NULL) return false;
+    for (i = 0; i < cUnit->numDalvikRegisters; i++) {
+        if (line[i >> 3] & (1 << (i & 0x07))) {
+            dvmCompilerSetBit(live, i);
+        }
+    }
+    return true;
+}
+
+/* Add what must be in the frame on entry to "succ" to "live" */
+static void addSuccessorLiveIn(CompilationUnit *cUnit, BasicBlock *succ,
+                               BitVector **liveInV, BitVector *live)
+{
+    if (succ == NULL) return;
+    switch (succ->blockType) {
+        case kDalvikByteCode:
+            dvmUnifyBitVectors(live, live, liveInV[succ->id]);
+            break;
+        case kChainingCellInvokeSingleton:
+        case kChainingCellInvokePredicted:
+            /* Covered by the invoke's own GC point */
+            break;
+        case kChainingCellNormal:
+        case kChainingCellHot:
+        case kChainingCellBackwardBranch:
+            if (addVerifierLiveness(cUnit, succ->startOffset, live)) break;
+            /* Fall through */
+        default:
+            dvmCompilerMarkAllBits(live, true);
+            break;
+    }
+}
+
+/*
+ * Compute the Dalvik registers that must be in the frame before block "bb"
+ * into "live", and if "markDead" is set, note the definitions in it that
+ * nothing reads.  Returns true if the block's live-in set changed.
+ */
+static bool findBlockWritebacks(CompilationUnit *cUnit, BasicBlock *bb,
+                                BitVector **liveInV, BitVector *live,
+                                BitVector *lineV, bool markDead)
+{
+    MIR *mir;
+    int i;
+
+    dvmCompilerMarkAllBits(live, false);
+    addSuccessorLiveIn(cUnit, bb->taken, liveInV, live);
+    addSuccessorLiveIn(cUnit, bb->fallThrough, liveInV, live);
+    if (bb->successorBlockList.blockListType != kNotUsed) {
+        GrowableListIterator iterator;
+        dvmGrowableListIteratorInit(&bb->successorBlockList.blocks,
+                                    &iterator);
+        while (true) {
+            SuccessorBlockInfo *successorBlockInfo =
+                (SuccessorBlockInfo *) dvmGrowableListIteratorNext(&iterator);
+            if (successorBlockInfo == NULL) break;
+            addSuccessorLiveIn(cUnit, successorBlockInfo->block, liveInV,
+                               live);
+        }
+    }
+
+    for (mir = bb->lastMIRInsn; mir != NULL; mir = mir->prev) {
+        SSARepresentation *ssaRep = mir->ssaRep;
+        int opcode = mir->dalvikInsn.opcode;
+
+        /*
+         * Extended MIRs and inlined callees don't map onto the method's
+         * own instructions, so keep everything they might need.
+         */
+        if (opcode >= kMirOpFirst || ssaRep == NULL ||
+            (mir->OptimizationFlags &
+             (MIR_INLINED | MIR_INLINED_PRED | MIR_CALLEE))) {
+            dvmCompilerMarkAllBits(live, true);
+            continue;
+        }
+
+        int flags = dexGetFlagsFromOpcode((Opcode) opcode);
+        dvmCompilerMarkAllBits(lineV, false);
+        bool haveLine = addVerifierLiveness(cUnit, mir->offset, lineV);
+
+        /*
+         * A branch or invoke defines no registers, so whatever is live
+         * after it is live before it too, and the verifier has already
+         * worked that out for the whole method.
+         */
+        if (haveLine && mir == bb->lastMIRInsn && ssaRep->numDefs == 0 &&
+            (flags & (kInstrCanBranch | kInstrCanSwitch | kInstrInvoke))) {
+            dvmCompilerMarkAllBits(live, false);
+        }
+
+        for (i = 0; i < ssaRep->numDefs; i++) {
+            int reg = DECODE_REG(dvmConvertSSARegToDalvik(cUnit,
+                                                          ssaRep->defs[i]));
+            if (markDead && !dvmIsBitSet(live, reg)) {
+                dvmCompilerSetBit(cUnit->deadDefSRegV, ssaRep->defs[i]);
+            }
+            dvmCompilerClearBit(live, reg);
+        }
+        for (i = 0; i < ssaRep->numUses; i++) {
+            int reg = DECODE_REG(dvmConvertSSARegToDalvik(cUnit,
+                                                          ssaRep->uses[i]));
+            dvmCompilerSetBit(live, reg);
+        }
+
+        /*
+         * The trace can leave for the interpreter at any instruction that
+         * may throw, branch or return; those are the verifier's GC points.
+         */
+        if (haveLine) {
+            dvmUnifyBitVectors(live, live, lineV);
+        } else if (flags & VERIFY_GC_INST_MASK) {
+            dvmCompilerMarkAllBits(live, true);
+        }
+    }
+
+    if (dvmCompareBitVectors(live, liveInV[bb->id])) {
+        dvmCopyBitVector(liveInV[bb->id], live);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Find the definitions in a non-loop trace that never need to be written
+ * back to the Dalvik frame, using the liveness the verifier recorded for
+ * the method: a value is dead if nothing later in the trace reads it and
+ * the verifier finds it dead wherever the trace can leave.  The result is
+ * "cUnit->deadDefSRegV", by SSA name, which dvmCompilerLiveOut() consults.
+ */
+void dvmCompilerFindDeadWritebacks(CompilationUnit *cUnit)
+{
+    const GrowableList *blockList = &cUnit->blockList;
+    int numRegs = cUnit->numDalvikRegisters;
+    int numBlocks = blockList->numUsed;
+    int i;
+
+    if (cUnit->method->liveMap == NULL ||
+        numRegs != cUnit->method->registersSize) {
+        return;
+    }
+
+    BitVector **liveInV =
+        (BitVector **) dvmCompilerNew(sizeof(BitVector *) * numBlocks, true);
+    for (i = 0; i < numBlocks; i++) {
+        BasicBlock *bb =
+            (BasicBlock *) dvmGrowableListGetElement(blockList, i);
+        if (bb->blockType == kDalvikByteCode) {
+            liveInV[bb->id] = dvmCompilerAllocBitVector(numRegs, false);
+        }
+    }
+    BitVector *live = dvmCompilerAllocBitVector(numRegs, false);
+    BitVector *lineV = dvmCompilerAllocBitVector(numRegs, false);
+    cUnit->deadDefSRegV = dvmCompilerAllocBitVector(cUnit->numSSARegs, false);
+
+    /* Blocks only link forward, so working backwards settles quickly */
+    bool markDead = false;
+    while (true) {
+        bool change = false;
+        for (i = numBlocks - 1; i >= 0; i--) {
+            BasicBlock *bb =
+                (BasicBlock *) dvmGrowableListGetElement(blockList, i);
+            if (bb->blockType != kDalvikByteCode || bb->hidden) continue;
+            change |= findBlockWritebacks(cUnit, bb, liveInV, live, lineV,
+                                          markDead);
+        }
+        if (markDead) break;
+        if (!change) markDead = true;
+    }
+}
+
+/*
+ * Returns true if nothing the instruction calls out to can suspend the
+ * thread, so that the GC can't start between it and the next one.  Those
+ * that throw leave the trace for the interpreter, and don't come back.
+ */
+static bool cannotSuspend(int opcode)
+{
+    return (opcode >= OP_MOVE && opcode <= OP_MOVE_OBJECT_16) ||
+           (opcode >= OP_CONST_4 && opcode <= OP_CONST_WIDE_HIGH16) ||
+           opcode == OP_ARRAY_LENGTH ||
+           (opcode >= OP_CMPL_FLOAT && opcode <= OP_CMP_LONG) ||
+           (opcode >= OP_AGET && opcode <= OP_SPUT_SHORT) ||
+           (opcode >= OP_NEG_INT && opcode <= OP_USHR_INT_LIT8) ||
+           (opcode >= OP_IGET_VOLATILE && opcode <= OP_SPUT_WIDE_VOLATILE) ||
+           (opcode >= OP_IGET_QUICK && opcode <= OP_IPUT_OBJECT_QUICK) ||
+           (opcode >= OP_IPUT_OBJECT_VOLATILE &&
+            opcode <= OP_SPUT_OBJECT_VOLATILE);
+}
+
+/*
+ * Flag the reference stores in "bb" whose card mark can be left out:
+ * those that store a null constant, and those into an object allocated
+ * earlier in the block that has not been seen by anything else since.
+ * Such an object is reachable only from this thread's registers, and as
+ * long as the thread hasn't passed a point where the GC could have
+ * started and scanned it, the GC finds whatever it holds when it reaches
+ * the object, because the object is unmarked.  "nullV" and "freshV" are
+ * by SSA name.
+ */
+static void findBlockCardMarks(CompilationUnit *cUnit, BasicBlock *bb,
+                               BitVector *nullV, BitVector *freshV,
+                               bool trackFresh)
+{
+    MIR *mir;
+    int i;
+
+    dvmClearAllBits(nullV);
+    dvmClearAllBits(freshV);
+    for (mir = bb->firstMIRInsn; mir != NULL; mir = mir->next) {
+        SSARepresentation *ssaRep = mir->ssaRep;
+        int opcode = mir->dalvikInsn.opcode;
+
+        if (opcode >= kMirOpFirst || ssaRep == NULL) {
+            dvmClearAllBits(freshV);
+            continue;
+        }
+
+        int valueUse = -1;
+        int objectUse = -1;
+        switch (opcode) {
+            case OP_IPUT_OBJECT:
+            case OP_IPUT_OBJECT_QUICK:
+            case OP_IPUT_OBJECT_VOLATILE:
+            case OP_APUT_OBJECT:
+                valueUse = 0;
+                objectUse = 1;
+                break;
+            case OP_SPUT_OBJECT:
+            case OP_SPUT_OBJECT_VOLATILE:
+                valueUse = 0;
+                break;
+            default:
+                break;
+        }
+        if (valueUse >= 0 && ssaRep->numUses > MAX(valueUse, objectUse)) {
+            if (dvmIsBitSet(nullV, ssaRep->uses[valueUse]) ||
+                (objectUse >= 0 &&
+                 dvmIsBitSet(freshV, ssaRep->uses[objectUse]))) {
+                mir->OptimizationFlags |= MIR_IGNORE_CARD_MARK;
+                gDvmJit.numCardMarksElided++;
+            }
+        }
+
+        /* Any other use may let a fresh object escape */
+        if (!cannotSuspend(opcode)) {
+            dvmClearAllBits(freshV);
+        } else {
+            for (i = 0; i < ssaRep->numUses; i++) {
+                if (i != objectUse) {
+                    dvmClearBit(freshV, ssaRep->uses[i]);
+                }
+            }
+        }
+
+        if (ssaRep->numDefs == 0) continue;
+        switch (opcode) {
+            case OP_CONST_4:
+            case OP_CONST_16:
+            case OP_CONST:
+            case OP_CONST_HIGH16:
+                if (mir->dalvikInsn.vB == 0) {
+                    dvmCompilerSetBit(nullV, ssaRep->defs[0]);
+                }
+                break;
+            case OP_NEW_INSTANCE:
+            case OP_NEW_ARRAY:
+                if (trackFresh) {
+                    dvmCompilerSetBit(freshV, ssaRep->defs[0]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/*
+ * Flag the reference stores whose card marks aren't needed with
+ * MIR_IGNORE_CARD_MARK.  Each block is worked on alone, as the SSA names
+ * of a non-loop trace are only exact within a block.  A sticky GC starts
+ * from a copy of the live bits that may take in an object allocated
+ * while it is made, as if it were old, so fresh objects aren't tracked
+ * when sticky GCs are enabled.
+ */
+void dvmCompilerFindUnneededCardMarks(CompilationUnit *cUnit)
+{
+    const GrowableList *blockList = &cUnit->blockList;
+    int i;
+
+    BitVector *nullV = dvmCompilerAllocBitVector(cUnit->numSSARegs, false);
+    BitVector *freshV = dvmCompilerAllocBitVector(cUnit->numSSARegs, false);
+    for (i = 0; i < blockList->numUsed; i++) {
+        BasicBlock *bb =
+            (BasicBlock *) dvmGrowableListGetElement(blockList, i);
+        if (bb->blockType != kDalvikByteCode || bb->hidden) continue;
+        findBlockCardMarks(cUnit, bb, nullV, freshV, !gDvm.stickyGc);
+    }
+}
@@ -47,6 +47,8 @@ static inline int parseInsn(const u2 *codePtr, DecodedInstruction *decInsn,
     Opcode opcode = dexOpcodeFromCodeUnit(instr);
 
     dexDecodeInstruction(codePtr, decInsn);
+    /* The second instruction of a superinstruction pair is left in place */
+    decInsn->opcode = dexGetBaseOpcode(decInsn->opcode);
     if (printMe) {
         char *decodedString = dvmCompilerGetDalvikDisassembly(decInsn, NULL);
         ALOGD("%p: %#06x %s", codePtr, opcode, decodedString);
@@ -205,8 +207,9 @@ static int compareMethod(const CompilerMethodStats *m1,
  * - is getter/setter?
  * - can throw exception?
  *
- * Currently the inliner only handles getters and setters. When its capability
- * becomes more sophisticated more information will be retrieved here.
+ * Besides getters and setters the inliner takes small leaf methods that
+ * cannot throw. When its capability becomes more sophisticated more
+ * information will be retrieved here.
  */
 static int analyzeInlineTarget(DecodedInstruction *dalvikInsn, int attributes,
                                int offset)
@@ -283,6 +286,8 @@ CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
 
     /* For lookup only */
     dummyMethodEntry.method = method;
+    /* Shared by the compiler threads */
+    dvmHashTableLock(gDvmJit.methodStatsTable);
     realMethodEntry = (CompilerMethodStats *)
         dvmHashTableLookup(gDvmJit.methodStatsTable,
                            hashValue,
@@ -301,6 +306,7 @@ CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
                            (HashCompareFunc) compareMethod,
                            true);
     }
+    dvmHashTableUnlock(gDvmJit.methodStatsTable);
 
     /* This method is invoked as a callee and has been analyzed - just return */
     if ((isCallee == true) && (realMethodEntry->attributes & METHOD_IS_CALLEE))
@@ -1190,6 +1196,7 @@ bool dvmCompileMethod(const Method *method, JitTranslationInfo *info)
      */
     /* Initialize the PC reconstruction list */
     dvmInitGrowableList(&cUnit.pcReconstructionList, 8);
+    dvmInitGrowableList(&cUnit.nullFaultList, 4);
 
     /* Allocate the bit-vector to track the beginning of basic blocks */
     BitVector *tryBlockAddr = dvmCompilerAllocBitVector(dexCode->insnsSize,
@@ -1344,7 +1351,7 @@ bool dvmCompileMethod(const Method *method, JitTranslationInfo *info)
 
         if (info->codeAddress) {
             dvmJitSetCodeAddr(dexCode->insns, info->codeAddress,
-                              info->instructionSet, true, 0);
+                              info->instructionSet, true, 0, false);
             /*
              * Clear the codeAddress for the enclosing trace to reuse the info
              */
@@ -1469,6 +1476,7 @@ static bool compileLoop(CompilationUnit *cUnit, unsigned int startOffset,
 
     /* Initialize the PC reconstruction list */
     dvmInitGrowableList(&cUnit->pcReconstructionList, 8);
+    dvmInitGrowableList(&cUnit->nullFaultList, 4);
 
     /* Create the default entry and exit blocks and enter them to the list */
     BasicBlock *entryBlock = dvmCompilerNewBB(kEntryBlock, numBlocks++);
@@ -1532,6 +1540,10 @@ static bool compileLoop(CompilationUnit *cUnit, unsigned int startOffset,
 
     dvmCompilerLoopOpt(cUnit);
 
+    if (!(gDvmJit.disableOpt & (1 << kCardMarkElision))) {
+        dvmCompilerFindUnneededCardMarks(cUnit);
+    }
+
     /*
      * Change the backward branch to the backward chaining cell after dataflow
      * analsys/optimizations are done.
@@ -1628,6 +1640,132 @@ static bool searchClassTablePrefix(const Method* method) {
     return false;
 }
 
+/*
+ * Mark the successors of a block that a method region may take in: the
+ * target of a forward branch and the instruction that follows one that can
+ * continue.  Switches and invokes always leave through chaining cells.
+ */
+static void markRegionSuccessors(const Method *method, MIR *lastInsn,
+                                 BitVector *regionStarts)
+{
+    unsigned int insnsSize = dvmGetMethodInsnsSize(method);
+    unsigned int curOffset = lastInsn->offset;
+    unsigned int targetOffset = UNKNOWN_TARGET;
+    unsigned int fallThroughOffset = curOffset + lastInsn->width;
+    bool isInvoke = false;
+    const Method *callee = NULL;
+    int flags = dexGetFlagsFromOpcode(lastInsn->dalvikInsn.opcode);
+
+    if (flags & (kInstrCanSwitch | kInstrInvoke)) {
+        return;
+    }
+    findBlockBoundary(method, lastInsn, curOffset, &targetOffset, &isInvoke,
+                      &callee);
+    if ((flags & kInstrCanBranch) && targetOffset != UNKNOWN_TARGET &&
+        targetOffset > curOffset && targetOffset < insnsSize) {
+        dvmCompilerSetBit(regionStarts, targetOffset);
+    }
+    if ((flags & kInstrCanContinue) && fallThroughOffset < insnsSize) {
+        dvmCompilerSetBit(regionStarts, fallThroughOffset);
+    }
+}
+
+/*
+ * Grow a trace that starts at the method entry into all of the method that
+ * can be reached from it through forward control flow, so that a method with
+ * many branches becomes one translation instead of a trace per path.  The
+ * new blocks are parsed in offset order and end before invokes, which need
+ * the callsite information only a trace run provides, and before backward
+ * branches, which are left to the loop compiler.  Both, like anything else
+ * outside the region, are reached through chaining cells.
+ */
+static void extendMethodRegion(CompilationUnit *cUnit, int *numBlocks,
+                               int numMaxInsts, int *traceSize)
+{
+    const Method *method = cUnit->method;
+    unsigned int insnsSize = dvmGetMethodInsnsSize(method);
+    GrowableList *blockList = &cUnit->blockList;
+    BitVector *regionStarts = dvmCompilerAllocBitVector(insnsSize, false);
+    BitVector *blockStarts = dvmCompilerAllocBitVector(insnsSize, false);
+    size_t blockId;
+
+    for (blockId = 0; blockId < blockList->numUsed; blockId++) {
+        BasicBlock *bb =
+            (BasicBlock *) dvmGrowableListGetElement(blockList, blockId);
+        if (bb->lastMIRInsn == NULL) {
+            continue;
+        }
+        dvmCompilerSetBit(blockStarts, bb->startOffset);
+        markRegionSuccessors(method, bb->lastMIRInsn, regionStarts);
+    }
+
+    /* Successors are always at higher offsets, so one pass finds them all */
+    for (unsigned int offset = 0; offset < insnsSize; offset++) {
+        if (!dvmIsBitSet(regionStarts, offset) ||
+            dvmIsBitSet(blockStarts, offset)) {
+            continue;
+        }
+        if (cUnit->numInsts >= numMaxInsts) {
+            break;
+        }
+        BasicBlock *bb = NULL;
+        unsigned int curOffset = offset;
+        while (cUnit->numInsts < numMaxInsts) {
+            MIR *insn = (MIR *) dvmCompilerNew(sizeof(MIR), true);
+            insn->offset = curOffset;
+            int width = parseInsn(method->insns + curOffset, &insn->dalvikInsn,
+                                  cUnit->printMe);
+
+            /* Terminate when the data section is seen */
+            if (width == 0) {
+                break;
+            }
+            insn->width = width;
+
+            int flags = dexGetFlagsFromOpcode(insn->dalvikInsn.opcode);
+            if (flags & kInstrInvoke) {
+                break;
+            }
+            if (flags & kInstrCanBranch) {
+                unsigned int targetOffset = UNKNOWN_TARGET;
+                bool isInvoke = false;
+                const Method *callee = NULL;
+                findBlockBoundary(method, insn, curOffset, &targetOffset,
+                                  &isInvoke, &callee);
+                if (targetOffset <= curOffset) {
+                    break;
+                }
+            }
+
+            if (bb == NULL) {
+                bb = dvmCompilerNewBB(kDalvikByteCode, (*numBlocks)++);
+                bb->startOffset = offset;
+                dvmInsertGrowableList(blockList, (intptr_t) bb);
+                dvmCompilerSetBit(blockStarts, offset);
+            }
+            dvmCompilerAppendMIR(bb, insn);
+            cUnit->numInsts++;
+            *traceSize += width;
+            curOffset += width;
+
+            if ((flags & (kInstrCanBranch | kInstrCanSwitch |
+                          kInstrCanReturn)) != 0 ||
+                (flags & kInstrCanContinue) == 0) {
+                break;
+            }
+            /* The next instruction starts a block of its own */
+            if (curOffset >= insnsSize ||
+                dvmIsBitSet(regionStarts, curOffset) ||
+                dvmIsBitSet(blockStarts, curOffset)) {
+                break;
+            }
+        }
+        if (bb != NULL) {
+            markRegionSuccessors(method, bb->lastMIRInsn, regionStarts);
+        }
+    }
+}
+
 /*
  * Main entry point to start trace compilation. Basic blocks are constructed
  * first and they will be passed to the codegen routines to convert Dalvik
@@ -1650,12 +1788,14 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
     static int compilationId;
     CompilationUnit cUnit;
     GrowableList *blockList;
+    bool methodRegion;
 #if defined(WITH_JIT_TUNING)
     CompilerMethodStats *methodStats;
 #endif
 
     /* If we've already compiled this trace, just return success */
-    if (dvmJitGetTraceAddr(startCodePtr) && !info->discardResult) {
+    if (dvmJitGetTraceAddr(startCodePtr) && !info->discardResult &&
+        (optHints & JIT_OPT_REPLACE) == 0) {
         /*
          * Make sure the codeAddress is NULL so that it won't clobber the
          * existing entry.
@@ -1683,6 +1823,10 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
     /* Initialize the printMe flag */
     cUnit.printMe = gDvmJit.printMe;
 
+    /* A baseline translation skips the passes that cost the most */
+    cUnit.isBaseline = (optHints & JIT_OPT_BASELINE) != 0;
+    info->isBaseline = cUnit.isBaseline;
+
     /* Setup the method */
     cUnit.method = desc->method;
 
@@ -1692,6 +1836,7 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
 
     /* Initialize the PC reconstruction list */
     dvmInitGrowableList(&cUnit.pcReconstructionList, 8);
+    dvmInitGrowableList(&cUnit.nullFaultList, 4);
 
     /* Initialize the basic block list */
     blockList = &cUnit.blockList;
@@ -1877,6 +2022,18 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
         }
     }
 
+    /*
+     * A hot trace at the entry of a small enough method takes in the rest of
+     * the method's forward code.
+     */
+    methodRegion = startOffset == 0 && !cUnit.allSingleStep &&
+                   gDvmJit.methodRegionSize > 0 &&
+                   dvmGetMethodInsnsSize(desc->method) <=
+                       (unsigned int) gDvmJit.methodRegionSize;
+    if (methodRegion) {
+        extendMethodRegion(&cUnit, &numBlocks, numMaxInsts, &traceSize);
+    }
+
 #if defined(WITH_JIT_TUNING)
     /* Convert # of half-word to bytes */
     methodStats->compiledDalvikSize += traceSize * 2;
@@ -1917,15 +2074,20 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
         if (isInvoke == false &&
             (flags & kInstrCanBranch) != 0 &&
             targetOffset < curOffset &&
-            (optHints & JIT_OPT_NO_LOOP) == 0) {
+            (optHints & (JIT_OPT_NO_LOOP | JIT_OPT_BASELINE)) == 0) {
             dvmCompilerArenaReset();
             return compileLoop(&cUnit, startOffset, desc, numMaxInsts,
                                info, bailPtr, optHints);
         }
 
-        /* No backward branch in the trace - start searching the next BB */
+        /*
+         * No backward branch in the trace - start searching the next BB.  The
+         * blocks of a method region aren't in execution order, but as all of
+         * their links go forward they can safely be searched from the start.
+         */
         size_t searchBlockId;
-        for (searchBlockId = blockId+1; searchBlockId < blockList->numUsed;
+        for (searchBlockId = methodRegion ? 0 : blockId+1;
+             searchBlockId < blockList->numUsed;
              searchBlockId++) {
             searchBB = (BasicBlock *) dvmGrowableListGetElement(blockList,
                                                                 searchBlockId);
@@ -2095,7 +2257,8 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
     cUnit.instructionSet = dvmCompilerInstructionSet();
 
     /* Inline transformation @ the MIR level */
-    if (cUnit.hasInvoke && !(gDvmJit.disableOpt & (1 << kMethodInlining))) {
+    if (cUnit.hasInvoke && !cUnit.isBaseline &&
+        !(gDvmJit.disableOpt & (1 << kMethodInlining))) {
         dvmCompilerInlineMIR(&cUnit, info);
     }
 
@@ -2106,6 +2269,17 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
 
     dvmCompilerNonLoopAnalysis(&cUnit);
 
+#if !defined(WITH_SELF_VERIFICATION)
+    /* The self-verifier compares the whole frame, dead values included */
+    if (!(gDvmJit.disableOpt & (1 << kDeadWritebacks))) {
+        dvmCompilerFindDeadWritebacks(&cUnit);
+    }
+#endif
+
+    if (!(gDvmJit.disableOpt & (1 << kCardMarkElision))) {
+        dvmCompilerFindUnneededCardMarks(&cUnit);
+    }
+
 #ifndef ARCH_IA32
     dvmCompilerInitializeRegAlloc(&cUnit);  // Needs to happen after SSA naming
 #endif
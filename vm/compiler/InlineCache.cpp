@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "compiler/InlineCache.h"
+
+/* The miss count at which those of a site are halved */
+#define IC_SITE_MAX_MISSES      256
+
+struct ICSite {
+    const PredictedChainingCell *cell;  /* NULL if the slot is free */
+    const ClassObject *classes[JIT_IC_SITE_CLASSES];
+    u4 misses[JIT_IC_SITE_CLASSES];
+    u2 numClasses;
+    bool megamorphic;
+};
+
+/*
+ * An open-addressed table keyed by cell address, allocated on the first
+ * miss.  It is guarded by gDvmJit.compilerICPatchLock, which the miss
+ * path takes anyway to queue the patch.
+ */
+static ICSite *gSites;
+static int gNumSites;
+static u4 gNumPatched;
+static u4 gNumKept;
+static u4 gNumMegamorphicMisses;
+
+static inline u4 siteHash(const PredictedChainingCell *cell)
+{
+    return ((uintptr_t) cell >> 4) & (JIT_IC_SITE_TABLE_SIZE - 1);
+}
+
+/*
+ * Returns the site of "cell", adding it if need be, or NULL if the table
+ * is too full to take it.
+ */
+static ICSite *findSite(const PredictedChainingCell *cell)
+{
+    u4 idx = siteHash(cell);
+    for (int i = 0; i < JIT_IC_SITE_TABLE_SIZE; i++) {
+        ICSite *site = &gSites[idx];
+        if (site->cell == cell) {
+            return site;
+        }
+        if (site->cell == NULL) {
+            /* Keep the probe sequences short */
+            if (gNumSites >= JIT_IC_SITE_TABLE_SIZE * 3 / 4) {
+                return NULL;
+            }
+            site->cell = cell;
+            gNumSites++;
+            return site;
+        }
+        idx = (idx + 1) & (JIT_IC_SITE_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+static int findClass(const ICSite *site, const ClassObject *clazz)
+{
+    for (int i = 0; i < site->numClasses; i++) {
+        if (site->classes[i] == clazz) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+JitICSiteDecision dvmJitICSiteRechain(const PredictedChainingCell *cell,
+                                      const ClassObject *clazz)
+{
+    JitICSiteDecision decision = kJitICSitePatch;
+
+    dvmLockMutex(&gDvmJit.compilerICPatchLock);
+    if (gSites == NULL) {
+        gSites = (ICSite *) calloc(JIT_IC_SITE_TABLE_SIZE, sizeof(ICSite));
+    }
+    ICSite *site = gSites == NULL ? NULL : findSite(cell);
+    if (site == NULL) {
+        /* Untracked sites behave as they always have */
+        goto done;
+    }
+
+    if (!site->megamorphic) {
+        int slot = findClass(site, clazz);
+        if (slot < 0) {
+            if (site->numClasses == JIT_IC_SITE_CLASSES) {
+                site->megamorphic = true;
+            } else {
+                slot = site->numClasses++;
+                site->classes[slot] = clazz;
+                site->misses[slot] = 0;
+            }
+        }
+        if (slot >= 0) {
+            if (++site->misses[slot] == IC_SITE_MAX_MISSES) {
+                /* Age the counts so that a change of phase is followed */
+                for (int i = 0; i < site->numClasses; i++) {
+                    site->misses[i] >>= 1;
+                }
+            }
+            int predicted = findClass(site, cell->clazz);
+            if (predicted >= 0 && predicted != slot &&
+                site->misses[slot] < 2 * site->misses[predicted]) {
+                decision = kJitICSiteKeep;
+            }
+        }
+    }
+    if (site->megamorphic) {
+        decision = kJitICSiteMegamorphic;
+    }
+
+done:
+    switch (decision) {
+        case kJitICSitePatch:
+            gNumPatched++;
+            break;
+        case kJitICSiteKeep:
+            gNumKept++;
+            break;
+        case kJitICSiteMegamorphic:
+            gNumMegamorphicMisses++;
+            break;
+    }
+    dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
+    return decision;
+}
+
+void dvmJitICSiteForget(const char *start, const char *end)
+{
+    if (gSites == NULL || gNumSites == 0) {
+        return;
+    }
+    if (start == NULL) {
+        memset(gSites, 0, JIT_IC_SITE_TABLE_SIZE * sizeof(ICSite));
+        gNumSites = 0;
+        return;
+    }
+
+    /*
+     * Removing entries would break the probe sequences of the others, so
+     * the survivors are rehashed into a fresh table.
+     */
+    ICSite *oldSites = gSites;
+    gSites = (ICSite *) calloc(JIT_IC_SITE_TABLE_SIZE, sizeof(ICSite));
+    gNumSites = 0;
+    if (gSites == NULL) {
+        free(oldSites);
+        return;
+    }
+    for (int i = 0; i < JIT_IC_SITE_TABLE_SIZE; i++) {
+        const char *cellAddr = (const char *) oldSites[i].cell;
+        if (cellAddr == NULL || (cellAddr >= start && cellAddr < end)) {
+            continue;
+        }
+        ICSite *site = findSite(oldSites[i].cell);
+        *site = oldSites[i];
+    }
+    free(oldSites);
+}
+
+void dvmJitICSiteDumpStats(void)
+{
+    int byClasses[JIT_IC_SITE_CLASSES + 1] = { 0 };
+    int numMegamorphic = 0;
+
+    dvmLockMutex(&gDvmJit.compilerICPatchLock);
+    if (gSites != NULL) {
+        for (int i = 0; i < JIT_IC_SITE_TABLE_SIZE; i++) {
+            if (gSites[i].cell == NULL) {
+                continue;
+            }
+            if (gSites[i].megamorphic) {
+                numMegamorphic++;
+            } else {
+                byClasses[gSites[i].numClasses]++;
+            }
+        }
+    }
+    dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
+
+    ALOGD("Inline cache sites: %d/%d/%d/%d with 1/2/3/4 classes, "
+          "%d megamorphic", byClasses[1], byClasses[2], byClasses[3],
+          byClasses[4], numMegamorphic);
+    ALOGD("Inline cache misses: %d patched, %d kept, %d megamorphic",
+          gNumPatched, gNumKept, gNumMegamorphicMisses);
+}
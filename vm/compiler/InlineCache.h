@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Per-site record of the receiver classes seen by the predicted chaining
+ * cells of virtual and interface invokes, used to keep polymorphic sites
+ * from being repatched back and forth.
+ */
+#ifndef DALVIK_VM_COMPILER_INLINECACHE_H_
+#define DALVIK_VM_COMPILER_INLINECACHE_H_
+
+/* The number of distinct receiver classes tracked per site */
+#define JIT_IC_SITE_CLASSES     4
+
+/* The number of sites tracked; must be a power of 2 */
+#define JIT_IC_SITE_TABLE_SIZE  1024
+
+enum JitICSiteDecision {
+    kJitICSitePatch,            /* predict the new class */
+    kJitICSiteKeep,             /* keep the class predicted now */
+    kJitICSiteMegamorphic,      /* too many classes, stop trying */
+};
+
+/*
+ * Called when a predicted chaining cell misses on "clazz".  The cell is
+ * repatched to predict "clazz" if it is new, or if "clazz" has missed
+ * at least twice as often as the class it predicts now, so that a site
+ * alternating between two classes isn't patched on every rechain.  A
+ * site that sees more than JIT_IC_SITE_CLASSES classes is megamorphic
+ * and keeps its cell for good.
+ */
+JitICSiteDecision dvmJitICSiteRechain(const PredictedChainingCell *cell,
+                                      const ClassObject *clazz);
+
+/*
+ * Forgets the sites whose cells lie in [start, end), or all of them if
+ * start is NULL.  Must be called with gDvmJit.compilerICPatchLock held.
+ */
+void dvmJitICSiteForget(const char *start, const char *end);
+
+/*
+ * Logs how polymorphic the tracked sites are.
+ */
+void dvmJitICSiteDumpStats(void);
+
+#endif  // DALVIK_VM_COMPILER_INLINECACHE_H_
@@ -18,6 +18,9 @@
 #include "Dataflow.h"
 #include "libdex/DexOpcodes.h"
 
+/* The largest leaf callee, in code units, that is inlined as a whole */
+#define INLINE_LEAF_MAX_CODE_UNITS  16
+
 /* Convert the reg id from the callee to the original id passed by the caller */
 static inline u4 convertRegId(const DecodedInstruction *invoke,
                               const Method *calleeMethod,
@@ -222,6 +225,265 @@ static bool inlineSetter(CompilationUnit *cUnit,
     return true;
 }
 
+/*
+ * Returns the caller register holding callee register "calleeRegId", or -1
+ * if it isn't an argument or a register that has been given a slot.
+ */
+static int mapLeafRegId(const DecodedInstruction *invoke,
+                        const Method *calleeMethod, const int *slotMap,
+                        u4 calleeRegId, bool isRange)
+{
+    if (slotMap[calleeRegId] >= 0) {
+        return slotMap[calleeRegId];
+    }
+    if (calleeRegId < (u4) (calleeMethod->registersSize -
+                            calleeMethod->insSize)) {
+        return -1;
+    }
+    return convertRegId(invoke, calleeMethod, calleeRegId, isRange);
+}
+
+static MIR *newCalleeMIR(const Method *calleeMethod, MIR *invokeMIR,
+                         const DecodedInstruction *insn)
+{
+    MIR *newMIR = (MIR *)dvmCompilerNew(sizeof(MIR), true);
+    newMIR->dalvikInsn = *insn;
+    newMIR->width = dexGetWidthFromOpcode(insn->opcode);
+    newMIR->OptimizationFlags |= MIR_CALLEE;
+    newMIR->offset = invokeMIR->offset;
+    newMIR->meta.calleeMethod = calleeMethod;
+    return newMIR;
+}
+
+/*
+ * Inline a straight-line leaf callee that cannot throw.  The callee's
+ * arguments are read from the caller's argument registers, while the
+ * registers it writes are given the move-result destination, which is
+ * dead until the call returns.  Callees that need more scratch registers
+ * than the result provides are left alone.
+ */
+static bool inlineLeafMethod(CompilationUnit *cUnit,
+                             const Method *calleeMethod,
+                             MIR *invokeMIR,
+                             BasicBlock *invokeBB,
+                             bool isPredicted,
+                             bool isRange)
+{
+    const DexCode *dexCode = dvmGetMethodCode(calleeMethod);
+    const DecodedInstruction *invoke = &invokeMIR->dalvikInsn;
+    DecodedInstruction insns[INLINE_LEAF_MAX_CODE_UNITS];
+    int numInsns = 0;
+    u4 offset = 0;
+
+    /* Decode the body, which must fall through to a single return */
+    while (true) {
+        if (numInsns == INLINE_LEAF_MAX_CODE_UNITS ||
+            offset >= dexCode->insnsSize) {
+            return false;
+        }
+        DecodedInstruction *insn = &insns[numInsns++];
+        insn->vC = 0;
+        dexDecodeInstruction(dexCode->insns + offset, insn);
+        insn->opcode = dexGetBaseOpcode(insn->opcode);
+        int flags = dexGetFlagsFromOpcode(insn->opcode);
+        int dfFlags = dvmCompilerDataFlowAttributes[insn->opcode];
+        if ((flags & (kInstrCanBranch | kInstrCanSwitch | kInstrCanThrow |
+                      kInstrInvoke)) ||
+            (dfFlags & (DF_FORMAT_35C | DF_FORMAT_3RC)) ||
+            SINGLE_STEP_OP(insn->opcode) ||
+            !dvmCompilerCanIncludeThisInstruction(calleeMethod, insn)) {
+            return false;
+        }
+        offset += dexGetWidthFromOpcode(insn->opcode);
+        if (flags & kInstrCanReturn) {
+            break;
+        }
+    }
+
+    /* The caller registers that can be written: the move-result's */
+    BasicBlock *moveResultBB = invokeBB->fallThrough;
+    MIR *moveResultMIR = moveResultBB ? moveResultBB->firstMIRInsn : NULL;
+    int numScratch = 0;
+    if (moveResultMIR != NULL) {
+        switch (moveResultMIR->dalvikInsn.opcode) {
+            case OP_MOVE_RESULT:
+            case OP_MOVE_RESULT_OBJECT:
+                numScratch = 1;
+                break;
+            case OP_MOVE_RESULT_WIDE:
+                numScratch = 2;
+                break;
+            default:
+                moveResultMIR = NULL;
+                break;
+        }
+    }
+    DecodedInstruction *retInsn = &insns[numInsns - 1];
+    if (retInsn->opcode == OP_RETURN_VOID_BARRIER ||
+        (retInsn->opcode != OP_RETURN_VOID && moveResultMIR == NULL)) {
+        return false;
+    }
+    int resultReg = moveResultMIR ? (int) moveResultMIR->dalvikInsn.vA : -1;
+
+    /* The scratch registers mustn't hold an argument still to be read */
+    for (int i = 0; i < (int) invoke->vA; i++) {
+        int argReg = isRange ? invoke->vC + i : invoke->arg[i];
+        if (argReg >= resultReg && argReg < resultReg + numScratch) {
+            return false;
+        }
+    }
+
+    /* Give a scratch register to each callee register that is written */
+    int numRegs = calleeMethod->registersSize;
+    int firstArg = numRegs - calleeMethod->insSize;
+    bool *isWritten = (bool *)dvmCompilerNew(numRegs * sizeof(bool), true);
+    bool *isWideArg = (bool *)dvmCompilerNew(numRegs * sizeof(bool), true);
+    int *slotMap = (int *)dvmCompilerNew(numRegs * sizeof(int), false);
+    for (int i = 0; i < numInsns; i++) {
+        int dfFlags = dvmCompilerDataFlowAttributes[insns[i].opcode];
+        if (dfFlags & DF_DA) {
+            isWritten[insns[i].vA] = true;
+        } else if (dfFlags & DF_DA_WIDE) {
+            isWritten[insns[i].vA] = true;
+            isWritten[insns[i].vA + 1] = true;
+        }
+    }
+    /* Wide arguments are copied in as a whole */
+    const char *shorty = calleeMethod->shorty + 1;
+    int argReg = firstArg;
+    if (!dvmIsStaticMethod(calleeMethod)) {
+        argReg++;
+    }
+    for (; *shorty != '\0'; shorty++) {
+        if (*shorty == 'J' || *shorty == 'D') {
+            isWideArg[argReg] = true;
+            if (isWritten[argReg] || isWritten[argReg + 1]) {
+                isWritten[argReg] = isWritten[argReg + 1] = true;
+            }
+            argReg += 2;
+        } else {
+            argReg++;
+        }
+    }
+    int numSlots = 0;
+    for (int i = 0; i < numRegs; i++) {
+        if (!isWritten[i]) {
+            slotMap[i] = -1;
+        } else if (numSlots == numScratch) {
+            return false;
+        } else {
+            slotMap[i] = resultReg + numSlots++;
+        }
+    }
+
+    /* Rewrite the body in terms of the caller's registers */
+    for (int i = 0; i < numInsns; i++) {
+        DecodedInstruction *insn = &insns[i];
+        int dfFlags = dvmCompilerDataFlowAttributes[insn->opcode];
+        int reg;
+        if (dfFlags & DF_A_IS_REG) {
+            reg = mapLeafRegId(invoke, calleeMethod, slotMap, insn->vA,
+                               isRange);
+            if (reg < 0) return false;
+            insn->vA = reg;
+        }
+        if (dfFlags & DF_B_IS_REG) {
+            reg = mapLeafRegId(invoke, calleeMethod, slotMap, insn->vB,
+                               isRange);
+            if (reg < 0) return false;
+            insn->vB = reg;
+        }
+        if (dfFlags & DF_C_IS_REG) {
+            reg = mapLeafRegId(invoke, calleeMethod, slotMap, insn->vC,
+                               isRange);
+            if (reg < 0) return false;
+            insn->vC = reg;
+        }
+    }
+
+    /* Past this point the inlining can't fail */
+    MIR *lastMIR = invokeMIR;
+
+    /* Copy in the arguments that the callee writes */
+    for (int i = firstArg; i < numRegs; i++) {
+        if (slotMap[i] < 0) {
+            continue;
+        }
+        DecodedInstruction moveInsn;
+        memset(&moveInsn, 0, sizeof(moveInsn));
+        moveInsn.opcode = isWideArg[i] ? OP_MOVE_WIDE : OP_MOVE;
+        moveInsn.vA = slotMap[i];
+        moveInsn.vB = convertRegId(invoke, calleeMethod, i, isRange);
+        MIR *moveMIR = newCalleeMIR(calleeMethod, invokeMIR, &moveInsn);
+        dvmCompilerInsertMIRAfter(invokeBB, lastMIR, moveMIR);
+        lastMIR = moveMIR;
+        if (isWideArg[i]) {
+            i++;
+        }
+    }
+
+    for (int i = 0; i < numInsns - 1; i++) {
+        MIR *newMIR = newCalleeMIR(calleeMethod, invokeMIR, &insns[i]);
+        dvmCompilerInsertMIRAfter(invokeBB, lastMIR, newMIR);
+        lastMIR = newMIR;
+    }
+
+    /* The return becomes a move into the result */
+    if (retInsn->opcode != OP_RETURN_VOID &&
+        (int) retInsn->vA != resultReg) {
+        DecodedInstruction moveInsn;
+        memset(&moveInsn, 0, sizeof(moveInsn));
+        moveInsn.opcode = retInsn->opcode == OP_RETURN_WIDE ? OP_MOVE_WIDE :
+                          retInsn->opcode == OP_RETURN_OBJECT ?
+                          OP_MOVE_OBJECT : OP_MOVE;
+        moveInsn.vA = resultReg;
+        moveInsn.vB = retInsn->vA;
+        MIR *moveMIR = newCalleeMIR(calleeMethod, invokeMIR, &moveInsn);
+        dvmCompilerInsertMIRAfter(invokeBB, lastMIR, moveMIR);
+        lastMIR = moveMIR;
+    }
+
+    if (isPredicted) {
+        MIR *invokeMIRSlow = (MIR *)dvmCompilerNew(sizeof(MIR), true);
+        *invokeMIRSlow = *invokeMIR;
+        invokeMIR->dalvikInsn.opcode = (Opcode)kMirOpCheckInlinePrediction;
+
+        /* Use vC to denote the first argument (ie this) */
+        if (!isRange) {
+            invokeMIR->dalvikInsn.vC = invokeMIRSlow->dalvikInsn.arg[0];
+        }
+
+        if (moveResultMIR != NULL) {
+            moveResultMIR->OptimizationFlags |= MIR_INLINED_PRED;
+        }
+
+        dvmCompilerInsertMIRAfter(invokeBB, lastMIR, invokeMIRSlow);
+        invokeMIRSlow->OptimizationFlags |= MIR_INLINED_PRED;
+#if defined(WITH_JIT_TUNING)
+        gDvmJit.invokePolyLeafInlined++;
+#endif
+    } else {
+        invokeMIR->OptimizationFlags |= MIR_INLINED;
+        if (moveResultMIR != NULL) {
+            moveResultMIR->OptimizationFlags |= MIR_INLINED;
+        } else {
+            invokeBB->needFallThroughBranch = true;
+        }
+#if defined(WITH_JIT_TUNING)
+        gDvmJit.invokeMonoLeafInlined++;
+#endif
+    }
+
+    return true;
+}
+
+static bool isInlinableLeaf(const CompilerMethodStats *methodStats)
+{
+    int leafThrowFree = METHOD_IS_LEAF | METHOD_IS_THROW_FREE;
+    return (methodStats->attributes & leafThrowFree) == leafThrowFree &&
+           methodStats->dalvikSize <= INLINE_LEAF_MAX_CODE_UNITS * 2;
+}
+
 static bool tryInlineSingletonCallsite(CompilationUnit *cUnit,
                                        const Method *calleeMethod,
                                        MIR *invokeMIR,
@@ -252,6 +514,9 @@ static bool tryInlineSingletonCallsite(CompilationUnit *cUnit,
     } else if (methodStats->attributes & METHOD_IS_SETTER) {
         return inlineSetter(cUnit, calleeMethod, invokeMIR, invokeBB, false,
                             isRange);
+    } else if (isInlinableLeaf(methodStats)) {
+        return inlineLeafMethod(cUnit, calleeMethod, invokeMIR, invokeBB,
+                                false, isRange);
     }
     return false;
 }
@@ -270,14 +535,121 @@ static bool inlineEmptyVirtualCallee(CompilationUnit *cUnit,
     return true;
 }
 
+/*
+ * The sun.misc.Unsafe natives that are expanded at the invoke, and the
+ * instruction sets whose codegen knows how.  The CAS needs LDREX/STREX
+ * on ARM; MIPS calls out for it.
+ */
+static const struct {
+    const char *name;
+    const char *signature;
+    UnsafeIntrinsic intrinsic;
+    bool needsCas;
+} unsafeIntrinsics[] = {
+    { "compareAndSwapInt", "(Ljava/lang/Object;JII)Z", kUnsafeCasInt, true },
+    { "compareAndSwapObject",
+      "(Ljava/lang/Object;JLjava/lang/Object;Ljava/lang/Object;)Z",
+      kUnsafeCasObject, true },
+    { "putOrderedInt", "(Ljava/lang/Object;JI)V", kUnsafePutOrderedInt,
+      false },
+    { "putOrderedObject", "(Ljava/lang/Object;JLjava/lang/Object;)V",
+      kUnsafePutOrderedObject, false },
+};
+
+/*
+ * Expand a call to one of the natives above in place.  Unsafe is final, so
+ * the predicted callee is the only possible one and the invoke needs no
+ * class check, just the null check on "this" that codegen emits.  The
+ * arguments stay where the invoke has them; a result goes to retval and
+ * the move-result in the next block picks it up as usual.
+ */
+static bool inlineUnsafeIntrinsic(CompilationUnit *cUnit,
+                                  const Method *calleeMethod,
+                                  MIR *invokeMIR,
+                                  BasicBlock *invokeBB)
+{
+    if (cUnit->instructionSet != DALVIK_JIT_THUMB2 &&
+        cUnit->instructionSet != DALVIK_JIT_THUMB &&
+        cUnit->instructionSet != DALVIK_JIT_MIPS)
+        return false;
+
+    if (!dvmIsFinalClass(calleeMethod->clazz) ||
+        strcmp(calleeMethod->clazz->descriptor, "Lsun/misc/Unsafe;") != 0)
+        return false;
+
+    for (size_t i = 0; i < NELEM(unsafeIntrinsics); i++) {
+        if (unsafeIntrinsics[i].needsCas &&
+            cUnit->instructionSet == DALVIK_JIT_THUMB)
+            continue;
+        if (dvmCompareNameDescriptorAndMethod(unsafeIntrinsics[i].name,
+                unsafeIntrinsics[i].signature, calleeMethod) != 0)
+            continue;
+
+        /* Use vB to denote the intrinsic */
+        invokeMIR->dalvikInsn.vB = unsafeIntrinsics[i].intrinsic;
+        invokeMIR->OptimizationFlags |= MIR_UNSAFE_INTRINSIC;
+        invokeBB->needFallThroughBranch = true;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Turn a clone() of an array into a direct call to dvmCloneObject().  The
+ * method reference has to name an array class: arrays have no subclasses,
+ * so the receiver is that array or null and Object.clone() is what the
+ * invoke reaches.  The quickened invokes have lost the reference and are
+ * left alone.
+ */
+static bool inlineArrayClone(CompilationUnit *cUnit,
+                             const Method *calleeMethod,
+                             MIR *invokeMIR,
+                             BasicBlock *invokeBB)
+{
+#if defined(WITH_SELF_VERIFICATION)
+    /* The failure path throws through TEMPLATE_THROW_EXCEPTION_COMMON */
+    return false;
+#else
+    if (cUnit->instructionSet != DALVIK_JIT_THUMB2 &&
+        cUnit->instructionSet != DALVIK_JIT_THUMB &&
+        cUnit->instructionSet != DALVIK_JIT_MIPS)
+        return false;
+
+    Opcode opcode = invokeMIR->dalvikInsn.opcode;
+    if (opcode != OP_INVOKE_VIRTUAL && opcode != OP_INVOKE_VIRTUAL_RANGE)
+        return false;
+
+    if (calleeMethod->clazz != gDvm.classJavaLangObject ||
+        dvmCompareNameDescriptorAndMethod("clone", "()Ljava/lang/Object;",
+                                          calleeMethod) != 0)
+        return false;
+
+    const DexFile *dexFile = cUnit->method->clazz->pDvmDex->pDexFile;
+    const DexMethodId *methodId =
+        dexGetMethodId(dexFile, invokeMIR->dalvikInsn.vB);
+    if (dexStringByTypeIdx(dexFile, methodId->classIdx)[0] != '[')
+        return false;
+
+    invokeMIR->OptimizationFlags |= MIR_ARRAY_CLONE;
+    invokeBB->needFallThroughBranch = true;
+    return true;
+#endif
+}
+
 static bool tryInlineVirtualCallsite(CompilationUnit *cUnit,
                                      const Method *calleeMethod,
                                      MIR *invokeMIR,
                                      BasicBlock *invokeBB,
                                      bool isRange)
 {
+    if (inlineArrayClone(cUnit, calleeMethod, invokeMIR, invokeBB))
+        return true;
+
     /* Not a Java method */
-    if (dvmIsNativeMethod(calleeMethod)) return false;
+    if (dvmIsNativeMethod(calleeMethod)) {
+        return inlineUnsafeIntrinsic(cUnit, calleeMethod, invokeMIR,
+                                     invokeBB);
+    }
 
     CompilerMethodStats *methodStats =
         dvmCompilerAnalyzeMethodBody(calleeMethod, true);
@@ -294,6 +666,9 @@ static bool tryInlineVirtualCallsite(CompilationUnit *cUnit,
     } else if (methodStats->attributes & METHOD_IS_SETTER) {
         return inlineSetter(cUnit, calleeMethod, invokeMIR, invokeBB, true,
                             isRange);
+    } else if (isInlinableLeaf(methodStats)) {
+        return inlineLeafMethod(cUnit, calleeMethod, invokeMIR, invokeBB,
+                                true, isRange);
     }
     return false;
 }
@@ -301,12 +676,12 @@ static bool tryInlineVirtualCallsite(CompilationUnit *cUnit,
 
 void dvmCompilerInlineMIR(CompilationUnit *cUnit, JitTranslationInfo *info)
 {
-    bool isRange = false;
     GrowableListIterator iterator;
 
     dvmGrowableListIteratorInit(&cUnit->blockList, &iterator);
     /*
-     * Analyze the basic block containing an invoke to see if it can be inlined
+     * Analyze each basic block ending with an invoke to see if it can be
+     * inlined.  Traces that followed a callee have more than one.
      */
     while (true) {
         BasicBlock *bb = (BasicBlock *) dvmGrowableListIteratorNext(&iterator);
@@ -314,6 +689,8 @@ void dvmCompilerInlineMIR(CompilationUnit *cUnit, JitTranslationInfo *info)
         if (bb->blockType != kDalvikByteCode)
             continue;
         MIR *lastMIRInsn = bb->lastMIRInsn;
+        if (lastMIRInsn == NULL)
+            continue;
         Opcode opcode = lastMIRInsn->dalvikInsn.opcode;
         int flags = (int)dexGetFlagsFromOpcode(opcode);
 
@@ -333,6 +710,7 @@ void dvmCompilerInlineMIR(CompilationUnit *cUnit, JitTranslationInfo *info)
             continue;
 
         const Method *calleeMethod;
+        bool isRange = false;
 
         switch (opcode) {
             case OP_INVOKE_SUPER:
@@ -378,7 +756,7 @@ void dvmCompilerInlineMIR(CompilationUnit *cUnit, JitTranslationInfo *info)
                     }
                 }
             }
-            return;
+            continue;
         }
 
         switch (opcode) {
@@ -423,7 +801,7 @@ void dvmCompilerInlineMIR(CompilationUnit *cUnit, JitTranslationInfo *info)
                     }
                 }
             }
-            return;
+            continue;
         }
     }
 }
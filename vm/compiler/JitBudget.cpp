@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "interp/Jit.h"
+#include "compiler/JitBudget.h"
+
+struct JitBudget {
+    /* The threshold the target asked for, which is never gone below */
+    int baseThreshold;
+
+    /* The window being measured, on the dvmGetRelativeTimeUsec() clock */
+    u8 windowStart;
+    u8 windowCpuNsec;
+    u8 windowStartBytes;
+
+    /* The outcome of the last complete window */
+    u4 lastCpuPermille;
+    u4 lastKBPerSec;
+
+    u8 totalCpuNsec;
+    u4 numRaised;
+    u4 numLowered;
+    u4 numPauses;
+};
+
+/*
+ * Updated by all the compiler threads, and read by whoever dumps the
+ * stats, so it has a lock of its own.
+ */
+static pthread_mutex_t gBudgetLock;
+static JitBudget gBudget;
+
+static bool budgetEnabled(void)
+{
+    return gDvmJit.compileBudgetPercent != 0 ||
+           gDvmJit.codeCacheBudgetKBPerSec != 0;
+}
+
+void dvmJitBudgetStartup(void)
+{
+    dvmInitMutex(&gBudgetLock);
+    gBudget.baseThreshold = gDvmJit.threshold;
+    gBudget.windowStart = dvmGetRelativeTimeUsec();
+    gBudget.windowStartBytes = gDvmJit.codeCacheBytesCommitted;
+}
+
+/*
+ * Closes the window if it has lasted long enough and returns the new
+ * threshold, or -1 if it is to stay as it is.  Must be called with
+ * gBudgetLock held.
+ */
+static int endWindow(u8 now)
+{
+    u8 elapsedUsec = now - gBudget.windowStart;
+    if (elapsedUsec < JIT_BUDGET_WINDOW_MS * 1000LL) {
+        return -1;
+    }
+    u8 bytes = gDvmJit.codeCacheBytesCommitted - gBudget.windowStartBytes;
+    gBudget.lastCpuPermille = (u4) (gBudget.windowCpuNsec / elapsedUsec);
+    gBudget.lastKBPerSec = (u4) (bytes * 1000000 / elapsedUsec / 1024);
+    gBudget.windowStart = now;
+    gBudget.windowCpuNsec = 0;
+    gBudget.windowStartBytes = gDvmJit.codeCacheBytesCommitted;
+
+    int cpuBudget = gDvmJit.compileBudgetPercent * 10;
+    int cacheBudget = gDvmJit.codeCacheBudgetKBPerSec;
+    bool over = (cpuBudget != 0 && gBudget.lastCpuPermille > (u4) cpuBudget) ||
+        (cacheBudget != 0 && gBudget.lastKBPerSec > (u4) cacheBudget);
+    /* Leave some slack so that the threshold doesn't swing every window */
+    bool under =
+        (cpuBudget == 0 || gBudget.lastCpuPermille < (u4) cpuBudget / 2) &&
+        (cacheBudget == 0 || gBudget.lastKBPerSec < (u4) cacheBudget / 2);
+
+    int threshold = gDvmJit.threshold;
+    if (over && threshold < JIT_BUDGET_MAX_THRESHOLD) {
+        gBudget.numRaised++;
+        return MIN(MAX(threshold, 1) * 2, JIT_BUDGET_MAX_THRESHOLD);
+    }
+    if (under && threshold > gBudget.baseThreshold) {
+        gBudget.numLowered++;
+        return MAX(threshold / 2, gBudget.baseThreshold);
+    }
+    return -1;
+}
+
+/*
+ * Makes the threads pick up the new threshold the next time one of their
+ * counters runs out.
+ */
+static void setThreshold(int threshold)
+{
+    if (threshold < 0 || threshold == gDvmJit.threshold) {
+        return;
+    }
+    gDvmJit.threshold = threshold;
+    dvmJitUpdateThreadStateAll();
+}
+
+u4 dvmJitBudgetRecord(u8 cpuNsec)
+{
+    if (!budgetEnabled()) {
+        return 0;
+    }
+    u8 now = dvmGetRelativeTimeUsec();
+    u4 pauseMs = 0;
+
+    dvmLockMutex(&gBudgetLock);
+    gBudget.windowCpuNsec += cpuNsec;
+    gBudget.totalCpuNsec += cpuNsec;
+    int threshold = endWindow(now);
+    /*
+     * Raising the threshold only slows down new requests, so the queued
+     * ones are held back by pausing until the window's share is earned.
+     */
+    if (threshold < 0 && gDvmJit.compileBudgetPercent != 0) {
+        u8 allowedNsec = (now - gBudget.windowStart) * 10 *
+                         gDvmJit.compileBudgetPercent;
+        if (gBudget.windowCpuNsec > allowedNsec) {
+            u8 neededUsec = gBudget.windowCpuNsec /
+                            (10 * gDvmJit.compileBudgetPercent);
+            pauseMs = (u4) MIN((neededUsec - (now - gBudget.windowStart)) /
+                               1000 + 1, JIT_BUDGET_WINDOW_MS);
+            gBudget.numPauses++;
+        }
+    }
+    dvmUnlockMutex(&gBudgetLock);
+
+    setThreshold(threshold);
+    return pauseMs;
+}
+
+bool dvmJitBudgetIdle(void)
+{
+    if (!budgetEnabled()) {
+        return false;
+    }
+    dvmLockMutex(&gBudgetLock);
+    int threshold = endWindow(dvmGetRelativeTimeUsec());
+    dvmUnlockMutex(&gBudgetLock);
+
+    setThreshold(threshold);
+    return gDvmJit.threshold > gBudget.baseThreshold;
+}
+
+void dvmJitBudgetDumpStats(void)
+{
+    if (!budgetEnabled()) {
+        return;
+    }
+    dvmLockMutex(&gBudgetLock);
+    JitBudget budget = gBudget;
+    dvmUnlockMutex(&gBudgetLock);
+
+    ALOGD("JIT budget: threshold %d (base %d), last window %d.%d%% CPU "
+          "and %dK/s of code; raised %d, lowered %d, %d pauses, "
+          "%lld ms compiling",
+          gDvmJit.threshold, budget.baseThreshold,
+          budget.lastCpuPermille / 10, budget.lastCpuPermille % 10,
+          budget.lastKBPerSec, budget.numRaised, budget.numLowered,
+          budget.numPauses, budget.totalCpuNsec / 1000000);
+}
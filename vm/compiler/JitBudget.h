@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Keeps the compiler threads within a share of the CPU and the code cache
+ * within a fill rate, set by -Xjitbudget and -Xjitcachebudget, by raising
+ * the trace selection threshold while they are exceeded and lowering it
+ * back once the compiler has gone quiet.
+ */
+#ifndef DALVIK_VM_COMPILER_JITBUDGET_H_
+#define DALVIK_VM_COMPILER_JITBUDGET_H_
+
+/* The period over which compile time and code size are measured */
+#define JIT_BUDGET_WINDOW_MS    1000
+
+/* The highest threshold the profile table counters can hold */
+#define JIT_BUDGET_MAX_THRESHOLD 255
+
+/*
+ * Takes the threshold picked by the target as the one to come back to.
+ * Called by the compiler thread once the target is set up.
+ */
+void dvmJitBudgetStartup(void);
+
+/*
+ * Accounts for a work order that took "cpuNsec" of compiler thread time.
+ * Returns how many milliseconds the compiler thread should pause for to
+ * stay within the CPU budget, usually 0.
+ */
+u4 dvmJitBudgetRecord(u8 cpuNsec);
+
+/*
+ * Called by the compiler thread when its queue is empty.  Returns true if
+ * the threshold is still raised, in which case it should be called again
+ * within JIT_BUDGET_WINDOW_MS.
+ */
+bool dvmJitBudgetIdle(void);
+
+/*
+ * Logs the compile time and code cache growth of the last window and how
+ * often the threshold was changed.
+ */
+void dvmJitBudgetDumpStats(void);
+
+#endif  // DALVIK_VM_COMPILER_JITBUDGET_H_
@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Persistent record of the hot traces.
+ *
+ * The record is a text file.  The first line is JIT_PROFILE_HEADER, and
+ * after that there is one trace per line:
+ *
+ *   <class descriptor> <method name> <method signature> <code hash> <run>...
+ *
+ * where a run is either a range of code, "c<start>,<count>,<hint>,<end>",
+ * or the callsite information that follows an invoke,
+ * "i<this class>,<callee class>,<callee name>,<callee signature>", with
+ * "-" for what isn't known.  The code hash is checked against the method
+ * when the trace is replayed, so a stale record is harmless: its traces
+ * are dropped and learned again.
+ */
+#include "Dalvik.h"
+#include "interp/Jit.h"
+#include "compiler/JitProfile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JIT_PROFILE_HEADER      "# dalvik jit traces 1"
+#define MAX_PROFILE_LINE        (64 * 1024)
+
+struct SavedRun {
+    bool isCode;
+    JitCodeDesc frag;
+    std::string thisClass;          // the rest are for callsite runs
+    std::string calleeClass;
+    std::string calleeName;
+    std::string calleeSignature;
+};
+
+struct SavedTrace {
+    std::string methodName;
+    std::string signature;
+    u4 codeHash;
+    std::vector<SavedRun> runs;
+};
+
+struct SavedClass {
+    char* descriptor;
+    std::vector<SavedTrace> traces;
+};
+
+struct ReadyTrace {
+    const u2* pc;
+    JitTraceDescription* desc;
+};
+
+/*
+ * The saved traces of the classes that haven't been initialized yet,
+ * keyed by class descriptor.  A class's entry is removed when it is
+ * replayed.
+ */
+static HashTable* gSavedClasses;
+
+/*
+ * Replayed traces that are waiting for room in the compiler's queue.
+ */
+static pthread_mutex_t gReadyLock;
+static std::vector<ReadyTrace>* gReadyTraces;
+
+static pthread_mutex_t gSaveLock;
+static u8 gLastSaveTime;
+static unsigned int gLastSaveCompilations;
+
+static int compareSavedClasses(const void* tableItem, const void* looseItem)
+{
+    return strcmp(((const SavedClass*) tableItem)->descriptor,
+                  ((const SavedClass*) looseItem)->descriptor);
+}
+
+static void freeSavedClass(void* ptr)
+{
+    SavedClass* saved = (SavedClass*) ptr;
+    free(saved->descriptor);
+    delete saved;
+}
+
+static u4 computeCodeHash(const Method* method)
+{
+    u4 size = dvmGetMethodInsnsSize(method);
+    u4 hash = 2166136261u;
+    for (u4 i = 0; i < size; i++) {
+        hash = (hash ^ method->insns[i]) * 16777619u;
+    }
+    return hash ^ size;
+}
+
+/*
+ * Returns the next blank-separated token of a line, or NULL at its end.
+ */
+static char* nextToken(char** cursor)
+{
+    char* start = *cursor + strspn(*cursor, " \t\r\n");
+    if (*start == '\0')
+        return NULL;
+    char* end = start + strcspn(start, " \t\r\n");
+    if (*end != '\0')
+        *end++ = '\0';
+    *cursor = end;
+    return start;
+}
+
+static std::string unlessDash(const char* field)
+{
+    return strcmp(field, "-") == 0 ? std::string() : std::string(field);
+}
+
+static bool parseRun(char* token, SavedRun* run)
+{
+    if (token[0] == 'c') {
+        unsigned int start, count, hint, end;
+        if (sscanf(token + 1, "%u,%u,%u,%u", &start, &count, &hint, &end) != 4
+            || start > 0xffff || count > 0xff || hint > kJitHintNoBias
+            || end > 1)
+        {
+            return false;
+        }
+        run->isCode = true;
+        run->frag.startOffset = start;
+        run->frag.numInsts = count;
+        run->frag.hint = (JitHint) hint;
+        run->frag.runEnd = end;
+        return true;
+    }
+    if (token[0] == 'i') {
+        char* fields[4];
+        char* cursor = token + 1;
+        for (int i = 0; i < 4; i++) {
+            fields[i] = cursor;
+            cursor = strchr(cursor, ',');
+            if ((cursor == NULL) != (i == 3))
+                return false;
+            if (cursor != NULL)
+                *cursor++ = '\0';
+        }
+        run->isCode = false;
+        run->thisClass = unlessDash(fields[0]);
+        run->calleeClass = unlessDash(fields[1]);
+        run->calleeName = fields[2];
+        run->calleeSignature = fields[3];
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Parses one trace line and files it under its class.  Returns false if
+ * the line is malformed.
+ */
+static bool parseTrace(char* line)
+{
+    char* cursor = line;
+    char* descriptor = nextToken(&cursor);
+    char* name = nextToken(&cursor);
+    char* signature = nextToken(&cursor);
+    char* hash = nextToken(&cursor);
+    if (hash == NULL || descriptor[0] != 'L')
+        return false;
+
+    SavedTrace trace;
+    trace.methodName = name;
+    trace.signature = signature;
+    trace.codeHash = strtoul(hash, NULL, 16);
+
+    /* Callsite runs stand for three entries of the description */
+    size_t numEntries = 0;
+    char* token;
+    while ((token = nextToken(&cursor)) != NULL) {
+        SavedRun run;
+        if (!parseRun(token, &run))
+            return false;
+        numEntries += run.isCode ? 1 : 3;
+        trace.runs.push_back(run);
+    }
+    if (trace.runs.empty() || !trace.runs[0].isCode ||
+        !trace.runs.back().isCode || !trace.runs.back().frag.runEnd ||
+        numEntries > MAX_JIT_RUN_LEN)
+    {
+        return false;
+    }
+
+    SavedClass probe;
+    probe.descriptor = descriptor;
+    u4 classHash = dvmComputeUtf8Hash(descriptor);
+    SavedClass* saved = (SavedClass*) dvmHashTableLookup(gSavedClasses,
+        classHash, &probe, compareSavedClasses, false);
+    if (saved == NULL) {
+        saved = new SavedClass;
+        saved->descriptor = strdup(descriptor);
+        dvmHashTableLookup(gSavedClasses, classHash, saved,
+            compareSavedClasses, true);
+    }
+    saved->traces.push_back(trace);
+    return true;
+}
+
+/*
+ * Finds a class as the code of "loader" would see it, without loading
+ * anything.
+ */
+static ClassObject* lookupClass(const std::string& descriptor, Object* loader)
+{
+    ClassObject* clazz = dvmLookupClass(descriptor.c_str(), loader, false);
+    if (clazz == NULL && loader != NULL)
+        clazz = dvmLookupClass(descriptor.c_str(), NULL, false);
+    return clazz;
+}
+
+static Method* findMethod(const ClassObject* clazz, const std::string& name,
+    const std::string& signature)
+{
+    Method* method = dvmFindDirectMethodByDescriptor(clazz, name.c_str(),
+        signature.c_str());
+    if (method == NULL) {
+        method = dvmFindVirtualMethodByDescriptor(clazz, name.c_str(),
+            signature.c_str());
+    }
+    return method;
+}
+
+/*
+ * Rebuilds the description of a saved trace of "clazz".  Returns NULL if
+ * the method has changed or a class it calls into isn't loaded.
+ */
+static JitTraceDescription* resolveTrace(const ClassObject* clazz,
+    const SavedTrace& trace)
+{
+    const Method* method = findMethod(clazz, trace.methodName, trace.signature);
+    if (method == NULL || dvmIsNativeMethod(method) ||
+        dvmIsAbstractMethod(method) || computeCodeHash(method) != trace.codeHash)
+    {
+        return NULL;
+    }
+    u4 insnsSize = dvmGetMethodInsnsSize(method);
+
+    size_t numEntries = 0;
+    for (size_t i = 0; i < trace.runs.size(); i++)
+        numEntries += trace.runs[i].isCode ? 1 : 3;
+    JitTraceDescription* desc = (JitTraceDescription*) calloc(1,
+        sizeof(JitTraceDescription) + sizeof(JitTraceRun) * numEntries);
+    if (desc == NULL)
+        return NULL;
+    desc->method = method;
+
+    JitTraceRun* entry = desc->trace;
+    for (size_t i = 0; i < trace.runs.size(); i++) {
+        const SavedRun& run = trace.runs[i];
+        if (run.isCode) {
+            if (run.frag.numInsts != 0 && run.frag.startOffset >= insnsSize)
+                goto fail;
+            entry->info.frag = run.frag;
+            entry->isCode = true;
+            entry++;
+            continue;
+        }
+
+        const ClassObject* thisClass = NULL;
+        const Method* callee = NULL;
+        if (!run.thisClass.empty()) {
+            thisClass = lookupClass(run.thisClass, clazz->classLoader);
+            if (thisClass == NULL)
+                goto fail;
+        }
+        if (!run.calleeClass.empty()) {
+            ClassObject* calleeClass =
+                lookupClass(run.calleeClass, clazz->classLoader);
+            if (calleeClass == NULL)
+                goto fail;
+            callee = findMethod(calleeClass, run.calleeName,
+                run.calleeSignature);
+            if (callee == NULL)
+                goto fail;
+        }
+        /* As laid out by insertClassMethodInfo() */
+        entry[0].info.meta = thisClass ? (void*) thisClass->descriptor : NULL;
+        entry[1].info.meta = thisClass ? (void*) thisClass->classLoader : NULL;
+        entry[2].info.meta = (void*) callee;
+        entry += 3;
+    }
+    return desc;
+
+fail:
+    free(desc);
+    return NULL;
+}
+
+/*
+ * Hands the ready traces to the compiler, as far as its queue allows.
+ */
+static void queueReadyTraces()
+{
+    dvmLockMutex(&gReadyLock);
+    while (!gReadyTraces->empty()) {
+        const ReadyTrace& ready = gReadyTraces->back();
+        if (!dvmJitRequestTrace(ready.pc, ready.desc))
+            break;
+        gReadyTraces->pop_back();
+    }
+    dvmUnlockMutex(&gReadyLock);
+}
+
+static void replayClass(ClassObject* clazz)
+{
+    SavedClass probe;
+    probe.descriptor = (char*) clazz->descriptor;
+    u4 hash = dvmComputeUtf8Hash(clazz->descriptor);
+
+    dvmHashTableLock(gSavedClasses);
+    SavedClass* saved = (SavedClass*) dvmHashTableLookup(gSavedClasses, hash,
+        &probe, compareSavedClasses, false);
+    if (saved != NULL)
+        dvmHashTableRemove(gSavedClasses, hash, saved);
+    dvmHashTableUnlock(gSavedClasses);
+    if (saved == NULL)
+        return;
+
+    std::vector<ReadyTrace> ready;
+    for (size_t i = 0; i < saved->traces.size(); i++) {
+        JitTraceDescription* desc = resolveTrace(clazz, saved->traces[i]);
+        if (desc != NULL) {
+            ReadyTrace trace;
+            trace.pc = desc->method->insns + desc->trace[0].info.frag.startOffset;
+            trace.desc = desc;
+            ready.push_back(trace);
+        }
+    }
+    ALOGV("JIT: replaying %zd of %zd traces of %s", ready.size(),
+        saved->traces.size(), clazz->descriptor);
+    freeSavedClass(saved);
+
+    dvmLockMutex(&gReadyLock);
+    gReadyTraces->insert(gReadyTraces->end(), ready.begin(), ready.end());
+    dvmUnlockMutex(&gReadyLock);
+}
+
+static int collectDescriptor(void* data, void* arg)
+{
+    ((std::vector<std::string>*) arg)->push_back(
+        ((const SavedClass*) data)->descriptor);
+    return 0;
+}
+
+void dvmJitProfileStartup(const char* fileName)
+{
+    dvmInitMutex(&gReadyLock);
+    dvmInitMutex(&gSaveLock);
+    gReadyTraces = new std::vector<ReadyTrace>;
+    gSavedClasses = dvmHashTableCreate(64, freeSavedClass);
+    gLastSaveTime = dvmGetRelativeTimeUsec();
+
+    FILE* fp = fopen(fileName, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            ALOGW("Unable to open JIT trace file '%s': %s",
+                fileName, strerror(errno));
+        }
+        return;
+    }
+    char* line = (char*) malloc(MAX_PROFILE_LINE);
+    if (line == NULL) {
+        fclose(fp);
+        return;
+    }
+    int lineNum = 0;
+    int numTraces = 0;
+    while (fgets(line, MAX_PROFILE_LINE, fp) != NULL) {
+        lineNum++;
+        if (lineNum == 1) {
+            if (strncmp(line, JIT_PROFILE_HEADER,
+                        strlen(JIT_PROFILE_HEADER)) != 0)
+            {
+                ALOGW("Ignoring JIT trace file '%s' of unknown format",
+                    fileName);
+                break;
+            }
+            continue;
+        }
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if (parseTrace(line)) {
+            numTraces++;
+        } else {
+            ALOGW("Skipping bad line %d of JIT trace file '%s'",
+                lineNum, fileName);
+        }
+    }
+    free(line);
+    fclose(fp);
+    ALOGV("JIT: read %d traces of %d classes from '%s'", numTraces,
+        dvmHashTableNumEntries(gSavedClasses), fileName);
+
+    /*
+     * Classes initialized during startup are past the hook; replay the
+     * ones the boot class loader has already brought up.
+     */
+    std::vector<std::string> descriptors;
+    dvmHashForeach(gSavedClasses, collectDescriptor, &descriptors);
+    for (size_t i = 0; i < descriptors.size(); i++) {
+        ClassObject* clazz = dvmLookupClass(descriptors[i].c_str(), NULL, false);
+        if (clazz != NULL && dvmIsClassInitialized(clazz))
+            replayClass(clazz);
+    }
+}
+
+void dvmJitProfileClassInitialized(ClassObject* clazz)
+{
+    if (gSavedClasses == NULL || dvmHashTableNumEntries(gSavedClasses) == 0)
+        return;
+    replayClass(clazz);
+    queueReadyTraces();
+}
+
+static void printRun(FILE* fp, const JitCodeDesc& frag)
+{
+    fprintf(fp, " c%u,%u,%u,%u", frag.startOffset, frag.numInsts,
+        frag.hint, frag.runEnd);
+}
+
+static void printCallsite(FILE* fp, const char* thisClass,
+    const char* calleeClass, const char* calleeName,
+    const char* calleeSignature)
+{
+    fprintf(fp, " i%s,%s,%s,%s", thisClass ? thisClass : "-",
+        calleeClass ? calleeClass : "-", calleeName, calleeSignature);
+}
+
+static void printTrace(FILE* fp, const JitTraceDescription* desc)
+{
+    const Method* method = desc->method;
+    char* signature = dexProtoCopyMethodDescriptor(&method->prototype);
+    fprintf(fp, "%s %s %s %08x", method->clazz->descriptor, method->name,
+        signature, computeCodeHash(method));
+    free(signature);
+
+    const JitTraceRun* run = desc->trace;
+    while (true) {
+        if (run->isCode) {
+            printRun(fp, run->info.frag);
+            if (run->info.frag.runEnd)
+                break;
+            run++;
+            continue;
+        }
+        const Method* callee =
+            (const Method*) run[JIT_TRACE_CUR_METHOD - 1].info.meta;
+        if (callee != NULL) {
+            char* calleeSignature =
+                dexProtoCopyMethodDescriptor(&callee->prototype);
+            printCallsite(fp,
+                (const char*) run[JIT_TRACE_CLASS_DESC - 1].info.meta,
+                callee->clazz->descriptor, callee->name, calleeSignature);
+            free(calleeSignature);
+        } else {
+            printCallsite(fp,
+                (const char*) run[JIT_TRACE_CLASS_DESC - 1].info.meta,
+                NULL, "-", "-");
+        }
+        run += 3;
+    }
+    fputc('\n', fp);
+}
+
+static int printSavedClass(void* data, void* arg)
+{
+    FILE* fp = (FILE*) arg;
+    const SavedClass* saved = (const SavedClass*) data;
+    for (size_t i = 0; i < saved->traces.size(); i++) {
+        const SavedTrace& trace = saved->traces[i];
+        fprintf(fp, "%s %s %s %08x", saved->descriptor,
+            trace.methodName.c_str(), trace.signature.c_str(),
+            trace.codeHash);
+        for (size_t j = 0; j < trace.runs.size(); j++) {
+            const SavedRun& run = trace.runs[j];
+            if (run.isCode) {
+                printRun(fp, run.frag);
+            } else {
+                printCallsite(fp,
+                    run.thisClass.empty() ? NULL : run.thisClass.c_str(),
+                    run.calleeClass.empty() ? NULL : run.calleeClass.c_str(),
+                    run.calleeName.c_str(), run.calleeSignature.c_str());
+            }
+        }
+        fputc('\n', fp);
+    }
+    return 0;
+}
+
+void dvmJitProfileSave()
+{
+    if (gDvmJit.traceFile == NULL || gSavedClasses == NULL)
+        return;
+
+    dvmLockMutex(&gSaveLock);
+
+    /*
+     * Copy the descriptions out of the code cache, which can't be reset
+     * while compilerLock is held.
+     */
+    std::vector<JitTraceDescription*> descs;
+    dvmLockMutex(&gDvmJit.compilerLock);
+    unsigned int compilations = gDvmJit.numCompilations;
+    if (gDvmJit.pJitEntryTable != NULL) {
+        dvmLockMutex(&gDvmJit.tableLock);
+        for (u4 i = 0; i < gDvmJit.jitTableSize; i++) {
+            const JitEntry* entry = &gDvmJit.pJitEntryTable[i];
+            if (entry->dPC != NULL && !entry->u.info.isMethodEntry &&
+                entry->codeAddress != NULL &&
+                entry->codeAddress != dvmCompilerGetInterpretTemplate())
+            {
+                JitTraceDescription* desc = dvmCopyTraceDescriptor(NULL, entry);
+                if (desc != NULL)
+                    descs.push_back(desc);
+            }
+        }
+        dvmUnlockMutex(&gDvmJit.tableLock);
+    }
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+
+    /* Write a new file and move it into place */
+    std::string tmpFile(gDvmJit.traceFile);
+    tmpFile += ".tmp";
+    FILE* fp = fopen(tmpFile.c_str(), "w");
+    if (fp == NULL) {
+        ALOGW("Unable to write JIT trace file '%s': %s",
+            tmpFile.c_str(), strerror(errno));
+    } else {
+        fprintf(fp, "%s\n", JIT_PROFILE_HEADER);
+        for (size_t i = 0; i < descs.size(); i++)
+            printTrace(fp, descs[i]);
+        dvmHashTableLock(gSavedClasses);
+        dvmHashForeach(gSavedClasses, printSavedClass, fp);
+        dvmHashTableUnlock(gSavedClasses);
+        bool failed = ferror(fp);
+        if (fclose(fp) != 0 || failed ||
+            rename(tmpFile.c_str(), gDvmJit.traceFile) != 0)
+        {
+            ALOGW("Unable to write JIT trace file '%s': %s",
+                gDvmJit.traceFile, strerror(errno));
+            unlink(tmpFile.c_str());
+        }
+    }
+    for (size_t i = 0; i < descs.size(); i++)
+        free(descs[i]);
+
+    gLastSaveTime = dvmGetRelativeTimeUsec();
+    gLastSaveCompilations = compilations;
+    dvmUnlockMutex(&gSaveLock);
+}
+
+void dvmJitProfileIdle()
+{
+    if (gSavedClasses == NULL)
+        return;
+    queueReadyTraces();
+    if (gDvmJit.numCompilations != gLastSaveCompilations &&
+        dvmGetRelativeTimeUsec() - gLastSaveTime >=
+            JIT_PROFILE_SAVE_INTERVAL_MS * 1000LL)
+    {
+        dvmJitProfileSave();
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Record of the hot traces that outlives the process, so that the next
+ * run can compile them as soon as their classes are initialized.
+ */
+#ifndef DALVIK_VM_COMPILER_JITPROFILE_H_
+#define DALVIK_VM_COMPILER_JITPROFILE_H_
+
+/* How often the profile is saved while new traces are being compiled */
+#define JIT_PROFILE_SAVE_INTERVAL_MS    30000
+
+/*
+ * Reads the traces saved in "fileName" by an earlier run, if any, and
+ * replays those of classes that are already initialized.  A missing or
+ * unreadable file just means there is nothing to replay.
+ */
+void dvmJitProfileStartup(const char* fileName);
+
+/*
+ * Queues the saved traces of a class that has just been initialized.
+ * Must be called in the RUNNING state.
+ */
+void dvmJitProfileClassInitialized(ClassObject* clazz);
+
+/*
+ * Writes the current translations, and the saved traces that haven't
+ * been replayed yet, to gDvmJit.traceFile.
+ */
+void dvmJitProfileSave(void);
+
+/*
+ * Called by the compiler thread when its queue is empty.  Queues the
+ * replayed traces that didn't fit in the queue before, and saves the
+ * profile now and then.
+ */
+void dvmJitProfileIdle(void);
+
+#endif  // DALVIK_VM_COMPILER_JITPROFILE_H_
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "interp/Jit.h"
+#include "compiler/JitSampler.h"
+
+#include <stdlib.h>
+
+/*
+ * A translation sample is keyed by the code address the thread entered
+ * the code cache through, which is where its chain of translations
+ * started; an interpreted sample by the method being run.
+ */
+struct SampleCount {
+    const void *key;            /* NULL if the slot is free */
+    const Method *method;
+    u4 count;
+};
+
+struct SampleTable {
+    SampleCount counts[JIT_SAMPLER_TABLE_SIZE];
+    u4 numSamples;
+    u4 numDropped;
+};
+
+struct JitSampler {
+    SampleTable traces;
+    SampleTable methods;
+    u4 numSamples;
+    int intervalMs;
+};
+
+/*
+ * The sampling thread is the only writer; the lock keeps the reports
+ * consistent and guards the start and stop.
+ */
+static pthread_mutex_t gSamplerLock;
+static pthread_cond_t gSamplerCond;
+static pthread_t gSamplerHandle;
+static bool gSamplerRunning;
+static JitSampler *gSampler;
+
+static void addSample(SampleTable *table, const void *key,
+                      const Method *method)
+{
+    u4 idx = ((uintptr_t) key >> 2) & (JIT_SAMPLER_TABLE_SIZE - 1);
+    table->numSamples++;
+    for (int i = 0; i < JIT_SAMPLER_TABLE_SIZE; i++) {
+        SampleCount *slot = &table->counts[idx];
+        if (slot->key == key) {
+            slot->count++;
+            return;
+        }
+        if (slot->key == NULL) {
+            slot->key = key;
+            slot->method = method;
+            slot->count = 1;
+            return;
+        }
+        idx = (idx + 1) & (JIT_SAMPLER_TABLE_SIZE - 1);
+    }
+    table->numDropped++;
+}
+
+/*
+ * Reads the threads' state without stopping them.  A thread may move on
+ * while it is looked at, which only blurs the sample it counts for.
+ */
+static void takeSamples(Thread *self)
+{
+    dvmLockThreadList(self);
+    for (Thread *thread = gDvm.threadList; thread != NULL;
+         thread = thread->next) {
+        if (thread == self || thread->status != THREAD_RUNNING) {
+            continue;
+        }
+        const void *codeAddr = thread->inJitCodeCache;
+        const Method *method = thread->interpSave.method;
+        gSampler->numSamples++;
+        if (codeAddr != NULL) {
+            addSample(&gSampler->traces, codeAddr, method);
+        } else if (method != NULL) {
+            addSample(&gSampler->methods, method, method);
+        }
+    }
+    dvmUnlockThreadList();
+}
+
+static void *samplerThreadStart(void *arg)
+{
+    Thread *self = dvmThreadSelf();
+
+    dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockMutex(&gSamplerLock);
+    while (gSamplerRunning) {
+        dvmRelativeCondWait(&gSamplerCond, &gSamplerLock,
+                            gSampler->intervalMs, 0);
+        if (gSamplerRunning) {
+            takeSamples(self);
+        }
+    }
+    dvmUnlockMutex(&gSamplerLock);
+    return NULL;
+}
+
+void dvmJitSamplerStartup(void)
+{
+    dvmInitMutex(&gSamplerLock);
+    dvmInitCondForTimedWait(&gSamplerCond);
+    if (gDvmJit.sampleIntervalMs > 0 &&
+        !dvmJitSamplerStart(gDvmJit.sampleIntervalMs)) {
+        ALOGW("Unable to start the JIT sampler");
+    }
+}
+
+bool dvmJitSamplerStart(int intervalMs)
+{
+    dvmLockMutex(&gSamplerLock);
+    if (gSamplerRunning) {
+        gSampler->intervalMs = intervalMs;
+        dvmUnlockMutex(&gSamplerLock);
+        return true;
+    }
+    if (gSampler == NULL) {
+        gSampler = (JitSampler *) malloc(sizeof(*gSampler));
+        if (gSampler == NULL) {
+            dvmUnlockMutex(&gSamplerLock);
+            return false;
+        }
+    }
+    memset(gSampler, 0, sizeof(*gSampler));
+    gSampler->intervalMs = intervalMs;
+    gSamplerRunning = true;
+    dvmUnlockMutex(&gSamplerLock);
+
+    if (!dvmCreateInternalThread(&gSamplerHandle, "JIT Sampler",
+                                 samplerThreadStart, NULL)) {
+        gSamplerRunning = false;
+        return false;
+    }
+    return true;
+}
+
+void dvmJitSamplerStop(void)
+{
+    dvmLockMutex(&gSamplerLock);
+    bool wasRunning = gSamplerRunning;
+    gSamplerRunning = false;
+    if (wasRunning) {
+        pthread_cond_signal(&gSamplerCond);
+    }
+    dvmUnlockMutex(&gSamplerLock);
+
+    if (wasRunning && pthread_join(gSamplerHandle, NULL) != 0) {
+        ALOGW("JIT sampler thread join failed");
+    }
+}
+
+static int compareCounts(const void *a, const void *b)
+{
+    u4 countA = ((const SampleCount *) a)->count;
+    u4 countB = ((const SampleCount *) b)->count;
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+static const JitEntry *findTranslation(const void *codeAddr)
+{
+    if (gDvmJit.pJitEntryTable == NULL) {
+        return NULL;
+    }
+    for (u4 i = 0; i < gDvmJit.jitTableSize; i++) {
+        const JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        if (entry->dPC != NULL && entry->codeAddress != NULL &&
+            (entry->codeAddress == codeAddr ||
+             (char *) entry->codeAddress + entry->u.info.profileOffset ==
+                 codeAddr)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static bool hasTranslation(const Method *method)
+{
+    const u2 *start = method->insns;
+    const u2 *end = start + dvmGetMethodInsnsSize(method);
+    if (gDvmJit.pJitEntryTable == NULL) {
+        return false;
+    }
+    for (u4 i = 0; i < gDvmJit.jitTableSize; i++) {
+        const JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        if (entry->dPC >= start && entry->dPC < end &&
+            entry->codeAddress != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Sorts "table" in place and returns the number of slots in use.
+ */
+static int sortCounts(SampleTable *table)
+{
+    int numUsed = 0;
+    for (int i = 0; i < JIT_SAMPLER_TABLE_SIZE; i++) {
+        if (table->counts[i].key != NULL) {
+            table->counts[numUsed++] = table->counts[i];
+        }
+    }
+    qsort(table->counts, numUsed, sizeof(SampleCount), compareCounts);
+    return numUsed;
+}
+
+#define PERCENT(n, total)   ((total) == 0 ? 0.0 : 100.0 * (n) / (total))
+
+void dvmJitSamplerDump(const DebugOutputTarget *target)
+{
+    JitSampler *sampler = (JitSampler *) malloc(sizeof(*sampler));
+    if (sampler == NULL) {
+        return;
+    }
+    dvmLockMutex(&gSamplerLock);
+    bool running = gSamplerRunning;
+    if (gSampler != NULL) {
+        *sampler = *gSampler;
+    } else {
+        memset(sampler, 0, sizeof(*sampler));
+    }
+    dvmUnlockMutex(&gSamplerLock);
+
+    u4 total = sampler->numSamples;
+    dvmPrintDebugMessage(target,
+        "JIT samples: %u every %dms%s, %u (%.1f%%) in translations, "
+        "%u (%.1f%%) interpreted\n",
+        total, sampler->intervalMs, running ? "" : " (stopped)",
+        sampler->traces.numSamples,
+        PERCENT(sampler->traces.numSamples, total),
+        sampler->methods.numSamples,
+        PERCENT(sampler->methods.numSamples, total));
+
+    int numTraces = sortCounts(&sampler->traces);
+    dvmPrintDebugMessage(target, "Translations (%d seen, %u dropped):\n",
+                         numTraces, sampler->traces.numDropped);
+    for (int i = 0; i < numTraces && i < JIT_SAMPLER_REPORT_SIZE; i++) {
+        const SampleCount *sample = &sampler->traces.counts[i];
+        const JitEntry *entry = findTranslation(sample->key);
+        const Method *method = sample->method;
+        int offset = -1;
+        if (entry != NULL && method != NULL &&
+            entry->dPC >= method->insns &&
+            entry->dPC < method->insns + dvmGetMethodInsnsSize(method)) {
+            offset = entry->dPC - method->insns;
+        }
+        dvmPrintDebugMessage(target, "  %5.1f%% %6u %p %s%s.%s",
+            PERCENT(sample->count, total), sample->count, sample->key,
+            entry == NULL ? "(gone) " : "",
+            method ? method->clazz->descriptor : "?",
+            method ? method->name : "?");
+        if (offset >= 0) {
+            dvmPrintDebugMessage(target, " +0x%04x\n", offset);
+        } else {
+            dvmPrintDebugMessage(target, "\n");
+        }
+    }
+
+    int numMethods = sortCounts(&sampler->methods);
+    dvmPrintDebugMessage(target,
+                         "Interpreted methods (%d seen, %u dropped), "
+                         "* if never compiled:\n",
+                         numMethods, sampler->methods.numDropped);
+    for (int i = 0; i < numMethods && i < JIT_SAMPLER_REPORT_SIZE; i++) {
+        const SampleCount *sample = &sampler->methods.counts[i];
+        const Method *method = sample->method;
+        dvmPrintDebugMessage(target, "  %5.1f%% %6u %c %s.%s\n",
+            PERCENT(sample->count, total), sample->count,
+            hasTranslation(method) ? ' ' : '*',
+            method->clazz->descriptor, method->name);
+    }
+    free(sampler);
+}
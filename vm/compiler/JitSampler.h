@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Timer-driven sampling of where the running threads are: in which
+ * translation, or interpreting which method.  Unlike the trace profiling
+ * counters it costs nothing in the generated code, so it can be left on.
+ */
+#ifndef DALVIK_VM_COMPILER_JITSAMPLER_H_
+#define DALVIK_VM_COMPILER_JITSAMPLER_H_
+
+/* The number of distinct translations and methods that can be counted */
+#define JIT_SAMPLER_TABLE_SIZE  4096
+
+/* The number of each that are reported */
+#define JIT_SAMPLER_REPORT_SIZE 20
+
+/*
+ * Sets up the sampler, and starts it if -Xjitsample asked for it.
+ */
+void dvmJitSamplerStartup(void);
+
+/*
+ * Starts sampling every "intervalMs" milliseconds, forgetting any earlier
+ * samples.  Returns false if the sampling thread couldn't be started.
+ */
+bool dvmJitSamplerStart(int intervalMs);
+
+/*
+ * Stops sampling and waits for the sampling thread to exit.  The samples
+ * are kept for dvmJitSamplerDump().
+ */
+void dvmJitSamplerStop(void);
+
+/*
+ * Prints the translations and the interpreted methods seen most often,
+ * marking the methods that have no translation at all.  Must be called
+ * in the RUNNING state, which keeps the JitTable from being resized.
+ */
+void dvmJitSamplerDump(const DebugOutputTarget *target);
+
+#endif  // DALVIK_VM_COMPILER_JITSAMPLER_H_
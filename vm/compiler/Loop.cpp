@@ -157,53 +157,42 @@ static Opcode negateOpcode(Opcode opcode)
 }
 
 /*
- * A loop is considered optimizable if:
- * 1) It has one basic induction variable.
- * 2) The loop back branch compares the BIV with a constant.
- * 3) We need to normalize the loop exit condition so that the loop is exited
- *    via the taken path.
- * 4) If it is a count-up loop, the condition is GE/GT. Otherwise it is
- *    LE/LT/LEZ/LTZ for a count-down loop.
- *
- * Return false for loops that fail the above tests.
+ * Return the block that follows bb in the loop, or NULL at the end of the
+ * loop.  Loop blocks form a chain in which every other successor leaves the
+ * loop (see dvmCompilerFilterLoopBlocks).
  */
-static bool isSimpleCountedLoop(CompilationUnit *cUnit)
+static BasicBlock *nextLoopBlock(const CompilationUnit *cUnit,
+                                 const BasicBlock *bb)
 {
-    unsigned int i;
-    BasicBlock *loopBackBlock = cUnit->entryBlock->fallThrough;
-    LoopAnalysis *loopAnalysis = cUnit->loopAnalysis;
-
-    if (loopAnalysis->numBasicIV != 1) return false;
-    for (i = 0; i < loopAnalysis->ivList->numUsed; i++) {
-        InductionVariableInfo *ivInfo;
+    BasicBlock *firstBB = cUnit->entryBlock->fallThrough;
 
-        ivInfo = GET_ELEM_N(loopAnalysis->ivList, InductionVariableInfo*, i);
-        /* Count up or down loop? */
-        if (ivInfo->ssaReg == ivInfo->basicSSAReg) {
-            /* Infinite loop */
-            if (ivInfo->inc == 0) {
-                return false;
-            }
-            loopAnalysis->isCountUpLoop = ivInfo->inc > 0;
-            break;
-        }
+    if (bb->fallThrough && bb->fallThrough != firstBB &&
+        bb->fallThrough->blockType == kDalvikByteCode) {
+        return bb->fallThrough;
     }
+    if (bb->taken && bb->taken != firstBB &&
+        bb->taken->blockType == kDalvikByteCode) {
+        return bb->taken;
+    }
+    return NULL;
+}
 
-    /* Find the block that ends with a branch to exit the loop */
-    while (true) {
-        loopBackBlock = findPredecessorBlock(cUnit, loopBackBlock);
-        /* Loop structure not recognized as counted blocks */
-        if (loopBackBlock == NULL) {
-            return false;
-        }
-        /* Unconditional goto - continue to trace up the predecessor chain */
-        if (loopBackBlock->taken == NULL) {
-            continue;
-        }
-        break;
+/*
+ * Check whether the branch ending bb exits the loop by comparing the BIV
+ * with a loop invariant, and if so record the normalized exit condition.
+ * phiBIV is the value of the BIV at the top of the loop, which may only be
+ * tested in the first block, ahead of any array access.
+ */
+static bool isCountedLoopExit(CompilationUnit *cUnit, BasicBlock *bb,
+                              int phiBIV)
+{
+    LoopAnalysis *loopAnalysis = cUnit->loopAnalysis;
+    MIR *branch = bb->lastMIRInsn;
+
+    if (branch == NULL || bb->taken == NULL || bb->fallThrough == NULL) {
+        return false;
     }
 
-    MIR *branch = loopBackBlock->lastMIRInsn;
     Opcode opcode = branch->dalvikInsn.opcode;
 
     /* Last instruction is not a conditional branch - bail */
@@ -211,14 +200,32 @@ static bool isSimpleCountedLoop(CompilationUnit *cUnit)
         return false;
     }
 
+    /* One side has to stay in the loop and the other has to leave it */
+    bool takenInLoop = bb->taken->blockType == kDalvikByteCode;
+    bool fallThroughInLoop = bb->fallThrough->blockType == kDalvikByteCode;
+    if (takenInLoop == fallThroughInLoop) {
+        return false;
+    }
+
+    int testedBIV = loopAnalysis->ssaBIV;
+    if (bb == cUnit->entryBlock->fallThrough) {
+        bool usesPhi = false;
+        for (int i = 0; i < branch->ssaRep->numUses; i++) {
+            usesPhi |= branch->ssaRep->uses[i] == phiBIV;
+        }
+        if (usesPhi) {
+            testedBIV = phiBIV;
+        }
+    }
+
     int endSSAReg;
     int endDalvikReg;
 
     /* reg/reg comparison */
     if (branch->ssaRep->numUses == 2) {
-        if (branch->ssaRep->uses[0] == loopAnalysis->ssaBIV) {
+        if (branch->ssaRep->uses[0] == testedBIV) {
             endSSAReg = branch->ssaRep->uses[1];
-        } else if (branch->ssaRep->uses[1] == loopAnalysis->ssaBIV) {
+        } else if (branch->ssaRep->uses[1] == testedBIV) {
             endSSAReg = branch->ssaRep->uses[0];
             opcode = negateOpcode(opcode);
         } else {
@@ -238,7 +245,7 @@ static bool isSimpleCountedLoop(CompilationUnit *cUnit)
         }
     /* Compare against zero */
     } else if (branch->ssaRep->numUses == 1) {
-        if (branch->ssaRep->uses[0] == loopAnalysis->ssaBIV) {
+        if (branch->ssaRep->uses[0] == testedBIV) {
             /* Keep the compiler happy */
             endDalvikReg = -1;
         } else {
@@ -249,7 +256,7 @@ static bool isSimpleCountedLoop(CompilationUnit *cUnit)
     }
 
     /* Normalize the loop exit check as "if (iv op end) exit;" */
-    if (loopBackBlock->taken->blockType == kDalvikByteCode) {
+    if (takenInLoop) {
         opcode = negateOpcode(opcode);
     }
 
@@ -288,9 +295,58 @@ static bool isSimpleCountedLoop(CompilationUnit *cUnit)
      * value used for the yanked range checks.
      */
     loopAnalysis->loopBranchOpcode = opcode;
+    loopAnalysis->countedExitBlock = bb;
+    loopAnalysis->exitTestsPhiBIV = testedBIV == phiBIV;
     return true;
 }
 
+/*
+ * A loop is considered optimizable if:
+ * 1) It has one basic induction variable.
+ * 2) One of the loop exits compares the BIV with a constant. It can test
+ *    the BIV after its update anywhere in the loop, or before it at the top
+ *    of the loop. Other exits only end the loop sooner, which the hoisted
+ *    checks allow for.
+ * 3) We need to normalize the loop exit condition so that the loop is exited
+ *    via the taken path.
+ * 4) If it is a count-up loop, the condition is GE/GT. Otherwise it is
+ *    LE/LT/LEZ/LTZ for a count-down loop.
+ *
+ * Return false for loops that fail the above tests.
+ */
+static bool isSimpleCountedLoop(CompilationUnit *cUnit)
+{
+    unsigned int i;
+    LoopAnalysis *loopAnalysis = cUnit->loopAnalysis;
+    int phiBIV = -1;
+
+    if (loopAnalysis->numBasicIV != 1) return false;
+    for (i = 0; i < loopAnalysis->ivList->numUsed; i++) {
+        InductionVariableInfo *ivInfo;
+
+        ivInfo = GET_ELEM_N(loopAnalysis->ivList, InductionVariableInfo*, i);
+        /* Count up or down loop? */
+        if (ivInfo->ssaReg == ivInfo->basicSSAReg) {
+            /* Infinite loop */
+            if (ivInfo->inc == 0) {
+                return false;
+            }
+            loopAnalysis->isCountUpLoop = ivInfo->inc > 0;
+            phiBIV = ivInfo->ssaReg;
+            break;
+        }
+    }
+
+    /* Find the exit that counts the iterations */
+    for (BasicBlock *bb = cUnit->entryBlock->fallThrough; bb != NULL;
+         bb = nextLoopBlock(cUnit, bb)) {
+        if (isCountedLoopExit(cUnit, bb, phiBIV)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
  * Record the upper and lower bound information for range checks for each
  * induction variable. If array A is accessed by index "i+5", the upper and
@@ -339,10 +395,13 @@ static void updateRangeCheckInfo(CompilationUnit *cUnit, int arrayReg,
     }
 }
 
-/* Returns true if the loop body cannot throw any exceptions */
-static bool doLoopBodyCodeMotion(CompilationUnit *cUnit)
+/*
+ * Hoist the null and range checks of one loop block if canHoist is true.
+ * Returns true if the block can throw any exceptions.
+ */
+static bool doBlockCodeMotion(CompilationUnit *cUnit, BasicBlock *loopBody,
+                              bool canHoist)
 {
-    BasicBlock *loopBody = cUnit->entryBlock->fallThrough;
     MIR *mir;
     bool loopBodyCanThrow = false;
 
@@ -404,7 +463,7 @@ static bool doLoopBodyCodeMotion(CompilationUnit *cUnit)
              * If the register is never updated in the loop (ie subscript == 0),
              * it is an optimization candidate.
              */
-            if (arraySub != 0) {
+            if (arraySub != 0 || !canHoist) {
                 loopBodyCanThrow = true;
                 continue;
             }
@@ -423,6 +482,30 @@ static bool doLoopBodyCodeMotion(CompilationUnit *cUnit)
         }
     }
 
+    return loopBodyCanThrow;
+}
+
+/* Returns true if the loop body cannot throw any exceptions */
+static bool doLoopBodyCodeMotion(CompilationUnit *cUnit)
+{
+    LoopAnalysis *loopAnalysis = cUnit->loopAnalysis;
+    BasicBlock *loopBody;
+    bool loopBodyCanThrow = false;
+
+    /*
+     * If the exit tests the BIV before its update, the accesses ahead of
+     * the test can run one iteration past the end and keep their checks.
+     */
+    bool canHoist = !loopAnalysis->exitTestsPhiBIV;
+
+    for (loopBody = cUnit->entryBlock->fallThrough; loopBody != NULL;
+         loopBody = nextLoopBlock(cUnit, loopBody)) {
+        loopBodyCanThrow |= doBlockCodeMotion(cUnit, loopBody, canHoist);
+        if (loopBody == loopAnalysis->countedExitBlock) {
+            canHoist = true;
+        }
+    }
+
     return !loopBodyCanThrow;
 }
 
@@ -696,7 +779,7 @@ bool dvmCompilerLoopOpt(CompilationUnit *cUnit)
     dvmCompilerDataFlowAnalysisDispatcher(cUnit,
                                           dvmCompilerFindInductionVariables,
                                           kAllNodes,
-                                          false /* isIterative */);
+                                          true /* isIterative */);
     DEBUG_LOOP(dumpIVList(cUnit);)
 
     /* Only optimize array accesses for simple counted loop for now */
@@ -726,15 +809,14 @@ void dvmCompilerInsertBackwardChaining(CompilationUnit *cUnit)
      * If we are not in self-verification or profiling mode, the backward
      * branch can go to the entryBlock->fallThrough directly. Suspend polling
      * code will be generated along the backward branch to honor the suspend
-     * requests.
+     * requests. On IA32 the poll is at the loop head, where the backward
+     * branch lands past the loads of the registers carried around the loop.
      */
-#ifndef ARCH_IA32
 #if !defined(WITH_SELF_VERIFICATION)
     if (gDvmJit.profileMode != kTraceProfilingContinuous &&
         gDvmJit.profileMode != kTraceProfilingPeriodicOn) {
         return;
     }
-#endif
 #endif
 
     /*
@@ -28,6 +28,8 @@ typedef struct LoopAnalysis {
     int ssaBIV;                         // basic IV in SSA name
     bool isCountUpLoop;                 // count up or down loop
     Opcode loopBranchOpcode;            // OP_IF_XXX for the loop back branch
+    BasicBlock *countedExitBlock;       // block ending with the counted exit
+    bool exitTestsPhiBIV;               // exit tests the BIV before its update
     int endConditionReg;                // vB in "vA op vB"
     LIR *branchToBody;                  // branch over to the body from entry
     LIR *branchToPCR;                   // branch over to the PCR cell
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "compiler/NullFault.h"
+
+#include <signal.h>
+#if defined(__arm__)
+#include <sys/ucontext.h>
+#endif
+
+/* Sites per block, so that a block is about a page */
+#define NULL_FAULT_BLOCK_SITES  510
+
+struct NullFaultSite {
+    const char *codeAddr;
+    const u2 *dalvikPC;
+};
+
+/*
+ * The sites of a region are kept in blocks, in address order.  Only the
+ * compiler appends to them, under compilerLock, and it publishes each
+ * site and block with a release store, so the signal handler can search
+ * them without taking a lock.  Blocks are freed only at a safe point,
+ * when no thread can be faulting in the code cache.
+ */
+struct NullFaultBlock {
+    NullFaultBlock *next;
+    volatile int32_t numSites;
+    NullFaultSite sites[NULL_FAULT_BLOCK_SITES];
+};
+
+struct NullFaultRegion {
+    NullFaultBlock *head;
+    NullFaultBlock *tail;
+};
+
+static NullFaultRegion gRegions[JIT_MAX_CODE_CACHE_REGIONS];
+static bool gHandlerInstalled;
+
+/* Returns the region holding <addr>, or -1 if it isn't past the templates */
+static int regionOf(const char *addr)
+{
+    unsigned int offset = addr - (const char *) gDvmJit.codeCache;
+    unsigned int i;
+
+    for (i = 0; i < gDvmJit.numCodeCacheRegions; i++) {
+        if (offset >= gDvmJit.codeCacheRegions[i].start &&
+            offset < gDvmJit.codeCacheRegions[i].end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Returns the Dalvik PC of the site at exactly <codeAddr>, or NULL if
+ * there is none.  Safe to call from the signal handler.
+ */
+static const u2 *findSite(const char *codeAddr)
+{
+    int r = regionOf(codeAddr);
+    if (r < 0) {
+        return NULL;
+    }
+    NullFaultBlock *block = (NullFaultBlock *) android_atomic_acquire_load(
+        (volatile int32_t *)(void *) &gRegions[r].head);
+    while (block != NULL) {
+        int lo = 0;
+        int hi = android_atomic_acquire_load(&block->numSites) - 1;
+        if (hi < 0 || codeAddr < block->sites[0].codeAddr) {
+            return NULL;
+        }
+        if (codeAddr <= block->sites[hi].codeAddr) {
+            while (lo <= hi) {
+                int mid = (lo + hi) >> 1;
+                const NullFaultSite *site = &block->sites[mid];
+                if (codeAddr < site->codeAddr) {
+                    hi = mid - 1;
+                } else if (codeAddr > site->codeAddr) {
+                    lo = mid + 1;
+                } else {
+                    return site->dalvikPC;
+                }
+            }
+            return NULL;
+        }
+        block = (NullFaultBlock *) android_atomic_acquire_load(
+            (volatile int32_t *)(void *) &block->next);
+    }
+    return NULL;
+}
+
+bool dvmJitNullFaultRecord(const char *codeAddr, const u2 *dalvikPC)
+{
+    int r = regionOf(codeAddr);
+    if (r < 0) {
+        return false;
+    }
+    NullFaultRegion *region = &gRegions[r];
+    NullFaultBlock *block = region->tail;
+
+    if (block != NULL && block->numSites != 0 &&
+        codeAddr <= block->sites[block->numSites - 1].codeAddr) {
+        /* The search needs the sites in order */
+        return false;
+    }
+    if (block == NULL || block->numSites == NULL_FAULT_BLOCK_SITES) {
+        NullFaultBlock *newBlock =
+            (NullFaultBlock *) calloc(1, sizeof(NullFaultBlock));
+        if (newBlock == NULL) {
+            return false;
+        }
+        newBlock->sites[0].codeAddr = codeAddr;
+        newBlock->sites[0].dalvikPC = dalvikPC;
+        newBlock->numSites = 1;
+        android_atomic_release_store((int32_t) newBlock, block == NULL ?
+            (volatile int32_t *)(void *) &region->head :
+            (volatile int32_t *)(void *) &block->next);
+        region->tail = newBlock;
+    } else {
+        block->sites[block->numSites].codeAddr = codeAddr;
+        block->sites[block->numSites].dalvikPC = dalvikPC;
+        android_atomic_release_store(block->numSites + 1, &block->numSites);
+    }
+    gDvmJit.numNullFaultSites++;
+    return true;
+}
+
+void dvmJitNullFaultForget(const char *start, const char *end)
+{
+    int first = 0;
+    int last = JIT_MAX_CODE_CACHE_REGIONS - 1;
+
+    if (start != NULL) {
+        first = last = regionOf(start);
+        if (first < 0) {
+            return;
+        }
+    }
+    for (int r = first; r <= last; r++) {
+        NullFaultBlock *block = gRegions[r].head;
+        while (block != NULL) {
+            NullFaultBlock *next = block->next;
+            free(block);
+            block = next;
+        }
+        gRegions[r].head = gRegions[r].tail = NULL;
+    }
+}
+
+#if defined(__arm__) && !defined(WITH_SELF_VERIFICATION)
+
+/* The handler that was installed before ours, to pass other faults to */
+static struct sigaction gOldSegvAction;
+
+/* Thumb state, and the If-Then state bits, of the CPSR */
+#define CPSR_THUMB  0x00000020
+#define CPSR_IT     0x0600fc00
+
+/*
+ * Handles a SIGSEGV.  A null object in a translation faults at one of the
+ * recorded sites, accessing the first page.  The thread is sent to the
+ * punt handler with the Dalvik PC in r0, as the PC reconstruction cell of
+ * an explicit check would have, and the interpreter then throws the
+ * exception from there.  Any other fault goes to the previous handler.
+ */
+static void segvCatcher(int signum, siginfo_t *info, void *context)
+{
+    struct ucontext *uc = (struct ucontext *) context;
+    struct sigcontext *sc = (struct sigcontext *) &uc->uc_mcontext;
+    const char *pc = (const char *) sc->arm_pc;
+
+    if ((uintptr_t) info->si_addr < JIT_NULL_FAULT_LIMIT &&
+        pc >= (const char *) gDvmJit.codeCache &&
+        pc < (const char *) gDvmJit.codeCache + gDvmJit.codeCacheSize) {
+        const u2 *dalvikPC = findSite(pc);
+        if (dalvikPC != NULL) {
+            Thread *self = (Thread *) sc->arm_r6;
+            uintptr_t punt =
+                (uintptr_t) self->jitToInterpEntries.dvmJitToInterpPunt;
+            sc->arm_r0 = (uintptr_t) dalvikPC;
+            sc->arm_lr = (uintptr_t) pc | 1;
+            sc->arm_pc = punt & ~1;
+            sc->arm_cpsr &= ~(CPSR_THUMB | CPSR_IT);
+            if (punt & 1) {
+                sc->arm_cpsr |= CPSR_THUMB;
+            }
+            android_atomic_inc(&gDvmJit.numNullFaults);
+            return;
+        }
+    }
+
+    if (gOldSegvAction.sa_flags & SA_SIGINFO) {
+        gOldSegvAction.sa_sigaction(signum, info, context);
+    } else if (gOldSegvAction.sa_handler == SIG_DFL ||
+               gOldSegvAction.sa_handler == SIG_IGN) {
+        /* Let the fault happen again, without us, and kill the process */
+        signal(SIGSEGV, SIG_DFL);
+    } else {
+        gOldSegvAction.sa_handler(signum);
+    }
+}
+
+void dvmJitNullFaultStartup(void)
+{
+    if (gDvmJit.explicitNullChecks || gHandlerInstalled) {
+        return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segvCatcher;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, &gOldSegvAction) != 0) {
+        ALOGW("Unable to install the JIT SIGSEGV handler: %s",
+              strerror(errno));
+        return;
+    }
+    gHandlerInstalled = true;
+    gDvmJit.implicitNullChecks = true;
+}
+
+/*
+ * There is no signal chaining layer to keep us first in line, so a
+ * handler installed after ours, by the app or a library, may never pass
+ * the faults on.  Once that happens the JIT stops leaving null checks to
+ * the fault, and the code cache is reset so the translations that did go
+ * with it.  Those can still be reached until the reset happens.
+ */
+void dvmJitNullFaultCheckHandler(void)
+{
+    if (!gDvmJit.implicitNullChecks) {
+        return;
+    }
+    struct sigaction sa;
+    if (sigaction(SIGSEGV, NULL, &sa) == 0 &&
+        (sa.sa_flags & SA_SIGINFO) != 0 && sa.sa_sigaction == segvCatcher) {
+        return;
+    }
+    ALOGW("JIT: SIGSEGV handler was replaced; using explicit null checks");
+    gDvmJit.implicitNullChecks = false;
+    gDvmJit.codeCacheFull = true;       // Force reset
+}
+
+#else
+
+/* Translations keep their explicit checks */
+void dvmJitNullFaultStartup(void)
+{
+}
+
+void dvmJitNullFaultCheckHandler(void)
+{
+}
+
+#endif
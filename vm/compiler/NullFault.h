@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Implicit null checks.  A field access in a translation may leave out
+ * the compare-and-branch on its object and fault instead when the
+ * object is null.  The SIGSEGV handler looks the faulting instruction up
+ * among the sites recorded for its code cache region and resumes the
+ * thread in the interpreter at the Dalvik instruction, which throws the
+ * NullPointerException, just as the explicit check would have.
+ */
+#ifndef DALVIK_VM_COMPILER_NULLFAULT_H_
+#define DALVIK_VM_COMPILER_NULLFAULT_H_
+
+/*
+ * Accesses this far past a null object still fault, as the first page
+ * is never mapped.  Fields at larger offsets keep their explicit check.
+ */
+#define JIT_NULL_FAULT_LIMIT    4096
+
+/*
+ * Installs the SIGSEGV handler, if the target supports it, and sets
+ * gDvmJit.implicitNullChecks if the translations may rely on it.
+ * Called by the compiler thread once the code cache is set up.
+ */
+void dvmJitNullFaultStartup(void);
+
+/*
+ * Makes sure SIGSEGV still goes to our handler before anything is
+ * compiled with implicit null checks.  If it doesn't, clears
+ * gDvmJit.implicitNullChecks and asks for a code cache reset.  Called by
+ * the compiler threads before each compilation.
+ */
+void dvmJitNullFaultCheckHandler(void);
+
+/*
+ * Records that a null object faults at <codeAddr>, which must lie past
+ * every site recorded for its region so far, for the Dalvik instruction
+ * at <dalvikPC>.  Must be called by the compiler thread with
+ * gDvmJit.compilerLock held, before the translation can be reached.
+ * Returns false if there is no memory for the record, in which case the
+ * translation must not be used.
+ */
+bool dvmJitNullFaultRecord(const char *codeAddr, const u2 *dalvikPC);
+
+/*
+ * Forgets the sites in [start, end), which must be a whole region, or
+ * all of them if start is NULL.  Must be called at a safe point, with no
+ * thread in the code cache, and with gDvmJit.compilerLock held.
+ */
+void dvmJitNullFaultForget(const char *start, const char *end);
+
+#endif  // DALVIK_VM_COMPILER_NULLFAULT_H_
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "interp/Jit.h"
+#include "compiler/TypeProfile.h"
+
+/* Marks a check that has seen more than one class */
+#define POLYMORPHIC_CLASS   ((const ClassObject *) 1)
+
+struct TypeProfileEntry {
+    const u2 *pc;
+    const ClassObject *clazz;
+};
+
+/*
+ * The table is direct mapped and written without a lock by the threads
+ * building traces, so an entry may now and then be lost or, in a race,
+ * name a class another check saw.  Either way the translation still
+ * tests the class it was given, and class objects are never freed.
+ */
+static TypeProfileEntry gTypeProfile[JIT_TYPE_PROFILE_SIZE];
+
+static inline TypeProfileEntry *entryFor(const u2 *pc)
+{
+    return &gTypeProfile[dvmJitHashMask(pc, JIT_TYPE_PROFILE_SIZE - 1)];
+}
+
+void dvmJitTypeProfileRecord(const u2 *pc, const ClassObject *clazz)
+{
+    TypeProfileEntry *entry = entryFor(pc);
+
+    if (clazz == NULL) {
+        return;
+    }
+    if (entry->pc != pc) {
+        entry->clazz = clazz;
+        ANDROID_MEMBAR_STORE();
+        entry->pc = pc;
+    } else if (entry->clazz != clazz) {
+        entry->clazz = POLYMORPHIC_CLASS;
+    }
+}
+
+const ClassObject *dvmJitTypeProfileLookup(const u2 *pc)
+{
+    TypeProfileEntry *entry = entryFor(pc);
+
+    if (entry->pc != pc) {
+        return NULL;
+    }
+    ANDROID_MEMBAR_FULL();
+    const ClassObject *clazz = entry->clazz;
+    return clazz == POLYMORPHIC_CLASS ? NULL : clazz;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Classes of the objects seen by check-cast and instance-of while their
+ * traces were being selected, so that the compiler can test for the
+ * expected class before calling dvmInstanceofNonTrivial.
+ */
+#ifndef DALVIK_VM_COMPILER_TYPEPROFILE_H_
+#define DALVIK_VM_COMPILER_TYPEPROFILE_H_
+
+/* The number of type checks tracked; must be a power of 2 */
+#define JIT_TYPE_PROFILE_SIZE   512
+
+/*
+ * Notes that the type check at "pc" was given an object of "clazz".  A
+ * check that sees a second class is no longer predicted.  Called by the
+ * trace builder.
+ */
+void dvmJitTypeProfileRecord(const u2 *pc, const ClassObject *clazz);
+
+/*
+ * Returns the one class seen by the type check at "pc", or NULL if none
+ * or several were seen.  The answer is only a hint: the translation must
+ * test the object's class against it.
+ */
+const ClassObject *dvmJitTypeProfileLookup(const u2 *pc);
+
+#endif  // DALVIK_VM_COMPILER_TYPEPROFILE_H_
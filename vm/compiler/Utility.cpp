@@ -16,34 +16,133 @@
 
 #include "Dalvik.h"
 #include "CompilerInternals.h"
+#include "InlineCache.h"
+#include "JitBudget.h"
 
-static ArenaMemBlock *arenaHead, *currentArena;
-static int numArenaBlocks;
+/*
+ * Each compiler thread has an arena of its own, found through a thread
+ * key so the compiler passes needn't carry it around.
+ *
+ * Requests that fit a default block are carved out of a chain of such
+ * blocks.  Bigger ones get a block of their own, kept by size class
+ * across compilations so that the next large trace finds one ready.
+ */
+struct CompilerArena {
+    ArenaMemBlock *head;
+    ArenaMemBlock *current;
+    /* Large blocks handed out since the last reset */
+    ArenaMemBlock *largeInUse;
+    /* Idle large blocks; bucket k holds ARENA_LARGE_MIN << k bytes */
+    ArenaMemBlock *largeFree[ARENA_LARGE_BUCKETS];
+    size_t largeFreeBytes;
+    /* Bytes handed out since the last reset */
+    size_t bytesInUse;
+};
+
+static pthread_key_t arenaKey;
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
+static volatile int32_t numArenaBlocks;
+/* The most arena memory a single compilation has used */
+static volatile int32_t arenaHighWater;
+static volatile int32_t numLargeAllocs;
+static volatile int32_t numLargeReused;
+
+static void createArenaKey(void)
+{
+    if (pthread_key_create(&arenaKey, NULL) != 0) {
+        ALOGE("Unable to create the compiler arena key");
+        dvmAbort();
+    }
+}
+
+static inline CompilerArena *getArena(void)
+{
+    CompilerArena *arena = (CompilerArena *) pthread_getspecific(arenaKey);
+    assert(arena != NULL);
+    return arena;
+}
 
 /* Allocate the initial memory block for arena-based allocation */
 bool dvmCompilerHeapInit(void)
 {
-    assert(arenaHead == NULL);
-    arenaHead =
+    pthread_once(&arenaKeyOnce, createArenaKey);
+    assert(pthread_getspecific(arenaKey) == NULL);
+    CompilerArena *arena = (CompilerArena *) calloc(1, sizeof(CompilerArena));
+    ArenaMemBlock *head =
         (ArenaMemBlock *) malloc(sizeof(ArenaMemBlock) + ARENA_DEFAULT_SIZE);
-    if (arenaHead == NULL) {
+    if (arena == NULL || head == NULL) {
         ALOGE("No memory left to create compiler heap memory");
+        free(arena);
+        free(head);
         return false;
     }
-    arenaHead->blockSize = ARENA_DEFAULT_SIZE;
-    currentArena = arenaHead;
-    currentArena->bytesAllocated = 0;
-    currentArena->next = NULL;
-    numArenaBlocks = 1;
+    head->blockSize = ARENA_DEFAULT_SIZE;
+    head->bytesAllocated = 0;
+    head->next = NULL;
+    arena->head = arena->current = head;
+    arena->bytesInUse = 0;
+    pthread_setspecific(arenaKey, arena);
+    android_atomic_inc(&numArenaBlocks);
 
     return true;
 }
 
+/* Returns the size class of a large request, or -1 if it has none */
+static int largeBucket(size_t size)
+{
+    for (int k = 0; k < ARENA_LARGE_BUCKETS; k++) {
+        if (size <= ((size_t) ARENA_LARGE_MIN << k)) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* Hands out a block of its own for a request too big for the chain */
+static void *newLargeBlock(CompilerArena *arena, size_t size)
+{
+    int bucket = largeBucket(size);
+    ArenaMemBlock *block = NULL;
+
+    android_atomic_inc(&numLargeAllocs);
+    if (bucket >= 0 && arena->largeFree[bucket] != NULL) {
+        block = arena->largeFree[bucket];
+        arena->largeFree[bucket] = block->next;
+        arena->largeFreeBytes -= block->blockSize;
+        android_atomic_inc(&numLargeReused);
+    } else {
+        size_t blockSize =
+            bucket >= 0 ? (size_t) ARENA_LARGE_MIN << bucket : size;
+        block = (ArenaMemBlock *) malloc(sizeof(ArenaMemBlock) + blockSize);
+        if (block == NULL) {
+            ALOGE("Arena allocation failure");
+            dvmAbort();
+        }
+        block->blockSize = blockSize;
+    }
+    block->bytesAllocated = size;
+    block->next = arena->largeInUse;
+    arena->largeInUse = block;
+    return block->ptr;
+}
+
 /* Arena-based malloc for compilation tasks */
 void * dvmCompilerNew(size_t size, bool zero)
 {
+    CompilerArena *arena = getArena();
+    ArenaMemBlock *currentArena;
+
     size = (size + 3) & ~3;
+    arena->bytesInUse += size;
+    if (size > ARENA_DEFAULT_SIZE) {
+        void *ptr = newLargeBlock(arena, size);
+        if (zero) {
+            memset(ptr, 0, size);
+        }
+        return ptr;
+    }
 retry:
+    currentArena = arena->current;
     /* Normal case - space is available in the current page */
     if (size + currentArena->bytesAllocated <= currentArena->blockSize) {
         void *ptr;
@@ -59,42 +158,85 @@ retry:
          * reset
          */
         if (currentArena->next) {
-            currentArena = currentArena->next;
+            arena->current = currentArena->next;
             goto retry;
         }
 
-        size_t blockSize = (size < ARENA_DEFAULT_SIZE) ?
-                          ARENA_DEFAULT_SIZE : size;
         /* Time to allocate a new arena */
         ArenaMemBlock *newArena = (ArenaMemBlock *)
-            malloc(sizeof(ArenaMemBlock) + blockSize);
+            malloc(sizeof(ArenaMemBlock) + ARENA_DEFAULT_SIZE);
         if (newArena == NULL) {
             ALOGE("Arena allocation failure");
             dvmAbort();
         }
-        newArena->blockSize = blockSize;
+        newArena->blockSize = ARENA_DEFAULT_SIZE;
         newArena->bytesAllocated = 0;
         newArena->next = NULL;
         currentArena->next = newArena;
-        currentArena = newArena;
-        numArenaBlocks++;
-        if (numArenaBlocks > 10)
-            ALOGI("Total arena pages for JIT: %d", numArenaBlocks);
+        arena->current = newArena;
+        int blocks = android_atomic_inc(&numArenaBlocks) + 1;
+        if (blocks > 10)
+            ALOGI("Total arena pages for JIT: %d", blocks);
         goto retry;
     }
     /* Should not reach here */
     dvmAbort();
 }
 
+/*
+ * Grows the most recent allocation in place if it is at the end of the
+ * current block and there is room behind it.  Returns false otherwise.
+ */
+static bool extendLastAllocation(void *ptr, size_t oldSize, size_t newSize)
+{
+    CompilerArena *arena = getArena();
+    ArenaMemBlock *block = arena->current;
+
+    oldSize = (oldSize + 3) & ~3;
+    newSize = (newSize + 3) & ~3;
+    if ((char *) ptr + oldSize != &block->ptr[block->bytesAllocated] ||
+        block->bytesAllocated - oldSize + newSize > block->blockSize) {
+        return false;
+    }
+    memset((char *) ptr + oldSize, 0, newSize - oldSize);
+    block->bytesAllocated += newSize - oldSize;
+    arena->bytesInUse += newSize - oldSize;
+    return true;
+}
+
 /* Reclaim all the arena blocks allocated so far */
 void dvmCompilerArenaReset(void)
 {
+    CompilerArena *arena = getArena();
     ArenaMemBlock *block;
 
-    for (block = arenaHead; block; block = block->next) {
+    for (block = arena->head; block; block = block->next) {
         block->bytesAllocated = 0;
     }
-    currentArena = arenaHead;
+    arena->current = arena->head;
+
+    /* Keep the large blocks for the next big compilation, within reason */
+    while (arena->largeInUse != NULL) {
+        block = arena->largeInUse;
+        arena->largeInUse = block->next;
+        int bucket = largeBucket(block->blockSize);
+        if (bucket < 0 ||
+            arena->largeFreeBytes + block->blockSize > ARENA_LARGE_RETAIN) {
+            free(block);
+            continue;
+        }
+        block->next = arena->largeFree[bucket];
+        arena->largeFree[bucket] = block;
+        arena->largeFreeBytes += block->blockSize;
+    }
+
+    int32_t used = (int32_t) arena->bytesInUse;
+    int32_t peak;
+    do {
+        peak = arenaHighWater;
+    } while (used > peak &&
+             android_atomic_release_cas(peak, used, &arenaHighWater) != 0);
+    arena->bytesInUse = 0;
 }
 
 /* Growable List initialization */
@@ -115,6 +257,12 @@ static void expandGrowableList(GrowableList *gList)
     } else {
         newLength += 128;
     }
+    if (extendLastAllocation(gList->elemList,
+                             sizeof(intptr_t) * gList->numAllocated,
+                             sizeof(intptr_t) * newLength)) {
+        gList->numAllocated = newLength;
+        return;
+    }
     intptr_t *newArray =
         (intptr_t *) dvmCompilerNew(sizeof(intptr_t) * newLength, true);
     memcpy(newArray, gList->elemList, sizeof(intptr_t) * gList->numAllocated);
@@ -244,11 +392,36 @@ void dvmCompilerDumpStats(void)
          gDvmJit.numCompilations,
          gDvmJit.templateSize,
          gDvmJit.codeCacheByteUsed - gDvmJit.templateSize);
-    ALOGD("Compiler arena uses %d blocks (%d bytes each)",
-         numArenaBlocks, ARENA_DEFAULT_SIZE);
+    if (gDvmJit.numCodeCacheEvictions != 0) {
+        ALOGD("Code cache: %d regions evicted with %d translations, "
+              "%d resets", gDvmJit.numCodeCacheEvictions,
+              gDvmJit.numTranslationsEvicted, gDvmJit.numCodeCacheReset);
+    }
+    ALOGD("Compiler arena uses %d blocks (%d bytes each), "
+          "peak %d bytes per compilation",
+         numArenaBlocks, ARENA_DEFAULT_SIZE, arenaHighWater);
+    if (numLargeAllocs != 0) {
+        ALOGD("Compiler arena: %d large allocations, %d from reused blocks",
+              numLargeAllocs, numLargeReused);
+    }
+    if (gDvmJit.recompileThreshold != 0) {
+        ALOGD("Tiers: %d baseline translations, %d recompiled in full",
+              gDvmJit.numBaselineTraces, gDvmJit.numTracesRecompiled);
+    }
     ALOGD("Compiler work queue length is %d/%d", gDvmJit.compilerQueueLength,
          gDvmJit.compilerMaxQueued);
+    if (gDvmJit.compilerOrdersDone != 0) {
+        ALOGD("Compiler threads: %d, %d orders: queued %lld/%lld us, "
+              "compiled %lld/%lld us (avg/max)",
+              gDvmJit.numCompilerThreads, gDvmJit.compilerOrdersDone,
+              gDvmJit.compilerQueueTime / gDvmJit.compilerOrdersDone,
+              gDvmJit.compilerMaxQueueTime,
+              gDvmJit.compilerWorkTime / gDvmJit.compilerOrdersDone,
+              gDvmJit.compilerMaxWorkTime);
+    }
     dvmJitStats();
+    dvmJitICSiteDumpStats();
+    dvmJitBudgetDumpStats();
     dvmCompilerArchDump();
     if (gDvmJit.methodStatsTable) {
         dvmHashForeach(gDvmJit.methodStatsTable, dumpMethodStats,
@@ -409,5 +582,6 @@ void dvmGetBlockName(BasicBlock *bb, char *name)
 }
 
 void dvmCompilerCacheFlush(uintptr_t start, uintptr_t end) {
+    gDvmJit.numCodeCacheFlushes++;
     __builtin___clear_cache(reinterpret_cast<void*>(start), reinterpret_cast<void*>(end));
 }
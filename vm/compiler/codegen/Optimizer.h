@@ -30,6 +30,9 @@ enum optControlVector {
     kSuppressLoads,
     kMethodInlining,
     kMethodJit,
+    kExtendedBlocks,
+    kDeadWritebacks,
+    kCardMarkElision,
 };
 
 /* Forward declarations */
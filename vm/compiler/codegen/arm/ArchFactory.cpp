@@ -65,6 +65,47 @@ static TGT_LIR *genNullCheck(CompilationUnit *cUnit, int sReg, int mReg,
     return genRegImmCheck(cUnit, kArmCondEq, mReg, 0, dOffset, pcrLabel);
 }
 
+/*
+ * Null-check for an access <displacement> bytes into the object in mReg.
+ * If the access can do the check itself, by faulting, nothing is emitted
+ * and true is returned; the caller then emits the access and passes it to
+ * genNullFaultSite.  Otherwise this is just genNullCheck.
+ */
+static bool genImplicitNullCheck(CompilationUnit *cUnit, int sReg, int mReg,
+                                 int dOffset, int displacement)
+{
+    if (dvmIsBitSet(cUnit->regPool->nullCheckedRegs, sReg)) {
+        return false;
+    }
+    if (!gDvmJit.implicitNullChecks || cUnit->jitMode == kJitMethod ||
+        displacement < 0 || displacement >= JIT_NULL_FAULT_LIMIT) {
+        genNullCheck(cUnit, sReg, mReg, dOffset, NULL);
+        return false;
+    }
+    dvmSetBit(cUnit->regPool->nullCheckedRegs, sReg);
+    return true;
+}
+
+/*
+ * Record the instruction just emitted as the null check of the Dalvik
+ * instruction at dOffset, to be matched by the fault handler once the
+ * translation is installed.
+ */
+static void genNullFaultSite(CompilationUnit *cUnit, int dOffset)
+{
+    ArmLIR *access = (ArmLIR *) cUnit->lastLIRInsn;
+
+    /* Forget all def info, as the interpreter may take over here */
+    dvmCompilerResetDefTracking(cUnit);
+    /* Nothing may move across the access, or the frame would be off */
+    access->defMask = ENCODE_ALL;
+
+    ArmLIR *site = (ArmLIR *) dvmCompilerNew(sizeof(ArmLIR), true);
+    site->operands[0] = (int) (cUnit->method->insns + dOffset);
+    site->generic.target = (LIR *) access;
+    dvmInsertGrowableList(&cUnit->nullFaultList, (intptr_t) site);
+}
+
 /*
  * Perform a "reg cmp reg" operation and jump to the PCR region if condition
  * satisfies.
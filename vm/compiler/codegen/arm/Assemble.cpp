@@ -20,6 +20,7 @@
 #include "../../CompilerInternals.h"
 #include "ArmLIR.h"
 #include "Codegen.h"
+#include "compiler/InlineCache.h"
 #include <sys/mman.h>           /* for protection change */
 
 #define MAX_ASSEMBLER_RETRIES 10
@@ -933,6 +934,27 @@ ArmEncodingMap EncodingMap[kArmLast] = {
 #define UPDATE_CODE_CACHE_PATCHES()
 #endif
 
+/*
+ * Record the accesses that do their own null checks with the fault
+ * handler.  Returns false if they couldn't all be recorded.
+ */
+static bool installNullFaultSites(CompilationUnit *cUnit)
+{
+    ArmLIR **sites = (ArmLIR **) cUnit->nullFaultList.elemList;
+    unsigned int i;
+
+    for (i = 0; i < cUnit->nullFaultList.numUsed; i++) {
+        ArmLIR *access = (ArmLIR *) sites[i]->generic.target;
+        assert(!access->flags.isNop);
+        if (!dvmJitNullFaultRecord(
+                (char *) cUnit->baseAddr + access->generic.offset,
+                (const u2 *) sites[i]->operands[0])) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /* Write the numbers in the constant and class pool to the output stream */
 static void installLiteralPools(CompilationUnit *cUnit)
 {
@@ -1397,6 +1419,9 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
         0 : getTraceDescriptionSize(cUnit->traceDesc);
     int chainingCellGap = 0;
 
+    /* The code is assembled for the current end of the code cache */
+    dvmCompilerLockInstall(info);
+
     info->instructionSet = cUnit->instructionSet;
 
     /* Beginning offset needs to allow space for chain cell offset */
@@ -1461,8 +1486,8 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
 
     cUnit->totalSize = offset;
 
-    if (gDvmJit.codeCacheByteUsed + cUnit->totalSize > gDvmJit.codeCacheSize) {
-        gDvmJit.codeCacheFull = true;
+    char *codeAddr = dvmCompilerCodeCacheAddr(cUnit->totalSize);
+    if (codeAddr == NULL) {
         info->discardResult = true;
         return;
     }
@@ -1479,8 +1504,7 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
      * Attempt to assemble the trace.  Note that assembleInstructions
      * may rewrite the code sequence and request a retry.
      */
-    cUnit->assemblerStatus = assembleInstructions(cUnit,
-          (intptr_t) gDvmJit.codeCache + gDvmJit.codeCacheByteUsed);
+    cUnit->assemblerStatus = assembleInstructions(cUnit, (intptr_t) codeAddr);
 
     switch(cUnit->assemblerStatus) {
         case kSuccess:
@@ -1530,8 +1554,24 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
         return;
     }
 
-    cUnit->baseAddr = (char *) gDvmJit.codeCache + gDvmJit.codeCacheByteUsed;
-    gDvmJit.codeCacheByteUsed += offset;
+    if (!dvmCompilerCodeCacheCommit(codeAddr, offset)) {
+        /* A region was evicted meanwhile - assemble for the new top */
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        if (cUnit->jitMode != kJitMethod) {
+            chainCellOffsetLIR->operands[0] = CHAIN_CELL_OFFSET_TAG;
+        }
+        cUnit->assemblerStatus = kRetryAll;
+        return;
+    }
+    cUnit->baseAddr = codeAddr;
+
+    /* The space stays claimed, but nothing will ever branch to it */
+    if (!installNullFaultSites(cUnit)) {
+        info->discardResult = true;
+        info->codeAddress = NULL;
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        return;
+    }
 
     UNPROTECT_CODE_CACHE(cUnit->baseAddr, offset);
 
@@ -1662,7 +1702,8 @@ void* dvmJitChain(void* tgtAddr, u4* branchAddr)
         UNPROTECT_CODE_CACHE(branchAddr, sizeof(*branchAddr));
 
         *branchAddr = newInst;
-        dvmCompilerCacheFlush((long)branchAddr, (long)branchAddr + 4);
+        /* Until flushed, the cell just keeps going through the interpreter */
+        dvmCompilerQueueCacheFlush((long)branchAddr, (long)branchAddr + 4);
         UPDATE_CODE_CACHE_PATCHES();
 
         PROTECT_CODE_CACHE(branchAddr, sizeof(*branchAddr));
@@ -1688,8 +1729,31 @@ static void inlineCachePatchEnqueue(PredictedChainingCell *cellAddr,
      */
     dvmLockMutex(&gDvmJit.compilerICPatchLock);
 
+    /* Already retired and waiting to be patched - the latest callee wins */
+    if (cellAddr->clazz ==
+            (const ClassObject *) PREDICTED_CHAIN_RETIRED_CLAZZ) {
+        int index = 0;
+        while (index < gDvmJit.compilerICPatchIndex &&
+               gDvmJit.compilerICPatchQueue[index].cellAddr != cellAddr) {
+            index++;
+        }
+        /* The patch may have been dropped with the code cache region */
+        if (index == gDvmJit.compilerICPatchIndex &&
+            index < COMPILER_IC_PATCH_QUEUE_SIZE) {
+            gDvmJit.compilerICPatchIndex++;
+        }
+        if (index < gDvmJit.compilerICPatchIndex) {
+            ICPatchWorkOrder *workOrder = &gDvmJit.compilerICPatchQueue[index];
+            const ClassObject *clazz = newContent->clazz;
+
+            workOrder->cellAddr = cellAddr;
+            workOrder->cellContent = *newContent;
+            workOrder->classDescriptor = clazz->descriptor;
+            workOrder->classLoader = clazz->classLoader;
+            workOrder->serialNumber = clazz->serialNumber;
+        }
     /* Fast path for uninitialized chaining cell */
-    if (cellAddr->clazz == NULL &&
+    } else if (cellAddr->clazz == NULL &&
         cellAddr->branch == PREDICTED_CHAIN_BX_PAIR_INIT) {
 
         UNPROTECT_CODE_CACHE(cellAddr, sizeof(*cellAddr));
@@ -1740,13 +1804,23 @@ static void inlineCachePatchEnqueue(PredictedChainingCell *cellAddr,
         gDvmJit.icPatchLockFree++;
 #endif
     /*
-     * Cannot patch the chaining cell inline - queue it until the next safe
-     * point.
+     * Cannot patch the chaining cell inline - retire it so that it misses
+     * from now on, and queue the patch until no thread can still be using
+     * the old contents.
      */
     } else if (gDvmJit.compilerICPatchIndex < COMPILER_IC_PATCH_QUEUE_SIZE) {
         int index = gDvmJit.compilerICPatchIndex++;
         const ClassObject *clazz = newContent->clazz;
 
+        UNPROTECT_CODE_CACHE(cellAddr, sizeof(*cellAddr));
+
+        /* Only data is changed, so there is nothing to flush */
+        android_atomic_release_store(PREDICTED_CHAIN_RETIRED_CLAZZ,
+            (volatile int32_t *)(void *)&cellAddr->clazz);
+        UPDATE_CODE_CACHE_PATCHES();
+
+        PROTECT_CODE_CACHE(cellAddr, sizeof(*cellAddr));
+
         gDvmJit.compilerICPatchQueue[index].cellAddr = cellAddr;
         gDvmJit.compilerICPatchQueue[index].cellContent = *newContent;
         gDvmJit.compilerICPatchQueue[index].classDescriptor = clazz->descriptor;
@@ -1765,6 +1839,28 @@ static void inlineCachePatchEnqueue(PredictedChainingCell *cellAddr,
 
     dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
 }
+
+static void applyInlineCachePatches(bool resolveClasses);
+
+/*
+ * Patches the retired cells right away if no other thread can be in the
+ * middle of using one, instead of waiting for the next GC to suspend them
+ * all.  The thread list lock is only tried: whoever holds it may be about
+ * to suspend us.
+ */
+static void patchRetiredInlineCaches(void)
+{
+    if (gDvmJit.compilerICPatchIndex == 0 || !dvmTryLockThreadList()) {
+        return;
+    }
+    if (dvmCompilerChainingCellsQuiescent()) {
+        applyInlineCachePatches(false);
+#if defined(WITH_JIT_TUNING)
+        gDvmJit.icPatchUnsuspended++;
+#endif
+    }
+    dvmUnlockThreadList();
+}
 #endif
 
 /*
@@ -1821,6 +1917,17 @@ const Method *dvmJitToPatchPredictedChain(const Method *method,
         goto done;
     }
 
+    /* Leave polymorphic sites alone unless the new class dominates */
+    switch (dvmJitICSiteRechain(cell, clazz)) {
+        case kJitICSiteKeep:
+            goto done;
+        case kJitICSiteMegamorphic:
+            newRechainCount = PREDICTED_CHAIN_COUNTER_AVOID;
+            goto done;
+        default:
+            break;
+    }
+
     if (cell->clazz == NULL) {
         newRechainCount = self->icRechainCount;
     }
@@ -1835,12 +1942,13 @@ const Method *dvmJitToPatchPredictedChain(const Method *method,
 
     /*
      * Enter the work order to the queue and the chaining cell will be patched
-     * the next time a safe point is entered.
+     * as soon as no thread can be using it, or at the next safe point.
      *
      * If the enqueuing fails reset the rechain count to a normal value so that
      * it won't get indefinitely delayed.
      */
     inlineCachePatchEnqueue(cell, &newCell);
+    patchRetiredInlineCaches();
 #endif
 done:
     self->icRechainCount = newRechainCount;
@@ -1849,21 +1957,14 @@ done:
 
 /*
  * Patch the inline cache content based on the content passed from the work
- * order.
+ * order.  Resolving the classes again is a check that can only be afforded
+ * with the threads suspended.
  */
-void dvmCompilerPatchInlineCache(void)
+static void applyInlineCachePatches(bool resolveClasses)
 {
     int i;
     PredictedChainingCell *minAddr, *maxAddr;
 
-    /* Nothing to be done */
-    if (gDvmJit.compilerICPatchIndex == 0) return;
-
-    /*
-     * Since all threads are already stopped we don't really need to acquire
-     * the lock. But race condition can be easily introduced in the future w/o
-     * paying attention so we still acquire the lock here.
-     */
     dvmLockMutex(&gDvmJit.compilerICPatchLock);
 
     UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
@@ -1879,30 +1980,41 @@ void dvmCompilerPatchInlineCache(void)
         ICPatchWorkOrder *workOrder = &gDvmJit.compilerICPatchQueue[i];
         PredictedChainingCell *cellAddr = workOrder->cellAddr;
         PredictedChainingCell *cellContent = &workOrder->cellContent;
-        ClassObject *clazz = dvmFindClassNoInit(workOrder->classDescriptor,
-                                                workOrder->classLoader);
 
-        assert(clazz->serialNumber == workOrder->serialNumber);
+        if (resolveClasses) {
+            ClassObject *clazz =
+                dvmFindClassNoInit(workOrder->classDescriptor,
+                                   workOrder->classLoader);
+
+            assert(clazz->serialNumber == workOrder->serialNumber);
 
-        /* Use the newly resolved clazz pointer */
-        cellContent->clazz = clazz;
+            /* Use the newly resolved clazz pointer */
+            cellContent->clazz = clazz;
+        }
 
         COMPILER_TRACE_CHAINING(
-            ALOGD("Jit Runtime: predicted chain %p from %s to %s (%s) "
-                 "patched",
+            ALOGD("Jit Runtime: predicted chain %p to %s (%s) patched",
                  cellAddr,
-                 cellAddr->clazz->descriptor,
                  cellContent->clazz->descriptor,
                  cellContent->method->name));
 
-        /* Patch the chaining cell */
-        *cellAddr = *cellContent;
+        /* Patch the chaining cell but leave it retired for now */
+        cellAddr->branch = cellContent->branch;
+        cellAddr->method = cellContent->method;
+        cellAddr->stagedClazz = cellContent->stagedClazz;
         minAddr = (cellAddr < minAddr) ? cellAddr : minAddr;
         maxAddr = (cellAddr > maxAddr) ? cellAddr : maxAddr;
     }
 
     /* Then synchronize the I/D cache */
     dvmCompilerCacheFlush((long) minAddr, (long) (maxAddr+1));
+
+    /* Only then can the cells match again */
+    for (i = 0; i < gDvmJit.compilerICPatchIndex; i++) {
+        ICPatchWorkOrder *workOrder = &gDvmJit.compilerICPatchQueue[i];
+        android_atomic_release_store((int32_t)workOrder->cellContent.clazz,
+            (volatile int32_t *)(void *)&workOrder->cellAddr->clazz);
+    }
     UPDATE_CODE_CACHE_PATCHES();
 
     PROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
@@ -1911,14 +2023,52 @@ void dvmCompilerPatchInlineCache(void)
     dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
 }
 
+void dvmCompilerPatchInlineCache(void)
+{
+    /* Nothing to be done */
+    if (gDvmJit.compilerICPatchIndex == 0) return;
+
+    /*
+     * Since all threads are already stopped we don't really need to acquire
+     * the lock. But race condition can be easily introduced in the future w/o
+     * paying attention so we still acquire the lock here.
+     */
+    applyInlineCachePatches(true);
+}
+
+/*
+ * Returns the target of the branch a chaining cell starts with, or NULL
+ * if the cell isn't chained.  See assembleChainingBranch.
+ */
+static const char *chainingCellTarget(const u4 *cell)
+{
+    u4 thumb1 = *cell & 0xffff;
+    u4 thumb2 = *cell >> 16;
+    int branchOffset;
+
+    if ((thumb1 & 0xf800) == getSkeleton(kThumbBl1)) {
+        branchOffset = (((int) (thumb1 & 0x7ff) << 21) >> 9) |
+                       ((thumb2 & 0x7ff) << 1);
+    } else if ((thumb1 & 0xf800) == getSkeleton(kThumbBUncond)) {
+        branchOffset = ((int) (thumb1 & 0x7ff) << 21) >> 20;
+        if (branchOffset == 0) {
+            return NULL;
+        }
+    } else {
+        return NULL;
+    }
+    return (const char *) cell + 4 + branchOffset;
+}
+
 /*
  * Unchain a trace given the starting address of the translation
  * in the code cache.  Refer to the diagram in dvmCompilerAssembleLIR.
- * Returns the address following the last cell unchained.  Note that
+ * If start is not NULL, only the cells chained to [start, end) are
+ * unchained.  Returns the address following the last cell.  Note that
  * the incoming codeAddr is a thumb code address, and therefore has
  * the low bit set.
  */
-static u4* unchainSingle(JitEntry *trace)
+static u4* unchainSingle(JitEntry *trace, const char *start, const char *end)
 {
     const char *base = getTraceBase(trace);
     ChainCellCounts *pChainCellCounts = getChainCellCountsPointer(base);
@@ -1943,6 +2093,13 @@ static u4* unchainSingle(JitEntry *trace)
         }
 
         for (j = 0; j < pChainCellCounts->u.count[i]; j++) {
+            if (start != NULL) {
+                const char *target = chainingCellTarget(pChainCells);
+                if (target < start || target >= end) {
+                    pChainCells += elemSize;
+                    continue;
+                }
+            }
             switch(i) {
                 case kChainingCellNormal:
                 case kChainingCellHot:
@@ -2001,7 +2158,8 @@ void dvmJitUnchainAll()
                 (gDvmJit.pJitEntryTable[i].codeAddress !=
                  dvmCompilerGetInterpretTemplate())) {
                 u4* lastAddress;
-                lastAddress = unchainSingle(&gDvmJit.pJitEntryTable[i]);
+                lastAddress = unchainSingle(&gDvmJit.pJitEntryTable[i],
+                                            NULL, NULL);
                 if (lowAddress == NULL ||
                       (u4*)gDvmJit.pJitEntryTable[i].codeAddress <
                       lowAddress)
@@ -2021,6 +2179,67 @@ void dvmJitUnchainAll()
     gDvmJit.hasNewChain = false;
 }
 
+/*
+ * Unchain the cells of the translations outside [start, end) that are
+ * chained into it, so that the code there can be discarded.  Must be
+ * called at a safe point with tableLock held.
+ */
+void dvmJitUnchainRange(const char *start, const char *end)
+{
+    u4* lowAddress = NULL;
+    u4* highAddress = NULL;
+
+    UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+
+    for (size_t i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        const char *codeAddr = (const char *) entry->codeAddress;
+        if (entry->dPC && !entry->u.info.isMethodEntry && codeAddr &&
+            codeAddr != dvmCompilerGetInterpretTemplate() &&
+            (codeAddr < start || codeAddr >= end)) {
+            u4* lastAddress = unchainSingle(entry, start, end);
+            if (lowAddress == NULL || (u4*) codeAddr < lowAddress)
+                lowAddress = (u4*) codeAddr;
+            if (lastAddress > highAddress)
+                highAddress = lastAddress;
+        }
+    }
+    if (lowAddress && highAddress)
+        dvmCompilerCacheFlush((long)lowAddress, (long)highAddress);
+    UPDATE_CODE_CACHE_PATCHES();
+
+    PROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+}
+
+/*
+ * Unchain a translation that has been replaced in the JitTable, and the
+ * cells chained into it, so that it is no longer reached.  <entry> is a
+ * copy of its old JitTable entry.  Must be called at a safe point with
+ * tableLock held.
+ */
+void dvmJitUnchainReplaced(const JitEntry *entry)
+{
+    JitEntry trace = *entry;
+    const char *base = getTraceBase(&trace);
+    /* Chained branches go to the counter or past it */
+    const char *entryEnd = (const char *) trace.codeAddress +
+                           trace.u.info.profileOffset + 2;
+
+    UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+    u4 *lastAddress = unchainSingle(&trace, NULL, NULL);
+    dvmCompilerCacheFlush((long) trace.codeAddress, (long) lastAddress);
+    UPDATE_CODE_CACHE_PATCHES();
+    PROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+
+    dvmJitUnchainRange(base, entryEnd);
+}
+
+/* Returns the number of times the translation of <entry> has been run */
+JitTraceCounter_t dvmJitGetTraceCount(const JitEntry *entry)
+{
+    return getProfileCount(entry);
+}
+
 typedef struct jitProfileAddrToLine {
     u4 lineNum;
     u4 bytecodeOffset;
@@ -2316,7 +2535,7 @@ void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
      * thread if there is a pending request before the state is actually
      * changed to RUNNING.
      */
-    dvmChangeStatus(gDvmJit.compilerThread, THREAD_RUNNING);
+    dvmChangeStatus(dvmThreadSelf(), THREAD_RUNNING);
 
     /*
      * Unprotecting the code cache will need to acquire the code cache
@@ -2360,7 +2579,7 @@ void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
     PROTECT_CODE_CACHE(startClassPointerP, numClassPointers * sizeof(intptr_t));
 
     /* Change the thread state back to VMWAIT */
-    dvmChangeStatus(gDvmJit.compilerThread, THREAD_VMWAIT);
+    dvmChangeStatus(dvmThreadSelf(), THREAD_VMWAIT);
 }
 
 #if defined(WITH_SELF_VERIFICATION)
@@ -98,6 +98,7 @@ const Method *dvmJitToPatchPredictedChain(const Method *method,
 
 /* Originally declared in alloc/Alloc.h */
 Object* dvmAllocObject(ClassObject* clazz, int flags);  // OP_NEW_INSTANCE
+Object* dvmAllocObjectFast(ClassObject* clazz, Thread* self); // OP_NEW_INSTANCE
 
 /*
  * Functions declared in gDvmInlineOpsTable[] are used for
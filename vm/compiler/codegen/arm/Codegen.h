@@ -23,6 +23,8 @@
  */
 
 #include "compiler/CompilerIR.h"
+#include "compiler/TypeProfile.h"
+#include "compiler/NullFault.h"
 #include "CalloutHelper.h"
 
 #if defined(_CODEGEN_C)
@@ -308,14 +308,17 @@ static void genIGetWide(CompilationUnit *cUnit, MIR *mir, int fieldOffset)
 
     assert(rlDest.wide);
 
-    genNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg, mir->offset,
-                 NULL);/* null object? */
+    bool faults = genImplicitNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg,
+                                       mir->offset, fieldOffset);
     opRegRegImm(cUnit, kOpAdd, regPtr, rlObj.lowReg, fieldOffset);
     rlResult = dvmCompilerEvalLoc(cUnit, rlDest, kAnyReg, true);
 
     HEAP_ACCESS_SHADOW(true);
     loadPair(cUnit, regPtr, rlResult.lowReg, rlResult.highReg);
     HEAP_ACCESS_SHADOW(false);
+    if (faults) {
+        genNullFaultSite(cUnit, mir->offset);
+    }
 
     dvmCompilerFreeTemp(cUnit, regPtr);
     storeValueWide(cUnit, rlDest, rlResult);
@@ -329,14 +332,17 @@ static void genIPutWide(CompilationUnit *cUnit, MIR *mir, int fieldOffset)
     rlObj = loadValue(cUnit, rlObj, kCoreReg);
     int regPtr;
     rlSrc = loadValueWide(cUnit, rlSrc, kAnyReg);
-    genNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg, mir->offset,
-                 NULL);/* null object? */
+    bool faults = genImplicitNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg,
+                                       mir->offset, fieldOffset);
     regPtr = dvmCompilerAllocTemp(cUnit);
     opRegRegImm(cUnit, kOpAdd, regPtr, rlObj.lowReg, fieldOffset);
 
     HEAP_ACCESS_SHADOW(true);
     storePair(cUnit, regPtr, rlSrc.lowReg, rlSrc.highReg);
     HEAP_ACCESS_SHADOW(false);
+    if (faults) {
+        genNullFaultSite(cUnit, mir->offset);
+    }
 
     dvmCompilerFreeTemp(cUnit, regPtr);
 }
@@ -354,13 +360,23 @@ static void genIGet(CompilationUnit *cUnit, MIR *mir, OpSize size,
     RegLocation rlDest = dvmCompilerGetDest(cUnit, mir, 0);
     rlObj = loadValue(cUnit, rlObj, kCoreReg);
     rlResult = dvmCompilerEvalLoc(cUnit, rlDest, regClass, true);
-    genNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg, mir->offset,
-                 NULL);/* null object? */
+    /* A volatile load keeps its check ahead of the barrier */
+    bool faults = false;
+    if (isVolatile) {
+        genNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg, mir->offset,
+                     NULL);/* null object? */
+    } else {
+        faults = genImplicitNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg,
+                                      mir->offset, fieldOffset);
+    }
 
     HEAP_ACCESS_SHADOW(true);
     loadBaseDisp(cUnit, mir, rlObj.lowReg, fieldOffset, rlResult.lowReg,
                  size, rlObj.sRegLow);
     HEAP_ACCESS_SHADOW(false);
+    if (faults) {
+        genNullFaultSite(cUnit, mir->offset);
+    }
     if (isVolatile) {
         dvmCompilerGenMemBarrier(cUnit, kISH);
     }
@@ -380,19 +396,26 @@ static void genIPut(CompilationUnit *cUnit, MIR *mir, OpSize size,
     RegLocation rlObj = dvmCompilerGetSrc(cUnit, mir, 1);
     rlObj = loadValue(cUnit, rlObj, kCoreReg);
     rlSrc = loadValue(cUnit, rlSrc, regClass);
-    genNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg, mir->offset,
-                 NULL);/* null object? */
-
+    /* A volatile store has to be checked before the barrier */
+    bool faults = false;
     if (isVolatile) {
+        genNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg, mir->offset,
+                     NULL);/* null object? */
         dvmCompilerGenMemBarrier(cUnit, kISHST);
+    } else {
+        faults = genImplicitNullCheck(cUnit, rlObj.sRegLow, rlObj.lowReg,
+                                      mir->offset, fieldOffset);
     }
     HEAP_ACCESS_SHADOW(true);
     storeBaseDisp(cUnit, rlObj.lowReg, fieldOffset, rlSrc.lowReg, size);
     HEAP_ACCESS_SHADOW(false);
+    if (faults) {
+        genNullFaultSite(cUnit, mir->offset);
+    }
     if (isVolatile) {
         dvmCompilerGenMemBarrier(cUnit, kISH);
     }
-    if (isObject) {
+    if (isObject && !(mir->OptimizationFlags & MIR_IGNORE_CARD_MARK)) {
         /* NOTE: marking card based on object head */
         markCard(cUnit, rlSrc.lowReg, rlObj.lowReg);
     }
@@ -626,40 +649,9 @@ static void genArrayObjectPut(CompilationUnit *cUnit, MIR *mir,
     dvmCompilerFreeTemp(cUnit, regIndex);
 
     /* NOTE: marking card here based on object head */
-    markCard(cUnit, r0, r1);
-}
-
-static bool genShiftOpLong(CompilationUnit *cUnit, MIR *mir,
-                           RegLocation rlDest, RegLocation rlSrc1,
-                           RegLocation rlShift)
-{
-    /*
-     * Don't mess with the regsiters here as there is a particular calling
-     * convention to the out-of-line handler.
-     */
-    RegLocation rlResult;
-
-    loadValueDirectWideFixed(cUnit, rlSrc1, r0, r1);
-    loadValueDirect(cUnit, rlShift, r2);
-    switch( mir->dalvikInsn.opcode) {
-        case OP_SHL_LONG:
-        case OP_SHL_LONG_2ADDR:
-            genDispatchToHandler(cUnit, TEMPLATE_SHL_LONG);
-            break;
-        case OP_SHR_LONG:
-        case OP_SHR_LONG_2ADDR:
-            genDispatchToHandler(cUnit, TEMPLATE_SHR_LONG);
-            break;
-        case OP_USHR_LONG:
-        case OP_USHR_LONG_2ADDR:
-            genDispatchToHandler(cUnit, TEMPLATE_USHR_LONG);
-            break;
-        default:
-            return true;
+    if (!(mir->OptimizationFlags & MIR_IGNORE_CARD_MARK)) {
+        markCard(cUnit, r0, r1);
     }
-    rlResult = dvmCompilerGetReturnWide(cUnit);
-    storeValueWide(cUnit, rlDest, rlResult);
-    return false;
 }
 
 static bool genArithOpLong(CompilationUnit *cUnit, MIR *mir,
@@ -1472,6 +1464,24 @@ static void genSuspendPoll(CompilationUnit *cUnit, MIR *mir)
     genRegImmCheck(cUnit, kArmCondNe, rTemp, 0, mir->offset, NULL);
 }
 
+/*
+ * Whether codegen can carry on from bb into nextBB without resetting the
+ * register state, which holds when bb is the only way into nextBB.  The
+ * values bb leaves in registers, and the null checks it has done, are then
+ * still good at the top of nextBB.
+ */
+static bool canExtendCodegenBlock(BasicBlock *bb, BasicBlock *nextBB)
+{
+    if (gDvmJit.disableOpt & (1 << kExtendedBlocks)) {
+        return false;
+    }
+    return nextBB != NULL && nextBB->blockType == kDalvikByteCode &&
+           nextBB->visited == false && nextBB->hidden == false &&
+           nextBB->isFallThroughFromInvoke == false &&
+           dvmCountSetBits(nextBB->predecessors) == 1 &&
+           dvmIsBitSet(nextBB->predecessors, bb->id);
+}
+
 /*
  * The following are the first-level codegen routines that analyze the format
  * of each bytecode then either dispatch special purpose codegen routines
@@ -1507,7 +1517,7 @@ static bool handleFmt10t_Fmt20t_Fmt30t(CompilationUnit *cUnit, MIR *mir,
 static bool handleFmt10x(CompilationUnit *cUnit, MIR *mir)
 {
     Opcode dalvikOpcode = mir->dalvikInsn.opcode;
-    if ((dalvikOpcode >= OP_UNUSED_3E) && (dalvikOpcode <= OP_UNUSED_43)) {
+    if ((dalvikOpcode >= OP_UNUSED_40) && (dalvikOpcode <= OP_UNUSED_43)) {
         ALOGE("Codegen: got unused opcode %#x",dalvikOpcode);
         return true;
     }
@@ -1776,7 +1786,9 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             }
             if (isSputObject) {
                 /* NOTE: marking card based sfield->clazz */
-                markCard(cUnit, rlSrc.lowReg, objHead);
+                if (!(mir->OptimizationFlags & MIR_IGNORE_CARD_MARK)) {
+                    markCard(cUnit, rlSrc.lowReg, objHead);
+                }
                 dvmCompilerFreeTemp(cUnit, objHead);
             }
 
@@ -1826,9 +1838,19 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             assert((classPtr->accessFlags & (ACC_INTERFACE|ACC_ABSTRACT)) == 0);
             dvmCompilerFlushAllRegs(cUnit);   /* Everything to home location */
             genExportPC(cUnit, mir);
-            LOAD_FUNC_ADDR(cUnit, r2, (int)dvmAllocObject);
-            loadConstant(cUnit, r0, (int) classPtr);
-            loadConstant(cUnit, r1, ALLOC_DONT_TRACK);
+            /*
+             * The class is initialized by now, so whether it can take the
+             * TLAB fast path is already known.
+             */
+            if (classPtr->fastAllocSize != 0) {
+                LOAD_FUNC_ADDR(cUnit, r2, (int)dvmAllocObjectFast);
+                loadConstant(cUnit, r0, (int) classPtr);
+                genRegCopy(cUnit, r1, r6SELF);
+            } else {
+                LOAD_FUNC_ADDR(cUnit, r2, (int)dvmAllocObject);
+                loadConstant(cUnit, r0, (int) classPtr);
+                loadConstant(cUnit, r1, ALLOC_DONT_TRACK);
+            }
             opReg(cUnit, kOpBlx, r2);
             dvmCompilerClobberCallRegs(cUnit);
             /* generate a branch over if allocation is successful */
@@ -1888,6 +1910,16 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             LOAD_FUNC_ADDR(cUnit, r2, (int)dvmInstanceofNonTrivial);
             opRegReg(cUnit, kOpCmp, r0, r1);
             ArmLIR *branch2 = opCondBranch(cUnit, kArmCondEq);
+            /* Then for the subclass seen when the trace was selected */
+            const ClassObject *seenClass =
+                dvmJitTypeProfileLookup(cUnit->method->insns + mir->offset);
+            ArmLIR *branch3 = NULL;
+            if (seenClass != NULL && seenClass != classPtr &&
+                dvmInstanceof(seenClass, classPtr)) {
+                loadConstant(cUnit, r3, (int) seenClass);
+                opRegReg(cUnit, kOpCmp, r0, r3);
+                branch3 = opCondBranch(cUnit, kArmCondEq);
+            }
             opReg(cUnit, kOpBlx, r2);
             dvmCompilerClobberCallRegs(cUnit);
             /*
@@ -1901,6 +1933,9 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             target->defMask = ENCODE_ALL;
             branch1->generic.target = (LIR *)target;
             branch2->generic.target = (LIR *)target;
+            if (branch3 != NULL) {
+                branch3->generic.target = (LIR *)target;
+            }
             break;
         }
         case OP_SGET_WIDE_VOLATILE:
@@ -2162,8 +2197,14 @@ static bool handleFmt21t(CompilationUnit *cUnit, MIR *mir, BasicBlock *bb,
     }
     ArmLIR* branch = genCmpImmBranch(cUnit, cond, rlSrc.lowReg, 0);
     branch->generic.target = (LIR*)&labelList[bb->taken->id];
-    /* This mostly likely will be optimized away in a later phase */
-    genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    /* Carry on into the fall-through block if nothing else can reach it */
+    if (bb->taken != bb->fallThrough &&
+        canExtendCodegenBlock(bb, bb->fallThrough)) {
+        cUnit->nextCodegenBlock = bb->fallThrough;
+    } else {
+        /* This mostly likely will be optimized away in a later phase */
+        genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    }
     return false;
 }
 
@@ -2557,10 +2598,30 @@ static bool handleFmt22c(CompilationUnit *cUnit, MIR *mir)
             loadConstant(cUnit, r0, 1);                /* Assume true */
             opRegReg(cUnit, kOpCmp, r1, r2);
             ArmLIR *branch2 = opCondBranch(cUnit, kArmCondEq);
+            /*
+             * Then for the class seen when the trace was selected, whose
+             * answer is known now.
+             */
+            const ClassObject *seenClass =
+                dvmJitTypeProfileLookup(cUnit->method->insns + mir->offset);
+            ArmLIR *branch3 = NULL;
+            if (seenClass != NULL && seenClass != classPtr) {
+                loadConstant(cUnit, r0, (int) seenClass);
+                opRegReg(cUnit, kOpCmp, r1, r0);
+                branch3 = opCondBranch(cUnit, kArmCondEq);
+            }
             genRegCopy(cUnit, r0, r1);
             genRegCopy(cUnit, r1, r2);
             opReg(cUnit, kOpBlx, r3);
             dvmCompilerClobberCallRegs(cUnit);
+            ArmLIR *branchOver = NULL;
+            if (branch3 != NULL) {
+                branchOver = opNone(cUnit, kOpUncondBr);
+                ArmLIR *seenTarget = newLIR0(cUnit, kArmPseudoTargetLabel);
+                seenTarget->defMask = ENCODE_ALL;
+                branch3->generic.target = (LIR *)seenTarget;
+                loadConstant(cUnit, r0, dvmInstanceof(seenClass, classPtr));
+            }
             /* branch target here */
             ArmLIR *target = newLIR0(cUnit, kArmPseudoTargetLabel);
             target->defMask = ENCODE_ALL;
@@ -2568,6 +2629,9 @@ static bool handleFmt22c(CompilationUnit *cUnit, MIR *mir)
             storeValue(cUnit, rlDest, rlResult);
             branch1->generic.target = (LIR *)target;
             branch2->generic.target = (LIR *)target;
+            if (branchOver != NULL) {
+                branchOver->generic.target = (LIR *)target;
+            }
             break;
         }
         case OP_IGET_WIDE:
@@ -2683,8 +2747,14 @@ static bool handleFmt22t(CompilationUnit *cUnit, MIR *mir, BasicBlock *bb,
             dvmCompilerAbort(cUnit);
     }
     genConditionalBranch(cUnit, cond, &labelList[bb->taken->id]);
-    /* This mostly likely will be optimized away in a later phase */
-    genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    /* Carry on into the fall-through block if nothing else can reach it */
+    if (bb->taken != bb->fallThrough &&
+        canExtendCodegenBlock(bb, bb->fallThrough)) {
+        cUnit->nextCodegenBlock = bb->fallThrough;
+    } else {
+        /* This mostly likely will be optimized away in a later phase */
+        genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    }
     return false;
 }
 
@@ -3025,6 +3095,126 @@ static void genLandingPadForMispredictedCallee(CompilationUnit *cUnit, MIR *mir,
     mir->meta.callsiteInfo->misPredBranchOver->target = (LIR *) target;
 }
 
+/*
+ * Unsafe.putOrderedInt/putOrderedObject: a store that later ones can't
+ * pass, as in the native version, and a card mark for a reference.
+ * The arguments are this, obj, offset (two words) and the value.
+ */
+static void genInlinedUnsafePutOrdered(CompilationUnit *cUnit, MIR *mir,
+                                       bool isObject)
+{
+    RegLocation rlObj = dvmCompilerGetSrc(cUnit, mir, 1);
+    RegLocation rlOffset = dvmCompilerGetSrc(cUnit, mir, 2);
+    RegLocation rlSrc = dvmCompilerGetSrc(cUnit, mir, 4);
+    rlObj = loadValue(cUnit, rlObj, kCoreReg);
+    rlOffset = loadValue(cUnit, rlOffset, kCoreReg);
+    rlSrc = loadValue(cUnit, rlSrc, kCoreReg);
+
+    dvmCompilerGenMemBarrier(cUnit, kISHST);
+    HEAP_ACCESS_SHADOW(true);
+    storeBaseIndexed(cUnit, rlObj.lowReg, rlOffset.lowReg, rlSrc.lowReg, 0,
+                     kWord);
+    HEAP_ACCESS_SHADOW(false);
+    if (isObject) {
+        markCard(cUnit, rlSrc.lowReg, rlObj.lowReg);
+    }
+}
+
+/*
+ * Unsafe.compareAndSwapInt/compareAndSwapObject.  The arguments are this,
+ * obj, offset (two words), the expected value and the new one; the
+ * boolean result goes to retval.
+ */
+static void genInlinedUnsafeCas(CompilationUnit *cUnit, MIR *mir,
+                                bool isObject)
+{
+    RegLocation rlObj = dvmCompilerGetSrc(cUnit, mir, 1);
+    RegLocation rlOffset = dvmCompilerGetSrc(cUnit, mir, 2);
+    RegLocation rlExpected = dvmCompilerGetSrc(cUnit, mir, 4);
+    RegLocation rlNew = dvmCompilerGetSrc(cUnit, mir, 5);
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+    rlObj = loadValue(cUnit, rlObj, kCoreReg);
+    rlOffset = loadValue(cUnit, rlOffset, kCoreReg);
+    rlExpected = loadValue(cUnit, rlExpected, kCoreReg);
+    rlNew = loadValue(cUnit, rlNew, kCoreReg);
+    int regPtr = dvmCompilerAllocTemp(cUnit);
+    opRegRegReg(cUnit, kOpAdd, regPtr, rlObj.lowReg, rlOffset.lowReg);
+    RegLocation rlResult = dvmCompilerEvalLoc(cUnit, rlDest, kCoreReg, true);
+
+    genCas(cUnit, regPtr, rlExpected.lowReg, rlNew.lowReg, rlResult.lowReg);
+    dvmCompilerFreeTemp(cUnit, regPtr);
+    if (isObject) {
+        /* NOTE: marking card based on object head */
+        markCard(cUnit, rlNew.lowReg, rlObj.lowReg);
+    }
+    storeValue(cUnit, rlDest, rlResult);
+}
+
+/*
+ * Expand an invoke of a sun.misc.Unsafe native that the inliner picked
+ * out, with the UnsafeIntrinsic in vB.  The call still throws if "this"
+ * is null.
+ */
+static bool genUnsafeIntrinsic(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlThis = dvmCompilerGetSrc(cUnit, mir, 0);
+    rlThis = loadValue(cUnit, rlThis, kCoreReg);
+    genNullCheck(cUnit, rlThis.sRegLow, rlThis.lowReg, mir->offset, NULL);
+
+    switch (mir->dalvikInsn.vB) {
+        case kUnsafeCasInt:
+            genInlinedUnsafeCas(cUnit, mir, false);
+            break;
+        case kUnsafeCasObject:
+            genInlinedUnsafeCas(cUnit, mir, true);
+            break;
+        case kUnsafePutOrderedInt:
+            genInlinedUnsafePutOrdered(cUnit, mir, false);
+            break;
+        case kUnsafePutOrderedObject:
+            genInlinedUnsafePutOrdered(cUnit, mir, true);
+            break;
+        default:
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Clone the receiver of an invoke that the inliner flagged as an array's
+ * clone().  The copy comes from dvmCloneObject() untracked, as with the
+ * native, and a failed allocation throws from here.
+ */
+static bool genArrayClone(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlThis = dvmCompilerGetSrc(cUnit, mir, 0);
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+
+    dvmCompilerFlushAllRegs(cUnit);   /* Everything to home location */
+    loadValueDirectFixed(cUnit, rlThis, r0);
+    genNullCheck(cUnit, rlThis.sRegLow, r0, mir->offset, NULL);
+    genExportPC(cUnit, mir);
+    LOAD_FUNC_ADDR(cUnit, r2, (int)dvmCloneObject);
+    loadConstant(cUnit, r1, ALLOC_DONT_TRACK);
+    opReg(cUnit, kOpBlx, r2);
+    dvmCompilerClobberCallRegs(cUnit);
+    /* generate a branch over if allocation is successful */
+    ArmLIR *branchOver = genCmpImmBranch(cUnit, kArmCondNe, r0, 0);
+    /*
+     * OOM exception needs to be thrown here and cannot re-execute
+     */
+    loadConstant(cUnit, r0,
+                 (int) (cUnit->method->insns + mir->offset));
+    genDispatchToHandler(cUnit, TEMPLATE_THROW_EXCEPTION_COMMON);
+    /* noreturn */
+
+    ArmLIR *target = newLIR0(cUnit, kArmPseudoTargetLabel);
+    target->defMask = ENCODE_ALL;
+    branchOver->generic.target = (LIR *) target;
+    storeValue(cUnit, rlDest, dvmCompilerGetReturn(cUnit));
+    return false;
+}
+
 static bool handleFmt35c_3rc(CompilationUnit *cUnit, MIR *mir,
                              BasicBlock *bb, ArmLIR *labelList)
 {
@@ -3035,6 +3225,12 @@ static bool handleFmt35c_3rc(CompilationUnit *cUnit, MIR *mir,
     if (mir->OptimizationFlags & MIR_INLINED)
         return false;
 
+    if (mir->OptimizationFlags & MIR_UNSAFE_INTRINSIC)
+        return genUnsafeIntrinsic(cUnit, mir);
+
+    if (mir->OptimizationFlags & MIR_ARRAY_CLONE)
+        return genArrayClone(cUnit, mir);
+
     if (bb->fallThrough != NULL)
         retChainingCell = &labelList[bb->fallThrough->id];
 
@@ -3396,6 +3592,9 @@ static bool handleFmt35ms_3rms(CompilationUnit *cUnit, MIR *mir,
     if (mir->OptimizationFlags & MIR_INLINED)
         return false;
 
+    if (mir->OptimizationFlags & MIR_UNSAFE_INTRINSIC)
+        return genUnsafeIntrinsic(cUnit, mir);
+
     DecodedInstruction *dInsn = &mir->dalvikInsn;
     switch (mir->dalvikInsn.opcode) {
         /* calleeMethod = this->clazz->vtable[BBBB] */
@@ -3460,6 +3659,10 @@ static bool handleFmt35ms_3rms(CompilationUnit *cUnit, MIR *mir,
     return false;
 }
 
+#if defined(USE_GLOBAL_STRING_DEFS) || defined(WITH_VECTOR_STRING_INTRINSICS)
+static bool handleExecuteInlineC(CompilationUnit *cUnit, MIR *mir);
+#endif
+
 /*
  * This operation is complex enough that we'll do it partly inline
  * and partly with a handler.  NOTE: the handler uses hardcoded
@@ -3468,7 +3671,7 @@ static bool handleFmt35ms_3rms(CompilationUnit *cUnit, MIR *mir,
  */
 static bool genInlinedCompareTo(CompilationUnit *cUnit, MIR *mir)
 {
-#if defined(USE_GLOBAL_STRING_DEFS)
+#if defined(USE_GLOBAL_STRING_DEFS) || defined(WITH_VECTOR_STRING_INTRINSICS)
     return handleExecuteInlineC(cUnit, mir);
 #else
     ArmLIR *rollback;
@@ -3494,7 +3697,7 @@ static bool genInlinedCompareTo(CompilationUnit *cUnit, MIR *mir)
 
 static bool genInlinedFastIndexOf(CompilationUnit *cUnit, MIR *mir)
 {
-#if defined(USE_GLOBAL_STRING_DEFS)
+#if defined(USE_GLOBAL_STRING_DEFS) || defined(WITH_VECTOR_STRING_INTRINSICS)
     return handleExecuteInlineC(cUnit, mir);
 #else
     RegLocation rlThis = dvmCompilerGetSrc(cUnit, mir, 0);
@@ -3631,6 +3834,30 @@ static bool genInlinedLongDoubleConversion(CompilationUnit *cUnit, MIR *mir)
     return false;
 }
 
+/*
+ * Unsafe.getIntVolatile/getObjectVolatile: dst = *(obj + offset) with
+ * acquire ordering.  As in the native version, only "this" is checked.
+ */
+static bool genInlinedUnsafeGetVolatile(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlThis = dvmCompilerGetSrc(cUnit, mir, 0);
+    RegLocation rlObj = dvmCompilerGetSrc(cUnit, mir, 1);
+    RegLocation rlOffset = dvmCompilerGetSrc(cUnit, mir, 2);
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+    rlThis = loadValue(cUnit, rlThis, kCoreReg);
+    rlObj = loadValue(cUnit, rlObj, kCoreReg);
+    rlOffset = loadValue(cUnit, rlOffset, kCoreReg);
+    RegLocation rlResult = dvmCompilerEvalLoc(cUnit, rlDest, kCoreReg, true);
+    genNullCheck(cUnit, rlThis.sRegLow, rlThis.lowReg, mir->offset, NULL);
+    HEAP_ACCESS_SHADOW(true);
+    loadBaseIndexed(cUnit, rlObj.lowReg, rlOffset.lowReg, rlResult.lowReg, 0,
+                    kWord);
+    HEAP_ACCESS_SHADOW(false);
+    dvmCompilerGenMemBarrier(cUnit, kISH);
+    storeValue(cUnit, rlDest, rlResult);
+    return false;
+}
+
 /*
  * JITs a call to a C function.
  * TODO: use this for faster native method invocation for simple native
@@ -3670,6 +3897,16 @@ static bool handleExecuteInlineC(CompilationUnit *cUnit, MIR *mir)
     return false;
 }
 
+static bool genInlinedCurrentThread(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+    RegLocation rlResult = dvmCompilerEvalLoc(cUnit, rlDest, kCoreReg, true);
+    loadWordDisp(cUnit, r6SELF, offsetof(Thread, threadObj),
+                 rlResult.lowReg);
+    storeValue(cUnit, rlDest, rlResult);
+    return false;
+}
+
 /*
  * NOTE: Handles both range and non-range versions (arguments
  * have already been normalized by this point).
@@ -3725,6 +3962,13 @@ static bool handleExecuteInline(CompilationUnit *cUnit, MIR *mir)
         case INLINE_LONG_BITS_TO_DOUBLE:
             return genInlinedLongDoubleConversion(cUnit, mir);
 
+        case INLINE_UNSAFE_GET_INT_VOLATILE:
+        case INLINE_UNSAFE_GET_OBJECT_VOLATILE:
+            return genInlinedUnsafeGetVolatile(cUnit, mir);
+
+        case INLINE_THREAD_CURRENT_THREAD:
+            return genInlinedCurrentThread(cUnit, mir);
+
         /*
          * These ones we just JIT a call to a C function for.
          * TODO: special-case these in the other "invoke" call paths.
@@ -3734,6 +3978,15 @@ static bool handleExecuteInline(CompilationUnit *cUnit, MIR *mir)
         case INLINE_MATH_SIN:
         case INLINE_FLOAT_TO_INT_BITS:
         case INLINE_DOUBLE_TO_LONG_BITS:
+        case INLINE_UNSAFE_GET_LONG_VOLATILE:
+        case INLINE_MATH_FLOOR:
+        case INLINE_MATH_CEIL:
+        case INLINE_MATH_RINT:
+        case INLINE_INTEGER_BIT_COUNT:
+        case INLINE_INTEGER_NUMBER_OF_LEADING_ZEROS:
+        case INLINE_LONG_BIT_COUNT:
+        case INLINE_LONG_NUMBER_OF_LEADING_ZEROS:
+        case INLINE_SYSTEM_NANO_TIME:
             return handleExecuteInlineC(cUnit, mir);
     }
     dvmCompilerAbort(cUnit);
@@ -4530,6 +4783,15 @@ void dvmCompilerMIR2LIR(CompilationUnit *cUnit)
                     break;
                 }
             }
+
+            /*
+             * A block that was cut short before the start of another block
+             * can carry on into it as well.
+             */
+            if (cUnit->nextCodegenBlock == NULL && bb->needFallThroughBranch &&
+                canExtendCodegenBlock(bb, bb->fallThrough)) {
+                cUnit->nextCodegenBlock = bb->fallThrough;
+            }
         }
 
         if (bb->blockType == kEntryBlock) {
@@ -4654,11 +4916,13 @@ bool dvmCompilerDoWork(CompilerWorkOrder *work)
 
     switch (work->kind) {
         case kWorkOrderTrace:
+        case kWorkOrderTraceRecompile:
             isCompile = true;
             /* Start compilation with maximally allowed trace length */
             desc = (JitTraceDescription *)work->info;
             success = dvmCompileTrace(desc, JIT_MAX_TRACE_LEN, &work->result,
-                                        work->bailPtr, 0 /* no hints */);
+                                      work->bailPtr,
+                                      dvmCompilerTraceHints(work->kind));
             break;
         case kWorkOrderTraceDebug: {
             bool oldPrintMe = gDvmJit.printMe;
@@ -456,6 +456,9 @@ static void applyLoadHoisting(CompilationUnit *cUnit,
 void dvmCompilerApplyLocalOptimizations(CompilationUnit *cUnit, LIR *headLIR,
                                         LIR *tailLIR)
 {
+    if (cUnit->isBaseline) {
+        return;
+    }
     if (!(gDvmJit.disableOpt & (1 << kLoadStoreElimination))) {
         applyLoadStoreElimination(cUnit, (ArmLIR *) headLIR,
                                   (ArmLIR *) tailLIR);
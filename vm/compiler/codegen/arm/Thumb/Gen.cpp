@@ -116,6 +116,39 @@ static void genMulLong(CompilationUnit *cUnit, RegLocation rlDest,
     storeValueWide(cUnit, rlDest, rlResult);
 }
 
+static bool genShiftOpLong(CompilationUnit *cUnit, MIR *mir,
+                           RegLocation rlDest, RegLocation rlSrc1,
+                           RegLocation rlShift)
+{
+    /*
+     * Don't mess with the regsiters here as there is a particular calling
+     * convention to the out-of-line handler.
+     */
+    RegLocation rlResult;
+
+    loadValueDirectWideFixed(cUnit, rlSrc1, r0, r1);
+    loadValueDirect(cUnit, rlShift, r2);
+    switch( mir->dalvikInsn.opcode) {
+        case OP_SHL_LONG:
+        case OP_SHL_LONG_2ADDR:
+            genDispatchToHandler(cUnit, TEMPLATE_SHL_LONG);
+            break;
+        case OP_SHR_LONG:
+        case OP_SHR_LONG_2ADDR:
+            genDispatchToHandler(cUnit, TEMPLATE_SHR_LONG);
+            break;
+        case OP_USHR_LONG:
+        case OP_USHR_LONG_2ADDR:
+            genDispatchToHandler(cUnit, TEMPLATE_USHR_LONG);
+            break;
+        default:
+            return true;
+    }
+    rlResult = dvmCompilerGetReturnWide(cUnit);
+    storeValueWide(cUnit, rlDest, rlResult);
+    return false;
+}
+
 static bool partialOverlap(int sreg1, int sreg2)
 {
     return abs(sreg1 - sreg2) == 1;
@@ -201,6 +234,16 @@ static void genMonitor(CompilationUnit *cUnit, MIR *mir)
     genMonitorPortable(cUnit, mir);
 }
 
+/*
+ * There is no LDREX/STREX to build a compare-and-swap from, so the Unsafe
+ * CAS intrinsics are never selected for Thumb.
+ */
+static void genCas(CompilationUnit *cUnit, int regPtr, int regExpected,
+                   int regNew, int regResult)
+{
+    dvmCompilerAbort(cUnit);
+}
+
 static void genCmpLong(CompilationUnit *cUnit, MIR *mir, RegLocation rlDest,
                        RegLocation rlSrc1, RegLocation rlSrc2)
 {
@@ -194,6 +194,77 @@ static ArmLIR *genIT(CompilationUnit *cUnit, ArmConditionCode code,
     return newLIR2(cUnit, kThumb2It, code, mask);
 }
 
+/*
+ * Long shifts in line, as the templates do them but without the call.
+ * Shifts by a register use its low byte and give 0 from 32 up, so the
+ * words shifted by 32 - n and n - 32 drop out on their own when they
+ * don't apply; only shr-long's arithmetic shift of the high word into
+ * the low one needs the IT.
+ */
+static bool genShiftOpLong(CompilationUnit *cUnit, MIR *mir,
+                           RegLocation rlDest, RegLocation rlSrc1,
+                           RegLocation rlShift)
+{
+    RegLocation rlResult;
+    int resLo = dvmCompilerAllocTemp(cUnit);
+    int resHi = dvmCompilerAllocTemp(cUnit);
+    int regShift = dvmCompilerAllocTemp(cUnit);
+    int regRevShift = dvmCompilerAllocTemp(cUnit);
+    int tmp = dvmCompilerAllocTemp(cUnit);
+
+    rlSrc1 = loadValueWide(cUnit, rlSrc1, kCoreReg);
+    rlShift = loadValue(cUnit, rlShift, kCoreReg);
+    opRegRegImm(cUnit, kOpAnd, regShift, rlShift.lowReg, 63);
+    newLIR3(cUnit, kThumb2RsubRRI8, regRevShift, regShift,
+            modifiedImmediate(32));
+
+    switch (mir->dalvikInsn.opcode) {
+        case OP_SHL_LONG:
+        case OP_SHL_LONG_2ADDR:
+            opRegRegReg(cUnit, kOpLsl, resHi, rlSrc1.highReg, regShift);
+            opRegRegReg(cUnit, kOpLsr, tmp, rlSrc1.lowReg, regRevShift);
+            opRegReg(cUnit, kOpOr, resHi, tmp);
+            opRegRegImm(cUnit, kOpSub, regRevShift, regShift, 32);
+            opRegRegReg(cUnit, kOpLsl, tmp, rlSrc1.lowReg, regRevShift);
+            opRegReg(cUnit, kOpOr, resHi, tmp);
+            opRegRegReg(cUnit, kOpLsl, resLo, rlSrc1.lowReg, regShift);
+            break;
+        case OP_SHR_LONG:
+        case OP_SHR_LONG_2ADDR:
+            opRegRegReg(cUnit, kOpLsr, resLo, rlSrc1.lowReg, regShift);
+            opRegRegReg(cUnit, kOpLsl, tmp, rlSrc1.highReg, regRevShift);
+            opRegReg(cUnit, kOpOr, resLo, tmp);
+            opRegRegImm(cUnit, kOpSub, regRevShift, regShift, 32);
+            opRegImm(cUnit, kOpCmp, regShift, 32);
+            genIT(cUnit, kArmCondGe, "");
+            opRegRegReg(cUnit, kOpAsr, resLo, rlSrc1.highReg, regRevShift);
+            genBarrier(cUnit);
+            opRegRegReg(cUnit, kOpAsr, resHi, rlSrc1.highReg, regShift);
+            break;
+        case OP_USHR_LONG:
+        case OP_USHR_LONG_2ADDR:
+            opRegRegReg(cUnit, kOpLsr, resLo, rlSrc1.lowReg, regShift);
+            opRegRegReg(cUnit, kOpLsl, tmp, rlSrc1.highReg, regRevShift);
+            opRegReg(cUnit, kOpOr, resLo, tmp);
+            opRegRegImm(cUnit, kOpSub, regRevShift, regShift, 32);
+            opRegRegReg(cUnit, kOpLsr, tmp, rlSrc1.highReg, regRevShift);
+            opRegReg(cUnit, kOpOr, resLo, tmp);
+            opRegRegReg(cUnit, kOpLsr, resHi, rlSrc1.highReg, regShift);
+            break;
+        default:
+            return true;
+    }
+    dvmCompilerFreeTemp(cUnit, regShift);
+    dvmCompilerFreeTemp(cUnit, regRevShift);
+    dvmCompilerFreeTemp(cUnit, tmp);
+
+    rlResult = dvmCompilerGetReturnWide(cUnit);  // Just as a template, will patch
+    rlResult.lowReg = resLo;
+    rlResult.highReg = resHi;
+    storeValueWide(cUnit, rlDest, rlResult);
+    return false;
+}
+
 /* Export the Dalvik PC assicated with an instruction to the StackSave area */
 static ArmLIR *genExportPC(CompilationUnit *cUnit, MIR *mir)
 {
@@ -352,6 +423,50 @@ static void genMonitor(CompilationUnit *cUnit, MIR *mir)
         genMonitorExit(cUnit, mir);
 }
 
+/*
+ * Compare-and-swap the word at regPtr, leaving 1 in regResult if it held
+ * regExpected and now holds regNew, 0 otherwise.  The barriers on either
+ * side give it the ordering of a volatile read and write.
+ *
+ *     mov     result, #0
+ *     dmb     ish
+ * retry:
+ *     ldrex   old, [ptr]
+ *     cmp     old, expected
+ *     bne     done
+ *     strex   status, new, [ptr]
+ *     cmp     status, #0
+ *     bne     retry
+ *     mov     result, #1
+ * done:
+ *     dmb     ish
+ */
+static void genCas(CompilationUnit *cUnit, int regPtr, int regExpected,
+                   int regNew, int regResult)
+{
+    int regOld = dvmCompilerAllocTemp(cUnit);
+    int regStatus = dvmCompilerAllocTemp(cUnit);
+
+    loadConstant(cUnit, regResult, 0);
+    dvmCompilerGenMemBarrier(cUnit, kISH);
+    ArmLIR *retry = newLIR0(cUnit, kArmPseudoTargetLabel);
+    retry->defMask = ENCODE_ALL;
+    newLIR3(cUnit, kThumb2Ldrex, regOld, regPtr, 0);
+    opRegReg(cUnit, kOpCmp, regOld, regExpected);
+    ArmLIR *branchFail = opCondBranch(cUnit, kArmCondNe);
+    newLIR4(cUnit, kThumb2Strex, regStatus, regNew, regPtr, 0);
+    ArmLIR *branchRetry = genCmpImmBranch(cUnit, kArmCondNe, regStatus, 0);
+    branchRetry->generic.target = (LIR *) retry;
+    loadConstant(cUnit, regResult, 1);
+    ArmLIR *done = newLIR0(cUnit, kArmPseudoTargetLabel);
+    done->defMask = ENCODE_ALL;
+    branchFail->generic.target = (LIR *) done;
+    dvmCompilerGenMemBarrier(cUnit, kISH);
+
+    dvmCompilerFreeTemp(cUnit, regOld);
+    dvmCompilerFreeTemp(cUnit, regStatus);
+}
+
 /*
  * 64-bit 3way compare function.
  *     mov   r7, #-1
@@ -55,6 +55,9 @@ bool dvmCompilerArchVariantInit(void)
     if (gDvmJit.threshold == 0) {
         gDvmJit.threshold = 200;
     }
+    if (gDvmJit.methodRegionSize < 0) {
+        gDvmJit.methodRegionSize = 256;
+    }
     if (gDvmJit.codeCacheSize == DEFAULT_CODE_CACHE_SIZE) {
       gDvmJit.codeCacheSize = 512 * 1024;
     } else if ((gDvmJit.codeCacheSize == 0) && (gDvm.executionMode == kExecutionModeJit)) {
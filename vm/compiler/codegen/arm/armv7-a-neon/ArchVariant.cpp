@@ -50,6 +50,9 @@ bool dvmCompilerArchVariantInit(void)
     if (gDvmJit.threshold == 0) {
         gDvmJit.threshold = 40;
     }
+    if (gDvmJit.methodRegionSize < 0) {
+        gDvmJit.methodRegionSize = 256;
+    }
     if (gDvmJit.codeCacheSize == DEFAULT_CODE_CACHE_SIZE) {
       gDvmJit.codeCacheSize = 1500 * 1024;
     } else if ((gDvmJit.codeCacheSize == 0) && (gDvm.executionMode == kExecutionModeJit)) {
@@ -107,9 +110,59 @@ int dvmCompilerTargetOptHint(int key)
     return res;
 }
 
+/*
+ * Returns true if falling through to the next instruction may skip over
+ * it, as a conditional branch to a PC reconstruction cell does.
+ */
+static bool isConditionalBranch(ArmOpcode opcode)
+{
+    return opcode == kThumbBCond || opcode == kThumb2BCond ||
+           opcode == kThumb2Cbz || opcode == kThumb2Cbnz;
+}
+
+/*
+ * Volatile accesses come in runs - a volatile store is a dmb ishst, the
+ * store and a dmb ish, and the next access starts with a barrier of its
+ * own.  Before adding a barrier, look back along the straight-line code
+ * for one that already orders whatever has to be ordered: a dmb ish
+ * covers a dmb ishst as long as no store came in between, and covers
+ * another dmb ish as long as no memory access did.  Labels, calls and
+ * unconditional branches end the search, since other paths or other
+ * code may get there.  A dmb ishst that is immediately followed by a
+ * request for a dmb ish is just strengthened.
+ */
 void dvmCompilerGenMemBarrier(CompilationUnit *cUnit, int barrierKind)
 {
 #if ANDROID_SMP != 0
+    bool adjacent = true;
+    for (ArmLIR *lir = (ArmLIR *) cUnit->lastLIRInsn; lir != NULL;
+         lir = PREV_LIR(lir)) {
+        if (lir->flags.isNop ||
+            lir->opcode == kArmPseudoDalvikByteCodeBoundary) {
+            continue;
+        }
+        if (lir->opcode == kThumb2Dmb) {
+            if (lir->operands[0] == kISH || lir->operands[0] == barrierKind) {
+                return;
+            }
+            if (adjacent && lir->operands[0] == kISHST &&
+                barrierKind == kISH) {
+                lir->operands[0] = kISH;
+                return;
+            }
+            break;
+        }
+        if (isPseudoOpcode(lir->opcode)) {
+            break;
+        }
+        int flags = EncodingMap[lir->opcode].flags;
+        if ((flags & IS_STORE) ||
+            ((flags & IS_LOAD) && barrierKind == kISH) ||
+            ((flags & IS_BRANCH) && !isConditionalBranch(lir->opcode))) {
+            break;
+        }
+        adjacent = false;
+    }
     ArmLIR *dmb = newLIR1(cUnit, kThumb2Dmb, barrierKind);
     dmb->defMask = ENCODE_ALL;
 #endif
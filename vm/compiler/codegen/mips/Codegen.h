@@ -23,6 +23,7 @@
  */
 
 #include "compiler/CompilerIR.h"
+#include "compiler/TypeProfile.h"
 #include "CalloutHelper.h"
 
 #if defined(_CODEGEN_C)
@@ -458,7 +458,7 @@ static void genIPut(CompilationUnit *cUnit, MIR *mir, OpSize size,
     if (isVolatile) {
         dvmCompilerGenMemBarrier(cUnit, kSY);
     }
-    if (isObject) {
+    if (isObject && !(mir->OptimizationFlags & MIR_IGNORE_CARD_MARK)) {
         /* NOTE: marking card based on object head */
         markCard(cUnit, rlSrc.lowReg, rlObj.lowReg);
     }
@@ -687,7 +687,9 @@ static void genArrayObjectPut(CompilationUnit *cUnit, MIR *mir,
     dvmCompilerFreeTemp(cUnit, regIndex);
 
     /* NOTE: marking card here based on object head */
-    markCard(cUnit, r_A0, r_A1);
+    if (!(mir->OptimizationFlags & MIR_IGNORE_CARD_MARK)) {
+        markCard(cUnit, r_A0, r_A1);
+    }
 }
 
 static bool genShiftOpLong(CompilationUnit *cUnit, MIR *mir,
@@ -1517,6 +1519,24 @@ static void genSuspendPoll(CompilationUnit *cUnit, MIR *mir)
     genRegImmCheck(cUnit, kMipsCondNe, rTemp, 0, mir->offset, NULL);
 }
 
+/*
+ * Whether codegen can carry on from bb into nextBB without resetting the
+ * register state, which holds when bb is the only way into nextBB.  The
+ * values bb leaves in registers, and the null checks it has done, are then
+ * still good at the top of nextBB.
+ */
+static bool canExtendCodegenBlock(BasicBlock *bb, BasicBlock *nextBB)
+{
+    if (gDvmJit.disableOpt & (1 << kExtendedBlocks)) {
+        return false;
+    }
+    return nextBB != NULL && nextBB->blockType == kDalvikByteCode &&
+           nextBB->visited == false && nextBB->hidden == false &&
+           nextBB->isFallThroughFromInvoke == false &&
+           dvmCountSetBits(nextBB->predecessors) == 1 &&
+           dvmIsBitSet(nextBB->predecessors, bb->id);
+}
+
 /*
  * The following are the first-level codegen routines that analyze the format
  * of each bytecode then either dispatch special purpose codegen routines
@@ -1552,7 +1572,7 @@ static bool handleFmt10t_Fmt20t_Fmt30t(CompilationUnit *cUnit, MIR *mir,
 static bool handleFmt10x(CompilationUnit *cUnit, MIR *mir)
 {
     Opcode dalvikOpcode = mir->dalvikInsn.opcode;
-    if ((dalvikOpcode >= OP_UNUSED_3E) && (dalvikOpcode <= OP_UNUSED_43)) {
+    if ((dalvikOpcode >= OP_UNUSED_40) && (dalvikOpcode <= OP_UNUSED_43)) {
         ALOGE("Codegen: got unused opcode %#x",dalvikOpcode);
         return true;
     }
@@ -1821,7 +1841,9 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             }
             if (isSputObject) {
                 /* NOTE: marking card based sfield->clazz */
-                markCard(cUnit, rlSrc.lowReg, objHead);
+                if (!(mir->OptimizationFlags & MIR_IGNORE_CARD_MARK)) {
+                    markCard(cUnit, rlSrc.lowReg, objHead);
+                }
                 dvmCompilerFreeTemp(cUnit, objHead);
             }
 
@@ -1871,9 +1893,19 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             assert((classPtr->accessFlags & (ACC_INTERFACE|ACC_ABSTRACT)) == 0);
             dvmCompilerFlushAllRegs(cUnit);   /* Everything to home location */
             genExportPC(cUnit, mir);
-            LOAD_FUNC_ADDR(cUnit, r_T9, (int)dvmAllocObject);
-            loadConstant(cUnit, r_A0, (int) classPtr);
-            loadConstant(cUnit, r_A1, ALLOC_DONT_TRACK);
+            /*
+             * The class is initialized by now, so whether it can take the
+             * TLAB fast path is already known.
+             */
+            if (classPtr->fastAllocSize != 0) {
+                LOAD_FUNC_ADDR(cUnit, r_T9, (int)dvmAllocObjectFast);
+                loadConstant(cUnit, r_A0, (int) classPtr);
+                genRegCopy(cUnit, r_A1, rSELF);
+            } else {
+                LOAD_FUNC_ADDR(cUnit, r_T9, (int)dvmAllocObject);
+                loadConstant(cUnit, r_A0, (int) classPtr);
+                loadConstant(cUnit, r_A1, ALLOC_DONT_TRACK);
+            }
             opReg(cUnit, kOpBlx, r_T9);
             newLIR3(cUnit, kMipsLw, r_GP, STACK_OFFSET_GP, r_SP);
             dvmCompilerClobberCallRegs(cUnit);
@@ -1932,6 +1964,15 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             loadWordDisp(cUnit, rlSrc.lowReg, offsetof(Object, clazz), r_A0);
             LOAD_FUNC_ADDR(cUnit, r_T9, (int)dvmInstanceofNonTrivial);
             MipsLIR *branch2 = opCompareBranch(cUnit, kMipsBeq, r_A0, r_A1);
+            /* Then for the subclass seen when the trace was selected */
+            const ClassObject *seenClass =
+                dvmJitTypeProfileLookup(cUnit->method->insns + mir->offset);
+            MipsLIR *branch3 = NULL;
+            if (seenClass != NULL && seenClass != classPtr &&
+                dvmInstanceof(seenClass, classPtr)) {
+                loadConstant(cUnit, r_A2, (int) seenClass);
+                branch3 = opCompareBranch(cUnit, kMipsBeq, r_A0, r_A2);
+            }
             opReg(cUnit, kOpBlx, r_T9);
             newLIR3(cUnit, kMipsLw, r_GP, STACK_OFFSET_GP, r_SP);
             dvmCompilerClobberCallRegs(cUnit);
@@ -1947,6 +1988,9 @@ static bool handleFmt21c_Fmt31c(CompilationUnit *cUnit, MIR *mir)
             target->defMask = ENCODE_ALL;
             branch1->generic.target = (LIR *)target;
             branch2->generic.target = (LIR *)target;
+            if (branch3 != NULL) {
+                branch3->generic.target = (LIR *)target;
+            }
             break;
         }
         case OP_SGET_WIDE_VOLATILE:
@@ -2193,8 +2237,14 @@ static bool handleFmt21t(CompilationUnit *cUnit, MIR *mir, BasicBlock *bb,
             dvmCompilerAbort(cUnit);
     }
     genConditionalBranchMips(cUnit, opc, rlSrc.lowReg, rt, &labelList[bb->taken->id]);
-    /* This mostly likely will be optimized away in a later phase */
-    genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    /* Carry on into the fall-through block if nothing else can reach it */
+    if (bb->taken != bb->fallThrough &&
+        canExtendCodegenBlock(bb, bb->fallThrough)) {
+        cUnit->nextCodegenBlock = bb->fallThrough;
+    } else {
+        /* This mostly likely will be optimized away in a later phase */
+        genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    }
     return false;
 }
 
@@ -2577,11 +2627,30 @@ return false;
             LOAD_FUNC_ADDR(cUnit, r_T9, (int)dvmInstanceofNonTrivial);
             loadConstant(cUnit, r_V0, 1);                /* Assume true */
             MipsLIR *branch2 = opCompareBranch(cUnit, kMipsBeq, r_A1, r_A2);
+            /*
+             * Then for the class seen when the trace was selected, whose
+             * answer is known now.
+             */
+            const ClassObject *seenClass =
+                dvmJitTypeProfileLookup(cUnit->method->insns + mir->offset);
+            MipsLIR *branch3 = NULL;
+            if (seenClass != NULL && seenClass != classPtr) {
+                loadConstant(cUnit, r_A3, (int) seenClass);
+                branch3 = opCompareBranch(cUnit, kMipsBeq, r_A1, r_A3);
+            }
             genRegCopy(cUnit, r_A0, r_A1);
             genRegCopy(cUnit, r_A1, r_A2);
             opReg(cUnit, kOpBlx, r_T9);
             newLIR3(cUnit, kMipsLw, r_GP, STACK_OFFSET_GP, r_SP);
             dvmCompilerClobberCallRegs(cUnit);
+            MipsLIR *branchOver = NULL;
+            if (branch3 != NULL) {
+                branchOver = opNone(cUnit, kOpUncondBr);
+                MipsLIR *seenTarget = newLIR0(cUnit, kMipsPseudoTargetLabel);
+                seenTarget->defMask = ENCODE_ALL;
+                branch3->generic.target = (LIR *)seenTarget;
+                loadConstant(cUnit, r_V0, dvmInstanceof(seenClass, classPtr));
+            }
             /* branch target here */
             MipsLIR *target = newLIR0(cUnit, kMipsPseudoTargetLabel);
             target->defMask = ENCODE_ALL;
@@ -2589,6 +2658,9 @@ return false;
             storeValue(cUnit, rlDest, rlResult);
             branch1->generic.target = (LIR *)target;
             branch2->generic.target = (LIR *)target;
+            if (branchOver != NULL) {
+                branchOver->generic.target = (LIR *)target;
+            }
             break;
         }
         case OP_IGET_WIDE:
@@ -2723,8 +2795,14 @@ static bool handleFmt22t(CompilationUnit *cUnit, MIR *mir, BasicBlock *bb,
     }
 
     genConditionalBranchMips(cUnit, opc, reg1, reg2, &labelList[bb->taken->id]);
-    /* This mostly likely will be optimized away in a later phase */
-    genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    /* Carry on into the fall-through block if nothing else can reach it */
+    if (bb->taken != bb->fallThrough &&
+        canExtendCodegenBlock(bb, bb->fallThrough)) {
+        cUnit->nextCodegenBlock = bb->fallThrough;
+    } else {
+        /* This mostly likely will be optimized away in a later phase */
+        genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    }
     return false;
 }
 
@@ -3080,6 +3158,136 @@ static void genLandingPadForMispredictedCallee(CompilationUnit *cUnit, MIR *mir,
     mir->meta.callsiteInfo->misPredBranchOver->target = (LIR *) target;
 }
 
+/*
+ * Unsafe.putOrderedInt/putOrderedObject: a store that later ones can't
+ * pass, as in the native version, and a card mark for a reference.
+ * The arguments are this, obj, offset (two words) and the value.
+ */
+static void genInlinedUnsafePutOrdered(CompilationUnit *cUnit, MIR *mir,
+                                       bool isObject)
+{
+    RegLocation rlObj = dvmCompilerGetSrc(cUnit, mir, 1);
+    RegLocation rlOffset = dvmCompilerGetSrc(cUnit, mir, 2);
+    RegLocation rlSrc = dvmCompilerGetSrc(cUnit, mir, 4);
+    rlObj = loadValue(cUnit, rlObj, kCoreReg);
+    rlOffset = loadValue(cUnit, rlOffset, kCoreReg);
+    rlSrc = loadValue(cUnit, rlSrc, kCoreReg);
+
+    dvmCompilerGenMemBarrier(cUnit, kSY);
+    HEAP_ACCESS_SHADOW(true);
+    storeBaseIndexed(cUnit, rlObj.lowReg, rlOffset.lowReg, rlSrc.lowReg, 0,
+                     kWord);
+    HEAP_ACCESS_SHADOW(false);
+    if (isObject) {
+        markCard(cUnit, rlSrc.lowReg, rlObj.lowReg);
+    }
+}
+
+/*
+ * Unsafe.compareAndSwapInt/compareAndSwapObject.  The arguments are this,
+ * obj, offset (two words), the expected value and the new one; the
+ * boolean result goes to retval.  The LIR has no ll/sc, so the swap is
+ * android_atomic_release_cas(), which the native uses too and which
+ * returns 0 on success.
+ */
+static void genInlinedUnsafeCas(CompilationUnit *cUnit, MIR *mir,
+                                bool isObject)
+{
+    RegLocation rlObj = dvmCompilerGetSrc(cUnit, mir, 1);
+    RegLocation rlOffset = dvmCompilerGetSrc(cUnit, mir, 2);
+    RegLocation rlExpected = dvmCompilerGetSrc(cUnit, mir, 4);
+    RegLocation rlNew = dvmCompilerGetSrc(cUnit, mir, 5);
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+
+    dvmCompilerFlushAllRegs(cUnit);   /* Everything to home location */
+    loadValueDirectFixed(cUnit, rlExpected, r_A0);
+    loadValueDirectFixed(cUnit, rlNew, r_A1);
+    loadValueDirectFixed(cUnit, rlObj, r_A2);
+    loadValueDirectFixed(cUnit, rlOffset, r_A3);
+    opRegRegReg(cUnit, kOpAdd, r_A2, r_A2, r_A3);
+    LOAD_FUNC_ADDR(cUnit, r_T9, (int)android_atomic_release_cas);
+    opReg(cUnit, kOpBlx, r_T9);
+    newLIR3(cUnit, kMipsLw, r_GP, STACK_OFFSET_GP, r_SP);
+    dvmCompilerClobberCallRegs(cUnit);
+
+    RegLocation rlResult = dvmCompilerEvalLoc(cUnit, rlDest, kCoreReg, true);
+    newLIR3(cUnit, kMipsSltu, rlResult.lowReg, r_ZERO, r_V0);
+    opRegRegImm(cUnit, kOpXor, rlResult.lowReg, rlResult.lowReg, 1);
+    if (isObject) {
+        /* NOTE: marking card based on object head */
+        rlObj = loadValue(cUnit, rlObj, kCoreReg);
+        rlNew = loadValue(cUnit, rlNew, kCoreReg);
+        markCard(cUnit, rlNew.lowReg, rlObj.lowReg);
+    }
+    storeValue(cUnit, rlDest, rlResult);
+}
+
+/*
+ * Expand an invoke of a sun.misc.Unsafe native that the inliner picked
+ * out, with the UnsafeIntrinsic in vB.  The call still throws if "this"
+ * is null.
+ */
+static bool genUnsafeIntrinsic(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlThis = dvmCompilerGetSrc(cUnit, mir, 0);
+    rlThis = loadValue(cUnit, rlThis, kCoreReg);
+    genNullCheck(cUnit, rlThis.sRegLow, rlThis.lowReg, mir->offset, NULL);
+
+    switch (mir->dalvikInsn.vB) {
+        case kUnsafeCasInt:
+            genInlinedUnsafeCas(cUnit, mir, false);
+            break;
+        case kUnsafeCasObject:
+            genInlinedUnsafeCas(cUnit, mir, true);
+            break;
+        case kUnsafePutOrderedInt:
+            genInlinedUnsafePutOrdered(cUnit, mir, false);
+            break;
+        case kUnsafePutOrderedObject:
+            genInlinedUnsafePutOrdered(cUnit, mir, true);
+            break;
+        default:
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Clone the receiver of an invoke that the inliner flagged as an array's
+ * clone().  The copy comes from dvmCloneObject() untracked, as with the
+ * native, and a failed allocation throws from here.
+ */
+static bool genArrayClone(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlThis = dvmCompilerGetSrc(cUnit, mir, 0);
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+
+    dvmCompilerFlushAllRegs(cUnit);   /* Everything to home location */
+    loadValueDirectFixed(cUnit, rlThis, r_A0);
+    genNullCheck(cUnit, rlThis.sRegLow, r_A0, mir->offset, NULL);
+    genExportPC(cUnit, mir);
+    LOAD_FUNC_ADDR(cUnit, r_T9, (int)dvmCloneObject);
+    loadConstant(cUnit, r_A1, ALLOC_DONT_TRACK);
+    opReg(cUnit, kOpBlx, r_T9);
+    newLIR3(cUnit, kMipsLw, r_GP, STACK_OFFSET_GP, r_SP);
+    dvmCompilerClobberCallRegs(cUnit);
+    /* generate a branch over if allocation is successful */
+    MipsLIR *branchOver = opCompareBranch(cUnit, kMipsBne, r_V0, r_ZERO);
+    /*
+     * OOM exception needs to be thrown here and cannot re-execute
+     */
+    loadConstant(cUnit, r_A0,
+                 (int) (cUnit->method->insns + mir->offset));
+    genDispatchToHandler(cUnit, TEMPLATE_THROW_EXCEPTION_COMMON);
+    /* noreturn */
+
+    MipsLIR *target = newLIR0(cUnit, kMipsPseudoTargetLabel);
+    target->defMask = ENCODE_ALL;
+    branchOver->generic.target = (LIR *) target;
+    storeValue(cUnit, rlDest, dvmCompilerGetReturn(cUnit));
+    return false;
+}
+
 static bool handleFmt35c_3rc(CompilationUnit *cUnit, MIR *mir,
                              BasicBlock *bb, MipsLIR *labelList)
 {
@@ -3090,6 +3298,12 @@ static bool handleFmt35c_3rc(CompilationUnit *cUnit, MIR *mir,
     if (mir->OptimizationFlags & MIR_INLINED)
         return false;
 
+    if (mir->OptimizationFlags & MIR_UNSAFE_INTRINSIC)
+        return genUnsafeIntrinsic(cUnit, mir);
+
+    if (mir->OptimizationFlags & MIR_ARRAY_CLONE)
+        return genArrayClone(cUnit, mir);
+
     if (bb->fallThrough != NULL)
         retChainingCell = &labelList[bb->fallThrough->id];
 
@@ -3771,6 +3985,16 @@ static bool handleExecuteInlineC(CompilationUnit *cUnit, MIR *mir)
     return false;
 }
 
+static bool genInlinedCurrentThread(CompilationUnit *cUnit, MIR *mir)
+{
+    RegLocation rlDest = inlinedTarget(cUnit, mir, false);
+    RegLocation rlResult = dvmCompilerEvalLoc(cUnit, rlDest, kCoreReg, true);
+    loadWordDisp(cUnit, rSELF, offsetof(Thread, threadObj),
+                 rlResult.lowReg);
+    storeValue(cUnit, rlDest, rlResult);
+    return false;
+}
+
 /*
  * NOTE: Handles both range and non-range versions (arguments
  * have already been normalized by this point).
@@ -3826,6 +4050,9 @@ static bool handleExecuteInline(CompilationUnit *cUnit, MIR *mir)
         case INLINE_LONG_BITS_TO_DOUBLE:
             return genInlinedLongDoubleConversion(cUnit, mir);
 
+        case INLINE_THREAD_CURRENT_THREAD:
+            return genInlinedCurrentThread(cUnit, mir);
+
         /*
          * These ones we just JIT a call to a C function for.
          * TODO: special-case these in the other "invoke" call paths.
@@ -3835,6 +4062,17 @@ static bool handleExecuteInline(CompilationUnit *cUnit, MIR *mir)
         case INLINE_MATH_SIN:
         case INLINE_FLOAT_TO_INT_BITS:
         case INLINE_DOUBLE_TO_LONG_BITS:
+        case INLINE_UNSAFE_GET_INT_VOLATILE:
+        case INLINE_UNSAFE_GET_LONG_VOLATILE:
+        case INLINE_UNSAFE_GET_OBJECT_VOLATILE:
+        case INLINE_MATH_FLOOR:
+        case INLINE_MATH_CEIL:
+        case INLINE_MATH_RINT:
+        case INLINE_INTEGER_BIT_COUNT:
+        case INLINE_INTEGER_NUMBER_OF_LEADING_ZEROS:
+        case INLINE_LONG_BIT_COUNT:
+        case INLINE_LONG_NUMBER_OF_LEADING_ZEROS:
+        case INLINE_SYSTEM_NANO_TIME:
             return handleExecuteInlineC(cUnit, mir);
     }
     dvmCompilerAbort(cUnit);
@@ -4602,6 +4840,15 @@ void dvmCompilerMIR2LIR(CompilationUnit *cUnit)
                     break;
                 }
             }
+
+            /*
+             * A block that was cut short before the start of another block
+             * can carry on into it as well.
+             */
+            if (cUnit->nextCodegenBlock == NULL && bb->needFallThroughBranch &&
+                canExtendCodegenBlock(bb, bb->fallThrough)) {
+                cUnit->nextCodegenBlock = bb->fallThrough;
+            }
         }
 
         if (bb->blockType == kEntryBlock) {
@@ -4726,11 +4973,13 @@ bool dvmCompilerDoWork(CompilerWorkOrder *work)
 
     switch (work->kind) {
         case kWorkOrderTrace:
+        case kWorkOrderTraceRecompile:
             isCompile = true;
             /* Start compilation with maximally allowed trace length */
             desc = (JitTraceDescription *)work->info;
             success = dvmCompileTrace(desc, JIT_MAX_TRACE_LEN, &work->result,
-                                        work->bailPtr, 0 /* no hints */);
+                                      work->bailPtr,
+                                      dvmCompilerTraceHints(work->kind));
             break;
         case kWorkOrderTraceDebug: {
             bool oldPrintMe = gDvmJit.printMe;
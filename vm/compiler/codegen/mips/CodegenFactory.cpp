@@ -170,6 +170,9 @@ static void storeValue(CompilationUnit *cUnit, RegLocation rlDest,
             dvmCompilerMarkClean(cUnit, rlDest.lowReg);
             defEnd = (LIR *)cUnit->lastLIRInsn;
             dvmCompilerMarkDef(cUnit, rlDest, defStart, defEnd);
+        } else {
+            /* Dead on every exit - don't let a flush write it back */
+            dvmCompilerMarkClean(cUnit, rlDest.lowReg);
         }
     }
 }
@@ -254,6 +257,9 @@ static void storeValueWide(CompilationUnit *cUnit, RegLocation rlDest,
             dvmCompilerMarkClean(cUnit, rlDest.highReg);
             defEnd = (LIR *)cUnit->lastLIRInsn;
             dvmCompilerMarkDefWide(cUnit, rlDest, defStart, defEnd);
+        } else {
+            dvmCompilerMarkClean(cUnit, rlDest.lowReg);
+            dvmCompilerMarkClean(cUnit, rlDest.highReg);
         }
     }
 }
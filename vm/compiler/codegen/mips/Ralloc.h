@@ -68,10 +68,15 @@ static inline int dvmCompilerSRegHi(int lowSreg) {
 }
 
 
+/*
+ * Does the value named "sReg" have to be written back to the Dalvik frame?
+ * Only false for the definitions dvmCompilerFindDeadWritebacks() proved
+ * dead.
+ */
 static inline bool dvmCompilerLiveOut(CompilationUnit *cUnit, int sReg)
 {
-    //TODO: fully implement
-    return true;
+    return cUnit->deadDefSRegV == NULL || sReg == INVALID_SREG ||
+           !dvmIsBitSet(cUnit->deadDefSRegV, sReg);
 }
 
 static inline int dvmCompilerSSASrc(MIR *mir, int num)
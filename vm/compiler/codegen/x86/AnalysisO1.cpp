@@ -24,6 +24,8 @@
 #include "interp/InterpState.h"
 #include "interp/InterpDefs.h"
 #include "libdex/Leb128.h"
+#include "compiler/Dataflow.h"
+#include "NcgAot.h"
 
 /* compilation flags to turn on debug printout */
 //#define DEBUG_COMPILE_TABLE
@@ -244,6 +246,7 @@ void setTypeOfVR();
 void insertGlueReg();
 void dumpVirtualInfoOfMethod();
 int codeGenBasicBlock(const Method* method, BasicBlock_O1* bb);
+void loopHeadEntry(const Method* method, BasicBlock_O1* bb);
 
 //used in collectInfoOfBasicBlock: getVirtualRegInfo
 int mergeEntry2(BasicBlock_O1* bb);
@@ -407,7 +410,8 @@ void initializeRegStateOfBB(BasicBlock_O1* bb) {
     for(k = 0; k < num_compile_entries; k++) {
         /* trace-based JIT: there is no VR with GG type */
         if(isVirtualReg(compileTable[k].physicalType) && compileTable[k].gType == GLOBALTYPE_GG) {
-            if(bb->bb_index > 0) { //non-entry block
+            /* the loop head of a loop trace loads its GG VRs on entry */
+            if(bb->bb_index > 0 || bb->jitBasicBlock->id == loopHeadBlockId) { //non-entry block
                 if(isFirstOfHandler(bb)) {
                     /* at the beginning of an exception handler, GG VR is in the interpreted stack */
                     compileTable[k].physicalReg = PhysicalReg_Null;
@@ -458,8 +462,11 @@ void initializeMemVRTable() {
     int k;
     for(k = 0; k < num_compile_entries; k++) {
         if(!isVirtualReg(compileTable[k].physicalType)) continue;
-        /* VRs in compileTable */
-        bool setToInMemory = (compileTable[k].physicalReg == PhysicalReg_Null);
+        /* VRs in compileTable
+           GG VRs are written through at the end of every basic block,
+           so the copy in the interpreted stack is current at the start of one */
+        bool setToInMemory = (compileTable[k].physicalReg == PhysicalReg_Null) ||
+                             compileTable[k].gType == GLOBALTYPE_GG;
         int regNum = compileTable[k].regNum;
         OpndSize sizeVR = getRegSize(compileTable[k].physicalType);
         /* search memVRTable for the VR in compileTable */
@@ -535,14 +542,128 @@ void preprocessingBB(BasicBlock* bb) {
     currentBB = NULL;
 }
 
+//! the callee-saved registers a loop trace keeps GG VRs in
+static const PhysicalReg loopGGRegs[] = { PhysicalReg_EBX, PhysicalReg_ESI };
+#define NUM_LOOP_GG_VRS ((int)(sizeof(loopGGRegs) / sizeof(loopGGRegs[0])))
+
+/* whether VR regNum is only ever accessed as a 32-bit gp VR in the trace;
+   adds the reference counts of its accesses to *refCount */
+static bool isGpOnlyVR(int regNum, int* refCount) {
+    int k, jj;
+    *refCount = 0;
+    for(k = 0; k < num_bbs_for_method; k++) {
+        BasicBlock_O1* bb = method_bbs_sorted[k];
+        for(jj = 0; jj < bb->num_regs; jj++) {
+            VirtualRegInfo* info = &bb->infoBasicBlock[jj];
+            if(info->regNum == regNum) {
+                if(info->physicalType != LowOpndRegType_gp) return false;
+                *refCount += info->refCount;
+            }
+            /* the high half of a 64-bit VR */
+            if(info->regNum == regNum - 1 && getRegSize(info->physicalType) == OpndSize_64)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* make VR regNum a GG VR in physicalReg in every basic block of the trace,
+   adding an entry to the blocks that do not access it */
+static void setLoopGlobalVR(int regNum, PhysicalReg physicalReg) {
+    int k, jj, ii;
+    for(k = 0; k < num_bbs_for_method; k++) {
+        BasicBlock_O1* bb = method_bbs_sorted[k];
+        for(jj = 0; jj < bb->num_regs; jj++)
+            if(bb->infoBasicBlock[jj].regNum == regNum) break;
+        VirtualRegInfo* info = &bb->infoBasicBlock[jj];
+        if(jj == bb->num_regs) {
+            /* the VR is live through this basic block */
+            memset(info, 0, sizeof(VirtualRegInfo));
+            info->regNum = regNum;
+            info->physicalType = LowOpndRegType_gp;
+            info->accessType = REGACCESS_U;
+            for(ii = 0; ii < 8; ii++) {
+                info->allocConstraints[ii].physicalReg = (PhysicalReg)ii;
+                info->allocConstraintsSorted[ii].physicalReg = (PhysicalReg)ii;
+            }
+            bb->num_regs++;
+        }
+        info->gType = GLOBALTYPE_GG;
+        info->physicalReg_GG = physicalReg;
+    }
+}
+
+/* a simplified version of setTypeOfVR() for loop traces
+   A loop trace is a single loop whose back edge jumps straight to the loop
+   head. The VRs that carry values around the loop (used before being defined
+   in some loop block, i.e. live-in in dvmCompilerFindLocalLiveIn) and are
+   referenced most are made GG, so induction variables and array bases stay
+   in callee-saved registers across basic blocks and iterations.
+   The hard-coded uses of each register across the trace decide which register
+   goes to the most referenced VR. */
+static void selectLoopGlobalVRs() {
+    int candidates[NUM_LOOP_GG_VRS];
+    int candidateRefs[NUM_LOOP_GG_VRS];
+    int numCandidates = 0;
+    int k, jj, regNum;
+
+    for(k = 0; k < num_bbs_for_method; k++) {
+        if(method_bbs_sorted[k]->num_regs + NUM_LOOP_GG_VRS > MAX_REG_PER_BASICBLOCK)
+            return;
+    }
+    for(regNum = 0; regNum < currentUnit->numDalvikRegisters; regNum++) {
+        bool liveIn = false;
+        for(k = 0; k < num_bbs_for_method && !liveIn; k++) {
+            BasicBlockDataFlow* dataFlowInfo = method_bbs_sorted[k]->jitBasicBlock->dataFlowInfo;
+            liveIn = dataFlowInfo != NULL && dataFlowInfo->liveInV != NULL &&
+                     dvmIsBitSet(dataFlowInfo->liveInV, regNum);
+        }
+        int refCount;
+        if(!liveIn || !isGpOnlyVR(regNum, &refCount) || refCount == 0) continue;
+        /* keep the candidates sorted by reference count */
+        for(jj = numCandidates; jj > 0 && candidateRefs[jj-1] < refCount; jj--) {
+            if(jj < NUM_LOOP_GG_VRS) {
+                candidates[jj] = candidates[jj-1];
+                candidateRefs[jj] = candidateRefs[jj-1];
+            }
+        }
+        if(jj < NUM_LOOP_GG_VRS) {
+            candidates[jj] = regNum;
+            candidateRefs[jj] = refCount;
+            if(numCandidates < NUM_LOOP_GG_VRS) numCandidates++;
+        }
+    }
+    if(numCandidates == 0) return;
+
+    /* the register with fewer hard-coded uses goes to the first candidate */
+    int constraints[NUM_LOOP_GG_VRS];
+    for(jj = 0; jj < NUM_LOOP_GG_VRS; jj++) {
+        constraints[jj] = 0;
+        for(k = 0; k < num_bbs_for_method; k++)
+            constraints[jj] += method_bbs_sorted[k]->allocConstraints[loopGGRegs[jj]].count;
+    }
+    int first = (constraints[1] < constraints[0]) ? 1 : 0;
+    for(jj = 0; jj < numCandidates; jj++) {
+        PhysicalReg reg = loopGGRegs[jj == 0 ? first : 1 - first];
+#ifdef DEBUG_COMPILE_TABLE
+        ALOGI("loop trace: VR %d with %d references is GG in register %d",
+              candidates[jj], candidateRefs[jj], reg);
+#endif
+        setLoopGlobalVR(candidates[jj], reg);
+    }
+}
+
 void preprocessingTrace() {
     int k, k2, k3, jj;
     /* this is a simplified verson of setTypeOfVR()
-        all VRs are assumed to be GL, no VR will be GG
+        all VRs are assumed to be GL; in a loop trace, a few VRs carried
+        around the loop are made GG
     */
     for(k = 0; k < num_bbs_for_method; k++)
         for(jj = 0; jj < method_bbs_sorted[k]->num_regs; jj++)
             method_bbs_sorted[k]->infoBasicBlock[jj].gType = GLOBALTYPE_GL;
+    if(loopHeadBlockId >= 0)
+        selectLoopGlobalVRs();
 
     /* insert a glue-related register GLUE_DVMDEX to compileTable */
     insertGlueReg();
@@ -595,6 +716,8 @@ void startOfTraceO1(const Method* method, LowOpBlockLabel* labelList, int except
     num_bbs_for_method = 0;
     currentUnit = cUnit;
     lowOpTimeStamp = 0;
+    if(cUnit->jitMode == kJitLoop)
+        loopHeadBlockId = cUnit->entryBlock->fallThrough->id;
 
 // dumpDebuggingInfo is gone in CompilationUnit struct
 #if 0
@@ -643,6 +766,43 @@ void endOfTraceO1() {
      freeCFG();
 }
 
+/* Entry code of the loop head in a loop trace
+   Entering from the start of the trace, load the GG VRs to their physical registers.
+   Back edges land after the loads, on the suspend poll: if a break is pending,
+   punt to the interpreter at the loop head; all VRs are in memory there since
+   GL VRs are stored and GG VRs are written through at the end of each basic block.
+   Lowered with physical registers, like the hoisted checks of the entry block. */
+void loopHeadEntry(const Method* method, BasicBlock_O1* bb) {
+    ExecutionMode origMode = gDvm.executionMode;
+    bool origScratchPhysical = isScratchPhysical;
+    gDvm.executionMode = kExecutionModeNcgO0;
+    isScratchPhysical = true;
+    int k;
+    for(k = 0; k < bb->num_regs; k++) {
+        if(bb->infoBasicBlock[k].gType == GLOBALTYPE_GG)
+            get_virtual_reg_noalloc(bb->infoBasicBlock[k].regNum, OpndSize_32,
+                                    bb->infoBasicBlock[k].physicalReg_GG, true);
+    }
+    loopHeadBodyNCG = stream - streamMethodStart;
+
+    get_self_pointer(PhysicalReg_EAX, true);
+    movez_mem_to_reg(OpndSize_8, offsetof(Thread, interpBreak.ctl.breakFlags),
+                     PhysicalReg_EAX, true, PhysicalReg_EAX, true);
+    compare_imm_reg(OpndSize_32, 0, PhysicalReg_EAX, true);
+    char* streamNoBreak = stream;
+    conditional_jump_int(Condition_E, 0, OpndSize_8);
+    rPC = (u2*)method->insns + bb->jitBasicBlock->startOffset;
+    export_pc();
+    scratchRegs[0] = PhysicalReg_EAX;
+    jumpToInterpPunt();
+    int relativeNCG = stream - streamNoBreak;
+    relativeNCG -= encoder_get_inst_size(streamNoBreak);
+    updateJumpInst(streamNoBreak, OpndSize_8, relativeNCG);
+
+    gDvm.executionMode = origMode;
+    isScratchPhysical = origScratchPhysical;
+}
+
 /** entry point to collect information about virtual registers used in a basic block
     Initialize data structure BasicBlock_O1
     The usage information of virtual registers is stoerd in bb->infoBasicBlock
@@ -741,6 +901,8 @@ int codeGenBasicBlock(const Method* method, BasicBlock_O1* bb) {
     /* we assume at the beginning of each basic block,
        all GL VRs reside in memory and all GG VRs reside in predefined physical registers,
        so at the end of a basic block, recover a spilled GG VR, store a GL VR to memory */
+    if(bb->jitBasicBlock->id == loopHeadBlockId)
+        loopHeadEntry(method, bb);
     /* update compileTable with entries in bb->infoBasicBlock */
     int k;
     for(k = 0; k < bb->num_regs; k++) {
@@ -4624,6 +4786,16 @@ void globalVREndOfBB(const Method* method) {
             }
         }//not const
     }
+    //write GG VRs through, so exits from the trace find them in memory
+    for(k = 0; k < num_compile_entries; k++) {
+        if(isVirtualReg(compileTable[k].physicalType) &&
+           compileTable[k].gType == GLOBALTYPE_GG &&
+           compileTable[k].physicalReg != PhysicalReg_Null) {
+            dumpToMem(compileTable[k].regNum,
+                      (LowOpndRegType)(compileTable[k].physicalType & MASK_FOR_TYPE),
+                      compileTable[k].physicalReg);
+        }
+    }
     if(indexForGlue >= 0 &&
         compileTable[indexForGlue].physicalReg == PhysicalReg_Null) {
         unspillLogicalReg(indexForGlue, PhysicalReg_EBP); //load %ebp
@@ -5033,7 +5033,7 @@ int getTempRegInfo(TempRegInfo* infoArray) { //returns an array of TempRegInfo
                 infoArray[2].physicalType = LowOpndRegType_scratch;
                 return 3;
             case INLINE_STRING_FASTINDEXOF_II:
-#if defined(USE_GLOBAL_STRING_DEFS)
+#if defined(USE_GLOBAL_STRING_DEFS) || defined(WITH_VECTOR_STRING_INTRINSICS)
                 break;
 #else
                 infoArray[0].regNum = 1;
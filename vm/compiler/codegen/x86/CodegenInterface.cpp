@@ -18,6 +18,7 @@
 #include "libdex/DexOpcodes.h"
 #include "compiler/Compiler.h"
 #include "compiler/CompilerIR.h"
+#include "compiler/InlineCache.h"
 #include "interp/Jit.h"
 #include "libdex/DexFile.h"
 #include "Lower.h"
@@ -77,6 +78,9 @@ bool dvmCompilerArchInit() {
     //Disable Method-JIT
     gDvmJit.disableOpt |= (1 << kMethodJit);
 
+    //The lowering keeps its state in globals, so compile on one thread
+    gDvmJit.numCompilerThreads = 1;
+
 #if defined(WITH_SELF_VERIFICATION)
     /* Force into blocking mode */
     gDvmJit.blockingMode = true;
@@ -459,6 +463,17 @@ const Method *dvmJitToPatchPredictedChain(const Method *method,
         goto done;
     }
 
+    /* Leave polymorphic sites alone unless the new class dominates */
+    switch (dvmJitICSiteRechain(cell, clazz)) {
+        case kJitICSiteKeep:
+            goto done;
+        case kJitICSiteMegamorphic:
+            newRechainCount = PREDICTED_CHAIN_COUNTER_AVOID;
+            goto done;
+        default:
+            break;
+    }
+
     PredictedChainingCell newCell;
 
     if (cell->clazz == NULL) {
@@ -613,6 +628,48 @@ void dvmJitUnchainAll()
     gDvmJit.hasNewChain = false;
 }
 
+/*
+ * The x86 chaining jumps aren't decoded here, so every translation
+ * outside [start, end) is unchained, which is always safe.  The x86 code
+ * cache isn't filled by regions, so it is reset rather than evicted from
+ * anyway.  Must be called at a safe point with tableLock held.
+ */
+void dvmJitUnchainRange(const char *start, const char *end)
+{
+    UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+
+    for (size_t i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        const char *codeAddr = (const char *) entry->codeAddress;
+        if (entry->dPC && !entry->u.info.isMethodEntry && codeAddr &&
+            (codeAddr < start || codeAddr >= end)) {
+            dvmJitUnchain(entry->codeAddress);
+        }
+    }
+
+    PROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+}
+
+/*
+ * Unchain a translation that has been replaced in the JitTable, and the
+ * cells chained into it.  x86 translations carry no run counter, so none
+ * is compiled as a baseline and none is replaced.
+ */
+void dvmJitUnchainReplaced(const JitEntry *entry)
+{
+    UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+    dvmJitUnchain(entry->codeAddress);
+    PROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+    dvmJitUnchainRange((const char *) entry->codeAddress,
+                       (const char *) entry->codeAddress + 1);
+}
+
+/* Returns the number of times the translation of <entry> has been run */
+JitTraceCounter_t dvmJitGetTraceCount(const JitEntry *entry)
+{
+    return getProfileCount(entry);
+}
+
 #define P_GPR_1 PhysicalReg_EBX
 /* Add an additional jump instruction, keep jump target 4 bytes aligned.*/
 static void insertJumpHelp()
@@ -1507,11 +1564,13 @@ bool dvmCompilerDoWork(CompilerWorkOrder *work)
 
     switch (work->kind) {
         case kWorkOrderTrace:
+        case kWorkOrderTraceRecompile:
             isCompile = true;
             /* Start compilation with maximally allowed trace length */
             desc = (JitTraceDescription *)work->info;
             success = dvmCompileTrace(desc, JIT_MAX_TRACE_LEN, &work->result,
-                                        work->bailPtr, 0 /* no hints */);
+                                      work->bailPtr,
+                                      dvmCompilerTraceHints(work->kind));
             break;
         case kWorkOrderTraceDebug: {
             bool oldPrintMe = gDvmJit.printMe;
@@ -56,6 +56,9 @@ int currentExceptionBlockIdx = -1;
 LowOpBlockLabel* traceLabelList = NULL;
 BasicBlock* traceCurrentBB = NULL;
 MIR* traceCurrentMIR = NULL;
+//! loop head of a loop trace and the offset where its back edges land
+int loopHeadBlockId = -1;
+int loopHeadBodyNCG = -1;
 bool scheduling_is_on = false;
 
 int common_invokeMethodNoRange();
@@ -447,6 +450,8 @@ void startOfTrace(const Method* method, LowOpBlockLabel* labelList, int exceptio
     //initialize mapFromBCtoNCG
     memset(&mapFromBCtoNCG[0], -1, BYTECODE_SIZE_PER_METHOD * sizeof(mapFromBCtoNCG[0]));
     traceLabelList = labelList;
+    loopHeadBlockId = -1;
+    loopHeadBodyNCG = -1;
     if(gDvm.executionMode == kExecutionModeNcgO1)
         startOfTraceO1(method, labelList, exceptionBlockId, cUnit);
 }
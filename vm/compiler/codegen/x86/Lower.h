@@ -77,7 +77,7 @@
 
 //COPIED from interp/InterpDefs.h
 #define FETCH(_offset) (rPC[(_offset)])
-#define INST_INST(_inst) ((_inst) & 0xff)
+#define INST_INST(_inst) dexGetBaseOpcode((Opcode)((_inst) & 0xff))
 #define INST_A(_inst)       (((_inst) >> 8) & 0x0f)
 #define INST_B(_inst)       ((_inst) >> 12)
 #define INST_AA(_inst)      ((_inst) >> 8)
@@ -1206,6 +1206,8 @@ void startOfBasicBlock(struct BasicBlock* bb);
 extern LowOpBlockLabel* traceLabelList;
 extern struct BasicBlock* traceCurrentBB;
 extern struct MIR* traceCurrentMIR;
+extern int loopHeadBlockId;
+extern int loopHeadBodyNCG;
 void startOfTrace(const Method* method, LowOpBlockLabel* labelList, int, CompilationUnit*);
 void endOfTrace(bool freeOnly);
 LowOp* jumpToBasicBlock(char* instAddr, int targetId);
@@ -1231,6 +1233,7 @@ int boundCheck(int vr_array, int reg_array, bool isPhysical_array,
 int getRelativeOffset(const char* target, bool isShortTerm, JmpCall_type type, bool* unknown,
                       OpndSize* immSize);
 int getRelativeNCG(s4 tmp, JmpCall_type type, bool* unknown, OpndSize* size);
+int updateJumpInst(char* jumpInst, OpndSize immSize, int relativeNCG);
 void freeAtomMem();
 OpndSize estOpndSizeFromImm(int target);
 
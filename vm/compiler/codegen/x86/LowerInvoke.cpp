@@ -1050,7 +1050,7 @@ int op_execute_inline(bool isRange) {
             move_reg_to_mem(OpndSize_32, 2, false, 4 + offsetof(Thread, interpSave.retval), 3, false);
             return 0;
         case INLINE_STRING_FASTINDEXOF_II:
-#if defined(USE_GLOBAL_STRING_DEFS)
+#if defined(USE_GLOBAL_STRING_DEFS) || defined(WITH_VECTOR_STRING_INTRINSICS)
             break;
 #else
             get_virtual_reg(vC, OpndSize_32, 1, false);
@@ -1106,6 +1106,7 @@ int op_execute_inline(bool isRange) {
             get_self_pointer(7, false);
             move_reg_to_mem(OpndSize_32, 1, false, offsetof(Thread, interpSave.retval), 7, false);
             return 0;
+#endif
         case INLINE_FLOAT_TO_RAW_INT_BITS:
             get_virtual_reg(vC, OpndSize_32, 1, false);
             get_self_pointer(2, false);
@@ -1133,7 +1134,6 @@ int op_execute_inline(bool isRange) {
         default:
                 break;
     }
-#endif
     get_self_pointer(PhysicalReg_SCRATCH_1, false);
     load_effective_addr(offsetof(Thread, interpSave.retval), PhysicalReg_SCRATCH_1, false, 1, false);
     load_effective_addr(-24, PhysicalReg_ESP, true, PhysicalReg_ESP, true);
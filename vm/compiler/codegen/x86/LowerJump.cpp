@@ -882,6 +882,10 @@ If the branch target is handled, call estOpndSizeFromImm to set immSize for jump
 */
 int getRelativeNCG(s4 tmp, JmpCall_type type, bool* unknown, OpndSize* size) {//tmp: relativePC
     int tmpNCG = traceLabelList[tmp].lop.generic.offset;
+    /* once the loop head is lowered, a jump to it is a back edge:
+       skip the GG VR loads and land on the suspend poll */
+    if(tmp == loopHeadBlockId && loopHeadBodyNCG >= 0)
+        tmpNCG = loopHeadBodyNCG;
 
     *unknown = false;
     if(tmpNCG <0) {
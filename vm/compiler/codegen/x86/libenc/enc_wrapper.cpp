@@ -79,6 +79,112 @@ inline void add_imm(EncoderBase::Operands & args, OpndSize sz, int value, bool i
              is_signed ? OpndExt_Signed : OpndExt_Zero));
 }
 
+//Direct emitter for the forms the lowering uses most: 32-bit MOV and the
+//two-operand ALU group between general registers, [base+disp] memory and
+//imm32.  It produces exactly the bytes EncoderBase::encode() would (imm32
+//stays imm32, so encoder_update_imm_rm can patch it), and returns NULL for
+//anything else so the caller falls back to the table-driven encoder.
+#ifndef PRINT_ENCODER_STREAM
+//hardware register number of physical registers EAX..EBP
+static const unsigned char gp_reg_code[] = { 0, 3, 1, 2, 7, 6, 4, 5 };
+
+inline bool is_fast_gp(int physicalReg) {
+    return (unsigned)physicalReg <= PhysicalReg_EBP;
+}
+//opcode of "op r/m32, r32" for the ALU group, whose /digit is opcode>>3
+inline int alu_opcode(Mnemonic m) {
+    switch (m) {
+    case Mnemonic_ADD: return 0x00;
+    case Mnemonic_OR:  return 0x08;
+    case Mnemonic_ADC: return 0x10;
+    case Mnemonic_SBB: return 0x18;
+    case Mnemonic_AND: return 0x20;
+    case Mnemonic_SUB: return 0x28;
+    case Mnemonic_XOR: return 0x30;
+    case Mnemonic_CMP: return 0x38;
+    default:           return -1;
+    }
+}
+//opcode of "op r/m32, r32", or -1
+inline int store_opcode(Mnemonic m) {
+    return m == Mnemonic_MOV ? 0x89 : alu_opcode(m) < 0 ? -1 : alu_opcode(m) + 1;
+}
+inline char * emit_imm32(char * stream, int imm) {
+    for (int i = 0; i < 4; i++) {
+        *stream++ = (char)(imm >> (8 * i));
+    }
+    return stream;
+}
+inline char * emit_modrm_reg(char * stream, int regField, int physicalReg) {
+    *stream++ = (char)(0xC0 | (regField << 3) | gp_reg_code[physicalReg]);
+    return stream;
+}
+inline char * emit_modrm_mem(char * stream, int regField, int baseReg, int disp) {
+    int base = gp_reg_code[baseReg];
+    int mod;
+    if (disp == 0 && base != 5/*ebp*/) mod = 0;
+    else if (disp >= -127 && disp <= 127) mod = 1; //same range as encodeModRM()
+    else mod = 2;
+    *stream++ = (char)((mod << 6) | (regField << 3) | base);
+    if (base == 4/*esp*/) *stream++ = 0x24; //SIB: no index, base esp
+    if (mod == 1) *stream++ = (char)disp;
+    else if (mod == 2) stream = emit_imm32(stream, disp);
+    return stream;
+}
+
+//"op reg2, reg"
+inline char * fast_reg_reg(Mnemonic m, OpndSize size, int reg, int reg2, char * stream) {
+    if (size != OpndSize_32 || !is_fast_gp(reg) || !is_fast_gp(reg2)) return NULL;
+    int opcode = m == Mnemonic_TEST ? 0x85 : store_opcode(m);
+    if (opcode < 0) return NULL;
+    *stream++ = (char)opcode;
+    return emit_modrm_reg(stream, gp_reg_code[reg], reg2);
+}
+//"op reg, [base+disp]" when load is set, "op [base+disp], reg" otherwise
+inline char * fast_mem(Mnemonic m, OpndSize size, int reg, int disp, int baseReg,
+                       bool load, char * stream) {
+    if (size != OpndSize_32 || !is_fast_gp(reg) || !is_fast_gp(baseReg)) return NULL;
+    int opcode = store_opcode(m);
+    if (opcode < 0) return NULL;
+    *stream++ = (char)(load ? opcode + 2 : opcode);
+    return emit_modrm_mem(stream, gp_reg_code[reg], baseReg, disp);
+}
+//"op reg, imm32"
+inline char * fast_imm_reg(Mnemonic m, OpndSize size, int imm, int reg, char * stream) {
+    if (size != OpndSize_32 || !is_fast_gp(reg)) return NULL;
+    if (m == Mnemonic_MOV) {
+        *stream++ = (char)(0xB8 | gp_reg_code[reg]);
+    } else {
+        int opcode = alu_opcode(m);
+        if (opcode < 0) return NULL;
+        *stream++ = (char)0x81;
+        stream = emit_modrm_reg(stream, opcode >> 3, reg);
+    }
+    return emit_imm32(stream, imm);
+}
+//"op [base+disp], imm32"
+inline char * fast_imm_mem(Mnemonic m, OpndSize size, int imm, int disp, int baseReg,
+                           char * stream) {
+    if (size != OpndSize_32 || !is_fast_gp(baseReg)) return NULL;
+    int digit;
+    if (m == Mnemonic_MOV) {
+        *stream++ = (char)0xC7;
+        digit = 0;
+    } else {
+        int opcode = alu_opcode(m);
+        if (opcode < 0) return NULL;
+        *stream++ = (char)0x81;
+        digit = opcode >> 3;
+    }
+    stream = emit_modrm_mem(stream, digit, baseReg, disp);
+    return emit_imm32(stream, imm);
+}
+#define TRY_FAST_ENCODE(call) \
+    do { char * fast_end = (call); if (fast_end != NULL) return fast_end; } while (0)
+#else
+#define TRY_FAST_ENCODE(call) do { } while (0)
+#endif
+
 #define MAX_DECODED_STRING_LEN 1024
 char tmpBuffer[MAX_DECODED_STRING_LEN];
 
@@ -225,6 +331,7 @@ extern "C" ENCODER_DECLARE_EXPORT char * encoder_reg_reg(Mnemonic m, OpndSize si
                    int reg, bool isPhysical,
                    int reg2, bool isPhysical2, LowOpndRegType type, char * stream) {
     if((m == Mnemonic_MOV || m == Mnemonic_MOVQ) && reg == reg2) return stream;
+    TRY_FAST_ENCODE(fast_reg_reg(m, size, reg, reg2, stream));
     EncoderBase::Operands args;
     add_r(args, reg2, size); //destination
     if(m == Mnemonic_SAL || m == Mnemonic_SHR || m == Mnemonic_SHL || m == Mnemonic_SAR)
@@ -242,6 +349,7 @@ extern "C" ENCODER_DECLARE_EXPORT char * encoder_reg_reg(Mnemonic m, OpndSize si
 extern "C" ENCODER_DECLARE_EXPORT char * encoder_mem_reg(Mnemonic m, OpndSize size,
                    int disp, int base_reg, bool isBasePhysical,
                    int reg, bool isPhysical, LowOpndRegType type, char * stream) {
+    TRY_FAST_ENCODE(fast_mem(m, size, reg, disp, base_reg, true, stream));
     EncoderBase::Operands args;
     add_r(args, reg, size);
     add_m(args, base_reg, disp, size);
@@ -330,6 +438,7 @@ extern "C" ENCODER_DECLARE_EXPORT char* encoder_reg_mem_disp_scale(Mnemonic m, O
 extern "C" ENCODER_DECLARE_EXPORT char * encoder_reg_mem(Mnemonic m, OpndSize size,
                    int reg, bool isPhysical,
                    int disp, int base_reg, bool isBasePhysical, LowOpndRegType type, char * stream) {
+    TRY_FAST_ENCODE(fast_mem(m, size, reg, disp, base_reg, false, stream));
     EncoderBase::Operands args;
     add_m(args, base_reg, disp, size);
     add_r(args, reg, size);
@@ -343,6 +452,7 @@ extern "C" ENCODER_DECLARE_EXPORT char * encoder_reg_mem(Mnemonic m, OpndSize si
 }
 extern "C" ENCODER_DECLARE_EXPORT char * encoder_imm_reg(Mnemonic m, OpndSize size,
                    int imm, int reg, bool isPhysical, LowOpndRegType type, char * stream) {
+    TRY_FAST_ENCODE(fast_imm_reg(m, size, imm, reg, stream));
     EncoderBase::Operands args;
     add_r(args, reg, size); //dst
     if(m == Mnemonic_IMUL) add_r(args, reg, size); //src CHECK
@@ -375,6 +485,7 @@ extern "C" ENCODER_DECLARE_EXPORT char * encoder_update_imm_rm(int imm, char * s
 extern "C" ENCODER_DECLARE_EXPORT char * encoder_imm_mem(Mnemonic m, OpndSize size,
                    int imm,
                    int disp, int base_reg, bool isBasePhysical, char * stream) {
+    TRY_FAST_ENCODE(fast_imm_mem(m, size, imm, disp, base_reg, stream));
     EncoderBase::Operands args;
     add_m(args, base_reg, disp, size);
     if (m == Mnemonic_SAL || m == Mnemonic_SHR || m == Mnemonic_SHL
@@ -15,11 +15,15 @@
  */
 
 /*
- * Preparation and completion of hprof data generation.  The output is
- * written into two files and then combined.  This is necessary because
- * we generate some of the data (strings and classes) while we dump the
- * heap, and some analysis tools require that the class and string data
- * appear first.
+ * Preparation and completion of hprof data generation.  Some analysis
+ * tools require that the class and string data appear first, but we only
+ * know which strings and classes we need by walking the heap.
+ *
+ * When writing to a file we walk the heap twice: once to collect the
+ * strings and classes, which are written straight away, and once to
+ * stream the heap dump out behind them.  For DDMS, which wants a single
+ * chunk, the heap dump is accumulated in memory and the string and class
+ * data are put in front of it at the end.
  */
 
 #include "Hprof.h"
@@ -44,15 +48,62 @@ hprof_context_t* hprofStartup(const char *outputFileName, int fd,
     hprof_context_t *ctx = (hprof_context_t *)calloc(1, sizeof(*ctx));
     if (ctx == NULL) {
         ALOGE("hprof: can't allocate context.");
-        return NULL;
+        goto fail;
     }
 
-    /* pass in name or descriptor of the output file */
-    hprofContextInit(ctx, strdup(outputFileName), fd, false, directToDdms);
-
-    assert(ctx->memFp != NULL);
+    if (directToDdms) {
+        /* pass in name or descriptor of the output file */
+        hprofContextInit(ctx, strdup(outputFileName), fd, false,
+            directToDdms);
+        assert(ctx->memFp != NULL);
+    } else {
+        int outFd;
+        if (fd >= 0) {
+            outFd = dup(fd);
+            if (outFd < 0) {
+                ALOGE("dup(%d) failed: %s", fd, strerror(errno));
+            }
+        } else {
+            outFd = open(outputFileName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (outFd < 0) {
+                ALOGE("can't open %s: %s", outputFileName, strerror(errno));
+            }
+        }
+        if (outFd < 0 ||
+            !hprofContextInitStream(ctx, strdup(outputFileName), fd, outFd,
+                                    gDvm.hprofCompress))
+        {
+            hprofFreeContext(ctx);
+            goto fail;
+        }
+    }
 
     return ctx;
+
+fail:
+    hprofShutdown_Class();
+    hprofShutdown_String();
+    return NULL;
+}
+
+/*
+ * Write the strings, classes and a dummy stack trace.
+ */
+static void hprofDumpHead(hprof_context_t *ctx)
+{
+    ALOGI("hprof: dumping heap strings to \"%s\".", ctx->fileName);
+    hprofDumpStrings(ctx);
+    hprofDumpClasses(ctx);
+
+    /* Write a dummy stack trace record so the analysis
+     * tools don't freak out.
+     */
+    hprofStartNewRecord(ctx, HPROF_TAG_STACK_TRACE, HPROF_TIME);
+    hprofAddU4ToRecord(&ctx->curRec, HPROF_NULL_STACK_TRACE);
+    hprofAddU4ToRecord(&ctx->curRec, HPROF_NULL_THREAD);
+    hprofAddU4ToRecord(&ctx->curRec, 0);    // no frames
+
+    hprofFlushCurrentRecord(ctx);
 }
 
 /*
@@ -63,6 +114,22 @@ bool hprofShutdown(hprof_context_t *tailCtx)
     /* flush the "tail" portion of the output */
     hprofFlushCurrentRecord(tailCtx);
 
+    if (tailCtx->stream != NULL) {
+        /* the head went out before the heap dump */
+        hprofShutdown_Class();
+        hprofShutdown_String();
+
+        u8 bytesWritten;
+        bool ok = hprofCloseStream(tailCtx, &bytesWritten);
+        if (ok) {
+            /* throw out a log message for the benefit of "runhat" */
+            ALOGI("hprof: heap dump completed (%dKB)",
+                (int)((bytesWritten + 1023) / 1024));
+        }
+        hprofFreeContext(tailCtx);
+        return ok;
+    }
+
     /*
      * Create a new context struct for the start of the file.  We
      * heap-allocate it so we can share the "free" function.
@@ -76,19 +143,7 @@ bool hprofShutdown(hprof_context_t *tailCtx)
     hprofContextInit(headCtx, strdup(tailCtx->fileName), tailCtx->fd, true,
         tailCtx->directToDdms);
 
-    ALOGI("hprof: dumping heap strings to \"%s\".", tailCtx->fileName);
-    hprofDumpStrings(headCtx);
-    hprofDumpClasses(headCtx);
-
-    /* Write a dummy stack trace record so the analysis
-     * tools don't freak out.
-     */
-    hprofStartNewRecord(headCtx, HPROF_TAG_STACK_TRACE, HPROF_TIME);
-    hprofAddU4ToRecord(&headCtx->curRec, HPROF_NULL_STACK_TRACE);
-    hprofAddU4ToRecord(&headCtx->curRec, HPROF_NULL_THREAD);
-    hprofAddU4ToRecord(&headCtx->curRec, 0);    // no frames
-
-    hprofFlushCurrentRecord(headCtx);
+    hprofDumpHead(headCtx);
 
     hprofShutdown_Class();
     hprofShutdown_String();
@@ -97,52 +152,14 @@ bool hprofShutdown(hprof_context_t *tailCtx)
     fflush(headCtx->memFp);
     fflush(tailCtx->memFp);
 
-    if (tailCtx->directToDdms) {
-        /* send the data off to DDMS */
-        struct iovec iov[2];
-        iov[0].iov_base = headCtx->fileDataPtr;
-        iov[0].iov_len = headCtx->fileDataSize;
-        iov[1].iov_base = tailCtx->fileDataPtr;
-        iov[1].iov_len = tailCtx->fileDataSize;
-        dvmDbgDdmSendChunkV(CHUNK_TYPE("HPDS"), iov, 2);
-    } else {
-        /*
-         * Open the output file, and copy the head and tail to it.
-         */
-        assert(headCtx->fd == tailCtx->fd);
-
-        int outFd;
-        if (headCtx->fd >= 0) {
-            outFd = dup(headCtx->fd);
-            if (outFd < 0) {
-                ALOGE("dup(%d) failed: %s", headCtx->fd, strerror(errno));
-                /* continue to fail-handler below */
-            }
-        } else {
-            outFd = open(tailCtx->fileName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
-            if (outFd < 0) {
-                ALOGE("can't open %s: %s", headCtx->fileName, strerror(errno));
-                /* continue to fail-handler below */
-            }
-        }
-        if (outFd < 0) {
-            hprofFreeContext(headCtx);
-            hprofFreeContext(tailCtx);
-            return false;
-        }
-
-        int result;
-        result = sysWriteFully(outFd, headCtx->fileDataPtr,
-            headCtx->fileDataSize, "hprof-head");
-        result |= sysWriteFully(outFd, tailCtx->fileDataPtr,
-            tailCtx->fileDataSize, "hprof-tail");
-        close(outFd);
-        if (result != 0) {
-            hprofFreeContext(headCtx);
-            hprofFreeContext(tailCtx);
-            return false;
-        }
-    }
+    /* send the data off to DDMS */
+    assert(tailCtx->directToDdms);
+    struct iovec iov[2];
+    iov[0].iov_base = headCtx->fileDataPtr;
+    iov[0].iov_len = headCtx->fileDataSize;
+    iov[1].iov_base = tailCtx->fileDataPtr;
+    iov[1].iov_len = tailCtx->fileDataSize;
+    dvmDbgDdmSendChunkV(CHUNK_TYPE("HPDS"), iov, 2);
 
     /* throw out a log message for the benefit of "runhat" */
     ALOGI("hprof: heap dump completed (%dKB)",
@@ -163,6 +180,8 @@ void hprofFreeContext(hprof_context_t *ctx)
 
     /* we don't own ctx->fd, do not close */
 
+    if (ctx->stream != NULL)
+        hprofCloseStream(ctx, NULL);
     if (ctx->memFp != NULL)
         fclose(ctx->memFp);
     free(ctx->curRec.body);
@@ -222,6 +241,15 @@ static void hprofBitmapCallback(Object *obj, void *arg)
     hprofDumpHeapObject(ctx, obj);
 }
 
+/*
+ * Visitor invoked on every heap object before a streamed dump.
+ */
+static void hprofRegisterCallback(Object *obj, void *arg)
+{
+    assert(obj != NULL);
+    hprofRegisterHeapObject(obj);
+}
+
 /*
  * Walk the roots and heap writing heap information to the specified
  * file.
@@ -244,8 +272,17 @@ int hprofDumpHeap(const char* fileName, int fd, bool directToDdms)
     dvmSuspendAllThreads(SUSPEND_FOR_HPROF);
     ctx = hprofStartup(fileName, fd, directToDdms);
     if (ctx == NULL) {
+        dvmResumeAllThreads(SUSPEND_FOR_HPROF);
+        dvmUnlockHeap();
         return -1;
     }
+    if (ctx->stream != NULL) {
+        /* find every string and class, and write them out first */
+        hprofPrepareHeapDump();
+        dvmHeapBitmapWalk(dvmHeapSourceGetLiveBits(), hprofRegisterCallback,
+                          NULL);
+        hprofDumpHead(ctx);
+    }
     // first record
     hprofStartNewRecord(ctx, HPROF_TAG_HEAP_DUMP_SEGMENT, HPROF_TIME);
     dvmVisitRoots(hprofRootVisitor, ctx);
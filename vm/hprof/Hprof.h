@@ -111,6 +111,8 @@ struct hprof_record_t {
     bool dirty;
 };
 
+struct HprofStream;
+
 enum HprofHeapId {
     HPROF_HEAP_DEFAULT = 0,
     HPROF_HEAP_ZYGOTE = 'Z',
@@ -140,6 +142,13 @@ struct hprof_context_t {
     size_t fileDataSize;        // for open_memstream
     FILE *memFp;
     int fd;
+
+    /*
+     * Set when writing to a file: records go through fixed-size buffers
+     * to a writer thread, which gzips them with -XX:+HprofCompress,
+     * instead of into memFp.
+     */
+    HprofStream *stream;
 };
 
 
@@ -181,14 +190,19 @@ void hprofMarkRootObject(hprof_context_t *ctx,
 
 int hprofDumpHeapObject(hprof_context_t *ctx, const Object *obj);
 
+void hprofPrepareHeapDump(void);
+void hprofRegisterHeapObject(const Object *obj);
+
 /*
  * HprofOutput.cpp functions
  */
 
 void hprofContextInit(hprof_context_t *ctx, char *fileName, int fd,
                       bool writeHeader, bool directToDdms);
+bool hprofContextInitStream(hprof_context_t *ctx, char *fileName, int fd,
+                            int outFd, bool compress);
+bool hprofCloseStream(hprof_context_t *ctx, u8 *pBytesWritten);
 
-int hprofFlushRecord(hprof_record_t *rec, FILE *fp);
 int hprofFlushCurrentRecord(hprof_context_t *ctx);
 int hprofStartNewRecord(hprof_context_t *ctx, u1 tag, u4 time);
 
@@ -39,30 +39,12 @@ int hprofShutdown_Class()
 
 static u4 computeClassHash(const ClassObject *clazz)
 {
-    u4 hash;
-    const char *cp;
-    char c;
-
-    cp = clazz->descriptor;
-    hash = (u4)clazz->classLoader;
-    while ((c = *cp++) != '\0') {
-        hash = hash * 31 + c;
-    }
-
-    return hash;
+    return (u4)((uintptr_t)clazz >> 3);
 }
 
 static int classCmp(const void *v1, const void *v2)
 {
-    const ClassObject *c1 = (const ClassObject *)v1;
-    const ClassObject *c2 = (const ClassObject *)v2;
-    intptr_t diff;
-
-    diff = (uintptr_t)c1->classLoader - (uintptr_t)c2->classLoader;
-    if (diff == 0) {
-        return strcmp(c1->descriptor, c2->descriptor);
-    }
-    return diff;
+    return v1 != v2;
 }
 
 static int getPrettyClassNameId(const char *descriptor) {
@@ -86,8 +68,15 @@ hprof_class_object_id hprofLookupClassId(const ClassObject *clazz)
     /* We're using the hash table as a list.
      * TODO: replace the hash table with a more suitable structure
      */
-    val = dvmHashTableLookup(gClassHashTable, computeClassHash(clazz),
-            (void *)clazz, classCmp, true);
+    u4 hash = computeClassHash(clazz);
+    bool added = false;
+    val = dvmHashTableLookup(gClassHashTable, hash, (void *)clazz, classCmp,
+            false);
+    if (val == NULL) {
+        val = dvmHashTableLookup(gClassHashTable, hash, (void *)clazz,
+                classCmp, true);
+        added = true;
+    }
     assert(val != NULL);
 
     dvmHashTableUnlock(gClassHashTable);
@@ -95,9 +84,12 @@ hprof_class_object_id hprofLookupClassId(const ClassObject *clazz)
     /* Make sure that the class's name is in the string table.
      * This is a bunch of extra work that we only have to do
      * because of the order of tables in the output file
-     * (strings need to be dumped before classes).
+     * (strings need to be dumped before classes).  Once per
+     * class is enough; this is called for every instance.
      */
-    getPrettyClassNameId(clazz->descriptor);
+    if (added) {
+        getPrettyClassNameId(clazz->descriptor);
+    }
 
     return (hprof_class_object_id)clazz;
 }
@@ -20,7 +20,8 @@
 
 /* Set DUMP_PRIM_DATA to 1 if you want to include the contents
  * of primitive arrays (byte arrays, character arrays, etc.)
- * in heap dumps.  This can be a large amount of data.
+ * in heap dumps.  This can be a large amount of data;
+ * -XX:HprofPrimitiveArrayLimit leaves out the larger arrays at runtime.
  */
 #define DUMP_PRIM_DATA 1
 
@@ -203,6 +204,16 @@ void hprofMarkRootObject(hprof_context_t *ctx, const Object *obj,
     ctx->objectsInSegment++;
 }
 
+/*
+ * Returns true if a primitive array with "byteLength" bytes of elements
+ * should be dumped with its contents.  The rest get a NODATA record that
+ * keeps their length, so object sizes still add up without the payload.
+ */
+static bool dumpPrimitiveData(size_t byteLength)
+{
+    return DUMP_PRIM_DATA && byteLength <= gDvm.hprofPrimitiveArrayLimit;
+}
+
 static int stackTraceSerialNumber(const void *obj)
 {
     return HPROF_NULL_STACK_TRACE;
@@ -270,15 +281,17 @@ int hprofDumpHeapObject(hprof_context_t *ctx, const Object *obj)
             int sFieldCount = thisClass->sfieldCount;
             if (sFieldCount != 0) {
                 int byteLength = sFieldCount*sizeof(StaticField);
+                bool withData = dumpPrimitiveData(byteLength);
                 /* Create a byte array to reflect the allocation of the
                  * StaticField array at the end of this class.
                  */
-                hprofAddU1ToRecord(rec, HPROF_PRIMITIVE_ARRAY_DUMP);
+                hprofAddU1ToRecord(rec, withData ? HPROF_PRIMITIVE_ARRAY_DUMP
+                        : HPROF_PRIMITIVE_ARRAY_NODATA_DUMP);
                 hprofAddIdToRecord(rec, CLASS_STATICS_ID(obj));
                 hprofAddU4ToRecord(rec, stackTraceSerialNumber(obj));
                 hprofAddU4ToRecord(rec, byteLength);
                 hprofAddU1ToRecord(rec, hprof_basic_byte);
-                for (int i = 0; i < byteLength; i++) {
+                for (int i = 0; withData && i < byteLength; i++) {
                     hprofAddU1ToRecord(rec, 0);
                 }
             }
@@ -374,21 +387,20 @@ int hprofDumpHeapObject(hprof_context_t *ctx, const Object *obj)
 
                 /* obj is a primitive array.
                  */
-#if DUMP_PRIM_DATA
-                hprofAddU1ToRecord(rec, HPROF_PRIMITIVE_ARRAY_DUMP);
-#else
-                hprofAddU1ToRecord(rec, HPROF_PRIMITIVE_ARRAY_NODATA_DUMP);
-#endif
+                bool withData = dumpPrimitiveData((size_t)length * size);
+                hprofAddU1ToRecord(rec, withData ? HPROF_PRIMITIVE_ARRAY_DUMP
+                        : HPROF_PRIMITIVE_ARRAY_NODATA_DUMP);
 
                 hprofAddIdToRecord(rec, (hprof_object_id)obj);
                 hprofAddU4ToRecord(rec, stackTraceSerialNumber(obj));
                 hprofAddU4ToRecord(rec, length);
                 hprofAddU1ToRecord(rec, t);
 
-#if DUMP_PRIM_DATA
                 /* Dump the raw, packed element values.
                  */
-                if (size == 1) {
+                if (!withData) {
+                    /* just the length */
+                } else if (size == 1) {
                     hprofAddU1ListToRecord(rec, (const u1 *)aobj->contents,
                             length);
                 } else if (size == 2) {
@@ -401,7 +413,6 @@ int hprofDumpHeapObject(hprof_context_t *ctx, const Object *obj)
                     hprofAddU8ListToRecord(rec, (const u8 *)aobj->contents,
                             length);
                 }
-#endif
             }
         } else {
             const ClassObject *sclass;
@@ -465,3 +476,48 @@ int hprofDumpHeapObject(hprof_context_t *ctx, const Object *obj)
 
     return 0;
 }
+
+/*
+ * Register the heap names hprofDumpHeapObject() may emit.
+ */
+void hprofPrepareHeapDump()
+{
+    hprofLookupStringId("app");
+    hprofLookupStringId("zygote");
+}
+
+/*
+ * Register every class and string ID that hprofDumpHeapObject() will
+ * look up for "obj", without writing anything.  When streaming, this is
+ * run over the whole heap first so the STRING and LOAD_CLASS records can
+ * go out ahead of the heap dump.  Keep it in step with
+ * hprofDumpHeapObject().
+ */
+void hprofRegisterHeapObject(const Object *obj)
+{
+    const ClassObject *clazz = obj->clazz;
+
+    if (clazz == NULL) {
+        /* not dumped */
+    } else if (dvmIsClassObject(obj)) {
+        const ClassObject *thisClass = (const ClassObject *)obj;
+
+        hprofLookupClassId(thisClass);
+        hprofLookupClassId(thisClass->super);
+        if (thisClass->sfieldCount != 0) {
+            hprofLookupStringId(STATIC_OVERHEAD_NAME);
+            for (int i = 0; i < thisClass->sfieldCount; i++) {
+                hprofLookupStringId(thisClass->sfields[i].name);
+            }
+        }
+        for (int i = 0; i < thisClass->ifieldCount; i++) {
+            hprofLookupStringId(thisClass->ifields[i].name);
+        }
+    } else if (IS_CLASS_FLAG_SET(clazz, CLASS_ISARRAY)) {
+        if (IS_CLASS_FLAG_SET(clazz, CLASS_ISOBJECTARRAY)) {
+            hprofLookupClassId(clazz);
+        }
+    } else {
+        hprofLookupClassId(clazz);
+    }
+}
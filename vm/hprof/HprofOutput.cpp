@@ -15,20 +15,18 @@
  */
 #include <sys/time.h>
 #include <cutils/open_memstream.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <zlib.h>
 #include <time.h>
+#include <unistd.h>
 #include <errno.h>
 #include "Hprof.h"
 
 #define HPROF_MAGIC_STRING  "JAVA PROFILE 1.0.3"
 
-#define U2_TO_BUF_BE(buf, offset, value) \
-    do { \
-        unsigned char *buf_ = (unsigned char *)(buf); \
-        int offset_ = (int)(offset); \
-        u2 value_ = (u2)(value); \
-        buf_[offset_ + 0] = (unsigned char)(value_ >>  8); \
-        buf_[offset_ + 1] = (unsigned char)(value_      ); \
-    } while (0)
+/* size of each of the two buffers between the dump and the writer thread */
+#define HPROF_STREAM_CHUNK_SIZE (1024 * 1024)
 
 #define U4_TO_BUF_BE(buf, offset, value) \
     do { \
@@ -41,20 +39,188 @@
         buf_[offset_ + 3] = (unsigned char)(value_      ); \
     } while (0)
 
-#define U8_TO_BUF_BE(buf, offset, value) \
-    do { \
-        unsigned char *buf_ = (unsigned char *)(buf); \
-        int offset_ = (int)(offset); \
-        u8 value_ = (u8)(value); \
-        buf_[offset_ + 0] = (unsigned char)(value_ >> 56); \
-        buf_[offset_ + 1] = (unsigned char)(value_ >> 48); \
-        buf_[offset_ + 2] = (unsigned char)(value_ >> 40); \
-        buf_[offset_ + 3] = (unsigned char)(value_ >> 32); \
-        buf_[offset_ + 4] = (unsigned char)(value_ >> 24); \
-        buf_[offset_ + 5] = (unsigned char)(value_ >> 16); \
-        buf_[offset_ + 6] = (unsigned char)(value_ >>  8); \
-        buf_[offset_ + 7] = (unsigned char)(value_      ); \
-    } while (0)
+/*
+ * The dump fills one buffer while the writer thread writes the other to
+ * the file, so a large heap never has to fit in memory and the suspended
+ * VM isn't held up by the disk more than one chunk at a time.
+ */
+struct HprofStream {
+    int fd;                     // owned; closed by hprofCloseStream()
+    bool compress;              // gzip on the writer thread
+    z_stream zstream;
+    unsigned char *zbuf;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned char *buf[2];
+    int cur;                    // the buffer being filled
+    size_t fill;                // bytes in buf[cur]
+    size_t pending;             // bytes of buf[cur ^ 1] not yet written
+    bool closing;
+    bool failed;
+    u8 bytesWritten;
+};
+
+/*
+ * Write "len" bytes to the file, compressing them first if asked.  With
+ * "finish" set, also writes out the end of the gzip stream.  Runs on the
+ * writer thread.  Returns false on failure.
+ */
+static bool streamEmit(HprofStream *stream, const unsigned char *buf,
+                       size_t len, bool finish)
+{
+    if (!stream->compress) {
+        if (len > 0 && sysWriteFully(stream->fd, buf, len, "hprof") != 0) {
+            return false;
+        }
+        stream->bytesWritten += len;
+        return true;
+    }
+
+    z_stream *zs = &stream->zstream;
+    zs->next_in = (Bytef *)buf;
+    zs->avail_in = len;
+    int zerr;
+    do {
+        zs->next_out = stream->zbuf;
+        zs->avail_out = HPROF_STREAM_CHUNK_SIZE;
+        zerr = deflate(zs, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (zerr == Z_STREAM_ERROR) {
+            ALOGE("hprof: deflate failed");
+            return false;
+        }
+        size_t n = HPROF_STREAM_CHUNK_SIZE - zs->avail_out;
+        if (n > 0 && sysWriteFully(stream->fd, stream->zbuf, n, "hprof") != 0) {
+            return false;
+        }
+        stream->bytesWritten += n;
+    } while (zs->avail_out == 0 || (finish && zerr != Z_STREAM_END));
+    return true;
+}
+
+static void *streamWriterThreadStart(void *arg)
+{
+    HprofStream *stream = (HprofStream *)arg;
+
+    pthread_mutex_lock(&stream->lock);
+    while (true) {
+        while (stream->pending == 0 && !stream->closing) {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+        if (stream->pending == 0) {
+            break;
+        }
+        /* "cur" can't change until we clear "pending" */
+        const unsigned char *buf = stream->buf[stream->cur ^ 1];
+        size_t len = stream->pending;
+        bool failed = stream->failed;
+        pthread_mutex_unlock(&stream->lock);
+
+        if (!failed && !streamEmit(stream, buf, len, false)) {
+            failed = true;
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        stream->failed = failed;
+        stream->pending = 0;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    if (stream->compress && !stream->failed &&
+        !streamEmit(stream, NULL, 0, true))
+    {
+        stream->failed = true;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+/*
+ * Hand the buffer being filled to the writer, waiting for it to finish
+ * with the other one first.
+ */
+static void streamHandOff(HprofStream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (stream->pending != 0) {
+        pthread_cond_wait(&stream->cond, &stream->lock);
+    }
+    stream->pending = stream->fill;
+    stream->cur ^= 1;
+    stream->fill = 0;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void streamWrite(HprofStream *stream, const void *data, size_t len)
+{
+    const unsigned char *src = (const unsigned char *)data;
+
+    while (len > 0) {
+        size_t n = HPROF_STREAM_CHUNK_SIZE - stream->fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(stream->buf[stream->cur] + stream->fill, src, n);
+        stream->fill += n;
+        src += n;
+        len -= n;
+        if (stream->fill == HPROF_STREAM_CHUNK_SIZE) {
+            streamHandOff(stream);
+        }
+    }
+}
+
+/*
+ * Write raw bytes to wherever "ctx" sends its output.  Returns the number
+ * of bytes accepted, as fwrite() does.
+ */
+static size_t contextWrite(hprof_context_t *ctx, const void *data, size_t len)
+{
+    if (ctx->stream != NULL) {
+        streamWrite(ctx->stream, data, len);
+        return len;
+    }
+    return fwrite(data, 1, len, ctx->memFp);
+}
+
+/*
+ * Write the file header.
+ */
+static void writeFileHeader(hprof_context_t *ctx)
+{
+    char magic[] = HPROF_MAGIC_STRING;
+    unsigned char buf[4];
+    struct timeval now;
+    u8 nowMs;
+
+    /* [u1]*: NUL-terminated magic string.
+     */
+    contextWrite(ctx, magic, sizeof(magic));
+
+    /* u4: size of identifiers.  We're using addresses
+     *     as IDs, so make sure a pointer fits.
+     */
+    U4_TO_BUF_BE(buf, 0, sizeof(void *));
+    contextWrite(ctx, buf, sizeof(u4));
+
+    /* The current time, in milliseconds since 0:00 GMT, 1/1/70.
+     */
+    if (gettimeofday(&now, NULL) < 0) {
+        nowMs = 0;
+    } else {
+        nowMs = (u8)now.tv_sec * 1000 + now.tv_usec / 1000;
+    }
+
+    /* u4: high word of the 64-bit time.
+     */
+    U4_TO_BUF_BE(buf, 0, (u4)(nowMs >> 32));
+    contextWrite(ctx, buf, sizeof(u4));
+
+    /* u4: low word of the 64-bit time.
+     */
+    U4_TO_BUF_BE(buf, 0, (u4)(nowMs & 0xffffffffULL));
+    contextWrite(ctx, buf, sizeof(u4)); //xxx fix the time
+}
 
 /*
  * Initialize an hprof context struct.
@@ -89,59 +255,132 @@ void hprofContextInit(hprof_context_t *ctx, char *fileName, int fd,
 //xxx check for/return an error
 
     if (writeHeader) {
-        char magic[] = HPROF_MAGIC_STRING;
-        unsigned char buf[4];
-        struct timeval now;
-        u8 nowMs;
-
-        /* Write the file header.
-         *
-         * [u1]*: NUL-terminated magic string.
-         */
-        fwrite(magic, 1, sizeof(magic), fp);
-
-        /* u4: size of identifiers.  We're using addresses
-         *     as IDs, so make sure a pointer fits.
-         */
-        U4_TO_BUF_BE(buf, 0, sizeof(void *));
-        fwrite(buf, 1, sizeof(u4), fp);
-
-        /* The current time, in milliseconds since 0:00 GMT, 1/1/70.
-         */
-        if (gettimeofday(&now, NULL) < 0) {
-            nowMs = 0;
-        } else {
-            nowMs = (u8)now.tv_sec * 1000 + now.tv_usec / 1000;
+        writeFileHeader(ctx);
+    }
+}
+
+/*
+ * Initialize an hprof context struct that streams everything, header
+ * included, to "outFd", gzipped if "compress" is set.  Takes ownership of
+ * "fileName" and "outFd", even on failure.
+ *
+ * NOTE: ctx is expected to have been zeroed out prior to calling this
+ * function.
+ */
+bool hprofContextInitStream(hprof_context_t *ctx, char *fileName, int fd,
+                            int outFd, bool compress)
+{
+    ctx->directToDdms = false;
+    ctx->fileName = fileName;
+    ctx->fd = fd;
+
+    ctx->curRec.allocLen = 128;
+    ctx->curRec.body = (unsigned char *)malloc(ctx->curRec.allocLen);
+
+    HprofStream *stream = (HprofStream *)calloc(1, sizeof(*stream));
+    if (stream == NULL || ctx->curRec.body == NULL) {
+        free(stream);
+        close(outFd);
+        return false;
+    }
+    stream->fd = outFd;
+    stream->buf[0] = (unsigned char *)malloc(HPROF_STREAM_CHUNK_SIZE);
+    stream->buf[1] = (unsigned char *)malloc(HPROF_STREAM_CHUNK_SIZE);
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    bool ready = stream->buf[0] != NULL && stream->buf[1] != NULL;
+    if (ready && compress) {
+        /* windowBits 15 + 16 asks for a gzip header and trailer */
+        stream->compress = true;
+        stream->zbuf = (unsigned char *)malloc(HPROF_STREAM_CHUNK_SIZE);
+        ready = stream->zbuf != NULL &&
+                deflateInit2(&stream->zstream, Z_BEST_SPEED, Z_DEFLATED,
+                             15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        if (!ready) {
+            free(stream->zbuf);
+            stream->compress = false;
+        }
+    }
+    int cc = -1;
+    if (ready) {
+        cc = pthread_create(&stream->writer, NULL, streamWriterThreadStart,
+                            stream);
+    }
+    if (cc != 0) {
+        ALOGE("hprof: can't start writer thread");
+        if (stream->compress) {
+            deflateEnd(&stream->zstream);
+            free(stream->zbuf);
         }
+        free(stream->buf[0]);
+        free(stream->buf[1]);
+        pthread_cond_destroy(&stream->cond);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream);
+        close(outFd);
+        return false;
+    }
+    ctx->stream = stream;
+
+    writeFileHeader(ctx);
+    return true;
+}
+
+/*
+ * Write out whatever is buffered, stop the writer thread and close the
+ * file.  Returns false if any write failed.
+ */
+bool hprofCloseStream(hprof_context_t *ctx, u8 *pBytesWritten)
+{
+    HprofStream *stream = ctx->stream;
+    assert(stream != NULL);
 
-        /* u4: high word of the 64-bit time.
-         */
-        U4_TO_BUF_BE(buf, 0, (u4)(nowMs >> 32));
-        fwrite(buf, 1, sizeof(u4), fp);
+    if (stream->fill > 0) {
+        streamHandOff(stream);
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->closing = true;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->writer, NULL);
+
+    bool ok = !stream->failed;
+    if (close(stream->fd) != 0) {
+        ALOGE("hprof: close failed: %s", strerror(errno));
+        ok = false;
+    }
+    if (pBytesWritten != NULL) {
+        *pBytesWritten = stream->bytesWritten;
+    }
 
-        /* u4: low word of the 64-bit time.
-         */
-        U4_TO_BUF_BE(buf, 0, (u4)(nowMs & 0xffffffffULL));
-        fwrite(buf, 1, sizeof(u4), fp); //xxx fix the time
+    if (stream->compress) {
+        deflateEnd(&stream->zstream);
+        free(stream->zbuf);
     }
+    free(stream->buf[0]);
+    free(stream->buf[1]);
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+    ctx->stream = NULL;
+    return ok;
 }
 
-int hprofFlushRecord(hprof_record_t *rec, FILE *fp)
+int hprofFlushCurrentRecord(hprof_context_t *ctx)
 {
+    hprof_record_t *rec = &ctx->curRec;
+
     if (rec->dirty) {
         unsigned char headBuf[sizeof (u1) + 2 * sizeof (u4)];
-        int nb;
 
         headBuf[0] = rec->tag;
         U4_TO_BUF_BE(headBuf, 1, rec->time);
         U4_TO_BUF_BE(headBuf, 5, rec->length);
 
-        nb = fwrite(headBuf, 1, sizeof(headBuf), fp);
-        if (nb != sizeof(headBuf)) {
+        if (contextWrite(ctx, headBuf, sizeof(headBuf)) != sizeof(headBuf)) {
             return UNIQUE_ERROR();
         }
-        nb = fwrite(rec->body, 1, rec->length, fp);
-        if (nb != (int)rec->length) {
+        if (contextWrite(ctx, rec->body, rec->length) != rec->length) {
             return UNIQUE_ERROR();
         }
 
@@ -152,17 +391,12 @@ int hprofFlushRecord(hprof_record_t *rec, FILE *fp)
     return 0;
 }
 
-int hprofFlushCurrentRecord(hprof_context_t *ctx)
-{
-    return hprofFlushRecord(&ctx->curRec, ctx->memFp);
-}
-
 int hprofStartNewRecord(hprof_context_t *ctx, u1 tag, u4 time)
 {
     hprof_record_t *rec = &ctx->curRec;
     int err;
 
-    err = hprofFlushRecord(rec, ctx->memFp);
+    err = hprofFlushCurrentRecord(ctx);
     if (err != 0) {
         return err;
     } else if (rec->dirty) {
@@ -250,12 +484,12 @@ int hprofAddU2ListToRecord(hprof_record_t *rec, const u2 *values,
         return err;
     }
 
-//xxx this can be way smarter
-//xxx also, don't do this bytewise if aligned and on a matching-endian arch
+    /* a word at a time; the compiler turns this into byte-swap loads */
     unsigned char *insert = rec->body + rec->length;
     for (size_t i = 0; i < numValues; i++) {
-        U2_TO_BUF_BE(insert, 0, *values++);
-        insert += sizeof(*values);
+        u2 value = htons(values[i]);
+        memcpy(insert, &value, sizeof(value));
+        insert += sizeof(value);
     }
     rec->length += numValues * 2;
 
@@ -275,12 +509,12 @@ int hprofAddU4ListToRecord(hprof_record_t *rec, const u4 *values,
         return err;
     }
 
-//xxx this can be way smarter
-//xxx also, don't do this bytewise if aligned and on a matching-endian arch
+    /* a word at a time; the compiler turns this into byte-swap loads */
     unsigned char *insert = rec->body + rec->length;
     for (size_t i = 0; i < numValues; i++) {
-        U4_TO_BUF_BE(insert, 0, *values++);
-        insert += sizeof(*values);
+        u4 value = htonl(values[i]);
+        memcpy(insert, &value, sizeof(value));
+        insert += sizeof(value);
     }
     rec->length += numValues * 4;
 
@@ -300,11 +534,12 @@ int hprofAddU8ListToRecord(hprof_record_t *rec, const u8 *values,
         return err;
     }
 
-//xxx this can be way smarter
-//xxx also, don't do this bytewise if aligned and on a matching-endian arch
     unsigned char *insert = rec->body + rec->length;
     for (size_t i = 0; i < numValues; i++) {
-        U8_TO_BUF_BE(insert, 0, *values++);
+        u4 hi = htonl((u4)(values[i] >> 32));
+        u4 lo = htonl((u4)values[i]);
+        memcpy(insert, &hi, sizeof(hi));
+        memcpy(insert + sizeof(hi), &lo, sizeof(lo));
         insert += sizeof(*values);
     }
     rec->length += numValues * 8;
@@ -25,6 +25,7 @@
  */
 #include "Dalvik.h"
 #include "interp/InterpDefs.h"
+#include "mterp/common/FindInterface.h"
 #if defined(WITH_JIT)
 #include "interp/Jit.h"
 #endif
@@ -627,7 +628,8 @@ void dvmReportExceptionThrow(Thread* self, Object* exception)
         self->jitResumeNPC = NULL;
     }
 #endif
-    if (self->interpBreak.ctl.subMode & kSubModeDebuggerActive) {
+    if (self->interpBreak.ctl.subMode &
+            (kSubModeDebuggerActive | kSubModeDebuggerAttached)) {
         void *catchFrame;
         int offset = self->interpSave.pc - curMethod->insns;
         int catchRelPc = dvmFindCatchBlock(self, offset, exception,
@@ -1210,6 +1212,26 @@ bool dvmInterpHandleFillArrayData(ArrayObject* arrayObj, const u2* arrayData)
     return true;
 }
 
+/*
+ * The miss path of the invoke-interface site cache (see InterpDefs.h).
+ */
+Method* dvmInterpFindInterfaceMethodAtSite(ClassObject* thisClass,
+    const u2* pc, const Method* method, DvmDex* methodClassDex)
+{
+    Method* methodToCall = dvmFindInterfaceMethodInCache(thisClass, pc[1],
+        method, methodClassDex);
+
+    if (methodToCall != NULL) {
+        Thread* self = dvmThreadSelf();
+        InterfaceSiteCacheEntry* entry =
+            &self->interfaceSiteCache[INTERFACE_SITE_CACHE_INDEX(pc)];
+        entry->sitePc = pc;
+        entry->clazz = thisClass;
+        entry->method = methodToCall;
+    }
+    return methodToCall;
+}
+
 /*
  * Find the concrete method that corresponds to "methodIdx".  The code in
  * "method" is executing invoke-method with "thisClass" as its first argument.
@@ -1221,7 +1243,8 @@ Method* dvmInterpFindInterfaceMethod(ClassObject* thisClass, u4 methodIdx,
 {
     Method* absMethod;
     Method* methodToCall;
-    int i, vtableIndex;
+    const InterfaceEntry* entry;
+    int vtableIndex;
 
     /*
      * Resolve the method.  This gives us the abstract method from the
@@ -1240,30 +1263,25 @@ Method* dvmInterpFindInterfaceMethod(ClassObject* thisClass, u4 methodIdx,
     assert(dvmIsAbstractMethod(absMethod));
 
     /*
-     * Run through the "this" object's iftable.  Find the entry for
-     * absMethod's class, then use absMethod->methodIndex to find
-     * the method's entry.  The value there is the offset into our
-     * vtable of the actual method to execute.
+     * Find the entry for absMethod's class in the "this" object's
+     * iftable, then use absMethod->methodIndex to find the method's
+     * entry.  The value there is the offset into our vtable of the
+     * actual method to execute.
      *
      * The verifier does not guarantee that objects stored into
      * interface references actually implement the interface, so this
      * check cannot be eliminated.
      */
-    for (i = 0; i < thisClass->iftableCount; i++) {
-        if (thisClass->iftable[i].clazz == absMethod->clazz)
-            break;
-    }
-    if (i == thisClass->iftableCount) {
+    entry = dvmFindIftableEntry(thisClass, absMethod->clazz);
+    if (entry == NULL) {
         /* impossible in verified DEX, need to check for it in unverified */
         dvmThrowIncompatibleClassChangeError("interface not implemented");
         return NULL;
     }
 
-    assert(absMethod->methodIndex <
-        thisClass->iftable[i].clazz->virtualMethodCount);
+    assert(absMethod->methodIndex < entry->clazz->virtualMethodCount);
 
-    vtableIndex =
-        thisClass->iftable[i].methodIndexArray[absMethod->methodIndex];
+    vtableIndex = entry->methodIndexArray[absMethod->methodIndex];
     assert(vtableIndex >= 0 && vtableIndex < thisClass->vtableCount);
     methodToCall = thisClass->vtable[vtableIndex];
 
@@ -1464,8 +1482,18 @@ void updateInterpBreak(Thread* thread, ExecutionSubModes subMode, bool enable)
         if (newValue.ctl.subMode & SAFEPOINT_BREAK_MASK)
             newValue.ctl.breakFlags |= kInterpSafePoint;
 #ifndef DVM_NO_ASM_INTERP
-        newValue.ctl.curHandlerTable = (newValue.ctl.breakFlags) ?
-            thread->altHandlerTable : thread->mainHandlerTable;
+        /*
+         * Instruction counting by itself doesn't need dvmCheckBefore's
+         * other checks, so it gets a table that only counts.
+         */
+        if (newValue.ctl.breakFlags == kInterpSingleStep &&
+            (newValue.ctl.subMode & SINGLESTEP_BREAK_MASK) ==
+                kSubModeInstCounting) {
+            newValue.ctl.curHandlerTable = dvmAsmCountInstructionStart;
+        } else {
+            newValue.ctl.curHandlerTable = (newValue.ctl.breakFlags) ?
+                thread->altHandlerTable : thread->mainHandlerTable;
+        }
 #endif
     } while (dvmQuasiAtomicCas64(oldValue.all, newValue.all,
              &thread->interpBreak.all) != 0);
@@ -1672,6 +1700,9 @@ void dvmInitializeInterpBreak(Thread* thread)
         dvmEnableSubMode(thread, kSubModeEmulatorTrace);
     }
     if (gDvm.debuggerActive) {
+        dvmEnableSubMode(thread, kSubModeDebuggerAttached);
+    }
+    if (gDvm.debuggerInstrumented) {
         dvmEnableSubMode(thread, kSubModeDebuggerActive);
     }
 #if defined(WITH_JIT)
@@ -1683,6 +1714,29 @@ void dvmInitializeInterpBreak(Thread* thread)
 #endif
 }
 
+void dvmCountInstruction(const u2 *pc, Thread* self)
+{
+    /*
+     * Count up the #of executed instructions.  This isn't synchronized
+     * for thread-safety; if we need that we should make this
+     * thread-local and merge counts into the global area when threads
+     * exit (perhaps suspending all other threads GC-style and pulling
+     * the data out of them).
+     */
+    gDvm.executedInstrCounts[GET_OPCODE(*pc)]++;
+
+    /* pairs only count when the first one falls through */
+    if (gDvm.executedPairCounts != NULL) {
+        Opcode opcode = dexOpcodeFromCodeUnit(*pc);
+        if (pc == self->pairNextPc) {
+            gDvm.executedPairCounts[self->pairFirstOpcode *
+                kNumPackedOpcodes + opcode]++;
+        }
+        self->pairFirstOpcode = opcode;
+        self->pairNextPc = pc + dexGetWidthFromOpcode(opcode);
+    }
+}
+
 /*
  * Inter-instruction handler invoked in between instruction interpretations
  * to handle exceptional events such as debugging housekeeping, instruction
@@ -1760,14 +1814,7 @@ void dvmCheckBefore(const u2 *pc, u4 *fp, Thread* self)
         updateDebugger(method, pc, fp, self);
     }
     if (gDvm.instructionCountEnableCount != 0) {
-        /*
-         * Count up the #of executed instructions.  This isn't synchronized
-         * for thread-safety; if we need that we should make this
-         * thread-local and merge counts into the global area when threads
-         * exit (perhaps suspending all other threads GC-style and pulling
-         * the data out of them).
-         */
-        gDvm.executedInstrCounts[GET_OPCODE(*pc)]++;
+        dvmCountInstruction(pc, self);
     }
 
 
@@ -84,6 +84,13 @@ extern "C" void dvmReportPostNativeInvoke(const Method* methodToCall, Thread* se
 extern "C" void dvmReportInvoke(Thread* self, const Method* methodToCall);
 extern "C" void dvmReportReturn(Thread* self);
 
+/*
+ * Count the instruction at "dPC" for -Xopcodepairs and the instruction
+ * counts.  The asm interpreters call this straight from a table of their
+ * own when nothing but counting needs to see every instruction.
+ */
+extern "C" void dvmCountInstruction(const u2 *dPC, Thread* self);
+
 /*
  * InterpBreak & subMode control
  */
@@ -112,6 +119,7 @@ void dvmArmSafePointCallback(Thread* thread, SafePointCallback funct,
 #ifndef DVM_NO_ASM_INTERP
 extern void* dvmAsmInstructionStart[];
 extern void* dvmAsmAltInstructionStart[];
+extern void* dvmAsmCountInstructionStart[];
 #endif
 
 #endif  // DALVIK_INTERP_INTERP_H_
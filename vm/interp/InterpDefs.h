@@ -75,11 +75,41 @@ Method* dvmInterpFindInterfaceMethod(ClassObject* thisClass, u4 methodIdx,
     const Method* method, DvmDex* methodClassDex);
 
 /*
- * Determine if the debugger or profiler is currently active.
+ * Each thread keeps a direct-mapped cache of the last receiver class seen
+ * by the invoke-interface instructions it runs, indexed by the address of
+ * the instruction, so that a monomorphic call site doesn't need a trip
+ * through the AtomicCache.  Being per-thread, entries can be read and
+ * written without atomics.  The size must be a power of 2, and the entry
+ * layout must match the mterp handlers.
+ */
+#define INTERFACE_SITE_CACHE_SIZE   256
+#define INTERFACE_SITE_CACHE_INDEX(_pc) \
+    (((uintptr_t) (_pc) >> 1) & (INTERFACE_SITE_CACHE_SIZE - 1))
+
+struct InterfaceSiteCacheEntry {
+    Method*             method;     /* the method it resolved to */
+    const u2*           sitePc;     /* the invoke-interface */
+    const ClassObject*  clazz;      /* the class of "this" */
+    u4                  unused;     /* pad to a power of 2 */
+};
+
+/*
+ * Find the interface method called by the invoke-interface at "pc" for a
+ * receiver of class "thisClass", and remember it in the current thread's
+ * site cache.  The handlers check the cache before calling this.
+ *
+ * Returns NULL with an exception raised on failure.
+ */
+extern "C" Method* dvmInterpFindInterfaceMethodAtSite(ClassObject* thisClass,
+    const u2* pc, const Method* method, DvmDex* methodClassDex);
+
+/*
+ * Determine if the debugger or profiler is currently active.  An attached
+ * debugger with no breakpoints, steps or method events doesn't count.
  */
 static inline bool dvmDebuggerOrProfilerActive()
 {
-    return gDvm.debuggerActive || gDvm.activeProfilers != 0;
+    return gDvm.debuggerInstrumented || gDvm.activeProfilers != 0;
 }
 
 #if defined(WITH_JIT)
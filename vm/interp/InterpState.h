@@ -64,6 +64,7 @@ enum ExecutionSubModes {
     kSubModeCountedStep       = 0x0040,
     kSubModeCheckAlways       = 0x0080,
     kSubModeSampleTrace       = 0x0100,
+    kSubModeDebuggerAttached  = 0x0200,   /* report exceptions only */
     kSubModeJitTraceBuild     = 0x4000,
     kSubModeJitSV             = 0x8000,
     kSubModeDebugProfile   = (kSubModeMethodTrace |
@@ -25,14 +25,23 @@
 #include "libdex/DexOpcodes.h"
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <signal.h>
 #include "compiler/Compiler.h"
 #include "compiler/CompilerUtility.h"
 #include "compiler/CompilerIR.h"
+#include "compiler/TypeProfile.h"
 #include <errno.h>
 
 #if defined(WITH_SELF_VERIFICATION)
+/* Whether only some runs, or some threads' runs, are verified */
+static inline bool selfVerificationSampling()
+{
+    return gDvmJit.selfVerificationSample > 1 ||
+           gDvmJit.selfVerificationThreads > 1;
+}
+
 /* Allocate space for per-thread ShadowSpace data structures */
 void* dvmSelfVerificationShadowSpaceAlloc(Thread* self)
 {
@@ -122,9 +131,60 @@ void* dvmSelfVerificationSaveState(const u2* pc, u4* fp,
     // Reset trace length
     shadowSpace->traceLength = 0;
 
+    /*
+     * Pick the runs that get replayed.  The others still run on the shadow
+     * state, which dvmSelfVerificationRestoreState() then keeps.  Once any
+     * trace has diverged, every run is replayed.
+     */
+    shadowSpace->verifyRun = true;
+    if (selfVerificationSampling() &&
+        gDvmJit.selfVerificationDivergences == 0) {
+        if (self->threadId % gDvmJit.selfVerificationThreads != 0) {
+            shadowSpace->verifyRun = false;
+        } else if (--shadowSpace->sampleCountdown > 0) {
+            shadowSpace->verifyRun = false;
+        } else {
+            shadowSpace->sampleCountdown = gDvmJit.selfVerificationSample;
+        }
+    }
+
     return shadowSpace;
 }
 
+/*
+ * Keep the results of a run that wasn't picked for replay: copy the
+ * shadow frame and the shadowed heap stores out, and resume the
+ * interpreter where the translation left off.  Every heap entry holds a
+ * whole aligned word, written back as a whole.
+ */
+static void selfVerificationKeepRun(ShadowSpace* shadowSpace,
+                                    const u2* pc, Thread* self)
+{
+    const Method* method = shadowSpace->method;
+    unsigned preBytes = method->outsSize*4 + sizeof(StackSaveArea);
+    unsigned postBytes = method->registersSize*4;
+
+    memcpy(((char*)shadowSpace->fp)-preBytes,
+        ((char*)shadowSpace->shadowFP)-preBytes, preBytes+postBytes);
+
+    ShadowHeap* heapSpacePtr;
+    for (heapSpacePtr = shadowSpace->heapSpace;
+         heapSpacePtr != shadowSpace->heapSpaceTail; heapSpacePtr++) {
+        *((unsigned int*) heapSpacePtr->addr) = heapSpacePtr->data;
+    }
+
+    shadowSpace->selfVerificationState = kSVSIdle;
+
+    /* The translation's retval stays */
+    self->interpSave.pc = pc;
+    self->interpSave.curFrame = shadowSpace->fp;
+    self->interpSave.method = shadowSpace->method;
+    self->interpSave.methodClassDex = shadowSpace->methodClassDex;
+    self->interpStackEnd = shadowSpace->interpStackEnd;
+
+    android_atomic_inc(&gDvmJit.selfVerificationKept);
+}
+
 /*
  * Save ending PC, FP and compiled code exit point to shadow space.
  * Return a pointer to the shadow space for JIT to restore state.
@@ -160,6 +220,19 @@ void* dvmSelfVerificationRestoreState(const u2* pc, u4* fp,
         shadowSpace->selfVerificationState = exitState;
     }
 
+    /*
+     * Runs that end in another frame or in a single-stepped instruction
+     * are replayed even when they weren't picked.
+     */
+    if (shadowSpace->selfVerificationState != kSVSIdle) {
+        if (!shadowSpace->verifyRun && exitState != kSVSSingleStep &&
+            fp == shadowSpace->shadowFP) {
+            selfVerificationKeepRun(shadowSpace, pc, self);
+            return shadowSpace;
+        }
+        android_atomic_inc(&gDvmJit.selfVerificationChecked);
+    }
+
     /* Restore state before returning */
     self->interpSave.pc = shadowSpace->startPC;
     self->interpSave.curFrame = shadowSpace->fp;
@@ -233,18 +306,33 @@ static void selfVerificationDumpTrace(const u2* pc, Thread* self)
     }
 }
 
-/* Code is forced into this spin loop when a divergence is detected */
+/*
+ * Code is forced into this spin loop when a divergence is detected.
+ * When only a sample of the runs is verified, the divergence is reported
+ * and the VM carries on from the replayed state, which is the right one.
+ */
 static void selfVerificationSpinLoop(ShadowSpace *shadowSpace)
 {
     const u2 *startPC = shadowSpace->startPC;
     JitTraceDescription* desc = dvmCopyTraceDescriptor(startPC, NULL);
     if (desc) {
-        dvmCompilerWorkEnqueue(startPC, kWorkOrderTraceDebug, desc);
+        if (!dvmCompilerWorkEnqueue(startPC, kWorkOrderTraceDebug, desc) &&
+            selfVerificationSampling()) {
+            free(desc);
+        }
         /*
-         * This function effectively terminates the VM right here, so not
-         * freeing the desc pointer when the enqueuing fails is acceptable.
+         * Otherwise this function effectively terminates the VM right here,
+         * so not freeing the desc pointer when the enqueuing fails is
+         * acceptable.
          */
     }
+    if (selfVerificationSampling()) {
+        android_atomic_inc(&gDvmJit.selfVerificationDivergences);
+        ALOGE("Jit: self verification divergence in trace at %#x (%s.%s)",
+            (int)startPC, shadowSpace->method->clazz->descriptor,
+            shadowSpace->method->name);
+        return;
+    }
     gDvmJit.selfVerificationSpin = true;
     while(gDvmJit.selfVerificationSpin) sleep(10);
 }
@@ -415,6 +503,10 @@ log_and_continue:
         selfVerificationDumpState(pc, self);
         selfVerificationDumpTrace(pc, self);
         selfVerificationSpinLoop(shadowSpace);
+        /* Only reached when sampling: leave replay mode */
+        shadowSpace->selfVerificationState = kSVSIdle;
+        dvmDisableSubMode(self, kSubModeJitSV);
+        self->jitState = kJitDone;
         return;
     }
     /* Log the instruction address and decoded instruction for debug */
@@ -471,10 +563,10 @@ void dvmJitStats()
     int i;
     int hit;
     int not_hit;
-    int chains;
+    int displaced;
     int stubs;
     if (gDvmJit.pJitEntryTable) {
-        for (i=0, stubs=chains=hit=not_hit=0;
+        for (i=0, stubs=displaced=hit=not_hit=0;
              i < (int) gDvmJit.jitTableSize;
              i++) {
             if (gDvmJit.pJitEntryTable[i].dPC != 0) {
@@ -482,17 +574,23 @@ void dvmJitStats()
                 if (gDvmJit.pJitEntryTable[i].codeAddress ==
                       dvmCompilerGetInterpretTemplate())
                     stubs++;
+                if (dvmJitHash(gDvmJit.pJitEntryTable[i].dPC) != (u4) i)
+                    displaced++;
             } else
                 not_hit++;
-            if (gDvmJit.pJitEntryTable[i].u.info.chain != gDvmJit.jitTableSize)
-                chains++;
         }
         ALOGD("JIT: table size is %d, entries used is %d",
              gDvmJit.jitTableSize,  gDvmJit.jitTableEntriesUsed);
-        ALOGD("JIT: %d traces, %d slots, %d chains, %d thresh, %s",
-             hit, not_hit + hit, chains, gDvmJit.threshold,
+        ALOGD("JIT: %d traces, %d slots, %d displaced, %d thresh, %s",
+             hit, not_hit + hit, displaced, gDvmJit.threshold,
              gDvmJit.blockingMode ? "Blocking" : "Non-blocking");
 
+#if defined(WITH_SELF_VERIFICATION)
+        ALOGD("JIT: Self verification: %d checked, %d kept, %d divergences",
+             gDvmJit.selfVerificationChecked, gDvmJit.selfVerificationKept,
+             gDvmJit.selfVerificationDivergences);
+#endif
+
 #if defined(WITH_JIT_TUNING)
         ALOGD("JIT: Code cache patches: %d", gDvmJit.codeCachePatches);
 
@@ -509,10 +607,10 @@ void dvmJitStats()
              gDvmJit.noChainExit[kSwitchOverflow]);
 
         ALOGD("JIT: ICPatch: %d init, %d rejected, %d lock-free, %d queued, "
-             "%d dropped",
+             "%d dropped, %d batches unsuspended",
              gDvmJit.icPatchInit, gDvmJit.icPatchRejected,
              gDvmJit.icPatchLockFree, gDvmJit.icPatchQueued,
-             gDvmJit.icPatchDropped);
+             gDvmJit.icPatchDropped, gDvmJit.icPatchUnsuspended);
 
         ALOGD("JIT: Invoke: %d mono, %d poly, %d native, %d return",
              gDvmJit.invokeMonomorphic, gDvmJit.invokePolymorphic,
@@ -520,6 +618,8 @@ void dvmJitStats()
         ALOGD("JIT: Inline: %d mgetter, %d msetter, %d pgetter, %d psetter",
              gDvmJit.invokeMonoGetterInlined, gDvmJit.invokeMonoSetterInlined,
              gDvmJit.invokePolyGetterInlined, gDvmJit.invokePolySetterInlined);
+        ALOGD("JIT: Inline: %d mleaf, %d pleaf",
+             gDvmJit.invokeMonoLeafInlined, gDvmJit.invokePolyLeafInlined);
         ALOGD("JIT: Total compilation time: %llu ms", gDvmJit.jitTime / 1000);
         ALOGD("JIT: Avg unit compilation time: %llu us",
              gDvmJit.numCompilations == 0 ? 0 :
@@ -541,6 +641,50 @@ void dvmJitStats()
     }
 }
 
+/*
+ * Print the main JIT and compiler counters to "target".  Unlike
+ * dvmJitStats() this reads no tables, so it takes no locks.
+ */
+void dvmJitPrintStats(const DebugOutputTarget* target)
+{
+    dvmPrintDebugMessage(target,
+        "JIT: table %d/%d entries, %d compilations, %d chains\n",
+        gDvmJit.jitTableEntriesUsed, gDvmJit.jitTableSize,
+        gDvmJit.numCompilations, gDvmJit.translationChains);
+    dvmPrintDebugMessage(target,
+        "JIT: code cache %d/%d bytes%s, %d evictions (%d translations), "
+        "%d resets\n",
+        gDvmJit.codeCacheByteUsed, gDvmJit.codeCacheSize,
+        gDvmJit.codeCacheFull ? " (full)" : "",
+        gDvmJit.numCodeCacheEvictions, gDvmJit.numTranslationsEvicted,
+        gDvmJit.numCodeCacheReset);
+    dvmPrintDebugMessage(target,
+        "JIT: code cache %llu writes, %llu flushes, %llu mprotects\n",
+        gDvmJit.numCodeCacheWrites, gDvmJit.numCodeCacheFlushes,
+        gDvmJit.numCodeCacheMprotects);
+    if (gDvmJit.implicitNullChecks) {
+        dvmPrintDebugMessage(target,
+            "JIT: %d implicit null checks, %d faults\n",
+            gDvmJit.numNullFaultSites, gDvmJit.numNullFaults);
+    }
+    dvmPrintDebugMessage(target,
+        "JIT: %d card marks elided%s\n", gDvmJit.numCardMarksElided,
+        gDvmJit.verifyCardElision ? " (verified)" : "");
+    dvmPrintDebugMessage(target,
+        "JIT: queue %d (max %d), %d baseline, %d recompiled\n",
+        gDvmJit.compilerQueueLength, gDvmJit.compilerMaxQueued,
+        gDvmJit.numBaselineTraces, gDvmJit.numTracesRecompiled);
+    if (gDvmJit.compilerOrdersDone != 0) {
+        dvmPrintDebugMessage(target,
+            "JIT: %d orders on %d threads: queued %llu/%llu us, "
+            "compiled %llu/%llu us (avg/max)\n",
+            gDvmJit.compilerOrdersDone, gDvmJit.numCompilerThreads,
+            gDvmJit.compilerQueueTime / gDvmJit.compilerOrdersDone,
+            gDvmJit.compilerMaxQueueTime,
+            gDvmJit.compilerWorkTime / gDvmJit.compilerOrdersDone,
+            gDvmJit.compilerMaxWorkTime);
+    }
+}
 
 /* End current trace now & don't include current instruction */
 void dvmJitEndTraceSelect(Thread* self, const u2* dPC)
@@ -557,104 +701,51 @@ void dvmJitEndTraceSelect(Thread* self, const u2* dPC)
 /*
  * Find an entry in the JitTable, creating if necessary.
  * Returns null if table is full.
+ *
+ * The table is open addressed with linear probing and entries are never
+ * removed, so a lookup can stop at the first slot without a dPC.  A slot
+ * is claimed by setting inUse in its info word with a CAS, after which
+ * the claimer publishes the dPC.  Threads that find a claimed slot wait
+ * for the dPC before moving on, so no entry is ever placed past a slot
+ * that lookups would see as empty.
  */
-static JitEntry *lookupAndAdd(const u2* dPC, bool callerLocked,
-                              bool isMethodEntry)
+static JitEntry *lookupAndAdd(const u2* dPC, bool isMethodEntry)
 {
-    u4 chainEndMarker = gDvmJit.jitTableSize;
+    JitEntry *table = gDvmJit.pJitEntryTable;
+    u4 mask = gDvmJit.jitTableMask;
     u4 idx = dvmJitHash(dPC);
 
-    /*
-     * Walk the bucket chain to find an exact match for our PC and trace/method
-     * type
-     */
-    while ((gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) &&
-           ((gDvmJit.pJitEntryTable[idx].dPC != dPC) ||
-            (gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry !=
-             isMethodEntry))) {
-        idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-    }
-
-    if (gDvmJit.pJitEntryTable[idx].dPC != dPC ||
-        gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry != isMethodEntry) {
-        /*
-         * No match.  Aquire jitTableLock and find the last
-         * slot in the chain. Possibly continue the chain walk in case
-         * some other thread allocated the slot we were looking
-         * at previuosly (perhaps even the dPC we're trying to enter).
-         */
-        if (!callerLocked)
-            dvmLockMutex(&gDvmJit.tableLock);
-        /*
-         * At this point, if .dPC is NULL, then the slot we're
-         * looking at is the target slot from the primary hash
-         * (the simple, and common case).  Otherwise we're going
-         * to have to find a free slot and chain it.
-         */
-        ANDROID_MEMBAR_FULL(); /* Make sure we reload [].dPC after lock */
-        if (gDvmJit.pJitEntryTable[idx].dPC != NULL) {
-            u4 prev;
-            while (gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) {
-                if (gDvmJit.pJitEntryTable[idx].dPC == dPC &&
-                    gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry ==
-                        isMethodEntry) {
-                    /* Another thread got there first for this dPC */
-                    if (!callerLocked)
-                        dvmUnlockMutex(&gDvmJit.tableLock);
-                    return &gDvmJit.pJitEntryTable[idx];
-                }
-                idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-            }
-            /* Here, idx should be pointing to the last cell of an
-             * active chain whose last member contains a valid dPC */
-            assert(gDvmJit.pJitEntryTable[idx].dPC != NULL);
-            /* Linear walk to find a free cell and add it to the end */
-            prev = idx;
-            while (true) {
-                idx++;
-                if (idx == chainEndMarker)
-                    idx = 0;  /* Wraparound */
-                if ((gDvmJit.pJitEntryTable[idx].dPC == NULL) ||
-                    (idx == prev))
-                    break;
-            }
-            if (idx != prev) {
-                JitEntryInfoUnion oldValue;
-                JitEntryInfoUnion newValue;
-                /*
-                 * Although we hold the lock so that noone else will
-                 * be trying to update a chain field, the other fields
-                 * packed into the word may be in use by other threads.
-                 */
-                do {
-                    oldValue = gDvmJit.pJitEntryTable[prev].u;
-                    newValue = oldValue;
-                    newValue.info.chain = idx;
-                } while (android_atomic_release_cas(oldValue.infoWord,
-                        newValue.infoWord,
-                        &gDvmJit.pJitEntryTable[prev].u.infoWord) != 0);
+    for (u4 probes = 0; probes <= mask; probes++, idx = (idx + 1) & mask) {
+        JitEntry *entry = &table[idx];
+        JitEntryInfoUnion oldValue = entry->u;
+        if (!oldValue.info.inUse) {
+            JitEntryInfoUnion newValue = oldValue;
+            newValue.info.inUse = true;
+            newValue.info.isMethodEntry = isMethodEntry;
+            if (android_atomic_acquire_cas(oldValue.infoWord,
+                    newValue.infoWord, &entry->u.infoWord) == 0) {
+                /* Must be set before the dPC makes the entry live */
+                entry->codeAddress = NULL;
+                android_atomic_release_store((int32_t)dPC,
+                     (volatile int32_t *)(void *)&entry->dPC);
+                android_atomic_inc(
+                     (volatile int32_t *)&gDvmJit.jitTableEntriesUsed);
+                return entry;
             }
         }
-        if (gDvmJit.pJitEntryTable[idx].dPC == NULL) {
-            gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry = isMethodEntry;
-            /*
-             * Initialize codeAddress and allocate the slot.  Must
-             * happen in this order (since dPC is set, the entry is live.
-             */
-            android_atomic_release_store((int32_t)dPC,
-                 (volatile int32_t *)(void *)&gDvmJit.pJitEntryTable[idx].dPC);
-            /* for simulator mode, we need to initialized codeAddress to null */
-            gDvmJit.pJitEntryTable[idx].codeAddress = NULL;
-            gDvmJit.pJitEntryTable[idx].dPC = dPC;
-            gDvmJit.jitTableEntriesUsed++;
-        } else {
-            /* Table is full */
-            idx = chainEndMarker;
+        /* Claimed, perhaps by a thread that hasn't set the dPC yet */
+        const u2* slotPC;
+        while ((slotPC = (const u2*) android_atomic_acquire_load(
+                    (volatile int32_t *)(void *)&entry->dPC)) == NULL) {
+            sched_yield();
+        }
+        if (slotPC == dPC && entry->u.info.isMethodEntry == isMethodEntry) {
+            /* Another thread got there first for this dPC */
+            return entry;
         }
-        if (!callerLocked)
-            dvmUnlockMutex(&gDvmJit.tableLock);
     }
-    return (idx == chainEndMarker) ? NULL : &gDvmJit.pJitEntryTable[idx];
+    /* Table is full */
+    return NULL;
 }
 
 /* Dump a trace description */
@@ -760,6 +851,39 @@ static void insertMoveResult(const u2 *lastPC, int len, int offset,
     self->currRunLen = dexGetWidthFromInstruction(moveResultPC);
 }
 
+/*
+ * Decide whether trace selection follows the invoke at lastPC into the
+ * callee that is now running at pc, and carries on in the caller once it
+ * returns.  Only small callees are followed, as they are the ones the
+ * compiler can inline; one that isn't inlined returns into the middle of
+ * the translation, as it does to a move-result.  Recursion and natives
+ * end the trace as before.
+ */
+static bool followInvoke(Thread* self, const u2* pc, const u2* lastPC,
+                         int len, const Method* calleeMethod)
+{
+    if (calleeMethod == NULL || dvmIsNativeMethod(calleeMethod) ||
+        calleeMethod == self->traceMethod)
+        return false;
+
+    /* The invoke may have thrown before the callee got going */
+    u4 calleeSize = dvmGetMethodInsnsSize(calleeMethod);
+    if (pc < calleeMethod->insns || pc >= calleeMethod->insns + calleeSize)
+        return false;
+
+    /* Room for the call site info, a run after the return and the end */
+    if (calleeSize > (u4) gDvmJit.followInvokeSize ||
+        self->currTraceRun + 6 >= MAX_JIT_RUN_LEN)
+        return false;
+
+    self->followReturnPC = lastPC + len;
+    self->followSteps = 0;
+    /* The invoke has to end its run, ahead of the call site info */
+    self->currRunHead = NULL;
+    self->currRunLen = 0;
+    return true;
+}
+
 /*
  * Adds to the current trace request one instruction at a time, just
  * before that instruction is interpreted.  This is the primary trace
@@ -796,6 +920,23 @@ void dvmCheckJit(const u2* pc, Thread* self)
         case kJitTSelect:
             /* First instruction - just remember the PC and exit */
             if (lastPC == NULL) break;
+            /*
+             * In a callee that followInvoke() took the trace into: skip its
+             * instructions until it returns.  Landing anywhere else in the
+             * trace's method means it threw, and a callee that runs too long
+             * isn't worth waiting for.
+             */
+            if (self->followReturnPC != NULL) {
+                if (pc == self->followReturnPC) {
+                    self->followReturnPC = NULL;
+                } else if ((pc >= self->traceMethod->insns &&
+                            pc < self->traceMethod->insns +
+                                 dvmGetMethodInsnsSize(self->traceMethod)) ||
+                           ++self->followSteps > JIT_FOLLOW_INVOKE_MAX_STEPS) {
+                    self->jitState = kJitTSelectEnd;
+                }
+                break;
+            }
             /* Grow the trace around the last PC if jitState is kJitTSelect */
             dexDecodeInstruction(lastPC, &decInsn);
 #if TRACE_OPCODE_FILTER
@@ -844,6 +985,21 @@ void dvmCheckJit(const u2* pc, Thread* self)
             self->totalTraceLen++;
             self->currRunLen += len;
 
+            /*
+             * Note the class of the object a type check was given, unless
+             * it threw or instance-of overwrote its operand.
+             */
+            if ((decInsn.opcode == OP_CHECK_CAST ||
+                 (decInsn.opcode == OP_INSTANCE_OF &&
+                  decInsn.vA != decInsn.vB)) && pc == lastPC + len) {
+                u4 reg = (decInsn.opcode == OP_CHECK_CAST) ?
+                         decInsn.vA : decInsn.vB;
+                Object *obj = (Object *) self->interpSave.curFrame[reg];
+                if (obj != NULL) {
+                    dvmJitTypeProfileRecord(lastPC, obj->clazz);
+                }
+            }
+
             /*
              * If the last instruction is an invoke, we will try to sneak in
              * the move-result* (if existent) into a separate trace run.
@@ -876,6 +1032,13 @@ void dvmCheckJit(const u2* pc, Thread* self)
                  * it to the trace too.
                  */
                 if (flags & kInstrInvoke) {
+                    if (self->totalTraceLen < JIT_MAX_TRACE_LEN &&
+                        followInvoke(self, pc, lastPC, len, curMethod)) {
+                        self->jitState = kJitTSelect;
+                        insertClassMethodInfo(self, thisClass, curMethod,
+                                              &decInsn);
+                        break;
+                    }
                     insertClassMethodInfo(self, thisClass, curMethod,
                                           &decInsn);
                     insertMoveResult(lastPC, len, offset, self);
@@ -911,7 +1074,8 @@ void dvmCheckJit(const u2* pc, Thread* self)
                     dvmJitSetCodeAddr(self->currTraceHead,
                                       dvmCompilerGetInterpretTemplate(),
                                       dvmCompilerGetInterpretTemplateSet(),
-                                      false /* Not method entry */, 0);
+                                      false /* Not method entry */, 0,
+                                      false /* Not baseline */);
                     self->jitState = kJitDone;
                     allDone = true;
                     break;
@@ -1000,65 +1164,68 @@ void dvmCheckJit(const u2* pc, Thread* self)
 
 JitEntry *dvmJitFindEntry(const u2* pc, bool isMethodEntry)
 {
-    int idx = dvmJitHash(pc);
+    u4 mask = gDvmJit.jitTableMask;
+    u4 idx = dvmJitHash(pc);
 
     /* Expect a high hit rate on 1st shot */
-    if ((gDvmJit.pJitEntryTable[idx].dPC == pc) &&
-        (gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry == isMethodEntry))
-        return &gDvmJit.pJitEntryTable[idx];
-    else {
-        int chainEndMarker = gDvmJit.jitTableSize;
-        while (gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) {
-            idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-            if ((gDvmJit.pJitEntryTable[idx].dPC == pc) &&
-                (gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry ==
-                isMethodEntry))
-                return &gDvmJit.pJitEntryTable[idx];
+    for (u4 probes = 0; probes <= mask; probes++, idx = (idx + 1) & mask) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[idx];
+        if (entry->dPC == NULL) {
+            break;
+        }
+        if (entry->dPC == pc && entry->u.info.isMethodEntry == isMethodEntry) {
+            return entry;
         }
     }
     return NULL;
 }
 
+/*
+ * Note that a translation has run, so that the code cache keeps it over
+ * the colder ones when it has to evict some.  The flag is only cleared at
+ * safe points, so testing it first keeps the atomic update off the common
+ * path.  Translations entered through a chaining cell don't come here,
+ * but their predecessors usually do.
+ */
+static inline void markRecentlyUsed(JitEntry *entry)
+{
+    if (!entry->u.info.recentlyUsed) {
+        JitEntryInfoUnion mask;
+        mask.infoWord = 0;
+        mask.info.recentlyUsed = 1;
+        android_atomic_or(mask.infoWord, &entry->u.infoWord);
+    }
+}
+
 /*
  * Walk through the JIT profile table and find the corresponding JIT code, in
  * the specified format (ie trace vs method). This routine needs to be fast.
  */
 void* getCodeAddrCommon(const u2* dPC, bool methodEntry)
 {
-    int idx = dvmJitHash(dPC);
-    const u2* pc = gDvmJit.pJitEntryTable[idx].dPC;
-    if (pc != NULL) {
-        bool hideTranslation = dvmJitHideTranslation();
-        if (pc == dPC &&
-            gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry == methodEntry) {
-            int offset = (gDvmJit.profileMode >= kTraceProfilingContinuous) ?
-                 0 : gDvmJit.pJitEntryTable[idx].u.info.profileOffset;
-            intptr_t codeAddress =
-                (intptr_t)gDvmJit.pJitEntryTable[idx].codeAddress;
+    u4 mask = gDvmJit.jitTableMask;
+    u4 idx = dvmJitHash(dPC);
+
+    for (u4 probes = 0; probes <= mask; probes++, idx = (idx + 1) & mask) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[idx];
+        const u2* pc = entry->dPC;
+        if (pc == NULL) {
+            break;
+        }
+        if (pc == dPC && entry->u.info.isMethodEntry == methodEntry) {
+            /* Baseline translations are entered through their counter */
+            int offset = (gDvmJit.profileMode >= kTraceProfilingContinuous ||
+                          entry->u.info.baseline) ?
+                 0 : entry->u.info.profileOffset;
+            intptr_t codeAddress = (intptr_t)entry->codeAddress;
 #if defined(WITH_JIT_TUNING)
             gDvmJit.addrLookupsFound++;
 #endif
-            return hideTranslation || !codeAddress ?  NULL :
-                  (void *)(codeAddress + offset);
-        } else {
-            int chainEndMarker = gDvmJit.jitTableSize;
-            while (gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) {
-                idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-                if (gDvmJit.pJitEntryTable[idx].dPC == dPC &&
-                    gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry ==
-                        methodEntry) {
-                    int offset = (gDvmJit.profileMode >=
-                        kTraceProfilingContinuous) ? 0 :
-                        gDvmJit.pJitEntryTable[idx].u.info.profileOffset;
-                    intptr_t codeAddress =
-                        (intptr_t)gDvmJit.pJitEntryTable[idx].codeAddress;
-#if defined(WITH_JIT_TUNING)
-                    gDvmJit.addrLookupsFound++;
-#endif
-                    return hideTranslation || !codeAddress ? NULL :
-                        (void *)(codeAddress + offset);
-                }
+            if (dvmJitHideTranslation() || !codeAddress) {
+                return NULL;
             }
+            markRecentlyUsed(entry);
+            return (void *)(codeAddress + offset);
         }
     }
 #if defined(WITH_JIT_TUNING)
@@ -1119,7 +1286,8 @@ void* dvmJitGetMethodAddrThread(const u2* dPC, Thread* self)
  * code is executing. see Issue 4271784 for details.
  */
 void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
-                       bool isMethodEntry, int profilePrefixSize)
+                       bool isMethodEntry, int profilePrefixSize,
+                       bool isBaseline)
 {
     JitEntryInfoUnion oldValue;
     JitEntryInfoUnion newValue;
@@ -1129,7 +1297,7 @@ void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
      * now.
      */
     JitEntry *jitEntry = isMethodEntry ?
-        lookupAndAdd(dPC, false /* caller holds tableLock */, isMethodEntry) :
+        lookupAndAdd(dPC, isMethodEntry) :
                      dvmJitFindEntry(dPC, isMethodEntry);
     assert(jitEntry);
     /* Note: order of update is important */
@@ -1139,10 +1307,54 @@ void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
         newValue.info.isMethodEntry = isMethodEntry;
         newValue.info.instructionSet = set;
         newValue.info.profileOffset = profilePrefixSize;
+        newValue.info.evicted = false;
+        newValue.info.baseline = isBaseline;
     } while (android_atomic_release_cas(
              oldValue.infoWord, newValue.infoWord,
              &jitEntry->u.infoWord) != 0);
     jitEntry->codeAddress = nPC;
+
+    /*
+     * A frame that is still looping at this trace head would otherwise
+     * count down a full threshold before looking the translation up.
+     * Leave its counter one short of expiring so that the next back-edge
+     * enters the compiled loop with the live Dalvik registers in place.
+     * A counter shared with another PC just triggers an early lookup.
+     */
+    unsigned char *pProfTable = gDvmJit.pProfTable;
+    if (!isMethodEntry && pProfTable != NULL &&
+        nPC != dvmCompilerGetInterpretTemplate()) {
+        pProfTable[dvmJitProfHash(dPC)] = 1;
+    }
+}
+
+/*
+ * Request the translation of a trace that hasn't been selected in this
+ * run, such as one recorded by an earlier run.  Returns false if the
+ * JIT can't take it right now, in which case the caller keeps the
+ * description; otherwise the description is used or freed.
+ */
+bool dvmJitRequestTrace(const u2* pc, JitTraceDescription* desc)
+{
+    /* Leave room in the queue for the traces that are hot right now */
+    if (gDvmJit.pProfTable == NULL ||
+        gDvmJit.compilerQueueLength >= gDvmJit.compilerHighWater / 2) {
+        return false;
+    }
+    /* Already translated or in progress */
+    JitEntry *entry = dvmJitFindEntry(pc, false);
+    if (entry != NULL && !entry->u.info.evicted) {
+        free(desc);
+        return true;
+    }
+    if (lookupAndAdd(pc, false /* method entry */) == NULL) {
+        /* Table is full - let the compiler thread resize it first */
+        return false;
+    }
+    if (!dvmCompilerWorkEnqueue(pc, kWorkOrderTrace, desc)) {
+        free(desc);
+    }
+    return true;
 }
 
 /*
@@ -1246,12 +1458,13 @@ void dvmJitCheckTraceRequest(Thread* self)
          */
         if (self->jitState == kJitTSelectRequest ||
             self->jitState == kJitTSelectRequestHot) {
-            if (dvmJitFindEntry(self->interpSave.pc, false)) {
-                /* In progress - nothing do do */
+            JitEntry *entry = dvmJitFindEntry(self->interpSave.pc, false);
+            if (entry != NULL && !entry->u.info.evicted) {
+                /* In progress - move it up the queue if it is still there */
+               dvmCompilerBoostWorkOrder(self->interpSave.pc);
                self->jitState = kJitDone;
             } else {
                 JitEntry *slot = lookupAndAdd(self->interpSave.pc,
-                                              false /* lock */,
                                               false /* method entry */);
                 if (slot == NULL) {
                     /*
@@ -1284,6 +1497,7 @@ void dvmJitCheckTraceRequest(Thread* self)
                 self->trace[0].info.frag.hint = kJitHintNone;
                 self->trace[0].isCode = true;
                 self->lastPC = 0;
+                self->followReturnPC = NULL;
                 /* Turn on trace selection mode */
                 dvmEnableSubMode(self, kSubModeJitTraceBuild);
 #if defined(SHOW_TRACE)
@@ -1312,7 +1526,6 @@ bool dvmJitResizeJitTable( unsigned int size )
 {
     JitEntry *pNewTable;
     JitEntry *pOldTable;
-    JitEntry tempEntry;
     unsigned int oldSize;
     unsigned int i;
 
@@ -1325,9 +1538,7 @@ bool dvmJitResizeJitTable( unsigned int size )
         return true;
     }
 
-    /* Make sure requested size is compatible with chain field width */
-    tempEntry.u.info.chain = size;
-    if (tempEntry.u.info.chain != size) {
+    if (size > JIT_MAX_ENTRIES) {
         ALOGD("Jit: JitTable request of %d too big", size);
         return true;
     }
@@ -1336,9 +1547,6 @@ bool dvmJitResizeJitTable( unsigned int size )
     if (pNewTable == NULL) {
         return true;
     }
-    for (i=0; i< size; i++) {
-        pNewTable[i].u.info.chain = size;  /* Initialize chain termination */
-    }
 
     /* Stop all other interpreting/jit'ng threads */
     dvmSuspendAllThreads(SUSPEND_FOR_TBL_RESIZE);
@@ -1355,14 +1563,10 @@ bool dvmJitResizeJitTable( unsigned int size )
     for (i=0; i < oldSize; i++) {
         if (pOldTable[i].dPC) {
             JitEntry *p;
-            u2 chain;
-            p = lookupAndAdd(pOldTable[i].dPC, true /* holds tableLock*/,
+            p = lookupAndAdd(pOldTable[i].dPC,
                              pOldTable[i].u.info.isMethodEntry);
             p->codeAddress = pOldTable[i].codeAddress;
-            /* We need to preserve the new chain field, but copy the rest */
-            chain = p->u.info.chain;
             p->u = pOldTable[i].u;
-            p->u.info.chain = chain;
         }
     }
 
@@ -1398,9 +1602,6 @@ void dvmJitResetTable()
     }
 
     memset((void *) jitEntry, 0, sizeof(JitEntry) * size);
-    for (i=0; i< size; i++) {
-        jitEntry[i].u.info.chain = size;  /* Initialize chain termination */
-    }
     gDvmJit.jitTableEntriesUsed = 0;
     dvmUnlockMutex(&gDvmJit.tableLock);
 }
@@ -24,6 +24,13 @@
 
 #define JIT_MAX_TRACE_LEN 100
 
+/*
+ * Default size limit, in code units, of a callee that trace selection
+ * follows, and the most instructions it waits in a callee for the return.
+ */
+#define JIT_FOLLOW_INVOKE_SIZE      16
+#define JIT_FOLLOW_INVOKE_MAX_STEPS 64
+
 #if defined (WITH_SELF_VERIFICATION)
 
 #define REG_SPACE 256                /* default size of shadow space */
@@ -57,6 +64,8 @@ struct ShadowSpace {
     const void* endShadowFP;    /* ending fp in shadow space */
     InstructionTrace trace[JIT_MAX_TRACE_LEN]; /* opcode trace for debugging */
     int traceLength;            /* counter for current trace length */
+    int sampleCountdown;        /* trace runs until the next verified one */
+    bool verifyRun;             /* the current run gets replayed */
 };
 
 /*
@@ -96,13 +105,20 @@ static inline u4 dvmJitHash( const u2* p ) {
 }
 
 /*
- * The width of the chain field in JitEntryInfo sets the upper
- * bound on the number of translations.  Be careful if changing
- * the size of JitEntry struct - the Dalvik PC to JitEntry
- * hash functions have built-in knowledge of the size.
+ * Index of the interpreter's trace-head counter for a Dalvik PC.  Must
+ * match the hash in common_updateProfile.
+ */
+static inline u4 dvmJitProfHash( const u2* p ) {
+    return (((u4)p>>12)^(u4)p) & (JIT_PROF_SIZE - 1);
+}
+
+/*
+ * The JitTable is open addressed, so the upper bound on the number
+ * of translations is only there to keep its doubling in check.  Be
+ * careful if changing the size of JitEntry struct - the Dalvik PC to
+ * JitEntry hash functions have built-in knowledge of the size.
  */
-#define JIT_ENTRY_CHAIN_WIDTH 2
-#define JIT_MAX_ENTRIES (1 << (JIT_ENTRY_CHAIN_WIDTH * 8))
+#define JIT_MAX_ENTRIES (1 << 20)
 
 /*
  * The trace profiling counters are allocated in blocks and individual
@@ -130,8 +146,11 @@ struct JitEntryInfo {
     unsigned int           profileEnabled:1;
     JitInstructionSetType  instructionSet:3;
     unsigned int           profileOffset:5;
-    unsigned int           unused:5;
-    u2                     chain;                 /* Index of next in chain */
+    unsigned int           recentlyUsed:1;        /* Run since last eviction */
+    unsigned int           evicted:1;             /* May be selected again */
+    unsigned int           inUse:1;               /* Claimed for a dPC */
+    unsigned int           baseline:1;            /* Counts toward recompile */
+    unsigned int           unused:17;
 };
 
 union JitEntryInfoUnion {
@@ -159,15 +178,19 @@ void dvmBumpNormal(void);
 void dvmBumpPunt(int from);
 #endif
 void dvmJitStats(void);
+void dvmJitPrintStats(const DebugOutputTarget* target);
 bool dvmJitResizeJitTable(unsigned int size);
 void dvmJitResetTable(void);
 JitEntry *dvmJitFindEntry(const u2* pc, bool isMethodEntry);
 s8 dvmJitd2l(double d);
 s8 dvmJitf2l(float f);
 void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
-                       bool isMethodEntry, int profilePrefixSize);
+                       bool isMethodEntry, int profilePrefixSize,
+                       bool isBaseline);
+bool dvmJitRequestTrace(const u2* pc, JitTraceDescription* desc);
 void dvmJitEndTraceSelect(Thread* self, const u2* dPC);
 JitTraceCounter_t *dvmJitNextTraceCounter(void);
+JitTraceCounter_t dvmJitGetTraceCount(const JitEntry *entry);
 void dvmJitTraceProfilingOff(void);
 void dvmJitTraceProfilingOn(void);
 void dvmJitChangeProfileMode(TraceProfilingModes newState);
@@ -348,6 +348,21 @@ static bool dvmPopFrame(Thread* self)
     return true;
 }
 
+/*
+ * Push the frames for a call from native code, throwing if there isn't
+ * room.  callPrep() wraps this in the access check and logging that
+ * reflection wants; the calls the VM and JNI make use it directly.
+ */
+static inline bool pushCallFrame(Thread* self, const Method* method)
+{
+    if (dvmIsNativeMethod(method)) {
+        /* native code calling native code the hard way */
+        return dvmPushJNIFrame(self, method);
+    }
+    /* native code calling interpreted code */
+    return dvmPushInterpFrame(self, method);
+}
+
 /*
  * Common code for dvmCallMethodV/A and dvmInvokeMethod.
  *
@@ -398,18 +413,9 @@ static ClassObject* callPrep(Thread* self, const Method* method, Object* obj,
      *
      * This updates self->interpSave.curFrame.
      */
-    if (dvmIsNativeMethod(method)) {
-        /* native code calling native code the hard way */
-        if (!dvmPushJNIFrame(self, method)) {
-            assert(dvmCheckException(self));
-            return NULL;
-        }
-    } else {
-        /* native code calling interpreted code */
-        if (!dvmPushInterpFrame(self, method)) {
-            assert(dvmCheckException(self));
-            return NULL;
-        }
+    if (!pushCallFrame(self, method)) {
+        assert(dvmCheckException(self));
+        return NULL;
     }
 
     return clazz;
@@ -431,9 +437,125 @@ void dvmCallMethod(Thread* self, const Method* method, Object* obj,
     va_end(args);
 }
 
+/*
+ * Method.callArgInfo holds the number of arguments, not counting "this",
+ * in its low bits, followed by a CallArgKind for each, the first one
+ * lowest.  The top bit is set so that a method without arguments isn't
+ * taken for one whose arguments aren't known.
+ */
+enum CallArgKind {
+    kCallArgInt = 0,
+    kCallArgFloat,
+    kCallArgWide,               /* long or double */
+    kCallArgRef,                /* includes arrays */
+    kCallArgBoolean,
+    kCallArgByte,
+    kCallArgChar,
+    kCallArgShort,
+};
+
+#define CALL_ARG_KNOWN          0x80000000
+#define CALL_ARG_COUNT_MASK     0x0f
+#define CALL_ARG_KIND_SHIFT     4
+#define CALL_ARG_KIND_BITS      3
+#define CALL_ARG_KIND_MASK      0x07
+#define CALL_ARG_MAX            9
+
+/*
+ * Returns the CallArgKind of a shorty character, or -1 if it isn't an
+ * argument type.
+ */
+static int callArgKind(char type)
+{
+    switch (type) {
+    case 'I':               return kCallArgInt;
+    case 'F':               return kCallArgFloat;
+    case 'D': case 'J':     return kCallArgWide;
+    case 'L':               return kCallArgRef;
+    case 'Z':               return kCallArgBoolean;
+    case 'B':               return kCallArgByte;
+    case 'C':               return kCallArgChar;
+    case 'S':               return kCallArgShort;
+    default:                return -1;
+    }
+}
+
+u4 dvmComputeCallArgInfo(const char* shorty)
+{
+    const char* desc = &shorty[1];      // [0] is the return type.
+    size_t count = strlen(desc);
+
+    if (count > CALL_ARG_MAX)
+        return 0;
+
+    u4 info = CALL_ARG_KNOWN | count;
+    for (size_t i = 0; i < count; i++) {
+        int kind = callArgKind(desc[i]);
+        if (kind < 0)
+            return 0;               /* let the call complain */
+        info |= kind << (CALL_ARG_KIND_SHIFT + i * CALL_ARG_KIND_BITS);
+    }
+    return info;
+}
+
+/*
+ * Run the method whose frame pushCallFrame() pushed, and pop it.
+ */
+static void runCallFrame(Thread* self, const Method* method, JValue* pResult)
+{
+    if (dvmIsNativeMethod(method)) {
+        TRACE_METHOD_ENTER(self, method);
+        /*
+         * Because we leave no space for local variables, "curFrame" points
+         * directly at the method arguments.
+         */
+        (*method->nativeFunc)((u4*)self->interpSave.curFrame, pResult,
+                              method, self);
+        TRACE_METHOD_EXIT(self, method);
+    } else {
+        dvmInterpret(self, method, pResult);
+    }
+    dvmPopFrame(self);
+}
+
+/*
+ * Copy one argument of kind "kind" from "args" to "ins", and return the
+ * next "ins".
+ */
+static inline u4* copyVarArg(Thread* self, u4* ins, int kind, bool fromJni,
+    va_list* args)
+{
+    switch (kind) {
+    case kCallArgWide: {
+        u8 val = va_arg(*args, u8);
+        memcpy(ins, &val, 8);       // EABI prevents direct store
+        return ins + 2;
+    }
+    case kCallArgFloat: {
+        /* floats were normalized to doubles; convert back */
+        float f = (float) va_arg(*args, double);
+        *ins = dvmFloatToU4(f);
+        return ins + 1;
+    }
+    case kCallArgRef: {
+        jobject argObj = reinterpret_cast<jobject>(va_arg(*args, void*));
+        if (fromJni)
+            *ins = (u4) dvmDecodeIndirectRef(self, argObj);
+        else
+            *ins = (u4) argObj;
+        return ins + 1;
+    }
+    default:
+        /* Z B C S I -- all passed as 32-bit integers */
+        *ins = va_arg(*args, u4);
+        return ins + 1;
+    }
+}
+
 /*
  * Issue a method call with a variable number of arguments.  We process
- * the contents of "args" by scanning the method signature.
+ * the contents of "args" by the argument types cached in the method, or
+ * by scanning the method signature if it has too many.
  *
  * Pass in NULL for "obj" on calls to static methods.
  *
@@ -443,20 +565,19 @@ void dvmCallMethod(Thread* self, const Method* method, Object* obj,
 void dvmCallMethodV(Thread* self, const Method* method, Object* obj,
     bool fromJni, JValue* pResult, va_list args)
 {
-    const char* desc = &(method->shorty[1]); // [0] is the return type.
-    int verifyCount = 0;
-    ClassObject* clazz;
     u4* ins;
+    va_list ap;
 
-    clazz = callPrep(self, method, obj, false);
-    if (clazz == NULL)
+    assert(self != NULL && method != NULL);
+    if (!pushCallFrame(self, method)) {
+        assert(dvmCheckException(self));
         return;
+    }
 
     /* "ins" for new frame start at frame pointer plus locals */
-    ins = ((u4*)self->interpSave.curFrame) +
+    u4* firstIn = ((u4*)self->interpSave.curFrame) +
            (method->registersSize - method->insSize);
-
-    //ALOGD("  FP is %p, INs live at >= %p", self->interpSave.curFrame, ins);
+    ins = firstIn;
 
     /* put "this" pointer into in0 if appropriate */
     if (!dvmIsStaticMethod(method)) {
@@ -464,78 +585,77 @@ void dvmCallMethodV(Thread* self, const Method* method, Object* obj,
         assert(obj != NULL && dvmIsHeapAddress(obj));
 #endif
         *ins++ = (u4) obj;
-        verifyCount++;
     }
 
-    while (*desc != '\0') {
-        switch (*(desc++)) {
-            case 'D': case 'J': {
-                u8 val = va_arg(args, u8);
-                memcpy(ins, &val, 8);       // EABI prevents direct store
-                ins += 2;
-                verifyCount += 2;
-                break;
-            }
-            case 'F': {
-                /* floats were normalized to doubles; convert back */
-                float f = (float) va_arg(args, double);
-                *ins++ = dvmFloatToU4(f);
-                verifyCount++;
-                break;
-            }
-            case 'L': {     /* 'shorty' descr uses L for all refs, incl array */
-                void* arg = va_arg(args, void*);
-                assert(obj == NULL || dvmIsHeapAddress(obj));
-                jobject argObj = reinterpret_cast<jobject>(arg);
-                if (fromJni)
-                    *ins++ = (u4) dvmDecodeIndirectRef(self, argObj);
-                else
-                    *ins++ = (u4) argObj;
-                verifyCount++;
-                break;
-            }
-            default: {
-                /* Z B C S I -- all passed as 32-bit integers */
-                *ins++ = va_arg(args, u4);
-                verifyCount++;
-                break;
-            }
+    va_copy(ap, args);
+    u4 info = method->callArgInfo;
+    if (info != 0) {
+        u4 kinds = info >> CALL_ARG_KIND_SHIFT;
+        for (int n = info & CALL_ARG_COUNT_MASK; n > 0; n--) {
+            ins = copyVarArg(self, ins, kinds & CALL_ARG_KIND_MASK, fromJni,
+                             &ap);
+            kinds >>= CALL_ARG_KIND_BITS;
         }
+    } else {
+        const char* desc = &(method->shorty[1]); // [0] is the return type.
+        while (*desc != '\0')
+            ins = copyVarArg(self, ins, callArgKind(*desc++), fromJni, &ap);
     }
+    va_end(ap);
 
 #ifndef NDEBUG
-    if (verifyCount != method->insSize) {
-        ALOGE("Got vfycount=%d insSize=%d for %s.%s", verifyCount,
-            method->insSize, clazz->descriptor, method->name);
+    if (ins - firstIn != method->insSize) {
+        ALOGE("Got vfycount=%d insSize=%d for %s.%s",
+            (int) (ins - firstIn), method->insSize,
+            method->clazz->descriptor, method->name);
         assert(false);
-        goto bail;
+        dvmPopFrame(self);
+        return;
     }
 #endif
 
-    //dvmDumpThreadStack(dvmThreadSelf());
+    runCallFrame(self, method, pResult);
+}
 
-    if (dvmIsNativeMethod(method)) {
-        TRACE_METHOD_ENTER(self, method);
-        /*
-         * Because we leave no space for local variables, "curFrame" points
-         * directly at the method arguments.
-         */
-        (*method->nativeFunc)((u4*)self->interpSave.curFrame, pResult,
-                              method, self);
-        TRACE_METHOD_EXIT(self, method);
-    } else {
-        dvmInterpret(self, method, pResult);
+/*
+ * Copy one argument of kind "kind" from "arg" to "ins", and return the
+ * next "ins".
+ */
+static inline u4* copyJValueArg(Thread* self, u4* ins, int kind,
+    bool fromJni, const jvalue* arg)
+{
+    switch (kind) {
+    case kCallArgWide:                  /* 64-bit quantity; have to use */
+        memcpy(ins, &arg->j, 8);        /*  memcpy() in case of mis-alignment */
+        return ins + 2;
+    case kCallArgRef:
+        if (fromJni)
+            *ins = (u4) dvmDecodeIndirectRef(self, arg->l);
+        else
+            *ins = (u4) arg->l;
+        return ins + 1;
+    case kCallArgShort:
+        *ins = arg->s;                  /* 16 bits, sign-extended */
+        return ins + 1;
+    case kCallArgChar:
+        *ins = arg->c;                  /* 16 bits, unsigned */
+        return ins + 1;
+    case kCallArgByte:
+        *ins = arg->b;                  /* 8 bits, sign-extended */
+        return ins + 1;
+    case kCallArgBoolean:
+        *ins = arg->z;                  /* 8 bits, zero or non-zero */
+        return ins + 1;
+    default:
+        *ins = arg->i;                  /* F and I, full 32 bits */
+        return ins + 1;
     }
-
-#ifndef NDEBUG
-bail:
-#endif
-    dvmPopFrame(self);
 }
 
 /*
  * Issue a method call with arguments provided in an array.  We process
- * the contents of "args" by scanning the method signature.
+ * the contents of "args" by the argument types cached in the method, or
+ * by scanning the method signature if it has too many.
  *
  * The values were likely placed into an uninitialized jvalue array using
  * the field specifiers, which means that sub-32-bit fields (e.g. short,
@@ -549,91 +669,60 @@ bail:
 void dvmCallMethodA(Thread* self, const Method* method, Object* obj,
     bool fromJni, JValue* pResult, const jvalue* args)
 {
-    const char* desc = &(method->shorty[1]); // [0] is the return type.
-    int verifyCount = 0;
-    ClassObject* clazz;
     u4* ins;
 
-    clazz = callPrep(self, method, obj, false);
-    if (clazz == NULL)
+    assert(self != NULL && method != NULL);
+    if (!pushCallFrame(self, method)) {
+        assert(dvmCheckException(self));
         return;
+    }
 
     /* "ins" for new frame start at frame pointer plus locals */
-    ins = ((u4*)self->interpSave.curFrame) +
+    u4* firstIn = ((u4*)self->interpSave.curFrame) +
         (method->registersSize - method->insSize);
+    ins = firstIn;
 
     /* put "this" pointer into in0 if appropriate */
     if (!dvmIsStaticMethod(method)) {
         assert(obj != NULL);
         *ins++ = (u4) obj;              /* obj is a "real" ref */
-        verifyCount++;
     }
 
-    while (*desc != '\0') {
-        switch (*desc++) {
-        case 'D':                       /* 64-bit quantity; have to use */
-        case 'J':                       /*  memcpy() in case of mis-alignment */
-            memcpy(ins, &args->j, 8);
-            ins += 2;
-            verifyCount++;              /* this needs an extra push */
-            break;
-        case 'L':                       /* includes array refs */
-            if (fromJni)
-                *ins++ = (u4) dvmDecodeIndirectRef(self, args->l);
-            else
-                *ins++ = (u4) args->l;
-            break;
-        case 'F':
-        case 'I':
-            *ins++ = args->i;           /* full 32 bits */
-            break;
-        case 'S':
-            *ins++ = args->s;           /* 16 bits, sign-extended */
-            break;
-        case 'C':
-            *ins++ = args->c;           /* 16 bits, unsigned */
-            break;
-        case 'B':
-            *ins++ = args->b;           /* 8 bits, sign-extended */
-            break;
-        case 'Z':
-            *ins++ = args->z;           /* 8 bits, zero or non-zero */
-            break;
-        default:
-            ALOGE("Invalid char %c in short signature of %s.%s",
-                *(desc-1), clazz->descriptor, method->name);
-            assert(false);
-            goto bail;
+    u4 info = method->callArgInfo;
+    if (info != 0) {
+        u4 kinds = info >> CALL_ARG_KIND_SHIFT;
+        for (int n = info & CALL_ARG_COUNT_MASK; n > 0; n--) {
+            ins = copyJValueArg(self, ins, kinds & CALL_ARG_KIND_MASK,
+                                fromJni, args++);
+            kinds >>= CALL_ARG_KIND_BITS;
+        }
+    } else {
+        const char* desc = &(method->shorty[1]); // [0] is the return type.
+        while (*desc != '\0') {
+            int kind = callArgKind(*desc++);
+            if (kind < 0) {
+                ALOGE("Invalid char %c in short signature of %s.%s",
+                    *(desc-1), method->clazz->descriptor, method->name);
+                assert(false);
+                dvmPopFrame(self);
+                return;
+            }
+            ins = copyJValueArg(self, ins, kind, fromJni, args++);
         }
-
-        verifyCount++;
-        args++;
     }
 
 #ifndef NDEBUG
-    if (verifyCount != method->insSize) {
-        ALOGE("Got vfycount=%d insSize=%d for %s.%s", verifyCount,
-            method->insSize, clazz->descriptor, method->name);
+    if (ins - firstIn != method->insSize) {
+        ALOGE("Got vfycount=%d insSize=%d for %s.%s",
+            (int) (ins - firstIn), method->insSize,
+            method->clazz->descriptor, method->name);
         assert(false);
-        goto bail;
+        dvmPopFrame(self);
+        return;
     }
 #endif
 
-    if (dvmIsNativeMethod(method)) {
-        TRACE_METHOD_ENTER(self, method);
-        /*
-         * Because we leave no space for local variables, "curFrame" points
-         * directly at the method arguments.
-         */
-        (*method->nativeFunc)((u4*)self->interpSave.curFrame, pResult,
-                              method, self);
-        TRACE_METHOD_EXIT(self, method);
-    } else {
-        dvmInterpret(self, method, pResult);
-    }
-
-bail:
-    dvmPopFrame(self);
+    runCallFrame(self, method, pResult);
 }
 
 static void throwArgumentTypeMismatch(int argIndex, ClassObject* expected, DataObject* arg) {
@@ -776,30 +865,6 @@ bail:
     return retObj;
 }
 
-struct LineNumFromPcContext {
-    u4 address;
-    u4 lineNum;
-};
-
-static int lineNumForPcCb(void *cnxt, u4 address, u4 lineNum)
-{
-    LineNumFromPcContext *pContext = (LineNumFromPcContext *)cnxt;
-
-    // We know that this callback will be called in
-    // ascending address order, so keep going until we find
-    // a match or we've just gone past it.
-
-    if (address > pContext->address) {
-        // The line number from the previous positions callback
-        // wil be the final result.
-        return 1;
-    }
-
-    pContext->lineNum = lineNum;
-
-    return (address == pContext->address) ? 1 : 0;
-}
-
 /*
  * Determine the source file line number based on the program counter.
  * "pc" is an offset, in 16-bit units, from the start of the method's code.
@@ -818,19 +883,7 @@ int dvmLineNumFromPC(const Method* method, u4 relPc)
         return -1;      /* can happen for abstract method stub */
     }
 
-    LineNumFromPcContext context;
-    memset(&context, 0, sizeof(context));
-    context.address = relPc;
-    // A method with no line number info should return -1
-    context.lineNum = -1;
-
-    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile, pDexCode,
-            method->clazz->descriptor,
-            method->prototype.protoIdx,
-            method->accessFlags,
-            lineNumForPcCb, NULL, &context);
-
-    return context.lineNum;
+    return dvmLineTableLookup(method, relPc);
 }
 
 /*
@@ -871,36 +924,59 @@ int dvmComputeVagueFrameDepth(Thread* thread, const void* fp)
 /*
  * Get the calling frame.  Pass in the current fp.
  *
- * Skip "break" frames and reflection invoke frames.
+ * Skip "break" frames and reflection invoke frames.  A reflection frame
+ * can only sit directly above a break frame, so that's the only place
+ * we look for one, and each save area is read once.
  */
 void* dvmGetCallerFP(const void* curFrame)
 {
     void* caller = SAVEAREA_FROM_FP(curFrame)->prevFrame;
-    StackSaveArea* saveArea;
+    const StackSaveArea* saveArea = SAVEAREA_FROM_FP(caller);
 
-retry:
-    if (dvmIsBreakFrame((u4*)caller)) {
-        /* pop up one more */
-        caller = SAVEAREA_FROM_FP(caller)->prevFrame;
+    while (saveArea->method == NULL) {
+        /* break frame; pop up one more */
+        caller = saveArea->prevFrame;
         if (caller == NULL)
             return NULL;        /* hit the top */
+        saveArea = SAVEAREA_FROM_FP(caller);
 
         /*
          * If we got here by java.lang.reflect.Method.invoke(), we don't
          * want to return Method's class loader.  Shift up one and try
          * again.
          */
+        if (!dvmIsReflectionMethod(saveArea->method))
+            break;
+        caller = saveArea->prevFrame;
+        assert(caller != NULL);
         saveArea = SAVEAREA_FROM_FP(caller);
-        if (dvmIsReflectionMethod(saveArea->method)) {
-            caller = saveArea->prevFrame;
-            assert(caller != NULL);
-            goto retry;
-        }
     }
 
     return caller;
 }
 
+/*
+ * Get the class of the method "depth" callers above the caller of the
+ * current frame, skipping break and reflection frames.
+ */
+static ClassObject* getCallerClassAtDepth(const void* curFrame, int depth)
+{
+    void* caller = SAVEAREA_FROM_FP(curFrame)->prevFrame;
+
+    /* at the top? */
+    if (dvmIsBreakFrame((u4*)caller) &&
+        SAVEAREA_FROM_FP(caller)->prevFrame == NULL)
+        return NULL;
+
+    while (depth-- > 0) {
+        caller = dvmGetCallerFP(caller);
+        if (caller == NULL)
+            return NULL;
+    }
+
+    return SAVEAREA_FROM_FP(caller)->method->clazz;
+}
+
 /*
  * Get the caller's class.  Pass in the current fp.
  *
@@ -925,20 +1001,7 @@ ClassObject* dvmGetCallerClass(const void* curFrame)
  */
 ClassObject* dvmGetCaller2Class(const void* curFrame)
 {
-    void* caller = SAVEAREA_FROM_FP(curFrame)->prevFrame;
-    void* callerCaller;
-
-    /* at the top? */
-    if (dvmIsBreakFrame((u4*)caller) &&
-        SAVEAREA_FROM_FP(caller)->prevFrame == NULL)
-        return NULL;
-
-    /* go one more */
-    callerCaller = dvmGetCallerFP(caller);
-    if (callerCaller == NULL)
-        return NULL;
-
-    return SAVEAREA_FROM_FP(callerCaller)->method->clazz;
+    return getCallerClassAtDepth(curFrame, 1);
 }
 
 /*
@@ -949,22 +1012,7 @@ ClassObject* dvmGetCaller2Class(const void* curFrame)
  */
 ClassObject* dvmGetCaller3Class(const void* curFrame)
 {
-    void* caller = SAVEAREA_FROM_FP(curFrame)->prevFrame;
-    int i;
-
-    /* at the top? */
-    if (dvmIsBreakFrame((u4*)caller) &&
-        SAVEAREA_FROM_FP(caller)->prevFrame == NULL)
-        return NULL;
-
-    /* Walk up two frames if possible. */
-    for (i = 0; i < 2; i++) {
-        caller = dvmGetCallerFP(caller);
-        if (caller == NULL)
-            return NULL;
-    }
-
-    return SAVEAREA_FROM_FP(caller)->method->clazz;
+    return getCallerClassAtDepth(curFrame, 2);
 }
 
 /*
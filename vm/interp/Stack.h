@@ -203,6 +203,13 @@ void dvmCallMethodV(Thread* self, const Method* method, Object* obj,
 void dvmCallMethodA(Thread* self, const Method* method, Object* obj,
     bool fromJni, JValue* pResult, const jvalue* args);
 
+/*
+ * Encode the argument types in "shorty" for dvmCallMethodV/A, which
+ * find the result in Method.callArgInfo.  Returns 0 if the method takes
+ * too many arguments, in which case they parse the shorty on each call.
+ */
+u4 dvmComputeCallArgInfo(const char* shorty);
+
 /*
  * Invoke a method, using the specified arguments and return type, through
  * a reflection interface.
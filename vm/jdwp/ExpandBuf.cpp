@@ -34,6 +34,7 @@ struct ExpandBuf {
 };
 
 #define kInitialStorage 64
+#define kRetainStorage  (256 * 1024)    /* most expandBufReset() keeps */
 
 /*
  * Allocate a JdwpBuf and some initial storage.
@@ -50,6 +51,20 @@ ExpandBuf* expandBufAlloc()
     return newBuf;
 }
 
+/*
+ * Empty the buffer so it can be reused for another packet.  Storage is
+ * kept, unless an unusually large reply grew it past kRetainStorage.
+ */
+void expandBufReset(ExpandBuf* pBuf)
+{
+    pBuf->curLen = 0;
+    if (pBuf->maxLen > kRetainStorage) {
+        free(pBuf->storage);
+        pBuf->storage = (u1*) malloc(kInitialStorage);
+        pBuf->maxLen = kInitialStorage;
+    }
+}
+
 /*
  * Free a JdwpBuf and associated storage.
  */
@@ -102,6 +117,16 @@ static void ensureSpace(ExpandBuf* pBuf, int newCount)
     pBuf->storage = newPtr;
 }
 
+/*
+ * Make room for at least "count" more bytes in one step.  Handlers that
+ * know roughly how big their reply will be call this first, so a large
+ * reply isn't grown and copied a dozen times.
+ */
+void expandBufReserve(ExpandBuf* pBuf, int count)
+{
+    ensureSpace(pBuf, count);
+}
+
 /*
  * Allocate some space in the buffer.
  */
@@ -170,6 +195,7 @@ void expandBufAddUtf8String(ExpandBuf* pBuf, const u1* str)
     int strLen = strlen((const char*)str);
 
     ensureSpace(pBuf, sizeof(u4) + strLen);
-    setUtf8String(pBuf->storage + pBuf->curLen, str);
+    set4BE(pBuf->storage + pBuf->curLen, strLen);
+    memcpy(pBuf->storage + pBuf->curLen + sizeof(u4), str, strLen);
     pBuf->curLen += sizeof(u4) + strLen;
 }
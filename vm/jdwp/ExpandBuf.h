@@ -27,6 +27,10 @@ struct ExpandBuf;   /* private */
 ExpandBuf* expandBufAlloc(void);
 /* free storage */
 void expandBufFree(ExpandBuf* pBuf);
+/* discard the contents, keeping (most of) the storage */
+void expandBufReset(ExpandBuf* pBuf);
+/* grow now for "count" more bytes; purely a hint */
+void expandBufReserve(ExpandBuf* pBuf, int count);
 
 /*
  * Accessors.  The buffer pointer and length will only be valid until more
@@ -452,7 +452,11 @@ static bool handlePacket(JdwpState* state)
     dataLen = length - (buf - netState->inputBuffer);
 
     if (!reply) {
-        ExpandBuf* pReply = expandBufAlloc();
+        /* the JDWP thread reuses one reply buffer for every request */
+        if (state->replyBuf == NULL)
+            state->replyBuf = expandBufAlloc();
+        ExpandBuf* pReply = state->replyBuf;
+        expandBufReset(pReply);
 
         hdr.length = length;
         hdr.id = id;
@@ -464,13 +468,11 @@ static bool handlePacket(JdwpState* state)
 
             if (cc != (ssize_t) expandBufGetLength(pReply)) {
                 ALOGE("Failed sending reply to debugger: %s", strerror(errno));
-                expandBufFree(pReply);
                 return false;
             }
         } else {
             ALOGW("No reply created for set=%d cmd=%d", cmdSet, cmd);
         }
-        expandBufFree(pReply);
     } else {
         ALOGV("reply?!");
         assert(false);
@@ -176,6 +176,118 @@ static void dumpEvent(const JdwpEvent* pEvent)
     }
 }
 
+/*
+ * Returns "true" if the interpreter has to check every instruction for
+ * this event to fire: breakpoints, steps, method entry/exit, and anything
+ * else filtered by location (which is implemented as a breakpoint).
+ */
+static bool needsInstrumentation(const JdwpEvent* pEvent)
+{
+    switch (pEvent->eventKind) {
+    case EK_SINGLE_STEP:
+    case EK_BREAKPOINT:
+    case EK_METHOD_ENTRY:
+    case EK_METHOD_EXIT:
+        return true;
+    default:
+        break;
+    }
+    for (int i = 0; i < pEvent->modCount; i++) {
+        if (pEvent->mods[i].modKind == MK_LOCATION_ONLY)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Work out once how a ClassMatch or ClassExclude pattern compares, so
+ * matching doesn't have to re-scan it for every posted event.
+ */
+static void compilePattern(JdwpEventMod* pMod)
+{
+    const char* pattern = pMod->classMatch.classPattern;
+    int patLen = strlen(pattern);
+
+    if (patLen > 0 && pattern[0] == '*') {
+        pMod->classMatch.patternKind = kPatternSuffix;
+        pMod->classMatch.patternLen = patLen - 1;
+    } else if (patLen > 0 && pattern[patLen-1] == '*') {
+        pMod->classMatch.patternKind = kPatternPrefix;
+        pMod->classMatch.patternLen = patLen - 1;
+    } else {
+        pMod->classMatch.patternKind = kPatternExact;
+        pMod->classMatch.patternLen = patLen;
+    }
+}
+
+/*
+ * Pick the mod that decides where this event can fire: a LocationOnly,
+ * or a ClassMatch on an exact name.  Mods are applied in order and a
+ * Count is decremented by every event that reaches it, so an event
+ * whose Count comes first has to be offered everything and can't be
+ * indexed.
+ */
+static const JdwpEventMod* chooseKeyMod(const JdwpEvent* pEvent)
+{
+    for (int i = 0; i < pEvent->modCount; i++) {
+        const JdwpEventMod* pMod = &pEvent->mods[i];
+        if (pMod->modKind == MK_COUNT)
+            return NULL;
+        if (pMod->modKind == MK_LOCATION_ONLY)
+            return pMod;
+        if (pMod->modKind == MK_CLASS_MATCH &&
+            pMod->classMatch.patternKind == kPatternExact)
+        {
+            return pMod;
+        }
+    }
+    return NULL;
+}
+
+static inline u4 locationHash(JdwpEventKind eventKind,
+    const JdwpLocation* pLoc)
+{
+    u4 hash = pLoc->methodId;
+    hash = hash * 31 + (u4) pLoc->idx;
+    return hash * 31 + eventKind;
+}
+
+static inline u4 classNameHash(JdwpEventKind eventKind, const char* name)
+{
+    u4 hash = 1;
+    while (*name != '\0')
+        hash = hash * 31 + *name++;
+    return hash * 31 + eventKind;
+}
+
+/*
+ * Find the chain of events of kind "eventKind" that aren't indexed.
+ * Kinds we don't know share chain 0.
+ */
+static inline JdwpEvent** kindChain(JdwpState* state, JdwpEventKind eventKind)
+{
+    int kind = eventKind;
+    if (kind < 0 || kind > EK_VM_DISCONNECTED)
+        kind = 0;
+    return &state->eventsByKind[kind];
+}
+
+static JdwpEvent** eventChain(JdwpState* state, const JdwpEvent* pEvent)
+{
+    const JdwpEventMod* pMod = pEvent->keyMod;
+    u4 hash;
+
+    if (pMod == NULL) {
+        return kindChain(state, pEvent->eventKind);
+    } else if (pMod->modKind == MK_LOCATION_ONLY) {
+        hash = locationHash(pEvent->eventKind, &pMod->locationOnly.loc);
+    } else {
+        hash = classNameHash(pEvent->eventKind,
+            pMod->classMatch.classPattern);
+    }
+    return &state->eventIndex[hash & (kJdwpEventIndexSize - 1)];
+}
+
 /*
  * Add an event to the list.  Ordering is not important.
  *
@@ -185,6 +297,14 @@ static void dumpEvent(const JdwpEvent* pEvent)
  */
 JdwpError dvmJdwpRegisterEvent(JdwpState* state, JdwpEvent* pEvent)
 {
+    /*
+     * Turn on the interpreter checks before the breakpoint or step is
+     * set up, so no thread can run past it on the fast path.
+     */
+    bool instrumented = needsInstrumentation(pEvent);
+    if (instrumented)
+        dvmDbgSetInstrumented(true);
+
     lockEventMutex(state);
 
     assert(state != NULL);
@@ -197,7 +317,7 @@ JdwpError dvmJdwpRegisterEvent(JdwpState* state, JdwpEvent* pEvent)
      * the interpreter.
      */
     for (int i = 0; i < pEvent->modCount; i++) {
-        const JdwpEventMod* pMod = &pEvent->mods[i];
+        JdwpEventMod* pMod = &pEvent->mods[i];
         if (pMod->modKind == MK_LOCATION_ONLY) {
             /* should only be for Breakpoint, Step, and Exception */
             dvmDbgWatchLocation(&pMod->locationOnly.loc);
@@ -209,6 +329,10 @@ JdwpError dvmJdwpRegisterEvent(JdwpState* state, JdwpEvent* pEvent)
         } else if (pMod->modKind == MK_FIELD_ONLY) {
             /* should be for EK_FIELD_ACCESS or EK_FIELD_MODIFICATION */
             dumpEvent(pEvent);  /* TODO - need for field watches */
+        } else if (pMod->modKind == MK_CLASS_MATCH ||
+                   pMod->modKind == MK_CLASS_EXCLUDE)
+        {
+            compilePattern(pMod);
         }
     }
 
@@ -222,6 +346,15 @@ JdwpError dvmJdwpRegisterEvent(JdwpState* state, JdwpEvent* pEvent)
     state->eventList = pEvent;
     state->numEvents++;
 
+    pEvent->keyMod = chooseKeyMod(pEvent);
+    pEvent->chainHead = eventChain(state, pEvent);
+    pEvent->chainNext = *pEvent->chainHead;
+    if (pEvent->chainNext != NULL)
+        pEvent->chainNext->chainPrev = pEvent;
+    *pEvent->chainHead = pEvent;
+    if (instrumented)
+        state->numInstrumentedEvents++;
+
     unlockEventMutex(state);
 
     return ERR_NONE;
@@ -252,6 +385,17 @@ static void unregisterEvent(JdwpState* state, JdwpEvent* pEvent)
     }
     pEvent->prev = NULL;
 
+    if (pEvent->chainPrev == NULL) {
+        assert(*pEvent->chainHead == pEvent);
+        *pEvent->chainHead = pEvent->chainNext;
+    } else {
+        pEvent->chainPrev->chainNext = pEvent->chainNext;
+    }
+    if (pEvent->chainNext != NULL)
+        pEvent->chainNext->chainPrev = pEvent->chainPrev;
+    pEvent->chainPrev = pEvent->chainNext = NULL;
+    pEvent->chainHead = NULL;
+
     /*
      * Unhook us from the interpreter, if necessary.
      */
@@ -269,6 +413,24 @@ static void unregisterEvent(JdwpState* state, JdwpEvent* pEvent)
 
     state->numEvents--;
     assert(state->numEvents != 0 || state->eventList == NULL);
+    if (needsInstrumentation(pEvent))
+        state->numInstrumentedEvents--;
+}
+
+/*
+ * Drop the interpreter checks if the last event that needed them is gone.
+ *
+ * Events that expire as they're posted are removed on the posting thread;
+ * the checks stay on until the JDWP thread next unregisters something.
+ */
+static void updateInstrumentation(JdwpState* state)
+{
+    lockEventMutex(state);
+    bool idle = (state->numInstrumentedEvents == 0);
+    unlockEventMutex(state);
+
+    if (idle)
+        dvmDbgSetInstrumented(false);
 }
 
 /*
@@ -297,6 +459,7 @@ void dvmJdwpUnregisterEventById(JdwpState* state, u4 requestId)
 
 done:
     unlockEventMutex(state);
+    updateInstrumentation(state);
 }
 
 /*
@@ -318,6 +481,7 @@ void dvmJdwpUnregisterAll(JdwpState* state)
     state->eventList = NULL;
 
     unlockEventMutex(state);
+    updateInstrumentation(state);
 }
 
 
@@ -411,26 +575,25 @@ static void cleanupMatchList(JdwpState* state, JdwpEvent** matchList,
 /*
  * Match a string against a "restricted regular expression", which is just
  * a string that may start or end with '*' (e.g. "*.Foo" or "java.*").
+ * The pattern was sorted out by compilePattern() when it was registered.
  *
  * ("Restricted name globbing" might have been a better term.)
  */
-static bool patternMatch(const char* pattern, const char* target)
+static bool patternMatch(const JdwpEventMod* pMod, const char* target)
 {
-    int patLen = strlen(pattern);
+    const char* pattern = pMod->classMatch.classPattern;
+    int patLen = pMod->classMatch.patternLen;
 
-    if (pattern[0] == '*') {
+    switch (pMod->classMatch.patternKind) {
+    case kPatternSuffix: {
         int targetLen = strlen(target);
-        patLen--;
-        // TODO: remove printf when we find a test case to verify this
-        ALOGE(">>> comparing '%s' to '%s'",
-            pattern+1, target + (targetLen-patLen));
-
         if (targetLen < patLen)
             return false;
         return strcmp(pattern+1, target + (targetLen-patLen)) == 0;
-    } else if (pattern[patLen-1] == '*') {
-        return strncmp(pattern, target, patLen-1) == 0;
-    } else {
+    }
+    case kPatternPrefix:
+        return strncmp(pattern, target, patLen) == 0;
+    default:
         return strcmp(pattern, target) == 0;
     }
 }
@@ -480,13 +643,11 @@ static bool modsMatch(JdwpState* state, JdwpEvent* pEvent, ModBasket* basket)
                 return false;
             break;
         case MK_CLASS_MATCH:
-            if (!patternMatch(pMod->classMatch.classPattern,
-                    basket->className))
+            if (!patternMatch(pMod, basket->className))
                 return false;
             break;
         case MK_CLASS_EXCLUDE:
-            if (patternMatch(pMod->classMatch.classPattern,
-                    basket->className))
+            if (patternMatch(pMod, basket->className))
                 return false;
             break;
         case MK_LOCATION_ONLY:
@@ -525,10 +686,35 @@ static bool modsMatch(JdwpState* state, JdwpEvent* pEvent, ModBasket* basket)
     return true;
 }
 
+/*
+ * Offer the events of type "eventKind" on one chain to modsMatch().  If
+ * "keyKind" is nonzero, only events indexed by a mod of that kind are
+ * looked at; the rest just share the bucket.
+ */
+static void matchChain(JdwpState* state, JdwpEvent* pEvent,
+    JdwpEventKind eventKind, JdwpModKind keyKind, ModBasket* basket,
+    JdwpEvent*** pMatchList, int* pMatchCount)
+{
+    while (pEvent != NULL) {
+        if (pEvent->eventKind == eventKind &&
+            (keyKind == 0 || pEvent->keyMod->modKind == keyKind) &&
+            modsMatch(state, pEvent, basket))
+        {
+            *(*pMatchList)++ = pEvent;
+            (*pMatchCount)++;
+        }
+
+        pEvent = pEvent->chainNext;
+    }
+}
+
 /*
  * Find all events of type "eventKind" with mods that match up with the
  * rest of the arguments.
  *
+ * Only the unindexed events of that kind, and the index buckets for the
+ * basket's location and class name, are examined.
+ *
  * Found events are appended to "matchList", and "*pMatchCount" is advanced,
  * so this may be called multiple times for grouped events.
  *
@@ -541,15 +727,18 @@ static void findMatchingEvents(JdwpState* state, JdwpEventKind eventKind,
     /* start after the existing entries */
     matchList += *pMatchCount;
 
-    JdwpEvent* pEvent = state->eventList;
-    while (pEvent != NULL) {
-        if (pEvent->eventKind == eventKind && modsMatch(state, pEvent, basket))
-        {
-            *matchList++ = pEvent;
-            (*pMatchCount)++;
-        }
+    matchChain(state, *kindChain(state, eventKind), eventKind,
+        (JdwpModKind) 0, basket, &matchList, pMatchCount);
 
-        pEvent = pEvent->next;
+    if (basket->pLoc != NULL) {
+        u4 hash = locationHash(eventKind, basket->pLoc);
+        matchChain(state, state->eventIndex[hash & (kJdwpEventIndexSize - 1)],
+            eventKind, MK_LOCATION_ONLY, basket, &matchList, pMatchCount);
+    }
+    if (basket->className != NULL) {
+        u4 hash = classNameHash(eventKind, basket->className);
+        matchChain(state, state->eventIndex[hash & (kJdwpEventIndexSize - 1)],
+            eventKind, MK_CLASS_MATCH, basket, &matchList, pMatchCount);
     }
 }
 
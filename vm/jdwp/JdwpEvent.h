@@ -22,6 +22,16 @@
 #include "JdwpConstants.h"
 #include "ExpandBuf.h"
 
+/*
+ * How a ClassMatch/ClassExclude pattern compares: "java.lang.String",
+ * "java.*" or "*.Foo".
+ */
+enum JdwpPatternKind {
+    kPatternExact = 0,
+    kPatternPrefix,
+    kPatternSuffix,
+};
+
 /*
  * Event modifiers.  A JdwpEvent may have zero or more of these.
  */
@@ -45,10 +55,14 @@ union JdwpEventMod {
     } classOnly;
     struct {
         u1          modKind;
+        u1          patternKind;    /* JdwpPatternKind, set on register */
+        int         patternLen;     /* without the '*' */
         char*       classPattern;
     } classMatch;
     struct {
         u1          modKind;
+        u1          patternKind;
+        int         patternLen;
         char*       classPattern;
     } classExclude;
     struct {
@@ -87,6 +101,15 @@ struct JdwpEvent {
     JdwpEvent* prev;           /* linked list */
     JdwpEvent* next;
 
+    /*
+     * Each event is also on one lookup chain: the per-kind chain, or an
+     * index chain if keyMod says where or on which class it can fire.
+     */
+    JdwpEvent* chainPrev;
+    JdwpEvent* chainNext;
+    JdwpEvent** chainHead;
+    const JdwpEventMod* keyMod;
+
     JdwpEventKind eventKind;      /* what kind of event is this? */
     JdwpSuspendPolicy suspendPolicy;  /* suspend all, none, or self? */
     int modCount;       /* #of entries in mods[] */
@@ -431,12 +431,31 @@ static JdwpError handleVM_ClassPaths(JdwpState* state,
 
 /*
  * Release a list of object IDs.  (Seen in jdb.)
- *
- * Currently does nothing.
  */
 static JdwpError HandleVM_DisposeObjects(JdwpState* state,
     const u1* buf, int dataLen, ExpandBuf* pReply)
 {
+    u4 requests = read4BE(&buf);
+    if (requests == 0)
+        return ERR_NONE;
+
+    ObjectId* ids = (ObjectId*) malloc(requests * sizeof(ObjectId));
+    u4* refCounts = (u4*) malloc(requests * sizeof(u4));
+    if (ids == NULL || refCounts == NULL) {
+        free(ids);
+        free(refCounts);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    for (u4 i = 0; i < requests; i++) {
+        ids[i] = dvmReadObjectId(&buf);
+        refCounts[i] = read4BE(&buf);
+    }
+    ALOGV("  Req DisposeObjects(%u)", requests);
+    dvmDbgDisposeObjects(ids, refCounts, requests);
+
+    free(ids);
+    free(refCounts);
     return ERR_NONE;
 }
 
@@ -485,6 +504,8 @@ static JdwpError handleVM_AllClassesWithGeneric(JdwpState* state,
 
     dvmDbgGetClassList(&numClasses, &classRefBuf);
 
+    /* tag, id, status, two string lengths, and a typical signature */
+    expandBufReserve(pReply, 4 + numClasses * (1 + 8 + 4 + 4 + 4 + 40));
     expandBufAdd4BE(pReply, numClasses);
 
     for (u4 i = 0; i < numClasses; i++) {
@@ -238,6 +238,7 @@ void dvmJdwpShutdown(JdwpState* state)
     assert(state->netState == NULL);
 
     dvmJdwpResetState(state);
+    expandBufFree(state->replyBuf);
     free(state);
 }
 
@@ -34,6 +34,9 @@
 #define kJDWPHeaderLen  11
 #define kJDWPFlagReply  0x80
 
+/* buckets in JdwpState.eventIndex; must be a power of 2 */
+#define kJdwpEventIndexSize 256
+
 /* DDM support */
 #define kJDWPDdmCmdSet  199     /* 0xc7, or 'G'+128 */
 #define kJDWPDdmCmd     1
@@ -85,6 +88,9 @@ struct JdwpState {
     const JdwpTransport*    transport;
     JdwpNetState*   netState;
 
+    /* reply storage, reused from one request to the next */
+    ExpandBuf*      replyBuf;
+
     /* for wait-for-debugger */
     pthread_mutex_t attachLock;
     pthread_cond_t  attachCond;
@@ -102,7 +108,10 @@ struct JdwpState {
      */
     int             numEvents;      /* #of elements in eventList */
     JdwpEvent*      eventList;      /* linked list of events */
-    pthread_mutex_t eventLock;      /* guards numEvents/eventList */
+    int             numInstrumentedEvents;  /* see needsInstrumentation() */
+    JdwpEvent*      eventsByKind[EK_VM_DISCONNECTED + 1];
+    JdwpEvent*      eventIndex[kJdwpEventIndexSize];
+    pthread_mutex_t eventLock;      /* guards numEvents/eventList/chains */
 
     /*
      * Synchronize suspension of event thread (to avoid receiving "resume"
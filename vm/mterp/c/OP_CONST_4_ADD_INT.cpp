@@ -0,0 +1,15 @@
+/*
+ * As with iget-quick-if-eqz, the add-int is still there, so this is just
+ * const/4.
+ */
+HANDLE_OPCODE(OP_CONST_4_ADD_INT /*vA, #+B*/)
+    {
+        s4 tmp;
+
+        vdst = INST_A(inst);
+        tmp = (s4) (INST_B(inst) << 28) >> 28;  // sign extend 4-bit value
+        ILOGV("|const/4 v%d,#0x%02x", vdst, (s4)tmp);
+        SET_REGISTER(vdst, tmp);
+    }
+    FINISH(1);
+OP_END
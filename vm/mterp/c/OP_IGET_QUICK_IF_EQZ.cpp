@@ -0,0 +1,7 @@
+/*
+ * The if-eqz that follows is left in place by dexopt, so running just the
+ * iget-quick and letting FINISH fetch the if-eqz is a complete (if not a
+ * faster) implementation.
+ */
+HANDLE_IGET_X_QUICK(OP_IGET_QUICK_IF_EQZ,   "", Int, )
+OP_END
@@ -39,7 +39,7 @@ HANDLE_OPCODE(OP_NEW_INSTANCE /*vAA, class@BBBB*/)
         //        clazz->descriptor);
         //    GOTO_exceptionThrown();
         //}
-        newObj = dvmAllocObject(clazz, ALLOC_DONT_TRACK);
+        newObj = dvmAllocObjectFast(clazz, self);
         if (newObj == NULL)
             GOTO_exceptionThrown();
         SET_REGISTER(vdst, (u4) newObj);
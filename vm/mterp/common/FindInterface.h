@@ -20,7 +20,8 @@
 extern "C" {
 
 /*
- * Look up an interface on a class using the cache.
+ * Look up an interface method on a class.  The interface's entry comes
+ * from the class's iftable index, so there's no cache in front of it.
  *
  * This function used to be defined in mterp/c/header.c, but it is now used by
  * the JIT compiler as well so it is separated into its own header file to
@@ -29,14 +30,8 @@ extern "C" {
 INLINE Method* dvmFindInterfaceMethodInCache(ClassObject* thisClass,
     u4 methodIdx, const Method* method, DvmDex* methodClassDex)
 {
-#define ATOMIC_CACHE_CALC \
-    dvmInterpFindInterfaceMethod(thisClass, methodIdx, method, methodClassDex)
-#define ATOMIC_CACHE_NULL_ALLOWED false
-
-    return (Method*) ATOMIC_CACHE_LOOKUP(methodClassDex->pInterfaceCache,
-                DEX_INTERFACE_CACHE_SIZE, thisClass, methodIdx);
-
-#undef ATOMIC_CACHE_CALC
+    return dvmInterpFindInterfaceMethod(thisClass, methodIdx, method,
+        methodClassDex);
 }
 
 }
@@ -86,7 +86,6 @@ MTERP_OFFSET(offDvmDex_pResStrings,     DvmDex, pResStrings, 8)
 MTERP_OFFSET(offDvmDex_pResClasses,     DvmDex, pResClasses, 12)
 MTERP_OFFSET(offDvmDex_pResMethods,     DvmDex, pResMethods, 16)
 MTERP_OFFSET(offDvmDex_pResFields,      DvmDex, pResFields, 20)
-MTERP_OFFSET(offDvmDex_pInterfaceCache, DvmDex, pInterfaceCache, 24)
 
 /* StackSaveArea fields */
 #ifdef EASY_GDB
@@ -194,20 +193,32 @@ MTERP_OFFSET(offThread_icRechainCount,    Thread, icRechainCount, 152)
 MTERP_OFFSET(offThread_pProfileCountdown, Thread, pProfileCountdown, 156)
 MTERP_OFFSET(offThread_callsiteClass,     Thread, callsiteClass, 160)
 MTERP_OFFSET(offThread_methodToCall,      Thread, methodToCall, 164)
+MTERP_OFFSET(offThread_interfaceSiteCache, Thread, interfaceSiteCache, 168)
 MTERP_OFFSET(offThread_jniLocal_topCookie, \
-                                Thread, jniLocalRefTable.segmentState.all, 168)
+                                Thread, jniLocalRefTable.segmentState.all, 172)
 #if defined(WITH_SELF_VERIFICATION)
-MTERP_OFFSET(offThread_shadowSpace,       Thread, shadowSpace, 188)
+MTERP_OFFSET(offThread_shadowSpace,       Thread, shadowSpace, 200)
 #endif
 #else
+MTERP_OFFSET(offThread_interfaceSiteCache, Thread, interfaceSiteCache, 100)
 MTERP_OFFSET(offThread_jniLocal_topCookie, \
-                                Thread, jniLocalRefTable.segmentState.all, 100)
+                                Thread, jniLocalRefTable.segmentState.all, 104)
 #endif
 
 /* Object fields */
 MTERP_OFFSET(offObject_clazz,           Object, clazz, 0)
 MTERP_OFFSET(offObject_lock,            Object, lock, 4)
 
+/* InterfaceSiteCacheEntry fields */
+MTERP_OFFSET(offInterfaceSiteCacheEntry_method, \
+                                InterfaceSiteCacheEntry, method, 0)
+MTERP_OFFSET(offInterfaceSiteCacheEntry_sitePc, \
+                                InterfaceSiteCacheEntry, sitePc, 4)
+MTERP_OFFSET(offInterfaceSiteCacheEntry_clazz, \
+                                InterfaceSiteCacheEntry, clazz, 8)
+MTERP_SIZEOF(sizeofInterfaceSiteCacheEntry, InterfaceSiteCacheEntry, 16)
+MTERP_CONSTANT(INTERFACE_SITE_CACHE_SIZE, 256)
+
 /* Lock shape */
 MTERP_CONSTANT(LW_LOCK_OWNER_SHIFT, 3)
 MTERP_CONSTANT(LW_HASH_STATE_SHIFT, 1)
@@ -310,6 +321,7 @@ MTERP_CONSTANT(kSubModeDebuggerActive,  0x0008)
 MTERP_CONSTANT(kSubModeSuspendPending,  0x0010)
 MTERP_CONSTANT(kSubModeCallbackPending, 0x0020)
 MTERP_CONSTANT(kSubModeCountedStep,     0x0040)
+MTERP_CONSTANT(kSubModeDebuggerAttached, 0x0200)
 MTERP_CONSTANT(kSubModeJitTraceBuild,   0x4000)
 MTERP_CONSTANT(kSubModeJitSV,           0x8000)
 MTERP_CONSTANT(kSubModeDebugProfile,    0x000f)
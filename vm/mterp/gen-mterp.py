@@ -33,11 +33,13 @@ in_op_start = 0             # 0=not started, 1=started, 2=ended
 in_alt_op_start = 0         # 0=not started, 1=started, 2=ended
 default_op_dir = None
 default_alt_stub = None
+default_count_stub = None
 opcode_locations = {}
 alt_opcode_locations = {}
 asm_stub_text = []
 label_prefix = ".L"         # use ".L" to hide labels from gdb
 alt_label_prefix = ".L_ALT" # use ".L" to hide labels from gdb
+count_label_prefix = ".L_CNT" # use ".L" to hide labels from gdb
 style = None                # interpreter style
 generate_alt_table = False
 
@@ -138,6 +140,18 @@ def setAsmAltStub(tokens):
     default_alt_stub = tokens[1]
     generate_alt_table = True
 
+#
+# Parse arch config file --
+# Record location of the instruction counting stub
+#
+def setAsmCountStub(tokens):
+    global default_count_stub
+    if style == "all-c":
+        print "Warning: asm-count-stub ingored for all-c interpreter"
+    if len(tokens) != 2:
+        raise DataParseError("import requires one argument")
+    default_count_stub = tokens[1]
+
 #
 # Parse arch config file --
 # Start of opcode list.
@@ -220,10 +234,7 @@ def opEnd(tokens):
     loadAndEmitOpcodes()
     if splitops == False:
         if generate_alt_table:
-            loadAndEmitAltOpcodes()
-            if style == "jump-table":
-                emitJmpTable("dvmAsmInstructionStart", label_prefix);
-                emitJmpTable("dvmAsmAltInstructionStart", alt_label_prefix);
+            loadAndEmitAltTables()
 
 def genaltop(tokens):
     if in_op_start != 2:
@@ -231,11 +242,21 @@ def genaltop(tokens):
     if len(tokens) != 1:
         raise DataParseError("opEnd takes no arguments")
     if generate_alt_table:
-        loadAndEmitAltOpcodes()
-        if style == "jump-table":
-            emitJmpTable("dvmAsmInstructionStart", label_prefix);
-            emitJmpTable("dvmAsmAltInstructionStart", alt_label_prefix);
+        loadAndEmitAltTables()
 
+#
+# Emit the alternate handlers, the counting stubs if there are any, and
+# for a jump-table interpreter the tables of all of them.
+#
+def loadAndEmitAltTables():
+    loadAndEmitAltOpcodes()
+    if default_count_stub != None:
+        loadAndEmitCountOpcodes()
+    if style == "jump-table":
+        emitJmpTable("dvmAsmInstructionStart", label_prefix);
+        emitJmpTable("dvmAsmAltInstructionStart", alt_label_prefix);
+        if default_count_stub != None:
+            emitJmpTable("dvmAsmCountInstructionStart", count_label_prefix);
 
 #
 # Extract an ordered list of instructions from the VM sources.  We use the
@@ -336,6 +357,39 @@ def loadAndEmitAltStub(source, opindex):
     emitAsmHeader(asm_fp, dict, alt_label_prefix)
     appendSourceFile(source, dict, asm_fp, None)
 
+#
+# Load and emit the instruction counting stub for all kNumPackedOpcodes
+# instructions.  Unlike the alternate handlers these can't be overridden
+# per opcode: all they do is count and go on to the real handler.
+#
+def loadAndEmitCountOpcodes():
+    assert len(opcodes) == kNumPackedOpcodes
+    if style == "jump-table":
+        start_label = "dvmAsmCountInstructionStartCode"
+        end_label = "dvmAsmCountInstructionEndCode"
+    else:
+        start_label = "dvmAsmCountInstructionStart"
+        end_label = "dvmAsmCountInstructionEnd"
+
+    asm_fp.write("\n    .global %s\n" % start_label)
+    asm_fp.write("    .type   %s, %%function\n" % start_label)
+    asm_fp.write("    .text\n\n")
+    asm_fp.write("%s = " % start_label + count_label_prefix + "_OP_NOP\n")
+
+    for i in xrange(kNumPackedOpcodes):
+        op = opcodes[i]
+        if verbose:
+            print " count emit %s --> stub" % default_count_stub
+        dict = getGlobalSubDict()
+        dict.update({ "opcode":op, "opnum":i })
+        emitAsmHeader(asm_fp, dict, count_label_prefix)
+        appendSourceFile(default_count_stub, dict, asm_fp, None)
+
+    emitAlign()
+    asm_fp.write("    .size   %s, .-%s\n" % (start_label, start_label))
+    asm_fp.write("    .global %s\n" % end_label)
+    asm_fp.write("%s:\n" % end_label)
+
 #
 # Load and emit alternate opcodes for all kNumPackedOpcodes instructions.
 #
@@ -594,6 +648,8 @@ try:
                 setAsmStub(tokens)
             elif tokens[0] == "asm-alt-stub":
                 setAsmAltStub(tokens)
+            elif tokens[0] == "asm-count-stub":
+                setAsmCountStub(tokens)
             elif tokens[0] == "op-start":
                 opStart(tokens)
             elif tokens[0] == "op-end":
@@ -1688,7 +1688,7 @@ HANDLE_OPCODE(OP_NEW_INSTANCE /*vAA, class@BBBB*/)
         //        clazz->descriptor);
         //    GOTO_exceptionThrown();
         //}
-        newObj = dvmAllocObject(clazz, ALLOC_DONT_TRACK);
+        newObj = dvmAllocObjectFast(clazz, self);
         if (newObj == NULL)
             GOTO_exceptionThrown();
         SET_REGISTER(vdst, (u4) newObj);
@@ -1974,12 +1974,30 @@ OP_END
 HANDLE_OP_IF_XXZ(OP_IF_LEZ, "lez", <=)
 OP_END
 
-/* File: c/OP_UNUSED_3E.cpp */
-HANDLE_OPCODE(OP_UNUSED_3E)
+/* File: c/OP_IGET_QUICK_IF_EQZ.cpp */
+/*
+ * The if-eqz that follows is left in place by dexopt, so running just the
+ * iget-quick and letting FINISH fetch the if-eqz is a complete (if not a
+ * faster) implementation.
+ */
+HANDLE_IGET_X_QUICK(OP_IGET_QUICK_IF_EQZ,   "", Int, )
 OP_END
 
-/* File: c/OP_UNUSED_3F.cpp */
-HANDLE_OPCODE(OP_UNUSED_3F)
+/* File: c/OP_CONST_4_ADD_INT.cpp */
+/*
+ * As with iget-quick-if-eqz, the add-int is still there, so this is just
+ * const/4.
+ */
+HANDLE_OPCODE(OP_CONST_4_ADD_INT /*vA, #+B*/)
+    {
+        s4 tmp;
+
+        vdst = INST_A(inst);
+        tmp = (s4) (INST_B(inst) << 28) >> 28;  // sign extend 4-bit value
+        ILOGV("|const/4 v%d,#0x%02x", vdst, (s4)tmp);
+        SET_REGISTER(vdst, tmp);
+    }
+    FINISH(1);
 OP_END
 
 /* File: c/OP_UNUSED_40.cpp */
@@ -3345,10 +3363,17 @@ GOTO_TARGET(invokeInterface, bool methodCallRange)
 
         /*
          * Given a class and a method index, find the Method* with the
-         * actual code we want to execute.
+         * actual code we want to execute, trying the last one seen at
+         * this call site first.
          */
-        methodToCall = dvmFindInterfaceMethodInCache(thisClass, ref, curMethod,
-                        methodClassDex);
+        InterfaceSiteCacheEntry* siteEntry =
+            &self->interfaceSiteCache[INTERFACE_SITE_CACHE_INDEX(pc)];
+        if (siteEntry->sitePc == pc && siteEntry->clazz == thisClass) {
+            methodToCall = siteEntry->method;
+        } else {
+            methodToCall = dvmInterpFindInterfaceMethodAtSite(thisClass, pc,
+                            curMethod, methodClassDex);
+        }
 #if defined(WITH_JIT) && defined(MTERP_STUB)
         self->callsiteClass = thisClass;
         self->methodToCall = methodToCall;
@@ -1578,10 +1578,17 @@ GOTO_TARGET(invokeInterface, bool methodCallRange)
 
         /*
          * Given a class and a method index, find the Method* with the
-         * actual code we want to execute.
+         * actual code we want to execute, trying the last one seen at
+         * this call site first.
          */
-        methodToCall = dvmFindInterfaceMethodInCache(thisClass, ref, curMethod,
-                        methodClassDex);
+        InterfaceSiteCacheEntry* siteEntry =
+            &self->interfaceSiteCache[INTERFACE_SITE_CACHE_INDEX(pc)];
+        if (siteEntry->sitePc == pc && siteEntry->clazz == thisClass) {
+            methodToCall = siteEntry->method;
+        } else {
+            methodToCall = dvmInterpFindInterfaceMethodAtSite(thisClass, pc,
+                            curMethod, methodClassDex);
+        }
 #if defined(WITH_JIT) && defined(MTERP_STUB)
         self->callsiteClass = thisClass;
         self->methodToCall = methodToCall;
@@ -64,6 +64,9 @@ static DalvikNativeClass gDvmNativeMethodSet[] = {
 };
 
 
+/* must be a power of 2 */
+#define CLASS_NAME_CACHE_SIZE   256
+
 /*
  * Set up hash values on the class names.
  */
@@ -81,6 +84,10 @@ bool dvmInternalNativeStartup()
     if (gDvm.userDexFiles == NULL)
         return false;
 
+    gDvm.classNameCache = dvmAllocAtomicCache(CLASS_NAME_CACHE_SIZE);
+    if (gDvm.classNameCache == NULL)
+        return false;
+
     return true;
 }
 
@@ -90,6 +97,7 @@ bool dvmInternalNativeStartup()
 void dvmInternalNativeShutdown()
 {
     dvmHashTableFree(gDvm.userDexFiles);
+    dvmFreeAtomicCache(gDvm.classNameCache);
 }
 
 /*
@@ -172,19 +180,44 @@ bool dvmVerifyObjectInClass(Object* obj, ClassObject* clazz) {
 }
 
 /*
- * Find a class by name, initializing it if requested.
+ * Returns "true" if "descriptor" is the descriptor for the binary name in
+ * "nameObj", e.g. "Ljava/lang/String;" for "java.lang.String" and
+ * "[Ljava/lang/String;" for "[Ljava.lang.String;".  Names with anything
+ * outside ASCII just don't match, which sends them down the slow path.
  */
-ClassObject* dvmFindClassByName(StringObject* nameObj, Object* loader,
-    bool doInit)
+static bool nameMatchesDescriptor(const StringObject* nameObj,
+    const char* descriptor)
+{
+    int len = nameObj->length();
+    const u2* chars = nameObj->chars();
+
+    bool isArray = (descriptor[0] == '[');
+    if (!isArray) {
+        if (descriptor[0] != 'L')
+            return false;
+        descriptor++;
+    }
+    for (int i = 0; i < len; i++) {
+        u2 ch = chars[i];
+        if (ch == '/' || ch >= 0x80)
+            return false;
+        if (ch == '.')
+            ch = '/';
+        if (ch != (u1) descriptor[i])
+            return false;
+    }
+    if (isArray)
+        return descriptor[len] == '\0';
+    return descriptor[len] == ';' && descriptor[len + 1] == '\0';
+}
+
+static ClassObject* findClassByNameUncached(StringObject* nameObj,
+    Object* loader, bool doInit)
 {
     ClassObject* clazz = NULL;
     char* name = NULL;
     char* descriptor = NULL;
 
-    if (nameObj == NULL) {
-        dvmThrowNullPointerException("name == null");
-        goto bail;
-    }
     name = dvmCreateCstrFromString(nameObj);
 
     /*
@@ -227,6 +260,122 @@ bail:
     return clazz;
 }
 
+/*
+ * The Class.forName() cache entry for a name and loader.
+ */
+static AtomicCacheEntry* classNameCacheEntry(Object* loader, u4 nameHash)
+{
+    u4 hash = (((u4) loader >> 2) ^ nameHash) & (CLASS_NAME_CACHE_SIZE - 1);
+    return gDvm.classNameCache->entries + hash;
+}
+
+/*
+ * Find a class by name, initializing it if requested.
+ */
+ClassObject* dvmFindClassByName(StringObject* nameObj, Object* loader,
+    bool doInit)
+{
+    if (nameObj == NULL) {
+        dvmThrowNullPointerException("name == null");
+        return NULL;
+    }
+
+    /*
+     * A loader must keep returning the class it returned once for a name,
+     * so a hit needs no more than a check that the entry wasn't for another
+     * name with the same hash.  Misses aren't cached: a loader can start
+     * finding a class without defining one, e.g. when a dex file is added
+     * to its path.
+     *
+     * The entries are read and written as in ATOMIC_CACHE_LOOKUP, which
+     * we can't use because the result has to be checked before it's used.
+     */
+    u4 nameHash = dvmComputeStringHash(nameObj);
+    AtomicCacheEntry* pEntry = classNameCacheEntry(loader, nameHash);
+    u4 firstVersion = android_atomic_acquire_load((int32_t*) &pEntry->version);
+    ClassObject* clazz = NULL;
+
+    if (pEntry->key1 == (u4) loader && pEntry->key2 == nameHash) {
+        clazz = (ClassObject*)
+            android_atomic_acquire_load((int32_t*) &pEntry->value);
+        if ((firstVersion & 0x01) != 0 || firstVersion != pEntry->version)
+            clazz = NULL;
+    }
+    if (clazz != NULL && nameMatchesDescriptor(nameObj, clazz->descriptor)) {
+        if (doInit && !dvmIsClassInitialized(clazz) && !dvmInitClass(clazz))
+            return NULL;
+        return clazz;
+    }
+
+    clazz = findClassByNameUncached(nameObj, loader, doInit);
+    if (clazz != NULL) {
+        dvmUpdateAtomicCache((u4) loader, nameHash, (u4) clazz, pEntry,
+            firstVersion
+#if CALC_CACHE_STATS > 0
+            , gDvm.classNameCache
+#endif
+            );
+    }
+    return clazz;
+}
+
+void dvmCacheClassByName(StringObject* nameObj, Object* loader,
+    ClassObject* clazz)
+{
+    u4 nameHash = dvmComputeStringHash(nameObj);
+    AtomicCacheEntry* pEntry = classNameCacheEntry(loader, nameHash);
+    u4 firstVersion = android_atomic_acquire_load((int32_t*) &pEntry->version);
+
+    dvmUpdateAtomicCache((u4) loader, nameHash, (u4) clazz, pEntry,
+        firstVersion
+#if CALC_CACHE_STATS > 0
+        , gDvm.classNameCache
+#endif
+        );
+}
+
+/*
+ * Called by the GC with the world stopped, so nobody is in the middle of
+ * an update.
+ */
+void dvmSweepClassNameCache(int (*isUnmarkedObject)(void*))
+{
+    AtomicCache* cache = gDvm.classNameCache;
+    if (cache == NULL)
+        return;
+    for (int i = 0; i < cache->numEntries; i++) {
+        AtomicCacheEntry* pEntry = &cache->entries[i];
+        if (pEntry->key1 != 0 && isUnmarkedObject((void*) pEntry->key1)) {
+            pEntry->key1 = pEntry->key2 = pEntry->value = 0;
+            pEntry->version += 2;       /* fail any read in progress */
+        }
+    }
+}
+
+/*
+ * Called by a compaction with the world stopped.  The entries are in the
+ * slots picked by the loader's address, so those of a loader that moved
+ * are cleared rather than forwarded; otherwise a new loader allocated
+ * where it was would find its classes.
+ */
+void dvmVisitClassNameCache(void (*visitor)(void* addr, void* arg), void* arg)
+{
+    AtomicCache* cache = gDvm.classNameCache;
+    if (cache == NULL)
+        return;
+    for (int i = 0; i < cache->numEntries; i++) {
+        AtomicCacheEntry* pEntry = &cache->entries[i];
+        if (pEntry->key1 == 0)
+            continue;
+        Object* loader = (Object*) pEntry->key1;
+        (*visitor)(&loader, arg);
+        if (loader != (Object*) pEntry->key1) {
+            pEntry->key1 = pEntry->key2 = pEntry->value = 0;
+            pEntry->version += 2;
+        }
+    }
+}
+
 /*
  * We insert native method stubs for abstract methods so we don't have to
  * check the access flags at the time of the method call.  This results in
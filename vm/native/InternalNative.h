@@ -23,6 +23,12 @@
 bool dvmInternalNativeStartup(void);
 void dvmInternalNativeShutdown(void);
 
+/* clear the Class.forName() cache entries of dead class loaders */
+void dvmSweepClassNameCache(int (*isUnmarkedObject)(void*));
+
+/* let a compaction drop the Class.forName() cache entries of moved loaders */
+void dvmVisitClassNameCache(void (*visitor)(void* addr, void* arg), void* arg);
+
 /* search the internal native set for a match */
 DalvikNativeFunc dvmLookupInternalNativeMethod(const Method* method);
 
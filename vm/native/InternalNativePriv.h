@@ -62,6 +62,13 @@ bool dvmVerifyObjectInClass(Object* obj, ClassObject* clazz);
 ClassObject* dvmFindClassByName(StringObject* nameObj, Object* loader,
     bool doInit);
 
+/*
+ * Record that "loader" finds "clazz" under the binary name in "nameObj",
+ * so dvmFindClassByName() can skip the lookup next time.
+ */
+void dvmCacheClassByName(StringObject* nameObj, Object* loader,
+    ClassObject* clazz);
+
 /*
  * We insert native method stubs for abstract methods so we don't have to
  * check the access flags at the time of the method call.  This results in
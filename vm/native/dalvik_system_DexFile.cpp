@@ -31,6 +31,16 @@ static bool hasDexExtension(const char* name) {
         && (strcmp(&name[len - 4], ".dex") == 0);
 }
 
+/*
+ * Where an openDexFileAsyncNative() open is.  Synchronous opens are
+ * kDexOpenReady from the start.
+ */
+enum DexOpenState {
+    kDexOpenReady = 0,
+    kDexOpenPending,
+    kDexOpenFailed,
+};
+
 /*
  * Internal struct for managing DexFile.
  */
@@ -41,8 +51,23 @@ struct DexOrJar {
     RawDexFile* pRawDexFile;
     JarFile*    pJarFile;
     u1*         pDexMemory; // malloc()ed memory, if any
+
+    /* async opens only; the rest of the struct is set when it's ready */
+    volatile int32_t openState; // DexOpenState
+    char*       outputName;
+    DexOrJar*   nextPending;
 };
 
+/*
+ * The queue of asynchronous opens, and the thread that works through it.
+ * gOpenLock also guards the openState changes that gOpenCond signals.
+ */
+static pthread_mutex_t gOpenLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gOpenCond = PTHREAD_COND_INITIALIZER;
+static DexOrJar* gPendingHead;
+static DexOrJar* gPendingTail;
+static bool gOpenThreadStarted;
+
 /*
  * (This is a dvmHashTableFree callback.)
  */
@@ -52,11 +77,14 @@ void dvmFreeDexOrJar(void* vptr)
 
     ALOGV("Freeing DexOrJar '%s'", pDexOrJar->fileName);
 
-    if (pDexOrJar->isDex)
-        dvmRawDexFileFree(pDexOrJar->pRawDexFile);
-    else
-        dvmJarFileFree(pDexOrJar->pJarFile);
+    if (pDexOrJar->openState == kDexOpenReady) {
+        if (pDexOrJar->isDex)
+            dvmRawDexFileFree(pDexOrJar->pRawDexFile);
+        else
+            dvmJarFileFree(pDexOrJar->pJarFile);
+    }
     free(pDexOrJar->fileName);
+    free(pDexOrJar->outputName);
     free(pDexOrJar->pDexMemory);
     free(pDexOrJar);
 }
@@ -129,6 +157,100 @@ static void addToDexFileTable(DexOrJar* pDexOrJar) {
     pDexOrJar->okayToFree = true;
 }
 
+/*
+ * Wait for an asynchronous open of "pDexOrJar" to finish.  Returns
+ * "false" with an IOException raised if it failed.
+ */
+static bool waitForOpen(DexOrJar* pDexOrJar)
+{
+    if (android_atomic_acquire_load(&pDexOrJar->openState) == kDexOpenReady)
+        return true;
+
+    Thread* self = dvmThreadSelf();
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+    pthread_mutex_lock(&gOpenLock);
+    while (pDexOrJar->openState == kDexOpenPending)
+        pthread_cond_wait(&gOpenCond, &gOpenLock);
+    pthread_mutex_unlock(&gOpenLock);
+    dvmChangeStatus(self, oldStatus);
+
+    if (pDexOrJar->openState != kDexOpenReady) {
+        dvmThrowIOException("unable to open DEX file");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Get the DvmDex of a file that's been opened.
+ */
+static DvmDex* getDvmDex(const DexOrJar* pDexOrJar)
+{
+    if (pDexOrJar->isDex)
+        return dvmGetRawDexFileDex(pDexOrJar->pRawDexFile);
+    else
+        return dvmGetJarFileDex(pDexOrJar->pJarFile);
+}
+
+/*
+ * Resolve a DEX file's strings on a thread of its own.  The DvmDex is
+ * kept until we exit.
+ */
+static void* preresolveThreadStart(void* arg)
+{
+    DvmDex* pDvmDex = (DvmDex*) arg;
+
+    if (!dvmPreresolveDexStrings(pDvmDex))
+        dvmClearException(dvmThreadSelf());
+    return NULL;
+}
+
+static void startPreresolving(DexOrJar* pDexOrJar)
+{
+    DvmDex* pDvmDex = getDvmDex(pDexOrJar);
+
+    /* the thread holds on to the storage, as a loaded class would */
+    pDexOrJar->okayToFree = false;
+
+    pthread_t handle;
+    if (!dvmCreateInternalThread(&handle, "Preresolve",
+            preresolveThreadStart, pDvmDex))
+    {
+        ALOGW("Unable to start string pre-resolution for %s",
+            pDexOrJar->fileName);
+        return;
+    }
+    pthread_detach(handle);
+}
+
+/*
+ * Open "sourceName" into "pDexOrJar": directly as a DEX if the name ends
+ * with ".dex", otherwise (or if that fails) as a Zip with a "classes.dex"
+ * inside.  Returns "false" if neither works.
+ */
+static bool openDexOrJar(DexOrJar* pDexOrJar, const char* sourceName,
+    const char* outputName)
+{
+    RawDexFile* pRawDexFile;
+    JarFile* pJarFile;
+
+    if (hasDexExtension(sourceName)
+            && dvmRawDexFileOpen(sourceName, outputName, &pRawDexFile, false) == 0) {
+        ALOGV("Opening DEX file '%s' (DEX)", sourceName);
+        pDexOrJar->isDex = true;
+        pDexOrJar->pRawDexFile = pRawDexFile;
+        pDexOrJar->pDexMemory = NULL;
+        return true;
+    } else if (dvmJarFileOpen(sourceName, outputName, &pJarFile, false) == 0) {
+        ALOGV("Opening DEX file '%s' (Jar)", sourceName);
+        pDexOrJar->isDex = false;
+        pDexOrJar->pJarFile = pJarFile;
+        pDexOrJar->pDexMemory = NULL;
+        return true;
+    }
+    return false;
+}
+
 /*
  * private static int openDexFileNative(String sourceName, String outputName,
  *     int flags) throws IOException
@@ -151,9 +273,7 @@ static void Dalvik_dalvik_system_DexFile_openDexFileNative(const u4* args,
 {
     StringObject* sourceNameObj = (StringObject*) args[0];
     StringObject* outputNameObj = (StringObject*) args[1];
-    DexOrJar* pDexOrJar = NULL;
-    JarFile* pJarFile;
-    RawDexFile* pRawDexFile;
+    DexOrJar* pDexOrJar;
     char* sourceName;
     char* outputName;
 
@@ -198,39 +318,134 @@ static void Dalvik_dalvik_system_DexFile_openDexFileNative(const u4* args,
         RETURN_VOID();
     }
 
-    /*
-     * Try to open it directly as a DEX if the name ends with ".dex".
-     * If that fails (or isn't tried in the first place), try it as a
-     * Zip with a "classes.dex" inside.
-     */
-    if (hasDexExtension(sourceName)
-            && dvmRawDexFileOpen(sourceName, outputName, &pRawDexFile, false) == 0) {
-        ALOGV("Opening DEX file '%s' (DEX)", sourceName);
-
-        pDexOrJar = (DexOrJar*) malloc(sizeof(DexOrJar));
-        pDexOrJar->isDex = true;
-        pDexOrJar->pRawDexFile = pRawDexFile;
-        pDexOrJar->pDexMemory = NULL;
-    } else if (dvmJarFileOpen(sourceName, outputName, &pJarFile, false) == 0) {
-        ALOGV("Opening DEX file '%s' (Jar)", sourceName);
-
-        pDexOrJar = (DexOrJar*) malloc(sizeof(DexOrJar));
-        pDexOrJar->isDex = false;
-        pDexOrJar->pJarFile = pJarFile;
-        pDexOrJar->pDexMemory = NULL;
-    } else {
+    pDexOrJar = (DexOrJar*) calloc(1, sizeof(DexOrJar));
+    if (!openDexOrJar(pDexOrJar, sourceName, outputName)) {
         ALOGV("Unable to open DEX file '%s'", sourceName);
         dvmThrowIOException("unable to open DEX file");
+        free(pDexOrJar);
+        free(sourceName);
+        free(outputName);
+        RETURN_VOID();
     }
 
-    if (pDexOrJar != NULL) {
-        pDexOrJar->fileName = sourceName;
-        addToDexFileTable(pDexOrJar);
-    } else {
+    pDexOrJar->fileName = sourceName;
+    addToDexFileTable(pDexOrJar);
+    if (gDvm.preresolveApps)
+        startPreresolving(pDexOrJar);
+
+    free(outputName);
+    RETURN_LONG((uintptr_t) pDexOrJar);
+}
+
+/*
+ * Work through the queue of asynchronous opens, in the order they were
+ * asked for.  One at a time is enough, as dexopt mostly waits on the
+ * disk.
+ */
+static void* openThreadStart(void* arg)
+{
+    Thread* self = dvmThreadSelf();
+
+    UNUSED_PARAMETER(arg);
+
+    while (true) {
+        dvmChangeStatus(self, THREAD_VMWAIT);
+        pthread_mutex_lock(&gOpenLock);
+        while (gPendingHead == NULL)
+            pthread_cond_wait(&gOpenCond, &gOpenLock);
+        DexOrJar* pDexOrJar = gPendingHead;
+        gPendingHead = pDexOrJar->nextPending;
+        if (gPendingHead == NULL)
+            gPendingTail = NULL;
+        pthread_mutex_unlock(&gOpenLock);
+        dvmChangeStatus(self, THREAD_RUNNING);
+
+        bool okay = openDexOrJar(pDexOrJar, pDexOrJar->fileName,
+            pDexOrJar->outputName);
+        if (okay) {
+            ALOGV("Opened DEX file '%s' in the background",
+                pDexOrJar->fileName);
+        } else {
+            ALOGW("Unable to open DEX file '%s' in the background",
+                pDexOrJar->fileName);
+        }
+
+        /*
+         * Pre-resolution clears okayToFree, so it has to start before a
+         * closeDexFile() waiting on the open can see the file as ready.
+         */
+        if (okay && gDvm.preresolveApps)
+            startPreresolving(pDexOrJar);
+
+        pthread_mutex_lock(&gOpenLock);
+        android_atomic_release_store(okay ? kDexOpenReady : kDexOpenFailed,
+            &pDexOrJar->openState);
+        pthread_cond_broadcast(&gOpenCond);
+        pthread_mutex_unlock(&gOpenLock);
+    }
+    return NULL;
+}
+
+/*
+ * private static long openDexFileAsyncNative(String sourceName,
+ *     String outputName, int flags)
+ *
+ * Like openDexFileNative(), but returns as soon as the file is queued.
+ * The file is opened, and optimized if need be, on a thread of ours.
+ * The calls that need its contents wait for that to finish, and throw
+ * the IOException the open would have if it failed; closeDexFile()
+ * waits too, and doesn't throw.
+ */
+static void Dalvik_dalvik_system_DexFile_openDexFileAsyncNative(
+    const u4* args, JValue* pResult)
+{
+    StringObject* sourceNameObj = (StringObject*) args[0];
+    StringObject* outputNameObj = (StringObject*) args[1];
+
+    if (sourceNameObj == NULL) {
+        dvmThrowNullPointerException("sourceName == null");
+        RETURN_VOID();
+    }
+
+    char* sourceName = dvmCreateCstrFromString(sourceNameObj);
+
+    /* see openDexFileNative() */
+    if (dvmClassPathContains(gDvm.bootClassPath, sourceName)) {
+        ALOGW("Refusing to reopen boot DEX '%s'", sourceName);
+        dvmThrowIOException(
+            "Re-opening BOOTCLASSPATH DEX files is not allowed");
         free(sourceName);
+        RETURN_VOID();
     }
 
-    free(outputName);
+    DexOrJar* pDexOrJar = (DexOrJar*) calloc(1, sizeof(DexOrJar));
+    pDexOrJar->fileName = sourceName;
+    if (outputNameObj != NULL)
+        pDexOrJar->outputName = dvmCreateCstrFromString(outputNameObj);
+    pDexOrJar->openState = kDexOpenPending;
+    addToDexFileTable(pDexOrJar);
+
+    pthread_mutex_lock(&gOpenLock);
+    if (!gOpenThreadStarted) {
+        /* the thread doesn't touch the queue until we've let go of it */
+        pthread_t handle;
+        if (!dvmCreateInternalThread(&handle, "DexFile open",
+                openThreadStart, NULL))
+        {
+            ALOGE("Unable to start the DexFile open thread");
+            dvmAbort();
+        }
+        pthread_detach(handle);
+        gOpenThreadStarted = true;
+    }
+    if (gPendingTail != NULL)
+        gPendingTail->nextPending = pDexOrJar;
+    else
+        gPendingHead = pDexOrJar;
+    gPendingTail = pDexOrJar;
+    pthread_cond_broadcast(&gOpenCond);
+    pthread_mutex_unlock(&gOpenLock);
+
     RETURN_LONG((uintptr_t) pDexOrJar);
 }
 
@@ -277,7 +492,7 @@ static void Dalvik_dalvik_system_DexFile_openDexFile_bytearray(const u4* args,
     }
 
     ALOGV("Opening in-memory DEX");
-    pDexOrJar = (DexOrJar*) malloc(sizeof(DexOrJar));
+    pDexOrJar = (DexOrJar*) calloc(1, sizeof(DexOrJar));
     pDexOrJar->isDex = true;
     pDexOrJar->pRawDexFile = pRawDexFile;
     pDexOrJar->pDexMemory = pBytes;
@@ -305,6 +520,10 @@ static void Dalvik_dalvik_system_DexFile_closeDexFile(const u4* args,
 
     ALOGV("Closing DEX file %p (%s)", pDexOrJar, pDexOrJar->fileName);
 
+    /* a failed open has nothing to keep, so it's freed like an unused one */
+    if (!waitForOpen(pDexOrJar))
+        dvmClearException(dvmThreadSelf());
+
     /*
      * We can't just free arbitrary DEX files because they have bits and
      * pieces of loaded classes.  The only exception to this rule is if
@@ -362,13 +581,12 @@ static void Dalvik_dalvik_system_DexFile_defineClassNative(const u4* args,
         descriptor, loader, cookie);
     free(name);
 
-    if (!validateCookie(cookie))
+    if (!validateCookie(cookie) || !waitForOpen(pDexOrJar)) {
+        free(descriptor);
         RETURN_VOID();
+    }
 
-    if (pDexOrJar->isDex)
-        pDvmDex = dvmGetRawDexFileDex(pDexOrJar->pRawDexFile);
-    else
-        pDvmDex = dvmGetJarFileDex(pDexOrJar->pJarFile);
+    pDvmDex = getDvmDex(pDexOrJar);
 
     /* once we load something, we can't unmap the storage */
     pDexOrJar->okayToFree = false;
@@ -390,6 +608,9 @@ static void Dalvik_dalvik_system_DexFile_defineClassNative(const u4* args,
             dvmClearException(self);
         }
         clazz = NULL;
+    } else if (clazz != NULL) {
+        /* the loader's findClass() is on its way to returning this */
+        dvmCacheClassByName(nameObj, loader, clazz);
     }
 
     free(descriptor);
@@ -409,14 +630,10 @@ static void Dalvik_dalvik_system_DexFile_getClassNameList(const u4* args,
     DexOrJar* pDexOrJar = (DexOrJar*) cookie;
     Thread* self = dvmThreadSelf();
 
-    if (!validateCookie(cookie))
+    if (!validateCookie(cookie) || !waitForOpen(pDexOrJar))
         RETURN_VOID();
 
-    DvmDex* pDvmDex;
-    if (pDexOrJar->isDex)
-        pDvmDex = dvmGetRawDexFileDex(pDexOrJar->pRawDexFile);
-    else
-        pDvmDex = dvmGetJarFileDex(pDexOrJar->pJarFile);
+    DvmDex* pDvmDex = getDvmDex(pDexOrJar);
     assert(pDvmDex != NULL);
     DexFile* pDexFile = pDvmDex->pDexFile;
 
@@ -522,6 +739,8 @@ static void Dalvik_dalvik_system_DexFile_isDexOptNeededInternal(const u4* args,
 const DalvikNativeMethod dvm_dalvik_system_DexFile[] = {
     { "openDexFileNative",  "(Ljava/lang/String;Ljava/lang/String;I)J",
         Dalvik_dalvik_system_DexFile_openDexFileNative },
+    { "openDexFileAsyncNative",  "(Ljava/lang/String;Ljava/lang/String;I)J",
+        Dalvik_dalvik_system_DexFile_openDexFileAsyncNative },
     { "openDexFile",        "([B)J",
         Dalvik_dalvik_system_DexFile_openDexFile_bytearray },
     { "closeDexFile",       "(J)V",
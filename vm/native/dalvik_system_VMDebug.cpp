@@ -18,12 +18,17 @@
  * dalvik.system.VMDebug
  */
 #include "Dalvik.h"
+#include "alloc/GcHistory.h"
 #include "alloc/HeapSource.h"
+#if defined(WITH_JIT)
+#include "compiler/JitSampler.h"
+#endif
 #include "native/InternalNativePriv.h"
 #include "hprof/Hprof.h"
 
 #include <string.h>
 #include <unistd.h>
+#include <cutils/open_memstream.h>
 
 
 /*
@@ -777,6 +782,288 @@ static void Dalvik_dalvik_system_VMDebug_countInstancesOfClass(const u4* args,
     }
 }
 
+/*
+ * public static native String getGcHistory()
+ *
+ * Returns the recent collections and the percentiles of their pause
+ * and phase times, as printed on SIGQUIT.
+ */
+static void Dalvik_dalvik_system_VMDebug_getGcHistory(const u4* args,
+    JValue* pResult)
+{
+    char* buf = NULL;
+    size_t len;
+    FILE* fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        dvmThrowRuntimeException("unable to dump the GC history");
+        RETURN_PTR(NULL);
+    }
+    DebugOutputTarget target;
+    dvmCreateFileOutputTarget(&target, fp);
+    dvmGcHistoryDump(&target);
+    fclose(fp);
+
+    StringObject* result = dvmCreateStringFromCstr(buf != NULL ? buf : "");
+    free(buf);
+    dvmReleaseTrackedAlloc((Object*) result, NULL);
+    RETURN_PTR(result);
+}
+
+/*
+ * public static native String getStartupTimeline()
+ *
+ * Returns the steps of the latest startup timeline, with the wall and
+ * CPU time of each, as printed on SIGQUIT.  In a process forked from the
+ * zygote that is the post-fork initialization.
+ */
+static void Dalvik_dalvik_system_VMDebug_getStartupTimeline(const u4* args,
+    JValue* pResult)
+{
+    char* buf = NULL;
+    size_t len;
+    FILE* fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        dvmThrowRuntimeException("unable to dump the startup timeline");
+        RETURN_PTR(NULL);
+    }
+    DebugOutputTarget target;
+    dvmCreateFileOutputTarget(&target, fp);
+    dvmStartupTimelineDump(&target);
+    fclose(fp);
+
+    StringObject* result = dvmCreateStringFromCstr(buf != NULL ? buf : "");
+    free(buf);
+    dvmReleaseTrackedAlloc((Object*) result, NULL);
+    RETURN_PTR(result);
+}
+
+/*
+ * public static native String getHeapHistogram(int maxClasses)
+ *
+ * Returns the instance count and shallow size of each class with live
+ * objects, largest first, from one walk of the live bitmap.  Much
+ * cheaper than an hprof dump when that's all that's wanted.  Lists at
+ * most maxClasses classes, or all of them if it is zero.
+ */
+static void Dalvik_dalvik_system_VMDebug_getHeapHistogram(const u4* args,
+    JValue* pResult)
+{
+    int maxClasses = args[0];
+    if (maxClasses < 0) {
+        dvmThrowIllegalArgumentException("maxClasses must not be negative");
+        RETURN_PTR(NULL);
+    }
+
+    char* buf = NULL;
+    size_t len;
+    FILE* fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        dvmThrowRuntimeException("unable to dump the heap histogram");
+        RETURN_PTR(NULL);
+    }
+    DebugOutputTarget target;
+    dvmCreateFileOutputTarget(&target, fp);
+    dvmHeapHistogramDump(&target, maxClasses);
+    fclose(fp);
+
+    StringObject* result = dvmCreateStringFromCstr(buf != NULL ? buf : "");
+    free(buf);
+    dvmReleaseTrackedAlloc((Object*) result, NULL);
+    RETURN_PTR(result);
+}
+
+/*
+ * public static native void startLockProfiling()
+ *
+ * Starts keeping totals of monitor contention by site, as with
+ * -Xlockprofsites.  Only monitors locked from then on know their owner's
+ * site.
+ */
+static void Dalvik_dalvik_system_VMDebug_startLockProfiling(const u4* args,
+    JValue* pResult)
+{
+    gDvm.lockProfSites = true;
+    RETURN_VOID();
+}
+
+/*
+ * public static native void stopLockProfiling()
+ *
+ * Stops keeping contention totals.  The ones kept so far stay.
+ */
+static void Dalvik_dalvik_system_VMDebug_stopLockProfiling(const u4* args,
+    JValue* pResult)
+{
+    gDvm.lockProfSites = false;
+    RETURN_VOID();
+}
+
+/*
+ * public static native String getLockContention(int maxSites, boolean reset)
+ *
+ * Returns the time threads blocked on monitors, by waiter and owner site,
+ * the most first, at most maxSites of them or all if it is zero.  Clears
+ * the totals afterwards if "reset" is set.
+ */
+static void Dalvik_dalvik_system_VMDebug_getLockContention(const u4* args,
+    JValue* pResult)
+{
+    int maxSites = args[0];
+    bool reset = (args[1] != 0);
+    if (maxSites < 0) {
+        dvmThrowIllegalArgumentException("maxSites must not be negative");
+        RETURN_PTR(NULL);
+    }
+
+    char* buf = NULL;
+    size_t len;
+    FILE* fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        dvmThrowRuntimeException("unable to dump the lock contention");
+        RETURN_PTR(NULL);
+    }
+    DebugOutputTarget target;
+    dvmCreateFileOutputTarget(&target, fp);
+    dvmDumpContentionSites(&target, maxSites);
+    fclose(fp);
+    if (reset) {
+        dvmResetContentionSites();
+    }
+
+    StringObject* result = dvmCreateStringFromCstr(buf != NULL ? buf : "");
+    free(buf);
+    dvmReleaseTrackedAlloc((Object*) result, NULL);
+    RETURN_PTR(result);
+}
+
+/*
+ * public static native void startAllocProfiling(int intervalBytes)
+ *
+ * Starts sampling one allocation per intervalBytes allocated on each
+ * thread, aggregated by class and stack.  Forgets any earlier samples.
+ */
+static void Dalvik_dalvik_system_VMDebug_startAllocProfiling(const u4* args,
+    JValue* pResult)
+{
+    int intervalBytes = args[0];
+
+    if (intervalBytes <= 0) {
+        dvmThrowIllegalArgumentException("interval must be positive");
+        RETURN_VOID();
+    }
+    dvmAllocProfilerStart(intervalBytes);
+    RETURN_VOID();
+}
+
+/*
+ * public static native void stopAllocProfiling()
+ */
+static void Dalvik_dalvik_system_VMDebug_stopAllocProfiling(const u4* args,
+    JValue* pResult)
+{
+    dvmAllocProfilerStop();
+    RETURN_VOID();
+}
+
+/*
+ * public static native void dumpAllocProfile(String fileName, boolean counts)
+ *
+ * Writes the sampled allocation sites as folded stacks, weighted by the
+ * estimated bytes allocated or, if "counts" is set, by the number of
+ * samples.
+ */
+static void Dalvik_dalvik_system_VMDebug_dumpAllocProfile(const u4* args,
+    JValue* pResult)
+{
+    StringObject* fileNameStr = (StringObject*) args[0];
+    bool counts = args[1];
+
+    if (fileNameStr == NULL) {
+        dvmThrowNullPointerException("fileName == null");
+        RETURN_VOID();
+    }
+    char* fileName = dvmCreateCstrFromString(fileNameStr);
+    if (fileName == NULL) {
+        /* unexpected -- malloc failure? */
+        dvmThrowRuntimeException("malloc failure?");
+        RETURN_VOID();
+    }
+    if (!dvmAllocProfilerDump(fileName, counts)) {
+        dvmThrowRuntimeException("failure writing allocation profile");
+    }
+    free(fileName);
+    RETURN_VOID();
+}
+
+/*
+ * public static native boolean startJitSampling(int intervalMs)
+ *
+ * Starts sampling which translations, or which interpreted methods, the
+ * running threads are in.  Returns false if the JIT isn't running.
+ */
+static void Dalvik_dalvik_system_VMDebug_startJitSampling(const u4* args,
+    JValue* pResult)
+{
+    int intervalMs = args[0];
+    bool started = false;
+
+    if (intervalMs <= 0) {
+        dvmThrowIllegalArgumentException("interval must be positive");
+        RETURN_BOOLEAN(false);
+    }
+#if defined(WITH_JIT)
+    if (gDvm.executionMode == kExecutionModeJit) {
+        started = dvmJitSamplerStart(intervalMs);
+    }
+#endif
+    RETURN_BOOLEAN(started);
+}
+
+/*
+ * public static native void stopJitSampling()
+ */
+static void Dalvik_dalvik_system_VMDebug_stopJitSampling(const u4* args,
+    JValue* pResult)
+{
+#if defined(WITH_JIT)
+    if (gDvm.executionMode == kExecutionModeJit) {
+        dvmJitSamplerStop();
+    }
+#endif
+    RETURN_VOID();
+}
+
+/*
+ * public static native String getJitSamples()
+ *
+ * Returns the translations and interpreted methods that were sampled
+ * most often, and the share of the samples spent in compiled code.
+ */
+static void Dalvik_dalvik_system_VMDebug_getJitSamples(const u4* args,
+    JValue* pResult)
+{
+    char* buf = NULL;
+    size_t len;
+    FILE* fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        dvmThrowRuntimeException("unable to dump the JIT samples");
+        RETURN_PTR(NULL);
+    }
+#if defined(WITH_JIT)
+    if (gDvm.executionMode == kExecutionModeJit) {
+        DebugOutputTarget target;
+        dvmCreateFileOutputTarget(&target, fp);
+        dvmJitSamplerDump(&target);
+    }
+#endif
+    fclose(fp);
+
+    StringObject* result = dvmCreateStringFromCstr(buf != NULL ? buf : "");
+    free(buf);
+    dvmReleaseTrackedAlloc((Object*) result, NULL);
+    RETURN_PTR(result);
+}
+
 /*
  * public static native void getHeapSpaceStats(long[] data)
  */
@@ -814,6 +1101,35 @@ static void Dalvik_dalvik_system_VMDebug_getHeapSpaceStats(const u4* args,
     RETURN_VOID();
 }
 
+/*
+ * public static native void getFinalizerStats(long[] data)
+ *
+ * Fills in the number of objects waiting for their finalize() to run,
+ * the age in msec of the oldest of them, and the number queued for
+ * finalization since startup.
+ */
+static void Dalvik_dalvik_system_VMDebug_getFinalizerStats(const u4* args,
+    JValue* pResult)
+{
+    ArrayObject* dataArray = (ArrayObject*) args[0];
+
+    if (dataArray == NULL || dataArray->length < 3) {
+      RETURN_VOID();
+    }
+
+    jlong* arr = (jlong*)(void*)dataArray->contents;
+
+    size_t numPending;
+    u4 oldestAgeMsec;
+    u8 totalQueued;
+    dvmHeapGetFinalizerStats(&numPending, &oldestAgeMsec, &totalQueued);
+    arr[0] = numPending;
+    arr[1] = oldestAgeMsec;
+    arr[2] = totalQueued;
+
+    RETURN_VOID();
+}
+
 const DalvikNativeMethod dvm_dalvik_system_VMDebug[] = {
     { "getVmFeatureList",           "()[Ljava/lang/String;",
         Dalvik_dalvik_system_VMDebug_getVmFeatureList },
@@ -821,6 +1137,8 @@ const DalvikNativeMethod dvm_dalvik_system_VMDebug[] = {
         Dalvik_dalvik_system_VMDebug_getAllocCount },
     { "getHeapSpaceStats",          "([J)V",
         Dalvik_dalvik_system_VMDebug_getHeapSpaceStats },
+    { "getFinalizerStats",          "([J)V",
+        Dalvik_dalvik_system_VMDebug_getFinalizerStats },
     { "resetAllocCount",            "(I)V",
         Dalvik_dalvik_system_VMDebug_resetAllocCount },
     { "startAllocCounting",         "()V",
@@ -875,5 +1193,29 @@ const DalvikNativeMethod dvm_dalvik_system_VMDebug[] = {
         Dalvik_dalvik_system_VMDebug_infopoint },
     { "countInstancesOfClass",     "(Ljava/lang/Class;Z)J",
         Dalvik_dalvik_system_VMDebug_countInstancesOfClass },
+    { "getGcHistory",              "()Ljava/lang/String;",
+        Dalvik_dalvik_system_VMDebug_getGcHistory },
+    { "getStartupTimeline",        "()Ljava/lang/String;",
+        Dalvik_dalvik_system_VMDebug_getStartupTimeline },
+    { "getHeapHistogram",          "(I)Ljava/lang/String;",
+        Dalvik_dalvik_system_VMDebug_getHeapHistogram },
+    { "startLockProfiling",        "()V",
+        Dalvik_dalvik_system_VMDebug_startLockProfiling },
+    { "stopLockProfiling",         "()V",
+        Dalvik_dalvik_system_VMDebug_stopLockProfiling },
+    { "getLockContention",         "(IZ)Ljava/lang/String;",
+        Dalvik_dalvik_system_VMDebug_getLockContention },
+    { "startAllocProfiling",       "(I)V",
+        Dalvik_dalvik_system_VMDebug_startAllocProfiling },
+    { "stopAllocProfiling",        "()V",
+        Dalvik_dalvik_system_VMDebug_stopAllocProfiling },
+    { "dumpAllocProfile",          "(Ljava/lang/String;Z)V",
+        Dalvik_dalvik_system_VMDebug_dumpAllocProfile },
+    { "startJitSampling",          "(I)Z",
+        Dalvik_dalvik_system_VMDebug_startJitSampling },
+    { "stopJitSampling",           "()V",
+        Dalvik_dalvik_system_VMDebug_stopJitSampling },
+    { "getJitSamples",             "()Ljava/lang/String;",
+        Dalvik_dalvik_system_VMDebug_getJitSamples },
     { NULL, NULL, NULL },
 };
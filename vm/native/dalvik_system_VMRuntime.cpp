@@ -111,9 +111,8 @@ static void Dalvik_dalvik_system_VMRuntime_newNonMovableArray(const u4* args,
         RETURN_PTR(NULL);
     }
 
-    // TODO: right now, we don't have a copying collector, so there's no need
-    // to do anything special here, but we ought to pass the non-movability
-    // through to the allocator.
+    // The heap compaction must not move these, which dvmMalloc()
+    // records from the allocation flags.
     ClassObject* arrayClass = dvmFindArrayClassForElement(elementClass);
     ArrayObject* newArray = dvmAllocArrayByClass(arrayClass,
                                                  length,
@@ -239,9 +238,23 @@ static void Dalvik_dalvik_system_VMRuntime_registerNativeFree(const u4* args,
   RETURN_VOID();
 }
 
+/*
+ * The process states passed in by the framework.
+ */
+enum {
+    kProcessStateJankPerceptible = 0,
+    kProcessStateJankImperceptible = 1,
+};
+
 static void Dalvik_dalvik_system_VMRuntime_updateProcessState(const u4* args,
                                                               JValue* pResult)
 {
+  int state = args[1];
+  // Once pauses no longer matter to the user, squeeze the heap.
+  if (state == kProcessStateJankImperceptible) {
+    dvmHeapSourceLogZygoteSharing();
+    dvmRequestHeapCompaction();
+  }
   RETURN_VOID();
 }
 
@@ -18,7 +18,6 @@
  * dalvik.system.VMStack
  */
 #include "Dalvik.h"
-#include "UniquePtr.h"
 #include "native/InternalNativePriv.h"
 
 /*
@@ -55,40 +54,54 @@ static void Dalvik_dalvik_system_VMStack_getStackClass2(const u4* args,
     RETURN_PTR(clazz);
 }
 
+/*
+ * Walk the stack for getClasses(), counting the classes it returns and,
+ * if "classes" isn't NULL, storing them.  Break frames don't count
+ * toward the ones skipped; reflection frames are skipped but do.
+ */
+static size_t walkStackClasses(const void* fp, size_t maxSize,
+    ArrayObject* classes)
+{
+    size_t skip = 2;
+    size_t count = 0;
+
+    for (; fp != NULL && count < maxSize; fp = SAVEAREA_FROM_FP(fp)->prevFrame) {
+        const Method* meth = SAVEAREA_FROM_FP(fp)->method;
+
+        if (meth == NULL)
+            continue;           /* break frame */
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        if (dvmIsReflectionMethod(meth))
+            continue;
+
+        if (classes != NULL)
+            dvmSetObjectArrayElement(classes, count, (Object*) meth->clazz);
+        count++;
+    }
+    return count;
+}
+
 /*
  * public static Class<?>[] getClasses(int maxDepth)
  *
  * Create an array of classes for the methods on the stack, skipping the
  * first two and all reflection methods.  If "stopAtPrivileged" is set,
  * stop shortly after we encounter a privileged class.
+ *
+ * The frames are walked twice, once to size the array and once to fill
+ * it, rather than copied out, so deep stacks needn't be copied to find
+ * the first few classes.
  */
 static void Dalvik_dalvik_system_VMStack_getClasses(const u4* args,
     JValue* pResult)
 {
     /* note "maxSize" is unsigned, so -1 turns into a very large value */
     size_t maxSize = args[0];
-    size_t size = 0;
-    const size_t kSkip = 2;
-
-    /*
-     * Get an array with the stack trace in it.
-     */
-    void *fp = dvmThreadSelf()->interpSave.curFrame;
-    size_t depth = dvmComputeExactFrameDepth(fp);
-    UniquePtr<const Method*[]> methods(new const Method*[depth]);
-    dvmFillStackTraceArray(fp, methods.get(), depth);
-
-    /*
-     * Run through the array and count up how many elements there are.
-     */
-    for (size_t i = kSkip; i < depth && size < maxSize; ++i) {
-        const Method* meth = methods[i];
-
-        if (dvmIsReflectionMethod(meth))
-            continue;
-
-        size++;
-    }
+    const void* fp = dvmThreadSelf()->interpSave.curFrame;
+    size_t size = walkStackClasses(fp, maxSize, NULL);
 
     /*
      * Create an array object to hold the classes.
@@ -111,15 +124,7 @@ static void Dalvik_dalvik_system_VMStack_getClasses(const u4* args,
     /*
      * Fill in the array.
      */
-    size_t objCount = 0;
-    for (size_t i = kSkip; i < depth; ++i) {
-        if (dvmIsReflectionMethod(methods[i])) {
-            continue;
-        }
-        Object* klass = (Object *)methods[i]->clazz;
-        dvmSetObjectArrayElement(classes, objCount, klass);
-        objCount++;
-    }
+    size_t objCount = walkStackClasses(fp, size, classes);
     assert(objCount == classes->length);
 
     dvmReleaseTrackedAlloc((Object*)classes, NULL);
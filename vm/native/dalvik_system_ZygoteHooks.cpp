@@ -22,6 +22,7 @@
 #include "native/InternalNativePriv.h"
 
 #include <sys/resource.h>
+#include <unistd.h>
 
 #if defined(HAVE_PRCTL)
 # include <sys/prctl.h>
@@ -122,10 +123,29 @@ static void Dalvik_dalvik_system_ZygoteHooks_preFork(const u4* args,
         RETURN_LONG(-1L);
     }
 
+    dvmStartupTimelineBegin("preFork");
+
+    /*
+     * Preloading is done, so resolve the constants the preloaded code
+     * will need, once, into the heap the children share.  This goes
+     * before the heap is packed for the fork.
+     */
+    static bool preresolved = false;
+    if (gDvm.preresolveZygote && !preresolved) {
+        dvmPreresolveLoadedClasses();
+        preresolved = true;
+        dvmStartupTimelineMark("preresolve");
+    }
+
     if (!dvmGcPreZygoteFork()) {
         ALOGE("pre-fork heap failed");
         dvmAbort();
     }
+    dvmStartupTimelineMark("heap");
+
+    /* preloading is done; only the first fork finds anything to record */
+    dvmStartupPagesRecord();
+    dvmStartupTimelineMark("startup-pages");
 
     RETURN_LONG(0L);
 }
@@ -136,6 +156,8 @@ static void Dalvik_dalvik_system_ZygoteHooks_preFork(const u4* args,
 static void Dalvik_dalvik_system_ZygoteHooks_postForkChild(
         const u4* args, JValue* pResult)
 {
+    dvmStartupTimelineBegin("postForkChild");
+
     /*
      * Our system thread ID has changed.  Get the new one.
      */
@@ -144,6 +166,7 @@ static void Dalvik_dalvik_system_ZygoteHooks_postForkChild(
 
     /* configure additional debug options */
     enableDebugFeatures(args[2]);
+    dvmStartupTimelineMark("debug-features");
 
     gDvm.zygote = false;
     if (!dvmInitAfterZygote()) {
@@ -154,10 +177,176 @@ static void Dalvik_dalvik_system_ZygoteHooks_postForkChild(
     RETURN_VOID();
 }
 
+/*
+ * The most threads preloadClasses() will use, counting the caller.
+ */
+#define kMaxPreloadThreads  8
+
+/*
+ * Work shared by the threads of one preloadClasses() call.  Each thread
+ * claims the next descriptor in turn, so a class that takes long to load
+ * doesn't hold up the rest of a fixed share.
+ */
+struct PreloadWork {
+    char**          descriptors;
+    int             count;
+    bool            initialize;
+    volatile int32_t next;
+    volatile int32_t loaded;
+};
+
+/*
+ * Load, link and, if asked to, initialize the classes in "work" until
+ * there are none left to claim.  Failures are logged and skipped, as the
+ * zygote does for a sequential preload.
+ *
+ * Two threads that need a class at the same time meet in
+ * findClassNoInit() and dvmInitClass(), where the one that got there
+ * second waits on the class object for the first to finish.
+ */
+static void preloadClassesFrom(PreloadWork* work)
+{
+    Thread* self = dvmThreadSelf();
+
+    while (true) {
+        int i = android_atomic_inc(&work->next);
+        if (i >= work->count)
+            break;
+
+        const char* descriptor = work->descriptors[i];
+        ClassObject* clazz = dvmFindSystemClassNoInit(descriptor);
+        if (clazz == NULL) {
+            ALOGW("Class not found for preloading: %s", descriptor);
+            dvmClearException(self);
+            continue;
+        }
+        if (work->initialize && !dvmInitClass(clazz)) {
+            ALOGW("Error initializing preloaded class %s", descriptor);
+            dvmClearException(self);
+            continue;
+        }
+        android_atomic_inc(&work->loaded);
+    }
+}
+
+static void* preloadThreadStart(void* arg)
+{
+    preloadClassesFrom((PreloadWork*) arg);
+    return NULL;
+}
+
+/*
+ * native public static int preloadClasses(String[] names, int numThreads,
+ *     boolean initialize)
+ *
+ * Loads and links the named classes from the boot class path on up to
+ * "numThreads" threads (the number of online CPUs if it's zero or less),
+ * and returns the number that were found.
+ *
+ * With "initialize", each thread also runs the initializers of the classes
+ * it loads, in whatever order the split and the dependencies between them
+ * produce.  As with any Java threads, that deadlocks if the initializers
+ * of two classes need each other and start on different threads.
+ * Otherwise the calling thread initializes them afterward, in list order,
+ * and only the loading and linking runs in parallel.
+ *
+ * The extra threads have all exited by the time this returns, so the
+ * zygote can still fork.
+ */
+static void Dalvik_dalvik_system_ZygoteHooks_preloadClasses(
+        const u4* args, JValue* pResult)
+{
+    ArrayObject* names = (ArrayObject*) args[0];
+    int numThreads = args[1];
+    bool initialize = (args[2] != 0);
+    Thread* self = dvmThreadSelf();
+
+    if (names == NULL) {
+        dvmThrowNullPointerException("names == null");
+        RETURN_INT(0);
+    }
+
+    /*
+     * Take copies of the names now, so the threads needn't touch the
+     * array or its strings.
+     */
+    PreloadWork work;
+    work.count = names->length;
+    work.descriptors = (char**) calloc(work.count, sizeof(char*));
+    if (work.descriptors == NULL && work.count != 0) {
+        dvmThrowOutOfMemoryError("preloadClasses");
+        RETURN_INT(0);
+    }
+    StringObject** contents = (StringObject**)(void*) names->contents;
+    for (int i = 0; i < work.count; i++) {
+        if (contents[i] == NULL) {
+            for (int j = 0; j < i; j++)
+                free(work.descriptors[j]);
+            free(work.descriptors);
+            dvmThrowNullPointerException("names[i] == null");
+            RETURN_INT(0);
+        }
+        char* name = dvmCreateCstrFromString(contents[i]);
+        work.descriptors[i] = dvmDotToDescriptor(name);
+        free(name);
+    }
+    work.initialize = initialize;
+    work.next = 0;
+    work.loaded = 0;
+
+    if (numThreads <= 0)
+        numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    numThreads = MAX(MIN(numThreads, kMaxPreloadThreads), 1);
+    numThreads = MIN(numThreads, MAX(work.count, 1));
+
+    pthread_t handles[kMaxPreloadThreads];
+    int numHelpers = 0;
+    for (int i = 1; i < numThreads; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Preload %d", i);
+        if (!dvmCreateInternalThread(&handles[numHelpers], name,
+                preloadThreadStart, &work)) {
+            ALOGW("Unable to start preload thread %d", i);
+            break;
+        }
+        numHelpers++;
+    }
+
+    preloadClassesFrom(&work);
+
+    /* the helpers may need a GC, which would have to suspend us */
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+    for (int i = 0; i < numHelpers; i++) {
+        if (pthread_join(handles[i], NULL) != 0)
+            ALOGW("Preload thread %d join failed", i + 1);
+    }
+    dvmChangeStatus(self, oldStatus);
+
+    if (!initialize) {
+        for (int i = 0; i < work.count; i++) {
+            ClassObject* clazz = dvmLookupClass(work.descriptors[i], NULL,
+                false);
+            if (clazz != NULL && !dvmInitClass(clazz)) {
+                ALOGW("Error initializing preloaded class %s",
+                    work.descriptors[i]);
+                dvmClearException(self);
+            }
+        }
+    }
+
+    for (int i = 0; i < work.count; i++)
+        free(work.descriptors[i]);
+    free(work.descriptors);
+
+    RETURN_INT(work.loaded);
+}
+
 const DalvikNativeMethod dvm_dalvik_system_ZygoteHooks[] = {
     { "nativePreFork", "()J",
       Dalvik_dalvik_system_ZygoteHooks_preFork },
     { "nativePostForkChild", "(JI)V",
       Dalvik_dalvik_system_ZygoteHooks_postForkChild },
+    { "preloadClasses", "([Ljava/lang/String;IZ)I",
+      Dalvik_dalvik_system_ZygoteHooks_preloadClasses },
     { NULL, NULL, NULL },
 };
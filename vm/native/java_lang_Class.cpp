@@ -365,6 +365,15 @@ static void Dalvik_java_lang_Class_getNameNative(const u4* args, JValue* pResult
     const char* descriptor = clazz->descriptor;
     StringObject* nameObj;
 
+    /*
+     * The name never changes, so the first caller interns it and leaves
+     * it on the class for everybody else.
+     */
+    nameObj = (StringObject*)
+        android_atomic_acquire_load((int32_t*) &clazz->nameString);
+    if (nameObj != NULL)
+        RETURN_PTR(nameObj);
+
     if ((descriptor[0] != 'L') && (descriptor[0] != '[')) {
         /*
          * The descriptor indicates that this is the class for
@@ -392,20 +401,39 @@ static void Dalvik_java_lang_Class_getNameNative(const u4* args, JValue* pResult
     } else {
         /*
          * Convert the UTF-8 name to a java.lang.String. The
-         * name must use '.' to separate package components.
-         *
-         * TODO: this could be more efficient. Consider a custom
-         * conversion function here that walks the string once and
-         * avoids the allocation for the common case (name less than,
-         * say, 128 bytes).
+         * name must use '.' to separate package components.  Arrays
+         * keep their descriptor form; other classes lose the "L" and
+         * ";".  The common case converts on the stack.
          */
-        char* dotName = dvmDescriptorToDot(clazz->descriptor);
+        size_t len = strlen(descriptor);
+        if (descriptor[0] == 'L') {
+            descriptor++;
+            len -= 2;
+        }
+        char buf[128];
+        char* dotName = (len < sizeof(buf)) ? buf : (char*) malloc(len + 1);
+        if (dotName == NULL) {
+            dvmThrowOutOfMemoryError(NULL);
+            RETURN_PTR(NULL);
+        }
+        for (size_t i = 0; i < len; i++)
+            dotName[i] = (descriptor[i] == '/') ? '.' : descriptor[i];
+        dotName[len] = '\0';
         nameObj = dvmCreateStringFromCstr(dotName);
-        free(dotName);
+        if (dotName != buf)
+            free(dotName);
     }
+    if (nameObj == NULL)
+        RETURN_PTR(NULL);
 
+    StringObject* interned = dvmLookupInternedString(nameObj);
     dvmReleaseTrackedAlloc((Object*) nameObj, NULL);
-    RETURN_PTR(nameObj);
+    if (interned == NULL)
+        RETURN_PTR(NULL);
+    android_atomic_release_store((int32_t) interned,
+        (int32_t*) &clazz->nameString);
+    dvmWriteBarrierField(clazz, &clazz->nameString);
+    RETURN_PTR(interned);
 }
 
 /*
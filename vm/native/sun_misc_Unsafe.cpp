@@ -160,7 +160,9 @@ static void Dalvik_sun_misc_Unsafe_getLongVolatile(const u4* args,
     volatile int64_t* address = (volatile int64_t*) (((u1*) obj) + offset);
 
     assert((offset & 7) == 0);
-    RETURN_LONG(dvmQuasiAtomicRead64(address));
+    int64_t value = dvmQuasiAtomicRead64(address);
+    DVM_MEMBAR_ACQUIRE();
+    RETURN_LONG(value);
 }
 
 /*
@@ -156,7 +156,11 @@ ArrayObject* dvmAllocPrimitiveArray(char type, size_t length, int allocFlags)
         return NULL; // Keeps the compiler happy.
     }
 
-    newArray = allocArray(arrayClass, length, width, allocFlags);
+    /* Primitive arrays hold no references, so a big one can go to the
+     * large object space.
+     */
+    newArray = allocArray(arrayClass, length, width,
+                          allocFlags | ALLOC_NO_REFS);
 
     /* the caller must dvmReleaseTrackedAlloc if allocFlags==ALLOC_DEFAULT */
     return newArray;
@@ -425,7 +429,7 @@ static ClassObject* createArrayClass(const char* descriptor, Object* loader)
      * We assume that Cloneable/Serializable don't have superinterfaces --
      * normally we'd have to crawl up and explicitly list all of the
      * supers as well.  These interfaces don't have any methods, so we
-     * don't have to worry about the ifviPool either.
+     * don't have to worry about their method indices either.
      */
     newClass->iftableCount = 2;
     newClass->iftable = (InterfaceEntry*) dvmLinearAlloc(newClass->classLoader,
@@ -434,6 +438,8 @@ static ClassObject* createArrayClass(const char* descriptor, Object* loader)
     newClass->iftable[0].clazz = newClass->interfaces[0];
     newClass->iftable[1].clazz = newClass->interfaces[1];
     dvmLinearReadOnly(newClass->classLoader, newClass->iftable);
+    dvmSetClassDisplay(newClass);
+    dvmSetInterfaceBits(newClass);
 
     /*
      * Inherit access flags from the element.  Arrays can't be used as a
@@ -25,6 +25,10 @@
 #include "libdex/DexClass.h"
 #include "libdex/ZipArchive.h"
 #include "analysis/Optimize.h"
+#include "oo/FieldProfile.h"
+#if defined(WITH_JIT)
+#include "compiler/JitProfile.h"
+#endif
 
 #include <stdlib.h>
 #include <stddef.h>
@@ -170,6 +174,7 @@ may not be worth the performance hit.
 
 static ClassPathEntry* processClassPath(const char* pathStr, bool isBootstrap);
 static void freeCpeArray(ClassPathEntry* cpe);
+static void buildBootClassIndex(void);
 
 static ClassObject* findClassFromLoaderNoInit(
     const char* descriptor, Object* loader);
@@ -351,6 +356,7 @@ static bool createPrimitiveType(PrimitiveType primitiveType, ClassObject** pClas
     newClass->descriptorAlloc = NULL;
     newClass->descriptor = descriptor;
     newClass->super = NULL;
+    dvmSetClassDisplay(newClass);
     newClass->status = CLASS_INITIALIZED;
 
     /* don't need to set newClass->objectSize */
@@ -416,7 +422,10 @@ bool dvmClassStartup()
     }
 
     gDvm.loadedClasses =
-        dvmHashTableCreate(256, (HashFreeFunc) dvmFreeClassInnards);
+        dvmHashTableCreateConcurrent(256, (HashFreeFunc) dvmFreeClassInnards);
+    gDvm.ifviArrays = dvmHashTableCreate(256, NULL);
+    gDvm.protoIdTable = dvmHashTableCreate(1024, free);
+    dvmInitMutex(&gDvm.directMethodsLock);
 
     gDvm.pBootLoaderAlloc = dvmLinearAllocCreate(NULL);
     if (gDvm.pBootLoaderAlloc == NULL)
@@ -433,6 +442,9 @@ bool dvmClassStartup()
      */
     gDvm.classSerialNumber = INITIAL_CLASS_SERIAL_NUMBER;
 
+    if (gDvm.fieldProfileFile != NULL)
+        dvmFieldProfileStartup(gDvm.fieldProfileFile);
+
     /*
      * Set up the table we'll use for tracking initiating loaders for
      * early classes.
@@ -460,6 +472,8 @@ bool dvmClassStartup()
     if (gDvm.bootClassPath == NULL)
         return false;
 
+    buildBootClassIndex();
+
     return true;
 }
 
@@ -472,6 +486,14 @@ void dvmClassShutdown()
     dvmHashTableFree(gDvm.loadedClasses);
     gDvm.loadedClasses = NULL;
 
+    /* the arrays themselves go with the LinearAlloc region */
+    dvmHashTableFree(gDvm.ifviArrays);
+    gDvm.ifviArrays = NULL;
+    gDvm.ifviChunk = NULL;
+    dvmHashTableFree(gDvm.protoIdTable);
+    gDvm.protoIdTable = NULL;
+    dvmDestroyMutex(&gDvm.directMethodsLock);
+
     /* discard primitive classes created for arrays */
     dvmFreeClassInnards(gDvm.typeVoid);
     dvmFreeClassInnards(gDvm.typeBoolean);
@@ -483,6 +505,9 @@ void dvmClassShutdown()
     dvmFreeClassInnards(gDvm.typeFloat);
     dvmFreeClassInnards(gDvm.typeDouble);
 
+    free(gDvm.bootClassIndex);
+    gDvm.bootClassIndex = NULL;
+
     /* this closes DEX files, JAR files, etc. */
     freeCpeArray(gDvm.bootClassPath);
     gDvm.bootClassPath = NULL;
@@ -490,6 +515,8 @@ void dvmClassShutdown()
     dvmLinearAllocDestroy(NULL);
 
     free(gDvm.initiatingLoaderList);
+
+    dvmFieldProfileShutdown();
 }
 
 
@@ -516,10 +543,14 @@ static void dumpClassPath(const ClassPathEntry* cpe)
         }
 
         ALOGI("  %2d: type=%s %s %p", idx, kindStr, cpe->fileName, cpe->ptr);
-        if (CALC_CACHE_STATS && cpe->kind == kCpeJar) {
-            JarFile* pJarFile = (JarFile*) cpe->ptr;
-            DvmDex* pDvmDex = dvmGetJarFileDex(pJarFile);
-            dvmDumpAtomicCacheStats(pDvmDex->pInterfaceCache);
+        if (cpe->kind == kCpeJar || cpe->kind == kCpeDex) {
+            DvmDex* pDvmDex = (cpe->kind == kCpeJar) ?
+                dvmGetJarFileDex((JarFile*) cpe->ptr) :
+                dvmGetRawDexFileDex((RawDexFile*) cpe->ptr);
+            size_t totalPages, committedPages;
+            dvmDexGetAuxPageCounts(pDvmDex, &totalPages, &committedPages);
+            ALOGI("      resolution tables: %zd/%zd pages committed",
+                committedPages, totalPages);
         }
 
         cpe++;
@@ -724,6 +755,8 @@ static ClassPathEntry* processClassPath(const char* pathStr, bool isBootstrap)
                 /* drop from list and continue on */
                 free(tmp.fileName);
             } else {
+                if (isBootstrap)
+                    dvmStartupTimelineMarkFile("open", tmp.fileName);
                 /* copy over, pointers and all */
                 cpe[idx] = tmp;
                 idx++;
@@ -758,6 +791,139 @@ bail:
     return cpe;
 }
 
+/*
+ * Merged class index over every DEX file in the bootstrap class path.
+ *
+ * Without this, a miss in the first few entries means probing each
+ * DEX file's DexClassLookup in turn, so finding a class in the last of
+ * a dozen jars costs a dozen hash probes.  The merged table is built
+ * once the whole class path is open, from the per-DEX lookup tables
+ * (which already hold the descriptor hash codes).  When a descriptor
+ * appears in more than one entry the earliest one wins, matching the
+ * order of the linear search.
+ *
+ * Like the per-DEX tables it's open-addressed and at most half full.
+ */
+struct BootClassIndexEntry {
+    u4                  hash;           /* class descriptor hash code */
+    u4                  dexIdx;         /* index into pDexes[] */
+    const DexClassDef*  pClassDef;      /* NULL for an empty slot */
+};
+
+struct BootClassIndex {
+    u4                  mask;           /* numEntries - 1 */
+    DvmDex**            pDexes;         /* points past the table */
+    BootClassIndexEntry table[1];
+};
+
+/*
+ * Get the DvmDex for a class path entry, or NULL if it isn't open or is
+ * of an unknown kind.
+ */
+static DvmDex* getCpeDvmDex(const ClassPathEntry* cpe)
+{
+    if (cpe->ptr == NULL)
+        return NULL;
+
+    switch (cpe->kind) {
+    case kCpeJar:
+        return dvmGetJarFileDex((JarFile*) cpe->ptr);
+    case kCpeDex:
+        return dvmGetRawDexFileDex((RawDexFile*) cpe->ptr);
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Find the index slot that holds "descriptor", or the empty slot where
+ * it would go.
+ */
+static BootClassIndexEntry* findBootClassIndexSlot(BootClassIndex* pIndex,
+    const char* descriptor, u4 hash)
+{
+    u4 idx = hash & pIndex->mask;
+
+    while (true) {
+        BootClassIndexEntry* pEntry = &pIndex->table[idx];
+        if (pEntry->pClassDef == NULL)
+            return pEntry;
+        if (pEntry->hash == hash) {
+            const DexFile* pDexFile = pIndex->pDexes[pEntry->dexIdx]->pDexFile;
+            const char* str =
+                dexStringByTypeIdx(pDexFile, pEntry->pClassDef->classIdx);
+            if (strcmp(str, descriptor) == 0)
+                return pEntry;
+        }
+        idx = (idx + 1) & pIndex->mask;
+    }
+}
+
+/*
+ * Build gDvm.bootClassIndex from the open bootstrap class path.  If we
+ * can't, lookups just fall back to scanning the entries.
+ */
+static void buildBootClassIndex()
+{
+    const ClassPathEntry* cpe;
+    u4 numDexes = 0, numClasses = 0;
+
+    assert(gDvm.bootClassIndex == NULL);
+
+    for (cpe = gDvm.bootClassPath; cpe->kind != kCpeLastEntry; cpe++) {
+        DvmDex* pDvmDex = getCpeDvmDex(cpe);
+        if (pDvmDex == NULL)
+            return;
+        numDexes++;
+        numClasses += pDvmDex->pHeader->classDefsSize;
+    }
+    if (numClasses == 0)
+        return;
+
+    u4 numEntries = dexRoundUpPower2(numClasses * 2);
+    size_t tableSize = offsetof(BootClassIndex, table) +
+        numEntries * sizeof(BootClassIndexEntry);
+    BootClassIndex* pIndex =
+        (BootClassIndex*) calloc(1, tableSize + numDexes * sizeof(DvmDex*));
+    if (pIndex == NULL) {
+        ALOGW("Unable to allocate boot class index (%d classes)", numClasses);
+        return;
+    }
+    pIndex->mask = numEntries - 1;
+    pIndex->pDexes = (DvmDex**) ((u1*) pIndex + tableSize);
+
+    u4 dexIdx = 0;
+    for (cpe = gDvm.bootClassPath; cpe->kind != kCpeLastEntry; cpe++) {
+        DvmDex* pDvmDex = getCpeDvmDex(cpe);
+        const DexFile* pDexFile = pDvmDex->pDexFile;
+        const DexClassLookup* pLookup = pDexFile->pClassLookup;
+
+        pIndex->pDexes[dexIdx] = pDvmDex;
+        for (int i = 0; i < pLookup->numEntries; i++) {
+            if (pLookup->table[i].classDescriptorOffset == 0)
+                continue;
+
+            const char* descriptor = (const char*) (pDexFile->baseAddr +
+                pLookup->table[i].classDescriptorOffset);
+            u4 hash = pLookup->table[i].classDescriptorHash;
+            BootClassIndexEntry* pEntry =
+                findBootClassIndexSlot(pIndex, descriptor, hash);
+            if (pEntry->pClassDef != NULL)
+                continue;       /* shadowed by an earlier entry */
+
+            pEntry->hash = hash;
+            pEntry->dexIdx = dexIdx;
+            pEntry->pClassDef = (const DexClassDef*)
+                (pDexFile->baseAddr + pLookup->table[i].classDefOffset);
+        }
+        dexIdx++;
+    }
+
+    ALOGV("Boot class index: %d classes from %d DEX files, %d slots",
+        numClasses, numDexes, numEntries);
+    gDvm.bootClassIndex = pIndex;
+}
+
 /*
  * Search the DEX files we loaded from the bootstrap class path for a DEX
  * file that has the class with the matching descriptor.
@@ -772,10 +938,24 @@ static DvmDex* searchBootPathForClass(const char* descriptor,
     const DexClassDef* pFoundDef = NULL;
     DvmDex* pFoundFile = NULL;
 
+    if (gDvm.bootClassIndex != NULL) {
+        BootClassIndex* pIndex = gDvm.bootClassIndex;
+        BootClassIndexEntry* pEntry = findBootClassIndexSlot(pIndex,
+            descriptor, dexClassDescriptorHash(descriptor));
+        if (pEntry->pClassDef != NULL) {
+            pFoundDef = pEntry->pClassDef;
+            pFoundFile = pIndex->pDexes[pEntry->dexIdx];
+            goto found;
+        }
+
+        /* not in any entry; skip straight to the "extra" DEX */
+        cpe = NULL;
+    }
+
     LOGVV("+++ class '%s' not yet loaded, scanning bootclasspath...",
         descriptor);
 
-    while (cpe->kind != kCpeLastEntry) {
+    while (cpe != NULL && cpe->kind != kCpeLastEntry) {
         //ALOGV("+++  checking '%s' (%d)", cpe->fileName, cpe->kind);
 
         switch (cpe->kind) {
@@ -855,6 +1035,41 @@ void dvmSetBootPathExtraDex(DvmDex* pDvmDex)
     gDvm.bootClassPathOptExtra = pDvmDex;
 }
 
+/*
+ * Load (but don't initialize) every class defined in the bootstrap class
+ * path.  Classes that fail to load are skipped.  Returns the number that
+ * were loaded.
+ *
+ * This is only useful to a process that is going to fork off workers
+ * which all want the same classes, e.g. batch dexopt.
+ */
+int dvmLoadAllBootClasses()
+{
+    const ClassPathEntry* cpe;
+    int loaded = 0;
+
+    for (cpe = gDvm.bootClassPath; cpe->kind != kCpeLastEntry; cpe++) {
+        DvmDex* pDvmDex = getCpeDvmDex(cpe);
+        if (pDvmDex == NULL)
+            continue;
+
+        const DexFile* pDexFile = pDvmDex->pDexFile;
+        u4 count = pDexFile->pHeader->classDefsSize;
+        for (u4 idx = 0; idx < count; idx++) {
+            const DexClassDef* pClassDef = dexGetClassDef(pDexFile, idx);
+            const char* descriptor =
+                dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
+            if (dvmFindSystemClassNoInit(descriptor) != NULL) {
+                loaded++;
+            } else {
+                dvmClearOptException(dvmThreadSelf());
+            }
+        }
+    }
+
+    return loaded;
+}
+
 
 /*
  * Return the #of entries in the bootstrap class path.
@@ -939,6 +1154,9 @@ struct ClassMatchCriteria {
     Object*     loader;
 };
 
+/* the dvmLookupClass calls that went on to search with the lock held */
+static u4 gClassLookupRetries = 0;
+
 #define kInitLoaderInc  4       /* must be power of 2 */
 
 static InitiatingLoaderList *dvmGetInitiatingLoaderList(ClassObject* clazz)
@@ -956,12 +1174,10 @@ static InitiatingLoaderList *dvmGetInitiatingLoaderList(ClassObject* clazz)
 /*
  * Determine if "loader" appears in clazz' initiating loader list.
  *
- * The class hash table lock must be held when calling here, since
- * it's also used when updating a class' initiating loader list.
- *
- * TODO: switch to some sort of lock-free data structure so we don't have
- * to grab the lock to do a lookup.  Among other things, this would improve
- * the speed of compareDescriptorClasses().
+ * This doesn't need the class hash table lock.  dvmAddInitiatingLoader
+ * publishes a new list before the count that covers it, and never frees
+ * a list a reader might still be scanning.  A loader that is being added
+ * right now may not be seen.
  */
 bool dvmLoaderInInitiatingList(const ClassObject* clazz, const Object* loader)
 {
@@ -978,11 +1194,15 @@ bool dvmLoaderInInitiatingList(const ClassObject* clazz, const Object* loader)
      */
     /* Cast to remove the const from clazz, but use const loaderList */
     ClassObject* nonConstClazz = (ClassObject*) clazz;
-    const InitiatingLoaderList *loaderList =
+    InitiatingLoaderList *loaderList =
         dvmGetInitiatingLoaderList(nonConstClazz);
+    int count = android_atomic_acquire_load(
+        (volatile int32_t*) &loaderList->initiatingLoaderCount);
+    Object** loaders = (Object**) android_atomic_acquire_load(
+        (volatile int32_t*) &loaderList->initiatingLoaders);
     int i;
-    for (i = loaderList->initiatingLoaderCount-1; i >= 0; --i) {
-        if (loaderList->initiatingLoaders[i] == loader) {
+    for (i = count-1; i >= 0; --i) {
+        if (loaders[i] == loader) {
             //ALOGI("+++ found initiating match %p in %s",
             //    loader, clazz->descriptor);
             return true;
@@ -1021,32 +1241,40 @@ void dvmAddInitiatingLoader(ClassObject* clazz, Object* loader)
 
         /*
          * The list never shrinks, so we just keep a count of the
-         * number of elements in it, and reallocate the buffer when
-         * we run off the end.
+         * number of elements in it, and double the buffer when we run
+         * off the end: at zero, at kInitLoaderInc, and at each power of
+         * two past it.
          *
-         * The pointer is initially NULL, so we *do* want to call realloc
-         * when count==0.
+         * dvmLoaderInInitiatingList reads the list without the lock, so
+         * the new buffer is published before the count, and the old one
+         * is never freed.  Since the buffer doubles, the abandoned ones
+         * add up to less than the live one.
          */
         InitiatingLoaderList *loaderList = dvmGetInitiatingLoaderList(clazz);
-        if ((loaderList->initiatingLoaderCount & (kInitLoaderInc-1)) == 0) {
+        int count = loaderList->initiatingLoaderCount;
+        if (count == 0 || (count >= kInitLoaderInc && (count & (count-1)) == 0)) {
+            int newCapacity = (count == 0) ? kInitLoaderInc : count * 2;
             Object** newList;
 
-            newList = (Object**) realloc(loaderList->initiatingLoaders,
-                        (loaderList->initiatingLoaderCount + kInitLoaderInc)
-                         * sizeof(Object*));
+            newList = (Object**) malloc(newCapacity * sizeof(Object*));
             if (newList == NULL) {
                 /* this is mainly a cache, so it's not the EotW */
                 assert(false);
                 goto bail_unlock;
             }
-            loaderList->initiatingLoaders = newList;
+            if (count != 0) {
+                memcpy(newList, loaderList->initiatingLoaders,
+                    count * sizeof(Object*));
+            }
+            android_atomic_release_store((int32_t) newList,
+                (volatile int32_t*) &loaderList->initiatingLoaders);
 
             //ALOGI("Expanded init list to %d (%s)",
-            //    loaderList->initiatingLoaderCount+kInitLoaderInc,
-            //    clazz->descriptor);
+            //    newCapacity, clazz->descriptor);
         }
-        loaderList->initiatingLoaders[loaderList->initiatingLoaderCount++] =
-            loader;
+        loaderList->initiatingLoaders[count] = loader;
+        android_atomic_release_store(count + 1,
+            &loaderList->initiatingLoaderCount);
 
 bail_unlock:
         dvmHashTableUnlock(gDvm.loadedClasses);
@@ -1063,7 +1291,7 @@ bail_unlock:
  * loader is in the hashed class' initiating loader list.  If so, we
  * can return "true" immediately and skip some of the loadClass melodrama.
  *
- * The caller must lock the hash table before calling here.
+ * This is safe to call without the hash table lock.
  *
  * Returns 0 if a matching entry is found, nonzero otherwise.
  */
@@ -1118,6 +1346,10 @@ static int hashcmpClassByClass(const void* vclazz, const void* vaddclazz)
  * such classes are ignored.  (The only place that should set "unprepOkay"
  * is findClassNoInit(), which will wait for the prep to finish.)
  *
+ * The table is searched without its lock first.  Only if that comes up
+ * empty, which it also may while another thread is adding to the table,
+ * do we search again with the lock.
+ *
  * Returns NULL if not found.
  */
 ClassObject* dvmLookupClass(const char* descriptor, Object* loader,
@@ -1134,10 +1366,15 @@ ClassObject* dvmLookupClass(const char* descriptor, Object* loader,
     LOGVV("threadid=%d: dvmLookupClass searching for '%s' %p",
         dvmThreadSelf()->threadId, descriptor, loader);
 
-    dvmHashTableLock(gDvm.loadedClasses);
-    found = dvmHashTableLookup(gDvm.loadedClasses, hash, &crit,
-                hashcmpClassByCrit, false);
-    dvmHashTableUnlock(gDvm.loadedClasses);
+    found = dvmHashTableLookupConcurrent(gDvm.loadedClasses, hash, &crit,
+                hashcmpClassByCrit, NULL);
+    if (found == NULL) {
+        dvmHashTableLock(gDvm.loadedClasses);
+        gClassLookupRetries++;
+        found = dvmHashTableLookup(gDvm.loadedClasses, hash, &crit,
+                    hashcmpClassByCrit, false);
+        dvmHashTableUnlock(gDvm.loadedClasses);
+    }
 
     /*
      * The class has been added to the hash table but isn't ready for use.
@@ -1190,26 +1427,27 @@ bool dvmAddClassToHash(ClassObject* clazz)
     return (found == (void*) clazz);
 }
 
-#if 0
 /*
  * Compute hash value for a class.
  */
-u4 hashcalcClass(const void* item)
+static u4 hashcalcClass(const void* item)
 {
     return dvmComputeUtf8Hash(((const ClassObject*) item)->descriptor);
 }
 
 /*
- * Check the performance of the "loadedClasses" hash table.
+ * Check the performance of the "loadedClasses" hash table: how far its
+ * entries are from their home slots, and how often a lookup without the
+ * lock had to be retried with it.
  */
 void dvmCheckClassTablePerf()
 {
     dvmHashTableLock(gDvm.loadedClasses);
     dvmHashTableProbeCount(gDvm.loadedClasses, hashcalcClass,
         hashcmpClassByClass);
+    ALOGI("Class lookups retried with the lock: %u", gClassLookupRetries);
     dvmHashTableUnlock(gDvm.loadedClasses);
 }
-#endif
 
 /*
  * Remove a class object from the hash table.
@@ -1629,15 +1867,15 @@ static ClassObject* findClassNoInit(const char* descriptor, Object* loader,
         dvmUnlockObject(self, (Object*) clazz);
 
         /*
-         * Add class stats to global counters.
-         *
-         * TODO: these should probably be atomic ops.
+         * Add class stats to global counters.  Classes can be loaded on
+         * several threads at once, e.g. by ZygoteHooks.preloadClasses().
          */
-        gDvm.numLoadedClasses++;
-        gDvm.numDeclaredMethods +=
-            clazz->virtualMethodCount + clazz->directMethodCount;
-        gDvm.numDeclaredInstFields += clazz->ifieldCount;
-        gDvm.numDeclaredStaticFields += clazz->sfieldCount;
+        android_atomic_inc(&gDvm.numLoadedClasses);
+        android_atomic_add(
+            clazz->virtualMethodCount + clazz->directMethodCount,
+            &gDvm.numDeclaredMethods);
+        android_atomic_add(clazz->ifieldCount, &gDvm.numDeclaredInstFields);
+        android_atomic_add(clazz->sfieldCount, &gDvm.numDeclaredStaticFields);
 
         /*
          * Cache pointers to basic classes.  We want to use these in
@@ -1862,7 +2100,8 @@ static ClassObject* loadClassFromDex0(DvmDex* pDvmDex,
      * If register maps have already been generated for this class, and
      * precise GC is enabled, we pull out pointers to them.  We know that
      * they were streamed to the DEX file in the same order in which the
-     * methods appear.
+     * methods appear.  Liveness maps stored with them are kept for the
+     * JIT whether or not GC is precise.
      *
      * If the class wasn't pre-verified, the maps will be generated when
      * the class is verified during class initialization.
@@ -1871,7 +2110,11 @@ static ClassObject* loadClassFromDex0(DvmDex* pDvmDex,
     const void* classMapData;
     u4 numMethods;
 
-    if (gDvm.preciseGc) {
+    bool wantMaps = gDvm.preciseGc;
+#if defined(WITH_JIT)
+    wantMaps |= (gDvm.executionMode == kExecutionModeJit);
+#endif
+    if (wantMaps) {
         classMapData =
             dvmRegisterMapGetClassData(pDexFile, classDefIdx, &numMethods);
 
@@ -1890,27 +2133,23 @@ static ClassObject* loadClassFromDex0(DvmDex* pDvmDex,
     }
 
     if (pHeader->directMethodsSize != 0) {
+        /*
+         * Just note where the direct methods are, and step past them and
+         * their maps.  dvmGetDirectMethods() builds them when they're
+         * first needed.
+         */
         int count = (int) pHeader->directMethodsSize;
         u4 lastIndex = 0;
         DexMethod method;
 
         newClass->directMethodCount = count;
-        newClass->directMethods = (Method*) dvmLinearAlloc(classLoader,
-                count * sizeof(Method));
+        newClass->directMethodData = pEncodedData;
+        newClass->directMapData = classMapData;
         for (i = 0; i < count; i++) {
             dexReadClassDataMethod(&pEncodedData, &method, &lastIndex);
-            loadMethodFromDex(newClass, &method, &newClass->directMethods[i]);
-            if (classMapData != NULL) {
-                const RegisterMap* pMap = dvmRegisterMapGetNext(&classMapData);
-                if (dvmRegisterMapGetFormat(pMap) != kRegMapFormatNone) {
-                    newClass->directMethods[i].registerMap = pMap;
-                    /* TODO: add rigorous checks */
-                    assert((newClass->directMethods[i].registersSize+7) / 8 ==
-                        newClass->directMethods[i].registerMap->regWidth);
-                }
-            }
+            if (classMapData != NULL)
+                dvmRegisterMapGetNext(&classMapData);
         }
-        dvmLinearReadOnly(classLoader, newClass->directMethods);
     }
 
     if (pHeader->virtualMethodsSize != 0) {
@@ -1927,10 +2166,13 @@ static ClassObject* loadClassFromDex0(DvmDex* pDvmDex,
             if (classMapData != NULL) {
                 const RegisterMap* pMap = dvmRegisterMapGetNext(&classMapData);
                 if (dvmRegisterMapGetFormat(pMap) != kRegMapFormatNone) {
-                    newClass->virtualMethods[i].registerMap = pMap;
+                    if (gDvm.preciseGc)
+                        newClass->virtualMethods[i].registerMap = pMap;
+                    newClass->virtualMethods[i].liveMap =
+                        dvmRegisterMapGetLiveness(pMap);
                     /* TODO: add rigorous checks */
                     assert((newClass->virtualMethods[i].registersSize+7) / 8 ==
-                        newClass->virtualMethods[i].registerMap->regWidth);
+                        pMap->regWidth);
                 }
             }
         }
@@ -1943,6 +2185,51 @@ static ClassObject* loadClassFromDex0(DvmDex* pDvmDex,
     return newClass;
 }
 
+/*
+ * Build the direct methods of a class loaded by loadClassFromDex0(), if
+ * another thread hasn't beaten us to it.
+ */
+Method* dvmLoadDirectMethods(ClassObject* clazz)
+{
+    dvmLockMutex(&gDvm.directMethodsLock);
+
+    Method* methods = clazz->directMethods;
+    if (methods == NULL) {
+        int count = clazz->directMethodCount;
+        const u1* pEncodedData = clazz->directMethodData;
+        const void* classMapData = clazz->directMapData;
+        u4 lastIndex = 0;
+        DexMethod method;
+
+        assert(pEncodedData != NULL);
+        methods = (Method*) dvmLinearAlloc(clazz->classLoader,
+                count * sizeof(Method));
+        for (int i = 0; i < count; i++) {
+            dexReadClassDataMethod(&pEncodedData, &method, &lastIndex);
+            loadMethodFromDex(clazz, &method, &methods[i]);
+            if (classMapData != NULL) {
+                const RegisterMap* pMap = dvmRegisterMapGetNext(&classMapData);
+                if (dvmRegisterMapGetFormat(pMap) != kRegMapFormatNone) {
+                    if (gDvm.preciseGc)
+                        methods[i].registerMap = pMap;
+                    methods[i].liveMap = dvmRegisterMapGetLiveness(pMap);
+                    /* TODO: add rigorous checks */
+                    assert((methods[i].registersSize+7) / 8 ==
+                        pMap->regWidth);
+                }
+            }
+        }
+        dvmLinearReadOnly(clazz->classLoader, methods);
+
+        /* the methods must be seen whole by threads that don't lock */
+        android_atomic_release_store((int32_t) methods,
+            (volatile int32_t*)(void*) &clazz->directMethods);
+    }
+
+    dvmUnlockMutex(&gDvm.directMethodsLock);
+    return methods;
+}
+
 /*
  * Try to load the indicated class from the specified DEX file.
  *
@@ -2037,10 +2324,13 @@ void dvmFreeClassInnards(ClassObject* clazz)
         } \
     } while (0)
 
-    /* arrays just point at Object's vtable; don't free vtable in this case.
+    /* arrays just point at Object's vtable, and classes that don't declare
+     * virtual methods at their superclass's; don't free vtable in this case.
      */
     clazz->vtableCount = -1;
-    if (clazz->vtable == gDvm.classJavaLangObject->vtable) {
+    if (IS_CLASS_FLAG_SET(clazz, CLASS_SHARED_VTABLE) ||
+        clazz->vtable == gDvm.classJavaLangObject->vtable)
+    {
         clazz->vtable = NULL;
     } else {
         NULL_AND_LINEAR_FREE(clazz->vtable);
@@ -2083,9 +2373,7 @@ void dvmFreeClassInnards(ClassObject* clazz)
 
     clazz->iftableCount = -1;
     NULL_AND_LINEAR_FREE(clazz->iftable);
-
-    clazz->ifviPoolCount = -1;
-    NULL_AND_LINEAR_FREE(clazz->ifviPool);
+    NULL_AND_LINEAR_FREE(clazz->iftableIndex);
 
     clazz->sfieldCount = -1;
     /* The sfields are attached to the ClassObject, and will be freed
@@ -2093,6 +2381,7 @@ void dvmFreeClassInnards(ClassObject* clazz)
 
     clazz->ifieldCount = -1;
     NULL_AND_LINEAR_FREE(clazz->ifields);
+    NULL_AND_LINEAR_FREE(clazz->refOffsetList);
 
 #undef NULL_AND_FREE
 #undef NULL_AND_LINEAR_FREE
@@ -2120,6 +2409,15 @@ static void freeMethodInnards(Method* meth)
         dvmFreeRegisterMap((RegisterMap*) pMap);
         meth->registerMap = NULL;
     }
+    pMap = meth->liveMap;
+    if (pMap != NULL && dvmRegisterMapGetOnHeap(pMap)) {
+        dvmFreeRegisterMap((RegisterMap*) pMap);
+        meth->liveMap = NULL;
+    }
+
+    /* the decoded catch table is a single block */
+    free(meth->catchTable);
+    meth->catchTable = NULL;
 
     /*
      * We may have copied the instructions.
@@ -2162,12 +2460,18 @@ static void loadMethodFromDex(ClassObject* clazz, const DexMethod* pDexMethod,
     meth->name = dexStringById(pDexFile, pMethodId->nameIdx);
     dexProtoSetFromMethodId(&meth->prototype, pDexFile, pMethodId);
     meth->shorty = dexProtoGetShorty(&meth->prototype);
+    meth->callArgInfo = dvmComputeCallArgInfo(meth->shorty);
     meth->accessFlags = pDexMethod->accessFlags;
     meth->clazz = clazz;
     meth->jniArgInfo = 0;
 
-    if (dvmCompareNameDescriptorAndMethod("finalize", "()V", meth) == 0) {
+    if (!dvmIsDirectMethod(meth) &&
+        dvmCompareNameDescriptorAndMethod("finalize", "()V", meth) == 0)
+    {
         /*
+         * A static or private finalize() doesn't override Object's, and
+         * direct methods are loaded too late to say anyway.
+         *
          * The Enum class declares a "final" finalize() method to
          * prevent subclasses from introducing a finalizer.  We don't
          * want to set the finalizable flag for Enum or its subclasses,
@@ -2447,6 +2751,47 @@ static bool precacheReferenceOffsets(ClassObject* clazz)
 }
 
 
+/*
+ * List the offsets of the reference ifields of a class whose offsets
+ * don't fit the bitmap, with those of its superclasses, so that the GC
+ * can scan an instance in one pass.  If an offset doesn't fit or we're
+ * out of memory the list is left NULL and the GC walks the superclasses.
+ */
+static void computeRefOffsetList(ClassObject* clazz)
+{
+    const ClassObject* super;
+    size_t count = 0;
+
+    for (super = clazz; super != NULL; super = super->super) {
+        count += super->ifieldRefCount;
+    }
+    if (count == 0) {
+        return;
+    }
+    u2* list = (u2*) dvmLinearAlloc(clazz->classLoader, count * sizeof(u2));
+    if (list == NULL) {
+        return;
+    }
+
+    /* Fill it from the end, so that the offsets of Object's subclasses
+     * come first and they mostly ascend. */
+    size_t end = count;
+    for (super = clazz; super != NULL; super = super->super) {
+        end -= super->ifieldRefCount;
+        for (int i = 0; i < super->ifieldRefCount; i++) {
+            int offset = super->ifields[i].byteOffset;
+            if (offset > 0xffff) {
+                dvmLinearFree(clazz->classLoader, list);
+                return;
+            }
+            list[end + i] = offset;
+        }
+    }
+    dvmLinearReadOnly(clazz->classLoader, list);
+    clazz->refOffsetList = list;
+    clazz->refOffsetCount = count;
+}
+
 /*
  * Set the bitmap of reference offsets, refOffsets, from the ifields
  * list.
@@ -2489,6 +2834,9 @@ static void computeRefOffsets(ClassObject* clazz)
           f++;
         }
     }
+    if (clazz->refOffsets == CLASS_WALK_SUPER) {
+        computeRefOffsetList(clazz);
+    }
 }
 
 
@@ -2639,6 +2987,7 @@ bool dvmLinkClass(ClassObject* clazz)
      * There are now Class references visible to the GC in super and
      * interfaces.
      */
+    dvmSetClassDisplay(clazz);
 
     /*
      * All classes have a direct superclass, except for
@@ -2859,12 +3208,100 @@ bail:
     return okay;
 }
 
+/*
+ * Classes that declare at least this many virtual methods find their
+ * overrides through a hash of their method names, in one pass over the
+ * superclass vtable.  Smaller ones just search the vtable for each method.
+ */
+#define kVtableHashMinMethods   8
+
+/*
+ * For each of the virtual methods declared by "clazz", set superSlots[i]
+ * to the first slot of the superclass vtable that holds a method with the
+ * same name and prototype, or leave it at -1 if there is none.
+ */
+static void findOverridesBySearch(const ClassObject* clazz, int* superSlots)
+{
+    const ClassObject* super = clazz->super;
+
+    for (int i = 0; i < clazz->virtualMethodCount; i++) {
+        const Method* localMeth = &clazz->virtualMethods[i];
+
+        for (int si = 0; si < super->vtableCount; si++) {
+            if (dvmMethodNamesAndProtosEqual(localMeth, super->vtable[si]))
+            {
+                superSlots[i] = si;
+                break;
+            }
+        }
+    }
+}
+
+static void findOverrides(const ClassObject* clazz, int* superSlots)
+{
+    const ClassObject* super = clazz->super;
+    int count = clazz->virtualMethodCount;
+
+    if (count < kVtableHashMinMethods) {
+        findOverridesBySearch(clazz, superSlots);
+        return;
+    }
+
+    /*
+     * Open-addressed table of local method indices, at most half full,
+     * keyed by the hash of the method name.  Overloads share a hash, so
+     * each candidate is checked in full.
+     */
+    int tableSize = 16;
+    while (tableSize < count * 2)
+        tableSize <<= 1;
+    int mask = tableSize - 1;
+    int* table = (int*) malloc(tableSize * sizeof(int));
+    u4* hashes = (u4*) malloc(count * sizeof(u4));
+    if (table == NULL || hashes == NULL) {
+        free(table);
+        free(hashes);
+        findOverridesBySearch(clazz, superSlots);
+        return;
+    }
+    memset(table, 0xff, tableSize * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        hashes[i] = dvmComputeUtf8Hash(clazz->virtualMethods[i].name);
+        int bucket = hashes[i] & mask;
+        while (table[bucket] >= 0)
+            bucket = (bucket + 1) & mask;
+        table[bucket] = i;
+    }
+
+    for (int si = 0; si < super->vtableCount; si++) {
+        const Method* superMeth = super->vtable[si];
+        u4 hash = dvmComputeUtf8Hash(superMeth->name);
+
+        for (int bucket = hash & mask; table[bucket] >= 0;
+             bucket = (bucket + 1) & mask)
+        {
+            int i = table[bucket];
+            if (hashes[i] == hash && superSlots[i] < 0 &&
+                dvmMethodNamesAndProtosEqual(&clazz->virtualMethods[i],
+                    superMeth))
+            {
+                superSlots[i] = si;
+                break;
+            }
+        }
+    }
+
+    free(table);
+    free(hashes);
+}
+
 /*
  * Create the virtual method table.
  *
  * The top part of the table is a copy of the table from our superclass,
  * with our local methods overriding theirs.  The bottom part of the table
- * has any new methods we defined.
+ * has any new methods we defined.  A class that doesn't declare any
+ * virtual methods shares its superclass's table.
  */
 static bool createVtable(ClassObject* clazz)
 {
@@ -2889,6 +3326,17 @@ static bool createVtable(ClassObject* clazz)
     }
     //ALOGD("+++ max vmethods for '%s' is %d", clazz->descriptor, maxCount);
 
+    if (clazz->super != NULL && clazz->virtualMethodCount == 0) {
+        /*
+         * Nothing to add or override.  createIftable() makes a copy if it
+         * has to add Miranda methods.
+         */
+        clazz->vtable = clazz->super->vtable;
+        clazz->vtableCount = clazz->super->vtableCount;
+        SET_CLASS_FLAG(clazz, CLASS_SHARED_VTABLE);
+        return true;
+    }
+
     /*
      * Over-allocate the table, then realloc it down if necessary.  So
      * long as we don't allocate anything in between we won't cause
@@ -2911,41 +3359,45 @@ static bool createVtable(ClassObject* clazz)
         /*
          * See if any of our virtual methods override the superclass.
          */
+        int* superSlots = (int*) malloc(clazz->virtualMethodCount * sizeof(int));
+        if (superSlots == NULL) {
+            ALOGE("Unable to allocate memory to link %s", clazz->descriptor);
+            goto bail;
+        }
+        memset(superSlots, 0xff, clazz->virtualMethodCount * sizeof(int));
+        findOverrides(clazz, superSlots);
+
         for (i = 0; i < clazz->virtualMethodCount; i++) {
             Method* localMeth = &clazz->virtualMethods[i];
-            int si;
+            int si = superSlots[i];
 
-            for (si = 0; si < clazz->super->vtableCount; si++) {
+            if (si >= 0) {
                 Method* superMeth = clazz->vtable[si];
 
-                if (dvmCompareMethodNamesAndProtos(localMeth, superMeth) == 0) {
-                    // We should have an access check here, but some apps rely on us not
-                    // checking access: http://b/7301030
-                    bool isAccessible = dvmCheckMethodAccess(clazz, superMeth);
-                    if (dvmIsFinalMethod(superMeth)) {
-                        ALOGE("Method %s.%s overrides final %s.%s",
-                              localMeth->clazz->descriptor, localMeth->name,
-                              superMeth->clazz->descriptor, superMeth->name);
-                        goto bail;
-                    }
-
-                    // Warn if we just spotted code relying on this bug...
-                    if (!isAccessible) {
-                        ALOGW("method %s.%s incorrectly overrides "
-                              "package-private method with same name in %s",
-                              localMeth->clazz->descriptor, localMeth->name,
-                              superMeth->clazz->descriptor);
-                    }
+                // We should have an access check here, but some apps rely on us not
+                // checking access: http://b/7301030
+                bool isAccessible = dvmCheckMethodAccess(clazz, superMeth);
+                if (dvmIsFinalMethod(superMeth)) {
+                    ALOGE("Method %s.%s overrides final %s.%s",
+                          localMeth->clazz->descriptor, localMeth->name,
+                          superMeth->clazz->descriptor, superMeth->name);
+                    free(superSlots);
+                    goto bail;
+                }
 
-                    clazz->vtable[si] = localMeth;
-                    localMeth->methodIndex = (u2) si;
-                    //ALOGV("+++   override %s.%s (slot %d)",
-                    //    clazz->descriptor, localMeth->name, si);
-                    break;
+                // Warn if we just spotted code relying on this bug...
+                if (!isAccessible) {
+                    ALOGW("method %s.%s incorrectly overrides "
+                          "package-private method with same name in %s",
+                          localMeth->clazz->descriptor, localMeth->name,
+                          superMeth->clazz->descriptor);
                 }
-            }
 
-            if (si == clazz->super->vtableCount) {
+                clazz->vtable[si] = localMeth;
+                localMeth->methodIndex = (u2) si;
+                //ALOGV("+++   override %s.%s (slot %d)",
+                //    clazz->descriptor, localMeth->name, si);
+            } else {
                 /* not an override, add to end */
                 clazz->vtable[actualCount] = localMeth;
                 localMeth->methodIndex = (u2) actualCount;
@@ -2955,6 +3407,7 @@ static bool createVtable(ClassObject* clazz)
                 //    clazz->descriptor, localMeth->name);
             }
         }
+        free(superSlots);
 
         if (actualCount != (u2) actualCount) {
             ALOGE("Too many methods (%d) in class '%s'", actualCount,
@@ -3003,6 +3456,80 @@ bail:
     return result;
 }
 
+/*
+ * Interned method index arrays smaller than this many ints are carved out
+ * of shared LinearAlloc chunks of kIfviChunkSize ints.
+ */
+#define kIfviChunkSize      1024
+#define kIfviMaxChunked     64
+
+static u4 ifviHash(const int* indices, int count)
+{
+    u4 hash = count;
+    for (int i = 0; i < count; i++)
+        hash = hash * 31 + indices[i];
+    return hash;
+}
+
+/*
+ * Compare two method index arrays, each of which is preceded by its
+ * length.
+ */
+static int ifviCompare(const void* tableItem, const void* looseItem)
+{
+    const int* a = (const int*) tableItem;
+    const int* b = (const int*) looseItem;
+    if (a[-1] != b[-1])
+        return 1;
+    return memcmp(a, b, a[-1] * sizeof(int));
+}
+
+/*
+ * Return the interned copy of the "count" vtable offsets at "indices",
+ * adding one if this is the first class to implement an interface this
+ * way.  indices[-1] must hold "count".  The copies are never freed.
+ *
+ * Returns NULL if we're out of memory.
+ */
+static int* internIfviArray(const int* indices, int count)
+{
+    assert(indices[-1] == count);
+    u4 hash = ifviHash(indices, count);
+    int size = count + 1;
+
+    dvmHashTableLock(gDvm.ifviArrays);
+    int* shared = (int*) dvmHashTableLookup(gDvm.ifviArrays, hash,
+        (void*) indices, ifviCompare, false);
+    if (shared == NULL) {
+        int* block;
+        int* mem;
+        if (size > kIfviMaxChunked) {
+            block = mem = (int*) dvmLinearAlloc(NULL, size * sizeof(int));
+        } else {
+            if (gDvm.ifviChunk == NULL ||
+                gDvm.ifviChunkUsed + size > kIfviChunkSize)
+            {
+                gDvm.ifviChunk = (int*) dvmLinearAlloc(NULL,
+                    kIfviChunkSize * sizeof(int));
+                gDvm.ifviChunkUsed = 0;
+            } else {
+                dvmLinearReadWrite(NULL, gDvm.ifviChunk);
+            }
+            block = gDvm.ifviChunk;
+            mem = block + gDvm.ifviChunkUsed;
+            gDvm.ifviChunkUsed += size;
+        }
+        if (block != NULL) {
+            memcpy(mem, indices - 1, size * sizeof(int));
+            dvmLinearReadOnly(NULL, block);
+            shared = (int*) dvmHashTableLookup(gDvm.ifviArrays, hash,
+                mem + 1, ifviCompare, true);
+        }
+    }
+    dvmHashTableUnlock(gDvm.ifviArrays);
+    return shared;
+}
+
 /*
  * Create and populate "iftable".
  *
@@ -3025,8 +3552,8 @@ static bool createIftable(ClassObject* clazz)
     bool result = false;
     bool zapIftable = false;
     bool zapVtable = false;
-    bool zapIfvipool = false;
     int poolOffset = 0, poolSize = 0;
+    int* ifvi = NULL;
     Method** mirandaList = NULL;
     int mirandaCount = 0, mirandaAlloc = 0;
 
@@ -3129,6 +3656,8 @@ static bool createIftable(ClassObject* clazz)
 
     ifCount = idx;
     clazz->iftableCount = ifCount;
+    dvmSetInterfaceBits(clazz);
+    dvmBuildIftableIndex(clazz);
 
     /*
      * If we're an interface, we don't need the vtable pointers, so
@@ -3153,10 +3682,11 @@ static bool createIftable(ClassObject* clazz)
      *
      * Each entry in "iftable" has a pointer to the start of its set of
      * vtable offsets.  The iftable entries in the superclass point to
-     * storage allocated in the superclass, and the iftable entries added
-     * for this class point to storage allocated in this class.  "iftable"
-     * is flat for fast access in a class and all of its subclasses, but
-     * "ifviPool" is only created for the topmost implementor.
+     * the superclass's arrays.  For the entries added for this class, we
+     * work the offsets out in "ifvi" and then point at the interned copy,
+     * which every class that implements the interface with the same
+     * offsets shares.  That's common: think of all the anonymous classes
+     * that extend Object and implement Runnable.
      */
     for (int i = superIfCount; i < ifCount; i++) {
         /*
@@ -3175,10 +3705,12 @@ static bool createIftable(ClassObject* clazz)
         goto bail;
     }
 
-    clazz->ifviPoolCount = poolSize;
-    clazz->ifviPool = (int*) dvmLinearAlloc(clazz->classLoader,
-                        poolSize * sizeof(int*));
-    zapIfvipool = true;
+    /* each interface's offsets are preceded by their count */
+    ifvi = (int*) malloc((poolSize + ifCount - superIfCount) * sizeof(int));
+    if (ifvi == NULL) {
+        ALOGE("Unable to allocate memory to link %s", clazz->descriptor);
+        goto bail;
+    }
 
     /*
      * Fill in the vtable offsets for the interfaces that weren't part of
@@ -3188,9 +3720,10 @@ static bool createIftable(ClassObject* clazz)
         ClassObject* interface;
         int methIdx;
 
-        clazz->iftable[i].methodIndexArray = clazz->ifviPool + poolOffset;
         interface = clazz->iftable[i].clazz;
-        poolOffset += interface->virtualMethodCount;    // end here
+        ifvi[poolOffset] = interface->virtualMethodCount;
+        clazz->iftable[i].methodIndexArray = ifvi + poolOffset + 1;
+        poolOffset += interface->virtualMethodCount + 1;    // end here
 
         /*
          * For each method listed in the interface's method list, find the
@@ -3233,9 +3766,7 @@ static bool createIftable(ClassObject* clazz)
             }
 
             for (j = clazz->vtableCount-1; j >= 0; j--) {
-                if (dvmCompareMethodNamesAndProtos(imeth, clazz->vtable[j])
-                    == 0)
-                {
+                if (dvmMethodNamesAndProtosEqual(imeth, clazz->vtable[j])) {
                     LOGVV("INTF:   matched at %d", j);
                     if (!dvmIsAbstractMethod(clazz->vtable[j]) &&
                         !dvmIsPublicMethod(clazz->vtable[j]))
@@ -3284,8 +3815,7 @@ static bool createIftable(ClassObject* clazz)
                  */
                 int mir;
                 for (mir = 0; mir < mirandaCount; mir++) {
-                    if (dvmCompareMethodNamesAndProtos(
-                            mirandaList[mir], imeth) == 0)
+                    if (dvmMethodNamesAndProtosEqual(mirandaList[mir], imeth))
                     {
                         IF_LOGVV() {
                             char* desc = dexProtoCopyMethodDescriptor(
@@ -3384,12 +3914,24 @@ static bool createIftable(ClassObject* clazz)
         dvmLinearReadOnly(clazz->classLoader, clazz->virtualMethods);
 
         /*
-         * We also have to expand the vtable.
+         * We also have to expand the vtable.  If we were sharing our
+         * superclass's, it's time we had our own.
          */
         assert(clazz->vtable != NULL);
-        clazz->vtable = (Method**) dvmLinearRealloc(clazz->classLoader,
+        if (IS_CLASS_FLAG_SET(clazz, CLASS_SHARED_VTABLE)) {
+            Method** vtable = (Method**) dvmLinearAlloc(clazz->classLoader,
+                        sizeof(Method*) * (clazz->vtableCount + mirandaCount));
+            if (vtable != NULL) {
+                memcpy(vtable, clazz->vtable,
+                    sizeof(Method*) * clazz->vtableCount);
+                CLEAR_CLASS_FLAG(clazz, CLASS_SHARED_VTABLE);
+            }
+            clazz->vtable = vtable;
+        } else {
+            clazz->vtable = (Method**) dvmLinearRealloc(clazz->classLoader,
                         clazz->vtable,
                         sizeof(Method*) * (clazz->vtableCount + mirandaCount));
+        }
         if (clazz->vtable == NULL) {
             assert(false);
             goto bail;
@@ -3449,20 +3991,40 @@ static bool createIftable(ClassObject* clazz)
      * but that doesn't seem like it would provide much of an advantage.  I'm
      * not sure this is worthwhile.
      *
-     * (This has been made largely obsolete by the interface cache mechanism.)
+     * (This has been made largely obsolete by the iftable index.)
      */
 
     //dvmDumpClass(clazz);
 
+    /*
+     * Now that the Miranda slots are settled, swap in the interned copies
+     * of the vtable offsets.
+     */
+    for (int i = superIfCount; i < ifCount; i++) {
+        int* indices = NULL;
+        int count = clazz->iftable[i].clazz->virtualMethodCount;
+        if (count != 0) {
+            indices = internIfviArray(clazz->iftable[i].methodIndexArray,
+                count);
+            if (indices == NULL)
+                goto bail;
+        }
+        clazz->iftable[i].methodIndexArray = indices;
+    }
+
     result = true;
 
 bail:
+    if (!result && ifvi != NULL) {
+        /* don't leave the class pointing at "ifvi" */
+        for (int i = superIfCount; i < ifCount; i++)
+            clazz->iftable[i].methodIndexArray = NULL;
+    }
     if (zapIftable)
         dvmLinearReadOnly(clazz->classLoader, clazz->iftable);
     if (zapVtable)
         dvmLinearReadOnly(clazz->classLoader, clazz->vtable);
-    if (zapIfvipool)
-        dvmLinearReadOnly(clazz->classLoader, clazz->ifviPool);
+    free(ifvi);
     return result;
 }
 
@@ -3520,6 +4082,127 @@ static inline void swapField(InstField* pOne, InstField* pTwo)
     *pTwo = swap;
 }
 
+/*
+ * Profile-driven field ordering.
+ *
+ * computeFieldOffsets() packs a class's fields as three groups: the
+ * references, the 64-bit fields and the other 32-bit fields.  Any order
+ * within a group is as good as another, so with a field profile loaded
+ * the fields accessed most are given the lowest offsets of their group,
+ * where they are most likely to share the object's first cache line
+ * with the header and each other.  References still come first both in
+ * the ifields list and in the object, so ifieldRefCount,
+ * precacheReferenceOffsets() and computeRefOffsets() see what they
+ * always have.
+ *
+ * Quickened field instructions carry the offsets they were optimized
+ * with, so only classes that no ahead-of-time optimized code can refer
+ * to are laid out this way: those outside the boot class path whose DEX
+ * file has no optimized classes.  (dexopt only resolves fields of the
+ * boot classes and of the DEX file it is optimizing.)  Classes
+ * optimized later, at runtime, see the offsets chosen here.
+ */
+struct ProfiledField {
+    int index;          // position in ifields before the reordering
+    int group;          // see fieldGroup()
+    u4 count;           // accesses in the profile
+    int byteOffset;     // offset given to the field
+};
+
+static int fieldGroup(const InstField* pField)
+{
+    char c = pField->signature[0];
+
+    if (c == '[' || c == 'L')
+        return 0;
+    else if (c == 'J' || c == 'D')
+        return 1;
+    else
+        return 2;
+}
+
+static int compareByHotness(const void* vOne, const void* vTwo)
+{
+    const ProfiledField* pOne = (const ProfiledField*) vOne;
+    const ProfiledField* pTwo = (const ProfiledField*) vTwo;
+
+    if (pOne->group != pTwo->group)
+        return pOne->group - pTwo->group;
+    if (pOne->count != pTwo->count)
+        return (pOne->count > pTwo->count) ? -1 : 1;
+    return pOne->index - pTwo->index;
+}
+
+static int compareByOffset(const void* vOne, const void* vTwo)
+{
+    const ProfiledField* pOne = (const ProfiledField*) vOne;
+    const ProfiledField* pTwo = (const ProfiledField*) vTwo;
+
+    return pOne->byteOffset - pTwo->byteOffset;
+}
+
+static bool canUseFieldProfile(const ClassObject* clazz)
+{
+    return dvmFieldProfileIsLoaded() && !gDvm.optimizing &&
+        clazz->classLoader != NULL && clazz->pDvmDex != NULL &&
+        !clazz->pDvmDex->hasOptimizedClasses && clazz->ifieldCount > 1;
+}
+
+/*
+ * Reorder the fields within each group by the profile, once
+ * computeFieldOffsets() has assigned the offsets.  Within a group the
+ * offsets ascend with the position in ifields, so handing them out again
+ * in order of hotness keeps the alignment of every field.
+ */
+static void applyFieldProfile(ClassObject* clazz)
+{
+    int fieldCount = clazz->ifieldCount;
+    ProfiledField* fields =
+        (ProfiledField*) malloc(fieldCount * sizeof(ProfiledField));
+    InstField* original = (InstField*) malloc(fieldCount * sizeof(InstField));
+    int groupStart[3] = { 0, 0, 0 };
+    bool anyProfiled = false;
+    int i;
+
+    if (fields == NULL || original == NULL)
+        goto bail;
+
+    for (i = 0; i < fieldCount; i++) {
+        InstField* pField = &clazz->ifields[i];
+        fields[i].index = i;
+        fields[i].group = fieldGroup(pField);
+        fields[i].count =
+            dvmFieldProfileGetCount(clazz->descriptor, pField->name);
+        if (fields[i].count != 0)
+            anyProfiled = true;
+        if (fields[i].group < 2)
+            groupStart[fields[i].group + 1]++;
+    }
+    if (!anyProfiled)
+        goto bail;
+    groupStart[2] += groupStart[1];
+
+    qsort(fields, fieldCount, sizeof(ProfiledField), compareByHotness);
+    for (i = 0; i < fieldCount; i++) {
+        InstField* pField = &clazz->ifields[i];
+        fields[groupStart[fieldGroup(pField)]++].byteOffset =
+            pField->byteOffset;
+    }
+    qsort(fields, fieldCount, sizeof(ProfiledField), compareByOffset);
+
+    memcpy(original, clazz->ifields, fieldCount * sizeof(InstField));
+    for (i = 0; i < fieldCount; i++) {
+        clazz->ifields[i] = original[fields[i].index];
+        clazz->ifields[i].byteOffset = fields[i].byteOffset;
+        LOGVV("  --- profiled '%s'=%d (count=%u)", clazz->ifields[i].name,
+            clazz->ifields[i].byteOffset, fields[i].count);
+    }
+
+bail:
+    free(fields);
+    free(original);
+}
+
 /*
  * Assign instance fields to u4 slots.
  *
@@ -3550,6 +4233,9 @@ static inline void swapField(InstField* pOne, InstField* pTwo)
  *
  * NOTE: reference fields *must* come first, or precacheReferenceOffsets()
  * will break.
+ *
+ * With a field profile loaded, applyFieldProfile() may then reorder the
+ * fields within each of the groups.
  */
 static bool computeFieldOffsets(ClassObject* clazz)
 {
@@ -3721,6 +4407,9 @@ static bool computeFieldOffsets(ClassObject* clazz)
             fieldOffset += sizeof(u4);
     }
 
+    if (canUseFieldProfile(clazz))
+        applyFieldProfile(clazz);
+
 #ifndef NDEBUG
     /* Make sure that all reference fields appear before
      * non-reference fields, and all double-wide fields are aligned.
@@ -4243,6 +4932,7 @@ bool dvmInitClass(ClassObject* clazz)
 #if LOG_CLASS_LOADING
     bool initializedByUs = false;
 #endif
+    bool justInitialized = false;
 
     Thread* self = dvmThreadSelf();
     const Method* method;
@@ -4500,7 +5190,9 @@ noverify:
     } else {
         /* success! */
         dvmLockObject(self, (Object*) clazz);
+        dvmInitFastAlloc(clazz);
         clazz->status = CLASS_INITIALIZED;
+        justInitialized = true;
         LOGVV("Initialized class: %s", clazz->descriptor);
 
         /*
@@ -4532,6 +5224,12 @@ bail_unlock:
 
     dvmUnlockObject(self, (Object*) clazz);
 
+#if defined(WITH_JIT)
+    /* Out from under the class lock, as this may look up other classes */
+    if (justInitialized)
+        dvmJitProfileClassInitialized(clazz);
+#endif
+
     return (clazz->status != CLASS_ERROR);
 }
 
@@ -4611,6 +5309,24 @@ void dvmSetRegisterMap(Method* method, const RegisterMap* pMap)
     dvmLinearReadOnly(clazz->classLoader, clazz->directMethods);
 }
 
+/*
+ * Set the method's liveness map, which is only ever done once.
+ */
+void dvmSetLivenessMap(Method* method, const RegisterMap* pMap)
+{
+    ClassObject* clazz = method->clazz;
+
+    assert(method->liveMap == NULL);
+
+    dvmLinearReadWrite(clazz->classLoader, clazz->virtualMethods);
+    dvmLinearReadWrite(clazz->classLoader, clazz->directMethods);
+
+    method->liveMap = pMap;
+
+    dvmLinearReadOnly(clazz->classLoader, clazz->virtualMethods);
+    dvmLinearReadOnly(clazz->classLoader, clazz->directMethods);
+}
+
 /*
  * dvmHashForeach callback.  A nonzero return value causes foreach to
  * bail out.
@@ -4755,10 +5471,9 @@ static int dumpClass(void* vclazz, void* varg)
         }
         ALOGI("  direct methods (%d entries):", clazz->directMethodCount);
         for (i = 0; i < clazz->directMethodCount; i++) {
-            desc = dexProtoCopyMethodDescriptor(
-                    &clazz->directMethods[i].prototype);
-            ALOGI("    %2d: %20s %s", i, clazz->directMethods[i].name,
-                desc);
+            const Method* meth = &dvmGetDirectMethods(clazz)[i];
+            desc = dexProtoCopyMethodDescriptor(&meth->prototype);
+            ALOGI("    %2d: %20s %s", i, meth->name, desc);
             free(desc);
         }
     } else {
@@ -4830,7 +5545,7 @@ void dvmDumpLoaderStats(const char* msg)
     ALOGV("VM stats (%s): cls=%d/%d meth=%d ifld=%d sfld=%d linear=%d",
         msg, gDvm.numLoadedClasses, dvmHashTableNumEntries(gDvm.loadedClasses),
         gDvm.numDeclaredMethods, gDvm.numDeclaredInstFields,
-        gDvm.numDeclaredStaticFields, gDvm.pBootLoaderAlloc->curOffset);
+        gDvm.numDeclaredStaticFields, dvmLinearAllocUsed(NULL));
 #ifdef COUNT_PRECISE_METHODS
     ALOGI("GC precise methods: %d",
         dvmPointerSetGetCount(gDvm.preciseMethods));
@@ -4843,6 +5558,100 @@ void dvmDumpLoaderStats(const char* msg)
  * ===========================================================================
  */
 
+struct ProtoIdEntry {
+    u4      id;
+    char    descriptor[1];  /* the full method descriptor */
+};
+
+static int protoIdEntryCompare(const void* vent1, const void* vent2)
+{
+    return strcmp(((const ProtoIdEntry*) vent1)->descriptor,
+        ((const ProtoIdEntry*) vent2)->descriptor);
+}
+
+/*
+ * Get the canonical id of the signature "descriptor", adding one if it's
+ * new.  Returns 0 if we're out of memory.
+ */
+static u4 lookupProtoId(const char* descriptor)
+{
+    size_t len = strlen(descriptor);
+    ProtoIdEntry* entry = (ProtoIdEntry*) malloc(sizeof(ProtoIdEntry) + len);
+    if (entry == NULL)
+        return 0;
+    memcpy(entry->descriptor, descriptor, len + 1);
+    u4 hash = dvmComputeUtf8Hash(descriptor);
+
+    dvmHashTableLock(gDvm.protoIdTable);
+    ProtoIdEntry* found = (ProtoIdEntry*) dvmHashTableLookup(
+        gDvm.protoIdTable, hash, entry, protoIdEntryCompare, false);
+    if (found == NULL) {
+        entry->id = ++gDvm.protoIdCount;
+        found = (ProtoIdEntry*) dvmHashTableLookup(gDvm.protoIdTable, hash,
+            entry, protoIdEntryCompare, true);
+        assert(found == entry);
+    }
+    u4 id = found->id;
+    dvmHashTableUnlock(gDvm.protoIdTable);
+
+    if (found != entry)
+        free(entry);
+    return id;
+}
+
+/*
+ * Get the canonical id of a prototype, working it out the first time each
+ * prototype of a DEX file is asked about.  Returns 0 if the prototype
+ * isn't from a DEX file the VM has open.
+ */
+u4 dvmGetProtoId(const DexProto* proto)
+{
+    const DvmDex* pDvmDex = (const DvmDex*) proto->dexFile->auxData;
+    if (pDvmDex == NULL)
+        return 0;
+
+    /* racing threads store the same value */
+    u4 id = pDvmDex->pProtoIds[proto->protoIdx];
+    if (id == 0) {
+        char* descriptor = dexProtoCopyMethodDescriptor(proto);
+        if (descriptor == NULL)
+            return 0;
+        id = lookupProtoId(descriptor);
+        free(descriptor);
+        pDvmDex->pProtoIds[proto->protoIdx] = id;
+    }
+    return id;
+}
+
+/*
+ * Return "true" if the two prototypes are the same.
+ */
+bool dvmProtosEqual(const DexProto* proto1, const DexProto* proto2)
+{
+    if (proto1->dexFile == proto2->dexFile)
+        return proto1->protoIdx == proto2->protoIdx;
+
+    u4 id1 = dvmGetProtoId(proto1);
+    u4 id2 = dvmGetProtoId(proto2);
+    if (id1 != 0 && id2 != 0)
+        return id1 == id2;
+    return dexProtoCompare(proto1, proto2) == 0;
+}
+
+/*
+ * Return "true" if the two methods have the same name and prototype.
+ */
+bool dvmMethodNamesAndProtosEqual(const Method* method1,
+        const Method* method2)
+{
+    if (method1->name != method2->name &&
+        strcmp(method1->name, method2->name) != 0)
+    {
+        return false;
+    }
+    return dvmProtosEqual(&method1->prototype, &method2->prototype);
+}
+
 /*
  * Compare the two method names and prototypes, a la strcmp(). The
  * name is considered the "major" order and the prototype the "minor"
@@ -117,6 +117,20 @@ ClassObject* dvmDefineClass(DvmDex* pDvmDex, const char* descriptor,
  */
 bool dvmLinkClass(ClassObject* clazz);
 
+/*
+ * Get a class's direct methods.  Classes loaded from a DEX file only build
+ * them the first time they're asked for, since they play no part in the
+ * vtable and most are never called.
+ */
+Method* dvmLoadDirectMethods(ClassObject* clazz);
+INLINE Method* dvmGetDirectMethods(const ClassObject* clazz) {
+    Method* methods = (Method*) android_atomic_acquire_load(
+        (volatile int32_t*)(void*) &clazz->directMethods);
+    if (methods == NULL && clazz->directMethodCount != 0)
+        methods = dvmLoadDirectMethods((ClassObject*) clazz);
+    return methods;
+}
+
 /*
  * Determine if a class has been initialized.
  */
@@ -156,6 +170,11 @@ void dvmSetNativeFunc(Method* method, DalvikBridgeFunc func, const u2* insns);
  */
 void dvmSetRegisterMap(Method* method, const RegisterMap* pMap);
 
+/*
+ * Set the method's "liveMap" field.
+ */
+void dvmSetLivenessMap(Method* method, const RegisterMap* pMap);
+
 /*
  * Make a method's DexCode (which includes the bytecode) read-write or
  * read-only.  The conversion to read-write may involve making a new copy
@@ -170,12 +189,19 @@ void dvmMakeCodeReadOnly(Method* meth);
  */
 void dvmSetBootPathExtraDex(DvmDex* pDvmDex);
 
+/*
+ * Load every class in the bootstrap class path.  Returns the number
+ * loaded.
+ */
+int dvmLoadAllBootClasses(void);
+
 /*
  * Debugging.
  */
 void dvmDumpClass(const ClassObject* clazz, int flags);
 void dvmDumpAllClasses(int flags);
 void dvmDumpLoaderStats(const char* msg);
+void dvmCheckClassTablePerf(void);
 int  dvmGetNumLoadedClasses();
 
 /* flags for dvmDumpClass / dvmDumpAllClasses */
@@ -229,6 +255,22 @@ INLINE int dvmCompareMethodParameterProtos(const Method* method1,
     return dexProtoCompareParameters(&method1->prototype, &method2->prototype);
 }
 
+/*
+ * Get the canonical id of a prototype's signature.  Prototypes from any
+ * DEX file have the same id just when their descriptors are the same.
+ * Returns 0 if the prototype isn't from a DEX file the VM has open.
+ */
+u4 dvmGetProtoId(const DexProto* proto);
+
+/*
+ * Equality tests for prototypes, and for method names and prototypes.
+ * Across DEX files these compare the canonical ids rather than the
+ * descriptors.
+ */
+bool dvmProtosEqual(const DexProto* proto1, const DexProto* proto2);
+bool dvmMethodNamesAndProtosEqual(const Method* method1,
+        const Method* method2);
+
 /*
  * Compare the two method names and prototypes, a la strcmp(). The
  * name is considered the "major" order and the prototype the "minor"
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Profile of instance field accesses.
+ *
+ * The profile is a text file with one field per line:
+ *
+ *   <class descriptor> <field name> <access count>
+ *
+ * e.g. "Lcom/example/Node; next 120345".  Blank lines and lines that
+ * start with '#' are skipped.  The counts would typically come from
+ * iget/iput traces; only their relative sizes matter.  A field listed
+ * more than once gets the sum of its counts.
+ */
+#include "Dalvik.h"
+#include "oo/FieldProfile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PROFILE_LINE 1024
+
+struct FieldProfileEntry {
+    char* key;      // "<class descriptor>.<field name>"
+    u4 count;
+};
+
+/*
+ * Filled in at startup and only read after that, so lookups don't
+ * take the table lock.
+ */
+static HashTable* gFieldProfile;
+
+static std::string makeKey(const char* classDescriptor, const char* fieldName)
+{
+    std::string key(classDescriptor);
+    key += '.';
+    key += fieldName;
+    return key;
+}
+
+static int compareEntries(const void* tableItem, const void* looseItem)
+{
+    const FieldProfileEntry* pTable = (const FieldProfileEntry*) tableItem;
+    const FieldProfileEntry* pLoose = (const FieldProfileEntry*) looseItem;
+    return strcmp(pTable->key, pLoose->key);
+}
+
+static void freeEntry(void* ptr)
+{
+    FieldProfileEntry* pEntry = (FieldProfileEntry*) ptr;
+    free(pEntry->key);
+    free(pEntry);
+}
+
+/*
+ * Adds "count" accesses to a field, creating its entry if need be.
+ */
+static bool addField(const char* classDescriptor, const char* fieldName,
+    u4 count)
+{
+    FieldProfileEntry* pEntry =
+        (FieldProfileEntry*) malloc(sizeof(FieldProfileEntry));
+    if (pEntry == NULL)
+        return false;
+    pEntry->key = strdup(makeKey(classDescriptor, fieldName).c_str());
+    if (pEntry->key == NULL) {
+        free(pEntry);
+        return false;
+    }
+    pEntry->count = count;
+
+    FieldProfileEntry* pFound = (FieldProfileEntry*)
+        dvmHashTableLookup(gFieldProfile, dvmComputeUtf8Hash(pEntry->key),
+            pEntry, compareEntries, true);
+    if (pFound != pEntry) {
+        pFound->count = (pFound->count > 0xffffffff - count) ?
+            0xffffffff : pFound->count + count;
+        freeEntry(pEntry);
+    }
+    return true;
+}
+
+void dvmFieldProfileStartup(const char* fileName)
+{
+    FILE* fp = fopen(fileName, "r");
+    if (fp == NULL) {
+        ALOGW("Unable to open field profile '%s': %s",
+            fileName, strerror(errno));
+        return;
+    }
+
+    gFieldProfile = dvmHashTableCreate(256, freeEntry);
+    if (gFieldProfile == NULL) {
+        fclose(fp);
+        return;
+    }
+    char line[MAX_PROFILE_LINE];
+    int lineNum = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char descriptor[MAX_PROFILE_LINE];
+        char name[MAX_PROFILE_LINE];
+        unsigned long count;
+
+        lineNum++;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if (sscanf(line, "%s %s %lu", descriptor, name, &count) != 3 ||
+            descriptor[0] != 'L')
+        {
+            ALOGW("Skipping bad line %d of field profile '%s'",
+                lineNum, fileName);
+            continue;
+        }
+        if (count == 0)
+            continue;
+        if (!addField(descriptor, name, (u4) MIN(count, 0xffffffffUL))) {
+            ALOGW("Out of memory reading field profile '%s'", fileName);
+            break;
+        }
+    }
+    fclose(fp);
+
+    ALOGV("Read %d fields from field profile '%s'",
+        dvmHashTableNumEntries(gFieldProfile), fileName);
+}
+
+void dvmFieldProfileShutdown()
+{
+    dvmHashTableFree(gFieldProfile);
+    gFieldProfile = NULL;
+}
+
+bool dvmFieldProfileIsLoaded()
+{
+    return gFieldProfile != NULL;
+}
+
+u4 dvmFieldProfileGetCount(const char* classDescriptor, const char* fieldName)
+{
+    if (gFieldProfile == NULL)
+        return 0;
+
+    std::string key = makeKey(classDescriptor, fieldName);
+    FieldProfileEntry probe;
+    probe.key = const_cast<char*>(key.c_str());
+    probe.count = 0;
+    const FieldProfileEntry* pEntry = (const FieldProfileEntry*)
+        dvmHashTableLookup(gFieldProfile, dvmComputeUtf8Hash(probe.key),
+            &probe, compareEntries, false);
+    return (pEntry != NULL) ? pEntry->count : 0;
+}
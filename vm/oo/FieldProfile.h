@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Profile of instance field accesses, used when laying out objects.
+ */
+#ifndef DALVIK_OO_FIELDPROFILE_H_
+#define DALVIK_OO_FIELDPROFILE_H_
+
+/*
+ * Loads the profile in "fileName".  A profile that can't be read is
+ * ignored, with a warning; a VM without one lays out objects as usual.
+ */
+void dvmFieldProfileStartup(const char* fileName);
+void dvmFieldProfileShutdown(void);
+
+/*
+ * Returns true if a profile was loaded.
+ */
+bool dvmFieldProfileIsLoaded(void);
+
+/*
+ * Returns the number of accesses the profile records for the named
+ * instance field, or 0 if it has none.  The profile doesn't change once
+ * loaded, so this may be called from any thread without locking.
+ */
+u4 dvmFieldProfileGetCount(const char* classDescriptor, const char* fieldName);
+
+#endif  // DALVIK_OO_FIELDPROFILE_H_
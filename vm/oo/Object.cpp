@@ -392,7 +392,7 @@ static Method* findMethodInListByDescriptor(const ClassObject* clazz,
             methods = clazz->virtualMethods;
             methodCount = clazz->virtualMethodCount;
         } else {
-            methods = clazz->directMethods;
+            methods = dvmGetDirectMethods(clazz);
             methodCount = clazz->directMethodCount;
         }
 
@@ -422,6 +422,13 @@ static Method* findMethodInListByDescriptor(const ClassObject* clazz,
  * list to search through.  If the match can come from either list, use
  * MATCH_UNKNOWN to scan both.
  */
+static inline bool nameAndProtoMatch(const char* name,
+    const DexProto* proto, const Method* method)
+{
+    return strcmp(name, method->name) == 0 &&
+        dvmProtosEqual(proto, &method->prototype);
+}
+
 static Method* findMethodInListByProto(const ClassObject* clazz,
     MethodType wantedType, bool isHier, const char* name, const DexProto* proto)
 {
@@ -434,15 +441,16 @@ static Method* findMethodInListByProto(const ClassObject* clazz,
         if (wantedType == METHOD_VIRTUAL || wantedType == METHOD_UNKNOWN) {
             for (i = 0; i < clazz->virtualMethodCount; i++) {
                 Method* method = &clazz->virtualMethods[i];
-                if (dvmCompareNameProtoAndMethod(name, proto, method) == 0) {
+                if (nameAndProtoMatch(name, proto, method)) {
                     return method;
                 }
             }
         }
         if (wantedType == METHOD_DIRECT || wantedType == METHOD_UNKNOWN) {
+            Method* directMethods = dvmGetDirectMethods(clazz);
             for (i = 0; i < clazz->directMethodCount; i++) {
-                Method* method = &clazz->directMethods[i];
-                if (dvmCompareNameProtoAndMethod(name, proto, method) == 0) {
+                Method* method = &directMethods[i];
+                if (nameAndProtoMatch(name, proto, method)) {
                     return method;
                 }
             }
@@ -685,23 +693,16 @@ const Method* dvmGetVirtualizedMethod(const ClassObject* clazz,
      * If the method was declared in an interface, we need to scan through
      * the class' list of interfaces for it, and find the vtable index
      * from that.
-     *
-     * TODO: use the interface cache.
      */
     if (dvmIsInterfaceClass(meth->clazz)) {
-        int i;
-
-        for (i = 0; i < clazz->iftableCount; i++) {
-            if (clazz->iftable[i].clazz == meth->clazz)
-                break;
-        }
-        if (i == clazz->iftableCount) {
+        const InterfaceEntry* entry = dvmFindIftableEntry(clazz, meth->clazz);
+        if (entry == NULL) {
             dvmThrowIncompatibleClassChangeError(
                 "invoking method from interface not implemented by class");
             return NULL;
         }
 
-        methodIndex = clazz->iftable[i].methodIndexArray[meth->methodIndex];
+        methodIndex = entry->methodIndexArray[meth->methodIndex];
     } else {
         methodIndex = meth->methodIndex;
     }
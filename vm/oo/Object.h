@@ -37,6 +37,7 @@ struct StaticField;
 struct InstField;
 struct Field;
 struct RegisterMap;
+struct CatchTable;
 
 /*
  * Native function pointer type.
@@ -51,6 +52,8 @@ struct RegisterMap;
 typedef void (*DalvikBridgeFunc)(const u4* args, JValue* pResult,
     const Method* method, struct Thread* self);
 typedef void (*DalvikNativeFunc)(const u4* args, JValue* pResult);
+typedef void (*JniCallStub)(JNIEnv* env, void* arg1, const u4* args,
+    void* func, JValue* pResult);
 
 
 /* vm-internal access flags and related definitions */
@@ -76,6 +79,7 @@ enum ClassFlags {
     CLASS_ISPHANTOMREFERENCE   = (1<<24), // class is a phantom reference
 
     CLASS_MULTIPLE_DEFS        = (1<<23), // DEX verifier: defs in multiple DEXs
+    CLASS_SHARED_VTABLE        = (1<<22), // vtable belongs to the superclass
 
     /* unlike the others, these can be present in the optimized DEX file */
     CLASS_ISOPTIMIZED          = (1<<17), // class may contain opt instrs
@@ -181,8 +185,9 @@ struct InterfaceEntry {
     ClassObject*    clazz;
 
     /*
-     * Index into array of vtable offsets.  This points into the ifviPool,
-     * which holds the vtables for all interfaces declared by this class.
+     * Index into array of vtable offsets.  Classes that implement the
+     * interface with the same vtable offsets share the array; see
+     * createIftable().
      */
     int*            methodIndexArray;
 };
@@ -331,6 +336,13 @@ struct InstField : Field {
  */
 #define CLASS_FIELD_SLOTS   4
 
+/*
+ * The number of superclasses, counting the class itself, that a class
+ * object lists for the subclass checks in TypeCheck.cpp.  Checks against
+ * a class deeper than this go through the instanceof cache.
+ */
+#define CLASS_DISPLAY_SIZE  8
+
 /*
  * Class objects have many additional fields.  This is used for both
  * classes and interfaces, including synthesized classes (arrays and
@@ -405,7 +417,7 @@ struct ClassObject : Object {
     int             interfaceCount;
     ClassObject**   interfaces;
 
-    /* static, private, and <init> methods */
+    /* static, private, and <init> methods; use dvmGetDirectMethods() */
     int             directMethodCount;
     Method*         directMethods;
 
@@ -438,14 +450,6 @@ struct ClassObject : Object {
     int             iftableCount;
     InterfaceEntry* iftable;
 
-    /*
-     * The interface vtable indices for iftable get stored here.  By placing
-     * them all in a single pool for each class that implements interfaces,
-     * we decrease the number of allocations.
-     */
-    int             ifviPoolCount;
-    int*            ifviPool;
-
     /* instance fields
      *
      * These describe the layout of the contents of a DataObject-compatible
@@ -464,9 +468,48 @@ struct ClassObject : Object {
     /* bitmap of offsets of ifields */
     u4 refOffsets;
 
+    /* when refOffsets is CLASS_WALK_SUPER, the offsets of all the
+     * reference ifields, the superclasses' first, so the GC needn't walk
+     * the superclasses; NULL if an offset doesn't fit in a u2 */
+    u2*             refOffsetList;
+    u4              refOffsetCount;
+
+    /* size of the TLAB chunk an instance takes if dvmAllocObjectFast()
+     * may carve it directly; set when the class is initialized */
+    u4              fastAllocSize;
+
+    /* biases revoked on instances, which stop being biased at a limit;
+     * see Sync.cpp */
+    u4              biasRevocations;
+
+    /* number of superclasses above this one (0 for java.lang.Object and
+     * the primitive classes), and the superclasses from Object down to
+     * this class as far as CLASS_DISPLAY_SIZE allows; see TypeCheck.cpp.
+     * The GC needn't visit these, as they are all reached through "super" */
+    u4              classDepth;
+    ClassObject*    display[CLASS_DISPLAY_SIZE];
+
+    /* bits for the interfaces in iftable, hashed from their serial
+     * numbers, so most failing interface checks need no search */
+    u4              interfaceBits;
+
+    /* open-addressed index of iftable, keyed by the serial numbers of the
+     * interfaces, for classes with enough interfaces to make a search
+     * slow; each slot is an iftable index plus one, or 0 if empty */
+    u2*             iftableIndex;
+    u4              iftableIndexMask;
+
     /* source file name, if known */
     const char*     sourceFile;
 
+    /* interned result of Class.getName(), set on first use */
+    StringObject*   nameString;
+
+    /* where the direct methods and their register maps are encoded, until
+     * dvmLoadDirectMethods() builds them */
+    const u1*       directMethodData;
+    const void*     directMapData;
+
     /* static fields */
     int             sfieldCount;
     StaticField     sfields[0]; /* MUST be last item */
@@ -547,9 +590,9 @@ struct Method {
     DalvikBridgeFunc nativeFunc;
 
     /*
-     * JNI: true if this static non-synchronized native method (that has no
-     * reference arguments) needs a JNIEnv* and jclass/jobject. Libcore
-     * uses this.
+     * JNI: true if this static non-synchronized native method doesn't need
+     * a jclass, and doesn't block or call back into the VM.  The JNI bridge
+     * calls it without a thread state transition.  Libcore uses this.
      */
     bool fastJni;
 
@@ -576,8 +619,33 @@ struct Method {
      */
     const RegisterMap* registerMap;
 
+    /*
+     * Registers live at each GC point, from live-precise verification.
+     * Set once, and never expanded or replaced; the JIT reads it without
+     * locking.
+     */
+    const RegisterMap* liveMap;
+
     /* set if method was called during method profiling */
     bool            inProfile;
+
+    /*
+     * The method's try/catch data, decoded the first time an exception
+     * is thrown through it.  On the heap; see Exception.cpp.
+     */
+    CatchTable*     catchTable;
+
+    /*
+     * JNI: a call stub specialized for this method's shorty, or NULL if
+     * the JNI bridge should use dvmPlatformInvoke.  See JniStubs.cpp.
+     */
+    JniCallStub     jniCallStub;
+
+    /*
+     * The argument types, decoded from the shorty once so that
+     * dvmCallMethodV/A don't have to; 0 if not known.  See Stack.cpp.
+     */
+    u4              callArgInfo;
 };
 
 u4 dvmGetMethodIdx(const Method* method);
@@ -107,14 +107,14 @@ INLINE float dvmGetFieldFloatVolatile(const Object* obj, int offset) {
 INLINE s8 dvmGetFieldLongVolatile(const Object* obj, int offset) {
     const s8* addr = (const s8*)BYTE_OFFSET(obj, offset);
     s8 val = dvmQuasiAtomicRead64(addr);
-    ANDROID_MEMBAR_FULL();
+    DVM_MEMBAR_ACQUIRE();
     return val;
 }
 INLINE double dvmGetFieldDoubleVolatile(const Object* obj, int offset) {
     union { s8 lval; double dval; } alias;
     const s8* addr = (const s8*)BYTE_OFFSET(obj, offset);
     alias.lval = dvmQuasiAtomicRead64(addr);
-    ANDROID_MEMBAR_FULL();
+    DVM_MEMBAR_ACQUIRE();
     return alias.dval;
 }
 INLINE Object* dvmGetFieldObjectVolatile(const Object* obj, int offset) {
@@ -263,14 +263,14 @@ INLINE float dvmGetStaticFieldFloatVolatile(const StaticField* sfield) {
 INLINE s8 dvmGetStaticFieldLongVolatile(const StaticField* sfield) {
     const s8* addr = &sfield->value.j;
     s8 val = dvmQuasiAtomicRead64(addr);
-    ANDROID_MEMBAR_FULL();
+    DVM_MEMBAR_ACQUIRE();
     return val;
 }
 INLINE double dvmGetStaticFieldDoubleVolatile(const StaticField* sfield) {
     union { s8 lval; double dval; } alias;
     const s8* addr = &sfield->value.j;
     alias.lval = dvmQuasiAtomicRead64(addr);
-    ANDROID_MEMBAR_FULL();
+    DVM_MEMBAR_ACQUIRE();
     return alias.dval;
 }
 INLINE Object* dvmGetStaticFieldObjectVolatile(const StaticField* sfield) {
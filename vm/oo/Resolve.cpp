@@ -28,8 +28,12 @@
  * not perform initialization.)
  */
 #include "Dalvik.h"
+#include "libdex/DexClass.h"
 
 #include <stdlib.h>
+#include <vector>
+
+static StringObject* resolveStringInDex(DvmDex* pDvmDex, u4 stringIdx);
 
 
 /*
@@ -516,14 +520,20 @@ StaticField* dvmResolveStaticField(const ClassObject* referrer, u4 sfieldIdx)
  */
 StringObject* dvmResolveString(const ClassObject* referrer, u4 stringIdx)
 {
-    DvmDex* pDvmDex = referrer->pDvmDex;
+    LOGVV("+++ resolving string, referrer is %s", referrer->descriptor);
+    return resolveStringInDex(referrer->pDvmDex, stringIdx);
+}
+
+/*
+ * Resolve and intern string "stringIdx" of "pDvmDex".
+ */
+static StringObject* resolveStringInDex(DvmDex* pDvmDex, u4 stringIdx)
+{
     StringObject* strObj;
     StringObject* internStrObj;
     const char* utf8;
     u4 utf16Size;
 
-    LOGVV("+++ resolving string, referrer is %s", referrer->descriptor);
-
     /*
      * Create a UTF-16 version so we can trivially compare it to what's
      * already interned.
@@ -562,6 +572,167 @@ bail:
     return strObj;
 }
 
+/*
+ * Resolve the strings named by the const-string instructions in "insns",
+ * and, if "referrer" isn't NULL, the classes named by its const-class
+ * instructions that its loader has already loaded from the same DEX (or
+ * the bootstrap path, for the bootstrap loader).  Anything else is left
+ * for dvmResolveClass() to do, with its checks, at execution time.
+ *
+ * Returns "false" with an exception raised if a string couldn't be made.
+ */
+static bool preresolveCode(DvmDex* pDvmDex, const ClassObject* referrer,
+    const u2* insns, u4 insnsSize)
+{
+    const DexFile* pDexFile = pDvmDex->pDexFile;
+    u4 i = 0;
+
+    while (i < insnsSize) {
+        Opcode opcode = dexOpcodeFromCodeUnit(insns[i]);
+        u4 stringIdx = kDexNoIndex;
+
+        switch (opcode) {
+        case OP_CONST_STRING:
+            stringIdx = insns[i + 1];
+            break;
+        case OP_CONST_STRING_JUMBO:
+            stringIdx = insns[i + 1] | ((u4) insns[i + 2] << 16);
+            break;
+        case OP_CONST_CLASS:
+            if (referrer != NULL &&
+                dvmDexGetResolvedClass(pDvmDex, insns[i + 1]) == NULL)
+            {
+                const char* className =
+                    dexStringByTypeIdx(pDexFile, insns[i + 1]);
+                ClassObject* resClass = NULL;
+                if (className[0] == 'L')
+                    resClass = dvmLookupClass(className,
+                        referrer->classLoader, false);
+                if (resClass != NULL && (resClass->pDvmDex == pDvmDex ||
+                                         resClass->classLoader == NULL))
+                    dvmDexSetResolvedClass(pDvmDex, insns[i + 1], resClass);
+            }
+            break;
+        case OP_BREAKPOINT:
+            /* the real opcode is elsewhere, so we can't find the next one */
+            return true;
+        default:
+            break;
+        }
+
+        if (stringIdx != kDexNoIndex &&
+            stringIdx < pDexFile->pHeader->stringIdsSize &&
+            dvmDexGetResolvedString(pDvmDex, stringIdx) == NULL &&
+            resolveStringInDex(pDvmDex, stringIdx) == NULL)
+        {
+            return false;
+        }
+
+        size_t width = dexGetWidthFromInstruction(&insns[i]);
+        if (width == 0)
+            return true;        /* malformed; leave the rest alone */
+        i += width;
+    }
+    return true;
+}
+
+static bool preresolveMethods(const ClassObject* clazz, const Method* methods,
+    int count)
+{
+    for (int i = 0; i < count; i++) {
+        const Method* meth = &methods[i];
+        if (meth->insns != NULL && !preresolveCode(clazz->pDvmDex, clazz,
+                meth->insns, dvmGetMethodInsnsSize(meth)))
+            return false;
+    }
+    return true;
+}
+
+bool dvmPreresolveClass(const ClassObject* clazz)
+{
+    if (clazz->pDvmDex == NULL)
+        return true;            /* arrays, primitives, proxies */
+
+    /* direct methods that were never built never ran, so skip them */
+    return preresolveMethods(clazz, clazz->virtualMethods,
+                clazz->virtualMethodCount) &&
+           (clazz->directMethods == NULL ||
+            preresolveMethods(clazz, clazz->directMethods,
+                clazz->directMethodCount));
+}
+
+bool dvmPreresolveDexStrings(DvmDex* pDvmDex)
+{
+    const DexFile* pDexFile = pDvmDex->pDexFile;
+    Thread* self = dvmThreadSelf();
+
+    for (u4 i = 0; i < pDexFile->pHeader->classDefsSize; i++) {
+        const u1* pEncodedData =
+            dexGetClassData(pDexFile, dexGetClassDef(pDexFile, i));
+        if (pEncodedData == NULL)
+            continue;
+        DexClassData* pClassData =
+            dexReadAndVerifyClassData(&pEncodedData, NULL);
+        if (pClassData == NULL)
+            continue;
+
+        bool okay = true;
+        u4 numMethods = pClassData->header.directMethodsSize +
+                        pClassData->header.virtualMethodsSize;
+        for (u4 m = 0; m < numMethods && okay; m++) {
+            const DexMethod* pDexMethod =
+                (m < pClassData->header.directMethodsSize) ?
+                    &pClassData->directMethods[m] :
+                    &pClassData->virtualMethods[m -
+                        pClassData->header.directMethodsSize];
+            const DexCode* pCode = dexGetCode(pDexFile, pDexMethod);
+            if (pCode != NULL)
+                okay = preresolveCode(pDvmDex, NULL, pCode->insns,
+                    pCode->insnsSize);
+        }
+        free(pClassData);
+        if (!okay)
+            return false;
+
+        /* we're allocating in a loop; let the GC in between classes */
+        dvmCheckSuspendPending(self);
+    }
+    return true;
+}
+
+/*
+ * Collect the classes in the loaded-class table, so we can resolve into
+ * them without holding the table lock, which the GC needs.
+ */
+static int collectLoadedClass(void* vclazz, void* varg)
+{
+    std::vector<ClassObject*>* pClasses = (std::vector<ClassObject*>*) varg;
+    pClasses->push_back((ClassObject*) vclazz);
+    return 0;
+}
+
+void dvmPreresolveLoadedClasses()
+{
+    std::vector<ClassObject*> classes;
+    Thread* self = dvmThreadSelf();
+    u8 start = dvmGetRelativeTimeUsec();
+
+    dvmHashTableLock(gDvm.loadedClasses);
+    dvmHashForeach(gDvm.loadedClasses, collectLoadedClass, &classes);
+    dvmHashTableUnlock(gDvm.loadedClasses);
+
+    for (size_t i = 0; i < classes.size(); i++) {
+        if (!dvmPreresolveClass(classes[i])) {
+            ALOGW("Pre-resolution of %s failed", classes[i]->descriptor);
+            dvmClearException(self);
+            break;
+        }
+        dvmCheckSuspendPending(self);
+    }
+    ALOGD("Pre-resolved constants of %zd classes in %lldms",
+        classes.size(), (dvmGetRelativeTimeUsec() - start) / 1000);
+}
+
 /*
  * For debugging: return a string representing the methodType.
  */
@@ -90,6 +90,30 @@ extern "C" StaticField* dvmResolveStaticField(const ClassObject* referrer,
  */
 extern "C" StringObject* dvmResolveString(const ClassObject* referrer, u4 stringIdx);
 
+/*
+ * Resolve ahead of time the strings of "clazz"'s const-string
+ * instructions, and the already-loaded classes of its const-class
+ * instructions.  Only the methods that have been built are scanned.
+ *
+ * Returns "false" with an exception raised on failure.
+ */
+bool dvmPreresolveClass(const ClassObject* clazz);
+
+/*
+ * Resolve the strings of every const-string instruction in "pDvmDex".
+ * This doesn't need the classes to be loaded, so it can run on a
+ * background thread as soon as the file is open.
+ *
+ * Returns "false" with an exception raised on failure.
+ */
+bool dvmPreresolveDexStrings(DvmDex* pDvmDex);
+
+/*
+ * Run dvmPreresolveClass() on every loaded class.  The zygote does this
+ * before it first forks, for -Xpreresolve:zygote.
+ */
+void dvmPreresolveLoadedClasses(void);
+
 /*
  * Return debug string constant for enum.
  */
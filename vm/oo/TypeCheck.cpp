@@ -169,21 +169,14 @@ static int isArrayInstanceOf(const ClassObject* sub, const ClassObject* clazz)
  */
 int dvmImplements(const ClassObject* clazz, const ClassObject* interface)
 {
-    int i;
-
     assert(dvmIsInterfaceClass(interface));
 
     /*
      * All interfaces implemented directly and by our superclass, and
      * recursively all super-interfaces of those interfaces, are listed
-     * in "iftable", so we can just do a linear scan through that.
+     * in "iftable".
      */
-    for (i = 0; i < clazz->iftableCount; i++) {
-        if (clazz->iftable[i].clazz == interface)
-            return 1;
-    }
-
-    return 0;
+    return BOOL_TO_INT(dvmFindIftableEntry(clazz, interface) != NULL);
 }
 
 /*
@@ -218,6 +211,78 @@ bool dvmCanPutArrayElement(const ClassObject* objectClass,
 }
 
 
+/*
+ * The bit that stands for "interface" in ClassObject.interfaceBits.
+ */
+static inline u4 interfaceBit(const ClassObject* interface)
+{
+    return 1U << (interface->serialNumber & 31);
+}
+
+/*
+ * A class lists itself and its superclasses by depth, so that "sub" is a
+ * subclass of a class at depth n exactly when display[n] of "sub" is that
+ * class (Cohen's display).  The superclass is linked first and has its
+ * display already.
+ */
+void dvmSetClassDisplay(ClassObject* clazz)
+{
+    u4 depth = 0;
+
+    if (clazz->super != NULL) {
+        depth = clazz->super->classDepth + 1;
+        memcpy(clazz->display, clazz->super->display,
+            MIN(depth, CLASS_DISPLAY_SIZE) * sizeof(ClassObject*));
+    }
+    clazz->classDepth = depth;
+    if (depth < CLASS_DISPLAY_SIZE)
+        clazz->display[depth] = clazz;
+}
+
+void dvmSetInterfaceBits(ClassObject* clazz)
+{
+    u4 bits = 0;
+
+    for (int i = 0; i < clazz->iftableCount; i++)
+        bits |= interfaceBit(clazz->iftable[i].clazz);
+    clazz->interfaceBits = bits;
+}
+
+/*
+ * Below this many interfaces a search of the iftable is as quick as the
+ * index.
+ */
+#define kIftableIndexMinCount   6
+
+void dvmBuildIftableIndex(ClassObject* clazz)
+{
+    assert(clazz->iftableIndex == NULL);
+    if (clazz->iftableCount < kIftableIndexMinCount ||
+        clazz->iftableCount >= 65535)
+    {
+        return;
+    }
+
+    /* keep it at most half full, so a miss ends quickly */
+    u4 size = 1;
+    while (size < 2 * (u4) clazz->iftableCount)
+        size <<= 1;
+    u4 mask = size - 1;
+
+    u2* index = (u2*) dvmLinearAlloc(clazz->classLoader, size * sizeof(u2));
+    memset(index, 0, size * sizeof(u2));
+    for (int i = 0; i < clazz->iftableCount; i++) {
+        u4 slot = clazz->iftable[i].clazz->serialNumber & mask;
+        while (index[slot] != 0)
+            slot = (slot + 1) & mask;
+        index[slot] = (u2) (i + 1);
+    }
+    dvmLinearReadOnly(clazz->classLoader, index);
+
+    clazz->iftableIndex = index;
+    clazz->iftableIndexMask = mask;
+}
+
 /*
  * Perform the instanceof calculation.
  */
@@ -235,12 +300,25 @@ static inline int isInstanceof(const ClassObject* instance,
 
 
 /*
- * Do the instanceof calculation, pulling the result from the cache if
- * possible.
+ * Do the instanceof calculation.  Checks against classes that aren't
+ * too deep are answered from the display, and most failing checks
+ * against interfaces from the interface bits.  The rest are pulled from
+ * the cache if possible.
  */
 int dvmInstanceofNonTrivial(const ClassObject* instance,
     const ClassObject* clazz)
 {
+    if (dvmIsInterfaceClass(clazz)) {
+        if ((instance->interfaceBits & interfaceBit(clazz)) == 0)
+            return 0;
+    } else if (!dvmIsArrayClass(clazz)) {
+        u4 depth = clazz->classDepth;
+        if (depth < CLASS_DISPLAY_SIZE) {
+            return BOOL_TO_INT(instance->classDepth >= depth &&
+                               instance->display[depth] == clazz);
+        }
+    }
+
 #define ATOMIC_CACHE_CALC isInstanceof(instance, clazz)
 #define ATOMIC_CACHE_NULL_ALLOWED true
     return ATOMIC_CACHE_LOOKUP(gDvm.instanceofCache,
@@ -24,6 +24,41 @@ bool dvmInstanceofStartup(void);
 void dvmInstanceofShutdown(void);
 
 
+/*
+ * Fill in the superclass display, the interface bits and the iftable
+ * index of a class, once its superclass or its iftable are final.
+ */
+void dvmSetClassDisplay(ClassObject* clazz);
+void dvmSetInterfaceBits(ClassObject* clazz);
+void dvmBuildIftableIndex(ClassObject* clazz);
+
+/*
+ * Find the entry for "interface" in the iftable of "clazz".  Returns NULL
+ * if "clazz" doesn't implement it.
+ */
+INLINE InterfaceEntry* dvmFindIftableEntry(const ClassObject* clazz,
+    const ClassObject* interface)
+{
+    const u2* index = clazz->iftableIndex;
+
+    if (index != NULL) {
+        u4 mask = clazz->iftableIndexMask;
+        for (u4 i = interface->serialNumber & mask; ; i = (i + 1) & mask) {
+            u2 slot = index[i];
+            if (slot == 0)
+                return NULL;
+            if (clazz->iftable[slot - 1].clazz == interface)
+                return &clazz->iftable[slot - 1];
+        }
+    }
+
+    for (int i = 0; i < clazz->iftableCount; i++) {
+        if (clazz->iftable[i].clazz == interface)
+            return &clazz->iftable[i];
+    }
+    return NULL;
+}
+
 /* used by dvmInstanceof; don't call */
 extern "C" int dvmInstanceofNonTrivial(const ClassObject* instance,
                                        const ClassObject* clazz);
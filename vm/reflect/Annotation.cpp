@@ -16,8 +16,9 @@
 /*
  * Annotations.
  *
- * We're not expecting to make much use of runtime annotations, so speed vs.
- * space choices are weighted heavily toward small size.
+ * Runtime annotations turn out to be read heavily (injection, serialization,
+ * test runners), so decoded annotation sets are cached; see "Annotation set
+ * cache" below.  Everything else still favors small size over speed.
  *
  * It would have been nice to treat "system" annotations in the same way
  * we do "real" annotations, but that doesn't work.  The chief difficulty
@@ -955,6 +956,213 @@ static Object* getAnnotationObjectFromAnnotationSet(const ClassObject* clazz,
     return processEncodedAnnotation(clazz, &ptr);
 }
 
+/*
+ * ===========================================================================
+ *      Annotation set cache
+ * ===========================================================================
+ */
+
+/*
+ * Frameworks ask for the same member's annotations many times (injection,
+ * serialization, test runners), so decoded sets are kept in
+ * gDvm.annotationCache.  Entries are keyed on the DexAnnotationSetItem,
+ * which every member with an identical set shares, and live until
+ * shutdown: classes are never unloaded, so there is nothing to
+ * invalidate.  Handing out the same Annotation instances is fine since
+ * they are immutable proxies whose member values are copied on access.
+ */
+
+static inline u4 annotationSetHash(const DexAnnotationSetItem* pAnnoSet)
+{
+    return (u4) ((uintptr_t) pAnnoSet >> 2);
+}
+
+static int compareAnnotationSetEntry(const void* tableItem,
+    const void* looseItem)
+{
+    const AnnotationSetEntry* a = (const AnnotationSetEntry*) tableItem;
+    const AnnotationSetEntry* b = (const AnnotationSetEntry*) looseItem;
+    return a->pAnnoSet != b->pAnnoSet || a->pDvmDex != b->pDvmDex;
+}
+
+/*
+ * Return the cache entry for "pAnnoSet", resolving the runtime-visible
+ * annotation types and adding it on first use.  Types that can't be
+ * resolved are left out, as processAnnotationSet leaves out their
+ * annotations.  No objects are allocated.
+ *
+ * Returns NULL with an exception raised on allocation failure.
+ */
+static AnnotationSetEntry* getAnnotationSetEntry(const ClassObject* clazz,
+    const DexAnnotationSetItem* pAnnoSet)
+{
+    HashTable* pCache = gDvm.annotationCache;
+    AnnotationSetEntry key;
+    key.pAnnoSet = pAnnoSet;
+    key.pDvmDex = clazz->pDvmDex;
+
+    dvmHashTableLock(pCache);
+    AnnotationSetEntry* entry = (AnnotationSetEntry*) dvmHashTableLookup(
+        pCache, annotationSetHash(pAnnoSet), &key, compareAnnotationSetEntry,
+        false);
+    dvmHashTableUnlock(pCache);
+    if (entry != NULL)
+        return entry;
+
+    /* resolving may load classes, so don't hold the lock */
+    size_t size = offsetof(AnnotationSetEntry, types) +
+                  pAnnoSet->size * sizeof(ClassObject*);
+    AnnotationSetEntry* newEntry = (AnnotationSetEntry*) calloc(1, size);
+    if (newEntry == NULL) {
+        dvmThrowOutOfMemoryError(NULL);
+        return NULL;
+    }
+    newEntry->pAnnoSet = pAnnoSet;
+    newEntry->pDvmDex = clazz->pDvmDex;
+
+    DexFile* pDexFile = clazz->pDvmDex->pDexFile;
+    for (u4 i = 0; i < pAnnoSet->size; i++) {
+        const DexAnnotationItem* pAnnoItem =
+            dexGetAnnotationItem(pDexFile, pAnnoSet, i);
+        if (pAnnoItem->visibility != kDexVisibilityRuntime)
+            continue;
+
+        const u1* ptr = pAnnoItem->annotation;
+        u4 typeIdx = readUleb128(&ptr);
+        ClassObject* annoClass = dvmDexGetResolvedClass(clazz->pDvmDex,
+                                                        typeIdx);
+        if (annoClass == NULL) {
+            annoClass = dvmResolveClass(clazz, typeIdx, true);
+            if (annoClass == NULL) {
+                ALOGE("Unable to resolve %s annotation class %d",
+                      clazz->descriptor, typeIdx);
+                Thread* self = dvmThreadSelf();
+                assert(dvmCheckException(self));
+                dvmClearException(self);
+                continue;
+            }
+        }
+        newEntry->types[newEntry->numTypes++] = annoClass;
+    }
+
+    /* someone may have beaten us to it, in which case theirs wins */
+    dvmHashTableLock(pCache);
+    entry = (AnnotationSetEntry*) dvmHashTableLookup(pCache,
+        annotationSetHash(pAnnoSet), newEntry, compareAnnotationSetEntry,
+        true);
+    dvmHashTableUnlock(pCache);
+    if (entry != newEntry)
+        free(newEntry);
+    return entry;
+}
+
+/*
+ * Return the decoded Annotation[] for "entry", decoding it the first time.
+ * The array belongs to the cache and must not be handed out as-is.  The
+ * pointer stays good because the compactor leaves root-referenced
+ * objects where they are.
+ *
+ * Returns NULL with an exception raised on failure.
+ */
+static ArrayObject* getDecodedAnnotations(const ClassObject* clazz,
+    AnnotationSetEntry* entry)
+{
+    HashTable* pCache = gDvm.annotationCache;
+
+    dvmHashTableLock(pCache);
+    ArrayObject* annoArray = entry->annotations;
+    dvmHashTableUnlock(pCache);
+    if (annoArray != NULL)
+        return annoArray;
+
+    /* decoding allocates, and the GC needs the lock to visit the table */
+    ArrayObject* newArray = processAnnotationSet(clazz, entry->pAnnoSet,
+                                                 kDexVisibilityRuntime);
+    if (newArray == NULL)
+        return NULL;
+
+    dvmHashTableLock(pCache);
+    if (entry->annotations == NULL)
+        entry->annotations = newArray;
+    annoArray = entry->annotations;
+    dvmHashTableUnlock(pCache);
+
+    /* the table holds it now, if it took ours */
+    dvmReleaseTrackedAlloc((Object*) newArray, NULL);
+    return annoArray;
+}
+
+/*
+ * Return a copy of the runtime-visible annotations in "pAnnoSet" for the
+ * caller to keep.
+ *
+ * Caller must call dvmReleaseTrackedAlloc().
+ *
+ * Returns NULL with an exception raised on failure.
+ */
+static ArrayObject* getCachedAnnotationSet(const ClassObject* clazz,
+    const DexAnnotationSetItem* pAnnoSet)
+{
+    AnnotationSetEntry* entry = getAnnotationSetEntry(clazz, pAnnoSet);
+    if (entry == NULL)
+        return NULL;
+    ArrayObject* annoArray = getDecodedAnnotations(clazz, entry);
+    if (annoArray == NULL)
+        return NULL;
+    return (ArrayObject*) dvmCloneObject((Object*) annoArray, ALLOC_DEFAULT);
+}
+
+/*
+ * Return the Annotation object of the specified type in "pAnnoSet", or
+ * NULL if the set contains no annotation of that type.
+ */
+static Object* getCachedAnnotation(const ClassObject* clazz,
+    const DexAnnotationSetItem* pAnnoSet, const ClassObject* annotationClazz)
+{
+    AnnotationSetEntry* entry = getAnnotationSetEntry(clazz, pAnnoSet);
+    if (entry == NULL)
+        return NULL;
+
+    u4 idx;
+    for (idx = 0; idx < entry->numTypes; idx++) {
+        if (entry->types[idx] == annotationClazz)
+            break;
+    }
+    if (idx == entry->numTypes)
+        return NULL;
+
+    ArrayObject* annoArray = getDecodedAnnotations(clazz, entry);
+    if (annoArray == NULL)
+        return NULL;
+
+    /*
+     * A type that resolves can still fail to decode, which shifts the
+     * array.  In that (broken-DEX) case decode just this one again.
+     */
+    if (annoArray->length != entry->numTypes) {
+        return getAnnotationObjectFromAnnotationSet(clazz, pAnnoSet,
+                kDexVisibilityRuntime, annotationClazz);
+    }
+    return ((Object**)(void*) annoArray->contents)[idx];
+}
+
+/*
+ * Returns true if "pAnnoSet" has a runtime-visible annotation of the
+ * specified type.  Only touches the cached type list.
+ */
+static bool isCachedAnnotationPresent(const ClassObject* clazz,
+    const DexAnnotationSetItem* pAnnoSet, const ClassObject* annotationClazz)
+{
+    AnnotationSetEntry* entry = getAnnotationSetEntry(clazz, pAnnoSet);
+    if (entry == NULL)
+        return false;
+    for (u4 i = 0; i < entry->numTypes; i++) {
+        if (entry->types[i] == annotationClazz)
+            return true;
+    }
+    return false;
+}
+
 /*
  * ===========================================================================
  *      Skipping and scanning
@@ -1259,8 +1467,7 @@ ArrayObject* dvmGetClassAnnotations(const ClassObject* clazz)
         /* no annotations for anything in class, or no class annotations */
         annoArray = emptyAnnoArray();
     } else {
-        annoArray = processAnnotationSet(clazz, pAnnoSet,
-                        kDexVisibilityRuntime);
+        annoArray = getCachedAnnotationSet(clazz, pAnnoSet);
     }
 
     return annoArray;
@@ -1276,8 +1483,7 @@ Object* dvmGetClassAnnotation(const ClassObject* clazz,
     if (pAnnoSet == NULL) {
         return NULL;
     }
-    return getAnnotationObjectFromAnnotationSet(clazz, pAnnoSet,
-            kDexVisibilityRuntime, annotationClazz);
+    return getCachedAnnotation(clazz, pAnnoSet, annotationClazz);
 }
 
 /*
@@ -1290,9 +1496,7 @@ bool dvmIsClassAnnotationPresent(const ClassObject* clazz,
     if (pAnnoSet == NULL) {
         return false;
     }
-    const DexAnnotationItem* pAnnoItem = getAnnotationItemFromAnnotationSet(
-            clazz, pAnnoSet, kDexVisibilityRuntime, annotationClazz);
-    return (pAnnoItem != NULL);
+    return isCachedAnnotationPresent(clazz, pAnnoSet, annotationClazz);
 }
 
 /*
@@ -1668,25 +1872,28 @@ static const DexAnnotationSetItem* findAnnotationSetForMethod(
         pMethodList = dexGetMethodAnnotations(pDexFile, pAnnoDir);
         if (pMethodList != NULL) {
             /*
-             * Run through the list and find a matching method.  We compare the
-             * method ref indices in the annotation list with the method's DEX
-             * method_idx value.
-             *
-             * TODO: use a binary search for long lists
+             * The list is sorted by method_idx, so binary search it for
+             * the method's DEX method_idx value.
              *
              * Alternate approach: for each entry in the annotations list,
              * find the method definition in the DEX file and perform string
              * comparisons on class name, method name, and signature.
              */
             u4 methodIdx = dvmGetMethodIdx(method);
-            u4 count = dexGetMethodAnnotationsSize(pDexFile, pAnnoDir);
-            u4 idx;
-
-            for (idx = 0; idx < count; idx++) {
-                if (pMethodList[idx].methodIdx == methodIdx) {
+            int lo = 0;
+            int hi = (int) dexGetMethodAnnotationsSize(pDexFile, pAnnoDir) - 1;
+
+            while (lo <= hi) {
+                int mid = (lo + hi) >> 1;
+                u4 midIdx = pMethodList[mid].methodIdx;
+                if (midIdx < methodIdx) {
+                    lo = mid + 1;
+                } else if (midIdx > methodIdx) {
+                    hi = mid - 1;
+                } else {
                     /* found! */
                     pAnnoSet = dexGetMethodAnnotationSetItem(pDexFile,
-                                    &pMethodList[idx]);
+                                    &pMethodList[mid]);
                     break;
                 }
             }
@@ -1715,7 +1922,7 @@ ArrayObject* dvmGetMethodAnnotations(const Method* method)
         /* no matching annotations found */
         annoArray = emptyAnnoArray();
     } else {
-        annoArray = processAnnotationSet(clazz, pAnnoSet,kDexVisibilityRuntime);
+        annoArray = getCachedAnnotationSet(clazz, pAnnoSet);
     }
 
     return annoArray;
@@ -1731,8 +1938,7 @@ Object* dvmGetMethodAnnotation(const ClassObject* clazz, const Method* method,
     if (pAnnoSet == NULL) {
         return NULL;
     }
-    return getAnnotationObjectFromAnnotationSet(clazz, pAnnoSet,
-            kDexVisibilityRuntime, annotationClazz);
+    return getCachedAnnotation(clazz, pAnnoSet, annotationClazz);
 }
 
 /*
@@ -1745,9 +1951,7 @@ bool dvmIsMethodAnnotationPresent(const ClassObject* clazz,
     if (pAnnoSet == NULL) {
         return false;
     }
-    const DexAnnotationItem* pAnnoItem = getAnnotationItemFromAnnotationSet(
-            clazz, pAnnoSet, kDexVisibilityRuntime, annotationClazz);
-    return (pAnnoItem != NULL);
+    return isCachedAnnotationPresent(clazz, pAnnoSet, annotationClazz);
 }
 
 /*
@@ -1981,24 +2185,27 @@ static const DexAnnotationSetItem* findAnnotationSetForField(const Field* field)
     }
 
     /*
-     * Run through the list and find a matching field.  We compare the
-     * field ref indices in the annotation list with the field's DEX
-     * field_idx value.
-     *
-     * TODO: use a binary search for long lists
+     * The list is sorted by field_idx, so binary search it for the
+     * field's DEX field_idx value.
      *
      * Alternate approach: for each entry in the annotations list,
      * find the field definition in the DEX file and perform string
      * comparisons on class name, field name, and signature.
      */
     u4 fieldIdx = dvmGetFieldIdx(field);
-    u4 count = dexGetFieldAnnotationsSize(pDexFile, pAnnoDir);
-    u4 idx;
-
-    for (idx = 0; idx < count; idx++) {
-        if (pFieldList[idx].fieldIdx == fieldIdx) {
+    int lo = 0;
+    int hi = (int) dexGetFieldAnnotationsSize(pDexFile, pAnnoDir) - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        u4 midIdx = pFieldList[mid].fieldIdx;
+        if (midIdx < fieldIdx) {
+            lo = mid + 1;
+        } else if (midIdx > fieldIdx) {
+            hi = mid - 1;
+        } else {
             /* found! */
-            return dexGetFieldAnnotationSetItem(pDexFile, &pFieldList[idx]);
+            return dexGetFieldAnnotationSetItem(pDexFile, &pFieldList[mid]);
         }
     }
 
@@ -2024,8 +2231,7 @@ ArrayObject* dvmGetFieldAnnotations(const Field* field)
         /* no matching annotations found */
         annoArray = emptyAnnoArray();
     } else {
-        annoArray = processAnnotationSet(clazz, pAnnoSet,
-                        kDexVisibilityRuntime);
+        annoArray = getCachedAnnotationSet(clazz, pAnnoSet);
     }
 
     return annoArray;
@@ -2041,8 +2247,7 @@ Object* dvmGetFieldAnnotation(const ClassObject* clazz, const Field* field,
     if (pAnnoSet == NULL) {
         return NULL;
     }
-    return getAnnotationObjectFromAnnotationSet(clazz, pAnnoSet,
-            kDexVisibilityRuntime, annotationClazz);
+    return getCachedAnnotation(clazz, pAnnoSet, annotationClazz);
 }
 
 /*
@@ -2055,9 +2260,7 @@ bool dvmIsFieldAnnotationPresent(const ClassObject* clazz,
     if (pAnnoSet == NULL) {
         return false;
     }
-    const DexAnnotationItem* pAnnoItem = getAnnotationItemFromAnnotationSet(
-            clazz, pAnnoSet, kDexVisibilityRuntime, annotationClazz);
-    return (pAnnoItem != NULL);
+    return isCachedAnnotationPresent(clazz, pAnnoSet, annotationClazz);
 }
 
 /*
@@ -2163,24 +2366,27 @@ static const DexParameterAnnotationsItem* findAnnotationsItemForMethod(
         return NULL;
 
     /*
-     * Run through the list and find a matching method.  We compare the
-     * method ref indices in the annotation list with the method's DEX
-     * method_idx value.
-     *
-     * TODO: use a binary search for long lists
+     * The list is sorted by method_idx, so binary search it for the
+     * method's DEX method_idx value.
      *
      * Alternate approach: for each entry in the annotations list,
      * find the method definition in the DEX file and perform string
      * comparisons on class name, method name, and signature.
      */
     u4 methodIdx = dvmGetMethodIdx(method);
-    u4 count = dexGetParameterAnnotationsSize(pDexFile, pAnnoDir);
-    u4 idx;
-
-    for (idx = 0; idx < count; idx++) {
-        if (pParameterList[idx].methodIdx == methodIdx) {
+    int lo = 0;
+    int hi = (int) dexGetParameterAnnotationsSize(pDexFile, pAnnoDir) - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        u4 midIdx = pParameterList[mid].methodIdx;
+        if (midIdx < methodIdx) {
+            lo = mid + 1;
+        } else if (midIdx > methodIdx) {
+            hi = mid - 1;
+        } else {
             /* found! */
-            return &pParameterList[idx];
+            return &pParameterList[mid];
         }
     }
 
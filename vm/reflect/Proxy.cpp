@@ -47,7 +47,9 @@ static bool mustWrapException(const Method* method, const Object* throwable);
 
 /* private static fields in the Proxy class */
 #define kThrowsField    0
-#define kProxySFieldCount 1
+#define kMethodsField   1
+#define kReturnTypesField 2
+#define kProxySFieldCount 3
 
 /*
  * Generate a proxy class with the specified name, interfaces, and loader.
@@ -68,6 +70,8 @@ ClassObject* dvmGenerateProxyClass(StringObject* str, ArrayObject* interfaces,
 {
     ClassObject* result = NULL;
     ArrayObject* throws = NULL;
+    ArrayObject* methodObjs = NULL;
+    ArrayObject* returnTypes = NULL;
 
     char* nameStr = dvmCreateCstrFromString(str);
     if (nameStr == NULL) {
@@ -149,8 +153,40 @@ ClassObject* dvmGenerateProxyClass(StringObject* str, ArrayObject* interfaces,
         for (int i = 0; i < newClass->virtualMethodCount; i++) {
             createHandlerMethod(newClass, &newClass->virtualMethods[i], methods[i]);
         }
-        free(methods);
         dvmLinearReadOnly(newClass->classLoader, newClass->virtualMethods);
+
+        /*
+         * Build the java.lang.reflect.Method and return type for each
+         * handler method now, rather than on every call.  This also means
+         * the handler sees the same Method object each time, as it would
+         * on other VMs.
+         */
+        methodObjs = dvmAllocArrayByClass(gDvm.classJavaLangReflectMethodArray,
+                methodCount, ALLOC_DEFAULT);
+        returnTypes = dvmAllocArrayByClass(gDvm.classJavaLangClassArray,
+                methodCount, ALLOC_DEFAULT);
+        if (methodObjs == NULL || returnTypes == NULL) {
+            free(methods);
+            goto bail;
+        }
+        for (int i = 0; i < methodCount; i++) {
+            Object* methodObj = dvmCreateReflectMethodObject(methods[i]);
+            if (methodObj == NULL) {
+                free(methods);
+                goto bail;
+            }
+            dvmSetObjectArrayElement(methodObjs, i, methodObj);
+            dvmReleaseTrackedAlloc(methodObj, NULL);
+
+            ClassObject* returnType =
+                dvmGetBoxedReturnType(&newClass->virtualMethods[i]);
+            if (returnType == NULL) {
+                free(methods);
+                goto bail;
+            }
+            dvmSetObjectArrayElement(returnTypes, i, (Object*) returnType);
+        }
+        free(methods);
     }
 
     /*
@@ -169,10 +205,11 @@ ClassObject* dvmGenerateProxyClass(StringObject* str, ArrayObject* interfaces,
     }
 
     /*
-     * Static field list.  We have one private field, for our list of
-     * exceptions declared for each method.
+     * Static field list.  We have three private fields: the exceptions
+     * declared for each method, and the Method object and return type
+     * that each handler method passes and checks.
      */
-    assert(kProxySFieldCount == 1);
+    assert(kProxySFieldCount == 3);
     newClass->sfieldCount = kProxySFieldCount;
     {
         StaticField* sfield = &newClass->sfields[kThrowsField];
@@ -181,6 +218,20 @@ ClassObject* dvmGenerateProxyClass(StringObject* str, ArrayObject* interfaces,
         sfield->signature = "[[Ljava/lang/Throwable;";
         sfield->accessFlags = ACC_STATIC | ACC_PRIVATE;
         dvmSetStaticFieldObject(sfield, (Object*)throws);
+
+        sfield = &newClass->sfields[kMethodsField];
+        sfield->clazz = newClass;
+        sfield->name = "methods";
+        sfield->signature = "[Ljava/lang/reflect/Method;";
+        sfield->accessFlags = ACC_STATIC | ACC_PRIVATE;
+        dvmSetStaticFieldObject(sfield, (Object*)methodObjs);
+
+        sfield = &newClass->sfields[kReturnTypesField];
+        sfield->clazz = newClass;
+        sfield->name = "returnTypes";
+        sfield->signature = "[Ljava/lang/Class;";
+        sfield->accessFlags = ACC_STATIC | ACC_PRIVATE;
+        dvmSetStaticFieldObject(sfield, (Object*)returnTypes);
     }
 
     /*
@@ -220,6 +271,8 @@ bail:
 
     /* allow the GC to free these when nothing else has a reference */
     dvmReleaseTrackedAlloc((Object*) throws, NULL);
+    dvmReleaseTrackedAlloc((Object*) methodObjs, NULL);
+    dvmReleaseTrackedAlloc((Object*) returnTypes, NULL);
     dvmReleaseTrackedAlloc((Object*) newClass, NULL);
 
     return result;
@@ -768,6 +821,7 @@ static void createHandlerMethod(ClassObject* clazz, Method* dstMeth,
     dstMeth->name = srcMeth->name;
     dstMeth->prototype = srcMeth->prototype;
     dstMeth->shorty = srcMeth->shorty;
+    dstMeth->callArgInfo = srcMeth->callArgInfo;
     // no pDexCode or pDexMethod
 
     int argsSize = dvmComputeMethodArgsSize(dstMeth) + 1;
@@ -863,18 +917,18 @@ static void proxyConstructor(const u4* args, JValue* pResult,
  * The method we're calling looks like:
  *   public Object invoke(Object proxy, Method method, Object[] args)
  *
- * This means we have to create a Method object, box our arguments into
- * a new Object[] array, make the call, and unbox the return value if
- * necessary.
+ * This means we have to box our arguments into a new Object[] array,
+ * make the call, and unbox the return value if necessary.  The Method
+ * object is shared by every call.
  */
 static void proxyInvoker(const u4* args, JValue* pResult,
     const Method* method, Thread* self)
 {
     Object* thisObj = (Object*) args[0];
-    Object* methodObj = NULL;
+    Object* methodObj;
     ArrayObject* argArray = NULL;
     Object* handler;
-    Method* invoke;
+    const Method* invoke;
     ClassObject* returnType;
     JValue invokeResult;
 
@@ -885,12 +939,10 @@ static void proxyInvoker(const u4* args, JValue* pResult,
     handler = dvmGetFieldObject(thisObj, gDvm.offJavaLangReflectProxy_h);
 
     /*
-     * Find the invoke() method, looking in "this"s class.  (Because we
-     * start here we don't have to convert it to a vtable index and then
-     * index into this' vtable.)
+     * Find the handler's invoke() through its interface table.
      */
-    invoke = dvmFindVirtualMethodHierByDescriptor(handler->clazz, "invoke",
-            "(Ljava/lang/Object;Ljava/lang/reflect/Method;[Ljava/lang/Object;)Ljava/lang/Object;");
+    invoke = dvmGetVirtualizedMethod(handler->clazz,
+            gDvm.methJavaLangReflectInvocationHandler_invoke);
     if (invoke == NULL) {
         ALOGE("Unable to find invoke()");
         dvmAbort();
@@ -901,33 +953,22 @@ static void proxyInvoker(const u4* args, JValue* pResult,
         thisObj, handler->clazz->descriptor);
 
     /*
-     * Create a java.lang.reflect.Method object for this method.
-     *
-     * We don't want to use "method", because that's the concrete
-     * implementation in the proxy class.  We want the abstract Method
-     * from the declaring interface.  We have a pointer to it tucked
-     * away in the "insns" field.
-     *
-     * TODO: this could be cached for performance.
+     * Get the java.lang.reflect.Method object for the abstract method in
+     * the declaring interface (tucked away in "insns"), and the return
+     * type, which dvmGenerateProxyClass built for us.
      */
-    methodObj = dvmCreateReflectMethodObject((Method*) method->insns);
-    if (methodObj == NULL) {
-        assert(dvmCheckException(self));
-        goto bail;
-    }
-
-    /*
-     * Determine the return type from the signature.
-     *
-     * TODO: this could be cached for performance.
-     */
-    returnType = dvmGetBoxedReturnType(method);
-    if (returnType == NULL) {
-        char* desc = dexProtoCopyMethodDescriptor(&method->prototype);
-        ALOGE("Could not determine return type for '%s'", desc);
-        free(desc);
-        assert(dvmCheckException(self));
-        goto bail;
+    {
+        int methodIndex = method - method->clazz->virtualMethods;
+        assert(methodIndex >= 0 &&
+               methodIndex < method->clazz->virtualMethodCount);
+
+        const ArrayObject* methodObjs = (ArrayObject*)
+            dvmGetStaticFieldObject(&method->clazz->sfields[kMethodsField]);
+        const ArrayObject* returnTypes = (ArrayObject*)
+            dvmGetStaticFieldObject(&method->clazz->sfields[kReturnTypesField]);
+        methodObj = ((Object**)(void*)methodObjs->contents)[methodIndex];
+        returnType =
+            ((ClassObject**)(void*)returnTypes->contents)[methodIndex];
     }
     ALOGV("  return type will be %s", returnType->descriptor);
 
@@ -984,7 +1025,6 @@ static void proxyInvoker(const u4* args, JValue* pResult,
     }
 
 bail:
-    dvmReleaseTrackedAlloc(methodObj, self);
     dvmReleaseTrackedAlloc((Object*)argArray, self);
 }
 
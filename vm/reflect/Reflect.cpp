@@ -31,33 +31,36 @@
  */
 bool dvmValidateBoxClasses()
 {
-    static const char* classes[] = {
-        "Ljava/lang/Boolean;",
-        "Ljava/lang/Character;",
-        "Ljava/lang/Float;",
-        "Ljava/lang/Double;",
-        "Ljava/lang/Byte;",
-        "Ljava/lang/Short;",
-        "Ljava/lang/Integer;",
-        "Ljava/lang/Long;",
-        NULL
+    static const struct {
+        const char*     descriptor;
+        PrimitiveType   type;
+    } classes[] = {
+        { "Ljava/lang/Boolean;",   PRIM_BOOLEAN },
+        { "Ljava/lang/Character;", PRIM_CHAR },
+        { "Ljava/lang/Float;",     PRIM_FLOAT },
+        { "Ljava/lang/Double;",    PRIM_DOUBLE },
+        { "Ljava/lang/Byte;",      PRIM_BYTE },
+        { "Ljava/lang/Short;",     PRIM_SHORT },
+        { "Ljava/lang/Integer;",   PRIM_INT },
+        { "Ljava/lang/Long;",      PRIM_LONG },
     };
-    const char** ccp;
 
-    for (ccp = classes; *ccp != NULL; ccp++) {
+    for (size_t i = 0; i < NELEM(classes); i++) {
         ClassObject* clazz;
 
-        clazz = dvmFindClassNoInit(*ccp, NULL);
+        clazz = dvmFindClassNoInit(classes[i].descriptor, NULL);
         if (clazz == NULL) {
-            ALOGE("Couldn't find '%s'", *ccp);
+            ALOGE("Couldn't find '%s'", classes[i].descriptor);
             return false;
         }
 
         if (clazz->ifieldCount != 1) {
             ALOGE("Found %d instance fields in '%s'",
-                clazz->ifieldCount, *ccp);
+                clazz->ifieldCount, classes[i].descriptor);
             return false;
         }
+
+        gDvm.boxClasses[classes[i].type] = clazz;
     }
 
     return true;
@@ -173,6 +176,114 @@ static ArrayObject* convertSignatureToClassArray(char** pSignature,
 }
 
 
+static inline u4 methodHash(const Method* method)
+{
+    return (u4) ((uintptr_t) method >> 3);
+}
+
+static int compareReflectSig(const void* tableItem, const void* looseItem)
+{
+    return ((const ReflectSig*) tableItem)->method !=
+           ((const ReflectSig*) looseItem)->method;
+}
+
+bool dvmReflectStartup()
+{
+    gDvm.reflectSigCache = dvmHashTableCreateRobinHood(dvmHashSize(256), free);
+    gDvm.annotationCache = dvmHashTableCreateRobinHood(dvmHashSize(256), free);
+    return (gDvm.reflectSigCache != NULL && gDvm.annotationCache != NULL);
+}
+
+void dvmReflectShutdown()
+{
+    dvmHashTableFree(gDvm.reflectSigCache);
+    gDvm.reflectSigCache = NULL;
+    dvmHashTableFree(gDvm.annotationCache);
+    gDvm.annotationCache = NULL;
+}
+
+/*
+ * Return the cached signature pieces for "meth", resolving and adding
+ * them on first use.  Dependency injection and serialization code asks
+ * for the same methods over and over, and each time we'd otherwise
+ * parse the descriptor, look up every class and read the annotations.
+ *
+ * Entries are freed only at shutdown (methods are never unloaded), so
+ * the pointer stays good without the lock.
+ *
+ * Returns NULL with an exception raised on failure.
+ */
+static const ReflectSig* getReflectSig(const Method* meth)
+{
+    HashTable* pCache = gDvm.reflectSigCache;
+    ReflectSig key;
+    key.method = meth;
+
+    dvmHashTableLock(pCache);
+    ReflectSig* sig = (ReflectSig*) dvmHashTableLookup(pCache,
+        methodHash(meth), &key, compareReflectSig, false);
+    dvmHashTableUnlock(pCache);
+    if (sig != NULL)
+        return sig;
+
+    /*
+     * Build it without the lock: we allocate, and the GC needs the lock
+     * to visit the table.
+     */
+    ReflectSig* newSig = (ReflectSig*) calloc(1, sizeof(*newSig));
+    if (newSig == NULL) {
+        dvmThrowOutOfMemoryError(NULL);
+        return NULL;
+    }
+    newSig->method = meth;
+
+    DexStringCache mangle;
+    dexStringCacheInit(&mangle);
+    char* cp = dvmCopyDescriptorStringFromMethod(meth, &mangle);
+    newSig->params = convertSignatureToClassArray(&cp, meth->clazz);
+    if (newSig->params == NULL)
+        goto fail;
+    assert(*cp == ')');
+    cp++;
+    newSig->returnType = convertSignaturePartToClass(&cp, meth->clazz);
+    if (newSig->returnType == NULL)
+        goto fail;
+
+    newSig->exceptions = dvmGetMethodThrows(meth);
+    if (dvmCheckException(dvmThreadSelf()))
+        goto fail;
+
+    if (meth->name[0] != '<') {
+        newSig->name = dvmCreateStringFromCstr(meth->name);
+        if (newSig->name == NULL)
+            goto fail;
+    }
+
+    /* someone may have beaten us to it, in which case theirs wins */
+    dvmHashTableLock(pCache);
+    sig = (ReflectSig*) dvmHashTableLookup(pCache, methodHash(meth), newSig,
+        compareReflectSig, true);
+    dvmHashTableUnlock(pCache);
+
+    /* the table holds them now, if it took ours */
+    dexStringCacheRelease(&mangle);
+    dvmReleaseTrackedAlloc((Object*) newSig->params, NULL);
+    dvmReleaseTrackedAlloc((Object*) newSig->exceptions, NULL);
+    dvmReleaseTrackedAlloc((Object*) newSig->name, NULL);
+    if (sig != newSig)
+        free(newSig);
+    return sig;
+
+fail:
+    assert(dvmCheckException(dvmThreadSelf()));
+    dexStringCacheRelease(&mangle);
+    dvmReleaseTrackedAlloc((Object*) newSig->params, NULL);
+    dvmReleaseTrackedAlloc((Object*) newSig->exceptions, NULL);
+    free(newSig);
+    return NULL;
+}
+
+
 /*
  * Convert a field pointer to a slot number.
  *
@@ -350,7 +461,7 @@ static int methodToSlot(const Method* meth)
     int slot;
 
     if (dvmIsDirectMethod(meth)) {
-        slot = meth - clazz->directMethods;
+        slot = meth - dvmGetDirectMethods(clazz);
         assert(slot >= 0 && slot < clazz->directMethodCount);
         slot = -(slot+1);
     } else {
@@ -369,7 +480,7 @@ Method* dvmSlotToMethod(ClassObject* clazz, int slot)
     if (slot < 0) {
         slot = -(slot+1);
         assert(slot < clazz->directMethodCount);
-        return &clazz->directMethods[slot];
+        return &dvmGetDirectMethods(clazz)[slot];
     } else {
         assert(slot < clazz->virtualMethodCount);
         return &clazz->virtualMethods[slot];
@@ -389,15 +500,10 @@ Method* dvmSlotToMethod(ClassObject* clazz, int slot)
 static Object* createConstructorObject(Method* meth)
 {
     Object* result = NULL;
-    ArrayObject* params = NULL;
-    ArrayObject* exceptions = NULL;
     Object* consObj;
-    DexStringCache mangle;
-    char* cp;
+    const ReflectSig* sig;
     int slot, method_idx;
 
-    dexStringCacheInit(&mangle);
-
     /* parent should guarantee init so we don't have to check on every call */
     assert(dvmIsClassInitialized(gDvm.classJavaLangReflectConstructor));
 
@@ -407,30 +513,20 @@ static Object* createConstructorObject(Method* meth)
         goto bail;
 
     /*
-     * Convert the signature string into an array of classes representing
-     * the arguments.
+     * The parameter classes and declared exceptions.
      */
-    cp = dvmCopyDescriptorStringFromMethod(meth, &mangle);
-    params = convertSignatureToClassArray(&cp, meth->clazz);
-    if (params == NULL)
-        goto bail;
-    assert(*cp == ')');
-    assert(*(cp+1) == 'V');
-
-    /*
-     * Create an array with one entry for every exception that the class
-     * is declared to throw.
-     */
-    exceptions = dvmGetMethodThrows(meth);
-    if (dvmCheckException(dvmThreadSelf()))
+    sig = getReflectSig(meth);
+    if (sig == NULL)
         goto bail;
+    assert(sig->returnType == gDvm.typeVoid);
 
     slot = methodToSlot(meth);
     method_idx = dvmGetMethodIdx(meth);
 
     JValue unused;
     dvmCallMethod(dvmThreadSelf(), gDvm.methJavaLangReflectConstructor_init,
-        consObj, &unused, meth->clazz, params, exceptions, slot, method_idx);
+        consObj, &unused, meth->clazz, sig->params, sig->exceptions, slot,
+        method_idx);
     if (dvmCheckException(dvmThreadSelf())) {
         ALOGD("Constructor class init threw exception");
         goto bail;
@@ -439,9 +535,6 @@ static Object* createConstructorObject(Method* meth)
     result = consObj;
 
 bail:
-    dexStringCacheRelease(&mangle);
-    dvmReleaseTrackedAlloc((Object*) params, NULL);
-    dvmReleaseTrackedAlloc((Object*) exceptions, NULL);
     if (result == NULL) {
         assert(dvmCheckException(dvmThreadSelf()));
         dvmReleaseTrackedAlloc(consObj, NULL);
@@ -470,7 +563,7 @@ ArrayObject* dvmGetDeclaredConstructors(ClassObject* clazz, bool publicOnly)
      */
     size_t count = 0;
     for (int i = 0; i < clazz->directMethodCount; ++i) {
-        Method* meth = &clazz->directMethods[i];
+        Method* meth = &dvmGetDirectMethods(clazz)[i];
         if ((!publicOnly || dvmIsPublicMethod(meth)) &&
             dvmIsConstructorMethod(meth) && !dvmIsStaticMethod(meth))
         {
@@ -491,7 +584,7 @@ ArrayObject* dvmGetDeclaredConstructors(ClassObject* clazz, bool publicOnly)
      */
     size_t ctorObjCount = 0;
     for (int i = 0; i < clazz->directMethodCount; ++i) {
-        Method* meth = &clazz->directMethods[i];
+        Method* meth = &dvmGetDirectMethods(clazz)[i];
         if ((!publicOnly || dvmIsPublicMethod(meth)) &&
             dvmIsConstructorMethod(meth) && !dvmIsStaticMethod(meth))
         {
@@ -527,13 +620,8 @@ ArrayObject* dvmGetDeclaredConstructors(ClassObject* clazz, bool publicOnly)
 Object* dvmCreateReflectMethodObject(const Method* meth)
 {
     Object* result = NULL;
-    ArrayObject* params = NULL;
-    ArrayObject* exceptions = NULL;
-    StringObject* nameObj = NULL;
     Object* methObj;
-    ClassObject* returnType;
-    DexStringCache mangle;
-    char* cp;
+    const ReflectSig* sig;
     int slot, method_idx;
 
     if (dvmCheckException(dvmThreadSelf())) {
@@ -542,8 +630,6 @@ Object* dvmCreateReflectMethodObject(const Method* meth)
         return NULL;
     }
 
-    dexStringCacheInit(&mangle);
-
     /* parent should guarantee init so we don't have to check on every call */
     assert(dvmIsClassInitialized(gDvm.classJavaLangReflectMethod));
 
@@ -552,30 +638,10 @@ Object* dvmCreateReflectMethodObject(const Method* meth)
         goto bail;
 
     /*
-     * Convert the signature string into an array of classes representing
-     * the arguments, and a class for the return type.
+     * The parameter classes, return class, declared exceptions and name.
      */
-    cp = dvmCopyDescriptorStringFromMethod(meth, &mangle);
-    params = convertSignatureToClassArray(&cp, meth->clazz);
-    if (params == NULL)
-        goto bail;
-    assert(*cp == ')');
-    cp++;
-    returnType = convertSignaturePartToClass(&cp, meth->clazz);
-    if (returnType == NULL)
-        goto bail;
-
-    /*
-     * Create an array with one entry for every exception that the class
-     * is declared to throw.
-     */
-    exceptions = dvmGetMethodThrows(meth);
-    if (dvmCheckException(dvmThreadSelf()))
-        goto bail;
-
-    /* method name */
-    nameObj = dvmCreateStringFromCstr(meth->name);
-    if (nameObj == NULL)
+    sig = getReflectSig(meth);
+    if (sig == NULL)
         goto bail;
 
     slot = methodToSlot(meth);
@@ -583,8 +649,8 @@ Object* dvmCreateReflectMethodObject(const Method* meth)
 
     JValue unused;
     dvmCallMethod(dvmThreadSelf(), gDvm.methJavaLangReflectMethod_init,
-        methObj, &unused, meth->clazz, params, exceptions, returnType,
-        nameObj, slot, method_idx);
+        methObj, &unused, meth->clazz, sig->params, sig->exceptions,
+        sig->returnType, sig->name, slot, method_idx);
     if (dvmCheckException(dvmThreadSelf())) {
         ALOGD("Method class init threw exception");
         goto bail;
@@ -593,15 +659,10 @@ Object* dvmCreateReflectMethodObject(const Method* meth)
     result = methObj;
 
 bail:
-    dexStringCacheRelease(&mangle);
     if (result == NULL) {
         assert(dvmCheckException(dvmThreadSelf()));
-    }
-    dvmReleaseTrackedAlloc((Object*) nameObj, NULL);
-    dvmReleaseTrackedAlloc((Object*) params, NULL);
-    dvmReleaseTrackedAlloc((Object*) exceptions, NULL);
-    if (result == NULL)
         dvmReleaseTrackedAlloc(methObj, NULL);
+    }
     return result;
 }
 
@@ -631,7 +692,7 @@ ArrayObject* dvmGetDeclaredMethods(ClassObject* clazz, bool publicOnly)
             count++;
         }
     }
-    meth = clazz->directMethods;
+    meth = dvmGetDirectMethods(clazz);
     for (int i = 0; i < clazz->directMethodCount; i++, meth++) {
         if ((!publicOnly || dvmIsPublicMethod(meth)) && meth->name[0] != '<') {
             count++;
@@ -663,7 +724,7 @@ ArrayObject* dvmGetDeclaredMethods(ClassObject* clazz, bool publicOnly)
             dvmReleaseTrackedAlloc(methObj, NULL);
         }
     }
-    meth = clazz->directMethods;
+    meth = dvmGetDirectMethods(clazz);
     for (int i = 0; i < clazz->directMethodCount; i++, meth++) {
         if ((!publicOnly || dvmIsPublicMethod(meth)) &&
             meth->name[0] != '<')
@@ -765,7 +826,7 @@ Object* dvmGetDeclaredConstructorOrMethod(ClassObject* clazz,
     targetDescriptor = targetDescriptorCache.value;
 
     result = findConstructorOrMethodInArray(clazz->directMethodCount,
-        clazz->directMethods, name, targetDescriptor);
+        dvmGetDirectMethods(clazz), name, targetDescriptor);
     if (result == NULL) {
         result = findConstructorOrMethodInArray(clazz->virtualMethodCount,
             clazz->virtualMethods, name, targetDescriptor);
@@ -846,32 +907,14 @@ ArrayObject* dvmGetInterfaces(ClassObject* clazz)
  */
 static PrimitiveType getBoxedType(DataObject* arg)
 {
-    static const int kJavaLangLen = 11;     // strlen("Ljava/lang/")
-
     if (arg == NULL)
         return PRIM_NOT;
 
-    const char* name = arg->clazz->descriptor;
-
-    if (strncmp(name, "Ljava/lang/", kJavaLangLen) != 0)
-        return PRIM_NOT;
-
-    if (strcmp(name + kJavaLangLen, "Boolean;") == 0)
-        return PRIM_BOOLEAN;
-    if (strcmp(name + kJavaLangLen, "Character;") == 0)
-        return PRIM_CHAR;
-    if (strcmp(name + kJavaLangLen, "Float;") == 0)
-        return PRIM_FLOAT;
-    if (strcmp(name + kJavaLangLen, "Double;") == 0)
-        return PRIM_DOUBLE;
-    if (strcmp(name + kJavaLangLen, "Byte;") == 0)
-        return PRIM_BYTE;
-    if (strcmp(name + kJavaLangLen, "Short;") == 0)
-        return PRIM_SHORT;
-    if (strcmp(name + kJavaLangLen, "Integer;") == 0)
-        return PRIM_INT;
-    if (strcmp(name + kJavaLangLen, "Long;") == 0)
-        return PRIM_LONG;
+    ClassObject* clazz = arg->clazz;
+    for (int type = PRIM_BOOLEAN; type <= PRIM_DOUBLE; type++) {
+        if (gDvm.boxClasses[type] == clazz)
+            return (PrimitiveType) type;
+    }
     return PRIM_NOT;
 }
 
@@ -1023,6 +1066,17 @@ int dvmConvertArgument(DataObject* arg, ClassObject* type, s4* destPtr)
         PrimitiveType srcType;
         s4* valuePtr;
 
+        /* the usual case: exactly the right box, so no widening */
+        PrimitiveType dstType = type->primitiveType;
+        if (arg != NULL && arg->clazz == gDvm.boxClasses[dstType]) {
+            if (dstType == PRIM_LONG || dstType == PRIM_DOUBLE) {
+                *(s8*) destPtr = *(s8*) arg->instanceData;
+                return 2;
+            }
+            *destPtr = *(s4*) arg->instanceData;
+            return 1;
+        }
+
         srcType = getBoxedType(arg);
         if (srcType == PRIM_NOT) {     // didn't pass a boxed primitive in
             LOGVV("conv arg: type '%s' not boxed primitive",
@@ -1066,7 +1120,6 @@ DataObject* dvmBoxPrimitive(JValue value, ClassObject* returnType)
     DataObject* wrapperObj;
     s4* dataPtr;
     PrimitiveType typeIndex = returnType->primitiveType;
-    const char* classDescriptor;
 
     if (typeIndex == PRIM_NOT) {
         /* add to tracking table so return value is always in table */
@@ -1075,14 +1128,14 @@ DataObject* dvmBoxPrimitive(JValue value, ClassObject* returnType)
         return (DataObject*) value.l;
     }
 
-    classDescriptor = dexGetBoxedTypeDescriptor(typeIndex);
-    if (classDescriptor == NULL) {
+    if (typeIndex == PRIM_VOID) {
         return NULL;
     }
 
-    wrapperClass = dvmFindSystemClass(classDescriptor);
-    if (wrapperClass == NULL) {
-        ALOGW("Unable to find '%s'", classDescriptor);
+    /* the box classes were found by dvmValidateBoxClasses */
+    wrapperClass = gDvm.boxClasses[typeIndex];
+    assert(wrapperClass != NULL);
+    if (!dvmIsClassInitialized(wrapperClass) && !dvmInitClass(wrapperClass)) {
         assert(dvmCheckException(dvmThreadSelf()));
         return NULL;
     }
@@ -20,10 +20,47 @@
 #define DALVIK_REFLECT_REFLECT_H_
 
 /*
- * During startup, validate the "box" classes, e.g. java/lang/Integer.
+ * During startup, validate the "box" classes, e.g. java/lang/Integer,
+ * and record them in gDvm.boxClasses.
  */
 bool dvmValidateBoxClasses();
 
+/*
+ * Create and free the caches of reflected method signatures and decoded
+ * annotation sets.
+ */
+bool dvmReflectStartup();
+void dvmReflectShutdown();
+
+/*
+ * An entry in gDvm.reflectSigCache: what a java/lang/reflect/Method or
+ * Constructor for "method" is built from.  The objects are shared by
+ * every reflection object for the method (they hand out clones of the
+ * arrays), and are GC roots.
+ */
+struct ReflectSig {
+    const Method*   method;
+    ArrayObject*    params;         /* Class[] of parameter types */
+    ArrayObject*    exceptions;     /* Class[] from Throws, or NULL */
+    ClassObject*    returnType;
+    StringObject*   name;           /* NULL for constructors */
+};
+
+/*
+ * An entry in gDvm.annotationCache: one runtime-visible annotation set
+ * from a DEX file, shared by every class, method and field that points
+ * at it.  "types" lists the annotation classes that resolved, in set
+ * order; "annotations" is the decoded Annotation[], filled in the first
+ * time someone asks for the objects and a GC root from then on.
+ */
+struct AnnotationSetEntry {
+    const DexAnnotationSetItem* pAnnoSet;
+    const DvmDex*   pDvmDex;
+    ArrayObject*    annotations;    /* NULL until decoded */
+    u4              numTypes;
+    ClassObject*    types[1];       /* numTypes entries */
+};
+
 /*
  * Get all fields declared by a class.
  *
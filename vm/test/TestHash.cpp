@@ -185,6 +185,48 @@ bool dvmTestHash()
     }
 
     dvmHashTableFree(pTab);
+
+
+    /*
+     * Round 3: Robin Hood placement and backward-shift removal.
+     */
+    pTab = dvmHashTableCreateRobinHood(dvmHashSize(2), free);
+    if (pTab == NULL)
+        return false;
+
+    /* a few entries sharing a home slot, then some that get displaced */
+    for (i = 0; i < kNumTestEntries; i++) {
+        sprintf(tmpStr, "entry %d", i);
+        hash = (i < kNumTestEntries / 2) ? 0 : i;
+        str = (const char*) dvmHashTableLookup(pTab, hash, strdup(tmpStr),
+                (HashCompareFunc) strcmp, true);
+        assert(str != NULL);
+    }
+    dumpForeach(pTab);
+
+    /* remove every other entry; the rest must still be found */
+    for (i = 0; i < kNumTestEntries; i += 2) {
+        sprintf(tmpStr, "entry %d", i);
+        hash = (i < kNumTestEntries / 2) ? 0 : i;
+        str = (const char*) dvmHashTableLookup(pTab, hash, tmpStr,
+                (HashCompareFunc) strcmp, false);
+        if (str == NULL || !dvmHashTableRemove(pTab, hash, (void*)str))
+            ALOGE("TestHash failed to delete '%s'", tmpStr);
+        else
+            free((void*)str);
+    }
+    for (i = 0; i < kNumTestEntries; i++) {
+        sprintf(tmpStr, "entry %d", i);
+        hash = (i < kNumTestEntries / 2) ? 0 : i;
+        str = (const char*) dvmHashTableLookup(pTab, hash, tmpStr,
+                (HashCompareFunc) strcmp, false);
+        if ((str != NULL) != (i % 2 != 0))
+            ALOGE("TestHash robin hood lookup wrong for '%s'", tmpStr);
+    }
+    if (pTab->numDeadEntries != 0)
+        ALOGE("TestHash robin hood table left tombstones");
+
+    dvmHashTableFree(pTab);
     ALOGV("TestHash END");
 
     return true;
@@ -73,7 +73,7 @@ static bool basicTest()
     const u4 cookie = IRT_FIRST_SEGMENT;
     bool result = false;
 
-    if (!irt.init(kTableMax/2, kTableMax, kIndirectKindGlobal)) {
+    if (!irt.init(kTableMax, kIndirectKindGlobal)) {
         return false;
     }
 
@@ -344,6 +344,79 @@ bail:
     return result;
 }
 
+/*
+ * Check that holes are reused in the right segment, including after a
+ * segment with holes of its own has been popped.
+ */
+static bool segmentHoleTest()
+{
+    static const int kTableMax = 20;
+    IndirectRefTable irt;
+    IndirectRef manyRefs[4];
+    ClassObject* clazz = dvmFindClass("Ljava/lang/Object;", NULL);
+    Object* obj0 = dvmAllocObject(clazz, ALLOC_DONT_TRACK);
+    Object* obj1 = dvmAllocObject(clazz, ALLOC_DONT_TRACK);
+    const u4 cookie = IRT_FIRST_SEGMENT;
+    u4 innerCookie;
+    IndirectRef iref0, iref1;
+    bool result = false;
+
+    DBUG_MSG("+++ START segment holes\n");
+
+    if (!irt.init(kTableMax, kIndirectKindLocal)) {
+        return false;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        manyRefs[i] = irt.add(cookie, obj0);
+    }
+    if (!irt.remove(cookie, manyRefs[1])) {
+        ALOGE("outer hole removal failed");
+        goto bail;
+    }
+
+    /* push a segment, leave a hole in it and fill it */
+    innerCookie = irt.segmentState.all;
+    iref0 = irt.add(innerCookie, obj1);
+    iref1 = irt.add(innerCookie, obj1);
+    if (!irt.remove(innerCookie, iref0)) {
+        ALOGE("inner hole removal failed");
+        goto bail;
+    }
+    iref0 = irt.add(innerCookie, obj1);
+    if (irt.capacity() != 6 || irt.get(iref0) != obj1) {
+        ALOGE("inner hole not reused (capacity %d)", irt.capacity());
+        goto bail;
+    }
+
+    /* leave another hole, then pop the segment */
+    if (!irt.remove(innerCookie, iref0)) {
+        ALOGE("second inner hole removal failed");
+        goto bail;
+    }
+    irt.segmentState.all = innerCookie;
+
+    /* the outer hole is the one that gets filled */
+    iref0 = irt.add(cookie, obj1);
+    if (irt.capacity() != 4 || irt.get(iref0) != obj1) {
+        ALOGE("outer hole not reused (capacity %d)", irt.capacity());
+        goto bail;
+    }
+    iref1 = irt.add(cookie, obj1);
+    if (irt.capacity() != 5 || irt.get(iref1) != obj1) {
+        ALOGE("stale inner hole reused (capacity %d)", irt.capacity());
+        goto bail;
+    }
+
+    DBUG_MSG("+++ segment hole test complete (%u scan steps)\n",
+            irt.holeScanSteps());
+    result = true;
+
+bail:
+    irt.destroy();
+    return result;
+}
+
 static bool performanceTest()
 {
     static const int kTableMax = 100;
@@ -357,7 +430,7 @@ static bool performanceTest()
 
     DBUG_MSG("+++ START performance\n");
 
-    if (!irt.init(kTableMax, kTableMax, kIndirectKindGlobal)) {
+    if (!irt.init(kTableMax, kIndirectKindGlobal)) {
         return false;
     }
 
@@ -414,6 +487,11 @@ bool dvmTestIndirectRefTable()
         return false;
     }
 
+    if (!segmentHoleTest()) {
+        ALOGE("IRT segment hole test failed");
+        return false;
+    }
+
     if (!performanceTest()) {
         ALOGE("IRT performance test failed");
         return false;